@@ -0,0 +1,191 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file BatchStereoModel.cc
+
+#include <asp/Camera/BatchStereoModel.h>
+#include <asp/Camera/CameraBatch.h>
+
+#include <vw/Camera/CameraModel.h>
+#include <vw/Core/Exception.h>
+
+#include <cmath>
+#include <limits>
+
+using namespace vw;
+
+namespace asp {
+
+  // The point minimizes the sum of squared distances to the rays, so it
+  // solves sum_i (I - d_i d_i^T) (P - c_i) = 0, a 3x3 system with
+  // fixed-size storage. For two rays the error would be the distance
+  // between them.
+  bool intersectRays(std::vector<Vector3> const& camDirs,
+                     std::vector<Vector3> const& camCtrs,
+                     Vector3 & result, Vector3 & errorVec) {
+
+    // Accumulate the symmetric matrix and the right-hand side
+    double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+    Vector3 rhs;
+    for (size_t p = 0; p < camDirs.size(); p++) {
+      Vector3 d = camDirs[p] / norm_2(camDirs[p]);
+      Vector3 const& c = camCtrs[p];
+      a00 += 1.0 - d[0]*d[0]; a01 -= d[0]*d[1]; a02 -= d[0]*d[2];
+      a11 += 1.0 - d[1]*d[1]; a12 -= d[1]*d[2]; a22 += 1.0 - d[2]*d[2];
+      rhs += c - d * dot_prod(d, c);
+    }
+
+    // Solve with the adjugate
+    double c00 = a11*a22 - a12*a12, c01 = a02*a12 - a01*a22, c02 = a01*a12 - a02*a11;
+    double det = a00*c00 + a01*c01 + a02*c02;
+    double scale = a00 + a11 + a22;
+    if (!(std::abs(det) > 1e-12 * scale * scale * scale))
+      return false;
+    double c11 = a00*a22 - a02*a02, c12 = a01*a02 - a00*a12, c22 = a00*a11 - a01*a01;
+    result = Vector3(c00*rhs[0] + c01*rhs[1] + c02*rhs[2],
+                     c01*rhs[0] + c11*rhs[1] + c12*rhs[2],
+                     c02*rhs[0] + c12*rhs[1] + c22*rhs[2]) / det;
+
+    double err = 0.0;
+    for (size_t p = 0; p < camDirs.size(); p++) {
+      Vector3 d = camDirs[p] / norm_2(camDirs[p]);
+      Vector3 v = result - camCtrs[p];
+      err += norm_2(v - d * dot_prod(d, v));
+    }
+    errorVec = Vector3(2.0 * err / camDirs.size(), 0, 0);
+
+    return true;
+  }
+
+  void BatchStereoModel::find_rays(std::vector<Vector2 const*> const& pixels, size_t num,
+                                   std::vector<std::vector<Vector3>> & ctrs,
+                                   std::vector<std::vector<Vector3>> & dirs) const {
+
+    int num_cams = m_cameras.size();
+    VW_ASSERT((int)pixels.size() == num_cams,
+              vw::ArgumentErr() << "The number of pixel arrays must match "
+                                << "the number of cameras.\n");
+
+    // Find the rays in each camera for the valid pixels only. Rays for
+    // missing pixels are left as NaN.
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    ctrs.resize(num_cams);
+    dirs.resize(num_cams);
+    std::vector<Vector2> valid_pix;
+    std::vector<Vector3> valid_ctrs, valid_dirs;
+    std::vector<size_t> valid_ids;
+    for (int c = 0; c < num_cams; c++) {
+      ctrs[c].assign(num, Vector3(nan, nan, nan));
+      dirs[c].assign(num, Vector3(nan, nan, nan));
+
+      valid_pix.clear();
+      valid_ids.clear();
+      for (size_t i = 0; i < num; i++) {
+        Vector2 const& pix = pixels[c][i];
+        if (pix != pix || // i.e., NaN
+            pix == camera::CameraModel::invalid_pixel())
+          continue;
+        valid_pix.push_back(pix);
+        valid_ids.push_back(i);
+      }
+      if (valid_pix.empty())
+        continue;
+
+      valid_ctrs.resize(valid_pix.size());
+      valid_dirs.resize(valid_pix.size());
+      asp::pixelsToRays(m_cameras[c], &valid_pix[0], valid_pix.size(),
+                        &valid_ctrs[0], &valid_dirs[0]);
+      for (size_t k = 0; k < valid_ids.size(); k++) {
+        ctrs[c][valid_ids[k]] = valid_ctrs[k];
+        dirs[c][valid_ids[k]] = valid_dirs[k];
+      }
+    }
+  }
+
+  void BatchStereoModel::triangulate(std::vector<Vector2 const*> const& pixels, size_t num,
+                                     Vector3 * points, Vector3 * errors) const {
+    std::vector<std::vector<Vector3>> ctrs, dirs;
+    triangulate(pixels, num, points, errors, ctrs, dirs);
+  }
+
+  void BatchStereoModel::triangulate(std::vector<Vector2 const*> const& pixels, size_t num,
+                                     Vector3 * points, Vector3 * errors,
+                                     std::vector<std::vector<Vector3>> & ctrs,
+                                     std::vector<std::vector<Vector3>> & dirs) const {
+
+    if (!supports_batch())
+      vw_throw(NoImplErr() << "Batch triangulation does not support least squares "
+               << "refinement.\n");
+
+    int num_cams = m_cameras.size();
+    find_rays(pixels, num, ctrs, dirs);
+
+    // Intersect the rays. This follows StereoModel::operator().
+    std::vector<Vector3> camDirs, camCtrs;
+    for (size_t i = 0; i < num; i++) {
+
+      points[i] = Vector3();
+      errors[i] = Vector3();
+
+      // Pick the valid rays. A pixel whose ray cannot be found fails
+      // the triangulation, as it would throw for a single pixel.
+      camDirs.clear();
+      camCtrs.clear();
+      bool failed = false;
+      for (int c = 0; c < num_cams; c++) {
+        Vector2 const& pix = pixels[c][i];
+        if (pix != pix || pix == camera::CameraModel::invalid_pixel())
+          continue;
+        Vector3 const& dir = dirs[c][i];
+        Vector3 const& ctr = ctrs[c][i];
+        if (dir != dir || ctr != ctr) {
+          failed = true;
+          break;
+        }
+        camDirs.push_back(dir);
+        camCtrs.push_back(ctr);
+      }
+
+      // Not enough valid rays
+      if (failed || camDirs.size() < 2)
+        continue;
+
+      if (are_nearly_parallel(m_least_squares, m_angle_tol, camDirs))
+        continue;
+
+      // Determine range by triangulation. With more than two rays, do it
+      // directly, without the dynamically sized least squares problem.
+      Vector3 errorVec, result;
+      if (camDirs.size() == 2)
+        result = triangulate_point(camDirs, camCtrs, errorVec);
+      else if (!intersectRays(camDirs, camCtrs, result, errorVec))
+        continue;
+
+      // Reflect points that fall behind one of the cameras
+      bool reflect = false;
+      for (size_t p = 0; p < camCtrs.size(); p++)
+        if (dot_prod(result - camCtrs[p], camDirs[p]) < 0)
+          reflect = true;
+      if (reflect)
+        result = -result + 2*camCtrs[0];
+
+      points[i] = result;
+      errors[i] = errorVec;
+    }
+  }
+
+} // namespace asp
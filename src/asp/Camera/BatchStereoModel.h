@@ -0,0 +1,78 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file BatchStereoModel.h
+/// A stereo model which triangulates many pixels at once. The rays for all
+/// pixels seen in a camera are found with one batch call, which is much
+/// faster for CSM and RPC cameras than a virtual call per pixel.
+
+#ifndef __ASP_CAMERA_BATCH_STEREO_MODEL_H__
+#define __ASP_CAMERA_BATCH_STEREO_MODEL_H__
+
+#include <vw/Stereo/StereoModel.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace asp {
+
+  class BatchStereoModel: public vw::stereo::StereoModel {
+
+  public:
+
+    BatchStereoModel(std::vector<const vw::camera::CameraModel *> const& cameras,
+                     bool least_squares_refine = false,
+                     double angle_tol = 0.0):
+      vw::stereo::StereoModel(cameras, least_squares_refine, angle_tol) {}
+
+    virtual ~BatchStereoModel() {}
+
+    /// If false, triangulate() cannot be used, and each pixel must go
+    /// through operator(). This is the case with least squares refinement.
+    bool supports_batch() const { return !m_least_squares; }
+
+    /// Find the rays for num pixels in each camera, with one batch call per
+    /// camera. The pixels seen in camera c are in pixels[c], with NaN where
+    /// there is no match. The rays for those are NaN.
+    void find_rays(std::vector<vw::Vector2 const*> const& pixels, size_t num,
+                   std::vector<std::vector<vw::Vector3>> & ctrs,
+                   std::vector<std::vector<vw::Vector3>> & dirs) const;
+
+    /// Triangulate num pixels. The pixels seen in camera c are in
+    /// pixels[c], with NaN where there is no match. The points and error
+    /// vectors are as from operator(). Failures produce zero vectors.
+    void triangulate(std::vector<vw::Vector2 const*> const& pixels, size_t num,
+                     vw::Vector3 * points, vw::Vector3 * errors) const;
+
+    /// Same as above, but also return the rays that were found, as from
+    /// find_rays(). These can be reused for error propagation.
+    void triangulate(std::vector<vw::Vector2 const*> const& pixels, size_t num,
+                     vw::Vector3 * points, vw::Vector3 * errors,
+                     std::vector<std::vector<vw::Vector3>> & ctrs,
+                     std::vector<std::vector<vw::Vector3>> & dirs) const;
+  };
+
+  /// Intersect three or more rays in the least squares sense. The error
+  /// vector is (err_len, 0, 0), with err_len twice the mean distance from
+  /// the point to the rays. Return false if the rays are degenerate.
+  bool intersectRays(std::vector<vw::Vector3> const& camDirs,
+                     std::vector<vw::Vector3> const& camCtrs,
+                     vw::Vector3 & result, vw::Vector3 & errorVec);
+
+} // namespace asp
+
+#endif // __ASP_CAMERA_BATCH_STEREO_MODEL_H__
@@ -24,11 +24,14 @@
 #include <asp/Camera/BundleAdjustCamera.h>
 #include <asp/Core/IpMatchingAlgs.h>         // Lightweight header
 #include <asp/Camera/CameraResectioning.h>
+#include <asp/Camera/CameraBatch.h>
 #include <asp/Camera/CsmModel.h>
 #include <asp/Camera/Covariance.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/ImageUtils.h>
+#include <asp/Core/FileUtils.h>
 
+#include <vw/Core/Settings.h>
 #include <vw/BundleAdjustment/CameraRelation.h>
 #include <vw/BundleAdjustment/ControlNetwork.h>
 #include <vw/BundleAdjustment/ControlNetworkLoader.h>
@@ -1471,12 +1474,17 @@ void asp::saveMapprojOffsets(
   ofs << "# Percentiles of distances between mapprojected matching pixels in an "
       << "image and the others.\n";
   ofs << "# image_name 25% 50% 75% 85% 95% count\n";
+  // Sort the offsets for the images in parallel, as there can be many
+  #pragma omp parallel for
+  for (int image_it = 0; image_it < int(imageFiles.size()); image_it++) {
+    auto & vals = mapprojOffsetsPerCam[image_it]; // alias
+    std::sort(vals.begin(), vals.end());
+  }
   for (size_t image_it = 0; image_it < imageFiles.size(); image_it++) {
     auto & vals = mapprojOffsetsPerCam[image_it]; // alias
     int len = vals.size();
     float val25 = -1.0, val50 = -1.0, val75 = -1.0, val85 = -1.0, val95 = -1.0, count = 0;
     if (!vals.empty()) {
-      std::sort(vals.begin(), vals.end());
       val25 = vals[0.25 * len];
       val50 = vals[0.50 * len];
       val75 = vals[0.75 * len];
@@ -1511,12 +1519,12 @@ void asp::saveMapprojOffsets(
   ofs << "# lon, lat, height_above_datum, mapproj_ip_dist_meters\n";
   ofs << "# " << mapproj_dem_georef.datum() << std::endl;
 
-  // Write all the points to the file
-  for (size_t it = 0; it < mapprojPoints.size(); it++) {
+  // Write all the points to the file. The lines are formatted in parallel.
+  asp::write_lines_parallel(ofs, mapprojPoints.size(), [&](std::ostream & os, size_t it) {
     Vector3 llh = subvector(mapprojPoints[it], 0, 3);
-    ofs << llh[0] << ", " << llh[1] <<", " << llh[2] << ", "
-         << mapprojPoints[it][3] << std::endl;
-  }
+    os << llh[0] << ", " << llh[1] <<", " << llh[2] << ", "
+       << mapprojPoints[it][3] << "\n";
+  });
   
   ofs.close();
   
@@ -1528,6 +1536,7 @@ void processMatchPair(size_t left_index, size_t right_index,
                       std::vector<vw::ip::InterestPoint> const& left_ip,
                       std::vector<vw::ip::InterestPoint> const& right_ip,
                       std::vector<vw::CamPtr> const& optimized_cams,
+                      bool single_threaded_cameras,
                       vw::cartography::GeoReference const& mapproj_dem_georef,
                       vw::ImageViewRef<vw::PixelMask<double>> const& interp_mapproj_dem,
                       vw::cartography::Datum const& datum,
@@ -1545,7 +1554,7 @@ void processMatchPair(size_t left_index, size_t right_index,
   convAngles.push_back(asp::MatchPairStats()); // add an element, then populate it
   std::vector<double> sorted_angles;
   asp::convergence_angles(optimized_cams[left_index].get(), optimized_cams[right_index].get(),
-                          left_ip, right_ip, sorted_angles);
+                          left_ip, right_ip, single_threaded_cameras, sorted_angles);
   convAngles.back().populate(left_index, right_index, sorted_angles);
 
   if (save_mapproj_match_points_offsets) {
@@ -1671,138 +1680,164 @@ void asp::matchFilesProcessing(vw::ba::ControlNetwork       const& cnet,
     }
   }
   
-  // Work on individual image pairs
-  for (const auto& match_it: match_files) {
-   
-    std::pair<int, int> cam_pair   = match_it.first;
-    std::string         match_file = match_it.second;
-    size_t left_index  = cam_pair.first;
-    size_t right_index = cam_pair.second;
-    if (left_index == right_index) 
-      vw::vw_throw(vw::ArgumentErr() << "Bookkeeping failure. Cannot have interest point "
-                   << "matches between an image and itself.\n");
-                   
-    std::vector<ip::InterestPoint> orig_left_ip, orig_right_ip;
-    if (opt.isis_cnet != "" || opt.nvm != "") {
-      // Must create the matches from the cnet.
-      auto & match_pair = match_map[std::make_pair(left_index, right_index)]; // alias
-      // Iterate over this set of quadruplets, and build matches
-      for (auto const& q: match_pair) {
-        double s = 1.0; // scale
-        orig_left_ip.push_back(vw::ip::InterestPoint(std::get<0>(q), std::get<1>(q), s));
-        orig_right_ip.push_back(vw::ip::InterestPoint(std::get<2>(q), std::get<3>(q), s));
+  // Work on individual image pairs. The match files are read in parallel, in
+  // batches, to limit memory usage. Each batch is then processed serially, in
+  // the order of the pairs, so the result does not depend on the number of
+  // threads.
+  bool read_match_files = (opt.isis_cnet == "" && opt.nvm == "");
+  std::vector<std::pair<std::pair<int, int>, std::string>>
+    match_vec(match_files.begin(), match_files.end());
+  int batch_size = 4 * std::max(1, int(vw::vw_settings().default_num_threads()));
+  for (size_t batch_beg = 0; batch_beg < match_vec.size(); batch_beg += batch_size) {
+    size_t batch_end = std::min(batch_beg + batch_size, match_vec.size());
+    std::vector<std::vector<ip::InterestPoint>> batch_left_ip(batch_end - batch_beg),
+      batch_right_ip(batch_end - batch_beg);
+    std::vector<char> batch_exists(batch_end - batch_beg, 0);
+    if (read_match_files) {
+      #pragma omp parallel for
+      for (int it = 0; it < int(batch_end - batch_beg); it++) {
+        std::string const& match_file = match_vec[batch_beg + it].second; // alias
+        if (!boost::filesystem::exists(match_file))
+          continue;
+        batch_exists[it] = 1;
+        vw::ip::read_binary_match_file(match_file, batch_left_ip[it], batch_right_ip[it]);
+      }
+    }
+
+    for (size_t match_it = batch_beg; match_it < batch_end; match_it++) {
+
+      std::pair<int, int> cam_pair   = match_vec[match_it].first;
+      std::string         match_file = match_vec[match_it].second;
+      size_t left_index  = cam_pair.first;
+      size_t right_index = cam_pair.second;
+      if (left_index == right_index) 
+        vw::vw_throw(vw::ArgumentErr() << "Bookkeeping failure. Cannot have interest point "
+                     << "matches between an image and itself.\n");
+                     
+      std::vector<ip::InterestPoint> orig_left_ip, orig_right_ip;
+      if (opt.isis_cnet != "" || opt.nvm != "") {
+        // Must create the matches from the cnet.
+        auto & match_pair = match_map[std::make_pair(left_index, right_index)]; // alias
+        // Iterate over this set of quadruplets, and build matches
+        for (auto const& q: match_pair) {
+          double s = 1.0; // scale
+          orig_left_ip.push_back(vw::ip::InterestPoint(std::get<0>(q), std::get<1>(q), s));
+          orig_right_ip.push_back(vw::ip::InterestPoint(std::get<2>(q), std::get<3>(q), s));
+        }
+        
+        // Write the matches formed from the cnet to disk
+        if (opt.output_cnet_type == "match-files") {
+          vw::vw_out() << "Writing: " << match_file << std::endl;
+          vw::ip::write_binary_match_file(match_file, orig_left_ip, orig_right_ip);
+        }
+        
+      } else {
+        // Use the matches read above. Skip over match files that don't exist.
+        if (!batch_exists[match_it - batch_beg]) {
+          vw_out() << "Skipping non-existent match file: " << match_file << std::endl;
+          continue;
+        }
+        // These are the original IP, to ensure later we write to disk only
+        // the subset of the IP from the control network which
+        // are part of these original ones. 
+        orig_left_ip.swap(batch_left_ip[match_it - batch_beg]);
+        orig_right_ip.swap(batch_right_ip[match_it - batch_beg]);
+      }
+
+      // Create a new convergence angle storage struct
+      asp::MatchPairStats & convAngle = convAngles.back(); // alias
+      if (!remove_outliers) {
+        // Do some processing with orig ip. Otherwise this will be done below
+        // with the inlier ip.
+        processMatchPair(left_index, right_index,
+                         orig_left_ip, orig_right_ip,
+                         optimized_cams, opt.single_threaded_cameras,
+                         mapproj_dem_georef, interp_mapproj_dem, opt.datum,
+                         save_mapproj_match_points_offsets,
+                         propagate_errors, horizontal_stddev_vec,
+                         // Will append to entities below
+                         convAngles, mapprojPoints, mapprojOffsets, mapprojOffsetsPerCam,
+                         horizVertErrors);
+        // Since no outliers are removed, nothing else to do
+        continue;
+      }
+      // Keep only inliers and non-gcp. GCP are used in optimization but are not
+      // part of the originally found interest point matches.
+      std::vector<vw::ip::InterestPoint> left_ip, right_ip;
+      for (size_t ip_iter = 0; ip_iter < orig_left_ip.size(); ip_iter++) {
+        Quadruplet q(orig_left_ip[ip_iter].x, orig_left_ip[ip_iter].y,
+                     orig_right_ip[ip_iter].x, orig_right_ip[ip_iter].y);
+        auto & match_pair = match_map[std::make_pair(left_index, right_index)]; // alias
+        if (match_pair.find(q) == match_pair.end()) 
+          continue;
+
+        // We do not copy descriptors, those take storage
+        left_ip.push_back(ip::InterestPoint(orig_left_ip[ip_iter].x, 
+                                            orig_left_ip[ip_iter].y,
+                                            orig_left_ip[ip_iter].scale));
+        right_ip.push_back(ip::InterestPoint(orig_right_ip[ip_iter].x, 
+                                             orig_right_ip[ip_iter].y,
+                                             orig_right_ip[ip_iter].scale));
       }
       
-      // Write the matches formed from the cnet to disk
-      if (opt.output_cnet_type == "match-files") {
-        vw::vw_out() << "Writing: " << match_file << std::endl;
-        vw::ip::write_binary_match_file(match_file, orig_left_ip, orig_right_ip);
+      // Filter by disparity
+      // TODO(oalexan1): Note that this does not update the outliers set. Likely this
+      // processing needs to move where other outlier filtering logic is.
+      bool quiet = true; // Otherwise too many messages are printed
+      if (opt.remove_outliers_params[0] > 0 && opt.remove_outliers_params[1] > 0.0) {
+        // The typical value of 75 for opt.remove_outliers_params[1] may be too low.
+        // Adjust it. pct = 75 becomes pct = 90. pct = 100 becomes pct = 100. So,
+        // if starting under 100, it gets closer to 100 but stays under it.
+        double pct = opt.remove_outliers_params[0];
+        pct = 100.0 * (pct + 150.0) / 250.0;
+        asp::filter_ip_by_disparity(pct, opt.remove_outliers_params[1],
+                                    quiet, left_ip, right_ip);
       }
       
-    } else {
-      // Read existing matches. Skip over match files that don't exist.
-      if (!boost::filesystem::exists(match_file)) {
-        vw_out() << "Skipping non-existent match file: " << match_file << std::endl;
-        continue;
+      if (num_cameras == 2) {
+        // Compute the coverage fraction
+        Vector2i right_image_size = file_image_size(opt.image_files[1]);
+        int right_ip_width = right_image_size[0]*
+          static_cast<double>(100.0 - std::max(opt.ip_edge_buffer_percent, 0))/100.0;
+        Vector2i ip_size(right_ip_width, right_image_size[1]);
+        double ip_coverage = asp::calc_ip_coverage_fraction(right_ip, ip_size);
+        // Careful with the line below, it gets used in process_icebridge_batch.py.
+        vw_out() << "IP coverage fraction after cleaning = " << ip_coverage << "\n";
       }
-      // Read the original IP, to ensure later we write to disk only
-      // the subset of the IP from the control network which
-      // are part of these original ones. 
-      vw::ip::read_binary_match_file(match_file, orig_left_ip, orig_right_ip);
-    }
 
-    // Create a new convergence angle storage struct
-    asp::MatchPairStats & convAngle = convAngles.back(); // alias
-    if (!remove_outliers) {
-      // Do some processing with orig ip. Otherwise this will be done below
-      // with the inlier ip.
-      processMatchPair(left_index, right_index,
-                       orig_left_ip, orig_right_ip,
-                       optimized_cams,
-                       mapproj_dem_georef, interp_mapproj_dem, opt.datum,
-                       save_mapproj_match_points_offsets,
+      // Process the inlier ip
+      processMatchPair(left_index, right_index, left_ip, right_ip,
+                       optimized_cams, opt.single_threaded_cameras,
+                       mapproj_dem_georef, interp_mapproj_dem,
+                       opt.datum,
+                       save_mapproj_match_points_offsets, 
                        propagate_errors, horizontal_stddev_vec,
                        // Will append to entities below
                        convAngles, mapprojPoints, mapprojOffsets, mapprojOffsetsPerCam,
                        horizVertErrors);
-      // Since no outliers are removed, nothing else to do
-      continue;
-    }
-    // Keep only inliers and non-gcp. GCP are used in optimization but are not
-    // part of the originally found interest point matches.
-    std::vector<vw::ip::InterestPoint> left_ip, right_ip;
-    for (size_t ip_iter = 0; ip_iter < orig_left_ip.size(); ip_iter++) {
-      Quadruplet q(orig_left_ip[ip_iter].x, orig_left_ip[ip_iter].y,
-                   orig_right_ip[ip_iter].x, orig_right_ip[ip_iter].y);
-      auto & match_pair = match_map[std::make_pair(left_index, right_index)]; // alias
-      if (match_pair.find(q) == match_pair.end()) 
-        continue;
 
-      // We do not copy descriptors, those take storage
-      left_ip.push_back(ip::InterestPoint(orig_left_ip[ip_iter].x, 
-                                          orig_left_ip[ip_iter].y,
-                                          orig_left_ip[ip_iter].scale));
-      right_ip.push_back(ip::InterestPoint(orig_right_ip[ip_iter].x, 
-                                           orig_right_ip[ip_iter].y,
-                                           orig_right_ip[ip_iter].scale));
-    }
-    
-    // Filter by disparity
-    // TODO(oalexan1): Note that this does not update the outliers set. Likely this
-    // processing needs to move where other outlier filtering logic is.
-    bool quiet = true; // Otherwise too many messages are printed
-    if (opt.remove_outliers_params[0] > 0 && opt.remove_outliers_params[1] > 0.0) {
-      // The typical value of 75 for opt.remove_outliers_params[1] may be too low.
-      // Adjust it. pct = 75 becomes pct = 90. pct = 100 becomes pct = 100. So,
-      // if starting under 100, it gets closer to 100 but stays under it.
-      double pct = opt.remove_outliers_params[0];
-      pct = 100.0 * (pct + 150.0) / 250.0;
-      asp::filter_ip_by_disparity(pct, opt.remove_outliers_params[1],
-                                  quiet, left_ip, right_ip);
-    }
-    
-    if (num_cameras == 2) {
-      // Compute the coverage fraction
-      Vector2i right_image_size = file_image_size(opt.image_files[1]);
-      int right_ip_width = right_image_size[0]*
-        static_cast<double>(100.0 - std::max(opt.ip_edge_buffer_percent, 0))/100.0;
-      Vector2i ip_size(right_ip_width, right_image_size[1]);
-      double ip_coverage = asp::calc_ip_coverage_fraction(right_ip, ip_size);
-      // Careful with the line below, it gets used in process_icebridge_batch.py.
-      vw_out() << "IP coverage fraction after cleaning = " << ip_coverage << "\n";
-    }
+      if (opt.output_cnet_type != "match-files")
+        continue; // Do not write match files
 
-    // Process the inlier ip
-    processMatchPair(left_index, right_index, left_ip, right_ip,
-                     optimized_cams, mapproj_dem_georef, interp_mapproj_dem,
-                     opt.datum,
-                     save_mapproj_match_points_offsets, 
-                     propagate_errors, horizontal_stddev_vec,
-                     // Will append to entities below
-                     convAngles, mapprojPoints, mapprojOffsets, mapprojOffsetsPerCam,
-                     horizVertErrors);
-
-    if (opt.output_cnet_type != "match-files")
-      continue; // Do not write match files
-
-    // Make a clean copy of the file
-    std::string clean_match_file = ip::clean_match_filename(match_file);
-    if (opt.clean_match_files_prefix != "") {
-      // Ensure "clean" does not show up twice
-      clean_match_file = match_file;
-      // Write the clean match file in the current dir, not where it was read from
-      clean_match_file.replace(0, opt.clean_match_files_prefix.size(), opt.out_prefix);
-    }
-    else if (opt.match_files_prefix != "") {
-      // Write the clean match file in the current dir, not where it was read from
-      clean_match_file.replace(0, opt.match_files_prefix.size(), opt.out_prefix);
-    }
-    
-    vw_out() << "Saving " << left_ip.size() << " filtered interest points.\n";
-    vw_out() << "Writing: " << clean_match_file << std::endl;
-    vw::ip::write_binary_match_file(clean_match_file, left_ip, right_ip);
+      // Make a clean copy of the file
+      std::string clean_match_file = ip::clean_match_filename(match_file);
+      if (opt.clean_match_files_prefix != "") {
+        // Ensure "clean" does not show up twice
+        clean_match_file = match_file;
+        // Write the clean match file in the current dir, not where it was read from
+        clean_match_file.replace(0, opt.clean_match_files_prefix.size(), opt.out_prefix);
+      }
+      else if (opt.match_files_prefix != "") {
+        // Write the clean match file in the current dir, not where it was read from
+        clean_match_file.replace(0, opt.match_files_prefix.size(), opt.out_prefix);
+      }
+      
+      vw_out() << "Saving " << left_ip.size() << " filtered interest points.\n";
+      vw_out() << "Writing: " << clean_match_file << std::endl;
+      vw::ip::write_binary_match_file(clean_match_file, left_ip, right_ip);
 
-  } // End loop through the match files
+    } // End loop through the match files in the batch
+  } // End loop through the batches
 }
 
 // Find stats of propagated errors
@@ -74,11 +74,11 @@ enum BACameraType {BaCameraType_Pinhole    = 0,
 
 // Options shared by bundle_adjust and jitter_solve
 struct BaBaseOptions: public vw::GdalWriteOptions {
-  std::string out_prefix, stereo_session, input_prefix, match_files_prefix,
+  std::string out_prefix, stereo_session, input_prefix, incremental_prefix, match_files_prefix,
     clean_match_files_prefix, heights_from_dem, reference_terrain, mapproj_dem, weight_image,
     isis_cnet, nvm, nvm_no_shift, output_cnet_type,
     image_list, camera_list, mapprojected_data_list,
-    fixed_image_list, camera_position_uncertainty_str;
+    fixed_image_list, camera_position_uncertainty_str, solver_preset;
   int overlap_limit, min_matches, max_pairwise_matches, num_iterations,
     ip_edge_buffer_percent, max_num_reference_points;
   bool have_overlap_list;
@@ -587,6 +587,15 @@ void matchFilesProcessing(vw::ba::ControlNetwork       const& cnet,
                           std::vector<std::vector<float>>   & mapprojOffsetsPerCam,
                           std::vector<asp::HorizVertErrorStats>  & horizVertErrors);
 
+/// If a camera was solved for in the previous run given by --incremental-prefix,
+/// so it has an adjustment with that prefix.
+bool in_previous_run(asp::BaBaseOptions const& opt, int icam);
+
+/// The adjustment to initialize a camera with, from the previous run given by
+/// --incremental-prefix, or else from --input-adjustments-prefix. Return an
+/// empty string if there is none.
+std::string input_adjustment_file(asp::BaBaseOptions const& opt, int icam);
+
 /// This is for the BundleAdjustmentModel class where the camera parameters
 /// are a rotation/offset that is applied on top of the existing camera model.
 /// First read initial adjustments, if any, and apply perhaps a pc_align transform.
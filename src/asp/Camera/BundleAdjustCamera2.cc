@@ -40,6 +40,7 @@
 #include <vw/Core/Stopwatch.h>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
 
 #include <string>
 
@@ -49,19 +50,38 @@ using namespace vw::ba;
 
 namespace asp {
 
+bool in_previous_run(asp::BaBaseOptions const& opt, int icam) {
+  if (opt.incremental_prefix == "")
+    return false;
+  std::string adjust_file
+    = asp::bundle_adjust_file_name(opt.incremental_prefix, opt.image_files[icam],
+                                   opt.camera_files[icam]);
+  return boost::filesystem::exists(adjust_file);
+}
+
+std::string input_adjustment_file(asp::BaBaseOptions const& opt, int icam) {
+  if (in_previous_run(opt, icam))
+    return asp::bundle_adjust_file_name(opt.incremental_prefix, opt.image_files[icam],
+                                        opt.camera_files[icam]);
+  if (opt.input_prefix != "")
+    return asp::bundle_adjust_file_name(opt.input_prefix, opt.image_files[icam],
+                                        opt.camera_files[icam]);
+  return "";
+}
+
 // Read previous adjustments and store them in params. The params must be well-formed
-// by now, but any prior adjustment in them will be overwritten.
-void put_adjustments_in_params(std::string const& input_prefix,
-                               std::vector<std::string> const& image_files,
-                               std::vector<std::string> const& camera_files,
+// by now, but any prior adjustment in them will be overwritten. Cameras without
+// an input adjustment are not changed.
+void put_adjustments_in_params(asp::BaBaseOptions const& opt,
                                // Output
                                asp::BAParams & param_storage) {
 
   const size_t num_cameras = param_storage.num_cameras();
   
   for (size_t icam = 0; icam < num_cameras; icam++) {
-    std::string adjust_file
-      = asp::bundle_adjust_file_name(input_prefix, image_files[icam], camera_files[icam]);
+    std::string adjust_file = input_adjustment_file(opt, icam);
+    if (adjust_file == "")
+      continue;
   
     double * cam_ptr = param_storage.get_camera_ptr(icam);
     CameraAdjustment adjustment;
@@ -103,9 +123,8 @@ bool init_cams(asp::BaBaseOptions const& opt, asp::BAParams & param_storage,
                            << opt.camera_models.size() << ".\n");
 
   // Read the adjustments from a previous run, if present. Put them in params.
-  if (opt.input_prefix != "") {
-    put_adjustments_in_params(opt.input_prefix, opt.image_files, opt.camera_files, 
-                              param_storage); // output
+  if (opt.input_prefix != "" || opt.incremental_prefix != "") {
+    put_adjustments_in_params(opt, param_storage); // output
     cameras_changed = true;
   }
 
@@ -155,10 +174,8 @@ bool init_cams_pinhole(asp::BaBaseOptions const& opt, asp::BAParams & param_stor
     PinholeModel pin_cam = *pin_ptr;
     
     // Read the adjustments from a previous run, if present
-    if (opt.input_prefix != "") {
-      std::string adjust_file
-        = asp::bundle_adjust_file_name(opt.input_prefix, opt.image_files[icam],
-                                       opt.camera_files[icam]);
+    std::string adjust_file = input_adjustment_file(opt, icam);
+    if (adjust_file != "") {
       vw_out() << "Reading input adjustment: " << adjust_file << std::endl;
       CameraAdjustment adjustment;
       adjustment.read_from_adjust_file(adjust_file);
@@ -206,7 +223,7 @@ bool init_cams_optical_bar(asp::BaBaseOptions const& opt, asp::BAParams & param_
                     vw::Matrix<double> const& initial_transform,
                     std::vector<vw::CamPtr> &new_cam_models) {
 
-  if (opt.input_prefix != "")
+  if (opt.input_prefix != "" || opt.incremental_prefix != "")
     vw::vw_throw(vw::ArgumentErr()
                  << "Applying initial adjustments to optical bar cameras "
                  << "and --inline-adjustments is not implemented. "
@@ -265,10 +282,8 @@ bool init_cams_csm(asp::BaBaseOptions const& opt, asp::BAParams & param_storage,
 
     // Read the adjustments from a previous run, if present. Apply them
     // inline to the camera model.
-    if (opt.input_prefix != "") {
-      std::string adjust_file
-        = asp::bundle_adjust_file_name(opt.input_prefix, opt.image_files[icam],
-                                       opt.camera_files[icam]);
+    std::string adjust_file = input_adjustment_file(opt, icam);
+    if (adjust_file != "") {
       vw_out() << "Reading input adjustment: " << adjust_file << std::endl;
       CameraAdjustment adjustment;
       adjustment.read_from_adjust_file(adjust_file);
@@ -295,17 +310,29 @@ bool init_cams_csm(asp::BaBaseOptions const& opt, asp::BAParams & param_storage,
     cameras_changed = true;
   }
 
-  // Fill out the new camera model vector
+  // Fill out the new camera model vector. Each camera is copied and
+  // transformed on its own, so do this in parallel, unless the cameras
+  // are not thread-safe.
   new_cam_models.resize(num_cameras);
-  for (size_t icam = 0; icam < num_cameras; icam++){
-
-    asp::CsmModel* in_cam
-      = dynamic_cast<asp::CsmModel*>(opt.camera_models[icam].get());
-    if (in_cam == NULL)
-      vw_throw(ArgumentErr() << "Expecting a CSM camera.\n");
+  std::vector<std::string> errors(num_cameras);
+  #pragma omp parallel for if (!opt.single_threaded_cameras)
+  for (int icam = 0; icam < int(num_cameras); icam++) {
+    // Must catch exceptions here, as OpenMP cannot propagate them
+    try {
+      asp::CsmModel* in_cam
+        = dynamic_cast<asp::CsmModel*>(opt.camera_models[icam].get());
+      if (in_cam == NULL)
+        vw_throw(ArgumentErr() << "Expecting a CSM camera.\n");
 
-    auto out_cam = transformedCsmCamera(icam, param_storage, *in_cam);
-    new_cam_models[icam] = boost::shared_ptr<camera::CameraModel>(out_cam);
+      auto out_cam = transformedCsmCamera(icam, param_storage, *in_cam);
+      new_cam_models[icam] = boost::shared_ptr<camera::CameraModel>(out_cam);
+    } catch (std::exception const& e) {
+      errors[icam] = e.what();
+    }
+  }
+  for (size_t icam = 0; icam < num_cameras; icam++) {
+    if (!errors[icam].empty())
+      vw_throw(ArgumentErr() << errors[icam]);
   }
 
   return cameras_changed;
@@ -1415,9 +1442,14 @@ void filterOutliersByConvergenceAngle(asp::BaBaseOptions const& opt,
   std::vector<vw::Vector3> opt_cam_positions;
   asp::calcOptimizedCameras(opt, param_storage, optimized_cams);
   asp::calcCameraCenters(optimized_cams, opt_cam_positions);
-  int num_outliers_by_conv_angle = 0;
 
-  for (size_t ipt = 0; ipt < param_storage.num_points(); ipt++) {
+  // The points are independent of each other, and only the camera centers
+  // found above are used, so the points can be processed in parallel. The
+  // outliers are flagged first and applied afterwards.
+  int num_pts = param_storage.num_points();
+  std::vector<char> is_outlier(num_pts, 0);
+  #pragma omp parallel for
+  for (int ipt = 0; ipt < num_pts; ipt++) {
 
     if (cnet[ipt].type() == ControlPoint::GroundControlPoint)
       continue; // don't filter out GCP
@@ -1452,13 +1484,17 @@ void filterOutliersByConvergenceAngle(asp::BaBaseOptions const& opt,
       }
     }
     
-    if (max_angle < opt.min_triangulation_angle) {
+    if (max_angle < opt.min_triangulation_angle)
+      is_outlier[ipt] = 1;
+  }
+
+  int num_outliers_by_conv_angle = 0;
+  for (int ipt = 0; ipt < num_pts; ipt++) {
+    if (is_outlier[ipt]) {
       param_storage.set_point_outlier(ipt, true);
       num_outliers_by_conv_angle++;
     }
   }
-  
-  int num_pts = param_storage.num_points();
   vw::vw_out() << std::setprecision(4) 
                << "Removed " << num_outliers_by_conv_angle 
                << " triangulated points out of " << num_pts
@@ -36,13 +36,11 @@
 #include <isis/BundleImage.h>
 #include <isis/Pvl.h>
 #include <isis/Target.h>
-#include <isis/CameraFactory.h>
-#include <isis/Camera.h>
-#include <isis/Cube.h>
-#include <isis/FileName.h>
 
 #include <boost/shared_ptr.hpp>
 
+#include <omp.h>
+
 #include <string>
 #include <iostream>
 
@@ -107,21 +105,120 @@ void setIsisCnetTarget(std::string const& image_name,
   }
 }
 
-// Read the cameras This may fail for non-ISIS images. Then use null cameras.
-void readIsisCameras(std::vector<std::string> const& image_files,
-                     std::vector<boost::shared_ptr<Isis::Camera>> & cameras) {
-
-  // Wipe the output
-  cameras.clear();
+// Convert an ISIS control point with given index to an ASP control point.
+// Flag it as an outlier if ignored, rejected, or having no measures.
+// Update the counters of point types.
+void isisPointToAspPoint(int i, Isis::ControlPoint * point,
+                         std::map<std::string, int> const& serialNumberToImageIndex,
+                         vw::ba::ControlPoint & cpoint, int & isOutlier,
+                         int & numSemiFree, int & numConstrained, int & numFixed,
+                         int & numRejected, int & numIgnored) {
+
+  isOutlier = 0;
+  bool ignore = false;
+  if (point->IsIgnored()) {
+    numIgnored++;
+    isOutlier = 1;
+    ignore = true;
+  }
+  if (point->IsRejected()) {
+    numRejected++;
+    isOutlier = 1;
+    ignore = true;
+  }
+    
+  // Triangulated point and apriori point
+  Isis::SurfacePoint P = point->GetAdjustedSurfacePoint();
+  Isis::SurfacePoint A = point->GetAprioriSurfacePoint();
   
-  for (size_t i = 0; i < image_files.size(); i++) {
-    Isis::Camera *cam = NULL;
-    try {
-      QString fileName = QString::fromStdString(image_files[i]);
-      Isis::Cube cube(Isis::FileName(fileName), "r");
-      Isis::Camera *cam = Isis::CameraFactory::Create(cube);
-    } catch (...) {}
-    cameras.push_back(boost::shared_ptr<Isis::Camera>(cam));
+  // Set the cnet tri point to the prior point. The surface point
+  // will be triangulated by bundle_adjust.
+  // By default, a point is free, and its sigma is nominal and will not be
+  // used. Will adjust below for constrained and fixed points.
+  cpoint = vw::ba::ControlPoint(vw::ba::ControlPoint::TiePoint); // free
+  vw::Vector3 a(A.GetX().meters(), A.GetY().meters(), A.GetZ().meters());
+  cpoint.set_position(a);
+  cpoint.set_ignore(ignore);
+
+  // Set sigma. This will be used only for constrained points. 
+  // Use the sigmas from the adjusted surface points, as they are 
+  // more likely to be positive and perhaps up-to-date than the
+  // prior sigmas.
+  double xs = P.GetXSigma().meters();
+  double ys = P.GetYSigma().meters();
+  double zs = P.GetZSigma().meters();
+  cpoint.set_sigma(vw::Vector3(xs, ys, zs));
+
+  // The actual surface point will not be used. It will later be initialized
+  // as the a priori point, and then optimized.    
+  // vw::Vector3 p(P.GetX().meters(), P.GetY().meters(), P.GetZ().meters());
+
+  if (point->GetType() == Isis::ControlPoint::Constrained) {
+    
+    // Treat partially constrained points as unconstrained.
+    int numConstr = int(point->IsCoord1Constrained()) +
+                    int(point->IsCoord2Constrained()) +
+                    int(point->IsCoord3Constrained());
+    if (numConstr < 3) {
+      numSemiFree++;
+    } else {
+      // Fully constrained point
+      numConstrained++;
+      if (xs <= 0 || ys <= 0 || zs <= 0) 
+        vw_throw(vw::ArgumentErr() 
+                  << "loadIsisCnet: ISIS constrained point with index "
+                  << i << " has a non-positive sigma.\n");
+      // Set as gcp, but with given sigma, rather than tiny sigma.
+      cpoint.set_type(vw::ba::ControlPoint::GroundControlPoint); // gcp
+    }
+  } else if (point->GetType() == Isis::ControlPoint::Free) {
+     // Nothing to do here. The point and sigma is already set. 
+  } else if (point->GetType() == Isis::ControlPoint::Fixed) {
+    numFixed++;
+    cpoint.set_type(vw::ba::ControlPoint::GroundControlPoint); // gcp
+    double s = asp::FIXED_GCP_SIGMA; // Later will keep fixed
+    cpoint.set_sigma(vw::Vector3(s, s, s));
+  }
+  
+  int numMeasures = point->GetNumMeasures();
+  for (int j = 0; j < numMeasures; j++) {
+
+    // The const accessor only reads the point, so it is safe to call in parallel
+    Isis::ControlMeasure const* controlMeasure
+      = static_cast<Isis::ControlPoint const*>(point)->GetMeasure(j);
+
+    // Get serial number as std::string. This is unique to each image.
+    QString qCubeSerialNumber = controlMeasure->GetCubeSerialNumber();
+    std::string cubeSerialNumber = qCubeSerialNumber.toStdString();
+    
+    // These have 0.5 added to them, which we will remove
+    double sample = controlMeasure->GetSample();
+    double line = controlMeasure->GetLine();
+    double col = sample + ISIS_CNET_TO_ASP_OFFSET;
+    double row = line   + ISIS_CNET_TO_ASP_OFFSET;
+
+    // These sigmas can turn out to be negative
+    double sample_sigma = controlMeasure->GetSampleSigma();
+    double line_sigma   = controlMeasure->GetLineSigma();
+    if (sample_sigma <= 0 || std::isnan(sample_sigma) || std::isinf(sample_sigma))
+      sample_sigma = 1.0;
+    if (line_sigma <= 0 || std::isnan(line_sigma) || std::isinf(line_sigma))
+      line_sigma = 1.0;
+    
+    // Find the image index
+    auto it = serialNumberToImageIndex.find(cubeSerialNumber);
+    if (it == serialNumberToImageIndex.end())
+      vw_throw(vw::ArgumentErr() << "Could not find image with serial number: "
+               << cubeSerialNumber << ".\n");
+    int image_id = it->second;
+    cpoint.add_measure(vw::ba::ControlMeasure(col, row, sample_sigma, line_sigma,
+                                              image_id));
+  }
+
+  // Points with no measures are flagged as outliers    
+  if (cpoint.size() == 0) {
+    isOutlier = 1;
+    cpoint.set_ignore(true);
   }
 }
 
@@ -168,124 +265,39 @@ void loadIsisCnet(std::string const& isisCnetFile,
     vw_throw(vw::ArgumentErr() << "Found images with the same serial number. "
              << "Check your input data.\n");
      
-  // Add the control points
+  // Convert the control points in parallel. Each is written to its own
+  // slot, and they are added to the ASP cnet after that, in order.
+  // OpenMP cannot propagate exceptions, so these are thrown after the loop.
   int numControlPoints = icnet->GetNumPoints();
+  std::vector<vw::ba::ControlPoint> cpoints(numControlPoints);
+  std::vector<int> isOutlier(numControlPoints, 0);
+  std::vector<std::string> errors(numControlPoints);
   int numSemiFree = 0, numConstrained = 0, numFixed = 0, numRejected = 0, numIgnored = 0;
+  #pragma omp parallel for schedule(dynamic, 1000) \
+    reduction(+:numSemiFree, numConstrained, numFixed, numRejected, numIgnored)
   for (int i = 0; i < numControlPoints; i++) {
-
-    Isis::ControlPoint *point = icnet->GetPoint(i);
-    bool ignore = false;
-    
-    if (point->IsIgnored()) {
-      numIgnored++;
-      // We do not skip any points, to preserve the one-to-one correspondence.
-      // Add to isisOutliers
-      isisOutliers.insert(i);
-      ignore = true;
-    }
-    if (point->IsRejected()) {
-      numRejected++;
-      // We do not skip any points, to preserve the one-to-one correspondence.
-      // Add to isisOutliers
-      isisOutliers.insert(i);
-      ignore = true;
-    }
-      
-    // Triangulated point and apriori point
-    Isis::SurfacePoint P = point->GetAdjustedSurfacePoint();
-    Isis::SurfacePoint A = point->GetAprioriSurfacePoint();
-    
-    // Set the cnet tri point to the prior point. The surface point
-    // will be triangulated by bundle_adjust.
-    // By default, a point is free, and its sigma is nominal and will not be
-    // used. Will adjust below for constrained and fixed points.
-    vw::ba::ControlPoint cpoint(vw::ba::ControlPoint::TiePoint); // free
-    vw::Vector3 a(A.GetX().meters(), A.GetY().meters(), A.GetZ().meters());
-    cpoint.set_position(a);
-    cpoint.set_ignore(ignore);
-
-     // Set sigma. This will be used only for constrained points. 
-     // Use the sigmas from the adjusted surface points, as they are 
-     // more likely to be positive and perhaps up-to-date than the
-     // prior sigmas.
-     double xs = P.GetXSigma().meters();
-     double ys = P.GetYSigma().meters();
-     double zs = P.GetZSigma().meters();
-     cpoint.set_sigma(vw::Vector3(xs, ys, zs));
-
-    // The actual surface point will not be used. It will later be initialized
-    // as the a priori point, and then optimized.    
-    // vw::Vector3 p(P.GetX().meters(), P.GetY().meters(), P.GetZ().meters());
-
-    if (point->GetType() == Isis::ControlPoint::Constrained) {
-      
-      // Treat partially constrained points as unconstrained.
-      int numConstr = int(point->IsCoord1Constrained()) +
-                      int(point->IsCoord2Constrained()) +
-                      int(point->IsCoord3Constrained());
-      if (numConstr < 3) {
-        numSemiFree++;
-      } else {
-        // Fully constrained point
-        numConstrained++;
-        if (xs <= 0 || ys <= 0 || zs <= 0) 
-          vw_throw(vw::ArgumentErr() 
-                    << "loadIsisCnet: ISIS constrained point with index "
-                    << i << " has a non-positive sigma.\n");
-        // Set as gcp, but with given sigma, rather than tiny sigma.
-        cpoint.set_type(vw::ba::ControlPoint::GroundControlPoint); // gcp
-      }
-    } else if (point->GetType() == Isis::ControlPoint::Free) {
-       // Nothing to do here. The point and sigma is already set. 
-    } else if (point->GetType() == Isis::ControlPoint::Fixed) {
-      numFixed++;
-      cpoint.set_type(vw::ba::ControlPoint::GroundControlPoint); // gcp
-      double s = asp::FIXED_GCP_SIGMA; // Later will keep fixed
-      cpoint.set_sigma(vw::Vector3(s, s, s));
-    }
-    
-    int numMeasures = point->GetNumMeasures();
-    for (int j = 0; j < numMeasures; j++) {
-
-      Isis::ControlMeasure *controlMeasure = point->GetMeasure(j);
-
-      // Get serial number as std::string. This is unique to each image.
-      QString qCubeSerialNumber = controlMeasure->GetCubeSerialNumber();
-      std::string cubeSerialNumber = qCubeSerialNumber.toStdString();
-      
-      // These have 0.5 added to them, which we will remove
-      double sample = controlMeasure->GetSample();
-      double line = controlMeasure->GetLine();
-      double col = sample + ISIS_CNET_TO_ASP_OFFSET;
-      double row = line   + ISIS_CNET_TO_ASP_OFFSET;
-
-      // These sigmas can turn out to be negative
-      double sample_sigma = controlMeasure->GetSampleSigma();
-      double line_sigma   = controlMeasure->GetLineSigma();
-      if (sample_sigma <= 0 || std::isnan(sample_sigma) || std::isinf(sample_sigma))
-        sample_sigma = 1.0;
-      if (line_sigma <= 0 || std::isnan(line_sigma) || std::isinf(line_sigma))
-        line_sigma = 1.0;
-      
-      // Find the image index
-      auto it = serialNumberToImageIndex.find(cubeSerialNumber);
-      if (it == serialNumberToImageIndex.end())
-        vw_throw(vw::ArgumentErr() << "Could not find image with serial number: "
-                 << cubeSerialNumber << ".\n");
-      int image_id = it->second;
-      cpoint.add_measure(vw::ba::ControlMeasure(col, row, sample_sigma, line_sigma,
-                                                image_id));
+    try {
+      Isis::ControlPoint * point = icnet->GetPoint(i);
+      isisPointToAspPoint(i, point, serialNumberToImageIndex, cpoints[i],
+                          isOutlier[i], numSemiFree, numConstrained, numFixed,
+                          numRejected, numIgnored);
+    } catch (std::exception const& e) {
+      errors[i] = e.what();
     }
+  }
 
-    // We do not skip any points, to preserve the one-to-one correspondence.
-    // But points with no measures are flagged as outliers.    
-    if (cpoint.size() == 0) {
+  for (int i = 0; i < numControlPoints; i++) {
+    if (!errors[i].empty())
+      vw_throw(vw::ArgumentErr() << errors[i]);
+  }
+  
+  // We do not skip any points, to preserve the one-to-one correspondence
+  for (int i = 0; i < numControlPoints; i++) {
+    if (isOutlier[i])
       isisOutliers.insert(i);
-      cpoint.set_ignore(true);
-    }
-    
-    cnet.add_control_point(cpoint);
-  }    
+    cnet.add_control_point(cpoints[i]);
+  }
+  cpoints.clear();
 
   if (numSemiFree > 0)
     vw::vw_out(vw::WarningMessage) 
@@ -313,7 +325,6 @@ void loadIsisCnet(std::string const& isisCnetFile,
 void addIsisControlPoint(Isis::ControlNet & icnet,
                          vw::ba::ControlNetwork const& cnet,
                          asp::BAParams const& param_storage,
-                         std::vector<boost::shared_ptr<Isis::Camera>> const& cameras,
                          std::vector<std::string> const& serialNumbers,
                          int ipt, int& numOutliers) {
 
@@ -396,7 +407,6 @@ void addIsisControlPoint(Isis::ControlNet & icnet,
     measurement->SetLineSigma(sigma[1]);
     measurement->SetResidual(0.0, 0.0);
     measurement->SetCubeSerialNumber(QString::fromStdString(serialNumbers[cid]));
-    measurement->SetCamera(cameras[cid].get());
 
     point->Add(measurement);
   }
@@ -421,9 +431,6 @@ void saveUpdatedIsisCnet(std::string const& outputPrefix,
   std::vector<std::string> image_files = cnet.get_image_list();
   std::vector<std::string> serialNumbers;
   readSerialNumbers(image_files, serialNumbers);
-  // Read the cameras This may fail for non-ISIS images. Then use null cameras.
-  std::vector<boost::shared_ptr<Isis::Camera>> cameras;
-  readIsisCameras(image_files, cameras);
 
   // Aliases
   Isis::ControlNetQsp const& icnet = isisCnetData.isisCnet;
@@ -501,7 +508,7 @@ void saveUpdatedIsisCnet(std::string const& outputPrefix,
       vw_throw(vw::ArgumentErr() 
                << "saveUpdatedIsisCnet: Book-keeping failure. Expected GCP.\n");
       
-    addIsisControlPoint(*icnet.get(), cnet, param_storage, cameras, serialNumbers, i, 
+    addIsisControlPoint(*icnet.get(), cnet, param_storage, serialNumbers, i, 
                         numOutliers);    
   }
   
@@ -531,9 +538,6 @@ void saveIsisCnet(std::string const& outputPrefix,
   std::vector<std::string> image_files = cnet.get_image_list();
   std::vector<std::string> serialNumbers;
   readSerialNumbers(image_files, serialNumbers);
-  // Read the cameras This may fail for non-ISIS images. Then use null cameras.
-  std::vector<boost::shared_ptr<Isis::Camera>> cameras;
-  readIsisCameras(image_files, cameras);
   
   // Initialize the isis cnet
   Isis::ControlNet icnet;
@@ -545,7 +549,7 @@ void saveIsisCnet(std::string const& outputPrefix,
   // Add a given control point to the ISIS cnet. Update the outlier counter.
   int numOutliers = 0;
   for (int i = 0; i < cnet.size(); i++)
-    addIsisControlPoint(icnet, cnet, param_storage, cameras, serialNumbers, i, 
+    addIsisControlPoint(icnet, cnet, param_storage, serialNumbers, i, 
                         numOutliers);    
   
   vw::vw_out() << "Number of points in control network: " << icnet.GetNumPoints() << "\n";
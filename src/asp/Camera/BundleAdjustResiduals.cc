@@ -21,6 +21,7 @@
 // Logic for computing residuals for bundle adjustment. 
 
 #include <asp/Camera/BundleAdjustResiduals.h>
+#include <asp/Core/FileUtils.h>
 
 #include <vw/BundleAdjustment/ControlNetwork.h>
 #include <vw/BundleAdjustment/ControlNetworkLoader.h>
@@ -47,6 +48,7 @@ void compute_residuals(asp::BaBaseOptions const& opt,
                        size_t num_cam_position_residuals,
                        std::vector<vw::Vector3> const& reference_vec,
                        ceres::Problem & problem,
+                       std::vector<ceres::ResidualBlockId> const& residual_blocks,
                        // Output
                        std::vector<double> & residuals) {
 
@@ -58,6 +60,10 @@ void compute_residuals(asp::BaBaseOptions const& opt,
     eval_options.num_threads = 1; // ISIS must be single threaded!
   else
     eval_options.num_threads = opt.num_threads;
+  // Blocks removed from the problem change the order of the remaining ones,
+  // so use the order the caller kept, if provided.
+  if (!residual_blocks.empty())
+    eval_options.residual_blocks = residual_blocks;
 
   problem.Evaluate(eval_options, &cost, &residuals, 0, 0);
   const size_t num_residuals = residuals.size();
@@ -196,27 +202,31 @@ void write_residual_map(std::string const& output_prefix,
   // do not modify the line below.
   file << "# " << opt.datum << std::endl;
   
-  // Now write all the points to the file
+  // Now write all the points to the file, skipping the outliers. The lines
+  // are formatted in parallel.
+  std::vector<size_t> inliers;
   for (size_t i = 0; i < param_storage.num_points(); i++) {
+    if (!param_storage.get_point_outlier(i))
+      inliers.push_back(i);
+  }
+  asp::write_lines_parallel(file, inliers.size(), [&](std::ostream & os, size_t it) {
+    size_t i = inliers[it];
 
-    if (param_storage.get_point_outlier(i))
-      continue; // skip outliers
-    
-      // The final GCC coordinate of this point
-      const double * point = param_storage.get_point_ptr(i);
-      Vector3 xyz(point[0], point[1], point[2]);
+    // The final GCC coordinate of this point
+    const double * point = param_storage.get_point_ptr(i);
+    Vector3 xyz(point[0], point[1], point[2]);
 
-      Vector3 llh = opt.datum.cartesian_to_geodetic(xyz);
+    Vector3 llh = opt.datum.cartesian_to_geodetic(xyz);
 
-      std::string comment = "";
-      if (cnet[i].type() == ControlPoint::GroundControlPoint)
-        comment = " # GCP";
-      else if (cnet[i].type() == ControlPoint::PointFromDem)
-        comment = " # from DEM";
-      
-      file << llh[0] <<", "<< llh[1] <<", "<< llh[2] <<", "<< mean_residuals[i] <<", "
-           << num_point_observations[i] << comment << std::endl;
-  }
+    std::string comment = "";
+    if (cnet[i].type() == ControlPoint::GroundControlPoint)
+      comment = " # GCP";
+    else if (cnet[i].type() == ControlPoint::PointFromDem)
+      comment = " # from DEM";
+
+    os << llh[0] <<", "<< llh[1] <<", "<< llh[2] <<", "<< mean_residuals[i] <<", "
+       << num_point_observations[i] << comment << "\n";
+  });
   file.close();
 
 } // End function write_residual_map
@@ -235,7 +245,8 @@ void write_residual_logs(std::string const& residual_prefix,
                          std::vector<vw::Vector3> const& reference_vec,
                          vw::ba::ControlNetwork const& cnet, 
                          asp::CRNJ const& crn, 
-                         ceres::Problem &problem) {
+                         ceres::Problem &problem,
+                         std::vector<ceres::ResidualBlockId> const& residual_blocks) {
 
   std::vector<double> residuals;
   asp::compute_residuals(opt, crn, param_storage,
@@ -243,7 +254,7 @@ void write_residual_logs(std::string const& residual_prefix,
                     num_gcp_or_dem_residuals, 
                     num_uncertainty_residuals,
                     num_tri_residuals, num_cam_position_residuals,
-                    reference_vec, problem,
+                    reference_vec, problem, residual_blocks,
                     // Output
                     residuals);
     
@@ -269,43 +280,61 @@ void write_residual_logs(std::string const& residual_prefix,
     residual_file_reference_xyz.precision(17);
   }
   
-  size_t index = 0;
-  // For each camera, average together all the point observation residuals
-  residual_file << "# Pixel reprojection error per camera\n";
-  residual_file << "# Image, mean, median, count\n";
-  for (size_t c = 0; c < param_storage.num_cameras(); c++) {
-    size_t num_this_cam_residuals = cam_residual_counts[c];
-    
-    // Write header for the raw file
-    std::string name = opt.image_files[c];
-    residual_file_raw_pixels << name << ", " << num_this_cam_residuals << std::endl;
-
+  // The index of the first residual of each camera
+  size_t num_cams = param_storage.num_cameras();
+  std::vector<size_t> cam_beg(num_cams + 1, 0);
+  for (size_t c = 0; c < num_cams; c++)
+    cam_beg[c + 1] = cam_beg[c] + PIXEL_SIZE * cam_residual_counts[c];
+  if (cam_beg[num_cams] > num_residuals)
+    vw_throw(LogicErr() << "Have " << num_residuals << " residuals, but the cameras need "
+              << cam_beg[num_cams] << ".\n");
+
+  // For each camera, average together all the point observation residuals.
+  // Do this in parallel, as there can be very many residuals.
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  std::vector<double> mean_residuals(num_cams, nan), median_residuals(num_cams, nan);
+  #pragma omp parallel for
+  for (int c = 0; c < int(num_cams); c++) {
     // All residuals are for inliers, as we do not even add a residual
     // for an outlier
-    
+    size_t num_this_cam_residuals = cam_residual_counts[c];
     double mean_residual = 0; // Take average of all pixel coord errors
-    std::vector<double> residual_norms;
+    std::vector<double> residual_norms(num_this_cam_residuals);
     for (size_t i = 0; i < num_this_cam_residuals; i++) {
-      double ex = residuals[index]; index++;
-      double ey = residuals[index]; index++;
-      double residual_norm = std::sqrt(ex * ex + ey * ey);
-      mean_residual += residual_norm;
-      residual_norms.push_back(residual_norm);
-      residual_file_raw_pixels << ex << ", " << ey << std::endl;
+      double ex = residuals[cam_beg[c] + PIXEL_SIZE * i];
+      double ey = residuals[cam_beg[c] + PIXEL_SIZE * i + 1];
+      residual_norms[i] = std::sqrt(ex * ex + ey * ey);
+      mean_residual += residual_norms[i];
     }
-    // Write line for the summary file
-    mean_residual /= static_cast<double>(num_this_cam_residuals);
-    double median_residual = std::numeric_limits<double>::quiet_NaN();
+    mean_residuals[c] = mean_residual / static_cast<double>(num_this_cam_residuals);
     if (residual_norms.size() > 0) {
-      std::sort(residual_norms.begin(), residual_norms.end());
-      median_residual = residual_norms[residual_norms.size()/2];
+      auto mid = residual_norms.begin() + residual_norms.size()/2;
+      std::nth_element(residual_norms.begin(), mid, residual_norms.end());
+      median_residuals[c] = *mid;
     }
+  }
+
+  residual_file << "# Pixel reprojection error per camera\n";
+  residual_file << "# Image, mean, median, count\n";
+  for (size_t c = 0; c < num_cams; c++) {
+    size_t num_this_cam_residuals = cam_residual_counts[c];
+
+    // Write header for the raw file, then the residuals
+    std::string name = opt.image_files[c];
+    residual_file_raw_pixels << name << ", " << num_this_cam_residuals << "\n";
+    asp::write_lines_parallel(residual_file_raw_pixels, num_this_cam_residuals,
+                              [&](std::ostream & os, size_t i) {
+      os << residuals[cam_beg[c] + PIXEL_SIZE * i] << ", "
+         << residuals[cam_beg[c] + PIXEL_SIZE * i + 1] << "\n";
+    });
     
+    // Write line for the summary file
     residual_file << name                   << ", "
-                  << mean_residual          << ", "
-                  << median_residual        << ", "
-                  << num_this_cam_residuals << std::endl;
+                  << mean_residuals[c]      << ", "
+                  << median_residuals[c]    << ", "
+                  << num_this_cam_residuals << "\n";
   }
+  size_t index = cam_beg[num_cams];
   
   residual_file_raw_pixels.close();
   residual_file.close();
@@ -500,18 +529,21 @@ void writeTriOffsetsPerCamera(int num_cams,
   ofs << "# Per-image offsets between initial and final triangulated points (meters)\n";
   ofs << "# Image mean median count\n";
   
-  // Iterate through the cameras
+  // Find the stats for the cameras in parallel, then write them
   double nan = std::numeric_limits<double>::quiet_NaN();
+  std::vector<double> means(num_cams, nan), medians(num_cams, nan), counts(num_cams, 0);
+  #pragma omp parallel for
   for (int icam = 0; icam < num_cams; icam++) {
     auto & offsets = tri_offsets[icam];
-    double mean = nan, median = nan, count = 0;
     if (!offsets.empty()) {
-      mean = vw::math::mean(offsets);
-      median = vw::math::destructive_median<double>(offsets);
-      count = offsets.size();
+      means[icam] = vw::math::mean(offsets);
+      medians[icam] = vw::math::destructive_median<double>(offsets);
+      counts[icam] = offsets.size();
     }
-    ofs << image_files[icam] << " " << mean << " " << median << " " << count << "\n";  
   }
+  for (int icam = 0; icam < num_cams; icam++)
+    ofs << image_files[icam] << " " << means[icam] << " " << medians[icam] << " "
+        << counts[icam] << "\n";
   ofs.close();
 }
 
@@ -721,12 +753,16 @@ void write_per_xyz_pixel_residuals(vw::ba::ControlNetwork const& cnet,
   file << "# lon, lat, height_above_datum, mean_residual, num_observations\n";
   file << "# " << datum << std::endl;
 
-  // Write all the points to the file
+  // Write all the points to the file, skipping the outliers. The lines
+  // are formatted in parallel.
+  std::vector<int> inliers;
   for (int ipt = 0; ipt < num_tri_points; ipt++) {
+    if (outliers.find(ipt) == outliers.end() && pixel_residual_count[ipt] > 0)
+      inliers.push_back(ipt);
+  }
+  asp::write_lines_parallel(file, inliers.size(), [&](std::ostream & os, size_t it) {
+    int ipt = inliers[it];
 
-    if (outliers.find(ipt) != outliers.end() || pixel_residual_count[ipt] <= 0)
-      continue; // Skip outliers
-    
     // The final GCC coordinate of this point
     const double * tri_point = &tri_points_vec[0] + ipt * NUM_XYZ_PARAMS;
     Vector3 xyz(tri_point[0], tri_point[1], tri_point[2]);
@@ -735,10 +771,10 @@ void write_per_xyz_pixel_residuals(vw::ba::ControlNetwork const& cnet,
     std::string comment = "";
     if (cnet[ipt].type() == vw::ba::ControlPoint::GroundControlPoint)
       comment = " # GCP";
-    file << llh[0] << ", " << llh[1] <<", " << llh[2] << ", "
-         << mean_pixel_residual_norm[ipt] << ", "
-         << pixel_residual_count[ipt] << comment << std::endl;
-  }
+    os << llh[0] << ", " << llh[1] <<", " << llh[2] << ", "
+       << mean_pixel_residual_norm[ipt] << ", "
+       << pixel_residual_count[ipt] << comment << "\n";
+  });
   file.close();
 }
 
@@ -757,11 +793,12 @@ void write_anchor_residuals(std::string              const& residual_prefix,
   file << "# lon, lat, height_above_datum, anchor_residual_pixel_norm\n";
   file << "# " << datum << std::endl;
 
-  for (size_t anchor_it = 0; anchor_it < anchor_xyz.size(); anchor_it++) {
+  asp::write_lines_parallel(file, anchor_xyz.size(), [&](std::ostream & os,
+                                                         size_t anchor_it) {
     Vector3 llh = datum.cartesian_to_geodetic(anchor_xyz[anchor_it]);
-    file << llh[0] <<", "<< llh[1] << ", " << llh[2] << ", "
-         << anchor_residual_norm[anchor_it] << std::endl;
-  }
+    os << llh[0] <<", "<< llh[1] << ", " << llh[2] << ", "
+       << anchor_residual_norm[anchor_it] << "\n";
+  });
   
   file.close();
 }
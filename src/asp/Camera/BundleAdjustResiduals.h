@@ -31,7 +31,8 @@
 
 namespace asp {
 
-// Compute the bundle_adjust residuals
+// Compute the bundle_adjust residuals. If residual_blocks is not empty,
+// only those residual blocks are evaluated, in the given order.
 void compute_residuals(asp::BaBaseOptions const& opt,
                        asp::CRNJ const& crn,
                        asp::BAParams const& param_storage,
@@ -43,6 +44,7 @@ void compute_residuals(asp::BaBaseOptions const& opt,
                        size_t num_cam_position_residuals,
                        std::vector<vw::Vector3> const& reference_vec,
                        ceres::Problem & problem,
+                       std::vector<ceres::ResidualBlockId> const& residual_blocks,
                        // Output
                        std::vector<double> & residuals);
 
@@ -78,7 +80,8 @@ void write_residual_logs(std::string const& residual_prefix,
                          std::vector<vw::Vector3> const& reference_vec,
                          vw::ba::ControlNetwork const& cnet, 
                          asp::CRNJ const& crn, 
-                         ceres::Problem &problem);
+                         ceres::Problem &problem,
+                         std::vector<ceres::ResidualBlockId> const& residual_blocks);
 
 // Find and save the offsets between initial and final triangulated points
 void saveTriOffsetsPerCamera(std::vector<std::string> const& image_files,
@@ -0,0 +1,160 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file BundleAdjustSolver.cc
+
+#include <asp/Camera/BundleAdjustSolver.h>
+
+#include <vw/Core/Exception.h>
+
+#include <algorithm>
+#include <cstdint>
+
+// Presets using newer Ceres features are enabled only when available
+#define ASP_CERES_AT_LEAST(major, minor)                                  \
+  (CERES_VERSION_MAJOR > (major) ||                                       \
+   (CERES_VERSION_MAJOR == (major) && CERES_VERSION_MINOR >= (minor)))
+
+namespace asp {
+
+std::vector<std::string> availableSolverPresets() {
+  std::vector<std::string> presets;
+  presets.push_back("auto");
+  presets.push_back("dense-schur");
+  presets.push_back("sparse-schur");
+  presets.push_back("iterative-schur");
+  presets.push_back("iterative-schur-explicit");
+#if ASP_CERES_AT_LEAST(2, 2)
+  presets.push_back("iterative-schur-power-series");
+#endif
+#if ASP_CERES_AT_LEAST(2, 0)
+  presets.push_back("sparse-schur-mixed-precision");
+#endif
+#ifndef CERES_NO_CUDA
+#if ASP_CERES_AT_LEAST(2, 1)
+  presets.push_back("cuda-dense-schur");
+#endif
+#if ASP_CERES_AT_LEAST(2, 2)
+  presets.push_back("cuda-sparse-schur");
+#endif
+#endif
+  return presets;
+}
+
+void applySolverPreset(std::string const& preset, ceres::Solver::Options & options) {
+
+  std::vector<std::string> presets = availableSolverPresets();
+  if (std::find(presets.begin(), presets.end(), preset) == presets.end()) {
+    std::string list;
+    for (size_t it = 0; it < presets.size(); it++)
+      list += (it == 0 ? "" : ", ") + presets[it];
+    vw::vw_throw(vw::ArgumentErr() << "Unknown or unsupported solver preset: " << preset
+                 << ". This build supports: " << list << ".\n");
+  }
+
+  if (preset == "auto") {
+    // Keep the choice made by the caller
+  } else if (preset == "dense-schur") {
+    options.linear_solver_type = ceres::DENSE_SCHUR;
+  } else if (preset == "sparse-schur") {
+    options.linear_solver_type = ceres::SPARSE_SCHUR;
+  } else if (preset == "iterative-schur") {
+    options.linear_solver_type = ceres::ITERATIVE_SCHUR;
+    options.preconditioner_type = ceres::SCHUR_JACOBI;
+    options.use_explicit_schur_complement = false;
+  } else if (preset == "iterative-schur-explicit") {
+    options.linear_solver_type = ceres::ITERATIVE_SCHUR;
+    options.preconditioner_type = ceres::SCHUR_JACOBI;
+    options.use_explicit_schur_complement = true;
+  }
+#if ASP_CERES_AT_LEAST(2, 2)
+  else if (preset == "iterative-schur-power-series") {
+    options.linear_solver_type = ceres::ITERATIVE_SCHUR;
+    options.preconditioner_type = ceres::SCHUR_POWER_SERIES_EXPANSION;
+    options.use_explicit_schur_complement = false;
+  }
+#endif
+#if ASP_CERES_AT_LEAST(2, 0)
+  else if (preset == "sparse-schur-mixed-precision") {
+    // Factor in single precision, then refine the solution in double precision
+    options.linear_solver_type = ceres::SPARSE_SCHUR;
+    options.use_mixed_precision_solves = true;
+    options.max_num_refinement_iterations = 3;
+  }
+#endif
+#ifndef CERES_NO_CUDA
+#if ASP_CERES_AT_LEAST(2, 1)
+  else if (preset == "cuda-dense-schur") {
+    options.linear_solver_type = ceres::DENSE_SCHUR;
+    options.dense_linear_algebra_library_type = ceres::CUDA;
+  }
+#endif
+#if ASP_CERES_AT_LEAST(2, 2)
+  else if (preset == "cuda-sparse-schur") {
+    options.linear_solver_type = ceres::SPARSE_SCHUR;
+    options.sparse_linear_algebra_library_type = ceres::CUDA_SPARSE;
+  }
+#endif
+#endif
+
+  // Catch combinations which this build of Ceres cannot do
+  std::string error;
+  if (!options.IsValid(&error))
+    vw::vw_throw(vw::ArgumentErr() << "Cannot use the solver preset " << preset
+                 << ": " << error << "\n");
+}
+
+void applyBandedSchur(ceres::Problem & problem, double * points, size_t num_points,
+                      ceres::Solver::Options & options) {
+
+  // Ceres picks by default an independent set of blocks to eliminate, and
+  // that can include camera variables not sharing residuals, rather than
+  // the points. Then the reduced matrix is not banded. All blocks must be
+  // in the ordering, including the constant ones, which are put with the
+  // cameras.
+  ceres::ParameterBlockOrdering * ordering = new ceres::ParameterBlockOrdering;
+  std::vector<double*> blocks;
+  problem.GetParameterBlocks(&blocks);
+  int num_eliminated = 0;
+  for (size_t it = 0; it < blocks.size(); it++) {
+    std::uintptr_t beg = reinterpret_cast<std::uintptr_t>(points);
+    std::uintptr_t ptr = reinterpret_cast<std::uintptr_t>(blocks[it]);
+    bool is_point = (ptr >= beg && ptr < beg + 3 * num_points * sizeof(double) &&
+                     (ptr - beg) % (3 * sizeof(double)) == 0 &&
+                     problem.ParameterBlockSize(blocks[it]) == 3 &&
+                     !problem.IsParameterBlockConstant(blocks[it]));
+    ordering->AddElementToGroup(blocks[it], is_point ? 0 : 1);
+    num_eliminated += int(is_point);
+  }
+
+  if (num_eliminated == 0) {
+    // Nothing to eliminate, so factor the banded normal equations directly
+    delete ordering;
+    options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+  } else {
+    options.linear_solver_type = ceres::SPARSE_SCHUR;
+    options.linear_solver_ordering.reset(ordering);
+  }
+  options.use_explicit_schur_complement = false;
+
+  std::string error;
+  if (!options.IsValid(&error))
+    vw::vw_throw(vw::ArgumentErr() << "Cannot use the banded Schur solver: "
+                 << error << "\n");
+}
+
+} // end namespace asp
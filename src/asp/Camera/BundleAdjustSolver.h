@@ -0,0 +1,51 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file BundleAdjustSolver.h
+/// Named choices of the Ceres linear solver, shared by bundle_adjust and
+/// jitter_solve.
+#ifndef __BUNDLE_ADJUST_SOLVER_H__
+#define __BUNDLE_ADJUST_SOLVER_H__
+
+#include <ceres/ceres.h>
+
+#include <string>
+#include <vector>
+
+namespace asp {
+
+// The names of the solver presets which this build of Ceres supports.
+// The first one, "auto", leaves the solver options as they are.
+std::vector<std::string> availableSolverPresets();
+
+// Overwrite the linear solver options with those for the given preset.
+// Throw an error if the preset is unknown, not supported by this build of
+// Ceres, or the resulting options are invalid.
+void applySolverPreset(std::string const& preset, ceres::Solver::Options & options);
+
+// Solve with a sparse direct Schur complement, eliminating first the
+// triangulated points, which are num_points consecutive blocks of size 3
+// starting at the given address. The reduced matrix for the remaining
+// variables, such as the positions and orientations of a linescan camera,
+// which are touched only by residuals for a few adjacent lines, is then
+// banded, and its factorization stays sparse.
+void applyBandedSchur(ceres::Problem & problem, double * points, size_t num_points,
+                      ceres::Solver::Options & options);
+
+} // end namespace asp
+
+#endif // __BUNDLE_ADJUST_SOLVER_H__
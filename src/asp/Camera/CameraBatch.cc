@@ -0,0 +1,169 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file CameraBatch.cc
+
+#include <asp/Camera/CameraBatch.h>
+#include <asp/Camera/RPCModel.h>
+#include <asp/Camera/CsmModel.h>
+#include <asp/Camera/LinescanDGModel.h>
+
+#include <vw/InterestPoint/InterestData.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <typeinfo>
+
+namespace asp {
+
+// Find the model with a native batch implementation behind this camera, if
+// any. Only exact types are matched, as a derived class may override the
+// projection, as PleiadesCameraModel does for CsmModel.
+void findBatchModel(vw::camera::CameraModel const* cam, bool for_rays,
+                    RPCModel const*& rpc, CsmModel const*& csm) {
+  rpc = NULL;
+  csm = NULL;
+  if (cam == NULL)
+    return;
+
+  // The DG model forwards point_to_pixel() to its CSM model. Its rays are
+  // found from its own tables of per-line poses, so those stay per pixel.
+  DGCameraModel const* dg = dynamic_cast<DGCameraModel const*>(cam);
+  if (dg != NULL) {
+    if (!for_rays && dg->m_csm_model && typeid(*dg->m_csm_model) == typeid(CsmModel))
+      csm = dg->m_csm_model.get();
+    return;
+  }
+
+  if (typeid(*cam) == typeid(RPCModel))
+    rpc = static_cast<RPCModel const*>(cam);
+  else if (typeid(*cam) == typeid(CsmModel))
+    csm = static_cast<CsmModel const*>(cam);
+}
+
+void pointsToPixels(vw::camera::CameraModel const* cam,
+                    vw::Vector3 const* points, size_t num,
+                    vw::Vector2 * pixels) {
+
+  RPCModel const* rpc = NULL;
+  CsmModel const* csm = NULL;
+  findBatchModel(cam, false, rpc, csm);
+  if (rpc != NULL) {
+    rpc->points_to_pixels(points, num, pixels);
+    return;
+  }
+  if (csm != NULL) {
+    csm->points_to_pixels(points, num, pixels);
+    return;
+  }
+
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  for (size_t i = 0; i < num; i++) {
+    try {
+      pixels[i] = cam->point_to_pixel(points[i]);
+    } catch (...) {
+      pixels[i] = vw::Vector2(nan, nan);
+    }
+  }
+}
+
+void pixelsToRays(vw::camera::CameraModel const* cam,
+                  vw::Vector2 const* pixels, size_t num,
+                  vw::Vector3 * centers, vw::Vector3 * dirs) {
+
+  RPCModel const* rpc = NULL;
+  CsmModel const* csm = NULL;
+  findBatchModel(cam, true, rpc, csm);
+  if (rpc != NULL) {
+    rpc->pixels_to_rays(pixels, num, centers, dirs);
+    return;
+  }
+  if (csm != NULL) {
+    csm->pixels_to_rays(pixels, num, centers, dirs);
+    return;
+  }
+
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  for (size_t i = 0; i < num; i++) {
+    try {
+      if (dirs != NULL)
+        dirs[i] = cam->pixel_to_vector(pixels[i]);
+      if (centers != NULL)
+        centers[i] = cam->camera_center(pixels[i]);
+    } catch (...) {
+      if (dirs != NULL)
+        dirs[i] = vw::Vector3(nan, nan, nan);
+      if (centers != NULL)
+        centers[i] = vw::Vector3(nan, nan, nan);
+    }
+  }
+}
+
+void pixelsToVectors(vw::camera::CameraModel const* cam,
+                     vw::Vector2 const* pixels, size_t num,
+                     vw::Vector3 * dirs) {
+  pixelsToRays(cam, pixels, num, NULL, dirs);
+}
+
+void cameraCenters(vw::camera::CameraModel const* cam,
+                   vw::Vector2 const* pixels, size_t num,
+                   vw::Vector3 * centers) {
+  pixelsToRays(cam, pixels, num, centers, NULL);
+}
+
+void convergence_angles(vw::camera::CameraModel const * left_cam,
+                        vw::camera::CameraModel const * right_cam,
+                        std::vector<vw::ip::InterestPoint> const& left_ip,
+                        std::vector<vw::ip::InterestPoint> const& right_ip,
+                        bool single_threaded_cameras,
+                        std::vector<double> & sorted_angles) {
+
+  sorted_angles.clear();
+  int num_ip = std::min(left_ip.size(), right_ip.size());
+  std::vector<vw::Vector2> left_pix(num_ip), right_pix(num_ip);
+  for (int ip_it = 0; ip_it < num_ip; ip_it++) {
+    left_pix[ip_it]  = vw::Vector2(left_ip[ip_it].x,  left_ip[ip_it].y);
+    right_pix[ip_it] = vw::Vector2(right_ip[ip_it].x, right_ip[ip_it].y);
+  }
+
+  // Large enough blocks amortize the batch calls, and there are enough of
+  // them to keep the threads busy
+  int block_size = 1024;
+  int num_blocks = (num_ip + block_size - 1) / block_size;
+  std::vector<vw::Vector3> left_dirs(num_ip), right_dirs(num_ip);
+  std::vector<double> angles(num_ip);
+  #pragma omp parallel for if (!single_threaded_cameras)
+  for (int block = 0; block < num_blocks; block++) {
+    int beg = block * block_size;
+    int num = std::min(block_size, num_ip - beg);
+    pixelsToVectors(left_cam,  &left_pix[beg],  num, &left_dirs[beg]);
+    pixelsToVectors(right_cam, &right_pix[beg], num, &right_dirs[beg]);
+    for (int ip_it = beg; ip_it < beg + num; ip_it++)
+      angles[ip_it] = (180.0 / M_PI) * acos(dot_prod(left_dirs[ip_it], right_dirs[ip_it]));
+  }
+
+  // A failed ray is NaN, and so is its angle
+  for (int ip_it = 0; ip_it < num_ip; ip_it++) {
+    if (!std::isnan(angles[ip_it]))
+      sorted_angles.push_back(angles[ip_it]);
+  }
+
+  std::sort(sorted_angles.begin(), sorted_angles.end());
+}
+
+} // end namespace asp
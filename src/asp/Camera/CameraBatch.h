@@ -0,0 +1,74 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file CameraBatch.h
+/// Apply point_to_pixel(), pixel_to_vector(), and camera_center() to many
+/// points or pixels at once. RPC and CSM cameras use a native batch
+/// implementation, and so does point_to_pixel() for DigitalGlobe linescan
+/// cameras, which are CSM underneath. Any other camera falls back to one
+/// virtual call per point.
+#ifndef __ASP_CAMERA_CAMERA_BATCH_H__
+#define __ASP_CAMERA_CAMERA_BATCH_H__
+
+#include <vw/Camera/CameraModel.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace vw {
+  namespace ip {
+    class InterestPoint;
+  }
+}
+
+namespace asp {
+
+// Project num points into the camera. The pixels array must have room for
+// num elements. A point which cannot be projected gets a NaN pixel.
+void pointsToPixels(vw::camera::CameraModel const* cam,
+                    vw::Vector3 const* points, size_t num,
+                    vw::Vector2 * pixels);
+
+// Find the camera centers and ray directions for num pixels. Either of
+// centers or dirs may be NULL. Asking for both at once is cheaper than
+// two separate calls for RPC cameras. Failures give NaN values.
+void pixelsToRays(vw::camera::CameraModel const* cam,
+                  vw::Vector2 const* pixels, size_t num,
+                  vw::Vector3 * centers, vw::Vector3 * dirs);
+
+// Convenience wrappers around pixelsToRays().
+void pixelsToVectors(vw::camera::CameraModel const* cam,
+                     vw::Vector2 const* pixels, size_t num,
+                     vw::Vector3 * dirs);
+void cameraCenters(vw::camera::CameraModel const* cam,
+                   vw::Vector2 const* pixels, size_t num,
+                   vw::Vector3 * centers);
+
+// Find and sort the convergence angles, in degrees, for given cameras and
+// interest point matches. The rays are found with pixelsToVectors() in
+// blocks, which are processed in parallel unless the cameras are not
+// thread-safe. Matches whose rays cannot be found are skipped.
+void convergence_angles(vw::camera::CameraModel const * left_cam,
+                        vw::camera::CameraModel const * right_cam,
+                        std::vector<vw::ip::InterestPoint> const& left_ip,
+                        std::vector<vw::ip::InterestPoint> const& right_ip,
+                        bool single_threaded_cameras,
+                        std::vector<double> & sorted_angles);
+
+} // end namespace asp
+
+#endif // __ASP_CAMERA_CAMERA_BATCH_H__
@@ -154,17 +154,31 @@ void scaledDGTriangulationJacobian(vw::cartography::Datum const& datum,
 
   // Find the camera center and direction for first unperturbed
   // camera, and for the perturbed versions. Same for the second
-  // camera.
-  std::vector<vw::Vector3> cam1_dirs, cam1_ctrs, cam2_dirs, cam2_ctrs;
-  cam1_dirs.push_back(dg_cam1->pixel_to_vector(pix1));
-  cam1_ctrs.push_back(dg_cam1->camera_center(pix1));
-  cam2_dirs.push_back(dg_cam2->pixel_to_vector(pix2));
-  cam2_ctrs.push_back(dg_cam2->camera_center(pix2));
-  for (size_t it = 0; it < dg_cam1->m_perturbed_cams.size(); it++) {
-    cam1_dirs.push_back(dg_cam1->m_perturbed_cams[it]->pixel_to_vector(pix1));
-    cam1_ctrs.push_back(dg_cam1->m_perturbed_cams[it]->camera_center(pix1));
-    cam2_dirs.push_back(dg_cam2->m_perturbed_cams[it]->pixel_to_vector(pix2));
-    cam2_ctrs.push_back(dg_cam2->m_perturbed_cams[it]->camera_center(pix2));
+  // camera. A perturbation in the satellite position moves all
+  // tabulated camera positions by the same amount, and the position
+  // interpolation is linear in those, so the camera center moves by
+  // exactly that amount and the direction does not change. Hence only
+  // the cameras with perturbed quaternions need to be evaluated.
+  int num_perturbed = dg_cam1->m_perturbed_cams.size();
+  std::vector<vw::Vector3> cam1_dirs(num_perturbed + 1), cam1_ctrs(num_perturbed + 1);
+  std::vector<vw::Vector3> cam2_dirs(num_perturbed + 1), cam2_ctrs(num_perturbed + 1);
+  cam1_dirs[0] = dg_cam1->pixel_to_vector(pix1);
+  cam1_ctrs[0] = dg_cam1->camera_center(pix1);
+  cam2_dirs[0] = dg_cam2->pixel_to_vector(pix2);
+  cam2_ctrs[0] = dg_cam2->camera_center(pix2);
+  for (int it = 0; it < num_perturbed; it++) {
+    vw::Vector3 dp = positionDelta(it + 1);
+    if (dp != vw::Vector3()) {
+      cam1_dirs[it + 1] = cam1_dirs[0];
+      cam1_ctrs[it + 1] = cam1_ctrs[0] + dp;
+      cam2_dirs[it + 1] = cam2_dirs[0];
+      cam2_ctrs[it + 1] = cam2_ctrs[0] + dp;
+      continue;
+    }
+    cam1_dirs[it + 1] = dg_cam1->m_perturbed_cams[it]->pixel_to_vector(pix1);
+    cam1_ctrs[it + 1] = dg_cam1->m_perturbed_cams[it]->camera_center(pix1);
+    cam2_dirs[it + 1] = dg_cam2->m_perturbed_cams[it]->pixel_to_vector(pix2);
+    cam2_ctrs[it + 1] = dg_cam2->m_perturbed_cams[it]->camera_center(pix2);
   }
 
   // Apply adjustments
@@ -383,13 +397,12 @@ vw::Vector3 nedTri(vw::Vector3 const& cam1_ctr, vw::Vector3 const& cam2_ctr,
 // point. Find the Jacobian of the nedTri() function, which will
 // propagate uncertainties from the North-East horizontal plane
 // through triangulation, with the result also being in NED.
-// Bundle-adjusted cameras need no special treatment.
+// The camera centers and directions are in ECEF. Bundle-adjusted
+// cameras need no special treatment.
 void triangulationJacobian(vw::cartography::Datum const& datum,
                            vw::Vector3 const& tri_nominal,
-                           vw::camera::CameraModel const* cam1,
-                           vw::camera::CameraModel const* cam2,
-                           vw::Vector2 const& pix1,
-                           vw::Vector2 const& pix2,
+                           vw::Vector3 const& cam1_ctr, vw::Vector3 const& cam1_dir,
+                           vw::Vector3 const& cam2_ctr, vw::Vector3 const& cam2_dir,
                            vw::Matrix<double> & J) {
   
   // The matrix to go from the NED coordinate system to ECEF at the
@@ -398,10 +411,6 @@ void triangulationJacobian(vw::cartography::Datum const& datum,
   vw::Matrix3x3 NedToEcef = datum.lonlat_to_ned_matrix(llh);
   vw::Matrix3x3 EcefToNed = inverse(NedToEcef);
 
-  // Camera centers and directions in ECEF
-  vw::Vector3 cam1_ctr = cam1->camera_center(pix1), cam1_dir = cam1->pixel_to_vector(pix1);
-  vw::Vector3 cam2_ctr = cam2->camera_center(pix2), cam2_dir = cam2->pixel_to_vector(pix2);
-
   // Convert to NED
   vw::Vector3 cam1_ctr_ned = EcefToNed * (cam1_ctr - tri_nominal);
   vw::Vector3 cam1_dir_ned = EcefToNed * cam1_dir;
@@ -459,45 +468,10 @@ void triangulationJacobian(vw::cartography::Datum const& datum,
   return;
 }
 
-// Propagate the covariances. Return propagated stddev. See the .h file for more info.
-vw::Vector2 propagateCovariance(vw::Vector3 const& tri_nominal,
-                                vw::cartography::Datum const& datum,
-                                double stddev1, double stddev2,
-                                vw::camera::CameraModel const* cam1,
-                                vw::camera::CameraModel const* cam2,
-                                vw::Vector2 const& pix1,
-                                vw::Vector2 const& pix2) {
-
-  // Return right away if triangulation was not successful. The caller will set the result
-  // to (0, 0, 0).
-  if (tri_nominal == vw::Vector3(0, 0, 0) || tri_nominal != tri_nominal) 
-    vw::vw_throw(vw::ArgumentErr() << "Could not compute the covariance.\n");
-
-  vw::Matrix<double> J, C;
-
-  // variance is square of stddev
-  vw::Vector2 variance;
-  variance[0] = stddev1 * stddev1;
-  variance[1] = stddev2 * stddev2;
-  
-  if (variance[0] > 0 && variance[1] > 0) {
-    // The user set horizontal stddev
-    triangulationJacobian(datum, tri_nominal, cam1, cam2, pix1, pix2, J);
-    C = vw::math::identity_matrix(4);
-    // The first two covariances are the left camera horizontal square stddev,
-    // and last two are for the right camera.
-    C(0, 0) = variance[0]; C(1, 1) = variance[0];
-    C(2, 2) = variance[1]; C(3, 3) = variance[1];
-  } else {
-    // Will arrive here only for DG cameras and if the user did not
-    // set --horizontal-stddev.  The Jacobian of the transform from
-    // ephemeris and attitude to the triangulated point in NED
-    // coordinates, multiplied by a scale factor.
-    asp::scaledDGTriangulationJacobian(datum, cam1, cam2, pix1, pix2, J);
-    
-    // The input covariance, divided by the square of the above scale factor.
-    asp::scaledDGSatelliteCovariance(cam1, cam2, pix1, pix2, C);
-  }
+// Given the Jacobian J of the transform to the triangulated point in
+// NED coordinates and the covariance C of its inputs, find the
+// horizontal and vertical stddev of the triangulated point.
+vw::Vector2 propagatedStdDev(vw::Matrix<double> const& J, vw::Matrix<double> const& C) {
   
   // Propagate the covariance
   // Per: https://en.wikipedia.org/wiki/Propagation_of_uncertainty#Non-linear_combinations
@@ -534,5 +508,77 @@ vw::Vector2 propagateCovariance(vw::Vector3 const& tri_nominal,
   // Take the square root, so return the standard deviation
   return vw::Vector2(sqrt(ans[0]), sqrt(ans[1]));
 }
+
+// The covariance of the horizontal ground plane positions for the
+// left and right camera, given their stddev
+void horizontalCovariance(double stddev1, double stddev2, vw::Matrix<double> & C) {
+  // variance is square of stddev
+  C = vw::math::identity_matrix(4);
+  // The first two covariances are the left camera horizontal square stddev,
+  // and last two are for the right camera.
+  C(0, 0) = stddev1 * stddev1; C(1, 1) = stddev1 * stddev1;
+  C(2, 2) = stddev2 * stddev2; C(3, 3) = stddev2 * stddev2;
+}
+
+// Propagate the covariances. Return propagated stddev. See the .h file for more info.
+vw::Vector2 propagateCovariance(vw::Vector3 const& tri_nominal,
+                                vw::cartography::Datum const& datum,
+                                double stddev1, double stddev2,
+                                vw::camera::CameraModel const* cam1,
+                                vw::camera::CameraModel const* cam2,
+                                vw::Vector2 const& pix1,
+                                vw::Vector2 const& pix2) {
+
+  // Return right away if triangulation was not successful. The caller will set the result
+  // to (0, 0, 0).
+  if (tri_nominal == vw::Vector3(0, 0, 0) || tri_nominal != tri_nominal) 
+    vw::vw_throw(vw::ArgumentErr() << "Could not compute the covariance.\n");
+
+  vw::Matrix<double> J, C;
+  if (stddev1 > 0 && stddev2 > 0) {
+    // The user set horizontal stddev. Camera centers and directions are in ECEF.
+    vw::Vector3 cam1_ctr = cam1->camera_center(pix1), cam1_dir = cam1->pixel_to_vector(pix1);
+    vw::Vector3 cam2_ctr = cam2->camera_center(pix2), cam2_dir = cam2->pixel_to_vector(pix2);
+    triangulationJacobian(datum, tri_nominal, cam1_ctr, cam1_dir, cam2_ctr, cam2_dir, J);
+    horizontalCovariance(stddev1, stddev2, C);
+  } else {
+    // Will arrive here only for DG cameras and if the user did not
+    // set --horizontal-stddev.  The Jacobian of the transform from
+    // ephemeris and attitude to the triangulated point in NED
+    // coordinates, multiplied by a scale factor.
+    asp::scaledDGTriangulationJacobian(datum, cam1, cam2, pix1, pix2, J);
+    
+    // The input covariance, divided by the square of the above scale factor.
+    asp::scaledDGSatelliteCovariance(cam1, cam2, pix1, pix2, C);
+  }
+
+  return propagatedStdDev(J, C);
+}
+
+// Same as above, but with the rays through the two pixels already
+// known. See the .h file for more info.
+vw::Vector2 propagateCovariance(vw::Vector3 const& tri_nominal,
+                                vw::cartography::Datum const& datum,
+                                double stddev1, double stddev2,
+                                vw::camera::CameraModel const* cam1,
+                                vw::camera::CameraModel const* cam2,
+                                vw::Vector2 const& pix1,
+                                vw::Vector2 const& pix2,
+                                vw::Vector3 const& cam1_ctr, vw::Vector3 const& cam1_dir,
+                                vw::Vector3 const& cam2_ctr, vw::Vector3 const& cam2_dir) {
+
+  // The DG covariances need the perturbed cameras
+  if (!(stddev1 > 0 && stddev2 > 0))
+    return propagateCovariance(tri_nominal, datum, stddev1, stddev2, cam1, cam2,
+                               pix1, pix2);
+
+  if (tri_nominal == vw::Vector3(0, 0, 0) || tri_nominal != tri_nominal) 
+    vw::vw_throw(vw::ArgumentErr() << "Could not compute the covariance.\n");
+
+  vw::Matrix<double> J, C;
+  triangulationJacobian(datum, tri_nominal, cam1_ctr, cam1_dir, cam2_ctr, cam2_dir, J);
+  horizontalCovariance(stddev1, stddev2, C);
+  return propagatedStdDev(J, C);
+}
   
 } // end namespace asp
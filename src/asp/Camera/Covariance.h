@@ -61,6 +61,20 @@ namespace asp {
                                   vw::camera::CameraModel const* cam2,
                                   vw::Vector2 const& pix1,
                                   vw::Vector2 const& pix2);
+
+  // Same as above, but with the camera centers and directions (in ECEF)
+  // for the two pixels already known, such as from batch triangulation.
+  // With positive horizontal stddev the cameras are then not used. The
+  // DG satellite covariances still need the cameras.
+  vw::Vector2 propagateCovariance(vw::Vector3 const& tri_nominal,
+                                  vw::cartography::Datum const& datum,
+                                  double stddev1, double stddev2,
+                                  vw::camera::CameraModel const* cam1,
+                                  vw::camera::CameraModel const* cam2,
+                                  vw::Vector2 const& pix1,
+                                  vw::Vector2 const& pix2,
+                                  vw::Vector3 const& cam1_ctr, vw::Vector3 const& cam1_dir,
+                                  vw::Vector3 const& cam2_ctr, vw::Vector3 const& cam2_dir);
   
 } // end namespace asp
 
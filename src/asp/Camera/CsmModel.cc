@@ -48,6 +48,12 @@
 #include <Eigen/Geometry>
 
 #include <streambuf>
+#include <limits>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <sstream>
+#include <unistd.h>
 
 namespace dll = boost::dll;
 namespace fs = boost::filesystem;
@@ -70,6 +76,11 @@ enum USGSCSM_MODEL_TYPE {
 };
 
 vw::Mutex csm_init_mutex;
+std::atomic<bool> g_plugins_initialized(false);
+
+// See CsmModel::setIsdCacheDir()
+vw::Mutex csm_cache_mutex;
+std::string g_isd_cache_dir;
 
 // -----------------------------------------------------------------
 // Helper functions
@@ -278,15 +289,43 @@ const csm::Plugin* find_plugin_for_isd(csm::Isd const& support_data,
   return 0;
 } // End function find_plugin_for_isd
 
+/// Find the loaded plugin having a model with given name. Return NULL if none.
+const csm::Plugin* find_plugin_for_model(std::string const& model_name,
+                                         std::string & model_family) {
+
+  csm::PluginList plugins = csm::Plugin::getList();
+  for (auto iter = plugins.begin(); iter != plugins.end(); iter++) {
+    const csm::Plugin* csm_plugin = (*iter);
+    size_t num_models = csm_plugin->getNumModels();
+    for (size_t i = 0; i < num_models; i++) {
+      if (csm_plugin->getModelName(i) == model_name) {
+        model_family = csm_plugin->getModelFamily(i);
+        return csm_plugin;
+      }
+    }
+  }
+
+  model_family = "";
+  return NULL;
+}
+
 void CsmModel::initialize_plugins() {
 
+  // Avoid the lock once the plugins are loaded
+  if (g_plugins_initialized)
+    return;
+
   // Only let one thread at a time in here.
   vw::Mutex::Lock lock(csm_init_mutex);
 
-  // If we already have plugins loaded, don't do initialization again.
+  // If we already have plugins loaded, don't do initialization again. The
+  // usgscsm plugin registers itself when the library is loaded, and ASP
+  // links to it, so then there is no need to look for plugins on disk.
   csm::PluginList plugins = csm::Plugin::getList();
-  if (!plugins.empty())
+  if (!plugins.empty()) {
+    g_plugins_initialized = true;
     return;
+  }
   
   //vw_out() << "Initializing CSM plugins...\n";
 
@@ -306,10 +345,12 @@ void CsmModel::initialize_plugins() {
   //csm::Plugin::setDataDirectory(plugin_folder); // Don't think we need this.
 
   print_available_models();
+  g_plugins_initialized = true;
 }
 
 // Read the semi-major and semi-minor axes
-void CsmModel::read_ellipsoid_from_isd(std::string const& isd_path) {
+void CsmModel::read_ellipsoid_from_isd(std::string const& isd_path,
+                                       std::string & model_name) {
 
   // Load and parse the json file
   std::ifstream ifs(isd_path);
@@ -320,6 +361,14 @@ void CsmModel::read_ellipsoid_from_isd(std::string const& isd_path) {
     vw::vw_throw(vw::ArgumentErr() << "Cannot open file: " << isd_path << "\n");
   }
   
+  // Read the model name. It saves probing each model to see which one
+  // can load the ISD.
+  model_name = "";
+  try {
+    model_name = json_isd.at("name_model");
+  } catch (...){
+  }
+
   // Read the semi-major axis
   m_semi_major_axis = 0.0;
   try {
@@ -368,16 +417,9 @@ void CsmModel::read_ellipsoid_from_isd(std::string const& isd_path) {
 /// TODO(oalexan1): This returns a single Sun position per camera. It appears
 /// that linescan cameras can return a line-dependent Sun position. It is 
 /// not clear if that has any value, given how quickly an image is taken.
-void readCsmSunPosition(boost::shared_ptr<csm::RasterGM> const& gm_model,
-                        vw::Vector3 & sun_position) {
+// Read the Sun position from a model state already parsed as json
+void readCsmSunPosition(nlohmann::json const& j, vw::Vector3 & sun_position) {
 
-  if (gm_model.get() == NULL)
-    vw::vw_throw(vw::ArgumentErr() 
-                 << "CsmModel::readCsmSunPosition() failed because " 
-                 << "the model is not initialized.\n");
-    
-  std::string modelState = gm_model->getModelState();
-  nlohmann::json j = stateAsJson(modelState);
   if (j.find("m_sunPosition") == j.end())
     vw::vw_throw(vw::ArgumentErr() 
                  << "The Sun position was not found in the CSM model state.\n");
@@ -390,6 +432,18 @@ void readCsmSunPosition(boost::shared_ptr<csm::RasterGM> const& gm_model,
   for (size_t it = 0; it < 3; it++) 
     sun_position[it] = sun_pos[it];
 }
+
+void readCsmSunPosition(boost::shared_ptr<csm::RasterGM> const& gm_model,
+                        vw::Vector3 & sun_position) {
+
+  if (gm_model.get() == NULL)
+    vw::vw_throw(vw::ArgumentErr() 
+                 << "CsmModel::readCsmSunPosition() failed because " 
+                 << "the model is not initialized.\n");
+    
+  std::string modelState = gm_model->getModelState();
+  readCsmSunPosition(stateAsJson(modelState), sun_position);
+}
  
 /// Load the camera model from an ISD file or model state.
 void CsmModel::load_model(std::string const& isd_path) {
@@ -405,10 +459,136 @@ void CsmModel::load_model(std::string const& isd_path) {
                          line == UsgsAstroPushFrameSensorModel::_SENSOR_MODEL_NAME ||
                          line == UsgsAstroSarSensorModel::_SENSOR_MODEL_NAME);
 
-  if (!is_model_state) 
-    CsmModel::load_model_from_isd(isd_path);
-  else
+  if (is_model_state) {
     CsmModel::loadModelFromStateFile(isd_path);
+    return;
+  }
+
+  if (readIsdCache(isd_path))
+    return;
+  CsmModel::load_model_from_isd(isd_path);
+  writeIsdCache(isd_path);
+}
+
+void CsmModel::setIsdCacheDir(std::string const& dir) {
+  vw::Mutex::Lock lock(csm_cache_mutex);
+  g_isd_cache_dir = dir;
+}
+
+// The cache file for an ISD. Empty if there is no cache directory.
+std::string isdCacheFile(std::string const& isd_path) {
+  std::string dir;
+  {
+    vw::Mutex::Lock lock(csm_cache_mutex);
+    dir = g_isd_cache_dir;
+  }
+  if (dir.empty())
+    return "";
+
+  // Different ISDs can have the same name, so add a hash of the full path
+  std::string full_path = fs::absolute(isd_path).string();
+  std::ostringstream os;
+  os << std::hex << std::hash<std::string>()(full_path);
+  return dir + "/" + fs::path(isd_path).stem().string() + "-" + os.str() + ".csmcache";
+}
+
+// The cache file holds, in binary, a magic string, the ISD path, size, and
+// modification time, the ellipsoid axes, the plugin name, and the model
+// state. It is used only if the ISD did not change.
+const std::string CSM_CACHE_MAGIC = "ASPCSMC1";
+
+void writeCacheString(std::ofstream & ofs, std::string const& str) {
+  std::uint64_t len = str.size();
+  ofs.write(reinterpret_cast<const char*>(&len), sizeof(len));
+  ofs.write(str.data(), len);
+}
+
+bool readCacheString(std::ifstream & ifs, std::string & str) {
+  std::uint64_t len = 0;
+  if (!ifs.read(reinterpret_cast<char*>(&len), sizeof(len)))
+    return false;
+  str.resize(len);
+  return bool(ifs.read(&str[0], len));
+}
+
+bool CsmModel::readIsdCache(std::string const& isd_path) {
+
+  std::string cache_file = isdCacheFile(isd_path);
+  if (cache_file.empty() || !fs::exists(cache_file))
+    return false;
+
+  try {
+    std::ifstream ifs(cache_file.c_str(), std::ios::binary);
+    std::string magic, path, plugin_name, model_state;
+    std::int64_t isd_size = 0, isd_time = 0;
+    double semi_major = 0.0, semi_minor = 0.0;
+    if (!readCacheString(ifs, magic) || magic != CSM_CACHE_MAGIC ||
+        !readCacheString(ifs, path) || path != fs::absolute(isd_path).string() ||
+        !ifs.read(reinterpret_cast<char*>(&isd_size), sizeof(isd_size)) ||
+        !ifs.read(reinterpret_cast<char*>(&isd_time), sizeof(isd_time)) ||
+        isd_size != std::int64_t(fs::file_size(isd_path)) ||
+        isd_time != std::int64_t(fs::last_write_time(isd_path)) ||
+        !ifs.read(reinterpret_cast<char*>(&semi_major), sizeof(semi_major)) ||
+        !ifs.read(reinterpret_cast<char*>(&semi_minor), sizeof(semi_minor)) ||
+        !readCacheString(ifs, plugin_name) ||
+        !readCacheString(ifs, model_state))
+      return false;
+
+    bool recreate_model = true;
+    setGmModelFromState(model_state, recreate_model);
+    m_plugin_name     = plugin_name;
+    m_semi_major_axis = semi_major;
+    m_semi_minor_axis = semi_minor;
+    readCsmSunPosition(stateAsJson(model_state), m_sun_position);
+    normalizeLinescanQuaternions();
+  } catch (...) {
+    // A bad cache file is not an error. The ISD will be loaded instead.
+    m_gm_model.reset();
+    return false;
+  }
+
+  return true;
+}
+
+void CsmModel::writeIsdCache(std::string const& isd_path) const {
+
+  std::string cache_file = isdCacheFile(isd_path);
+  if (cache_file.empty())
+    return;
+
+  // Write to a unique temporary file first, then rename, so that a partially
+  // written cache is never read, even when loading cameras in parallel,
+  // including by several processes.
+  static std::atomic<int> count(0);
+  std::ostringstream os;
+  os << cache_file << ".tmp" << getpid() << "_" << count++;
+  std::string tmp_file = os.str();
+
+  try {
+    fs::create_directories(fs::path(cache_file).parent_path());
+    {
+      std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+      std::int64_t isd_size = fs::file_size(isd_path);
+      std::int64_t isd_time = fs::last_write_time(isd_path);
+      writeCacheString(ofs, CSM_CACHE_MAGIC);
+      writeCacheString(ofs, fs::absolute(isd_path).string());
+      ofs.write(reinterpret_cast<const char*>(&isd_size), sizeof(isd_size));
+      ofs.write(reinterpret_cast<const char*>(&isd_time), sizeof(isd_time));
+      ofs.write(reinterpret_cast<const char*>(&m_semi_major_axis), sizeof(m_semi_major_axis));
+      ofs.write(reinterpret_cast<const char*>(&m_semi_minor_axis), sizeof(m_semi_minor_axis));
+      writeCacheString(ofs, m_plugin_name);
+      writeCacheString(ofs, m_gm_model->getModelState());
+      if (!ofs)
+        vw_throw(IOErr() << "Failed writing: " << tmp_file);
+    }
+    fs::rename(tmp_file, cache_file);
+  } catch (std::exception const& e) {
+    // The cache is only an optimization
+    vw_out(WarningMessage) << "Could not write the CSM cache file " << cache_file
+                           << ". " << e.what() << "\n";
+    boost::system::error_code ec;
+    fs::remove(tmp_file, ec);
+  }
 }
 
 /// Load the model from ISD. Read the ellipsoid, sun position, and
@@ -423,20 +603,40 @@ void CsmModel::load_model_from_isd(std::string const& isd_path) {
   // Load ISD data
   csm::Isd support_data(isd_path);
 
-  CsmModel::read_ellipsoid_from_isd(isd_path);
- 
-  // Check each available CSM plugin until we find one that can handle the ISD.
   std::string model_name, model_family;
-  const csm::Plugin* csm_plugin = find_plugin_for_isd(support_data, model_name,
-                                                      model_family, false);
+  CsmModel::read_ellipsoid_from_isd(isd_path, model_name);
 
-  // If we did not find a plugin that would work, go through them again and print error
-  //  messages for each plugin that fails.
-  if (csm_plugin == 0) {
-    find_plugin_for_isd(support_data, model_name, model_family, true);
-    vw::vw_throw(vw::ArgumentErr() 
-                 << "Unable to construct a camera model for the ISD file "
-                 << isd_path << " using any of the loaded CSM plugins!");
+  // If the ISD names its model, construct that one directly. Each check for
+  // whether a model can be constructed parses the ISD, which is slow.
+  csm::WarningList warnings;
+  csm::Model* csm_model = NULL;
+  const csm::Plugin* csm_plugin = NULL;
+  if (model_name != "")
+    csm_plugin = find_plugin_for_model(model_name, model_family);
+  if (csm_plugin != NULL) {
+    try {
+      csm_model = csm_plugin->constructModelFromISD(support_data, model_name, &warnings);
+    } catch (...) {
+      csm_model = NULL;
+    }
+  }
+
+  if (csm_model == NULL) {
+    // Check each available CSM plugin until we find one that can handle the ISD.
+    warnings.clear();
+    csm_plugin = find_plugin_for_isd(support_data, model_name, model_family, false);
+
+    // If we did not find a plugin that would work, go through them again and print error
+    //  messages for each plugin that fails.
+    if (csm_plugin == 0) {
+      find_plugin_for_isd(support_data, model_name, model_family, true);
+      vw::vw_throw(vw::ArgumentErr() 
+                   << "Unable to construct a camera model for the ISD file "
+                   << isd_path << " using any of the loaded CSM plugins!");
+    }
+
+    // Now try to construct the camera model
+    csm_model = csm_plugin->constructModelFromISD(support_data, model_name, &warnings);
   }
   
   // Remember the plugin name. It will be needed to add a model state to a cub file.
@@ -446,11 +646,6 @@ void CsmModel::load_model_from_isd(std::string const& isd_path) {
   //vw::vw_out() << "Using plugin: " << this->plugin_name() 
   //             << " with model name " << model_name << std::endl;
 
-  // Now try to construct the camera model
-  csm::WarningList warnings;
-  csm::Model* csm_model
-    = csm_plugin->constructModelFromISD(support_data, model_name, &warnings);
-
   // Error checking
   csm::WarningList::const_iterator w_iter;
   for (w_iter = warnings.begin(); w_iter!=warnings.end(); ++w_iter) {
@@ -551,9 +746,9 @@ void CsmModel::normalizeLinescanQuaternions() {
 ///
 /// See also load_model_from_isd() for a different construction method. These
 /// must be kept in sync.
-void CsmModel::setModelFromStateString(std::string const& model_state, 
-                                       bool recreate_model) {
-  
+void CsmModel::setGmModelFromState(std::string const& model_state,
+                                   bool recreate_model) {
+
   // TODO(oalexan1): Use the usgscsm function
   // constructModelFromState() after that package pushes a new version
   // (currently there are compile-time issues with it).
@@ -584,6 +779,12 @@ void CsmModel::setModelFromStateString(std::string const& model_state,
   } else {
     vw::vw_throw(vw::ArgumentErr() << "Could not create CSM model from state string.\n");
   }
+}
+
+void CsmModel::setModelFromStateString(std::string const& model_state, 
+                                       bool recreate_model) {
+
+  setGmModelFromState(model_state, recreate_model);
 
   // Get the plugin name
   csm::PluginList plugins = csm::Plugin::getList();
@@ -598,6 +799,7 @@ void CsmModel::setModelFromStateString(std::string const& model_state,
   
   // Set the semi-axes from json (cannot pull it from the usgs models
   // as these figure as private in some of them).
+  // Parse the state only once, for the axes and the Sun position
   auto j = stateAsJson(model_state);
   m_semi_major_axis = j["m_majorAxis"];
   m_semi_minor_axis = j["m_minorAxis"];
@@ -607,8 +809,8 @@ void CsmModel::setModelFromStateString(std::string const& model_state,
     vw::vw_throw(vw::ArgumentErr() << "Could not read positive semi-major "
                  << "and semi-minor axies from state string.");
     
-  // This must happen after gm model is set
-  readCsmSunPosition(m_gm_model, m_sun_position);
+  // The Sun position in the model is the one in the state
+  readCsmSunPosition(j, m_sun_position);
   
   // This is a bug fix.
   normalizeLinescanQuaternions();  
@@ -706,6 +908,51 @@ Vector3 CsmModel::camera_center(Vector2 const& pix) const {
   return ecefCoordToVector(ecef);
 }
 
+void CsmModel::points_to_pixels(Vector3 const* points, size_t num,
+                                Vector2 * pixels) const {
+  throw_if_not_init();
+
+  csm::RasterGM const* gm = m_gm_model.get();
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  double achievedPrecision = -1.0;
+  for (size_t i = 0; i < num; i++) {
+    try {
+      csm::ImageCoord imagePt
+        = gm->groundToImage(vectorToEcefCoord(points[i]), m_desired_precision,
+                            &achievedPrecision, NULL);
+      pixels[i] = imageCoordToVector(imagePt) - ASP_TO_CSM_SHIFT;
+    } catch (...) {
+      pixels[i] = Vector2(nan, nan);
+    }
+  }
+}
+
+void CsmModel::pixels_to_rays(Vector2 const* pixels, size_t num,
+                              Vector3 * centers, Vector3 * dirs) const {
+  throw_if_not_init();
+
+  csm::RasterGM const* gm = m_gm_model.get();
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  double achievedPrecision = -1.0;
+  for (size_t i = 0; i < num; i++) {
+    csm::ImageCoord imagePt = vectorToImageCoord(pixels[i] + ASP_TO_CSM_SHIFT);
+    try {
+      if (dirs != NULL) {
+        csm::EcefLocus locus = gm->imageToRemoteImagingLocus(imagePt, m_desired_precision,
+                                                             &achievedPrecision);
+        dirs[i] = ecefVectorToVector(locus.direction);
+      }
+      if (centers != NULL)
+        centers[i] = ecefCoordToVector(gm->getSensorPosition(imagePt));
+    } catch (...) {
+      if (dirs != NULL)
+        dirs[i] = Vector3(nan, nan, nan);
+      if (centers != NULL)
+        centers[i] = Vector3(nan, nan, nan);
+    }
+  }
+}
+
 // Apply a transform to the model state in json format
 template<class ModelT>
 void applyTransformToState(ModelT const * model,
@@ -826,8 +1073,12 @@ void CsmModel::applyTransform(vw::Matrix4x4 const& transform) {
                         // Output
                         modelState);
 
+  // The transform does not change the ellipsoid or plugin, so skip reading
+  // those. The Sun position is read from the new state.
   bool recreate_model = false; // don't want to destroy the model
-  setModelFromStateString(modelState, recreate_model);
+  setGmModelFromState(modelState, recreate_model);
+  readCsmSunPosition(stateAsJson(modelState), m_sun_position);
+  normalizeLinescanQuaternions();
 }
  
 std::string CsmModel::plugin_name() const {
@@ -66,6 +66,11 @@ namespace asp {
     /// Load the camera model from an ISD file or model state.
     void load_model(std::string const& isd_path);
 
+    /// If non-empty, the model state of each ISD loaded with load_model() is
+    /// saved in this directory, and later loads of the same unchanged ISD read
+    /// it from there, skipping the plugin search and ISD processing.
+    static void setIsdCacheDir(std::string const& dir);
+
     /// Return the size of the associated image.
     vw::Vector2 get_image_size() const;
 
@@ -75,6 +80,15 @@ namespace asp {
 
     virtual vw::Vector3 camera_center(vw::Vector2 const& pix) const;
 
+    /// Batch versions of the above, which check the model and set up the
+    /// CSM call only once. The output arrays must have room for num
+    /// elements. Either of centers or dirs may be NULL. A point or pixel
+    /// for which CSM fails gets NaN values. See CameraBatch.h.
+    void points_to_pixels(vw::Vector3 const* points, size_t num,
+                          vw::Vector2 * pixels) const;
+    void pixels_to_rays(vw::Vector2 const* pixels, size_t num,
+                        vw::Vector3 * centers, vw::Vector3 * dirs) const;
+
     virtual vw::Quaternion<double> camera_pose(vw::Vector2 const& pix) const {
       vw_throw(vw::NoImplErr() << "CsmModel: Cannot retrieve camera_pose!");
       return vw::Quaternion<double>();
@@ -183,8 +197,10 @@ namespace asp {
   protected:
 
     // Read the ellipsoid (datum) axes from the isd json file
-    // (does not work for reading it from a json state file).
-    void read_ellipsoid_from_isd(std::string const& isd_path);
+    // (does not work for reading it from a json state file). Also
+    // read the model name, if the ISD has it, or else set it to empty.
+    void read_ellipsoid_from_isd(std::string const& isd_path,
+                                 std::string & model_name);
     
     /// Load the camera model from an ISD file.
     void load_model_from_isd(std::string const& isd_path);
@@ -195,12 +211,21 @@ namespace asp {
     void loadModelFromStateFile(std::string const& state_file);
 
     /// Find and load any available CSM plugin libraries from disk.
-    /// - This does nothing after the first time it finds any plugins.
+    /// - This does nothing after the first time it finds any plugins,
+    ///   or if the plugins are linked in and already registered.
     void initialize_plugins();
 
     /// Throw an exception if we have not loaded the model yet.
     void throw_if_not_init() const;
 
+    /// Set only m_gm_model from a model state. Does not read the ellipsoid,
+    /// Sun position, or plugin name.
+    void setGmModelFromState(std::string const& model_state, bool recreate_model);
+
+    /// Read and write the cached model state for an ISD. See setIsdCacheDir().
+    bool readIsdCache(std::string const& isd_path);
+    void writeIsdCache(std::string const& isd_path) const;
+
     vw::Vector3 m_sun_position;
     
     std::string m_plugin_name;
@@ -21,12 +21,15 @@
 
 #include <vw/Math/Quaternion.h>
 #include <vw/Math/Geometry.h>
+#include <vw/Cartography/CameraBBox.h>
 
 #include <asp/Camera/CsmModel.h>
 
 #include <ceres/ceres.h>
 #include <ceres/loss_function.h>
 
+#include <limits>
+
 namespace asp {
 
 // Find the rotation matrices, focal length, and optical center,
@@ -180,16 +183,18 @@ void fitBestRotationsIntrinsics(
   // Initial optical center (column and row)
   optical_center = vw::Vector2(image_size[0]/2.0, 0);
   
-  // Find the initial rotation matrix for each row of world_sight_mat
-  // iterate throw rows, print each row
-  // make a vector of matrices, one for each row
-  for (int row = 0; row < world_sight_mat.size(); row++) {
+  // Find the initial rotation matrix for each row of world_sight_mat, from
+  // the sight vectors in that row. A good initial guess makes the solver
+  // below converge in fewer iterations. The rows are independent.
+  rotation_vec.resize(num_rows);
+  #pragma omp parallel for if (num_rows > 10)
+  for (int row = 0; row < num_rows; row++) {
 
     // Find input-output pair correspondences
     std::vector<vw::Vector3> in_vec, out_vec;
-    for (int col = 0; col < world_sight_mat[0].size(); col++) {
+    for (int col = 0; col < num_cols; col++) {
       vw::Vector3 in(col * d_col - optical_center[0], -optical_center[1], focal_length);
-      vw::Vector3 out = world_sight_mat[0][col];
+      vw::Vector3 out = world_sight_mat[row][col];
       // Normalize and push back
       in = in/norm_2(in);
       out = out/norm_2(out);
@@ -206,8 +211,7 @@ void fitBestRotationsIntrinsics(
                                             rotation, translation, scale,
                                             transform_type);
     
-    // append the rotation to the vec
-    rotation_vec.push_back(rotation);
+    rotation_vec[row] = rotation;
   }
   
   // Convert rotations to axis angle format
@@ -322,10 +326,13 @@ struct SightVecLinescanError {
    axisAngleToCsmQuatVec(m_num_poses, rotations, quaternions); 
    local_model.set_linescan_quaternions(quaternions);
    
-    // Find the residuals with the local model
+    // Find the residuals with the local model. This is called once for each
+    // parameter when numerically differentiating, so the rows are done in
+    // parallel. Each residual is written by one thread only, so the result
+    // does not depend on the number of threads.
     int num_rows = m_world_sight_mat.size();
     int num_cols = m_world_sight_mat[0].size();
-    int count = 0;
+    #pragma omp parallel for if (num_rows * num_cols > 100)
     for (int row = 0; row < num_rows; row++) {
       for (int col = 0; col < num_cols; col++) {
         
@@ -338,11 +345,9 @@ struct SightVecLinescanError {
                         double(row) * m_d_row + double(m_min_row));
         vw::Vector3 dir2 = local_model.pixel_to_vector(pix);
         
-        int j = 3 * count;
+        int j = 3 * (row * num_cols + col);
         for (int k = 0; k < 3; k++)
           residuals[j+k] = dir1[k] - dir2[k];
-          
-        count++;
       }
     }
 
@@ -502,6 +507,98 @@ void fitAsterLinescanCsmModel(
   return;
 }
 
+// See the .h file for the documentation
+void fitCsmLinescanToCamera(vw::CamPtr exact_cam,
+                            std::string const& sensor_id, 
+                            vw::cartography::Datum const& datum,
+                            vw::Vector2i const& image_size,
+                            int max_num_rows, int max_num_cols,
+                            // Output
+                            asp::CsmModel & csm_model) {
+
+  int width = image_size[0], height = image_size[1];
+  if (width < 2 || height < 2 || max_num_rows < 2 || max_num_cols < 2)
+    vw::vw_throw(vw::ArgumentErr() << "fitCsmLinescanToCamera: Invalid dimensions.\n");
+  
+  // Samples start at pixel (0, 0) and are spaced by integer amounts. The last
+  // sample is at most one spacing before the last pixel. Each sampled row
+  // becomes a pose in the CSM model.
+  int d_row = std::max(1, (height - 1) / (max_num_rows - 1));
+  int d_col = std::max(1, (width - 1) / (max_num_cols - 1));
+  int num_rows = (height - 1) / d_row + 1;
+  int num_cols = (width - 1) / d_col + 1;
+  int min_row = 0, min_col = 0;
+
+  std::vector<vw::Vector3> sat_pos(num_rows);
+  std::vector<std::vector<vw::Vector3>> world_sight_mat(num_rows);
+  for (int row = 0; row < num_rows; row++) {
+    world_sight_mat[row].resize(num_cols);
+    for (int col = 0; col < num_cols; col++) {
+      vw::Vector2 pix(double(min_col) + double(col) * d_col,
+                      double(min_row) + double(row) * d_row);
+      world_sight_mat[row][col] = exact_cam->pixel_to_vector(pix);
+      if (col == 0)
+        sat_pos[row] = exact_cam->camera_center(pix);
+    }
+  }
+
+  // The ASTER fit works for any linescan camera, given such samples
+  fitAsterLinescanCsmModel(sensor_id, datum, image_size, sat_pos, world_sight_mat,
+                           min_col, min_row, d_col, d_row, csm_model);
+}
+
+// See the .h file for the documentation
+double csmFitPixelError(vw::CamPtr exact_cam,
+                        vw::cartography::Datum const& datum,
+                        vw::Vector2i const& image_size,
+                        int num_pixel_samples,
+                        vw::camera::CameraModel const& cam) {
+
+  std::vector<vw::Vector2> pix_samples;
+  createPixelSamples(image_size[0], image_size[1], num_pixel_samples, pix_samples);
+
+  // The exact camera may be an ISIS camera, which is not thread-safe, so
+  // find the ground points with it serially. A sample is skipped if the exact
+  // camera fails or the ray misses the datum.
+  int num_samples = pix_samples.size();
+  std::vector<vw::Vector3> xyz_vec(num_samples);
+  for (int it = 0; it < num_samples; it++) {
+    vw::Vector2 pix = pix_samples[it];
+    try {
+      vw::Vector3 ctr = exact_cam->camera_center(pix);
+      vw::Vector3 dir = exact_cam->pixel_to_vector(pix);
+      xyz_vec[it] = vw::cartography::datum_intersection(datum, ctr, dir);
+    } catch (...) {
+      xyz_vec[it] = vw::Vector3();
+    }
+  }
+
+  // Project into the fitted camera, which is the expensive part, in parallel
+  std::vector<double> err_vec(num_samples, -1.0);
+  #pragma omp parallel for schedule(dynamic) if (num_samples > 100)
+  for (int it = 0; it < num_samples; it++) {
+    if (xyz_vec[it] == vw::Vector3())
+      continue;
+
+    double err = std::numeric_limits<double>::infinity();
+    try {
+      err = norm_2(cam.point_to_pixel(xyz_vec[it]) - pix_samples[it]);
+    } catch (...) {}
+    if (!(err == err)) // NaN
+      err = std::numeric_limits<double>::infinity();
+    err_vec[it] = err;
+  }
+
+  double max_err = -1.0;
+  for (int it = 0; it < num_samples; it++)
+    max_err = std::max(max_err, err_vec[it]);
+
+  if (max_err < 0)
+    return std::numeric_limits<double>::infinity();
+
+  return max_err;
+}
+
 // Create pixel samples. Make sure to sample the pixel at (width - 1, height - 1).
 void createPixelSamples(int width, int height, int num_pixel_samples,
                         std::vector<vw::Vector2> & pix_samples) {
@@ -645,8 +742,9 @@ struct FrameCamReprojErr {
      dist_vec[i] = distortion[i];
    local_model.set_distortion(dist_vec); 
 
-    // Find the residuals with the local model
+    // Find the residuals with the local model, in parallel, as above
     int num_samples = m_pixels.size();
+    #pragma omp parallel for if (num_samples > 100)
     for (int count = 0; count < num_samples; count++) {
         
       vw::Vector2 pix1 = m_pixels[count];
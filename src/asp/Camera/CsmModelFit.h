@@ -22,6 +22,8 @@
 
 #include <vw/Math/Matrix.h>
 #include <vw/Math/Vector.h>
+#include <vw/Camera/CameraModel.h>
+#include <vw/Cartography/Datum.h>
 
 namespace asp {
 
@@ -40,6 +42,28 @@ void fitAsterLinescanCsmModel(
        // This model will be modified
        asp::CsmModel & csm_model);
   
+// Fit a CSM linescan model with distortion to an arbitrary linescan camera, by
+// sampling its camera centers and sight vectors on a grid of pixels. The
+// number of rows and columns of the grid are at most the given values.
+void fitCsmLinescanToCamera(vw::CamPtr exact_cam,
+                            std::string const& sensor_id, 
+                            vw::cartography::Datum const& datum,
+                            vw::Vector2i const& image_size,
+                            int max_num_rows, int max_num_cols,
+                            // Output
+                            asp::CsmModel & csm_model);
+
+// The maximum error, in pixels, of projecting into a camera the points where
+// the rays of the exact camera meet the datum, for a grid of image pixels.
+// Returns infinity if there are no valid samples. The exact camera is used
+// from one thread, while the given camera is used from several, so it
+// must be thread-safe, as CSM cameras are.
+double csmFitPixelError(vw::CamPtr exact_cam,
+                        vw::cartography::Datum const& datum,
+                        vw::Vector2i const& image_size,
+                        int num_pixel_samples,
+                        vw::camera::CameraModel const& cam);
+  
 // Create pixel samples. Make sure to sample the pixel at (width - 1, height - 1).
 void createPixelSamples(int width, int height, int num_pixel_samples,
                         std::vector<vw::Vector2> & pix_samples);
@@ -417,7 +417,11 @@ void populateCsmLinescan(double first_line_time, double dt_line,
   ls_model->m_t0Quat = t0_quat;
   ls_model->m_dtQuat = dt_quat;
   ls_model->m_quaternions.resize(ls_model->m_numQuaternions);
-  for (size_t index = 0; index < cam2world.size(); index++) {
+  // Each sample is converted on its own, so this can be done in parallel
+  // for the long orbital segments produced by sat_sim.
+  int num_quat = cam2world.size();
+  #pragma omp parallel for schedule(static) if (num_quat > 10000)
+  for (int index = 0; index < num_quat; index++) {
     auto c2w = cam2world[index];
     double x, y, z, w;
     asp::matrixToQuaternion(c2w, x, y, z, w);
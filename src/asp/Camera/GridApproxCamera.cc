@@ -0,0 +1,306 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file GridApproxCamera.cc
+
+#include <asp/Camera/GridApproxCamera.h>
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <queue>
+#include <utility>
+
+using namespace vw;
+
+namespace asp {
+
+GridApproxCameraModel::GridApproxCameraModel(vw::CamPtr exact_cam,
+                                             vw::cartography::GeoReference const& georef,
+                                             vw::BBox2 const& point_box,
+                                             double min_height, double max_height,
+                                             double max_pixel_error,
+                                             int max_grid_size):
+  m_exact_cam(exact_cam), m_georef(georef), m_point_box(point_box),
+  m_min_height(min_height), m_max_height(max_height), m_valid(false),
+  m_max_error(std::numeric_limits<double>::quiet_NaN()),
+  m_nx(0), m_ny(0), m_nz(0), m_dx(0), m_dy(0), m_dz(0), m_lattice_res(0) {
+
+  if (!m_exact_cam)
+    vw_throw(ArgumentErr() << "GridApproxCameraModel: The exact camera is not set.\n");
+  if (m_point_box.empty() || m_point_box.width() <= 0 || m_point_box.height() <= 0)
+    vw_throw(ArgumentErr() << "GridApproxCameraModel: Expecting a non-empty region.\n");
+  if (max_pixel_error <= 0)
+    vw_throw(ArgumentErr() << "GridApproxCameraModel: Expecting a positive pixel error.\n");
+  if (!(m_max_height > m_min_height))
+    m_max_height = m_min_height + 1.0; // so that the height cell is not empty
+
+  // Start with a coarse grid, with cells that are roughly square in
+  // the ground plane
+  m_nx = 8; m_ny = 8;
+  double ratio = m_point_box.width() / m_point_box.height();
+  if (ratio > 1.0)
+    m_ny = std::max(1, int(round(m_nx / ratio)));
+  else
+    m_nx = std::max(1, int(round(m_ny * ratio)));
+  m_dx = m_point_box.width()  / m_nx;
+  m_dy = m_point_box.height() / m_ny;
+
+  // The projection changes smoothly with height, so the same height cells
+  // are used everywhere. Refine them at the coarse grid nodes.
+  const int max_nz = 32;
+  int nz = 1;
+  double err_z = height_error(nz);
+  while (err_z > max_pixel_error && 2 * nz <= max_nz) {
+    nz *= 2;
+    err_z = height_error(nz);
+  }
+
+  // Split the cells at most this many times, so that they are no smaller
+  // than 1/max_grid_size of the box
+  int max_depth = 0;
+  while ((std::max(m_nx, m_ny) << (max_depth + 1)) <= max_grid_size)
+    max_depth++;
+
+  int num_leaves = 0;
+  double exact_fraction = 1.0;
+  m_max_error = err_z;
+  if (err_z <= max_pixel_error) {
+    m_nz = nz;
+    m_dz = (m_max_height - m_min_height) / m_nz;
+    double err_xy = build_tree(max_pixel_error, max_depth, num_leaves, exact_fraction);
+    m_max_error = std::max(err_z, err_xy);
+    m_valid = (exact_fraction < 1.0);
+  }
+
+  if (m_valid) {
+    vw_out() << "Approximating the camera projection with " << num_leaves
+             << " cells, refined from a grid of " << m_nx << " x " << m_ny
+             << ", and " << m_nz << " height cells. Max error at test points: "
+             << m_max_error << " pixels.\n";
+    if (exact_fraction > 0.0)
+      vw_out() << "Using the exact camera for " << 100.0 * exact_fraction
+               << "% of the region, where the accuracy was not reached.\n";
+  } else {
+    vw_out(WarningMessage) << "Could not approximate the camera projection to within "
+                           << max_pixel_error << " pixels (reached " << m_max_error
+                           << " pixels). Using the exact camera.\n";
+    m_cells.clear();
+    m_table.clear();
+  }
+}
+
+Vector2 GridApproxCameraModel::exact_pixel(double x, double y, double height) const {
+  Vector2 lonlat = m_georef.point_to_lonlat(Vector2(x, y));
+  Vector3 xyz = m_georef.datum().geodetic_to_cartesian(Vector3(lonlat[0], lonlat[1], height));
+  try {
+    return m_exact_cam->point_to_pixel(xyz);
+  } catch (...) {
+  }
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  return Vector2(nan, nan);
+}
+
+double GridApproxCameraModel::height_error(int nz) const {
+
+  double dz = (m_max_height - m_min_height) / nz;
+  double err = 0.0;
+  for (int j = 0; j <= m_ny; j++) {
+    double y = m_point_box.min().y() + j * m_dy;
+    for (int i = 0; i <= m_nx; i++) {
+      double x = m_point_box.min().x() + i * m_dx;
+      Vector2 prev = exact_pixel(x, y, m_min_height);
+      for (int k = 0; k < nz; k++) {
+        Vector2 mid  = exact_pixel(x, y, m_min_height + (k + 0.5) * dz);
+        Vector2 next = exact_pixel(x, y, m_min_height + (k + 1) * dz);
+        Vector2 diff = mid - 0.5 * (prev + next);
+        if (!std::isnan(diff[0]) && !std::isnan(diff[1]))
+          err = std::max(err, norm_2(diff));
+        prev = next;
+      }
+    }
+  }
+
+  return err;
+}
+
+double GridApproxCameraModel::build_tree(double max_pixel_error, int max_depth,
+                                         int & num_leaves, double & exact_fraction) {
+
+  m_lattice_res = 2 << max_depth;
+  m_cells.clear();
+  m_table.clear();
+
+  // The exact pixels at each lattice point are found once, as they are
+  // shared by neighboring cells, and the midpoints of a cell become the
+  // corners of its children.
+  std::map<std::pair<int, int>, size_t> lattice;
+  auto sample = [&](int I, int J) -> size_t {
+    auto it = lattice.find(std::make_pair(I, J));
+    if (it != lattice.end())
+      return it->second;
+    size_t offset = m_table.size();
+    double x = m_point_box.min().x() + I * m_dx / m_lattice_res;
+    double y = m_point_box.min().y() + J * m_dy / m_lattice_res;
+    for (int k = 0; k <= m_nz; k++)
+      m_table.push_back(exact_pixel(x, y, m_min_height + k * m_dz));
+    lattice[std::make_pair(I, J)] = offset;
+    return offset;
+  };
+
+  // A cell to process, with its lower corner and size in lattice steps
+  struct Pending {
+    int cell, I, J, size, depth;
+  };
+  std::queue<Pending> pending;
+  for (int j = 0; j < m_ny; j++) {
+    for (int i = 0; i < m_nx; i++) {
+      Pending p = {int(m_cells.size()), i * m_lattice_res, j * m_lattice_res,
+                   m_lattice_res, 0};
+      pending.push(p);
+      m_cells.push_back(Cell());
+    }
+  }
+
+  // The midpoints of the edges and the center, as fractions of the cell
+  const int num_mid = 5;
+  const double mid_a[num_mid] = {0.5, 0.0, 1.0, 0.5, 0.5};
+  const double mid_b[num_mid] = {0.0, 0.5, 0.5, 1.0, 0.5};
+
+  double max_err = 0.0, exact_area = 0.0;
+  num_leaves = 0;
+  while (!pending.empty()) {
+    Pending p = pending.front();
+    pending.pop();
+
+    int s = p.size, h = p.size / 2;
+    size_t corners[4] = {sample(p.I, p.J),     sample(p.I + s, p.J),
+                         sample(p.I, p.J + s), sample(p.I + s, p.J + s)};
+
+    // Compare the exact pixels at the midpoints with those interpolated
+    // from the corners. Failed projections are not counted.
+    double err = 0.0;
+    for (int m = 0; m < num_mid; m++) {
+      size_t mid = sample(p.I + int(mid_a[m] * s), p.J + int(mid_b[m] * s));
+      double a = mid_a[m], b = mid_b[m];
+      for (int k = 0; k <= m_nz; k++) {
+        Vector2 approx
+          = (1.0 - b) * ((1.0 - a) * m_table[corners[0] + k] + a * m_table[corners[1] + k])
+          + b         * ((1.0 - a) * m_table[corners[2] + k] + a * m_table[corners[3] + k]);
+        Vector2 diff = m_table[mid + k] - approx;
+        if (!std::isnan(diff[0]) && !std::isnan(diff[1]))
+          err = std::max(err, norm_2(diff));
+      }
+    }
+
+    Cell & cell = m_cells[p.cell];
+    cell.child = -1;
+    cell.exact = false;
+    for (int c = 0; c < 4; c++)
+      cell.corners[c] = corners[c];
+
+    if (err <= max_pixel_error) {
+      max_err = std::max(max_err, err);
+      num_leaves++;
+    } else if (p.depth < max_depth) {
+      // Split in four. This invalidates the reference to the cell.
+      int child = m_cells.size();
+      cell.child = child;
+      for (int q = 0; q < 4; q++) {
+        Pending c = {child + q, p.I + (q % 2) * h, p.J + (q / 2) * h, h, p.depth + 1};
+        pending.push(c);
+        m_cells.push_back(Cell());
+      }
+    } else {
+      cell.exact = true;
+      exact_area += double(s) * s;
+      num_leaves++;
+    }
+  }
+
+  exact_fraction = exact_area / (double(m_nx) * m_ny * m_lattice_res * m_lattice_res);
+  return max_err;
+}
+
+bool GridApproxCameraModel::interp(Vector2 const& proj_pt, double height,
+                                   Vector2 & pix) const {
+
+  double u = (proj_pt.x() - m_point_box.min().x()) / m_dx;
+  double v = (proj_pt.y() - m_point_box.min().y()) / m_dy;
+  double w = (height - m_min_height) / m_dz;
+
+  // This also rejects NaN
+  if (!(u >= 0 && u <= m_nx && v >= 0 && v <= m_ny && w >= 0 && w <= m_nz))
+    return false;
+
+  int i = std::min(int(u), m_nx - 1);
+  int j = std::min(int(v), m_ny - 1);
+  int k = std::min(int(w), m_nz - 1);
+  double a = u - i, b = v - j, c = w - k;
+
+  // Descend to the leaf, with a and b the position within the current cell
+  int cell = j * m_nx + i;
+  while (m_cells[cell].child >= 0) {
+    int qa = (a >= 0.5), qb = (b >= 0.5);
+    a = 2.0 * a - qa;
+    b = 2.0 * b - qb;
+    cell = m_cells[cell].child + 2 * qb + qa;
+  }
+
+  Cell const& leaf = m_cells[cell];
+  if (leaf.exact)
+    return false;
+
+  Vector2 p[2];
+  for (int l = 0; l < 2; l++)
+    p[l] = (1.0 - b) * ((1.0 - a) * m_table[leaf.corners[0] + k + l]
+                        + a * m_table[leaf.corners[1] + k + l])
+      + b * ((1.0 - a) * m_table[leaf.corners[2] + k + l]
+             + a * m_table[leaf.corners[3] + k + l]);
+  pix = (1.0 - c) * p[0] + c * p[1];
+
+  // A failed node makes the result NaN
+  return !std::isnan(pix[0]) && !std::isnan(pix[1]);
+}
+
+Vector2 GridApproxCameraModel::point_to_pixel(Vector3 const& point) const {
+
+  if (m_valid) {
+    Vector3 llh = m_georef.datum().cartesian_to_geodetic(point);
+    Vector2 proj_pt = m_georef.lonlat_to_point(Vector2(llh[0], llh[1]));
+
+    // For a longitude-latitude georeference the box may not be in [-180, 180]
+    if (!m_georef.is_projected() && !m_point_box.contains(proj_pt)) {
+      if (proj_pt.x() < m_point_box.min().x())
+        proj_pt.x() += 360.0;
+      else if (proj_pt.x() > m_point_box.max().x())
+        proj_pt.x() -= 360.0;
+    }
+
+    Vector2 pix;
+    if (interp(proj_pt, llh[2], pix))
+      return pix;
+  }
+
+  return m_exact_cam->point_to_pixel(point);
+}
+
+} // end namespace asp
@@ -0,0 +1,134 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file GridApproxCamera.h
+/// A camera model which approximates point_to_pixel() of another camera by
+/// interpolating in a table of exact values over a ground region. This helps
+/// with linescan cameras, for which point_to_pixel() is an iterative search.
+
+#ifndef __ASP_CAMERA_GRID_APPROX_CAMERA_H__
+#define __ASP_CAMERA_GRID_APPROX_CAMERA_H__
+
+#include <vw/Camera/CameraModel.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Math/BBox.h>
+
+#include <vector>
+
+namespace asp {
+
+class GridApproxCameraModel: public vw::camera::CameraModel {
+
+public:
+
+  // Tabulate point_to_pixel() of the exact camera over the given box, in the
+  // projected coordinates of the georeference, and at heights above the
+  // datum in the given range. The box is split into a coarse grid of cells,
+  // and each cell is split further, as a quadtree, only where interpolating
+  // from its corners differs from the exact camera by more than
+  // max_pixel_error at the cell center and edge midpoints. Cells are not
+  // made smaller than 1/max_grid_size of the box. Where the accuracy is not
+  // reached at that size, the exact camera is used.
+  GridApproxCameraModel(vw::CamPtr exact_cam,
+                        vw::cartography::GeoReference const& georef,
+                        vw::BBox2 const& point_box,
+                        double min_height, double max_height,
+                        double max_pixel_error,
+                        int max_grid_size = 512);
+
+  virtual ~GridApproxCameraModel() {}
+  virtual std::string type() const { return "GridApprox"; }
+
+  // Interpolate in the table. Points outside of the tabulated region, or
+  // near nodes where the exact camera failed, use the exact camera.
+  virtual vw::Vector2 point_to_pixel(vw::Vector3 const& point) const;
+
+  // These are not approximated
+  virtual vw::Vector3 pixel_to_vector(vw::Vector2 const& pix) const {
+    return m_exact_cam->pixel_to_vector(pix);
+  }
+  virtual vw::Vector3 camera_center(vw::Vector2 const& pix) const {
+    return m_exact_cam->camera_center(pix);
+  }
+  virtual vw::Quaternion<double> camera_pose(vw::Vector2 const& pix) const {
+    return m_exact_cam->camera_pose(pix);
+  }
+
+  // If false, the accuracy could not be reached anywhere and the table is
+  // not used
+  bool is_valid() const { return m_valid; }
+
+  // The largest interpolation error at the test locations
+  double max_error() const { return m_max_error; }
+
+  vw::CamPtr exact_camera() const { return m_exact_cam; }
+
+private:
+
+  vw::CamPtr m_exact_cam;
+  vw::cartography::GeoReference m_georef;
+  vw::BBox2 m_point_box;
+  double m_min_height, m_max_height;
+  bool m_valid;
+  double m_max_error;
+
+  // Number of coarse cells in x, y, and height, and their sizes
+  int m_nx, m_ny, m_nz;
+  double m_dx, m_dy, m_dz;
+
+  // The quadtree corners are on a lattice with this many steps per side
+  // of a coarse cell. The finest cells have two steps per side, so that
+  // their midpoints are on the lattice as well.
+  int m_lattice_res;
+
+  // A cell of the quadtree. The coarse cells come first, row after row.
+  // A split cell has its four children stored together, starting at
+  // 'child', in the order: low x and low y, high x and low y, low x and
+  // high y, high x and high y. A leaf has the offsets in m_table of its
+  // corners, in the same order.
+  struct Cell {
+    int child;
+    bool exact;     // if true, the accuracy was not reached here
+    size_t corners[4];
+  };
+  std::vector<Cell> m_cells;
+
+  // Exact pixels at the lattice points in use, at each of the m_nz + 1
+  // heights. Failed projections are stored as NaN.
+  std::vector<vw::Vector2> m_table;
+
+  // Build the quadtree, with cells split at most max_depth times. Return
+  // the largest interpolation error in the accepted cells, the number of
+  // leaves, and the fraction of the region where the exact camera is used.
+  double build_tree(double max_pixel_error, int max_depth,
+                    int & num_leaves, double & exact_fraction);
+
+  // The largest error when interpolating linearly in height between the
+  // coarse grid nodes with the given number of height cells
+  double height_error(int nz) const;
+
+  // Interpolate at the given projected point and height. Return false if
+  // outside the table or next to a failed node.
+  bool interp(vw::Vector2 const& proj_pt, double height, vw::Vector2 & pix) const;
+
+  // The exact pixel at the given projected point and height, or NaN
+  vw::Vector2 exact_pixel(double x, double y, double height) const;
+};
+
+} // end namespace asp
+
+#endif // __ASP_CAMERA_GRID_APPROX_CAMERA_H__
@@ -33,6 +33,8 @@
 #include <vw/Core/Exception.h>
 #include <vw/Camera/CameraImage.h>
 
+#include <atomic>
+
 namespace asp {
 
 // An error function minimizing the error of projecting an xyz point
@@ -165,15 +167,70 @@ void updateLsModelTriPt(double const * const * parameters,
   P.z = parameters[param_shift][2];
 }  
 
+// Each thread keeps a copy of each linescan model it evaluates residuals for,
+// together with the range of samples it last modified. Copying the whole model
+// for each residual evaluation is expensive, as it has all the positions,
+// velocities, and quaternions. Instead, only the samples changed by the
+// previous evaluation are restored from the original model. The copies are
+// invalid when the generation changes.
+struct LsModelCopy {
+  int generation = -1;
+  UsgsAstroLsSensorModel cam;
+  int begQuatIndex = 0, endQuatIndex = 0, begPosIndex = 0, endPosIndex = 0;
+};
+
+std::atomic<int> g_ls_model_cache_generation(0);
+
+void resetLsModelCache() {
+  g_ls_model_cache_generation++;
+}
+
+// Get this thread's copy of the given model. It agrees with the model
+// everywhere, except perhaps at the samples in the given range, which the
+// caller will overwrite.
+UsgsAstroLsSensorModel & lsModelCopy(UsgsAstroLsSensorModel const* ls_model,
+                                     int begQuatIndex, int endQuatIndex,
+                                     int begPosIndex, int endPosIndex) {
+
+  thread_local std::map<UsgsAstroLsSensorModel const*, LsModelCopy> copies;
+
+  int generation = g_ls_model_cache_generation;
+  LsModelCopy & copy = copies[ls_model];
+  if (copy.generation != generation) {
+    copy.cam = *ls_model;
+    copy.generation = generation;
+  } else {
+    // Restore the samples modified last time
+    for (int qi = copy.begQuatIndex; qi < copy.endQuatIndex; qi++) {
+      for (int coord = 0; coord < NUM_QUAT_PARAMS; coord++)
+        copy.cam.m_quaternions[NUM_QUAT_PARAMS * qi + coord]
+          = ls_model->m_quaternions[NUM_QUAT_PARAMS * qi + coord];
+    }
+    for (int pi = copy.begPosIndex; pi < copy.endPosIndex; pi++) {
+      for (int coord = 0; coord < NUM_XYZ_PARAMS; coord++)
+        copy.cam.m_positions[NUM_XYZ_PARAMS * pi + coord]
+          = ls_model->m_positions[NUM_XYZ_PARAMS * pi + coord];
+    }
+  }
+
+  copy.begQuatIndex = begQuatIndex; copy.endQuatIndex = endQuatIndex;
+  copy.begPosIndex  = begPosIndex;  copy.endPosIndex  = endPosIndex;
+
+  return copy.cam;
+}
+
 // See the documentation higher up in the file.
 bool LsPixelReprojErr::operator()(double const * const * parameters, 
                                   double * residuals) const {
 
   try {
-    // Make a copy of the model, as we will update quaternion and position
-    // values that are being modified now. This may be expensive.
+    // Get a copy of the model, as we will update quaternion and position
+    // values that are being modified now. This copy is owned by the current
+    // thread and reused, to avoid copying the whole model each time.
     // Update the shift too.
-    UsgsAstroLsSensorModel cam = *m_ls_model;
+    UsgsAstroLsSensorModel & cam
+      = lsModelCopy(m_ls_model, m_begQuatIndex, m_endQuatIndex,
+                    m_begPosIndex, m_endPosIndex);
     int shift = 0;
     csm::EcefCoord P;
     updateLsModelTriPt(parameters, m_begQuatIndex, m_endQuatIndex,
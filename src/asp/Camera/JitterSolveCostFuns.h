@@ -64,6 +64,11 @@ void updateLsModelTriPt(double const * const * parameters,
                         UsgsAstroLsSensorModel & cam,
                         csm::EcefCoord & P);
 
+// Invalidate the per-thread copies of the linescan models used when evaluating
+// the reprojection errors. Must be called when the models are changed
+// outside of the optimizer, such as after updating them with the solution.
+void resetLsModelCache();
+
 // Add the linescan model reprojection error to the cost function
 void addLsReprojectionErr(asp::BaBaseOptions const & opt,
                           UsgsAstroLsSensorModel * ls_model,
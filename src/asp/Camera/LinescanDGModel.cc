@@ -23,14 +23,298 @@
 #include <asp/Camera/Covariance.h>
 
 #include <vw/Camera/OrbitalCorrections.h>
+#include <vw/Core/Thread.h>
 
 #include <usgscsm/UsgsAstroLsSensorModel.h>
 #include <usgscsm/Utilities.h>
 
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
 using namespace vw;
+namespace fs = boost::filesystem;
 
 namespace asp {
 
+// Spacing of the lookup tables, in lines. See setLineTableStep().
+static std::atomic<int> g_dg_line_table_step(8);
+
+// Each set of tables gets a new id, so the memoized poses below are never
+// mistaken for those of another camera or of an older version of this one.
+static std::atomic<uint64_t> g_dg_table_id(0);
+
+// The pose at the last line looked up by this thread. See linePose().
+struct DgLinePose {
+  uint64_t id = 0;
+  double line = 0.0;
+  vw::Vector3 ctr;
+  vw::Matrix3x3 rot;
+};
+thread_local DgLinePose t_dg_line_pose;
+
+// Find the table node to the left of x and the fraction past it. Clamp the
+// node so that values outside the table are linearly extrapolated. Written
+// without branches, with NaN mapping to the first node.
+inline void tableNode(double x, double x0, double inv_step, int num,
+                      int & i, double & w) {
+  double s = (x - x0) * inv_step;
+  i = int(std::max(0.0, std::min(s, double(num - 2))));
+  w = s - i;
+}
+
+// Visit a few values of the CSM model data, to detect if it was changed after
+// the tables were made. Changes, such as applying a transform or solving for
+// jitter, modify all of the samples, so this is sufficient.
+template<class Visitor>
+void visitCsmFingerprint(UsgsAstroLsSensorModel const* ls, Visitor & visit) {
+  visit(ls->m_t0Ephem); visit(ls->m_dtEphem);
+  visit(ls->m_t0Quat);  visit(ls->m_dtQuat);
+  visit(ls->m_positions.size()); visit(ls->m_quaternions.size());
+  std::vector<double> const* vecs[5] = {&ls->m_positions, &ls->m_velocities,
+                                        &ls->m_quaternions, &ls->m_intTimeStartTimes,
+                                        &ls->m_intTimes};
+  for (int v = 0; v < 5; v++) {
+    auto const& a = *vecs[v];
+    if (a.empty())
+      continue;
+    visit(a.front());
+    visit(a[a.size()/2]);
+    visit(a.back());
+  }
+  // The adjustments applied on top of the above, as in usgscsm
+  for (size_t it = 0; it < ls->m_currentParameterValue.size(); it++)
+    visit(ls->m_currentParameterValue[it]);
+  // The intrinsics, which the rays made from the tables depend on
+  visit(ls->m_focalLength); visit(ls->m_zDirection);
+  visit(ls->m_detectorSampleOrigin); visit(ls->m_detectorLineOrigin);
+  visit(ls->m_startingDetectorSample); visit(ls->m_startingDetectorLine);
+  visit(ls->m_detectorSampleSumming); visit(ls->m_detectorLineSumming);
+  for (int it = 0; it < 3; it++) {
+    visit(ls->m_iTransS[it]);
+    visit(ls->m_iTransL[it]);
+  }
+  visit(ls->m_opticalDistCoeffs.size());
+  for (size_t it = 0; it < ls->m_opticalDistCoeffs.size(); it++)
+    visit(ls->m_opticalDistCoeffs[it]);
+}
+
+// See setDgXmlCacheDir()
+static vw::Mutex g_dg_cache_mutex;
+static std::string g_dg_cache_dir;
+
+// The cache holds, in binary, a magic string, the XML path, size, and
+// modification time, then the values parsed from the XML file. It is used
+// only if the XML file did not change.
+const std::string DG_CACHE_MAGIC = "ASPDGXC1";
+
+// Read or write the cache. The same code does both, so the two cannot get
+// out of sync. A failed read sets the fail bit of the input stream.
+struct DgCacheStream {
+  std::istream * in;
+  std::ostream * out;
+  DgCacheStream(std::istream * in, std::ostream * out): in(in), out(out) {}
+
+  bool good() const { return in ? bool(*in) : bool(*out); }
+
+  void bytes(void * data, std::uint64_t len) {
+    if (in)
+      in->read(static_cast<char*>(data), len);
+    else
+      out->write(static_cast<const char*>(data), len);
+  }
+
+  // Check a length just read, to not allocate memory based on a bad file
+  bool goodLen(std::uint64_t len) {
+    if (in && (!*in || len > (1ULL << 30))) {
+      in->setstate(std::ios::failbit);
+      return false;
+    }
+    return true;
+  }
+
+  void operator()(double & val)        { bytes(&val, sizeof(val)); }
+  void operator()(int & val)           { bytes(&val, sizeof(val)); }
+  void operator()(std::uint64_t & val) { bytes(&val, sizeof(val)); }
+
+  void operator()(std::string & str) {
+    std::uint64_t len = str.size();
+    (*this)(len);
+    if (!goodLen(len))
+      return;
+    str.resize(len);
+    if (len > 0)
+      bytes(&str[0], len);
+  }
+
+  template<class T>
+  void operator()(std::pair<T, T> & val) {
+    (*this)(val.first);
+    (*this)(val.second);
+  }
+
+  template<class T>
+  void operator()(std::vector<T> & vec) {
+    std::uint64_t len = vec.size();
+    (*this)(len);
+    if (!goodLen(len))
+      return;
+    vec.resize(len);
+    for (size_t it = 0; it < vec.size(); it++)
+      (*this)(vec[it]);
+  }
+
+  template<class T, int N>
+  void operator()(vw::Vector<T, N> & vec) {
+    std::uint64_t len = vec.size();
+    (*this)(len);
+    if (!goodLen(len))
+      return;
+    if (in && N != 0 && len != std::uint64_t(N)) {
+      in->setstate(std::ios::failbit);
+      return;
+    }
+    vec.set_size(len);
+    for (size_t it = 0; it < vec.size(); it++)
+      (*this)(vec[it]);
+  }
+
+  void operator()(vw::Quat & q) {
+    double w = q.w(), x = q.x(), y = q.y(), z = q.z();
+    (*this)(w); (*this)(x); (*this)(y); (*this)(z);
+    if (in)
+      q = vw::Quat(w, x, y, z);
+  }
+};
+
+// The values parsed from a DG XML file which are used to create the camera
+void dgCacheFields(DgCacheStream & ar, GeometricXML & geo, AttitudeXML & att,
+                   EphemerisXML & eph, ImageXML & img, vw::BBox3 & bbox) {
+  ar(geo.principal_distance);   ar(geo.optical_polyorder);
+  ar(geo.optical_a);            ar(geo.optical_b);
+  ar(geo.perspective_center);   ar(geo.camera_attitude);
+  ar(geo.detector_origin);      ar(geo.detector_rotation);
+  ar(geo.detector_pixel_pitch);
+  ar(att.start_time);           ar(att.time_interval);
+  ar(att.satellite_quat_vec);   ar(att.satellite_quat_cov);
+  ar(eph.start_time);           ar(eph.time_interval);
+  ar(eph.satellite_position_vec); ar(eph.satellite_pos_cov);
+  ar(eph.velocity_vec);
+  ar(img.tlc_start_time);       ar(img.first_line_start_time);
+  ar(img.tlc_vec);              ar(img.sat_id);
+  ar(img.band_id);              ar(img.scan_direction);
+  ar(img.tdi);                  ar(img.tdi_multi);
+  ar(img.avg_line_rate);        ar(img.image_size);
+  ar(img.generation_time);      ar(img.image_descriptor);
+  ar(bbox.min());               ar(bbox.max());
+}
+
+void setDgXmlCacheDir(std::string const& dir) {
+  vw::Mutex::Lock lock(g_dg_cache_mutex);
+  g_dg_cache_dir = dir;
+}
+
+// The cache file for a DG XML file. Empty if there is no cache directory.
+std::string dgCacheFile(std::string const& xml_path) {
+  std::string dir;
+  {
+    vw::Mutex::Lock lock(g_dg_cache_mutex);
+    dir = g_dg_cache_dir;
+  }
+  if (dir.empty())
+    return "";
+
+  // Different XML files can have the same name, so add a hash of the full path
+  std::string full_path = fs::absolute(xml_path).string();
+  std::ostringstream os;
+  os << std::hex << std::hash<std::string>()(full_path);
+  return dir + "/" + fs::path(xml_path).stem().string() + "-" + os.str() + ".dgcache";
+}
+
+// Read the values parsed from the XML file from the cache, if the cache
+// exists and the XML file did not change since the cache was written.
+bool readDgXmlCache(std::string const& xml_path, GeometricXML & geo,
+                    AttitudeXML & att, EphemerisXML & eph, ImageXML & img,
+                    vw::BBox3 & bbox) {
+
+  std::string cache_file = dgCacheFile(xml_path);
+  if (cache_file.empty() || !fs::exists(cache_file))
+    return false;
+
+  // Read into copies, so the outputs are untouched on failure
+  GeometricXML geo_c;
+  AttitudeXML  att_c;
+  EphemerisXML eph_c;
+  ImageXML     img_c;
+  vw::BBox3    bbox_c;
+  try {
+    std::ifstream ifs(cache_file.c_str(), std::ios::binary);
+    DgCacheStream ar(&ifs, NULL);
+    std::string magic, path;
+    std::uint64_t xml_size = 0, xml_time = 0;
+    ar(magic); ar(path); ar(xml_size); ar(xml_time);
+    if (!ar.good() || magic != DG_CACHE_MAGIC ||
+        path != fs::absolute(xml_path).string() ||
+        xml_size != std::uint64_t(fs::file_size(xml_path)) ||
+        xml_time != std::uint64_t(fs::last_write_time(xml_path)))
+      return false;
+    dgCacheFields(ar, geo_c, att_c, eph_c, img_c, bbox_c);
+    if (!ar.good())
+      return false;
+  } catch (...) {
+    // A bad cache file is not an error. The XML file will be parsed instead.
+    return false;
+  }
+
+  geo = geo_c; att = att_c; eph = eph_c; img = img_c; bbox = bbox_c;
+  return true;
+}
+
+void writeDgXmlCache(std::string const& xml_path, GeometricXML & geo,
+                     AttitudeXML & att, EphemerisXML & eph, ImageXML & img,
+                     vw::BBox3 & bbox) {
+
+  std::string cache_file = dgCacheFile(xml_path);
+  if (cache_file.empty())
+    return;
+
+  // Write to a temporary file unique to this process and thread, then rename,
+  // so a partially written cache is never read by the other stereo processes.
+  static std::atomic<int> count(0);
+  std::ostringstream os;
+  os << cache_file << ".tmp" << getpid() << "_" << count++;
+  std::string tmp_file = os.str();
+
+  try {
+    fs::create_directories(fs::path(cache_file).parent_path());
+    {
+      std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+      DgCacheStream ar(NULL, &ofs);
+      std::string magic = DG_CACHE_MAGIC;
+      std::string path = fs::absolute(xml_path).string();
+      std::uint64_t xml_size = fs::file_size(xml_path);
+      std::uint64_t xml_time = fs::last_write_time(xml_path);
+      ar(magic); ar(path); ar(xml_size); ar(xml_time);
+      dgCacheFields(ar, geo, att, eph, img, bbox);
+      if (!ar.good())
+        vw_throw(IOErr() << "Failed writing: " << tmp_file);
+    }
+    fs::rename(tmp_file, cache_file);
+  } catch (std::exception const& e) {
+    // The cache is only an optimization
+    vw_out(WarningMessage) << "Could not write the camera cache file " << cache_file
+                           << ". " << e.what() << "\n";
+    boost::system::error_code ec;
+    fs::remove(tmp_file, ec);
+  }
+}
+
 // -----------------------------------------------------------------
 // LinescanDGModel supporting functions
 
@@ -54,16 +338,21 @@ vw::CamPtr load_dg_camera_model_from_xml(std::string const& path) {
   AttitudeXML  att;
   EphemerisXML eph;
   ImageXML     img;
-  RPCXML       rpc;
+  vw::BBox3    bbox;
 
-  try {
-    read_xml(path, geo, att, eph, img, rpc);
-  } catch (const std::exception& e){
-    vw::vw_throw(vw::ArgumentErr() << "Invalid Digital Globe XML file: " << path << ". "
-                 << "If you are not using Digital Globe images, you may "
-                 << "need to specify the session type, such as -t rpc, "
-                 << "-t rpcmaprpc, -t aster, etc.\n"
-		 << e.what() << "\n");
+  if (!readDgXmlCache(path, geo, att, eph, img, bbox)) {
+    RPCXML rpc;
+    try {
+      read_xml(path, geo, att, eph, img, rpc);
+    } catch (const std::exception& e){
+      vw::vw_throw(vw::ArgumentErr() << "Invalid Digital Globe XML file: " << path << ". "
+                   << "If you are not using Digital Globe images, you may "
+                   << "need to specify the session type, such as -t rpc, "
+                   << "-t rpcmaprpc, -t aster, etc.\n"
+                   << e.what() << "\n");
+    }
+    bbox = rpc.get_lon_lat_height_box();
+    writeDgXmlCache(path, geo, att, eph, img, bbox);
   }
 
   // For WV, only Stereo1B and Basic1B products are supported. Users
@@ -84,7 +373,6 @@ vw::CamPtr load_dg_camera_model_from_xml(std::string const& path) {
   // corrections.
   double local_earth_radius = vw::DEFAULT_EARTH_RADIUS;
   double mean_ground_elevation = vw::DEFAULT_SURFACE_ELEVATION;
-  vw::BBox3 bbox = rpc.get_lon_lat_height_box();
   if (!bbox.empty()) {
     mean_ground_elevation = (bbox.min()[2] + bbox.max()[2]) / 2.0;
     double lon = (bbox.min()[0] + bbox.max()[0])/2.0;
@@ -396,10 +684,180 @@ void DGCameraModel::populateCsmModel() {
   // This can only happen after the model is fully initialized,
   // as need to create rays from the camera center to the ground.
   orbitalCorrections();
+
+  // Lookup tables of the final model
+  updateLineTables();
   
   return;
 }
 
+void DGCameraModel::setLineTableStep(int step) {
+  if (step < 0)
+    vw::vw_throw(vw::ArgumentErr() << "The DG lookup table step must be non-negative.\n");
+  g_dg_line_table_step = step;
+}
+
+// Sample the CSM model at uniformly spaced lines and times. Go one step
+// beyond the image on each side, so the whole image is inside the tables.
+void DGCameraModel::updateLineTables() {
+
+  // Wipe the old tables, so the exact functions are sampled below
+  m_tables = LineTables();
+  int step = g_dg_line_table_step;
+  int num_lines = m_ls_model->m_nLines;
+  if (step <= 0 || num_lines <= 0)
+    return; // the exact CSM code will be used
+
+  int num = (num_lines - 1) / step + 1 + 3; // covers [-step, num_lines - 1 + step]
+  LineTables t;
+  t.num = num;
+  t.line0 = -step;
+  t.inv_line_step = 1.0 / step;
+
+  t.time.resize(num);
+  for (int i = 0; i < num; i++)
+    t.time[i] = get_time_at_line(t.line0 + double(i) * step);
+
+  t.t_beg = std::min(t.time.front(), t.time.back());
+  t.t_end = std::max(t.time.front(), t.time.back());
+  if (!(t.t_end > t.t_beg))
+    return; // degenerate timing, leave without tables
+  t.t0 = t.t_beg;
+  t.dt = (t.t_end - t.t_beg) / (num - 1);
+  t.inv_dt = 1.0 / t.dt;
+
+  t.pos.resize(3 * num);
+  t.vel.resize(3 * num);
+  t.quat.resize(4 * num);
+  for (int i = 0; i < num; i++) {
+    double time = t.t0 + i * t.dt;
+    vw::Vector3 P = get_camera_center_at_time(time);
+    vw::Vector3 V = get_camera_velocity_at_time(time);
+    double q[4];
+    getCsmQuaternions(time, q);
+    // Keep the sign consistent, so that the quaternions can be interpolated
+    if (i > 0) {
+      double const* p = &t.quat[4*(i-1)];
+      if (p[0]*q[0] + p[1]*q[1] + p[2]*q[2] + p[3]*q[3] < 0.0)
+        for (int c = 0; c < 4; c++) q[c] = -q[c];
+    }
+    for (int c = 0; c < 3; c++) {
+      t.pos[3*i + c] = P[c];
+      t.vel[3*i + c] = V[c];
+    }
+    for (int c = 0; c < 4; c++)
+      t.quat[4*i + c] = q[c];
+  }
+
+  auto record = [&t](double val) { t.fingerprint.push_back(val); };
+  visitCsmFingerprint(m_ls_model.get(), record);
+  t.id = ++g_dg_table_id;
+  m_tables = t;
+
+  // Make rays from the tables only if that reproduces CSM
+  m_tables.fast_rays = fastRaysAgree();
+}
+
+// The pose at the given line. Consecutive calls for the same line, as when
+// triangulating or mapprojecting along an image row, reuse the last result.
+void DGCameraModel::linePose(double line, vw::Vector3 & ctr, vw::Matrix3x3 & rot) const {
+  DgLinePose & memo = t_dg_line_pose;
+  if (memo.id == m_tables.id && memo.line == line) {
+    ctr = memo.ctr;
+    rot = memo.rot;
+    return;
+  }
+
+  double time = get_time_at_line(line);
+  ctr = get_camera_center_at_time(time);
+  double q[4];
+  getQuaternions(time, q); // in CSM order (x, y, z, w)
+  rot = vw::Quat(q[3], q[0], q[1], q[2]).rotation_matrix();
+
+  memo.id   = m_tables.id;
+  memo.line = line;
+  memo.ctr  = ctr;
+  memo.rot  = rot;
+}
+
+// Same as in UsgsAstroLsSensorModel::losToEcf(), before the rotation to
+// world coordinates. There is no distortion to remove, as checked in
+// fastRaysAgree().
+vw::Vector3 DGCameraModel::cameraLook(vw::Vector2 const& pix) const {
+  UsgsAstroLsSensorModel const* ls = m_ls_model.get();
+  csm::ImageCoord csm_pix;
+  asp::toCsmPixel(pix, csm_pix);
+
+  // A linescan sensor has one detector line, so only the fraction matters
+  double fractional_line = csm_pix.line - std::floor(csm_pix.line);
+  double det_sample = csm_pix.samp * ls->m_detectorSampleSumming
+    + ls->m_startingDetectorSample;
+  double det_line = fractional_line * ls->m_detectorLineSumming + ls->m_startingDetectorLine;
+
+  // Invert the transform from focal plane to detector coordinates
+  double m11 = ls->m_iTransL[1], m12 = ls->m_iTransL[2];
+  double m21 = ls->m_iTransS[1], m22 = ls->m_iTransS[2];
+  double t1 = det_line   - ls->m_detectorLineOrigin   - ls->m_iTransL[0];
+  double t2 = det_sample - ls->m_detectorSampleOrigin - ls->m_iTransS[0];
+  double det = m11 * m22 - m12 * m21;
+  double x = ( m22 * t1 - m12 * t2) / det;
+  double y = (-m21 * t1 + m11 * t2) / det;
+
+  return vw::Vector3(-x * ls->m_zDirection, -y * ls->m_zDirection, -ls->m_focalLength);
+}
+
+// The tables are accurate but not exact, so compare the rays made with the
+// exact CSM pose. This catches any step of CSM not replicated in cameraLook().
+bool DGCameraModel::fastRaysAgree() const {
+  if (!tablesValid())
+    return false;
+ 
+  UsgsAstroLsSensorModel const* ls = m_ls_model.get();
+  for (size_t it = 0; it < ls->m_opticalDistCoeffs.size(); it++) {
+    if (ls->m_opticalDistCoeffs[it] != 0.0)
+      return false;
+  }
+  for (size_t it = 0; it < ls->m_currentParameterValue.size(); it++) {
+    if (ls->m_currentParameterValue[it] != 0.0)
+      return false;
+  }
+
+  double cols = m_image_size[0], rows = m_image_size[1];
+  double samples[] = {0.0, 0.37 * cols, cols - 1.0};
+  double lines[]   = {0.0, 0.5 * rows + 0.25, rows - 1.5};
+  for (double line: lines) {
+    for (double sample: samples) {
+      vw::Vector2 pix(sample, line);
+      csm::ImageCoord csm_pix;
+      asp::toCsmPixel(pix, csm_pix);
+      double q[4];
+      getCsmQuaternions(m_ls_model->getImageTime(csm_pix), q);
+      vw::Matrix3x3 rot = vw::Quat(q[3], q[0], q[1], q[2]).rotation_matrix();
+      vw::Vector3 fast_dir = normalize(rot * cameraLook(pix));
+      vw::Vector3 dir = m_csm_model->pixel_to_vector(pix);
+      if (!(norm_2(fast_dir - dir) < 1e-10))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+// This is done without memory allocation, as it is invoked for each lookup
+bool DGCameraModel::tablesValid() const {
+  if (m_tables.num < 2)
+    return false;
+  size_t count = 0;
+  bool same = true;
+  auto const& fp = m_tables.fingerprint;
+  auto compare = [&](double val) {
+    same = same && count < fp.size() && fp[count] == val;
+    count++;
+  };
+  visitCsmFingerprint(m_ls_model.get(), compare);
+  return same && count == fp.size();
+}
+
 // Adjust the CSM model to correct for velocity aberration and/or
 // atmospheric refraction.
 // This can only happen after the model is fully initialized,
@@ -460,6 +918,13 @@ void DGCameraModel::orbitalCorrections() {
 // Re-implement base class functions
 // TODO(oalexan1): This must be wiped when no longer inheriting from VW linescan  
 double DGCameraModel::get_time_at_line(double line) const {
+  if (tablesValid()) {
+    int i = 0;
+    double w = 0.0;
+    tableNode(line, m_tables.line0, m_tables.inv_line_step, m_tables.num, i, w);
+    return (1.0 - w) * m_tables.time[i] + w * m_tables.time[i+1];
+  }
+  
   csm::ImageCoord csm_pix;
   vw::Vector2 pix(0, line);
   asp::toCsmPixel(pix, csm_pix);
@@ -483,16 +948,73 @@ double DGCameraModel::get_line_at_time(double time) const {
   return line0 + (line1 - line0) * (time - time0) / (time1 - time0);
 }
 
+// Use cubic Hermite interpolation with the tabulated positions and velocities.
 vw::Vector3 DGCameraModel::get_camera_center_at_time(double time) const {
+  if (time >= m_tables.t_beg && time <= m_tables.t_end && tablesValid()) {
+    int i = 0;
+    double w = 0.0;
+    tableNode(time, m_tables.t0, m_tables.inv_dt, m_tables.num, i, w);
+    double w2 = w * w, w3 = w2 * w, h = m_tables.dt;
+    double h00 = 2.0 * w3 - 3.0 * w2 + 1.0, h10 = (w3 - 2.0 * w2 + w) * h;
+    double h01 = -2.0 * w3 + 3.0 * w2,      h11 = (w3 - w2) * h;
+    double const* p = &m_tables.pos[3*i];
+    double const* v = &m_tables.vel[3*i];
+    vw::Vector3 P;
+    for (int c = 0; c < 3; c++)
+      P[c] = h00 * p[c] + h10 * v[c] + h01 * p[c+3] + h11 * v[c+3];
+    return P;
+  }
+  
   csm::EcefCoord ecef = m_ls_model->getSensorPosition(time);
   return vw::Vector3(ecef.x, ecef.y, ecef.z);
 }
 
 vw::Vector3 DGCameraModel::get_camera_velocity_at_time(double time) const {
+  if (time >= m_tables.t_beg && time <= m_tables.t_end && tablesValid()) {
+    int i = 0;
+    double w = 0.0;
+    tableNode(time, m_tables.t0, m_tables.inv_dt, m_tables.num, i, w);
+    double const* v = &m_tables.vel[3*i];
+    return vw::Vector3((1.0 - w) * v[0] + w * v[3],
+                       (1.0 - w) * v[1] + w * v[4],
+                       (1.0 - w) * v[2] + w * v[5]);
+  }
+  
   csm::EcefVector ecef = m_ls_model->getSensorVelocity(time);
   return vw::Vector3(ecef.x, ecef.y, ecef.z);
 }
 
+// The quaternions, in the CSM order (x, y, z, w), normalized.
+void DGCameraModel::getQuaternions(const double& time, double q[4]) const {
+  if (time >= m_tables.t_beg && time <= m_tables.t_end && tablesValid()) {
+    int i = 0;
+    double w = 0.0;
+    tableNode(time, m_tables.t0, m_tables.inv_dt, m_tables.num, i, w);
+    double const* a = &m_tables.quat[4*i];
+    for (int c = 0; c < 4; c++)
+      q[c] = (1.0 - w) * a[c] + w * a[c+4];
+  } else {
+    getCsmQuaternions(time, q);
+  }
+
+  double norm = std::sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+  for (int c = 0; c < 4; c++)
+    q[c] /= norm;
+}
+
+// Same logic as the quaternion interpolation in UsgsAstroLsSensorModel
+void DGCameraModel::getCsmQuaternions(double time, double q[4]) const {
+  int numQuat = m_ls_model->m_numQuaternions / 4;
+  int nOrder = 8;
+  if (m_ls_model->m_platformFlag == 0)
+    nOrder = 4;
+  int nOrderQuat = nOrder;
+  if (numQuat < 6 && nOrder == 8)
+    nOrderQuat = 4;
+  lagrangeInterp(numQuat, &m_ls_model->m_quaternions[0], m_ls_model->m_t0Quat,
+                 m_ls_model->m_dtQuat, time, 4, nOrderQuat, q);
+}
+
 // Interpolate the satellite position covariance at given pixel
 void DGCameraModel::interpSatellitePosCov(vw::Vector2 const& pix,
                                           double p_cov[SAT_POS_COV_SIZE]) const {
@@ -535,6 +1057,13 @@ void DGCameraModel::interpSatelliteQuatCov(vw::Vector2 const& pix,
 
 // Gives a pointing vector in the world coordinates.
 vw::Vector3 DGCameraModel::pixel_to_vector(vw::Vector2 const& pix) const {
+  if (m_tables.fast_rays && tablesValid()) {
+    vw::Vector3 ctr;
+    vw::Matrix3x3 rot;
+    linePose(pix.y(), ctr, rot);
+    return normalize(rot * cameraLook(pix));
+  }
+
   return m_csm_model->pixel_to_vector(pix);
 }
 
@@ -551,6 +1080,13 @@ vw::Quaternion<double> DGCameraModel::camera_pose(vw::Vector2 const& pix) const
 
 // Gives the camera position in world coordinates.
 vw::Vector3 DGCameraModel::camera_center(vw::Vector2 const& pix) const {
+  if (tablesValid()) {
+    vw::Vector3 ctr;
+    vw::Matrix3x3 rot;
+    linePose(pix.y(), ctr, rot);
+    return ctr;
+  }
+
   return m_csm_model->camera_center(pix);
 }
     
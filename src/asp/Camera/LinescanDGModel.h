@@ -30,6 +30,8 @@
 #include <vw/Cartography/Datum.h>
 #include <vw/Math/EulerAngles.h>
 
+#include <cstdint>
+
 // Forward declaration
 class UsgsAstroLsSensorModel;
 
@@ -99,11 +101,22 @@ namespace asp {
 
     // Interpolate the satellite quaternion covariance at given pixel
     void interpSatelliteQuatCov(vw::Vector2 const& pix, double q_cov[SAT_QUAT_COV_SIZE]) const;
+
+    // Function to interpolate quaternions with the CSM model. Uses the lookup
+    // tables when available.
+    void getQuaternions(const double& time, double q[4]) const;
+
+    // Spacing, in image lines, of the lookup tables of time, position,
+    // velocity, and quaternion built for each new model. The default is 8.
+    // Set to 0 to not create the tables and always use the CSM interpolation.
+    static void setLineTableStep(int step);
+
+    // Re-sample the lookup tables from the current CSM model. Must be called
+    // if m_ls_model is modified in place and the tables are still used. 
+    // Otherwise the change is detected and the exact CSM evaluation is used.
+    void updateLineTables();
     
   private:
-    // Function to interpolate quaternions with the CSM model. This is used
-    // for validation of the CSM model but not in production.  
-    void getQuaternions(const double& time, double q[4]) const;
 
     // Digital Globe implementation using CSM. Eventually this will replace
     // LinescanDGModel. Note that the CSM-based logic does not support velocity
@@ -137,6 +150,42 @@ namespace asp {
     
     // Mean ground elevation and local Earth radius. 
     double m_mean_ground_elevation, m_local_earth_radius;
+
+    // Lookup tables, so that any of the per-line quantities is found with O(1)
+    // work. The time is sampled uniformly in lines and the other quantities
+    // uniformly in time. With the default step the tables agree with the
+    // Lagrange interpolation in CSM to well below a millimeter and a
+    // nano-radian.
+    struct LineTables {
+      int num = 0;                            // number of nodes, 0 if no tables
+      double line0 = 0.0, inv_line_step = 0.0; // nodes in line
+      double t0 = 0.0, dt = 0.0, inv_dt = 0.0; // nodes in time
+      double t_beg = 0.0, t_end = 0.0;        // time range covered
+      std::vector<double> time;               // 1 value per node
+      std::vector<double> pos, vel;           // 3 values per node
+      std::vector<double> quat;               // 4 values per node (x, y, z, w)
+      std::vector<double> fingerprint;        // samples of the CSM model data
+      uint64_t id = 0;                        // unique for each set of tables
+      bool fast_rays = false;                 // if pixel_to_vector() can use them
+    } m_tables;
+
+    // If the tables exist and the CSM model has not changed since they were made
+    bool tablesValid() const;
+
+    // The camera center and camera-to-world rotation for an image line, from
+    // the tables. The last line looked up by each thread is memoized, as
+    // consecutive pixels along an image row share the pose.
+    void linePose(double line, vw::Vector3 & ctr, vw::Matrix3x3 & rot) const;
+
+    // The look direction in the camera frame, as computed by CSM, but without
+    // the sensor pose. Valid only if m_tables.fast_rays is true.
+    vw::Vector3 cameraLook(vw::Vector2 const& pix) const;
+
+    // Check that the rays from the pose and cameraLook() agree with CSM
+    bool fastRaysAgree() const;
+
+    // Exact quaternion interpolation, with the same logic as in CSM
+    void getCsmQuaternions(double time, double q[4]) const;
   };
 
   /// Load a DG camera model from an XML file. This function does not
@@ -144,6 +193,12 @@ namespace asp {
   /// this is done before/after this function is called.
   vw::CamPtr load_dg_camera_model_from_xml(std::string const& path);
 
+  /// Save the values parsed from each DG XML file in this directory, and read
+  /// them from there on later loads, if the XML file did not change. This
+  /// avoids parsing the XML files again in each stereo step and tile. Not
+  /// used if the directory is empty, which is the default.
+  void setDgXmlCacheDir(std::string const& dir);
+
 } //end  namespace asp
 
 #endif//__STEREO_CAMERA_LINESCAN_DG_MODEL_H__
@@ -94,6 +94,15 @@ void write_parallel_cond(std::string              const& filename,
     keywords["ADJUSTMENT_TRANSLATION"] = ost.str();
 
     keywords["DEM_FILE"] = opt.dem_file;
+
+    // If the camera was approximated, stereo can undo the mapprojection
+    // with the same approximation
+    if (opt.approx_camera_model) {
+      std::ostringstream ose;
+      ose.precision(17);
+      ose << opt.approx_max_pixel_error;
+      keywords["APPROX_MAX_PIXEL_ERROR"] = ose.str();
+    }
     
     // Parse keywords from the --mo option.
     asp::parse_append_metadata(opt.metadata, keywords);
@@ -375,6 +384,11 @@ void project_image(asp::MapprojOptions & opt, GeoReference const& dem_georef,
   ImageFormat image_fmt = image_rsrc->format();
   const int num_input_channels = num_channels(image_fmt.pixel_format);
 
+  // The camera to project with. It can be an approximation of the camera.
+  vw::CamPtr proj_cam = opt.camera_model;
+  if (opt.approx_camera_model)
+    proj_cam = opt.approx_camera_model;
+
   // Redirect to the correctly typed function to perform the actual map projection.
   // - Must correspond to the type of the input image.
   if (image_fmt.pixel_format == VW_PIXEL_RGB) {
@@ -388,28 +402,28 @@ void project_image(asp::MapprojOptions & opt, GeoReference const& dem_georef,
                                                             croppedGeoRef, image_size, 
                                                             Vector2i(virtual_image_width,
                                                                     virtual_image_height),
-                                                            croppedImageBB, opt.camera_model);
+                                                            croppedImageBB, proj_cam);
       break;
     case VW_CHANNEL_INT16:
       project_image_alpha_pick_transform<PixelRGBA<int16>>(opt, dem_georef, target_georef,
                                                             croppedGeoRef, image_size, 
                                                             Vector2i(virtual_image_width,
                                                                     virtual_image_height),
-                                                            croppedImageBB, opt.camera_model);
+                                                            croppedImageBB, proj_cam);
       break;
     case VW_CHANNEL_UINT16:
       project_image_alpha_pick_transform<PixelRGBA<uint16>>(opt, dem_georef, target_georef,
                                                             croppedGeoRef, image_size, 
                                                             Vector2i(virtual_image_width,
                                                                       virtual_image_height),
-                                                            croppedImageBB, opt.camera_model);
+                                                            croppedImageBB, proj_cam);
       break;
     default:
       project_image_alpha_pick_transform<PixelRGBA<float32>>(opt, dem_georef, target_georef,
                                                               croppedGeoRef, image_size, 
                                                               Vector2i(virtual_image_width,
                                                                       virtual_image_height),
-                                                              croppedImageBB, opt.camera_model);
+                                                              croppedImageBB, proj_cam);
       break;
     };
     
@@ -422,7 +436,7 @@ void project_image(asp::MapprojOptions & opt, GeoReference const& dem_georef,
     project_image_nodata_pick_transform<float>(opt, dem_georef, target_georef, croppedGeoRef,
                                                 image_size, 
                           Vector2i(virtual_image_width, virtual_image_height),
-                          croppedImageBB, opt.camera_model);
+                          croppedImageBB, proj_cam);
   } 
   // Done map projecting
 }
@@ -33,16 +33,20 @@ namespace asp {
 struct MapprojOptions: vw::GdalWriteOptions {
   // Input
   std::string dem_file, image_file, camera_file, output_file, stereo_session,
-    bundle_adjust_prefix;
+    bundle_adjust_prefix, image_list, camera_cache_dir;
   bool isQuery, noGeoHeaderInfo, nearest_neighbor, parseOptions, aster_use_csm;
   bool multithreaded_model; // This is set based on the session type
+  int isis_camera_pool_size;
   
   // Keep a copy of the model here to not have to pass it around separately
   boost::shared_ptr<vw::camera::CameraModel> camera_model;
+  // If set, project with this approximation of camera_model instead
+  boost::shared_ptr<vw::camera::CameraModel> approx_camera_model;
   
   // Settings
   std::string target_srs_string, output_type, metadata;
-  double nodata_value, tr, mpp, ppd, datum_offset;
+  double nodata_value, tr, mpp, ppd, datum_offset, approx_max_pixel_error,
+    isis_to_csm_max_pixel_error;
   vw::BBox2 target_projwin, target_pixelwin;
   vw::Vector2 query_pixel;
 };
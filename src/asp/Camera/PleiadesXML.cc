@@ -50,6 +50,7 @@ using namespace xercesc;
 
 using asp::XmlUtils::get_node;
 using asp::XmlUtils::cast_xmlch;
+using asp::XmlUtils::get_child;
 
 namespace asp {
 
@@ -212,39 +213,31 @@ void PleiadesXML::read_ephemeris(xercesc::DOMElement* ephemeris) {
 
   xercesc::DOMElement* point_list = get_node<DOMElement>(ephemeris, "Point_List");
 
-  // Pick out the "Point" nodes
-  DOMNodeList* children = point_list->getChildNodes();
-
-  for (XMLSize_t i = 0; i < children->getLength(); i++) {
+  // Pick out the "Point" nodes. The tags are converted once, and looked up
+  // among the direct children of each point, as there can be many points.
+  asp::XmlUtils::XmlTag location_tag("LOCATION_XYZ"), velocity_tag("VELOCITY_XYZ"),
+    time_tag("TIME");
+  for (DOMElement* curr_element = point_list->getFirstElementChild();
+       curr_element != NULL; curr_element = curr_element->getNextElementSibling()) {
     
-    // Check child node type
-    DOMNode* child = children->item(i);
-    if (child->getNodeType() != DOMNode::ELEMENT_NODE)
-      continue;
-
     // Check the node name
-    DOMElement* curr_element = dynamic_cast<DOMElement*>(child);
-    std::string tag(XMLString::transcode(curr_element->getTagName()));
-    if (tag.find("Point") == std::string::npos)
+    if (!asp::XmlUtils::tag_contains(curr_element, "Point"))
       continue;
 
-    // Get the three sub-nodes
-    std::string time_str, position_str, velocity_str;
-    Vector3 position_vec, velocity_vec;
-    
     // Parse the position and velocity
-    cast_xmlch(get_node<DOMElement>(curr_element, "LOCATION_XYZ")->getTextContent(), position_str);
-    cast_xmlch(get_node<DOMElement>(curr_element, "VELOCITY_XYZ")->getTextContent(), velocity_str);
+    Vector3 position_vec, velocity_vec;
+    if (asp::XmlUtils::parse_numbers(get_child(curr_element, location_tag)->getTextContent(),
+                                     &position_vec[0], 3) != 3 ||
+        asp::XmlUtils::parse_numbers(get_child(curr_element, velocity_tag)->getTextContent(),
+                                     &velocity_vec[0], 3) != 3)
+      vw_throw(ArgumentErr() << "Failed to parse the position and velocity of a point.\n");
 
     // Parse the time
-    cast_xmlch(get_node<DOMElement>(curr_element, "TIME")->getTextContent(), time_str);
+    std::string time_str = asp::XmlUtils::to_string(get_child(curr_element, time_tag)
+                                                    ->getTextContent());
     bool is_start_time = false;
     double time = PleiadesXML::convert_time(time_str, is_start_time);
 
-    std::string delimiters(",\t ");
-    position_vec = str_to_vec<Vector3>(position_str, delimiters);
-    velocity_vec = str_to_vec<Vector3>(velocity_str, delimiters);
-
     m_positions.push_back(std::pair<double, Vector3>(time, position_vec));
     m_velocities.push_back(std::pair<double, Vector3>(time, velocity_vec));
   } // End loop through points
@@ -282,27 +275,22 @@ void PleiadesXML::read_attitudes_Neo(xercesc::DOMElement* attitudes) {
   // Reset data storage
   m_poses.clear();
 
-  DOMNodeList* children = quaternion_list->getChildNodes();
-  for (XMLSize_t i = 0; i < children->getLength(); i++) {
+  asp::XmlUtils::XmlTag q0_tag("Q0"), q1_tag("Q1"), q2_tag("Q2"), q3_tag("Q3"),
+    time_tag("TIME");
+  for (DOMElement* curr_element = quaternion_list->getFirstElementChild();
+       curr_element != NULL; curr_element = curr_element->getNextElementSibling()) {
     
-    // Check child node type
-    DOMNode* child = children->item(i);
-    if (child->getNodeType() != DOMNode::ELEMENT_NODE)
-      continue;
-
-    // Check the node time
-    DOMElement* curr_element = dynamic_cast<DOMElement*>(child);
-    std::string tag(XMLString::transcode(curr_element->getTagName()));
-    if (tag.find("Quaternion") == std::string::npos)
+    // Check the node name
+    if (!asp::XmlUtils::tag_contains(curr_element, "Quaternion"))
       continue;
 
     // Parse the quaternion
     std::pair<double, vw::Quaternion<double>> data;
     double w, x, y, z;
-    cast_xmlch(get_node<DOMElement>(curr_element, "Q0")->getTextContent(), w);
-    cast_xmlch(get_node<DOMElement>(curr_element, "Q1")->getTextContent(), x);
-    cast_xmlch(get_node<DOMElement>(curr_element, "Q2")->getTextContent(), y);
-    cast_xmlch(get_node<DOMElement>(curr_element, "Q3")->getTextContent(), z);
+    cast_xmlch(get_child(curr_element, q0_tag)->getTextContent(), w);
+    cast_xmlch(get_child(curr_element, q1_tag)->getTextContent(), x);
+    cast_xmlch(get_child(curr_element, q2_tag)->getTextContent(), y);
+    cast_xmlch(get_child(curr_element, q3_tag)->getTextContent(), z);
     vw::Quaternion<double> q = vw::Quaternion<double>(w, x, y, z);
 
     // Normalize the quaternions to remove any inaccuracy due to the
@@ -312,8 +300,8 @@ void PleiadesXML::read_attitudes_Neo(xercesc::DOMElement* attitudes) {
     data.second = q;
 
     // Parse the quaternion time
-    std::string time_str; 
-    cast_xmlch(get_node<DOMElement>(curr_element, "TIME")->getTextContent(), time_str);
+    std::string time_str = asp::XmlUtils::to_string(get_child(curr_element, time_tag)
+                                                    ->getTextContent());
     bool is_start_time = false;
     double time = PleiadesXML::convert_time(time_str, is_start_time);
     data.first = time;
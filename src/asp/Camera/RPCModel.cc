@@ -29,6 +29,8 @@
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 
+#include <algorithm>
+
 using namespace vw;
 
 namespace asp {
@@ -228,12 +230,14 @@ namespace asp {
 
     // Should we verify that the  input geodetic is in the box?
 
-    Vector3 normalized_geodetic =
-      elem_quot(geodetic - m_lonlatheight_offset, m_lonlatheight_scale);
-
-    Vector2 normalized_pixel = normalized_geodetic_to_normalized_pixel(normalized_geodetic);
+    RPCBlock block;
+    block.x[0] = (geodetic[0] - m_lonlatheight_offset[0]) / m_lonlatheight_scale[0];
+    block.y[0] = (geodetic[1] - m_lonlatheight_offset[1]) / m_lonlatheight_scale[1];
+    block.z[0] = (geodetic[2] - m_lonlatheight_offset[2]) / m_lonlatheight_scale[2];
+    evalRPCBlock(*this, 1, false, block);
 
-    return elem_prod(normalized_pixel, m_xy_scale) + m_xy_offset;
+    return Vector2(block.samp[0] * m_xy_scale[0] + m_xy_offset[0],
+                   block.line[0] * m_xy_scale[1] + m_xy_offset[1]);
   }
 
   Vector2 RPCModel::normalized_geodetic_to_normalized_pixel
@@ -291,6 +295,118 @@ namespace asp {
     return result;
   }
 
+  void evalRPCBlock(RPCModel const& model, int n, bool with_jacobian,
+                    RPCBlock & b) {
+
+    const int NT = 20; // number of terms
+    const int B  = RPC_BLOCK_SIZE;
+
+    RPCModel::CoeffVec const& sn = model.sample_num_coeff();
+    RPCModel::CoeffVec const& sd = model.sample_den_coeff();
+    RPCModel::CoeffVec const& ln = model.line_num_coeff();
+    RPCModel::CoeffVec const& ld = model.line_den_coeff();
+
+    // The terms, in the same order as in calculate_terms()
+    double t[NT][B];
+    for (int i = 0; i < n; i++) {
+      double x = b.x[i], y = b.y[i], z = b.z[i];
+      t[ 0][i] = 1.0;
+      t[ 1][i] = x;
+      t[ 2][i] = y;
+      t[ 3][i] = z;
+      t[ 4][i] = x*y;
+      t[ 5][i] = x*z;
+      t[ 6][i] = y*z;
+      t[ 7][i] = x*x;
+      t[ 8][i] = y*y;
+      t[ 9][i] = z*z;
+      t[10][i] = x*y*z;
+      t[11][i] = x*x*x;
+      t[12][i] = x*y*y;
+      t[13][i] = x*z*z;
+      t[14][i] = x*x*y;
+      t[15][i] = y*y*y;
+      t[16][i] = y*z*z;
+      t[17][i] = x*x*z;
+      t[18][i] = y*y*z;
+      t[19][i] = z*z*z;
+    }
+
+    double Ns[B], Ds[B], Nl[B], Dl[B];
+    for (int i = 0; i < n; i++)
+      Ns[i] = Ds[i] = Nl[i] = Dl[i] = 0.0;
+    for (int k = 0; k < NT; k++) {
+      double csn = sn[k], csd = sd[k], cln = ln[k], cld = ld[k];
+      for (int i = 0; i < n; i++) {
+        Ns[i] += csn * t[k][i];
+        Ds[i] += csd * t[k][i];
+        Nl[i] += cln * t[k][i];
+        Dl[i] += cld * t[k][i];
+      }
+    }
+    for (int i = 0; i < n; i++) {
+      b.samp[i] = Ns[i] / Ds[i];
+      b.line[i] = Nl[i] / Dl[i];
+    }
+
+    if (!with_jacobian)
+      return;
+
+    // Partial derivatives of the terms, as in terms_Jacobian3(). The zero
+    // entries are skipped below.
+    double tx[NT][B], ty[NT][B], tz[NT][B];
+    for (int i = 0; i < n; i++) {
+      double x = b.x[i], y = b.y[i], z = b.z[i];
+      tx[ 1][i] = 1.0;     ty[ 2][i] = 1.0;     tz[ 3][i] = 1.0;     // x, y, z
+      tx[ 4][i] = y;       ty[ 4][i] = x;                            // xy
+      tx[ 5][i] = z;                            tz[ 5][i] = x;       // xz
+                           ty[ 6][i] = z;       tz[ 6][i] = y;       // yz
+      tx[ 7][i] = 2.0*x;                                             // xx
+                           ty[ 8][i] = 2.0*y;                        // yy
+                                                tz[ 9][i] = 2.0*z;   // zz
+      tx[10][i] = y*z;     ty[10][i] = x*z;     tz[10][i] = x*y;     // xyz
+      tx[11][i] = 3.0*x*x;                                           // xxx
+      tx[12][i] = y*y;     ty[12][i] = 2.0*x*y;                      // xyy
+      tx[13][i] = z*z;                          tz[13][i] = 2.0*x*z; // xzz
+      tx[14][i] = 2.0*x*y; ty[14][i] = x*x;                          // xxy
+                           ty[15][i] = 3.0*y*y;                      // yyy
+                           ty[16][i] = z*z;     tz[16][i] = 2.0*y*z; // yzz
+      tx[17][i] = 2.0*x*z;                      tz[17][i] = x*x;     // xxz
+                           ty[18][i] = 2.0*y*z; tz[18][i] = y*y;     // yyz
+                                                tz[19][i] = 3.0*z*z; // zzz
+    }
+
+    // The terms with a nonzero derivative with respect to x, y, and z
+    static const int xk[] = {1, 4, 5, 7, 10, 11, 12, 13, 14, 17};
+    static const int yk[] = {2, 4, 6, 8, 10, 12, 14, 15, 16, 18};
+    static const int zk[] = {3, 5, 6, 9, 10, 13, 16, 17, 18, 19};
+    const int NK = 10;
+    int const* nonzero[3] = {xk, yk, zk};
+    double (*dt[3])[B] = {tx, ty, tz};
+
+    for (int c = 0; c < 3; c++) {
+      double dNs[B], dDs[B], dNl[B], dDl[B];
+      for (int i = 0; i < n; i++)
+        dNs[i] = dDs[i] = dNl[i] = dDl[i] = 0.0;
+      for (int j = 0; j < NK; j++) {
+        int k = nonzero[c][j];
+        double csn = sn[k], csd = sd[k], cln = ln[k], cld = ld[k];
+        double const* d = dt[c][k];
+        for (int i = 0; i < n; i++) {
+          dNs[i] += csn * d[i];
+          dDs[i] += csd * d[i];
+          dNl[i] += cln * d[i];
+          dDl[i] += cld * d[i];
+        }
+      }
+      // Quotient rule
+      for (int i = 0; i < n; i++) {
+        b.dsamp[c][i] = (dNs[i] * Ds[i] - Ns[i] * dDs[i]) / (Ds[i] * Ds[i]);
+        b.dline[c][i] = (dNl[i] * Dl[i] - Nl[i] * dDl[i]) / (Dl[i] * Dl[i]);
+      }
+    }
+  }
+
   vw::Vector<int,20> RPCModel::get_coeff_order() {
     vw::Vector<int,20> result;
     for (int i= 0; i< 3; ++i) result[i] = 1;
@@ -398,18 +514,18 @@ namespace asp {
 
   Matrix<double, 2, 3> RPCModel::geodetic_to_pixel_Jacobian(Vector3 const& geodetic) const {
 
-    Vector3 normalized_geodetic = elem_quot(geodetic - m_lonlatheight_offset, m_lonlatheight_scale);
-
-    CoeffVec term = calculate_terms(normalized_geodetic);
-
-    CoeffVec Qs = quotient_Jacobian(sample_num_coeff(), sample_den_coeff(), term);
-    CoeffVec Ql = quotient_Jacobian(line_num_coeff(),   line_den_coeff(),   term);
-    Matrix<double, 20, 3> MN = terms_Jacobian3(normalized_geodetic) *
-      normalization_Jacobian(m_lonlatheight_scale);
+    RPCBlock block;
+    block.x[0] = (geodetic[0] - m_lonlatheight_offset[0]) / m_lonlatheight_scale[0];
+    block.y[0] = (geodetic[1] - m_lonlatheight_offset[1]) / m_lonlatheight_scale[1];
+    block.z[0] = (geodetic[2] - m_lonlatheight_offset[2]) / m_lonlatheight_scale[2];
+    evalRPCBlock(*this, 1, true, block);
 
+    // Chain rule with the normalization of the input and output
     Matrix<double, 2, 3> J;
-    select_row(J, 0) = m_xy_scale[0] * transpose(Qs) * MN;
-    select_row(J, 1) = m_xy_scale[1] * transpose(Ql) * MN;
+    for (int c = 0; c < 3; c++) {
+      J(0, c) = m_xy_scale[0] * block.dsamp[c][0] / m_lonlatheight_scale[c];
+      J(1, c) = m_xy_scale[1] * block.dline[c][0] / m_lonlatheight_scale[c];
+    }
 
     return J;
   }
@@ -426,16 +542,15 @@ namespace asp {
 
     // 3. The output is in normalized pixels (see m_xy_scale and m_xy_offset).
 
-    CoeffVec term = calculate_terms(normalized_geodetic);
-
-    CoeffVec Qs = quotient_Jacobian(sample_num_coeff(), sample_den_coeff(), term);
-    CoeffVec Ql = quotient_Jacobian(line_num_coeff(),   line_den_coeff(),   term);
-
-    Matrix<double, 20, 2> Jt = terms_Jacobian2(normalized_geodetic);
+    RPCBlock block;
+    block.x[0] = normalized_geodetic[0];
+    block.y[0] = normalized_geodetic[1];
+    block.z[0] = normalized_geodetic[2];
+    evalRPCBlock(*this, 1, true, block);
 
     Matrix<double, 2, 2> J;
-    select_row(J, 0) = transpose(Qs) * Jt;
-    select_row(J, 1) = transpose(Ql) * Jt;
+    J(0, 0) = block.dsamp[0][0]; J(0, 1) = block.dsamp[1][0];
+    J(1, 0) = block.dline[0][0]; J(1, 1) = block.dline[1][0];
 
     return J;
   }
@@ -465,97 +580,90 @@ namespace asp {
   // intersection point must project back into the pixel.
   Vector2 RPCModel::image_to_ground(Vector2 const& pixel, double height,
                                     Vector2 lonlat_guess) const {
+    Vector2 lonlat;
+    image_to_ground_block(1, &pixel, height, &lonlat_guess, &lonlat);
+    return lonlat;
+  }
+
+  // Run Newton's method for a block of pixels at once. Each pixel is
+  // updated only until its own iterations converge, so the result is the
+  // same as when solving for one pixel at a time.
+  void RPCModel::image_to_ground_block(int n, Vector2 const* pixels, double height,
+                                       Vector2 const* lonlat_guesses,
+                                       Vector2 * lonlats) const {
 
     // The absolute tolerance is experimental, needs more investigation
     double abs_tolerance = 1e-6;
 
-    Vector2 normalized_pixel = elem_quot(pixel - m_xy_offset, m_xy_scale);
-
-    // Initial guess for the normalized lon and lat
-    if (lonlat_guess == Vector2(0.0, 0.0))
-      lonlat_guess = subvector(m_lonlatheight_offset, 0, 2);
-
-    Vector2 normalized_lonlat = elem_quot(lonlat_guess - subvector(m_lonlatheight_offset, 0, 2),
-                                          subvector(m_lonlatheight_scale, 0, 2));
-    double len = norm_2(normalized_lonlat);
-    if (len != len || len > 1.5){
-      // If the input guess is NaN or unreasonable, use 0 as initial guess
-      normalized_lonlat = Vector2(0.0, 0.0);
+    RPCBlock block;
+    double norm_samp[RPC_BLOCK_SIZE], norm_line[RPC_BLOCK_SIZE];
+    bool active[RPC_BLOCK_SIZE];
+    double z = (height - m_lonlatheight_offset[2])/m_lonlatheight_scale[2];
+
+    for (int i = 0; i < n; i++) {
+      norm_samp[i] = (pixels[i][0] - m_xy_offset[0]) / m_xy_scale[0];
+      norm_line[i] = (pixels[i][1] - m_xy_offset[1]) / m_xy_scale[1];
+
+      // Initial guess for the normalized lon and lat
+      Vector2 lonlat_guess = lonlat_guesses[i];
+      if (lonlat_guess == Vector2(0.0, 0.0))
+        lonlat_guess = subvector(m_lonlatheight_offset, 0, 2);
+
+      double x = (lonlat_guess[0] - m_lonlatheight_offset[0]) / m_lonlatheight_scale[0];
+      double y = (lonlat_guess[1] - m_lonlatheight_offset[1]) / m_lonlatheight_scale[1];
+      double len = sqrt(x*x + y*y);
+      if (len != len || len > 1.5){
+        // If the input guess is NaN or unreasonable, use 0 as initial guess
+        x = 0.0;
+        y = 0.0;
+      }
+      block.x[i] = x;
+      block.y[i] = y;
+      block.z[i] = z;
+      active[i]  = true;
     }
 
     // 10 iterations should be enough for Newton's method to converge
     for (int iter = 0; iter < 10; iter++){
 
-      Vector3 normalized_geodetic;
-      normalized_geodetic[0] = normalized_lonlat[0];
-      normalized_geodetic[1] = normalized_lonlat[1];
-      normalized_geodetic[2] = (height - m_lonlatheight_offset[2])/m_lonlatheight_scale[2];
-
-      Vector2              p = normalized_geodetic_to_normalized_pixel(normalized_geodetic);
-      Matrix<double, 2, 2> J = normalized_geodetic_to_pixel_Jacobian(normalized_geodetic);
-
-      // The inverse matrix computed analytically
-      double det = J[0][0]*J[1][1] - J[0][1]*J[1][0];
-      Matrix<double, 2, 2> invJ;
-      invJ[0][0] =  J[1][1];
-      invJ[0][1] = -J[0][1];
-      invJ[1][0] = -J[1][0];
-      invJ[1][1] =  J[0][0];
-      // TODO(oalexan1): What if det is close to 0?
-      invJ /= det;
-
-      // Newton's method for F(x) = y is
-      // x = x - J^{-1}(F(x) - y)
-      Vector2 error_try = p - normalized_pixel;
-      normalized_lonlat -= invJ*error_try;
-
-      // Absolute error convergence criterion
-      double  norm_try = norm_2(error_try);
-      if (norm_try < abs_tolerance) {
-        break;
+      evalRPCBlock(*this, n, true, block);
+
+      int num_active = 0;
+      for (int i = 0; i < n; i++) {
+        if (!active[i])
+          continue;
+
+        // The inverse matrix computed analytically
+        double j00 = block.dsamp[0][i], j01 = block.dsamp[1][i];
+        double j10 = block.dline[0][i], j11 = block.dline[1][i];
+        // TODO(oalexan1): What if det is close to 0?
+        double det = j00*j11 - j01*j10;
+
+        // Newton's method for F(x) = y is
+        // x = x - J^{-1}(F(x) - y)
+        double e0 = block.samp[i] - norm_samp[i];
+        double e1 = block.line[i] - norm_line[i];
+        block.x[i] -= ( j11*e0 - j01*e1) / det;
+        block.y[i] -= (-j10*e0 + j00*e1) / det;
+
+        // Absolute error convergence criterion
+        if (sqrt(e0*e0 + e1*e1) < abs_tolerance)
+          active[i] = false;
+        else
+          num_active++;
       }
 
+      if (num_active == 0)
+        break;
     }
 
-    Vector2 lonlat = elem_prod(normalized_lonlat, subvector(m_lonlatheight_scale, 0, 2))
-      + subvector(m_lonlatheight_offset, 0, 2);
-
-    return lonlat;
-
+    for (int i = 0; i < n; i++)
+      lonlats[i] = Vector2(block.x[i] * m_lonlatheight_scale[0] + m_lonlatheight_offset[0],
+                           block.y[i] * m_lonlatheight_scale[1] + m_lonlatheight_offset[1]);
   }
 
   void RPCModel::point_and_dir(Vector2 const& pix, Vector3 & P, Vector3 & dir) const {
-
-    // For an RPC model there is no defined origin so it and the ray need to be computed.
-
-    // Center of valid region to bottom of valid region (normalized)
-    const double VERT_SCALE_FACTOR = 0.9; // - The virtual center should be above the terrain
-    double  height_up = m_lonlatheight_offset[2] + m_lonlatheight_scale[2]*VERT_SCALE_FACTOR;
-    double  height_dn = m_lonlatheight_offset[2] - m_lonlatheight_scale[2]*VERT_SCALE_FACTOR;
-
-    // Given the pixel and elevation, estimate lon-lat.
-    // Use m_lonlatheight_offset as initial guess for lonlat_up,
-    // and then use lonlat_up as initial guess for lonlat_dn.
-    Vector2 lonlat_up = image_to_ground(pix, height_up, subvector(m_lonlatheight_offset, 0, 2));
-    Vector2 lonlat_dn = image_to_ground(pix, height_dn, lonlat_up);
-
-    Vector3 geo_up = Vector3(lonlat_up[0], lonlat_up[1], height_up);
-    Vector3 geo_dn = Vector3(lonlat_dn[0], lonlat_dn[1], height_dn);
-
-    Vector3 P_up = m_datum.geodetic_to_cartesian(geo_up);
-    Vector3 P_dn = m_datum.geodetic_to_cartesian(geo_dn);
-
-    dir = normalize(P_dn - P_up);
-    
-    // Set the origin location very far in the opposite direction of the pointing vector,
-    //  to put it high above the terrain. Normally the precise position along the ray
-    // should not make any difference, except perhaps in error propagation
-    // (see Covariance.cc).
-    // TODO(oalexan1): Use the logic from cam_gen.cc to shoot rays from the ground
-    // up and estimate where they intersect. That will give a better idea of the true
-    // elevation of the camera above the ground.
-    const double LONG_SCALE_UP = 100000.0; // 100 km above ground
-    P = P_up - dir*LONG_SCALE_UP;
+    pixels_to_rays(&pix, 1, &P, &dir);
   }
 
   Vector3 RPCModel::camera_center(Vector2 const& pix) const{
@@ -576,6 +684,73 @@ namespace asp {
     return dir;
   }
 
+  void RPCModel::points_to_pixels(Vector3 const* points, size_t num,
+                                  Vector2 * pixels) const {
+
+    RPCBlock block;
+    for (size_t start = 0; start < num; start += RPC_BLOCK_SIZE) {
+      int n = std::min(size_t(RPC_BLOCK_SIZE), num - start);
+      for (int i = 0; i < n; i++) {
+        Vector3 geodetic = m_datum.cartesian_to_geodetic(points[start + i]);
+        block.x[i] = (geodetic[0] - m_lonlatheight_offset[0]) / m_lonlatheight_scale[0];
+        block.y[i] = (geodetic[1] - m_lonlatheight_offset[1]) / m_lonlatheight_scale[1];
+        block.z[i] = (geodetic[2] - m_lonlatheight_offset[2]) / m_lonlatheight_scale[2];
+      }
+      evalRPCBlock(*this, n, false, block);
+      for (int i = 0; i < n; i++)
+        pixels[start + i] = Vector2(block.samp[i] * m_xy_scale[0] + m_xy_offset[0],
+                                    block.line[i] * m_xy_scale[1] + m_xy_offset[1]);
+    }
+  }
+
+  void RPCModel::pixels_to_rays(Vector2 const* pixels, size_t num,
+                                Vector3 * centers, Vector3 * dirs) const {
+
+    // For an RPC model there is no defined origin so it and the ray need to be computed.
+
+    // Center of valid region to bottom of valid region (normalized)
+    const double VERT_SCALE_FACTOR = 0.9; // - The virtual center should be above the terrain
+    double  height_up = m_lonlatheight_offset[2] + m_lonlatheight_scale[2]*VERT_SCALE_FACTOR;
+    double  height_dn = m_lonlatheight_offset[2] - m_lonlatheight_scale[2]*VERT_SCALE_FACTOR;
+
+    Vector2 guess[RPC_BLOCK_SIZE], lonlat_up[RPC_BLOCK_SIZE], lonlat_dn[RPC_BLOCK_SIZE];
+    for (int i = 0; i < RPC_BLOCK_SIZE; i++)
+      guess[i] = subvector(m_lonlatheight_offset, 0, 2);
+
+    for (size_t start = 0; start < num; start += RPC_BLOCK_SIZE) {
+      int n = std::min(size_t(RPC_BLOCK_SIZE), num - start);
+
+      // Given the pixel and elevation, estimate lon-lat.
+      // Use m_lonlatheight_offset as initial guess for lonlat_up,
+      // and then use lonlat_up as initial guess for lonlat_dn.
+      image_to_ground_block(n, pixels + start, height_up, guess, lonlat_up);
+      image_to_ground_block(n, pixels + start, height_dn, lonlat_up, lonlat_dn);
+
+      for (int i = 0; i < n; i++) {
+        Vector3 geo_up = Vector3(lonlat_up[i][0], lonlat_up[i][1], height_up);
+        Vector3 geo_dn = Vector3(lonlat_dn[i][0], lonlat_dn[i][1], height_dn);
+
+        Vector3 P_up = m_datum.geodetic_to_cartesian(geo_up);
+        Vector3 P_dn = m_datum.geodetic_to_cartesian(geo_dn);
+
+        Vector3 dir = normalize(P_dn - P_up);
+        if (dirs != NULL)
+          dirs[start + i] = dir;
+
+        // Set the origin location very far in the opposite direction of the pointing vector,
+        //  to put it high above the terrain. Normally the precise position along the ray
+        // should not make any difference, except perhaps in error propagation
+        // (see Covariance.cc).
+        // TODO(oalexan1): Use the logic from cam_gen.cc to shoot rays from the ground
+        // up and estimate where they intersect. That will give a better idea of the true
+        // elevation of the camera above the ground.
+        const double LONG_SCALE_UP = 100000.0; // 100 km above ground
+        if (centers != NULL)
+          centers[start + i] = P_up - dir*LONG_SCALE_UP;
+      }
+    }
+  }
+
   std::ostream& operator<<(std::ostream& os, const RPCModel& rpc) {
     os << "RPC Model:"         << std::endl
        << "Line Numerator: "   << rpc.line_num_coeff()      << std::endl
@@ -84,6 +84,15 @@ namespace asp {
     virtual vw::Vector3 pixel_to_vector( vw::Vector2 const& pix   ) const;
     virtual vw::Vector3 camera_center  ( vw::Vector2 const& pix   ) const;
 
+    /// Batch versions of the above, without per-point virtual dispatch. The
+    /// output arrays must have room for num elements. Either of centers or
+    /// dirs may be NULL. Each ray is found only once if both are wanted.
+    /// See CameraBatch.h for the generic interface.
+    void points_to_pixels(vw::Vector3 const* points, size_t num,
+                          vw::Vector2 * pixels) const;
+    void pixels_to_rays(vw::Vector2 const* pixels, size_t num,
+                        vw::Vector3 * centers, vw::Vector3 * dirs) const;
+
     static vw::Vector2 normalized_geodetic_to_normalized_pixel
       (vw::Vector3 const& normalized_geodetic,
        CoeffVec    const& line_num_coeff,   CoeffVec const& line_den_coeff,
@@ -146,8 +155,34 @@ namespace asp {
     vw::Vector3 m_lonlatheight_scale;
 
     void initialize( vw::DiskImageResourceGDAL* resource );
+
+    /// image_to_ground() for n <= RPC_BLOCK_SIZE pixels at once.
+    void image_to_ground_block(int n, vw::Vector2 const* pixels, double height,
+                               vw::Vector2 const* lonlat_guesses,
+                               vw::Vector2 * lonlats) const;
   };
 
+  /// The number of points evaluated together by evalRPCBlock().
+  const int RPC_BLOCK_SIZE = 8;
+
+  /// Inputs and outputs of evalRPCBlock() for up to RPC_BLOCK_SIZE points.
+  /// The points are stored as separate coordinate arrays, so that the loops
+  /// over them can be vectorized.
+  struct RPCBlock {
+    // Normalized lon, lat, and height
+    double x[RPC_BLOCK_SIZE], y[RPC_BLOCK_SIZE], z[RPC_BLOCK_SIZE];
+    // Normalized sample and line
+    double samp[RPC_BLOCK_SIZE], line[RPC_BLOCK_SIZE];
+    // Derivatives of the normalized sample and line with respect to x, y, z
+    double dsamp[3][RPC_BLOCK_SIZE], dline[3][RPC_BLOCK_SIZE];
+  };
+
+  /// Evaluate the RPC polynomials of the model at the first n points of the
+  /// block. Find also the derivatives if with_jacobian is true. Gives the
+  /// same values as RPCModel::normalized_geodetic_to_normalized_pixel().
+  void evalRPCBlock(RPCModel const& model, int n, bool with_jacobian,
+                    RPCBlock & block);
+
   std::ostream& operator<<(std::ostream& os, const RPCModel& rpc);
 }
 
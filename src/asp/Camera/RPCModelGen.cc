@@ -20,6 +20,8 @@
 #include <asp/Camera/RPCModel.h>
 #include <vw/Math/Geometry.h>
 
+#include <algorithm>
+
 using namespace vw;
 
 namespace asp {
@@ -70,6 +72,125 @@ namespace asp {
     return;
   }
 
+  // The offsets of the four polynomials in the vector of 78 variable
+  // coefficients. See unpackCoeffs(). The denominators lack the constant
+  // term, which is always 1.
+  const int NUM_TERMS = 20;
+  const int LINE_NUM = 0, LINE_DEN = 20, SAMP_NUM = 39, SAMP_DEN = 59;
+
+  RpcSolveLMA::RpcSolveLMA(const Vector<double>& normalizedGeodetics,
+                           const Vector<double>& normalizedPixels,
+                           double penaltyWeight):
+    m_normalizedGeodetics(normalizedGeodetics),
+    m_normalizedPixels(normalizedPixels),
+    m_wt(penaltyWeight) {
+
+    int numPts = m_normalizedGeodetics.size()/RPCModel::GEODETIC_COORD_SIZE;
+    m_terms.resize(NUM_TERMS * size_t(numPts));
+#pragma omp parallel for
+    for (int i = 0; i < numPts; i++) {
+      Vector3 G = subvector(m_normalizedGeodetics, RPCModel::GEODETIC_COORD_SIZE*i,
+                            RPCModel::GEODETIC_COORD_SIZE);
+      RPCModel::CoeffVec t = RPCModel::calculate_terms(G);
+      for (int k = 0; k < NUM_TERMS; k++)
+        m_terms[NUM_TERMS * size_t(i) + k] = t[k];
+    }
+  }
+
+  // Evaluate the four RPC polynomials given the terms at a point
+  inline void evalRpcPolys(double const* t, double const* C,
+                           double & ln, double & ld, double & sn, double & sd) {
+    ln = 0.0; sn = 0.0; ld = 1.0; sd = 1.0;
+    for (int k = 0; k < NUM_TERMS; k++) {
+      ln += C[LINE_NUM + k] * t[k];
+      sn += C[SAMP_NUM + k] * t[k];
+    }
+    for (int k = 1; k < NUM_TERMS; k++) {
+      ld += C[LINE_DEN + k - 1] * t[k];
+      sd += C[SAMP_DEN + k - 1] * t[k];
+    }
+  }
+
+  RpcSolveLMA::result_type RpcSolveLMA::operator()(domain_type const& C) const {
+
+    VW_ASSERT(C.size() == 78, ArgumentErr() << "Must have 78 coefficients.\n");
+    
+    int numPts = m_normalizedGeodetics.size()/RPCModel::GEODETIC_COORD_SIZE;
+    result_type result;
+    result.set_size(m_normalizedPixels.size());
+
+    // Project each normalized geodetic into the RPC camera to get a normalized
+    // pixel, as (sample, line).
+    double const* c = &C[0];
+#pragma omp parallel for
+    for (int i = 0; i < numPts; i++) {
+      double ln, ld, sn, sd;
+      evalRpcPolys(&m_terms[NUM_TERMS * size_t(i)], c, ln, ld, sn, sd);
+      result[RPCModel::IMAGE_COORD_SIZE*i + 0] = sn / sd;
+      result[RPCModel::IMAGE_COORD_SIZE*i + 1] = ln / ld;
+    }
+
+    // There are 4*20 - 2 = 78 coefficients we optimize. Of those, 2
+    // are 0-th degree, 4*3 = 12 are 1st degree, and the rest, 78 - 12
+    // - 2 = 64 are higher degree.  Per Hartley, we'll add for each
+    // such coefficient c, a term K*c in the cost function vector,
+    // where K is a large number. This will penalize large values in
+    // the higher degree coefficients.
+    // - These values are attached to the end of the output vector
+    int count = RPCModel::IMAGE_COORD_SIZE*numPts; 
+    vw::Vector<int,20> coeff_order = RPCModel::get_coeff_order(); // This ranges from 1 to 3
+    for (int i = 4; i < NUM_TERMS; i++) result[count++] = m_wt*C[LINE_NUM+i]   * (coeff_order[i]-1);
+    for (int i = 4; i < NUM_TERMS; i++) result[count++] = m_wt*C[LINE_DEN+i-1] * (coeff_order[i]-1);
+    for (int i = 4; i < NUM_TERMS; i++) result[count++] = m_wt*C[SAMP_NUM+i]   * (coeff_order[i]-1);
+    for (int i = 4; i < NUM_TERMS; i++) result[count++] = m_wt*C[SAMP_DEN+i-1] * (coeff_order[i]-1);
+
+    VW_ASSERT((int)result.size() == count, vw::ArgumentErr() << "Book-keeping error.\n");
+
+    return result;
+  }
+
+  RpcSolveLMA::jacobian_type RpcSolveLMA::jacobian(domain_type const& C) const {
+
+    VW_ASSERT(C.size() == 78, ArgumentErr() << "Must have 78 coefficients.\n");
+
+    int numPts = m_normalizedGeodetics.size()/RPCModel::GEODETIC_COORD_SIZE;
+    int numRows = m_normalizedPixels.size(), numCols = C.size();
+    jacobian_type J(numRows, numCols);
+    std::fill(J.data(), J.data() + size_t(numRows) * numCols, 0.0);
+
+    // The sample only depends on the sample coefficients, and the same for
+    // the line. For p = num/den, dp/dnum_k = t_k/den, dp/dden_k = -p*t_k/den.
+    double const* c = &C[0];
+#pragma omp parallel for
+    for (int i = 0; i < numPts; i++) {
+      double const* t = &m_terms[NUM_TERMS * size_t(i)];
+      double ln, ld, sn, sd;
+      evalRpcPolys(t, c, ln, ld, sn, sd);
+      double s = sn / sd, l = ln / ld;
+      int sr = RPCModel::IMAGE_COORD_SIZE*i, lr = sr + 1;
+      for (int k = 0; k < NUM_TERMS; k++) {
+        J(sr, SAMP_NUM + k) = t[k] / sd;
+        J(lr, LINE_NUM + k) = t[k] / ld;
+      }
+      for (int k = 1; k < NUM_TERMS; k++) {
+        J(sr, SAMP_DEN + k - 1) = -s * t[k] / sd;
+        J(lr, LINE_DEN + k - 1) = -l * t[k] / ld;
+      }
+    }
+
+    // The penalty terms are linear in the coefficients
+    int count = RPCModel::IMAGE_COORD_SIZE*numPts;
+    vw::Vector<int,20> coeff_order = RPCModel::get_coeff_order();
+    for (int i = 4; i < NUM_TERMS; i++) J(count++, LINE_NUM+i)   = m_wt * (coeff_order[i]-1);
+    for (int i = 4; i < NUM_TERMS; i++) J(count++, LINE_DEN+i-1) = m_wt * (coeff_order[i]-1);
+    for (int i = 4; i < NUM_TERMS; i++) J(count++, SAMP_NUM+i)   = m_wt * (coeff_order[i]-1);
+    for (int i = 4; i < NUM_TERMS; i++) J(count++, SAMP_DEN+i-1) = m_wt * (coeff_order[i]-1);
+
+    VW_ASSERT(numRows == count, vw::ArgumentErr() << "Book-keeping error.\n");
+
+    return J;
+  }
+
   /// Print out a name followed by the vector of values
   void print_vec(std::string const& name, Vector<double> const& vals){
     std::cout.precision(16);
@@ -23,6 +23,8 @@
 #include <asp/Camera/RPCModel.h>
 #include <vw/Math/LevenbergMarquardt.h>
 
+#include <vector>
+
 namespace asp {
 
   /// Unpack the 78 RPC coefficients from one long vector into four seperate vectors.
@@ -39,12 +41,17 @@ namespace asp {
 
   /// Find the best-fitting RPC coefficients for the camera transform
   /// mapping a set of normalized geodetics to a set of normalized pixel values.
+  /// The model and its Jacobian are evaluated in parallel over the points.
   class RpcSolveLMA : public vw::math::LeastSquaresModelBase<RpcSolveLMA> {
     
     /// The normalized values are in the -1 to 1 range.
     vw::Vector<double> m_normalizedGeodetics, 
                        m_normalizedPixels; ///< Also contains the extra penalty terms
     double             m_wt; ///< The penalty weight, k in the reference paper.
+
+    /// The 20 RPC terms for each normalized geodetic. These do not change
+    /// during the optimization, so are computed only once.
+    std::vector<double> m_terms;
     
   public:
    
@@ -59,62 +66,15 @@ namespace asp {
     RpcSolveLMA( const vw::Vector<double>& normalizedGeodetics,
                  const vw::Vector<double>& normalizedPixels,
                  double penaltyWeight
-                 ) :
-      m_normalizedGeodetics(normalizedGeodetics),
-      m_normalizedPixels(normalizedPixels),
-      m_wt(penaltyWeight){}
-
-    /// Given a set of RPC coefficients, compute the projected pixels.
-    inline result_type operator()( domain_type const& C ) const {
-
-      // The input is the RPC coefficients, packed in a vector.
-      // For each normalized geodetic, compute the normalized
-      // pixel value. This will be the output.
-
-      // Add the penalization terms to the output,
-      // see the note later in the code.
-
-      // Unpack all the RPC model coefficients from the input vector C
-      RPCModel::CoeffVec lineNum, lineDen, sampNum, sampDen;
-      unpackCoeffs(C, lineNum, lineDen, sampNum, sampDen);
-
-      // Initialize the output vector
-      int numPts = m_normalizedGeodetics.size()/RPCModel::GEODETIC_COORD_SIZE;
-      result_type result;
-      result.set_size(m_normalizedPixels.size());
-      
-      // Loop through each test point
-      for (int i = 0; i < numPts; i++){
-        // Unpack the normalized Geodetic coordinate
-        vw::Vector3 G = subvector(m_normalizedGeodetics, RPCModel::GEODETIC_COORD_SIZE*i, RPCModel::GEODETIC_COORD_SIZE);
-        
-        // Project the normalized geodetic coordinate into the RPC camera to get a normalized pixel
-        vw::Vector2 pxn = RPCModel::normalized_geodetic_to_normalized_pixel(G, lineNum, lineDen, sampNum, sampDen);
-             
-        // Pack the normalized pixel into the output result vector
-        subvector(result, RPCModel::IMAGE_COORD_SIZE*i, RPCModel::IMAGE_COORD_SIZE) = pxn;
-
-      }
-
-      // There are 4*20 - 2 = 78 coefficients we optimize. Of those, 2
-      // are 0-th degree, 4*3 = 12 are 1st degree, and the rest, 78 - 12
-      // - 2 = 64 are higher degree.  Per Hartley, we'll add for each
-      // such coefficient c, a term K*c in the cost function vector,
-      // where K is a large number. This will penalize large values in
-      // the higher degree coefficients.
-      // - These values are attached to the end of the output vector
-      int count = RPCModel::IMAGE_COORD_SIZE*numPts; 
-      vw::Vector<int,20> coeff_order = RPCModel::get_coeff_order(); // This ranges from 1 to 3
-      for (int i = 4; i < (int)lineNum.size(); i++)  result[count++] = m_wt*lineNum[i] * (coeff_order[i]-1);
-      for (int i = 4; i < (int)lineDen.size(); i++)  result[count++] = m_wt*lineDen[i] * (coeff_order[i]-1);
-      for (int i = 4; i < (int)sampNum.size(); i++)  result[count++] = m_wt*sampNum[i] * (coeff_order[i]-1);
-      for (int i = 4; i < (int)sampDen.size(); i++)  result[count++] = m_wt*sampDen[i] * (coeff_order[i]-1);
-
-      VW_ASSERT((int)result.size() == count, vw::ArgumentErr() << "Book-keeping error.\n");
+                 );
 
-      return result;
-    }
+    /// Given a set of RPC coefficients, compute the projected pixels,
+    /// followed by the penalty terms.
+    result_type operator()( domain_type const& C ) const;
 
+    /// The analytic Jacobian of operator(). The solver uses this instead
+    /// of numerical differentiation, which needs 78 evaluations of the model.
+    jacobian_type jacobian( domain_type const& C ) const;
   };
 
   /// Print out a name followed by the vector of values
@@ -337,40 +337,35 @@ void asp::EphemerisXML::parse_meta(xercesc::DOMElement* node) {
 }
 
 void asp::EphemerisXML::parse_eph_list(xercesc::DOMElement* node) {
-  DOMNodeList* children = node->getChildNodes();
   size_t count = 0;
 
-  for (XMLSize_t i = 0; i < children->getLength(); i++) {
-    if (children->item(i)->getNodeType() == DOMNode::ELEMENT_NODE) {
-      DOMElement* element = dynamic_cast<DOMElement*>(children->item(i));
-      std::string buffer;
-      cast_xmlch(element->getTextContent(), buffer);
-
-      std::istringstream istr(buffer);
-      std::string index_b;
-      istr >> index_b;
-      size_t index;
-      try{
-        index = size_t(boost::lexical_cast<float>(index_b) + 0.5) - 1;
-      } catch (boost::bad_lexical_cast const& e) {
-        vw_throw(ArgumentErr() << "Failed to parse string: " << index_b << "\n");
-      }
-
-      istr >> satellite_position_vec[index][0]
-           >> satellite_position_vec[index][1]
-           >> satellite_position_vec[index][2]
-           >> velocity_vec[index][0]
-           >> velocity_vec[index][1]
-           >> velocity_vec[index][2];
-      istr >> satellite_pos_cov[6*index + 0]
-           >> satellite_pos_cov[6*index + 1]
-           >> satellite_pos_cov[6*index + 2]
-           >> satellite_pos_cov[6*index + 3]
-           >> satellite_pos_cov[6*index + 4]
-           >> satellite_pos_cov[6*index + 5];
-
-      count++;
+  // Each sample has the index, position, velocity, and the upper-right
+  // portion of the position covariance. The numbers are read directly from
+  // the XML text, as there can be many thousands of samples.
+  const int num_vals = 13;
+  double vals[num_vals];
+  for (DOMElement* element = node->getFirstElementChild(); element != NULL;
+       element = element->getNextElementSibling()) {
+
+    int num_read = asp::XmlUtils::parse_numbers(element->getTextContent(), vals, num_vals);
+    if (num_read < 7)
+      vw_throw(ArgumentErr() << "Failed to parse ephemeris sample: "
+               << asp::XmlUtils::to_string(element->getTextContent()) << "\n");
+    for (int it = num_read; it < num_vals; it++)
+      vals[it] = 0.0; // as before, a missing covariance is zero
+
+    size_t index = size_t(float(vals[0]) + 0.5) - 1;
+    if (index >= satellite_position_vec.size())
+      vw_throw(ArgumentErr() << "Invalid ephemeris sample index: " << vals[0] << "\n");
+
+    for (int coord = 0; coord < 3; coord++) {
+      satellite_position_vec[index][coord] = vals[1 + coord];
+      velocity_vec[index][coord]           = vals[4 + coord];
     }
+    for (int it = 0; it < 6; it++)
+      satellite_pos_cov[6*index + it] = vals[7 + it];
+
+    count++;
   }
 
   VW_ASSERT(count == satellite_position_vec.size(),
@@ -383,7 +378,6 @@ void asp::EphemerisXML::parse(xercesc::DOMElement* node) {
   parse_meta(node);
   check_argument(0);
 
-  // TODO(oalexan1): This is slow to parse
   parse_eph_list(get_node<DOMElement>(node, "EPHEMLISTList"));
   check_argument(1);
 }
@@ -401,40 +395,33 @@ void asp::AttitudeXML::parse_meta(xercesc::DOMElement* node) {
 }
 
 void asp::AttitudeXML::parse_att_list(xercesc::DOMElement* node) {
-  DOMNodeList* children = node->getChildNodes();
   size_t count = 0;
-  Vector4 qbuf;
-
-  for (XMLSize_t i = 0; i < children->getLength(); i++) {
-    if (children->item(i)->getNodeType() == DOMNode::ELEMENT_NODE) {
-      DOMElement* element = dynamic_cast<DOMElement*>(children->item(i));
-      std::string buffer;
-      cast_xmlch(element->getTextContent(), buffer);
 
-      std::istringstream istr(buffer);
-      std::string index_b;
-      istr >> index_b;
-      size_t index;
-      try {
-        index = size_t(boost::lexical_cast<float>(index_b) + 0.5) - 1;
-      } catch (boost::bad_lexical_cast const& e) {
-        vw_throw(ArgumentErr() << "Failed to parse string: " << index_b << "\n");
-      }
-
-      // Read the quaternion values for satellite orientation.
-      istr >> satellite_quat_vec[index][0]
-           >> satellite_quat_vec[index][1]
-           >> satellite_quat_vec[index][2]
-           >> satellite_quat_vec[index][3];
-      // Only the upper-right portion of the 4x4 covariance matrix is saved
-      istr >> satellite_quat_cov[10*index + 0] >> satellite_quat_cov[10*index + 1]
-           >> satellite_quat_cov[10*index + 2] >> satellite_quat_cov[10*index + 3]
-           >> satellite_quat_cov[10*index + 4] >> satellite_quat_cov[10*index + 5]
-           >> satellite_quat_cov[10*index + 6] >> satellite_quat_cov[10*index + 7]
-           >> satellite_quat_cov[10*index + 8] >> satellite_quat_cov[10*index + 9];
-
-      count++;
-    }
+  // Each sample has the index, the quaternion, and the upper-right portion
+  // of the 4x4 quaternion covariance. Read as for the ephemeris.
+  const int num_vals = 15;
+  double vals[num_vals];
+  for (DOMElement* element = node->getFirstElementChild(); element != NULL;
+       element = element->getNextElementSibling()) {
+
+    int num_read = asp::XmlUtils::parse_numbers(element->getTextContent(), vals, num_vals);
+    if (num_read < 5)
+      vw_throw(ArgumentErr() << "Failed to parse attitude sample: "
+               << asp::XmlUtils::to_string(element->getTextContent()) << "\n");
+    for (int it = num_read; it < num_vals; it++)
+      vals[it] = 0.0;
+
+    size_t index = size_t(float(vals[0]) + 0.5) - 1;
+    if (index >= satellite_quat_vec.size())
+      vw_throw(ArgumentErr() << "Invalid attitude sample index: " << vals[0] << "\n");
+
+    // The quaternion values for satellite orientation
+    for (int coord = 0; coord < 4; coord++)
+      satellite_quat_vec[index][coord] = vals[1 + coord];
+    for (int it = 0; it < 10; it++)
+      satellite_quat_cov[10*index + it] = vals[5 + it];
+
+    count++;
   }
 
   VW_ASSERT(count == satellite_quat_vec.size(),
@@ -447,7 +434,6 @@ void asp::AttitudeXML::parse(xercesc::DOMElement* node) {
   parse_meta(node);
   check_argument(0);
 
-  // TODO(oalexan1): This is slow to parse
   parse_att_list(get_node<DOMElement>(node, "ATTLISTList"));
   check_argument(1);
 }
@@ -37,6 +37,8 @@
 #include <vw/Core/StringUtils.h>
 
 #include <iomanip>
+#include <exception>
+#include <thread>
 
 using namespace vw::cartography;
 using namespace vw::math;
@@ -882,11 +884,6 @@ void genCamPoses(SatSimOptions & opt,
   ref_cam2world.resize(total);
   cam_times.resize(total, 0.0);
 
-  // Print progress
-  vw::TerminalProgressCallback tpc("asp", "\t--> ");
-  double inc_amount = 1.0 / double(total);
-  tpc.report_progress(0);
-
   // The signed distance from ref_proj to first_proj. Later will add to it the
   // distance from first_proj to the current point. This allows measuring
   // distance and time from ref_proj. Based on this, set the first line time.
@@ -895,19 +892,11 @@ void genCamPoses(SatSimOptions & opt,
   if (opt.model_time)
     first_line_time = opt.ref_time + ref_to_first_signed_dist / opt.velocity;
   
+  // Record the time at which the camera is at each position. Must be kept
+  // consistent with logic in genLinearCameras(). This is checked before the
+  // poses are found in parallel below.
   for (int i = 0; i < total; i++) {
-
-    // Parametrize the orbital segment    
     double t = double(i + first_pos) / std::max(double(opt.num_cameras - 1.0), 1.0);
-
-    // Current satellite postion in projected coordinates
-    vw::Vector3 curr_proj = first_proj * (1.0 - t) + last_proj * t;
-
-    // Signed distance from ref_proj to curr_proj. 
-    double signed_dist = ref_to_first_signed_dist + t * orbit_len;
-    
-    // Record the time at which the camera is at this position. Must
-    // be kept consistent with logic in genLinearCameras().
     cam_times[i] = first_line_time + t * orbit_len / opt.velocity;
     
     // Time better be positive, otherwise it may be tricky to interpret the timestamp
@@ -919,19 +908,53 @@ void genCamPoses(SatSimOptions & opt,
        vw::vw_throw(vw::ArgumentErr() << "Time must be less than 1e+6. Check "
                     << "--reference-time.\n");
     }
-      
+  }
+
+  // The rotations which are the same for all samples. The one with jitter is
+  // the same as the one without it if there is no jitter.
+  vw::Matrix3x3 rotXY = asp::rotationXY();
+  vw::Matrix3x3 R0 = vw::math::identity_matrix<3>();
+  if (have_roll_pitch_yaw)
+    R0 = asp::rollPitchYaw(opt.roll, opt.pitch, opt.yaw);
+
+  // Print progress
+  vw::TerminalProgressCallback tpc("asp", "\t--> ");
+  double inc_amount = 1.0 / double(total);
+  tpc.report_progress(0);
+
+  // The samples are independent of each other, so find them in parallel.
+  // Each thread uses its own copy of the georef, as the projection is not
+  // thread-safe. Exceptions are rethrown after the loop, the first one by
+  // sample index.
+  std::vector<std::exception_ptr> errors(total);
+  #pragma omp parallel
+  {
+  vw::cartography::GeoReference local_georef = dem_georef;
+  #pragma omp for schedule(dynamic, 64)
+  for (int i = 0; i < total; i++) {
+
+    try {
+    // Parametrize the orbital segment    
+    double t = double(i + first_pos) / std::max(double(opt.num_cameras - 1.0), 1.0);
+
+    // Current satellite postion in projected coordinates
+    vw::Vector3 curr_proj = first_proj * (1.0 - t) + last_proj * t;
+
+    // Signed distance from ref_proj to curr_proj. 
+    double signed_dist = ref_to_first_signed_dist + t * orbit_len;
+    
     // Calc position along the trajectory and normalized along and across vectors
     // in ECEF. Produced along and across vectors are normalized and perpendicular
     // to each other.
     vw::Vector3 P, along, across;
-    calcEcefTrajPtAlongAcross(curr_proj, dem_georef, delta,
+    calcEcefTrajPtAlongAcross(curr_proj, local_georef, delta,
                               proj_along, proj_across, 
                               // Outputs, in ECEF
                               P, along, across);
 
     // Adjust the camera if constrained by the ground but not by roll/pitch/yaw
     if (have_ground_pos && !have_roll_pitch_yaw)
-      cameraAdjustment(opt.first_ground_pos, opt.last_ground_pos, t, dem_georef, dem, P, 
+      cameraAdjustment(opt.first_ground_pos, opt.last_ground_pos, t, local_georef, dem, P, 
                        // outputs, will be normalized and perpendicular to each other
                        along, across);
     
@@ -950,32 +973,39 @@ void genCamPoses(SatSimOptions & opt,
     ref_cam2world[i] = cam2world[i];
     cam2world_no_jitter[i] = cam2world[i];
 
-    vw::Vector3 jitter_amp(0, 0, 0);
-    if (model_jitter)
-      jitter_amp = calcJitterAmplitude(opt, curr_proj, signed_dist);
-    
     // If to apply a roll, pitch, yaw rotation
     if (have_roll_pitch_yaw) {
-      vw::Matrix3x3 R = asp::rollPitchYaw(opt.roll  + jitter_amp[0], 
-                                          opt.pitch + jitter_amp[1], 
-                                          opt.yaw   + jitter_amp[2]);
+      vw::Matrix3x3 R = R0;
+      if (model_jitter) {
+        vw::Vector3 jitter_amp = calcJitterAmplitude(opt, curr_proj, signed_dist);
+        R = asp::rollPitchYaw(opt.roll  + jitter_amp[0], 
+                              opt.pitch + jitter_amp[1], 
+                              opt.yaw   + jitter_amp[2]);
+      }
       cam2world[i] = cam2world[i] * R;
     }
     
     // The rotation without jitter
-    vw::Matrix3x3 R0 = vw::math::identity_matrix<3>();
-    if (have_roll_pitch_yaw)
-      R0 = asp::rollPitchYaw(opt.roll, opt.pitch, opt.yaw);
     cam2world_no_jitter[i] = cam2world_no_jitter[i] * R0;
 
     // In either case apply the in-plane rotation from camera to satellite frame
-    cam2world[i] = cam2world[i] * asp::rotationXY();
-    cam2world_no_jitter[i] = cam2world_no_jitter[i] * asp::rotationXY();
+    cam2world[i] = cam2world[i] * rotXY;
+    cam2world_no_jitter[i] = cam2world_no_jitter[i] * rotXY;
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
 
+    #pragma omp critical
     tpc.report_incremental_progress(inc_amount);
   }
+  } // end omp parallel
   tpc.report_finished();
 
+  for (int i = 0; i < total; i++) {
+    if (errors[i])
+      std::rethrow_exception(errors[i]);
+  }
+
   return;
 }
 
@@ -1378,6 +1408,158 @@ public:
   }
 };
 
+// The portions of the DEM and ortho image seen by a group of cameras, read in
+// memory once and shared by all tiles of all images for these cameras, and a
+// pyramid of DEM heights for intersecting rays with the DEM.
+struct SynImageCache {
+  vw::cartography::GeoReference dem_georef, ortho_georef;
+  vw::ImageView<vw::PixelMask<float>> dem, ortho;
+  boost::shared_ptr<asp::DemHeightPyramid> dem_pyramid;
+};
+
+// If the DEM and ortho portions seen by a group of cameras have more pixels
+// than this, they are read for each tile instead, as before.
+const double MAX_SYN_CACHE_PIXELS = 2.5e+8;
+
+// Fill the cache for the given cameras. Return false if the portions to
+// read are too large.
+bool setupSynImageCache(vw::Vector2 const& image_size,
+                        std::vector<vw::CamPtr> const& cams,
+                        vw::ImageViewRef<vw::PixelMask<float>> const& dem,
+                        vw::cartography::GeoReference const& dem_georef,
+                        vw::ImageViewRef<vw::PixelMask<float>> const& ortho,
+                        vw::cartography::GeoReference const& ortho_georef,
+                        SynImageCache & cache) {
+
+  // The union of the footprints, in projected coordinates. This is done
+  // once per camera rather than once per tile.
+  vw::BBox2 dem_box;
+  for (size_t it = 0; it < cams.size(); it++) {
+    float mean_gsd = 0.0;
+    bool quick = true; // Assumes a big DEM fully containing the image
+    try {
+      dem_box.grow(vw::cartography::camera_bbox(dem, dem_georef, dem_georef,
+                                                cams[it], image_size[0], image_size[1],
+                                                mean_gsd, quick));
+    } catch (const vw::Exception& e) {
+      vw::vw_throw(vw::ArgumentErr() << "sat_sim: Failed to compute a synthetic image. "
+                   << "The most likely cause is that the desired image is out of "
+                   << "bounds given the input DEM and orthoimage.\n");
+    }
+  }
+
+  vw::cartography::GeoTransform d2o(dem_georef, ortho_georef);
+  vw::BBox2 ortho_box = d2o.point_to_point_bbox(dem_box);
+
+  // Expand the pixel boxes in case there were some inaccuracies in finding them
+  int expand = 50;
+  vw::BBox2i dem_pixel_box = dem_georef.point_to_pixel_bbox(dem_box);
+  dem_pixel_box.expand(expand);
+  dem_pixel_box.crop(vw::bounding_box(dem));
+  vw::BBox2i ortho_pixel_box = ortho_georef.point_to_pixel_bbox(ortho_box);
+  ortho_pixel_box.expand(expand);
+  ortho_pixel_box.crop(vw::bounding_box(ortho));
+
+  double num_pixels = double(dem_pixel_box.width()) * dem_pixel_box.height() +
+    double(ortho_pixel_box.width()) * ortho_pixel_box.height();
+  if (num_pixels > MAX_SYN_CACHE_PIXELS)
+    return false;
+
+  cache.dem          = vw::crop(dem, dem_pixel_box);
+  cache.dem_georef   = crop(dem_georef, dem_pixel_box);
+  cache.ortho        = vw::crop(ortho, ortho_pixel_box);
+  cache.ortho_georef = crop(ortho_georef, ortho_pixel_box);
+  cache.dem_pyramid.reset(new asp::DemHeightPyramid(cache.dem, cache.dem_georef));
+  return true;
+}
+
+// Create a synthetic image with multiple threads, with the DEM and ortho
+// image in memory. In each tile, the rays for all pixels are found first,
+// then intersected with the DEM pyramid, then the ortho image is sampled.
+class SynImageCachedView: public vw::ImageViewBase<SynImageCachedView> {
+
+  typedef typename ImageT::pixel_type PixelT;
+  SatSimOptions const& m_opt;
+  vw::CamPtr m_cam;
+  SynImageCache const& m_cache;
+
+public:
+  SynImageCachedView(SatSimOptions const& opt, vw::CamPtr const& cam,
+                     SynImageCache const& cache):
+    m_opt(opt), m_cam(cam), m_cache(cache) {}
+
+  typedef PixelT pixel_type;
+  typedef PixelT result_type;
+  typedef vw::ProceduralPixelAccessor<SynImageCachedView> pixel_accessor;
+
+  inline vw::int32 cols() const { return m_opt.image_size[0]; }
+  inline vw::int32 rows() const { return m_opt.image_size[1]; }
+  inline vw::int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+  inline pixel_type operator()( double/*i*/, double/*j*/, vw::int32/*p*/ = 0 ) const {
+    vw::vw_throw(vw::NoImplErr() 
+      << "SynImageCachedView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef vw::CropView<vw::ImageView<pixel_type>> prerasterize_type;
+  inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+
+    vw::cartography::GeoReference ortho_georef = m_cache.ortho_georef; // thread-safe copy
+    vw::cartography::Datum datum = m_cache.dem_georef.datum();
+
+    vw::PixelMask<float> nodata_mask = vw::PixelMask<float>(); // invalid value
+    nodata_mask.invalidate();
+    auto interp_ortho
+      = vw::interpolate(m_cache.ortho, vw::BicubicInterpolation(),
+                        vw::ValueEdgeExtension<vw::PixelMask<float>>(nodata_mask));
+
+    // The rays for all pixels in the tile
+    int num_pix = bbox.width() * bbox.height();
+    std::vector<vw::Vector3> ctrs(num_pix), dirs(num_pix);
+    for (int row = bbox.min().y(); row < bbox.max().y(); row++) {
+      for (int col = bbox.min().x(); col < bbox.max().x(); col++) {
+        int k = (row - bbox.min().y()) * bbox.width() + (col - bbox.min().x());
+        vw::Vector2 pix(col, row);
+        ctrs[k] = m_cam->camera_center(pix);
+        dirs[k] = m_cam->pixel_to_vector(pix);
+      }
+    }
+
+    vw::ImageView<result_type> tile(bbox.width(), bbox.height());
+    for (int r = 0; r < bbox.height(); r++) {
+      for (int c = 0; c < bbox.width(); c++) {
+        int k = r * bbox.width() + c;
+
+        // Start with an invalid pixel
+        tile(c, r) = nodata_mask;
+
+        vw::Vector3 xyz;
+        if (!m_cache.dem_pyramid->intersect(ctrs[k], dirs[k],
+                                            m_opt.dem_height_error_tol, xyz))
+          continue; // will result in nodata pixels
+
+        // Find the texture value at the intersection point by interpolation.
+        // This will result in an invalid value if if out of range or if the
+        // image itself has invalid pixels.
+        vw::Vector3 llh = datum.cartesian_to_geodetic(xyz);
+        vw::Vector2 ortho_pix = ortho_georef.lonlat_to_pixel(vw::Vector2(llh[0], llh[1]));
+        tile(c, r) = interp_ortho(ortho_pix[0], ortho_pix[1]);
+      }
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
+                             cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, vw::BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
 // Generate images by projecting rays from the sensor to the ground
 void genImages(SatSimOptions const& opt,
     bool external_cameras,
@@ -1404,27 +1586,75 @@ void genImages(SatSimOptions const& opt,
      image_names[i] = fs::path(cam_names[i]).replace_extension(".tif").string();
   }
 
-  for (size_t i = 0; i < cams.size(); i++) {
-
-    // Check if we do a range
-    if (skipCamera(i, opt)) continue;
+  // The images to create
+  std::vector<int> frames;
+  for (int i = 0; i < int(cams.size()); i++) {
+    if (!skipCamera(i, opt))
+      frames.push_back(i);
+  }
 
-    // Save the image using the block write function with multiple threads
-    // Increase the tile size, as otherwise this code becomes very slow
-    // since a time-consuming camera box calculation happens in each tile.
-    // TODO(oalexan1): Figure out why the slowdown.
-    vw::vw_out() << "Writing: " << image_names[i] << std::endl;
-    bool has_georef = false; // the produced image is raw, it has no georef
-    bool has_nodata = true;
-    SatSimOptions local_opt = opt;
-    local_opt.raster_tile_size = vw::Vector2i(512, 512);
-    block_write_gdal_image(image_names[i], 
-                           vw::apply_mask(SynImageView(opt, cams[i], dem_georef, dem, 
-                                                       height_guess, ortho_georef, 
-                                                       ortho, ortho_nodata_val), 
-                                          ortho_nodata_val),
-                           has_georef, ortho_georef, has_nodata, ortho_nodata_val, 
-                           local_opt, vw::TerminalProgressCallback("", "\t--> "));
+  // Increase the tile size, as otherwise this code becomes very slow
+  // when the DEM and ortho image are read for each tile, as then a
+  // time-consuming camera box calculation happens in each tile.
+  SatSimOptions local_opt = opt;
+  local_opt.raster_tile_size = vw::Vector2i(512, 512);
+  bool has_georef = false; // the produced image is raw, it has no georef
+  bool has_nodata = true;
+
+  // Create the images for a group of cameras at the same time. The DEM and
+  // ortho image portions seen by the group are read in memory once.
+  int group_size = std::max(opt.num_parallel_frames, 1);
+  for (size_t beg = 0; beg < frames.size(); beg += group_size) {
+    size_t end = std::min(beg + group_size, frames.size());
+    std::vector<vw::CamPtr> group_cams;
+    for (size_t it = beg; it < end; it++)
+      group_cams.push_back(cams[frames[it]]);
+
+    SynImageCache cache;
+    bool use_cache = setupSynImageCache(opt.image_size, group_cams, dem, dem_georef,
+                                        ortho, ortho_georef, cache);
+
+    // Save the image using the block write function with multiple threads.
+    // With several images at once, the progress is not shown, as it would
+    // be garbled.
+    auto writeImage = [&](int i) {
+      vw::vw_out() << "Writing: " << image_names[i] << std::endl;
+      vw::TerminalProgressCallback tpc("", "\t--> ");
+      vw::ProgressCallback const& progress
+        = (end - beg > 1) ? vw::ProgressCallback::dummy_instance() : tpc;
+      if (use_cache)
+        block_write_gdal_image(image_names[i], 
+                               vw::apply_mask(SynImageCachedView(opt, cams[i], cache),
+                                              ortho_nodata_val),
+                               has_georef, ortho_georef, has_nodata, ortho_nodata_val, 
+                               local_opt, progress);
+      else
+        block_write_gdal_image(image_names[i], 
+                               vw::apply_mask(SynImageView(opt, cams[i], dem_georef, dem, 
+                                                           height_guess, ortho_georef, 
+                                                           ortho, ortho_nodata_val), 
+                                              ortho_nodata_val),
+                               has_georef, ortho_georef, has_nodata, ortho_nodata_val, 
+                               local_opt, progress);
+    };
+
+    std::vector<std::exception_ptr> errors(end - beg);
+    std::vector<std::thread> threads;
+    for (size_t it = beg; it < end; it++) {
+      threads.push_back(std::thread([&, it]() {
+        try {
+          writeImage(frames[it]);
+        } catch (...) {
+          errors[it - beg] = std::current_exception();
+        }
+      }));
+    }
+    for (size_t it = 0; it < threads.size(); it++)
+      threads[it].join();
+    for (size_t it = 0; it < errors.size(); it++) {
+      if (errors[it])
+        std::rethrow_exception(errors[it]);
+    }
   }  
 
   // Write the list of images only if we are not skipping the first camera
@@ -46,7 +46,7 @@ struct SatSimOptions: vw::GdalWriteOptions {
   std::string dem_file, ortho_file, out_prefix, camera_list, sensor_type, 
   rig_sensor_ground_offsets;
   vw::Vector3 first, last; // dem pixel and height above dem datum
-  int num_cameras, first_index, last_index;
+  int num_cameras, first_index, last_index, num_parallel_frames;
   vw::Vector2 optical_center, image_size, first_ground_pos, last_ground_pos;
   double focal_length, dem_height_error_tol;
   double roll, pitch, yaw, velocity, frame_rate, ref_time;
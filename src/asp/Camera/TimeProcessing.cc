@@ -84,8 +84,74 @@ std::string fix_millisecond(std::string const& in_str) {
   return out_str;
 }
 
+namespace {
+
+// Read the given number of digits starting at the given position
+bool read_digits(std::string const& s, size_t pos, int num, int & val) {
+  if (pos + num > s.size())
+    return false;
+  val = 0;
+  for (int it = 0; it < num; it++) {
+    char c = s[pos + it];
+    if (c < '0' || c > '9')
+      return false;
+    val = 10 * val + (c - '0');
+  }
+  return true;
+}
+
+// Parse quickly a time such as "2022-04-13T22:46:31.4540000Z", which is
+// how times are given in DigitalGlobe and Pleiades metadata, with many
+// thousands of them in long scenes. Like fix_millisecond(), keep at most 6
+// digits after the dot. Return false if the string does not look like this,
+// and then the slower Boost parser will be used.
+bool parse_time_fast(std::string const& s, boost::posix_time::ptime & time) {
+
+  int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+  if (!read_digits(s, 0, 4, year)    || s.size() < 20 || s[4] != '-' ||
+      !read_digits(s, 5, 2, month)   || s[7] != '-'   ||
+      !read_digits(s, 8, 2, day)     || (s[10] != 'T' && s[10] != ' ') ||
+      !read_digits(s, 11, 2, hour)   || s[13] != ':'  ||
+      !read_digits(s, 14, 2, minute) || s[16] != ':'  ||
+      !read_digits(s, 17, 2, second) || s[19] != '.')
+    return false;
+
+  // The fractional part, in microseconds
+  size_t pos = 20;
+  int num_digits = 0, micro = 0;
+  while (pos < s.size() && s[pos] >= '0' && s[pos] <= '9') {
+    if (num_digits < 6) {
+      micro = 10 * micro + (s[pos] - '0');
+      num_digits++;
+    }
+    pos++;
+  }
+  if (pos == 20)
+    return false;
+  for (; num_digits < 6; num_digits++)
+    micro *= 10;
+
+  // Allow only a trailing "Z"
+  if (pos < s.size() && !(pos + 1 == s.size() && s[pos] == 'Z'))
+    return false;
+
+  // This throws an exception for an invalid date, as the Boost parser does
+  time = boost::posix_time::ptime(boost::gregorian::date(year, month, day),
+                                  boost::posix_time::hours(hour) +
+                                  boost::posix_time::minutes(minute) +
+                                  boost::posix_time::seconds(second) +
+                                  boost::posix_time::microseconds(micro));
+  return true;
+}
+
+} // end anonymous namespace
+
 boost::posix_time::ptime parse_time(std::string const& s) {
 
+  boost::posix_time::ptime time;
+  if (parse_time_fast(s, time))
+    return time;
+
   // Replace the T with a space so the default Boost function can
   // parse the time.
   std::string s2 = s;
@@ -95,7 +161,7 @@ boost::posix_time::ptime parse_time(std::string const& s) {
   // Boost will complain.
   s2 = asp::fix_millisecond(s2);
   
-  boost::posix_time::ptime time = boost::posix_time::time_from_string(s2);
+  time = boost::posix_time::time_from_string(s2);
   
   return time;
 }
@@ -21,3 +21,82 @@
 using namespace vw;
 
 
+
+#include <xercesc/dom/DOMNode.hpp>
+
+#include <cstdlib>
+
+namespace asp {
+
+namespace XmlUtils {
+
+XmlTag::XmlTag(std::string const& name): m_name(name) {
+  m_xml = xercesc::XMLString::transcode(name.c_str());
+}
+
+XmlTag::~XmlTag() {
+  xercesc::XMLString::release(&m_xml);
+}
+
+xercesc::DOMElement* get_child(xercesc::DOMElement* element, XmlTag const& tag) {
+  for (xercesc::DOMElement* child = element->getFirstElementChild(); child != NULL;
+       child = child->getNextElementSibling()) {
+    if (xercesc::XMLString::equals(child->getTagName(), tag.xml()))
+      return child;
+  }
+  vw_throw(vw::IOErr() << "Couldn't find \"" << tag.name() << "\" tag.");
+  return NULL; // never reached
+}
+
+bool tag_contains(xercesc::DOMElement* element, std::string const& str) {
+  return to_string(element->getTagName()).find(str) != std::string::npos;
+}
+
+std::string to_string(const XMLCh* ch) {
+  char* text = xercesc::XMLString::transcode(ch);
+  std::string ans(text);
+  xercesc::XMLString::release(&text);
+  return ans;
+}
+
+int parse_numbers(const XMLCh* ch, double* vals, int max_vals) {
+
+  // A number is at most a few dozen characters. Copy its characters to
+  // this buffer, as they are all ASCII, and parse it with strtod().
+  const int buf_len = 64;
+  char buf[buf_len];
+  int count = 0;
+  const XMLCh* pos = ch;
+  while (count < max_vals) {
+
+    // Skip the separators
+    while (*pos == ' ' || *pos == '\t' || *pos == '\n' || *pos == '\r' || *pos == ',')
+      pos++;
+    if (*pos == 0)
+      break;
+
+    int len = 0;
+    while (pos[len] != 0 && pos[len] != ' ' && pos[len] != '\t' && pos[len] != '\n' &&
+           pos[len] != '\r' && pos[len] != ',') {
+      if (len + 1 >= buf_len || pos[len] > 127)
+        vw_throw(vw::ArgumentErr() << "Failed to parse string: " << to_string(ch) << "\n");
+      buf[len] = char(pos[len]);
+      len++;
+    }
+    buf[len] = '\0';
+
+    char* end = NULL;
+    vals[count] = strtod(buf, &end);
+    if (end != buf + len)
+      vw_throw(vw::ArgumentErr() << "Failed to parse string: " << to_string(ch) << "\n");
+
+    count++;
+    pos += len;
+  }
+
+  return count;
+}
+
+} // end namespace XmlUtils
+
+} // end namespace asp
@@ -73,6 +73,39 @@ T* get_node( xercesc::DOMElement* element, std::string const& tag ) {
   return dynamic_cast<T*>(list->item(0));
 }
 
+/// A tag name converted to XML characters once, to look it up in many
+/// nodes, as when reading tens of thousands of ephemeris samples.
+class XmlTag {
+public:
+  XmlTag(std::string const& name);
+  ~XmlTag();
+  XMLCh const* xml() const { return m_xml; }
+  std::string const& name() const { return m_name; }
+private:
+  XmlTag(XmlTag const&);            // not copyable
+  XmlTag& operator=(XmlTag const&);
+  std::string m_name;
+  XMLCh* m_xml;
+};
+
+/// Find the child of this element with the given tag, among its direct
+/// children only. This is much faster than get_node() for elements in a
+/// long list, as no node list is created and the subtree is not searched.
+/// Throw an error if the child is not found.
+xercesc::DOMElement* get_child(xercesc::DOMElement* element, XmlTag const& tag);
+
+/// If the name of this element contains the given string
+bool tag_contains(xercesc::DOMElement* element, std::string const& str);
+
+/// Convert XML text to a string
+std::string to_string(const XMLCh* ch);
+
+/// Parse up to max_vals numbers separated by spaces, tabs, newlines, or
+/// commas, from XML text, without creating intermediate strings. Return
+/// how many were read. Throw an error if something other than a number
+/// is encountered.
+int parse_numbers(const XMLCh* ch, double* vals, int max_vals);
+
 } // End namespace XmlUtils 
 
 } // end namespace asp
@@ -0,0 +1,104 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Camera/BundleAdjustSolver.h>
+
+using namespace vw;
+
+// The difference between a point and a camera position, in 2D, minus its
+// observed value. Points and cameras are separate blocks, so the Schur
+// solvers apply.
+struct OffsetError {
+  OffsetError(double x, double y): m_x(x), m_y(y) {}
+  template <typename T>
+  bool operator()(const T* point, const T* cam, T* residuals) const {
+    residuals[0] = point[0] - cam[0] - m_x;
+    residuals[1] = point[1] - cam[1] - m_y;
+    return true;
+  }
+  double m_x, m_y;
+};
+
+// Solve a small problem with the given preset. Return the final cost.
+double solveWithPreset(std::string const& preset) {
+
+  int num_cams = 5, num_points = 40;
+  std::vector<double> cams(2 * num_cams), points(2 * num_points);
+  for (int c = 0; c < num_cams; c++) {
+    cams[2*c + 0] = 0.1 * c; // perturbed below
+    cams[2*c + 1] = -0.2 * c;
+  }
+  for (int p = 0; p < num_points; p++) {
+    points[2*p + 0] = 0.3 * p;
+    points[2*p + 1] = 0.05 * p * p;
+  }
+
+  ceres::Problem problem;
+  for (int c = 0; c < num_cams; c++) {
+    for (int p = 0; p < num_points; p++) {
+      // Observations from the true positions, which are (i, 2*i) for camera i
+      double x = points[2*p + 0] - c;
+      double y = points[2*p + 1] - 2.0 * c;
+      ceres::CostFunction* cost_function
+        = new ceres::AutoDiffCostFunction<OffsetError, 2, 2, 2>(new OffsetError(x, y));
+      problem.AddResidualBlock(cost_function, NULL, &points[2*p], &cams[2*c]);
+    }
+  }
+  problem.SetParameterBlockConstant(&cams[0]); // fix the gauge
+
+  // Start away from the solution
+  for (int p = 0; p < num_points; p++)
+    points[2*p + 0] += 0.5;
+
+  ceres::Solver::Options options;
+  options.linear_solver_type = ceres::SPARSE_SCHUR;
+  options.max_num_iterations = 50;
+  options.function_tolerance  = 1e-16;
+  options.gradient_tolerance  = 1e-16;
+  options.parameter_tolerance = 1e-16;
+  asp::applySolverPreset(preset, options);
+
+  ceres::Solver::Summary summary;
+  ceres::Solve(options, &problem, &summary);
+  return summary.final_cost;
+}
+
+TEST(BundleAdjustSolver, Presets) {
+
+  std::vector<std::string> presets = asp::availableSolverPresets();
+  ASSERT_FALSE(presets.empty());
+  EXPECT_EQ(presets[0], "auto");
+
+  for (size_t it = 0; it < presets.size(); it++) {
+    // The GPU presets need a device, which may not exist where the tests run
+    if (presets[it].find("cuda") != std::string::npos)
+      continue;
+    double cost = 0.0;
+    try {
+      cost = solveWithPreset(presets[it]);
+    } catch (vw::ArgumentErr const& e) {
+      // The options can still be invalid for this build, such as mixed
+      // precision without a suitable sparse library.
+      continue;
+    }
+    EXPECT_LT(cost, 1e-16) << "Preset: " << presets[it];
+  }
+
+  ceres::Solver::Options options;
+  EXPECT_THROW(asp::applySolverPreset("no-such-preset", options), vw::ArgumentErr);
+}
@@ -0,0 +1,208 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+// Micro-benchmarks for point_to_pixel(), pixel_to_vector(), and
+// camera_center() of the camera models which can be made from the files in
+// this directory. For each camera and function, print the throughput, the
+// latency percentiles, and the speedup with multiple threads. The checks
+// are only for correctness, so that this can run with the other tests.
+// Set ASP_CAMERA_BENCH_CALLS to change the number of calls per measurement.
+
+#include <asp/Camera/LinescanDGModel.h>
+#include <asp/Camera/LinescanSpotModel.h>
+#include <asp/Camera/RPCModel.h>
+#include <asp/Camera/RPC_XML.h>
+#include <asp/Camera/CsmModel.h>
+#include <vw/Camera/PinholeModel.h>
+#include <usgscsm/UsgsAstroLsSensorModel.h>
+#include <test/Helpers.h>
+#include <xercesc/util/PlatformUtils.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <thread>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct BenchCamera {
+  std::string name;
+  vw::CamPtr cam;
+  vw::Vector2 image_size;
+};
+
+int numCalls() {
+  char const* val = getenv("ASP_CAMERA_BENCH_CALLS");
+  int num = (val == NULL) ? 2000 : atoi(val);
+  return std::max(num, 16);
+}
+
+// Pixels on a grid covering the image, and ground points seen at them
+void makeSamples(BenchCamera const& b, int num,
+                 std::vector<Vector2> & pixels, std::vector<Vector3> & points) {
+  int side = std::max(2, int(std::ceil(std::sqrt(double(num)))));
+  pixels.clear();
+  points.clear();
+  for (int row = 0; row < side && int(pixels.size()) < num; row++) {
+    for (int col = 0; col < side && int(pixels.size()) < num; col++) {
+      Vector2 pix((b.image_size[0] - 1) * col / (side - 1.0),
+                  (b.image_size[1] - 1) * row / (side - 1.0));
+      Vector3 ctr = b.cam->camera_center(pix);
+      Vector3 dir = b.cam->pixel_to_vector(pix);
+      // Half-way down to the surface of an Earth-sized sphere is far
+      // enough from the camera and works for all cameras here.
+      double range = std::max(1.0e3, 0.5 * (norm_2(ctr) - 6.371e6));
+      pixels.push_back(pix);
+      points.push_back(ctr + range * dir);
+    }
+  }
+}
+
+// Time the calls in groups, to have a latency distribution without the
+// overhead of reading the clock for each call.
+void timeCalls(std::function<void(int)> const& call, int num,
+               double & calls_per_sec, std::vector<double> & group_ns) {
+  const int GROUP = 16;
+  group_ns.clear();
+  auto beg = Clock::now();
+  for (int start = 0; start + GROUP <= num; start += GROUP) {
+    auto t0 = Clock::now();
+    for (int i = start; i < start + GROUP; i++)
+      call(i);
+    auto t1 = Clock::now();
+    group_ns.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count() / GROUP);
+  }
+  double secs = std::chrono::duration<double>(Clock::now() - beg).count();
+  calls_per_sec = GROUP * group_ns.size() / std::max(secs, 1e-12);
+}
+
+// Seconds to do all calls with the given number of threads
+double timeThreaded(std::function<void(int)> const& call, int num, int num_threads) {
+  auto beg = Clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.push_back(std::thread([&call, num, num_threads, t]() {
+          for (int i = t; i < num; i += num_threads)
+            call(i);
+        }));
+  }
+  for (size_t t = 0; t < threads.size(); t++)
+    threads[t].join();
+  return std::chrono::duration<double>(Clock::now() - beg).count();
+}
+
+double percentile(std::vector<double> vals, double p) {
+  if (vals.empty())
+    return 0.0;
+  size_t k = std::min(vals.size() - 1, size_t(p * vals.size()));
+  std::nth_element(vals.begin(), vals.begin() + k, vals.end());
+  return vals[k];
+}
+
+void runBenchmark(BenchCamera const& b) {
+  int num = numCalls();
+  std::vector<Vector2> pixels;
+  std::vector<Vector3> points;
+  makeSamples(b, num, pixels, points);
+  num = pixels.size();
+
+  // The functions under test. The results are stored, so the calls are
+  // not optimized away, and are checked after.
+  std::vector<Vector2> out_pix(num);
+  std::vector<Vector3> out_vec(num);
+  std::vector<std::pair<std::string, std::function<void(int)>>> funcs;
+  funcs.push_back(std::make_pair("point_to_pixel", [&](int i) {
+        out_pix[i] = b.cam->point_to_pixel(points[i]); }));
+  funcs.push_back(std::make_pair("pixel_to_vector", [&](int i) {
+        out_vec[i] = b.cam->pixel_to_vector(pixels[i]); }));
+  funcs.push_back(std::make_pair("camera_center", [&](int i) {
+        out_vec[i] = b.cam->camera_center(pixels[i]); }));
+
+  int num_threads = std::max(1u, std::min(8u, std::thread::hardware_concurrency()));
+  for (size_t f = 0; f < funcs.size(); f++) {
+    double calls_per_sec = 0.0;
+    std::vector<double> group_ns;
+    timeCalls(funcs[f].second, num, calls_per_sec, group_ns);
+
+    double serial   = timeThreaded(funcs[f].second, num, 1);
+    double threaded = timeThreaded(funcs[f].second, num, num_threads);
+
+    std::cout << std::left << std::setw(12) << b.name << std::setw(17) << funcs[f].first
+              << std::right << std::fixed << std::setprecision(0)
+              << std::setw(12) << calls_per_sec << " calls/s"
+              << "  p50 " << std::setw(8) << percentile(group_ns, 0.50) << " ns"
+              << "  p90 " << std::setw(8) << percentile(group_ns, 0.90) << " ns"
+              << "  p99 " << std::setw(8) << percentile(group_ns, 0.99) << " ns"
+              << std::setprecision(2)
+              << "  " << num_threads << " threads: " << serial / std::max(threaded, 1e-12)
+              << "x" << std::endl;
+  }
+
+  // The last round of point_to_pixel() must have found the sampled pixels
+  double max_err = 0.0;
+  for (int i = 0; i < num; i++)
+    max_err = std::max(max_err, norm_2(out_pix[i] - pixels[i]));
+  EXPECT_LT(max_err, 0.1) << b.name;
+}
+
+} // end anonymous namespace
+
+TEST(CameraBenchmark, AllCameras) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  std::vector<BenchCamera> cams;
+  {
+    // Pinhole camera 500 km above the equator, looking down
+    Matrix3x3 R;
+    R(0, 2) = -1; R(1, 1) = 1; R(2, 0) = 1;
+    vw::CamPtr cam(new vw::camera::PinholeModel(Vector3(6.871e6, 0, 0), R,
+                                                5000, 5000, 1000, 1000));
+    cams.push_back(BenchCamera{"Pinhole", cam, Vector2(2000, 2000)});
+  }
+
+  boost::shared_ptr<DGCameraModel> dg
+    = boost::dynamic_pointer_cast<DGCameraModel>(load_dg_camera_model_from_xml("dg_example1.xml"));
+  ASSERT_TRUE(dg.get() != NULL);
+  Vector2 dg_size(dg->m_ls_model->m_nSamples, dg->m_ls_model->m_nLines);
+  cams.push_back(BenchCamera{"DG", dg, dg_size});
+
+  // The CSM linescan model behind the DG camera, without the DG tables
+  cams.push_back(BenchCamera{"CSM-ls", dg->m_csm_model, dg_size});
+
+  RPCXML rpc_xml;
+  rpc_xml.read_from_file("dg_example1.xml");
+  vw::CamPtr rpc(new RPCModel(*rpc_xml.rpc_ptr()));
+  cams.push_back(BenchCamera{"RPC", rpc, dg_size});
+
+  boost::shared_ptr<SPOTCameraModel> spot
+    = load_spot5_camera_model_from_xml("spot_example1.xml");
+  cams.push_back(BenchCamera{"SPOT", spot, Vector2(300, 96168)});
+
+  // OpticalBar, CSM frame, ASTER, Pleiades, PeruSat, and ISIS cameras need
+  // sample files which are not kept with the tests.
+  for (size_t c = 0; c < cams.size(); c++)
+    runBenchmark(cams[c]);
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
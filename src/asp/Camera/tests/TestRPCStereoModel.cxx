@@ -29,6 +29,7 @@
 #include <asp/Camera/LinescanDGModel.h>
 #include <asp/Camera/RPCModel.h>
 #include <asp/Camera/RPCStereoModel.h>
+#include <asp/Camera/CameraBatch.h>
 #include <asp/Core/StereoSettings.h>
 #include <xercesc/util/PlatformUtils.hpp>
 
@@ -192,6 +193,49 @@ TEST( StereoSessionRPC, InstantiateTest ) {
   xercesc::XMLPlatformUtils::Terminate();
 }
 
+TEST( RPCModel, BatchMatchesPerPoint ) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  RPCXML xml;
+  xml.read_from_file( "dg_example1.xml" );
+  RPCModel model( *xml.rpc_ptr() );
+
+  const int NUM_PIXELS = 5;
+  std::vector<Vector2> pixels(NUM_PIXELS);
+  std::vector<Vector3> points(NUM_PIXELS);
+  for (int i = 0; i < NUM_PIXELS; i++) {
+    pixels[i] = Vector2(1000 * i, 500 * i);
+    points[i] = model.camera_center(pixels[i]) + 1e5 * model.pixel_to_vector(pixels[i]);
+  }
+
+  std::vector<Vector2> batch_pixels(NUM_PIXELS);
+  std::vector<Vector3> batch_centers(NUM_PIXELS), batch_dirs(NUM_PIXELS);
+  asp::pointsToPixels(&model, &points[0], NUM_PIXELS, &batch_pixels[0]);
+  asp::pixelsToRays(&model, &pixels[0], NUM_PIXELS, &batch_centers[0], &batch_dirs[0]);
+
+  for (int i = 0; i < NUM_PIXELS; i++) {
+    EXPECT_VECTOR_NEAR(model.point_to_pixel(points[i]), batch_pixels[i], 1e-8);
+    EXPECT_VECTOR_NEAR(model.camera_center(pixels[i]), batch_centers[i], 1e-8);
+    EXPECT_VECTOR_NEAR(model.pixel_to_vector(pixels[i]), batch_dirs[i], 1e-12);
+  }
+
+  // The block evaluator agrees with the 20-term dot products
+  RPCBlock block;
+  for (int i = 0; i < NUM_PIXELS; i++) {
+    block.x[i] = -0.8 + 0.3 * i;
+    block.y[i] =  0.5 - 0.2 * i;
+    block.z[i] =  0.1 * i;
+  }
+  evalRPCBlock(model, NUM_PIXELS, true, block);
+  for (int i = 0; i < NUM_PIXELS; i++) {
+    Vector3 q(block.x[i], block.y[i], block.z[i]);
+    EXPECT_VECTOR_NEAR(model.normalized_geodetic_to_normalized_pixel(q),
+                       Vector2(block.samp[i], block.line[i]), 1e-12);
+  }
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
 TEST( StereoSessionRPC, CheckStereo ) {
 
   xercesc::XMLPlatformUtils::Initialize();
@@ -0,0 +1,138 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file AlignedImageView.cc
+///
+
+#include <asp/Core/AlignedImageView.h>
+
+#include <vw/Image/Algorithms.h>
+#include <vw/Math/LinearAlgebra.h>
+
+#include <cmath>
+#include <vector>
+
+namespace asp {
+
+  AlignedImageView::AlignedImageView(vw::ImageViewRef<vw::PixelMask<float>> const& image,
+                                     vw::Matrix<double> const& align_matrix,
+                                     vw::Vector2i const& warp_size,
+                                     vw::Vector2i const& out_size,
+                                     double norm_min, double norm_max):
+    m_image(image), m_warp_size(warp_size), m_cols(out_size[0]), m_rows(out_size[1]),
+    m_norm_min(norm_min) {
+
+    if (align_matrix.rows() != 3 || align_matrix.cols() != 3)
+      vw::vw_throw(vw::ArgumentErr() << "Expecting a 3x3 alignment matrix.\n");
+    m_inverse = vw::math::inverse(align_matrix);
+
+    // Same as for VW's normalize()
+    m_norm_scale = 0.0;
+    if (norm_max != norm_min)
+      m_norm_scale = 1.0 / (norm_max - norm_min);
+  }
+
+  AlignedImageView::prerasterize_type
+  AlignedImageView::prerasterize(vw::BBox2i const& bbox) const {
+
+    // Pixels start as no-data
+    vw::ImageView<pixel_type> tile(bbox.width(), bbox.height());
+    pixel_type nodata_pix;
+    nodata_pix.invalidate();
+    vw::fill(tile, nodata_pix);
+    prerasterize_type out(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+
+    vw::BBox2i active = bbox;
+    active.crop(vw::BBox2i(0, 0, m_warp_size[0], m_warp_size[1]));
+    if (active.empty())
+      return out;
+
+    // The input region seen by the tile. The image of a box under a
+    // homography is bounded by the images of its corners, unless the box
+    // crosses the line sent to infinity, when the whole input is used.
+    vw::BBox2i image_box = vw::bounding_box(m_image);
+    vw::BBox2 in_box;
+    bool use_all = false;
+    for (int c = 0; c < 4; c++) {
+      vw::Vector3 p(c % 2 == 0 ? active.min().x() : active.max().x() - 1,
+                    c / 2 == 0 ? active.min().y() : active.max().y() - 1, 1.0);
+      vw::Vector3 q = m_inverse * p;
+      if (!(q[2] > 0)) {
+        use_all = true;
+        break;
+      }
+      in_box.grow(vw::Vector2(q[0] / q[2], q[1] / q[2]));
+    }
+    vw::BBox2i in_ibox = image_box;
+    if (!use_all) {
+      // Bilinear interpolation also needs the next column and row
+      in_ibox = vw::BBox2i(vw::Vector2i(std::floor(in_box.min().x()),
+                                        std::floor(in_box.min().y())),
+                           vw::Vector2i(std::floor(in_box.max().x()) + 2,
+                                        std::floor(in_box.max().y()) + 2));
+      in_ibox.crop(image_box);
+    }
+    if (in_ibox.empty())
+      return out;
+
+    vw::ImageView<pixel_type> in_tile = vw::crop(m_image, in_ibox);
+    double in_min_x = in_ibox.min().x(), in_max_x = in_ibox.max().x() - 1;
+    double in_min_y = in_ibox.min().y(), in_max_y = in_ibox.max().y() - 1;
+
+    int width = active.width();
+    std::vector<double> xs(width), ys(width);
+    for (int row = active.min().y(); row < active.max().y(); row++) {
+
+      // The homogeneous input position changes linearly along the row. There
+      // are no branches here, so the compiler can vectorize this loop.
+      vw::Vector3 p = m_inverse * vw::Vector3(active.min().x(), row, 1.0);
+      double a0 = m_inverse(0, 0), a1 = m_inverse(1, 0), a2 = m_inverse(2, 0);
+      for (int col = 0; col < width; col++) {
+        double w = p[2] + col * a2;
+        xs[col] = (p[0] + col * a0) / w;
+        ys[col] = (p[1] + col * a1) / w;
+      }
+
+      pixel_type * out_row = &tile(active.min().x() - bbox.min().x(),
+                                   row - bbox.min().y());
+      for (int col = 0; col < width; col++) {
+
+        // Skip positions out of the input, including NaN ones
+        double fx = std::floor(xs[col]), fy = std::floor(ys[col]);
+        if (!(fx >= in_min_x && fx < in_max_x && fy >= in_min_y && fy < in_max_y))
+          continue;
+
+        int ix = int(fx) - in_ibox.min().x(), iy = int(fy) - in_ibox.min().y();
+        pixel_type const& v00 = in_tile(ix,     iy);
+        pixel_type const& v01 = in_tile(ix,     iy + 1);
+        pixel_type const& v10 = in_tile(ix + 1, iy);
+        pixel_type const& v11 = in_tile(ix + 1, iy + 1);
+        // As with masked pixel arithmetic, all four pixels must be valid
+        if (!is_valid(v00) || !is_valid(v01) || !is_valid(v10) || !is_valid(v11))
+          continue;
+
+        double nx = xs[col] - fx, ny = ys[col] - fy;
+        double val = (v00.child() * (1.0 - ny) + v01.child() * ny) * (1.0 - nx)
+          + (v10.child() * (1.0 - ny) + v11.child() * ny) * nx;
+        out_row[col] = pixel_type((val - m_norm_min) * m_norm_scale);
+      }
+    }
+
+    return out;
+  }
+
+} // end namespace asp
@@ -0,0 +1,89 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file AlignedImageView.h
+///
+
+// Apply a homography or affine alignment to a masked image and normalize
+// it, in one pass over each output tile. This produces the same pixels as
+// normalize(transform(image, HomographyTransform(H), cols, rows), min, max,
+// 0, 1), with bilinear interpolation and no-data beyond the image edges,
+// but without a chain of per-pixel views. For each tile, the needed part of
+// the input is read once. Then, for each output row, the input positions
+// are found in a tight loop, as they change linearly along the row, up to
+// the division by the homogeneous coordinate. The interpolated values are
+// normalized as they are written.
+
+#ifndef __ASP_CORE_ALIGNED_IMAGE_VIEW_H__
+#define __ASP_CORE_ALIGNED_IMAGE_VIEW_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Math/Matrix.h>
+
+namespace asp {
+
+  class AlignedImageView: public vw::ImageViewBase<AlignedImageView> {
+    vw::ImageViewRef<vw::PixelMask<float>> m_image;
+    vw::Matrix3x3 m_inverse;   // from output pixels to input pixels
+    vw::Vector2i  m_warp_size; // output pixels beyond this are no-data
+    vw::int32     m_cols, m_rows;
+    double        m_norm_min, m_norm_scale;
+
+  public:
+
+    /// The alignment matrix maps input pixels to output pixels, as for
+    /// HomographyTransform. The output has the given size. Only the pixels
+    /// within warp_size get values, the rest are no-data. This allows
+    /// producing the aligned right image already padded to the size of the
+    /// left one. The intensities from norm_min to norm_max are mapped to
+    /// [0, 1], without clamping.
+    AlignedImageView(vw::ImageViewRef<vw::PixelMask<float>> const& image,
+                     vw::Matrix<double> const& align_matrix,
+                     vw::Vector2i const& warp_size, vw::Vector2i const& out_size,
+                     double norm_min, double norm_max);
+
+    typedef vw::PixelMask<float>                      pixel_type;
+    typedef pixel_type                                result_type;
+    typedef vw::ProceduralPixelAccessor<AlignedImageView> pixel_accessor;
+
+    inline vw::int32 cols  () const { return m_cols; }
+    inline vw::int32 rows  () const { return m_rows; }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline pixel_type operator()(double /*i*/, double /*j*/, vw::int32 /*p*/ = 0) const {
+      vw::vw_throw(vw::NoImplErr() << "AlignedImageView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type>> prerasterize_type;
+    prerasterize_type prerasterize(vw::BBox2i const& bbox) const;
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_ALIGNED_IMAGE_VIEW_H__
@@ -0,0 +1,174 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file BandIpDetection.h
+///
+
+// Detect interest points in an image one band of rows at a time. Each band
+// is as tall as a detection cell and is read in one pass, from top to
+// bottom. The cells of a band are then shared among threads, each with its
+// own detector, and the points with the largest interest in
+// each cell are kept. Only one band is in memory at a time, so the memory
+// use does not depend on the image height. The result does not depend on
+// the number of threads.
+
+#ifndef __ASP_CORE_BAND_IP_DETECTION_H__
+#define __ASP_CORE_BAND_IP_DETECTION_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/InterestPoint/InterestData.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// The side of the square cells in which interest points are detected.
+  /// This is the tile size in ip_per_tile_for_image().
+  const int IP_DETECTION_CELL_SIZE = 1024;
+
+  /// Keep the given number of interest points with the largest interest.
+  /// Among points with the same interest, the earlier ones are kept.
+  inline void keep_top_ip(vw::ip::InterestPointList & ip, int max_points) {
+    if (max_points <= 0 || ip.size() <= size_t(max_points))
+      return;
+    ip.sort([](vw::ip::InterestPoint const& a, vw::ip::InterestPoint const& b) {
+        return a.interest > b.interest;
+      });
+    auto it = ip.begin();
+    std::advance(it, max_points);
+    ip.erase(it, ip.end());
+  }
+
+  /// Detect the interest points in the cells of a band, taking the next
+  /// cell not yet started until none are left. Each task makes its own
+  /// detector, as the OpenCV detectors cannot be shared among threads.
+  template <class BandT, class DetectorT>
+  class BandIpDetectionTask: public vw::Task, private boost::noncopyable {
+    BandT const& m_band;
+    DetectorT    m_detector;
+    int          m_max_points;
+    std::vector<vw::BBox2i>                 const& m_cells;
+    std::atomic<size_t>                          & m_next_cell;
+    std::vector<vw::ip::InterestPointList>       & m_cell_ip;
+    std::string                                  & m_error;
+
+  public:
+    BandIpDetectionTask(BandT const& band, DetectorT const& detector, int max_points,
+                        std::vector<vw::BBox2i> const& cells,
+                        std::atomic<size_t> & next_cell,
+                        std::vector<vw::ip::InterestPointList> & cell_ip,
+                        std::string & error):
+      m_band(band), m_detector(detector), m_max_points(max_points), m_cells(cells),
+      m_next_cell(next_cell), m_cell_ip(cell_ip), m_error(error) {}
+
+    void operator()() {
+      try {
+        while (1) {
+          size_t cell = m_next_cell++;
+          if (cell >= m_cells.size())
+            break;
+          m_cell_ip[cell] = m_detector(vw::crop(m_band, m_cells[cell]), m_max_points);
+          keep_top_ip(m_cell_ip[cell], m_max_points);
+        }
+      } catch (std::exception const& e) {
+        m_error = e.what();
+      }
+    }
+  };
+
+  /// Detect interest points in an image, one band of rows at a time, with
+  /// up to max_points points in each cell of IP_DETECTION_CELL_SIZE pixels.
+  /// The function make_detector() is called once per thread and returns a
+  /// detector. The points have the coordinates of the full image.
+  template <class ViewT, class MakeDetectorT>
+  vw::ip::InterestPointList
+  detect_ip_in_bands(vw::ImageViewBase<ViewT> const& image,
+                     MakeDetectorT const& make_detector,
+                     int max_points, size_t num_threads = 0) {
+
+    typedef decltype(make_detector()) DetectorT;
+
+    if (num_threads == 0)
+      num_threads = vw::vw_settings().default_num_threads();
+    num_threads = std::max(num_threads, size_t(1));
+
+    ViewT const& view = image.impl();
+    int cell_size = IP_DETECTION_CELL_SIZE;
+    vw::ip::InterestPointList ip;
+    typedef vw::ImageView<typename ViewT::pixel_type> BandT;
+    for (int row = 0; row < view.rows(); row += cell_size) {
+
+      vw::BBox2i band_box(0, row, view.cols(), std::min(cell_size, view.rows() - row));
+      vw::vw_out(vw::DebugMessage, "asp") << "Detecting interest points in rows "
+                                          << band_box.min().y() << " to "
+                                          << band_box.max().y() << ".\n";
+      BandT band = vw::crop(view, band_box);
+
+      std::vector<vw::BBox2i> cells;
+      for (int col = 0; col < band.cols(); col += cell_size)
+        cells.push_back(vw::BBox2i(col, 0, std::min(cell_size, band.cols() - col),
+                                   band.rows()));
+
+      std::atomic<size_t> next_cell(0);
+      std::vector<vw::ip::InterestPointList> cell_ip(cells.size());
+      std::vector<std::string> errors(std::min(num_threads, cells.size()));
+      {
+        vw::FifoWorkQueue queue(errors.size());
+        for (size_t it = 0; it < errors.size(); it++) {
+          boost::shared_ptr<vw::Task> task
+            (new BandIpDetectionTask<BandT, DetectorT>(band, make_detector(), max_points, cells,
+                                                       next_cell, cell_ip, errors[it]));
+          queue.add_task(task);
+        }
+        queue.join_all();
+      }
+      for (size_t it = 0; it < errors.size(); it++) {
+        if (errors[it] != "")
+          vw::vw_throw(vw::ArgumentErr() << "Interest point detection failed: "
+                       << errors[it] << "\n");
+      }
+
+      // Merge the cells in order, moving the points to image coordinates
+      for (size_t cell = 0; cell < cells.size(); cell++) {
+        vw::Vector2i shift = cells[cell].min() + band_box.min();
+        for (auto it = cell_ip[cell].begin(); it != cell_ip[cell].end(); it++) {
+          it->x  += shift.x();
+          it->y  += shift.y();
+          it->ix += shift.x();
+          it->iy += shift.y();
+        }
+        ip.splice(ip.end(), cell_ip[cell]);
+      }
+    }
+
+    return ip;
+  }
+
+} // end namespace asp
+
+#endif // __ASP_CORE_BAND_IP_DETECTION_H__
@@ -467,20 +467,13 @@ namespace asp {
     did_bathy = false;
     errorVec = Vector3();
     
-    // It was verified beforehand that both bathy planes have the same
-    // value for use_curved_water_surface.
-    bool use_curved_water_surface = m_bathy_set[0].use_curved_water_surface;
-    
     int num_cams = m_cameras.size();
     VW_ASSERT((int)pixVec.size() == num_cams,
               vw::ArgumentErr() << "the number of rays must match "
               << "the number of cameras.\n");
   
+    std::vector<Vector3> camDirs, camCtrs;
     try {
-
-      std::vector<Vector3> camDirs(num_cams), camCtrs(num_cams);
-      camDirs.clear(); camCtrs.clear();
-    
       // Pick the valid rays
       for (int p = 0; p < num_cams; p++){
       
@@ -492,6 +485,71 @@ namespace asp {
         camDirs.push_back(m_cameras[p]->pixel_to_vector(pix));
         camCtrs.push_back(m_cameras[p]->camera_center(pix));
       }
+    } catch (const camera::PixelToRayErr& /*e*/) {
+      return vw::Vector3();
+    }
+
+    return triangulate_rays(camDirs, camCtrs, pixVec, errorVec, do_bathy, did_bathy);
+  }
+
+  // Triangulate a batch of ray pairs found beforehand. Only the refraction
+  // and intersection happen here, as the rays are the expensive part and
+  // are best found in bulk by the caller.
+  void BathyStereoModel::triangulate(std::vector<Vector3 const*> const& ctrs,
+                                     std::vector<Vector3 const*> const& dirs,
+                                     size_t num, std::vector<bool> const& do_bathy,
+                                     Vector3 * points, Vector3 * errors,
+                                     std::vector<bool> & did_bathy) const {
+
+    if (m_least_squares)
+      vw::vw_throw(vw::NoImplErr() << "Batch triangulation does not support least "
+                   << "squares refinement.\n");
+    if (m_cameras.size() != 2 || ctrs.size() != 2 || dirs.size() != 2)
+      vw::vw_throw(vw::ArgumentErr() << "Batch bathymetry triangulation "
+                   << "needs two cameras.\n");
+
+    did_bathy.assign(num, false);
+    std::vector<Vector3> camDirs, camCtrs;
+    std::vector<Vector2> pixVec; // not used without least squares
+    for (size_t i = 0; i < num; i++) {
+
+      points[i] = Vector3();
+      errors[i] = Vector3();
+
+      camDirs.clear();
+      camCtrs.clear();
+      for (int c = 0; c < 2; c++) {
+        Vector3 const& dir = dirs[c][i];
+        Vector3 const& ctr = ctrs[c][i];
+        if (dir != dir || ctr != ctr) // i.e., NaN, so no ray
+          continue;
+        camDirs.push_back(dir);
+        camCtrs.push_back(ctr);
+      }
+
+      bool did = false;
+      points[i] = triangulate_rays(camDirs, camCtrs, pixVec, errors[i], do_bathy[i], did);
+      did_bathy[i] = did;
+    }
+  }
+
+  // Intersect the rays, with bathymetry correction if do_bathy is true
+  Vector3 BathyStereoModel::triangulate_rays(std::vector<Vector3> const& camDirs,
+                                             std::vector<Vector3> const& camCtrs,
+                                             std::vector<Vector2> const& pixVec,
+                                             Vector3& errorVec, bool do_bathy,
+                                             bool & did_bathy) const {
+    // Initialize the outputs
+    did_bathy = false;
+    errorVec = Vector3();
+    
+    // It was verified beforehand that both bathy planes have the same
+    // value for use_curved_water_surface.
+    bool use_curved_water_surface = m_bathy_set.empty() ? false :
+      m_bathy_set[0].use_curved_water_surface;
+    int num_cams = m_cameras.size();
+    
+    try {
 
       // Not enough valid rays
       if (camDirs.size() < 2) 
@@ -88,12 +88,33 @@ namespace asp {
     virtual vw::Vector3 operator()(vw::Vector2 const& pix1, vw::Vector2 const& pix2,
                                    double & error) const;
     
+    /// Triangulate a batch of two-camera rays found beforehand, such as with
+    /// one batch call per camera. The ray for pixel i in camera c is
+    /// ctrs[c][i] and dirs[c][i], which are NaN if there is no ray.
+    /// Bathymetry correction is done when do_bathy[i] is true. The outputs
+    /// are as for operator(), and are zero on failure. Least squares
+    /// refinement is not supported.
+    void triangulate(std::vector<vw::Vector3 const*> const& ctrs,
+                     std::vector<vw::Vector3 const*> const& dirs,
+                     size_t num, std::vector<bool> const& do_bathy,
+                     vw::Vector3 * points, vw::Vector3 * errors,
+                     std::vector<bool> & did_bathy) const;
+
     // Settings used for bathymetry correction. The left and right images
     // get individual bathy plane settings, but they may be identical.
     void set_bathy(double refraction_index,
                    std::vector<BathyPlaneSettings> const& bathy_set);
     
   private:
+
+    // Intersect the rays, with bathymetry correction if do_bathy is true.
+    // The pixels are used only for least squares refinement.
+    vw::Vector3 triangulate_rays(std::vector<vw::Vector3> const& camDirs,
+                                 std::vector<vw::Vector3> const& camCtrs,
+                                 std::vector<vw::Vector2> const& pixVec,
+                                 vw::Vector3& errorVec, bool do_bathy,
+                                 bool & did_bathy) const;
+
     // Used for bathymetry
     bool m_bathy_correct;                        // If to do bathy correction
     bool m_single_bathy_plane;                   // if the left and right images use same plane 
@@ -0,0 +1,318 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file BruteForceMatching.cc
+///
+
+#include <asp/Core/BruteForceMatching.h>
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/ThreadPool.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+namespace asp {
+
+  // The float target descriptors are stored in panels of BF_PANEL
+  // descriptors, with their values interleaved, so that the distances from
+  // a query to all descriptors in a panel are found with vector instructions.
+  const int BF_PANEL = 8;
+
+  // The queries and targets compared at a time, so that their descriptors
+  // and the distances between them stay in the cache.
+  const size_t BF_QUERY_BLOCK  = 32;
+  const size_t BF_TARGET_BLOCK = 256; // a multiple of BF_PANEL
+
+  // The descriptors of a set of interest points, packed for comparison
+  struct BfDescriptors {
+    size_t num;   // number of descriptors
+    int    dim;   // values per descriptor
+    int    words; // 64-bit words per binary descriptor
+    std::vector<float>         vals; // float descriptors
+    std::vector<std::uint64_t> bits; // binary descriptors
+  };
+
+  void bf_pack(std::vector<vw::ip::InterestPoint> const& ip, int dim,
+               bool use_hamming, bool as_panels, BfDescriptors & desc) {
+
+    desc.num   = ip.size();
+    desc.dim   = dim;
+    desc.words = (dim + 7) / 8;
+
+    if (use_hamming) {
+      // Each descriptor value is a byte. Pack 8 of them per word.
+      desc.bits.assign(desc.num * desc.words, 0);
+      for (size_t it = 0; it < desc.num; it++) {
+        for (int v = 0; v < dim; v++) {
+          std::uint64_t byte = static_cast<unsigned char>(ip[it].descriptor[v]);
+          desc.bits[it * desc.words + v / 8] |= byte << (8 * (v % 8));
+        }
+      }
+      return;
+    }
+
+    if (!as_panels) {
+      desc.vals.resize(desc.num * dim);
+      for (size_t it = 0; it < desc.num; it++)
+        for (int v = 0; v < dim; v++)
+          desc.vals[it * dim + v] = ip[it].descriptor[v];
+      return;
+    }
+
+    // The panel with descriptor it starts at (it / BF_PANEL) * BF_PANEL * dim.
+    // The last panel is padded with zeros.
+    size_t num_panels = (desc.num + BF_PANEL - 1) / BF_PANEL;
+    desc.vals.assign(num_panels * BF_PANEL * dim, 0.0f);
+    for (size_t it = 0; it < desc.num; it++) {
+      float * panel = desc.vals.data() + (it / BF_PANEL) * BF_PANEL * dim;
+      for (int v = 0; v < dim; v++)
+        panel[v * BF_PANEL + it % BF_PANEL] = ip[it].descriptor[v];
+    }
+  }
+
+  // Squared L2 distances from queries [q0, q1) to targets [t0, t1), with t0
+  // a multiple of BF_PANEL. Row q - q0 of buf has the distances from query q.
+  // The padding of the last panel is compared too, but not used.
+  void bf_l2_block(BfDescriptors const& query, BfDescriptors const& target,
+                   size_t q0, size_t q1, size_t t0, size_t t1, float * buf) {
+    int dim = query.dim;
+    for (size_t q = q0; q < q1; q++) {
+      float const* qv  = query.vals.data() + q * dim;
+      float      * row = buf + (q - q0) * BF_TARGET_BLOCK;
+      for (size_t p = t0; p < t1; p += BF_PANEL) {
+        float const* panel = target.vals.data() + p * dim;
+        float acc[BF_PANEL] = {0};
+        for (int v = 0; v < dim; v++) {
+          float qval = qv[v];
+          float const* pv = panel + v * BF_PANEL;
+          for (int c = 0; c < BF_PANEL; c++) {
+            float diff = qval - pv[c];
+            acc[c] += diff * diff;
+          }
+        }
+        for (int c = 0; c < BF_PANEL; c++)
+          row[p - t0 + c] = acc[c];
+      }
+    }
+  }
+
+  // Hamming distances from queries [q0, q1) to targets [t0, t1)
+  void bf_hamming_block(BfDescriptors const& query, BfDescriptors const& target,
+                        size_t q0, size_t q1, size_t t0, size_t t1, float * buf) {
+    int words = query.words;
+    for (size_t q = q0; q < q1; q++) {
+      std::uint64_t const* qb  = query.bits.data() + q * words;
+      float              * row = buf + (q - q0) * BF_TARGET_BLOCK;
+      for (size_t t = t0; t < t1; t++) {
+        std::uint64_t const* tb = target.bits.data() + t * words;
+        int dist = 0;
+        for (int w = 0; w < words; w++)
+          dist += __builtin_popcountll(qb[w] ^ tb[w]);
+        row[t - t0] = dist;
+      }
+    }
+  }
+
+  // Find the k nearest targets for queries [begin, end). Optionally
+  // find the nearest query in this range for each target.
+  class BruteForceKnnTask: public vw::Task, private boost::noncopyable {
+    BfDescriptors const& m_query;
+    BfDescriptors const& m_target;
+    bool                 m_use_hamming;
+    int                  m_k;
+    size_t               m_begin, m_end;
+    std::vector<int>   & m_indices;
+    std::vector<float> & m_dists;
+    std::vector<int>   * m_rev_index; // may be null
+    std::vector<float> * m_rev_dist;
+
+  public:
+    BruteForceKnnTask(BfDescriptors const& query, BfDescriptors const& target,
+                      bool use_hamming, int k, size_t begin, size_t end,
+                      std::vector<int> & indices, std::vector<float> & dists,
+                      std::vector<int> * rev_index, std::vector<float> * rev_dist):
+      m_query(query), m_target(target), m_use_hamming(use_hamming), m_k(k),
+      m_begin(begin), m_end(end), m_indices(indices), m_dists(dists),
+      m_rev_index(rev_index), m_rev_dist(rev_dist) {}
+
+    void operator()() {
+      std::vector<float> buf(BF_QUERY_BLOCK * BF_TARGET_BLOCK);
+      for (size_t q0 = m_begin; q0 < m_end; q0 += BF_QUERY_BLOCK) {
+        size_t q1 = std::min(q0 + BF_QUERY_BLOCK, m_end);
+        for (size_t t0 = 0; t0 < m_target.num; t0 += BF_TARGET_BLOCK) {
+          size_t t1 = std::min(t0 + BF_TARGET_BLOCK, m_target.num);
+          if (m_use_hamming)
+            bf_hamming_block(m_query, m_target, q0, q1, t0, t1, buf.data());
+          else
+            bf_l2_block(m_query, m_target, q0, q1, t0, t1, buf.data());
+
+          // Targets and queries are visited in increasing order, and a
+          // distance must be strictly smaller to replace another, so ties
+          // go to the smaller index.
+          for (size_t q = q0; q < q1; q++) {
+            float const* row = buf.data() + (q - q0) * BF_TARGET_BLOCK;
+            int   * index = m_indices.data() + q * m_k;
+            float * dist  = m_dists.data()   + q * m_k;
+            for (size_t t = t0; t < t1; t++) {
+              float d = row[t - t0];
+              if (d < dist[m_k - 1]) {
+                int j = m_k - 1;
+                while (j > 0 && d < dist[j - 1]) {
+                  dist[j]  = dist[j - 1];
+                  index[j] = index[j - 1];
+                  j--;
+                }
+                dist[j]  = d;
+                index[j] = t;
+              }
+              if (m_rev_index != NULL && d < (*m_rev_dist)[t]) {
+                (*m_rev_dist)[t]  = d;
+                (*m_rev_index)[t] = q;
+              }
+            }
+          }
+        }
+      }
+    }
+  };
+
+  void brute_force_knn(std::vector<vw::ip::InterestPoint> const& query,
+                       std::vector<vw::ip::InterestPoint> const& target,
+                       bool use_hamming, int k, size_t num_threads,
+                       std::vector<int>   & indices,
+                       std::vector<float> & dists,
+                       std::vector<int>   * reverse_nearest) {
+
+    if (k <= 0)
+      vw::vw_throw(vw::ArgumentErr() << "Brute-force matching: Expecting a positive "
+                   << "number of neighbors.\n");
+
+    const float inf = std::numeric_limits<float>::infinity();
+    indices.assign(query.size() * k, -1);
+    dists.assign(query.size() * k, inf);
+    if (reverse_nearest != NULL)
+      reverse_nearest->assign(target.size(), -1);
+    if (query.empty() || target.empty())
+      return;
+
+    // All descriptors must have the same size
+    int dim = query[0].descriptor.size();
+    for (size_t it = 0; it < query.size(); it++)
+      if (int(query[it].descriptor.size()) != dim)
+        vw::vw_throw(vw::ArgumentErr() << "Brute-force matching: The interest point "
+                     << "descriptors have different sizes.\n");
+    for (size_t it = 0; it < target.size(); it++)
+      if (int(target[it].descriptor.size()) != dim)
+        vw::vw_throw(vw::ArgumentErr() << "Brute-force matching: The interest point "
+                     << "descriptors have different sizes.\n");
+    if (dim == 0)
+      vw::vw_throw(vw::ArgumentErr() << "Brute-force matching: The interest points "
+                   << "have no descriptors.\n");
+
+    BfDescriptors packed_query, packed_target;
+    bf_pack(query,  dim, use_hamming, false, packed_query);
+    bf_pack(target, dim, use_hamming, true,  packed_target);
+
+    // Split the queries in contiguous ranges, one per thread. Each range
+    // finds the nearest query for each target on its own. These are merged
+    // in order, so ties still go to the smaller index.
+    size_t num_blocks = (query.size() + BF_QUERY_BLOCK - 1) / BF_QUERY_BLOCK;
+    size_t num_tasks  = std::max(size_t(1), std::min(num_threads, num_blocks));
+    size_t blocks_per_task = (num_blocks + num_tasks - 1) / num_tasks;
+    std::vector<std::vector<int>>   rev_index(num_tasks);
+    std::vector<std::vector<float>> rev_dist(num_tasks);
+
+    std::vector<boost::shared_ptr<BruteForceKnnTask>> tasks;
+    for (size_t it = 0; it < num_tasks; it++) {
+      size_t begin = std::min(it * blocks_per_task * BF_QUERY_BLOCK, query.size());
+      size_t end   = std::min(begin + blocks_per_task * BF_QUERY_BLOCK, query.size());
+      if (begin >= end)
+        break;
+      std::vector<int>   * rev_index_ptr = NULL;
+      std::vector<float> * rev_dist_ptr  = NULL;
+      if (reverse_nearest != NULL) {
+        rev_index[it].assign(target.size(), -1);
+        rev_dist[it].assign(target.size(), inf);
+        rev_index_ptr = &rev_index[it];
+        rev_dist_ptr  = &rev_dist[it];
+      }
+      tasks.push_back(boost::shared_ptr<BruteForceKnnTask>
+                      (new BruteForceKnnTask(packed_query, packed_target, use_hamming, k,
+                                             begin, end, indices, dists,
+                                             rev_index_ptr, rev_dist_ptr)));
+    }
+
+    if (tasks.size() == 1) {
+      (*tasks[0])();
+    } else {
+      vw::FifoWorkQueue queue(num_threads);
+      for (size_t it = 0; it < tasks.size(); it++)
+        queue.add_task(tasks[it]);
+      queue.join_all();
+    }
+
+    if (reverse_nearest == NULL)
+      return;
+    std::vector<float> best_dist(target.size(), inf);
+    for (size_t it = 0; it < tasks.size(); it++) {
+      for (size_t t = 0; t < target.size(); t++) {
+        if (rev_dist[it][t] < best_dist[t]) {
+          best_dist[t] = rev_dist[it][t];
+          (*reverse_nearest)[t] = rev_index[it][t];
+        }
+      }
+    }
+  }
+
+  void brute_force_ip_matching(std::vector<vw::ip::InterestPoint> const& ip1,
+                               std::vector<vw::ip::InterestPoint> const& ip2,
+                               bool use_hamming, double uniqueness_threshold,
+                               size_t num_threads,
+                               std::vector<vw::ip::InterestPoint> & matched_ip1,
+                               std::vector<vw::ip::InterestPoint> & matched_ip2) {
+
+    matched_ip1.clear();
+    matched_ip2.clear();
+    if (ip1.empty() || ip2.empty())
+      return;
+
+    const int k = 2;
+    std::vector<int> indices, nearest1;
+    std::vector<float> dists;
+    brute_force_knn(ip1, ip2, use_hamming, k, num_threads, indices, dists, &nearest1);
+
+    for (size_t i = 0; i < ip1.size(); i++) {
+      int j = indices[i * k];
+      if (j < 0 || nearest1[j] != int(i))
+        continue; // not mutual nearest neighbors
+
+      // With a single target there is no second neighbor to compare with
+      if (indices[i * k + 1] >= 0 &&
+          !(dists[i * k] < uniqueness_threshold * dists[i * k + 1]))
+        continue; // not unique enough
+
+      matched_ip1.push_back(ip1[i]);
+      matched_ip2.push_back(ip2[j]);
+    }
+  }
+
+} // end namespace asp
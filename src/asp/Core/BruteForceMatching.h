@@ -0,0 +1,64 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file BruteForceMatching.h
+///
+
+// Exact matching of interest point descriptors, by comparing each descriptor
+// in one set with each one in the other set, rather than with the
+// approximate FLANN search. The descriptors are packed in contiguous arrays
+// and compared in blocks which fit in the cache. Float descriptors are
+// compared with the squared L2 distance, as FLANN does, in a layout the
+// compiler can vectorize. Binary ORB descriptors are compared with the
+// Hamming distance. The result does not depend on the number of threads.
+
+#ifndef __ASP_CORE_BRUTE_FORCE_MATCHING_H__
+#define __ASP_CORE_BRUTE_FORCE_MATCHING_H__
+
+#include <vw/InterestPoint/InterestData.h>
+
+#include <vector>
+
+namespace asp {
+
+  /// For each query descriptor find the indices of its k nearest target
+  /// descriptors and their distances, sorted by increasing distance, with
+  /// ties going to the smaller index. Entry i * k + j is for the j-th
+  /// nearest neighbor of query i. If there are fewer than k targets, the
+  /// remaining indices are -1. If reverse_nearest is not null, also find
+  /// for each target the index of its nearest query, in the same pass.
+  void brute_force_knn(std::vector<vw::ip::InterestPoint> const& query,
+                       std::vector<vw::ip::InterestPoint> const& target,
+                       bool use_hamming, int k, size_t num_threads,
+                       std::vector<int>   & indices,
+                       std::vector<float> & dists,
+                       std::vector<int>   * reverse_nearest = NULL);
+
+  /// Match two sets of interest points by brute force. A pair is kept if
+  /// the points are each other's nearest neighbor, and the distance to the
+  /// nearest neighbor of the first point is less than uniqueness_threshold
+  /// times the distance to its second nearest neighbor.
+  void brute_force_ip_matching(std::vector<vw::ip::InterestPoint> const& ip1,
+                               std::vector<vw::ip::InterestPoint> const& ip2,
+                               bool use_hamming, double uniqueness_threshold,
+                               size_t num_threads,
+                               std::vector<vw::ip::InterestPoint> & matched_ip1,
+                               std::vector<vw::ip::InterestPoint> & matched_ip2);
+
+} // end namespace asp
+
+#endif // __ASP_CORE_BRUTE_FORCE_MATCHING_H__
@@ -20,6 +20,8 @@
 
 #include <asp/Core/BundleAdjustUtils.h>
 #include <asp/Core/ImageUtils.h>
+#include <asp/Core/DemUtils.h>
+#include <asp/Core/FileUtils.h>
 
 #include <vw/Core/Log.h>
 #include <vw/Camera/CameraModel.h>
@@ -27,11 +29,17 @@
 #include <vw/Stereo/StereoModel.h>
 #include <vw/Cartography/GeoReference.h>
 #include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/DiskImageUtils.h>
 #include <vw/Cartography/CameraBBox.h>
 #include <vw/BundleAdjustment/CameraRelation.h>
 #include <vw/InterestPoint/Matcher.h>
 
 #include <string>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdint>
+#include <cstring>
 
 using namespace vw;
 using namespace vw::camera;
@@ -119,7 +127,8 @@ void compute_stereo_residuals(std::vector<vw::CamPtr> const& camera_models,
 vw::BBox2 camera_bbox_with_cache(std::string const& dem_file,
                                  std::string const& image_file,
                                  vw::CamPtr  const& camera_model,
-                                 std::string const& out_prefix) {
+                                 std::string const& out_prefix,
+                                 std::string const& prev_prefix) {
   
   namespace fs = boost::filesystem;
 
@@ -128,43 +137,58 @@ vw::BBox2 camera_bbox_with_cache(std::string const& dem_file,
   vw::BBox2 box;
   
   std::string box_path = out_prefix + '-' + fs::path(image_file).stem().string() + "-bbox.txt";
-  if (fs::exists(box_path)) {
+  std::vector<std::string> cached_paths;
+  cached_paths.push_back(box_path);
+  bool found_cached = false;
+  if (prev_prefix != "")
+    cached_paths.push_back(prev_prefix + '-' + fs::path(image_file).stem().string()
+                           + "-bbox.txt");
+  for (size_t it = 0; it < cached_paths.size(); it++) {
+    if (!fs::exists(cached_paths[it]))
+      continue;
     double min_x, min_y, max_x, max_y;
-    std::ifstream ifs(box_path);
+    std::ifstream ifs(cached_paths[it]);
     if (ifs >> min_x >> min_y >> max_x >> max_y) {
       box.min() = vw::Vector2(min_x, min_y);
       box.max() = vw::Vector2(max_x, max_y);
-      vw_out() << "Read cached ground footprint bbox from: " << box_path << ":\n" << box << "\n";
-      return box;
+      vw_out() << "Read cached ground footprint bbox from: " << cached_paths[it] << ":\n"
+               << box << "\n";
+      if (it == 0)
+        return box;
+      found_cached = true;
+      break; // Copy it to the current cache below
     }
   }
 
-  // Read the DEM and supporting data
-  vw::cartography::GeoReference dem_georef;
-  DiskImageView<float> dem_disk_image(dem_file);
-  ImageViewRef<PixelMask<float>> dem;
-  boost::shared_ptr<DiskImageResource> dem_rsrc(DiskImageResourcePtr(dem_file));
-  if (dem_rsrc->has_nodata_read())
-    dem = create_mask(dem_disk_image, dem_rsrc->nodata_read());
-  else
-    dem = pixel_cast<PixelMask<float>>(dem_disk_image); // all pixels are valid
-  
-  bool has_georef = vw::cartography::read_georeference(dem_georef, dem_file);
-  if (!has_georef)
-    vw_throw( ArgumentErr() << "There is no georeference information in: "
-              << dem_file << ".\n" );
+  if (!found_cached) {
 
-  try {
-    DiskImageView<float> img(image_file);
-    float auto_res = -1.0;  // Will be updated
-    bool quick = false;     // Do a thorough job
-    box = vw::cartography::camera_bbox(dem, dem_georef, dem_georef,
-                                       camera_model, img.cols(), img.rows(),
-                                       auto_res, quick);
-  } catch (std::exception const& e) {
-    vw_throw( ArgumentErr() << e.what() << "\n"
-              << "Failed to compute the footprint of camera image: " << image_file
-              << " onto DEM: " << dem_file << ".\n");
+    // Read the DEM and supporting data
+    vw::cartography::GeoReference dem_georef;
+    DiskImageView<float> dem_disk_image(dem_file);
+    ImageViewRef<PixelMask<float>> dem;
+    boost::shared_ptr<DiskImageResource> dem_rsrc(DiskImageResourcePtr(dem_file));
+    if (dem_rsrc->has_nodata_read())
+      dem = create_mask(dem_disk_image, dem_rsrc->nodata_read());
+    else
+      dem = pixel_cast<PixelMask<float>>(dem_disk_image); // all pixels are valid
+  
+    bool has_georef = vw::cartography::read_georeference(dem_georef, dem_file);
+    if (!has_georef)
+      vw_throw( ArgumentErr() << "There is no georeference information in: "
+                << dem_file << ".\n" );
+
+    try {
+      DiskImageView<float> img(image_file);
+      float auto_res = -1.0;  // Will be updated
+      bool quick = false;     // Do a thorough job
+      box = vw::cartography::camera_bbox(dem, dem_georef, dem_georef,
+                                         camera_model, img.cols(), img.rows(),
+                                         auto_res, quick);
+    } catch (std::exception const& e) {
+      vw_throw( ArgumentErr() << e.what() << "\n"
+                << "Failed to compute the footprint of camera image: " << image_file
+                << " onto DEM: " << dem_file << ".\n");
+    }
   }
 
   vw_out() << "Writing: " << box_path << "\n";
@@ -434,6 +458,7 @@ void update_point_from_dem(vw::ba::ControlNetwork const& cnet,
                            std::vector<vw::CamPtr> const& camera_models,
                            vw::cartography::GeoReference const& dem_georef,
                            vw::ImageViewRef<vw::PixelMask<double>> const& interp_dem,
+                           asp::DemHeightPyramid const& dem_pyramid,
                            // Output
                            std::vector<vw::Vector3> & dem_xyz_vec) {
 
@@ -442,6 +467,9 @@ void update_point_from_dem(vw::ba::ControlNetwork const& cnet,
   dem_xyz_vec = std::vector<vw::Vector3>(num_tri_points, vw::Vector3(0, 0, 0));
   std::vector<int> dem_xyz_count(num_tri_points, 0);
   
+  // Find the rays serially, as the cameras may not be thread-safe
+  std::vector<int> ray_pts;
+  std::vector<Vector3> ctrs, dirs;
   for (int icam = 0; icam < (int)crn.size(); icam++) {
     
     for (auto fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++) {
@@ -459,36 +487,30 @@ void update_point_from_dem(vw::ba::ControlNetwork const& cnet,
       // the camera with index icam.
       Vector2 observation = (**fiter).m_location;
         
-      // Ideally this point projects back to the pixel observation, so use the
-      // triangulated position as initial guess.
-      Vector3 xyz_guess = cnet[ipt].position();
-
       // Points at planet center are outliers. This check is likely redundant,
       // but good to have.
-      if (xyz_guess == Vector3(0, 0, 0))
-        continue;
-
-      bool treat_nodata_as_zero = false;
-      bool has_intersection = false;
-      double height_error_tol = 0.001; // 1 mm should be enough
-      double max_abs_tol      = 1e-14; // abs cost fun change b/w iterations
-      double max_rel_tol      = 1e-14;
-      int num_max_iter        = 25;   // Using many iterations can be very slow
-
-      Vector3 dem_xyz = vw::cartography::camera_pixel_to_dem_xyz
-        (camera_models[icam]->camera_center(observation),
-         camera_models[icam]->pixel_to_vector(observation),
-         interp_dem, dem_georef, treat_nodata_as_zero, has_intersection,
-         height_error_tol, max_abs_tol, max_rel_tol, num_max_iter, xyz_guess);
-
-      if (!has_intersection) 
+      if (cnet[ipt].position() == Vector3(0, 0, 0))
         continue;
 
-      dem_xyz_vec[ipt] += dem_xyz;
-      dem_xyz_count[ipt]++;
+      ray_pts.push_back(ipt);
+      ctrs.push_back(camera_models[icam]->camera_center(observation));
+      dirs.push_back(camera_models[icam]->pixel_to_vector(observation));
     }
   }
 
+  // Intersect the rays with the DEM in parallel. The first intersection
+  // along each ray is found, with no initial guess.
+  double height_error_tol = 0.001; // 1 mm should be enough
+  std::vector<Vector3> ray_xyz;
+  asp::demIntersectRays(dem_pyramid, ctrs, dirs, height_error_tol, ray_xyz);
+
+  for (size_t it = 0; it < ray_pts.size(); it++) {
+    if (ray_xyz[it] == Vector3()) 
+      continue; // no intersection
+    dem_xyz_vec[ray_pts[it]] += ray_xyz[it];
+    dem_xyz_count[ray_pts[it]]++;
+  }
+
   // Average the successful intersections
   for (size_t xyz_it = 0; xyz_it < dem_xyz_vec.size(); xyz_it++) {
     if (dem_xyz_count[xyz_it] > 0) 
@@ -602,4 +624,217 @@ std::string csmStateFile(std::string const& adjustFile) {
   return csmFile;
 }
 
+// The control network cache. It has a header, followed by flat arrays of
+// fixed-size records, first for the points and then for the measures of all
+// points, so it can be read with a few large reads, or memory-mapped.
+const char CNET_CACHE_MAGIC[8] = {'A', 'S', 'P', 'C', 'N', 'E', 'T', '1'};
+
+struct CnetCacheHeader {
+  char          magic[8];
+  std::uint64_t key, num_images, num_points, num_measures;
+};
+
+struct CnetCachePoint {
+  double        position[3], sigma[3];
+  std::int32_t  type, ignore;
+  std::uint64_t num_measures;
+};
+
+struct CnetCacheMeasure {
+  double        position[2], sigma[2];
+  std::int64_t  image_id;
+  std::int32_t  ignore, padding;
+};
+
+// A 64-bit FNV-1a hash of a string
+std::uint64_t cnetStringHash(std::string const& str) {
+  std::uint64_t hash = 14695981039346656037ULL;
+  for (size_t it = 0; it < str.size(); it++) {
+    hash ^= static_cast<unsigned char>(str[it]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// The key of the control network cache. The cameras are represented by where
+// some pixels project, so this covers also adjustments and initial transforms
+// applied to them. Return 0 if a camera cannot be evaluated.
+std::uint64_t cnetCacheKey(bool triangulate_control_points,
+                           std::vector<vw::CamPtr> const& camera_models,
+                           std::vector<std::string> const& image_files,
+                           std::map<std::pair<int, int>, std::string> const& match_files,
+                           size_t min_matches, double min_angle_radians,
+                           double forced_triangulation_distance,
+                           int max_pairwise_matches) {
+
+  std::ostringstream os;
+  os.precision(17);
+  os << triangulate_control_points << ' ' << min_matches << ' ' << min_angle_radians
+     << ' ' << forced_triangulation_distance << ' ' << max_pairwise_matches << '\n';
+
+  try {
+    for (size_t it = 0; it < image_files.size(); it++) {
+      vw::Vector2 size = vw::file_image_size(image_files[it]);
+      os << image_files[it] << ' ' << size << '\n';
+      vw::Vector2 pixels[] = {vw::Vector2(0, 0), size/2.0, size - vw::Vector2(1, 1)};
+      for (int p = 0; p < 3; p++)
+        os << camera_models[it]->camera_center(pixels[p]) << ' '
+           << camera_models[it]->pixel_to_vector(pixels[p]) << '\n';
+    }
+  } catch (...) {
+    return 0;
+  }
+
+  for (auto it = match_files.begin(); it != match_files.end(); it++)
+    os << it->first.first << ' ' << it->first.second << ' ' << it->second << ' '
+       << asp::file_content_hash(it->second) << '\n';
+
+  std::uint64_t key = cnetStringHash(os.str());
+  if (key == 0)
+    key = 1; // 0 means no key
+  return key;
+}
+
+// Load the cached control network if its key agrees with the given one
+bool readCnetCache(std::string const& cache_file, std::uint64_t key,
+                   std::vector<std::string> const& image_files,
+                   vw::ba::ControlNetwork & cnet) {
+
+  std::ifstream ifs(cache_file.c_str(), std::ios::binary);
+  if (!ifs.good())
+    return false;
+
+  CnetCacheHeader header;
+  ifs.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!ifs || std::memcmp(header.magic, CNET_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.key != key || header.num_images != image_files.size())
+    return false;
+
+  std::vector<CnetCachePoint> points(header.num_points);
+  std::vector<CnetCacheMeasure> measures(header.num_measures);
+  if (!points.empty())
+    ifs.read(reinterpret_cast<char*>(&points[0]), points.size() * sizeof(CnetCachePoint));
+  if (!measures.empty())
+    ifs.read(reinterpret_cast<char*>(&measures[0]),
+             measures.size() * sizeof(CnetCacheMeasure));
+  if (!ifs)
+    return false;
+
+  // Fill a local network, so the output is not touched on failure
+  vw::ba::ControlNetwork local_cnet("BundleAdjust");
+  for (size_t it = 0; it < image_files.size(); it++)
+    local_cnet.add_image_name(image_files[it]);
+
+  size_t measure_count = 0;
+  for (size_t ipt = 0; ipt < points.size(); ipt++) {
+    CnetCachePoint const& P = points[ipt];
+    if (measure_count + P.num_measures > measures.size())
+      return false;
+    vw::ba::ControlPoint cp(static_cast<vw::ba::ControlPoint::ControlPointType>(P.type));
+    cp.set_position(vw::Vector3(P.position[0], P.position[1], P.position[2]));
+    cp.set_sigma(vw::Vector3(P.sigma[0], P.sigma[1], P.sigma[2]));
+    cp.set_ignore(P.ignore != 0);
+    for (size_t im = 0; im < P.num_measures; im++) {
+      CnetCacheMeasure const& M = measures[measure_count++];
+      vw::ba::ControlMeasure cm(M.position[0], M.position[1], M.sigma[0], M.sigma[1],
+                                M.image_id);
+      cm.set_ignore(M.ignore != 0);
+      cp.add_measure(cm);
+    }
+    local_cnet.add_control_point(cp);
+  }
+
+  if (measure_count != measures.size())
+    return false;
+
+  cnet = local_cnet;
+  return true;
+}
+
+void writeCnetCache(std::string const& cache_file, std::uint64_t key,
+                    vw::ba::ControlNetwork const& cnet) {
+
+  std::vector<CnetCachePoint> points(cnet.size());
+  std::vector<CnetCacheMeasure> measures;
+  for (size_t ipt = 0; ipt < cnet.size(); ipt++) {
+    vw::ba::ControlPoint const& cp = cnet[ipt];
+    CnetCachePoint & P = points[ipt];
+    for (int c = 0; c < 3; c++) {
+      P.position[c] = cp.position()[c];
+      P.sigma[c]    = cp.sigma()[c];
+    }
+    P.type = cp.type();
+    P.ignore = cp.ignore();
+    P.num_measures = cp.size();
+    for (size_t im = 0; im < cp.size(); im++) {
+      vw::ba::ControlMeasure const& cm = cp[im];
+      CnetCacheMeasure M;
+      for (int c = 0; c < 2; c++) {
+        M.position[c] = cm.position()[c];
+        M.sigma[c]    = cm.sigma()[c];
+      }
+      M.image_id = cm.image_id();
+      M.ignore   = cm.ignore();
+      M.padding  = 0;
+      measures.push_back(M);
+    }
+  }
+
+  CnetCacheHeader header;
+  std::memcpy(header.magic, CNET_CACHE_MAGIC, sizeof(header.magic));
+  header.key          = key;
+  header.num_images   = cnet.get_image_list().size();
+  header.num_points   = points.size();
+  header.num_measures = measures.size();
+
+  vw_out() << "Writing: " << cache_file << "\n";
+  std::ofstream ofs(cache_file.c_str(), std::ios::binary);
+  ofs.write(reinterpret_cast<char const*>(&header), sizeof(header));
+  if (!points.empty())
+    ofs.write(reinterpret_cast<char const*>(&points[0]),
+              points.size() * sizeof(CnetCachePoint));
+  if (!measures.empty())
+    ofs.write(reinterpret_cast<char const*>(&measures[0]),
+              measures.size() * sizeof(CnetCacheMeasure));
+  if (!ofs) {
+    // A failed cache is not fatal, but must not be used later
+    vw_out(WarningMessage) << "Failed to write: " << cache_file << "\n";
+    ofs.close();
+    boost::system::error_code ec;
+    fs::remove(cache_file, ec);
+  }
+}
+
+bool build_control_network_with_cache(bool triangulate_control_points,
+                                      vw::ba::ControlNetwork& cnet,
+                                      std::vector<vw::CamPtr> const& camera_models,
+                                      std::vector<std::string> const& image_files,
+                                      std::map<std::pair<int, int>, std::string>
+                                      const& match_files,
+                                      size_t min_matches,
+                                      double min_angle_radians,
+                                      double forced_triangulation_distance,
+                                      int max_pairwise_matches,
+                                      std::string const& out_prefix) {
+
+  std::string cache_file = out_prefix + "-cnet-cache.bin";
+  std::uint64_t key = cnetCacheKey(triangulate_control_points, camera_models, image_files,
+                                   match_files, min_matches, min_angle_radians,
+                                   forced_triangulation_distance, max_pairwise_matches);
+  if (key != 0 && readCnetCache(cache_file, key, image_files, cnet)) {
+    vw_out() << "Read the control network from the cache: " << cache_file << "\n";
+    return (cnet.size() > 0);
+  }
+
+  bool success = vw::ba::build_control_network(triangulate_control_points,
+                                               cnet, camera_models, image_files,
+                                               match_files, min_matches, min_angle_radians,
+                                               forced_triangulation_distance,
+                                               max_pairwise_matches);
+  if (success && key != 0)
+    writeCnetCache(cache_file, key, cnet);
+
+  return success;
+}
+
 } // end namespace asp
\ No newline at end of file
@@ -21,6 +21,8 @@
 #ifndef __BUNDLE_ADJUST_UTILS_H__
 #define __BUNDLE_ADJUST_UTILS_H__
 
+#include <asp/Core/DemUtils.h>
+
 #include <vw/Math/Vector.h>
 #include <vw/Math/Quaternion.h>
 #include <vw/Math/BBox.h>
@@ -30,6 +32,7 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <map>
 
 #include <boost/smart_ptr/shared_ptr.hpp>
 
@@ -74,12 +77,14 @@ typedef vw::ba::CameraRelationNetwork<vw::ba::JFeature> CRNJ;
                                 vw::ba::ControlNetwork const& cnet);
 
   // Compute a camera footprint's bounding box. Used a cached result if available.
-  // Cache the current result if computed.
+  // Cache the current result if computed. If prev_prefix is set, a result cached
+  // with that prefix is used as well, and copied to the cache for out_prefix.
   vw::BBox2 camera_bbox_with_cache(std::string const& dem_file,
                                    std::string const& image_file,
                                    boost::shared_ptr<vw::camera::CameraModel> const&
                                    camera_model,
-                                   std::string const& out_prefix);
+                                   std::string const& out_prefix,
+                                   std::string const& prev_prefix = "");
   
   // Expand a box by a given percentage (typically pct is between 0 and 100)
   void expand_box_by_pct(vw::BBox2 & box, double pct);
@@ -129,13 +134,14 @@ typedef vw::ba::CameraRelationNetwork<vw::ba::JFeature> CRNJ;
 
   // Shoot rays from all matching interest point. Intersect those with a DEM. Find
   // their average. Project it vertically onto the DEM. Invalid or uncomputable
-  // xyz are set to the zero vector.
+  // xyz are set to the zero vector. The DEM pyramid must be for the same DEM.
   void update_point_from_dem(vw::ba::ControlNetwork const& cnet,
                              asp::CRNJ const& crn,
                              std::set<int> const& outliers,
                              std::vector<vw::CamPtr> const& camera_models,
                              vw::cartography::GeoReference const& dem_georef,
                              vw::ImageViewRef<vw::PixelMask<double>> const& interp_dem,
+                             asp::DemHeightPyramid const& dem_pyramid,
                              // Output
                              std::vector<vw::Vector3> & dem_xyz_vec);
   
@@ -151,6 +157,22 @@ typedef vw::ba::CameraRelationNetwork<vw::ba::JFeature> CRNJ;
   
   // Manufacture a CSM state file from an adjust file
   std::string csmStateFile(std::string const& adjustFile);
+
+  /// Build the control network from match files, as
+  /// vw::ba::build_control_network() does, or load it from
+  /// <out_prefix>-cnet-cache.bin, saved by an earlier run, if the match files
+  /// (by content), images, cameras, and the options used here did not change.
+  bool build_control_network_with_cache(bool triangulate_control_points,
+                                        vw::ba::ControlNetwork& cnet,
+                                        std::vector<vw::CamPtr> const& camera_models,
+                                        std::vector<std::string> const& image_files,
+                                        std::map<std::pair<int, int>, std::string>
+                                        const& match_files,
+                                        size_t min_matches,
+                                        double min_angle_radians,
+                                        double forced_triangulation_distance,
+                                        int max_pairwise_matches,
+                                        std::string const& out_prefix);
 } // end namespace asp
 
 #endif // __BUNDLE_ADJUST_UTILS_H__
@@ -20,10 +20,13 @@
 #include <vw/Math/BBox.h>
 #include <vw/FileIO/DiskImageResource.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/MemoryBudget.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/Tracing.h>
 
 #include <asp/asp_date_config.h>
 
+#include <fstream>
 #include <map>
 #include <sstream>
 #include <string>
@@ -31,6 +34,8 @@
 #include <unistd.h>
 
 #include <gdal_version.h>
+#include <gdal_utils.h>
+#include <cpl_string.h>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -414,6 +419,70 @@ std::string asp::extract_prog_name(std::string const& prog_str){
   return prog_name;
 }
 
+int asp::run_batch(int argc, char *argv[], int (*main_func)(int argc, char *argv[])) {
+
+  // Separate the batch list from the other arguments
+  std::string batch_list;
+  std::vector<std::string> args;
+  for (int i = 0; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--batch-list" && i + 1 < argc) {
+      batch_list = argv[++i];
+      continue;
+    }
+    if (boost::starts_with(arg, "--batch-list=")) {
+      batch_list = arg.substr(std::string("--batch-list=").size());
+      continue;
+    }
+    args.push_back(arg);
+  }
+
+  if (batch_list.empty())
+    return main_func(argc, argv);
+
+  std::ifstream ifs(batch_list.c_str());
+  if (!ifs) {
+    vw::vw_out() << "\n\nERROR: Cannot read: " << batch_list << "\n\n";
+    return 1;
+  }
+
+  int num_runs = 0, num_failed = 0;
+  std::string line;
+  while (std::getline(ifs, line)) {
+
+    // Skip empty lines and comments
+    std::vector<std::string> run_args = args;
+    std::istringstream iss(line);
+    std::string token;
+    int num_tokens = 0;
+    while (iss >> token) {
+      if (num_tokens == 0 && token[0] == '#')
+        break;
+      run_args.push_back(token);
+      num_tokens++;
+    }
+    if (num_tokens == 0)
+      continue;
+
+    std::vector<char*> run_argv;
+    for (size_t i = 0; i < run_args.size(); i++)
+      run_argv.push_back(&run_args[i][0]);
+    run_argv.push_back(NULL);
+
+    num_runs++;
+    vw::vw_out() << "Batch run " << num_runs << ": " << line << "\n";
+    if (main_func(run_args.size(), &run_argv[0]) != 0) {
+      num_failed++;
+      vw::vw_out(vw::WarningMessage) << "Batch run failed: " << line << "\n";
+    }
+  }
+
+  vw::vw_out() << "Finished " << num_runs << " batch runs, of which "
+               << num_failed << " failed.\n";
+
+  return (num_failed == 0) ? 0 : 1;
+}
+
 void asp::log_to_file(int argc, char *argv[],
                       std::string stereo_default_filename,
                       std::string out_prefix){
@@ -633,6 +702,7 @@ asp::check_command_line(int argc, char *argv[], vw::GdalWriteOptions& opt,
   usage_comment = ostr.str();
 
   set_asp_env_vars();
+  asp::trace_init(argv[0]);
   
   // We distinguish between all_public_options, which is all the
   // options we must parse, even if we don't need some of them, and
@@ -693,7 +763,10 @@ asp::check_command_line(int argc, char *argv[], vw::GdalWriteOptions& opt,
   }
 
   opt.setVwSettingsFromOpt();
-  
+
+  // A memory budget set in the environment replaces --cache-size-mb
+  asp::set_memory_budget(asp::memory_budget_mb(0.0));
+
   return vm;
 }
 
@@ -818,6 +891,94 @@ std::string asp::read_target_name(std::string const& filename) {
   return target;
 }
 
+// Copy a GeoTIFF to a Cloud-Optimized GeoTIFF. The COG driver creates the
+// overviews, each level from the previous one, and writes them before the
+// full-resolution tiles, so that a reader can fetch them with HTTP range
+// requests. The georeference, nodata value, and metadata are kept.
+void asp::write_cog(std::string const& input_file, std::string const& output_file,
+                    vw::GdalWriteOptions const& opt) {
+
+  std::string compress = "LZW", bigtiff = "IF_SAFER", num_threads = "ALL_CPUS";
+  auto it = opt.gdal_options.find("COMPRESS");
+  if (it != opt.gdal_options.end())
+    compress = it->second;
+  it = opt.gdal_options.find("BIGTIFF");
+  if (it != opt.gdal_options.end())
+    bigtiff = it->second;
+  if (opt.num_threads > 0)
+    num_threads = std::to_string(opt.num_threads);
+
+  std::vector<std::string> args = {"-of", "COG",
+                                   "-co", "COMPRESS=" + compress,
+                                   "-co", "BIGTIFF=" + bigtiff,
+                                   "-co", "NUM_THREADS=" + num_threads};
+  // The COG block size must be a power of 2
+  int block_size = opt.raster_tile_size[0];
+  if (block_size == opt.raster_tile_size[1] && block_size >= 64 &&
+      (block_size & (block_size - 1)) == 0) {
+    args.push_back("-co");
+    args.push_back("BLOCKSIZE=" + std::to_string(block_size));
+  }
+
+  char ** argv = NULL;
+  for (size_t i = 0; i < args.size(); i++)
+    argv = CSLAddString(argv, args[i].c_str());
+  GDALTranslateOptions * translate_opts = GDALTranslateOptionsNew(argv, NULL);
+  CSLDestroy(argv);
+  if (translate_opts == NULL)
+    vw_throw(ArgumentErr() << "Invalid options for writing: " << output_file << "\n");
+
+  GDALAllRegister();
+  GDALDatasetH input = GDALOpen(input_file.c_str(), GA_ReadOnly);
+  if (input == NULL) {
+    GDALTranslateOptionsFree(translate_opts);
+    vw_throw(IOErr() << "Cannot open: " << input_file << "\n");
+  }
+
+  vw_out() << "Writing Cloud-Optimized GeoTIFF: " << output_file << "\n";
+  int usage_error = 0;
+  GDALDatasetH output = GDALTranslate(output_file.c_str(), input, translate_opts,
+                                      &usage_error);
+  GDALTranslateOptionsFree(translate_opts);
+  GDALClose(input);
+  if (output == NULL || usage_error)
+    vw_throw(IOErr() << "Failed to write: " << output_file << "\n");
+  GDALClose(output);
+}
+
+// Convert a GeoTIFF to a Cloud-Optimized GeoTIFF, in place.
+void asp::convert_to_cog(std::string const& filename, vw::GdalWriteOptions const& opt) {
+  std::string tmp_file
+    = boost::filesystem::path(filename).replace_extension(".tmp.tif").string();
+  boost::filesystem::rename(filename, tmp_file);
+  asp::write_cog(tmp_file, filename, opt);
+  boost::filesystem::remove(tmp_file);
+}
+
+// ZSTD with the floating-point predictor, and LERC with zero error, compress
+// floating-point data better than LZW, and decode faster.
+vw::GdalWriteOptions asp::intermediate_write_options(vw::GdalWriteOptions const& opt,
+                                                     bool is_float) {
+
+  vw::GdalWriteOptions out_opt = opt;
+  std::string codec = boost::to_lower_copy(asp::stereo_settings().intermediate_compression);
+  if (codec == "" || codec == "default") {
+    return out_opt;
+  } else if (codec == "zstd") {
+    out_opt.gdal_options["COMPRESS"]  = "ZSTD";
+    out_opt.gdal_options["PREDICTOR"] = is_float ? "3" : "2";
+  } else if (codec == "lerc" || codec == "lerc_zstd") {
+    out_opt.gdal_options["COMPRESS"]    = boost::to_upper_copy(codec);
+    out_opt.gdal_options["MAX_Z_ERROR"] = "0";
+    out_opt.gdal_options.erase("PREDICTOR");
+  } else {
+    vw_throw(ArgumentErr() << "Unknown value for --intermediate-compression: "
+             << asp::stereo_settings().intermediate_compression << ".\n");
+  }
+
+  return out_opt;
+}
+
 void asp::BitChecker::check_argument(vw::uint8 arg) {
   // Turn on the arg'th bit in m_checksum
   m_checksum.set(arg);
@@ -42,6 +42,8 @@
 #include <vw/Cartography/GeoReference.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 
+#include <asp/Core/Tracing.h>
+
 #include <boost/program_options.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/shared_ptr.hpp>
@@ -121,6 +123,13 @@ namespace asp {
                    std::string stereo_default_filename,
                    std::string output_prefix);
 
+  /// If the option --batch-list is set, call the given main function once
+  /// for each line of that file, in this process, with the arguments on that
+  /// line appended to the other arguments. Otherwise call it once. For many
+  /// small runs, this saves starting a process and loading and initializing
+  /// the libraries and plugins for each. Return 0 if all runs succeeded.
+  int run_batch(int argc, char *argv[], int (*main_func)(int argc, char *argv[]));
+
   /// Set env variables for some of ASP's dependencies
   void set_asp_env_vars();
   
@@ -257,8 +266,24 @@ namespace asp {
                                std::map<std::string, std::string>());
 
 
+  /// Copy a GeoTIFF to a Cloud-Optimized GeoTIFF, with internal overviews.
+  /// Use the compression, BIGTIFF setting, block size, and number of threads
+  /// from opt.
+  void write_cog(std::string const& input_file, std::string const& output_file,
+                 vw::GdalWriteOptions const& opt);
+
+  /// Convert a GeoTIFF to a Cloud-Optimized GeoTIFF, in place.
+  void convert_to_cog(std::string const& filename, vw::GdalWriteOptions const& opt);
+
+  /// Options for writing an intermediate file, such as a disparity or
+  /// point cloud, with the compression set by --intermediate-compression.
+  /// The predictor depends on whether the pixel values are floating-point.
+  vw::GdalWriteOptions intermediate_write_options(vw::GdalWriteOptions const& opt,
+                                                  bool is_float);
+
   /// Often times, we'd like to save an image to disk by using big
   /// blocks, for performance reasons, then re-write it with desired blocks.
+  /// If cog is true, the re-write is to a Cloud-Optimized GeoTIFF.
   template <class ImageT>
   void save_with_temp_big_blocks(int big_block_size,
                                  const std::string &filename,
@@ -267,7 +292,8 @@ namespace asp {
                                  vw::cartography::GeoReference const& georef,
                                  bool has_nodata, double nodata,
                                  vw::GdalWriteOptions & opt,
-                                 vw::ProgressCallback const& tpc);
+                                 vw::ProgressCallback const& tpc,
+                                 bool cog = false);
 
 
   // TODO: Replace with something else!
@@ -40,6 +40,8 @@ namespace asp {
                                      vw::ProgressCallback const& progress_callback,
                                      std::map<std::string, std::string> const& keywords) {
 
+    // The span includes computing the pixels being written
+    asp::TraceSpan trace_span("block_write", "io", [&filename]() { return filename; });
 
     if (norm_2(shift) > 0){
 
@@ -102,12 +104,23 @@ namespace asp {
                                  vw::cartography::GeoReference const& georef,
                                  bool has_nodata, double nodata,
                                  vw::GdalWriteOptions & opt,
-                                 vw::ProgressCallback const& tpc){
+                                 vw::ProgressCallback const& tpc,
+                                 bool cog){
+
+    // The span includes computing the pixels being written
+    asp::TraceSpan trace_span("block_write", "io", [&filename]() { return filename; });
 
     vw::Vector2 orig_block_size = opt.raster_tile_size;
     opt.raster_tile_size = vw::Vector2(big_block_size, big_block_size);
     block_write_gdal_image(filename, img, has_georef, georef, has_nodata, nodata, opt, tpc);
 
+    if (cog) {
+      // The COG is written with the desired blocks, so no other re-write is needed
+      opt.raster_tile_size = orig_block_size;
+      asp::convert_to_cog(filename, opt);
+      return;
+    }
+
     if (opt.raster_tile_size != orig_block_size){
       std::string tmp_file
         = boost::filesystem::path(filename).replace_extension(".tmp.tif").string();
@@ -0,0 +1,452 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file CorrEvalView.cc
+///
+
+#include <asp/Core/CorrEvalView.h>
+
+#include <vw/Image/Algorithms.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace asp {
+
+namespace {
+
+  // A part of an image, with the no-data pixels set to zero, and a mask
+  // which is 1 at valid pixels and 0 elsewhere. Pixels beyond the image
+  // are no-data.
+  struct Region {
+    vw::BBox2i box;
+    int width, height;
+    std::vector<float> val, mask;
+
+    void read(vw::ImageViewRef<vw::PixelMask<float>> const& image,
+              vw::BBox2i const& region_box) {
+      box    = region_box;
+      width  = box.width();
+      height = box.height();
+      val.assign(size_t(width) * height, 0.0f);
+      mask.assign(size_t(width) * height, 0.0f);
+
+      vw::BBox2i in_box = box;
+      in_box.crop(vw::bounding_box(image));
+      if (in_box.empty())
+        return;
+
+      vw::ImageView<vw::PixelMask<float>> in_tile = vw::crop(image, in_box);
+      for (int row = 0; row < in_tile.rows(); row++) {
+        size_t start = index(in_box.min().x(), in_box.min().y() + row);
+        for (int col = 0; col < in_tile.cols(); col++) {
+          vw::PixelMask<float> const& pix = in_tile(col, row);
+          if (!is_valid(pix))
+            continue;
+          val[start + col]  = pix.child();
+          mask[start + col] = 1.0f;
+        }
+      }
+    }
+
+    // The index of a pixel given in image coordinates
+    inline size_t index(int x, int y) const {
+      return size_t(y - box.min().y()) * width + (x - box.min().x());
+    }
+  };
+
+  // Sums over rectangles in constant time. The entry at (x, y) is the sum
+  // of the values at smaller columns and rows.
+  class Integral {
+    int m_stride;
+    std::vector<double> m_sums;
+  public:
+    template <class FuncT>
+    void build(int width, int height, FuncT func) {
+      m_stride = width + 1;
+      m_sums.assign(size_t(width + 1) * (height + 1), 0.0);
+      for (int y = 0; y < height; y++) {
+        double row_sum = 0.0;
+        double const* prev = &m_sums[size_t(y) * m_stride];
+        double      * curr = &m_sums[size_t(y + 1) * m_stride];
+        for (int x = 0; x < width; x++) {
+          row_sum += func(x, y);
+          curr[x + 1] = prev[x + 1] + row_sum;
+        }
+      }
+    }
+
+    /// The sum over nx columns and ny rows starting at (x, y), in region
+    /// coordinates
+    inline double sum(int x, int y, int nx, int ny) const {
+      size_t r0 = size_t(y) * m_stride, r1 = size_t(y + ny) * m_stride;
+      return m_sums[r1 + x + nx] - m_sums[r0 + x + nx] - m_sums[r1 + x] + m_sums[r0 + x];
+    }
+  };
+
+  // The offsets of the four right patches used with bilinear interpolation
+  const int OFF_X[4] = {0, 1, 0, 1};
+  const int OFF_Y[4] = {0, 0, 1, 1};
+
+  // The sum of products of the left patch at (lx, ly) and the right patch
+  // at (rx, ry), both in region coordinates. The patch rows are contiguous
+  // in memory, and the inner loop has no branches.
+  double patch_product(Region const& L, Region const& R, int lx, int ly,
+                       int rx, int ry, int kx, int ky) {
+    double sum = 0.0;
+    for (int j = 0; j < ky; j++) {
+      float const* l = &L.val[size_t(ly + j) * L.width + lx];
+      float const* r = &R.val[size_t(ry + j) * R.width + rx];
+      double row_sum = 0.0;
+      for (int i = 0; i < kx; i++)
+        row_sum += double(l[i]) * r[i];
+      sum += row_sum;
+    }
+    return sum;
+  }
+
+  // The same for one column of the patches
+  double column_product(Region const& L, Region const& R, int lx, int ly,
+                        int rx, int ry, int ky) {
+    double sum = 0.0;
+    for (int j = 0; j < ky; j++)
+      sum += double(L.val[size_t(ly + j) * L.width + lx]) * R.val[size_t(ry + j) * R.width + rx];
+    return sum;
+  }
+
+  // The right image value at (x, y) in region coordinates, with bilinear
+  // interpolation if there are several weights. Return false if any of the
+  // pixels used is no-data.
+  inline bool right_value(Region const& R, int x, int y, int num_weights,
+                          double const* weights, double & value) {
+    value = 0.0;
+    for (int a = 0; a < num_weights; a++) {
+      size_t k = size_t(y + OFF_Y[a]) * R.width + x + OFF_X[a];
+      if (R.mask[k] == 0.0f)
+        return false;
+      value += weights[a] * R.val[k];
+    }
+    return true;
+  }
+
+} // end anonymous namespace
+
+CorrEvalView::CorrEvalView(vw::ImageViewRef<vw::PixelMask<float>> const& left,
+                           vw::ImageViewRef<vw::PixelMask<float>> const& right,
+                           vw::ImageViewRef<vw::PixelMask<vw::Vector2f>> const& disp,
+                           vw::Vector2i const& kernel_size, std::string const& metric,
+                           int sample_rate, bool round_to_int):
+  m_left(left), m_right(right), m_disp(disp), m_kernel_size(kernel_size),
+  m_ncc(metric == "ncc"), m_sample_rate(sample_rate), m_round_to_int(round_to_int) {
+
+  if (metric != "ncc" && metric != "stddev")
+    vw::vw_throw(vw::ArgumentErr() << "Unknown correlation quality metric: " << metric << ".\n");
+  if (kernel_size[0] <= 0 || kernel_size[1] <= 0 ||
+      kernel_size[0] % 2 == 0 || kernel_size[1] % 2 == 0)
+    vw::vw_throw(vw::ArgumentErr() << "The kernel size must have positive odd values.\n");
+  if (sample_rate < 1)
+    vw::vw_throw(vw::ArgumentErr() << "The sample rate must be positive.\n");
+  if (left.cols() != disp.cols() || left.rows() != disp.rows())
+    vw::vw_throw(vw::ArgumentErr() << "The left image and disparity must have "
+                 << "the same size.\n");
+}
+
+CorrEvalView::prerasterize_type
+CorrEvalView::prerasterize(vw::BBox2i const& bbox) const {
+
+  // Pixels start as no-data
+  vw::ImageView<pixel_type> tile(bbox.width(), bbox.height());
+  pixel_type nodata_pix;
+  nodata_pix.invalidate();
+  vw::fill(tile, nodata_pix);
+  prerasterize_type out(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+
+  vw::ImageView<vw::PixelMask<vw::Vector2f>> disp = vw::crop(m_disp, bbox);
+  eval_block(bbox, bbox, disp, tile);
+
+  return out;
+}
+
+void CorrEvalView::eval_block(vw::BBox2i const& block, vw::BBox2i const& tile_box,
+                              vw::ImageView<vw::PixelMask<vw::Vector2f>> const& disp,
+                              vw::ImageView<vw::PixelMask<float>> & tile) const {
+
+  int kx = m_kernel_size[0], ky = m_kernel_size[1];
+  int hx = kx / 2, hy = ky / 2;
+  // Bilinear interpolation also needs the next column and row
+  int e = m_round_to_int ? 0 : 1;
+  int num_weights = m_round_to_int ? 1 : 4;
+  int s = m_sample_rate;
+
+  // The integer part of the disparity, and the bilinear weights
+  auto split_disp = [&](vw::Vector2f const& d, int & dx, int & dy, double * w) {
+    if (m_round_to_int) {
+      dx = int(std::round(d[0]));
+      dy = int(std::round(d[1]));
+      w[0] = 1.0;
+      return;
+    }
+    dx = int(std::floor(d[0]));
+    dy = int(std::floor(d[1]));
+    double fx = d[0] - dx, fy = d[1] - dy;
+    w[0] = (1.0 - fx) * (1.0 - fy);
+    w[1] = fx * (1.0 - fy);
+    w[2] = (1.0 - fx) * fy;
+    w[3] = fx * fy;
+  };
+
+  // The range of integer disparities in the block
+  bool found = false;
+  int min_dx = 0, max_dx = 0, min_dy = 0, max_dy = 0;
+  for (int row = block.min().y(); row < block.max().y(); row++) {
+    if (row % s != 0)
+      continue;
+    for (int col = block.min().x(); col < block.max().x(); col++) {
+      if (col % s != 0)
+        continue;
+      vw::PixelMask<vw::Vector2f> const& d
+        = disp(col - tile_box.min().x(), row - tile_box.min().y());
+      if (!is_valid(d) || d.child() != d.child()) // skip NaN
+        continue;
+      int dx = 0, dy = 0;
+      double w[4];
+      split_disp(d.child(), dx, dy, w);
+      if (!found) {
+        min_dx = max_dx = dx;
+        min_dy = max_dy = dy;
+        found = true;
+      }
+      min_dx = std::min(min_dx, dx); max_dx = std::max(max_dx, dx);
+      min_dy = std::min(min_dy, dy); max_dy = std::max(max_dy, dy);
+    }
+  }
+  if (!found)
+    return;
+
+  vw::BBox2i left_box(block.min() - vw::Vector2i(hx, hy), block.max() + vw::Vector2i(hx, hy));
+  vw::BBox2i right_box(vw::Vector2i(block.min().x() + min_dx - hx,
+                                    block.min().y() + min_dy - hy),
+                       vw::Vector2i(block.max().x() + max_dx + hx + e,
+                                    block.max().y() + max_dy + hy + e));
+
+  // If the disparity varies a lot, such as due to outliers, the right
+  // region can be much bigger than the left one. Then split the block.
+  double left_area  = double(left_box.width())  * left_box.height();
+  double right_area = double(right_box.width()) * right_box.height();
+  if (right_area > 4.0 * left_area && (block.width() > 1 || block.height() > 1)) {
+    vw::BBox2i b1 = block, b2 = block;
+    if (block.width() >= block.height()) {
+      int mid = block.min().x() + block.width() / 2;
+      b1.max().x() = mid;
+      b2.min().x() = mid;
+    } else {
+      int mid = block.min().y() + block.height() / 2;
+      b1.max().y() = mid;
+      b2.min().y() = mid;
+    }
+    eval_block(b1, tile_box, disp, tile);
+    eval_block(b2, tile_box, disp, tile);
+    return;
+  }
+
+  Region L, R;
+  L.read(m_left,  left_box);
+  R.read(m_right, right_box);
+
+  Integral L_count, L_sum, L_sq, R_count, R_sum, R_sq;
+  L_count.build(L.width, L.height, [&](int x, int y) { return L.mask[size_t(y) * L.width + x]; });
+  L_sq.build   (L.width, L.height, [&](int x, int y) {
+      double v = L.val[size_t(y) * L.width + x]; return v * v; });
+  R_count.build(R.width, R.height, [&](int x, int y) { return R.mask[size_t(y) * R.width + x]; });
+  R_sq.build   (R.width, R.height, [&](int x, int y) {
+      double v = R.val[size_t(y) * R.width + x]; return v * v; });
+  if (!m_ncc) {
+    L_sum.build(L.width, L.height, [&](int x, int y) { return L.val[size_t(y) * L.width + x]; });
+    R_sum.build(R.width, R.height, [&](int x, int y) { return R.val[size_t(y) * R.width + x]; });
+  }
+
+  // For bilinear interpolation, the products of right image values with
+  // their neighbors to the right, below, and on the two diagonals
+  Integral P10, P01, P11, P1m;
+  if (!m_round_to_int) {
+    auto rv = [&](int x, int y) -> double {
+      if (x < 0 || y < 0 || x >= R.width || y >= R.height)
+        return 0.0;
+      return R.val[size_t(y) * R.width + x];
+    };
+    P10.build(R.width, R.height, [&](int x, int y) { return rv(x, y) * rv(x + 1, y);     });
+    P01.build(R.width, R.height, [&](int x, int y) { return rv(x, y) * rv(x,     y + 1); });
+    P11.build(R.width, R.height, [&](int x, int y) { return rv(x, y) * rv(x + 1, y + 1); });
+    P1m.build(R.width, R.height, [&](int x, int y) { return rv(x, y) * rv(x + 1, y - 1); });
+  }
+
+  // The sum over the right patch at (rx, ry) of the interpolated values and
+  // of their squares, when all pixels used are valid. The interpolated
+  // value is the sum of the four shifted patches times their weights.
+  auto right_sums = [&](int rx, int ry, double const* w, double & sum, double & sq) {
+    if (m_round_to_int) {
+      sq = R_sq.sum(rx, ry, kx, ky);
+      if (!m_ncc)
+        sum = R_sum.sum(rx, ry, kx, ky);
+      return;
+    }
+    sq = 0.0;
+    sum = 0.0;
+    for (int a = 0; a < 4; a++) {
+      sq += w[a] * w[a] * R_sq.sum(rx + OFF_X[a], ry + OFF_Y[a], kx, ky);
+      if (!m_ncc)
+        sum += w[a] * R_sum.sum(rx + OFF_X[a], ry + OFF_Y[a], kx, ky);
+    }
+    sq += 2.0 * (w[0] * w[1] * P10.sum(rx,     ry,     kx, ky) +
+                 w[0] * w[2] * P01.sum(rx,     ry,     kx, ky) +
+                 w[0] * w[3] * P11.sum(rx,     ry,     kx, ky) +
+                 w[1] * w[2] * P1m.sum(rx,     ry + 1, kx, ky) +
+                 w[1] * w[3] * P01.sum(rx + 1, ry,     kx, ky) +
+                 w[2] * w[3] * P10.sum(rx,     ry + 1, kx, ky));
+  };
+
+  double full_left  = double(kx) * ky;
+  double full_right = double(kx + e) * (ky + e);
+
+  for (int row = block.min().y(); row < block.max().y(); row++) {
+    if (row % s != 0)
+      continue;
+
+    // The running sums of products of the left and shifted right patches,
+    // for the previous pixel in the row, if it had the same integer disparity
+    bool   run = false;
+    int    run_col = 0, run_dx = 0, run_dy = 0;
+    double cross[4] = {0.0, 0.0, 0.0, 0.0};
+
+    for (int col = block.min().x(); col < block.max().x(); col++) {
+      if (col % s != 0)
+        continue;
+
+      vw::PixelMask<vw::Vector2f> const& d
+        = disp(col - tile_box.min().x(), row - tile_box.min().y());
+      if (!is_valid(d) || d.child() != d.child() ||
+          L.mask[L.index(col, row)] == 0.0f) {
+        run = false;
+        continue;
+      }
+
+      int dx = 0, dy = 0;
+      double w[4];
+      split_disp(d.child(), dx, dy, w);
+
+      // The patch corners, in region coordinates
+      int lx = col - hx - left_box.min().x(),       ly = row - hy - left_box.min().y();
+      int rx = col + dx - hx - right_box.min().x(), ry = row + dy - hy - right_box.min().y();
+
+      double num_left = L_count.sum(lx, ly, kx, ky);
+      bool full = (num_left == full_left &&
+                   R_count.sum(rx, ry, kx + e, ky + e) == full_right);
+
+      double value = 0.0;
+      bool good = false;
+
+      if (!m_ncc) {
+
+        // Average of the standard deviations of the left and right patches,
+        // each over its valid pixels
+        double left_sum = L_sum.sum(lx, ly, kx, ky), left_sq = L_sq.sum(lx, ly, kx, ky);
+        double num_right = 0.0, right_sum = 0.0, right_sq = 0.0;
+        if (full) {
+          num_right = double(kx) * ky;
+          right_sums(rx, ry, w, right_sum, right_sq);
+        } else if (m_round_to_int) {
+          num_right = R_count.sum(rx, ry, kx, ky);
+          right_sum = R_sum.sum(rx, ry, kx, ky);
+          right_sq  = R_sq.sum(rx, ry, kx, ky);
+        } else {
+          for (int j = 0; j < ky; j++) {
+            for (int i = 0; i < kx; i++) {
+              double v = 0.0;
+              if (!right_value(R, rx + i, ry + j, num_weights, w, v))
+                continue;
+              num_right += 1.0;
+              right_sum += v;
+              right_sq  += v * v;
+            }
+          }
+        }
+
+        if (num_left > 0 && num_right > 0) {
+          double left_mean = left_sum / num_left, right_mean = right_sum / num_right;
+          double left_var  = std::max(0.0, left_sq  / num_left  - left_mean  * left_mean);
+          double right_var = std::max(0.0, right_sq / num_right - right_mean * right_mean);
+          value = 0.5 * (std::sqrt(left_var) + std::sqrt(right_var));
+          good = true;
+        }
+
+      } else {
+
+        // Normalized cross-correlation, over the pixels valid in both patches
+        double s_lr = 0.0, s_ll = 0.0, s_rr = 0.0;
+        if (full) {
+          s_ll = L_sq.sum(lx, ly, kx, ky);
+          double right_sum = 0.0;
+          right_sums(rx, ry, w, right_sum, s_rr);
+
+          if (run && run_col == col - 1 && run_dx == dx && run_dy == dy) {
+            // Move the patches by one column
+            for (int a = 0; a < num_weights; a++)
+              cross[a] += column_product(L, R, lx + kx - 1, ly,
+                                         rx + kx - 1 + OFF_X[a], ry + OFF_Y[a], ky)
+                - column_product(L, R, lx - 1, ly, rx - 1 + OFF_X[a], ry + OFF_Y[a], ky);
+          } else {
+            for (int a = 0; a < num_weights; a++)
+              cross[a] = patch_product(L, R, lx, ly, rx + OFF_X[a], ry + OFF_Y[a], kx, ky);
+          }
+          run = true;
+          run_col = col;
+          run_dx = dx;
+          run_dy = dy;
+
+          for (int a = 0; a < num_weights; a++)
+            s_lr += w[a] * cross[a];
+
+        } else {
+          run = false;
+          for (int j = 0; j < ky; j++) {
+            for (int i = 0; i < kx; i++) {
+              size_t k = size_t(ly + j) * L.width + lx + i;
+              double v = 0.0;
+              if (L.mask[k] == 0.0f || !right_value(R, rx + i, ry + j, num_weights, w, v))
+                continue;
+              double l = L.val[k];
+              s_lr += l * v;
+              s_ll += l * l;
+              s_rr += v * v;
+            }
+          }
+        }
+
+        if (s_ll > 0.0 && s_rr > 0.0) {
+          value = s_lr / std::sqrt(s_ll * s_rr);
+          good = true;
+        }
+      }
+
+      if (good)
+        tile(col - tile_box.min().x(), row - tile_box.min().y()) = pixel_type(value);
+    }
+  }
+}
+
+} // end namespace asp
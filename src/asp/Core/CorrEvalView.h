@@ -0,0 +1,98 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file CorrEvalView.h
+///
+
+// Evaluate the quality of a disparity at each pixel, with the same metrics
+// as vw::stereo::corr_eval(), but without extracting the image patches of
+// each pixel. For each tile, the needed parts of the left and right images
+// are read once, and integral images are made of the values, their
+// squares, and the products of neighboring right image values. Then the
+// sums over the patch of a pixel, and for bilinear interpolation also the
+// sums over the right patch shifted by one pixel, take constant time,
+// whatever the kernel size. The sum of products of the left and right
+// patches depends on the disparity, so it is found along each row as a
+// running sum, which is updated by one column at each pixel while the
+// integer part of the disparity does not change. Patches with no-data
+// pixels are handled one pixel at a time, as before.
+
+#ifndef __ASP_CORE_CORR_EVAL_VIEW_H__
+#define __ASP_CORE_CORR_EVAL_VIEW_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Math/Vector.h>
+
+#include <string>
+
+namespace asp {
+
+  class CorrEvalView: public vw::ImageViewBase<CorrEvalView> {
+    vw::ImageViewRef<vw::PixelMask<float>>        m_left, m_right;
+    vw::ImageViewRef<vw::PixelMask<vw::Vector2f>> m_disp;
+    vw::Vector2i m_kernel_size;
+    bool         m_ncc;
+    int          m_sample_rate;
+    bool         m_round_to_int;
+
+    void eval_block(vw::BBox2i const& block, vw::BBox2i const& tile_box,
+                    vw::ImageView<vw::PixelMask<vw::Vector2f>> const& disp,
+                    vw::ImageView<vw::PixelMask<float>> & tile) const;
+
+  public:
+
+    /// The metric is "ncc" or "stddev". The kernel size must have positive
+    /// odd values. Only one out of sample_rate rows and columns get values.
+    /// With round_to_int, the disparity is rounded, rather than used with
+    /// bilinear interpolation.
+    CorrEvalView(vw::ImageViewRef<vw::PixelMask<float>> const& left,
+                 vw::ImageViewRef<vw::PixelMask<float>> const& right,
+                 vw::ImageViewRef<vw::PixelMask<vw::Vector2f>> const& disp,
+                 vw::Vector2i const& kernel_size, std::string const& metric,
+                 int sample_rate, bool round_to_int);
+
+    typedef vw::PixelMask<float>                      pixel_type;
+    typedef pixel_type                                result_type;
+    typedef vw::ProceduralPixelAccessor<CorrEvalView> pixel_accessor;
+
+    inline vw::int32 cols  () const { return m_disp.cols(); }
+    inline vw::int32 rows  () const { return m_disp.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline pixel_type operator()(double /*i*/, double /*j*/, vw::int32 /*p*/ = 0) const {
+      vw::vw_throw(vw::NoImplErr() << "CorrEvalView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type>> prerasterize_type;
+    prerasterize_type prerasterize(vw::BBox2i const& bbox) const;
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_CORR_EVAL_VIEW_H__
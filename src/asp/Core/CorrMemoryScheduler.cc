@@ -0,0 +1,104 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file CorrMemoryScheduler.cc
+///
+
+#include <asp/Core/CorrMemoryScheduler.h>
+
+#include <algorithm>
+
+namespace asp {
+
+std::int64_t estimCorrTileMemory(vw::Vector2i const& tile_size,
+                                 vw::BBox2 const& search_range,
+                                 vw::Vector2i const& kernel_size,
+                                 vw::stereo::CorrelationAlgorithm stereo_alg,
+                                 int sgm_collar_size,
+                                 std::int64_t corr_memory_limit_mb) {
+
+  std::int64_t dx = std::max(0.0, search_range.width())  + 1;
+  std::int64_t dy = std::max(0.0, search_range.height()) + 1;
+  std::int64_t kx = kernel_size[0], ky = kernel_size[1];
+  
+  // Left and right image windows, with their masks, after kernel padding.
+  // The right window covers the search range as well.
+  std::int64_t left_pix  = (tile_size[0] + kx) * std::int64_t(tile_size[1] + ky);
+  std::int64_t right_pix = (tile_size[0] + kx + dx) * (tile_size[1] + ky + dy);
+  std::int64_t images = (left_pix + right_pix) * (sizeof(float) + 1);
+  
+  bool using_sgm = (stereo_alg > vw::stereo::VW_CORRELATION_BM &&
+                    stereo_alg < vw::stereo::VW_CORRELATION_OTHER);
+  if (!using_sgm) {
+    // Block matching keeps the best and current cost per pixel, and the
+    // disparity for both directions. The pyramid adds about a third.
+    std::int64_t disp = left_pix * (2 * sizeof(float) + 2 * 3 * sizeof(float));
+    return 4 * (images + disp) / 3;
+  }
+
+  // SGM/MGM. The uint8 cost and uint16 accumulated cost buffers span the
+  // tile plus collar over the full search range, unless the correlator
+  // shrinks the search range to stay near the memory limit.
+  std::int64_t cx = tile_size[0] + 2 * sgm_collar_size;
+  std::int64_t cy = tile_size[1] + 2 * sgm_collar_size;
+  std::int64_t volume = cx * cy * dx * dy * (sizeof(std::uint8_t) + sizeof(std::uint16_t));
+  if (corr_memory_limit_mb > 0)
+    volume = std::min(volume, corr_memory_limit_mb * 1024 * 1024);
+
+  return images + volume;
+}
+
+CorrMemoryScheduler::CorrMemoryScheduler(std::int64_t budget_bytes):
+  m_budget(budget_bytes), m_in_use(0), m_num_active(0),
+  m_next_ticket(0), m_now_serving(0) {}
+
+void CorrMemoryScheduler::acquire(std::int64_t bytes) {
+  vw::Mutex::Lock lock(m_mutex);
+
+  // Take a ticket, so that a large tile is not starved by small ones
+  // arriving after it.
+  std::uint64_t ticket = m_next_ticket++;
+  while (ticket != m_now_serving ||
+         (m_num_active > 0 && m_in_use + bytes > m_budget))
+    m_cond.wait(lock);
+
+  m_in_use += bytes;
+  m_num_active++;
+  m_now_serving++;
+  m_cond.notify_all(); // let the next ticket holder check
+}
+
+void CorrMemoryScheduler::release(std::int64_t bytes) {
+  vw::Mutex::Lock lock(m_mutex);
+  m_in_use -= bytes;
+  m_num_active--;
+  m_cond.notify_all();
+}
+
+CorrMemoryReservation::CorrMemoryReservation(CorrMemoryScheduler * scheduler,
+                                             std::int64_t bytes):
+  m_scheduler(scheduler), m_bytes(bytes) {
+  if (m_scheduler)
+    m_scheduler->acquire(m_bytes);
+}
+
+CorrMemoryReservation::~CorrMemoryReservation() {
+  if (m_scheduler)
+    m_scheduler->release(m_bytes);
+}
+
+} // End namespace asp
@@ -0,0 +1,86 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file CorrMemoryScheduler.h
+///
+
+// Estimate how much memory correlating a tile takes given its local search
+// range, and admit tiles for processing so that the tiles being correlated at
+// the same time stay under a global memory budget.
+
+#ifndef __ASP_CORE_CORR_MEMORY_SCHEDULER_H__
+#define __ASP_CORE_CORR_MEMORY_SCHEDULER_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Math/BBox.h>
+#include <vw/Stereo/CorrelationAlgorithms.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <cstdint>
+
+namespace asp {
+
+// Approximate peak memory, in bytes, for correlating a tile of the given size
+// with the given search range. For SGM/MGM this is dominated by the cost
+// volume over the tile plus its collar, which the correlator itself keeps
+// near corr_memory_limit_mb. For block matching the right image window
+// grows with the search range.
+std::int64_t estimCorrTileMemory(vw::Vector2i const& tile_size,
+                                 vw::BBox2 const& search_range,
+                                 vw::Vector2i const& kernel_size,
+                                 vw::stereo::CorrelationAlgorithm stereo_alg,
+                                 int sgm_collar_size,
+                                 std::int64_t corr_memory_limit_mb);
+
+// Admit tiles in arrival order while the sum of their estimated memory stays
+// under the budget. A tile bigger than the budget runs alone. This lets many
+// small tiles run together, while a tile with a large search range waits for
+// the others to finish. Thread-safe.
+class CorrMemoryScheduler: private boost::noncopyable {
+public:
+  explicit CorrMemoryScheduler(std::int64_t budget_bytes);
+
+  // Block until the tile can run
+  void acquire(std::int64_t bytes);
+  void release(std::int64_t bytes);
+
+  std::int64_t budget() const { return m_budget; }
+
+private:
+  vw::Mutex m_mutex;
+  vw::Condition m_cond;
+  std::int64_t m_budget, m_in_use;
+  int m_num_active;
+  std::uint64_t m_next_ticket, m_now_serving;
+};
+
+// Hold a reservation from construction to destruction. Does nothing if
+// the scheduler is null.
+class CorrMemoryReservation: private boost::noncopyable {
+public:
+  CorrMemoryReservation(CorrMemoryScheduler * scheduler, std::int64_t bytes);
+  ~CorrMemoryReservation();
+
+private:
+  CorrMemoryScheduler * m_scheduler;
+  std::int64_t m_bytes;
+};
+
+} // End namespace asp
+
+#endif
@@ -18,9 +18,510 @@
 #include <asp/Core/DemUtils.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Cartography/CameraBBox.h>
+#include <vw/Image/ImageView.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <list>
+#include <map>
+#include <mutex>
+
+namespace {
+
+// The tiles of all CachedDem instances, keyed by the DEM id and the tile
+// index. The cache is split into shards, each with its own lock and
+// least-recently-used list. The memory budget is split evenly among them.
+const int DEM_TILE_SIZE = 256;
+const int DEM_CACHE_NUM_SHARDS = 16;
+typedef boost::shared_ptr<vw::ImageView<float>> DemTilePtr;
+typedef std::pair<std::int64_t, std::int64_t> DemTileKey;
+
+struct DemCacheShard {
+  std::mutex mutex;
+  std::list<DemTileKey> lru; // most recently used first
+  std::map<DemTileKey, std::pair<DemTilePtr, std::list<DemTileKey>::iterator>> tiles;
+  std::int64_t num_bytes = 0;
+};
+
+std::atomic<std::int64_t> g_dem_cache_size(std::int64_t(1) << 30);
+std::atomic<std::int64_t> g_next_dem_id(0);
+DemCacheShard g_dem_cache[DEM_CACHE_NUM_SHARDS];
+
+// The last few tiles looked up by each thread, so that most lookups take no
+// lock. A tile never changes once read, so these stay valid even when
+// evicted from the cache.
+const int DEM_TILE_MEMO_LEN = 4;
+struct DemTileMemo {
+  DemTileKey keys[DEM_TILE_MEMO_LEN];
+  DemTilePtr tiles[DEM_TILE_MEMO_LEN];
+  int next;
+  DemTileMemo(): next(0) {
+    for (int k = 0; k < DEM_TILE_MEMO_LEN; k++)
+      keys[k] = DemTileKey(-1, -1);
+  }
+};
+thread_local DemTileMemo t_dem_tile_memo;
+
+std::int64_t tileBytes(DemTilePtr const& tile) {
+  return std::int64_t(tile->cols()) * std::int64_t(tile->rows()) * sizeof(float);
+}
+
+// Fetch a tile from the cache, or read it from disk and add it to the cache
+DemTilePtr getDemTile(vw::DiskImageView<float> const& dem, std::int64_t dem_id,
+                      int tile_col, int tile_row) {
+
+  std::int64_t num_tile_cols = (dem.cols() + DEM_TILE_SIZE - 1) / DEM_TILE_SIZE;
+  DemTileKey key(dem_id, tile_row * num_tile_cols + tile_col);
+
+  DemTileMemo & memo = t_dem_tile_memo;
+  for (int k = 0; k < DEM_TILE_MEMO_LEN; k++) {
+    if (memo.keys[k] == key)
+      return memo.tiles[k];
+  }
+
+  DemCacheShard & shard = g_dem_cache[(key.first * 31 + key.second) % DEM_CACHE_NUM_SHARDS];
+  DemTilePtr tile;
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.tiles.find(key);
+    if (it != shard.tiles.end()) {
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second.second);
+      tile = it->second.first;
+    }
+  }
+
+  if (!tile) {
+    // Read the tile without holding the lock. If another thread reads the
+    // same tile meanwhile, only one copy is kept.
+    vw::BBox2i box(tile_col * DEM_TILE_SIZE, tile_row * DEM_TILE_SIZE,
+                   DEM_TILE_SIZE, DEM_TILE_SIZE);
+    box.crop(vw::bounding_box(dem));
+    tile.reset(new vw::ImageView<float>(vw::crop(dem, box)));
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.tiles.find(key);
+    if (it != shard.tiles.end()) {
+      tile = it->second.first;
+    } else {
+      shard.lru.push_front(key);
+      shard.tiles[key] = std::make_pair(tile, shard.lru.begin());
+      shard.num_bytes += tileBytes(tile);
+      std::int64_t budget = g_dem_cache_size / DEM_CACHE_NUM_SHARDS;
+      while (shard.num_bytes > budget && shard.lru.size() > 1) {
+        auto old = shard.tiles.find(shard.lru.back());
+        shard.num_bytes -= tileBytes(old->second.first);
+        shard.tiles.erase(old);
+        shard.lru.pop_back();
+      }
+    }
+  }
+
+  memo.keys[memo.next] = key;
+  memo.tiles[memo.next] = tile;
+  memo.next = (memo.next + 1) % DEM_TILE_MEMO_LEN;
+  return tile;
+}
+
+// Catmull-Rom weights for the four samples around a point at fraction t
+// past the second sample
+void cubicWeights(double t, double w[4]) {
+  double t2 = t * t, t3 = t2 * t;
+  w[0] = 0.5 * (-t3 + 2.0 * t2 - t);
+  w[1] = 0.5 * (3.0 * t3 - 5.0 * t2 + 2.0);
+  w[2] = 0.5 * (-3.0 * t3 + 4.0 * t2 + t);
+  w[3] = 0.5 * (t3 - t2);
+}
+
+// Blocks at the finest level of a DemHeightPyramid are this many DEM cells
+// on a side
+const int DEM_PYR_BLOCK = 8;
+
+// A point on a ray, with its DEM pixel and height above the datum
+struct RayPoint {
+  double t;
+  vw::Vector2 pix;
+  double h;
+};
+
+RayPoint makeRayPoint(vw::cartography::GeoReference const& georef,
+                      vw::Vector3 const& ctr, vw::Vector3 const& dir, double t) {
+  RayPoint p;
+  p.t = t;
+  vw::Vector3 llh = georef.datum().cartesian_to_geodetic(ctr + t * dir);
+  p.h = llh[2];
+  p.pix = georef.lonlat_to_pixel(vw::subvector(llh, 0, 2));
+  return p;
+}
+
+// Bilinear interpolation in a DEM cell with the given corner heights, in the
+// order (0, 0), (1, 0), (0, 1), (1, 1). The point is clamped to the cell.
+double cellHeight(float const corners[4], double x, double y) {
+  x = std::min(std::max(x, 0.0), 1.0);
+  y = std::min(std::max(y, 0.0), 1.0);
+  return (1.0 - y) * ((1.0 - x) * corners[0] + x * corners[1])
+    + y * ((1.0 - x) * corners[2] + x * corners[3]);
+}
+
+} // end anonymous namespace
 
 namespace asp {
 
+CachedDem::CachedDem(std::string const& dem_file):
+  m_dem(dem_file), m_nodata(-std::numeric_limits<float>::max()),
+  m_id(g_next_dem_id++) {
+
+  if (!vw::cartography::read_georeference(m_georef, dem_file))
+    vw::vw_throw(vw::ArgumentErr() << "Cannot read a georeference from DEM: "
+                 << dem_file << ".\n");
+  vw::read_nodata_val(dem_file, m_nodata); // ignore the success status
+}
+
+CachedDem::pixel_type CachedDem::operator()(std::int32_t col, std::int32_t row,
+                                            std::int32_t /*p*/) const {
+  pixel_type result; // invalid
+  if (col < 0 || row < 0 || col >= cols() || row >= rows())
+    return result;
+
+  DemTilePtr tile = getDemTile(m_dem, m_id, col / DEM_TILE_SIZE, row / DEM_TILE_SIZE);
+  float val = (*tile)(col % DEM_TILE_SIZE, row % DEM_TILE_SIZE);
+  result = pixel_type(val);
+  if (val == float(m_nodata) || val != val)
+    result.invalidate();
+  return result;
+}
+
+vw::PixelMask<double> CachedDem::height(vw::Vector2 const& pix, bool bicubic) const {
+
+  vw::PixelMask<double> result;
+  result.invalidate();
+  if (!(pix[0] >= 0 && pix[1] >= 0 && pix[0] <= cols() - 1 && pix[1] <= rows() - 1))
+    return result;
+
+  int x0 = floor(pix[0]), y0 = floor(pix[1]);
+  double dx = pix[0] - x0, dy = pix[1] - y0;
+  double sum = 0.0;
+
+  if (!bicubic) {
+    // Pixels with zero weight are not read, so this works at the last row
+    // and column too
+    for (int j = 0; j < 2; j++) {
+      double wy = (j == 0) ? 1.0 - dy : dy;
+      if (wy == 0.0)
+        continue;
+      for (int i = 0; i < 2; i++) {
+        double wx = (i == 0) ? 1.0 - dx : dx;
+        if (wx == 0.0)
+          continue;
+        pixel_type val = operator()(x0 + i, y0 + j);
+        if (!is_valid(val))
+          return result;
+        sum += wx * wy * val.child();
+      }
+    }
+    return vw::PixelMask<double>(sum);
+  }
+
+  // Bicubic interpolation. At the edges the border pixels are repeated.
+  double wx[4], wy[4];
+  cubicWeights(dx, wx);
+  cubicWeights(dy, wy);
+  for (int j = 0; j < 4; j++) {
+    int row = std::min(std::max(y0 - 1 + j, 0), rows() - 1);
+    for (int i = 0; i < 4; i++) {
+      int col = std::min(std::max(x0 - 1 + i, 0), cols() - 1);
+      pixel_type val = operator()(col, row);
+      if (!is_valid(val))
+        return result;
+      sum += wx[i] * wy[j] * val.child();
+    }
+  }
+  return vw::PixelMask<double>(sum);
+}
+
+// Set the memory budget of the CachedDem tile cache
+void setDemCacheSize(std::int64_t num_bytes) {
+  g_dem_cache_size = num_bytes;
+}
+
+DemHeightPyramid::DemHeightPyramid(vw::ImageViewRef<vw::PixelMask<float>> const& masked_dem,
+                                   vw::cartography::GeoReference const& dem_georef):
+  m_dem(masked_dem), m_georef(dem_georef), m_step(1.0) {
+
+  // The cells are between pixel centers, where bilinear interpolation happens
+  std::int64_t cols = m_dem.cols(), rows = m_dem.rows();
+  std::int64_t num_cells_x = cols - 1, num_cells_y = rows - 1;
+  if (num_cells_x <= 0 || num_cells_y <= 0)
+    return; // no levels, so no intersections
+
+  // The finest level. A pixel on a block boundary is a corner of cells in
+  // both blocks, so it counts for both.
+  const float inf = std::numeric_limits<float>::max();
+  std::int64_t nx = (num_cells_x + DEM_PYR_BLOCK - 1) / DEM_PYR_BLOCK;
+  std::int64_t ny = (num_cells_y + DEM_PYR_BLOCK - 1) / DEM_PYR_BLOCK;
+  std::vector<float> min_h(nx * ny, inf), max_h(nx * ny, -inf);
+#pragma omp parallel for schedule(dynamic)
+  for (std::int64_t by = 0; by < ny; by++) {
+    std::int64_t row_end = std::min((by + 1) * DEM_PYR_BLOCK, num_cells_y);
+    for (std::int64_t row = by * DEM_PYR_BLOCK; row <= row_end; row++) {
+      for (std::int64_t col = 0; col < cols; col++) {
+        vw::PixelMask<float> val = m_dem(col, row);
+        if (!is_valid(val))
+          continue;
+        std::int64_t bx_end = std::min(col / DEM_PYR_BLOCK, nx - 1);
+        std::int64_t bx_beg = bx_end;
+        if (col % DEM_PYR_BLOCK == 0 && col > 0)
+          bx_beg = col / DEM_PYR_BLOCK - 1;
+        for (std::int64_t bx = bx_beg; bx <= bx_end; bx++) {
+          std::int64_t k = by * nx + bx;
+          min_h[k] = std::min(min_h[k], val.child());
+          max_h[k] = std::max(max_h[k], val.child());
+        }
+      }
+    }
+  }
+  m_num_x.push_back(nx);
+  m_num_y.push_back(ny);
+  m_min.push_back(min_h);
+  m_max.push_back(max_h);
+
+  // Coarser levels, until one block covers the DEM
+  while (m_num_x.back() > 1 || m_num_y.back() > 1) {
+    std::int64_t px = m_num_x.back(), py = m_num_y.back();
+    std::int64_t qx = (px + 1) / 2, qy = (py + 1) / 2;
+    std::vector<float> const& prev_min = m_min.back();
+    std::vector<float> const& prev_max = m_max.back();
+    min_h.assign(qx * qy, inf);
+    max_h.assign(qx * qy, -inf);
+    for (std::int64_t by = 0; by < py; by++) {
+      for (std::int64_t bx = 0; bx < px; bx++) {
+        std::int64_t k = (by / 2) * qx + bx / 2;
+        min_h[k] = std::min(min_h[k], prev_min[by * px + bx]);
+        max_h[k] = std::max(max_h[k], prev_max[by * px + bx]);
+      }
+    }
+    m_num_x.push_back(qx);
+    m_num_y.push_back(qy);
+    m_min.push_back(min_h);
+    m_max.push_back(max_h);
+  }
+
+  // The step used to find the direction of a ray in DEM pixels
+  try {
+    vw::Vector2 pix(cols / 2, rows / 2);
+    vw::Vector2 ll0 = m_georef.pixel_to_lonlat(pix);
+    vw::Vector2 ll1 = m_georef.pixel_to_lonlat(pix + vw::Vector2(1, 0));
+    double dist = norm_2(m_georef.datum().geodetic_to_cartesian(vw::Vector3(ll0[0], ll0[1], 0))
+                         - m_georef.datum().geodetic_to_cartesian(vw::Vector3(ll1[0], ll1[1], 0)));
+    if (dist > 0)
+      m_step = 0.1 * dist;
+  } catch (...) {}
+}
+
+bool DemHeightPyramid::blockRange(int level, std::int64_t bx, std::int64_t by,
+                                  float & min_h, float & max_h) const {
+  if (bx < 0 || by < 0 || bx >= m_num_x[level] || by >= m_num_y[level])
+    return false;
+  std::int64_t k = by * m_num_x[level] + bx;
+  min_h = m_min[level][k];
+  max_h = m_max[level][k];
+  return min_h <= max_h;
+}
+
+bool DemHeightPyramid::intersect(vw::Vector3 const& ctr, vw::Vector3 const& dir_in,
+                                 double height_error_tol, vw::Vector3 & xyz) const {
+
+  xyz = vw::Vector3();
+  if (m_min.empty() || norm_2(dir_in) == 0.0)
+    return false;
+  int top = m_min.size() - 1;
+  float dem_min = 0.0, dem_max = 0.0;
+  if (!blockRange(top, 0, 0, dem_min, dem_max))
+    return false; // no valid heights
+
+  vw::Vector3 dir = normalize(dir_in);
+  vw::cartography::Datum const& datum = m_georef.datum();
+  auto rayPoint = [&](double t) {
+    return makeRayPoint(m_georef, ctr, dir, t);
+  };
+
+  // The part of the ray between the lowest and highest DEM heights
+  double a = datum.semi_major_axis(), b = datum.semi_minor_axis();
+  double h_top = dem_max + 1.0, h_bot = dem_min - 1.0;
+  double t_beg = 0.0;
+  if (datum.cartesian_to_geodetic(ctr)[2] > h_top) {
+    vw::Vector3 P = vw::cartography::datum_intersection(a + h_top, b + h_top, ctr, dir);
+    if (P == vw::Vector3() || dot_prod(P - ctr, dir) < 0.0)
+      return false; // the ray misses the DEM heights
+    t_beg = dot_prod(P - ctr, dir);
+  }
+  // Where the ray leaves the highest height, found by going back from far away
+  double far_len = 4.0 * (a + h_top) + norm_2(ctr);
+  vw::Vector3 far_pt = ctr + far_len * dir;
+  vw::Vector3 P = vw::cartography::datum_intersection(a + h_top, b + h_top, far_pt, -dir);
+  double t_end = (P == vw::Vector3()) ? t_beg : dot_prod(P - ctr, dir);
+  P = vw::cartography::datum_intersection(a + h_bot, b + h_bot, ctr, dir);
+  if (P != vw::Vector3() && dot_prod(P - ctr, dir) > t_beg)
+    t_end = std::min(t_end, dot_prod(P - ctr, dir));
+
+  // Go down the pyramid where the ray may be below the highest point of a
+  // block, and up after leaving a block. Level -1 is a single DEM cell.
+  double nudge = 1e-2 * m_step;
+  int level = top;
+  RayPoint cur = rayPoint(t_beg);
+  const int max_steps = 1000000;
+  for (int step = 0; step < max_steps && cur.t < t_end; step++) {
+
+    // How the DEM pixel and height change along the ray, per meter
+    RayPoint nxt = rayPoint(cur.t + m_step);
+    vw::Vector2 vpix = (nxt.pix - cur.pix) / m_step;
+    double vh = (nxt.h - cur.h) / m_step;
+    if (cur.h > dem_max && vh >= 0.0)
+      return false; // above the DEM and rising
+
+    // The current block, and where the ray leaves it
+    double size = (level < 0) ? 1.0 : DEM_PYR_BLOCK * double(std::int64_t(1) << level);
+    std::int64_t bx = floor(cur.pix[0] / size), by = floor(cur.pix[1] / size);
+    double t_exit = t_end;
+    for (int c = 0; c < 2; c++) {
+      double lo = (c == 0 ? bx : by) * size, hi = lo + size;
+      if (vpix[c] > 0.0)
+        t_exit = std::min(t_exit, cur.t + (hi - cur.pix[c]) / vpix[c]);
+      else if (vpix[c] < 0.0)
+        t_exit = std::min(t_exit, cur.t + (lo - cur.pix[c]) / vpix[c]);
+    }
+    t_exit = std::min(std::max(t_exit, cur.t) + nudge, t_end);
+
+    if (level >= 0) {
+      float min_h = 0.0, max_h = 0.0;
+      if (!blockRange(level, bx, by, min_h, max_h)) {
+        cur = rayPoint(t_exit);
+        level = std::min(level + 1, top);
+        continue;
+      }
+
+      if (cur.h > max_h) {
+        // The height along the ray is convex, so it is lowest at the start
+        // if rising there, and lowest at the end if descending there.
+        // Then, if above the block at the lowest end, skip the block.
+        bool skip = (vh >= 0.0);
+        RayPoint ex = rayPoint(t_exit);
+        if (!skip && ex.h > max_h)
+          skip = (rayPoint(t_exit + m_step).h <= ex.h);
+        if (skip) {
+          cur = ex;
+          level = std::min(level + 1, top);
+          continue;
+        }
+
+        // Move to where the ray may reach the block top. The tangent to a
+        // convex function is below it, so this does not overshoot.
+        if (vh < 0.0) {
+          double t_top = cur.t + (max_h - cur.h) / vh - m_step;
+          if (t_top > cur.t)
+            cur = rayPoint(std::min(t_top, t_exit));
+        }
+      }
+
+      level--;
+      continue;
+    }
+
+    // A DEM cell. All its corners must be valid, as for bilinear interpolation.
+    float corners[4];
+    bool valid = (bx >= 0 && by >= 0 && bx < m_dem.cols() - 1 && by < m_dem.rows() - 1);
+    for (int k = 0; valid && k < 4; k++) {
+      vw::PixelMask<float> val = m_dem(bx + k % 2, by + k / 2);
+      valid = is_valid(val);
+      corners[k] = val.child();
+    }
+    if (!valid) {
+      cur = rayPoint(t_exit);
+      level = 0;
+      continue;
+    }
+    auto heightDiff = [&](RayPoint const& p) {
+      return p.h - cellHeight(corners, p.pix[0] - bx, p.pix[1] - by);
+    };
+
+    double f_cur = heightDiff(cur);
+    if (f_cur <= 0.0) {
+      xyz = ctr + cur.t * dir; // already at the surface
+      return true;
+    }
+
+    // Go to where the ray leaves the cell or may be below all its corners
+    double t_next = t_exit;
+    if (vh < 0.0) {
+      float min_h = *std::min_element(corners, corners + 4);
+      t_next = std::min(t_next, cur.t + (min_h - height_error_tol - cur.h) / vh);
+    }
+    RayPoint next = rayPoint(t_next);
+    double f_next = heightDiff(next);
+    if (f_next > 0.0) {
+      if (t_next >= t_exit)
+        level = 0; // left the cell
+      cur = next;
+      continue;
+    }
+
+    // The ray crosses the surface in this cell. Refine with the
+    // Illinois variant of the regula falsi method.
+    RayPoint lo = cur, hi = next;
+    double f_lo = f_cur, f_hi = f_next;
+    int side = 0;
+    for (int iter = 0; iter < 100; iter++) {
+      double t = (f_lo * hi.t - f_hi * lo.t) / (f_lo - f_hi);
+      RayPoint mid = rayPoint(t);
+      double f_mid = heightDiff(mid);
+      if (std::abs(f_mid) <= height_error_tol || hi.t - lo.t <= 1e-6) {
+        xyz = ctr + t * dir;
+        return true;
+      }
+      if (f_mid > 0.0) {
+        lo = mid; f_lo = f_mid;
+        if (side == 1)
+          f_hi /= 2.0;
+        side = 1;
+      } else {
+        hi = mid; f_hi = f_mid;
+        if (side == -1)
+          f_lo /= 2.0;
+        side = -1;
+      }
+    }
+    xyz = ctr + 0.5 * (lo.t + hi.t) * dir;
+    return true;
+  }
+
+  return false;
+}
+
+// Intersect rays with a DEM using multiple threads
+void demIntersectRays(DemHeightPyramid const& dem_pyramid,
+                      std::vector<vw::Vector3> const& ctrs,
+                      std::vector<vw::Vector3> const& dirs,
+                      double height_error_tol,
+                      std::vector<vw::Vector3> & xyz) {
+
+  std::int64_t num = ctrs.size();
+  if ((std::int64_t)dirs.size() != num)
+    vw::vw_throw(vw::ArgumentErr() << "demIntersectRays: Inconsistent input sizes.\n");
+
+  xyz.assign(num, vw::Vector3());
+#pragma omp parallel for schedule(dynamic, 16)
+  for (std::int64_t i = 0; i < num; i++) {
+    vw::Vector3 pt;
+    try {
+      if (dem_pyramid.intersect(ctrs[i], dirs[i], height_error_tol, pt))
+        xyz[i] = pt;
+    } catch (...) {}
+  }
+}
+
 // Find a handful of valid DEM values and average them. It helps later when
 // intersecting with the DEM, especially for Mars, where the DEM heights ca be
 // very far from the datum. 
@@ -64,13 +565,8 @@ void queryPixel(std::string const& dem_file, vw::CamPtr camera_model,
   if (!has_georef)
     vw::vw_throw(vw::ArgumentErr() << "The DEM file must have a georeference.\n");
   
-  // Read the no-data
-  double nodata_val = -std::numeric_limits<float>::max(); // note we use a float nodata
-  vw::read_nodata_val(dem_file, nodata_val); // ignore the success status
-
-  // Create the masked DEM
-  vw::ImageViewRef<vw::PixelMask<float>> masked_dem
-    = vw::create_mask(vw::DiskImageView<float>(dem_file), nodata_val);
+  // Create the masked DEM. Only the tiles needed are read.
+  vw::ImageViewRef<vw::PixelMask<float>> masked_dem = asp::CachedDem(dem_file);
   
   vw::Vector3 cam_ctr = camera_model->camera_center(query_pixel);
   vw::Vector3 cam_dir = camera_model->pixel_to_vector(query_pixel);
@@ -107,4 +603,43 @@ void queryPixel(std::string const& dem_file, vw::CamPtr camera_model,
 
 }
 
+// Find the range of DEM heights over a region in the projected coordinates
+// of the given georeference, by sampling the DEM.
+bool demHeightRange(vw::ImageViewRef<vw::PixelMask<float>> const& dem,
+                    vw::cartography::GeoReference const& dem_georef,
+                    vw::cartography::GeoReference const& target_georef,
+                    vw::BBox2 const& point_box,
+                    double & min_height, double & max_height) {
+
+  min_height = std::numeric_limits<double>::max();
+  max_height = -min_height;
+  const int num = 100; // samples per side
+  for (int j = 0; j <= num; j++) {
+    for (int i = 0; i <= num; i++) {
+      vw::Vector2 pt = point_box.min()
+        + elem_prod(vw::Vector2(i, j), point_box.size()) / num;
+      vw::Vector2 dem_pix
+        = dem_georef.lonlat_to_pixel(target_georef.point_to_lonlat(pt));
+      int col = round(dem_pix[0]), row = round(dem_pix[1]);
+      if (col < 0 || row < 0 || col >= dem.cols() || row >= dem.rows())
+        continue;
+      vw::PixelMask<float> h = dem(col, row);
+      if (!is_valid(h))
+        continue;
+      min_height = std::min(min_height, double(h.child()));
+      max_height = std::max(max_height, double(h.child()));
+    }
+  }
+
+  if (min_height > max_height)
+    return false;
+
+  // The samples may miss some of the highs and lows. Heights outside
+  // this range are handled by the exact camera.
+  double pad = 0.1 * (max_height - min_height) + 10.0;
+  min_height -= pad;
+  max_height += pad;
+  return true;
+}
+
 } //end namespace asp
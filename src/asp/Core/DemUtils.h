@@ -18,16 +18,113 @@
 #ifndef __CORE_DEM_UTILS_H__
 #define __CORE_DEM_UTILS_H__
 
+#include <vw/Image/ImageViewBase.h>
 #include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelAccessors.h>
 #include <vw/Image/PixelMask.h>
+#include <vw/FileIO/DiskImageView.h>
 #include <vw/Camera/CameraModel.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Math/BBox.h>
 
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
 
 namespace asp {
 
+// A DEM whose pixels are read from disk in tiles as needed. The tiles of
+// all such DEMs are kept in one least-recently-used cache with a memory
+// budget. Lookups are thread-safe. The cache is split into independently
+// locked shards, and each thread remembers its last few tiles, so most
+// lookups take no lock. Copies share the cached tiles. This is an image
+// view, so it can be interpolated and passed to the ray-DEM intersection
+// functions. Pixels equal to the nodata value or out of bounds are invalid.
+class CachedDem: public vw::ImageViewBase<CachedDem> {
+public:
+  typedef vw::PixelMask<float> pixel_type;
+  typedef pixel_type result_type;
+  typedef vw::ProceduralPixelAccessor<CachedDem> pixel_accessor;
+
+  // Throws if the DEM has no georeference
+  CachedDem(std::string const& dem_file);
+
+  inline std::int32_t cols()   const { return m_dem.cols(); }
+  inline std::int32_t rows()   const { return m_dem.rows(); }
+  inline std::int32_t planes() const { return 1; }
+  inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+  pixel_type operator()(std::int32_t col, std::int32_t row, std::int32_t p = 0) const;
+
+  // The height at a non-integer pixel, with bilinear or bicubic
+  // interpolation. Invalid unless all pixels used are valid.
+  vw::PixelMask<double> height(vw::Vector2 const& pix, bool bicubic = false) const;
+
+  vw::cartography::GeoReference const& georef() const { return m_georef; }
+  double nodata() const { return m_nodata; }
+
+  typedef CachedDem prerasterize_type;
+  inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const { return *this; }
+  template <class DestT>
+  inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+
+private:
+  vw::DiskImageView<float>      m_dem;
+  vw::cartography::GeoReference m_georef;
+  double                        m_nodata;
+  std::int64_t                  m_id; // identifies the DEM in the cache
+};
+
+// Set the memory budget of the CachedDem tile cache. The default is 1 GB.
+void setDemCacheSize(std::int64_t num_bytes);
+
+// The minimum and maximum heights of a DEM over blocks of 8 x 8 pixels, and
+// over ever larger blocks, up to one covering the DEM. A ray is intersected
+// with the DEM by marching through these blocks, skipping the ones it passes
+// above, and descending to individual pixels only where it gets close to the
+// surface. That needs few DEM lookups per ray, and finds the first
+// intersection along the ray, with no initial guess. The DEM is interpolated
+// bilinearly, as with create_interp_dem(). Lookups are thread-safe if the
+// DEM lookups are.
+class DemHeightPyramid {
+public:
+  // Read the whole DEM once, using multiple threads
+  DemHeightPyramid(vw::ImageViewRef<vw::PixelMask<float>> const& masked_dem,
+                   vw::cartography::GeoReference const& dem_georef);
+
+  // Find the first intersection of the ray with the DEM, with the given
+  // tolerance for the height. Return false if there is none.
+  bool intersect(vw::Vector3 const& ctr, vw::Vector3 const& dir,
+                 double height_error_tol, vw::Vector3 & xyz) const;
+
+  vw::cartography::GeoReference const& georef() const { return m_georef; }
+
+private:
+  // The height range over a block at a given level. Return false if there
+  // is no data.
+  bool blockRange(int level, std::int64_t bx, std::int64_t by,
+                  float & min_h, float & max_h) const;
+
+  vw::ImageViewRef<vw::PixelMask<float>> m_dem;
+  vw::cartography::GeoReference m_georef;
+  double m_step; // about a tenth of a DEM pixel on the ground, in meters
+  std::vector<std::int64_t> m_num_x, m_num_y; // number of blocks at each level
+  std::vector<std::vector<float>> m_min, m_max;
+};
+
+// Intersect rays with a DEM using multiple threads. The results are the zero
+// vector for rays not intersecting the DEM. The rays themselves should be
+// found beforehand, as the cameras may not be thread-safe.
+void demIntersectRays(DemHeightPyramid const& dem_pyramid,
+                      std::vector<vw::Vector3> const& ctrs,
+                      std::vector<vw::Vector3> const& dirs,
+                      double height_error_tol,
+                      std::vector<vw::Vector3> & xyz);
+
 // Find a handful of valid DEM values and average them. It helps later when
 // intersecting with the DEM, especially for Mars, where the DEM heights ca be
 // very far from the datum. 
@@ -37,6 +134,15 @@ double findDemHeightGuess(vw::ImageViewRef<vw::PixelMask<float>> const& dem);
 void queryPixel(std::string const& dem_file, vw::CamPtr camera_model,
                 vw::Vector2 const& query_pixel);
 
+// Find the range of DEM heights over a region in the projected coordinates
+// of the given georeference, by sampling the DEM. The range is padded a
+// little. Return false if no valid heights were found.
+bool demHeightRange(vw::ImageViewRef<vw::PixelMask<float>> const& dem,
+                    vw::cartography::GeoReference const& dem_georef,
+                    vw::cartography::GeoReference const& target_georef,
+                    vw::BBox2 const& point_box,
+                    double & min_height, double & max_height);
+
 
 } //end namespace asp
 
@@ -19,6 +19,7 @@
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/DisparityProcessing.h>
+#include <asp/Core/PointUtils.h>
 #include <vw/Math/Transform.h>
 #include <vw/Stereo/StereoModel.h>
 #include <vw/FileIO/MatrixIO.h>
@@ -27,6 +28,9 @@
 #include <vw/Cartography/Map2CamTrans.h>
 #include <vw/InterestPoint/InterestData.h>
 
+#include <exception>
+#include <limits>
+
 using namespace vw;
 using namespace vw::cartography;
 
@@ -318,6 +322,66 @@ void filter_D_sub(ASPGlobalOptions const& opt,
   
 } 
 
+// Find the point cloud center from a sample of D_sub
+bool save_cloud_center_from_D_sub(ASPGlobalOptions const& opt,
+                                  vw::TransformPtr tx_left, vw::TransformPtr tx_right,
+                                  boost::shared_ptr<vw::camera::CameraModel> left_camera_model, 
+                                  boost::shared_ptr<vw::camera::CameraModel> right_camera_model,
+                                  std::string const& d_sub_file) {
+
+  vw::ImageViewRef<vw::PixelMask<vw::Vector2f>> sub_disp_ref;
+  vw::Vector2 upsample_scale;
+  asp::load_D_sub_and_scale(opt, d_sub_file, sub_disp_ref, upsample_scale);
+  vw::ImageView<vw::PixelMask<vw::Vector2f>> sub_disp = sub_disp_ref;
+
+  // Pick evenly at most this many valid pixels. Their median is just as
+  // good a center as the one from the full-resolution cloud.
+  const std::int64_t max_num_points = 10000;
+  std::vector<Vector2i> valid_pix;
+  for (int col = 0; col < sub_disp.cols(); col++) {
+    for (int row = 0; row < sub_disp.rows(); row++) {
+      if (is_valid(sub_disp(col, row)))
+        valid_pix.push_back(Vector2i(col, row));
+    }
+  }
+  double step = std::max(1.0, double(valid_pix.size()) / double(max_num_points));
+
+  double angle_tol = vw::stereo::StereoModel
+    ::robust_1_minus_cos(stereo_settings().min_triangulation_angle*M_PI/180);
+  stereo::StereoModel model(left_camera_model.get(), right_camera_model.get(),
+                            stereo_settings().use_least_squares, angle_tol);
+
+  std::vector<Vector3> points;
+  for (double pos = 0; pos < valid_pix.size(); pos += step) {
+    Vector2i const& pix = valid_pix[std::int64_t(pos)];
+    Vector2 left_pix  = Vector2(pix);
+    Vector2 right_pix = left_pix + sub_disp(pix.x(), pix.y()).child();
+
+    // Scale to full resolution and undo the alignment transform
+    left_pix  = tx_left->reverse(elem_prod(left_pix, upsample_scale));
+    right_pix = tx_right->reverse(elem_prod(right_pix, upsample_scale));
+
+    double err = 0.0;
+    Vector3 xyz;
+    try {
+      xyz = model(left_pix, right_pix, err);
+    } catch(...) {
+      continue;
+    }
+    if (xyz != Vector3())
+      points.push_back(xyz);
+  }
+
+  if (points.empty())
+    return false;
+
+  Vector3 center = asp::find_approx_points_median(points);
+  std::string cloud_center_file = opt.out_prefix + "-PC-center.txt";
+  vw_out() << "Writing point cloud center based on D_sub: " << cloud_center_file << "\n";
+  asp::write_point(cloud_center_file, center);
+  return true;
+}
+
 // Filter D_sub by reducing its spread around the median
 void filter_D_sub_using_spread(ASPGlobalOptions const& opt, std::string const& d_sub_file,
                                double max_disp_spread) {
@@ -414,7 +478,13 @@ class UnalignDisparityView: public ImageViewBase<UnalignDisparityView>{
   ASPGlobalOptions const& m_opt;
   int m_num_cols, m_num_rows;
   bool m_is_map_projected;
-  std::map <std::pair<int, int>, Vector2> m_unaligned_trans;
+
+  // For mapprojected images, the output image is split into cells. For
+  // each cell, keep the box of disparity pixels that a sample of the
+  // disparity maps into that cell. The box of disparity pixels needed
+  // for a tile is then found without unaligning any pixels.
+  int m_cell_size, m_num_cell_cols, m_num_cell_rows;
+  std::vector<BBox2i> m_cell_disp_boxes;
 public:
   UnalignDisparityView(bool is_map_projected,
                        DispImageType    const& disparity,
@@ -424,7 +494,8 @@ public:
     m_is_map_projected(is_map_projected), 
     m_disparity(disparity), m_left_transform(left_transform), 
     m_right_transform(right_transform), m_opt(opt),
-    m_num_cols(0), m_num_rows(0){
+    m_num_cols(0), m_num_rows(0),
+    m_cell_size(1), m_num_cell_cols(0), m_num_cell_rows(0){
 
     // Compute the output image size
     
@@ -438,7 +509,6 @@ public:
     }else{
       // Map projected, need to check all the pixel coordinates.
       // This is going to be slow for large images!
-      BBox2i img_box;
 
       // Use sampling as this operation is very slow.
       int sample_len = 10;
@@ -446,44 +516,88 @@ public:
       int col_sample = std::max(1, std::min(sample_len, m_disparity.cols()/num_min_samples));
       int row_sample = std::max(1, std::min(sample_len, m_disparity.rows()/num_min_samples));
 
-      vw::TerminalProgressCallback tpc("asp", "\t--> ");
-      double inc_amount = col_sample / std::max(double(m_disparity.cols()), 1.0);
-      tpc.report_progress(0);
-      vw_out() << "\nEstimating the unaligned disparity dimensions.\n";
-
+      // Ensure that the last column and row are picked
+      std::vector<int> sample_cols, sample_rows;
       for (int col = 0; col < m_disparity.cols(); col++) {
+        if (col % col_sample == 0 || col == m_disparity.cols() - 1)
+          sample_cols.push_back(col);
+      }
+      for (int row = 0; row < m_disparity.rows(); row++) {
+        if (row % row_sample == 0 || row == m_disparity.rows() - 1)
+          sample_rows.push_back(row);
+      }
+      int num_sample_cols = sample_cols.size(), num_sample_rows = sample_rows.size();
 
-	// Ensure that the last column is picked
-	if (col % col_sample != 0 && col != m_disparity.cols() - 1) 
-	  continue;
+      // The unaligned left pixel for each sample, or NaN if the disparity
+      // is invalid or the pixel cannot be unaligned. Use floats, as these
+      // are only needed to find bounding boxes, which are grown later.
+      double nan = std::numeric_limits<double>::quiet_NaN();
+      std::vector<Vector2f> unaligned(size_t(num_sample_cols) * num_sample_rows,
+                                      Vector2f(nan, nan));
 
-        for (int row = 0; row < m_disparity.rows(); row++) {
-	  
-	  // Ensure that the last row is picked
-	  if (row % row_sample != 0 && row != m_disparity.rows() - 1) 
-	    continue;
+      vw::TerminalProgressCallback tpc("asp", "\t--> ");
+      double inc_amount = 1.0 / std::max(double(num_sample_rows), 1.0);
+      tpc.report_progress(0);
+      vw_out() << "\nEstimating the unaligned disparity dimensions.\n";
 
-	  // This is quite important to avoid an incorrectly computed img_box.
-          typename DispImageType::pixel_type dpix = m_disparity(col, row);
-          if (!is_valid(dpix))
-	    continue;
-
-          // Unalign the left pixel
-	  Vector2 left_pix;
-	  try{
-	    left_pix  = m_left_transform->reverse(Vector2(col, row));
-	  }catch(...){
-	    continue;
-	  }
-          img_box.grow(left_pix);
+      // Process rows of samples in parallel. The mapprojection transform
+      // is not thread-safe, so each thread has its own copy.
+      std::vector<std::exception_ptr> errors;
+      #pragma omp parallel
+      {
+        vw::TransformPtr local_left_transform;
+        try {
+          local_left_transform = vw::cartography::mapproj_trans_copy(m_left_transform);
+        } catch (...) {
+          #pragma omp critical
+          errors.push_back(std::current_exception());
+        }
 
-	  // Save this lookup map for the future
-	  m_unaligned_trans[std::make_pair(col, row)] = left_pix;
+        #pragma omp for schedule(dynamic)
+        for (int sample_row = 0; sample_row < num_sample_rows; sample_row++) {
+          if (!local_left_transform)
+            continue;
+          try {
+            // Read the whole row of the disparity at once
+            int row = sample_rows[sample_row];
+            ImageView<typename DispImageType::pixel_type> disp_row
+              = crop(m_disparity, BBox2i(0, row, m_disparity.cols(), 1));
+
+            for (int sample_col = 0; sample_col < num_sample_cols; sample_col++) {
+              int col = sample_cols[sample_col];
+
+              // This is quite important to avoid an incorrectly computed img_box.
+              if (!is_valid(disp_row(col, 0)))
+                continue;
+
+              // Unalign the left pixel
+              Vector2 left_pix;
+              try{
+                left_pix = local_left_transform->reverse(Vector2(col, row));
+              }catch(...){
+                continue;
+              }
+              unaligned[size_t(sample_row) * num_sample_cols + sample_col]
+                = Vector2f(left_pix[0], left_pix[1]);
+            }
+          } catch (...) {
+            #pragma omp critical
+            errors.push_back(std::current_exception());
+          }
+
+          #pragma omp critical
+          tpc.report_incremental_progress(inc_amount);
         }
+      } // end omp parallel
+      tpc.report_finished();
+      if (!errors.empty())
+        std::rethrow_exception(errors[0]);
 
-	tpc.report_incremental_progress(inc_amount);
+      BBox2i img_box;
+      for (size_t it = 0; it < unaligned.size(); it++) {
+        if (!std::isnan(unaligned[it][0]))
+          img_box.grow(Vector2(unaligned[it][0], unaligned[it][1]));
       }
-      tpc.report_finished();
 
       // Grow the box to account for the fact that we did a sub-sampling
       // and may have missed some points.
@@ -496,6 +610,25 @@ public:
       m_num_cols = img_box.max().x();
       m_num_rows = img_box.max().y();
 
+      // Record for each cell of the output image the box of disparity
+      // pixels which map into it. The samples are not needed after this.
+      m_cell_size = 64;
+      m_num_cell_cols = std::max(0, (m_num_cols + m_cell_size - 1) / m_cell_size);
+      m_num_cell_rows = std::max(0, (m_num_rows + m_cell_size - 1) / m_cell_size);
+      m_cell_disp_boxes.resize(size_t(m_num_cell_cols) * m_num_cell_rows);
+      for (int sample_row = 0; sample_row < num_sample_rows; sample_row++) {
+        for (int sample_col = 0; sample_col < num_sample_cols; sample_col++) {
+          Vector2f rev = unaligned[size_t(sample_row) * num_sample_cols + sample_col];
+          if (std::isnan(rev[0]) || rev[0] < 0 || rev[1] < 0)
+            continue;
+          int cell_col = int(rev[0]) / m_cell_size, cell_row = int(rev[1]) / m_cell_size;
+          if (cell_col >= m_num_cell_cols || cell_row >= m_num_cell_rows)
+            continue;
+          m_cell_disp_boxes[size_t(cell_row) * m_num_cell_cols + cell_col]
+            .grow(Vector2i(sample_cols[sample_col], sample_rows[sample_row]));
+        }
+      }
+
       vw_out() << "Dimensions are: " << m_num_cols << ' ' << m_num_rows << ".\n";
     }
     // Done computing the input image size.
@@ -543,11 +676,11 @@ public:
     // Initialize the unaligned disparity values for this tile.
     ImageView<pixel_type> unaligned_disp(curr_bbox.width(), curr_bbox.height());
     ImageView<int> count(curr_bbox.width(), curr_bbox.height());
-    for (int col = 0; col < curr_bbox.width(); col++) {
-      for (int row = 0; row < curr_bbox.height(); row++) {
+    for (int row = 0; row < curr_bbox.height(); row++) {
+      for (int col = 0; col < curr_bbox.width(); col++) {
         unaligned_disp(col, row) = pixel_type();
         unaligned_disp(col, row).invalidate();
-	count(col, row) = 0;
+        count(col, row) = 0;
       }
     }
     
@@ -557,38 +690,68 @@ public:
     BBox2i disp_bbox;
     if (!m_is_map_projected) {
       BBox2i full_disp_bbox = bounding_box(m_disparity);
-      for (int col = 0; col < unaligned_disp.cols(); col++) {
-	for (int row = 0; row < unaligned_disp.rows(); row++) {
-	  
-	  // Get the pixel coordinate in the output image (left unaligned pixel),
-	  // Then get the pixel coordinate in the left input image.
-	  Vector2 output_pixel(col + curr_bbox.min()[0], row + curr_bbox.min()[1]);
-	  Vector2 left_aligned_pixel;
-	try {
-	  left_aligned_pixel = local_left_transform->forward(output_pixel);
-	}catch(...){
-	  // This can fail since we may apply it to pixels outside of range
-	  continue;
-	}
-	if (!full_disp_bbox.contains(left_aligned_pixel)) 
-	  continue;
-	disp_bbox.grow(left_aligned_pixel);
-	}
+
+      // The alignment transforms are continuous and one-to-one, so the
+      // image of the tile is within the image of its boundary. Hence it
+      // is enough to transform the boundary pixels. If any of them
+      // cannot be transformed, transform all pixels, as before.
+      bool success = true;
+      int wid = unaligned_disp.cols(), hgt = unaligned_disp.rows();
+      for (int col = 0; col < wid && success; col++) {
+        for (int row = 0; row < hgt; row++) {
+          if (col != 0 && col != wid - 1 && row != 0 && row != hgt - 1)
+            row = hgt - 1; // skip the interior
+          Vector2 output_pixel(col + curr_bbox.min()[0], row + curr_bbox.min()[1]);
+          try {
+            disp_bbox.grow(local_left_transform->forward(output_pixel));
+          } catch(...) {
+            success = false;
+            break;
+          }
+        }
+      }
+      if (success) {
+        // Cover the pixels the transformed boundary passes through
+        if (!disp_bbox.empty())
+          disp_bbox.max() += Vector2i(1, 1);
+        disp_bbox.crop(full_disp_bbox);
+      } else {
+        disp_bbox = BBox2i();
+        for (int row = 0; row < unaligned_disp.rows(); row++) {
+          for (int col = 0; col < unaligned_disp.cols(); col++) {
+            
+            // Get the pixel coordinate in the output image (left unaligned pixel),
+            // Then get the pixel coordinate in the left input image.
+            Vector2 output_pixel(col + curr_bbox.min()[0], row + curr_bbox.min()[1]);
+            Vector2 left_aligned_pixel;
+            try {
+              left_aligned_pixel = local_left_transform->forward(output_pixel);
+            }catch(...){
+              // This can fail since we may apply it to pixels outside of range
+              continue;
+            }
+            if (!full_disp_bbox.contains(left_aligned_pixel)) 
+              continue;
+            disp_bbox.grow(left_aligned_pixel);
+          }
+        }
       }
     }else{
-      for (int col = 0; col < m_disparity.cols(); col++) {
-	for (int row = 0; row < m_disparity.rows(); row++) {
-	  
-	  std::pair<int, int> pix = std::make_pair(col, row);
-	  std::map <std::pair<int, int>, Vector2>::const_iterator it = m_unaligned_trans.find(pix);
-	  if (it == m_unaligned_trans.end())
-	    continue;
-
-	  Vector2 rev = it->second;
-	  if (curr_bbox.contains(rev)) {
-	    disp_bbox.grow(Vector2(col, row));
-	  }
-	}
+      // Use the boxes of disparity pixels which map into the output cells
+      // overlapping with this tile
+      int beg_col = std::max(curr_bbox.min().x() / m_cell_size, 0);
+      int beg_row = std::max(curr_bbox.min().y() / m_cell_size, 0);
+      int end_col = std::min((curr_bbox.max().x() - 1) / m_cell_size + 1, m_num_cell_cols);
+      int end_row = std::min((curr_bbox.max().y() - 1) / m_cell_size + 1, m_num_cell_rows);
+      for (int cell_row = beg_row; cell_row < end_row; cell_row++) {
+        for (int cell_col = beg_col; cell_col < end_col; cell_col++) {
+          BBox2i const& cell_box
+            = m_cell_disp_boxes[size_t(cell_row) * m_num_cell_cols + cell_col];
+          if (cell_box.empty())
+            continue;
+          disp_bbox.grow(cell_box.min());
+          disp_bbox.grow(cell_box.max());
+        }
       }
 
       // Grow the box to account for the fact that we did a sub-sampling
@@ -611,8 +774,8 @@ public:
     typedef typename DispImageType::pixel_type DispPixelT;
     ImageView<DispPixelT> disp = crop(m_disparity, disp_bbox);
 
-    for (int col = 0; col < disp.cols(); col++) {
-      for (int row = 0; row < disp.rows(); row++) {
+    for (int row = 0; row < disp.rows(); row++) {
+      for (int col = 0; col < disp.cols(); col++) {
 	
 	DispPixelT dpix = disp(col, row);
 	if (!is_valid(dpix))
@@ -634,18 +797,18 @@ public:
 	}
 	Vector2 dir = right_pix - left_pix; // disparity value
 	
+	// Shift to be in the domain of the cropped image
+	int ccol = int(round(left_pix[0])) - curr_bbox.min()[0];
+	int crow = int(round(left_pix[1])) - curr_bbox.min()[1];
+	
 	// This averaging is useful in filling tiny holes and avoiding staircasing.
 	// TODO: Use some weights. The closer contribution should have more weight.
-	for (int icol = -KERNEL_SIZE; icol <= KERNEL_SIZE; icol++) {
-	  for (int irow = -KERNEL_SIZE; irow <= KERNEL_SIZE; irow++) {
-	    int lcol = round(left_pix[0]) + icol;
-	    int lrow = round(left_pix[1]) + irow;
-	    
-	    // shift to be in the domain of the cropped image
-	    lcol -= curr_bbox.min()[0];
-	    lrow -= curr_bbox.min()[1];
-	    if (lcol < 0 || lcol >= curr_bbox.width())  continue;
-	    if (lrow < 0 || lrow >= curr_bbox.height()) continue;
+	int beg_col = std::max(ccol - KERNEL_SIZE, 0);
+	int end_col = std::min(ccol + KERNEL_SIZE, curr_bbox.width() - 1);
+	int beg_row = std::max(crow - KERNEL_SIZE, 0);
+	int end_row = std::min(crow + KERNEL_SIZE, curr_bbox.height() - 1);
+	for (int lrow = beg_row; lrow <= end_row; lrow++) {
+	  for (int lcol = beg_col; lcol <= end_col; lcol++) {
 	    if (!is_valid(unaligned_disp(lcol, lrow)))
 	      unaligned_disp(lcol, lrow).validate();
 	    unaligned_disp(lcol, lrow).child() += dir;
@@ -656,8 +819,8 @@ public:
       }
     }
     
-    for (int col = 0; col < unaligned_disp.cols(); col++) {
-      for (int row = 0; row < unaligned_disp.rows(); row++) {
+    for (int row = 0; row < unaligned_disp.rows(); row++) {
+      for (int col = 0; col < unaligned_disp.cols(); col++) {
 	if (count(col, row) == 0)
 	  unaligned_disp(col, row).invalidate();
 	else
@@ -730,40 +893,143 @@ void compute_matches_from_disp(ASPGlobalOptions const& opt,
     int lenx = round(disp.cols()/bin_len); lenx = std::max(1, lenx);
     int leny = round(disp.rows()/bin_len); leny = std::max(1, leny);
 
-    // Iterate over bins.
+    // Pick the disparity at the center of each bin. If it is invalid, pick
+    // the valid one closest to the center within a small window, so that
+    // bins with holes at their centers still produce a match.
+    typedef typename DispImageType::pixel_type DispPixelT;
+    std::vector<int> bin_posx(lenx), bin_posy(leny);
+    for (int binx = 0; binx < lenx; binx++)
+      bin_posx[binx] = round((binx+0.5)*bin_len);
+    for (int biny = 0; biny < leny; biny++)
+      bin_posy[biny] = round((biny+0.5)*bin_len);
+    int half_win = std::max(0, std::min(16, int(floor((bin_len - 1.0)/2.0))));
+
+    // Process groups of bins spanning about 512 pixels in parallel, one
+    // group at a time, to read the disparity in blocks. For small bins,
+    // read the region around all bin centers of the group at once.
+    // Otherwise read only the window around each bin center.
+    int group_len = std::max(1, int(512.0/bin_len));
+    int num_groups_x = (lenx + group_len - 1) / group_len;
+    int num_groups_y = (leny + group_len - 1) / group_len;
+    int num_groups = num_groups_x * num_groups_y;
+    bool read_group_at_once = (bin_len <= 64.0);
+    BBox2i full_box = bounding_box(disp);
 
     vw_out() << "Computing interest point matches based on disparity.\n";
     vw::TerminalProgressCallback tpc("asp", "\t--> ");
-    double inc_amount = 1.0 / double(lenx);
+    double inc_amount = 1.0 / double(num_groups);
     tpc.report_progress(0);
 
-    for (int binx = 0; binx < lenx; binx++) {
-
-      // Pick the disparity at the center of the bin
-      int posx = round((binx+0.5)*bin_len);
-
-      for (int biny = 0; biny < leny; biny++) {
-
-        int posy = round((biny+0.5)*bin_len);
+    // The matches of each group, put together in order at the end
+    std::vector<std::vector<vw::ip::InterestPoint>> group_left_ip(num_groups),
+      group_right_ip(num_groups);
+    std::vector<std::exception_ptr> errors;
+    #pragma omp parallel
+    {
+      // The mapprojection transform is not thread-safe, so make copies
+      vw::TransformPtr local_left_trans = left_trans, local_right_trans = right_trans;
+      bool have_trans = true;
+      if (is_map_projected) {
+        #pragma omp critical
+        {
+          try {
+            local_left_trans  = vw::cartography::mapproj_trans_copy(left_trans);
+            local_right_trans = vw::cartography::mapproj_trans_copy(right_trans);
+          } catch (...) {
+            errors.push_back(std::current_exception());
+            have_trans = false;
+          }
+        }
+      }
 
-        if (posx >= disp.cols() || posy >= disp.rows()) 
-          continue;
-        typedef typename DispImageType::pixel_type DispPixelT;
-        DispPixelT dpix = disp(posx, posy);
-        if (!is_valid(dpix))
+      #pragma omp for schedule(dynamic)
+      for (int group = 0; group < num_groups; group++) {
+        if (!have_trans)
           continue;
+        try {
+          int beg_binx = (group % num_groups_x) * group_len;
+          int beg_biny = (group / num_groups_x) * group_len;
+          int end_binx = std::min(beg_binx + group_len, lenx);
+          int end_biny = std::min(beg_biny + group_len, leny);
+
+          ImageView<DispPixelT> group_disp;
+          BBox2i group_box;
+          if (read_group_at_once) {
+            group_box = BBox2i(Vector2i(bin_posx[beg_binx] - half_win,
+                                        bin_posy[beg_biny] - half_win),
+                               Vector2i(bin_posx[end_binx - 1] + half_win + 1,
+                                        bin_posy[end_biny - 1] + half_win + 1));
+            group_box.crop(full_box);
+            if (!group_box.empty())
+              group_disp = crop(disp, group_box);
+          }
+
+          for (int binx = beg_binx; binx < end_binx; binx++) {
+            int posx = bin_posx[binx];
+            for (int biny = beg_biny; biny < end_biny; biny++) {
+              int posy = bin_posy[biny];
+              if (posx >= disp.cols() || posy >= disp.rows())
+                continue;
+
+              // The window around the bin center
+              BBox2i win_box(Vector2i(posx - half_win, posy - half_win),
+                             Vector2i(posx + half_win + 1, posy + half_win + 1));
+              win_box.crop(full_box);
+              ImageView<DispPixelT> win_disp;
+              BBox2i read_box = group_box;
+              if (!read_group_at_once) {
+                win_disp = crop(disp, win_box);
+                read_box = win_box;
+              }
+              ImageView<DispPixelT> const& local_disp
+                = read_group_at_once ? group_disp : win_disp;
+
+              // The center, if valid, else the closest valid pixel to it
+              int best_col = -1, best_row = -1, best_dist = -1;
+              DispPixelT dpix;
+              for (int row = win_box.min().y(); row < win_box.max().y(); row++) {
+                for (int col = win_box.min().x(); col < win_box.max().x(); col++) {
+                  int dist = (col - posx) * (col - posx) + (row - posy) * (row - posy);
+                  if (best_dist >= 0 && dist >= best_dist)
+                    continue;
+                  DispPixelT curr = local_disp(col - read_box.min().x(),
+                                               row - read_box.min().y());
+                  if (!is_valid(curr))
+                    continue;
+                  best_col = col; best_row = row; best_dist = dist;
+                  dpix = curr;
+                }
+              }
+              if (best_dist < 0)
+                continue;
+
+              // De-warp left and right pixels to be in the camera coordinate system
+              Vector2 left_pix  = local_left_trans->reverse (Vector2(best_col, best_row));
+              Vector2 right_pix = local_right_trans->reverse(Vector2(best_col, best_row)
+                                                             + stereo::DispHelper(dpix));
+
+              group_left_ip[group].push_back(ip::InterestPoint(left_pix.x(), left_pix.y()));
+              group_right_ip[group].push_back(ip::InterestPoint(right_pix.x(), right_pix.y()));
+            }
+          }
+        } catch (...) {
+          #pragma omp critical
+          errors.push_back(std::current_exception());
+        }
 
-        // De-warp left and right pixels to be in the camera coordinate system
-        Vector2 left_pix  = left_trans->reverse (Vector2(posx, posy));
-        Vector2 right_pix = right_trans->reverse(Vector2(posx, posy) + stereo::DispHelper(dpix));
-
-        left_ip.push_back(ip::InterestPoint(left_pix.x(), left_pix.y()));
-        right_ip.push_back(ip::InterestPoint(right_pix.x(), right_pix.y()));
+        #pragma omp critical
+        tpc.report_incremental_progress(inc_amount);
       }
+    } // end omp parallel
+    tpc.report_finished();
+    if (!errors.empty())
+      std::rethrow_exception(errors[0]);
 
-      tpc.report_incremental_progress(inc_amount);
+    for (int group = 0; group < num_groups; group++) {
+      left_ip.insert(left_ip.end(), group_left_ip[group].begin(), group_left_ip[group].end());
+      right_ip.insert(right_ip.end(), group_right_ip[group].begin(),
+                      group_right_ip[group].end());
     }
-    tpc.report_finished();
 
   } else {
 
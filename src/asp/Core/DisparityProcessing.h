@@ -53,6 +53,17 @@ namespace asp {
                     std::string const& d_sub_file,
                     vw::Vector2 const& outlier_removal_params);
   
+  // Triangulate an evenly spread sample of the valid pixels in D_sub,
+  // and save the median of the points as the point cloud center, in
+  // <out prefix>-PC-center.txt. Triangulation will then read it rather
+  // than find it from the full-resolution disparity. Return false if no
+  // point could be triangulated.
+  bool save_cloud_center_from_D_sub(ASPGlobalOptions const& opt,
+                                    vw::TransformPtr tx_left, vw::TransformPtr tx_right,
+                                    boost::shared_ptr<vw::camera::CameraModel> left_camera_model, 
+                                    boost::shared_ptr<vw::camera::CameraModel> right_camera_model,
+                                    std::string const& d_sub_file);
+  
   // Filter D_sub by reducing its spread around the median
   void filter_D_sub_using_spread(ASPGlobalOptions const& opt, std::string const& d_sub_file,
                                  double max_disp_spread);
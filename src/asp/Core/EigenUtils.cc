@@ -88,54 +88,30 @@ void random_pc_subsample(std::int64_t m, DoubleMatrix& points){
   points.conservativeResize(Eigen::NoChange, m);
 }
 
-std::int64_t load_csv_aux(std::string const& file_name, std::int64_t num_points_to_load,
-                          vw::BBox2 const& lonlat_box,
-                          bool calc_shift, vw::Vector3 & shift,
-                          vw::cartography::GeoReference const& geo, CsvConv const& csv_conv,
-                          bool & is_lola_rdr_format, double & median_longitude,
-                          bool verbose, DoubleMatrix & data) {
-
-  // Note: The input CsvConv object is responsible for parsing out the
-  //       type of information contained in the CSV file.
-
-  is_lola_rdr_format = false;
-
-  std::int64_t num_total_points = csv_file_size(file_name);
+bool guess_lola_rdr_format(std::string const& first_line, std::string const& file_name,
+                           vw::cartography::GeoReference const& geo,
+                           CsvConv const& csv_conv, bool verbose) {
 
   std::string sep_str = csv_separator();
   const char* sep = sep_str.c_str();
 
   const std::int64_t bufSize = 1024;
   char temp[bufSize];
-  std::ifstream file( file_name.c_str() );
-  if (!file)
-    vw_throw(vw::IOErr() << "Unable to open file: " << file_name << "\n");
-
-  // We will randomly pick or not a point with probability load_ratio
-  double load_ratio = (double)num_points_to_load/std::max(1.0, (double)num_total_points);
-
-  data.conservativeResize(DIM+1, std::min(num_points_to_load, num_total_points));
-
-  // Peek at the first valid line and see how many elements it has
-  std::string line;
-  while ( getline(file, line, '\n') ) {
-    if (is_valid_csv_line(line))
-      break;
-  }
-
-  file.clear(); file.seekg(0, std::ios_base::beg); // go back to start of file
-  strncpy(temp, line.c_str(), bufSize);
-  const char* token = strtok (temp, sep);
+  strncpy(temp, first_line.c_str(), bufSize);
+  temp[bufSize - 1] = '\0';
+  char * saveptr = NULL;
+  const char* token = strtok_r(temp, sep, &saveptr);
   std::int64_t numTokens = 0;
   while (token != NULL){
     numTokens++;
-    token = strtok (NULL, sep);
+    token = strtok_r(NULL, sep, &saveptr);
   }
   if (numTokens < 3){
     vw_throw( vw::IOErr() << "Expecting at least three fields on each "
                           << "line of file: " << file_name << "\n" );
   }
 
+  bool is_lola_rdr_format = false;
   if (!csv_conv.is_configured()){
     if (numTokens > 20){
       is_lola_rdr_format = true;
@@ -150,161 +126,208 @@ std::int64_t load_csv_aux(std::string const& file_name, std::int64_t num_points_
     }
   }
 
-  // TODO(oalexan1): We parse these guessed file types manually but we should
-  // use a CsvConv object to do it!
-
   if (is_lola_rdr_format && geo.datum().semi_major_axis() != geo.datum().semi_minor_axis() ){
     vw_throw( vw::ArgumentErr() << "The CSV file was detected to be in the"
               << " LOLA RDR format, yet the datum semi-axes are not equal "
               << "as expected for the Moon.\n" );
   }
 
-  bool shift_was_calc = false;
-  bool is_first_line  = true;
-  std::int64_t points_count = 0;
-  std::vector<double> longitudes;
-  line = "";
-  while (getline(file, line, '\n')) {
+  return is_lola_rdr_format;
+}
 
-    if (!is_first_line && !line.empty() && line[0] == '#' && verbose) {
-      vw::vw_out() << "Ignoring line starting with comment: " << line << std::endl;
-      continue;
-    }
-    
-    if (points_count >= num_points_to_load)
-      break;
+bool parse_csv_point(std::string const& line, CsvConv const& csv_conv,
+                     vw::cartography::GeoReference const& geo,
+                     bool is_lola_rdr_format, bool & is_first_line,
+                     vw::Vector3 & xyz, vw::Vector2 & lonlat) {
 
-    if (!is_valid_csv_line(line))
-      continue;
+  std::string sep_str = csv_separator();
+  const char* sep = sep_str.c_str();
 
-    // Randomly skip a percentage of points
-    double r = (double)std::rand()/(double)RAND_MAX;
-    if (r > load_ratio)
-      continue;
+  // We went with C-style parsing instead of C++ in this instance
+  // because we found it to be significantly faster on large files.
+  const std::int64_t bufSize = 1024;
+  char temp[bufSize];
+  char * saveptr = NULL;
 
-    // We went with C-style file reading instead of C++ in this instance
-    // because we found it to be significantly faster on large files.
+  double lon = 0.0, lat = 0.0;
 
-    vw::Vector3 xyz;
-    double lon = 0.0, lat = 0.0;
+  if (csv_conv.is_configured()){
 
-    if (csv_conv.is_configured()){
+    // Parse custom CSV file with given format string
+    bool success;
+    CsvConv::CsvRecord vals = csv_conv.parse_csv_line(is_first_line, success, line);
+    if (!success)
+      return false;
 
-      // Parse custom CSV file with given format string
-      bool success;
-      CsvConv::CsvRecord vals = csv_conv.parse_csv_line(is_first_line, success, line);
-      if (!success)
-        continue;
+    xyz = csv_conv.csv_to_cartesian(vals, geo);
+    lonlat = csv_conv.csv_to_lonlat(vals, geo);
+    return true;
 
-      xyz = csv_conv.csv_to_cartesian(vals, geo);
+  } else if (!is_lola_rdr_format) {
 
-      // Decide if the point is in the box. Also save for the future
-      // the longitude of the point, we'll use it to compute the mean longitude.
-      vw::Vector2 lonlat = csv_conv.csv_to_lonlat(vals, geo);
-      lon = lonlat[0]; // Needed for mean calculation below
-      lat = lonlat[1];
+    // lat,lon,height format
+    double height;
 
-      // TODO: We really need a lonlat bbox function that handles wraparound!!!!!!
-      // Skip points outside the given box
-      if (!lonlat_box.empty() && !lonlat_box.contains(lonlat)
-                              && !lonlat_box.contains(lonlat+vw::Vector2(360,0))
-                              && !lonlat_box.contains(lonlat-vw::Vector2(360,0))) {
-        continue;
-      }
+    strncpy(temp, line.c_str(), bufSize);
+    temp[bufSize - 1] = '\0';
+    const char* token = strtok_r(temp, sep, &saveptr); null_check(token, line);
+    std::int64_t ret = sscanf(token, "%lg", &lat);
 
-    } else if (!is_lola_rdr_format) {
+    token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
+    ret += sscanf(token, "%lg", &lon);
 
-      // lat,lon,height format
-      double height;
+    token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
+    ret += sscanf(token, "%lg", &height);
 
-      strncpy(temp, line.c_str(), bufSize);
-      const char* token = strtok(temp, sep); null_check(token, line);
-      std::int64_t ret = sscanf(token, "%lg", &lat);
+    // Be prepared for the fact that the first line may be the header.
+    if (ret != 3){
+      if (!is_first_line){
+        vw_throw( vw::IOErr() << "Failed to read line: " << line << "\n" );
+      }else{
+        is_first_line = false;
+        return false;
+      }
+    }
+    is_first_line = false;
 
-      token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &lon);
+    vw::Vector3 llh( lon, lat, height );
+    xyz = geo.datum().geodetic_to_cartesian( llh );
+    if ( xyz == vw::Vector3() || !(xyz == xyz) ) return false; // invalid and NaN check
 
-      token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &height);
+  }else{
 
-      // Be prepared for the fact that the first line may be the header.
-      if (ret != 3){
-        if (!is_first_line){
-          vw_throw( vw::IOErr() << "Failed to read line: " << line << "\n" );
-        }else{
-          is_first_line = false;
-          continue;
-        }
+    // Load a RDR_*PointPerRow_csv_table.csv file used for LOLA. Code
+    // copied from Ara Nefian's lidar2dem tool.
+    // We will ignore lines which do not start with year (or a value that
+    // cannot be converted into an integer greater than zero, specifically).
+
+    std::int64_t year, month, day, hour, min;
+    double rad, sec, is_invalid;
+
+    strncpy(temp, line.c_str(), bufSize);
+    temp[bufSize - 1] = '\0';
+    const char* token = strtok_r(temp, sep, &saveptr); null_check(token, line);
+
+    std::int64_t ret = sscanf(token, "%lld-%lld-%lldT%lld:%lld:%lg", &year, &month, &day, &hour,
+                     &min, &sec);
+    if( year <= 0 )
+      return false;
+
+    token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
+    ret += sscanf(token, "%lg", &lon);
+
+    token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
+    ret += sscanf(token, "%lg", &lat);
+    token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
+    ret += sscanf(token, "%lg", &rad);
+    rad *= 1000; // km to m
+
+    // Scan 7 more fields, until we get to the is_invalid flag.
+    for (std::int64_t i = 0; i < 7; i++)
+      token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
+    ret += sscanf(token, "%lg", &is_invalid);
+
+    // Be prepared for the fact that the first line may be the header.
+    if (ret != 10){
+      if (!is_first_line){
+        vw_throw( vw::IOErr() << "Failed to read line: " << line << "\n" );
+      }else{
+        is_first_line = false;
+        return false;
       }
-      is_first_line = false;
+    }
+    is_first_line = false;
 
-      // Skip points outside the given box
-      if (!lonlat_box.empty() && !lonlat_box.contains(vw::Vector2(lon, lat)))
-        continue;
+    if (is_invalid)
+      return false;
 
-      vw::Vector3 llh( lon, lat, height );
-      xyz = geo.datum().geodetic_to_cartesian( llh );
-      if ( xyz == vw::Vector3() || !(xyz == xyz) ) continue; // invalid and NaN check
+    vw::Vector3 lonlatrad( lon, lat, 0 );
 
-    }else{
+    xyz = geo.datum().geodetic_to_cartesian( lonlatrad );
+    if ( xyz == vw::Vector3() || !(xyz == xyz) )
+      return false; // invalid and NaN check
 
-      // Load a RDR_*PointPerRow_csv_table.csv file used for LOLA. Code
-      // copied from Ara Nefian's lidar2dem tool.
-      // We will ignore lines which do not start with year (or a value that
-      // cannot be converted into an integer greater than zero, specifically).
+    // Adjust the point so that it is at the right distance from
+    // planet center.
+    xyz = rad*(xyz/norm_2(xyz));
+  }
 
-      std::int64_t year, month, day, hour, min;
-      double lat, rad, sec, is_invalid;
+  lonlat = vw::Vector2(lon, lat);
+  return true;
+}
 
-      strncpy(temp, line.c_str(), bufSize);
-      const char* token = strtok(temp, sep); null_check(token, line);
+std::int64_t load_csv_aux(std::string const& file_name, std::int64_t num_points_to_load,
+                          vw::BBox2 const& lonlat_box,
+                          bool calc_shift, vw::Vector3 & shift,
+                          vw::cartography::GeoReference const& geo, CsvConv const& csv_conv,
+                          bool & is_lola_rdr_format, double & median_longitude,
+                          bool verbose, DoubleMatrix & data) {
 
-      std::int64_t ret = sscanf(token, "%lld-%lld-%lldT%lld:%lld:%lg", &year, &month, &day, &hour,
-                       &min, &sec);
-      if( year <= 0 )
-        continue;
+  // Note: The input CsvConv object is responsible for parsing out the
+  //       type of information contained in the CSV file.
 
-      token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &lon);
-
-      token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &lat);
-      token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &rad);
-      rad *= 1000; // km to m
-
-      // Scan 7 more fields, until we get to the is_invalid flag.
-      for (std::int64_t i = 0; i < 7; i++)
-        token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &is_invalid);
-
-      // Be prepared for the fact that the first line may be the header.
-      if (ret != 10){
-        if (!is_first_line){
-          vw_throw( vw::IOErr() << "Failed to read line: " << line << "\n" );
-        }else{
-          is_first_line = false;
-          continue;
-        }
-      }
-      is_first_line = false;
+  std::int64_t num_total_points = csv_file_size(file_name);
 
-      if (is_invalid)
-        continue;
+  std::ifstream file( file_name.c_str() );
+  if (!file)
+    vw_throw(vw::IOErr() << "Unable to open file: " << file_name << "\n");
 
-      // Skip points outside the given box
-      if (!lonlat_box.empty() && !lonlat_box.contains(vw::Vector2(lon, lat)))
-        continue;
+  // We will randomly pick or not a point with probability load_ratio
+  double load_ratio = (double)num_points_to_load/std::max(1.0, (double)num_total_points);
 
-      vw::Vector3 lonlatrad( lon, lat, 0 );
+  data.conservativeResize(DIM+1, std::min(num_points_to_load, num_total_points));
 
-      xyz = geo.datum().geodetic_to_cartesian( lonlatrad );
-      if ( xyz == vw::Vector3() || !(xyz == xyz) )
-        continue; // invalid and NaN check
+  // Peek at the first valid line and see how many elements it has
+  std::string line;
+  while ( getline(file, line, '\n') ) {
+    if (is_valid_csv_line(line))
+      break;
+  }
+
+  file.clear(); file.seekg(0, std::ios_base::beg); // go back to start of file
+  is_lola_rdr_format = guess_lola_rdr_format(line, file_name, geo, csv_conv, verbose);
+
+  // TODO(oalexan1): We parse these guessed file types manually but we should
+  // use a CsvConv object to do it!
+
+  bool shift_was_calc = false;
+  bool is_first_line  = true;
+  std::int64_t points_count = 0;
+  std::vector<double> longitudes;
+  line = "";
+  while (getline(file, line, '\n')) {
+
+    if (!is_first_line && !line.empty() && line[0] == '#' && verbose) {
+      vw::vw_out() << "Ignoring line starting with comment: " << line << std::endl;
+      continue;
+    }
+    
+    if (points_count >= num_points_to_load)
+      break;
+
+    if (!is_valid_csv_line(line))
+      continue;
+
+    // Randomly skip a percentage of points
+    double r = (double)std::rand()/(double)RAND_MAX;
+    if (r > load_ratio)
+      continue;
 
-      // Adjust the point so that it is at the right distance from
-      // planet center.
-      xyz = rad*(xyz/norm_2(xyz));
+    vw::Vector3 xyz;
+    vw::Vector2 lonlat;
+    if (!parse_csv_point(line, csv_conv, geo, is_lola_rdr_format, is_first_line,
+                         xyz, lonlat))
+      continue;
+    double lon = lonlat[0], lat = lonlat[1];
+
+    // Skip points outside the given box. With a custom format, the
+    // longitude may be off by 360 degrees.
+    // TODO: We really need a lonlat bbox function that handles wraparound!!!!!!
+    if (!lonlat_box.empty() && !lonlat_box.contains(lonlat)) {
+      if (!csv_conv.is_configured() ||
+          (!lonlat_box.contains(lonlat + vw::Vector2(360, 0)) &&
+           !lonlat_box.contains(lonlat - vw::Vector2(360, 0))))
+        continue;
     }
 
     if (calc_shift && !shift_was_calc){
@@ -398,20 +421,24 @@ void load_dem_pixel_type(std::string const& file_name,
       nodata = dem_rsrc->nodata_read();
   }
   
-  // Load only points within lonlat_box
+  // Load only points within lonlat_box. Sample its edges, not just the
+  // corners, as in a projected DEM they can be curved.
   vw::BBox2i pix_box;
   if (!lonlat_box.empty()){
-    // Need a lot of catch statements, as lonlat_to_pixel() can throw things
-    try { pix_box.grow(dem_geo.lonlat_to_pixel(lonlat_box.min())); } catch(...){}
-    try { pix_box.grow(dem_geo.lonlat_to_pixel(lonlat_box.max())); } catch(...){}
-    try {
-      pix_box.grow(dem_geo.lonlat_to_pixel(vw::Vector2(lonlat_box.min().x(),
-                                                       lonlat_box.max().y())));
-    }catch(...){}
-    try{
-      pix_box.grow(dem_geo.lonlat_to_pixel(vw::Vector2(lonlat_box.max().x(),
-                                                       lonlat_box.min().y())));
-    }catch(...){}
+    int num_samples = 100;
+    for (int it = 0; it <= num_samples; it++) {
+      double t = double(it) / num_samples;
+      double lon = lonlat_box.min().x() + t * lonlat_box.width();
+      double lat = lonlat_box.min().y() + t * lonlat_box.height();
+      vw::Vector2 edges[4] = {vw::Vector2(lon, lonlat_box.min().y()),
+                              vw::Vector2(lon, lonlat_box.max().y()),
+                              vw::Vector2(lonlat_box.min().x(), lat),
+                              vw::Vector2(lonlat_box.max().x(), lat)};
+      // Need a catch statement, as lonlat_to_pixel() can throw things
+      for (int e = 0; e < 4; e++) {
+        try { pix_box.grow(dem_geo.lonlat_to_pixel(edges[e])); } catch(...){}
+      }
+    }
     pix_box.expand(1); // to counteract casting to int
     pix_box.crop(bounding_box(dem));
   }
@@ -426,51 +453,70 @@ void load_dem_pixel_type(std::string const& file_name,
   bool shift_was_calc = false;
   std::int64_t  points_count   = 0;
 
+  // Read the DEM window in strips of rows, each with one read from disk,
+  // rather than fetching pixels one at a time in column order.
+  std::int64_t max_strip_pixels = 4 * 1024 * 1024;
+  std::int64_t strip_rows = std::max(std::int64_t(1),
+                                     max_strip_pixels / std::int64_t(pix_box.width()));
+  
   vw::TerminalProgressCallback tpc("asp", "\t--> ");
-  double inc_amount = 1.0 / double(pix_box.width() );
+  double inc_amount = double(strip_rows) / double(pix_box.height());
   if (verbose)
     tpc.report_progress(0);
 
-  for (std::int64_t i = pix_box.min().x(); i < pix_box.max().x(); i++ ) {
+  for (std::int64_t strip_beg = pix_box.min().y(); strip_beg < pix_box.max().y();
+       strip_beg += strip_rows) {
+
+    if (points_count >= num_points_to_load)
+      break;
+    
+    vw::BBox2i strip_box(pix_box.min().x(), strip_beg, pix_box.width(),
+                         std::min(strip_rows, std::int64_t(pix_box.max().y()) - strip_beg));
+    vw::ImageView<DemPixelType> strip = vw::crop(dem, strip_box);
 
-    for (std::int64_t j = pix_box.min().y(); j < pix_box.max().y(); j++ ) {
+    for (std::int64_t j = strip_box.min().y(); j < strip_box.max().y(); j++ ) {
       if (points_count >= num_points_to_load)
         break;
 
-      double r = (double)std::rand()/(double)RAND_MAX;
-      if (r > load_ratio)
-        continue;
+      for (std::int64_t i = strip_box.min().x(); i < strip_box.max().x(); i++ ) {
+        if (points_count >= num_points_to_load)
+          break;
 
-      DemPixelType h = dem(i, j);
-      if ( h == nodata || std::isnan(h) || std::isinf(h) )
-        continue;
+        double r = (double)std::rand()/(double)RAND_MAX;
+        if (r > load_ratio)
+          continue;
+
+        DemPixelType h = strip(i - strip_box.min().x(), j - strip_box.min().y());
+        if ( h == nodata || std::isnan(h) || std::isinf(h) )
+          continue;
       
-      vw::Vector2 lonlat = dem_geo.pixel_to_lonlat( vw::Vector2(i,j) );
+        vw::Vector2 lonlat = dem_geo.pixel_to_lonlat( vw::Vector2(i,j) );
 
-      // Skip points outside the given box
-      if (!lonlat_box.empty() && !lonlat_box.contains(lonlat))
-        continue;
+        // Skip points outside the given box
+        if (!lonlat_box.empty() && !lonlat_box.contains(lonlat))
+          continue;
 
-      vw::Vector3 llh( lonlat.x(), lonlat.y(), h );
-      vw::Vector3 xyz = dem_geo.datum().geodetic_to_cartesian( llh );
-      if ( xyz == vw::Vector3() || !(xyz == xyz) )
-        continue; // invalid and NaN check
+        vw::Vector3 llh( lonlat.x(), lonlat.y(), h );
+        vw::Vector3 xyz = dem_geo.datum().geodetic_to_cartesian( llh );
+        if ( xyz == vw::Vector3() || !(xyz == xyz) )
+          continue; // invalid and NaN check
 
-      if (calc_shift && !shift_was_calc){
-        shift = xyz;
-        shift_was_calc = true;
-      }
+        if (calc_shift && !shift_was_calc){
+          shift = xyz;
+          shift_was_calc = true;
+        }
 
-      for (std::int64_t row = 0; row < DIM; row++)
-        data(row, points_count) = xyz[row] - shift[row];
-      data(DIM, points_count) = 1; // Extend to be a homogenous coordinate
+        for (std::int64_t row = 0; row < DIM; row++)
+          data(row, points_count) = xyz[row] - shift[row];
+        data(DIM, points_count) = 1; // Extend to be a homogenous coordinate
 
-      points_count++;
+        points_count++;
+      } // end x loop
     } // end y loop
 
     if (verbose)
       tpc.report_incremental_progress( inc_amount );
-  } // end x loop
+  } // end strip loop
   if (verbose)
     tpc.report_finished();
 
@@ -46,6 +46,21 @@ const int DIM = 3;
 // Return at most m random points out of the input point cloud.
 void random_pc_subsample(std::int64_t m, DoubleMatrix& points);
   
+// Guess from the first valid line of a CSV file, when the format is not
+// set, if it is in the LOLA RDR PointPerRow format.
+bool guess_lola_rdr_format(std::string const& first_line, std::string const& file_name,
+                           vw::cartography::GeoReference const& geo,
+                           CsvConv const& csv_conv, bool verbose);
+
+// Parse a point from a valid line of a CSV file, as done by load_csv(). The
+// first line may be a header, which is then skipped. Return false if the
+// line has no valid point. This can be called from multiple threads if
+// each has its own copy of the georeference.
+bool parse_csv_point(std::string const& line, CsvConv const& csv_conv,
+                     vw::cartography::GeoReference const& geo,
+                     bool is_lola_rdr_format, bool & is_first_line,
+                     vw::Vector3 & xyz, vw::Vector2 & lonlat);
+
 // Load a csv file, perhaps sub-sampling it along the way
 void load_csv(std::string const& file_name,
               std::int64_t num_points_to_load,
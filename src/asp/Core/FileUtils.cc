@@ -20,6 +20,11 @@
 
 #include <asp/Core/FileUtils.h>
 
+#include <vw/Core/Settings.h>
+
+#include <algorithm>
+#include <vector>
+
 namespace asp{
 
   using namespace vw;
@@ -61,6 +66,52 @@ namespace asp{
     return is_latest_timestamp(test_file, vec);
   }
 
+  std::uint64_t file_content_hash(std::string const& file) {
+
+    std::ifstream ifs(file.c_str(), std::ios::binary);
+    if (!ifs.good())
+      return 0;
+
+    std::uint64_t hash = 14695981039346656037ULL;
+    std::vector<char> buf(1 << 20);
+    while (ifs) {
+      ifs.read(&buf[0], buf.size());
+      std::streamsize len = ifs.gcount();
+      for (std::streamsize it = 0; it < len; it++) {
+        hash ^= static_cast<unsigned char>(buf[it]);
+        hash *= 1099511628211ULL;
+      }
+    }
+    return hash;
+  }
+
+  void write_lines_parallel(std::ostream & os, size_t num_lines,
+                            std::function<void(std::ostream&, size_t)> const& format_line) {
+
+    // Format a few blocks per thread at a time, to bound the memory usage
+    const size_t block_size = 10000;
+    int num_threads = std::max(1, int(vw_settings().default_num_threads()));
+    size_t num_blocks = (num_lines + block_size - 1) / block_size;
+    size_t blocks_per_round = 4 * num_threads;
+    std::vector<std::string> blocks;
+    for (size_t beg = 0; beg < num_blocks; beg += blocks_per_round) {
+      size_t end = std::min(beg + blocks_per_round, num_blocks);
+      blocks.resize(end - beg);
+      #pragma omp parallel for num_threads(num_threads)
+      for (int it = 0; it < int(end - beg); it++) {
+        std::ostringstream oss;
+        oss.precision(os.precision());
+        size_t line_beg = (beg + it) * block_size;
+        size_t line_end = std::min(line_beg + block_size, num_lines);
+        for (size_t line = line_beg; line < line_end; line++)
+          format_line(oss, line);
+        blocks[it] = oss.str();
+      }
+      for (size_t it = 0; it < blocks.size(); it++)
+        os.write(blocks[it].data(), blocks[it].size());
+    }
+  }
+
   void read_1d_points(std::string const& file, std::vector<double> & points){
 
     std::ifstream ifs(file.c_str());
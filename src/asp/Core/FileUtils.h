@@ -18,7 +18,9 @@
 #ifndef __CORE_FILE_UTILS_H__
 #define __CORE_FILE_UTILS_H__
 
+#include <cstdint>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -40,6 +42,17 @@ namespace asp {
                            std::string const& f1, std::string const& f2,
                            std::string const& f3, std::string const& f4);
 
+  /// A 64-bit FNV-1a hash of the contents of a file. Returns 0 if the
+  /// file cannot be read.
+  std::uint64_t file_content_hash(std::string const& file);
+
+  /// Write num_lines lines to a stream. The lines are formatted in parallel, in
+  /// blocks, by format_line(out, line_index), using the precision of the given
+  /// stream, then written in order. This is much faster than writing millions
+  /// of lines one at a time. format_line() must be thread-safe.
+  void write_lines_parallel(std::ostream & os, size_t num_lines,
+                            std::function<void(std::ostream&, size_t)> const& format_line);
+
   void read_1d_points(std::string const& file, std::vector<double> & points);
   void read_2d_points(std::string const& file, std::vector<vw::Vector2> & points);
   void read_3d_points(std::string const& file, std::vector<vw::Vector3> & points);
@@ -0,0 +1,171 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file GeoidGrid.cc
+///
+
+#include <asp/Core/GeoidGrid.h>
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Image/ImageView.h>
+#include <vw/FileIO/DiskImageResourceGDAL.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/FileUtils.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/dll.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace fs = boost::filesystem;
+
+namespace asp {
+
+  const char GEOID_GRID_MAGIC[9] = "ASPGEO01";
+
+  std::string geoid_full_path(std::string const& geoid_file) {
+
+    char * geoid_dir_ptr = getenv("ASP_GEOID_DIR");
+    fs::path geoid_dir;
+    if (geoid_dir_ptr != NULL && std::string(geoid_dir_ptr) != "")
+      geoid_dir = fs::path(std::string(geoid_dir_ptr));
+    else
+      geoid_dir = boost::dll::program_location().parent_path().parent_path()
+        / fs::path("share") / fs::path("geoids");
+
+    fs::path geoid_path = geoid_dir / fs::path(geoid_file);
+    if (!fs::exists(geoid_path))
+      vw::vw_throw(vw::ArgumentErr() << "Could not find the geoid: " << geoid_path.string()
+                   << ". Set export ASP_GEOID_DIR=/path/to/share/geoids\n");
+
+    return geoid_path.string();
+  }
+
+  // The EGM96 and EGM2008 geoids are stored as int16 JPEG2000 files, with
+  // the values in [0, 65534] mapping linearly to heights in [min_ht, max_ht].
+  bool geoid_jp2_range(std::string const& geoid_file, double & min_ht, double & max_ht) {
+    std::string name = fs::path(geoid_file).filename().string();
+    if (name == "egm96-5.jp2") {
+      min_ht = -108; max_ht = 86;
+      return true;
+    }
+    if (name == "egm2008.jp2") {
+      min_ht = -107; max_ht = 86;
+      return true;
+    }
+    return false;
+  }
+
+  // Read the cached grid header. Return false if there is no cached grid,
+  // or it does not match the geoid file.
+  bool read_geoid_cache_header(std::string const& cache_file, GeoidGridHeader const& expected) {
+    if (!fs::exists(cache_file))
+      return false;
+
+    GeoidGridHeader header;
+    std::ifstream ifs(cache_file.c_str(), std::ios::binary);
+    if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)))
+      return false;
+
+    std::uint64_t expected_size = sizeof(GeoidGridHeader)
+      + std::uint64_t(expected.cols) * expected.rows * sizeof(double);
+    return (std::memcmp(header.magic, GEOID_GRID_MAGIC, sizeof(header.magic)) == 0 &&
+            header.cols == expected.cols && header.rows == expected.rows &&
+            header.source_size == expected.source_size &&
+            header.source_mtime == expected.source_mtime &&
+            fs::file_size(cache_file) == expected_size);
+  }
+
+  GeoidGrid::GeoidGrid(std::string const& geoid_file, std::string const& cache_dir):
+    m_data(NULL), m_cols(0), m_rows(0) {
+
+    // The georeference and no-data value are read from the geoid file, which
+    // does not need decoding the grid.
+    m_nodata = std::numeric_limits<float>::quiet_NaN();
+    vw::DiskImageResourceGDAL rsrc(geoid_file);
+    if (rsrc.has_nodata_read())
+      m_nodata = rsrc.nodata_read();
+    vw::cartography::read_georeference(m_georef, rsrc);
+    m_cols = rsrc.cols();
+    m_rows = rsrc.rows();
+
+    GeoidGridHeader header;
+    std::memcpy(header.magic, GEOID_GRID_MAGIC, sizeof(header.magic));
+    header.cols         = m_cols;
+    header.rows         = m_rows;
+    header.nodata       = m_nodata;
+    header.source_size  = fs::file_size(geoid_file);
+    header.source_mtime = fs::last_write_time(geoid_file);
+
+    std::string cache_file;
+    if (cache_dir != "") {
+      cache_file = (fs::path(cache_dir) / fs::path(geoid_file).filename())
+        .replace_extension(".grid").string();
+      if (read_geoid_cache_header(cache_file, header)) {
+        m_file.open(cache_file);
+        if (m_file.is_open()) {
+          vw::vw_out() << "Reading the geoid grid from: " << cache_file << "\n";
+          m_data = reinterpret_cast<double const*>(m_file.data() + sizeof(GeoidGridHeader));
+          return;
+        }
+      }
+    }
+
+    // Decode the grid and scale it to meters. The EGM2008 heights are kept
+    // as doubles, and the rest are rounded to float, as they were read before.
+    double min_ht = 0, max_ht = 0;
+    bool is_jp2 = geoid_jp2_range(geoid_file, min_ht, max_ht);
+    bool is_egm2008 = (fs::path(geoid_file).filename().string() == "egm2008.jp2");
+    double a = 0, b = 65534, s = (max_ht - min_ht) / (b - a);
+    vw::ImageView<float> geoid_img = vw::DiskImageView<float>(rsrc);
+    m_vals.resize(std::int64_t(m_cols) * m_rows);
+    for (int col = 0; col < m_cols; col++) {
+      for (int row = 0; row < m_rows; row++) {
+        double val = geoid_img(col, row);
+        if (is_jp2) {
+          val = s * (val - a) + min_ht;
+          if (!is_egm2008)
+            val = float(val);
+        }
+        m_vals[std::int64_t(col) * m_rows + row] = val;
+      }
+    }
+    m_data = &m_vals[0];
+
+    if (cache_file == "")
+      return;
+
+    // Write to a uniquely named temporary file first, as several processes
+    // may be creating the cache at the same time.
+    vw::create_out_dir(cache_file);
+    std::string tmp_file = fs::unique_path(cache_file + ".%%%%-%%%%.tmp").string();
+    {
+      std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+      ofs.write(reinterpret_cast<char const*>(&header), sizeof(header));
+      ofs.write(reinterpret_cast<char const*>(m_data), m_vals.size() * sizeof(double));
+      if (!ofs)
+        vw::vw_throw(vw::IOErr() << "Could not write: " << tmp_file << "\n");
+    }
+    fs::rename(tmp_file, cache_file);
+    vw::vw_out() << "Wrote: " << cache_file << "\n";
+  }
+
+} // end namespace asp
@@ -0,0 +1,114 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file GeoidGrid.h
+///
+
+// A geoid grid (EGM96, EGM2008, NAVD88, or the MOLA areoid), with the
+// heights decoded and scaled to meters. Decoding the EGM2008 grid from
+// JPEG2000 takes a while, so the decoded grid can be saved in a cache
+// directory, and later be mapped into memory instead of decoded again.
+
+#ifndef __ASP_CORE_GEOID_GRID_H__
+#define __ASP_CORE_GEOID_GRID_H__
+
+#include <vw/Cartography/GeoReference.h>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  // The header of the cached grid, followed by the heights. All values
+  // are in native byte order.
+  struct GeoidGridHeader {
+    char         magic[8];     // "ASPGEO01"
+    std::int32_t cols, rows;   // grid dimensions
+    double       nodata;       // no-data value of the grid
+    std::int64_t source_size;  // size and modification time of the geoid
+    std::int64_t source_mtime; // file, to know when to redo the cache
+  };
+
+  /// Get the absolute path to the geoid. It is normally in the share/geoids
+  /// directory of the ASP distribution, but in dev mode the directory
+  /// having the geoids can be set via the ASP_GEOID_DIR env var.
+  std::string geoid_full_path(std::string const& geoid_file);
+
+  /// The geoid heights, in meters, with the georeference of the geoid file.
+  /// The heights are stored as doubles in column-major order, which is what
+  /// the EGM2008 Fortran interpolation routine expects.
+  class GeoidGrid {
+    boost::iostreams::mapped_file_source m_file; // the cached grid, if mapped
+    std::vector<double> m_vals;                   // the grid, if not mapped
+    double const*       m_data;
+    int                 m_cols, m_rows;
+    double              m_nodata;
+    vw::cartography::GeoReference m_georef;
+
+  public:
+    /// Read the geoid from the given file. If the cache directory is not
+    /// empty, map the decoded grid from there if it was saved before, and
+    /// save it otherwise.
+    GeoidGrid(std::string const& geoid_file, std::string const& cache_dir);
+
+    int cols() const { return m_cols; }
+    int rows() const { return m_rows; }
+    double nodata() const { return m_nodata; }
+    double const* data() const { return m_data; }
+    vw::cartography::GeoReference const& georef() const { return m_georef; }
+
+    inline double operator()(int col, int row) const {
+      return m_data[std::int64_t(col) * m_rows + row];
+    }
+
+    /// Bicubic interpolation at the given pixel, with the same weights as
+    /// vw::BicubicInterpolation. Return false if any of the 16 grid values
+    /// used is outside the grid or is no-data.
+    inline bool interpolate(double x, double y, double & val) const {
+      int c = int(std::floor(x)), r = int(std::floor(y));
+      if (c - 1 < 0 || r - 1 < 0 || c + 2 >= m_cols || r + 2 >= m_rows)
+        return false;
+
+      double nx = x - c, ny = y - r;
+      double s[4] = {((2 - nx) * nx - 1) * nx, (3 * nx - 5) * nx * nx + 2,
+                     ((4 - 3 * nx) * nx + 1) * nx, (nx - 1) * nx * nx};
+      double t[4] = {((2 - ny) * ny - 1) * ny, (3 * ny - 5) * ny * ny + 2,
+                     ((4 - 3 * ny) * ny + 1) * ny, (ny - 1) * ny * ny};
+
+      val = 0.0;
+      for (int i = 0; i < 4; i++) {
+        double const* col = m_data + std::int64_t(c - 1 + i) * m_rows + (r - 1);
+        double sum = 0.0;
+        for (int j = 0; j < 4; j++) {
+          if (col[j] == m_nodata || std::isnan(col[j]))
+            return false;
+          sum += t[j] * col[j];
+        }
+        val += s[i] * sum;
+      }
+      val *= 0.25;
+      return true;
+    }
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_GEOID_GRID_H__
@@ -17,11 +17,17 @@
 
 #include <vw/FileIO/DiskImageResource.h>
 #include <vw/Core/Log.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Manipulation.h>
 
 #include <asp/Core/ImageNormalization.h>
 #include <asp/Core/StereoSettings.h>
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
+#include <string>
+#include <vector>
 
 using namespace vw;
 
@@ -58,4 +64,181 @@ namespace asp {
     return;
   }
   
+  // The start and size of a sample window of up to the given size, around
+  // the given position along one image axis. The window is kept within the
+  // disk block having that position, so it is read from one block.
+  void sample_window_range(int pos, int len, int block, int win,
+                           int & start, int & size) {
+    int beg = 0, end = len;
+    if (block > 0 && block < len) {
+      beg = (pos / block) * block;
+      end = std::min(len, beg + block);
+    }
+    size  = std::min(win, end - beg);
+    start = std::max(beg, std::min(pos - size / 2, end - size));
+  }
+
+  bool sample_image_stats(vw::ImageViewRef<vw::PixelMask<float>> const& image,
+                          vw::Vector2i const& block_size, double accuracy,
+                          vw::Vector6f & stats) {
+
+    if (accuracy <= 0.0)
+      vw_throw(ArgumentErr() << "The image statistics accuracy must be positive.\n");
+
+    int cols = image.cols(), rows = image.rows();
+    if (cols <= 0 || rows <= 0)
+      return false;
+
+    // With n samples, a percentile is off by at most 0.5/sqrt(n) of the
+    // pixels on average. Use twice that, so n = 1/accuracy^2.
+    const int win = 32;
+    double num_samples = 1.0 / (accuracy * accuracy);
+    int num_wins = std::max(1.0, std::ceil(num_samples / (win * win)));
+
+    // A grid of cells with about the aspect ratio of the image, with cells
+    // no smaller than the windows
+    int grid_cols = std::round(std::sqrt(double(num_wins) * cols / rows));
+    grid_cols = std::max(1, std::min(grid_cols, (cols + win - 1) / win));
+    int grid_rows = (num_wins + grid_cols - 1) / grid_cols;
+    grid_rows = std::max(1, std::min(grid_rows, (rows + win - 1) / win));
+
+    std::vector<BBox2i> wins;
+    for (int grid_row = 0; grid_row < grid_rows; grid_row++) {
+      for (int grid_col = 0; grid_col < grid_cols; grid_col++) {
+        int cx = int((grid_col + 0.5) * cols / grid_cols);
+        int cy = int((grid_row + 0.5) * rows / grid_rows);
+        int x0 = 0, y0 = 0, wx = 0, wy = 0;
+        sample_window_range(cx, cols, block_size[0], win, x0, wx);
+        sample_window_range(cy, rows, block_size[1], win, y0, wy);
+        wins.push_back(BBox2i(x0, y0, wx, wy));
+      }
+    }
+    vw_out() << "\t    Estimating statistics from " << wins.size()
+             << " windows of up to " << win << " x " << win << " pixels.\n";
+
+    // Read the windows in parallel. OpenMP cannot propagate exceptions.
+    std::vector<std::vector<float>> win_vals(wins.size());
+    std::vector<std::string> errors(wins.size());
+    #pragma omp parallel for
+    for (int it = 0; it < int(wins.size()); it++) {
+      try {
+        ImageView<PixelMask<float>> tile = crop(image, wins[it]);
+        for (int row = 0; row < tile.rows(); row++) {
+          for (int col = 0; col < tile.cols(); col++) {
+            if (is_valid(tile(col, row)))
+              win_vals[it].push_back(tile(col, row).child());
+          }
+        }
+      } catch (std::exception const& e) {
+        errors[it] = e.what();
+      }
+    }
+    for (size_t it = 0; it < errors.size(); it++) {
+      if (!errors[it].empty())
+        vw_throw(ArgumentErr() << errors[it]);
+    }
+
+    std::vector<float> vals;
+    for (size_t it = 0; it < win_vals.size(); it++)
+      vals.insert(vals.end(), win_vals[it].begin(), win_vals[it].end());
+    if (vals.empty())
+      return false;
+
+    std::sort(vals.begin(), vals.end());
+    double sum = 0.0, sum2 = 0.0;
+    for (size_t it = 0; it < vals.size(); it++) {
+      sum  += vals[it];
+      sum2 += double(vals[it]) * vals[it];
+    }
+    size_t num = vals.size();
+    double mean = sum / num;
+    auto quantile = [&](double q) { return vals[size_t(std::round(q * (num - 1)))]; };
+
+    stats[0] = vals.front();
+    stats[1] = vals.back();
+    stats[2] = mean;
+    stats[3] = std::sqrt(std::max(0.0, sum2 / num - mean * mean));
+    stats[4] = quantile(0.02);
+    stats[5] = quantile(0.98);
+
+    return true;
+  }
+
+  /// Find the intensity ranges which normalize_images() maps to [0, 1]
+  void normalization_bounds(bool force_use_entire_range,
+                            bool individually_normalize,
+                            bool use_percentile_stretch,
+                            bool do_not_exceed_min_max,
+                            vw::Vector6f const& left_stats,
+                            vw::Vector6f const& right_stats,
+                            double & left_min,  double & left_max,
+                            double & right_min, double & right_max) {
+    
+    // These arguments must contain: (min, max, mean, std)
+    VW_ASSERT(left_stats.size() == 6 && right_stats.size() == 6,
+              vw::ArgumentErr() << "Expecting a vector of size 6 in normalize_images()\n");
+
+    // If the input stats don't contain the stddev, must use the entire range version.
+    // - This should only happen when normalizing ISIS images for ip_matching purposes.
+    if ((left_stats[3] == 0) || (right_stats[3] == 0))
+      force_use_entire_range = true;
+
+    if (force_use_entire_range) { // Stretch between the min and max values
+      if (individually_normalize) {
+        vw::vw_out() << "\t--> Individually normalize images to their respective min max\n";
+        left_min  = left_stats [0];
+        left_max  = left_stats [1];
+        right_min = right_stats[0];
+        right_max = right_stats[1];
+      } else { // Normalize using the same stats
+        double low = std::min(left_stats[0], right_stats[0]);
+        double hi  = std::max(left_stats[1], right_stats[1]);
+        vw::vw_out() << "\t--> Normalizing globally to: [" << low << " " << hi << "]\n";
+        left_min  = right_min = low;
+        left_max  = right_max = hi;
+      }
+      return;
+    }
+    
+    // Don't force the entire range
+    if (use_percentile_stretch) {
+      // Percentile stretch
+      left_min  = left_stats [4];
+      left_max  = left_stats [5];
+      right_min = right_stats[4];
+      right_max = right_stats[5];
+    } else {
+      // Two standard deviation stretch
+      left_min  = left_stats [2] - 2*left_stats [3];
+      left_max  = left_stats [2] + 2*left_stats [3];
+      right_min = right_stats[2] - 2*right_stats[3];
+      right_max = right_stats[2] + 2*right_stats[3];
+
+      if (do_not_exceed_min_max) {
+        // This is important for ISIS which may have special pixels beyond the min and max
+        left_min = std::max(left_min,   (double)left_stats[0]);
+        left_max = std::min(left_max,   (double)left_stats[1]);
+        right_min = std::max(right_min, (double)right_stats[0]);
+        right_max = std::min(right_max, (double)right_stats[1]);
+      }
+    }
+
+    if (individually_normalize > 0) {
+      vw::vw_out() << "\t--> Individually normalize images\n";
+    } else { // Normalize using the same stats
+      double low = std::min(left_min, right_min);
+      double hi  = std::max(left_max, right_max);
+      vw::vw_out() << "\t--> Normalizing globally to: [" << low << " " << hi << "]\n";
+      if (!do_not_exceed_min_max) {
+        left_min  = right_min = low;
+        left_max  = right_max = hi;
+      } else {
+        left_min  = std::max(low, left_min);
+        left_max  = std::min(hi,  left_max);
+        right_min = std::max(low, right_min);
+        right_max = std::min(hi,  right_max);
+      }
+    }
+  }
+
 }
@@ -16,10 +16,20 @@
 // __END_LICENSE__
 
 #include <asp/Core/ImageUtils.h>
+#include <asp/Core/DemUtils.h>
 #include <vw/FileIO/DiskImageResourceGDAL.h>
 #include <vw/Cartography/GeoReference.h>
 #include <vw/FileIO/DiskImageUtils.h>
 #include <vw/Image/Interpolation.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+#include <vw/Core/Settings.h>
+#include <vw/Image/ImageViewRef.h>
+
+#include <gdal.h>
+#include <omp.h>
+
+#include <cstdint>
+#include <cmath>
 
 using namespace vw;
 
@@ -61,21 +71,280 @@ void create_interp_dem(std::string const& dem_file,
   if (vw::read_nodata_val(dem_file, nodata_val))
     vw_out() << "Found DEM nodata value: " << nodata_val << std::endl;
 
-  // Create the interpolated DEM. Values out of bounds will be invalid.
-  vw::PixelMask<double> invalid_val;
-  invalid_val[0] = nodata_val;
-  invalid_val.invalidate();
-  ImageViewRef<PixelMask<double>> dem
-    = create_mask(DiskImageView<double>(dem_file), nodata_val);
-  interp_dem = interpolate(dem, BilinearInterpolation(), 
-                           vw::ValueEdgeExtension<vw::PixelMask<float>>(invalid_val));
-
   // Read the georef. It must exist.
   bool is_good = vw::cartography::read_georeference(dem_georef, dem_file);
   if (!is_good) {
     vw_throw(ArgumentErr() << "Error: Cannot read a georeference from DEM: "
              << dem_file << ".\n");
   }
+
+  // The DEM tiles are read as needed and shared via the DEM cache
+  create_interp_dem(asp::CachedDem(dem_file), interp_dem);
+}
+
+/// Create a DEM ready to use for interpolation from a masked DEM. Values out
+/// of bounds will be invalid.
+void create_interp_dem(ImageViewRef<PixelMask<float>> const& masked_dem,
+                       ImageViewRef<PixelMask<double>> & interp_dem) {
+  vw::PixelMask<double> invalid_val;
+  invalid_val[0] = -std::numeric_limits<float>::max();
+  invalid_val.invalidate();
+  interp_dem = interpolate(pixel_cast<PixelMask<double>>(masked_dem), BilinearInterpolation(),
+                           vw::ValueEdgeExtension<vw::PixelMask<float>>(invalid_val));
+}
+
+// Read into memory the pixels of a DEM in the box of the given ECEF points,
+// with some padding.
+bool read_dem_window(std::string const& dem_file,
+                     std::vector<vw::Vector3> const& xyz_vec,
+                     std::int64_t max_pixels,
+                     // Outputs
+                     vw::ImageView<float> & dem_win,
+                     vw::cartography::GeoReference & win_georef) {
+
+  vw::cartography::GeoReference georef;
+  if (!vw::cartography::read_georeference(georef, dem_file))
+    return false;
+  DiskImageView<float> dem(dem_file);
+
+  BBox2 pix_box;
+  for (size_t it = 0; it < xyz_vec.size(); it++) {
+    if (xyz_vec[it] == Vector3())
+      continue;
+    Vector3 llh = georef.datum().cartesian_to_geodetic(xyz_vec[it]);
+    Vector2 pix;
+    try {
+      pix = georef.lonlat_to_pixel(subvector(llh, 0, 2));
+    } catch (...) {
+      continue;
+    }
+    pix_box.grow(pix);
+  }
+  if (pix_box.empty())
+    return false;
+
+  // The rays which are intersected with the DEM may meet it away from the points
+  double pad = 0.25 * std::max(pix_box.width(), pix_box.height()) + 100.0;
+  BBox2i win_box(Vector2i(floor(pix_box.min().x() - pad), floor(pix_box.min().y() - pad)),
+                 Vector2i(ceil(pix_box.max().x() + pad) + 1, ceil(pix_box.max().y() + pad) + 1));
+  win_box.crop(bounding_box(dem));
+  if (win_box.empty() || std::int64_t(win_box.width()) * win_box.height() > max_pixels)
+    return false;
+
+  dem_win = crop(dem, win_box);
+  win_georef = vw::cartography::crop(georef, win_box);
+  vw_out() << "Read into memory a window of " << win_box.width() << " x "
+           << win_box.height() << " pixels of the DEM.\n";
+  return true;
+}
+
+// Create a masked DEM, with the DEM window around the given points read into
+// memory if feasible.
+void create_masked_dem(std::string const& dem_file,
+                       std::vector<vw::Vector3> const& xyz_vec,
+                       vw::cartography::GeoReference & dem_georef,
+                       ImageViewRef<PixelMask<float>> & masked_dem) {
+
+  vw_out() << "Loading DEM: " << dem_file << std::endl;
+  double nodata_val = -std::numeric_limits<float>::max(); // note we use a float nodata
+  if (vw::read_nodata_val(dem_file, nodata_val))
+    vw_out() << "Found DEM nodata value: " << nodata_val << std::endl;
+
+  // The window is stored as float, so 2^28 pixels need 1 GB of memory
+  const std::int64_t max_pixels = std::int64_t(1) << 28;
+  vw::ImageView<float> dem_win;
+  if (read_dem_window(dem_file, xyz_vec, max_pixels, dem_win, dem_georef)) {
+    masked_dem = create_mask(dem_win, float(nodata_val));
+    return;
+  }
+
+  // Read the DEM tiles as needed. This throws if there is no georeference.
+  asp::CachedDem dem(dem_file);
+  dem_georef = dem.georef();
+  masked_dem = dem;
+}
+
+// Apply a functor to each tile of an image, in parallel, with each tile
+// read once. The functor is passed the thread index, so it can
+// accumulate per-thread partial results without locking. OpenMP cannot
+// propagate exceptions, so these are thrown after the loop.
+template <class TileFunc>
+void process_tiles(ImageViewRef<PixelMask<float>> const& image, TileFunc & func) {
+
+  int tile_size = vw::vw_settings().default_tile_size();
+  std::vector<BBox2i> boxes = subdivide_bbox(image, tile_size, tile_size);
+  std::vector<std::string> errors(boxes.size());
+  #pragma omp parallel for schedule(dynamic)
+  for (int it = 0; it < int(boxes.size()); it++) {
+    try {
+      ImageView<PixelMask<float>> tile = crop(image, boxes[it]);
+      func(omp_get_thread_num(), tile);
+    } catch (std::exception const& e) {
+      errors[it] = e.what();
+    }
+  }
+  for (size_t it = 0; it < errors.size(); it++) {
+    if (!errors[it].empty())
+      vw_throw(ArgumentErr() << errors[it]);
+  }
+}
+
+// Per-thread range of valid pixel values
+struct TileRangeFunc {
+  std::vector<double> min_vals, max_vals;
+  TileRangeFunc(int num_threads):
+    min_vals(num_threads, std::numeric_limits<double>::max()),
+    max_vals(num_threads, -std::numeric_limits<double>::max()) {}
+  void operator()(int thread, ImageView<PixelMask<float>> const& tile) {
+    double min_val = min_vals[thread], max_val = max_vals[thread];
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        PixelMask<float> const& pix = tile(col, row);
+        if (!is_valid(pix) || std::isnan(pix.child()))
+          continue;
+        min_val = std::min(min_val, double(pix.child()));
+        max_val = std::max(max_val, double(pix.child()));
+      }
+    }
+    min_vals[thread] = min_val;
+    max_vals[thread] = max_val;
+  }
+};
+
+// Per-thread histogram of valid pixel values
+struct TileHistogramFunc {
+  int m_num_bins;
+  double m_min_val, m_scale;
+  std::vector<std::vector<std::int64_t>> hists;
+  TileHistogramFunc(int num_threads, int num_bins, double min_val, double max_val):
+    m_num_bins(num_bins), m_min_val(min_val), m_scale(0.0),
+    hists(num_threads, std::vector<std::int64_t>(num_bins, 0)) {
+    if (max_val > min_val)
+      m_scale = (num_bins - 1.0) / (max_val - min_val);
+  }
+  void operator()(int thread, ImageView<PixelMask<float>> const& tile) {
+    std::vector<std::int64_t> & hist = hists[thread];
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        PixelMask<float> const& pix = tile(col, row);
+        if (!is_valid(pix) || std::isnan(pix.child()))
+          continue;
+        int bin = round(m_scale * (pix.child() - m_min_val));
+        bin = std::max(0, std::min(bin, m_num_bins - 1));
+        hist[bin]++;
+      }
+    }
+  }
+};
+
+// Find the range of the valid pixels of an image, in parallel
+bool valid_pixel_range(ImageViewRef<PixelMask<float>> const& image,
+                       double & min_val, double & max_val) {
+
+  TileRangeFunc func(omp_get_max_threads());
+  process_tiles(image, func);
+
+  min_val = std::numeric_limits<double>::max();
+  max_val = -std::numeric_limits<double>::max();
+  for (size_t it = 0; it < func.min_vals.size(); it++) {
+    min_val = std::min(min_val, func.min_vals[it]);
+    max_val = std::max(max_val, func.max_vals[it]);
+  }
+
+  return min_val <= max_val;
+}
+
+// Find the histogram of the valid pixels of an image, in parallel
+void tile_histogram(ImageViewRef<PixelMask<float>> const& image,
+                    int num_bins, double min_val, double max_val,
+                    std::vector<std::int64_t> & hist) {
+
+  if (num_bins <= 0)
+    vw_throw(ArgumentErr() << "The number of histogram bins must be positive.\n");
+
+  TileHistogramFunc func(omp_get_max_threads(), num_bins, min_val, max_val);
+  process_tiles(image, func);
+
+  // Integer sums, so the result does not depend on the number of threads
+  hist.assign(num_bins, 0);
+  for (size_t it = 0; it < func.hists.size(); it++) {
+    for (int bin = 0; bin < num_bins; bin++)
+      hist[bin] += func.hists[it][bin];
+  }
+}
+
+// Find the Otsu threshold given a histogram. Maximize the variance
+// between the class of values no more than the threshold and the rest.
+double otsu_threshold(std::vector<std::int64_t> const& hist,
+                      double min_val, double max_val) {
+
+  int num_bins = hist.size();
+  if (num_bins <= 1 || max_val <= min_val)
+    return min_val;
+
+  double total = 0.0, total_sum = 0.0;
+  for (int bin = 0; bin < num_bins; bin++) {
+    total     += hist[bin];
+    total_sum += double(bin) * hist[bin];
+  }
+
+  double w0 = 0.0, sum0 = 0.0, max_var = -1.0;
+  int best_bin = 0;
+  for (int bin = 0; bin < num_bins - 1; bin++) {
+    w0   += hist[bin];
+    sum0 += double(bin) * hist[bin];
+    double w1 = total - w0;
+    if (w0 <= 0.0 || w1 <= 0.0)
+      continue;
+    double mu0 = sum0 / w0, mu1 = (total_sum - sum0) / w1;
+    double var = w0 * w1 * (mu0 - mu1) * (mu0 - mu1);
+    if (var > max_var) {
+      max_var = var;
+      best_bin = bin;
+    }
+  }
+
+  return min_val + best_bin * (max_val - min_val) / (num_bins - 1.0);
+}
+
+// Read in memory the coarsest GDAL overview of the first band having
+// at least the given number of pixels
+bool read_overview(std::string const& image_file, std::int64_t min_num_pixels,
+                   vw::ImageView<float> & overview) {
+
+  GDALAllRegister();
+  GDALDatasetH ds = GDALOpen(image_file.c_str(), GA_ReadOnly);
+  if (ds == NULL)
+    return false;
+
+  GDALRasterBandH band = (GDALGetRasterCount(ds) > 0) ? GDALGetRasterBand(ds, 1) : NULL;
+  int num_ovr = (band != NULL) ? GDALGetOverviewCount(band) : 0;
+
+  // The overviews are usually from finest to coarsest, but do not assume that
+  GDALRasterBandH best = NULL;
+  std::int64_t best_num_pixels = std::numeric_limits<std::int64_t>::max();
+  for (int level = 0; level < num_ovr; level++) {
+    GDALRasterBandH ovr = GDALGetOverview(band, level);
+    if (ovr == NULL)
+      continue;
+    std::int64_t num_pixels = std::int64_t(GDALGetRasterBandXSize(ovr)) *
+      GDALGetRasterBandYSize(ovr);
+    if (num_pixels >= min_num_pixels && num_pixels < best_num_pixels) {
+      best = ovr;
+      best_num_pixels = num_pixels;
+    }
+  }
+
+  bool success = false;
+  if (best != NULL) {
+    int cols = GDALGetRasterBandXSize(best), rows = GDALGetRasterBandYSize(best);
+    overview.set_size(cols, rows);
+    success = (GDALRasterIO(best, GF_Read, 0, 0, cols, rows, &overview(0, 0),
+                            cols, rows, GDT_Float32, 0, 0) == CE_None);
+  }
+
+  GDALClose(ds);
+  return success;
 }
 
 } // end namespace asp
@@ -22,6 +22,13 @@
 #define __ASP_CORE_IMAGE_UTILS_H__
 
 #include <vw/Image/ImageViewRef.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Math/Vector.h>
+#include <vw/Image/PixelMask.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
 
 namespace vw {
   namespace cartography {
@@ -41,6 +48,56 @@ void load_image(std::string const& image_file,
                          vw::cartography::GeoReference & dem_georef,
                          vw::ImageViewRef<vw::PixelMask<double>> & interp_dem);
 
+  /// Read into memory the pixels of a DEM in the box of the given ECEF
+  /// points, grown by a quarter of its size plus 100 pixels on each side.
+  /// Also find the georeference of this window. Return false, without
+  /// reading the pixels, if no points project into the DEM or if the window
+  /// would have more than max_pixels pixels. Zero points are ignored.
+  bool read_dem_window(std::string const& dem_file,
+                       std::vector<vw::Vector3> const& xyz_vec,
+                       std::int64_t max_pixels,
+                       // Outputs
+                       vw::ImageView<float> & dem_win,
+                       vw::cartography::GeoReference & win_georef);
+
+  /// Create a DEM ready to use for interpolation from a masked DEM
+  void create_interp_dem(vw::ImageViewRef<vw::PixelMask<float>> const& masked_dem,
+                         vw::ImageViewRef<vw::PixelMask<double>> & interp_dem);
+
+  /// Create a masked DEM, with the DEM window around the given ECEF points
+  /// read into memory. That is much faster than fetching tiles from disk
+  /// when intersecting many rays with the DEM. The georeference is for the
+  /// window. If the window cannot be formed or is too large, read the DEM
+  /// from disk as needed.
+  void create_masked_dem(std::string const& dem_file,
+                         std::vector<vw::Vector3> const& xyz_vec,
+                         vw::cartography::GeoReference & dem_georef,
+                         vw::ImageViewRef<vw::PixelMask<float>> & masked_dem);
+
+  /// Find the range of the valid pixels of an image. The tiles of the
+  /// image are read in parallel. Return false if no pixels are valid.
+  bool valid_pixel_range(vw::ImageViewRef<vw::PixelMask<float>> const& image,
+                         double & min_val, double & max_val);
+
+  /// Find the histogram of the valid pixels of an image, with num_bins
+  /// bins spanning [min_val, max_val]. A value v goes to the bin
+  /// round((num_bins - 1) * (v - min_val) / (max_val - min_val)). The
+  /// partial histograms of the tiles are found in parallel and added up.
+  void tile_histogram(vw::ImageViewRef<vw::PixelMask<float>> const& image,
+                      int num_bins, double min_val, double max_val,
+                      std::vector<std::int64_t> & hist);
+
+  /// Find the Otsu threshold given a histogram as above. Values no
+  /// more than the threshold are in the lower class.
+  double otsu_threshold(std::vector<std::int64_t> const& hist,
+                        double min_val, double max_val);
+
+  /// Read in memory the coarsest GDAL internal overview of the first
+  /// band of an image having at least min_num_pixels pixels. Return
+  /// false if the image has no such overview.
+  bool read_overview(std::string const& image_file, std::int64_t min_num_pixels,
+                     vw::ImageView<float> & overview);
+  
 } // end namespace asp
 
 #endif//__ASP_CORE_IMAGE_UTILS_H__
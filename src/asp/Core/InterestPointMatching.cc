@@ -16,6 +16,7 @@
 // __END_LICENSE__
 
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/ParallelRansac.h>
 
 #include <vw/InterestPoint/InterestPointUtils.h>
 #include <vw/Math/GaussianClustering.h>
@@ -26,12 +27,31 @@
 #include <vw/Image/AlgorithmFunctions.h>
 #include <vw/Core/Stopwatch.h>
 
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
 // Some of the implementation is in InterestPointMatching2.cc
 
 using namespace vw;
 
 namespace asp {
 
+// The same as math::InterestPointErrorMetric for a homography and points
+// with the last coordinate equal to 1, but without temporaries, as this is
+// evaluated for each point and each RANSAC hypothesis.
+struct HomographyErrorMetric {
+  double operator()(Matrix<double> const& H, Vector3 const& p1, Vector3 const& p2) const {
+    double w =  H(2, 0) * p1[0] + H(2, 1) * p1[1] + H(2, 2) * p1[2];
+    double x = (H(0, 0) * p1[0] + H(0, 1) * p1[1] + H(0, 2) * p1[2]) / w;
+    double y = (H(1, 0) * p1[0] + H(1, 1) * p1[1] + H(1, 2) * p1[2]) / w;
+    double dx = p2[0] - x, dy = p2[1] - y, dz = p2[2] - 1.0;
+    return sqrt(dx * dx + dy * dy + dz * dz);
+  }
+};
+
 void check_homography_matrix(Matrix<double>       const& H,
                              std::vector<Vector3> const& left_points,
                              std::vector<Vector3> const& right_points,
@@ -147,13 +167,14 @@ rough_homography_fit(camera::CameraModel* cam1,
   vw_out() << "Estimating rough homography using RANSAC with " 
     << num_iter << " iterations.\n";
   typedef math::HomographyFittingFunctor hfit_func;
-  math::RandomSampleConsensus<hfit_func, math::InterestPointErrorMetric>
-    ransac(hfit_func(), math::InterestPointErrorMetric(),
+  asp::ParallelRansac<hfit_func, HomographyErrorMetric>
+    ransac(hfit_func(), HomographyErrorMetric(),
            num_iter, inlier_th, min_inliers, reduce_num_if_no_fit);
 
   Matrix<double> H = ransac(right_points, left_points);
   std::vector<size_t> indices = ransac.inlier_indices(H, right_points, left_points);
   check_homography_matrix(H, left_points, right_points, indices);
+  vw_out() << "RANSAC hypotheses tried: " << ransac.num_tried() << ".\n";
   vw_out() << "Number of inliers: " << indices.size() << ".\n";
 
   sw.stop();
@@ -199,13 +220,13 @@ Vector2i homography_rectification(bool adjust_left_image_size,
   bool reduce_num_if_no_fit = true;
   
   vw_out() << "\t    Homography rectification inlier threshold: " << inlier_th << "\n";
-  vw_out() << "\t    RANSAC iterations:                         "
+  vw_out() << "\t    Max RANSAC iterations:                     "
            << stereo_settings().ip_num_ransac_iterations << "\n";
   
   // Use RANSAC to determine a good homography transform between the images
-  math::RandomSampleConsensus<math::HomographyFittingFunctor, math::InterestPointErrorMetric>
+  asp::ParallelRansac<math::HomographyFittingFunctor, HomographyErrorMetric>
     ransac(math::HomographyFittingFunctor(),
-            math::InterestPointErrorMetric(),
+            HomographyErrorMetric(),
             stereo_settings().ip_num_ransac_iterations,
             inlier_th, min_inliers, reduce_num_if_no_fit);
   Matrix<double> H;
@@ -220,6 +241,7 @@ Vector2i homography_rectification(bool adjust_left_image_size,
   }
   std::vector<size_t> indices = ransac.inlier_indices(H, right_copy, left_copy);
   vw::vw_out() << "Homography matrix:\n" << H << "\n";
+  vw_out() << "RANSAC hypotheses tried: " << ransac.num_tried() << ".\n";
   vw_out() << "Number of inliers: " << indices.size() << ".\n";
   
   // TODO(oalexan1): A percentile-based filter may help here, after finding
@@ -742,20 +764,21 @@ size_t filter_ip_homog(std::vector<ip::InterestPoint> const& ip1_in,
       ransac_ip2 = iplist_to_vectorlist(ip2_in);
 
     vw_out() << "\t    Homography ip filter inlier threshold: " << inlier_threshold << "\n";
-    vw_out() << "\t    RANSAC iterations:                     "
+    vw_out() << "\t    Max RANSAC iterations:                 "
              << stereo_settings().ip_num_ransac_iterations << "\n";
-    typedef math::RandomSampleConsensus<math::HomographyFittingFunctor,
-      math::InterestPointErrorMetric> RansacT;
+    typedef asp::ParallelRansac<math::HomographyFittingFunctor,
+      HomographyErrorMetric> RansacT;
     int min_inliers = ransac_ip1.size()/2;
     bool reduce_num_if_no_fit = true;
     RansacT ransac(math::HomographyFittingFunctor(),
-                   math::InterestPointErrorMetric(),
+                   HomographyErrorMetric(),
                    stereo_settings().ip_num_ransac_iterations,
                    inlier_threshold,
                    min_inliers, reduce_num_if_no_fit);
     H = ransac(ransac_ip2, ransac_ip1); // 2 then 1 is used here for legacy reasons
     indices = ransac.inlier_indices(H, ransac_ip2, ransac_ip1);
     vw::vw_out() << "Homography matrix:\n" << H << "\n";
+    vw_out() << "RANSAC hypotheses tried: " << ransac.num_tried() << ".\n";
     vw_out() << "Number of inliers: " << indices.size() << ".\n";
   } catch (const math::RANSACErr& e) {
     vw_out() << "RANSAC failed: " << e.what() << "\n";
@@ -974,9 +997,9 @@ vw::Matrix<double> translation_ip_matching(vw::ImageView<vw::PixelGray<float>> c
   std::vector<size_t> indices;
   try {
 
-    vw::math::RandomSampleConsensus<vw::math::TranslationScaleFittingFunctor, vw::math::InterestPointErrorMetric>
+    asp::ParallelRansac<vw::math::TranslationScaleFittingFunctor, HomographyErrorMetric>
       ransac(vw::math::TranslationScaleFittingFunctor(),
-             vw::math::InterestPointErrorMetric(),
+             HomographyErrorMetric(),
              stereo_settings().ip_num_ransac_iterations,
              10, ransac_ip1.size()/2, true);
     T = ransac( ransac_ip2, ransac_ip1 );
@@ -1204,4 +1227,85 @@ void write_match_image(std::string const& out_file_name,
   vw::block_write_image(*rsrc, comp, vw::TerminalProgressCallback("", ""));
 }
 
+size_t ip_per_tile_for_image(vw::BBox2i const& box, int ip_per_tile) {
+
+  // Can be overridden either by --ip-per-image or --ip-per-tile (the latter
+  // takes priority).
+  double tile_size = 1024.0;
+  double number_tiles = (box.width() / tile_size) * (box.height() / tile_size);
+
+  int ip_per_image = 5000; // default
+  if (stereo_settings().ip_per_image > 0) 
+    ip_per_image = stereo_settings().ip_per_image; 
+  
+  size_t points_per_tile = double(ip_per_image) / number_tiles;
+  if (points_per_tile > 5000) points_per_tile = 5000;
+  if (points_per_tile < 50  ) points_per_tile = 50;
+
+  // See if to override with ip per tile
+  if (ip_per_tile != 0)
+    points_per_tile = ip_per_tile;
+
+  return points_per_tile;
+}
+
+const std::string IP_CACHE_EXT = ".cache.vwip";
+
+std::string ip_cache_filename(std::string const& cache_dir,
+                              std::string const& image_file,
+                              vw::Vector2i const& image_size,
+                              double nodata,
+                              vw::Vector<vw::float32,6> const& stats) {
+
+  // Cropped images get new interest points each time
+  if (stereo_settings().left_image_crop_win  != vw::BBox2i(0, 0, 0, 0) ||
+      stereo_settings().right_image_crop_win != vw::BBox2i(0, 0, 0, 0))
+    return "";
+
+  // The OpenCV methods work on normalized images. Unless each image is
+  // normalized by itself, the result depends on the other image.
+  bool normalized = (stereo_settings().ip_matching_method != DETECT_IP_METHOD_INTEGRAL &&
+                     stats[0] != stats[1]);
+  if (normalized && !stereo_settings().individually_normalize)
+    return "";
+
+  boost::system::error_code ec;
+  boost::filesystem::path path = boost::filesystem::absolute(image_file);
+  std::uintmax_t file_size = boost::filesystem::file_size(path, ec);
+  if (ec)
+    return "";
+  std::time_t mtime = boost::filesystem::last_write_time(path, ec);
+  if (ec)
+    return "";
+
+  std::ostringstream os;
+  os.precision(17);
+  os << path.string() << ' ' << file_size << ' ' << mtime << ' ' << image_size << '\n'
+     << stereo_settings().ip_matching_method << ' ' << stereo_settings().num_scales << ' '
+     << ip_per_tile_for_image(vw::BBox2i(0, 0, image_size[0], image_size[1]),
+                              stereo_settings().ip_per_tile) << ' '
+     << nodata << ' ' << stereo_settings().ip_nodata_radius << ' '
+     << stereo_settings().skip_image_normalization << ' '
+     << stereo_settings().ip_normalize_tiles << '\n';
+  if (normalized)
+    os << stats << ' ' << stereo_settings().force_use_entire_range << '\n';
+
+  // A 64-bit FNV-1a hash of the above
+  std::string str = os.str();
+  std::uint64_t hash = 14695981039346656037ULL;
+  for (size_t it = 0; it < str.size(); it++) {
+    hash ^= static_cast<unsigned char>(str[it]);
+    hash *= 1099511628211ULL;
+  }
+
+  std::ostringstream name;
+  name << path.stem().string() << '-' << std::hex << std::setw(16) << std::setfill('0')
+       << hash << IP_CACHE_EXT;
+  return (boost::filesystem::path(cache_dir) / name.str()).string();
+}
+
+bool is_ip_cache_file(std::string const& ip_file) {
+  return boost::algorithm::ends_with(ip_file, IP_CACHE_EXT);
+}
+
 } // end namespace asp
@@ -33,7 +33,10 @@
 #include <vw/Core/Stopwatch.h>
 
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/BandIpDetection.h>
+#include <asp/Core/Tracing.h>
 #include <boost/foreach.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/math/special_functions/fpclassify.hpp>
 
 namespace asp {
@@ -220,6 +223,26 @@ void match_ip_pair(vw::ip::InterestPointList const& ip1,
                        DETECT_IP_METHOD_SIFT     = 1,
                        DETECT_IP_METHOD_ORB      = 2};
 
+/// The number of interest points per tile to detect in an image with the
+/// given bounding box. Use ip_per_tile, if nonzero, or else the value
+/// determined from --ip-per-image.
+size_t ip_per_tile_for_image(vw::BBox2i const& box, int ip_per_tile);
+
+/// The file having the cached interest points of a given image, in the given
+/// directory. Its name has a hash of the image path, size, and modification
+/// time, and of the settings which affect the detection. Return an empty
+/// string if the interest points depend on the other image of the pair,
+/// such as when both images are normalized with the same stats.
+std::string ip_cache_filename(std::string const& cache_dir,
+                              std::string const& image_file,
+                              vw::Vector2i const& image_size,
+                              double nodata,
+                              vw::Vector<vw::float32,6> const& stats);
+
+/// If this file was made by ip_cache_filename(). Such a file is kept
+/// when matches are redone, as it cannot be out of date.
+bool is_ip_cache_file(std::string const& ip_file);
+
 
 /// Detect interest points
 ///
@@ -249,26 +272,12 @@ void detect_ip(vw::ip::InterestPointList& ip,
     return;
   }
   
+  asp::TraceSpan trace_span("detect_ip", "ip");
   vw::Stopwatch sw1;
   sw1.start();
 
-  // Automatically determine how many ip we need. Can be overridden below
-  // either by --ip-per-image or --ip-per-tile (the latter takes priority).
-  double tile_size = 1024.0;
-  vw::BBox2i box = vw::bounding_box(image.impl());
-  double number_tiles = (box.width() / tile_size) * (box.height() / tile_size);
-
-  int ip_per_image = 5000; // default
-  if (stereo_settings().ip_per_image > 0) 
-    ip_per_image = stereo_settings().ip_per_image; 
-  
-  size_t points_per_tile = double(ip_per_image) / number_tiles;
-  if (points_per_tile > 5000) points_per_tile = 5000;
-  if (points_per_tile < 50  ) points_per_tile = 50;
-
-  // See if to override with ip per tile
-  if (ip_per_tile != 0)
-    points_per_tile = ip_per_tile;
+  // Automatically determine how many ip we need, unless set
+  size_t points_per_tile = ip_per_tile_for_image(vw::bounding_box(image.impl()), ip_per_tile);
 
   // Record the current number of ip per tile. Later this can be used
   // for a subsequent attempt, if this one failed.
@@ -301,7 +310,16 @@ void detect_ip(vw::ip::InterestPointList& ip,
     // This detector can't handle a mask so if there is nodata just set those pixels to zero.
 
     vw::vw_out() << "\t    Detecting IP\n";
-    if (!has_nodata)
+    if (stereo_settings().ip_detect_in_bands) {
+      auto make_detector = [points_per_tile, num_scales]() {
+        return vw::ip::IntegralAutoGainDetector(points_per_tile, num_scales);
+      };
+      if (!has_nodata)
+        ip = detect_ip_in_bands(image.impl(), make_detector, points_per_tile);
+      else
+        ip = detect_ip_in_bands(apply_mask(create_mask_less_or_equal(image.impl(),nodata)),
+                                make_detector, points_per_tile);
+    } else if (!has_nodata)
       ip = detect_interest_points(image.impl(), detector, points_per_tile);
     else
       ip = detect_interest_points(apply_mask(create_mask_less_or_equal(image.impl(),nodata)), detector, points_per_tile);
@@ -329,7 +347,18 @@ void detect_ip(vw::ip::InterestPointList& ip,
     // These detectors do accept a mask so use one if applicable.
 
     vw::vw_out() << "\t    Detecting IP\n";
-    if (!has_nodata)
+    if (stereo_settings().ip_detect_in_bands) {
+      auto make_detector = [cv_method, opencv_normalize, build_opencv_descriptors,
+                            points_per_tile]() {
+        return vw::ip::OpenCvInterestPointDetector(cv_method, opencv_normalize,
+                                                   build_opencv_descriptors, points_per_tile);
+      };
+      if (!has_nodata)
+        ip = detect_ip_in_bands(image.impl(), make_detector, points_per_tile);
+      else
+        ip = detect_ip_in_bands(create_mask_less_or_equal(image.impl(),nodata),
+                                make_detector, points_per_tile);
+    } else if (!has_nodata)
       ip = detect_interest_points(image.impl(), detector, points_per_tile);
     else
       ip = detect_interest_points(create_mask_less_or_equal(image.impl(),nodata), detector, points_per_tile);
@@ -363,10 +392,15 @@ void detect_ip(vw::ip::InterestPointList& ip,
 
   vw::vw_out() << "\t    Found interest points: " << ip.size() << std::endl;
 
-  // If a file path was provided, record the IP to disk.
+  // If a file path was provided, record the IP to disk. Write to a uniquely
+  // named file first, as other processes may be reading or writing the same
+  // file, such as with the interest point cache in parallel_bundle_adjust.
   if (file_path != "") {
     vw::vw_out() << "\t    Recording interest points to file: " << file_path << std::endl;
-    vw::ip::write_binary_ip_file(file_path, ip);
+    std::string tmp_file
+      = boost::filesystem::unique_path(file_path + ".%%%%-%%%%.tmp").string();
+    vw::ip::write_binary_ip_file(tmp_file, ip);
+    boost::filesystem::rename(tmp_file, file_path);
   }
 
   return;
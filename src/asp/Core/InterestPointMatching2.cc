@@ -16,6 +16,7 @@
 // __END_LICENSE__
 
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/BruteForceMatching.h>
 #include <vw/Math/GaussianClustering.h>
 #include <vw/Math/RANSAC.h>
 #include <vw/Cartography/CameraBBox.h>
@@ -156,6 +157,9 @@ double EpipolarLinePointMatcher::distance_point_line(Vector3 const& line,
     norm_2(subvector(line, 0, 2));
 }
 
+// The number of nearest descriptors to check against the epipolar line
+const size_t NUM_MATCHES_TO_FIND = 10;
+
 // Local class definition
 class EpipolarLineMatchTask: public Task, private boost::noncopyable {
   typedef ip::InterestPointList::const_iterator IPListIter;
@@ -163,7 +167,11 @@ class EpipolarLineMatchTask: public Task, private boost::noncopyable {
   bool                            m_use_uchar_tree;
   math::FLANNTree<float>        & m_tree_float;
   math::FLANNTree<unsigned char>& m_tree_uchar;
+  // With brute-force matching, the nearest neighbors of all ip, found beforehand
+  std::vector<int>   const&       m_bf_indices;
+  std::vector<float> const&       m_bf_dists;
   IPListIter                      m_start, m_end;
+  size_t                          m_start_index; // index of m_start in the list
   ip::InterestPointList const&    m_ip_other;
   camera::CameraModel            *m_cam1, *m_cam2;
   EpipolarLinePointMatcher const& m_matcher;
@@ -174,8 +182,11 @@ public:
                         bool use_uchar_tree,
                         math::FLANNTree<float>        & tree_float,
                         math::FLANNTree<unsigned char>& tree_uchar,
+                        std::vector<int>   const& bf_indices,
+                        std::vector<float> const& bf_dists,
                         ip::InterestPointList::const_iterator start,
                         ip::InterestPointList::const_iterator end,
+                        size_t start_index,
                         ip::InterestPointList const& ip2,
                         vw::camera::CameraModel* cam1,
                         vw::camera::CameraModel* cam2,
@@ -184,17 +195,18 @@ public:
                         std::vector<size_t>::iterator output):
     m_single_threaded_camera(single_threaded_camera),
     m_use_uchar_tree(use_uchar_tree), m_tree_float(tree_float), m_tree_uchar(tree_uchar),
-    m_start(start), m_end(end), m_ip_other(ip2),
+    m_bf_indices(bf_indices), m_bf_dists(bf_dists),
+    m_start(start), m_end(end), m_start_index(start_index), m_ip_other(ip2),
     m_cam1(cam1), m_cam2(cam2),
     m_matcher( matcher), m_camera_mutex(camera_mutex), m_output(output) {}
 
   void operator()() {
 
-    const size_t NUM_MATCHES_TO_FIND = 10;
     Vector<int> indices(NUM_MATCHES_TO_FIND);
     Vector<double> distances(NUM_MATCHES_TO_FIND);
 
-    for (IPListIter ip = m_start; ip != m_end; ip++) {
+    size_t query_index = m_start_index;
+    for (IPListIter ip = m_start; ip != m_end; ip++, query_index++) {
       Vector2 ip_org_coord = Vector2(ip->x, ip->y);
       Vector3 line_eq;
 
@@ -221,7 +233,16 @@ public:
 
       // Call the correct FLANN tree for the matching type
       size_t num_matches_valid = 0;
-      if (m_use_uchar_tree) {
+      if (!m_bf_indices.empty()) {
+        for (size_t i = 0; i < NUM_MATCHES_TO_FIND; i++) {
+          int index = m_bf_indices[query_index * NUM_MATCHES_TO_FIND + i];
+          if (index < 0)
+            break;
+          indices[i]   = index;
+          distances[i] = m_bf_dists[query_index * NUM_MATCHES_TO_FIND + i];
+          num_matches_valid++;
+        }
+      } else if (m_use_uchar_tree) {
         vw::Vector<unsigned char> uchar_descriptor(ip->descriptor.size());
         for (size_t i=0; i<ip->descriptor.size(); i++)
           uchar_descriptor[i] = static_cast<unsigned char>(ip->descriptor[i]);
@@ -312,18 +333,28 @@ void EpipolarLinePointMatcher::operator()(ip::InterestPointList const& ip1,
   Matrix<float>         ip2_matrix_float;
   Matrix<unsigned char> ip2_matrix_uchar;
 
-  // Pack the IP descriptors into a matrix and feed it to the chosen FLANNTree object
+  // With brute-force matching, find the nearest neighbors of all points at
+  // once, and the tasks below only look them up.
   const bool use_uchar_FLANN = (ip_detect_method == DETECT_IP_METHOD_ORB);
-  if (use_uchar_FLANN) {
-    ip_list_to_matrix(ip2, ip2_matrix_uchar);
-    kd_uchar.load_match_data(ip2_matrix_uchar, vw::math::FLANN_DistType_Hamming);
-  }else {
-    ip_list_to_matrix(ip2, ip2_matrix_float);
-    kd_float.load_match_data(ip2_matrix_float,  vw::math::FLANN_DistType_L2);
+  std::vector<int> bf_indices;
+  std::vector<float> bf_dists;
+  if (asp::stereo_settings().ip_brute_force_matching) {
+    std::vector<ip::InterestPoint> ip1_vec(ip1.begin(), ip1.end());
+    std::vector<ip::InterestPoint> ip2_vec(ip2.begin(), ip2.end());
+    brute_force_knn(ip1_vec, ip2_vec, use_uchar_FLANN, NUM_MATCHES_TO_FIND,
+                    number_of_jobs, bf_indices, bf_dists);
+  } else {
+    // Pack the IP descriptors into a matrix and feed it to the chosen FLANNTree object
+    if (use_uchar_FLANN) {
+      ip_list_to_matrix(ip2, ip2_matrix_uchar);
+      kd_uchar.load_match_data(ip2_matrix_uchar, vw::math::FLANN_DistType_Hamming);
+    }else {
+      ip_list_to_matrix(ip2, ip2_matrix_float);
+      kd_float.load_match_data(ip2_matrix_float,  vw::math::FLANN_DistType_L2);
+    }
+    vw_out(InfoMessage,"interest_point") << "FLANN-Tree created. Searching...\n";
   }
 
-  vw_out(InfoMessage,"interest_point") << "FLANN-Tree created. Searching...\n";
-
   FifoWorkQueue matching_queue; // Create a thread pool object
   Mutex camera_mutex;
 
@@ -335,6 +366,7 @@ void EpipolarLinePointMatcher::operator()(ip::InterestPointList const& ip1,
   IPListIter start_it = ip1.begin();
   std::vector<size_t>::iterator output_it = output_indices.begin();
 
+  size_t start_index = 0;
   for (size_t i = 0; i < number_of_jobs - 1; i++) {
     // Update iterators and launch the job.
     IPListIter end_it = start_it;
@@ -342,11 +374,13 @@ void EpipolarLinePointMatcher::operator()(ip::InterestPointList const& ip1,
     boost::shared_ptr<Task>
       match_task(new EpipolarLineMatchTask(m_single_threaded_camera,
                                            use_uchar_FLANN, kd_float, kd_uchar,
-                                           start_it, end_it,
+                                           bf_indices, bf_dists,
+                                           start_it, end_it, start_index,
                                            ip2, cam1, cam2, *this,
                                            camera_mutex, output_it));
     matching_queue.add_task( match_task );
     start_it = end_it;
+    start_index += ip1_size / number_of_jobs;
     std::advance(output_it, ip1_size / number_of_jobs);
   }
   // Launch the last job.
@@ -354,7 +388,8 @@ void EpipolarLinePointMatcher::operator()(ip::InterestPointList const& ip1,
   boost::shared_ptr<Task>
     match_task(new EpipolarLineMatchTask(m_single_threaded_camera,
                                          use_uchar_FLANN, kd_float, kd_uchar,
-                                         start_it, ip1.end(),
+                                         bf_indices, bf_dists,
+                                         start_it, ip1.end(), start_index,
                                          ip2, cam1, cam2, *this,
                                          camera_mutex, output_it));
   matching_queue.add_task(match_task);
@@ -576,11 +611,22 @@ void pick_subset(int max_pairwise_matches,
 void match_ip_no_datum(std::vector<vw::ip::InterestPoint> const& ip1_copy,
                        std::vector<vw::ip::InterestPoint> const& ip2_copy,
                        DetectIpMethod detect_method, double uniqueness_threshold, 
-                       bool quiet,
+                       bool quiet, size_t number_of_jobs,
                        // Outputs
                        std::vector<vw::ip::InterestPoint>& matched_ip1,
                        std::vector<vw::ip::InterestPoint>& matched_ip2) {
 
+  if (asp::stereo_settings().ip_brute_force_matching) {
+    // Exact matching, keeping only mutual nearest neighbors
+    brute_force_ip_matching(ip1_copy, ip2_copy, detect_method == DETECT_IP_METHOD_ORB,
+                            uniqueness_threshold, number_of_jobs,
+                            matched_ip1, matched_ip2);
+    if (!quiet)
+      vw_out() << "	    Brute-force matching found " << matched_ip1.size()
+               << " matches.\n";
+    return;
+  }
+
   // TODO: Should probably unify the ip::InterestPointMatcher class
   // with the EpipolarLinePointMatcher class!
   if (detect_method != DETECT_IP_METHOD_ORB) {
@@ -708,8 +754,9 @@ public:
           }
         
         } else {
+          int local_number_of_jobs = 1;
           match_ip_no_datum(tile_ip1, tile_ip2, m_detect_method, m_uniqueness_threshold, 
-            quiet, local_matched_ip1, local_matched_ip2); // outputs
+            quiet, local_number_of_jobs, local_matched_ip1, local_matched_ip2); // outputs
         }
       } catch(...) {
         // This need not succeed
@@ -1095,7 +1142,7 @@ void match_ip_pair(vw::ip::InterestPointList const& ip1,
   vw::Stopwatch sw1;
   sw1.start();
   match_ip_no_datum(ip1_copy, ip2_copy, detect_method, uniqueness_threshold, quiet,
-    matched_ip1, matched_ip2); // outputs
+    number_of_jobs, matched_ip1, matched_ip2); // outputs
   sw1.stop();
   vw_out() << "Elapsed time in ip matching: " << sw1.elapsed_seconds() << " s.\n";
 
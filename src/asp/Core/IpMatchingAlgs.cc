@@ -18,7 +18,6 @@
 #include <asp/Core/IpMatchingAlgs.h>         // Lightweight header
 #include <vw/InterestPoint/InterestData.h>
 #include <vw/InterestPoint/Matcher.h>
-#include <vw/Camera/CameraModel.h>
 #include <vw/BundleAdjustment/ControlNetwork.h>
 #include <boost/filesystem.hpp>
 using namespace vw;
@@ -180,36 +179,6 @@ std::string unwarped_disp_file(std::string const& prefix, std::string const& lef
   return disp_file + "-unaligned-D.tif";
 }
   
-// Find and sort the convergence angles for given cameras and interest points
-void convergence_angles(vw::camera::CameraModel const * left_cam,
-                        vw::camera::CameraModel const * right_cam,
-                        std::vector<vw::ip::InterestPoint> const& left_ip,
-                        std::vector<vw::ip::InterestPoint> const& right_ip,
-                        std::vector<double> & sorted_angles) {
-
-  int num_ip = left_ip.size();
-  sorted_angles.clear();
-  for (int ip_it = 0; ip_it < num_ip; ip_it++) {
-    Vector2 lip(left_ip[ip_it].x,  left_ip[ip_it].y);
-    Vector2 rip(right_ip[ip_it].x, right_ip[ip_it].y);
-    double angle = 0.0;
-    try {
-      angle = (180.0 / M_PI) * acos(dot_prod(left_cam->pixel_to_vector(lip),
-                                             right_cam->pixel_to_vector(rip)));
-    } catch(...) {
-      // Projection into camera may not always succeed
-      continue;
-    }
-      
-    if (std::isnan(angle)) 
-      continue;
-      
-    sorted_angles.push_back(angle);
-  }
-  
-  std::sort(sorted_angles.begin(), sorted_angles.end());
-}
-
 // Find all match files stored on disk having this prefix. This is much faster
 // than trying to see if any combination of images results in a match file.
 void listExistingMatchFiles(std::string const& prefix,
@@ -30,6 +30,8 @@
 #include <asp/Core/IpMatchingAlgs.h>         // Lightweight header
 #include <asp/Core/OpenCVUtils.h>
 #include <asp/Core/DisparityProcessing.h>
+#include <asp/Core/FileUtils.h>
+#include <asp/Core/LocalIpIndex.h>
 
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/imgcodecs.hpp>
@@ -333,6 +335,109 @@ namespace asp {
     
   }
 
+  // The number of interest points per 1024^2 pixels to detect for a tile
+  // of the given size. The full images use the same density when the
+  // interest point index is built, so each tile gets as many points from
+  // the index as it would get by detecting them itself.
+  int local_ip_per_tile(int max_tile_size) {
+    return ip_per_tile_for_image(BBox2i(0, 0, max_tile_size, max_tile_size),
+                                 stereo_settings().ip_per_tile);
+  }
+
+  void build_local_ip_index(ASPGlobalOptions const& opt) {
+
+    int ip_per_tile = local_ip_per_tile(stereo_settings().corr_tile_size_ovr);
+    int ip_method = stereo_settings().ip_matching_method;
+
+    // detect_ip() records the density it used, so it must be restored
+    int orig_ip_per_tile = stereo_settings().ip_per_tile;
+
+    std::vector<std::string> image_files;
+    image_files.push_back(opt.out_prefix + "-L.tif");
+    image_files.push_back(opt.out_prefix + "-R.tif");
+    for (size_t it = 0; it < image_files.size(); it++) {
+
+      std::string index_file = localIpIndexName(image_files[it]);
+      if (is_latest_timestamp(index_file, image_files[it])) {
+        try {
+          LocalIpIndex index(index_file);
+          if (index.ip_per_tile() == ip_per_tile && index.ip_method() == ip_method) {
+            vw_out() << "Using cached interest point index: " << index_file << "\n";
+            continue;
+          }
+        } catch (std::exception const& e) {
+          vw_out() << e.what(); // will be rebuilt
+        }
+      }
+
+      boost::shared_ptr<DiskImageResource>
+        rsrc(vw::DiskImageResourcePtr(image_files[it]));
+      float nodata_value = std::numeric_limits<float>::quiet_NaN();
+      if (rsrc->has_nodata_read())
+        nodata_value = rsrc->nodata_read();
+      DiskImageView<PixelGray<float>> image(rsrc);
+
+      vw_out() << "Detecting interest points for local alignment in: "
+               << image_files[it] << "\n";
+      vw::ip::InterestPointList ip;
+      detect_ip(ip, image, ip_per_tile, "", nodata_value);
+      stereo_settings().ip_per_tile = orig_ip_per_tile;
+
+      vw_out() << "Writing: " << index_file << "\n";
+      writeLocalIpIndex(index_file, Vector2i(image.cols(), image.rows()),
+                        ip_per_tile, ip_method, ip);
+    }
+  }
+
+  // Read the interest points in the left and right crop windows from the
+  // indices made by build_local_ip_index() and match them. Return false if
+  // the indices are missing, out of date, or made with other settings. Then
+  // the interest points must be detected in the crops instead.
+  bool match_local_ip_from_index(ASPGlobalOptions const& opt,
+                                 int max_tile_size, size_t number_of_jobs,
+                                 ImageViewRef<float> left_crop,
+                                 ImageViewRef<float> right_crop,
+                                 BBox2i const& left_trans_crop_win,
+                                 BBox2i const& right_trans_crop_win,
+                                 // Outputs
+                                 std::vector<vw::ip::InterestPoint> & left_local_ip,
+                                 std::vector<vw::ip::InterestPoint> & right_local_ip) {
+
+    std::string left_file  = opt.out_prefix + "-L.tif";
+    std::string right_file = opt.out_prefix + "-R.tif";
+    std::string left_index_file  = localIpIndexName(left_file);
+    std::string right_index_file = localIpIndexName(right_file);
+    if (!is_latest_timestamp(left_index_file, left_file) ||
+        !is_latest_timestamp(right_index_file, right_file))
+      return false;
+
+    int ip_per_tile = local_ip_per_tile(max_tile_size);
+    int ip_method = stereo_settings().ip_matching_method;
+    vw::ip::InterestPointList ip1, ip2;
+    try {
+      LocalIpIndex left_index(left_index_file), right_index(right_index_file);
+      if (left_index.ip_per_tile()  != ip_per_tile || left_index.ip_method()  != ip_method ||
+          right_index.ip_per_tile() != ip_per_tile || right_index.ip_method() != ip_method)
+        return false;
+      left_index.read(left_trans_crop_win, ip1);
+      right_index.read(right_trans_crop_win, ip2);
+    } catch (std::exception const& e) {
+      vw_out() << e.what();
+      return false;
+    }
+
+    vw_out() << "\t--> Read interest points from: " << left_index_file << ' '
+             << right_index_file << "\n";
+    vw_out() << "\t    Found interest points: " << ip1.size() << ' ' << ip2.size() << "\n";
+    side_ip_filtering(ip1, ip2, bounding_box(left_crop), bounding_box(right_crop));
+    match_ip_pair(ip1, ip2, left_crop, right_crop, number_of_jobs,
+                  left_local_ip, right_local_ip, // outputs
+                  "" // do not save any match file to disk
+                  );
+
+    return true;
+  }
+
   // Algorithm to perform local alignment. Approach:
   //  - Given the global interest points and the left crop window, find
   //    the right crop window.
@@ -432,17 +537,24 @@ namespace asp {
     // But do not introduced hard-coded values.
     
     // Redo ip matching in the current tile. It should be more accurate after alignment
-    // and cropping.
+    // and cropping. Use the interest points detected in stereo_pprc, if available.
     std::vector<vw::ip::InterestPoint> left_local_ip, right_local_ip;
     size_t number_of_jobs = 1;
-    detect_match_ip(left_local_ip, right_local_ip,
-                    crop(left_globally_aligned_image, left_trans_crop_win),
-                    crop(right_globally_aligned_image, right_trans_crop_win), 
-                    stereo_settings().ip_per_tile, number_of_jobs,
-                    "", "", // do not save any results to disk  
-                    left_nodata_value, right_nodata_value,
-                    "" // do not save any match file to disk
-                    );
+    if (!match_local_ip_from_index(opt, max_tile_size, number_of_jobs,
+                                   pixel_cast<float>(crop(left_globally_aligned_image,
+                                                          left_trans_crop_win)),
+                                   pixel_cast<float>(crop(right_globally_aligned_image,
+                                                          right_trans_crop_win)),
+                                   left_trans_crop_win, right_trans_crop_win,
+                                   left_local_ip, right_local_ip))
+      detect_match_ip(left_local_ip, right_local_ip,
+                      crop(left_globally_aligned_image, left_trans_crop_win),
+                      crop(right_globally_aligned_image, right_trans_crop_win), 
+                      stereo_settings().ip_per_tile, number_of_jobs,
+                      "", "", // do not save any results to disk  
+                      left_nodata_value, right_nodata_value,
+                      "" // do not save any match file to disk
+                      );
 
     if (stereo_settings().local_alignment_debug) {
       // These clips have global but not local alignment
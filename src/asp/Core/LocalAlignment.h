@@ -72,6 +72,12 @@ namespace asp {
                        std::string        & right_aligned_file,
                        int                & min_disp,
                        int                & max_disp); 
+
+  // With local_epipolar alignment, detect the interest points once in each
+  // full globally aligned image, at the density used for a tile, and save
+  // them in a spatial index. Then local_alignment() reads from it the
+  // interest points of each tile, rather than detecting them again.
+  void build_local_ip_index(ASPGlobalOptions const& opt);
   
   // Go from 1D disparity of images with affine epipolar alignment to the 2D
   // disparity by undoing the transforms that applied this alignment.
@@ -0,0 +1,201 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file LocalIpIndex.cc
+///
+
+#include <asp/Core/LocalIpIndex.h>
+#include <asp/Core/MatchDatabase.h>
+
+#include <vw/Core/Exception.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+namespace asp {
+
+  const char LOCAL_IP_INDEX_MAGIC[9] = "ASPLIX01";
+
+  // Small enough that a tile reads few points outside of it
+  const int LOCAL_IP_INDEX_CELL_SIZE = 256;
+
+  std::string localIpIndexName(std::string const& image_file) {
+    fs::path path(image_file);
+    return (path.parent_path() / (path.stem().string() + "-ip-index.db")).string();
+  }
+
+  // The cell having the given point, clamped to the grid
+  std::int32_t localIpCell(float val, std::int32_t cell_size, std::int32_t num_cells) {
+    std::int32_t cell = static_cast<std::int32_t>(std::floor(val / cell_size));
+    return std::max(0, std::min(cell, num_cells - 1));
+  }
+
+  void writeLocalIpIndex(std::string const& index_file,
+                         vw::Vector2i const& image_size,
+                         int ip_per_tile, int ip_method,
+                         vw::ip::InterestPointList const& ip) {
+
+    LocalIpIndexHeader header;
+    header.cols        = image_size[0];
+    header.rows        = image_size[1];
+    header.cell_size   = LOCAL_IP_INDEX_CELL_SIZE;
+    header.ip_per_tile = ip_per_tile;
+    header.ip_method   = ip_method;
+    header.desc_len    = ip.empty() ? 0 : ip.begin()->descriptor.size();
+    header.num_ip      = ip.size();
+
+    std::int32_t num_cols = std::max(1, (header.cols + header.cell_size - 1) / header.cell_size);
+    std::int32_t num_rows = std::max(1, (header.rows + header.cell_size - 1) / header.cell_size);
+    std::int64_t num_cells = std::int64_t(num_cols) * num_rows;
+
+    // Sort the points by cell, keeping their order within each cell
+    std::vector<vw::ip::InterestPoint const*> points;
+    std::vector<std::int64_t> cells;
+    std::vector<std::uint64_t> offsets(num_cells + 1, 0);
+    for (auto it = ip.begin(); it != ip.end(); it++) {
+      if (it->descriptor.size() != header.desc_len)
+        vw::vw_throw(vw::ArgumentErr() << "Interest points with different "
+                     << "descriptor sizes cannot be indexed.\n");
+      std::int64_t cell = std::int64_t(localIpCell(it->y, header.cell_size, num_rows)) * num_cols
+        + localIpCell(it->x, header.cell_size, num_cols);
+      points.push_back(&*it);
+      cells.push_back(cell);
+      offsets[cell + 1]++;
+    }
+    for (std::int64_t cell = 0; cell < num_cells; cell++)
+      offsets[cell + 1] += offsets[cell];
+    std::vector<std::uint64_t> pos(offsets.begin(), offsets.end() - 1);
+    std::vector<vw::ip::InterestPoint const*> sorted(points.size());
+    for (size_t k = 0; k < points.size(); k++)
+      sorted[pos[cells[k]]++] = points[k];
+
+    std::string tmp_file = fs::unique_path(index_file + ".%%%%-%%%%.tmp").string();
+    std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+    if (!ofs.good())
+      vw::vw_throw(vw::IOErr() << "Cannot write: " << tmp_file << "\n");
+    ofs.write(LOCAL_IP_INDEX_MAGIC, 8);
+    ofs.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<char const*>(&offsets[0]),
+              offsets.size() * sizeof(std::uint64_t));
+    for (size_t k = 0; k < sorted.size(); k++) {
+      vw::ip::InterestPoint const& p = *sorted[k];
+      MatchDbPoint P;
+      P.x           = p.x;
+      P.y           = p.y;
+      P.orientation = p.orientation;
+      P.scale       = p.scale;
+      P.interest    = p.interest;
+      P.ix          = p.ix;
+      P.iy          = p.iy;
+      P.octave      = p.octave;
+      P.scale_lvl   = p.scale_lvl;
+      P.polarity    = p.polarity;
+      ofs.write(reinterpret_cast<char const*>(&P), sizeof(P));
+    }
+    for (size_t k = 0; k < sorted.size(); k++) {
+      for (size_t d = 0; d < header.desc_len; d++) {
+        float val = sorted[k]->descriptor[d];
+        ofs.write(reinterpret_cast<char const*>(&val), sizeof(val));
+      }
+    }
+    ofs.close();
+    if (!ofs)
+      vw::vw_throw(vw::IOErr() << "Failed writing: " << tmp_file << "\n");
+
+    fs::rename(tmp_file, index_file);
+  }
+
+  LocalIpIndex::LocalIpIndex(std::string const& index_file) {
+
+    m_file.open(index_file);
+    if (!m_file.is_open() || m_file.size() < 8 + sizeof(LocalIpIndexHeader) ||
+        std::memcmp(m_file.data(), LOCAL_IP_INDEX_MAGIC, 8) != 0)
+      vw::vw_throw(vw::IOErr() << "Invalid interest point index: " << index_file << "\n");
+
+    std::memcpy(&m_header, m_file.data() + 8, sizeof(m_header));
+    if (m_header.cell_size <= 0)
+      vw::vw_throw(vw::IOErr() << "Invalid interest point index: " << index_file << "\n");
+    m_num_cols = std::max(1, (m_header.cols + m_header.cell_size - 1) / m_header.cell_size);
+    m_num_rows = std::max(1, (m_header.rows + m_header.cell_size - 1) / m_header.cell_size);
+
+    std::uint64_t num_cells = std::uint64_t(m_num_cols) * m_num_rows;
+    std::uint64_t len = 8 + sizeof(LocalIpIndexHeader)
+      + (num_cells + 1) * sizeof(std::uint64_t)
+      + m_header.num_ip * sizeof(MatchDbPoint)
+      + m_header.num_ip * m_header.desc_len * sizeof(float);
+    if (m_file.size() != len)
+      vw::vw_throw(vw::IOErr() << "Truncated interest point index: " << index_file << "\n");
+  }
+
+  void LocalIpIndex::read(vw::BBox2i const& box, vw::ip::InterestPointList & ip) const {
+
+    ip.clear();
+    if (box.empty())
+      return;
+
+    char const* offsets = m_file.data() + 8 + sizeof(LocalIpIndexHeader);
+    std::uint64_t num_cells = std::uint64_t(m_num_cols) * m_num_rows;
+    char const* points = offsets + (num_cells + 1) * sizeof(std::uint64_t);
+    char const* desc = points + m_header.num_ip * sizeof(MatchDbPoint);
+
+    std::int32_t cell_size = m_header.cell_size;
+    std::int32_t col_beg = localIpCell(box.min().x(), cell_size, m_num_cols);
+    std::int32_t col_end = localIpCell(box.max().x(), cell_size, m_num_cols);
+    std::int32_t row_beg = localIpCell(box.min().y(), cell_size, m_num_rows);
+    std::int32_t row_end = localIpCell(box.max().y(), cell_size, m_num_rows);
+
+    for (std::int32_t row = row_beg; row <= row_end; row++) {
+      // The cells in a row are contiguous, so read their range at once
+      std::uint64_t beg = 0, end = 0;
+      std::uint64_t cell = std::uint64_t(row) * m_num_cols;
+      std::memcpy(&beg, offsets + (cell + col_beg) * sizeof(std::uint64_t), sizeof(beg));
+      std::memcpy(&end, offsets + (cell + col_end + 1) * sizeof(std::uint64_t), sizeof(end));
+
+      for (std::uint64_t k = beg; k < end; k++) {
+        MatchDbPoint P;
+        std::memcpy(&P, points + k * sizeof(MatchDbPoint), sizeof(P));
+        if (!box.contains(vw::Vector2(P.x, P.y)))
+          continue;
+
+        vw::ip::InterestPoint p;
+        p.x           = P.x - box.min().x();
+        p.y           = P.y - box.min().y();
+        p.ix          = P.ix - box.min().x();
+        p.iy          = P.iy - box.min().y();
+        p.orientation = P.orientation;
+        p.scale       = P.scale;
+        p.interest    = P.interest;
+        p.polarity    = (P.polarity != 0);
+        p.octave      = P.octave;
+        p.scale_lvl   = P.scale_lvl;
+        p.descriptor.set_size(m_header.desc_len);
+        if (m_header.desc_len > 0)
+          std::memcpy(&p.descriptor[0], desc + k * m_header.desc_len * sizeof(float),
+                      m_header.desc_len * sizeof(float));
+        ip.push_back(p);
+      }
+    }
+  }
+
+} // end namespace asp
@@ -0,0 +1,89 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file LocalIpIndex.h
+///
+
+// A spatial index of the interest points of an aligned image, such as
+// run-L.tif. With local_epipolar alignment, the interest points are
+// detected once for each full image in stereo_pprc and saved in a file
+// named run-L-ip-index.db. Then each stereo_corr tile reads only the points
+// in its region, rather than detecting them again. The points are sorted
+// into a grid of square cells and the file is mapped into memory, so only
+// the cells overlapping a region are touched.
+
+#ifndef __ASP_CORE_LOCAL_IP_INDEX_H__
+#define __ASP_CORE_LOCAL_IP_INDEX_H__
+
+#include <vw/Math/BBox.h>
+#include <vw/InterestPoint/InterestData.h>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace asp {
+
+  // The file starts with the 8-byte magic "ASPLIX01" and this header. Then
+  // come num_cells + 1 offsets, as uint64, with the points of cell k having
+  // the indices from offsets[k] to offsets[k + 1]. The cells are stored
+  // row after row. Then come the points, as MatchDbPoint, and then the
+  // descriptors as floats, if any. All values are little-endian.
+  struct LocalIpIndexHeader {
+    std::int32_t  cols, rows;   // image size
+    std::int32_t  cell_size;    // side of each grid cell, in pixels
+    std::int32_t  ip_per_tile;  // the detection density
+    std::int32_t  ip_method;    // the detection method
+    std::uint32_t desc_len;     // number of descriptor values per point
+    std::uint64_t num_ip;
+  };
+
+  /// The index file for an image, such as run-L-ip-index.db for run-L.tif.
+  std::string localIpIndexName(std::string const& image_file);
+
+  /// Sort the interest points of an image into cells and write the index.
+  /// The file is written under a unique name first and then renamed, so
+  /// that it is never seen partially written.
+  void writeLocalIpIndex(std::string const& index_file,
+                         vw::Vector2i const& image_size,
+                         int ip_per_tile, int ip_method,
+                         vw::ip::InterestPointList const& ip);
+
+  /// An index of interest points, mapped into memory
+  class LocalIpIndex {
+    boost::iostreams::mapped_file_source m_file;
+    LocalIpIndexHeader m_header;
+    std::int32_t m_num_cols, m_num_rows; // grid size, in cells
+
+  public:
+    LocalIpIndex(std::string const& index_file);
+
+    vw::Vector2i image_size() const {
+      return vw::Vector2i(m_header.cols, m_header.rows);
+    }
+    int ip_per_tile() const { return m_header.ip_per_tile; }
+    int ip_method() const { return m_header.ip_method; }
+
+    /// Read the interest points within the given box. Their coordinates are
+    /// made relative to the box corner, as if detected in the cropped image.
+    void read(vw::BBox2i const& box, vw::ip::InterestPointList & ip) const;
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_LOCAL_IP_INDEX_H__
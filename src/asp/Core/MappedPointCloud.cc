@@ -0,0 +1,283 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file MappedPointCloud.cc
+///
+
+#include <asp/Core/MappedPointCloud.h>
+#include <asp/Core/Common.h>
+
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/Log.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/FileIO/DiskImageResourceGDAL.h>
+#include <vw/FileIO/DiskImageUtils.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace fs = boost::filesystem;
+
+namespace asp {
+
+  const char MAPPED_CLOUD_MAGIC[9] = "ASPPCM01";
+
+  std::string mapped_point_cloud_name(std::string const& pc_file) {
+    return fs::path(pc_file).replace_extension(".pcm").string();
+  }
+
+  // Copy one chunk of the cloud to its place in the mapped file, and
+  // find the box of its valid points.
+  template<int m>
+  class MappedChunkTask: public vw::Task, private boost::noncopyable {
+    vw::ImageViewRef<vw::Vector<float, m>> m_img;
+    vw::Vector3        m_shift;
+    MappedCloudChunk & m_chunk;
+    char             * m_data;
+    vw::Mutex        & m_mutex;
+    vw::ProgressCallback const& m_progress;
+    double             m_inc_amt;
+
+  public:
+    MappedChunkTask(vw::ImageViewRef<vw::Vector<float, m>> img, vw::Vector3 const& shift,
+                    MappedCloudChunk & chunk, char * data, vw::Mutex & mutex,
+                    vw::ProgressCallback const& progress, double inc_amt):
+      m_img(img), m_shift(shift), m_chunk(chunk), m_data(data), m_mutex(mutex),
+      m_progress(progress), m_inc_amt(inc_amt) {}
+
+    void operator()() {
+      vw::BBox2i box(m_chunk.col, m_chunk.row, m_chunk.width, m_chunk.height);
+      vw::ImageView<vw::Vector<float, m>> buf = crop(m_img, box);
+
+      vw::BBox3 pts_box;
+      float * out = reinterpret_cast<float*>(m_data + m_chunk.offset);
+      for (int row = 0; row < buf.rows(); row++) {
+        for (int col = 0; col < buf.cols(); col++) {
+          vw::Vector<float, m> const& v = buf(col, row);
+          for (int k = 0; k < m; k++)
+            out[k] = v[k];
+          out += m;
+
+          // Same validity check as in SubtractShift
+          int len = std::min(3, m);
+          vw::Vector3 pt;
+          bool is_zero = true;
+          for (int k = 0; k < len; k++) {
+            pt[k] = double(v[k]) + m_shift[k];
+            if (v[k] != 0)
+              is_zero = false;
+          }
+          if (!is_zero)
+            pts_box.grow(pt);
+        }
+      }
+
+      if (pts_box.empty()) {
+        for (int k = 0; k < 3; k++) {
+          m_chunk.min[k] = std::numeric_limits<double>::max();
+          m_chunk.max[k] = -std::numeric_limits<double>::max();
+        }
+      } else {
+        for (int k = 0; k < 3; k++) {
+          m_chunk.min[k] = pts_box.min()[k];
+          m_chunk.max[k] = pts_box.max()[k];
+        }
+      }
+
+      vw::Mutex::Lock lock(m_mutex);
+      m_progress.report_incremental_progress(m_inc_amt);
+    }
+  };
+
+  template<int m>
+  void write_mapped_chunks(std::string const& pc_file, std::string const& out_file,
+                           vw::Vector3 const& shift, int chunk_size,
+                           vw::ProgressCallback const& progress) {
+
+    // The payload is the floats stored in the file, before the shift is added back
+    vw::ImageViewRef<vw::Vector<float, m>> img = vw::read_channels<m, float>(pc_file, 0);
+
+    MappedCloudHeader header;
+    std::memcpy(header.magic, MAPPED_CLOUD_MAGIC, sizeof(header.magic));
+    header.cols       = img.cols();
+    header.rows       = img.rows();
+    header.channels   = m;
+    header.chunk_size = chunk_size;
+    for (int k = 0; k < 3; k++)
+      header.shift[k] = shift[k];
+
+    // The chunks, in row-major order 
+    std::vector<MappedCloudChunk> chunks;
+    std::int64_t offset = sizeof(MappedCloudHeader);
+    for (int row = 0; row < img.rows(); row += chunk_size) {
+      for (int col = 0; col < img.cols(); col += chunk_size) {
+        MappedCloudChunk c;
+        c.col    = col;
+        c.row    = row;
+        c.width  = std::min(chunk_size, img.cols() - col);
+        c.height = std::min(chunk_size, img.rows() - row);
+        chunks.push_back(c);
+      }
+    }
+    header.num_chunks = chunks.size();
+    offset += chunks.size() * sizeof(MappedCloudChunk);
+    for (size_t it = 0; it < chunks.size(); it++) {
+      chunks[it].offset = offset;
+      offset += std::int64_t(chunks[it].width) * chunks[it].height * m * sizeof(float);
+    }
+
+    // Write to a temporary file first, so that a partially written file
+    // is never mistaken for a valid one.
+    std::string tmp_file = out_file + ".tmp";
+    {
+      boost::iostreams::mapped_file_params params;
+      params.path          = tmp_file;
+      params.new_file_size = offset;
+      boost::iostreams::mapped_file_sink sink(params);
+      char * data = sink.data();
+
+      vw::FifoWorkQueue queue(vw::vw_settings().default_num_threads());
+      vw::Mutex mutex;
+      double inc_amt = 1.0 / std::max(double(chunks.size()), 1.0);
+      for (size_t it = 0; it < chunks.size(); it++) {
+        boost::shared_ptr<MappedChunkTask<m>>
+          task(new MappedChunkTask<m>(img, shift, chunks[it], data, mutex, progress,
+                                      inc_amt));
+        queue.add_task(task);
+      }
+      queue.join_all();
+      progress.report_finished();
+
+      std::memcpy(data, &header, sizeof(header));
+      std::memcpy(data + sizeof(header), &chunks[0], chunks.size() * sizeof(MappedCloudChunk));
+      sink.close();
+    }
+
+    fs::rename(tmp_file, out_file);
+  }
+
+  bool write_mapped_point_cloud(std::string const& pc_file, int chunk_size,
+                                vw::ProgressCallback const& progress) {
+
+    vw::Vector3 shift;
+    int num_channels = 0;
+    {
+      vw::DiskImageResourceGDAL rsrc(pc_file);
+      num_channels = rsrc.channels();
+      std::string shift_str;
+      if (vw::cartography::read_header_string(rsrc, asp::ASP_POINT_OFFSET_TAG_STR,
+                                              shift_str))
+        shift = vw::str_to_vec<vw::Vector3>(shift_str);
+    }
+
+    // Only clouds stored as shifted floats can be copied without loss
+    if (shift == vw::Vector3()) {
+      vw::vw_out() << "The point cloud " << pc_file << " is not stored as shifted "
+                   << "floats. Will not write a mapped copy of it.\n";
+      return false;
+    }
+
+    std::string out_file = mapped_point_cloud_name(pc_file);
+    vw::vw_out() << "Writing: " << out_file << "\n";
+    if (num_channels == 3)
+      write_mapped_chunks<3>(pc_file, out_file, shift, chunk_size, progress);
+    else if (num_channels == 4)
+      write_mapped_chunks<4>(pc_file, out_file, shift, chunk_size, progress);
+    else if (num_channels == 6)
+      write_mapped_chunks<6>(pc_file, out_file, shift, chunk_size, progress);
+    else
+      vw::vw_throw(vw::ArgumentErr() << "Expecting a point cloud with 3, 4, or 6 "
+                   << "channels. Got: " << num_channels << ".\n");
+
+    return true;
+  }
+
+  bool have_mapped_point_cloud(std::string const& pc_file, int cols, int rows,
+                               int channels) {
+
+    std::string mapped_file = mapped_point_cloud_name(pc_file);
+    if (!fs::exists(mapped_file) || !fs::exists(pc_file) ||
+        fs::last_write_time(mapped_file) < fs::last_write_time(pc_file))
+      return false;
+
+    // Only the header is needed
+    MappedCloudHeader header;
+    std::ifstream ifs(mapped_file.c_str(), std::ios::binary);
+    if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)))
+      return false;
+
+    return (std::memcmp(header.magic, MAPPED_CLOUD_MAGIC, sizeof(header.magic)) == 0 &&
+            header.cols == cols && header.rows == rows && header.channels >= channels);
+  }
+
+  MappedCloudFile::MappedCloudFile(std::string const& file) {
+
+    m_file.open(file);
+    if (!m_file.is_open() || m_file.size() < sizeof(MappedCloudHeader))
+      vw::vw_throw(vw::IOErr() << "Cannot read the mapped point cloud: " << file << "\n");
+
+    std::memcpy(&m_header, m_file.data(), sizeof(m_header));
+    if (std::memcmp(m_header.magic, MAPPED_CLOUD_MAGIC, sizeof(m_header.magic)) != 0 ||
+        m_header.chunk_size <= 0)
+      vw::vw_throw(vw::IOErr() << "Invalid mapped point cloud: " << file << "\n");
+
+    m_chunk_cols = (m_header.cols + m_header.chunk_size - 1) / m_header.chunk_size;
+    int chunk_rows = (m_header.rows + m_header.chunk_size - 1) / m_header.chunk_size;
+    if (m_header.num_chunks != std::int64_t(m_chunk_cols) * chunk_rows ||
+        m_file.size() < sizeof(MappedCloudHeader) +
+        m_header.num_chunks * sizeof(MappedCloudChunk))
+      vw::vw_throw(vw::IOErr() << "Corrupted mapped point cloud: " << file << "\n");
+
+    m_chunks = reinterpret_cast<MappedCloudChunk const*>
+      (m_file.data() + sizeof(MappedCloudHeader));
+  }
+
+  vw::BBox3 MappedCloudFile::chunk_bbox(int index) const {
+    MappedCloudChunk const& c = m_chunks[index];
+    if (c.min[0] > c.max[0])
+      return vw::BBox3(); // no valid points
+    return vw::BBox3(vw::Vector3(c.min[0], c.min[1], c.min[2]),
+                     vw::Vector3(c.max[0], c.max[1], c.max[2]));
+  }
+
+  void MappedCloudFile::chunks_intersecting(vw::BBox3 const& box,
+                                            std::vector<int> & indices) const {
+    indices.clear();
+    for (std::int64_t it = 0; it < m_header.num_chunks; it++) {
+      vw::BBox3 chunk_box = chunk_bbox(it);
+      if (chunk_box.empty())
+        continue;
+      // Boxes of chunks with one point may have zero volume, so do not use
+      // BBox3::intersects().
+      bool overlaps = true;
+      for (int k = 0; k < 3; k++) {
+        if (chunk_box.min()[k] > box.max()[k] || box.min()[k] > chunk_box.max()[k])
+          overlaps = false;
+      }
+      if (overlaps)
+        indices.push_back(it);
+    }
+  }
+  
+} // end namespace asp
@@ -0,0 +1,173 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file MappedPointCloud.h
+///
+
+// A memory-mappable copy of an ASP point cloud, organized in chunks. Each
+// chunk has the bounding box of its points, followed by the shifted float
+// payload, exactly as stored in the PC.tif file. Reading it needs no
+// decompression or conversion, and chunks outside a region of interest can
+// be skipped. The PC.tif file stays the authoritative copy, and has the
+// georeference and other metadata. The mapped copy sits next to it.
+
+#ifndef __ASP_CORE_MAPPED_POINT_CLOUD_H__
+#define __ASP_CORE_MAPPED_POINT_CLOUD_H__
+
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/PixelAccessors.h>
+#include <vw/Math/Vector.h>
+#include <vw/Math/BBox.h>
+#include <vw/Core/ProgressCallback.h>
+#include <vw/Core/Exception.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  // The file header. All values are in native byte order.
+  struct MappedCloudHeader {
+    char         magic[8];   // "ASPPCM01"
+    std::int32_t cols, rows; // image dimensions
+    std::int32_t channels;   // number of float channels per pixel
+    std::int32_t chunk_size; // chunks are of this size, except at the right and bottom
+    double       shift[3];   // add this to the first 3 channels of valid points
+    std::int64_t num_chunks;
+  };
+
+  // Followed by a table having num_chunks entries, in row-major order 
+  struct MappedCloudChunk {
+    std::int32_t col, row, width, height; // pixel box of the chunk
+    double       min[3], max[3];          // box of valid points, with the shift added back
+    std::int64_t offset;                  // position of the float payload in the file
+  };
+
+  /// The name of the mapped copy of a given point cloud. For example,
+  /// run/run-PC.tif becomes run/run-PC.pcm.
+  std::string mapped_point_cloud_name(std::string const& pc_file);
+
+  /// Write the mapped copy of a point cloud saved as shifted floats. Return
+  /// false if the cloud is not in that format.
+  bool write_mapped_point_cloud(std::string const& pc_file, int chunk_size,
+                                vw::ProgressCallback const& progress);
+
+  /// Return true if there is a mapped copy of this point cloud which is
+  /// not older than it, has the same dimensions, and has at least the given
+  /// number of channels.
+  bool have_mapped_point_cloud(std::string const& pc_file, int cols, int rows,
+                               int channels);
+
+  /// A point cloud file, mapped into memory
+  class MappedCloudFile {
+    boost::iostreams::mapped_file_source m_file;
+    MappedCloudHeader              m_header;
+    MappedCloudChunk const*        m_chunks;
+    int                            m_chunk_cols; // number of chunks in a row
+
+  public:
+    MappedCloudFile(std::string const& file);
+
+    MappedCloudHeader const& header() const { return m_header; }
+    MappedCloudChunk  const& chunk(int index) const { return m_chunks[index]; }
+    vw::Vector3 shift() const {
+      return vw::Vector3(m_header.shift[0], m_header.shift[1], m_header.shift[2]);
+    }
+
+    /// The box of valid points in the given chunk. May be empty.
+    vw::BBox3 chunk_bbox(int index) const;
+
+    /// The channels of the given pixel, without the shift added back
+    inline float const* pixel(int col, int row) const {
+      int chunk_size = m_header.chunk_size;
+      MappedCloudChunk const& c 
+        = m_chunks[(row / chunk_size) * m_chunk_cols + (col / chunk_size)];
+      std::int64_t pix = std::int64_t(row - c.row) * c.width + (col - c.col);
+      return reinterpret_cast<float const*>(m_file.data() + c.offset)
+        + pix * m_header.channels;
+    }
+
+    /// Find the chunks having points in the given box. The rest can be
+    /// skipped, as they have no such points.
+    void chunks_intersecting(vw::BBox3 const& box, std::vector<int> & indices) const;
+  };
+
+  /// A view of the first m channels of a mapped point cloud, with the shift
+  /// added back to valid points. It returns the same values as reading the
+  /// PC.tif file with read_asp_point_cloud().
+  template<int m>
+  class MappedPointCloudView: public vw::ImageViewBase<MappedPointCloudView<m>> {
+    boost::shared_ptr<MappedCloudFile> m_file;
+    vw::Vector3 m_shift;
+    
+  public:
+    typedef vw::Vector<double, m> pixel_type;
+    typedef pixel_type result_type;
+    typedef vw::ProceduralPixelAccessor<MappedPointCloudView> pixel_accessor;
+
+    MappedPointCloudView(std::string const& file):
+      m_file(new MappedCloudFile(file)), m_shift(m_file->shift()) {
+      VW_ASSERT(m_file->header().channels >= m,
+                vw::ArgumentErr() << "Expecting at least " << m << " channels in: "
+                << file << ".\n");
+    }
+
+    inline vw::int32 cols  () const { return m_file->header().cols; }
+    inline vw::int32 rows  () const { return m_file->header().rows; }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()(int col, int row, int p = 0) const {
+      float const* vals = m_file->pixel(col, row);
+      pixel_type pt;
+      for (int k = 0; k < m; k++)
+        pt[k] = vals[k];
+
+      // Same logic as in SubtractShift. Points with the first 3
+      // components being zero are invalid and are not shifted.
+      int len = std::min(3, m);
+      bool is_zero = true;
+      for (int k = 0; k < len; k++) {
+        if (pt[k] != 0)
+          is_zero = false;
+      }
+      if (!is_zero) {
+        for (int k = 0; k < len; k++)
+          pt[k] += m_shift[k];
+      }
+      return pt;
+    }
+
+    // The data is in memory already, so there is nothing to do here
+    typedef MappedPointCloudView prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const { return *this; }
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+
+    MappedCloudFile const& file() const { return *m_file; }
+  };
+  
+} // end namespace asp
+
+#endif // __ASP_CORE_MAPPED_POINT_CLOUD_H__
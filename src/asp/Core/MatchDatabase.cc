@@ -0,0 +1,166 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file MatchDatabase.cc
+///
+
+#include <asp/Core/MatchDatabase.h>
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Thread.h>
+#include <vw/InterestPoint/InterestData.h>
+#include <vw/InterestPoint/Matcher.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <cstring>
+#include <map>
+
+namespace fs = boost::filesystem;
+
+namespace asp {
+
+  const char MATCH_DB_MAGIC[9] = "ASPMDB01";
+
+  // Round up to a multiple of 8
+  std::uint64_t matchDbPad(std::uint64_t len) {
+    return (len + 7) / 8 * 8;
+  }
+
+  std::string matchDatabaseName(std::string const& match_file) {
+    return (fs::path(match_file).parent_path() / "matches.db").string();
+  }
+
+  MatchDatabase::MatchDatabase(std::string const& db_file) {
+
+    m_file.open(db_file);
+    if (!m_file.is_open() || m_file.size() < 8 ||
+        std::memcmp(m_file.data(), MATCH_DB_MAGIC, 8) != 0)
+      vw::vw_throw(vw::IOErr() << "Invalid match database: " << db_file << "\n");
+
+    // Index the records. Only the record headers are touched. Later
+    // records replace earlier ones with the same name.
+    std::uint64_t size = m_file.size(), offset = 8;
+    while (offset + sizeof(MatchDbRecordHeader) <= size) {
+      MatchDbRecordHeader header;
+      std::memcpy(&header, m_file.data() + offset, sizeof(header));
+      std::uint64_t num_ip = header.num_ip1 + header.num_ip2;
+      std::uint64_t len = sizeof(MatchDbRecordHeader) + matchDbPad(header.key_len)
+        + matchDbPad(num_ip * sizeof(MatchDbPoint) +
+                     num_ip * header.desc_len * sizeof(float));
+      if (offset + len > size)
+        vw::vw_throw(vw::IOErr() << "Truncated match database: " << db_file << "\n");
+
+      std::string name(m_file.data() + offset + sizeof(MatchDbRecordHeader),
+                       header.key_len);
+      m_index[name] = offset;
+      offset += len;
+    }
+  }
+
+  bool MatchDatabase::read(std::string const& name,
+                           std::vector<vw::ip::InterestPoint> & ip1,
+                           std::vector<vw::ip::InterestPoint> & ip2) const {
+
+    auto it = m_index.find(name);
+    if (it == m_index.end())
+      return false;
+
+    char const* rec = m_file.data() + it->second;
+    MatchDbRecordHeader header;
+    std::memcpy(&header, rec, sizeof(header));
+    char const* points = rec + sizeof(MatchDbRecordHeader) + matchDbPad(header.key_len);
+    std::uint64_t num_ip = header.num_ip1 + header.num_ip2;
+    char const* desc = points + num_ip * sizeof(MatchDbPoint);
+
+    ip1.resize(header.num_ip1);
+    ip2.resize(header.num_ip2);
+    for (std::uint64_t k = 0; k < num_ip; k++) {
+      MatchDbPoint P;
+      std::memcpy(&P, points + k * sizeof(MatchDbPoint), sizeof(P));
+      vw::ip::InterestPoint & ip = (k < header.num_ip1) ? ip1[k] : ip2[k - header.num_ip1];
+      ip.x           = P.x;
+      ip.y           = P.y;
+      ip.ix          = P.ix;
+      ip.iy          = P.iy;
+      ip.orientation = P.orientation;
+      ip.scale       = P.scale;
+      ip.interest    = P.interest;
+      ip.polarity    = (P.polarity != 0);
+      ip.octave      = P.octave;
+      ip.scale_lvl   = P.scale_lvl;
+      ip.descriptor.set_size(header.desc_len);
+      if (header.desc_len > 0)
+        std::memcpy(&ip.descriptor[0], desc + k * header.desc_len * sizeof(float),
+                    header.desc_len * sizeof(float));
+    }
+
+    return true;
+  }
+
+  bool MatchDatabase::has(std::string const& name) const {
+    return m_index.find(name) != m_index.end();
+  }
+
+  void MatchDatabase::names(std::vector<std::string> & match_names) const {
+    match_names.clear();
+    for (auto it = m_index.begin(); it != m_index.end(); it++)
+      match_names.push_back(it->first);
+  }
+
+  // The match database in the directory of this match file, or null if there
+  // is none. Each database is opened once. A missing one is remembered as null.
+  boost::shared_ptr<MatchDatabase> openMatchDatabase(std::string const& match_file) {
+    static vw::Mutex db_mutex;
+    static std::map<std::string, boost::shared_ptr<MatchDatabase>> databases;
+    std::string db_file = matchDatabaseName(match_file);
+    vw::Mutex::Lock lock(db_mutex);
+    auto it = databases.find(db_file);
+    if (it != databases.end())
+      return it->second;
+    boost::shared_ptr<MatchDatabase> db;
+    if (fs::exists(db_file))
+      db.reset(new MatchDatabase(db_file));
+    databases[db_file] = db;
+    return db;
+  }
+
+  void readMatchFile(std::string const& match_file,
+                     std::vector<vw::ip::InterestPoint> & ip1,
+                     std::vector<vw::ip::InterestPoint> & ip2) {
+
+    if (fs::exists(match_file)) {
+      vw::ip::read_binary_match_file(match_file, ip1, ip2);
+      return;
+    }
+
+    boost::shared_ptr<MatchDatabase> db = openMatchDatabase(match_file);
+    std::string name = fs::path(match_file).filename().string();
+    if (db.get() == NULL || !db->read(name, ip1, ip2))
+      vw::vw_throw(vw::IOErr() << "Cannot find the match file: " << match_file
+                   << ", and it is not in a match database.\n");
+  }
+
+  bool matchFileExists(std::string const& match_file) {
+    if (fs::exists(match_file))
+      return true;
+    boost::shared_ptr<MatchDatabase> db = openMatchDatabase(match_file);
+    return db.get() != NULL && db->has(fs::path(match_file).filename().string());
+  }
+
+} // end namespace asp
@@ -0,0 +1,105 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file MatchDatabase.h
+///
+
+// A match database holds the contents of many match files in one file, named
+// matches.db, in the directory of the match files. It is created and
+// appended to with parse_match_file.py. Each record has the name of a match
+// file, such as run-img1__img2.match, and its interest points. A later
+// record with the same name replaces an earlier one. The file is mapped
+// into memory, and the records are found via an index built when it is
+// opened, so no match files need to be listed or opened.
+
+#ifndef __ASP_CORE_MATCH_DATABASE_H__
+#define __ASP_CORE_MATCH_DATABASE_H__
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace vw {
+  namespace ip {
+    class InterestPoint;
+  }
+}
+
+namespace asp {
+
+  // The file starts with the 8-byte magic "ASPMDB01", followed by the
+  // records. All values are little-endian.
+  struct MatchDbRecordHeader {
+    std::uint32_t key_len;  // length of the match file name, which follows
+    std::uint32_t desc_len; // number of descriptor values per point, or 0
+    std::uint64_t num_ip1, num_ip2;
+  };
+
+  // After the name, padded with zeros to a multiple of 8 bytes, come
+  // num_ip1 + num_ip2 of these, and then the descriptors as floats, if any.
+  // The record is padded to a multiple of 8 bytes.
+  struct MatchDbPoint {
+    float         x, y, orientation, scale, interest;
+    std::int32_t  ix, iy;
+    std::uint32_t octave, scale_lvl;
+    std::int32_t  polarity;
+  };
+
+  /// The match database for the match files in the same directory as
+  /// the given match file.
+  std::string matchDatabaseName(std::string const& match_file);
+
+  /// A match database, mapped into memory
+  class MatchDatabase {
+    boost::iostreams::mapped_file_source m_file;
+    std::unordered_map<std::string, std::uint64_t> m_index; // name to record offset
+
+  public:
+    MatchDatabase(std::string const& db_file);
+
+    /// If the database has matches for this match file name (without the
+    /// directory), read them and return true.
+    bool read(std::string const& name,
+              std::vector<vw::ip::InterestPoint> & ip1,
+              std::vector<vw::ip::InterestPoint> & ip2) const;
+
+    /// If the database has matches for this match file name. The matches
+    /// are not read.
+    bool has(std::string const& name) const;
+
+    /// The names of the match files in the database
+    void names(std::vector<std::string> & match_names) const;
+  };
+
+  /// Read a match file. If it does not exist, read its matches from the
+  /// match database in the same directory, if any. A match file on disk
+  /// takes priority, so that edited or redone matches are used. The
+  /// databases are opened once per process.
+  void readMatchFile(std::string const& match_file,
+                     std::vector<vw::ip::InterestPoint> & ip1,
+                     std::vector<vw::ip::InterestPoint> & ip2);
+
+  /// If a match file exists, on disk or in the match database in the same
+  /// directory. Nothing is read besides the database index.
+  bool matchFileExists(std::string const& match_file);
+
+} // end namespace asp
+
+#endif // __ASP_CORE_MATCH_DATABASE_H__
@@ -16,22 +16,145 @@
 // __END_LICENSE__
 
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <string>
 #include <vector>
 #include <vw/BundleAdjustment/ControlNetworkLoader.h>
 #include <vw/InterestPoint/Matcher.h> // Needed for vw::ip::match_filename
 #include <asp/Core/MatchList.h>
+#include <asp/Core/MatchDatabase.h>
 
 using namespace vw;
 
 namespace asp {
 
+std::int64_t MatchPointIndex::cellKey(std::int64_t cx, std::int64_t cy) const {
+  return (cx << 32) ^ (cy & 0xffffffff);
+}
+
+void MatchPointIndex::build(std::vector<vw::ip::InterestPoint> const& ip,
+                            double cell_size) {
+  m_cells.clear();
+  m_box = BBox2();
+  for (size_t it = 0; it < ip.size(); it++) {
+    if (std::isfinite(ip[it].x) && std::isfinite(ip[it].y))
+      m_box.grow(Vector2(ip[it].x, ip[it].y));
+  }
+
+  // Aim for about two points per cell
+  m_cell_size = cell_size;
+  if (m_cell_size <= 0) {
+    double area = std::max(m_box.width(), 1.0) * std::max(m_box.height(), 1.0);
+    m_cell_size = std::max(1.0, std::sqrt(2.0 * area / std::max(ip.size(), size_t(1))));
+  }
+
+  for (size_t it = 0; it < ip.size(); it++) {
+    if (!std::isfinite(ip[it].x) || !std::isfinite(ip[it].y))
+      continue;
+    std::int64_t cx = std::floor((ip[it].x - m_box.min().x()) / m_cell_size);
+    std::int64_t cy = std::floor((ip[it].y - m_box.min().y()) / m_cell_size);
+    m_cells[cellKey(cx, cy)].push_back(it); // indices are in increasing order
+  }
+  m_built = true;
+}
+
+int MatchPointIndex::findNearest(std::vector<vw::ip::InterestPoint> const& ip,
+                                 vw::Vector2 const& P, double distLimit) const {
+  if (m_cells.empty())
+    return -1;
+
+  double min_dist = std::numeric_limits<double>::max();
+  if (distLimit > 0)
+    min_dist = distLimit;
+  int min_index = -1;
+
+  // The farthest ring of cells around P which can have a point. If P is
+  // much farther than the extent of the points, it is cheaper to visit them all.
+  Vector2 d = elem_diff(P, m_box.min()) / m_cell_size;
+  double span = std::max(m_box.width(), m_box.height()) / m_cell_size + 1.0;
+  double r_max = std::max(std::max(std::abs(d.x()), std::abs(d.x() - span)),
+                          std::max(std::abs(d.y()), std::abs(d.y() - span))) + 1.0;
+  if (distLimit > 0)
+    r_max = std::min(r_max, std::ceil(distLimit / m_cell_size) + 1.0);
+  if (!std::isfinite(r_max) || r_max > 2.0 * span) {
+    for (size_t it = 0; it < ip.size(); it++) {
+      double dist = norm_2(Vector2(ip[it].x, ip[it].y) - P);
+      if (dist < min_dist) {
+        min_dist  = dist;
+        min_index = it;
+      }
+    }
+    return min_index;
+  }
+
+  // Visit rings of cells of growing size centered at the cell of P. Any
+  // point beyond ring r is farther than r cells from P.
+  std::int64_t pcx = std::floor(d.x()), pcy = std::floor(d.y());
+  for (std::int64_t r = 0; r <= std::int64_t(r_max); r++) {
+    for (std::int64_t cy = pcy - r; cy <= pcy + r; cy++) {
+      bool edge_row = (cy == pcy - r || cy == pcy + r);
+      for (std::int64_t cx = pcx - r; cx <= pcx + r; cx += (edge_row ? 1 : 2 * r)) {
+        auto it = m_cells.find(cellKey(cx, cy));
+        if (it != m_cells.end()) {
+          std::vector<int> const& cell = it->second; // alias
+          for (size_t k = 0; k < cell.size(); k++) {
+            double dist = norm_2(Vector2(ip[cell[k]].x, ip[cell[k]].y) - P);
+            if (dist < min_dist || (dist == min_dist && min_index >= 0 && cell[k] < min_index)) {
+              min_dist  = dist;
+              min_index = cell[k];
+            }
+          }
+        }
+        if (r == 0)
+          break;
+      }
+    }
+    if (min_index >= 0 && min_dist < r * m_cell_size)
+      break;
+  }
+
+  return min_index;
+}
+
+int MatchPointIndex::findFirstWithin(std::vector<vw::ip::InterestPoint> const& ip,
+                                     vw::Vector2 const& P, double half_width) const {
+  if (m_cells.empty())
+    return -1;
+
+  int ans = -1;
+  std::int64_t beg_x = std::floor((P.x() - half_width - m_box.min().x()) / m_cell_size);
+  std::int64_t end_x = std::floor((P.x() + half_width - m_box.min().x()) / m_cell_size);
+  std::int64_t beg_y = std::floor((P.y() - half_width - m_box.min().y()) / m_cell_size);
+  std::int64_t end_y = std::floor((P.y() + half_width - m_box.min().y()) / m_cell_size);
+  for (std::int64_t cy = beg_y; cy <= end_y; cy++) {
+    for (std::int64_t cx = beg_x; cx <= end_x; cx++) {
+      auto it = m_cells.find(cellKey(cx, cy));
+      if (it == m_cells.end())
+        continue;
+      std::vector<int> const& cell = it->second; // alias
+      for (size_t k = 0; k < cell.size(); k++) {
+        if (ans >= 0 && cell[k] >= ans)
+          break; // the indices in a cell are increasing
+        if (std::abs(ip[cell[k]].x - P.x()) < half_width &&
+            std::abs(ip[cell[k]].y - P.y()) < half_width) {
+          ans = cell[k];
+          break;
+        }
+      }
+    }
+  }
+  return ans;
+}
+
 void MatchList::throwIfNoPoint(size_t image, size_t point) const {
   if ((image >= m_matches.size()) || (point >= m_matches[image].size()))
     vw_throw(ArgumentErr() << "IP " << image << ", " << point << " does not exist!\n");
 }
 
 void MatchList::resize(size_t num_images) {
+  invalidateIndex();
   m_matches.resize(num_images);
   m_valid_matches.resize(num_images);
 }
@@ -65,6 +188,7 @@ bool MatchList::addPoint(size_t image, vw::ip::InterestPoint const &pt, bool val
 
   m_matches[image].push_back(pt);
   m_valid_matches[image].push_back(true);
+  invalidateIndex();
   return true;
 }
 
@@ -106,26 +230,19 @@ void MatchList::setPointPosition(size_t image, size_t point, float x, float y) {
   throwIfNoPoint(image, point);
   m_matches[image][point].x = x;
   m_matches[image][point].y = y;
+  invalidateIndex();
 }
 
 int MatchList::findNearestMatchPoint(size_t image, vw::Vector2 P, double distLimit) const {
   if (image >= m_matches.size())
     return -1;
 
-  double min_dist  = std::numeric_limits<double>::max();
-  if (distLimit > 0)
-    min_dist = distLimit;
-  int    min_index = -1;
-  std::vector<vw::ip::InterestPoint> const& ip = m_matches[image]; // alias
-  for (size_t ip_iter = 0; ip_iter < ip.size(); ip_iter++) {
-    Vector2 Q(ip[ip_iter].x, ip[ip_iter].y);
-    double curr_dist = norm_2(Q-P);
-    if (curr_dist < min_dist) {
-      min_dist  = curr_dist;
-      min_index = ip_iter;
-    }
-  }
-  return min_index;
+  if (m_index.size() != m_matches.size())
+    m_index.resize(m_matches.size());
+  if (!m_index[image].built())
+    m_index[image].build(m_matches[image]);
+
+  return m_index[image].findNearest(m_matches[image], P, distLimit);
 }
 
 void MatchList::deletePointsForImage(size_t image) {
@@ -134,6 +251,7 @@ void MatchList::deletePointsForImage(size_t image) {
 
   m_matches.erase      (m_matches.begin()       + image);
   m_valid_matches.erase(m_valid_matches.begin() + image);
+  invalidateIndex();
 }
 
 bool MatchList::deletePointAcrossImages(size_t point) {
@@ -154,6 +272,7 @@ bool MatchList::deletePointAcrossImages(size_t point) {
     m_matches[vec_iter].erase(m_matches[vec_iter].begin() + point);
     m_valid_matches[vec_iter].erase(m_valid_matches[vec_iter].begin() + point);
   }
+  invalidateIndex();
   return true;
 }
 
@@ -285,7 +404,6 @@ void populateMatchFiles(std::vector<std::string> const& image_files,
   
   std::string trial_match = "";
   int leftIndex = 0;
-  std::vector<vw::ip::InterestPoint> left, right; // local variables
   for (size_t i = 1; i < image_files.size(); i++) {
 
     // Handle user-provided match file for two images
@@ -295,25 +413,17 @@ void populateMatchFiles(std::vector<std::string> const& image_files,
       break;
     }
 
-    // Look for the match file in the default location, and if it
-    // does not appear prompt the user or a path.
+    // Look for the match file in the default location. Only check that it
+    // exists. It is read later, if at all.
 
     // Look in default location 1, match from previous file to this file.
-    try {
-      trial_match = vw::ip::match_filename(output_prefix, image_files[i-1],
-             image_files[i]);
-      leftIndex = i - 1;
-      vw::ip::read_binary_match_file(trial_match, left, right);
-
-    } catch(...) {
+    trial_match = vw::ip::match_filename(output_prefix, image_files[i-1], image_files[i]);
+    leftIndex = i - 1;
+    if (!asp::matchFileExists(trial_match)) {
       // Look in default location 2, match from first file to this file.
-      try {
-        trial_match = vw::ip::match_filename(output_prefix, image_files[0],
-               image_files[i]);
-        leftIndex = 0;
-        vw::ip::read_binary_match_file(trial_match, left, right);
-
-      } catch(...) {
+      trial_match = vw::ip::match_filename(output_prefix, image_files[0], image_files[i]);
+      leftIndex = 0;
+      if (!asp::matchFileExists(trial_match)) {
         // Default locations failed, Start with a blank match file.
         trial_match = vw::ip::match_filename(output_prefix, image_files[i-1],
                                              image_files[i]);
@@ -379,7 +489,7 @@ bool MatchList::loadPointsFromMatchFiles(std::vector<std::string> const& matchFi
     std::vector<vw::ip::InterestPoint> left, right;
     try {
       vw_out() << "Reading binary match file: " << match_file << std::endl;
-      ip::read_binary_match_file(match_file, left, right);
+      asp::readMatchFile(match_file, left, right);
     }catch(...){
       vw_out() << "IP load failed, leaving default invalid IP\n";
       continue;
@@ -394,26 +504,23 @@ bool MatchList::loadPointsFromMatchFiles(std::vector<std::string> const& matchFi
     }
 
     // For other cases, we need to isolate the same IP in the left image.
-    // Loop through the ip in the "left" image
+    // Index the ip we already have for that image, with cells of the size
+    // of the search box, so only a few of them are looked at per point.
+    MatchPointIndex index;
+    index.build(m_matches[j], 2 * ALLOWED_POS_DIFF);
     size_t count = 0;
-    for (size_t pnew=0; pnew<left.size(); ++pnew) {
-
-      // Look through the ip we already have for that image
-      //  and see if any of them are at the same location
-      for (size_t pold=0; pold<num_ip; ++pold) {
-
-        float dx = fabs(left[pnew].x - m_matches[j][pold].x);
-        float dy = fabs(left[pnew].y - m_matches[j][pold].y);
-        if ((dx < ALLOWED_POS_DIFF) && (dy < ALLOWED_POS_DIFF))
-        {
-          // If we found a match, record it and move on to the next point.
-          // - Note that we match left[] but we record right[]
-          m_matches      [i][pold] = right[pnew];
-          m_valid_matches[i][pold] = true;
-          ++count;
-          break;
-        }
-      } // End loop through m_matches[j]
+    for (size_t pnew = 0; pnew < left.size(); pnew++) {
+
+      // See if any of the ip we have are at the same location
+      int pold = index.findFirstWithin(m_matches[j], Vector2(left[pnew].x, left[pnew].y),
+                                       ALLOWED_POS_DIFF);
+      if (pold >= 0 && size_t(pold) < num_ip) {
+        // If we found a match, record it and move on to the next point.
+        // - Note that we match left[] but we record right[]
+        m_matches      [i][pold] = right[pnew];
+        m_valid_matches[i][pold] = true;
+        ++count;
+      }
       
       if (count == num_ip)
         break; // This means we matched all of the IP in the existing image!
@@ -421,6 +528,7 @@ bool MatchList::loadPointsFromMatchFiles(std::vector<std::string> const& matchFi
     }  // End loop through left
     // Any points that did not match are left with their original value.
   }
+  invalidateIndex();
   return true;
 }
 
@@ -29,9 +29,11 @@
 #include <vw/InterestPoint/InterestData.h>
 
 #include <string>
+#include <cstdint>
 #include <vector>
 #include <list>
 #include <set>
+#include <unordered_map>
 
 namespace asp { 
 
@@ -48,6 +50,38 @@ namespace asp {
                           std::vector<size_t> & leftIndices,
                           bool & matchfiles_found);
   
+  /// A uniform grid over the interest points of one image, so that the
+  /// points near a given pixel are found without visiting all of them.
+  class MatchPointIndex {
+  public:
+    MatchPointIndex(): m_built(false), m_cell_size(1.0) {}
+
+    bool built() const { return m_built; }
+
+    /// Index the given points. If the cell size is not positive, pick one
+    /// so that there are a couple of points per cell.
+    void build(std::vector<vw::ip::InterestPoint> const& ip, double cell_size = 0);
+
+    /// The index of the point nearest to P, or -1 if there are none. If
+    /// distLimit is positive, the point must be closer than that. Ties go to
+    /// the lowest index. The points must be the same as passed to build().
+    int findNearest(std::vector<vw::ip::InterestPoint> const& ip,
+                    vw::Vector2 const& P, double distLimit) const;
+
+    /// The lowest index of a point whose x and y differ from those of P by
+    /// less than half_width, or -1 if there is none.
+    int findFirstWithin(std::vector<vw::ip::InterestPoint> const& ip,
+                        vw::Vector2 const& P, double half_width) const;
+
+  private:
+    std::int64_t cellKey(std::int64_t cx, std::int64_t cy) const;
+
+    bool m_built;
+    double m_cell_size;
+    vw::BBox2 m_box; // bounding box of the points
+    std::unordered_map<std::int64_t, std::vector<int>> m_cells;
+  };
+
   class MatchList {
   public:
     /// Clear all exiting points and set up for a new image count.
@@ -129,6 +163,9 @@ namespace asp {
     /// Set all IP for the image as valid.
     void setIpValid(size_t image);
 
+    /// Must be called each time points are added, moved, or removed.
+    void invalidateIndex() { m_index.clear(); }
+
     /// A set of interest points for each input image
     /// - There is always one set of matched interest points shared among all images.
     /// - The only way the counts can differ is if the user is in the process of manually
@@ -137,6 +174,9 @@ namespace asp {
     std::vector<std::vector<vw::ip::InterestPoint>> m_matches;
     /// Stay synced with m_matches, set to false if that match is not 
     std::vector<std::vector<bool>> m_valid_matches;
+    /// A spatial index of the points in each image, built on first use.
+    /// This class is not thread-safe, so it is fine to build it in a const method.
+    mutable std::vector<MatchPointIndex> m_index;
 
   }; // End class MatchList
 
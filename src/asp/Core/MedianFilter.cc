@@ -19,6 +19,12 @@
 #include <asp/Core/MedianFilter.h>
 #include <vw/Math/Vector.h>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
 using namespace vw;
 
 uint8 find_median_in_histogram(Vector<int, CALC_PIXEL_NUM_VALS> histogram,
@@ -39,3 +45,128 @@ uint8 find_median_in_histogram(Vector<int, CALC_PIXEL_NUM_VALS> histogram,
 
   return i;
 }
+
+namespace asp {
+
+namespace {
+
+  // A Fenwick tree over ranks, to count the ranks in the window and find
+  // the one with a given position in sorted order
+  class RankCounter {
+    std::vector<int> m_tree;
+    int m_top; // the largest power of 2 not above the size
+  public:
+    void reset(int size) {
+      m_tree.assign(size + 1, 0);
+      m_top = 1;
+      while (2 * m_top <= size)
+        m_top *= 2;
+    }
+    void add(int rank, int delta) {
+      for (int i = rank + 1; i < (int)m_tree.size(); i += i & (-i))
+        m_tree[i] += delta;
+    }
+    // The rank having k ranks before it, with k starting from 0
+    int select(int k) const {
+      int pos = 0;
+      for (int step = m_top; step > 0; step /= 2) {
+        int next = pos + step;
+        if (next < (int)m_tree.size() && m_tree[next] <= k) {
+          pos = next;
+          k -= m_tree[next];
+        }
+      }
+      return pos; // the ranks are from 0, the tree indices from 1
+    }
+  };
+
+} // end anonymous namespace
+
+void median_filter_nodata(vw::ImageView<double> const& input, int half_win,
+                          vw::ImageView<double> & median) {
+
+  int nc = input.cols(), nr = input.rows();
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  median.set_size(nc, nr);
+  half_win = std::max(half_win, 0);
+
+  // The valid values in the rows of the window, with their row and
+  // column, in sorted order. As the window moves down, the values of the
+  // row it leaves are removed, and those of the row it enters are sorted
+  // and merged in, rather than sorting all again.
+  typedef std::pair<double, std::pair<int, int>> ValT; // value, then row and column
+  std::vector<ValT> sorted, merged, new_row;
+  std::vector<double> sorted_vals;
+  std::vector<int> band_rank; // the rank of each value in the band, or -1
+  RankCounter counter;
+  int prev_end_row = 0;
+
+  for (int row = 0; row < nr; row++) {
+
+    int beg_row = std::max(row - half_win, 0);
+    int end_row = std::min(row + half_win + 1, nr);
+    int band_rows = end_row - beg_row;
+
+    // Update the sorted values of the rows of the window
+    sorted.erase(std::remove_if(sorted.begin(), sorted.end(),
+                                [beg_row](ValT const& v) { return v.second.first < beg_row; }),
+                 sorted.end());
+    for (int r = prev_end_row; r < end_row; r++) {
+      new_row.clear();
+      for (int c = 0; c < nc; c++) {
+        double val = input(c, r);
+        if (!std::isnan(val))
+          new_row.push_back(ValT(val, std::make_pair(r, c)));
+      }
+      std::sort(new_row.begin(), new_row.end());
+      merged.resize(sorted.size() + new_row.size());
+      std::merge(sorted.begin(), sorted.end(), new_row.begin(), new_row.end(),
+                 merged.begin());
+      sorted.swap(merged);
+    }
+    prev_end_row = end_row;
+
+    // Rank the values
+    band_rank.assign(size_t(band_rows) * nc, -1);
+    sorted_vals.resize(sorted.size());
+    for (size_t it = 0; it < sorted.size(); it++) {
+      sorted_vals[it] = sorted[it].first;
+      int r = sorted[it].second.first - beg_row, c = sorted[it].second.second;
+      band_rank[size_t(r) * nc + c] = it;
+    }
+    counter.reset(sorted.size());
+
+    // Add or remove the values of a column of the band
+    int count = 0;
+    auto update = [&](int c, int delta) {
+      for (int r = 0; r < band_rows; r++) {
+        int rank = band_rank[size_t(r) * nc + c];
+        if (rank < 0)
+          continue;
+        counter.add(rank, delta);
+        count += delta;
+      }
+    };
+
+    for (int c = 0; c < std::min(half_win, nc); c++)
+      update(c, 1);
+
+    for (int col = 0; col < nc; col++) {
+      // Slide the window to be centered at this column
+      if (col + half_win < nc)
+        update(col + half_win, 1);
+      if (col - half_win - 1 >= 0)
+        update(col - half_win - 1, -1);
+
+      if (count == 0)
+        median(col, row) = nan;
+      else if (count % 2 == 1)
+        median(col, row) = sorted_vals[counter.select(count/2)];
+      else
+        median(col, row) = (sorted_vals[counter.select(count/2 - 1)] +
+                            sorted_vals[counter.select(count/2)]) / 2.0;
+    }
+  }
+}
+
+} // end namespace asp
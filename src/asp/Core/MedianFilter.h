@@ -142,4 +142,20 @@ namespace vw {
 
 }
 
+namespace asp {
+
+  /// Find the median of the valid values in the window of size
+  /// 2*half_win+1 around each pixel, with NaN values being invalid. The
+  /// window is clipped at the image boundary. The median of an even number
+  /// of values is the mean of the middle two. If there are no valid values,
+  /// the result is NaN. The values in the rows of the window are kept
+  /// sorted as the window moves down. Along each row, the ranks of one
+  /// column at a time are added and removed in a Fenwick tree, which finds
+  /// the median rank. That costs O(half_win * log) per pixel, rather than
+  /// sorting all values in the window.
+  void median_filter_nodata(vw::ImageView<double> const& input, int half_win,
+                            vw::ImageView<double> & median);
+
+} // end namespace asp
+
 #endif // __MEDIAN_FILTER_H__
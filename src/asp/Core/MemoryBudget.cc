@@ -0,0 +1,191 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file MemoryBudget.cc
+///
+
+#include <asp/Core/MemoryBudget.h>
+
+#include <vw/Core/Log.h>
+#include <vw/Core/Settings.h>
+
+#include <gdal.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace asp {
+
+namespace {
+
+  const double MB = 1024.0 * 1024.0;
+
+  // The share of the budget for the VW cache starts here, and is kept
+  // within these bounds. The rest goes to GDAL.
+  const double VW_FRACTION_START = 0.75;
+  const double VW_FRACTION_MIN   = 0.5;
+  const double VW_FRACTION_MAX   = 0.9;
+  const double VW_FRACTION_STEP  = 0.05;
+
+  // How often to rebalance, in seconds
+  const int REBALANCE_PERIOD = 5;
+
+  // Read a limit in bytes from a cgroup file. Return 0 for no limit.
+  double read_cgroup_limit(std::string const& path) {
+    std::ifstream ifs(path.c_str());
+    std::string val;
+    if (!(ifs >> val) || val == "max")
+      return 0.0;
+    double bytes = atof(val.c_str());
+    // cgroup v1 reports a huge number when there is no limit
+    if (bytes <= 0.0 || bytes >= 1.0e18)
+      return 0.0;
+    return bytes / MB;
+  }
+
+  // Set the cache sizes and rebalance them periodically
+  class MemoryGovernor {
+  public:
+    MemoryGovernor(): m_budget_mb(0.0), m_vw_fraction(VW_FRACTION_START),
+                      m_stop(false) {}
+
+    ~MemoryGovernor() {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+      }
+      m_cond.notify_all();
+      if (m_thread.joinable())
+        m_thread.join();
+    }
+
+    void set_budget(double budget_mb) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_budget_mb = budget_mb;
+      apply();
+      if (!m_thread.joinable())
+        m_thread = std::thread(&MemoryGovernor::run, this);
+    }
+
+  private:
+
+    // Must be called with the lock held
+    void apply() {
+      vw::vw_settings().set_system_cache_size(size_t(m_budget_mb * m_vw_fraction * MB));
+      GDALSetCacheMax64(GIntBig(m_budget_mb * (1.0 - m_vw_fraction) * MB));
+    }
+
+    void run() {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while (!m_stop) {
+        m_cond.wait_for(lock, std::chrono::seconds(REBALANCE_PERIOD));
+        if (m_stop)
+          break;
+        double fraction
+          = rebalance_vw_fraction(m_vw_fraction, double(GDALGetCacheUsed64()),
+                                  double(GDALGetCacheMax64()));
+        if (fraction != m_vw_fraction) {
+          m_vw_fraction = fraction;
+          apply();
+        }
+      }
+    }
+
+    double m_budget_mb, m_vw_fraction;
+    bool m_stop;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+  };
+
+  MemoryGovernor& memory_governor() {
+    static MemoryGovernor governor;
+    return governor;
+  }
+
+} // end anonymous namespace
+
+double cgroup_memory_limit_mb() {
+
+  // With cgroup v2, find the group of this process, then its limit
+  std::ifstream ifs("/proc/self/cgroup");
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (line.compare(0, 3, "0::") != 0)
+      continue;
+    double limit = read_cgroup_limit("/sys/fs/cgroup" + line.substr(3) + "/memory.max");
+    if (limit > 0.0)
+      return limit;
+  }
+
+  double limit = read_cgroup_limit("/sys/fs/cgroup/memory.max");
+  if (limit > 0.0)
+    return limit;
+
+  // cgroup v1
+  return read_cgroup_limit("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+}
+
+double memory_budget_mb(double budget_mb) {
+
+  if (budget_mb <= 0.0) {
+    const char* env = getenv("ASP_MEMORY_BUDGET_MB");
+    if (env != NULL)
+      budget_mb = atof(env);
+  }
+  if (budget_mb <= 0.0)
+    return 0.0;
+
+  // Leave half of the cgroup memory for the data not in the caches
+  double limit = cgroup_memory_limit_mb();
+  if (limit > 0.0 && budget_mb > 0.5 * limit) {
+    vw::vw_out(vw::WarningMessage) << "Reducing the memory budget to "
+                                   << 0.5 * limit << " MB, as the memory of this "
+                                   << "process is limited to " << limit << " MB.\n";
+    budget_mb = 0.5 * limit;
+  }
+
+  return budget_mb;
+}
+
+void set_memory_budget(double budget_mb) {
+  if (budget_mb <= 0.0)
+    return;
+  memory_governor().set_budget(budget_mb);
+}
+
+double rebalance_vw_fraction(double vw_fraction, double gdal_used,
+                             double gdal_max) {
+
+  if (gdal_max <= 0.0)
+    return vw_fraction;
+
+  if (gdal_used >= 0.95 * gdal_max)
+    vw_fraction -= VW_FRACTION_STEP; // GDAL needs more
+  else if (gdal_used < 0.5 * gdal_max)
+    vw_fraction += VW_FRACTION_STEP; // GDAL has more than it needs
+
+  return std::max(VW_FRACTION_MIN, std::min(VW_FRACTION_MAX, vw_fraction));
+}
+
+} // end namespace asp
@@ -0,0 +1,58 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file MemoryBudget.h
+///
+
+// A memory budget for the caches of a process, split between the VW tile
+// cache and the GDAL block cache. The budget is set with the stereo option
+// --memory-budget-mb, or for any ASP tool with the environment variable
+// ASP_MEMORY_BUDGET_MB. It is capped by the memory limit of the cgroup of
+// the process, if any. While the process runs, a background thread moves
+// memory to the GDAL cache when it is full, and back to the VW cache when
+// it is not needed. Without a budget, --cache-size-mb is used for the VW
+// cache, and GDAL uses its default.
+
+#ifndef __ASP_CORE_MEMORY_BUDGET_H__
+#define __ASP_CORE_MEMORY_BUDGET_H__
+
+namespace asp {
+
+  /// The memory limit of the cgroup of this process, in MB, or 0 if
+  /// there is no limit or it cannot be found. Both cgroup v1 and v2
+  /// are supported.
+  double cgroup_memory_limit_mb();
+
+  /// The memory budget for the caches, in MB, from the given value, or if
+  /// that is not positive, from ASP_MEMORY_BUDGET_MB. Capped by the cgroup
+  /// limit. Return 0 if there is no budget.
+  double memory_budget_mb(double budget_mb);
+
+  /// Split the given budget, in MB, between the VW and GDAL caches, and
+  /// start rebalancing them. Calling this again sets a new budget. Does
+  /// nothing if the budget is not positive.
+  void set_memory_budget(double budget_mb);
+
+  /// The new fraction of the budget for the VW cache, given the current
+  /// one, and the used and maximum size of the GDAL cache. The GDAL cache
+  /// grows when it is nearly full, and shrinks when mostly unused.
+  double rebalance_vw_fraction(double vw_fraction, double gdal_used,
+                               double gdal_max);
+
+} // end namespace asp
+
+#endif // __ASP_CORE_MEMORY_BUDGET_H__
@@ -21,6 +21,8 @@
 #include <vw/FileIO/FileUtils.h>
 #include <vw/BundleAdjustment/ControlNetwork.h>
 
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 
@@ -306,10 +308,345 @@ void writeNvm(std::vector<Eigen::Matrix2Xd> const& cid_to_keypoint_map,
   writeNvmOffsets(offset_path, optical_centers);
 }
 
+namespace {
+
+// A binary NVM file starts with this header. It is followed by the
+// sections, each starting at a multiple of 8 bytes, so that the arrays of
+// numbers in them are aligned if the file is mapped in memory. The byte
+// order is the one of the machine writing the file, and is checked on reading.
+const char     NVM_BINARY_MAGIC[8] = {'N', 'V', 'M', '_', 'B', 'I', 'N', '1'};
+const uint32_t NVM_BYTE_ORDER      = 0x01020304;
+const uint32_t NVM_BINARY_VERSION  = 1;
+const uint64_t NVM_HAS_OFFSETS     = 1; // a flag for the optical centers
+
+struct NvmBinaryHeader {
+  char     magic[8];
+  uint32_t byte_order, version;
+  uint64_t num_cams, num_points, num_obs, flags;
+  // Where each of the cameras, keypoints, and tracks sections starts, and its size
+  uint64_t offsets[3], sizes[3];
+};
+
+template<class T>
+void writeVals(std::ofstream & f, T const* vals, size_t num) {
+  f.write(reinterpret_cast<char const*>(vals), sizeof(T) * num);
+}
+
+template<class T>
+void readVals(std::ifstream & f, std::string const& filename, T * vals, size_t num) {
+  f.read(reinterpret_cast<char*>(vals), sizeof(T) * num);
+  if (!f)
+    vw::vw_throw(vw::IOErr() << "Failed to read: " << filename << ".\n");
+}
+
+// Pad with zeros to a multiple of 8 bytes
+void pad8(std::ofstream & f) {
+  char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  uint64_t pos = f.tellp();
+  if (pos % 8 != 0)
+    f.write(zeros, 8 - pos % 8);
+}
+
+// Start reading a section, and check that it fits in the file
+void seekSection(std::ifstream & f, std::string const& filename,
+                 NvmBinaryHeader const& h, int index, uint64_t file_size) {
+  if (h.offsets[index] + h.sizes[index] > file_size)
+    vw::vw_throw(vw::IOErr() << "Truncated binary NVM file: " << filename << ".\n");
+  f.seekg(h.offsets[index]);
+}
+
+} // end anonymous namespace
+
+// If this is the name of a binary NVM file, so it has the .nvmb extension
+bool isBinaryNvm(std::string const& filename) {
+  return vw::get_extension(filename) == ".nvmb";
+}
+
+// Read a binary NVM file. See the header for the layout. The keypoints and
+// tracks are read only if asked for.
+void readBinaryNvm(std::string const& input_filename, int sections, bool add_offsets,
+                   std::vector<Eigen::Matrix2Xd>          & cid_to_keypoint_map,
+                   std::vector<std::string>               & cid_to_filename,
+                   std::vector<std::map<int, int>>        & pid_to_cid_fid,
+                   std::vector<Eigen::Vector3d>           & pid_to_xyz,
+                   std::vector<Eigen::Affine3d>           & world_to_cam,
+                   std::vector<double>                    & focal_lengths,
+                   std::map<std::string, Eigen::Vector2d> & optical_centers) {
+
+  // Wipe the outputs
+  cid_to_keypoint_map.clear();
+  cid_to_filename.clear();
+  pid_to_cid_fid.clear();
+  pid_to_xyz.clear();
+  world_to_cam.clear();
+  focal_lengths.clear();
+  optical_centers.clear();
+
+  vw::vw_out() << "Reading: " << input_filename << std::endl;
+  std::ifstream f(input_filename, std::ios::in | std::ios::binary | std::ios::ate);
+  if (!f.good())
+    vw::vw_throw(vw::ArgumentErr() << "Cannot open file: " << input_filename << ".\n");
+  uint64_t file_size = f.tellg();
+  f.seekg(0);
+
+  NvmBinaryHeader h;
+  readVals(f, input_filename, &h, 1);
+  if (std::string(h.magic, 8) != std::string(NVM_BINARY_MAGIC, 8))
+    vw::vw_throw(vw::ArgumentErr() << "Not a binary NVM file: " << input_filename << ".\n");
+  if (h.byte_order != NVM_BYTE_ORDER)
+    vw::vw_throw(vw::ArgumentErr() << "The binary NVM file " << input_filename
+                 << " was written on a machine with a different byte order.\n");
+  if (h.version != NVM_BINARY_VERSION)
+    vw::vw_throw(vw::ArgumentErr() << "Unsupported binary NVM version " << h.version
+                 << " in: " << input_filename << ".\n");
+  if (h.num_cams < 1)
+    vw::vw_throw(vw::ArgumentErr() << "NVM file is missing cameras.");
+
+  bool have_offsets = ((h.flags & NVM_HAS_OFFSETS) != 0);
+  if (add_offsets && !have_offsets)
+    vw::vw_throw(vw::ArgumentErr() << "The binary NVM file " << input_filename
+                 << " has no optical center offsets. Consider reading it with "
+                 << "the no-shift option.\n");
+
+  // The cameras. Each has the image name length, the name padded to 8
+  // bytes, then the focal length, world-to-camera rotation quaternion
+  // (w, x, y, z), camera center, and optical center.
+  size_t num_cams = h.num_cams;
+  seekSection(f, input_filename, h, 0, file_size);
+  cid_to_filename.resize(num_cams);
+  world_to_cam.resize(num_cams);
+  focal_lengths.resize(num_cams);
+  std::vector<Eigen::Vector2d> cid_to_offset(num_cams, Eigen::Vector2d(0, 0));
+  for (size_t cid = 0; cid < num_cams; cid++) {
+    uint64_t len = 0;
+    readVals(f, input_filename, &len, 1);
+    if (len > h.sizes[0])
+      vw::vw_throw(vw::IOErr() << "Corrupted binary NVM file: " << input_filename << ".\n");
+    std::string name(len + (8 - len % 8) % 8, '\0');
+    readVals(f, input_filename, &name[0], name.size());
+    name.resize(len);
+    double vals[10];
+    readVals(f, input_filename, vals, 10);
+    cid_to_filename[cid] = name;
+    focal_lengths[cid] = vals[0];
+    Eigen::Quaterniond q(vals[1], vals[2], vals[3], vals[4]);
+    Eigen::Vector3d c(vals[5], vals[6], vals[7]);
+    Eigen::Matrix3d r = q.matrix();
+    world_to_cam[cid].linear() = r;
+    world_to_cam[cid].translation() = -r * c;
+    cid_to_offset[cid] = Eigen::Vector2d(vals[8], vals[9]);
+    if (have_offsets) {
+      if (optical_centers.find(name) != optical_centers.end())
+        vw::vw_throw(vw::ArgumentErr() << "Repeated optical center entry for image: "
+                     << name << ".\n");
+      optical_centers[name] = cid_to_offset[cid];
+    }
+  }
+
+  // The keypoints. The number of keypoints for each image, then the
+  // keypoints of each image, as (x, y) pairs, in the order of an Eigen
+  // Matrix2Xd.
+  cid_to_keypoint_map.resize(num_cams);
+  for (size_t cid = 0; cid < num_cams; cid++)
+    cid_to_keypoint_map[cid].resize(Eigen::NoChange_t(), 0);
+  if (sections & NVM_KEYPOINTS) {
+    seekSection(f, input_filename, h, 1, file_size);
+    std::vector<uint64_t> counts(num_cams);
+    readVals(f, input_filename, &counts[0], num_cams);
+    uint64_t total = 0;
+    for (size_t cid = 0; cid < num_cams; cid++)
+      total += counts[cid];
+    if (8 * (num_cams + 2 * total) != h.sizes[1])
+      vw::vw_throw(vw::IOErr() << "Corrupted binary NVM file: " << input_filename << ".\n");
+    for (size_t cid = 0; cid < num_cams; cid++) {
+      cid_to_keypoint_map[cid].resize(Eigen::NoChange_t(), counts[cid]);
+      readVals(f, input_filename, cid_to_keypoint_map[cid].data(), 2 * counts[cid]);
+      if (add_offsets)
+        cid_to_keypoint_map[cid].colwise() += cid_to_offset[cid];
+    }
+  }
+
+  // The tracks. The number of observations in each track, padded to 8
+  // bytes, then the triangulated points, then the (cid, fid) pairs of all
+  // tracks.
+  if (sections & NVM_TRACKS) {
+    size_t num_points = h.num_points, num_obs = h.num_obs;
+    seekSection(f, input_filename, h, 2, file_size);
+    size_t num_sizes = num_points + num_points % 2;
+    if (4 * num_sizes + 24 * num_points + 8 * num_obs != h.sizes[2])
+      vw::vw_throw(vw::IOErr() << "Corrupted binary NVM file: " << input_filename << ".\n");
+    std::vector<uint32_t> track_sizes(num_sizes);
+    std::vector<int32_t> cid_fid(2 * num_obs);
+    pid_to_xyz.resize(num_points);
+    if (num_points > 0) {
+      readVals(f, input_filename, &track_sizes[0], num_sizes);
+      readVals(f, input_filename, pid_to_xyz[0].data(), 3 * num_points);
+    }
+    if (num_obs > 0)
+      readVals(f, input_filename, &cid_fid[0], 2 * num_obs);
+
+    pid_to_cid_fid.resize(num_points);
+    size_t pos = 0;
+    for (size_t pid = 0; pid < num_points; pid++) {
+      if (pos + track_sizes[pid] > num_obs)
+        vw::vw_throw(vw::IOErr() << "Corrupted binary NVM file: " << input_filename << ".\n");
+      auto & track = pid_to_cid_fid[pid]; // alias
+      for (size_t it = pos; it < pos + track_sizes[pid]; it++) {
+        int cid = cid_fid[2 * it], fid = cid_fid[2 * it + 1];
+        bool bad_fid = (fid < 0 ||
+                        ((sections & NVM_KEYPOINTS) && fid >= cid_to_keypoint_map[cid].cols()));
+        if (cid < 0 || cid >= int(num_cams) || bad_fid)
+          vw::vw_throw(vw::IOErr() << "Unable to correctly read PID: " << pid << ".\n");
+        track.insert(track.end(), std::make_pair(cid, fid));
+      }
+      pos += track_sizes[pid];
+    }
+  }
+}
+
+// Write a binary NVM file. See readBinaryNvm() for the layout.
+void writeBinaryNvm(std::vector<Eigen::Matrix2Xd>          const& cid_to_keypoint_map,
+                    std::vector<std::string>               const& cid_to_filename,
+                    std::vector<double>                    const& focal_lengths,
+                    std::vector<std::map<int, int>>        const& pid_to_cid_fid,
+                    std::vector<Eigen::Vector3d>           const& pid_to_xyz,
+                    std::vector<Eigen::Affine3d>           const& world_to_cam,
+                    std::map<std::string, Eigen::Vector2d> const& optical_centers,
+                    bool subtract_offsets,
+                    std::string const& output_filename) {
+
+  size_t num_cams = cid_to_filename.size();
+  if (num_cams != cid_to_keypoint_map.size())
+    vw::vw_throw(vw::ArgumentErr() << "Unequal number of filenames and keypoints.");
+  if (pid_to_cid_fid.size() != pid_to_xyz.size())
+    vw::vw_throw(vw::ArgumentErr()
+                 << "Unequal number of pid_to_cid_fid and xyz measurements.");
+  if (num_cams != world_to_cam.size())
+    vw::vw_throw(vw::ArgumentErr() << "Unequal number of filename and camera transforms.");
+  if (!focal_lengths.empty() && focal_lengths.size() != num_cams)
+    vw::vw_throw(vw::ArgumentErr() << "Unequal number of filenames and focal lengths.");
+
+  // The optical center of each image, if any
+  bool have_offsets = !optical_centers.empty();
+  if (subtract_offsets && !have_offsets)
+    vw::vw_throw(vw::ArgumentErr() << "Missing the optical center offsets.\n");
+  std::vector<Eigen::Vector2d> cid_to_offset(num_cams, Eigen::Vector2d(0, 0));
+  if (have_offsets) {
+    for (size_t cid = 0; cid < num_cams; cid++) {
+      auto map_it = optical_centers.find(cid_to_filename[cid]);
+      if (map_it == optical_centers.end())
+        vw::vw_throw(vw::ArgumentErr() << "Cannot find optical offset for image "
+                     << cid_to_filename[cid] << "\n");
+      cid_to_offset[cid] = map_it->second;
+    }
+  }
+
+  // Ensure that the output directory having this file exists
+  vw::create_out_dir(output_filename);
+  vw::vw_out() << "Writing: " << output_filename << std::endl;
+  std::ofstream f(output_filename, std::ios::out | std::ios::binary);
+  if (!f.good())
+    vw::vw_throw(vw::ArgumentErr() << "Cannot write file: " << output_filename << ".\n");
+
+  NvmBinaryHeader h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, NVM_BINARY_MAGIC, 8);
+  h.byte_order = NVM_BYTE_ORDER;
+  h.version    = NVM_BINARY_VERSION;
+  h.num_cams   = num_cams;
+  h.num_points = pid_to_cid_fid.size();
+  h.flags      = have_offsets ? NVM_HAS_OFFSETS : 0;
+  for (size_t pid = 0; pid < pid_to_cid_fid.size(); pid++)
+    h.num_obs += pid_to_cid_fid[pid].size();
+  writeVals(f, &h, 1); // a placeholder, to be overwritten at the end
+
+  // The cameras
+  pad8(f);
+  h.offsets[0] = f.tellp();
+  for (size_t cid = 0; cid < num_cams; cid++) {
+    std::string const& name = cid_to_filename[cid]; // alias
+    uint64_t len = name.size();
+    writeVals(f, &len, 1);
+    writeVals(f, name.c_str(), len);
+    pad8(f);
+    Eigen::Quaterniond q(world_to_cam[cid].rotation());
+    Eigen::Vector3d c = -world_to_cam[cid].rotation().inverse() * world_to_cam[cid].translation();
+    double focal = focal_lengths.empty() ? 1.0 : focal_lengths[cid];
+    double vals[10] = {focal, q.w(), q.x(), q.y(), q.z(), c[0], c[1], c[2],
+                       cid_to_offset[cid][0], cid_to_offset[cid][1]};
+    writeVals(f, vals, 10);
+  }
+  h.sizes[0] = uint64_t(f.tellp()) - h.offsets[0];
+
+  // The keypoints
+  h.offsets[1] = f.tellp();
+  std::vector<uint64_t> counts(num_cams);
+  for (size_t cid = 0; cid < num_cams; cid++)
+    counts[cid] = cid_to_keypoint_map[cid].cols();
+  writeVals(f, &counts[0], num_cams);
+  for (size_t cid = 0; cid < num_cams; cid++) {
+    if (subtract_offsets) {
+      Eigen::Matrix2Xd shifted = cid_to_keypoint_map[cid].colwise() - cid_to_offset[cid];
+      writeVals(f, shifted.data(), 2 * counts[cid]);
+    } else {
+      writeVals(f, cid_to_keypoint_map[cid].data(), 2 * counts[cid]);
+    }
+  }
+  h.sizes[1] = uint64_t(f.tellp()) - h.offsets[1];
+
+  // The tracks
+  h.offsets[2] = f.tellp();
+  size_t num_points = pid_to_cid_fid.size();
+  std::vector<uint32_t> track_sizes(num_points + num_points % 2, 0);
+  std::vector<int32_t> cid_fid;
+  cid_fid.reserve(2 * h.num_obs);
+  for (size_t pid = 0; pid < num_points; pid++) {
+    if (pid_to_cid_fid[pid].size() <= 1)
+      vw::vw_throw(vw::ArgumentErr() << "PID " << pid << " has "
+                   << pid_to_cid_fid[pid].size() << " measurements.");
+    track_sizes[pid] = pid_to_cid_fid[pid].size();
+    for (auto it = pid_to_cid_fid[pid].begin(); it != pid_to_cid_fid[pid].end(); it++) {
+      if (it->first < 0 || it->first >= int(num_cams) || it->second < 0 ||
+          it->second >= cid_to_keypoint_map[it->first].cols())
+        vw::vw_throw(vw::ArgumentErr() << "Invalid feature in track " << pid << ".\n");
+      cid_fid.push_back(it->first);
+      cid_fid.push_back(it->second);
+    }
+  }
+  if (!track_sizes.empty())
+    writeVals(f, &track_sizes[0], track_sizes.size());
+  if (num_points > 0)
+    writeVals(f, pid_to_xyz[0].data(), 3 * num_points);
+  if (!cid_fid.empty())
+    writeVals(f, &cid_fid[0], cid_fid.size());
+  h.sizes[2] = uint64_t(f.tellp()) - h.offsets[2];
+
+  // Now that the sections are known, write the header again
+  f.seekp(0);
+  writeVals(f, &h, 1);
+  if (!f.good())
+    vw::vw_throw(vw::IOErr() << "Failed to write: " << output_filename << ".\n");
+  f.close();
+}
+
 // A wrapper to carry fewer things around
 void readNvm(std::string const& input_filename, 
              bool nvm_no_shift,
              nvmData & nvm) {
+
+  if (isBinaryNvm(input_filename)) {
+    readBinaryNvm(input_filename, NVM_ALL, !nvm_no_shift,
+                  nvm.cid_to_keypoint_map, nvm.cid_to_filename, nvm.pid_to_cid_fid,
+                  nvm.pid_to_xyz, nvm.world_to_cam, nvm.focal_lengths,
+                  nvm.optical_centers);
+    // If no offsets, use zero offsets
+    if (nvm_no_shift) {
+      for (size_t cid = 0; cid < nvm.cid_to_filename.size(); cid++)
+        nvm.optical_centers[nvm.cid_to_filename[cid]] = Eigen::Vector2d(0, 0);
+    }
+    return;
+  }
+
   readNvm(input_filename,
           nvm_no_shift,
           nvm.cid_to_keypoint_map,
@@ -323,6 +660,15 @@ void readNvm(std::string const& input_filename,
 
 // A wrapper for writing an nvm file
 void writeNvm(nvmData const& nvm, std::string const& output_filename) {
+
+  if (isBinaryNvm(output_filename)) {
+    bool subtract_offsets = true;
+    writeBinaryNvm(nvm.cid_to_keypoint_map, nvm.cid_to_filename, nvm.focal_lengths,
+                   nvm.pid_to_cid_fid, nvm.pid_to_xyz, nvm.world_to_cam,
+                   nvm.optical_centers, subtract_offsets, output_filename);
+    return;
+  }
+
   writeNvm(nvm.cid_to_keypoint_map,
           nvm.cid_to_filename,
           nvm.focal_lengths,
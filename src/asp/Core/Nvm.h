@@ -55,13 +55,56 @@ struct nvmData {
 void readNvmOffsets(std::string const& offset_path,
                     std::map<std::string, Eigen::Vector2d> & offsets);
 
-// Read an NVM file. Any offset is applied upon reading.
+// Read an NVM file. Any offset is applied upon reading. If the file is
+// binary (extension .nvmb), the offsets are read from it.
 void readNvm(std::string const& input_filename, bool nvm_no_shift, nvmData & nvm);
 
 // Write an NVM file. Subtract from the interest points the given offset.
-// The offsets are saved in a separate file.
+// The offsets are saved in a separate file, or in the file itself if it is
+// binary (extension .nvmb).
 void writeNvm(nvmData const& nvm, std::string const& output_filename);
 
+// Sections of a binary NVM file. The cameras are always read. The other
+// sections are read only if asked for.
+enum NvmSection {
+  NVM_CAMERAS   = 1, // image names, focal lengths, poses, and optical centers
+  NVM_KEYPOINTS = 2, // the interest points of each image
+  NVM_TRACKS    = 4, // the triangulated points and their (cid, fid) pairs
+  NVM_ALL       = NVM_CAMERAS | NVM_KEYPOINTS | NVM_TRACKS
+};
+
+// If this is the name of a binary NVM file, so it has the .nvmb extension
+bool isBinaryNvm(std::string const& filename);
+
+// Read a binary NVM file. The optical centers are stored in the file, if at
+// all, rather than in a separate file. If add_offsets is true, they must
+// exist, and are added to the interest points. Otherwise the interest points
+// are as stored. The keypoints and tracks are read only if in 'sections'.
+// Otherwise the keypoints have no columns and there are no tracks.
+void readBinaryNvm(std::string const& input_filename, int sections, bool add_offsets,
+                   std::vector<Eigen::Matrix2Xd>          & cid_to_keypoint_map,
+                   std::vector<std::string>               & cid_to_filename,
+                   std::vector<std::map<int, int>>        & pid_to_cid_fid,
+                   std::vector<Eigen::Vector3d>           & pid_to_xyz,
+                   std::vector<Eigen::Affine3d>           & world_to_cam,
+                   std::vector<double>                    & focal_lengths,
+                   std::map<std::string, Eigen::Vector2d> & optical_centers);
+
+// Write a binary NVM file. If the optical centers are not empty, there must
+// be one for each image, and they are stored in the file. If subtract_offsets
+// is true, they are subtracted from the interest points on writing.
+// Otherwise the interest points are written as they are. If focal_lengths is
+// empty, the focal length of each camera is set to 1.
+void writeBinaryNvm(std::vector<Eigen::Matrix2Xd>          const& cid_to_keypoint_map,
+                    std::vector<std::string>               const& cid_to_filename,
+                    std::vector<double>                    const& focal_lengths,
+                    std::vector<std::map<int, int>>        const& pid_to_cid_fid,
+                    std::vector<Eigen::Vector3d>           const& pid_to_xyz,
+                    std::vector<Eigen::Affine3d>           const& world_to_cam,
+                    std::map<std::string, Eigen::Vector2d> const& optical_centers,
+                    bool subtract_offsets,
+                    std::string const& output_filename);
+
 // Read an NVM file into the VisionWorkbench control network format. The flag
 // nvm_no_shift, if true, means that the interest points are not shifted
 // relative to the optical center, so can be read as is.
@@ -28,6 +28,7 @@
 #include <vw/Image/Algorithms.h>
 #include <vw/Image/BlockRasterize.h>
 #include <vw/Core/ThreadPool.h>
+#include <vw/Core/StringUtils.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/BBox.h>
 #include <vw/Math/Statistics.h>
@@ -36,10 +37,13 @@
 
 #include <asp/Core/SoftwareRenderer.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/MedianFilter.h>
+#include <asp/Core/Tracing.h>
 #include <boost/foreach.hpp>
 #include <boost/math/special_functions/next.hpp>
 #include <asp/Core/OrthoRasterizer.h>
 #include <valarray>
+#include <algorithm>
 
 namespace asp{
 
@@ -271,33 +275,27 @@ namespace asp{
     if (half <= 0 || thresh <= 0)
       return;
 
-    int nc = image.cols(), nr = image.rows(); // shorten
     double nan = std::numeric_limits<double>::quiet_NaN();
 
-    ImageView<Vector3> image_out = copy(image);
+    // The median of the valid heights in the window around each pixel
+    ImageView<double> heights(image.cols(), image.rows()), median;
+    for (int row = 0; row < image.rows(); row++) {
+      for (int col = 0; col < image.cols(); col++)
+        heights(col, row) = image(col, row).z();
+    }
+    asp::median_filter_nodata(heights, half, median);
 
-    for (int col = 0; col < image.cols(); col++){
-      for (int row = 0; row < image.rows(); row++){
+    for (int row = 0; row < image.rows(); row++){
+      for (int col = 0; col < image.cols(); col++){
 
-        if (boost::math::isnan(image(col, row).z()))
+        if (boost::math::isnan(heights(col, row)))
           continue;
 
-        std::vector<double> vals;
-        for (int c = std::max(col-half, 0); c <= std::min(col+half, nc-1); c++){
-          for (int r = std::max(row-half, 0); r <= std::min(row+half, nr-1); r++){
-            if (boost::math::isnan(image(c, r).z()))
-              continue;
-            vals.push_back(image(c, r).z());
-          }
-        }
-        double median = vw::math::destructive_median(vals);
-        if (fabs(median - image(col, row).z()) > thresh){
-          image_out(col, row).z() = nan;
+        if (fabs(median(col, row) - heights(col, row)) > thresh){
+          image(col, row).z() = nan;
         }
       }
     }
-
-    image = copy(image_out);
   }
 
   // TODO: This function should live somewhere else!
@@ -358,6 +356,12 @@ namespace asp{
       image = copy(buffer);
   }
 
+  // Convert a VW box to a box the R-tree can use
+  RtreeBox3 toRtreeBox(BBox3 const& box) {
+    return RtreeBox3(RtreePoint3(box.min().x(), box.min().y(), box.min().z()),
+                     RtreePoint3(box.max().x(), box.max().y(), box.max().z()));
+  }
+
   // Given a histogram as a vector of counts, based on binning values
   // in the interval [0, max_val] with n bins, find a given percentile
   // error. Here, pct is in [0, 100].
@@ -417,7 +421,7 @@ namespace asp{
     m_median_filter_params(median_filter_params), m_erode_len(erode_len),
     m_default_grid_size_multiplier(default_grid_size_multiplier),
     m_num_invalid_pixels(num_invalid_pixels),
-    m_count_mutex(count_mutex){
+    m_count_mutex(count_mutex), m_occupancy_cols(0), m_occupancy_rows(0) {
 
     *m_num_invalid_pixels = 0; // Init counter
     set_texture(texture.impl());
@@ -498,6 +502,24 @@ namespace asp{
 
     VW_OUT(DebugMessage,"asp") << "Point cloud boundary is " << m_bbox << "\n";
 
+    // Bulk-load the R-tree of block boundaries. The packing algorithm
+    // invoked by the range constructor produces a better tree than
+    // inserting the boxes one at a time. The boundaries were found in
+    // parallel, so sort them first to make the order deterministic.
+    std::sort(m_point_image_boundaries.begin(), m_point_image_boundaries.end(),
+              [](BBoxPair const& a, BBoxPair const& b) {
+                if (a.second.min().y() != b.second.min().y())
+                  return a.second.min().y() < b.second.min().y();
+                return a.second.min().x() < b.second.min().x();
+              });
+    {
+      std::vector<RtreeValue> values;
+      values.reserve(m_point_image_boundaries.size());
+      for (size_t i = 0; i < m_point_image_boundaries.size(); i++)
+        values.push_back(std::make_pair(toRtreeBox(m_point_image_boundaries[i].first), i));
+      m_boundaries_tree = boost::shared_ptr<BBoxRtree>(new BBoxRtree(values));
+    }
+
     if (outlier_removal_method != NO_OUTLIER_REMOVAL_METHOD) {
 
       // Per user request, find some error percentiles to print.
@@ -602,7 +624,9 @@ namespace asp{
       m_default_spacing = std::max(m_default_spacing_x, m_default_spacing_y);
     }
 
-    // Set the sampling rate (i.e. spacing between pixels)
+    // Set the sampling rate (i.e. spacing between pixels). The snapped box
+    // is not known yet, so wipe it, to not compute the occupancy here.
+    m_snapped_bbox = BBox3();
     this->set_spacing(spacing);
     VW_OUT(DebugMessage,"asp") << "Pixel spacing is " << m_spacing << " pnt/px\n";
 
@@ -625,8 +649,77 @@ namespace asp{
       subvector(m_snapped_bbox.max(), 0, 2) = m_projwin.max();
     }
 
+    compute_occupancy();
+    
   } // End function initialize_spacing()
 
+  // Mark the cells of the output grid which may receive points. A cloud
+  // block's box is converted to output pixels, using the inverse of
+  // pixel_to_point_bbox(), then grown by the expansion done in
+  // prerasterize() and a pixel more, to be conservative.
+  void OrthoRasterizerView::compute_occupancy() {
+
+    int num_cols = cols(), num_rows = rows();
+    m_occupancy_cols = (num_cols + OCCUPANCY_CELL_SIZE - 1) / OCCUPANCY_CELL_SIZE;
+    m_occupancy_rows = (num_rows + OCCUPANCY_CELL_SIZE - 1) / OCCUPANCY_CELL_SIZE;
+    m_occupancy.assign(size_t(m_occupancy_cols) * size_t(m_occupancy_rows), 0);
+
+    int d   = (int)m_use_surface_sampling;
+    int pad = (int)ceil(std::max(m_search_radius_factor, 5.0)) + 1;
+    double x0 = m_snapped_bbox.min().x(), y0 = m_snapped_bbox.min().y();
+
+    for (size_t it = 0; it < m_point_image_boundaries.size(); it++) {
+      BBox3 const& box = m_point_image_boundaries[it].first;
+      if (box.empty())
+        continue;
+      double min_col = floor((box.min().x() - x0)/m_spacing) + d - pad;
+      double max_col = ceil ((box.max().x() - x0)/m_spacing) + d + pad;
+      double min_row = floor(num_rows - d - (box.max().y() - y0)/m_spacing) - pad;
+      double max_row = ceil (num_rows - d - (box.min().y() - y0)/m_spacing) + pad;
+
+      // Clamp to the grid, in double precision, to avoid integer overflow
+      min_col = std::max(min_col, 0.0); max_col = std::min(max_col, num_cols - 1.0);
+      min_row = std::max(min_row, 0.0); max_row = std::min(max_row, num_rows - 1.0);
+      if (min_col > max_col || min_row > max_row)
+        continue;
+
+      for (int r = int(min_row)/OCCUPANCY_CELL_SIZE; r <= int(max_row)/OCCUPANCY_CELL_SIZE; r++) {
+        for (int c = int(min_col)/OCCUPANCY_CELL_SIZE; c <= int(max_col)/OCCUPANCY_CELL_SIZE;
+             c++)
+          m_occupancy[size_t(r) * m_occupancy_cols + c] = 1;
+      }
+    }
+  }
+
+  // Return true if any cell overlapping the given box of output pixels may
+  // receive points.
+  bool OrthoRasterizerView::is_occupied(BBox2i const& bbox) const {
+
+    BBox2i box = bbox;
+    box.crop(BBox2i(0, 0, cols(), rows()));
+    if (box.empty() || m_occupancy.empty())
+      return true; // be conservative
+
+    for (int r = box.min().y()/OCCUPANCY_CELL_SIZE;
+         r <= (box.max().y() - 1)/OCCUPANCY_CELL_SIZE && r < m_occupancy_rows; r++) {
+      for (int c = box.min().x()/OCCUPANCY_CELL_SIZE;
+           c <= (box.max().x() - 1)/OCCUPANCY_CELL_SIZE && c < m_occupancy_cols; c++) {
+        if (m_occupancy[size_t(r) * m_occupancy_cols + c])
+          return true;
+      }
+    }
+    return false;
+  }
+
+  // The value for output pixels with no data
+  double OrthoRasterizerView::min_value() const {
+    if (m_use_alpha)
+      return std::numeric_limits<float>::min(); // use this dummy value to denote transparency
+    if (m_minz_as_default)
+      return m_snapped_bbox.min().z();
+    return m_default_value;
+  }
+
   // Function to convert pixel coordinates to the point domain
   BBox3 OrthoRasterizerView::pixel_to_point_bbox( BBox2 const& inbox ) const {
     BBox3 outbox = m_snapped_bbox;
@@ -642,15 +735,119 @@ namespace asp{
     return outbox;
   }
 
+  // Find the indices of the point image boundaries whose 3D boxes
+  // intersect the given box.
+  void OrthoRasterizerView::query_boundaries(BBox3 const& box,
+                                             std::vector<size_t> & indices) const {
+    indices.clear();
+    if (box.empty() || m_boundaries_tree.get() == NULL)
+      return;
+
+    std::vector<RtreeValue> candidates;
+    m_boundaries_tree->query(boost::geometry::index::intersects(toRtreeBox(box)),
+                             std::back_inserter(candidates));
+
+    // The R-tree treats boxes as closed, which may differ from how
+    // BBox3::intersects() handles touching boxes. Apply the latter to the
+    // candidates, to get the same answer as an exhaustive search.
+    for (size_t it = 0; it < candidates.size(); it++) {
+      size_t index = candidates[it].second;
+      if (box.intersects(m_point_image_boundaries[index].first))
+        indices.push_back(index);
+    }
+
+    // Keep the original order of the boundaries
+    std::sort(indices.begin(), indices.end());
+  }
+
+  void OrthoRasterizerView::set_extra_textures(std::vector<ImageViewRef<double>> const&
+                                               textures) {
+    m_extra_textures.clear();
+    for (size_t it = 0; it < textures.size(); it++) {
+      VW_ASSERT(textures[it].cols() == m_point_image.cols() &&
+                textures[it].rows() == m_point_image.rows(),
+                ArgumentErr() << "Orthorasterizer: set_extra_textures() failed."
+                << " Texture dimensions must match point image dimensions.");
+      m_extra_textures.push_back(channel_cast<float>(textures[it]));
+    }
+  }
+
   /// \cond INTERNAL
   OrthoRasterizerView::prerasterize_type
   OrthoRasterizerView::prerasterize(BBox2i const& bbox) const {
 
-    BBox2i bbox_1 = bbox;
+    BBox2i bbox_1;
+    ImageView<pixel_type> result;
+    std::vector<ImageView<pixel_type>> extra_results;
+    bool with_extras = false;
+    rasterize_tile(bbox, with_extras, bbox_1, result, extra_results);
+
+    return prerasterize_type(result,
+                             BBox2i(-bbox_1.min().x(), -bbox_1.min().y(), cols(), rows()));
+  }
+  /// \endcond
+
+  // Record with the profiler, if set, the time spent on a tile and the
+  // amount of data processed, when going out of scope.
+  struct TileProfile {
+    boost::shared_ptr<RunProfiler> profiler;
+    BBox2i box;
+    double wall_time, cpu_time;
+    std::int64_t cloud_pixels, points_binned;
+    
+    TileProfile(boost::shared_ptr<RunProfiler> profiler_in, BBox2i const& box_in):
+      profiler(profiler_in), box(box_in), wall_time(0), cpu_time(0),
+      cloud_pixels(0), points_binned(0) {
+      if (profiler) {
+        wall_time = wallTime();
+        cpu_time  = threadCpuTime();
+      }
+    }
+    ~TileProfile() {
+      if (profiler)
+        profiler->addTile(box, wallTime() - wall_time, threadCpuTime() - cpu_time,
+                          cloud_pixels, points_binned);
+    }
+  };
+
+  void OrthoRasterizerView::rasterize_tile(BBox2i const& bbox, bool with_extras,
+                                           BBox2i & bbox_1,
+                                           ImageView<pixel_type> & result,
+                                           std::vector<ImageView<pixel_type>>
+                                           & extra_results) const {
+
+    int num_extra = with_extras ? m_extra_textures.size() : 0;
+    if (num_extra > 0 && m_use_surface_sampling)
+      vw_throw(ArgumentErr() << "Orthorasterizer: Cannot grid extra textures "
+               << "with surface sampling.\n");
+    extra_results.resize(num_extra);
+    TileProfile tile_profile(m_profiler, bbox);
+    asp::TraceSpan trace_span("ortho_tile", "tile",
+                              [&bbox]() { return vw::stringify(bbox); });
+    
+    bbox_1 = bbox;
     
     // bugfix, ensure we see enough beyond current tile
     bbox_1.expand((int)ceil(std::max(m_search_radius_factor, 5.0)));
 
+    // Set up the default color value
+    double min_val = min_value();
+
+    // Fast path. If no point cloud block can contribute to this tile,
+    // return no-data right away, without setting up the gridding or
+    // touching the cloud.
+    if (!is_occupied(bbox)) {
+      { // Lock and update the total number of invalid pixels in this tile.
+        vw::Mutex::Lock lock(*m_count_mutex);
+        (*m_num_invalid_pixels) += std::int64_t(bbox.width())*std::int64_t(bbox.height());
+      }
+      result.set_size(bbox_1.width(), bbox_1.height());
+      fill(result, pixel_type(min_val));
+      for (int e = 0; e < num_extra; e++)
+        extra_results[e] = copy(result);
+      return;
+    }
+
     // Used to find which polygons are actually in the draw space.
     BBox3 local_3d_bbox = pixel_to_point_bbox(bbox_1);
 
@@ -685,18 +882,20 @@ namespace asp{
                                m_spacing, m_default_spacing,
                                search_radius, m_sigma_factor,
                                m_filter, m_percentile);
-    
-    // Set up the default color value
-    double min_val = 0.0;
-    if (m_use_alpha) {
-      // use this dummy value to denote transparency
-      min_val = std::numeric_limits<float>::min();
-    } else if (m_minz_as_default) {
-      min_val = m_snapped_bbox.min().z();
-    } else {
-      min_val = m_default_value;
-    }
 
+    // The extra textures get gridded at the same points, each with its
+    // own grid. Size the buffers first, as the grids keep references to them.
+    std::vector<ImageView<double>> extra_d_buffers(num_extra), extra_weights(num_extra);
+    std::vector<boost::shared_ptr<asp::Point2Grid>> extra_grids(num_extra);
+    for (int e = 0; e < num_extra; e++)
+      extra_grids[e].reset(new asp::Point2Grid(bbox_1.width(), bbox_1.height(),
+                                               extra_d_buffers[e], extra_weights[e],
+                                               local_3d_bbox.min().x(),
+                                               local_3d_bbox.min().y(),
+                                               m_spacing, m_default_spacing,
+                                               search_radius, m_sigma_factor,
+                                               m_filter, m_percentile));
+    
     std::valarray<float> vertices(10), intensities(5);
 
     if (m_use_surface_sampling){
@@ -707,6 +906,8 @@ namespace asp{
       renderer.SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[0]);
     }else{
       point2grid.Clear(min_val);
+      for (int e = 0; e < num_extra; e++)
+        extra_grids[e]->Clear(min_val);
     }
 
     // For each block in the DEM space intersecting local_3d_bbox,
@@ -717,11 +918,10 @@ namespace asp{
     typedef std::map<BBox2i, BBox2i, compare_bboxes> BlockMapType;
     typedef BlockMapType::iterator MapIterType;
     BlockMapType blocks_map;
-    BOOST_FOREACH( BBoxPair const& boundary, m_point_image_boundaries ) {
-      if (! local_3d_bbox.intersects(boundary.first) )
-        continue;
-
-      BBox2i pc_block = boundary.second;
+    std::vector<size_t> boundary_indices;
+    query_boundaries(local_3d_bbox, boundary_indices);
+    for (size_t k = 0; k < boundary_indices.size(); k++) {
+      BBox2i pc_block = m_point_image_boundaries[boundary_indices[k]].second;
 
       BBox2i snapped_block;
       snapped_block.min() = m_block_size*floor(pc_block.min()/double(m_block_size));
@@ -744,13 +944,13 @@ namespace asp{
         (*m_num_invalid_pixels) += std::int64_t(bbox.width())*std::int64_t(bbox.height());
       }
       
-      if (m_use_surface_sampling){
-        return prerasterize_type(render_buffer, BBox2i(-bbox_1.min().x(),
-                                                       -bbox_1.min().y(), cols(), rows()));
-      }else{
-        return prerasterize_type(d_buffer, BBox2i(-bbox_1.min().x(),
-                                                  -bbox_1.min().y(), cols(), rows()) );
-      }
+      if (m_use_surface_sampling)
+        result = pixel_cast<pixel_type>(render_buffer);
+      else
+        result = pixel_cast<pixel_type>(channel_cast<float>(d_buffer));
+      for (int e = 0; e < num_extra; e++)
+        extra_results[e] = copy(result);
+      return;
     }
 
     // This is very important. When doing surface sampling, for each
@@ -771,6 +971,7 @@ namespace asp{
       biased_block.expand(bias);
       biased_block.crop(vw::bounding_box(m_point_image));
       ImageView<Vector3> point_copy = crop(m_point_image, biased_block);
+      tile_profile.cloud_pixels += std::int64_t(biased_block.width()) * biased_block.height();
 
       remove_outliers(point_copy, m_error_image, m_error_cutoff, biased_block);
       filter_by_median(point_copy, m_median_filter_params);
@@ -780,6 +981,9 @@ namespace asp{
       point_copy = crop(point_copy, block - biased_block.min());
 
       ImageView<float> texture_copy = crop(m_texture, block );
+      std::vector<ImageView<float>> extra_copies(num_extra);
+      for (int e = 0; e < num_extra; e++)
+        extra_copies[e] = crop(m_extra_textures[e], block);
 
       typedef ImageView<Vector3>::pixel_accessor PointAcc;
       PointAcc row_acc = point_copy.origin();
@@ -815,6 +1019,7 @@ namespace asp{
               intensities[3] = texture_copy(col+1,row);
               intensities[4] = texture_copy(col,row);
 
+              tile_profile.points_binned++;
               if (!boost::math::isnan((*point_ll).z())) {
                 // triangle 1 is: UL LL LR
                 renderer.DrawPolygon(0, 3);
@@ -832,6 +1037,11 @@ namespace asp{
               point2grid.AddPoint(point_copy(col, row).x(),
                                   point_copy(col, row).y(),
                                   texture_copy(col,  row));
+              tile_profile.points_binned++;
+              for (int e = 0; e < num_extra; e++)
+                extra_grids[e]->AddPoint(point_copy(col, row).x(),
+                                         point_copy(col, row).y(),
+                                         extra_copies[e](col, row));
             }
           }
           point_ul.next_col();
@@ -841,18 +1051,22 @@ namespace asp{
 
     }
 
-    if (!m_use_surface_sampling)
+    if (!m_use_surface_sampling) {
       point2grid.normalize();
+      for (int e = 0; e < num_extra; e++)
+        extra_grids[e]->normalize();
+    }
 
     // The software renderer returns an image which will render
     // upside down in most image formats, so we correct that here.
     // We also introduce transparent pixels into the result where necessary.
     // TODO: Here can do flipping in place.
-    ImageView<PixelGray<float>> result;
     if (m_use_surface_sampling)
       result = flip_vertical(render_buffer);
     else
       result = flip_vertical(d_buffer);
+    for (int e = 0; e < num_extra; e++)
+      extra_results[e] = flip_vertical(extra_d_buffers[e]);
 
     // Loop through result here and count up how many pixels have been
     // changed from the default value.
@@ -872,10 +1086,32 @@ namespace asp{
       vw::Mutex::Lock lock(*m_count_mutex);
       (*m_num_invalid_pixels) += num_unset;
     }
+  }
 
-    return prerasterize_type(result,
+  /// \cond INTERNAL
+  FusedOrthoRasterizerView::prerasterize_type
+  FusedOrthoRasterizerView::prerasterize(BBox2i const& bbox) const {
+
+    BBox2i bbox_1;
+    ImageView<PixelGray<float>> result;
+    std::vector<ImageView<PixelGray<float>>> extra_results;
+    bool with_extras = true;
+    m_rasterizer.rasterize_tile(bbox, with_extras, bbox_1, result, extra_results);
+
+    // Put all results as planes of one image
+    ImageView<float> fused(result.cols(), result.rows(), planes());
+    for (int row = 0; row < fused.rows(); row++) {
+      for (int col = 0; col < fused.cols(); col++) {
+        fused(col, row, 0) = result(col, row).v();
+        for (size_t e = 0; e < extra_results.size(); e++)
+          fused(col, row, e + 1) = extra_results[e](col, row).v();
+      }
+    }
+
+    return prerasterize_type(fused,
                              BBox2i(-bbox_1.min().x(), -bbox_1.min().y(), cols(), rows()));
   }
+  /// \endcond
 
   // Return the affine georeferencing transform.
   vw::Matrix<double,3,3> OrthoRasterizerView::geo_transform() {
@@ -31,6 +31,11 @@
 #include <vw/Math/Vector.h>
 #include <vw/Math/BBox.h>
 #include <asp/Core/Point2Grid.h>
+#include <asp/Core/ProfileUtils.h>
+
+#include <boost/geometry.hpp>
+#include <boost/geometry/index/rtree.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace asp{
 
@@ -41,6 +46,14 @@ namespace asp{
 
   typedef std::pair<BBox3, BBox2i> BBoxPair;
 
+  // An R-tree over the 3D point cloud block boxes. Each value stores the
+  // index of the block in the list of point image boundaries.
+  typedef boost::geometry::model::point<double, 3, boost::geometry::cs::cartesian> RtreePoint3;
+  typedef boost::geometry::model::box<RtreePoint3> RtreeBox3;
+  typedef std::pair<RtreeBox3, size_t> RtreeValue;
+  typedef boost::geometry::index::rtree<RtreeValue, boost::geometry::index::rstar<16>>
+    BBoxRtree;
+
   /// Given a point image and corresponding texture, this class
   /// bins and averages the point cloud on a regular grid over the [x,y]
   /// plane of the point image; producing an evenly sampled ortho-image
@@ -49,6 +62,7 @@ namespace asp{
     public ImageViewBase<OrthoRasterizerView> {
     ImageViewRef<Vector3> m_point_image;
     ImageViewRef<float>   m_texture;
+    std::vector<ImageViewRef<float>> m_extra_textures; // gridded with m_texture if fused
     BBox3   m_bbox, m_snapped_bbox; // bounding box of point cloud
     double  m_spacing;         // point cloud units (usually m or deg) per pixel
     double  m_default_spacing; // if user did not specify spacing
@@ -71,15 +85,35 @@ namespace asp{
     double m_default_grid_size_multiplier;
     std::int64_t * m_num_invalid_pixels; ///< Keep a count of nodata output pixels, needs to be pointer due to VW weirdness.
     vw::Mutex  *m_count_mutex;        ///< A lock for m_num_invalid_pixels, needs to be pointer due to C++ weirdness.
+    boost::shared_ptr<RunProfiler> m_profiler; ///< If set, record the time for each tile
 
-    // We could actually use a quadtree here .. but this should be a
-    // good enough improvement.
     std::vector<BBoxPair> m_point_image_boundaries;
     // These boundaries describe a point cloud 3D boundaries and then
     // their location in the the point cloud image. These boxes are
     // overlapping in the pc image X/Y domain to insure that
     // everything is triangulated.
 
+    // A bulk-loaded R-tree over the 3D boxes in m_point_image_boundaries,
+    // so that each output tile finds its candidate blocks without scanning
+    // all of them. Shared, as this view gets copied around.
+    boost::shared_ptr<BBoxRtree> m_boundaries_tree;
+
+    // Find the indices of the point image boundaries whose 3D boxes
+    // intersect the given box.
+    void query_boundaries(BBox3 const& box, std::vector<size_t> & indices) const;
+
+    // For each cell of OCCUPANCY_CELL_SIZE x OCCUPANCY_CELL_SIZE output
+    // pixels, if any point cloud block may contribute to it. Tiles touching
+    // only empty cells are written as no-data without reading the cloud.
+    std::vector<unsigned char> m_occupancy;
+    int m_occupancy_cols, m_occupancy_rows;
+    static const int OCCUPANCY_CELL_SIZE = 64;
+    void compute_occupancy();
+    bool is_occupied(BBox2i const& bbox) const;
+
+    // The value for output pixels with no data
+    double min_value() const;
+
     // Function to convert pixel coordinates to the point domain
     BBox3 pixel_to_point_bbox( BBox2 const& px ) const;
 
@@ -139,6 +173,20 @@ namespace asp{
       return pixel_type();
     }
 
+    /// Textures which, besides the main one, are gridded in the same pass
+    /// over the point cloud, with FusedOrthoRasterizerView. These must have
+    /// the same dimensions as the point image. Does not work with surface
+    /// sampling.
+    void set_extra_textures(std::vector<ImageViewRef<double>> const& textures);
+    int num_extra_textures() const { return m_extra_textures.size(); }
+
+    /// Grid the given tile, with the main texture, and with the extra ones
+    /// if with_extras is true. The results are for the expanded tile
+    /// bbox_1, which is returned as well.
+    void rasterize_tile(BBox2i const& bbox, bool with_extras, BBox2i & bbox_1,
+                        ImageView<pixel_type> & result,
+                        std::vector<ImageView<pixel_type>> & extra_results) const;
+
     /// \cond INTERNAL
     typedef CropView<ImageView<pixel_type> > prerasterize_type;
     prerasterize_type prerasterize( BBox2i const& bbox ) const;
@@ -148,6 +196,7 @@ namespace asp{
     }
     /// \endcond
 
+    void set_profiler(boost::shared_ptr<RunProfiler> profiler) { m_profiler = profiler; }
     void set_use_alpha          (bool   val) { m_use_alpha       = val; }
     void set_use_minz_as_default(bool   val) { m_minz_as_default = val; }
     void set_default_value      (double val) { m_default_value   = val; }
@@ -168,6 +217,10 @@ namespace asp{
         m_spacing = val;
       }
 
+      // The grid changed, so the occupancy must be recomputed. This is
+      // skipped if the bounding box is not known yet.
+      if (!m_snapped_bbox.empty())
+        compute_occupancy();
     }
 
     double spacing() const { return m_spacing; }
@@ -193,6 +246,43 @@ namespace asp{
     
   };
 
+  /// Grid the main texture and the extra textures of an OrthoRasterizerView
+  /// in one pass over the point cloud, rather than reading and filtering the
+  /// cloud once for each. Plane 0 is the main texture, usually the height,
+  /// and plane k is extra texture k - 1.
+  class FusedOrthoRasterizerView:
+    public ImageViewBase<FusedOrthoRasterizerView> {
+    OrthoRasterizerView m_rasterizer;
+
+  public:
+    typedef float pixel_type;
+    typedef const float result_type;
+    typedef ProceduralPixelAccessor<FusedOrthoRasterizerView> pixel_accessor;
+
+    FusedOrthoRasterizerView(OrthoRasterizerView const& rasterizer):
+      m_rasterizer(rasterizer) {}
+
+    inline int32 cols() const { return m_rasterizer.cols(); }
+    inline int32 rows() const { return m_rasterizer.rows(); }
+    inline int32 planes() const { return 1 + m_rasterizer.num_extra_textures(); }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( int /*i*/, int /*j*/, int /*p*/=0 ) const {
+      vw_throw(NoImplErr() << "FusedOrthoRasterizerView::operator() has not been implemented.");
+      return pixel_type();
+    }
+
+    /// \cond INTERNAL
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    prerasterize_type prerasterize( BBox2i const& bbox ) const;
+
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+    /// \endcond
+  };
+
   /// Snaps the coordinates of a BBox to a grid spacing
   template <size_t N>
   void snap_bbox(const double spacing, BBox<double, N> &bbox ) {
@@ -20,6 +20,19 @@
 #include <vw/Image/Statistics.h>
 #include <vw/Math/Statistics.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/Settings.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace fs = boost::filesystem;
 
 using namespace vw;
 
@@ -62,34 +75,15 @@ void estimate_inliers_bbox(double pct_factor_x, double pct_factor_y, double pct_
 
 // Get a generous estimate of the bounding box of the current set
 // while excluding outliers
-void estimate_points_bdbox(vw::ImageViewRef<vw::Vector3> const& proj_points,
-                           vw::ImageViewRef<double> const& error_image,
+void estimate_points_bdbox(std::vector<double> const& x_vals,
+                           std::vector<double> const& y_vals,
+                           std::vector<double> const& z_vals,
                            vw::Vector2 const& remove_outliers_params,
-                           double estim_max_error,
                            vw::BBox3 & inliers_bbox) {
 
   // TODO(oalexan1): Here it may help to do several passes. First throw out the worst
   // outliers, then estimate the box from the remaining points, etc.
   
-  std::vector<double> x_vals, y_vals, z_vals;
-  for (int col = 0; col < proj_points.cols(); col++){
-    for (int row = 0; row < proj_points.rows(); row++){
-
-      // Avoid points marked as not valid
-      Vector3 P = proj_points(col, row);
-      if (P != P)
-        continue;
-
-      // Make use of the estimated error, if available
-      if (estim_max_error > 0 && error_image(col, row) > estim_max_error) 
-        continue;
-
-      x_vals.push_back(P.x());
-      y_vals.push_back(P.y());
-      z_vals.push_back(P.z());
-    }
-  }
-
   double pct_factor     = remove_outliers_params[0]/100.0; // e.g., 0.75
   double outlier_factor = remove_outliers_params[1];       // e.g., 3.0.
 
@@ -112,6 +106,94 @@ void estimate_points_bdbox(vw::ImageViewRef<vw::Vector3> const& proj_points,
   return;
 }
 
+// The samples of the cloud and error image collected by one task. The
+// errors are kept for all positive values, and separately for each valid
+// point, as the points with large error are excluded later.
+struct ErrorBoxSamples {
+  std::vector<double> errors;
+  std::vector<double> x_vals, y_vals, z_vals, pt_errors;
+};
+
+// Sample a range of rows of the subsampled cloud and error image. Each task
+// fills its own samples, which are merged at the end, so the result does not
+// depend on the number of threads.
+class ErrorBoxSampleTask: public vw::Task, private boost::noncopyable {
+  vw::ImageViewRef<vw::Vector3> m_points;
+  vw::ImageViewRef<double>      m_errors;
+  int                           m_beg_row, m_end_row;
+  ErrorBoxSamples             & m_samples;
+  vw::Mutex                   & m_mutex;
+  vw::ProgressCallback const  & m_progress;
+  double                        m_inc_amt;
+
+public:
+  ErrorBoxSampleTask(vw::ImageViewRef<vw::Vector3> points,
+                     vw::ImageViewRef<double> errors,
+                     int beg_row, int end_row, ErrorBoxSamples & samples,
+                     vw::Mutex & mutex, vw::ProgressCallback const& progress,
+                     double inc_amt):
+    m_points(points), m_errors(errors), m_beg_row(beg_row), m_end_row(end_row),
+    m_samples(samples), m_mutex(mutex), m_progress(progress), m_inc_amt(inc_amt) {}
+
+  void operator()() {
+    bool has_errors = (m_errors.cols() > 0 && m_errors.rows() > 0);
+    for (int row = m_beg_row; row < m_end_row; row++) {
+      for (int col = 0; col < m_points.cols(); col++) {
+
+        double err = 0.0;
+        if (has_errors) {
+          err = m_errors(col, row);
+          // Don't add zero errors, those most likely came from invalid points
+          if (err > 0)
+            m_samples.errors.push_back(err);
+        }
+
+        // Avoid points marked as not valid
+        Vector3 P = m_points(col, row);
+        if (P != P)
+          continue;
+
+        m_samples.x_vals.push_back(P.x());
+        m_samples.y_vals.push_back(P.y());
+        m_samples.z_vals.push_back(P.z());
+        m_samples.pt_errors.push_back(err);
+      }
+    }
+
+    vw::Mutex::Lock lock(m_mutex);
+    m_progress.report_incremental_progress(m_inc_amt);
+  }
+};
+
+// Sample the given images in parallel, in strips of rows
+void sample_error_and_points(vw::ImageViewRef<vw::Vector3> const& points,
+                             vw::ImageViewRef<double> const& errors,
+                             std::vector<ErrorBoxSamples> & samples) {
+
+  int num_rows = points.rows();
+  int rows_per_task = std::max(1, std::min(64, num_rows));
+  int num_tasks = (num_rows + rows_per_task - 1) / rows_per_task;
+  samples.clear();
+  samples.resize(num_tasks);
+
+  TerminalProgressCallback progress("asp", "Bounding box and triangulation error "
+                                    "range estimation: ");
+  progress.report_progress(0);
+  double inc_amt = 1.0 / std::max(double(num_tasks), 1.0);
+  vw::Mutex mutex;
+  vw::FifoWorkQueue queue(vw::vw_settings().default_num_threads());
+  for (int it = 0; it < num_tasks; it++) {
+    int beg_row = it * rows_per_task;
+    int end_row = std::min(num_rows, beg_row + rows_per_task);
+    boost::shared_ptr<ErrorBoxSampleTask>
+      task(new ErrorBoxSampleTask(points, errors, beg_row, end_row, samples[it],
+                                  mutex, progress, inc_amt));
+    queue.add_task(task);
+  }
+  queue.join_all();
+  progress.report_finished();
+}
+
 // A class to pick some samples to estimate the range of values
 // of a given dataset
 class ErrorRangeEstimAccum: public ReturnFixedType<void> {
@@ -187,27 +269,43 @@ double estim_max_tri_error_and_proj_box(vw::ImageViewRef<vw::Vector3> const& pro
     
     if (subsample_amt < 1)
       subsample_amt = 1;
+
+    // Collect the samples in one multi-threaded pass over the cloud and
+    // error image
+    ImageViewRef<double> sub_error;
+    if (error_image.cols() > 0 && error_image.rows() > 0)
+      sub_error = subsample(error_image, subsample_amt);
+    std::vector<ErrorBoxSamples> samples;
+    sample_error_and_points(subsample(proj_points, subsample_amt), sub_error,
+                            samples);
     
-    PixelAccumulator<asp::ErrorRangeEstimAccum> error_accum;
     if (error_image.cols() > 0 && error_image.rows() > 0) {
-      //Stopwatch sw2;
-      //sw2.start();
-      for_each_pixel(subsample(error_image, subsample_amt),
-                    error_accum,
-                    TerminalProgressCallback
-                    ("asp","Bounding box and triangulation error range estimation: ") );
+      PixelAccumulator<asp::ErrorRangeEstimAccum> error_accum;
+      for (size_t it = 0; it < samples.size(); it++) {
+        for (size_t k = 0; k < samples[it].errors.size(); k++)
+          error_accum(samples[it].errors[k]);
+      }
       if (error_accum.size() > 0) 
         estim_max_error = error_accum.value(remove_outliers_params);
       else
         success = false;
-        
-      //sw2.stop();
-      //vw_out(DebugMessage,"asp") << "Elapsed time: " << sw2.elapsed_seconds() << std::endl;
     }
 
-    asp::estimate_points_bdbox(subsample(proj_points, subsample_amt),
-                               subsample(error_image, subsample_amt),
-                               remove_outliers_params,  estim_max_error,
+    // Make use of the estimated error, if available
+    std::vector<double> x_vals, y_vals, z_vals;
+    for (size_t it = 0; it < samples.size(); it++) {
+      ErrorBoxSamples const& S = samples[it];
+      for (size_t k = 0; k < S.x_vals.size(); k++) {
+        if (estim_max_error > 0 && S.pt_errors[k] > estim_max_error) 
+          continue;
+        x_vals.push_back(S.x_vals[k]);
+        y_vals.push_back(S.y_vals[k]);
+        z_vals.push_back(S.z_vals[k]);
+      }
+    }
+    samples.clear();
+    
+    asp::estimate_points_bdbox(x_vals, y_vals, z_vals, remove_outliers_params,
                                estim_proj_box);
 
     if (estim_proj_box.empty()) 
@@ -223,4 +321,74 @@ double estim_max_tri_error_and_proj_box(vw::ImageViewRef<vw::Vector3> const& pro
   return estim_max_error;
 }
   
+// Read the estimates from a cache file. The key must match the one with which
+// the file was written. Return false if the cache is missing or stale.
+bool read_estim_max_tri_error_and_proj_box(std::string const& cache_file,
+                                           std::string const& key,
+                                           double & estim_max_error,
+                                           vw::BBox3 & estim_proj_box) {
+  std::ifstream ifs(cache_file.c_str());
+  if (!ifs.good())
+    return false;
+
+  std::string file_key;
+  std::getline(ifs, file_key);
+  if (file_key != key)
+    return false;
+
+  Vector3 beg, end;
+  if (!(ifs >> estim_max_error >> beg[0] >> beg[1] >> beg[2] >> end[0] >> end[1] >> end[2]))
+    return false;
+
+  estim_proj_box = BBox3(beg, end);
+  return true;
+}
+
+// Write the estimates to a cache file, with the given key. Failure is not
+// fatal, as the cache is only an optimization.
+void write_estim_max_tri_error_and_proj_box(std::string const& cache_file,
+                                            std::string const& key,
+                                            double estim_max_error,
+                                            vw::BBox3 const& estim_proj_box) {
+  std::string tmp_file = cache_file + ".tmp";
+  {
+    std::ofstream ofs(tmp_file.c_str());
+    if (!ofs.good()) {
+      vw_out(DebugMessage, "asp") << "Could not write: " << cache_file << "\n";
+      return;
+    }
+    ofs << key << "\n";
+    ofs << std::setprecision(17) << estim_max_error << "\n"
+        << estim_proj_box.min()[0] << " " << estim_proj_box.min()[1] << " "
+        << estim_proj_box.min()[2] << "\n"
+        << estim_proj_box.max()[0] << " " << estim_proj_box.max()[1] << " "
+        << estim_proj_box.max()[2] << "\n";
+  }
+  boost::system::error_code ec;
+  fs::rename(tmp_file, cache_file, ec);
+  if (ec)
+    fs::remove(tmp_file, ec);
+}
+
+// Form the key for the cache file of the estimates. It depends on the
+// names, sizes, and modification times of the clouds, and on anything
+// else the caller passes in, such as the projection and options.
+std::string estim_cache_key(std::vector<std::string> const& pointcloud_files,
+                            std::string const& extra) {
+  std::ostringstream os;
+  os << std::setprecision(17);
+  for (size_t it = 0; it < pointcloud_files.size(); it++) {
+    std::string const& file = pointcloud_files[it];
+    boost::system::error_code ec;
+    os << fs::absolute(file).string() << " " << fs::file_size(file, ec) << " "
+       << fs::last_write_time(file, ec) << " ";
+  }
+  os << extra;
+
+  // Must fit on a line
+  std::string key = os.str();
+  std::replace(key.begin(), key.end(), '\n', ' ');
+  return key;
+}
+  
 } // end namespace asp
@@ -22,6 +22,7 @@
 
 #include <vw/Image/ImageViewRef.h>
 
+#include <string>
 #include <vector>
 
 namespace asp {
@@ -43,6 +44,21 @@ double estim_max_tri_error_and_proj_box(vw::ImageViewRef<vw::Vector3> const& pro
                                         vw::ImageViewRef<double> const& error_image,
                                         vw::Vector2 const& remove_outliers_params,
                                         vw::BBox3 & estim_proj_box);
+
+// Cache the estimates computed by estim_max_tri_error_and_proj_box() in a
+// text file, so that repeated runs on the same cloud can skip that pass.
+// The key should identify the cloud and the settings used. See
+// estim_cache_key().
+bool read_estim_max_tri_error_and_proj_box(std::string const& cache_file,
+                                           std::string const& key,
+                                           double & estim_max_error,
+                                           vw::BBox3 & estim_proj_box);
+void write_estim_max_tri_error_and_proj_box(std::string const& cache_file,
+                                            std::string const& key,
+                                            double estim_max_error,
+                                            vw::BBox3 const& estim_proj_box);
+std::string estim_cache_key(std::vector<std::string> const& pointcloud_files,
+                            std::string const& extra);
   
 } // End namespace asp
 
@@ -0,0 +1,352 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file ParallelRansac.h
+///
+
+// RANSAC which evaluates the hypotheses in parallel and stops once enough
+// of them were tried to find the best model with the given confidence. It
+// has the same interface as vw::math::RandomSampleConsensus, and works
+// with the same fitting and error functors, so it can be used by stereo,
+// bundle_adjust, and the rig tools.
+//
+// Each hypothesis is fit to a minimal random sample, its inliers are found,
+// and if there are enough of them, the model is fit again to all of them.
+// The model with the smallest mean error over its inliers is kept. The
+// hypotheses are tried in rounds of a fixed size. After each round the
+// number of hypotheses needed is updated from the largest inlier ratio
+// seen so far. The sample for each hypothesis is found from its index, so
+// the result does not depend on the number of threads.
+
+#ifndef __ASP_CORE_PARALLEL_RANSAC_H__
+#define __ASP_CORE_PARALLEL_RANSAC_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Math/RANSAC.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  // The number of hypotheses per round. Fixed, so that the number of
+  // hypotheses tried does not depend on the number of threads.
+  const int RANSAC_ROUND_SIZE = 64;
+
+  // The fitting functors in VW take a sample point to find the number of
+  // points needed for a fit, while the ones in the rig tools do not.
+  template <class FittingFuncT, class ContainerT>
+  auto ransac_min_elems(FittingFuncT const& func, ContainerT const& p, int)
+    -> decltype(int(func.min_elements_needed_for_fit(p))) {
+    return func.min_elements_needed_for_fit(p);
+  }
+  template <class FittingFuncT, class ContainerT>
+  auto ransac_min_elems(FittingFuncT const& func, ContainerT const& p, long)
+    -> decltype(int(func.min_elements_needed_for_fit())) {
+    return func.min_elements_needed_for_fit();
+  }
+
+  /// The number of hypotheses needed to draw at least one sample of
+  /// num_elems inliers with the given confidence, if this is the
+  /// inlier ratio.
+  inline int ransac_num_needed(double inlier_ratio, int num_elems, double confidence) {
+    if (inlier_ratio >= 1.0)
+      return 0;
+    double good_sample = std::pow(inlier_ratio, num_elems);
+    double denom = std::log(1.0 - good_sample);
+    if (!(denom < 0.0))
+      return std::numeric_limits<int>::max();
+    double num = std::ceil(std::log(1.0 - confidence) / denom);
+    if (num >= double(std::numeric_limits<int>::max()))
+      return std::numeric_limits<int>::max();
+    return std::max(int(num), 0);
+  }
+
+  template <class FittingFuncT, class ErrorFuncT>
+  class ParallelRansac {
+  public:
+    typedef typename FittingFuncT::result_type result_type;
+
+  private:
+    FittingFuncT m_fitting_func;
+    ErrorFuncT   m_error_func;
+    int          m_num_iterations;
+    double       m_inlier_threshold;
+    int          m_min_num_output_inliers;
+    bool         m_reduce_min_num_output_inliers_if_no_fit;
+    bool         m_increase_threshold_if_no_fit;
+    double       m_confidence;
+    int          m_num_threads;
+    int          m_num_tried;
+
+    struct Hypothesis {
+      bool        valid;       // if it has enough inliers
+      int         num_inliers; // for the fit to the minimal sample
+      double      mean_error;  // over those inliers, for the fit to all of them
+      result_type H;
+    };
+
+    // Evaluate the hypotheses with indices in [begin, end)
+    template <class ContainerT1, class ContainerT2>
+    class RoundTask: public vw::Task, private boost::noncopyable {
+      ParallelRansac const& m_ransac;
+      std::vector<ContainerT1> const& m_p1;
+      std::vector<ContainerT2> const& m_p2;
+      int m_num_elems, m_begin, m_end;
+      Hypothesis * m_out;
+    public:
+      RoundTask(ParallelRansac const& ransac,
+                std::vector<ContainerT1> const& p1, std::vector<ContainerT2> const& p2,
+                int num_elems, int begin, int end, Hypothesis * out):
+        m_ransac(ransac), m_p1(p1), m_p2(p2), m_num_elems(num_elems),
+        m_begin(begin), m_end(end), m_out(out) {}
+      void operator()() {
+        for (int it = m_begin; it < m_end; it++)
+          m_ransac.eval_hypothesis(it, m_p1, m_p2, m_num_elems, m_out[it - m_begin]);
+      }
+    };
+
+    template <class ContainerT1, class ContainerT2>
+    void eval_hypothesis(int iteration,
+                         std::vector<ContainerT1> const& p1,
+                         std::vector<ContainerT2> const& p2,
+                         int num_elems, Hypothesis & h) const {
+      h.valid = false;
+      h.num_inliers = 0;
+
+      // Pick num_elems distinct points, with a generator seeded by the
+      // iteration, so the sample does not depend on what other threads do.
+      std::mt19937 generator(iteration);
+      std::uniform_int_distribution<int> distribution(0, int(p1.size()) - 1);
+      std::vector<int> sample;
+      while (int(sample.size()) < num_elems) {
+        int val = distribution(generator);
+        if (std::find(sample.begin(), sample.end(), val) == sample.end())
+          sample.push_back(val);
+      }
+
+      std::vector<ContainerT1> try1(num_elems);
+      std::vector<ContainerT2> try2(num_elems);
+      for (int i = 0; i < num_elems; i++) {
+        try1[i] = p1[sample[i]];
+        try2[i] = p2[sample[i]];
+      }
+
+      try {
+        result_type H = m_fitting_func(try1, try2);
+        inliers(H, p1, p2, try1, try2);
+        h.num_inliers = try1.size();
+        if (h.num_inliers < m_min_num_output_inliers)
+          return;
+
+        // Fit again, using all inliers, and find the mean error
+        H = m_fitting_func(try1, try2);
+        double err = 0.0;
+        for (size_t i = 0; i < try1.size(); i++)
+          err += m_error_func(H, try1[i], try2[i]);
+        h.mean_error = err / try1.size();
+        h.H = H;
+        h.valid = true;
+      } catch (std::exception const&) {
+        // A degenerate sample. Skip it.
+      }
+    }
+
+    template <class ContainerT1, class ContainerT2>
+    result_type attempt_ransac(std::vector<ContainerT1> const& p1,
+                               std::vector<ContainerT2> const& p2,
+                               int num_elems) {
+
+      if (m_min_num_output_inliers < num_elems)
+        vw::vw_throw(vw::math::RANSACErr() << "RANSAC error. Number of requested inliers "
+                     << "is less than min number of elements needed for fit.\n");
+
+      int num_threads = m_num_threads;
+      if (num_threads <= 0)
+        num_threads = vw::vw_settings().default_num_threads();
+      num_threads = std::max(1, std::min(num_threads, RANSAC_ROUND_SIZE));
+
+      result_type best_H = result_type();
+      bool found = false;
+      double min_err = std::numeric_limits<double>::max();
+      int max_inliers = 0;
+      int num_needed = m_num_iterations;
+      std::vector<Hypothesis> round(RANSAC_ROUND_SIZE);
+
+      m_num_tried = 0;
+      while (m_num_tried < std::min(m_num_iterations, num_needed)) {
+        int begin = m_num_tried;
+        int end   = std::min(begin + RANSAC_ROUND_SIZE, m_num_iterations);
+
+        int per_task = (end - begin + num_threads - 1) / num_threads;
+        if (num_threads == 1) {
+          RoundTask<ContainerT1, ContainerT2> task(*this, p1, p2, num_elems,
+                                                   begin, end, &round[0]);
+          task();
+        } else {
+          vw::FifoWorkQueue queue(num_threads);
+          for (int start = begin; start < end; start += per_task) {
+            boost::shared_ptr<vw::Task>
+              task(new RoundTask<ContainerT1, ContainerT2>
+                   (*this, p1, p2, num_elems, start, std::min(start + per_task, end),
+                    &round[start - begin]));
+            queue.add_task(task);
+          }
+          queue.join_all();
+        }
+
+        // Merge in order, so ties go to the earlier hypothesis
+        for (int it = begin; it < end; it++) {
+          Hypothesis const& h = round[it - begin];
+          max_inliers = std::max(max_inliers, h.num_inliers);
+          if (h.valid && h.mean_error < min_err) {
+            min_err = h.mean_error;
+            best_H  = h.H;
+            found   = true;
+          }
+        }
+        m_num_tried = end;
+
+        if (found)
+          num_needed = ransac_num_needed(double(max_inliers) / p1.size(), num_elems,
+                                         m_confidence);
+      }
+
+      if (!found)
+        vw::vw_throw(vw::math::RANSACErr() << "RANSAC was unable to find a fit with "
+                     << m_min_num_output_inliers << " inliers.\n");
+
+      return best_H;
+    }
+
+  public:
+
+    /// Besides the inputs of vw::math::RandomSampleConsensus, this takes
+    /// the confidence with which to find a good model, which determines
+    /// when to stop, and the number of threads. If that is 0, use the
+    /// default number of threads.
+    ParallelRansac(FittingFuncT const& fitting_func,
+                   ErrorFuncT   const& error_func,
+                   int    num_iterations,
+                   double inlier_threshold,
+                   int    min_num_output_inliers,
+                   bool   reduce_min_num_output_inliers_if_no_fit = false,
+                   bool   increase_threshold_if_no_fit = false,
+                   double confidence = 0.999,
+                   int    num_threads = 0):
+      m_fitting_func(fitting_func), m_error_func(error_func),
+      m_num_iterations(num_iterations),
+      m_inlier_threshold(inlier_threshold),
+      m_min_num_output_inliers(min_num_output_inliers),
+      m_reduce_min_num_output_inliers_if_no_fit(reduce_min_num_output_inliers_if_no_fit),
+      m_increase_threshold_if_no_fit(increase_threshold_if_no_fit),
+      m_confidence(confidence), m_num_threads(num_threads), m_num_tried(0) {}
+
+    /// The inliers of a given model
+    template <class ContainerT1, class ContainerT2>
+    void inliers(result_type const& H,
+                 std::vector<ContainerT1> const& p1,
+                 std::vector<ContainerT2> const& p2,
+                 std::vector<ContainerT1>      & inliers1,
+                 std::vector<ContainerT2>      & inliers2) const {
+      inliers1.clear();
+      inliers2.clear();
+      for (size_t i = 0; i < p1.size(); i++) {
+        if (m_error_func(H, p1[i], p2[i]) < m_inlier_threshold) {
+          inliers1.push_back(p1[i]);
+          inliers2.push_back(p2[i]);
+        }
+      }
+    }
+
+    /// The indices of the inliers of a given model
+    template <class ContainerT1, class ContainerT2>
+    std::vector<size_t> inlier_indices(result_type const& H,
+                                       std::vector<ContainerT1> const& p1,
+                                       std::vector<ContainerT2> const& p2) const {
+      std::vector<size_t> result;
+      for (size_t i = 0; i < p1.size(); i++)
+        if (m_error_func(H, p1[i], p2[i]) < m_inlier_threshold)
+          result.push_back(i);
+      return result;
+    }
+
+    /// The number of hypotheses tried by the last successful attempt
+    int num_tried() const { return m_num_tried; }
+
+    /// The inlier threshold, which may have been increased to find a fit
+    double inlier_threshold() const { return m_inlier_threshold; }
+
+    /// Find the best model. If none has enough inliers, and if so set,
+    /// try again with fewer inliers, and then with a larger threshold.
+    template <class ContainerT1, class ContainerT2>
+    result_type operator()(std::vector<ContainerT1> const& p1,
+                           std::vector<ContainerT2> const& p2) {
+
+      if (p1.empty())
+        vw::vw_throw(vw::math::RANSACErr() << "RANSAC error. Insufficient data.\n");
+      if (p1.size() != p2.size())
+        vw::vw_throw(vw::math::RANSACErr() << "RANSAC error. Data vectors are not "
+                     << "the same size.\n");
+      int num_elems = ransac_min_elems(m_fitting_func, p1[0], 0);
+      if (int(p1.size()) < num_elems)
+        vw::vw_throw(vw::math::RANSACErr() << "RANSAC error. Not enough potential "
+                     << "matches for this fitting functor.\n");
+
+      int orig_num_inliers = m_min_num_output_inliers;
+      std::string err;
+      for (int attempt_thresh = 0; attempt_thresh < 10; attempt_thresh++) {
+        for (int attempt_inlier = 0; attempt_inlier < 10; attempt_inlier++) {
+          try {
+            return attempt_ransac(p1, p2, num_elems);
+          } catch (vw::math::RANSACErr const& e) {
+            err = e.what();
+            if (!m_reduce_min_num_output_inliers_if_no_fit)
+              break;
+            m_min_num_output_inliers = static_cast<int>(m_min_num_output_inliers / 1.5);
+            if (m_min_num_output_inliers < num_elems)
+              break;
+            vw::vw_out() << "Attempting RANSAC with " << m_min_num_output_inliers
+                         << " output inliers.\n";
+          }
+        }
+
+        if (!m_increase_threshold_if_no_fit)
+          break;
+        m_min_num_output_inliers = orig_num_inliers;
+        m_inlier_threshold *= 1.5;
+        vw::vw_out() << "Increasing the inlier threshold to: " << m_inlier_threshold << ".\n";
+      }
+
+      vw::vw_throw(vw::math::RANSACErr() << err);
+      return result_type(); // never reached
+    }
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_PARALLEL_RANSAC_H__
@@ -24,6 +24,8 @@
 #include <asp/Core/PdalUtils.h>
 #include <vw/Cartography/GeoReference.h>
 #include <vw/Core/ProgressCallback.h>   // for TerminalProgressCallback
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Manipulation.h>
 
 #include <pdal/PointView.hpp>
 #include <pdal/PointTable.hpp>
@@ -36,12 +38,69 @@
 #include <io/LasWriter.hpp>
 #include <pdal/SpatialReference.hpp>
 
+#include <algorithm>
+#include <future>
+#include <string>
+#include <vector>
+
 namespace pdal {
+
+// A strip of rows of the point cloud and error images, in memory
+struct CloudStrip {
+  vw::ImageView<vw::Vector3> points;
+  vw::ImageView<double> errors;
+};
+
+// Rasterize the given rows of the point cloud and, if needed, of the error
+// image. The blocks of the strip are done in parallel.
+CloudStrip read_cloud_strip(vw::ImageViewRef<vw::Vector3> point_image,
+                            vw::ImageViewRef<double> error_image,
+                            bool need_errors, int beg_row, int num_rows) {
+
+  CloudStrip strip;
+  int cols = point_image.cols();
+  strip.points.set_size(cols, num_rows);
+  if (need_errors)
+    strip.errors.set_size(cols, num_rows);
+
+  int block_size = 256;
+  int num_blocks = (cols + block_size - 1) / block_size;
+  std::vector<std::string> errors(num_blocks);
+  #pragma omp parallel for schedule(dynamic)
+  for (int block = 0; block < num_blocks; block++) {
+    try {
+      int beg_col = block * block_size;
+      vw::BBox2i box(beg_col, beg_row, std::min(block_size, cols - beg_col), num_rows);
+      vw::ImageView<vw::Vector3> points = vw::crop(point_image, box);
+      vw::ImageView<double> errs;
+      if (need_errors)
+        errs = vw::crop(error_image, box);
+      for (int row = 0; row < box.height(); row++) {
+        for (int col = 0; col < box.width(); col++) {
+          strip.points(beg_col + col, row) = points(col, row);
+          if (need_errors)
+            strip.errors(beg_col + col, row) = errs(col, row);
+        }
+      }
+    } catch (std::exception const& e) {
+      errors[block] = e.what();
+    }
+  }
+  for (int block = 0; block < num_blocks; block++) {
+    if (!errors[block].empty())
+      vw::vw_throw(vw::ArgumentErr() << errors[block]);
+  }
+
+  return strip;
+}
     
 // A class to produce a point cloud point-by-point, rather than
 // having it all in memory at the same time. It will be streamed to
 // disk. See the GDALReader class for how to add more fields
-// and read from disk.
+// and read from disk. The input is read in strips of rows, with the blocks
+// of each strip computed in parallel. The next strip is read while the
+// points of the current one are written and compressed, so at most two
+// strips are in memory.
 class PDAL_DLL StreamedCloud: public Reader, public Streamable {
   
 public:
@@ -67,11 +126,18 @@ private:
   vw::ImageViewRef<double> m_error_image;
   double m_max_valid_triangulation_error;
   double m_triangulation_error_factor;
+  bool m_need_errors;
 
   // These are of type uint64_t
   point_count_t m_col_count, m_row_count, m_cols, m_rows;
   point_count_t m_count, m_size, m_num_valid_points, m_num_saved_points;
 
+  // The current strip, its first row, and the strip being read
+  CloudStrip m_strip;
+  point_count_t m_strip_beg, m_strip_rows;
+  std::future<CloudStrip> m_next_strip;
+  void start_reading_strip(point_count_t beg_row);
+
   vw::TerminalProgressCallback m_tpc;
 };
     
@@ -88,10 +154,12 @@ StreamedCloud::StreamedCloud(bool has_georef,
   m_point_image(point_image), m_error_image(error_image),
   m_max_valid_triangulation_error(max_valid_triangulation_error),
   m_triangulation_error_factor(triangulation_error_factor), 
+  m_need_errors(max_valid_triangulation_error > 0.0 || triangulation_error_factor > 0.0),
   m_col_count(0), m_row_count(0),
   m_cols(m_point_image.cols()), m_rows(m_point_image.rows()),
   m_size(m_cols * m_rows), // careful here to avoid integer overflow
   m_count(0), m_num_valid_points(0), m_num_saved_points(0),
+  m_strip_beg(0), m_strip_rows(0),
   m_tpc(vw::TerminalProgressCallback("asp", "\t--> ")) {
 
   // Sanity check, if the error image is nonempty, it must have the 
@@ -103,6 +171,18 @@ StreamedCloud::StreamedCloud(bool has_georef,
                   << "Expecting the error image to have the same dimensions "
                   << "as the point cloud image.\n");
     }
+
+  // About 2 million points per strip
+  point_count_t max_strip_points = 2 * 1024 * 1024;
+  m_strip_rows = std::max(point_count_t(1), max_strip_points / std::max(m_cols, point_count_t(1)));
+}
+
+// Start reading the strip starting at the given row in the background
+void StreamedCloud::start_reading_strip(point_count_t beg_row) {
+  int num_rows = std::min(m_strip_rows, m_rows - beg_row);
+  m_next_strip = std::async(std::launch::async, read_cloud_strip,
+                            m_point_image, m_error_image, m_need_errors,
+                            int(beg_row), num_rows);
 }
 
 StreamedCloud::~StreamedCloud() {}
@@ -123,6 +203,8 @@ void StreamedCloud::addArgs(ProgramArgs& args) {
 
 void StreamedCloud::ready(PointTableRef table) {
   m_count = 0;
+  if (m_size > 0)
+    start_reading_strip(0);
 }
 
 // This function is used when a point cloud is formed fully in memory.
@@ -144,14 +226,25 @@ bool StreamedCloud::processOne(PointRef& point) {
     if (m_count >= m_size)
         return false; 
 
+    // Move to the next strip when done with the current one, and start
+    // reading the one after it
+    if (m_row_count >= m_strip_beg + m_strip.points.rows()) {
+      m_strip = m_next_strip.get();
+      m_strip_beg = m_row_count;
+      point_count_t next_beg = m_strip_beg + m_strip.points.rows();
+      if (next_beg < m_rows)
+        start_reading_strip(next_beg);
+    }
+    point_count_t strip_row = m_row_count - m_strip_beg;
+      
     // Note how we access in col, row order, per ASP conventions
-    vw::Vector3 xyz = m_point_image(m_col_count, m_row_count);
+    vw::Vector3 xyz = m_strip.points(m_col_count, strip_row);
     
     // Skip no-data points and point above the max valid triangulation error
     bool is_good1 = ((!m_has_georef && xyz != vw::Vector3()) ||
                     (m_has_georef  && !boost::math::isnan(xyz.z())));
     bool is_good2 = (m_max_valid_triangulation_error <= 0 ||
-                    m_error_image(m_col_count, m_row_count) <= 
+                    m_strip.errors(m_col_count, strip_row) <= 
                     m_max_valid_triangulation_error);
 
     if (is_good1)
@@ -170,7 +263,7 @@ bool StreamedCloud::processOne(PointRef& point) {
         // taken already x, y, and z) with 32-bit values, so uint16
         // is all one can do.
         double scaled_error = m_triangulation_error_factor * 
-                              m_error_image(m_col_count, m_row_count);
+                              m_strip.errors(m_col_count, strip_row);
         scaled_error = round(scaled_error); // round to int32
         scaled_error = std::max(scaled_error, 0.0); // should not be necessary
         double max_int16 = std::numeric_limits<std::uint16_t>::max();
@@ -198,6 +291,8 @@ bool StreamedCloud::processOne(PointRef& point) {
 }
 
 void StreamedCloud::done(PointTableRef table) {
+  if (m_next_strip.valid())
+    m_next_strip.wait();
   m_tpc.report_finished();
   
   vw::vw_out () << "Wrote: " << m_num_saved_points << " points." << std::endl;
@@ -75,9 +75,10 @@ void asp::photometric_outlier_rejection(vw::GdalWriteOptions const& opt,
   float thresh = cdf.quantile(0.99985); // Pulling out last bin of CDF
   vw_out() << "\t  Using threshold: " << thresh << "\n";
 
-  // Thresholding image and dilating
-  ImageView<PixelGray<float>> dust =
-    threshold(apply_mask(copy_mask(diff,right_mask)),thresh,1.0,0.0);
+  // Thresholding image and dilating. The difference is already zero
+  // where the projected right image is invalid, so it need not be masked
+  // again, which would read the projected right image once more.
+  ImageView<PixelGray<float>> dust = threshold(diff,thresh,1.0,0.0);
   ImageView<PixelGray<float>> grass;
   grassfire(dust,grass);
   dust = gaussian_filter(grass,kernel_size/3);
@@ -23,6 +23,7 @@
 #include <vw/Math/Functors.h>
 
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 using namespace vw;
@@ -40,6 +41,7 @@ Point2Grid::Point2Grid(int width, int height,
                        FilterType filter, double percentile):
   m_width(width), m_height(height),
   m_buffer(buffer), m_weights(weights),
+  m_max_in_memory_values(MAX_IN_MEMORY_GRID_VALUES), m_spill_file(NULL), m_num_spilled(0),
   m_x0(x0), m_y0(y0), m_grid_size(grid_size),
   m_radius(radius), m_filter(filter), m_percentile(percentile){
   
@@ -79,6 +81,22 @@ Point2Grid::Point2Grid(int width, int height,
   
 }
 
+Point2Grid::~Point2Grid() {
+  if (m_spill_file != NULL)
+    std::fclose(m_spill_file);
+}
+
+void Point2Grid::set_max_in_memory_values(size_t max_vals) {
+  m_max_in_memory_values = std::max(max_vals, size_t(1));
+}
+
+// For these we need to keep all values (in fact, for stddev we could get away with less,
+// but it is not worth trying so hard).
+bool Point2Grid::keepAllValues() const {
+  return (m_filter == f_median || m_filter == f_stddev ||
+          m_filter == f_nmad   || m_filter == f_percentile);
+}
+
 void Point2Grid::Clear(const float value) {
   m_buffer.set_size (m_width, m_height);
   m_weights.set_size (m_width, m_height);
@@ -89,13 +107,49 @@ void Point2Grid::Clear(const float value) {
     }
   }
 
-  // For these we need to keep all values (in fact, for stddev we could get away with less,
-  // but it is not worth trying so hard).
-  if (m_filter == f_median || m_filter == f_stddev ||
-      m_filter == f_nmad   || m_filter == f_percentile) {
-    m_vals.set_size(m_width, m_height);
+  if (m_filter == f_weighted_average)
+    m_sum_wts.assign(2 * size_t(m_width) * size_t(m_height), 0.0);
+
+  // Wipe any values from before. The arena memory is kept for reuse.
+  m_vals.clear();
+  if (m_spill_file != NULL) {
+    std::fclose(m_spill_file);
+    m_spill_file = NULL;
   }
-  
+  m_num_spilled = 0;
+}
+
+// Append the values in memory to a temporary file, and clear them.
+void Point2Grid::spillValues() {
+
+  if (m_vals.empty())
+    return;
+
+  if (m_spill_file == NULL) {
+    m_spill_file = std::tmpfile();
+    if (m_spill_file == NULL)
+      vw_throw(IOErr() << "Point2Grid: Could not create a temporary file.\n");
+  }
+
+  size_t num = std::fwrite(&m_vals[0], sizeof(GridValue), m_vals.size(), m_spill_file);
+  if (num != m_vals.size())
+    vw_throw(IOErr() << "Point2Grid: Could not write to a temporary file.\n");
+
+  m_num_spilled += num;
+  m_vals.clear();
+}
+
+// Read back the spilled values with indices in [start, start + num).
+void Point2Grid::readSpilledValues(size_t start, size_t num,
+                                   std::vector<GridValue> & vals) {
+
+  vals.resize(num);
+  if (num == 0)
+    return;
+
+  if (std::fseek(m_spill_file, long(start * sizeof(GridValue)), SEEK_SET) != 0 ||
+      std::fread(&vals[0], sizeof(GridValue), num, m_spill_file) != num)
+    vw_throw(IOErr() << "Point2Grid: Could not read from a temporary file.\n");
 }
 
 void Point2Grid::AddPoint(double x, double y, double z){
@@ -106,6 +160,14 @@ void Point2Grid::AddPoint(double x, double y, double z){
   int maxx = std::min( (int)floor( (x + m_radius - m_x0)/m_grid_size ), m_buffer.cols() - 1 );
   int maxy = std::min( (int)floor( (y + m_radius - m_y0)/m_grid_size ), m_buffer.rows() - 1 );
 
+  if (minx > maxx || miny > maxy)
+    return; // the point is too far from the grid
+
+  if (m_filter == f_weighted_average) {
+    splatWeighted(x, y, z, minx, miny, maxx, maxy);
+    return;
+  }
+
   // Add the contribution of current point to all grid points within radius
   for (int ix = minx; ix <= maxx; ix++){
     for (int iy = miny; iy <= maxy; iy++){
@@ -115,16 +177,7 @@ void Point2Grid::AddPoint(double x, double y, double z){
       double dist = sqrt( (x-gx)*(x-gx) + (y-gy)*(y-gy) );
       if ( dist > m_radius ) continue;
 
-      if (m_filter == f_weighted_average) {
-        double wt = m_sampled_gauss[(int)round(dist/m_dx)];
-        if (wt <= 0)
-          continue;
-        if (m_weights(ix, iy) == 0)
-          m_buffer(ix, iy) = 0.0; // set to 0 before incrementing below
-        m_buffer(ix, iy)  += z*wt;
-        m_weights(ix, iy) += wt;
-
-      }else if (m_filter == f_mean){
+      if (m_filter == f_mean){
         if (m_weights(ix, iy) == 0)
           m_buffer(ix, iy) = 0.0; // set to 0 before incrementing below
         m_buffer(ix, iy)  += z;
@@ -152,7 +205,12 @@ void Point2Grid::AddPoint(double x, double y, double z){
         
       }else if (m_filter == f_stddev || m_filter == f_median ||
                 m_filter == f_nmad   || m_filter == f_percentile){
-        m_vals(ix, iy).push_back(z); // not strictly needed for stddev
+        GridValue v;
+        v.val   = z;
+        v.index = iy * m_buffer.cols() + ix;
+        m_vals.push_back(v); // not strictly needed for stddev
+        if (m_vals.size() >= m_max_in_memory_values)
+          spillValues();
       }
       
     }
@@ -160,49 +218,192 @@ void Point2Grid::AddPoint(double x, double y, double z){
   }
 }
 
+// Add the weighted contribution of a point to the grid points within the
+// radius, one grid row at a time. The inner loop has no branches and
+// touches contiguous memory, so the compiler can vectorize it. Grid points
+// beyond the radius get zero weight, which does not change the sums. The
+// weights are the same as when traversing the footprint in any other order.
+void Point2Grid::splatWeighted(double x, double y, double z,
+                               int minx, int miny, int maxx, int maxy) {
+
+  int width = m_buffer.cols();
+  int max_k = int(m_sampled_gauss.size()) - 1;
+  const double * gauss = &m_sampled_gauss[0];
+  
+  for (int iy = miny; iy <= maxy; iy++) {
+    double gy  = m_y0 + iy*m_grid_size;
+    double dy2 = (y-gy)*(y-gy);
+    double * sum_wt = &m_sum_wts[2 * (size_t(iy) * width + minx)];
+    for (int ix = minx; ix <= maxx; ix++) {
+      double gx   = m_x0 + ix*m_grid_size;
+      double dist = sqrt( (x-gx)*(x-gx) + dy2 );
+      int    k    = std::min((int)round(dist/m_dx), max_k);
+      double wt   = (dist <= m_radius) ? gauss[k] : 0.0;
+      sum_wt[0] += z*wt;
+      sum_wt[1] += wt;
+      sum_wt += 2;
+    }
+  }
+}
+
 void Point2Grid::normalize(){
+
+  if (m_filter == f_weighted_average) {
+    int width = m_buffer.cols();
+    for (int r = 0; r < m_buffer.rows(); r++) {
+      const double * sum_wt = &m_sum_wts[2 * size_t(r) * width];
+      for (int c = 0; c < width; c++) {
+        double wt = sum_wt[2*c + 1];
+        if (wt > 0) {
+          m_buffer (c, r) = sum_wt[2*c] / wt;
+          m_weights(c, r) = wt;
+        }
+      }
+    }
+    return;
+  }
+
+  if (keepAllValues()) {
+    normalizeAllValues();
+    return;
+  }
+
   for (int c = 0; c < m_buffer.cols(); c++){
     for (int r = 0; r < m_buffer.rows(); r++){
 
-      if (m_filter == f_weighted_average || m_filter == f_mean) {
+      if (m_filter == f_mean) {
         if (m_weights(c, r) > 0)
           m_buffer (c, r) /= m_weights(c, r);
 
       }else if (m_filter == f_count)
         m_buffer(c, r) = m_weights(c, r); // hence instead of no-data we will have always 0
+    }
+  }
+}
 
-      else if (m_filter == f_stddev){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        vw::math::StdDevAccumulator<double> V;
-        for (size_t it = 0; it < m_vals(c, r).size(); it++) 
-          V(m_vals(c, r)[it]);
-        m_buffer(c, r) = V.value();
-      }
-      
-      else if (m_filter == f_median){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        vw::math::MedianAccumulator<double> V;
-        for (size_t it = 0; it < m_vals(c, r).size(); it++) 
-          V(m_vals(c, r)[it]);
-        m_buffer(c, r) = V.value();
-      }
+// Find the statistic for the grid point with given linear index, given
+// all the values at that point, which must be non-empty.
+void Point2Grid::computeStats(std::int32_t index, double * vals, size_t len,
+                              std::vector<double> & scratch) {
+
+  int c = index % m_buffer.cols();
+  int r = index / m_buffer.cols();
+
+  if (m_filter == f_stddev){
+    vw::math::StdDevAccumulator<double> V;
+    for (size_t it = 0; it < len; it++) 
+      V(vals[it]);
+    m_buffer(c, r) = V.value();
+  }
+
+  else if (m_filter == f_median){
+    vw::math::MedianAccumulator<double> V;
+    for (size_t it = 0; it < len; it++) 
+      V(vals[it]);
+    m_buffer(c, r) = V.value();
+  }
+
+  else if (m_filter == f_nmad){
+    scratch.assign(vals, vals + len); // reuse the memory
+    m_buffer(c, r) = vw::math::destructive_nmad(scratch);
+  }
+
+  else if (m_filter == f_percentile){
+    scratch.assign(vals, vals + len);
+    m_buffer(c, r) = vw::math::destructive_percentile(scratch, m_percentile);
+  }
+}
+
+// Compute the order statistics. The values for each grid point are made
+// contiguous with a stable counting sort, so they are seen in the order
+// they were added. If some values were spilled to disk, grid points are
+// processed in ranges whose values fit in memory, with a pass over the
+// spill file for each range.
+void Point2Grid::normalizeAllValues(){
+
+  int num_pixels = m_buffer.cols() * m_buffer.rows();
+  std::vector<double> scratch;
 
-      else if (m_filter == f_nmad){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        m_buffer(c, r) = vw::math::destructive_nmad(m_vals(c, r));
+  if (m_num_spilled == 0) {
+    // All values are in memory
+    std::vector<size_t> offsets(num_pixels + 1, 0);
+    for (size_t it = 0; it < m_vals.size(); it++)
+      offsets[m_vals[it].index + 1]++;
+    for (int i = 0; i < num_pixels; i++)
+      offsets[i + 1] += offsets[i];
+
+    std::vector<double> sorted(m_vals.size());
+    std::vector<size_t> pos(offsets.begin(), offsets.end() - 1);
+    for (size_t it = 0; it < m_vals.size(); it++)
+      sorted[pos[m_vals[it].index]++] = m_vals[it].val;
+    std::vector<GridValue>().swap(m_vals); // release the memory
+
+    for (int i = 0; i < num_pixels; i++) {
+      if (offsets[i + 1] > offsets[i])
+        computeStats(i, &sorted[offsets[i]], offsets[i + 1] - offsets[i], scratch);
+    }
+    return;
+  }
+
+  // Put on disk what is left, so all values are in one place
+  spillValues();
+  std::vector<GridValue>().swap(m_vals);
+
+  // Read the spilled values in chunks of this size
+  size_t chunk = std::min(m_max_in_memory_values, size_t(1024 * 1024));
+  std::vector<GridValue> buf;
+
+  // Count the values for each grid point
+  std::vector<size_t> counts(num_pixels, 0);
+  for (size_t start = 0; start < m_num_spilled; start += chunk) {
+    readSpilledValues(start, std::min(chunk, m_num_spilled - start), buf);
+    for (size_t it = 0; it < buf.size(); it++)
+      counts[buf[it].index]++;
+  }
+
+  std::vector<size_t> offsets, pos;
+  std::vector<double> sorted;
+  int beg = 0;
+  while (beg < num_pixels) {
+
+    // Find the range [beg, end) of grid points whose values fit in memory.
+    // It must have at least one grid point.
+    int end = beg;
+    size_t total = 0;
+    while (end < num_pixels &&
+           (end == beg || total + counts[end] <= m_max_in_memory_values)) {
+      total += counts[end];
+      end++;
+    }
+
+    if (total > 0) {
+      offsets.assign(end - beg + 1, 0);
+      for (int i = beg; i < end; i++)
+        offsets[i - beg + 1] = offsets[i - beg] + counts[i];
+      pos.assign(offsets.begin(), offsets.end() - 1);
+      sorted.resize(total);
+
+      for (size_t start = 0; start < m_num_spilled; start += chunk) {
+        readSpilledValues(start, std::min(chunk, m_num_spilled - start), buf);
+        for (size_t it = 0; it < buf.size(); it++) {
+          std::int32_t index = buf[it].index;
+          if (index >= beg && index < end)
+            sorted[pos[index - beg]++] = buf[it].val;
+        }
       }
-      
-      else if (m_filter == f_percentile){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        m_buffer(c, r) = vw::math::destructive_percentile(m_vals(c, r), m_percentile);
+
+      for (int i = beg; i < end; i++) {
+        if (counts[i] > 0)
+          computeStats(i, &sorted[offsets[i - beg]], counts[i], scratch);
       }
-      
     }
+
+    beg = end;
   }
+
+  std::fclose(m_spill_file);
+  m_spill_file = NULL;
+  m_num_spilled = 0;
 }
   
 } // end namespace asp
@@ -24,12 +24,27 @@
 
 #include <vw/Image/ImageView.h>
 
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
 namespace asp {
 
   // The type of filter to apply to points within a circular bin.
   enum FilterType {f_weighted_average, f_min, f_max, f_mean, f_median, f_stddev, f_count,
                    f_nmad, f_percentile};
 
+  // For the filters which need all values at a grid point (median, etc.), this
+  // many values are kept in memory per tile before they are spilled to disk.
+  const size_t MAX_IN_MEMORY_GRID_VALUES = 16 * 1024 * 1024;
+
+  // A value contributed by a cloud point to a grid point, and the linear
+  // index of that grid point.
+  struct GridValue {
+    double       val;
+    std::int32_t index;
+  };
+
   /// Given a set of xyz points, create an xy grid. For every node in the
   /// grid, combine all points within given radius of the grid point and
   /// calculate a single z value at the grid point.
@@ -42,24 +57,46 @@ namespace asp {
                double grid_size, double min_spacing, double radius,
                double sigma_factor,
                FilterType filter, double percentile);
-    ~Point2Grid(){}
+    ~Point2Grid();
     void Clear    (const float val);
     void AddPoint (double x, double y, double z);
     void normalize();
 
+    // Set how many values to keep in memory for the order-statistic filters,
+    // beyond which they are written to a temporary file.
+    void set_max_in_memory_values(size_t max_vals);
+
   private:
     int m_width, m_height; // DEM dimensions
     vw::ImageView<double> & m_buffer;
     vw::ImageView<double> & m_weights;
-    vw::ImageView< std::vector<double> > m_vals; // when need to keep all individual values
+    // When need to keep all individual values, these are appended to a flat
+    // arena, rather than kept in one vector per grid point. Before computing
+    // the statistics the arena is reordered by grid point, in CSR fashion.
+    std::vector<GridValue> m_vals;
+    size_t      m_max_in_memory_values;
+    std::FILE * m_spill_file;  // values which did not fit in memory
+    size_t      m_num_spilled; // how many values are in the spill file
     double     m_x0, m_y0; // lower-left corner
     double     m_grid_size;  // spacing between output DEM pixels
     double     m_radius;   // how far to search for cloud points
     double     m_dx;       // spacing between samples
     std::vector<double> m_sampled_gauss;
+    // For the weighted average, the weighted sums of heights and the sums of
+    // weights, interleaved and stored row after row, so that the footprint of
+    // a point is traversed with contiguous memory access.
+    std::vector<double> m_sum_wts;
     FilterType m_filter;
     double     m_percentile; // The actual value of the percentile to use if in that mode
 
+    void splatWeighted(double x, double y, double z,
+                       int minx, int miny, int maxx, int maxy);
+    bool keepAllValues() const;
+    void spillValues();
+    void readSpilledValues(size_t start, size_t num, std::vector<GridValue> & vals);
+    void normalizeAllValues();
+    void computeStats(std::int32_t index, double * vals, size_t len,
+                      std::vector<double> & scratch);
   };
 
 }
@@ -33,9 +33,16 @@
 #include <io/LasHeader.hpp>
 #include <pdal/Options.hpp>
 
+#include <queue>
+
 namespace pdal {
 
-// Read a LAS cloud and return a subset of it.  
+// Read a LAS cloud and return a subset of it. The points are picked in a
+// single streaming pass. Each point gets a random key, and the points
+// within the lon-lat box with the smallest keys are kept. This gives a
+// uniform sample of the points in the box, however small the box is, and
+// a point whose key cannot make it into the sample is skipped without
+// being converted or checked against the box.
 class PDAL_DLL LasLoader: public Writer, public Streamable {
 
 public:
@@ -59,11 +66,31 @@ public:
     m_data.conservativeResize(asp::DIM + 1, m_num_points_to_load);
     m_has_las_georef = asp::georef_from_las(m_file_name, m_las_georef);
     m_shift_was_calc = false;
-    m_points_count = 0;
-    
-    // We will randomly pick or not a point with probability load_ratio
+    m_num_seen = 0;
     m_num_total_points = asp::las_file_size(m_file_name);
-    m_load_ratio = (double)m_num_points_to_load/std::max(1.0, (double)m_num_total_points);
+
+    // For a projected cloud, the box in projected coordinates, to quickly
+    // reject the points far from the lon-lat box. Sample the box edges, as
+    // they can be curved, and pad the result.
+    m_has_proj_box = false;
+    if (m_has_las_georef && !m_lonlat_box.empty()) {
+      try {
+        int num_samples = 100;
+        for (int it = 0; it <= num_samples; it++) {
+          double t = double(it) / num_samples;
+          double lon = m_lonlat_box.min().x() + t * m_lonlat_box.width();
+          double lat = m_lonlat_box.min().y() + t * m_lonlat_box.height();
+          m_proj_box.grow(m_las_georef.lonlat_to_point(vw::Vector2(lon, m_lonlat_box.min().y())));
+          m_proj_box.grow(m_las_georef.lonlat_to_point(vw::Vector2(lon, m_lonlat_box.max().y())));
+          m_proj_box.grow(m_las_georef.lonlat_to_point(vw::Vector2(m_lonlat_box.min().x(), lat)));
+          m_proj_box.grow(m_las_georef.lonlat_to_point(vw::Vector2(m_lonlat_box.max().x(), lat)));
+        }
+        m_proj_box.expand(0.1 * std::max(m_proj_box.width(), m_proj_box.height()));
+        m_has_proj_box = true;
+      } catch (...) {
+        m_has_proj_box = false; // check each point against the lon-lat box
+      }
+    }
 
     std::int64_t hundred = 100;
     m_spacing = std::max(m_num_total_points/hundred, std::int64_t(1));
@@ -86,9 +113,13 @@ private:
   bool m_calc_shift;
   bool m_has_las_georef;
   vw::cartography::GeoReference m_las_georef;
-  double m_load_ratio;
+  bool m_has_proj_box;
+  vw::BBox2 m_proj_box;
   bool m_shift_was_calc;
-  std::int64_t m_points_count;
+  std::int64_t m_num_seen;
+  // The random keys of the points kept so far, with their columns in
+  // m_data. The largest key is at the top.
+  std::priority_queue<std::pair<double, std::int64_t>> m_heap;
   vw::TerminalProgressCallback m_tpc;
   std::int64_t m_spacing;
   double m_inc_amount;
@@ -104,18 +135,26 @@ private:
   // This will be called for each point in the cloud.
   virtual bool processOne(PointRef& point) {
 
-    if (m_points_count >= m_num_points_to_load)
+    if (m_num_points_to_load <= 0)
       return false; // done with reading points
 
-    // try next time is above the load ratio
-    double r = (double)std::rand()/(double)RAND_MAX;
-    if (r > m_load_ratio)
+    if (m_verbose && m_num_seen % m_spacing == 0) 
+      m_tpc.report_incremental_progress(m_inc_amount);
+    m_num_seen++;
+    
+    // Skip the point if its key is bigger than the ones kept so far
+    double key = (double)std::rand()/(double)RAND_MAX;
+    bool is_full = (std::int64_t(m_heap.size()) >= m_num_points_to_load);
+    if (is_full && key >= m_heap.top().first)
       return true;
     
     // Current point
     vw::Vector3 xyz(point.getFieldAs<double>(Dimension::Id::X),
                     point.getFieldAs<double>(Dimension::Id::Y),
                     point.getFieldAs<double>(Dimension::Id::Z));
+
+    if (m_has_proj_box && !m_proj_box.contains(subvector(xyz, 0, 2)))
+      return true;
     
     if (m_has_las_georef) {
       // This is a projected point, convert to cartesian
@@ -136,16 +175,18 @@ private:
         return true;
     }
     
-    // Save this point
+    // Save this point, in place of the one with the largest key if the
+    // sample is full
+    std::int64_t col = m_heap.size();
+    if (is_full) {
+      col = m_heap.top().second;
+      m_heap.pop();
+    }
+    m_heap.push(std::make_pair(key, col));
     for (int row = 0; row < asp::DIM; row++)
-      m_data(row, m_points_count) = xyz[row] - m_shift[row];
-    m_data(asp::DIM, m_points_count) = 1; // last field
+      m_data(row, col) = xyz[row] - m_shift[row];
+    m_data(asp::DIM, col) = 1; // last field
 
-    if (m_verbose && m_points_count % m_spacing == 0) 
-      m_tpc.report_incremental_progress(m_inc_amount);
-
-    m_points_count++;
-    
     return true;  
   }
 
@@ -155,7 +196,7 @@ private:
 
   // To be called after all the points are read.
   virtual void done(PointTableRef table) {
-    m_data.conservativeResize(Eigen::NoChange, m_points_count);
+    m_data.conservativeResize(Eigen::NoChange, m_heap.size());
 
     if (m_verbose) 
       m_tpc.report_finished();
@@ -23,6 +23,11 @@
 #include <asp/Core/PdalUtils.h>
 
 #include <vw/Cartography/Chipper.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/Settings.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include <pdal/PointView.hpp>
 #include <pdal/PointTable.hpp>
@@ -42,7 +47,45 @@ using namespace pdal::filters;
 // Read through las points in streaming fashion. When a given amount is collected,
 // write a chip to disk. 
 namespace pdal {
-  
+
+// Organize a buffer of points in small chips, with points in each chip
+// being spatially close together. Then write the result to disk. This
+// runs in a separate thread while the LAS file continues to be read.
+class ChipWriteTask: public vw::Task, private boost::noncopyable {
+
+  boost::shared_ptr<PointBuffer> m_buf;
+  std::int64_t m_tile_len;
+  std::int64_t m_chip_size;
+  bool m_has_georef;
+  vw::cartography::GeoReference m_georef; // a copy, for thread safety
+  vw::GdalWriteOptions const& m_opt;
+  std::string m_out_file;
+
+public:
+  ChipWriteTask(boost::shared_ptr<PointBuffer> buf,
+                std::int64_t tile_len, std::int64_t chip_size,
+                bool has_georef, vw::cartography::GeoReference const& georef,
+                vw::GdalWriteOptions const& opt, std::string const& out_file):
+    m_buf(buf), m_tile_len(tile_len), m_chip_size(chip_size),
+    m_has_georef(has_georef), m_georef(georef), m_opt(opt), m_out_file(out_file) {}
+
+  void operator()() {
+    // TODO(oalexan1): Move Chipper to vw namespace. It is not a pdal class.
+    vw::ImageView<Vector3> Img;
+    pdal::filters::Chipper(*m_buf, m_chip_size, m_has_georef, m_georef,
+                           m_tile_len, m_tile_len, Img);
+    m_buf.reset(); // free the memory early
+
+    // Several tiles may be written at the same time, so do not print
+    // progress, which would be garbled.
+    bool has_nodata = false;
+    double nodata = -std::numeric_limits<double>::max();
+    vw::cartography::block_write_gdal_image(m_out_file, Img, m_has_georef, m_georef, 
+                                            has_nodata, nodata, m_opt,
+                                            vw::ProgressCallback::dummy_instance());
+  }
+};
+
 class PDAL_DLL ChipMaker: public Writer, public Streamable {
 
 public:
@@ -52,16 +95,19 @@ std::string getName() const { return "chip maker"; }
   // Go through a LAS file and write to disk spatially organized tiles.
   // Also converts along the way from projected coordinates (if applicable)
   // to ECEF. 
-  // tile_len is big, but chip_size is small.
+  // tile_len is big, but chip_size is small. Up to max_num_tasks tiles are
+  // chipped and written in parallel, while reading continues.
   ChipMaker(std::int64_t tile_len, std::int64_t chip_size,
             bool has_georef, vw::cartography::GeoReference const& georef,
             vw::GdalWriteOptions & opt, // will change 
             std::string const& out_prefix, 
-            std::vector<std::string> & out_files):
+            std::vector<std::string> & out_files,
+            int max_num_tasks):
     m_tile_len(tile_len), m_chip_size(chip_size), 
     m_has_georef(has_georef), m_georef(georef), m_opt(opt),
     m_out_prefix(out_prefix), m_out_files(out_files),
-    m_tile_count(0), m_buf(PointBuffer()) {}
+    m_tile_count(0), m_buf(PointBuffer()),
+    m_max_num_tasks(std::max(max_num_tasks, 1)), m_num_tasks(0) {}
 
 ~ChipMaker() {} 
 
@@ -76,33 +122,50 @@ private:
   std::vector<std::string> & m_out_files; // alias, used for output
   std::int64_t m_tile_count;
   PointBuffer m_buf;
+  int m_max_num_tasks; // max number of tiles being written at the same time
+  int m_num_tasks;     // number of tiles in the queue
+  boost::shared_ptr<vw::FifoWorkQueue> m_queue;
+  
+  // Wait until all tiles in the queue are written
+  void joinTasks() {
+    if (m_queue.get() != NULL) {
+      m_queue->join_all();
+      m_queue.reset();
+    }
+    m_num_tasks = 0;
+  }
   
   // Call this when the buffer is full or when we are done reading.
-  // Organize the points in small chips, with points in each chip
-  // being spatially close together. Then write each chip to disk.
+  // Hand off the buffer to a task which makes the chips and writes
+  // them to disk. 
   void processBuf() {
     
     if (m_buf.empty()) 
       return;
 
-    // Make the chips
-    // TODO(oalexan1): Move Chipper to vw namespace. It is not a pdal class.
-    vw::ImageView<Vector3> Img;
-    pdal::filters::Chipper(m_buf, m_chip_size, m_has_georef, m_georef,
-            m_tile_len, m_tile_len, Img);
-
-    // Create a file of the form tile with index m_tile_count
+    // Create a file of the form tile with index m_tile_count. The file
+    // names are decided here, so their order does not depend on which
+    // task finishes first.
     std::ostringstream os;
     os << m_out_prefix << "-" << m_tile_count << ".tif";
     std::string out_file = os.str();
     m_out_files.push_back(out_file);
-    
     vw::vw_out() << "Writing temporary file: " << out_file << std::endl;    
-    bool has_nodata = false;
-    double nodata = -std::numeric_limits<double>::max();
-    vw::TerminalProgressCallback tpc("asp", "\t--> ");
-    vw::cartography::block_write_gdal_image(out_file, Img, m_has_georef, m_georef, 
-                                            has_nodata, nodata, m_opt, tpc);
+
+    // Bound the memory usage by the number of buffers in flight
+    if (m_num_tasks >= m_max_num_tasks)
+      joinTasks();
+    if (m_queue.get() == NULL)
+      m_queue.reset(new vw::FifoWorkQueue(m_max_num_tasks));
+
+    // Move the points to the task, and continue reading
+    boost::shared_ptr<PointBuffer> buf(new PointBuffer());
+    std::swap(*buf, m_buf);
+    boost::shared_ptr<ChipWriteTask>
+      task(new ChipWriteTask(buf, m_tile_len, m_chip_size, m_has_georef, m_georef,
+                             m_opt, out_file));
+    m_queue->add_task(task);
+    m_num_tasks++;
     
     // Wipe the buf when done and increment the tile count
     m_buf.clear();
@@ -127,8 +190,9 @@ private:
 
   // To be called after all the points are read.
   virtual void done(PointTableRef table) {
-    // Process the rest of the points
+    // Process the rest of the points, and wait for all tiles to be written
     processBuf();
+    joinTasks();
   }
 
   // Part of the API, not used here.
@@ -623,8 +687,11 @@ void las_or_csv_to_tif(std::string const& in_file,
     int buf_size = 100;
     pdal::FixedPointTable t(buf_size);
     pdal_reader.prepare(t);
+    // Each buffer of points in flight takes about 100 MB, so cap the
+    // number of tiles written in parallel.
+    int max_num_tasks = std::min(int(vw::vw_settings().default_num_threads()), 8);
     pdal::ChipMaker writer(ASP_POINT_CLOUD_TILE_LEN, block_size, has_georef, las_georef, 
-                           opt, out_prefix, out_files);
+                           opt, out_prefix, out_files, max_num_tasks);
     pdal::Options write_options;
     writer.setOptions(write_options);
     writer.setInput(pdal_reader);
@@ -0,0 +1,295 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file PointIndex.cc
+///
+
+#include <asp/Core/PointIndex.h>
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+namespace asp {
+
+  const char POINT_INDEX_MAGIC[9] = "ASPPIX01";
+
+  // About this many points per cell, so a box query reads few points
+  // outside of it
+  const double POINT_INDEX_CELL_POINTS = 1024.0;
+  const int    POINT_INDEX_MAX_GRID    = 4096;
+
+  bool is_point_index(std::string const& file) {
+    return boost::iends_with(file, ".pcidx");
+  }
+
+  // Copy a string into a fixed-size field, always null-terminated
+  void copyName(std::string const& name, char * field, size_t len) {
+    std::memset(field, 0, len);
+    std::strncpy(field, name.c_str(), len - 1);
+  }
+
+  // Longitude and latitude of a point, with the longitude moved by a
+  // multiple of 360 degrees to be closest to the median longitude
+  vw::Vector2 pointLonLat(vw::cartography::Datum const& datum,
+                          double median_longitude, vw::Vector3 const& xyz) {
+    vw::Vector3 llh = datum.cartesian_to_geodetic(xyz);
+    llh[0] += 360.0 * round((median_longitude - llh[0]) / 360.0);
+    return vw::Vector2(llh[0], llh[1]);
+  }
+
+  // The cell having the given value, clamped to the grid
+  std::int32_t pointIndexCell(double val, double min_val, double cell_size,
+                              std::int32_t num_cells) {
+    double cell = std::floor((val - min_val) / cell_size);
+    if (!(cell >= 0)) // also catches NaN
+      return 0;
+    return std::int32_t(std::min(cell, double(num_cells - 1)));
+  }
+
+  void writePointIndex(std::string const& index_file,
+                       vw::cartography::Datum const& datum,
+                       double median_longitude,
+                       DoubleMatrix const& points) {
+
+    std::int64_t num = points.cols();
+    std::vector<vw::Vector2> lonlat(num);
+    vw::BBox2 box;
+    for (std::int64_t it = 0; it < num; it++) {
+      vw::Vector3 xyz(points(0, it), points(1, it), points(2, it));
+      lonlat[it] = pointLonLat(datum, median_longitude, xyz);
+      if (lonlat[it] == lonlat[it]) // skip NaN
+        box.grow(lonlat[it]);
+    }
+    if (box.empty())
+      box = vw::BBox2(0, 0, 0, 0);
+
+    // A grid with about the aspect ratio of the box, in degrees
+    PointIndexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    double width  = std::max(box.width(),  1e-9);
+    double height = std::max(box.height(), 1e-9);
+    double num_cells = std::max(1.0, num / POINT_INDEX_CELL_POINTS);
+    double grid_cols = std::round(std::sqrt(num_cells * width / height));
+    grid_cols = std::max(1.0, std::min(grid_cols, double(POINT_INDEX_MAX_GRID)));
+    double grid_rows = std::ceil(num_cells / grid_cols);
+    grid_rows = std::max(1.0, std::min(grid_rows, double(POINT_INDEX_MAX_GRID)));
+
+    header.num_points       = num;
+    header.lon_min          = box.min().x();
+    header.lat_min          = box.min().y();
+    header.grid_cols        = grid_cols;
+    header.grid_rows        = grid_rows;
+    // Pad the cells a little so the points on the far edges fall inside
+    header.cell_lon         = width  * (1.0 + 1e-9) / header.grid_cols;
+    header.cell_lat         = height * (1.0 + 1e-9) / header.grid_rows;
+    header.semi_major       = datum.semi_major_axis();
+    header.semi_minor       = datum.semi_minor_axis();
+    header.meridian_offset  = datum.meridian_offset();
+    header.median_longitude = median_longitude;
+    copyName(datum.name(),          header.datum_name,    sizeof(header.datum_name));
+    copyName(datum.spheroid_name(), header.spheroid_name, sizeof(header.spheroid_name));
+    copyName(datum.meridian_name(), header.meridian_name, sizeof(header.meridian_name));
+
+    // Sort the points by cell, keeping their order within each cell
+    std::int64_t total_cells = std::int64_t(header.grid_cols) * header.grid_rows;
+    std::vector<std::uint64_t> offsets(total_cells + 1, 0);
+    std::vector<std::int64_t> cells(num);
+    for (std::int64_t it = 0; it < num; it++) {
+      cells[it] = std::int64_t(pointIndexCell(lonlat[it].y(), header.lat_min,
+                                              header.cell_lat, header.grid_rows))
+        * header.grid_cols
+        + pointIndexCell(lonlat[it].x(), header.lon_min, header.cell_lon, header.grid_cols);
+      offsets[cells[it] + 1]++;
+    }
+    lonlat = std::vector<vw::Vector2>(); // free the memory
+    for (std::int64_t cell = 0; cell < total_cells; cell++)
+      offsets[cell + 1] += offsets[cell];
+    std::vector<std::uint64_t> pos(offsets.begin(), offsets.end() - 1);
+    std::vector<std::uint64_t> order(num);
+    for (std::int64_t it = 0; it < num; it++)
+      order[pos[cells[it]]++] = it;
+    cells = std::vector<std::int64_t>();
+
+    std::string tmp_file = fs::unique_path(index_file + ".%%%%-%%%%.tmp").string();
+    std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+    if (!ofs.good())
+      vw::vw_throw(vw::IOErr() << "Cannot write: " << tmp_file << "\n");
+    ofs.write(POINT_INDEX_MAGIC, 8);
+    ofs.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<char const*>(&offsets[0]),
+              offsets.size() * sizeof(std::uint64_t));
+
+    // Write the points in large blocks
+    const std::int64_t block_size = 1000000;
+    std::vector<double> buf;
+    for (std::int64_t beg = 0; beg < num; beg += block_size) {
+      std::int64_t end = std::min(num, beg + block_size);
+      buf.resize(3 * (end - beg));
+      for (std::int64_t it = beg; it < end; it++) {
+        for (int c = 0; c < 3; c++)
+          buf[3 * (it - beg) + c] = points(c, order[it]);
+      }
+      ofs.write(reinterpret_cast<char const*>(&buf[0]), buf.size() * sizeof(double));
+    }
+    ofs.close();
+    if (!ofs)
+      vw::vw_throw(vw::IOErr() << "Failed writing: " << tmp_file << "\n");
+
+    fs::rename(tmp_file, index_file);
+  }
+
+  PointIndex::PointIndex(std::string const& index_file) {
+
+    m_file.open(index_file);
+    if (!m_file.is_open() || m_file.size() < 8 + sizeof(PointIndexHeader) ||
+        std::memcmp(m_file.data(), POINT_INDEX_MAGIC, 8) != 0)
+      vw::vw_throw(vw::IOErr() << "Invalid point index: " << index_file << "\n");
+
+    std::memcpy(&m_header, m_file.data() + 8, sizeof(m_header));
+    if (m_header.grid_cols <= 0 || m_header.grid_rows <= 0 ||
+        !(m_header.cell_lon > 0) || !(m_header.cell_lat > 0))
+      vw::vw_throw(vw::IOErr() << "Invalid point index: " << index_file << "\n");
+    // Ensure the names are terminated
+    m_header.datum_name   [sizeof(m_header.datum_name)    - 1] = '\0';
+    m_header.spheroid_name[sizeof(m_header.spheroid_name) - 1] = '\0';
+    m_header.meridian_name[sizeof(m_header.meridian_name) - 1] = '\0';
+
+    std::uint64_t num_cells = std::uint64_t(m_header.grid_cols) * m_header.grid_rows;
+    std::uint64_t len = 8 + sizeof(PointIndexHeader)
+      + (num_cells + 1) * sizeof(std::uint64_t)
+      + m_header.num_points * 3 * sizeof(double);
+    if (m_file.size() != len)
+      vw::vw_throw(vw::IOErr() << "Truncated point index: " << index_file << "\n");
+  }
+
+  vw::cartography::Datum PointIndex::datum() const {
+    return vw::cartography::Datum(m_header.datum_name, m_header.spheroid_name,
+                                  m_header.meridian_name, m_header.semi_major,
+                                  m_header.semi_minor, m_header.meridian_offset);
+  }
+
+  void PointIndex::load(std::int64_t num_points_to_load, vw::BBox2 const& lonlat_box,
+                        bool calc_shift, vw::Vector3 & shift,
+                        bool verbose, DoubleMatrix & data) const {
+
+    char const* offsets = m_file.data() + 8 + sizeof(PointIndexHeader);
+    std::uint64_t num_cells = std::uint64_t(m_header.grid_cols) * m_header.grid_rows;
+    char const* points = offsets + (num_cells + 1) * sizeof(std::uint64_t);
+    auto offset = [&](std::uint64_t cell) {
+      std::uint64_t val = 0;
+      std::memcpy(&val, offsets + cell * sizeof(std::uint64_t), sizeof(val));
+      return val;
+    };
+
+    // The ranges of cells overlapping the box. The box may be in a different
+    // 360-degree longitude range than the grid, so try it shifted both ways.
+    struct CellRange {
+      vw::BBox2 box;
+      std::int32_t col_beg, col_end, row_beg, row_end; // inclusive
+    };
+    std::vector<CellRange> ranges;
+    if (lonlat_box.empty()) {
+      CellRange r = {vw::BBox2(), 0, m_header.grid_cols - 1, 0, m_header.grid_rows - 1};
+      ranges.push_back(r);
+    } else {
+      vw::BBox2 grid_box(m_header.lon_min, m_header.lat_min,
+                         m_header.grid_cols * m_header.cell_lon,
+                         m_header.grid_rows * m_header.cell_lat);
+      for (int k = -1; k <= 1; k++) {
+        vw::BBox2 box = lonlat_box + vw::Vector2(360.0 * k, 0.0);
+        if (!box.intersects(grid_box))
+          continue;
+        CellRange r;
+        r.box     = box;
+        r.col_beg = pointIndexCell(box.min().x(), m_header.lon_min, m_header.cell_lon,
+                                   m_header.grid_cols);
+        r.col_end = pointIndexCell(box.max().x(), m_header.lon_min, m_header.cell_lon,
+                                   m_header.grid_cols);
+        r.row_beg = pointIndexCell(box.min().y(), m_header.lat_min, m_header.cell_lat,
+                                   m_header.grid_rows);
+        r.row_end = pointIndexCell(box.max().y(), m_header.lat_min, m_header.cell_lat,
+                                   m_header.grid_rows);
+        ranges.push_back(r);
+      }
+    }
+
+    // The points in the box. Only the points in the cells on the edges of
+    // a range need checking.
+    vw::cartography::Datum d = this->datum();
+    std::vector<std::uint64_t> in_box;
+    for (auto const& r: ranges) {
+      for (std::int32_t row = r.row_beg; row <= r.row_end; row++) {
+        for (std::int32_t col = r.col_beg; col <= r.col_end; col++) {
+          bool check = (!r.box.empty() &&
+                        (row == r.row_beg || row == r.row_end ||
+                         col == r.col_beg || col == r.col_end));
+          std::uint64_t cell = std::uint64_t(row) * m_header.grid_cols + col;
+          std::uint64_t beg = offset(cell), end = offset(cell + 1);
+          for (std::uint64_t k = beg; k < end; k++) {
+            if (check) {
+              vw::Vector3 xyz;
+              std::memcpy(&xyz[0], points + k * 3 * sizeof(double), 3 * sizeof(double));
+              if (!r.box.contains(pointLonLat(d, m_header.median_longitude, xyz)))
+                continue;
+            }
+            in_box.push_back(k);
+          }
+        }
+      }
+    }
+    if (verbose)
+      vw::vw_out() << "Found " << in_box.size() << " points in the index within the box.\n";
+
+    // Pick the points evenly if there are too many
+    std::int64_t num_in_box = in_box.size();
+    std::int64_t points_count = std::max(std::int64_t(0),
+                                         std::min(num_in_box, num_points_to_load));
+    data.conservativeResize(DIM + 1, points_count);
+    for (std::int64_t it = 0; it < points_count; it++) {
+      std::uint64_t k = in_box[(it * num_in_box) / points_count];
+      vw::Vector3 xyz;
+      std::memcpy(&xyz[0], points + k * 3 * sizeof(double), 3 * sizeof(double));
+      if (calc_shift && it == 0)
+        shift = xyz;
+      for (int c = 0; c < DIM; c++)
+        data(c, it) = xyz[c] - shift[c];
+      data(DIM, it) = 1; // Extend to be a homogenous coordinate
+    }
+  }
+
+  void load_point_index(std::string const& file_name,
+                        std::int64_t num_points_to_load, vw::BBox2 const& lonlat_box,
+                        bool calc_shift, vw::Vector3 & shift,
+                        double & median_longitude, bool verbose,
+                        DoubleMatrix & data) {
+    PointIndex index(file_name);
+    median_longitude = index.median_longitude();
+    index.load(num_points_to_load, lonlat_box, calc_shift, shift, verbose, data);
+  }
+
+} // end namespace asp
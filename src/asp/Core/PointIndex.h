@@ -0,0 +1,99 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file PointIndex.h
+///
+
+// A spatial index of a point cloud, made by pc_index and read by pc_align.
+// The ECEF points are sorted into a grid of cells in longitude and
+// latitude, and the file is mapped into memory. Then loading the points in
+// a lon-lat box touches only the cells overlapping it, with no parsing or
+// conversion of the original cloud. This is useful when many clouds are
+// aligned to the same large reference cloud.
+
+#ifndef __ASP_CORE_POINT_INDEX_H__
+#define __ASP_CORE_POINT_INDEX_H__
+
+#include <asp/Core/EigenUtils.h>
+
+#include <vw/Math/BBox.h>
+#include <vw/Cartography/Datum.h>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace asp {
+
+  // The file starts with the 8-byte magic "ASPPIX01" and this header. Then
+  // come num_cells + 1 offsets, as uint64, with the points of cell k having
+  // the indices from offsets[k] to offsets[k + 1]. The cells are stored row
+  // after row, with the rows going up in latitude. Then come the points, as
+  // three doubles each. All values are little-endian.
+  struct PointIndexHeader {
+    std::uint64_t num_points;
+    double        lon_min, lat_min;       // corner of the grid, in degrees
+    double        cell_lon, cell_lat;     // size of each cell, in degrees
+    double        semi_major, semi_minor, meridian_offset;
+    double        median_longitude;       // as found when loading the cloud
+    std::int32_t  grid_cols, grid_rows;
+    char          datum_name[128], spheroid_name[128], meridian_name[128];
+  };
+
+  /// Return true if this is a point index file, with the .pcidx extension
+  bool is_point_index(std::string const& file);
+
+  /// Sort the given points into cells and write the index. The points are
+  /// in the columns of the matrix, with no shift applied. The file is
+  /// written under a unique name first and then renamed, so that it is
+  /// never seen partially written.
+  void writePointIndex(std::string const& index_file,
+                       vw::cartography::Datum const& datum,
+                       double median_longitude,
+                       DoubleMatrix const& points);
+
+  /// A point index, mapped into memory
+  class PointIndex {
+    boost::iostreams::mapped_file_source m_file;
+    PointIndexHeader m_header;
+
+  public:
+    PointIndex(std::string const& index_file);
+
+    std::uint64_t num_points() const { return m_header.num_points; }
+    double median_longitude() const { return m_header.median_longitude; }
+    vw::cartography::Datum datum() const;
+
+    /// Load up to the given number of points within the lon-lat box, or
+    /// all points if the box is empty. The points are picked evenly from
+    /// the cells overlapping the box. The data is as from load_dem().
+    void load(std::int64_t num_points_to_load, vw::BBox2 const& lonlat_box,
+              bool calc_shift, vw::Vector3 & shift,
+              bool verbose, DoubleMatrix & data) const;
+  };
+
+  /// Load a point index, perhaps subsampling it along the way
+  void load_point_index(std::string const& file_name,
+                        std::int64_t num_points_to_load, vw::BBox2 const& lonlat_box,
+                        bool calc_shift, vw::Vector3 & shift,
+                        double & median_longitude, bool verbose,
+                        DoubleMatrix & data);
+
+} // end namespace asp
+
+#endif // __ASP_CORE_POINT_INDEX_H__
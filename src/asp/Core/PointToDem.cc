@@ -40,7 +40,8 @@ DemOptions::DemOptions():
   erode_len(0), search_radius_factor(0), sigma_factor(0),
   default_grid_size_multiplier(1.0), use_surface_sampling(false),
   has_las_or_csv_or_pcd(false), max_output_size(9999999, 9999999), 
-  auto_proj_center(false), input_is_projected(false) {}
+  auto_proj_center(false), input_is_projected(false), fused_rasterization(false),
+  cog(false) {}
 
 // Create an antialiased DEM. This is old code. Needs to be wiped at some point.
 ImageViewRef<PixelGray<float>>
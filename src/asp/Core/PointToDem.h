@@ -23,6 +23,7 @@
 
 #include <vw/FileIO/GdalWriteOptions.h>
 #include <asp/Core/OrthoRasterizer.h>
+#include <asp/Core/ProfileUtils.h>
 
 namespace vw {
   namespace cartography {
@@ -79,10 +80,13 @@ struct DemOptions: vw::GdalWriteOptions {
   bool        use_surface_sampling;
   bool        has_las_or_csv_or_pcd, auto_proj_center;
   vw::Vector2i max_output_size;
-  bool        input_is_projected;
+  bool        input_is_projected, fused_rasterization, cog;
 
   // Output
-  std::string out_prefix, output_file_type;
+  std::string out_prefix, output_file_type, profile_report;
+
+  // Set if profile_report is not empty
+  boost::shared_ptr<asp::RunProfiler> profiler;
   
   // Constructor
   DemOptions();
@@ -62,7 +62,7 @@ void save_image(DemOptions & opt, ImageT img, vw::cartography::GeoReference cons
   if (opt.output_file_type == "tif")
     asp::save_with_temp_big_blocks(block_size, output_file, img,
                                     has_georef, georef,
-                                    has_nodata, opt.nodata_value, opt, tpc);
+                                    has_nodata, opt.nodata_value, opt, tpc, opt.cog);
   else 
     vw::cartography::write_gdal_image(output_file, img, georef, opt, tpc);
 } // End function save_image
@@ -231,24 +231,16 @@ CombinedAbsView combine_abs_channels(double nodata_value,
   return CombinedAbsView(nodata_value, image1, image2, image3);
 }
 
-// Save the DEM
+// Save the DEM, given the gridded heights. The value stored in
+// num_invalid_pixels gets updated as the heights are gridded, as
+// OrthoRasterizerView has a pointer to it. The caller must reset it before
+// that starts.
 void save_dem(DemOptions & opt,
               vw::cartography::GeoReference const& georef,
-              asp::OrthoRasterizerView& rasterizer, 
+              ImageViewRef<PixelGray<float>> rasterizer_fsaa,
               Vector2 const& tile_size,
               std::int64_t * num_invalid_pixels) {
 
-  // The value stored in num_invalid_pixels will get updated as the DEM is being
-  // written to disk. That because OrthoRasterizerView has a pointer to it.
-  // This must be reset before each use. 
-  // TODO(oalexan1): This logic is confusing. Better have two member functions that
-  // first reset and later get this number.
-  *num_invalid_pixels = 0;
- 
-   // We use the existing texture channel, which is the height.
-   ImageViewRef<PixelGray<float>> rasterizer_fsaa
-    = generate_fsaa_raster(rasterizer, opt);
-
   Stopwatch sw2;
   sw2.start();
   ImageViewRef<PixelGray<float>> dem
@@ -474,6 +466,106 @@ void save_ortho(DemOptions & opt,
   vw_out(DebugMessage,"asp") << "DRG render time: " << sw3.elapsed_seconds() << "\n";
 }
 
+// If the error image can be gridded as a single band, so with the DEM.
+bool is_scalar_error(DemOptions const& opt, bool has_stddev) {
+  int num_channels = asp::num_channels(opt.pointcloud_files);
+  return (num_channels == 4 || (num_channels == 6 && has_stddev) || opt.scalar_error);
+}
+
+// Fusing needs the Point2Grid algorithm with no oversampling, and something
+// besides the DEM to grid. The error as a 3D vector and the orthoimage with
+// hole-filling are still done separately.
+bool can_fuse_rasterization(DemOptions const& opt, bool has_stddev) {
+  if (opt.use_surface_sampling || opt.fsaa > 1)
+    return false;
+  bool fuse_error = (opt.do_error && is_scalar_error(opt, has_stddev));
+  bool fuse_ortho = (opt.do_ortho && opt.ortho_hole_fill_len == 0);
+  return (fuse_error || opt.propagate_errors || fuse_ortho);
+}
+
+// Grid in one pass over the cloud the DEM, and the scalar error, stddev, and
+// orthoimage, if requested, rather than reading and filtering the cloud once
+// per output. The result is written to a temporary multi-band file, which
+// is then split into the individual outputs.
+void do_fused_rasterization(asp::OrthoRasterizerView& rasterizer,
+                            DemOptions & opt, bool has_stddev,
+                            vw::cartography::GeoReference const& georef,
+                            Vector2 const& tile_size,
+                            std::int64_t * num_invalid_pixels) {
+
+  // The extra textures, and the names and rounding of the outputs
+  std::vector<ImageViewRef<double>> extra_textures;
+  std::vector<std::string> names;
+  std::vector<double> rounding;
+  if (opt.do_error && is_scalar_error(opt, has_stddev)) {
+    extra_textures.push_back(asp::point_cloud_error_image(opt.pointcloud_files));
+    names.push_back("IntersectionErr");
+    rounding.push_back(opt.rounding_error);
+  }
+  if (opt.propagate_errors) {
+    vw_out() << "Not rounding propagated errors (option: --rounding-error) to avoid "
+             << "introducing step artifacts.\n";
+    ImageViewRef<Vector6> point_disk_image = asp::form_point_cloud_composite<Vector6>
+      (opt.pointcloud_files, ASP_MAX_SUBBLOCK_SIZE);
+    extra_textures.push_back(select_channel(point_disk_image, 4));
+    names.push_back("HorizontalStdDev");
+    rounding.push_back(0.0);
+    extra_textures.push_back(select_channel(point_disk_image, 5));
+    names.push_back("VerticalStdDev");
+    rounding.push_back(0.0);
+  }
+  if (opt.do_ortho && opt.ortho_hole_fill_len == 0) {
+    ImageViewRef<PixelGray<float>> texture
+      = asp::form_point_cloud_composite<PixelGray<float>>
+      (opt.texture_files, ASP_MAX_SUBBLOCK_SIZE);
+    extra_textures.push_back(pixel_cast<double>(texture));
+    names.push_back("DRG");
+    rounding.push_back(0.0);
+  }
+
+  Stopwatch sw;
+  sw.start();
+  boost::shared_ptr<asp::ProfileStage>
+    grid_stage(new asp::ProfileStage(opt.profiler, "FusedGridding"));
+  
+  // The main texture stays the height. Grid it all to a temporary file.
+  // The invalid pixel count is updated as the heights are gridded.
+  rasterizer.set_extra_textures(extra_textures);
+  asp::FusedOrthoRasterizerView fused(rasterizer);
+  std::string fused_file = opt.out_prefix + "-fused-tmp.tif";
+  vw_out() << "Gridding the DEM and " << names.size()
+           << " other output(s) in one pass.\n";
+  *num_invalid_pixels = 0;
+  bool has_georef = true, has_nodata = true;
+  vw::cartography::block_write_gdal_image(fused_file, fused, has_georef, georef,
+                                          has_nodata, opt.nodata_value, opt,
+                                          TerminalProgressCallback("asp", "Gridding: "));
+  rasterizer.set_extra_textures(std::vector<ImageViewRef<double>>());
+  grid_stage.reset();
+  sw.stop();
+  vw_out(DebugMessage,"asp") << "Fused render time: " << sw.elapsed_seconds() << "\n";
+
+  // Split into the individual outputs
+  {
+    asp::ProfileStage stage(opt.profiler, "FusedSplit");
+    DiskImageView<float> fused_image(fused_file);
+    if (!opt.no_dem)
+      save_dem(opt, georef, pixel_cast<PixelGray<float>>(select_plane(fused_image, 0)),
+               tile_size, num_invalid_pixels);
+    for (size_t it = 0; it < names.size(); it++) {
+      int hole_fill_len = 0;
+      ImageViewRef<PixelGray<float>> band
+        = pixel_cast<PixelGray<float>>(select_plane(fused_image, it + 1));
+      save_image(opt, asp::round_image_pixels_skip_nodata(band, rounding[it],
+                                                          opt.nodata_value),
+                 georef, hole_fill_len, names[it]);
+    }
+  }
+
+  if (fs::exists(fused_file))
+    fs::remove(fused_file);
+}
+
 // Rasterize a DEM, and perhaps the error image, orthoimage, stddev, etc. 
 // This may be called several times, with different grid sizes.
 void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
@@ -527,18 +619,9 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
   Vector2 tile_size(vw_settings().default_tile_size(),
                     vw_settings().default_tile_size());
   
-  // Write out the DEM. We've set the texture to be the height.
-  // This must happen before we set the texture to something else.
-  if (!opt.no_dem)
-     save_dem(opt, georef, rasterizer, tile_size, num_invalid_pixels);
-  
   // If the point cloud has propagated stddev affects how we write the error image.   
   bool has_stddev = asp::has_stddev(opt.pointcloud_files);
   
-  // Write triangulation error image if requested
-  if (opt.do_error)
-    save_intersection_error(opt, has_stddev, georef, tile_size, rasterizer);
-
   if (opt.propagate_errors && !has_stddev) {
     // Do not throw an error. Go on and save at least the intersection
     // error and orthoimage.
@@ -546,9 +629,43 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
              << "cloud file is not in the expected format.\n";
     opt.propagate_errors = false;
   }
+
+  bool do_ortho = opt.do_ortho;
+  if (opt.fused_rasterization && can_fuse_rasterization(opt, has_stddev)) {
+    // The DEM, scalar error, stddev, and orthoimage without hole-filling are
+    // gridded together. What is left for later is only the orthoimage with
+    // hole-filling.
+    do_fused_rasterization(rasterizer, opt, has_stddev, georef, tile_size,
+                           num_invalid_pixels);
+    do_ortho = (opt.do_ortho && opt.ortho_hole_fill_len > 0);
+  } else {
+
+    if (opt.fused_rasterization)
+      vw_out(WarningMessage) << "Cannot use --fused-rasterization with these "
+                             << "options. Gridding each output separately.\n";
+    
+    // Write out the DEM. We've set the texture to be the height.
+    // This must happen before we set the texture to something else.
+    if (!opt.no_dem) {
+      asp::ProfileStage stage(opt.profiler, "DEM");
+      // The value stored in num_invalid_pixels will get updated as the DEM is
+      // being written to disk. This must be reset before each use.
+      *num_invalid_pixels = 0;
+      save_dem(opt, georef, generate_fsaa_raster(rasterizer, opt), tile_size,
+               num_invalid_pixels);
+    }
   
-  if (opt.propagate_errors)
-    save_stddev(opt, georef, rasterizer);
+    // Write triangulation error image if requested
+    if (opt.do_error) {
+      asp::ProfileStage stage(opt.profiler, "IntersectionErr");
+      save_intersection_error(opt, has_stddev, georef, tile_size, rasterizer);
+    }
+
+    if (opt.propagate_errors) {
+      asp::ProfileStage stage(opt.profiler, "StdDev");
+      save_stddev(opt, georef, rasterizer);
+    }
+  }
   
   // Write out a normalized version of the DEM, if requested (for debugging).
   // Here the DEM is read back and written normalized to a new file.
@@ -566,8 +683,10 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
   // Write DRG if the user requested and provided a texture file.
   // This must be at the end, as we may be messing with the point
   // image in irreversible ways.
-  if (opt.do_ortho)
-   save_ortho(opt, georef, rasterizer);
+  if (do_ortho) {
+    asp::ProfileStage stage(opt.profiler, "DRG");
+    save_ortho(opt, georef, rasterizer);
+  }
   
 } // End do_software_rasterization
 
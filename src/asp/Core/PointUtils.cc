@@ -21,11 +21,15 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/PointIndex.h>
 #include <vw/Core/Stopwatch.h>
 
 #include <boost/math/special_functions/fpclassify.hpp>
 #include <boost/math/special_functions/next.hpp>
 
+#include <algorithm>
+#include <fstream>
+
 using namespace vw;
 using namespace vw::cartography;
 
@@ -239,11 +243,13 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
     return values;
   }
   
+  // Use strtok_r() so that lines can be parsed from multiple threads
   char * ptr = temp;
+  char * saveptr = NULL;
   while (1) {
 
     col_index++; // Increment the column counter
-    const char* token = strtok(ptr, sep.c_str());  // Split line on seperator char
+    const char* token = strtok_r(ptr, sep.c_str(), &saveptr);  // Split line on seperator char
     ptr = NULL; // After the first call, strtok expects a null pointer as input.
     if (token == NULL) break; // no more tokens
     if (num_values_read >= this->num_fields) break; // read enough values
@@ -970,6 +976,8 @@ std::string asp::get_cloud_type(std::string const& file_name) {
     return "CSV";
   if (asp::is_las(file_name))
     return "LAS";
+  if (asp::is_point_index(file_name))
+    return "INDEX";
 
   // Note that any tif, ntf, and cub file with one channel with georeference be
   // interpreted as a DEM.
@@ -1051,3 +1059,47 @@ vw::ImageViewRef<double> asp::point_cloud_error_image
 
   return error_image;
 }
+
+vw::Vector3 asp::find_approx_points_median(std::vector<vw::Vector3> const& points) {
+
+  // Find the median of the x coordinates of points, then of y, then of
+  // z. Perturb the median a bit to ensure it is never exactly on top
+  // of a real point, as in such a case after subtraction of that
+  // point from median we'd get the zero vector which by convention
+  // is invalid.
+
+  if (points.empty())
+    return Vector3();
+
+  Vector3 median;
+  std::vector<double> V(points.size());
+  for (int i = 0; i < (int)median.size(); i++){
+    for (int p = 0; p < (int)points.size(); p++) V[p] = points[p][i];
+    std::sort(V.begin(), V.end());
+    median[i] = V[points.size()/2];
+
+    median[i] += median[i]*1e-10*rand()/double(RAND_MAX);
+  }
+
+  return median;
+}
+
+bool asp::read_point(std::string const& file, vw::Vector3 & point) {
+  point = Vector3();
+  
+  std::ifstream fh(file.c_str());
+  if (!fh.good()) return false;
+  
+  for (int c = 0; c < (int)point.size(); c++)
+    if (! (fh >> point[c]) ) return false;
+
+  return true;
+}
+
+void asp::write_point(std::string const& file, vw::Vector3 const& point) {
+  std::ofstream fh(file.c_str());
+  fh.precision(18); // precision(16) is not enough
+  for (int c = 0; c < (int)point.size(); c++)
+    fh << point[c] << " ";
+  fh << std::endl;
+}
@@ -33,6 +33,7 @@
 #include <vw/FileIO/DiskImageUtils.h>
 
 #include <asp/Core/Common.h>
+#include <asp/Core/MappedPointCloud.h>
 
 namespace vw{
   namespace cartography {
@@ -360,6 +361,11 @@ vw::ImageViewRef<vw::Vector<double, m>> read_asp_point_cloud(std::string const&
   std::string shift_str;
   boost::shared_ptr<vw::DiskImageResource> rsrc
     ( new vw::DiskImageResourceGDAL(filename) );
+  // If there is a current memory-mapped copy of the cloud, use it, as it
+  // needs no decoding.
+  if (asp::have_mapped_point_cloud(filename, rsrc->cols(), rsrc->rows(), m))
+    return asp::MappedPointCloudView<m>(asp::mapped_point_cloud_name(filename));
+
   if (vw::cartography::read_header_string(*rsrc.get(), asp::ASP_POINT_OFFSET_TAG_STR, shift_str)){
     shift = vw::str_to_vec<vw::Vector3>(shift_str);
   }
@@ -465,6 +471,14 @@ vw::ImageViewRef<double> error_norm(std::vector<std::string> const& pc_files){
 // Get a handle to the error image given a set of point clouds with 4 or 6 bands
 vw::ImageViewRef<double> point_cloud_error_image(std::vector<std::string> const& pointcloud_files);
 
+// Find the median of each coordinate of the points, perturbed a bit so
+// that it is never a point itself. Used as the point cloud center.
+vw::Vector3 find_approx_points_median(std::vector<vw::Vector3> const& points);
+
+// Read and write a point as text, such as the point cloud center
+bool read_point(std::string const& file, vw::Vector3 & point);
+void write_point(std::string const& file, vw::Vector3 const& point);
+
 } // End namespace asp
 
 #endif
@@ -0,0 +1,173 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file ProfileUtils.cc
+///
+
+#include <asp/Core/ProfileUtils.h>
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+
+#include <sys/resource.h>
+#include <time.h>
+
+namespace asp {
+
+double wallTime() {
+  return std::chrono::duration<double>
+    (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double processCpuTime() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0.0;
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+    + 1.0e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+double threadCpuTime() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    return 0.0;
+  return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+std::int64_t peakRss() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  return std::int64_t(usage.ru_maxrss);        // bytes on OSX
+#else
+  return std::int64_t(usage.ru_maxrss) * 1024; // kilobytes on Linux
+#endif
+}
+
+// Use the "rchar" field of /proc/self/io. That counts reads served from the
+// page cache as well, which is what matters when decompressing the inputs.
+// Not available on OSX, so return 0 there.
+std::int64_t bytesRead() {
+  std::ifstream ifs("/proc/self/io");
+  std::string name;
+  std::int64_t val = 0;
+  while (ifs >> name >> val) {
+    if (name == "rchar:")
+      return val;
+  }
+  return 0;
+}
+
+RunProfiler::RunProfiler(): m_start_wall_time(wallTime()) {}
+
+void RunProfiler::addStage(StageRecord const& rec) {
+  vw::Mutex::Lock lock(m_mutex);
+  m_stages.push_back(rec);
+}
+
+void RunProfiler::addTile(vw::BBox2i const& box, double wall_time, double cpu_time,
+                          std::int64_t cloud_pixels, std::int64_t points_binned) {
+  vw::Mutex::Lock lock(m_mutex);
+  TileRecord rec;
+  rec.stage         = m_current_stage;
+  rec.box           = box;
+  rec.wall_time     = wall_time;
+  rec.cpu_time      = cpu_time;
+  rec.cloud_pixels  = cloud_pixels;
+  rec.points_binned = points_binned;
+  m_tiles.push_back(rec);
+}
+
+void RunProfiler::setCurrentStage(std::string const& name) {
+  vw::Mutex::Lock lock(m_mutex);
+  m_current_stage = name;
+}
+
+std::string RunProfiler::currentStage() const {
+  vw::Mutex::Lock lock(m_mutex);
+  return m_current_stage;
+}
+
+void RunProfiler::writeJson(std::string const& file) const {
+
+  vw::Mutex::Lock lock(m_mutex);
+
+  std::ofstream ofs(file.c_str());
+  if (!ofs.good())
+    vw_throw(vw::IOErr() << "Could not write: " << file << "\n");
+
+  // Stage names are set in the code, so they need no escaping
+  ofs << std::setprecision(9);
+  ofs << "{\n";
+  ofs << "  \"total_wall_time\": " << wallTime() - m_start_wall_time << ",\n";
+  ofs << "  \"total_cpu_time\": " << processCpuTime() << ",\n";
+  ofs << "  \"peak_rss\": " << peakRss() << ",\n";
+  ofs << "  \"stages\": [";
+  for (size_t it = 0; it < m_stages.size(); it++) {
+    StageRecord const& S = m_stages[it];
+    ofs << (it == 0 ? "\n" : ",\n")
+        << "    {\"name\": \"" << S.name << "\", \"wall_time\": " << S.wall_time
+        << ", \"cpu_time\": " << S.cpu_time << ", \"bytes_read\": " << S.bytes_read
+        << ", \"peak_rss\": " << S.peak_rss << "}";
+  }
+  ofs << "\n  ],\n";
+  ofs << "  \"tiles\": [";
+  for (size_t it = 0; it < m_tiles.size(); it++) {
+    TileRecord const& T = m_tiles[it];
+    ofs << (it == 0 ? "\n" : ",\n")
+        << "    {\"stage\": \"" << T.stage << "\", \"box\": [" << T.box.min().x()
+        << ", " << T.box.min().y() << ", " << T.box.width() << ", " << T.box.height()
+        << "], \"wall_time\": " << T.wall_time << ", \"cpu_time\": " << T.cpu_time
+        << ", \"cloud_pixels\": " << T.cloud_pixels
+        << ", \"points_binned\": " << T.points_binned << "}";
+  }
+  ofs << "\n  ]\n";
+  ofs << "}\n";
+}
+
+ProfileStage::ProfileStage(boost::shared_ptr<RunProfiler> profiler,
+                           std::string const& name):
+  m_profiler(profiler), m_name(name), m_wall_time(0), m_cpu_time(0), m_bytes_read(0) {
+  if (!m_profiler)
+    return;
+  m_prev_stage = m_profiler->currentStage();
+  m_profiler->setCurrentStage(name);
+  m_wall_time  = wallTime();
+  m_cpu_time   = processCpuTime();
+  m_bytes_read = bytesRead();
+}
+
+ProfileStage::~ProfileStage() {
+  if (!m_profiler)
+    return;
+  RunProfiler::StageRecord rec;
+  rec.name       = m_name;
+  rec.wall_time  = wallTime() - m_wall_time;
+  rec.cpu_time   = processCpuTime() - m_cpu_time;
+  rec.bytes_read = bytesRead() - m_bytes_read;
+  rec.peak_rss   = peakRss();
+  m_profiler->addStage(rec);
+  m_profiler->setCurrentStage(m_prev_stage);
+}
+
+} // End namespace asp
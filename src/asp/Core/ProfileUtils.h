@@ -0,0 +1,99 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file ProfileUtils.h
+///
+
+// Utilities for recording the time and memory used by the stages of a tool,
+// and by the tiles it processes, and saving that as a JSON report.
+
+#ifndef __ASP_CORE_PROFILE_UTILS_H__
+#define __ASP_CORE_PROFILE_UTILS_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Math/BBox.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+// Process and thread resource usage, as read from the system
+double wallTime();          // seconds since some fixed point
+double processCpuTime();    // all threads, seconds
+double threadCpuTime();     // current thread, seconds
+std::int64_t peakRss();     // bytes
+std::int64_t bytesRead();   // bytes read by the process, from any source
+
+// Collect per-stage and per-tile measurements. This is thread-safe.
+class RunProfiler {
+public:
+
+  struct StageRecord {
+    std::string name;
+    double wall_time, cpu_time;
+    std::int64_t bytes_read, peak_rss;
+  };
+
+  struct TileRecord {
+    std::string stage;
+    vw::BBox2i box;
+    double wall_time, cpu_time;
+    std::int64_t cloud_pixels, points_binned;
+  };
+
+  RunProfiler();
+
+  void addStage(StageRecord const& rec);
+  void addTile(vw::BBox2i const& box, double wall_time, double cpu_time,
+               std::int64_t cloud_pixels, std::int64_t points_binned);
+
+  // The stage with which new tiles will be tagged
+  void setCurrentStage(std::string const& name);
+  std::string currentStage() const;
+
+  // Write all records as JSON
+  void writeJson(std::string const& file) const;
+
+private:
+  mutable vw::Mutex m_mutex;
+  std::string m_current_stage;
+  double m_start_wall_time;
+  std::vector<StageRecord> m_stages;
+  std::vector<TileRecord> m_tiles;
+};
+
+// Measure a stage from construction to destruction. Does nothing if the
+// profiler is null.
+class ProfileStage {
+public:
+  ProfileStage(boost::shared_ptr<RunProfiler> profiler, std::string const& name);
+  ~ProfileStage();
+
+private:
+  boost::shared_ptr<RunProfiler> m_profiler;
+  std::string m_name, m_prev_stage;
+  double m_wall_time, m_cpu_time;
+  std::int64_t m_bytes_read;
+};
+
+} // End namespace asp
+
+#endif
@@ -115,6 +115,30 @@ namespace asp {
                      "Normalize images based on the global min and max values from both images. Don't use this option if you are using normalized cross correlation.")
       ("individually-normalize",   po::bool_switch(&global.individually_normalize)->default_value(false)->implicit_value(true),
                      "Individually normalize the input images between 0.0-1.0 using +- 2.5 sigmas about their mean values.")
+      ("image-stats-accuracy", po::value(&global.image_stats_accuracy)->default_value(0.0),
+       "If positive, estimate the image statistics used for normalization from a sample of "
+       "small windows spread over the image and read in parallel, rather than from the whole "
+       "image. The sample is large enough for the percentiles to be within this fraction of "
+       "the pixels of their true values, such as 0.002, most of the time.")
+      ("camera-cache-dir", po::value(&global.camera_cache_dir)->default_value(""),
+       "Save the loaded CSM and Digital Globe cameras in this directory, and read them "
+       "from there in later stereo steps and tiles, rather than processing the camera "
+       "files again. Set to 'none' to not use a cache. [default: <output prefix>-camera-cache]")
+      ("intermediate-compression", po::value(&global.intermediate_compression)->default_value("default"),
+       "Compression for the disparities and the point cloud. Options: default (use "
+       "--tif-compress), zstd (ZSTD with the floating-point predictor), lerc (LERC with "
+       "zero error), lerc_zstd (LERC with zero error, then ZSTD). All are lossless.")
+      ("compact-intermediates",
+       po::bool_switch(&global.compact_intermediates)->default_value(false)->implicit_value(true),
+       "Save the normalized images L.tif and R.tif with 16-bit floating-point values, "
+       "and the integer disparity D.tif with 16-bit integers, if the image sizes allow "
+       "it. This halves the size of these files.")
+      ("memory-budget-mb", po::value(&global.memory_budget_mb)->default_value(0.0),
+       "The memory for the VW tile cache and the GDAL block cache of each process, in "
+       "MB. It is split between them, and rebalanced as the GDAL cache fills up. This "
+       "replaces --cache-size-mb. With parallel_stereo, this is the budget for all "
+       "processes on a node, which share it. If not positive, use the environment "
+       "variable ASP_MEMORY_BUDGET_MB, if set.")
       ("ip-per-tile", po::value(&global.ip_per_tile)->default_value(0),
                      "How many interest points to detect in each 1024^2 image tile (default: automatic determination). This is before matching. Not all interest points will have a match. See also --matches-per-tile.")
       ("ip-per-image", po::value(&global.ip_per_image)->default_value(0),
@@ -140,7 +164,7 @@ namespace asp {
       ("ip-triangulation-max-error", po::value(&global.ip_triangulation_max_error)->default_value(-1),
        "When matching IP, filter out any pairs with a triangulation error higher than this.")
       ("ip-num-ransac-iterations", po::value(&global.ip_num_ransac_iterations)->default_value(1000),
-       "How many RANSAC iterations to do in interest point matching.")
+       "The maximum number of RANSAC iterations to do in interest point matching. Fewer are done once a good fit is found with 99.9% confidence.")
       ("disable-tri-ip-filter",     po::bool_switch(&global.disable_tri_filtering)->default_value(false)->implicit_value(true),
        "Turn off the tri-ip filtering step.")
       ("ip-debug-images", po::bool_switch(&global.ip_debug_images)->default_value(false)->implicit_value(true),
@@ -194,12 +218,24 @@ namespace asp {
       ("flann-method",  po::value(&global.flann_method)->default_value("kmeans"),
        "Choose the FLANN method for matching interest points. The default 'kmeans' is "
        "slower but deterministic, while 'kdtree' is faster but not deterministic.")
+      ("ip-brute-force-matching", po::bool_switch(&global.ip_brute_force_matching)->default_value(false)->implicit_value(true),
+       "Match interest points by comparing all descriptors, rather than with FLANN. This is exact and deterministic, and can be faster for many interest points. Without a datum, only matches which are each other's nearest neighbor are kept.")
+      ("ip-detect-in-bands", po::bool_switch(&global.ip_detect_in_bands)->default_value(false)->implicit_value(true),
+       "Detect interest points one band of 1024 image rows at a time, with the 1024 x 1024 cells of each band shared among threads. This needs memory only for one band, and makes use of all threads for large images.")
       ("left-image-clip", po::value(&global.left_image_clip)->default_value(""),
        "If --left-image-crop-win is used, replaced the left image cropped to that window with this clip.")
       ("right-image-clip", po::value(&global.right_image_clip)->default_value(""),
        "If --right-image-crop-win is used, replaced the right image cropped to that window with this clip.")
       ("aster-use-csm", po::bool_switch(&global.aster_use_csm)->default_value(false)->implicit_value(true),
        "Use the CSM model with ASTER cameras (-t aster).")
+      ("isis-camera-pool-size", po::value(&global.isis_camera_pool_size)->default_value(1),
+       "Create up to this many ISIS camera instances per cube, as needed, and use "
+       "them in parallel. If more than 1, ISIS cameras (-t isis) are used with "
+       "multiple threads. Set this to the number of threads.")
+      ("isis-to-csm-max-pixel-error", po::value(&global.isis_to_csm_max_pixel_error)->default_value(0.0),
+       "If positive, replace each ISIS linescan camera with a CSM model fit to it, "
+       "if the two agree to within this many pixels. The fit is cached next to the "
+       "cube. CSM cameras are faster and can use multiple threads.")
       ("accept-provided-mapproj-dem", 
         po::bool_switch(&global.accept_provided_mapproj_dem)->default_value(false)->implicit_value(true),
        "Accept the DEM provided on the command line as the one mapprojection was done with, "
@@ -290,6 +326,12 @@ namespace asp {
                      "Search range expansion for SGM down stereo pyramid levels.  Smaller values are faster, but greater change of blunders.")
       ("corr-memory-limit-mb",     po::value(&global.corr_memory_limit_mb)->default_value(4*1024),
        "Keep correlation memory usage (per tile) close to this limit.  Important for SGM/MGM.")
+      ("corr-memory-budget-mb",     po::value(&global.corr_memory_budget_mb)->default_value(0),
+       "Limit the estimated memory of all tiles being correlated at the same time to this value. Tiles with large search ranges then run with fewer others. Set to 0 to disable.")
+      ("corr-tile-cost-size",      po::value(&global.corr_tile_cost_size)->default_value(Vector2i(0,0),"0 0"),
+       "After low-resolution correlation, estimate the cost of correlating each tile of this size, and save it to <output prefix>-corr-tile-costs.txt. Set by parallel_stereo.")
+      ("save-blend-weights", po::bool_switch(&global.save_blend_weights)->default_value(false)->implicit_value(true),
+       "Save the weights with which stereo_blend blends the disparity of this tile with its neighbors, to <output prefix>-D-weights.tif. Set by parallel_stereo.")
       ("correlator-mode", po::bool_switch(&global.correlator_mode)->default_value(false)->implicit_value(true),
        "Function as an image correlator only (including with subpixel refinement). Assume no cameras, aligned input images, and stop before triangulation, so at filtered disparity.")
 
@@ -382,7 +424,13 @@ namespace asp {
       ("casp-go-param-file", po::value(&global.casp_go_param_file)->default_value(""),
        "The parameter file to use with Gotcha (and in the future other CASP-GO functionality) when invoking the 'gotcha-disparity-refinement' option. The default is to use the file 'share/CASP-GO_params.xml' shipped with ASP.")
       ("mask-flatfield",      po::bool_switch(&global.mask_flatfield)->default_value(false)->implicit_value(true),
-                              "Mask dust found on the sensor or film. (For use with Apollo Metric Cameras only.)");
+                              "Mask dust found on the sensor or film. (For use with Apollo Metric Cameras only.)")
+      ("fused-refinement-filtering", po::bool_switch(&global.fused_refinement_filtering)->default_value(false)->implicit_value(true),
+                              "Do subpixel refinement in memory as part of filtering, without writing and reading back the -RD.tif file. For the stereo program only.")
+      ("save-edge-extents-only", po::bool_switch(&global.save_edge_extents_only)->default_value(false)->implicit_value(true),
+                              "Find the valid region of the left and right masks, save it, and exit. This option is invoked from parallel_stereo.")
+      ("filter-parent-prefix", po::value(&global.filter_parent_prefix)->default_value(""),
+                              "Filter only the tile given by --trans-crop-win of the run with this output prefix, reading its refined disparity and edge mask extents. This option is invoked from parallel_stereo.");
 
     po::options_description backwards_compat_options("Aliased backwards compatibility options");
     // Do not add default values here. They may override the values set
@@ -411,6 +459,8 @@ namespace asp {
       ("propagate-errors",  po::bool_switch(&global.propagate_errors)->default_value(false)->implicit_value(true),
        "Propagate the errors from the input cameras to the triangulated point cloud.")
       ("horizontal-stddev", po::value(&global.horizontal_stddev)->default_value(Vector2(0, 0), "0 0"), "If positive, propagate these left and right camera horizontal ground plane stddev through triangulation. To be used with --propagate-errors.")
+      ("propagate-errors-grid-size", po::value(&global.propagate_errors_grid_size)->default_value(0),
+       "If positive, propagate the errors only at the nodes of a grid with this spacing, in pixels, in the left image, and interpolate them bilinearly in between. This is much faster. If 0, propagate the errors at each point. To be used with --propagate-errors.")
       
       ("position-covariance-factor", po::value(&global.position_covariance_factor)->default_value(1.0),
        "Multiply the satellite position covariances by this number before propagating them to the triangulated point cloud. Applicable only to Maxar(DigitalGlobe) linescan cameras.")
@@ -426,6 +476,8 @@ namespace asp {
        "How much to round the output point cloud values, in meters (more rounding means less precision but potentially smaller size on disk). The inverse of a power of 2 is suggested. Default: 1/2^10 for Earth and proportionally less for smaller bodies, unless error propagation happens, when it is set by default to 1e-8 meters, to avoid introducing step artifacts in these errors.")
       ("save-double-precision-point-cloud", po::bool_switch(&global.save_double_precision_point_cloud)->default_value(false)->implicit_value(true),
        "Save the final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at twice the storage).")
+      ("save-mapped-point-cloud", po::bool_switch(&global.save_mapped_point_cloud)->default_value(false)->implicit_value(true),
+       "Also save the point cloud in a memory-mappable format, in a file ending in PC.pcm, next to the PC.tif file. Tools reading the cloud, such as point2dem, will use it automatically, which avoids decoding PC.tif. Not supported with --save-double-precision-point-cloud.")
       
       ("compute-point-cloud-center-only",   po::bool_switch(&global.compute_point_cloud_center_only)->default_value(false)->implicit_value(true),
                                             "Only compute the center of triangulated point cloud and exit.")
@@ -461,6 +513,8 @@ namespace asp {
                             "The elevation value when showing hillshaded images.")
       ("lowest-resolution-subimage-num-pixels", po::value(&global.lowest_resolution_subimage_num_pixels)->default_value(-1),
        "When building a pyramid of lower-resolution versions of an image, the coarsest image will have no more than this many pixels. If not set, it will internally default to 1000 x 1000. This is increased to 10000 x 10000 when loading .nvm files or with the --preview option.")
+      ("pyramid-cache-dir", po::value(&global.pyramid_cache_dir)->default_value(""),
+       "Keep the pyramids of lower-resolution versions of the images in this directory, keyed by image content, and reuse them across runs, users, and copies of the same image. GDAL internal overviews are used as pyramid levels. If not set, the pyramids are written next to the images or in the current directory.")
       ("view-matches",   po::bool_switch(&global.view_matches)->default_value(false)->implicit_value(true),
                             "Locate and display the interest point matches for a stereo pair.")
       ("match-file", po::value(&global.match_file)->default_value(""),
@@ -505,6 +559,10 @@ namespace asp {
        "When plotting points from CSV files, let each point be drawn as a filled ball with this radius, in pixels.")
       ("font-size", po::value(&global.font_size)->default_value(9),
        "Set the font size.")
+      ("load-threads", po::value(&global.load_threads)->default_value(4),
+       "Read and decode the image portions to display with this many background threads, drawing a lower-resolution version until they arrive. Set to 0 to read them on the main thread.")
+      ("display-cache-size-mb", po::value(&global.display_cache_size_mb)->default_value(2048),
+       "Keep the image portions read for display, for all images together, within this many MB. When more is needed, those of hidden images are dropped first, then the least recently drawn ones.")
       ("no-georef", 
         po::bool_switch(&global.no_georef)->default_value(false)->implicit_value(true),
        "Do not use georeference information when displaying the data, even when it exists.")
@@ -104,6 +104,12 @@ namespace asp {
     bool   individually_normalize;          /// If > 1, normalize the images
                                             ///         individually with their
                                             ///         own hi's and lo's
+    double image_stats_accuracy;            ///< If positive, estimate the image stats
+                                            ///  from a sample with this percentile error
+    std::string camera_cache_dir;           ///< Where to cache the loaded cameras
+    std::string intermediate_compression;   ///< Compression for disparities and clouds
+    bool   compact_intermediates;           ///< Save L.tif, R.tif, D.tif with 16 bits
+    double memory_budget_mb;                ///< Memory for the VW and GDAL caches
     int   ip_per_tile;                      ///< How many ip to find in each 1024^2 tile
     int   ip_per_image;                     ///< How many ip to find in each image
     int   matches_per_tile;                 ///< How many ip matches to find in each 1024^2 tile
@@ -147,9 +153,13 @@ namespace asp {
     int disparity_range_expansion_percent; ///< Expand the estimated disparity range by this percentage before computing the stereo correlation with local alignment
 
     std::string flann_method; // The method to use for FLANN matching 
+    bool ip_brute_force_matching; // Compare all descriptors rather than use FLANN
+    bool ip_detect_in_bands; // Detect interest points one band of rows at a time
     
     // This option will be the default in the future and then it will go away
     bool aster_use_csm; // Use the CSM camera model with ASTER images
+    int isis_camera_pool_size; // Max number of ISIS camera instances per cube
+    double isis_to_csm_max_pixel_error; // If positive, use CSM fits to ISIS cameras
     bool accept_provided_mapproj_dem;
     
     // Correlation options
@@ -199,6 +209,9 @@ namespace asp {
     int    sgm_collar_size;           // Extra tile padding used for SGM calculation.
     vw::Vector2i sgm_search_buffer;   // Search padding in SGM around previous pyramid level disparity value.
     size_t corr_memory_limit_mb;      // Correlation memory limit, only important for SGM/MGM.
+    size_t corr_memory_budget_mb;     // Memory budget for all tiles correlated at once.
+    vw::Vector2i corr_tile_cost_size; // Write per-tile correlation cost estimates for this tile size.
+    bool save_blend_weights;          // Save the weights for stereo_blend (parallel_stereo)
     bool   correlator_mode;           // Use the correlation logic only (including subpixel rfne). 
     bool   stereo_debug;              // Write stereo debug images and messages
     bool   local_alignment_debug;     // Debug local alignment
@@ -246,6 +259,9 @@ namespace asp {
     double disp_smooth_texture;        // Adaptive disparity smoothing max texture value    
     bool  gotcha_disparity_refinement;
     std::string casp_go_param_file;
+    bool  fused_refinement_filtering; // Refine in memory in stereo_fltr, without -RD.tif
+    bool  save_edge_extents_only;     // Save the edge mask extents and exit (stereo_fltr)
+    std::string filter_parent_prefix; // Filter one tile of this run (parallel_stereo)
 
     // Triangulation options
     std::string universe_center;      // Center for the radius clipping
@@ -259,6 +275,7 @@ namespace asp {
     // Error propagation options    
     bool propagate_errors;
     vw::Vector2 horizontal_stddev;
+    int propagate_errors_grid_size;
     double position_covariance_factor, orientation_covariance_factor;
     
     bool compute_error_vector;              // Compute the triangulation error vector, not just its length
@@ -268,6 +285,7 @@ namespace asp {
     bool   use_least_squares;                 // Use a more rigorous triangulation
     bool   save_double_precision_point_cloud; // Save final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at 2x the storage).
     double point_cloud_rounding_error;        // How much to round the output point cloud values
+    bool   save_mapped_point_cloud;           // Also save the point cloud in a memory-mappable format
     bool   compute_point_cloud_center_only;   // Only compute the center of triangulated point cloud and exit.
     bool   skip_point_cloud_center_comp;
     bool   unalign_disparity;                 // Compute disparity between unaligned images
@@ -288,7 +306,9 @@ namespace asp {
     std::vector<std::string> vwip_files;
     vw::BBox2 zoom_proj_win;
     double min, max;
-    int plot_point_radius, font_size;
+    int plot_point_radius, font_size, load_threads;
+    double display_cache_size_mb;
+    std::string pyramid_cache_dir;
     
     // stereo_parse options
     std::string tile_at_loc;
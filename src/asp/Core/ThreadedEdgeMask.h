@@ -20,6 +20,9 @@
 #include <vw/Image/MaskViews.h>
 #include <boost/foreach.hpp>
 
+#include <fstream>
+#include <string>
+
 #ifndef __ASP_CORE_THREADEDEDGEMASK_H__
 #define __ASP_CORE_THREADEDEDGEMASK_H__
 
@@ -249,6 +252,49 @@ namespace asp {
                      vw::ArgValInPlaceDifferenceFunctor<vw::int32>(mask_buffer));
     }
 
+    // Load the edges saved with write_extents() instead of finding them. This
+    // way the edges of a large image can be found once and then be shared
+    // among all processes that work on tiles of it.
+    ThreadedEdgeMaskView(ViewT const& view, vw::int32 mask_buffer,
+                         std::string const& extents_file):
+      m_view(view), m_left(new vw::int32[view.rows()]), m_right(new vw::int32[view.rows()]),
+      m_top(new vw::int32[view.cols()]), m_bottom(new vw::int32[view.cols()]) {
+      using namespace vw;
+
+      std::ifstream ifs(extents_file.c_str(), std::ios::binary);
+      if (!ifs)
+        vw_throw(IOErr() << "Cannot read: " << extents_file << "\n");
+
+      int32 header[3] = {0, 0, 0}; // cols, rows, mask buffer
+      ifs.read(reinterpret_cast<char*>(header), sizeof(header));
+      if (!ifs || header[0] != view.cols() || header[1] != view.rows() ||
+          header[2] != mask_buffer)
+        vw_throw(ArgumentErr() << "The edge mask extents in " << extents_file
+                 << " do not agree with the image dimensions or mask buffer.\n");
+
+      ifs.read(reinterpret_cast<char*>(m_left.get()),   view.rows()*sizeof(int32));
+      ifs.read(reinterpret_cast<char*>(m_right.get()),  view.rows()*sizeof(int32));
+      ifs.read(reinterpret_cast<char*>(m_top.get()),    view.cols()*sizeof(int32));
+      ifs.read(reinterpret_cast<char*>(m_bottom.get()), view.cols()*sizeof(int32));
+      if (!ifs)
+        vw_throw(IOErr() << "Truncated edge mask extents file: " << extents_file << "\n");
+    }
+
+    // Save the edges, after the erosion by the mask buffer.
+    void write_extents(vw::int32 mask_buffer, std::string const& extents_file) const {
+      using namespace vw;
+
+      std::ofstream ofs(extents_file.c_str(), std::ios::binary);
+      int32 header[3] = {cols(), rows(), mask_buffer};
+      ofs.write(reinterpret_cast<char const*>(header), sizeof(header));
+      ofs.write(reinterpret_cast<char const*>(m_left.get()),   rows()*sizeof(int32));
+      ofs.write(reinterpret_cast<char const*>(m_right.get()),  rows()*sizeof(int32));
+      ofs.write(reinterpret_cast<char const*>(m_top.get()),    cols()*sizeof(int32));
+      ofs.write(reinterpret_cast<char const*>(m_bottom.get()), cols()*sizeof(int32));
+      if (!ofs)
+        vw_throw(IOErr() << "Cannot write: " << extents_file << "\n");
+    }
+
     inline vw::int32 cols  () const { return m_view.cols  (); }
     inline vw::int32 rows  () const { return m_view.rows  (); }
     inline vw::int32 planes() const { return m_view.planes(); }
@@ -0,0 +1,197 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file Tracing.cc
+///
+
+#include <asp/Core/Tracing.h>
+
+#include <vw/Core/Log.h>
+
+#include <boost/filesystem.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <unistd.h>
+
+namespace fs = boost::filesystem;
+
+namespace asp {
+
+namespace {
+
+  struct TraceEvent {
+    const char*  name;
+    const char*  category;
+    std::int64_t start, dur;
+    std::string  detail;
+  };
+
+  // The events of one thread. The lock is only contended when the trace
+  // is written while the thread is still recording.
+  struct TraceBuffer {
+    int tid;
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+  };
+
+  // The buffers of all threads. They are kept after their threads exit.
+  std::mutex g_trace_mutex;
+  std::vector<std::shared_ptr<TraceBuffer>> g_trace_buffers;
+  std::string g_trace_tool = "asp";
+  bool g_trace_written = false;
+
+  thread_local std::shared_ptr<TraceBuffer> t_trace_buffer;
+
+  TraceBuffer & thread_buffer() {
+    if (!t_trace_buffer) {
+      std::lock_guard<std::mutex> lock(g_trace_mutex);
+      t_trace_buffer.reset(new TraceBuffer);
+      t_trace_buffer->tid = g_trace_buffers.size();
+      g_trace_buffers.push_back(t_trace_buffer);
+    }
+    return *t_trace_buffer;
+  }
+
+  // Escape a string for JSON
+  void write_json_str(std::ostream & os, std::string const& str) {
+    os << '"';
+    for (size_t it = 0; it < str.size(); it++) {
+      char c = str[it];
+      if (c == '"' || c == '\\') {
+        os << '\\' << c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        os << buf;
+      } else {
+        os << c;
+      }
+    }
+    os << '"';
+  }
+
+  void write_trace_at_exit() {
+    try {
+      trace_write();
+    } catch (...) {} // must not throw at exit
+  }
+
+} // end anonymous namespace
+
+bool trace_enabled() {
+  static const bool enabled = (getenv("ASP_TRACE") != NULL &&
+                               std::string(getenv("ASP_TRACE")) != "");
+  return enabled;
+}
+
+void trace_init(std::string const& tool_path) {
+  if (!trace_enabled())
+    return;
+
+  std::lock_guard<std::mutex> lock(g_trace_mutex);
+  static bool registered = false;
+  g_trace_tool = fs::path(tool_path).filename().string();
+  if (!registered) {
+    std::atexit(write_trace_at_exit);
+    registered = true;
+  }
+}
+
+std::int64_t trace_now_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>
+    (std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void trace_record(const char* name, const char* category,
+                  std::int64_t start_us, std::int64_t dur_us,
+                  std::string const& detail) {
+  if (!trace_enabled())
+    return;
+
+  TraceBuffer & buf = thread_buffer();
+  std::lock_guard<std::mutex> lock(buf.mutex);
+  TraceEvent event;
+  event.name     = name;
+  event.category = category;
+  event.start    = start_us;
+  event.dur      = dur_us;
+  event.detail   = detail;
+  buf.events.push_back(event);
+}
+
+// Write the events as complete ("X") events, with a name for each thread
+void trace_write() {
+  if (!trace_enabled())
+    return;
+
+  std::lock_guard<std::mutex> lock(g_trace_mutex);
+  if (g_trace_written)
+    return;
+  g_trace_written = true;
+
+  int pid = getpid();
+  std::string trace_file = std::string(getenv("ASP_TRACE")) + "-" + g_trace_tool
+    + "-" + std::to_string(pid) + ".json";
+  fs::path dir = fs::path(trace_file).parent_path();
+  if (!dir.empty())
+    fs::create_directories(dir);
+
+  std::ofstream ofs(trace_file.c_str());
+  if (!ofs) {
+    vw::vw_out(vw::WarningMessage) << "Cannot write: " << trace_file << "\n";
+    return;
+  }
+
+  ofs << "{\"traceEvents\":[\n";
+  ofs << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+      << ",\"tid\":0,\"args\":{\"name\":";
+  write_json_str(ofs, g_trace_tool + " " + std::to_string(pid));
+  ofs << "}}";
+
+  for (size_t b = 0; b < g_trace_buffers.size(); b++) {
+    TraceBuffer & buf = *g_trace_buffers[b];
+    std::lock_guard<std::mutex> buf_lock(buf.mutex);
+    ofs << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+        << ",\"tid\":" << buf.tid << ",\"args\":{\"name\":\"thread "
+        << buf.tid << "\"}}";
+    for (size_t e = 0; e < buf.events.size(); e++) {
+      TraceEvent const& event = buf.events[e];
+      ofs << ",\n{\"name\":";
+      write_json_str(ofs, event.name);
+      ofs << ",\"cat\":";
+      write_json_str(ofs, event.category);
+      ofs << ",\"ph\":\"X\",\"ts\":" << event.start << ",\"dur\":" << event.dur
+          << ",\"pid\":" << pid << ",\"tid\":" << buf.tid;
+      if (!event.detail.empty()) {
+        ofs << ",\"args\":{\"detail\":";
+        write_json_str(ofs, event.detail);
+        ofs << "}";
+      }
+      ofs << "}";
+    }
+  }
+  ofs << "\n]}\n";
+}
+
+} // end namespace asp
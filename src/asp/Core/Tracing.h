@@ -0,0 +1,91 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file Tracing.h
+///
+
+// Record spans of time, such as for processing a tile or for a solver
+// iteration, with the thread doing the work, and save them in the Chrome
+// trace format, which can be viewed with chrome://tracing or Perfetto.
+// Tracing is on if the environment variable ASP_TRACE is set. Then each
+// process writes at exit the file <ASP_TRACE>-<tool>-<pid>.json. When
+// tracing is off, a span costs one check of a flag.
+
+#ifndef __ASP_CORE_TRACING_H__
+#define __ASP_CORE_TRACING_H__
+
+#include <cstdint>
+#include <string>
+
+namespace asp {
+
+  /// If the environment variable ASP_TRACE is set
+  bool trace_enabled();
+
+  /// Set the name of the current tool, for the trace file name. Also
+  /// ensure the trace is written at exit.
+  void trace_init(std::string const& tool_path);
+
+  /// The time in microseconds since the epoch, so the traces of
+  /// different processes can be put on one timeline.
+  std::int64_t trace_now_us();
+
+  /// Record a span with given start and duration, in microseconds. The
+  /// name and category must be string literals. The detail, if not
+  /// empty, is shown with the span.
+  void trace_record(const char* name, const char* category,
+                    std::int64_t start_us, std::int64_t dur_us,
+                    std::string const& detail = "");
+
+  /// Write the trace recorded so far. Called at exit.
+  void trace_write();
+
+  /// Record a span for the lifetime of this object. The detail, such
+  /// as a tile box, is found with a functor, so nothing is formatted if
+  /// tracing is off.
+  class TraceSpan {
+  public:
+    TraceSpan(const char* name, const char* category):
+      m_name(name), m_category(category), m_start(-1) {
+      if (trace_enabled())
+        m_start = trace_now_us();
+    }
+
+    template <class DetailFunc>
+    TraceSpan(const char* name, const char* category, DetailFunc const& detail_func):
+      m_name(name), m_category(category), m_start(-1) {
+      if (trace_enabled()) {
+        m_detail = detail_func();
+        m_start = trace_now_us();
+      }
+    }
+
+    ~TraceSpan() {
+      if (m_start >= 0)
+        trace_record(m_name, m_category, m_start, trace_now_us() - m_start, m_detail);
+    }
+
+  private:
+    const char*  m_name;
+    const char*  m_category;
+    std::int64_t m_start;
+    std::string  m_detail;
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_TRACING_H__
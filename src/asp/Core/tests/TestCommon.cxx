@@ -18,6 +18,8 @@
 
 #include <test/Helpers.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/MemoryBudget.h>
+#include <asp/Core/StereoSettings.h>
 
 using namespace vw;
 using namespace asp;
@@ -143,3 +145,42 @@ TEST( Common, StereoMultiCmdCheck ) {
   EXPECT_EQ("dem.tif" , dem_path);
 
 } // End test StereoMultiCmdCheck
+
+TEST( Common, intermediate_write_options ) {
+
+  vw::GdalWriteOptions opt;
+  opt.gdal_options["COMPRESS"] = "LZW";
+  std::string prev = stereo_settings().intermediate_compression;
+
+  stereo_settings().intermediate_compression = "default";
+  EXPECT_EQ("LZW", intermediate_write_options(opt, true).gdal_options["COMPRESS"]);
+
+  stereo_settings().intermediate_compression = "zstd";
+  vw::GdalWriteOptions out_opt = intermediate_write_options(opt, true);
+  EXPECT_EQ("ZSTD", out_opt.gdal_options["COMPRESS"]);
+  EXPECT_EQ("3",    out_opt.gdal_options["PREDICTOR"]);
+  EXPECT_EQ("2",    intermediate_write_options(opt, false).gdal_options["PREDICTOR"]);
+
+  stereo_settings().intermediate_compression = "lerc";
+  out_opt = intermediate_write_options(opt, true);
+  EXPECT_EQ("LERC", out_opt.gdal_options["COMPRESS"]);
+  EXPECT_EQ("0",    out_opt.gdal_options["MAX_Z_ERROR"]);
+
+  stereo_settings().intermediate_compression = "lzma";
+  EXPECT_THROW(intermediate_write_options(opt, true), vw::ArgumentErr);
+
+  stereo_settings().intermediate_compression = prev;
+}
+
+TEST( Common, rebalance_vw_fraction ) {
+
+  // A full GDAL cache grows, an unused one shrinks, else no change
+  EXPECT_NEAR(0.70, rebalance_vw_fraction(0.75, 99.0, 100.0), 1e-12);
+  EXPECT_NEAR(0.80, rebalance_vw_fraction(0.75, 10.0, 100.0), 1e-12);
+  EXPECT_NEAR(0.75, rebalance_vw_fraction(0.75, 70.0, 100.0), 1e-12);
+
+  // The fraction stays within bounds
+  EXPECT_NEAR(0.5, rebalance_vw_fraction(0.5, 100.0, 100.0), 1e-12);
+  EXPECT_NEAR(0.9, rebalance_vw_fraction(0.9, 0.0,   100.0), 1e-12);
+  EXPECT_NEAR(0.6, rebalance_vw_fraction(0.6, 0.0,   0.0),   1e-12);
+}
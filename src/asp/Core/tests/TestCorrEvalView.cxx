@@ -0,0 +1,136 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/CorrEvalView.h>
+#include <vw/Image/ImageViewRef.h>
+
+#include <cmath>
+
+using namespace vw;
+
+namespace {
+
+  // The right image value at a position, with bilinear interpolation,
+  // if all pixels used are valid
+  bool interp(ImageView<PixelMask<float>> const& img, double x, double y,
+              bool round_to_int, double & val) {
+    if (round_to_int) {
+      int ix = int(std::round(x)), iy = int(std::round(y));
+      if (ix < 0 || iy < 0 || ix >= img.cols() || iy >= img.rows() ||
+          !is_valid(img(ix, iy)))
+        return false;
+      val = img(ix, iy).child();
+      return true;
+    }
+    int ix = int(std::floor(x)), iy = int(std::floor(y));
+    double fx = x - ix, fy = y - iy;
+    if (ix < 0 || iy < 0 || ix + 1 >= img.cols() || iy + 1 >= img.rows())
+      return false;
+    if (!is_valid(img(ix, iy))     || !is_valid(img(ix + 1, iy)) ||
+        !is_valid(img(ix, iy + 1)) || !is_valid(img(ix + 1, iy + 1)))
+      return false;
+    val = (1 - fx) * (1 - fy) * img(ix, iy).child() + fx * (1 - fy) * img(ix + 1, iy).child()
+      + (1 - fx) * fy * img(ix, iy + 1).child() + fx * fy * img(ix + 1, iy + 1).child();
+    return true;
+  }
+
+  // Evaluate the quality at one pixel by visiting every pixel of the patches
+  PixelMask<float> brute_force(ImageView<PixelMask<float>> const& left,
+                               ImageView<PixelMask<float>> const& right,
+                               ImageView<PixelMask<Vector2f>> const& disp,
+                               int col, int row, int h, bool ncc, bool round_to_int) {
+    PixelMask<float> out;
+    out.invalidate();
+    if (!is_valid(disp(col, row)) || !is_valid(left(col, row)))
+      return out;
+    Vector2f d = disp(col, row).child();
+
+    double s_lr = 0, s_ll = 0, s_rr = 0;
+    double nl = 0, sl = 0, ssl = 0, nr = 0, sr = 0, ssr = 0;
+    for (int j = -h; j <= h; j++) {
+      for (int i = -h; i <= h; i++) {
+        int x = col + i, y = row + j;
+        bool lv = (x >= 0 && y >= 0 && x < left.cols() && y < left.rows() &&
+                   is_valid(left(x, y)));
+        double l = lv ? left(x, y).child() : 0.0, r = 0.0;
+        bool rv = interp(right, x + d[0], y + d[1], round_to_int, r);
+        if (lv) { nl++; sl += l; ssl += l * l; }
+        if (rv) { nr++; sr += r; ssr += r * r; }
+        if (lv && rv) { s_lr += l * r; s_ll += l * l; s_rr += r * r; }
+      }
+    }
+
+    if (ncc) {
+      if (s_ll > 0 && s_rr > 0)
+        out = PixelMask<float>(s_lr / std::sqrt(s_ll * s_rr));
+    } else if (nl > 0 && nr > 0) {
+      double vl = std::max(0.0, ssl / nl - (sl / nl) * (sl / nl));
+      double vr = std::max(0.0, ssr / nr - (sr / nr) * (sr / nr));
+      out = PixelMask<float>(0.5 * (std::sqrt(vl) + std::sqrt(vr)));
+    }
+    return out;
+  }
+
+} // end anonymous namespace
+
+// The running and integral sums must give the same values as visiting
+// each pixel of the patches, including near no-data pixels and image edges.
+TEST(CorrEvalView, MatchesBruteForce) {
+
+  int cols = 60, rows = 40;
+  ImageView<PixelMask<float>> left(cols, rows), right(cols, rows);
+  ImageView<PixelMask<Vector2f>> disp(cols, rows);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      left(col, row)  = PixelMask<float>(std::sin(0.3 * col) * std::cos(0.2 * row) + 0.01 * col);
+      right(col, row) = PixelMask<float>(std::sin(0.3 * col + 0.5) * std::cos(0.2 * row) + 0.5);
+      if ((col * 7 + row * 3) % 41 == 0) {
+        left(col, row).invalidate();
+        right(col, row).invalidate();
+      }
+
+      // Runs of the same integer disparity, with changing fractional parts
+      disp(col, row) = PixelMask<Vector2f>(Vector2f(2 + (col / 9) % 3 + 0.1 * (col % 7),
+                                                    -1 + 0.2 * (row % 4)));
+      if ((col + row) % 23 == 0)
+        disp(col, row).invalidate();
+    }
+  }
+  disp(30, 20) = PixelMask<Vector2f>(Vector2f(500, -300)); // an outlier
+
+  ImageViewRef<PixelMask<float>> left_ref = left, right_ref = right;
+  ImageViewRef<PixelMask<Vector2f>> disp_ref = disp;
+  int h = 2;
+  for (int m = 0; m < 4; m++) {
+    bool ncc = (m % 2 == 0), round_to_int = (m / 2 == 0);
+    std::string metric = ncc ? "ncc" : "stddev";
+    ImageView<PixelMask<float>> out
+      = asp::CorrEvalView(left_ref, right_ref, disp_ref, Vector2i(2 * h + 1, 2 * h + 1),
+                          metric, 1, round_to_int);
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        PixelMask<float> expected
+          = brute_force(left, right, disp, col, row, h, ncc, round_to_int);
+        ASSERT_EQ(is_valid(expected), is_valid(out(col, row)));
+        if (is_valid(expected))
+          EXPECT_NEAR(expected.child(), out(col, row).child(), 1e-4);
+      }
+    }
+  }
+}
@@ -0,0 +1,72 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/ImageUtils.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/MaskViews.h>
+
+using namespace vw;
+
+// The histogram over tiles must be the same as over the whole image, and
+// the Otsu threshold must separate two well-separated classes.
+TEST(ImageUtils, TileHistogramOtsu) {
+
+  // Several tiles, with the nodata value of 0 in a corner
+  ImageView<float> img(700, 300);
+  for (int col = 0; col < img.cols(); col++) {
+    for (int row = 0; row < img.rows(); row++) {
+      if (col < 10 && row < 10)
+        img(col, row) = 0;
+      else if (col < 400)
+        img(col, row) = 10 + (col + row) % 5;
+      else
+        img(col, row) = 100 + (col * row) % 7;
+    }
+  }
+  ImageViewRef<PixelMask<float>> masked = create_mask(img, 0.0f);
+
+  double min_val = 0, max_val = 0;
+  EXPECT_TRUE(asp::valid_pixel_range(masked, min_val, max_val));
+  EXPECT_EQ(10.0, min_val);
+  EXPECT_EQ(106.0, max_val);
+
+  int num_bins = 256;
+  std::vector<std::int64_t> hist;
+  asp::tile_histogram(masked, num_bins, min_val, max_val, hist);
+  ASSERT_EQ(num_bins, int(hist.size()));
+
+  // The values 100 to 106 go to the top bins
+  std::int64_t total = 0, num_high = 0;
+  for (int bin = 0; bin < num_bins; bin++) {
+    total += hist[bin];
+    if (bin >= 200)
+      num_high += hist[bin];
+  }
+  EXPECT_EQ(std::int64_t(700 * 300 - 100), total);
+  EXPECT_EQ(std::int64_t(300 * 300), num_high);
+
+  double threshold = asp::otsu_threshold(hist, min_val, max_val);
+  EXPECT_GE(threshold, 14.0);
+  EXPECT_LT(threshold, 100.0);
+
+  // No valid pixels
+  ImageView<float> empty(20, 20);
+  ImageViewRef<PixelMask<float>> masked_empty = create_mask(empty, 0.0f);
+  EXPECT_FALSE(asp::valid_pixel_range(masked_empty, min_val, max_val));
+}
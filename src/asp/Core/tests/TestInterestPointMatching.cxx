@@ -18,6 +18,7 @@
 
 #include <test/Helpers.h>
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/BruteForceMatching.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/LensDistortion.h>
 #include <vw/Cartography/CameraBBox.h>
@@ -68,3 +69,72 @@ TEST( InterestPointMatching, DatumIntersection ) {
   }
 
 }
+
+TEST( InterestPointMatching, BruteForceMatching ) {
+
+  // Descriptors on a grid, with the second set shifted a little, so each
+  // point has a unique nearest neighbor in the other set.
+  std::vector<ip::InterestPoint> ip1, ip2;
+  for (int i = 0; i < 50; i++) {
+    ip::InterestPoint p1(i, i), p2(i, i);
+    p1.descriptor.set_size(20);
+    p2.descriptor.set_size(20);
+    for (int v = 0; v < 20; v++) {
+      p1.descriptor[v] = (i * 7 + v * 3) % 11 + 10.0 * i;
+      p2.descriptor[v] = p1.descriptor[v] + 0.1;
+    }
+    ip1.push_back(p1);
+    ip2.push_back(p2);
+  }
+  // A point in the second set with no match in the first
+  ip2.push_back(ip2[0]);
+  for (int v = 0; v < 20; v++)
+    ip2.back().descriptor[v] = 1e+4;
+
+  std::vector<int> indices, nearest;
+  std::vector<float> dists;
+  int k = 3;
+  size_t num_threads = 4;
+  brute_force_knn(ip1, ip2, false, k, num_threads, indices, dists, &nearest);
+  ASSERT_EQ(ip1.size() * k, indices.size());
+  ASSERT_EQ(ip2.size(), nearest.size());
+  for (size_t i = 0; i < ip1.size(); i++) {
+    EXPECT_EQ(int(i), indices[i * k]);
+    EXPECT_NEAR(20 * 0.1 * 0.1, dists[i * k], 1e-3);
+    EXPECT_LE(dists[i * k], dists[i * k + 1]);
+    EXPECT_LE(dists[i * k + 1], dists[i * k + 2]);
+    EXPECT_EQ(int(i), nearest[i]);
+  }
+
+  // The same with one thread
+  std::vector<int> indices1;
+  std::vector<float> dists1;
+  brute_force_knn(ip1, ip2, false, k, 1, indices1, dists1);
+  EXPECT_TRUE(indices == indices1);
+  EXPECT_TRUE(dists == dists1);
+
+  // The extra point is not matched
+  std::vector<ip::InterestPoint> matched_ip1, matched_ip2;
+  double uniqueness_threshold = 0.8;
+  brute_force_ip_matching(ip1, ip2, false, uniqueness_threshold, num_threads,
+                          matched_ip1, matched_ip2);
+  ASSERT_EQ(ip1.size(), matched_ip1.size());
+  for (size_t i = 0; i < matched_ip1.size(); i++)
+    EXPECT_EQ(matched_ip1[i].x, matched_ip2[i].x);
+
+  // Hamming distance, with one byte per descriptor value
+  std::vector<ip::InterestPoint> orb1(1, ip::InterestPoint()), orb2(2, ip::InterestPoint());
+  orb1[0].descriptor.set_size(32);
+  orb2[0].descriptor.set_size(32);
+  orb2[1].descriptor.set_size(32);
+  for (int v = 0; v < 32; v++) {
+    orb1[0].descriptor[v] = 0;
+    orb2[0].descriptor[v] = 255; // all bits differ
+    orb2[1].descriptor[v] = (v == 5) ? 7 : 0; // 3 bits differ
+  }
+  brute_force_knn(orb1, orb2, true, 2, 1, indices, dists);
+  EXPECT_EQ(1, indices[0]);
+  EXPECT_EQ(0, indices[1]);
+  EXPECT_EQ(3, dists[0]);
+  EXPECT_EQ(256, dists[1]);
+}
@@ -0,0 +1,69 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/Point2Grid.h>
+
+using namespace vw;
+using namespace asp;
+
+// Grid a set of points, with the given limit on how many values are kept
+// in memory before being written to disk.
+void gridPoints(FilterType filter, size_t max_vals, ImageView<double> & buffer) {
+
+  int width = 16, height = 12;
+  ImageView<double> weights;
+  double x0 = 0.0, y0 = 0.0, grid_size = 0.5, min_spacing = 0.5, radius = 1.2;
+  double sigma_factor = 0.0, percentile = 30.0;
+  Point2Grid point2grid(width, height, buffer, weights, x0, y0, grid_size, min_spacing,
+                        radius, sigma_factor, filter, percentile);
+  point2grid.set_max_in_memory_values(max_vals);
+  point2grid.Clear(-1.0);
+
+  // A deterministic pseudo-random cloud
+  unsigned int seed = 1;
+  for (int it = 0; it < 2000; it++) {
+    double vals[3];
+    for (int k = 0; k < 3; k++) {
+      seed = 1103515245u * seed + 12345u;
+      vals[k] = 8.0 * double((seed >> 8) % 10000) / 10000.0;
+    }
+    point2grid.AddPoint(vals[0], vals[1], vals[2]);
+  }
+
+  point2grid.normalize();
+}
+
+// Spilling the values to disk must not change the result
+TEST(Point2Grid, SpillToDisk) {
+
+  FilterType filters[] = {f_median, f_stddev, f_nmad, f_percentile};
+  for (size_t f = 0; f < sizeof(filters)/sizeof(FilterType); f++) {
+
+    ImageView<double> in_memory, spilled;
+    gridPoints(filters[f], MAX_IN_MEMORY_GRID_VALUES, in_memory);
+    gridPoints(filters[f], 7, spilled);
+
+    ASSERT_EQ(in_memory.cols(), spilled.cols());
+    ASSERT_EQ(in_memory.rows(), spilled.rows());
+    for (int c = 0; c < in_memory.cols(); c++) {
+      for (int r = 0; r < in_memory.rows(); r++)
+        EXPECT_EQ(in_memory(c, r), spilled(c, r));
+    }
+  }
+}
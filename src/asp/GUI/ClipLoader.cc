@@ -0,0 +1,315 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file ClipLoader.cc
+///
+
+#include <asp/GUI/ClipLoader.h>
+
+#include <vw/Core/Log.h>
+
+#include <algorithm>
+#include <atomic>
+
+namespace vw { namespace gui {
+
+  namespace {
+    // The memory used by the clips of all loaders, and a clock to tell which
+    // clips were drawn least recently
+    std::atomic<std::uint64_t> g_clip_bytes(0);
+    std::atomic<std::uint64_t> g_clip_clock(0);
+
+    // If a loaded clip was created with the same inputs as the requested one
+    bool sameRequest(ImageClip const& a, ImageClip const& b) {
+      HillshadeParams const& ha = a.hillshade;
+      HillshadeParams const& hb = b.hillshade;
+      return a.scale_in == b.scale_in && a.region_in == b.region_in &&
+        a.highlight_nodata == b.highlight_nodata && ha.hillshade == hb.hillshade &&
+        (!ha.hillshade || (ha.azimuth == hb.azimuth && ha.elevation == hb.elevation &&
+                           ha.pixel_size == hb.pixel_size));
+    }
+
+    // Read the clip, and hillshade it if asked
+    void loadClip(DiskImagePyramidMultiChannel const& img, ImageClip & clip) {
+      HillshadeParams const& h = clip.hillshade;
+      if (h.hillshade)
+        img.get_hillshaded_clip(clip.scale_in, clip.region_in, h.azimuth, h.elevation,
+                                h.pixel_size, clip.qimg, clip.scale_out, clip.region_out);
+      else
+        img.get_image_clip(clip.scale_in, clip.region_in, clip.highlight_nodata,
+                           clip.qimg, clip.scale_out, clip.region_out);
+    }
+  }
+
+  ClipLoader::ClipLoader(int num_threads, double cache_size_mb,
+                         std::function<void()> const& on_loaded):
+    m_max_bytes(std::max(cache_size_mb, 0.0) * 1024.0 * 1024.0),
+    m_on_loaded(on_loaded), m_num_threads(num_threads), m_num_busy(0), m_generation(0),
+    m_frame(0), m_stop(false), m_new_clips(false) {
+    for (int it = 0; it < num_threads; it++)
+      m_threads.push_back(std::thread(&ClipLoader::worker, this));
+  }
+
+  ClipLoader::~ClipLoader() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_work_cond.notify_all();
+    for (size_t it = 0; it < m_threads.size(); it++)
+      m_threads[it].join();
+
+    for (auto it = m_slots.begin(); it != m_slots.end(); it++)
+      dropClip(it->second);
+  }
+
+  void ClipLoader::dropClip(Slot & slot) {
+    g_clip_bytes -= slot.bytes;
+    slot.bytes      = 0;
+    slot.loaded     = ImageClip();
+    slot.has_loaded = false;
+  }
+
+  void ClipLoader::storeClip(SlotKey const& key, ImageClip const& clip) {
+    Slot & slot = m_slots[key];
+    dropClip(slot);
+    slot.loaded     = clip;
+    slot.has_loaded = true;
+    slot.bytes      = size_t(clip.qimg.bytesPerLine()) * clip.qimg.height();
+    slot.last_used  = ++g_clip_clock;
+    g_clip_bytes   += slot.bytes;
+
+    // Drop the clips of hidden images first, then the least recently
+    // drawn ones, but never the one just stored or those on screen. Only
+    // the clips of this loader can be dropped here. The others are dropped
+    // when their loaders store new clips.
+    while (g_clip_bytes > m_max_bytes) {
+      auto victim = m_slots.end();
+      for (auto it = m_slots.begin(); it != m_slots.end(); it++) {
+        if (!it->second.has_loaded || it->first == key || it->second.frame == m_frame)
+          continue;
+        if (victim == m_slots.end()) {
+          victim = it;
+          continue;
+        }
+        bool hidden = (m_hidden.count(it->first.first) > 0);
+        bool victim_hidden = (m_hidden.count(victim->first.first) > 0);
+        if (hidden != victim_hidden) {
+          if (hidden)
+            victim = it;
+        } else if (it->second.last_used < victim->second.last_used) {
+          victim = it;
+        }
+      }
+      if (victim == m_slots.end())
+        break;
+      dropClip(victim->second);
+    }
+  }
+
+  ClipLoader::ClipStatus
+  ClipLoader::fetch(int image_index, int display_mode,
+                    DiskImagePyramidMultiChannel const& img,
+                    double scale, vw::BBox2i const& region, bool highlight_nodata,
+                    HillshadeParams const& hillshade, ImageClip & clip) {
+
+    clip = ImageClip();
+    clip.scale_in         = scale;
+    clip.region_in        = region;
+    clip.highlight_nodata = highlight_nodata;
+    clip.hillshade        = hillshade;
+
+    // With no worker threads, load the clip right here, as before
+    if (m_threads.empty()) {
+      loadClip(img, clip);
+      return CLIP_EXACT;
+    }
+
+    SlotKey key(image_index, display_mode);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_hidden.erase(image_index); // it is being drawn
+    Slot & slot = m_slots[key];
+    slot.frame = m_frame;
+    if (slot.has_loaded)
+      slot.last_used = ++g_clip_clock;
+    if (slot.has_loaded && sameRequest(slot.loaded, clip)) {
+      clip = slot.loaded;
+      return CLIP_EXACT;
+    }
+
+    // Queue this request, unless it is already queued or being loaded.
+    // A different pending request for this slot is stale, so replace it.
+    bool queued = (slot.pending || slot.busy) && sameRequest(slot.request, clip);
+    if (!queued) {
+      slot.img     = img;
+      slot.request = clip;
+      slot.pending = true;
+      m_work_cond.notify_one();
+    }
+
+    if (slot.has_loaded) {
+      clip = slot.loaded;
+      return CLIP_FALLBACK;
+    }
+
+    // Nothing was loaded for this image yet. Read the coarsest level, so that
+    // something shows up on screen right away.
+    int generation = m_generation;
+    lock.unlock();
+    ImageClip coarse;
+    coarse.scale_in         = std::max(img.cols(), img.rows());
+    coarse.region_in        = vw::BBox2i(0, 0, img.cols(), img.rows());
+    coarse.highlight_nodata = highlight_nodata;
+    coarse.hillshade        = hillshade;
+    loadClip(img, coarse);
+    lock.lock();
+
+    // The reference above may have been invalidated
+    if (generation == m_generation && !m_slots[key].has_loaded)
+      storeClip(key, coarse);
+    clip = coarse;
+    return CLIP_FALLBACK;
+  }
+
+  bool ClipLoader::hasNewClips() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool ans = m_new_clips;
+    m_new_clips = false;
+    return ans;
+  }
+
+  void ClipLoader::beginFrame() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_frame++;
+  }
+
+  void ClipLoader::setHidden(int image_index, bool hidden) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!hidden) {
+      m_hidden.erase(image_index);
+      return;
+    }
+    m_hidden.insert(image_index);
+    for (auto it = m_slots.begin(); it != m_slots.end(); it++) {
+      if (it->first.first == image_index)
+        it->second.pending = false;
+    }
+  }
+
+  void ClipLoader::clear() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_generation++;
+    for (auto it = m_slots.begin(); it != m_slots.end(); it++)
+      dropClip(it->second);
+    m_slots.clear();
+    m_new_clips = false;
+    m_idle_cond.wait(lock, [this]{ return m_num_busy == 0; });
+  }
+
+  bool ClipLoader::hasPendingWork() const {
+    for (auto it = m_slots.begin(); it != m_slots.end(); it++) {
+      if (it->second.pending)
+        return true;
+    }
+    return false;
+  }
+
+  void ClipLoader::worker() {
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (1) {
+
+      // Wait for a slot with a pending request which is not being loaded
+      // by another thread
+      std::map<SlotKey, Slot>::iterator slot_it;
+      m_work_cond.wait(lock, [this, &slot_it]{
+        if (m_stop)
+          return true;
+        for (slot_it = m_slots.begin(); slot_it != m_slots.end(); slot_it++) {
+          if (slot_it->second.pending && !slot_it->second.busy)
+            return true;
+        }
+        return false;
+      });
+      if (m_stop)
+        return;
+
+      SlotKey key = slot_it->first;
+      Slot & slot = slot_it->second;
+      slot.pending = false;
+      slot.busy    = true;
+      m_num_busy++;
+      DiskImagePyramidMultiChannel img = slot.img;
+      ImageClip clip = slot.request;
+      int generation = m_generation;
+
+      lock.unlock();
+      bool success = true;
+      try {
+        loadClip(img, clip);
+      } catch (std::exception const& e) {
+        vw_out(WarningMessage) << "Failed to load image clip: " << e.what() << "\n";
+        success = false;
+      }
+      lock.lock();
+
+      m_num_busy--;
+      bool notify = false;
+      // If clear() was called meanwhile, the slots were wiped, and this
+      // clip may be from an image which is no longer on disk.
+      if (generation == m_generation) {
+        m_slots[key].busy = false;
+        if (success) {
+          storeClip(key, clip);
+          m_new_clips = true;
+          notify      = true;
+        }
+      }
+      m_idle_cond.notify_all();
+      // A pending request for this slot may have been skipped while it was busy
+      m_work_cond.notify_one();
+
+      if (notify && m_on_loaded) {
+        lock.unlock();
+        m_on_loaded();
+        lock.lock();
+      }
+
+      // For an image read over the network, when there is nothing else to do,
+      // read the area around the view, to have it in the GDAL cache if the
+      // user pans there. The result is not kept. Another thread must be
+      // left for new requests.
+      if (notify && img.m_is_remote && m_num_threads > 1 && !m_stop &&
+          !hasPendingWork()) {
+        ImageClip around = clip;
+        vw::Vector2i margin(clip.region_in.width() / 2, clip.region_in.height() / 2);
+        around.region_in.min() -= margin;
+        around.region_in.max() += margin;
+        around.region_in.crop(vw::BBox2i(0, 0, img.cols(), img.rows()));
+        m_num_busy++;
+        lock.unlock();
+        try {
+          loadClip(img, around);
+        } catch (...) {} // this is only a prefetch
+        lock.lock();
+        m_num_busy--;
+        m_idle_cond.notify_all();
+      }
+    }
+  }
+
+}} // namespace vw::gui
@@ -0,0 +1,159 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ClipLoader.h
+///
+/// Fetch image clips to display in the background, so that reading
+/// and decoding pyramid levels does not block the GUI thread.
+///
+#ifndef __STEREO_GUI_CLIP_LOADER_H__
+#define __STEREO_GUI_CLIP_LOADER_H__
+
+#include <asp/GUI/DiskImagePyramidMultiChannel.h>
+
+#include <QImage>
+
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace vw { namespace gui {
+
+  // How to hillshade a clip, if at all. See get_hillshaded_clip().
+  struct HillshadeParams {
+    bool        hillshade;
+    double      azimuth, elevation;
+    vw::Vector2 pixel_size;
+    HillshadeParams(): hillshade(false), azimuth(0), elevation(0) {}
+  };
+
+  // A clip of an image as returned by DiskImagePyramidMultiChannel::get_image_clip(),
+  // or get_hillshaded_clip(), together with the inputs it was created from.
+  struct ImageClip {
+    double          scale_in;
+    vw::BBox2i      region_in;
+    bool            highlight_nodata;
+    HillshadeParams hillshade;
+    QImage          qimg;
+    double          scale_out;
+    vw::BBox2i      region_out;
+    ImageClip(): scale_in(0), highlight_nodata(false), scale_out(1.0) {}
+  };
+
+  // Load image clips with a pool of worker threads. There is at most one
+  // pending request per image and display mode. A newer request for the same
+  // image and mode replaces the pending one, so the clips for views the user
+  // already zoomed or panned away from are never fetched. While a request
+  // is in flight, the last clip loaded for that image and mode is
+  // returned instead, to be drawn at its lower resolution. For images read
+  // over the network, idle workers prefetch the area around the view.
+  // The clips kept by all loaders together stay within a memory budget.
+  // Past it, the clips of hidden images are dropped first, then the least
+  // recently drawn ones. The clips drawn on screen now are always kept, as
+  // otherwise they would be read again and again.
+  class ClipLoader {
+  public:
+
+    enum ClipStatus {
+      CLIP_NONE,     // nothing to draw
+      CLIP_FALLBACK, // an older or coarser clip, the requested one is on the way
+      CLIP_EXACT     // the requested clip
+    };
+
+    // The callback is invoked from a worker thread each time a clip
+    // finishes loading. It must only schedule work on the GUI thread.
+    // The memory budget is for the clips of all loaders.
+    ClipLoader(int num_threads, double cache_size_mb,
+               std::function<void()> const& on_loaded);
+    ~ClipLoader();
+
+    // Return the requested clip if it was loaded. Otherwise queue it and return
+    // the last clip for this image and display mode. If there is none, read
+    // the whole image from the coarsest pyramid level right away, which is small.
+    ClipStatus fetch(int image_index, int display_mode,
+                     DiskImagePyramidMultiChannel const& img,
+                     double scale, vw::BBox2i const& region, bool highlight_nodata,
+                     HillshadeParams const& hillshade, ImageClip & clip);
+
+    // Return true if clips were loaded since the last call
+    bool hasNewClips();
+
+    // Must be called before fetching the clips to draw on screen. The
+    // clips fetched after this are not dropped until the next call.
+    void beginFrame();
+
+    // Mark an image as hidden or shown. The clips of hidden images are
+    // dropped first, and their pending requests are canceled.
+    void setHidden(int image_index, bool hidden);
+
+    // Forget all pending requests and loaded clips, and wait for the clips
+    // being loaded. Must be called before the images on disk are
+    // overwritten or re-read.
+    void clear();
+
+  private:
+
+    typedef std::pair<int, int> SlotKey; // image index and display mode
+
+    struct Slot {
+      bool pending, busy;
+      DiskImagePyramidMultiChannel img; // a copy, so it is safe to use in a worker
+      ImageClip request, loaded;
+      bool has_loaded;
+      size_t bytes;            // memory used by the loaded clip
+      std::uint64_t last_used; // when the loaded clip was last fetched
+      int frame;               // the frame in which it was last fetched
+      Slot(): pending(false), busy(false), has_loaded(false), bytes(0), last_used(0),
+              frame(-1) {}
+    };
+
+    void worker();
+
+    // Keep this clip in the slot, and drop other clips if over the budget.
+    // The mutex must be locked.
+    void storeClip(SlotKey const& key, ImageClip const& clip);
+
+    // Drop the clip kept in a slot. The mutex must be locked.
+    void dropClip(Slot & slot);
+
+    // If any request is waiting. The mutex must be locked.
+    bool hasPendingWork() const;
+
+    std::map<SlotKey, Slot>  m_slots;
+    std::set<int>            m_hidden;  // the indices of the hidden images
+    size_t                   m_max_bytes;
+    std::vector<std::thread> m_threads;
+    std::mutex               m_mutex;
+    std::condition_variable  m_work_cond, m_idle_cond;
+    std::function<void()>    m_on_loaded;
+    int                      m_num_threads, m_num_busy, m_generation, m_frame;
+    bool                     m_stop, m_new_clips;
+  };
+
+}} // namespace vw::gui
+
+#endif  // __STEREO_GUI_CLIP_LOADER_H__
@@ -407,6 +407,13 @@ void drawScatteredData(imageData         const & image,
   if (den <= 0.0)
     den = 1.0;
 
+  // Tabulate the colors, as that is much faster than looking them up per point
+  const int num_colors = 1024;
+  std::vector<QRgb> colors(num_colors);
+  for (int k = 0; k < num_colors; k++)
+    colors[k] = cmap->rgb(I, double(k) / (num_colors - 1));
+
+  PointRasterizer rasterizer(canvasRect.toAlignedRect(), r);
   for (size_t pt_it = 0; pt_it < image.scattered_data.size(); pt_it++) {
     auto const& P = image.scattered_data[pt_it];
 
@@ -430,13 +437,15 @@ void drawScatteredData(imageData         const & image,
     // because nodata_plot_val < min_val.
     double s = (val - nodata_plot_val) / den;
 
-    // Find and draw the color 
-    QColor c = cmap->rgb(I, s);
-    painter->setPen(c);
-    painter->setBrush(c);
-    painter->drawEllipse(q, r, r); 
+    // Find the color. Keep s > 0 mapping to a color other than the no-data one.
+    int k = std::min(std::max(int(round(s * (num_colors - 1))), 0), num_colors - 1);
+    if (s > 0.0 && k == 0)
+      k = 1;
+    rasterizer.add(q.x(), q.y(), colors[k]);
   }
 
+  rasterizer.draw(painter);
+
   return;
 }
   
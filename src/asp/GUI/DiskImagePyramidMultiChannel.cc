@@ -20,8 +20,21 @@
 #include <vw/Core/Stopwatch.h>
 #include <QtWidgets>
 
+#include <gdal.h>
+#include <cpl_conv.h>
+#include <cpl_string.h>
+#include <cpl_vsi.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
 #include <string>
 #include <vector>
+#include <unistd.h>
 
 using namespace vw;
 using namespace vw::gui;
@@ -38,12 +51,287 @@ TemporaryFiles& temporary_files() {
   temporary_files_once.run( init_temporary_files);
   return *temporary_files_ptr;
 }
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+// 64-bit FNV-1a. Unlike std::hash, this is the same on all platforms, so
+// the pyramid cache can be shared among machines.
+void fnv1aHash(const char* buf, size_t len, std::uint64_t & hash) {
+  for (size_t it = 0; it < len; it++) {
+    hash ^= static_cast<unsigned char>(buf[it]);
+    hash *= 1099511628211ULL;
+  }
+}
+
+std::string hashToStr(std::uint64_t hash) {
+  std::ostringstream os;
+  os << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return os.str();
+}
+
+// Hash the size of the file and samples of its content: the first MB,
+// which has the headers, 64 KB at 64 evenly spaced places, and the last
+// 64 KB. Reading all of a large image would take as long as building its
+// pyramid.
+std::string imageContentHash(std::string const& image_file) {
+
+  std::ifstream ifs(image_file.c_str(), std::ios::binary);
+  if (!ifs)
+    vw_throw(IOErr() << "Cannot read: " << image_file << "\n");
+
+  std::uint64_t size = fs::file_size(image_file);
+  std::uint64_t hash = 14695981039346656037ULL;
+  fnv1aHash(reinterpret_cast<const char*>(&size), sizeof(size), hash);
+
+  std::vector<char> buf;
+  auto hashAt = [&](std::uint64_t offset, std::uint64_t len) {
+    if (offset >= size)
+      return;
+    len = std::min(len, size - offset);
+    buf.resize(len);
+    ifs.clear();
+    ifs.seekg(offset);
+    ifs.read(&buf[0], len);
+    fnv1aHash(&buf[0], ifs.gcount(), hash);
+  };
+
+  const std::uint64_t head_len = 1 << 20, chunk_len = 1 << 16;
+  const int num_chunks = 64;
+  hashAt(0, head_len);
+  if (size > head_len) {
+    for (int it = 0; it < num_chunks; it++)
+      hashAt(head_len + (size - head_len) * it / num_chunks, chunk_len);
+    hashAt(size - std::min(size, chunk_len), chunk_len);
+  }
+
+  return hashToStr(hash);
+}
+
+// The name DiskImagePyramid uses for the pyramid level at this scale
+std::string pyramidLevelFile(std::string const& image_file, int scale) {
+  return fs::path(image_file).replace_extension("").string()
+    + "_sub" + std::to_string(scale) + ".tif";
+}
+
+// Write a file atomically, so that another process sharing the cache never
+// reads it half-written.
+void writeFileAtomically(std::string const& file, std::string const& content) {
+  std::string tmp_file = file + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream ofs(tmp_file.c_str());
+    ofs << content;
+    if (!ofs)
+      vw_throw(IOErr() << "Cannot write: " << tmp_file << "\n");
+  }
+  fs::rename(tmp_file, file);
+}
+
+// For each GDAL internal overview of the image which halves the previous
+// level, as made by gdaladdo or the COG driver, write a VRT pointing to
+// it, with the name DiskImagePyramid uses for that level. Then that level
+// is read from the overview rather than created. Return the number of
+// levels which are overviews.
+int useGdalOverviews(std::string const& image_file, std::string const& pyramid_file) {
+
+  GDALAllRegister();
+  GDALDatasetH ds = GDALOpen(image_file.c_str(), GA_ReadOnly);
+  if (ds == NULL)
+    return 0;
+
+  int num_bands = GDALGetRasterCount(ds);
+  int cols = GDALGetRasterXSize(ds), rows = GDALGetRasterYSize(ds);
+  GDALRasterBandH band = (num_bands > 0) ? GDALGetRasterBand(ds, 1) : NULL;
+  int num_ovr = (band != NULL) ? GDALGetOverviewCount(band) : 0;
+
+  std::string abs_file = image_file;
+  if (!isRemoteImage(image_file))
+    abs_file = fs::absolute(image_file).string();
+  char * escaped = CPLEscapeString(abs_file.c_str(), -1, CPLES_XML);
+  std::string src_file = escaped;
+  CPLFree(escaped);
+
+  int scale = 1, num_used = 0;
+  for (int level = 0; level < num_ovr; level++) {
+    scale *= 2;
+    GDALRasterBandH ovr = GDALGetOverview(band, level);
+    int ovr_cols = (cols + scale - 1) / scale, ovr_rows = (rows + scale - 1) / scale;
+    if (ovr == NULL || GDALGetRasterBandXSize(ovr) != ovr_cols ||
+        GDALGetRasterBandYSize(ovr) != ovr_rows)
+      break; // not the level DiskImagePyramid expects
+
+    num_used++;
+    std::string level_file = pyramidLevelFile(pyramid_file, scale);
+    if (fs::exists(level_file))
+      continue;
+
+    std::ostringstream vrt;
+    vrt << "<VRTDataset rasterXSize=\"" << ovr_cols << "\" rasterYSize=\""
+        << ovr_rows << "\">\n";
+    for (int b = 1; b <= num_bands; b++) {
+      GDALRasterBandH band_b = GDALGetRasterBand(ds, b);
+      vrt << "  <VRTRasterBand dataType=\""
+          << GDALGetDataTypeName(GDALGetRasterDataType(band_b))
+          << "\" band=\"" << b << "\">\n";
+      int has_nodata = 0;
+      double nodata = GDALGetRasterNoDataValue(band_b, &has_nodata);
+      if (has_nodata)
+        vrt << "    <NoDataValue>" << std::setprecision(17) << nodata
+            << "</NoDataValue>\n";
+      vrt << "    <SimpleSource>\n"
+          << "      <SourceFilename relativeToVRT=\"0\">" << src_file
+          << "</SourceFilename>\n"
+          << "      <OpenOptions><OOI key=\"OVERVIEW_LEVEL\">" << level
+          << "</OOI></OpenOptions>\n"
+          << "      <SourceBand>" << b << "</SourceBand>\n"
+          << "    </SimpleSource>\n"
+          << "  </VRTRasterBand>\n";
+    }
+    vrt << "</VRTDataset>\n";
+
+    vw_out() << "Using the GDAL overview of " << image_file << " at scale "
+             << scale << ".\n";
+    writeFileAtomically(level_file, vrt.str());
+  }
+
+  GDALClose(ds);
+  return num_used;
+}
+
+// Prepare the pyramid cache entry for this image and return the file to
+// pass to DiskImagePyramid. That is a link to the image in a directory named
+// by the image content hash, so the pyramid levels get written to and found
+// in that directory. The levels made for another copy of the same image are
+// linked in. Return the image itself if it cannot be cached.
+std::string cachedPyramidFile(std::string const& image_file,
+                              std::string const& cache_dir) {
+
+  // A VRT or a PDS label refer to other files by relative path, which
+  // would not resolve from the cache. Cache only self-contained images.
+  std::string ext = boost::to_lower_copy(fs::path(image_file).extension().string());
+  if (ext != ".tif" && ext != ".tiff" && ext != ".ntf" && ext != ".jp2")
+    return image_file;
+
+  fs::path entry = fs::path(cache_dir) / imageContentHash(image_file);
+  fs::create_directories(entry);
+
+  // Name the link by the image path, so different copies do not overwrite
+  // each other's link
+  std::string abs_file = fs::absolute(image_file).string();
+  std::uint64_t path_hash = 14695981039346656037ULL;
+  fnv1aHash(abs_file.c_str(), abs_file.size(), path_hash);
+  fs::path link = entry / ("image-" + hashToStr(path_hash) + ext);
+  boost::system::error_code ec;
+  if (fs::symlink_status(link).type() == fs::file_not_found)
+    fs::create_symlink(abs_file, link, ec); // another process may have just made it
+  if (!fs::exists(link))
+    return image_file;
+
+  useGdalOverviews(image_file, link.string());
+
+  // Reuse the levels made for other copies of this image
+  std::string link_stem = link.stem().string();
+  for (fs::directory_iterator it(entry); it != fs::directory_iterator(); it++) {
+    std::string name = it->path().filename().string();
+    size_t pos = name.find("_sub");
+    if (pos == std::string::npos || name.substr(0, pos) == link_stem ||
+        !boost::ends_with(name, ".tif"))
+      continue;
+    fs::path level_file = entry / (link_stem + name.substr(pos));
+    if (fs::symlink_status(level_file).type() == fs::file_not_found)
+      fs::create_symlink(it->path().filename(), level_file, ec);
+  }
+
+  return link.string();
+}
+
+// Set up GDAL for reading images over the network, unless the user set
+// these options. Cache the ranges read, so panning back and forth and
+// prefetching do not fetch them again, and do not list the remote
+// directory on opening each file.
+void configureRemoteReads() {
+  const char* options[][2] = {
+    {"GDAL_DISABLE_READDIR_ON_OPEN",       "EMPTY_DIR"},
+    {"CPL_VSIL_CURL_CACHE_SIZE",           "536870912"}, // 512 MB for all files
+    {"VSI_CACHE",                          "TRUE"},
+    {"VSI_CACHE_SIZE",                     "67108864"},  // 64 MB per file
+    {"GDAL_HTTP_MERGE_CONSECUTIVE_RANGES", "YES"},
+    {"GDAL_HTTP_MULTIPLEX",                "YES"},
+    {"GDAL_HTTP_MAX_RETRY",                "3"},
+    {"GDAL_HTTP_RETRY_DELAY",              "1"}
+  };
+  for (size_t it = 0; it < sizeof(options) / sizeof(options[0]); it++) {
+    if (CPLGetConfigOption(options[it][0], NULL) == NULL)
+      CPLSetConfigOption(options[it][0], options[it][1]);
+  }
+}
+
+// For an image read over the network, write a VRT pointing to it in the
+// pyramid cache, and return it as the file to pass to DiskImagePyramid.
+// The pyramid levels are made next to the VRT, from the internal overviews
+// of the image, so only the tiles on screen are fetched. The entry is keyed
+// by the path, size, and modification time of the image, as hashing the
+// content would mean downloading it.
+std::string remotePyramidFile(std::string const& image_file,
+                              std::string const& cache_dir) {
+
+  static vw::RunOnce once = VW_RUNONCE_INIT;
+  once.run(configureRemoteReads);
+
+  std::uint64_t hash = 14695981039346656037ULL;
+  fnv1aHash(image_file.c_str(), image_file.size(), hash);
+  VSIStatBufL stat;
+  if (VSIStatL(image_file.c_str(), &stat) == 0) {
+    std::uint64_t size = stat.st_size, mtime = stat.st_mtime;
+    fnv1aHash(reinterpret_cast<const char*>(&size), sizeof(size), hash);
+    fnv1aHash(reinterpret_cast<const char*>(&mtime), sizeof(mtime), hash);
+  }
+
+  fs::path entry = fs::path(cache_dir) / hashToStr(hash);
+  fs::create_directories(entry);
+  std::string vrt_file = (entry / "image.vrt").string();
+  if (!fs::exists(vrt_file)) {
+    GDALAllRegister();
+    GDALDatasetH ds = GDALOpen(image_file.c_str(), GA_ReadOnly);
+    if (ds == NULL)
+      vw_throw(IOErr() << "Cannot open: " << image_file << "\n");
+    std::string tmp_file = vrt_file + ".tmp" + std::to_string(getpid());
+    GDALDatasetH vrt = GDALCreateCopy(GDALGetDriverByName("VRT"), tmp_file.c_str(),
+                                      ds, FALSE, NULL, NULL, NULL);
+    GDALClose(ds);
+    if (vrt == NULL)
+      vw_throw(IOErr() << "Cannot write: " << tmp_file << "\n");
+    GDALClose(vrt);
+    fs::rename(tmp_file, vrt_file);
+  }
+
+  if (useGdalOverviews(image_file, vrt_file) == 0)
+    vw_out(WarningMessage) << image_file << " has no internal overviews. All of it "
+                           << "will be read to make lower-resolution versions of it. "
+                           << "It should be a Cloud-Optimized GeoTIFF.\n";
+
+  return vrt_file;
+}
+
+} // end anonymous namespace
+
+bool isRemoteImage(std::string const& image_file) {
+  const char* prefixes[] = {"/vsicurl/", "/vsis3/", "/vsigs/", "/vsiaz/",
+                            "/vsiadls/", "/vsioss/", "/vsiswift/"};
+  for (size_t it = 0; it < sizeof(prefixes) / sizeof(prefixes[0]); it++) {
+    if (boost::starts_with(image_file, prefixes[it]))
+      return true;
+  }
+  return false;
+}
   
 DiskImagePyramidMultiChannel::
 DiskImagePyramidMultiChannel(std::string const& image_file,
  vw::GdalWriteOptions const& opt,
                              int top_image_max_pix, int subsample):
-  m_opt(opt), m_num_channels(0), m_rows(0), m_cols(0), m_type(UNINIT) {
+  m_opt(opt), m_num_channels(0), m_rows(0), m_cols(0), m_type(UNINIT),
+  m_is_remote(false) {
   
   if (image_file == "")
     return;
@@ -57,6 +345,27 @@ DiskImagePyramidMultiChannel(std::string const& image_file,
     = vw::DiskImageResourcePtr(image_file);
   ImageFormat image_fmt = image_rsrc->format();
 
+  // If asked, keep the pyramid in the shared cache rather than next to the image.
+  // The cached levels must outlive this run, so they are not temporary files.
+  std::string pyramid_file = image_file;
+  std::string cache_dir = asp::stereo_settings().pyramid_cache_dir;
+  m_is_remote = isRemoteImage(image_file);
+  if (m_is_remote) {
+    // The pyramid of a remote image must be local. Its levels come from the
+    // overviews of the image, so they are small and are kept across runs.
+    if (cache_dir == "")
+      cache_dir = (fs::temp_directory_path() / "stereo_gui_pyramid_cache").string();
+    pyramid_file = remotePyramidFile(image_file, cache_dir);
+  } else if (cache_dir != "") {
+    try {
+      pyramid_file = cachedPyramidFile(image_file, cache_dir);
+    } catch (const std::exception& e) {
+      vw_out(WarningMessage) << "Cannot use the pyramid cache for " << image_file
+                             << ": " << e.what() << "\n";
+    }
+  }
+  bool use_cache = (pyramid_file != image_file);
+
   // Redirect to the correctly typed function to perform the actual map projection.
   // - Must correspond to the type of the input image.
   // Instantiate the correct DiskImagePyramid then record information including
@@ -74,42 +383,46 @@ DiskImagePyramidMultiChannel(std::string const& image_file,
       // Single channel image with float pixels.
 
       m_img_ch1_double =
-        vw::mosaic::DiskImagePyramid<double>(image_file, m_opt, lowres_size);
+        vw::mosaic::DiskImagePyramid<double>(pyramid_file, m_opt, lowres_size);
       m_rows = m_img_ch1_double.rows();
       m_cols = m_img_ch1_double.cols();
       m_type = CH1_DOUBLE;
-      temporary_files().files.insert(m_img_ch1_double.get_temporary_files().begin(), 
-                                     m_img_ch1_double.get_temporary_files().end());
+      if (!use_cache)
+        temporary_files().files.insert(m_img_ch1_double.get_temporary_files().begin(),
+                                       m_img_ch1_double.get_temporary_files().end());
     }else if (m_num_channels == 2) {
       // uint8 image with an alpha channel.
       m_img_ch2_uint8 = vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 2>>
-        (image_file, m_opt, lowres_size);
+        (pyramid_file, m_opt, lowres_size);
       m_num_channels = 2; // we read only 1 channel
       m_rows = m_img_ch2_uint8.rows();
       m_cols = m_img_ch2_uint8.cols();
       m_type = CH2_UINT8;
-      temporary_files().files.insert(m_img_ch2_uint8.get_temporary_files().begin(), 
-                                     m_img_ch2_uint8.get_temporary_files().end());
+      if (!use_cache)
+        temporary_files().files.insert(m_img_ch2_uint8.get_temporary_files().begin(),
+                                       m_img_ch2_uint8.get_temporary_files().end());
     } else if (m_num_channels == 3) {
       // RGB image with three uint8 channels.
       m_img_ch3_uint8 = vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 3>>
-        (image_file, m_opt, lowres_size);
+        (pyramid_file, m_opt, lowres_size);
       m_num_channels = 3;
       m_rows = m_img_ch3_uint8.rows();
       m_cols = m_img_ch3_uint8.cols();
       m_type = CH3_UINT8;
-      temporary_files().files.insert(m_img_ch3_uint8.get_temporary_files().begin(), 
-                                     m_img_ch3_uint8.get_temporary_files().end());
+      if (!use_cache)
+        temporary_files().files.insert(m_img_ch3_uint8.get_temporary_files().begin(),
+                                       m_img_ch3_uint8.get_temporary_files().end());
     } else if (m_num_channels == 4) {
       // RGB image with three uint8 channels and an alpha channel
       m_img_ch4_uint8 = vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 4>>
-        (image_file, m_opt, lowres_size);
+        (pyramid_file, m_opt, lowres_size);
       m_num_channels = 4;
       m_rows = m_img_ch4_uint8.rows();
       m_cols = m_img_ch4_uint8.cols();
       m_type = CH4_UINT8;
-      temporary_files().files.insert(m_img_ch4_uint8.get_temporary_files().begin(), 
-                                     m_img_ch4_uint8.get_temporary_files().end());
+      if (!use_cache)
+        temporary_files().files.insert(m_img_ch4_uint8.get_temporary_files().begin(),
+                                       m_img_ch4_uint8.get_temporary_files().end());
     }else{
       vw_throw(ArgumentErr() << "Unsupported image with " << m_num_channels
                << " bands.\n");
@@ -232,6 +545,69 @@ void DiskImagePyramidMultiChannel::get_image_clip(double scale_in, vw::BBox2i re
   }
 }
 
+// Hillshade a DEM clip. The light comes from the given azimuth, measured
+// clockwise from the image up direction, and elevation, in degrees. The
+// pixel size is in the DEM height units. Slopes use central differences,
+// or one-sided ones next to nodata and at the clip boundary.
+void formHillshadedQimage(ImageView<double> const& dem, double nodata_val,
+                          vw::Vector2 const& pixel_size,
+                          double azimuth, double elevation, QImage & qimg) {
+
+  double az = azimuth * M_PI / 180.0, el = elevation * M_PI / 180.0;
+  double lx = sin(az) * cos(el), ly = cos(az) * cos(el), lz = sin(el);
+  double dx = pixel_size[0], dy = pixel_size[1];
+
+  int cols = dem.cols(), rows = dem.rows();
+  qimg = QImage(cols, rows, QImage::Format_ARGB32_Premultiplied);
+  uchar * bits = qimg.bits();
+  int bytes_per_line = qimg.bytesPerLine();
+#pragma omp parallel for if (cols * rows >= g_min_pixels_for_parallel_qimage)
+  for (int row = 0; row < rows; row++) {
+    const double * up   = &dem(0, std::max(row - 1, 0));
+    const double * curr = &dem(0, row);
+    const double * down = &dem(0, std::min(row + 1, rows - 1));
+    bool has_up = (row > 0), has_down = (row < rows - 1);
+    QRgb * dst = reinterpret_cast<QRgb*>(bits + row * bytes_per_line);
+    for (int col = 0; col < cols; col++) {
+      double z = curr[col];
+      if (z == nodata_val || z != z) {
+        dst[col] = QRgb(0); // transparent
+        continue;
+      }
+      // Fall back to the center value for neighbors which are missing
+      int cl = std::max(col - 1, 0), cr = std::min(col + 1, cols - 1);
+      bool l_ok = (col > 0        && curr[cl] != nodata_val && curr[cl] == curr[cl]);
+      bool r_ok = (col < cols - 1 && curr[cr] != nodata_val && curr[cr] == curr[cr]);
+      bool u_ok = (has_up   && up[col]   != nodata_val && up[col]   == up[col]);
+      bool d_ok = (has_down && down[col] != nodata_val && down[col] == down[col]);
+      double zl = l_ok ? curr[cl] : z, zr = r_ok ? curr[cr] : z;
+      double zu = u_ok ? up[col]  : z, zd = d_ok ? down[col] : z;
+      int nx = int(l_ok) + int(r_ok), ny = int(u_ok) + int(d_ok);
+      double dzdx  = (nx > 0) ? (zr - zl) / (nx * dx) : 0.0;
+      double dzdup = (ny > 0) ? (zu - zd) / (ny * dy) : 0.0; // rows go down
+      double shade = (lz - dzdx * lx - dzdup * ly) / sqrt(1.0 + dzdx * dzdx + dzdup * dzdup);
+      vw::uint32 v = vw::uint32(std::min(std::max(0.0, shade), 1.0) * 255.0 + 0.5);
+      dst[col] = opaqueGray(v);
+    }
+  }
+}
+
+void DiskImagePyramidMultiChannel::get_hillshaded_clip(double scale_in, vw::BBox2i region_in,
+                                                       double azimuth, double elevation,
+                                                       vw::Vector2 const& pixel_size,
+                                                       QImage & qimg, double & scale_out,
+                                                       vw::BBox2i & region_out) const {
+  if (m_type != CH1_DOUBLE)
+    vw_throw(ArgumentErr() << "Hill-shading makes sense only for single-channel images.\n");
+
+  // The pyramid level is coarser than the full-resolution DEM by scale_out,
+  // and so are its pixels.
+  ImageView<double> clip;
+  m_img_ch1_double.get_image_clip(scale_in, region_in, clip, scale_out, region_out);
+  formHillshadedQimage(clip, m_img_ch1_double.get_nodata_val(), pixel_size * scale_out,
+                       azimuth, elevation, qimg);
+}
+
 std::string DiskImagePyramidMultiChannel::get_value_as_str(int32 x, int32 y) const {
 
   // Below we cast from Vector<uint8> to Vector<double>, as the former
@@ -263,4 +639,85 @@ double DiskImagePyramidMultiChannel::get_value_as_double(int32 x, int32 y) const
   return 0;
 }
 
+namespace {
+  // Sample the pixels of a coarse pyramid level in clips of about this size
+  const int g_value_clip_size = 256;
+
+  double firstChannel(double val) { return val; }
+  double firstChannel(Vector<vw::uint8, 2> const& val) { return val[0]; }
+
+  // Read the values at the given pixels, which are in the given region, from
+  // a clip of the pyramid level at the given scale
+  template <class PixelT>
+  void pyramidValuesAsDouble(vw::mosaic::DiskImagePyramid<PixelT> const& pyr,
+                             double scale, BBox2i const& region,
+                             std::vector<vw::Vector2i> const& pixels,
+                             std::vector<size_t> const& indices,
+                             std::vector<double> & vals) {
+    ImageView<PixelT> clip;
+    double scale_out = 1.0;
+    BBox2i region_out;
+    pyr.get_image_clip(scale, region, clip, scale_out, region_out);
+    if (clip.cols() <= 0 || clip.rows() <= 0)
+      return;
+    for (size_t it = 0; it < indices.size(); it++) {
+      Vector2i const& pix = pixels[indices[it]];
+      int x = floor(pix.x() / scale_out) - region_out.min().x();
+      int y = floor(pix.y() / scale_out) - region_out.min().y();
+      x = std::max(0, std::min(x, clip.cols() - 1));
+      y = std::max(0, std::min(y, clip.rows() - 1));
+      vals[indices[it]] = firstChannel(clip(x, y));
+    }
+  }
+}
+
+void DiskImagePyramidMultiChannel::get_values_as_double(std::vector<vw::Vector2i> const& pixels,
+                                                        double scale,
+                                                        std::vector<double> & vals,
+                                                        std::atomic<bool> const* cancel) const {
+  if (m_type != CH1_DOUBLE && m_type != CH2_UINT8)
+    vw_throw(ArgumentErr() << "Unsupported image with " << m_num_channels << " bands\n");
+
+  vals.assign(pixels.size(), get_nodata_val());
+
+  // At full resolution read the pixels one at a time
+  if (scale <= 1.0) {
+    for (size_t it = 0; it < pixels.size(); it++) {
+      if (cancel != NULL && (it % 1024) == 0 && cancel->load())
+        return;
+      vals[it] = get_value_as_double(pixels[it].x(), pixels[it].y());
+    }
+    return;
+  }
+
+  // Group the pixels by the tile they are in, so that each tile is read once
+  double tile_size = g_value_clip_size * scale;
+  std::map<std::pair<int, int>, std::vector<size_t>> tiles;
+  for (size_t it = 0; it < pixels.size(); it++) {
+    std::pair<int, int> tile(floor(pixels[it].x() / tile_size),
+                             floor(pixels[it].y() / tile_size));
+    tiles[tile].push_back(it);
+  }
+
+  for (auto it = tiles.begin(); it != tiles.end(); it++) {
+    if (cancel != NULL && cancel->load())
+      return;
+
+    // The box of the pixels in this tile, rather than the whole tile
+    std::vector<size_t> const& indices = it->second; // alias
+    Vector2i beg = pixels[indices[0]], end = pixels[indices[0]];
+    for (size_t k = 1; k < indices.size(); k++) {
+      Vector2i const& pix = pixels[indices[k]];
+      beg = Vector2i(std::min(beg.x(), pix.x()), std::min(beg.y(), pix.y()));
+      end = Vector2i(std::max(end.x(), pix.x()), std::max(end.y(), pix.y()));
+    }
+    BBox2i region(beg, end + Vector2i(1, 1));
+
+    if (m_type == CH1_DOUBLE)
+      pyramidValuesAsDouble(m_img_ch1_double, scale, region, pixels, indices, vals);
+    else
+      pyramidValuesAsDouble(m_img_ch2_uint8, scale, region, pixels, indices, vals);
+  }
+}
+
 }} // namespace vw::gui
@@ -47,6 +47,7 @@
 #include <vw/Core/RunOnce.h>
 #include <vw/Core/Stopwatch.h>
 
+#include <atomic>
 #include <string>
 #include <vector>
 #include <list>
@@ -63,12 +64,32 @@ namespace vw { namespace gui {
   };
   /// Access the global list of temporary files
   TemporaryFiles& temporary_files();
+
+  /// If the image is read over the network via GDAL, such as with
+  /// /vsicurl/ or /vsis3/.
+  bool isRemoteImage(std::string const& image_file);
   
   // Form a QImage to show on screen. For scalar images, we scale them
   // and handle the nodata val. For two channel images, interpret the
   // second channel as mask. If there are 3 or more channels,
   // interpret those as RGB.
-  
+
+  // The pixels are written row by row straight into the QImage buffer,
+  // with no branches in the inner loops, so the compiler can vectorize
+  // them. Rows are done in parallel only for large clips, as for small
+  // ones starting the threads costs more than the work.
+  const int g_min_pixels_for_parallel_qimage = 256 * 256;
+
+  // A QImage pixel in Format_ARGB32_Premultiplied. With alpha being 0 or
+  // 255, premultiplying changes nothing, except that a transparent pixel
+  // must be all zero.
+  inline QRgb opaqueGray(vw::uint32 v) {
+    return 0xff000000u | (v << 16) | (v << 8) | v;
+  }
+  inline QRgb opaqueRgb(vw::uint32 r, vw::uint32 g, vw::uint32 b) {
+    return 0xff000000u | (r << 16) | (g << 8) | b;
+  }
+
   template<class PixelT>
   typename boost::enable_if<boost::is_same<PixelT,double>, void>::type
   formQimage(bool highlight_nodata, bool scale_pixels, double nodata_val,
@@ -77,32 +98,26 @@ namespace vw { namespace gui {
 
     double min_val = approx_bounds[0];
     double max_val = approx_bounds[1];
-
-    qimg = QImage(clip.cols(), clip.rows(), QImage::Format_ARGB32_Premultiplied);
-#pragma omp parallel for
-    for (int col = 0; col < clip.cols(); col++){
-      for (int row = 0; row < clip.rows(); row++){
-
-        double v = clip(col, row);
-        if (scale_pixels) 
-          v = round(255*(std::max(v, min_val) - min_val)/(max_val-min_val));
-     
-        v = std::min(std::max(0.0, v), 255.0);
-      
-        if (clip(col, row) == nodata_val || std::isnan(clip(col, row)) ){
-        
-          if (!highlight_nodata){
-            // transparent
-            qimg.setPixel(col, row, Qt::transparent);
-          }else{
-            // highlight in red
-            qimg.setPixel(col, row, qRgb(255, 0, 0));
-          }
-        
-        }else{
-          // opaque
-          qimg.setPixel(col, row, QColor(v, v, v, 255).rgba());
-        }
+    double factor  = 255.0/(max_val - min_val);
+
+    // Nodata is shown as transparent or highlighted in red
+    QRgb nodata_pix = highlight_nodata ? opaqueRgb(255, 0, 0) : QRgb(0);
+
+    int cols = clip.cols(), rows = clip.rows();
+    qimg = QImage(cols, rows, QImage::Format_ARGB32_Premultiplied);
+    uchar * bits = qimg.bits();
+    int bytes_per_line = qimg.bytesPerLine();
+#pragma omp parallel for if (cols * rows >= g_min_pixels_for_parallel_qimage)
+    for (int row = 0; row < rows; row++){
+      const double * src = &clip(0, row);
+      QRgb * dst = reinterpret_cast<QRgb*>(bits + row * bytes_per_line);
+      for (int col = 0; col < cols; col++){
+        double x = src[col];
+        // When scaling, adding 0.5 then truncating rounds to nearest
+        double v = scale_pixels ? (std::max(x, min_val) - min_val) * factor + 0.5 : x;
+        v = std::min(std::max(0.0, v), 255.0); // this also maps NaN to 0
+        bool is_nodata = (x == nodata_val || x != x);
+        dst[col] = is_nodata ? nodata_pix : opaqueGray(vw::uint32(v));
       }
     }
   }
@@ -113,18 +128,17 @@ namespace vw { namespace gui {
              vw::Vector2 const& approx_bounds,
              ImageView<PixelT> const& clip, QImage & qimg){
 
-    qimg = QImage(clip.cols(), clip.rows(), QImage::Format_ARGB32_Premultiplied);
-#pragma omp parallel for
-    for (int col = 0; col < clip.cols(); col++){
-      for (int row = 0; row < clip.rows(); row++){
-        Vector<vw::uint8, 2> v = clip(col, row);
-        if ( v[1] > 0 && v == v){ // need the latter for NaN
-          // opaque grayscale
-          qimg.setPixel(col, row, QColor(v[0], v[0], v[0], 255).rgba());
-        }else{
-          // transparent
-          qimg.setPixel(col, row, QColor(0, 0, 0, 0).rgba());
-        }
+    int cols = clip.cols(), rows = clip.rows();
+    qimg = QImage(cols, rows, QImage::Format_ARGB32_Premultiplied);
+    uchar * bits = qimg.bits();
+    int bytes_per_line = qimg.bytesPerLine();
+#pragma omp parallel for if (cols * rows >= g_min_pixels_for_parallel_qimage)
+    for (int row = 0; row < rows; row++){
+      const PixelT * src = &clip(0, row);
+      QRgb * dst = reinterpret_cast<QRgb*>(bits + row * bytes_per_line);
+      for (int col = 0; col < cols; col++){
+        // Opaque grayscale where the mask is on, else transparent
+        dst[col] = (src[col][1] > 0) ? opaqueGray(src[col][0]) : QRgb(0);
       }
     }
   }
@@ -136,23 +150,33 @@ namespace vw { namespace gui {
              vw::Vector2 const& approx_bounds,
              ImageView<PixelT> const& clip, QImage & qimg){
 
-    qimg = QImage(clip.cols(), clip.rows(), QImage::Format_ARGB32_Premultiplied);
-#pragma omp parallel for
-    for (int col = 0; col < clip.cols(); col++){
-      for (int row = 0; row < clip.rows(); row++){
-        PixelT v = clip(col, row);
-        if (v != v) // NaN, set to transparent
-          qimg.setPixel(col, row, QColor(0, 0, 0, 0).rgba());
-        else if (v.size() == 3) // color
-          qimg.setPixel(col, row, QColor(v[0], v[1], v[2], 255).rgba());
-        else if (v.size() > 3) // color or transparent
-          qimg.setPixel(col, row, QColor(v[0], v[1], v[2], 255*(v[3] > 0)).rgba());
-        else // grayscale 
-          qimg.setPixel(col, row, QColor(v[0], v[0], v[0], 255).rgba());
+    int cols = clip.cols(), rows = clip.rows();
+    qimg = QImage(cols, rows, QImage::Format_ARGB32_Premultiplied);
+    uchar * bits = qimg.bits();
+    int bytes_per_line = qimg.bytesPerLine();
+    const int num_ch = PixelT().size();
+#pragma omp parallel for if (cols * rows >= g_min_pixels_for_parallel_qimage)
+    for (int row = 0; row < rows; row++){
+      const PixelT * src = &clip(0, row);
+      QRgb * dst = reinterpret_cast<QRgb*>(bits + row * bytes_per_line);
+      for (int col = 0; col < cols; col++){
+        PixelT const& v = src[col];
+        if (num_ch >= 3) {
+          // Color. With more than 3 channels, the 4th one is the mask.
+          bool is_on = (num_ch == 3 || v[num_ch > 3 ? 3 : 0] > 0);
+          dst[col] = is_on ? opaqueRgb(v[0], v[1], v[2]) : QRgb(0);
+        } else {
+          dst[col] = opaqueGray(v[0]); // grayscale
+        }
       }
     }
   }
 
+  // Hillshade a DEM clip into a QImage, with nodata being transparent.
+  void formHillshadedQimage(ImageView<double> const& dem, double nodata_val,
+                            vw::Vector2 const& pixel_size,
+                            double azimuth, double elevation, QImage & qimg);
+
   // An image class that supports 1 to 3 channels.  We use
   // DiskImagePyramid<double> to be able to use some of the
   // pre-defined member functions for an image class. This class
@@ -168,6 +192,7 @@ namespace vw { namespace gui {
     int m_num_channels;
     int m_rows, m_cols;
     ImgType m_type; // keeps track of which of the above images we use
+    bool m_is_remote; // read over the network, so prefetching helps
 
     // Constructor
     DiskImagePyramidMultiChannel(std::string const& image_file = "",
@@ -181,6 +206,15 @@ namespace vw { namespace gui {
     void get_image_clip(double scale_in, vw::BBox2i region_in, bool highlight_nodata,
                         QImage & qimg, double & scale_out,
                         vw::BBox2i & region_out) const;
+
+    // Same as get_image_clip(), but hillshade the clip on the fly, using the
+    // pyramid level it comes from. Only for single-channel images. The pixel
+    // size of the full-resolution image is in the same units as the heights.
+    void get_hillshaded_clip(double scale_in, vw::BBox2i region_in,
+                             double azimuth, double elevation,
+                             vw::Vector2 const& pixel_size,
+                             QImage & qimg, double & scale_out,
+                             vw::BBox2i & region_out) const;
     double get_nodata_val() const;
     
     int32 cols  () const { return m_cols;  }
@@ -191,6 +225,15 @@ namespace vw { namespace gui {
     /// - Only works for single channel pyramids!
     double get_value_as_double(int32 x, int32 y) const;
 
+    /// Return the values at these full-resolution pixels, cast to double.
+    /// If scale is more than 1, read them from the pyramid level at that
+    /// scale, a tile-sized clip at a time. Otherwise read them at full
+    /// resolution. Stop early if cancel becomes true. Only works for single
+    /// channel pyramids!
+    void get_values_as_double(std::vector<vw::Vector2i> const& pixels, double scale,
+                              std::vector<double> & vals,
+                              std::atomic<bool> const* cancel = NULL) const;
+
     // Return value as string
     std::string get_value_as_str(int32 x, int32 y) const;
   };
@@ -32,7 +32,6 @@
 
 #include <vw/Image/Algorithms.h>
 #include <vw/Cartography/GeoTransform.h>
-#include <vw/Cartography/Hillshade.h>
 #include <vw/Core/RunOnce.h>
 #include <vw/BundleAdjustment/ControlNetworkLoader.h>
 #include <vw/InterestPoint/Matcher.h> // Needed for vw::ip::match_filename
@@ -108,65 +107,25 @@ QRect bbox2qrect(BBox2 const& B){
                round(B.width()), round(B.height()));
 }
 
-bool write_hillshade(vw::GdalWriteOptions const& opt,
-                     bool have_gui,
-                     double azimuth, double elevation,
-                     std::string const& input_file,
-                     std::string      & output_file) {
-
-  // Sanity check: Must have a georeference
-  cartography::GeoReference georef;
-  bool has_georef = vw::cartography::read_georeference(georef, input_file);
-  if (!has_georef) {
-    popUp("No georeference present in: " + input_file + ".");
-    return false;
+// The size of a full-resolution DEM pixel, in the units of the heights, for
+// hillshading. For a geographic DEM, convert degrees to meters at the DEM center.
+vw::Vector2 demPixelSize(vw::cartography::GeoReference const& georef,
+                         vw::BBox2 const& image_bbox) {
+
+  vw::Matrix3x3 T = georef.transform();
+  vw::Vector2 pixel_size(std::abs(T(0, 0)), std::abs(T(1, 1)));
+  if (!georef.is_projected()) {
+    double meters_per_deg = M_PI / 180.0 * georef.datum().semi_major_axis();
+    vw::Vector2 lonlat = georef.pixel_to_lonlat(image_bbox.center());
+    pixel_size[0] *= meters_per_deg * cos(lonlat[1] * M_PI / 180.0);
+    pixel_size[1] *= meters_per_deg;
   }
 
-  double scale       = 0.0;
-  double blur_sigma  = std::numeric_limits<double>::quiet_NaN();
-  double nodata_val  = std::numeric_limits<double>::quiet_NaN();
-  vw::read_nodata_val(input_file, nodata_val);
-  std::ostringstream oss;
-  oss << "_hillshade_a" << azimuth << "_e" << elevation << ".tif"; 
-  std::string suffix = oss.str();
+  // Guard against a degenerate georeference
+  if (!(pixel_size[0] > 0.0) || !(pixel_size[1] > 0.0))
+    pixel_size = vw::Vector2(1.0, 1.0);
 
-  output_file = vw::mosaic::filename_from_suffix1(input_file, suffix);
-  bool align_light_to_georef = false;
-  try {
-    DiskImageView<float> input(input_file);
-    // TODO(oalexan1): Factor out repeated logic below.
-    try {
-      bool will_write = vw::mosaic::overwrite_if_no_good(input_file, output_file,
-                                             input.cols(), input.rows());
-      if (will_write) {
-        vw_out() << "Writing: " << output_file << std::endl;
-        vw::cartography::do_multitype_hillshade(input_file, output_file, azimuth, elevation, scale,
-                                                nodata_val, blur_sigma, align_light_to_georef);
-      }
-    } catch(...) {
-      // Failed to write, presumably because we have no write access.
-      // Write the file in the current dir.
-      vw_out() << "Failed to write: " << output_file << "\n";
-      output_file = vw::mosaic::filename_from_suffix2(input_file, suffix);
-      bool will_write = vw::mosaic::overwrite_if_no_good(input_file, output_file,
-                                             input.cols(), input.rows());
-      if (will_write) {
-        vw_out() << "Writing: " << output_file << std::endl;
-        vw::cartography::do_multitype_hillshade(input_file,  output_file,
-                                                azimuth, elevation, scale,
-                                                nodata_val, blur_sigma,
-                                                align_light_to_georef);
-      }
-    }
-  } catch (const Exception& e) {
-    if (!have_gui) 
-      vw_out() << e.what() << "\n";
-    else
-      popUp(e.what());
-    return false;
-  }
-  
-  return true;
+  return pixel_size;
 }
 
 // TODO(oalexan1): The 0.5 bias may be the wrong thing to do. Need to test
@@ -552,10 +511,9 @@ void imageData::read(std::string const& name_in, vw::GdalWriteOptions const& opt
                      std::map<std::string, std::string> const& properties,
                      bool delay_loading) {
 
-  if (display_mode == REGULAR_VIEW)
+  // A hillshaded image is the regular image, hillshaded on the fly
+  if (display_mode == REGULAR_VIEW || display_mode == HILLSHADED_VIEW)
     name = name_in;
-  else if (display_mode == HILLSHADED_VIEW)
-    hillshaded_name = name_in;
   else if (display_mode == THRESHOLDED_VIEW)
     thresholded_name = name_in;
   else if (display_mode == COLORIZED_VIEW)
@@ -663,16 +621,11 @@ void parseCsvHeader(std::string const& file, std::string & wkt,
 void imageData::load() {
 
   // Loaded data need not be reloaded
-  if (m_display_mode == REGULAR_VIEW) {
+  if (m_display_mode == REGULAR_VIEW || m_display_mode == HILLSHADED_VIEW) {
     if (loaded_regular) 
       return;
     vw_out() << "Reading: " << name << std::endl; 
     loaded_regular = true;
-  } else if (m_display_mode == HILLSHADED_VIEW) {
-    if (loaded_hillshaded) 
-      return;
-    vw_out() << "Reading: " << hillshaded_name << std::endl; 
-    loaded_hillshaded = true;
   } else if (m_display_mode == THRESHOLDED_VIEW) {
     if (loaded_thresholded) 
       return;
@@ -774,13 +727,9 @@ void imageData::load() {
     int top_image_max_pix = 1000*1000;
     int subsample = 4;
     has_georef = vw::cartography::read_georeference(georef, name);
-    if (m_display_mode == REGULAR_VIEW) {
+    if (m_display_mode == REGULAR_VIEW || m_display_mode == HILLSHADED_VIEW) {
       img = DiskImagePyramidMultiChannel(name, m_opt, top_image_max_pix, subsample);
       image_bbox = BBox2(0, 0, img.cols(), img.rows());
-    } else if (m_display_mode == HILLSHADED_VIEW) {
-      hillshaded_img = DiskImagePyramidMultiChannel(hillshaded_name, m_opt,
-                                                    top_image_max_pix, subsample);
-      image_bbox = BBox2(0, 0, hillshaded_img.cols(), hillshaded_img.rows());
     } else if (m_display_mode == THRESHOLDED_VIEW) {
       thresholded_img = DiskImagePyramidMultiChannel(thresholded_name, m_opt,
                                                      top_image_max_pix, subsample);
@@ -237,6 +237,17 @@ namespace vw { namespace gui {
 
     m_border_factor = 0.95;
 
+    // Load the image clips to draw in background threads. The loader calls
+    // back from a worker thread, so redraw via the Qt event loop.
+    m_clipLoader = boost::shared_ptr<ClipLoader>
+      (new ClipLoader(std::max(asp::stereo_settings().load_threads, 0),
+                      asp::stereo_settings().display_cache_size_mb, [this]() {
+        QMetaObject::invokeMethod(this, "clipsLoaded", Qt::QueuedConnection);
+      }));
+    m_profileLoader = boost::shared_ptr<ProfileLoader>(new ProfileLoader([this]() {
+        QMetaObject::invokeMethod(this, "profileLoaded", Qt::QueuedConnection);
+      }));
+
     // Set mouse tracking
     this->setMouseTracking(true);
 
@@ -417,6 +428,21 @@ namespace vw { namespace gui {
   } // End constructor
 
   MainWidget::~MainWidget() {
+    // Stop the loader threads before anything else goes away
+    m_clipLoader.reset();
+    m_profileLoader.reset();
+  }
+
+  // Some image clips finished loading in the background. Draw them.
+  void MainWidget::clipsLoaded() {
+    if (m_clipLoader && m_clipLoader->hasNewClips())
+      refreshPixmap();
+  }
+
+  // The profile was read at full resolution. Plot it, unless it is no longer shown.
+  void MainWidget::profileLoaded() {
+    if (m_profileMode && m_profilePlot != NULL)
+      MainWidget::plotProfile(m_images, m_profileX, m_profileY);
   }
 
   bool MainWidget::eventFilter(QObject *obj, QEvent *E) {
@@ -645,6 +671,8 @@ BBox2 MainWidget::expand_box_to_keep_aspect_ratio(BBox2 const& box) {
 
     // Create the thresholded images and save them to disk. We have to do it each
     // time as perhaps the image threshold changed.
+    // The clips read so far are from the previous thresholded images.
+    m_clipLoader->clear();
     for (int image_iter = m_beg_image_id; image_iter < m_end_image_id; image_iter++) {
       std::string input_file = m_images[image_iter].name;
 
@@ -669,7 +697,7 @@ BBox2 MainWidget::expand_box_to_keep_aspect_ratio(BBox2 const& box) {
         = apply_mask(create_mask_less_or_equal(DiskImageView<double>(input_file),
                                                nodata_val), nodata_val);
 
-      // TODO(oalexan1): Need to do something like in write_hillshade()
+      // TODO(oalexan1): Need to use vw::mosaic::overwrite_if_no_good()
       // so that we don't have to always re-write the thresholded image.
       std::string suffix = "_thresh.tif";
       bool has_nodata = true;
@@ -696,8 +724,8 @@ BBox2 MainWidget::expand_box_to_keep_aspect_ratio(BBox2 const& box) {
 
     int num_images = m_images.size();
 
-    // Create the hillshaded images and save them to disk. We have to do
-    // it each time as perhaps the hillshade parameters changed.
+    // Turn off hillshading for the images which cannot be hillshaded. The
+    // hillshading itself is done on the fly, for each clip being drawn.
     for (int image_iter = m_beg_image_id; image_iter < m_end_image_id; image_iter++) {
 
       if (m_images[image_iter].m_display_mode != HILLSHADED_VIEW)
@@ -720,7 +748,6 @@ BBox2 MainWidget::expand_box_to_keep_aspect_ratio(BBox2 const& box) {
         return;
       }
 
-      std::string input_file = m_images[image_iter].name;
       int num_channels = m_images[image_iter].img.planes();
       if (num_channels != 1) {
         // Turn off hillshade mode for all images which don't support it,
@@ -738,23 +765,6 @@ BBox2 MainWidget::expand_box_to_keep_aspect_ratio(BBox2 const& box) {
         popUp("Hill-shading makes sense only for single-channel images.");
         continue;
       }
-
-      // Save the hillshaded images to disk (unless it already exists)
-      std::string hillshaded_file;
-      bool have_gui = true;
-      bool success = write_hillshade(m_opt,
-                                     have_gui,
-                                     m_hillshade_azimuth,
-                                     m_hillshade_elevation,
-                                     input_file, hillshaded_file);
-
-      if (!success) {
-        m_images[image_iter].m_display_mode = REGULAR_VIEW;
-        return;
-      }
-
-      m_images[image_iter].read(hillshaded_file, m_opt, HILLSHADED_VIEW);
-      temporary_files().files.insert(hillshaded_file);
     }
   }
 
@@ -1012,6 +1022,9 @@ BBox2 MainWidget::expand_box_to_keep_aspect_ratio(BBox2 const& box) {
     //Stopwatch sw1;
     //sw1.start();
 
+    // The clips fetched from now on are on screen, so must be kept
+    m_clipLoader->beginFrame();
+
     // Draw the images in the desired order
     for (int j = m_beg_image_id; j < m_end_image_id; j++) {
       int i = m_filesOrder[j]; // image index
@@ -1019,9 +1032,12 @@ BBox2 MainWidget::expand_box_to_keep_aspect_ratio(BBox2 const& box) {
       //Stopwatch sw2;
       //sw2.start();
 
-      // Don't show files the user wants hidden
-      if (m_chooseFiles && m_chooseFiles->isHidden(m_images[i].name))
+      // Don't show files the user wants hidden. Their clips can be dropped
+      // first when short on memory.
+      if (m_chooseFiles && m_chooseFiles->isHidden(m_images[i].name)) {
+        m_clipLoader->setHidden(i, true);
         continue;
+      }
 
       // Load if not loaded so far. 
       m_images[i].load();
@@ -1089,20 +1105,35 @@ BBox2 MainWidget::expand_box_to_keep_aspect_ratio(BBox2 const& box) {
 
       //Stopwatch sw3;
       //sw3.start();
+      // Fetch the clip in the background. Until it arrives, draw the last clip
+      // loaded for this image, which may be at a coarser resolution or for a
+      // different region.
+      ImageClip clip;
+      ClipLoader::ClipStatus status = ClipLoader::CLIP_NONE;
       if (m_images[i].m_display_mode == THRESHOLDED_VIEW) {
-        m_images[i].thresholded_img.get_image_clip(scale, image_box,
-                                                   highlight_nodata,
-                                                   qimg, scale_out, region_out);
+        status = m_clipLoader->fetch(i, THRESHOLDED_VIEW, m_images[i].thresholded_img,
+                                     scale, image_box, highlight_nodata,
+                                     HillshadeParams(), clip);
       }else if (m_images[i].m_display_mode == HILLSHADED_VIEW){
-        m_images[i].hillshaded_img.get_image_clip(scale, image_box,
-                                                  highlight_nodata,
-                                                  qimg, scale_out, region_out);
+        // Hillshade the DEM clip as it is read
+        HillshadeParams hillshade;
+        hillshade.hillshade  = true;
+        hillshade.azimuth    = m_hillshade_azimuth;
+        hillshade.elevation  = m_hillshade_elevation;
+        hillshade.pixel_size = demPixelSize(m_images[i].georef, m_images[i].image_bbox);
+        status = m_clipLoader->fetch(i, HILLSHADED_VIEW, m_images[i].img,
+                                     scale, image_box, highlight_nodata, hillshade, clip);
       }else{
         // Original images
-        m_images[i].img.get_image_clip(scale, image_box,
-                                       highlight_nodata,
-                                       qimg, scale_out, region_out);
+        status = m_clipLoader->fetch(i, REGULAR_VIEW, m_images[i].img,
+                                     scale, image_box, highlight_nodata,
+                                     HillshadeParams(), clip);
       }
+      if (status == ClipLoader::CLIP_NONE)
+        continue;
+      qimg       = clip.qimg;
+      scale_out  = clip.scale_out;
+      region_out = clip.region_out;
       //sw3.stop();
       //vw_out() << "Render time 3 (seconds): " << sw3.elapsed_seconds() << std::endl;
 
@@ -1113,7 +1144,24 @@ BBox2 MainWidget::expand_box_to_keep_aspect_ratio(BBox2 const& box) {
         // This is a regular image, no georeference, just pass it to the QT painter
         QRect rect(screen_box.min().x(), screen_box.min().y(),
                    screen_box.width(), screen_box.height());
-        paint->drawImage(rect, qimg);
+        if (status == ClipLoader::CLIP_EXACT) {
+          paint->drawImage(rect, qimg);
+        } else {
+          // Find the portion of the fallback clip which is in image_box, in
+          // the clip's pixels, and the screen area it goes to.
+          double cx0 = image_box.min().x()/scale_out - region_out.min().x();
+          double cy0 = image_box.min().y()/scale_out - region_out.min().y();
+          double cx1 = image_box.max().x()/scale_out - region_out.min().x();
+          double cy1 = image_box.max().y()/scale_out - region_out.min().y();
+          double sx0 = std::max(cx0, 0.0), sx1 = std::min(cx1, double(qimg.width()));
+          double sy0 = std::max(cy0, 0.0), sy1 = std::min(cy1, double(qimg.height()));
+          if (sx0 >= sx1 || sy0 >= sy1 || cx0 >= cx1 || cy0 >= cy1)
+            continue; // the fallback clip does not overlap the current view
+          double fx = rect.width()/(cx1 - cx0), fy = rect.height()/(cy1 - cy0);
+          QRectF target(rect.x() + (sx0 - cx0)*fx, rect.y() + (sy0 - cy0)*fy,
+                        (sx1 - sx0)*fx, (sy1 - sy0)*fy);
+          paint->drawImage(target, qimg, QRectF(sx0, sy0, sx1 - sx0, sy1 - sy0));
+        }
         //sw4.stop();
         //vw_out() << "Render time 4 (seconds): " << sw4.elapsed_seconds() << std::endl;
         
@@ -1256,6 +1304,7 @@ BBox2 MainWidget::expand_box_to_keep_aspect_ratio(BBox2 const& box) {
     }
 
     // Iterate over interest points
+    PointRasterizer rasterizer(QRect(0, 0, m_window_width, m_window_height), 2);
     for (size_t ip_iter = 0; ip_iter < ip_vec.size(); ip_iter++) {
       // Generate the pixel coord of the point
       Vector2 pt    = ip_vec[ip_iter];
@@ -1268,32 +1317,26 @@ BBox2 MainWidget::expand_box_to_keep_aspect_ratio(BBox2 const& box) {
         continue;
       }
       
-      paint->setPen(ipColor); // The default IP color
-      paint->setBrush(ipColor); // make the point filled
+      QColor color = ipColor; // The default IP color
 
       if (asp::stereo_settings().view_matches) {
         // Some special handling for when we add matches
-        if (!m_matchlist.isPointValid(m_beg_image_id, ip_iter)) {
-          paint->setPen(ipInvalidColor);
-          paint->setBrush(ipInvalidColor);
-        }
+        if (!m_matchlist.isPointValid(m_beg_image_id, ip_iter))
+          color = ipInvalidColor;
         
         // Highlighting the last point
-        if (highlight_last && (ip_iter == m_matchlist.getNumPoints(m_beg_image_id)-1)) {
-          paint->setPen(ipAddHighlightColor);
-          paint->setBrush(ipAddHighlightColor);
-        }
+        if (highlight_last && (ip_iter == m_matchlist.getNumPoints(m_beg_image_id)-1))
+          color = ipAddHighlightColor;
         
-        if (static_cast<int>(ip_iter) == m_editMatchPointVecIndex) {
-          paint->setPen(ipMoveHighlightColor);
-          paint->setBrush(ipMoveHighlightColor);
-        }
+        if (static_cast<int>(ip_iter) == m_editMatchPointVecIndex)
+          color = ipMoveHighlightColor;
       }
       
-      QPoint Q(P.x(), P.y());
-      paint->drawEllipse(Q, 2, 2); // Draw the point
+      rasterizer.add(P.x(), P.y(), color.rgba()); // Draw the point
 
     } // End loop through points
+
+    rasterizer.draw(paint);
   } // End function drawInterestPoints
   
   // Draw irregular xyz data to be plotted at (x, y) location with z giving
@@ -1306,8 +1349,17 @@ BBox2 MainWidget::expand_box_to_keep_aspect_ratio(BBox2 const& box) {
     // remove outliers along the way to not skew the plotting range.
     double min_val = asp::stereo_settings().min;
     double max_val = asp::stereo_settings().max;
-    if (std::isnan(min_val) || std::isnan(max_val)) 
-      findRobustBounds(m_images[image_index].scattered_data, min_val, max_val);
+    if (std::isnan(min_val) || std::isnan(max_val)) {
+      // This sorts all values, so do it only once per image
+      auto it = m_scatteredDataBounds.find(image_index);
+      if (it == m_scatteredDataBounds.end()) {
+        findRobustBounds(m_images[image_index].scattered_data, min_val, max_val);
+        m_scatteredDataBounds[image_index] = Vector2(min_val, max_val);
+      } else {
+        min_val = it->second[0];
+        max_val = it->second[1];
+      }
+    }
     
     std::map<float, vw::cm::Vector3u> lut_map;
     try {
@@ -1318,13 +1370,27 @@ BBox2 MainWidget::expand_box_to_keep_aspect_ratio(BBox2 const& box) {
       vw::cm::parse_color_style(m_images[image_index].colormap, lut_map);
     }
     vw::cm::Colormap colormap(lut_map);
-      
+
+    // Tabulate the colors, as that is much faster than looking them up
+    // per point. The colormap has 8-bit colors anyway.
+    std::vector<QRgb> colors(256);
+    for (int k = 0; k < 256; k++) {
+      if (asp::stereo_settings().colorize) {
+        // Get the color from the colormap
+        PixelRGB<uint8> v = colormap(k / 255.0).child();
+        colors[k] = qRgb(v[0], v[1], v[2]);
+      } else {
+        // Grayscale color
+        colors[k] = qRgb(k, k, k);
+      }
+    }
+
+    PointRasterizer rasterizer(QRect(0, 0, m_window_width, m_window_height), r);
     for (size_t pt_it = 0; pt_it < m_images[image_index].scattered_data.size(); pt_it++) {
       auto const& P = m_images[image_index].scattered_data[pt_it];
 
       vw::Vector2 world_P = projpoint2world(subvector(P, 0, 2), image_index);
       Vector2 screen_P = world2screen(world_P);
-      QPoint Q(screen_P.x(), screen_P.y());
 
       // Scale the intensity to [0, 1]
       double s = (P[2] - min_val) / (max_val - min_val);
@@ -1335,23 +1401,12 @@ BBox2 MainWidget::expand_box_to_keep_aspect_ratio(BBox2 const& box) {
       if (s < 0.0)
         s = 0.0;
 
-      QColor c;
-      if (asp::stereo_settings().colorize) {
-        // Get the color from the colormap
-        PixelRGB<uint8> v = colormap(s).child();
-        c = QColor(v[0], v[1], v[2]);
-      } else {
-        // Grayscale color
-        s = round(255.0 * s);
-        c = QColor(s, s, s);
-      }
-
-      // Draw the ball
-      paint->setPen(QPen(c));
-      paint->setBrush(QBrush(c));
-      paint->drawEllipse(Q, r, r); 
+      rasterizer.add(screen_P.x(), screen_P.y(), colors[round(255.0 * s)]);
     }
 
+    // Draw the balls
+    rasterizer.draw(paint);
+
     return;
   }
   
@@ -1451,12 +1506,13 @@ void MainWidget::plotPolys(QPainter & paint) {
         m_images[image_it].polyVec[polyIter].set_color(m_images[image_it].color);
     }
     
-    // Let polyVec be the polygons for the current image, or,
-    // at the end, the polygon we are in the middle of drawing
-    // TODO(oalexan1): How to avoid a deep copy?
-    std::vector<vw::geometry::dPoly> polyVec;
+    // Let polyVec be the polygons for the current image in world units, or,
+    // at the end, the polygon we are in the middle of drawing. The former
+    // are converted only when they change.
+    std::vector<vw::geometry::dPoly> drawnPolyVec;
+    std::vector<vw::geometry::dPoly> const* polyVec = &drawnPolyVec;
     if (!currDrawnPoly) {
-      polyVec = m_images[image_it].polyVec; // deep copy
+      polyVec = &polyIndex(image_it, m_images).worldPolys();
     } else {
       if (m_currPolyX.empty() || !m_polyEditMode)
         continue;
@@ -1469,27 +1525,26 @@ void MainWidget::plotPolys(QPainter & paint) {
                          vw::geometry::vecPtr(m_currPolyX),  
                          vw::geometry::vecPtr(m_currPolyY),  
                          isPolyClosed, m_polyColor, layer);
-      polyVec.push_back(poly);
-    }
-    
-    // Plot the polygon being drawn now, and pre-existing polygons
-    for (size_t polyIter = 0; polyIter < polyVec.size(); polyIter++){
-      
-      vw::geometry::dPoly poly = polyVec[polyIter]; // make a deep copy
-      const std::vector<std::string> & colors = poly.get_colors();
-      
+
       // Convert to world units
-      int            numVerts  = poly.get_totalNumVerts();
-      double *             xv  = poly.get_xv();
-      double *             yv  = poly.get_yv();
+      int      numVerts = poly.get_totalNumVerts();
+      double * xv       = poly.get_xv();
+      double * yv       = poly.get_yv();
       for (int vIter = 0; vIter < numVerts; vIter++){
-        
-        Vector2 P;
-        P = projpoint2world(Vector2(xv[vIter], yv[vIter]), image_it);
-        
+        Vector2 P = projpoint2world(Vector2(xv[vIter], yv[vIter]), image_it);
         xv[vIter] = P.x();
         yv[vIter] = P.y();
       }
+      drawnPolyVec.push_back(poly);
+    }
+    
+    // Plot the polygon being drawn now, and pre-existing polygons
+    for (size_t polyIter = 0; polyIter < polyVec->size(); polyIter++){
+      
+      vw::geometry::dPoly const& poly = (*polyVec)[polyIter]; // alias
+      const std::vector<std::string> & colors = poly.get_colors();
+      if (colors.empty())
+        continue; // nothing to plot
 
       int drawVertIndex = 0;
       bool plotPoints = false, plotEdges = true, plotFilled = false;
@@ -1645,8 +1700,9 @@ void MainWidget::paintEvent(QPaintEvent * /* event */) {
     double nodata_val = images[imgInd].img.get_nodata_val();
     
     m_valsX.clear(); m_valsY.clear();
-    int count = 0;
     
+    // The pixels to sample
+    std::vector<Vector2i> pixels;
     int num_pts = profileX.size();
     for (int pt_iter = 0; pt_iter < num_pts; pt_iter++) {
 
@@ -1676,17 +1732,30 @@ void MainWidget::paintEvent(QPaintEvent * /* event */) {
                       y >= 0 && y <= images[imgInd].img.rows()-1 );
         if (!is_in)
           continue;
+        pixels.push_back(Vector2i(x, y));
+      }
 
-        double pixel_val = images[imgInd].img.get_value_as_double(x, y);
+    }
 
-        // TODO: Deal with this NAN
-        if (pixel_val == nodata_val)
-          pixel_val = std::numeric_limits<double>::quiet_NaN();
-        m_valsX.push_back(count);
-        m_valsY.push_back(pixel_val);
-        count++;
-      }
+    // First read the values from the pyramid level matching the current view,
+    // as for drawing the image, and at full resolution in the background. A
+    // long profile on a large image can take a while to read.
+    BBox2 image_box = MainWidget::world2image(m_current_view, imgInd);
+    double coarse_scale = sqrt((1.0*image_box.width()) * image_box.height())/
+      std::max(1.0, sqrt((1.0*m_window_width) * m_window_height));
+    std::vector<double> vals;
+    bool full_res = m_profileLoader->fetch(images[imgInd].name, images[imgInd].img,
+                                           pixels, coarse_scale, vals);
+    m_profilePlot->setWindowTitle(full_res ? "1D Profile" : "1D Profile (reading...)");
 
+    for (size_t it = 0; it < vals.size(); it++) {
+      double pixel_val = vals[it];
+
+      // TODO: Deal with this NAN
+      if (pixel_val == nodata_val)
+        pixel_val = std::numeric_limits<double>::quiet_NaN();
+      m_valsX.push_back(it);
+      m_valsY.push_back(pixel_val);
     }
 
     if (num_pts == 1) {
@@ -1700,7 +1769,6 @@ void MainWidget::paintEvent(QPaintEvent * /* event */) {
     
     QwtPlotCurve * curve = new QwtPlotCurve("1D Profile");
     m_profilePlot->setFixedWidth(300);
-    m_profilePlot->setWindowTitle("1D Profile");
 
     if (!m_valsX.empty()) {
       
@@ -2001,6 +2069,19 @@ void MainWidget::paintEvent(QPaintEvent * /* event */) {
     update();
   }
     
+  // The polygons of an image in world coordinates, with a grid over their
+  // vertices and edges. These are updated here if the polygons changed,
+  // which is cheap if only a few vertices were moved.
+  PolyIndex & MainWidget::polyIndex(int image_index,
+                                    std::vector<imageData> const& imageData) {
+    PolyIndex & index = m_polyIndex[image_index];
+    index.update(imageData[image_index].polyVec,
+                 [this, image_index](Vector2 const& P) {
+                   return projpoint2world(P, image_index);
+                 });
+    return index;
+  }
+
   // Find the closest edge in a given set of imageData structures to a
   // given point. This needs to be in the MainWidget class as it needs
   // to know about how to convert from world coordinates to each
@@ -2024,8 +2105,6 @@ void MainWidget::paintEvent(QPaintEvent * /* event */) {
     minY                = world_y0;
     minDist             = std::numeric_limits<double>::max();
 
-    Vector2 world_P(world_x0, world_y0);
-
     for (int j = m_beg_image_id; j < m_end_image_id; j++) {
       
       int clipIter = m_filesOrder[j]; // image index
@@ -2034,39 +2113,21 @@ void MainWidget::paintEvent(QPaintEvent * /* event */) {
       
       double minX0, minY0, minDist0;
       int polyVecIndex0, polyIndexInCurrPoly0, vertIndexInCurrPoly0;
-    
-      // Convert from world coordinates to given clip coordinates
-      Vector2 clip_P = world2projpoint(world_P, clipIter);
+      if (!polyIndex(clipIter, imageData).findClosestEdge(world_x0, world_y0,
+                                                          polyVecIndex0,
+                                                          polyIndexInCurrPoly0,
+                                                          vertIndexInCurrPoly0,
+                                                          minX0, minY0, minDist0))
+        continue; // no polygons
       
-      vw::gui::findClosestPolyEdge(// inputs
-                                   clip_P.x(), clip_P.y(),  
-                                   imageData[clipIter].polyVec,  
-                                   // outputs
-                                   polyVecIndex0,  
-                                   polyIndexInCurrPoly0,  
-                                   vertIndexInCurrPoly0,  
-                                   minX0, minY0,  
-                                   minDist0);
-      
-      // Unless the polygon is empty, convert back to world
-      // coordinates, and see if the current distance is smaller than
-      // the previous one.
-      if (polyVecIndex0 >= 0 && polyIndexInCurrPoly0 >= 0 &&
-          vertIndexInCurrPoly0 >= 0) {
-
-        Vector2 closest_P = projpoint2world(Vector2(minX0, minY0),
-                                            clipIter);
-        minDist0 = norm_2(closest_P - world_P);
-        
-        if (minDist0 <= minDist) {
-          clipIndex           = clipIter;
-          polyVecIndex        = polyVecIndex0;
-          polyIndexInCurrPoly = polyIndexInCurrPoly0;
-          vertIndexInCurrPoly = vertIndexInCurrPoly0;
-          minDist             = minDist0;
-          minX                = closest_P.x();
-          minY                = closest_P.y();
-        }
+      if (minDist0 <= minDist) {
+        clipIndex           = clipIter;
+        polyVecIndex        = polyVecIndex0;
+        polyIndexInCurrPoly = polyIndexInCurrPoly0;
+        vertIndexInCurrPoly = vertIndexInCurrPoly0;
+        minDist             = minDist0;
+        minX                = minX0;
+        minY                = minY0;
       }
     }
 
@@ -2093,45 +2154,25 @@ void MainWidget::paintEvent(QPaintEvent * /* event */) {
     minY                = world_y0;
     minDist             = std::numeric_limits<double>::max();
 
-    Vector2 world_P(world_x0, world_y0);
-    
     for (int clipIter = m_beg_image_id; clipIter < m_end_image_id; clipIter++){
     
       double minX0, minY0, minDist0;
       int polyVecIndex0, polyIndexInCurrPoly0, vertIndexInCurrPoly0;
-
-      // Convert from world coordinates to given clip coordinates
-      Vector2 clip_P = world2projpoint(world_P, clipIter);
-
-      vw::gui::findClosestPolyVertex(// inputs
-                                     clip_P.x(), clip_P.y(),  
-                                     imageData[clipIter].polyVec,  
-                                     // outputs
-                                     polyVecIndex0,  
-                                     polyIndexInCurrPoly0,  
-                                     vertIndexInCurrPoly0,  
-                                     minX0, minY0,  
-                                     minDist0);
-
-      // Unless the polygon is empty, convert back to world
-      // coordinates, and see if the current distance is smaller than
-      // the previous one.
-      if (polyVecIndex0 >= 0 && polyIndexInCurrPoly0 >= 0 &&
-          vertIndexInCurrPoly0 >= 0) {
-        
-        Vector2 closest_P = projpoint2world(Vector2(minX0, minY0),
-                                            clipIter);
-        minDist0 = norm_2(closest_P - world_P);
+      if (!polyIndex(clipIter, imageData).findClosestVertex(world_x0, world_y0,
+                                                            polyVecIndex0,
+                                                            polyIndexInCurrPoly0,
+                                                            vertIndexInCurrPoly0,
+                                                            minX0, minY0, minDist0))
+        continue; // no polygons
       
-        if (minDist0 <= minDist) {
-          clipIndex           = clipIter;
-          polyVecIndex        = polyVecIndex0;
-          polyIndexInCurrPoly = polyIndexInCurrPoly0;
-          vertIndexInCurrPoly = vertIndexInCurrPoly0;
-          minDist             = minDist0;
-          minX                = closest_P.x();
-          minY                = closest_P.y();
-        }
+      if (minDist0 <= minDist) {
+        clipIndex           = clipIter;
+        polyVecIndex        = polyVecIndex0;
+        polyIndexInCurrPoly = polyIndexInCurrPoly0;
+        vertIndexInCurrPoly = vertIndexInCurrPoly0;
+        minDist             = minDist0;
+        minX                = minX0;
+        minY                = minY0;
       }
     }
   
@@ -2282,25 +2323,31 @@ void MainWidget::paintEvent(QPaintEvent * /* event */) {
         fromOGR(good_geom, poly_color, layer_str, polyVec, append);
       }else if (wkbFlatten(good_geom->getGeometryType()) == wkbMultiPolygon) {
       
-        // We can merge
-        OGRGeometry * merged_geom = new OGRPolygon;
-      
+        // We can merge. A cascaded union merges the polygons pairwise in a
+        // tree, which is much faster than adding them one at a time to an
+        // ever-growing result. Its input must have only polygons.
         OGRMultiPolygon *poMultiPolygon = (OGRMultiPolygon*)good_geom;
-      
+        OGRMultiPolygon polys_only;
         int numGeom = poMultiPolygon->getNumGeometries();
         for (int iGeom = 0; iGeom < numGeom; iGeom++){
-        
           const OGRGeometry *currPolyGeom = poMultiPolygon->getGeometryRef(iGeom);
           if (wkbFlatten(currPolyGeom->getGeometryType()) != wkbPolygon) continue;
-        
-          OGRPolygon *poPolygon = (OGRPolygon *) currPolyGeom;
-          OGRGeometry * local_merged = merged_geom->Union(poPolygon);
-        
-          // Keep the pointer to the new geometry
-          if (merged_geom != NULL)
+          polys_only.addGeometry(currPolyGeom);
+        }
+        OGRGeometry * merged_geom = polys_only.UnionCascaded();
+
+        // Fall back to merging one polygon at a time
+        if (merged_geom == NULL) {
+          merged_geom = new OGRPolygon;
+          for (int iGeom = 0; iGeom < polys_only.getNumGeometries(); iGeom++){
+            OGRGeometry * local_merged
+              = merged_geom->Union(polys_only.getGeometryRef(iGeom));
             OGRGeometryFactory::destroyGeometry(merged_geom);
-          merged_geom = local_merged;
-        }    
+            merged_geom = local_merged;
+            if (merged_geom == NULL)
+              vw_throw(ArgumentErr() << "Failed to merge the polygons.\n");
+          }
+        }
       
         bool append = false;
         fromOGR(merged_geom, poly_color, layer_str, polyVec, append);
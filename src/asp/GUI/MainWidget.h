@@ -64,6 +64,9 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/MatchList.h>
 #include <asp/GUI/GuiUtilities.h>
+#include <asp/GUI/ClipLoader.h>
+#include <asp/GUI/ProfileLoader.h>
+#include <asp/GUI/PolyIndex.h>
 #include <asp/GUI/WidgetBase.h>
 
 class QMouseEvent;
@@ -203,6 +206,8 @@ public slots:
     void insertVertex           (); ///< Insert an intermediate vertex at right-click
     void mergePolys             (); ///< Merge existing polygons
     void saveScreenshot         (); ///< Save a screenshot of the current imagery
+    void clipsLoaded            (); ///< Redraw when image clips arrive from the loader
+    void profileLoaded          (); ///< Replot when the full-resolution profile is read
 
   protected:
 
@@ -280,6 +285,18 @@ public slots:
     // if really necessary, and display it when paintEvent is called.
     QPixmap m_pixmap;
 
+    // Read the image clips to draw in the background
+    boost::shared_ptr<ClipLoader> m_clipLoader;
+
+    // Read the full-resolution profile in the background
+    boost::shared_ptr<ProfileLoader> m_profileLoader;
+
+    // The polygons of each image in world coordinates, indexed for search
+    std::map<int, PolyIndex> m_polyIndex;
+
+    // The robust intensity bounds of scattered data, per image
+    std::map<int, vw::Vector2> m_scatteredDataBounds;
+
     // Default color when polys are created from scratch
     std::string m_polyColor;
     
@@ -399,6 +416,10 @@ public slots:
                              double & minX, double & minY,
                              double & minDist);
     
+    // The polygons of imageData[image_index] in world coordinates, brought
+    // up to date
+    PolyIndex & polyIndex(int image_index, std::vector<imageData> const& imageData);
+
     // Merge some polygons and save them in imageData[outIndex]
     void mergePolys(std::vector<imageData> & imageData, int outIndex);
     
@@ -29,6 +29,7 @@
 #include <asp/Core/GCP.h>
 #include <asp/Core/Nvm.h>
 #include <asp/Core/IpMatchingAlgs.h>
+#include <asp/Core/MatchDatabase.h>
 #include <asp/Camera/BundleAdjustIsis.h>
 
 #include <vw/config.h>
@@ -1483,7 +1484,7 @@ void MainWindow::viewPairwiseMatchesOrCleanMatches() {
     try {
       // Load it
       vw_out() << "Loading match file: " << match_file << std::endl;
-      ip::read_binary_match_file(match_file, left_ip, right_ip);
+      asp::readMatchFile(match_file, left_ip, right_ip);
     } catch(...) {
       // Having this pop-up for a large number of images is annoying
       vw_out() << "Cannot find the match file with given images and output prefix.\n";
@@ -0,0 +1,347 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file PolyIndex.cc
+///
+
+#include <asp/GUI/PolyIndex.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace vw { namespace gui {
+
+  namespace {
+    // An edge whose bounding box spans more cells than this is not put in
+    // the grid, but checked on each query
+    const std::int64_t MAX_EDGE_CELLS = 64;
+
+    // The point on segment AB closest to P
+    vw::Vector2 closestOnSegment(vw::Vector2 const& A, vw::Vector2 const& B,
+                                 vw::Vector2 const& P) {
+      vw::Vector2 D = B - A;
+      double len2 = D.x() * D.x() + D.y() * D.y();
+      if (!(len2 > 0))
+        return A;
+      double t = ((P.x() - A.x()) * D.x() + (P.y() - A.y()) * D.y()) / len2;
+      t = std::max(0.0, std::min(1.0, t));
+      return A + t * D;
+    }
+
+    void eraseFrom(std::unordered_map<std::int64_t, std::vector<int>> & cells,
+                   std::int64_t key, int id) {
+      auto it = cells.find(key);
+      if (it == cells.end())
+        return;
+      std::vector<int> & cell = it->second; // alias
+      auto pos = std::find(cell.begin(), cell.end(), id);
+      if (pos != cell.end()) {
+        *pos = cell.back();
+        cell.pop_back();
+      }
+      if (cell.empty())
+        cells.erase(it);
+    }
+  }
+
+  std::int64_t PolyIndex::cellKey(std::int64_t cx, std::int64_t cy) const {
+    return (cx << 32) ^ (cy & 0xffffffff);
+  }
+
+  void PolyIndex::cellOf(vw::Vector2 const& P, std::int64_t & cx, std::int64_t & cy) const {
+    cx = std::floor((P.x() - m_origin.x()) / m_cell_size);
+    cy = std::floor((P.y() - m_origin.y()) / m_cell_size);
+  }
+
+  void PolyIndex::edgeCells(int id, std::int64_t & beg_x, std::int64_t & beg_y,
+                            std::int64_t & end_x, std::int64_t & end_y) const {
+    vw::Vector2 A = point(id), B = point(m_verts[id].next);
+    cellOf(vw::Vector2(std::min(A.x(), B.x()), std::min(A.y(), B.y())), beg_x, beg_y);
+    cellOf(vw::Vector2(std::max(A.x(), B.x()), std::max(A.y(), B.y())), end_x, end_y);
+  }
+
+  void PolyIndex::addVertexToGrid(int id) {
+    std::int64_t cx, cy;
+    cellOf(point(id), cx, cy);
+    m_vert_cells[cellKey(cx, cy)].push_back(id);
+  }
+
+  void PolyIndex::removeVertexFromGrid(int id) {
+    std::int64_t cx, cy;
+    cellOf(point(id), cx, cy);
+    eraseFrom(m_vert_cells, cellKey(cx, cy), id);
+  }
+
+  void PolyIndex::addEdgeToGrid(int id) {
+    std::int64_t beg_x, beg_y, end_x, end_y;
+    edgeCells(id, beg_x, beg_y, end_x, end_y);
+    if ((end_x - beg_x + 1) * (end_y - beg_y + 1) > MAX_EDGE_CELLS) {
+      m_long_edges.push_back(id);
+      return;
+    }
+    for (std::int64_t cy = beg_y; cy <= end_y; cy++)
+      for (std::int64_t cx = beg_x; cx <= end_x; cx++)
+        m_edge_cells[cellKey(cx, cy)].push_back(id);
+  }
+
+  void PolyIndex::removeEdgeFromGrid(int id) {
+    std::int64_t beg_x, beg_y, end_x, end_y;
+    edgeCells(id, beg_x, beg_y, end_x, end_y);
+    if ((end_x - beg_x + 1) * (end_y - beg_y + 1) > MAX_EDGE_CELLS) {
+      auto pos = std::find(m_long_edges.begin(), m_long_edges.end(), id);
+      if (pos != m_long_edges.end())
+        m_long_edges.erase(pos);
+      return;
+    }
+    for (std::int64_t cy = beg_y; cy <= end_y; cy++)
+      for (std::int64_t cx = beg_x; cx <= end_x; cx++)
+        eraseFrom(m_edge_cells, cellKey(cx, cy), id);
+  }
+
+  bool PolyIndex::sameLayout(std::vector<vw::geometry::dPoly> const& polyVec) const {
+    if (polyVec.size() != m_src.size())
+      return false;
+    for (size_t s = 0; s < polyVec.size(); s++) {
+      vw::geometry::dPoly const& a = polyVec[s]; // alias
+      vw::geometry::dPoly const& b = m_src[s];   // alias
+      int numPolys = a.get_numPolys();
+      if (numPolys != b.get_numPolys() || a.get_totalNumVerts() != b.get_totalNumVerts())
+        return false;
+      if (!std::equal(a.get_numVerts(), a.get_numVerts() + numPolys, b.get_numVerts()))
+        return false;
+      if (a.get_isPolyClosed() != b.get_isPolyClosed() ||
+          a.get_colors() != b.get_colors() || a.get_layers() != b.get_layers())
+        return false;
+    }
+    return true;
+  }
+
+  void PolyIndex::rebuild(std::vector<vw::geometry::dPoly> const& polyVec,
+                          std::function<vw::Vector2(vw::Vector2 const&)> const& to_world) {
+    m_src   = polyVec;
+    m_world = polyVec;
+    m_verts.clear();
+    m_x.clear();
+    m_y.clear();
+    m_vert_cells.clear();
+    m_edge_cells.clear();
+    m_long_edges.clear();
+    m_box = vw::BBox2();
+
+    for (size_t s = 0; s < m_world.size(); s++) {
+      double *    xv       = m_world[s].get_xv();
+      double *    yv       = m_world[s].get_yv();
+      const int * numVerts = m_world[s].get_numVerts();
+      int         numPolys = m_world[s].get_numPolys();
+      int start = 0;
+      for (int pIter = 0; pIter < numPolys; pIter++) {
+        if (pIter > 0) start += numVerts[pIter - 1];
+        int pSize = numVerts[pIter];
+        int first = m_verts.size();
+        for (int vIter = 0; vIter < pSize; vIter++) {
+          vw::Vector2 P = to_world(vw::Vector2(xv[start + vIter], yv[start + vIter]));
+          xv[start + vIter] = P.x();
+          yv[start + vIter] = P.y();
+          Vertex v;
+          v.set    = s;
+          v.poly   = pIter;
+          v.vert   = vIter;
+          v.offset = start + vIter;
+          v.prev   = first + (vIter + pSize - 1) % pSize;
+          v.next   = first + (vIter + 1) % pSize;
+          m_verts.push_back(v);
+          m_x.push_back(P.x());
+          m_y.push_back(P.y());
+          m_box.grow(P);
+        }
+      }
+    }
+
+    if (m_verts.empty())
+      return;
+
+    // Aim for about two vertices per cell
+    m_origin = m_box.min();
+    double min_len = 1e-6 * std::max(1.0, std::max(std::abs(m_origin.x()),
+                                                   std::abs(m_origin.y())));
+    double area = std::max(m_box.width(), min_len) * std::max(m_box.height(), min_len);
+    m_cell_size = std::sqrt(2.0 * area / m_verts.size());
+    if (!std::isfinite(m_cell_size) || m_cell_size <= 0)
+      m_cell_size = 1.0;
+
+    for (size_t id = 0; id < m_verts.size(); id++) {
+      addVertexToGrid(id);
+      addEdgeToGrid(id);
+    }
+  }
+
+  void PolyIndex::moveVertex(int id, vw::Vector2 const& P) {
+    int prev = m_verts[id].prev;
+    removeVertexFromGrid(id);
+    removeEdgeFromGrid(id);
+    if (prev != id)
+      removeEdgeFromGrid(prev);
+
+    m_x[id] = P.x();
+    m_y[id] = P.y();
+    m_box.grow(P);
+    Vertex const& v = m_verts[id]; // alias
+    m_world[v.set].get_xv()[v.offset] = P.x();
+    m_world[v.set].get_yv()[v.offset] = P.y();
+
+    addVertexToGrid(id);
+    addEdgeToGrid(id);
+    if (prev != id)
+      addEdgeToGrid(prev);
+  }
+
+  void PolyIndex::update(std::vector<vw::geometry::dPoly> const& polyVec,
+                         std::function<vw::Vector2(vw::Vector2 const&)> const& to_world) {
+
+    if (!sameLayout(polyVec)) {
+      rebuild(polyVec, to_world);
+      return;
+    }
+
+    std::vector<int> moved;
+    for (size_t id = 0; id < m_verts.size(); id++) {
+      Vertex const& v = m_verts[id]; // alias
+      if (polyVec[v.set].get_xv()[v.offset] != m_src[v.set].get_xv()[v.offset] ||
+          polyVec[v.set].get_yv()[v.offset] != m_src[v.set].get_yv()[v.offset])
+        moved.push_back(id);
+    }
+
+    // When many vertices moved, as when a layer was replaced with one of the
+    // same shape, it is simpler to start over
+    if (moved.size() > 16 + m_verts.size() / 8) {
+      rebuild(polyVec, to_world);
+      return;
+    }
+
+    for (size_t it = 0; it < moved.size(); it++) {
+      Vertex const& v = m_verts[moved[it]]; // alias
+      double x = polyVec[v.set].get_xv()[v.offset];
+      double y = polyVec[v.set].get_yv()[v.offset];
+      m_src[v.set].get_xv()[v.offset] = x;
+      m_src[v.set].get_yv()[v.offset] = y;
+      moveVertex(moved[it], to_world(vw::Vector2(x, y)));
+    }
+  }
+
+  template<class Visit>
+  void PolyIndex::searchCells(std::unordered_map<std::int64_t, std::vector<int>> const& cells,
+                              vw::Vector2 const& P, double & minDist, Visit visit) const {
+
+    // The farthest ring of cells around P which can have anything. If P is
+    // much farther than the extent of the polygons, it is cheaper to visit
+    // all cells.
+    vw::Vector2 d = (P - m_origin) / m_cell_size;
+    double span = std::max(m_box.width(), m_box.height()) / m_cell_size + 1.0;
+    vw::Vector2 e = (m_box.max() - m_origin) / m_cell_size;
+    double r_max = std::max(std::max(std::abs(d.x()), std::abs(d.x() - e.x())),
+                            std::max(std::abs(d.y()), std::abs(d.y() - e.y()))) + 1.0;
+    if (!std::isfinite(r_max) || r_max > 2.0 * span) {
+      for (auto it = cells.begin(); it != cells.end(); it++)
+        visit(it->second);
+      return;
+    }
+
+    // Any vertex or edge which is not in rings 0 to r is farther than r
+    // cells from P
+    std::int64_t pcx = std::floor(d.x()), pcy = std::floor(d.y());
+    for (std::int64_t r = 0; r <= std::int64_t(r_max); r++) {
+      for (std::int64_t cy = pcy - r; cy <= pcy + r; cy++) {
+        bool edge_row = (cy == pcy - r || cy == pcy + r);
+        for (std::int64_t cx = pcx - r; cx <= pcx + r; cx += (edge_row ? 1 : 2 * r)) {
+          auto it = cells.find(cellKey(cx, cy));
+          if (it != cells.end())
+            visit(it->second);
+          if (r == 0)
+            break;
+        }
+      }
+      if (minDist <= r * m_cell_size)
+        break;
+    }
+  }
+
+  bool PolyIndex::findClosestVertex(double x0, double y0,
+                                    int & polyVecIndex, int & polyIndexInCurrPoly,
+                                    int & vertIndexInCurrPoly,
+                                    double & minX, double & minY, double & minDist) const {
+    if (m_verts.empty())
+      return false;
+
+    vw::Vector2 P(x0, y0);
+    minDist = std::numeric_limits<double>::max();
+    int best = -1;
+    searchCells(m_vert_cells, P, minDist, [&](std::vector<int> const& cell) {
+      for (size_t k = 0; k < cell.size(); k++) {
+        double dist = norm_2(point(cell[k]) - P);
+        if (dist < minDist || (dist == minDist && cell[k] < best)) {
+          minDist = dist;
+          best    = cell[k];
+        }
+      }
+    });
+    if (best < 0)
+      return false;
+
+    polyVecIndex        = m_verts[best].set;
+    polyIndexInCurrPoly = m_verts[best].poly;
+    vertIndexInCurrPoly = m_verts[best].vert;
+    minX                = m_x[best];
+    minY                = m_y[best];
+    return true;
+  }
+
+  bool PolyIndex::findClosestEdge(double x0, double y0,
+                                  int & polyVecIndex, int & polyIndexInCurrPoly,
+                                  int & vertIndexInCurrPoly,
+                                  double & minX, double & minY, double & minDist) const {
+    if (m_verts.empty())
+      return false;
+
+    vw::Vector2 P(x0, y0), closest;
+    minDist = std::numeric_limits<double>::max();
+    int best = -1;
+    auto visit = [&](std::vector<int> const& cell) {
+      for (size_t k = 0; k < cell.size(); k++) {
+        vw::Vector2 Q = closestOnSegment(point(cell[k]), point(m_verts[cell[k]].next), P);
+        double dist = norm_2(Q - P);
+        if (dist < minDist || (dist == minDist && cell[k] < best)) {
+          minDist = dist;
+          best    = cell[k];
+          closest = Q;
+        }
+      }
+    };
+    visit(m_long_edges);
+    searchCells(m_edge_cells, P, minDist, visit);
+    if (best < 0)
+      return false;
+
+    polyVecIndex        = m_verts[best].set;
+    polyIndexInCurrPoly = m_verts[best].poly;
+    vertIndexInCurrPoly = m_verts[best].vert;
+    minX                = closest.x();
+    minY                = closest.y();
+    return true;
+  }
+
+}} // namespace vw::gui
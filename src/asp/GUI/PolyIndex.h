@@ -0,0 +1,123 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file PolyIndex.h
+///
+/// Keep the polygons of an image in world coordinates, with a grid over
+/// their vertices and edges, so that they need not be converted on each
+/// redraw, and the vertex or edge closest to a point is found without
+/// visiting all of them.
+///
+#ifndef __STEREO_GUI_POLY_INDEX_H__
+#define __STEREO_GUI_POLY_INDEX_H__
+
+#include <vw/Geometry/dPoly.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace vw { namespace gui {
+
+  // The edges of a ring go from each vertex to the next one, and from the
+  // last vertex back to the first. An edge is identified by the index of
+  // its first vertex, as in dPoly::findClosestPolyEdge().
+  class PolyIndex {
+  public:
+    PolyIndex(): m_cell_size(1.0) {}
+
+    // Make the polygons in world coordinates and the grid agree with the
+    // given ones. If only some vertices moved since the last call, as when
+    // the user drags a vertex, only those are converted and moved in the
+    // grid. Otherwise all is redone. The function to_world converts a
+    // vertex to world coordinates.
+    void update(std::vector<vw::geometry::dPoly> const& polyVec,
+                std::function<vw::Vector2(vw::Vector2 const&)> const& to_world);
+
+    // The polygons in world coordinates, as of the last update
+    std::vector<vw::geometry::dPoly> const& worldPolys() const { return m_world; }
+
+    // Find the vertex closest to the given point in world coordinates.
+    // Return false if there are no vertices.
+    bool findClosestVertex(double x0, double y0,
+                           int & polyVecIndex, int & polyIndexInCurrPoly,
+                           int & vertIndexInCurrPoly,
+                           double & minX, double & minY, double & minDist) const;
+
+    // Same for edges. The closest point on the edge is returned.
+    bool findClosestEdge(double x0, double y0,
+                         int & polyVecIndex, int & polyIndexInCurrPoly,
+                         int & vertIndexInCurrPoly,
+                         double & minX, double & minY, double & minDist) const;
+
+  private:
+
+    struct Vertex {
+      int set, poly, vert; // the polygon set, the ring in it, and the index in the ring
+      int offset;          // the index among all vertices of the set
+      int prev, next;      // the neighbors in the ring, among all vertices
+    };
+
+    // If the polygons differ from the last ones only in vertex positions
+    bool sameLayout(std::vector<vw::geometry::dPoly> const& polyVec) const;
+
+    void rebuild(std::vector<vw::geometry::dPoly> const& polyVec,
+                 std::function<vw::Vector2(vw::Vector2 const&)> const& to_world);
+
+    // Move a vertex, and the edges starting and ending at it, to the given
+    // world position
+    void moveVertex(int id, vw::Vector2 const& P);
+
+    vw::Vector2 point(int id) const { return vw::Vector2(m_x[id], m_y[id]); }
+
+    std::int64_t cellKey(std::int64_t cx, std::int64_t cy) const;
+    void cellOf(vw::Vector2 const& P, std::int64_t & cx, std::int64_t & cy) const;
+
+    void addVertexToGrid(int id);
+    void removeVertexFromGrid(int id);
+    void addEdgeToGrid(int id);
+    void removeEdgeFromGrid(int id);
+
+    // The cells spanned by the bounding box of an edge
+    void edgeCells(int id, std::int64_t & beg_x, std::int64_t & beg_y,
+                   std::int64_t & end_x, std::int64_t & end_y) const;
+
+    // Visit rings of cells of growing size around P, until none can hold
+    // anything closer than the current best
+    template<class Visit>
+    void searchCells(std::unordered_map<std::int64_t, std::vector<int>> const& cells,
+                     vw::Vector2 const& P, double & minDist, Visit visit) const;
+
+    std::vector<vw::geometry::dPoly> m_src;   // the polygons as last seen
+    std::vector<vw::geometry::dPoly> m_world; // the same, in world coordinates
+    std::vector<Vertex>  m_verts;             // all vertices in all sets
+    std::vector<double>  m_x, m_y;            // their world coordinates
+
+    double m_cell_size;
+    vw::Vector2 m_origin; // the corner of cell (0, 0)
+    vw::BBox2 m_box;      // contains all vertices
+    std::unordered_map<std::int64_t, std::vector<int>> m_vert_cells, m_edge_cells;
+    std::vector<int> m_long_edges; // edges spanning too many cells, checked always
+  };
+
+}} // namespace vw::gui
+
+#endif  // __STEREO_GUI_POLY_INDEX_H__
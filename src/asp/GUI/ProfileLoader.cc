@@ -0,0 +1,91 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file ProfileLoader.cc
+///
+
+#include <asp/GUI/ProfileLoader.h>
+
+#include <vw/Core/Log.h>
+
+namespace vw { namespace gui {
+
+  ProfileLoader::ProfileLoader(std::function<void()> const& on_loaded):
+    m_cancel(false), m_on_loaded(on_loaded) {}
+
+  ProfileLoader::~ProfileLoader() {
+    cancel();
+  }
+
+  void ProfileLoader::cancel() {
+    m_cancel = true;
+    if (m_thread.joinable())
+      m_thread.join();
+    m_cancel = false;
+  }
+
+  bool ProfileLoader::fetch(std::string const& image_name,
+                            DiskImagePyramidMultiChannel const& img,
+                            std::vector<vw::Vector2i> const& pixels, double coarse_scale,
+                            std::vector<double> & vals) {
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto it = m_profiles.find(image_name);
+      if (it != m_profiles.end() && it->second.pixels == pixels) {
+        vals = it->second.vals;
+        return true;
+      }
+    }
+
+    // This is an older request, or it is done. Either way it is not needed.
+    cancel();
+
+    if (coarse_scale <= 1.0) {
+      img.get_values_as_double(pixels, 1.0, vals);
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_profiles[image_name].pixels = pixels;
+      m_profiles[image_name].vals   = vals;
+      return true;
+    }
+
+    img.get_values_as_double(pixels, coarse_scale, vals);
+
+    // The worker gets its own copy of the image, as with ClipLoader
+    m_thread = std::thread([this, image_name, img, pixels]() {
+      std::vector<double> full_vals;
+      try {
+        img.get_values_as_double(pixels, 1.0, full_vals, &m_cancel);
+      } catch (std::exception const& e) {
+        vw_out(WarningMessage) << "Failed to read the profile: " << e.what() << "\n";
+        return;
+      }
+      if (m_cancel)
+        return;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_profiles[image_name].pixels = pixels;
+        m_profiles[image_name].vals   = full_vals;
+      }
+      if (m_on_loaded)
+        m_on_loaded();
+    });
+
+    return false;
+  }
+
+}} // namespace vw::gui
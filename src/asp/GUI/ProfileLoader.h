@@ -0,0 +1,80 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ProfileLoader.h
+///
+/// Read the image values along a profile first from a coarse pyramid
+/// level, then at full resolution in the background.
+///
+#ifndef __STEREO_GUI_PROFILE_LOADER_H__
+#define __STEREO_GUI_PROFILE_LOADER_H__
+
+#include <asp/GUI/DiskImagePyramidMultiChannel.h>
+
+#include <vw/Math/Vector.h>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vw { namespace gui {
+
+  // The values along the last profile drawn for each image are kept once
+  // read at full resolution. Only one profile is read in the background at
+  // a time. A new request cancels the one in progress.
+  class ProfileLoader {
+  public:
+
+    // The callback is invoked from the worker thread when the full-resolution
+    // values are read. It must only schedule work on the GUI thread.
+    ProfileLoader(std::function<void()> const& on_loaded);
+    ~ProfileLoader();
+
+    // Return true and the full-resolution values at the given pixels if
+    // these were read. Otherwise, return false and the values from the
+    // pyramid level at coarse_scale, and start reading the full-resolution
+    // ones in the background. If coarse_scale is no more than 1, the values
+    // are read at full resolution right away.
+    bool fetch(std::string const& image_name, DiskImagePyramidMultiChannel const& img,
+               std::vector<vw::Vector2i> const& pixels, double coarse_scale,
+               std::vector<double> & vals);
+
+  private:
+
+    struct Profile {
+      std::vector<vw::Vector2i> pixels;
+      std::vector<double>       vals;
+    };
+
+    // Stop the thread reading a profile, if any
+    void cancel();
+
+    std::map<std::string, Profile> m_profiles; // full-resolution profile per image
+    std::thread                    m_thread;
+    std::atomic<bool>              m_cancel;
+    std::mutex                     m_mutex;
+    std::function<void()>          m_on_loaded;
+  };
+
+}} // namespace vw::gui
+
+#endif  // __STEREO_GUI_PROFILE_LOADER_H__
@@ -20,6 +20,10 @@
 #include <asp/GUI/WidgetBase.h>
 #include <vw/Math/Statistics.h>
 
+#include <QImage>
+
+#include <cmath>
+
 namespace vw { namespace gui {
 
 WidgetBase::WidgetBase(int beg_image_id, int end_image_id,
@@ -78,4 +82,65 @@ void findRobustBounds(std::vector<vw::Vector3> const& scattered_data,
   return;
 }
 
+PointRasterizer::PointRasterizer(QRect const& region, int radius):
+  m_region(region), m_radius(std::max(radius, 0)) {}
+
+void PointRasterizer::add(double x, double y, QRgb color) {
+
+  // Discs centered within a radius of the region may still touch it, so
+  // keep track of the center pixels in the region padded by the radius.
+  int r = m_radius;
+  int padded_wid = m_region.width() + 2 * r, padded_hgt = m_region.height() + 2 * r;
+  int col = int(floor(x + 0.5)) - m_region.left() + r;
+  int row = int(floor(y + 0.5)) - m_region.top()  + r;
+  if (col < 0 || row < 0 || col >= padded_wid || row >= padded_hgt || x != x || y != y)
+    return;
+
+  m_pixels.push_back(row * padded_wid + col);
+  m_colors.push_back(color);
+}
+
+void PointRasterizer::draw(QPainter * paint) {
+
+  int wid = m_region.width(), hgt = m_region.height();
+  if (m_pixels.empty() || wid <= 0 || hgt <= 0)
+    return;
+
+  // The last disc at each center pixel, the only one which will be drawn
+  int r = m_radius;
+  int padded_wid = wid + 2 * r, padded_hgt = hgt + 2 * r;
+  std::vector<int> last(size_t(padded_wid) * padded_hgt, -1);
+  for (size_t it = 0; it < m_pixels.size(); it++)
+    last[m_pixels[it]] = it;
+
+  // The pixels of a disc, about as drawn by QPainter::drawEllipse()
+  std::vector<QPoint> disc;
+  for (int dy = -r; dy <= r; dy++) {
+    for (int dx = -r; dx <= r; dx++) {
+      if (dx * dx + dy * dy <= r * r + r)
+        disc.push_back(QPoint(dx, dy));
+    }
+  }
+
+  QImage qimg(wid, hgt, QImage::Format_ARGB32_Premultiplied);
+  qimg.fill(Qt::transparent);
+  uchar * bits = qimg.bits();
+  int bytes_per_line = qimg.bytesPerLine();
+  for (size_t it = 0; it < m_pixels.size(); it++) {
+    int pix = m_pixels[it];
+    if (last[pix] != int(it))
+      continue;
+    int col = pix % padded_wid - r, row = pix / padded_wid - r;
+    QRgb color = m_colors[it];
+    for (size_t d = 0; d < disc.size(); d++) {
+      int c = col + disc[d].x(), w = row + disc[d].y();
+      if (c < 0 || w < 0 || c >= wid || w >= hgt)
+        continue;
+      reinterpret_cast<QRgb*>(bits + w * bytes_per_line)[c] = color;
+    }
+  }
+
+  paint->drawImage(m_region.topLeft(), qimg);
+}
+
 }} // namespace vw::gui
@@ -23,6 +23,8 @@
 #define __STEREO_GUI_WIDGET_BASE_H__
 
 #include <QObject> // to avoid errors about boost and Qobject
+#include <QPainter>
+#include <QRect>
 
 // ASP
 #include <asp/GUI/GuiUtilities.h>
@@ -89,6 +91,30 @@ public:
 void findRobustBounds(std::vector<vw::Vector3> const& scattered_data,
   double & min_val, double & max_val);
 
+// Draw many filled discs of the same radius, such as scattered data points
+// or interest points. They are written straight into an image, which is
+// then drawn in one QPainter call, rather than one call per disc. A disc
+// centered at the same screen pixel as a later one is skipped, as the
+// later disc covers it fully. When zoomed out, with many points per
+// pixel, this leaves about one disc per pixel. Discs far off screen are
+// skipped too.
+class PointRasterizer {
+public:
+  // The region is in the painter's coordinates
+  PointRasterizer(QRect const& region, int radius);
+
+  // Queue a disc. The discs are drawn in the order they are added.
+  void add(double x, double y, QRgb color);
+
+  void draw(QPainter * paint);
+
+private:
+  QRect m_region;
+  int   m_radius;
+  std::vector<int>  m_pixels; // the center pixel in the padded region, or -1
+  std::vector<QRgb> m_colors;
+};
+
 }} // namespace vw::gui
 
 #endif  // __STEREO_GUI_WIDGET_BASE_H__
\ No newline at end of file
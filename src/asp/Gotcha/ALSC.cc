@@ -52,16 +52,13 @@ ALSC::ALSC(Mat imgL, Mat imgR, CALSCParam paramALSC){
     nSystemMatrixRows = nRowPatch*nColPatch; //4 * nRadius * nRadius + 1 + 4 * nRadius;
     emA = Eigen::MatrixXf(nSystemMatrixRows,nParam);
     emB = Eigen::VectorXf(nSystemMatrixRows);
+    emAS = SmallMatrix(nParam, nParam);
+    emATB = SmallVector(nParam);
+    emS = SmallVector(nParam);
+    emErrors = Eigen::VectorXf(nSystemMatrixRows);
 
-    pfGx.resize(nRowPatch);
-    for (int i = 0; i < nRowPatch; i++) {
-        pfGx[i].resize(nColPatch);
-    }
-
-    pfGy.resize(nRowPatch);
-    for (int i = 0; i < nRowPatch; i++) {
-        pfGy[i].resize(nColPatch);
-    }
+    pfGx = Eigen::MatrixXf::Zero(nRowPatch, nColPatch);
+    pfGy = Eigen::MatrixXf::Zero(nRowPatch, nColPatch);
 
 }
 
@@ -154,12 +151,12 @@ bool ALSC::doMatching(Point2f ptStartL, Point2f ptStartR, CTiePt& tp, const floa
 
                 int xOffset = x - nPatchRadius;
 
-                float fVal = pfGx[y][x];
+                float fVal = pfGx(y, x);
                 emA(count,0) = fVal;
                 emA(count,1) = fVal * xOffset;
                 emA(count,2) = fVal * yOffset;
 
-                fVal = pfGy[y][x];
+                fVal = pfGy(y, x);
                 emA(count,3) = fVal;
                 emA(count,4) = fVal * xOffset;
                 emA(count,5) = fVal * yOffset;
@@ -174,20 +171,18 @@ bool ALSC::doMatching(Point2f ptStartL, Point2f ptStartR, CTiePt& tp, const floa
         }
 
         // get LMS solution
-        Eigen::VectorXf emS(nParam);
-        Eigen::MatrixXf emAS(nParam,nParam);
 
         /* Don't explicitly calculate the inverse!  Use Cholesky decomposition instead. */
-        Eigen::MatrixXf emAT = emA.transpose();
-        emAS = (emAT*emA);
-        emS = emAS.llt().solve(emAT*emB);
+        emAS.noalias() = emA.transpose() * emA;
+        emATB.noalias() = emA.transpose() * emB;
+        emS = emAS.llt().solve(emATB);
 
         if (m_paramALSC.m_bIntOffset)
             fIntOffNew = emS(6);
 
         // error computation
-        Eigen::VectorXf emErrors(nSystemMatrixRows);
-        emErrors = (emA * emS) - emB;
+        emErrors.noalias() = emA * emS;
+        emErrors -= emB;
 
         // Compute the standard deviation of residual errors
         double dTotElelement = nSystemMatrixRows; //nRowPatch *nColPatch; //2 * nRadius + 1; //dTotElelement *= dTotElelement;
@@ -307,9 +302,10 @@ void ALSC::getGradientX(Eigen::Ref<Eigen::MatrixXf> matSrc) {
     int nW = matSrc.cols();
     int nH = matSrc.rows();
 
-    for (int y = 1; y < nH - 1; y++) {
-        for (int x = 1; x < nW - 1; x++) {
-            pfGx.at(y).at(x) = matSrc(y, x+1) - matSrc(y, x);
+    // Eigen matrices are column-major
+    for (int x = 1; x < nW - 1; x++) {
+        for (int y = 1; y < nH - 1; y++) {
+            pfGx(y, x) = matSrc(y, x+1) - matSrc(y, x);
         }
     }
 
@@ -321,9 +317,9 @@ void ALSC::getGradientY(Eigen::Ref<Eigen::MatrixXf> matSrc) {
     int nW = matSrc.cols();
     int nH = matSrc.rows();
 
-    for (int y = 1; y < nH - 1; y++) {
-        for (int x = 1; x < nW - 1; x++) {
-            pfGy.at(y).at(x) = matSrc(y+1, x) - matSrc(y, x);
+    for (int x = 1; x < nW - 1; x++) {
+        for (int y = 1; y < nH - 1; y++) {
+            pfGy(y, x) = matSrc(y+1, x) - matSrc(y, x);
         }
     }
 
@@ -363,14 +359,16 @@ void ALSC::distortPatch(const Mat& matImg, const Point2f ptCentre, const float*
     /* Case when we're just cropping an image, don't waste time doing interpolation */
     if(pfAff[0] == 0 && pfAff[1] == 0 && pfAff[2] == 0 && pfAff[3] == 0){
         for (j = 0; j < nH; j++) {
+                dNewY = ptCentre.y + initY + j;
+                bool bRowOut = (dNewY < 0 || dNewY >= matImg.rows);
+                const unsigned char* pRow = bRowOut ? NULL : matImg.ptr<unsigned char>((int)dNewY);
                 for (i = 0; i < nW; i++) {
                     dNewX = ptCentre.x + initX + i;
-                    dNewY = ptCentre.y + initY + j;
 
-                    if(dNewX < 0 || dNewY < 0 || dNewX > matImg.cols || dNewY > matImg.rows)
+                    if(bRowOut || dNewX < 0 || dNewX >= matImg.cols)
                         matImgPatch(j,i) = 0.0;
                     else{
-                        matImgPatch(j,i) = matImg.at<unsigned char>(dNewY, dNewX);
+                        matImgPatch(j,i) = pRow[(int)dNewX];
                     }
                 }
         }
@@ -382,28 +380,33 @@ void ALSC::distortPatch(const Mat& matImg, const Point2f ptCentre, const float*
             pptUpdated[3] = Point2f(ptCentre.x + initX + nW-1, ptCentre.y + initY + nH-1);
         }
     }else{
-        /* Otherwise interpolate */
+        /* Otherwise interpolate. The affine transform is done inline, with
+           the terms depending only on the row found once per row. */
         for (j = 0; j < nH; j++) {
+                double y = initY + j;
+                double dRowX = ptCentre.x + y * pfAff[1];
+                double dRowY = ptCentre.y + y + y * pfAff[3];
                 for (i = 0; i < nW; i++) {
-                    /* Perform the affine transform on the points */
-                    affineTransform(initX+i, initY+j, ptCentre, pfAff, &dNewX, &dNewY);
+                    double x = initX + i;
+                    dNewX = dRowX + x + x * pfAff[0];
+                    dNewY = dRowY + x * pfAff[2];
 
                     /* Interpolate from the image */
                     matImgPatch(j,i) = interpolate(dNewX, dNewY, matImg);
-
-                    /* Check if we're at one of the patch corners and store into the boundary array if needed */
-                    if(i == 0){
-                        if(j == 0){
-                            if (pptUpdated != NULL) pptUpdated[0] = Point2f(dNewX, dNewY);
-                        }else if(j == nH-1){
-                            if (pptUpdated != NULL) pptUpdated[1] = Point2f(dNewX, dNewY);
-                        }
-                    }else if(i == nW-1 && j == 0){
-                        if (pptUpdated != NULL) pptUpdated[3] = Point2f(dNewX, dNewY);
-                    }
                 }
             }
-            if (pptUpdated != NULL) pptUpdated[2] = Point2f(dNewX, dNewY);
+
+        /* Store the patch corners into the boundary array if needed */
+        if (pptUpdated != NULL){
+            affineTransform(initX, initY, ptCentre, pfAff, &dNewX, &dNewY);
+            pptUpdated[0] = Point2f(dNewX, dNewY);
+            affineTransform(initX, initY+nH-1, ptCentre, pfAff, &dNewX, &dNewY);
+            pptUpdated[1] = Point2f(dNewX, dNewY);
+            affineTransform(initX+nW-1, initY+nH-1, ptCentre, pfAff, &dNewX, &dNewY);
+            pptUpdated[2] = Point2f(dNewX, dNewY);
+            affineTransform(initX+nW-1, initY, ptCentre, pfAff, &dNewX, &dNewY);
+            pptUpdated[3] = Point2f(dNewX, dNewY);
+        }
     }
 
     return;
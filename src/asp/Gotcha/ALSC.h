@@ -74,8 +74,9 @@ private:
     int nColPatch;
     int nSystemMatrixRows;
 
-    std::vector<std::vector<float> > pfGx;
-    std::vector<std::vector<float> > pfGy;
+    // Gradients of the right patch. The border stays zero.
+    Eigen::MatrixXf pfGx;
+    Eigen::MatrixXf pfGy;
 
     Eigen::MatrixXf matPatchL;
     Eigen::MatrixXf matPatchR;
@@ -85,6 +86,15 @@ private:
     Eigen::MatrixXf emA;
     Eigen::VectorXf emB;
 
+    // Workspace for the normal equations, with at most 7 parameters, so
+    // that it is not allocated in each iteration
+    typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, 0, 7, 7> SmallMatrix;
+    typedef Eigen::Matrix<float, Eigen::Dynamic, 1, 0, 7, 1> SmallVector;
+    SmallMatrix emAS;
+    SmallVector emATB;
+    SmallVector emS;
+    Eigen::VectorXf emErrors;
+
     int nParam;
 
     // outputs:
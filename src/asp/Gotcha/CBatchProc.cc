@@ -19,6 +19,8 @@
 #include <asp/Gotcha/CDensifyParam.h>
 #include <asp/Gotcha/CDensify.h>
 
+#include <algorithm>
+
 #include <boost/filesystem.hpp>
 
 namespace fs = boost::filesystem;
@@ -53,7 +55,8 @@ CBatchProc::CBatchProc(std::string          const & strMetaFile,
                        vw::ImageView<float> const & imgL,
                        vw::ImageView<float> const & imgR, 
                        vw::ImageView<float> const & input_dispX,
-                       vw::ImageView<float> const & input_dispY) {
+                       vw::ImageView<float> const & input_dispY,
+                       int num_threads): m_nThreads(std::max(num_threads, 1)) {
 
   // Sanity checks
   if (bounding_box(imgL)        != bounding_box(imgR) ||
@@ -481,6 +484,19 @@ void CBatchProc::refinement(std::vector<CTiePt> const& vecTPs,
   //paramDense.m_paramGotcha.m_nMinTile = (int)tl["nMinTile"];
   //Mat matDummy = imread(m_strImgL, CV_LOAD_IMAGE_ANYDEPTH);
   paramDense.m_paramGotcha.m_nMinTile = m_imgL.cols + m_imgL.rows;
+  paramDense.m_nThreads = m_nThreads;
+  if (m_nThreads > 1) {
+    // Break the image into a grid of g x g tiles, for g a power of 2, so that
+    // each of the four passes over the tiles in CDensify::doGotcha() has at
+    // least as many tiles as threads. The tiles must be well larger than the
+    // ALSC patch.
+    int g = 2;
+    while ((g/2) * (g/2) < m_nThreads)
+      g *= 2;
+    int nMinTile = std::min(m_imgL.cols, m_imgL.rows) / g - 1;
+    int nPatch = (int)tl["nALSCKernel"];
+    paramDense.m_paramGotcha.m_nMinTile = std::max(nMinTile, 4 * nPatch);
+  }
   paramDense.m_paramGotcha.m_nNeiType = (int)tl["nNeiType"];
 
   paramDense.m_paramGotcha.m_paramALSC.m_bIntOffset = (int)tl["bIntOffset"];
@@ -41,7 +41,8 @@ public:
              vw::ImageView<float> const & imgL,
              vw::ImageView<float> const & imgR, 
              vw::ImageView<float> const & input_dispX,
-             vw::ImageView<float> const & input_dispY);
+             vw::ImageView<float> const & input_dispY,
+             int num_threads = 1);
 
   ~CBatchProc();
   
@@ -66,6 +67,7 @@ protected:
 
 protected:
   std::string m_strMetaFile;   // file path to the Metadata file
+  int m_nThreads;              // threads to use for densification
 #if 0
   std::string m_strImgL;
   std::string m_strImgR;
@@ -87,6 +89,7 @@ class GotchaPerBlockView: public vw::ImageViewBase<GotchaPerBlockView>{
   vw::ImageViewRef<float> m_left_img, m_right_img;
   int m_padding;
   std::string m_casp_go_param_file;
+  int m_num_threads;
   
   typedef vw::PixelMask<vw::Vector2f> PixelT;
 
@@ -94,9 +97,11 @@ public:
   GotchaPerBlockView(vw::ImageViewRef<vw::PixelMask<vw::Vector2f>> input_disp,
                      vw::ImageViewRef<float> left_img,
                      vw::ImageViewRef<float> right_img,
-                     int padding, std::string const& casp_go_param_file):
+                     int padding, std::string const& casp_go_param_file,
+                     int num_threads):
     m_input_disp(input_disp), m_left_img(left_img), m_right_img(right_img),
-    m_padding(padding), m_casp_go_param_file(casp_go_param_file){}
+    m_padding(padding), m_casp_go_param_file(casp_go_param_file),
+    m_num_threads(num_threads){}
   
   typedef PixelT pixel_type;
   typedef PixelT result_type;
@@ -129,7 +134,8 @@ public:
                          crop(m_left_img, biased_box), 
                          crop(m_right_img, biased_box), 
                          vw::select_channel(cropped_disp, 0),
-                         vw::select_channel(cropped_disp, 1));
+                         vw::select_channel(cropped_disp, 1),
+                         m_num_threads);
     batchProc.doBatchProcessing(output_dispX, output_dispY);
     
     // Integrate back the processed bands.
@@ -146,11 +152,16 @@ public:
   }
 };
 
+// Each block is refined with the given number of threads. Blocks are
+// already processed in parallel when written, so this should be more
+// than one only if there are fewer blocks than threads.
 GotchaPerBlockView gotcha_refine(vw::ImageViewRef<vw::PixelMask<vw::Vector2f>> input_disp,
                                  vw::ImageViewRef<float> left_img,
                                  vw::ImageViewRef<float> right_img,
-                                 int padding, std::string const& casp_go_param_file){
-  return GotchaPerBlockView(input_disp, left_img, right_img, padding, casp_go_param_file);
+                                 int padding, std::string const& casp_go_param_file,
+                                 int num_threads = 1){
+  return GotchaPerBlockView(input_disp, left_img, right_img, padding, casp_go_param_file,
+                            num_threads);
 }
 
 } // end namespace gotcha
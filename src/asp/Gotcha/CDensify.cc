@@ -175,10 +175,18 @@ int CDensify::performDensitification(cv::Mat & output_dispX, cv::Mat & output_di
 }
 
 vector<CTiePt> CDensify::getIntToFloatSeed(vector<CTiePt>& vecTPSrc) {
-    vector<CTiePt> vecRes;
 
+    // The seeds are refined independently of each other, so this is done in
+    // parallel, with an ALSC instance, and hence workspace, for each thread.
+    // The results are kept per seed and put together in the original order.
     int nLen =  vecTPSrc.size();
+    vector< vector<CTiePt> > vecResPerSeed(nLen);
+    #pragma omp parallel num_threads(m_paramDense.m_nThreads) if (m_paramDense.m_nThreads > 1)
+    {
+    ALSC alsc(m_imgL, m_imgR,  m_paramDense.m_paramGotcha.m_paramALSC);
+    #pragma omp for schedule(dynamic, 256)
     for (int i = 0; i < nLen; i++){
+        vector<CTiePt> & vecRes = vecResPerSeed[i];
         //get four neighbours
         CTiePt tp = vecTPSrc.at(i);
         Point2f ptL = tp.m_ptL;
@@ -221,7 +229,6 @@ vector<CTiePt> CDensify::getIntToFloatSeed(vector<CTiePt>& vecTPSrc) {
         vectpSeeds.push_back(tpTemp);
 
         //apply ALSC to collect as new seed
-        ALSC alsc(m_imgL, m_imgR,  m_paramDense.m_paramGotcha.m_paramALSC);
         alsc.performALSC(&vectpSeeds);
         vectpSeeds.clear();
         alsc.getRefinedTps(vectpSeeds); // hard-copy
@@ -233,6 +240,11 @@ vector<CTiePt> CDensify::getIntToFloatSeed(vector<CTiePt>& vecTPSrc) {
             }
         }
     }
+    } // end omp parallel
+
+    vector<CTiePt> vecRes;
+    for (int i = 0; i < nLen; i++)
+        vecRes.insert(vecRes.end(), vecResPerSeed[i].begin(), vecResPerSeed[i].end());
 
     return vecRes;
 }
@@ -671,7 +683,7 @@ void CDensify::removeOutsideImage(vector<CTiePt>& vecNeiTp, const Rect_<float> r
 
 }
 
-void CDensify::removePtInLUT(vector<CTiePt>& vecNeiTp, const vector<bool>& pLUT, const int nWidth){
+void CDensify::removePtInLUT(vector<CTiePt>& vecNeiTp, const vector<unsigned char>& pLUT, const int nWidth){
     vector<CTiePt>::iterator iter;
 
     for (iter = vecNeiTp.begin(); iter < vecNeiTp.end(); ){        
@@ -751,13 +763,8 @@ bool CDensify::doGotcha(const Mat& matImgL, const Mat& matImgR, vector<CTiePt>&
     // cout << "CASP-GO INFO: initialising pixel LUT" << endl;
 
     // IMARS bool pLUT[szImgL.area()]; // if true it indicates the pixel has already processed
-    vector<bool> pLUT; //IMARS
-
-    // initialise
-    for (int i = 0; i< szImgL.area(); i++){
-        bool bpLUT = false; //IMARS
-        pLUT.push_back(bpLUT); //IMARS
-    } //IMARS
+    // Not a vector<bool>, as tiles may set their pixels from different threads
+    vector<unsigned char> pLUT(szImgL.area(), false); //IMARS
 
     vector< Rect_<float> > vecRectTiles;
     vecRectTiles.push_back(Rect(0., 0., matImgL.cols, matImgL.rows));
@@ -804,16 +811,86 @@ bool CDensify::doGotcha(const Mat& matImgL, const Mat& matImgR, vector<CTiePt>&
     vectpAdded.clear();
     //cout << "CASP-GO INFO: Desifying disparity... ..." << endl;
 
-    for (int i = 0 ; i < (int)vecRectTiles.size(); i++){
-          vector<CTiePt> vecRes;
-          bRes = bRes && doTileGotcha(matImgL, matImgR, vectpSeeds, paramGotcha, vecRes, vecRectTiles.at(i), matSimMap, pLUT);
-          // collect result
-          vectpAdded.insert(vectpAdded.end(), vecRes.begin(), vecRes.end());
+    // The neighbours of a point are at most this far from it. With
+    // diffusion, they are found from the similarity map in a window around
+    // the point, which may extend into other tiles.
+    int nReach = 1;
+    if (paramGotcha.m_nNeiType == CGOTCHAParam::NEI_DIFF)
+        nReach = paramGotcha.m_paramALSC.m_nPatch + 1;
+
+    // The tiles are all of the same size. They are grown in parallel in four
+    // passes, one for each position in a 2x2 pattern of tiles. The tiles in a
+    // pass are at least a tile apart, so if the tiles are larger than the
+    // reach, none of them sees the pixels another one changes, and the result
+    // does not depend on the number of threads.
+    int nTiles = vecRectTiles.size();
+    int nThreads = m_paramDense.m_nThreads;
+    bool bParallel = (nThreads > 1 && nTiles > 1);
+    for (int i = 0; i < nTiles; i++){
+        if (vecRectTiles[i].width <= nReach || vecRectTiles[i].height <= nReach)
+            bParallel = false;
+    }
 
-          // debug
-          //cout << "Tile " << i << " has been processed: " << vecRes.size() << " points are added" << endl;
+    vector< vector<CTiePt> > vecTileRes(nTiles);
+    if (!bParallel){
+        for (int i = 0 ; i < nTiles; i++){
+            bRes = bRes && doTileGotcha(matImgL, matImgR, vectpSeeds, paramGotcha, vecTileRes[i], vecRectTiles.at(i), matSimMap, pLUT);
+            // debug
+            //cout << "Tile " << i << " has been processed: " << vecTileRes[i].size() << " points are added" << endl;
+        }
+    }
+    else{
+        vector<unsigned char> vecTileOk(nTiles, true);
+        for (int nPass = 0; nPass < 4; nPass++){
+            vector<int> vecPassTiles;
+            for (int i = 0; i < nTiles; i++){
+                Rect_<float> rect = vecRectTiles[i];
+                int nTileX = (int)floor(rect.x / rect.width + 0.5);
+                int nTileY = (int)floor(rect.y / rect.height + 0.5);
+                if (nTileX % 2 + 2 * (nTileY % 2) == nPass)
+                    vecPassTiles.push_back(i);
+            }
+            int nPassTiles = vecPassTiles.size();
+            #pragma omp parallel for schedule(dynamic) num_threads(nThreads)
+            for (int k = 0; k < nPassTiles; k++){
+                int i = vecPassTiles[k];
+                vecTileOk[i] = doTileGotcha(matImgL, matImgR, vectpSeeds, paramGotcha, vecTileRes[i],
+                                            vecRectTiles.at(i), matSimMap, pLUT);
+            }
+        }
+        for (int i = 0; i < nTiles; i++)
+            bRes = bRes && vecTileOk[i];
+
+        // A tile does not grow past its boundary. To grow across the seams,
+        // as a single tile would, grow once more over the whole image, from the
+        // points close enough to a tile boundary to have neighbours past it.
+        // Points already found are not revisited.
+        vector<CTiePt> vecSeamSeeds;
+        for (int i = 0; i < nTiles; i++){
+            Rect_<float> rect = vecRectTiles[i];
+            Rect_<float> rectInner(rect.x + nReach, rect.y + nReach,
+                                   rect.width - 2 * nReach, rect.height - 2 * nReach);
+            for (int j = 0; j < (int)vectpSeeds.size(); j++){
+                Point2f pt = vectpSeeds[j].m_ptL;
+                if (rect.contains(pt) && !rectInner.contains(pt))
+                    vecSeamSeeds.push_back(vectpSeeds[j]);
+            }
+            for (int j = 0; j < (int)vecTileRes[i].size(); j++){
+                if (!rectInner.contains(vecTileRes[i][j].m_ptL))
+                    vecSeamSeeds.push_back(vecTileRes[i][j]);
+            }
+        }
+        vector<CTiePt> vecSeamRes;
+        Rect_<float> rectImg(0, 0, matImgL.cols, matImgL.rows);
+        bRes = bRes && doTileGotcha(matImgL, matImgR, vecSeamSeeds, paramGotcha, vecSeamRes,
+                                    rectImg, matSimMap, pLUT);
+        vecTileRes.push_back(vecSeamRes);
     }
 
+    // collect result
+    for (int i = 0; i < (int)vecTileRes.size(); i++)
+        vectpAdded.insert(vectpAdded.end(), vecTileRes[i].begin(), vecTileRes[i].end());
+
     return bRes;
 }
 
@@ -821,7 +898,7 @@ bool CDensify::doGotcha(const Mat& matImgL, const Mat& matImgR, vector<CTiePt>&
 bool CDensify::doTileGotcha(const Mat& matImgL, const Mat& matImgR, const
                             vector<CTiePt>& vectpSeeds,
                             const CGOTCHAParam& paramGotcha, vector<CTiePt>& vectpAdded,
-                            const Rect_<float> rectTileL, Mat& matSimMap, vector<bool>& pLUT){
+                            const Rect_<float> rectTileL, Mat& matSimMap, vector<unsigned char>& pLUT){
 
     vector<CTiePt> vectpSeedTPs; //= vectpSeeds;                // need this hard copy for sorting
 
@@ -840,6 +917,9 @@ bool CDensify::doTileGotcha(const Mat& matImgL, const Mat& matImgR, const
     }
     //std::cout << "Reading mask: " << paramGotcha.m_strMask << std::endl;
     //Mat Mask = imread(paramGotcha.m_strMask, CV_LOAD_IMAGE_ANYDEPTH);
+#if 0
+    // This visits the whole image for each tile, and is only needed for the
+    // progress messages below
     Mat imgL = matImgL;
     Mat imgR = matImgR;
     imgL.convertTo(imgL, CV_8UC1);
@@ -853,6 +933,7 @@ bool CDensify::doTileGotcha(const Mat& matImgL, const Mat& matImgR, const
                 nGapSize+=1;
         }
     }
+#endif
 
     //sort(vectpSeedTPs.begin(), vectpSeedTPs.end(), compareTP); // sorted in ascending order
     /////////////////////////////////////////////////////////////////////
@@ -863,12 +944,18 @@ bool CDensify::doTileGotcha(const Mat& matImgL, const Mat& matImgR, const
       cout << "[--------------------]  0% OF THE GAP AREA HAS BEEN DENSIFIED\r" << std::flush;
 #endif
       
-    while (vectpSeedTPs.size() > 0) {
+    // The seeds are taken in the order they were added. Advance an index
+    // rather than erasing the first one, which would move all others. One
+    // ALSC instance is used for the tile, to not allocate its workspace for
+    // each seed.
+    ALSC alsc(matImgL, matImgR, paramGotcha.m_paramALSC);
+    size_t nHead = 0;
+    while (nHead < vectpSeedTPs.size()) {
         // get a point from seed
-        CTiePt tp = vectpSeedTPs.at(0);
+        CTiePt tp = vectpSeedTPs.at(nHead);
 
 //        mvectpAdded.push_back(tp);
-        vectpSeedTPs.erase(vectpSeedTPs.begin());
+        nHead++;
         vector<CTiePt> vecNeiTp;        
         getNeighbour(tp, vecNeiTp, paramGotcha.m_nNeiType, matSimMap);
         removeOutsideImage(vecNeiTp, rectTileL, rectImgR);
@@ -883,8 +970,6 @@ bool CDensify::doTileGotcha(const Mat& matImgL, const Mat& matImgR, const
             pfData[4] = tp.m_ptOffset.x;
             pfData[5] = tp.m_ptOffset.y;
 
-            ALSC alsc(matImgL, matImgR, paramGotcha.m_paramALSC);
-
             alsc.performALSC(&vecNeiTp, (float*) pfData);
             const vector<CTiePt>* pvecRefTPtemp = alsc.getRefinedTps();
 
@@ -62,8 +62,8 @@ private:
                   const CGOTCHAParam& paramGotcha, std::vector<CTiePt>& vectpAdded);
     bool doTileGotcha(const cv::Mat& matImgL, const cv::Mat& matImgR, const std::vector<CTiePt>& vectpSeeds,
                       const CGOTCHAParam& paramGotcha, std::vector<CTiePt>& mvectpAdded,
-                      const cv::Rect_<float> rectTileL, cv::Mat& matSimMap, std::vector<bool>& pLUT); //IMARS
-    void removePtInLUT(std::vector<CTiePt>& vecNeiTp, const std::vector<bool>& pLUT, const int nWidth); //IMARS
+                      const cv::Rect_<float> rectTileL, cv::Mat& matSimMap, std::vector<unsigned char>& pLUT); //IMARS
+    void removePtInLUT(std::vector<CTiePt>& vecNeiTp, const std::vector<unsigned char>& pLUT, const int nWidth); //IMARS
     void removeOutsideImage(std::vector<CTiePt>& vecNeiTp, const cv::Rect_<float> rectTileL, const cv::Rect_<float> rectImgR);
     void getNeighbour(const CTiePt tp, std::vector<CTiePt>& vecNeiTp, const int nNeiType, const cv::Mat& matSim);
     void getDisffusedNei(std::vector<CTiePt>& vecNeiTp, const CTiePt tp, const cv::Mat& matSim);
@@ -27,8 +27,9 @@ namespace gotcha {
 class CDensifyParam {
 
 public:
-  CDensifyParam(): m_nProcType(GOTCHA){}
+  CDensifyParam(): m_nProcType(GOTCHA), m_nThreads(1){}
   int m_nProcType;     // growing method
+  int m_nThreads;      // threads for seed refinement and for growing tiles in parallel
 #if 0
   std::string m_strImgL;
   std::string m_strImgR;
@@ -515,7 +515,12 @@ def getGsdFromMapproject(imagePath, cameraPath, logger, lidarDem, referenceDem):
     return gsd
 
 def getCorrectedFireballDems(outputFolder):
-    '''Get a dictionary of the corrected fireball DEMs, with path prepended to them.'''
+    '''Get a dictionary of the corrected fireball DEMs, with path prepended to them.
+       The result is cached.'''
+
+    if outputFolder in fireballFrameDictCache:
+        return fireballFrameDictCache[outputFolder]
+
     fireballFolder     = getFireballFolder(outputFolder)
     corrFireballFolder = getCorrFireballFolder(outputFolder)
     fireballIndexPath  = csvIndexFile(fireballFolder)
@@ -554,6 +559,7 @@ def getCorrectedFireballDems(outputFolder):
         
         correctedFireballFrameDict[frame] = corrDem
 
+    fireballFrameDictCache[outputFolder] = correctedFireballFrameDict
     return correctedFireballFrameDict
     
 def getCameraGsdAndBoundsRetry(imagePath, cameraPath, logger, referenceDem, projString=""):
@@ -1198,9 +1204,19 @@ def getAlignedBundlePrefix(outputFolder):
 def lidar_pair_prefix():
     return 'LIDAR_PAIR_'
 
-def findMatchingLidarFile(imageFile, lidarFolder):
-    '''Given an image file, find the best lidar file to use for alignment.'''
-    
+# The lists of lidar files and fireball DEMs for each folder, read once per
+# process. When these are filled in before starting a pool of processes, each
+# process gets a copy without reading the index files again.
+lidarFileListCache     = {}
+fireballFrameDictCache = {}
+
+def getLidarFileList(lidarFolder):
+    '''Return the paired lidar files in the given lidar folder. The result
+       is cached.'''
+
+    if lidarFolder in lidarFileListCache:
+        return lidarFileListCache[lidarFolder]
+
     # Look in the paired lidar folder, not the original lidar folder.
     pairedFolder    = getPairedLidarFolder(lidarFolder)
     pairedLidarFile = getPairedIndexFile(pairedFolder)
@@ -1220,6 +1236,13 @@ def findMatchingLidarFile(imageFile, lidarFolder):
     if len(lidarFiles) <= 0:
         raise Exception("Empty directory of pairs in " + pairedFolder)
 
+    lidarFileListCache[lidarFolder] = lidarFiles
+    return lidarFiles
+
+def findMatchingLidarFile(imageFile, lidarFolder):
+    '''Given an image file, find the best lidar file to use for alignment.'''
+    
+    lidarFiles = getLidarFileList(lidarFolder)
     return findMatchingLidarFileFromList(imageFile, lidarFiles)
 
 def findMatchingLidarFileFromList(imageFile, lidarFiles):
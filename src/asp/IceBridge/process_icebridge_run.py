@@ -486,6 +486,16 @@ def main(argsIn):
         os.system('rm -f ' + batchLogPath)
         logger.info('Just generating batch log file '+batchLogPath+', no processing will occur.')
 
+    # Read the lidar and fireball indices once, before starting the pool, so
+    # each process has them already. The pool processes are reused for many
+    # batches, and keep any other cached data between them.
+    try:
+        icebridge_common.getLidarFileList(lidarFolder)
+        if options.fireballFolder:
+            icebridge_common.getCorrectedFireballDems(os.path.dirname(options.fireballFolder))
+    except Exception as e:
+        logger.warning('Could not read the lidar or fireball index: ' + str(e))
+
     logger.info('Starting processing pool with ' + str(options.numProcesses) +' processes.')
     pool = NonDaemonPool(options.numProcesses)
     
@@ -30,20 +30,25 @@
 
 // ASP
 #include <asp/IsisIO/IsisInterface.h>
+#include <asp/IsisIO/IsisInterfacePool.h>
 
 namespace vw {
 namespace camera {
 
   // This is largely just a shortened reimplementation of ISIS's
-  // Camera.cpp.
+  // Camera.cpp. Each call is made with an ISIS camera instance used by only
+  // one thread at a time. If pool_size is more than 1, up to that many
+  // instances are created as needed, so this model can be used from that
+  // many threads in parallel.
   class IsisCameraModel : public CameraModel {
+    typedef asp::isis::IsisInterfacePool::Handle Handle;
 
   public:
     //------------------------------------------------------------------
     // Constructors / Destructors
     //------------------------------------------------------------------
-    IsisCameraModel(std::string cube_filename) :
-      m_interface(asp::isis::IsisInterface::open( cube_filename )) {}
+    IsisCameraModel(std::string cube_filename, int pool_size = 1) :
+      m_pool(new asp::isis::IsisInterfacePool(cube_filename, pool_size)) {}
     virtual std::string type() const { return "Isis"; }
 
     //------------------------------------------------------------------
@@ -54,60 +59,68 @@ namespace camera {
     //  image plane.  Returns a pixel location (col, row) where the
     //  point appears in the image.
     virtual Vector2 point_to_pixel(Vector3 const& point) const {
-      return m_interface->point_to_pixel( point ); }
+      return Handle(*m_pool)->point_to_pixel( point ); }
 
     // Returns a (normalized) pointing vector from the camera center
     //  through the position of the pixel 'pix' on the image plane.
     virtual Vector3 pixel_to_vector (Vector2 const& pix) const {
-      return m_interface->pixel_to_vector( pix ); }
+      return Handle(*m_pool)->pixel_to_vector( pix ); }
 
 
     // Returns the position of the focal point of the camera
     virtual Vector3 camera_center(Vector2 const& pix = Vector2() ) const {
-      return m_interface->camera_center( pix ); }
+      return Handle(*m_pool)->camera_center( pix ); }
 
     // Pose is a rotation which moves a vector in camera coordinates
     // into world coordinates.
     virtual Quat camera_pose(Vector2 const& pix = Vector2() ) const {
-      return m_interface->camera_pose( pix ); }
+      return Handle(*m_pool)->camera_pose( pix ); }
 
     // Returns the number of lines is the ISIS cube
-    int lines() const { return m_interface->lines(); }
+    int lines() const { return Handle(*m_pool)->lines(); }
 
     // Returns the number of samples in the ISIS cube
-    int samples() const{ return m_interface->samples(); }
+    int samples() const{ return Handle(*m_pool)->samples(); }
 
     // Returns the serial number of the ISIS cube
     std::string serial_number() const {
-      return m_interface->serial_number(); }
+      return Handle(*m_pool)->serial_number(); }
 
     // Returns the ephemeris time for a pixel
     double ephemeris_time( Vector2 const& pix = Vector2() ) const {
-      return m_interface->ephemeris_time( pix );
+      return Handle(*m_pool)->ephemeris_time( pix );
     }
 
     // Sun position in the target frame's inertial frame
     Vector3 sun_position( Vector2 const& pix = Vector2() ) const {
-      return m_interface->sun_position( pix );
+      return Handle(*m_pool)->sun_position( pix );
     }
 
     // The three main radii that make up the spheroid. Z is out the polar region
     Vector3 target_radii() const {
-      return m_interface->target_radii();
+      return Handle(*m_pool)->target_radii();
     }
 
     // The spheroid name
     std::string target_name() const {
-      return m_interface->target_name();
+      return Handle(*m_pool)->target_name();
     }
 
     // The datum
     vw::cartography::Datum get_datum_isis(bool use_sphere_for_non_earth) const {
-      return m_interface->get_datum_isis(use_sphere_for_non_earth);
+      return Handle(*m_pool)->get_datum_isis(use_sphere_for_non_earth);
     }
     
+    // The kind of ISIS camera, such as "LineScan" or "Frame"
+    std::string isis_type() const {
+      return Handle(*m_pool)->type();
+    }
+
+    // Number of ISIS camera instances that can be used in parallel
+    int pool_size() const { return m_pool->max_size(); }
+
   protected:
-    boost::shared_ptr<asp::isis::IsisInterface> m_interface;
+    boost::shared_ptr<asp::isis::IsisInterfacePool> m_pool;
 
     friend std::ostream& operator<<( std::ostream&, IsisCameraModel const& );
   };
@@ -117,7 +130,7 @@ namespace camera {
   inline std::ostream& operator<<( std::ostream& os,
                                    IsisCameraModel const& i ) {
     os << "IsisCameraModel" << i.lines() << "x" << i.samples() << "( "
-       << i.m_interface << " )";
+       << IsisCameraModel::Handle(*i.m_pool).get() << " )";
     return os;
   }
 
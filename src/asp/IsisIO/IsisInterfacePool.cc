@@ -0,0 +1,108 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/IsisIO/IsisInterfacePool.h>
+
+#include <vw/Core/Exception.h>
+
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace asp {
+namespace isis {
+
+// ISIS and SPICE initialization must happen one camera at a time, for all
+// cubes, so this is a global lock. It is used only when creating an instance.
+static std::mutex g_isis_create_mutex;
+
+IsisInterfacePool::IsisInterfacePool(std::string const& cube_file, int max_size):
+  m_cube_file(cube_file), m_num_created(0) {
+
+  if (max_size < 1)
+    vw::vw_throw(vw::ArgumentErr() << "The ISIS camera pool size must be positive.\n");
+
+  m_slots.resize(max_size);
+  for (int it = 0; it < max_size; it++)
+    m_slots[it].reset(new Slot);
+
+  // Create the first instance now, which will throw if the cube is not valid
+  std::lock_guard<std::mutex> lock(g_isis_create_mutex);
+  m_slots[0]->interface.reset(IsisInterface::open(m_cube_file));
+  m_slots[0]->created = true;
+  m_num_created = 1;
+}
+
+IsisInterfacePool::~IsisInterfacePool() {}
+
+int IsisInterfacePool::acquire() const {
+
+  int num = m_slots.size();
+
+  // Start the search at a slot that depends on the thread, so that each
+  // thread tends to reuse its own instance.
+  int start = std::hash<std::thread::id>()(std::this_thread::get_id()) % num;
+
+  while (1) {
+    // Prefer instances which already exist
+    for (int pass = 0; pass < 2; pass++) {
+      for (int k = 0; k < num; k++) {
+        int it = (start + k) % num;
+        Slot & slot = *m_slots[it];
+        if (pass == 0 && !slot.created.load(std::memory_order_relaxed))
+          continue;
+        bool expected = false;
+        if (slot.busy.load(std::memory_order_relaxed) ||
+            !slot.busy.compare_exchange_strong(expected, true, std::memory_order_acquire))
+          continue;
+
+        // This slot is now exclusively ours
+        if (!slot.created.load(std::memory_order_relaxed)) {
+          std::lock_guard<std::mutex> lock(g_isis_create_mutex);
+          try {
+            slot.interface.reset(IsisInterface::open(m_cube_file));
+          } catch (...) {
+            slot.busy.store(false, std::memory_order_release);
+            throw;
+          }
+          slot.created.store(true, std::memory_order_relaxed);
+          m_num_created++;
+        }
+        return it;
+      }
+    }
+
+    // All instances are in use
+    std::this_thread::yield();
+  }
+
+  return 0; // never reached
+}
+
+void IsisInterfacePool::release(int slot) const {
+  m_slots[slot]->busy.store(false, std::memory_order_release);
+}
+
+IsisInterfacePool::Handle::Handle(IsisInterfacePool const& pool):
+  m_pool(pool), m_slot(pool.acquire()),
+  m_interface(pool.m_slots[m_slot]->interface.get()) {}
+
+IsisInterfacePool::Handle::~Handle() {
+  m_pool.release(m_slot);
+}
+
+}}
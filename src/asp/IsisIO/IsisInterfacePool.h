@@ -0,0 +1,91 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file IsisInterfacePool.h
+
+// A pool of independent ISIS camera instances for the same cube. An
+// Isis::Camera keeps state between calls, so it cannot be shared between
+// threads. Instead, each thread checks out an instance of its own for the
+// duration of one camera call. Checking out and returning an instance is
+// lock-free. The instances are created as needed, up to the pool size,
+// and creating them is serialized, as ISIS and SPICE initialization are not
+// thread-safe. After that each instance reads only its own copy of the
+// SPICE data attached to the cube, so the instances can be used at the same
+// time.
+
+#ifndef __ASP_ISIS_INTERFACE_POOL_H__
+#define __ASP_ISIS_INTERFACE_POOL_H__
+
+#include <asp/IsisIO/IsisInterface.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace asp {
+namespace isis {
+
+  class IsisInterfacePool {
+  public:
+    // The first instance is created right away, to validate the cube.
+    IsisInterfacePool(std::string const& cube_file, int max_size);
+    ~IsisInterfacePool();
+
+    int max_size() const { return m_slots.size(); }
+
+    // Number of instances created so far
+    int size() const { return m_num_created; }
+
+    // An instance checked out by the current thread. It is returned to the
+    // pool when this goes out of scope. If all instances are in use, this
+    // waits for one to be returned.
+    class Handle {
+    public:
+      explicit Handle(IsisInterfacePool const& pool);
+      ~Handle();
+      IsisInterface* operator->() const { return m_interface; }
+      IsisInterface* get() const { return m_interface; }
+    private:
+      Handle(Handle const&) = delete;
+      Handle& operator=(Handle const&) = delete;
+      IsisInterfacePool const& m_pool;
+      int m_slot;
+      IsisInterface* m_interface;
+    };
+
+  private:
+    // The instance is only read or created by the thread which set the busy
+    // flag. The other flag is a hint for which slots to try first.
+    struct Slot {
+      std::atomic<bool> busy, created;
+      std::unique_ptr<IsisInterface> interface;
+      Slot(): busy(false), created(false) {}
+    };
+
+    // Find a free slot, creating its instance if needed. Return its index.
+    int acquire() const;
+    void release(int slot) const;
+
+    std::string m_cube_file;
+    mutable std::vector<std::unique_ptr<Slot>> m_slots;
+    mutable std::atomic<int> m_num_created;
+  };
+
+}}
+
+#endif //__ASP_ISIS_INTERFACE_POOL_H__
@@ -23,62 +23,151 @@
 
 #include <ceres/ceres.h>
 #include <ceres/loss_function.h>
+#include <ceres/rotation.h>
+
+#include <algorithm>
+#include <cmath>
 
 namespace asp {
 
 using namespace vw;
   
-// Discrepancy between a 3D point with the rotation to be solved
-// applied to it, and its projection straight down onto the DEM. Used
-// with the least squares method of finding the best transform between
-// clouds.
-struct PointToDemError {
-  PointToDemError(Vector3 const& point,
-		 ImageViewRef<vw::PixelMask<float> > const& dem,
-		 cartography::GeoReference const& geo):
-    m_point(point), m_dem(dem), m_geo(geo){}
-
-  template <typename F>
-  bool operator()(const F* const transform, const F* const scale, F* residuals) const {
-
-    // Default residuals are zero, if we can't project into the DEM
-    residuals[0] = F(0.0);
+// The height above the DEM of a point, and the DEM height there. Return
+// false if the point does not project onto a valid DEM pixel.
+bool heightAboveDem(Vector3 const& xyz,
+                    ImageViewRef<vw::PixelMask<float>> const& dem,
+                    cartography::GeoReference const& geo,
+                    Vector3 & llh, double & height_diff) {
+  llh = geo.datum().cartesian_to_geodetic(xyz); // lon-lat-height
+  double dem_height_here = 0.0;
+  if (!interp_dem_height(dem, geo, llh, dem_height_here))
+    return false;
+  height_diff = llh[2] - dem_height_here;
+  return true;
+}
 
-    // Extract the translation, and rotation
-    Vector3 translation;
-    Quat rotation;
-    extract_rotation_translation(transform, rotation, translation);
+// Discrepancy between a set of 3D points with the transform to be solved
+// applied to them, and their projections straight down onto the DEM. Used
+// with the least squares method of finding the best transform between
+// clouds. Each point is transformed as scale * R * p + t, and its residual
+// is its height above the DEM. The gradient of that in ECEF is the local
+// up direction minus the DEM slope, which is found by looking up the DEM a
+// short distance to the east and north of the point. This is chained with
+// the derivatives of the transform. Handling many points per residual
+// block keeps down the Ceres overhead. As a loss function given to Ceres
+// would apply to the whole block, the Cauchy loss is applied here to each
+// point, with the residual replaced by sqrt(rho(r^2)), so the cost is the
+// same as with one block per point.
+class PointsToDemError: public ceres::CostFunction {
+public:
+  PointsToDemError(std::vector<Vector3> const& points,
+                   ImageViewRef<vw::PixelMask<float>> const& dem,
+                   cartography::GeoReference const& geo,
+                   double loss_scale):
+    m_points(points), m_dem(dem), m_geo(geo), m_loss_b(loss_scale * loss_scale) {
+    set_num_residuals(points.size());
+    mutable_parameter_block_sizes()->push_back(6); // translation, axis-angle
+    mutable_parameter_block_sizes()->push_back(1); // scale
+  }
 
-    Vector3 trans_point = scale[0]*rotation.rotate(m_point) + translation;
-    
-    // Convert from GDC to GCC
-    Vector3 llh = m_geo.datum().cartesian_to_geodetic(trans_point); // lon-lat-height
-
-    // Interpolate the point at this location
-    double dem_height_here;
-    if (!interp_dem_height(m_dem, m_geo, llh, dem_height_here)) {
-      // If we did not intersect the DEM, record a flag error value here.
-      residuals[0] = F(0.0);
-      return true;
+  virtual bool Evaluate(double const* const* parameters, double* residuals,
+                        double** jacobians) const {
+
+    const double * transform = parameters[0];
+    double scale = parameters[1][0];
+    Vector3 translation(transform[0], transform[1], transform[2]);
+
+    // For the derivatives of the rotation with respect to the axis-angle
+    typedef ceres::Jet<double, 3> JetT;
+    JetT axis_angle[3] = {JetT(transform[3], 0), JetT(transform[4], 1),
+                          JetT(transform[5], 2)};
+
+    // How far to look for the DEM slope, in meters
+    const double slope_step = 0.1;
+
+    for (size_t it = 0; it < m_points.size(); it++) {
+
+      // Rotate the point, also finding the derivatives
+      JetT pt[3] = {JetT(m_points[it][0]), JetT(m_points[it][1]), JetT(m_points[it][2])};
+      JetT rot_pt[3];
+      ceres::AngleAxisRotatePoint(axis_angle, pt, rot_pt);
+      Vector3 rotated(rot_pt[0].a, rot_pt[1].a, rot_pt[2].a);
+      Vector3 trans_point = scale * rotated + translation;
+
+      // Default residuals are zero, if we can't project into the DEM
+      Vector3 llh;
+      double r = 0.0;
+      bool success = heightAboveDem(trans_point, m_dem, m_geo, llh, r);
+      if (!success)
+        r = 0.0;
+
+      // The Cauchy loss, as ceres::CauchyLoss, with rho(s) = b * log(1 + s/b)
+      double s = r * r;
+      double rho = m_loss_b * log1p(s / m_loss_b);
+      double rho_der = 1.0 / (1.0 + s / m_loss_b);
+      double res = (r < 0 ? -1.0 : 1.0) * std::sqrt(rho);
+      residuals[it] = res;
+
+      if (jacobians == NULL)
+        continue;
+
+      // Zero derivatives where the point is off the DEM
+      double * jac_transform = (jacobians[0] != NULL) ? jacobians[0] + 6 * it : NULL;
+      double * jac_scale     = (jacobians[1] != NULL) ? jacobians[1] + it : NULL;
+      if (jac_transform != NULL)
+        std::fill(jac_transform, jac_transform + 6, 0.0);
+      if (jac_scale != NULL)
+        *jac_scale = 0.0;
+      if (!success)
+        continue;
+
+      // The local east, north, and up directions
+      double lon = llh[0] * M_PI / 180.0, lat = llh[1] * M_PI / 180.0;
+      Vector3 east (-sin(lon), cos(lon), 0.0);
+      Vector3 north(-sin(lat) * cos(lon), -sin(lat) * sin(lon), cos(lat));
+      Vector3 up   (cos(lat) * cos(lon), cos(lat) * sin(lon), sin(lat));
+
+      // The gradient of the height above the DEM. Where the DEM cannot be
+      // looked up nearby, take it as flat.
+      Vector3 grad = up;
+      Vector3 dirs[2] = {east, north};
+      for (int d = 0; d < 2; d++) {
+        Vector3 llh2;
+        double r2 = 0.0;
+        if (heightAboveDem(trans_point + slope_step * dirs[d], m_dem, m_geo, llh2, r2))
+          grad += ((r2 - r) / slope_step) * dirs[d];
+      }
+
+      // Account for the loss. Then the derivative of 0.5 * res^2 is the
+      // same as of 0.5 * rho(r^2).
+      double factor = 1.0;
+      if (std::abs(res) > 1e-12)
+        factor = rho_der * r / res;
+      grad *= factor;
+
+      // Chain with the derivatives of the transform
+      if (jac_transform != NULL) {
+        for (int c = 0; c < 3; c++)
+          jac_transform[c] = grad[c];
+        for (int c = 0; c < 3; c++) {
+          for (int row = 0; row < 3; row++)
+            jac_transform[3 + c] += grad[row] * scale * rot_pt[row].v[c];
+        }
+      }
+      if (jac_scale != NULL)
+        *jac_scale = dot_prod(grad, rotated);
     }
-    
-    residuals[0] = llh[2] - dem_height_here;
+
     return true;
   }
-  
-  // Factory to hide the construction of the CostFunction object from
-  // the client code.
-  static ceres::CostFunction* Create(Vector3 const& point,
-				     vw::ImageViewRef<vw::PixelMask<float> > const& dem,
-				     vw::cartography::GeoReference const& geo){
-    return (new ceres::NumericDiffCostFunction<PointToDemError,
-	    ceres::CENTRAL, 1, 6, 1>
-	    (new PointToDemError(point, dem, geo)));
-  }
 
-  Vector3                                  m_point;
-  ImageViewRef< PixelMask<float> > const & m_dem;    // alias
-  cartography::GeoReference        const & m_geo;    // alias
+private:
+  std::vector<Vector3>                      m_points;
+  ImageViewRef<vw::PixelMask<float>> const& m_dem; // alias
+  // A copy, as Ceres may evaluate blocks in parallel, and the projection
+  // is not thread-safe
+  cartography::GeoReference                 m_geo;
+  double                                    m_loss_b;
 };
 
 /// Compute alignment using least squares
@@ -97,21 +186,23 @@ least_squares_alignment(DP const& source_point_cloud, // Should not be modified
 
   double scale = 1.0;
   
-  // Add a residual block for every source point
+  // Add a residual block for each chunk of source points
   const std::int64_t num_pts = source_point_cloud.features.cols();
-
-  // Loop through every point in the point cloud
-  for (std::int64_t i = 0; i < num_pts; i++){
-    
-    // Extract and un-shift the point to get the real GCC coordinate
-    Vector3 gcc_coord = get_cloud_gcc_coord(source_point_cloud, point_cloud_shift, i);
-
-    ceres::CostFunction* cost_function =
-      PointToDemError::Create(gcc_coord, dem_ref, dem_georef);
-    ceres::LossFunction* loss_function = new ceres::CauchyLoss(0.5); // NULL;
+  const std::int64_t chunk_size = 1000;
+  const double loss_scale = 0.5;
+  for (std::int64_t beg = 0; beg < num_pts; beg += chunk_size) {
+
+    // Extract and un-shift the points to get the real GCC coordinates
+    std::int64_t end = std::min(num_pts, beg + chunk_size);
+    std::vector<Vector3> gcc_coords;
+    for (std::int64_t i = beg; i < end; i++)
+      gcc_coords.push_back(get_cloud_gcc_coord(source_point_cloud, point_cloud_shift, i));
+
+    ceres::CostFunction* cost_function
+      = new PointsToDemError(gcc_coords, dem_ref, dem_georef, loss_scale);
+    ceres::LossFunction* loss_function = NULL; // applied per point in the cost function
     problem.AddResidualBlock(cost_function, loss_function, &transform[0], &scale);
-    
-  } // End loop through all points
+  }
 
   if (alignment_method == "least-squares") {
     // Only solve for rotation and translation
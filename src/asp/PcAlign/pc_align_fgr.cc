@@ -27,19 +27,28 @@
 #include <FastGlobalRegistration/app.h>
 #pragma GCC diagnostic pop
 
+#include <nabo/nabo.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
 namespace asp {
 
 using namespace vw;
 
 // Parse a string like:
 // div_factor: 1.4 use_absolute_scale: 0 max_corr_dist: 0.025 iteration_number: 100 tuple_scale: 0.95 tuple_max_cnt: 10000
+// The optional voxel_size and fpfh_radius are in meters, and are 0 if not set.
 void parse_fgr_options(std::string const & options,
                        double            & div_factor,
                        bool              & use_absolute_scale,
                        double            & max_corr_dist,
                        int               & iteration_number,
                        float             & tuple_scale,
-                       int               & tuple_max_cnt){
+                       int               & tuple_max_cnt,
+                       double            & voxel_size,
+                       double            & fpfh_radius){
 
   // Initialize the outputs
   div_factor         = -1;
@@ -48,6 +57,8 @@ void parse_fgr_options(std::string const & options,
   iteration_number   = -1;
   tuple_scale        = -1;
   tuple_max_cnt      = -1;
+  voxel_size         = 0;
+  fpfh_radius        = 0;
 
   std::istringstream is(options);
   std::string name, val;
@@ -64,15 +75,192 @@ void parse_fgr_options(std::string const & options,
       tuple_scale = atof(val.c_str());
     if (name.find("tuple_max_cnt") != std::string::npos)
       tuple_max_cnt = atof(val.c_str());
+    if (name.find("voxel_size") != std::string::npos)
+      voxel_size = atof(val.c_str());
+    if (name.find("fpfh_radius") != std::string::npos)
+      fpfh_radius = atof(val.c_str());
   }
   
   // Sanity check
   if (div_factor <= 0 || max_corr_dist < 0 || iteration_number < 0 || tuple_scale <= 0 ||
-      tuple_max_cnt <= 0) {
+      tuple_max_cnt <= 0 || voxel_size < 0 || fpfh_radius < 0) {
     vw_throw( ArgumentErr() << "Could not parse correctly --fgr-options.");
   }
 }
   
+// The number of bins for each of the three angles in FPFH
+const int FPFH_BINS = 11;
+
+// The angles between two oriented points, as in Rusu et al., "Fast Point
+// Feature Histograms (FPFH) for 3D Registration", 2009. Return false if
+// the points coincide.
+bool fpfh_pair_features(Eigen::Vector3d const& p1, Eigen::Vector3d const& n1,
+                        Eigen::Vector3d const& p2, Eigen::Vector3d const& n2,
+                        double & theta, double & alpha, double & phi) {
+
+  Eigen::Vector3d dp = p2 - p1;
+  double dist = dp.norm();
+  if (dist == 0)
+    return false;
+
+  // Use as source the point whose normal makes the smaller angle with the
+  // line between the points
+  Eigen::Vector3d u = n1, n_target = n2;
+  double angle1 = n1.dot(dp) / dist, angle2 = n2.dot(dp) / dist;
+  phi = angle1;
+  if (std::acos(std::abs(angle1)) > std::acos(std::abs(angle2))) {
+    u = n2;
+    n_target = n1;
+    dp = -dp;
+    phi = -angle2;
+  }
+
+  Eigen::Vector3d v = dp.cross(u);
+  double v_norm = v.norm();
+  if (v_norm == 0) {
+    theta = 0;
+    alpha = 0;
+    return true;
+  }
+  v /= v_norm;
+  Eigen::Vector3d w = u.cross(v);
+  alpha = v.dot(n_target);
+  theta = std::atan2(w.dot(n_target), u.dot(n_target));
+  return true;
+}
+
+// Add to a histogram bin, with values in [min_val, max_val]
+void add_to_fpfh_bin(double val, double min_val, double max_val, double incr,
+                     double * hist) {
+  int bin = std::floor(FPFH_BINS * (val - min_val) / (max_val - min_val));
+  bin = std::max(0, std::min(bin, FPFH_BINS - 1));
+  hist[bin] += incr;
+}
+
+// Compute the FPFH feature of each point, with the neighbors within the
+// given radius. The normals are from the neighbors within half of that,
+// and point away from the planet center. The KD-tree searches and the
+// features are computed in parallel.
+void compute_fpfh(DP const& data, vw::Vector3 const& shift, double radius,
+                  std::vector<Eigen::VectorXf> & features) {
+
+  std::int64_t num = data.features.cols();
+  const int max_neighbors = 100; // for FPFH, fewer for the normals
+  const int max_normal_neighbors = 30;
+
+  Eigen::MatrixXf cloud(3, num);
+  for (std::int64_t c = 0; c < num; c++) {
+    for (int r = 0; r < 3; r++)
+      cloud(r, c) = data.features(r, c);
+  }
+  std::shared_ptr<Nabo::NNSearchF>
+    tree(Nabo::NNSearchF::createKDTreeLinearHeap(cloud));
+
+  // Find the neighbors of each point
+  Eigen::MatrixXi neighbors(max_neighbors, num);
+  Eigen::MatrixXf dists2(max_neighbors, num);
+  const std::int64_t block_size = 10000;
+  std::int64_t num_blocks = (num + block_size - 1) / block_size;
+  #pragma omp parallel for schedule(dynamic)
+  for (std::int64_t block = 0; block < num_blocks; block++) {
+    std::int64_t beg = block * block_size;
+    std::int64_t len = std::min(num - beg, block_size);
+    Eigen::MatrixXi ids(max_neighbors, len);
+    Eigen::MatrixXf d2(max_neighbors, len);
+    tree->knn(cloud.block(0, beg, 3, len), ids, d2, max_neighbors, 0,
+              Nabo::NNSearchF::ALLOW_SELF_MATCH, radius);
+    neighbors.block(0, beg, max_neighbors, len) = ids;
+    dists2.block(0, beg, max_neighbors, len) = d2;
+  }
+
+  // The normals, from the smallest eigenvector of the covariance of the
+  // nearby neighbors. Neighbors not found have infinite distance.
+  std::vector<Eigen::Vector3d> normals(num, Eigen::Vector3d::Zero());
+  double normal_radius2 = radius * radius / 4.0;
+  #pragma omp parallel for schedule(dynamic, 1000)
+  for (std::int64_t c = 0; c < num; c++) {
+    Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+    std::vector<Eigen::Vector3d> pts;
+    for (int k = 0; k < max_normal_neighbors; k++) {
+      if (!(dists2(k, c) <= normal_radius2))
+        break;
+      pts.push_back(data.features.block(0, neighbors(k, c), 3, 1));
+      mean += pts.back();
+    }
+    if (pts.size() < 3)
+      continue;
+    mean /= pts.size();
+    Eigen::Matrix3d cov = Eigen::Matrix3d::Zero();
+    for (size_t k = 0; k < pts.size(); k++)
+      cov += (pts[k] - mean) * (pts[k] - mean).transpose();
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(cov);
+    Eigen::Vector3d n = solver.eigenvectors().col(0);
+    Eigen::Vector3d up(data.features(0, c) + shift[0], data.features(1, c) + shift[1],
+                       data.features(2, c) + shift[2]);
+    if (n.dot(up) < 0)
+      n = -n;
+    normals[c] = n;
+  }
+
+  // The simplified point feature histograms
+  int dim = 3 * FPFH_BINS;
+  Eigen::MatrixXd spfh = Eigen::MatrixXd::Zero(dim, num);
+  #pragma omp parallel for schedule(dynamic, 1000)
+  for (std::int64_t c = 0; c < num; c++) {
+    if (normals[c].norm() == 0)
+      continue;
+    Eigen::Vector3d p1 = data.features.block(0, c, 3, 1);
+    int count = 0;
+    for (int k = 0; k < max_neighbors; k++)
+      count += (std::isfinite(dists2(k, c)) && normals[neighbors(k, c)].norm() > 0);
+    if (count <= 1)
+      continue;
+    double incr = 100.0 / (count - 1);
+    for (int k = 0; k < max_neighbors; k++) {
+      if (!std::isfinite(dists2(k, c)))
+        break;
+      std::int64_t n = neighbors(k, c);
+      if (n == c || normals[n].norm() == 0)
+        continue;
+      double theta = 0, alpha = 0, phi = 0;
+      Eigen::Vector3d p2 = data.features.block(0, n, 3, 1);
+      if (!fpfh_pair_features(p1, normals[c], p2, normals[n], theta, alpha, phi))
+        continue;
+      add_to_fpfh_bin(theta, -M_PI, M_PI, incr, &spfh(0, c));
+      add_to_fpfh_bin(alpha, -1.0, 1.0, incr, &spfh(FPFH_BINS, c));
+      add_to_fpfh_bin(phi,   -1.0, 1.0, incr, &spfh(2 * FPFH_BINS, c));
+    }
+  }
+
+  // Each feature is the histogram of the point plus the histograms of the
+  // neighbors, weighted by inverse distance and normalized
+  features.resize(num);
+  #pragma omp parallel for schedule(dynamic, 1000)
+  for (std::int64_t c = 0; c < num; c++) {
+    Eigen::VectorXd f = Eigen::VectorXd::Zero(dim);
+    double sums[3] = {0, 0, 0};
+    for (int k = 0; k < max_neighbors; k++) {
+      if (!std::isfinite(dists2(k, c)))
+        break;
+      std::int64_t n = neighbors(k, c);
+      double dist = std::sqrt(dists2(k, c));
+      if (n == c || dist == 0)
+        continue;
+      for (int j = 0; j < dim; j++) {
+        double val = spfh(j, n) / dist;
+        sums[j / FPFH_BINS] += val;
+        f[j] += val;
+      }
+    }
+    for (int j = 0; j < dim; j++) {
+      if (sums[j / FPFH_BINS] != 0)
+        f[j] *= 100.0 / sums[j / FPFH_BINS];
+      f[j] += spfh(j, c);
+    }
+    features[c] = f.cast<float>();
+  }
+}
+
 // Convert a point clould to the format expected by FGR
 void export_to_fgr(DP const & data, fgr::Points& pts, fgr::Feature & feat){
 
@@ -95,6 +283,7 @@ void export_to_fgr(DP const & data, fgr::Points& pts, fgr::Feature & feat){
 /// Compute alignment using FGR
 PointMatcher<RealT>::Matrix fgr_alignment(DP const & source_point_cloud, 
                                           DP const & ref_point_cloud, 
+                                          vw::Vector3 const& shift,
                                           std::string const& fgr_options) {
 
   // Parse the options and initialize the FGR object
@@ -104,8 +293,10 @@ PointMatcher<RealT>::Matrix fgr_alignment(DP const & source_point_cloud,
   int     iteration_number;
   float   tuple_scale;
   int     tuple_max_cnt;
+  double  voxel_size, fpfh_radius;
   parse_fgr_options(fgr_options, div_factor, use_absolute_scale, max_corr_dist,
-                    iteration_number, tuple_scale, tuple_max_cnt);
+                    iteration_number, tuple_scale, tuple_max_cnt, voxel_size,
+                    fpfh_radius);
   fgr::CApp app(div_factor, use_absolute_scale, max_corr_dist, iteration_number,  
                 tuple_scale, tuple_max_cnt);
 
@@ -113,13 +304,25 @@ PointMatcher<RealT>::Matrix fgr_alignment(DP const & source_point_cloud,
   fgr::Points pts;
   fgr::Feature feat;
 
-  // Pass the reference cloud to FGR
-  export_to_fgr(ref_point_cloud, pts, feat);
-  app.LoadFeature(pts, feat);
+  // Subsample the clouds, if desired
+  DP ref_sub, source_sub;
+  DP const* clouds[2] = {&ref_point_cloud, &source_point_cloud};
+  if (voxel_size > 0) {
+    voxel_downsample(ref_point_cloud, voxel_size, ref_sub);
+    voxel_downsample(source_point_cloud, voxel_size, source_sub);
+    clouds[0] = &ref_sub;
+    clouds[1] = &source_sub;
+    vw_out() << "Using for FGR " << ref_sub.features.cols() << " reference and "
+             << source_sub.features.cols() << " source points.\n";
+  }
 
-  // Pass the source cloud to FGR
-  export_to_fgr(source_point_cloud, pts, feat);
-  app.LoadFeature(pts, feat);
+  // Pass the reference cloud, then the source cloud, to FGR
+  for (int c = 0; c < 2; c++) {
+    export_to_fgr(*clouds[c], pts, feat);
+    if (fpfh_radius > 0)
+      compute_fpfh(*clouds[c], shift, fpfh_radius, feat);
+    app.LoadFeature(pts, feat);
+  }
 
   // Perform alignment
   app.NormalizePoints();
@@ -28,6 +28,7 @@ namespace asp {
 /// Compute alignment using FGR
 PointMatcher<RealT>::Matrix fgr_alignment(DP const & source_point_cloud, 
                                           DP const & ref_point_cloud, 
+                                          vw::Vector3 const& shift,
                                           std::string const& fgr_options);
 
 }
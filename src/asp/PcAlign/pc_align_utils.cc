@@ -27,39 +27,19 @@
 #include <pointmatcher/PointMatcher.h>
 #include <asp/Core/PointCloudAlignment.h>
 #include <asp/Core/PdalUtils.h>
+#include <asp/Core/PointIndex.h>
+#include <asp/Core/ImageUtils.h>
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <limits>
+#include <sstream>
 
 namespace asp {
 
 using namespace vw;
 
-void load_las_multi_attempt(std::string const& file_name,
-                            std::int64_t num_points_to_load,
-                            vw::BBox2 const& lonlat_box,
-                            bool calc_shift,
-                            vw::Vector3 & shift,
-                            vw::cartography::GeoReference const& geo,
-                            bool verbose, DoubleMatrix & data){
-
-  std::int64_t num_total_points 
-    = load_las(file_name, num_points_to_load, lonlat_box, geo, verbose, calc_shift,
-               shift, data); // outputs
-
-  int num_loaded_points = data.cols();
-  if (!lonlat_box.empty()                    &&
-      num_loaded_points < num_points_to_load &&
-      num_loaded_points < num_total_points){
-
-    // We loaded too few points. Try harder. Need some care here as to not run
-    // out of memory.
-    num_points_to_load = std::max(4*num_points_to_load, std::int64_t(10000000));
-    if (verbose)
-      vw::vw_out() << "Too few points were loaded. Trying again." << std::endl;
-    load_las(file_name, num_points_to_load, lonlat_box, geo, verbose, calc_shift,
-             shift, data); // outputs
-  }
-
-}
-
 // Load xyz points from disk into a matrix with 4 columns. Last column is just ones.
 void load_cloud(std::string const& file_name,
                std::int64_t num_points_to_load,
@@ -88,13 +68,16 @@ void load_cloud(std::string const& file_name,
     load_pc(file_name, num_points_to_load, lonlat_box, calc_shift, shift,
 	    geo, verbose, data);
   else if (file_type == "LAS")
-    load_las_multi_attempt(file_name, num_points_to_load, lonlat_box, calc_shift, shift,
-                           geo, verbose, data);
+    load_las(file_name, num_points_to_load, lonlat_box, geo, verbose, calc_shift,
+             shift, data); // outputs
   else if (file_type == "CSV") {
     bool verbose = true;
     load_csv(file_name, num_points_to_load, lonlat_box, 
              calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
              median_longitude, verbose, data);
+  } else if (file_type == "INDEX") {
+    load_point_index(file_name, num_points_to_load, lonlat_box,
+                     calc_shift, shift, median_longitude, verbose, data);
   } else {
     vw::vw_throw(vw::ArgumentErr() << "Unknown file type: " << file_name << "\n");
   }
@@ -347,6 +330,180 @@ double calc_max_displacement(DP const& source, DP const& trans_source){
   return max_obtained_disp;
 }
 
+/// Apply a given transform to a CSV file and save it, in a format consistent
+/// with the input. The file is read in chunks of lines, which are parsed,
+/// transformed, and formatted in parallel, then written in order. So each
+/// line is read and written once, and the memory use is bounded.
+void save_trans_csv(std::string const& input_file,
+                    std::string const& output_file,
+                    vw::cartography::GeoReference const& geo,
+                    CsvConv const& csv_conv,
+                    PointMatcher<RealT>::Matrix const& T) {
+
+  std::ifstream ifs(input_file.c_str());
+  if (!ifs)
+    vw::vw_throw(vw::IOErr() << "Unable to open file: " << input_file << "\n");
+
+  // Guess the format from the first valid line, then parse that line
+  // separately, as it may be a header.
+  std::string line;
+  while (getline(ifs, line, '\n')) {
+    if (is_valid_csv_line(line))
+      break;
+  }
+  bool verbose = false;
+  bool is_lola_rdr_format = guess_lola_rdr_format(line, input_file, geo, csv_conv,
+                                                  verbose);
+  ifs.clear(); ifs.seekg(0, std::ios_base::beg); // go back to start of file
+
+  std::ofstream outfile(output_file.c_str());
+  outfile.precision(16);
+
+  // Write the header line
+  if (csv_conv.is_configured()){
+    outfile << "# " << csv_conv.write_header_string(",");
+    outfile << std::endl;
+  }else{
+    if (is_lola_rdr_format)
+      outfile << "# longitude,latitude,radius (km)" << std::endl;
+    else
+      outfile << "# latitude,longitude,height above datum (meters)" << std::endl;
+  }
+
+  // Save the datum, may be useful to know what it was
+  if (geo.datum().name() != UNSPECIFIED_DATUM) {
+    outfile << "# " << geo.datum() << std::endl;
+    outfile << "# Projection: " << geo.get_wkt() << std::endl;
+  }
+
+  double file_size = std::max(1.0, double(boost::filesystem::file_size(input_file)));
+  vw::TerminalProgressCallback tpc("asp", "\t--> ");
+
+  const std::int64_t chunk_size = 1000000, block_size = 10000;
+  bool is_first_line = true, have_median = false;
+  double median_longitude = 0.0;
+  std::vector<std::string> lines;
+  std::vector<vw::Vector3> points;
+  std::vector<vw::Vector2> lonlats;
+  std::vector<char> is_valid;
+  std::vector<std::string> out_blocks;
+  while (1) {
+
+    // Read a chunk of lines. Only the first valid one may be a header, so
+    // parse it here.
+    lines.clear();
+    while (std::int64_t(lines.size()) < chunk_size && getline(ifs, line, '\n')) {
+      if (!is_valid_csv_line(line))
+        continue;
+      if (is_first_line) {
+        vw::Vector3 xyz;
+        vw::Vector2 lonlat;
+        if (!parse_csv_point(line, csv_conv, geo, is_lola_rdr_format, is_first_line,
+                             xyz, lonlat))
+          continue;
+        is_first_line = false;
+      }
+      lines.push_back(line);
+    }
+    std::int64_t num_lines = lines.size();
+    if (num_lines == 0)
+      break;
+
+    // Parse the lines. Each thread has its own copy of the georeference, as
+    // the projection it uses is not thread-safe.
+    points.resize(num_lines);
+    lonlats.resize(num_lines);
+    is_valid.resize(num_lines);
+    std::int64_t num_blocks = (num_lines + block_size - 1) / block_size;
+    std::vector<std::string> errors(num_blocks);
+    #pragma omp parallel
+    {
+      vw::cartography::GeoReference local_geo = geo;
+      #pragma omp for schedule(dynamic)
+      for (std::int64_t block = 0; block < num_blocks; block++) {
+        try {
+          std::int64_t end = std::min(num_lines, (block + 1) * block_size);
+          for (std::int64_t it = block * block_size; it < end; it++) {
+            bool not_first = false;
+            is_valid[it] = parse_csv_point(lines[it], csv_conv, local_geo,
+                                           is_lola_rdr_format, not_first,
+                                           points[it], lonlats[it]);
+          }
+        } catch (std::exception const& e) {
+          errors[block] = e.what();
+        }
+      }
+    }
+    for (std::int64_t block = 0; block < num_blocks; block++) {
+      if (errors[block] != "")
+        vw::vw_throw(vw::IOErr() << errors[block]);
+    }
+
+    // As when loading the cloud, adjust the longitudes to be close to the
+    // median of the input longitudes. Find it from the first chunk.
+    if (!have_median) {
+      std::vector<double> longitudes;
+      for (std::int64_t it = 0; it < num_lines; it++) {
+        if (is_valid[it])
+          longitudes.push_back(lonlats[it][0]);
+      }
+      std::sort(longitudes.begin(), longitudes.end());
+      if (!longitudes.empty())
+        median_longitude = longitudes[longitudes.size()/2];
+      have_median = true;
+    }
+
+    // Transform and format the points
+    out_blocks.resize(num_blocks);
+    #pragma omp parallel
+    {
+      vw::cartography::GeoReference local_geo = geo;
+      #pragma omp for schedule(dynamic)
+      for (std::int64_t block = 0; block < num_blocks; block++) {
+        try {
+          std::ostringstream os;
+          os.precision(16);
+          std::int64_t end = std::min(num_lines, (block + 1) * block_size);
+          for (std::int64_t it = block * block_size; it < end; it++) {
+            if (!is_valid[it])
+              continue;
+
+            // Apply the transform
+            vw::Vector3 P = apply_transform_to_vec(T, points[it]);
+
+            if (csv_conv.is_configured()){
+              vw::Vector3 csv = csv_conv.cartesian_to_csv(P, local_geo, median_longitude);
+              os << csv[0] << ',' << csv[1] << ',' << csv[2] << "\n";
+            }else{
+              vw::Vector3 llh = local_geo.datum().cartesian_to_geodetic(P); // lon-lat-height
+              llh[0] += 360.0*round((median_longitude - llh[0])/360.0); // 360 deg adjustment
+
+              if (is_lola_rdr_format)
+                os << llh[0] << ',' << llh[1] << ',' << norm_2(P)/1000.0 << "\n";
+              else
+                os << llh[1] << ',' << llh[0] << ',' << llh[2] << "\n";
+            }
+          }
+          out_blocks[block] = os.str();
+        } catch (std::exception const& e) {
+          errors[block] = e.what();
+        }
+      }
+    }
+    for (std::int64_t block = 0; block < num_blocks; block++) {
+      if (errors[block] != "")
+        vw::vw_throw(vw::ArgumentErr() << errors[block]);
+    }
+    for (std::int64_t block = 0; block < num_blocks; block++)
+      outfile << out_blocks[block];
+
+    if (ifs.good())
+      tpc.report_progress(std::min(1.0, double(ifs.tellg()) / file_size));
+  }
+  tpc.report_finished();
+  outfile.close();
+}
+
 /// Apply a given transform to the point cloud in input file,
 /// and save it.
 /// - Note: We transform the entire point cloud, not just the resampled
@@ -416,78 +573,7 @@ void save_trans_point_cloud(vw::GdalWriteOptions const& opt,
     
   }else if (file_type == "CSV") {
 
-    // Write a CSV file in format consistent with the input CSV file.
-    // TODO(oalexan1): This must be a function.
-
-    vw::BBox2   empty_box;
-    bool        verbose = false;
-    bool        calc_shift = true;
-    vw::Vector3 shift;
-    bool        is_lola_rdr_format;
-    double      median_longitude;
-    DP          point_cloud;
-    load_cloud(input_file, std::numeric_limits<int>::max(),
-	       empty_box, calc_shift, shift,
-	       geo, csv_conv, is_lola_rdr_format,
-	       median_longitude, verbose, point_cloud);
-
-    std::ofstream outfile(output_file.c_str());
-    outfile.precision(16);
-
-    // Write the header line
-    if (csv_conv.is_configured()){
-      outfile << "# " << csv_conv.write_header_string(",");
-      outfile << std::endl;
-    }else{
-      if (is_lola_rdr_format)
-        outfile << "# longitude,latitude,radius (km)" << std::endl;
-      else
-        outfile << "# latitude,longitude,height above datum (meters)" << std::endl;
-    }
-
-    // Save the datum, may be useful to know what it was
-    if (geo.datum().name() != UNSPECIFIED_DATUM) {
-      outfile << "# " << geo.datum() << std::endl;
-      outfile << "# Projection: " << geo.get_wkt() << std::endl;
-    }
-
-    int numPts = point_cloud.features.cols();
-    vw::TerminalProgressCallback tpc("asp", "\t--> ");
-    int hundred = 100;
-    int spacing = std::max(numPts/hundred, 1);
-    double inc_amount = 1.0 / hundred;
-    for (int col = 0; col < numPts; col++){
-
-      Eigen::VectorXd V(DIM + 1);
-      for (int row = 0; row < DIM; row++)
-        V[row] = point_cloud.features(row, col) + shift[row];
-      V[DIM] = 1;
-
-      // Apply the transform
-      V = T*V;
-
-      vw::Vector3 P;
-      for (int row = 0; row < DIM; row++) P[row] = V[row];
-
-      if (csv_conv.is_configured()){
-
-        vw::Vector3 csv = csv_conv.cartesian_to_csv(P, geo, median_longitude);
-        outfile << csv[0] << ',' << csv[1] << ',' << csv[2] << std::endl;
-
-      }else{
-        vw::Vector3 llh = geo.datum().cartesian_to_geodetic(P); // lon-lat-height
-        llh[0] += 360.0*round((median_longitude - llh[0])/360.0); // 360 deg adjustment
-
-        if (is_lola_rdr_format)
-          outfile << llh[0] << ',' << llh[1] << ',' << norm_2(P)/1000.0 << std::endl;
-        else
-          outfile << llh[1] << ',' << llh[0] << ',' << llh[2] << std::endl;
-      }
-
-      if (col%spacing == 0) tpc.report_incremental_progress( inc_amount );
-    }
-    tpc.report_finished();
-    outfile.close();
+    save_trans_csv(input_file, output_file, geo, csv_conv, T);
 
   }else{
     vw_throw( vw::ArgumentErr() << "Unknown file type: " << input_file << "\n" );
@@ -515,6 +601,28 @@ InterpolationReadyDem load_interpolation_ready_dem(std::string const& dem_path,
   return InterpolationReadyDem(interpolate(masked_dem));
 }
 
+/// Same as above, but read into memory the DEM window around the given points.
+InterpolationReadyDem load_interpolation_ready_dem(std::string const& dem_path,
+                                                   std::vector<vw::Vector3> const& xyz_vec,
+                                                   vw::cartography::GeoReference & georef) {
+
+  // The window is stored as float, so 2^28 pixels need 1 GB of memory
+  const std::int64_t max_pixels = std::int64_t(1) << 28;
+  vw::ImageView<float> dem_win;
+  if (!asp::read_dem_window(dem_path, xyz_vec, max_pixels, dem_win, georef))
+    return load_interpolation_ready_dem(dem_path, georef);
+
+  double nodata = std::numeric_limits<double>::quiet_NaN();
+  {
+    boost::shared_ptr<vw::DiskImageResource> dem_rsrc( new vw::DiskImageResourceGDAL(dem_path) );
+    if (dem_rsrc->has_nodata_read())
+      nodata = dem_rsrc->nodata_read();
+  }
+
+  vw::ImageViewRef< vw::PixelMask<float> > masked_dem = create_mask(dem_win, nodata);
+  return InterpolationReadyDem(interpolate(masked_dem));
+}
+
 
 /// Try to read the georef/datum info, need it to read CSV files.
 void read_georef(std::vector<std::string> const& clouds,
@@ -586,6 +694,17 @@ void read_georef(std::vector<std::string> const& clouds,
       }
     }
   }
+
+  // Then, try to set it from the point index, which always has a datum
+  for (size_t it = 0; it < clouds.size(); it++) {
+    if (is_good)
+      break;
+    if (asp::get_cloud_type(clouds[it]) == "INDEX") {
+      geo.set_datum(asp::PointIndex(clouds[it]).datum());
+      vw::vw_out() << "Detected datum from " << clouds[it] << ":\n" << geo.datum() << std::endl;
+      is_good = true;
+    }
+  }
   
   // We should have read in the datum from an input file, but check to see if
   //  we should override it with input parameters.
@@ -653,6 +772,47 @@ void extract_rotation_translation(const double * transform, vw::Quat & rotation,
   rotation = vw::math::axis_angle_to_quaternion(axis_angle);
 }
 
+void voxel_downsample(DP const& in, double voxel_size, DP & out) {
+
+  if (voxel_size <= 0)
+    vw::vw_throw(vw::ArgumentErr() << "The voxel size must be positive.\n");
+
+  // Find the voxel of each point, and sort the points by voxel
+  std::int64_t num = in.features.cols();
+  std::vector<std::array<std::int64_t, 3>> voxels(num);
+  for (std::int64_t col = 0; col < num; col++) {
+    for (int row = 0; row < DIM; row++)
+      voxels[col][row] = std::int64_t(std::floor(in.features(row, col) / voxel_size));
+  }
+  std::vector<std::int64_t> order(num);
+  for (std::int64_t col = 0; col < num; col++)
+    order[col] = col;
+  std::sort(order.begin(), order.end(), [&voxels](std::int64_t a, std::int64_t b) {
+      return voxels[a] < voxels[b] || (voxels[a] == voxels[b] && a < b);
+    });
+
+  // Average the points in each voxel
+  out.featureLabels = form_labels<RealT>(DIM);
+  out.features.resize(DIM + 1, num);
+  std::int64_t points_count = 0;
+  std::int64_t beg = 0;
+  while (beg < num) {
+    std::int64_t end = beg;
+    vw::Vector3 sum;
+    while (end < num && voxels[order[end]] == voxels[order[beg]]) {
+      for (int row = 0; row < DIM; row++)
+        sum[row] += in.features(row, order[end]);
+      end++;
+    }
+    for (int row = 0; row < DIM; row++)
+      out.features(row, points_count) = sum[row] / (end - beg);
+    out.features(DIM, points_count) = 1; // Extend to be a homogenous coordinate
+    points_count++;
+    beg = end;
+  }
+  out.features.conservativeResize(Eigen::NoChange, points_count);
+}
+
 /// Extracts the full GCC coordinate of a single point from a LibPointMatcher point cloud.
 /// - The shift converts from the normalized coordinate to the actual GCC coordinate.
 /// - No bounds checking is performed on the point index.
@@ -691,6 +851,35 @@ bool interp_dem_height(vw::ImageViewRef<vw::PixelMask<float> > const& dem,
   return true;
 }
 
+void interp_dem_heights(vw::ImageViewRef<vw::PixelMask<float>> const& dem,
+                        vw::cartography::GeoReference          const& georef,
+                        std::vector<vw::Vector3>               const& lonlat,
+                        std::vector<double>                         & dem_heights) {
+
+  // Find all the pixels first, then look them up
+  size_t num = lonlat.size();
+  std::vector<vw::Vector2> pix(num);
+  for (size_t it = 0; it < num; it++) {
+    try {
+      pix[it] = georef.lonlat_to_pixel(subvector(lonlat[it], 0, 2));
+    } catch(...) {
+      pix[it] = vw::Vector2(-1, -1); // will be rejected below
+    }
+  }
+
+  double max_col = dem.cols() - 1, max_row = dem.rows() - 1;
+  dem_heights.resize(num);
+  for (size_t it = 0; it < num; it++) {
+    dem_heights[it] = std::numeric_limits<double>::quiet_NaN();
+    double c = pix[it][0], r = pix[it][1];
+    if (!(c >= 0 && c < max_col && r >= 0 && r < max_row))
+      continue;
+    vw::PixelMask<float> v = dem(c, r);
+    if (is_valid(v))
+      dem_heights[it] = v.child();
+  }
+}
+
 // Consider a 4x4 matrix T which implements a rotation + translation
 // y = A*x + b. Consider a point s in space close to the points
 // x. We want to make that the new origin, so the points x get
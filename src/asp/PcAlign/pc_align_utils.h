@@ -138,6 +138,11 @@ void calc_translation_vec(PointMatcher<RealT>::Matrix const& initT,
 /// Calculate max distance between any two points of two point clouds.
 double calc_max_displacement(DP const& source, DP const& trans_source);
 
+/// Replace the points in each cube of the given size with their mean. The
+/// output has the points ordered by cube, so it does not depend on the
+/// order of the input points within a cube.
+void voxel_downsample(DP const& in, double voxel_size, DP & out);
+
 /// Apply a transformation matrix to a Vector3 in homogenous coordinates
 vw::Vector3 apply_transform(PointMatcher<RealT>::Matrix const& T, vw::Vector3 const& P);
 
@@ -208,6 +213,12 @@ typedef vw::InterpolationView<vw::EdgeExtensionView<vw::ImageViewRef<vw::PixelMa
 InterpolationReadyDem load_interpolation_ready_dem(std::string const& dem_path,
                                                    vw::cartography::GeoReference & georef);
 
+/// Same as above, but read into memory the DEM window around the given
+/// ECEF points, if not too large, and return the georeference of the window.
+InterpolationReadyDem load_interpolation_ready_dem(std::string const& dem_path,
+                                                   std::vector<vw::Vector3> const& xyz_vec,
+                                                   vw::cartography::GeoReference & georef);
+
 // Extract rotation and translation from a vector of 6 elements
 void extract_rotation_translation(const double * transform, vw::Quat & rotation, 
                                   vw::Vector3 & translation);
@@ -223,6 +234,14 @@ bool interp_dem_height(vw::ImageViewRef<vw::PixelMask<float>> const& dem,
                        vw::Vector3                            const& lonlat,
                        double                                      & dem_height);
 
+/// Interpolate the DEM heights at a batch of lon-lat-height points. The
+/// height is NaN for the points outside the valid DEM area. The georef
+/// must not be shared with other threads.
+void interp_dem_heights(vw::ImageViewRef<vw::PixelMask<float>> const& dem,
+                        vw::cartography::GeoReference          const& georef,
+                        std::vector<vw::Vector3>               const& lonlat,
+                        std::vector<double>                         & dem_heights);
+
 /// Consider a 4x4 matrix T which implements a rotation + translation
 /// y = A*x + b. Consider a point s in space close to the points
 /// x. We want to make that the new origin, so the points x get
@@ -287,6 +287,21 @@ def parse_corr_seed_mode(filename):
 
     return mode
 
+def read_first_batch_line(filename):
+    '''Return the arguments on the first line of a batch list which is not
+    empty or a comment. The C++ tools skip the same lines.'''
+
+    if not os.path.isfile(filename):
+        raise Exception('Cannot find the batch list: ' + filename)
+
+    with open(filename, 'r') as fh:
+        for line in fh:
+            vals = line.split()
+            if len(vals) > 0 and not vals[0].startswith('#'):
+                return vals
+
+    raise Exception('No runs in the batch list: ' + filename)
+
 def run_multiview(prog_name, args, extra_args, entry_point, stop_point,
                   verbose, settings):
 
@@ -89,6 +89,74 @@ def get_num_cpus():
 
     return num_cpus
 
+def get_numa_nodes():
+    """Return the sorted list of NUMA nodes on the current machine which have
+    CPUs. This is empty if it cannot be found."""
+
+    nodes = []
+    node_dir = '/sys/devices/system/node'
+    if not os.path.isdir(node_dir):
+        return nodes
+    for name in os.listdir(node_dir):
+        m = re.match(r'^node(\d+)$', name)
+        if m is None:
+            continue
+        cpulist = os.path.join(node_dir, name, 'cpulist')
+        try:
+            with open(cpulist, 'r') as f:
+                if f.read().strip() == '':
+                    continue # a node with memory only
+        except Exception:
+            continue
+        nodes.append(int(m.group(1)))
+    return sorted(nodes)
+
+def numa_bind_prefix(slot):
+    """Return the numactl command which binds a process and its memory to one
+    NUMA node, chosen based on the given job slot, which starts from 1.
+    Consecutive slots go to different nodes, so the processes are spread
+    evenly. Return an empty list if there is only one node, or numactl is
+    not installed."""
+
+    nodes = get_numa_nodes()
+    if len(nodes) <= 1:
+        return []
+    try:
+        which('numactl')
+    except Exception:
+        return []
+    node = str(nodes[(slot - 1) % len(nodes)])
+    # Prefer the local memory, but do not fail if the node runs out of it
+    return ['numactl', '--cpunodebind=' + node, '--preferred=' + node]
+
+def get_cgroup_memory_limit_mb():
+    """Return the memory limit of the cgroup of the current process, in MB, or
+    0 if there is none. Both cgroup v1 and v2 are supported."""
+
+    files = []
+    try:
+        with open('/proc/self/cgroup', 'r') as f:
+            for line in f:
+                if line.startswith('0::'):
+                    files.append('/sys/fs/cgroup' + line[3:].strip() + '/memory.max')
+    except Exception:
+        pass
+    files += ['/sys/fs/cgroup/memory.max',
+              '/sys/fs/cgroup/memory/memory.limit_in_bytes']
+
+    for path in files:
+        try:
+            with open(path, 'r') as f:
+                val = f.read().strip()
+        except Exception:
+            continue
+        if val == 'max':
+            continue
+        limit = float(val)
+        # cgroup v1 reports a huge number when there is no limit
+        if limit > 0 and limit < 1.0e18:
+            return limit / (1024.0 * 1024.0)
+    return 0
 
 def checkIfToolExists(toolName):
     """Returns true if the system knows about the utility with this name (it is on the PATH)."""
@@ -169,6 +237,33 @@ def getNumNodesInList(nodesListPath):
 
     return num_nodes
 
+def getAllocationNodes():
+    '''Return the nodes of the current PBS or Slurm allocation, without
+    repetition and in the original order. Return an empty list if not
+    running in an allocation.'''
+
+    names = []
+    if 'PBS_NODEFILE' in os.environ and os.path.isfile(os.environ['PBS_NODEFILE']):
+        with open(os.environ['PBS_NODEFILE'], 'r') as fh:
+            names = fh.read().split()
+    elif 'SLURM_JOB_NODELIST' in os.environ:
+        # Expand a compressed list like node[01-03,07]
+        try:
+            p = subprocess.Popen(['scontrol', 'show', 'hostnames',
+                                  os.environ['SLURM_JOB_NODELIST']],
+                                 stdout=subprocess.PIPE, universal_newlines=True)
+            out, err = p.communicate()
+            if p.returncode == 0:
+                names = out.split()
+        except OSError:
+            raise Exception('Could not run scontrol to find the Slurm nodes.')
+
+    nodes = []
+    for name in names:
+        if name not in nodes:
+            nodes.append(name)
+    return nodes
+
 def check_parallel_version():
     # This error will never be reached for users of our packaged final
     # product as that one bundles 'parallel' with it.
@@ -192,7 +287,7 @@ def runInGnuParallel(numParallelProcesses, commandString, argumentFilePath, para
     # that vital env variables are copied over.
     cmd = ['parallel',  '--will-cite', '--workdir', os.getcwd(), '-u',
            '--env', 'PATH', '--env', 'PYTHONPATH', '--env', 'ISISROOT',
-           '--env', 'ASP_LIBRARY_PATH',
+           '--env', 'ASP_LIBRARY_PATH', '--env', 'ASP_TRACE',
            '--env', 'ISISDATA', '-a', argumentFilePath]
 
     # Add number of processes if specified (default is one job per CPU core)
@@ -33,6 +33,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <memory>
 
 camera::CameraParameters::CameraParameters(Eigen::Vector2i const& image_size,
     Eigen::Vector2d const& focal_length,
@@ -208,6 +209,14 @@ Eigen::VectorXd numericalJacobian(Eigen::Vector2d const& P,
   return jacobian;
 }
 
+// The Jacobian of the RPC distortion, found analytically. This has the same
+// interface as numericalJacobian(), but the step and function are not used.
+Eigen::VectorXd rpcJacobian(Eigen::Vector2d const& P,
+                            Eigen::VectorXd const& dist,
+                            double step, FunT func) {
+  return rig::compute_rpc_jacobian(P, dist);
+}
+
 // Find X solving func(X) - Y = 0. Use the Newton-Raphson method.
 // Update X as X - (func(X) - Y) * J^-1, where J is the Jacobian of func(X).
 Eigen::Vector2d newtonRaphson(Eigen::Vector2d const& Y,
@@ -393,7 +402,7 @@ void camera::CameraParameters::UndistortCentered(Eigen::Vector2d const& distorte
 
      // Find the normalized undistorted pixel using Newton-Raphson
      Eigen::Vector2d U = newtonRaphson(norm, m_distortion_coeffs,
-                                       rig::compute_rpc, numericalJacobian);
+                                       rig::compute_rpc, rpcJacobian);
      
      // Undo the normalization
      *undistorted_c = U.cwiseProduct(m_focal_length);
@@ -404,14 +413,28 @@ void camera::CameraParameters::UndistortCentered(Eigen::Vector2d const& distorte
 // image, and want to apply it to a version of that image at a different resolution,
 // with 'scale' being the ratio of the width of the image at different resolution
 // and the one at the resolution at which the distortion model is computed.
-void camera::CameraParameters::GenerateRemapMaps(cv::Mat* remap_map, double scale) {
+void camera::CameraParameters::GenerateRemapMaps(cv::Mat* remap_map, double scale,
+                                                 double table_spacing) {
   remap_map->create(scale*m_undistorted_size[1], scale*m_undistorted_size[0], CV_32FC2);
-  Eigen::Vector2d undistorted, distorted;
-  for (undistorted[1] = 0; undistorted[1] < scale*m_undistorted_size[1]; undistorted[1]++) {
-    for (undistorted[0] = 0; undistorted[0] < scale*m_undistorted_size[0]; undistorted[0]++) {
-      Convert<UNDISTORTED, DISTORTED>(undistorted/scale, &distorted);
-      remap_map->at<cv::Vec2f>(undistorted[1], undistorted[0])[0] = scale*distorted[0];
-      remap_map->at<cv::Vec2f>(undistorted[1], undistorted[0])[1] = scale*distorted[1];
+
+  std::shared_ptr<DistortionTable> table;
+  if (table_spacing > 0)
+    table.reset(new DistortionTable(*this, DistortionTable::DISTORT, table_spacing));
+
+  // Each row is independent of the others
+  int num_rows = remap_map->rows, num_cols = remap_map->cols;
+#pragma omp parallel for
+  for (int row = 0; row < num_rows; row++) {
+    Eigen::Vector2d undistorted, distorted;
+    undistorted[1] = row;
+    for (int col = 0; col < num_cols; col++) {
+      undistorted[0] = col;
+      if (table)
+        table->Convert(undistorted/scale, &distorted);
+      else
+        Convert<UNDISTORTED, DISTORTED>(undistorted/scale, &distorted);
+      remap_map->at<cv::Vec2f>(row, col)[0] = scale*distorted[0];
+      remap_map->at<cv::Vec2f>(row, col)[1] = scale*distorted[1];
     }
   }
 }
@@ -505,3 +528,103 @@ namespace camera {
 
 }  // end namespace camera
 
+namespace camera {
+
+// The size of the image whose pixels are converted, for the given direction
+static Eigen::Vector2i tableInputSize(CameraParameters const& params,
+                                      DistortionTable::Direction direction) {
+  if (direction == DistortionTable::UNDISTORT)
+    return params.GetDistortedSize();
+  return params.GetUndistortedSize();
+}
+
+int64_t DistortionTable::NumNodes(CameraParameters const& params, Direction direction,
+                                  double spacing) {
+  if (spacing <= 0)
+    LOG(FATAL) << "The distortion table spacing must be positive.\n";
+  Eigen::Vector2i size = tableInputSize(params, direction);
+  // One more node than cells, and one more cell to cover the last pixel
+  int64_t cols = static_cast<int64_t>(ceil(size[0] / spacing)) + 2;
+  int64_t rows = static_cast<int64_t>(ceil(size[1] / spacing)) + 2;
+  return cols * rows;
+}
+
+DistortionTable::DistortionTable(CameraParameters const& params, Direction direction,
+                                 double spacing):
+  m_params(params), m_direction(direction), m_spacing(spacing), m_cols(0), m_rows(0) {
+
+  if (spacing <= 0)
+    LOG(FATAL) << "The distortion table spacing must be positive.\n";
+
+  Eigen::Vector2i size = tableInputSize(params, direction);
+  m_cols = static_cast<int>(ceil(size[0] / spacing)) + 2;
+  m_rows = static_cast<int>(ceil(size[1] / spacing)) + 2;
+  m_nodes.resize(static_cast<int64_t>(m_cols) * m_rows);
+
+#pragma omp parallel for
+  for (int row = 0; row < m_rows; row++) {
+    for (int col = 0; col < m_cols; col++)
+      ConvertExactly(Eigen::Vector2d(col * spacing, row * spacing),
+                     &m_nodes[static_cast<int64_t>(row) * m_cols + col]);
+  }
+}
+
+void DistortionTable::ConvertExactly(Eigen::Vector2d const& input,
+                                     Eigen::Vector2d *output) const {
+  if (m_direction == UNDISTORT)
+    m_params.Convert<DISTORTED, UNDISTORTED_C>(input, output);
+  else
+    m_params.Convert<UNDISTORTED, DISTORTED>(input, output);
+}
+
+void DistortionTable::Convert(Eigen::Vector2d const& input, Eigen::Vector2d *output) const {
+  double x = input[0] / m_spacing, y = input[1] / m_spacing;
+  int col = static_cast<int>(floor(x)), row = static_cast<int>(floor(y));
+
+  // Outside the grid, or NaN
+  if (!(col >= 0 && row >= 0 && col + 1 < m_cols && row + 1 < m_rows)) {
+    ConvertExactly(input, output);
+    return;
+  }
+
+  double wx = x - col, wy = y - row;
+  int64_t index = static_cast<int64_t>(row) * m_cols + col;
+  Eigen::Vector2d const& p00 = m_nodes[index];
+  Eigen::Vector2d const& p10 = m_nodes[index + 1];
+  Eigen::Vector2d const& p01 = m_nodes[index + m_cols];
+  Eigen::Vector2d const& p11 = m_nodes[index + m_cols + 1];
+  *output = (1.0 - wy) * ((1.0 - wx) * p00 + wx * p10) + wy * ((1.0 - wx) * p01 + wx * p11);
+}
+
+void DistortionTable::Convert(std::vector<Eigen::Vector2d> const& input,
+                              std::vector<Eigen::Vector2d> *output) const {
+  output->resize(input.size());
+  int64_t num = input.size();
+#pragma omp parallel for
+  for (int64_t it = 0; it < num; it++)
+    Convert(input[it], &(*output)[it]);
+}
+
+void UndistortPixels(CameraParameters const& params, double table_spacing,
+                     std::vector<Eigen::Vector2d> const& dist_pix,
+                     std::vector<Eigen::Vector2d> *undist_c_pix) {
+
+  // Only the fisheye, radtan, and RPC models are slow to undistort
+  bool use_table = (table_spacing > 0 && params.GetDistortion().size() >= 4 &&
+                    static_cast<int64_t>(dist_pix.size()) >
+                    DistortionTable::NumNodes(params, DistortionTable::UNDISTORT,
+                                              table_spacing));
+  if (use_table) {
+    DistortionTable table(params, DistortionTable::UNDISTORT, table_spacing);
+    table.Convert(dist_pix, undist_c_pix);
+    return;
+  }
+
+  undist_c_pix->resize(dist_pix.size());
+  int64_t num = dist_pix.size();
+#pragma omp parallel for
+  for (int64_t it = 0; it < num; it++)
+    params.Convert<DISTORTED, UNDISTORTED_C>(dist_pix[it], &(*undist_c_pix)[it]);
+}
+
+}  // end namespace camera
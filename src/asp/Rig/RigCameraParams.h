@@ -23,6 +23,7 @@
 
 #include <Eigen/Core>
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <algorithm>
@@ -82,8 +83,11 @@ namespace camera {
 
     // Used to create a remap table. This table is the same size as the
     // UNDISTORTED image, where every pixel's value is the corresponding pixel
-    // location in the DISTORTED image.
-    void GenerateRemapMaps(cv::Mat* remap_map, double scale = 1.0);
+    // location in the DISTORTED image. If table_spacing is positive, the
+    // distorted pixels are found exactly only on a grid with this spacing,
+    // in pixels of the camera model, and interpolated in between.
+    void GenerateRemapMaps(cv::Mat* remap_map, double scale = 1.0,
+                           double table_spacing = 0.0);
 
     // Conversion utilities
     template <int SRC, int DEST>
@@ -219,6 +223,53 @@ namespace camera {
   DECLARE_INTRINSIC(UNDISTORTED);
   DECLARE_INTRINSIC(UNDISTORTED_C);
 #undef DECLARE_INTRINSIC
+
+  // A lookup table for converting pixels from the DISTORTED to the
+  // UNDISTORTED_C frame, or from the UNDISTORTED to the DISTORTED frame. The
+  // conversion is done exactly at the nodes of a grid with given spacing
+  // covering the input image, and is interpolated bilinearly in between.
+  // That is much faster than undistorting each pixel iteratively, as for
+  // the fisheye and RPC models, or with OpenCV, as for the radtan model.
+  // Pixels outside the grid are converted exactly.
+  class DistortionTable {
+   public:
+    enum Direction {
+      UNDISTORT, // DISTORTED to UNDISTORTED_C
+      DISTORT    // UNDISTORTED to DISTORTED
+    };
+
+    // The table keeps a copy of the camera parameters
+    DistortionTable(CameraParameters const& params, Direction direction, double spacing);
+
+    void Convert(Eigen::Vector2d const& input, Eigen::Vector2d *output) const;
+
+    // Convert many pixels, in parallel
+    void Convert(std::vector<Eigen::Vector2d> const& input,
+                 std::vector<Eigen::Vector2d> *output) const;
+
+    // The number of grid nodes for a camera, direction, and spacing, which is
+    // how many exact conversions it takes to make the table
+    static int64_t NumNodes(CameraParameters const& params, Direction direction,
+                            double spacing);
+
+   private:
+    void ConvertExactly(Eigen::Vector2d const& input, Eigen::Vector2d *output) const;
+
+    CameraParameters m_params;
+    Direction m_direction;
+    double m_spacing;
+    int m_cols, m_rows;  // number of nodes in each direction
+    std::vector<Eigen::Vector2d> m_nodes;  // the converted nodes, row by row
+  };
+
+  // Undistort many pixels, from the DISTORTED to the UNDISTORTED_C frame, in
+  // parallel. For the fisheye, radtan, and RPC models, if table_spacing is
+  // positive and there are more pixels than nodes in a DistortionTable with
+  // this spacing, such a table is made and used.
+  void UndistortPixels(CameraParameters const& params, double table_spacing,
+                       std::vector<Eigen::Vector2d> const& dist_pix,
+                       std::vector<Eigen::Vector2d> *undist_c_pix);
+
 }  // namespace camera
 
 #endif  // ASP_RIG_CAMERA_PARAMS_H
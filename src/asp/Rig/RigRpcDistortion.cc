@@ -160,6 +160,63 @@ Eigen::Vector2d compute_rpc(Eigen::Vector2d const& p, Eigen::VectorXd const& coe
   return Eigen::Vector2d(vals[0]/vals[1], vals[2]/vals[3]);
 }
 
+// The Jacobian of compute_rpc() at the given point, found analytically. The
+// output is the 2x2 matrix stored row by row, as in numericalJacobian().
+Eigen::VectorXd compute_rpc_jacobian(Eigen::Vector2d const& p,
+                                     Eigen::VectorXd const& coeffs) {
+  validate_distortion_params(coeffs.size());
+
+  int rpc_deg = rpc_degree(coeffs.size());
+  double x = p[0];
+  double y = p[1];
+
+  // Precompute x^n and y^m values
+  std::vector<double> powx(rpc_deg + 1), powy(rpc_deg + 1);
+  double valx = 1.0, valy = 1.0;
+  for (int deg = 0; deg <= rpc_deg; deg++) {
+    powx[deg] = valx;
+    valx *= x;
+    powy[deg] = valy;
+    valy *= y;
+  }
+
+  // Evaluate the four polynomials and their partial derivatives in x and y,
+  // in the same order as in compute_rpc().
+  int coeff_index = 0;
+  double vals[] = {0.0, 1.0, 0.0, 1.0};
+  double dx[]   = {0.0, 0.0, 0.0, 0.0};
+  double dy[]   = {0.0, 0.0, 0.0, 0.0};
+  for (int count = 0; count < 4; count++) {
+    int start = 0;                            // starting degree for numerator
+    if (count == 1 || count == 3) start = 1;  // starting degree for denominator
+
+    for (int deg = start; deg <= rpc_deg; deg++) {
+      for (int i = 0; i <= deg; i++) {
+        // The term is coeff * x^(deg-i) * y^i
+        double c = coeffs[coeff_index];
+        vals[count] += c * powx[deg - i] * powy[i];
+        if (deg - i > 0)
+          dx[count] += c * (deg - i) * powx[deg - i - 1] * powy[i];
+        if (i > 0)
+          dy[count] += c * i * powx[deg - i] * powy[i - 1];
+        coeff_index++;
+      }
+    }
+  }
+
+  if (coeff_index != static_cast<int>(coeffs.size()))
+    throw "Book-keeping failure in RPCLensDistortion.";
+
+  // The derivative of a ratio
+  Eigen::VectorXd jacobian(4);
+  jacobian[0] = (dx[0] * vals[1] - vals[0] * dx[1]) / (vals[1] * vals[1]);
+  jacobian[1] = (dy[0] * vals[1] - vals[0] * dy[1]) / (vals[1] * vals[1]);
+  jacobian[2] = (dx[2] * vals[3] - vals[2] * dx[3]) / (vals[3] * vals[3]);
+  jacobian[3] = (dy[2] * vals[3] - vals[2] * dy[3]) / (vals[3] * vals[3]);
+
+  return jacobian;
+}
+
 // Put the vectors of numerator and denominator coefficients for the x and y
 // coordinates into a single vector.
 void pack_params(Eigen::VectorXd& params, Eigen::VectorXd const& num_x,
@@ -277,9 +334,11 @@ void RPCLensDistortion::increment_degree(Eigen::VectorXd& params) {
 }
 
 // An error function minimizing the fit of an RPC model, that is,
-// minimizing norm of dist_pix - RPC_model(undist_pix).
-struct RpcFitError {
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+// minimizing norm of dist_pix - RPC_model(undist_pix). The Jacobian is
+// found analytically, as the model is a ratio of polynomials that are
+// linear in the coefficients.
+class RpcFitError: public ceres::CostFunction {
+ public:
   RpcFitError(Eigen::Vector2d const& undist_pix, Eigen::Vector2d const& dist_pix,
               std::vector<int> const& block_sizes):
     m_undist_pix(undist_pix), m_dist_pix(dist_pix), m_block_sizes(block_sizes) {
@@ -287,39 +346,67 @@ struct RpcFitError {
     if (block_sizes.size() != 1)
       throw "RpcFitError: The block sizes were not set up properly.\n";
     validate_distortion_params(block_sizes[0]);
+
+    set_num_residuals(PIXEL_SIZE);
+    mutable_parameter_block_sizes()->push_back(block_sizes[0]);
   }
 
-  // Call to work with ceres::DynamicNumericDiffCostFunction.
-  bool operator()(double const* const* parameters, double* residuals) const {
+  bool Evaluate(double const* const* parameters, double* residuals,
+                double** jacobians) const override {
     int num_coeffs = m_block_sizes[0];
-    Eigen::VectorXd coeffs(num_coeffs);
-    for (int it = 0; it < num_coeffs; it++) coeffs[it] = parameters[0][it];
+    int rpc_deg = rpc_degree(num_coeffs);
+    double x = m_undist_pix[0];
+    double y = m_undist_pix[1];
+
+    // The monomials x^(deg-i) * y^i, for 0 <= i <= deg <= rpc_deg, in the
+    // order of the coefficients in compute_rpc()
+    std::vector<double> monomials;
+    for (int deg = 0; deg <= rpc_deg; deg++) {
+      for (int i = 0; i <= deg; i++)
+        monomials.push_back(pow(x, deg - i) * pow(y, i));
+    }
 
-    // distort
-    // this is wrong!
-    Eigen::Vector2d rpc_dist = compute_rpc(m_undist_pix, coeffs);
+    // Evaluate the numerator and denominator for each coordinate. The
+    // denominator has no constant term, as it is always 1.
+    int num_len = monomials.size(), den_len = num_len - 1;
+    double const* c = parameters[0];
+    double vals[] = {0.0, 1.0, 0.0, 1.0};
+    int starts[] = {0, num_len, num_len + den_len, 2 * num_len + den_len};
+    for (int count = 0; count < 4; count++) {
+      int shift = (count == 1 || count == 3) ? 1 : 0; // skip the constant term
+      int len = shift ? den_len : num_len;
+      for (int it = 0; it < len; it++)
+        vals[count] += c[starts[count] + it] * monomials[it + shift];
+    }
 
-    for (int it = 0; it < PIXEL_SIZE; it++) 
-      residuals[it] = rpc_dist[it] - m_dist_pix[it];
+    residuals[0] = vals[0] / vals[1] - m_dist_pix[0];
+    residuals[1] = vals[2] / vals[3] - m_dist_pix[1];
+
+    if (jacobians == NULL || jacobians[0] == NULL)
+      return true;
+
+    // The Jacobian is stored row by row. Each output coordinate depends only
+    // on its own coefficients.
+    double* J = jacobians[0];
+    for (int it = 0; it < PIXEL_SIZE * num_coeffs; it++)
+      J[it] = 0.0;
+    for (int coord = 0; coord < PIXEL_SIZE; coord++) {
+      double num = vals[2 * coord], den = vals[2 * coord + 1];
+      double* row = J + coord * num_coeffs;
+      for (int it = 0; it < num_len; it++)
+        row[starts[2 * coord] + it] = monomials[it] / den;
+      for (int it = 0; it < den_len; it++)
+        row[starts[2 * coord + 1] + it] = -num * monomials[it + 1] / (den * den);
+    }
 
     return true;
   }
 
   // Factory to hide the construction of the CostFunction object from the client code.
-  // TODO(oalexan1): Use analytical diff cost function
   static ceres::CostFunction*
   Create(Eigen::Vector2d const& undist_pix, Eigen::Vector2d const& dist_pix,
          std::vector<int> const& block_sizes) {
-    ceres::DynamicNumericDiffCostFunction<RpcFitError>* cost_function =
-      new ceres::DynamicNumericDiffCostFunction<RpcFitError>
-      (new RpcFitError(undist_pix, dist_pix, block_sizes));
-
-    cost_function->SetNumResiduals(PIXEL_SIZE);
-
-    for (size_t i = 0; i < block_sizes.size(); i++)
-      cost_function->AddParameterBlock(block_sizes[i]);
-
-    return cost_function;
+    return new RpcFitError(undist_pix, dist_pix, block_sizes);
   }
 
  private:
@@ -76,6 +76,11 @@ void evalRpcDistUndist(int num_samples, camera::CameraParameters const& cam_para
 // RPC is ratio of two polynomials in x and y. This assumes centered pixels that
 // are normalized by the focal length.
 Eigen::Vector2d compute_rpc(Eigen::Vector2d const& p, Eigen::VectorXd const& coeffs);
+
+// The Jacobian of compute_rpc() at the given point, as a 2x2 matrix
+// stored row by row
+Eigen::VectorXd compute_rpc_jacobian(Eigen::Vector2d const& p,
+                                     Eigen::VectorXd const& coeffs);
   
 // Prepend a 1 to a vector
 void prepend_1(Eigen::VectorXd & vec);
@@ -701,7 +701,7 @@ void readListOrNvm(// Inputs
                    std::string const& extra_list,
                    bool use_initial_rig_transforms,
                    double bracket_len, bool nearest_neighbor_interp,
-                   bool read_nvm_no_shift,
+                   bool read_nvm_no_shift, bool no_nvm_matches,
                    rig::RigSet const& R,
                    // Outputs
                    nvmData & nvm,
@@ -723,15 +723,12 @@ void readListOrNvm(// Inputs
                                // Outputs
                                nvm);
   } else {
-    rig::ReadNvm(nvm_file, 
-                 nvm.cid_to_keypoint_map,  
-                 nvm.cid_to_filename,  
-                 nvm.pid_to_cid_fid,  
-                 nvm.pid_to_xyz,  
-                 nvm.cid_to_cam_t_global);
+    // The tracks are not needed without the nvm matches. Then only the
+    // cameras are read from a binary nvm file.
+    bool read_offsets = !read_nvm_no_shift;
+    bool read_tracks = !no_nvm_matches;
+    rig::readNvmData(nvm_file, read_offsets, read_tracks, nvm);
     if (!read_nvm_no_shift) {
-      std::string offsets_file = rig::offsetsFilename(nvm_file);
-      rig::readNvmOffsets(offsets_file, nvm.optical_centers); 
       // Must have as many offsets as images
       if (nvm.optical_centers.size() != nvm.cid_to_filename.size())
         LOG(FATAL) << "Expecting as many optical centers as images.\n";
@@ -31,6 +31,7 @@
 #include <Rig/random_set.h>
 #include <Rig/image_lookup.h>
 #include <Rig/nvm.h>
+#include <Rig/tracks.h>
 
 #include <Rig/RigCameraParams.h>
 
@@ -52,6 +53,9 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <atomic>
+#include <limits>
+#include <algorithm>
 
 namespace fs = boost::filesystem;
 
@@ -67,6 +71,16 @@ DEFINE_double(sift_sigma, 1.6, "SIFT sigma.");
 DEFINE_int32(max_pairwise_matches, 2000,
              "Maximum number of pairwise matches in an image pair to keep.");
 
+DEFINE_double(undistortion_table_spacing, 0.0,
+              "When triangulating, for sensors with fisheye, radtan, or RPC "
+              "distortion having more keypoints than pixels in the image divided "
+              "by the square of this, undistort exactly only the nodes of a grid "
+              "with this spacing, in pixels, and interpolate in between. The "
+              "error grows as the square of the spacing. If 0, undistort each "
+              "keypoint exactly.");
+
+DECLARE_int32(num_threads); // defined in thread.cc
+
 namespace rig {
 
 void detectFeatures(const cv::Mat& image, bool verbose,
@@ -501,38 +515,140 @@ std::string matchFileName(std::string const& match_dir,
   return match_file;
 }
 
-// Build tracks from pairs  
+// Find the root of a node in a concurrent union-find forest. Use path halving.
+// Other threads may be changing the parents, but a parent is always a node
+// with an index no more than the current one, so this terminates.
+unsigned int findRoot(std::vector<std::atomic<unsigned int>> & parent,
+                      unsigned int node) {
+  while (true) {
+    unsigned int p = parent[node].load(std::memory_order_relaxed);
+    if (p == node)
+      return node;
+    unsigned int gp = parent[p].load(std::memory_order_relaxed);
+    if (gp != p)
+      parent[node].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+    node = gp;
+  }
+}
+
+// Merge the sets of two nodes. The root with the larger index points to the
+// one with the smaller index. Hence, regardless of the order in which the
+// merges happen, the root of each set is its smallest node.
+void unionNodes(std::vector<std::atomic<unsigned int>> & parent,
+                unsigned int a, unsigned int b) {
+  while (true) {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a == b)
+      return;
+    if (a < b)
+      std::swap(a, b);
+    unsigned int expected = a;
+    if (parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed))
+      return;
+  }
+}
+
+// Build tracks from pairs. Each feature (cid, fid) is a node, with an index
+// given by the cid offset and the fid. The pairs are merged in parallel in
+// a lock-free union-find forest. The result does not depend on the number
+// of threads, as each track is ordered by its smallest node. As in OpenMVG,
+// tracks having more than one feature in the same image are removed.
 void buildTracks(aspOpenMVG::matching::PairWiseMatches const& match_map,
                  std::vector<std::map<int, int>>& pid_to_cid_fid) { // output
 
   pid_to_cid_fid.clear(); // wipe the output
-  
-  aspOpenMVG::tracks::TracksBuilder trackBuilder;
-  trackBuilder.Build(match_map);  // Build:  Efficient fusion of correspondences
-  trackBuilder.Filter();          // Filter: Remove tracks that have conflict
-  // trackBuilder.ExportToStream(std::cout);
-  // Export tracks as a map (each entry is a sequence of imageId and featureIndex):
-  //  {TrackIndex => {(imageIndex, featureIndex), ... ,(imageIndex, featureIndex)}
-  aspOpenMVG::tracks::STLMAPTracks map_tracks;
-  trackBuilder.ExportToSTL(map_tracks);
-  trackBuilder = aspOpenMVG::tracks::TracksBuilder();   // wipe it
-
-  if (map_tracks.empty())
-    LOG(FATAL) << "No tracks left after filtering. Perhaps images "
-               << "are too dis-similar?\n";
-  
-  // Populate the filtered tracks
-  size_t num_elems = map_tracks.size();
-  pid_to_cid_fid.clear();
-  pid_to_cid_fid.resize(num_elems);
-  size_t curr_id = 0;
-  for (auto itr = map_tracks.begin(); itr != map_tracks.end(); itr++) {
-    for (auto itr2 = (itr->second).begin(); itr2 != (itr->second).end(); itr2++) {
-      pid_to_cid_fid[curr_id][itr2->first] = itr2->second;
+
+  // Iterators to the pairs, for multi-threading
+  std::vector<aspOpenMVG::matching::PairWiseMatches::const_iterator> pairs;
+  for (auto it = match_map.begin(); it != match_map.end(); it++)
+    pairs.push_back(it);
+
+  // The number of features in each image
+  std::vector<unsigned int> num_fid;
+  for (size_t it = 0; it < pairs.size(); it++) {
+    unsigned int left_cid = pairs[it]->first.first, right_cid = pairs[it]->first.second;
+    unsigned int max_cid = std::max(left_cid, right_cid);
+    if (num_fid.size() <= max_cid)
+      num_fid.resize(max_cid + 1, 0);
+    for (auto const& m: pairs[it]->second) {
+      num_fid[left_cid]  = std::max(num_fid[left_cid],  m.i_ + 1);
+      num_fid[right_cid] = std::max(num_fid[right_cid], m.j_ + 1);
     }
-    curr_id++;
   }
 
+  // The index of the first feature of each image among all nodes
+  std::vector<size_t> offset(num_fid.size() + 1, 0);
+  for (size_t cid = 0; cid < num_fid.size(); cid++)
+    offset[cid + 1] = offset[cid] + num_fid[cid];
+  size_t num_nodes = offset.back();
+  if (num_nodes >= std::numeric_limits<unsigned int>::max())
+    LOG(FATAL) << "Too many features to build tracks.\n";
+
+  std::vector<std::atomic<unsigned int>> parent(num_nodes);
+  for (size_t node = 0; node < num_nodes; node++)
+    parent[node].store(node, std::memory_order_relaxed);
+
+  // Each thread merges the matches in a shard of the pairs
+  int num_threads = std::max(1, std::min<int>(FLAGS_num_threads, pairs.size()));
+  auto mergeShard = [&](int shard) {
+    for (size_t it = shard; it < pairs.size(); it += num_threads) {
+      size_t left_offset = offset[pairs[it]->first.first];
+      size_t right_offset = offset[pairs[it]->first.second];
+      for (auto const& m: pairs[it]->second)
+        unionNodes(parent, left_offset + m.i_, right_offset + m.j_);
+    }
+  };
+  {
+    rig::ThreadPool thread_pool;
+    for (int shard = 0; shard < num_threads; shard++)
+      thread_pool.AddTask(mergeShard, shard);
+    thread_pool.Join();
+  }
+
+  // Collect the features of each set, in increasing order of the smallest
+  // node. Mark as invalid the sets which have an image more than once.
+  std::vector<int> root_to_pid(num_nodes, -1);
+  std::vector<bool> is_valid;
+  for (size_t cid = 0; cid < num_fid.size(); cid++) {
+    for (size_t fid = 0; fid < num_fid[cid]; fid++) {
+      unsigned int node = offset[cid] + fid;
+      unsigned int root = findRoot(parent, node);
+      if (root == node)
+        continue; // will add it when seen from another node of its set
+      if (root_to_pid[root] < 0) {
+        // The root is the smallest node, so it was visited already
+        root_to_pid[root] = pid_to_cid_fid.size();
+        pid_to_cid_fid.push_back(std::map<int, int>());
+        is_valid.push_back(true);
+        size_t root_cid = std::upper_bound(offset.begin(), offset.end(), root)
+          - offset.begin() - 1;
+        pid_to_cid_fid.back()[root_cid] = root - offset[root_cid];
+      }
+      int pid = root_to_pid[root];
+      auto & cid_fid = pid_to_cid_fid[pid]; // alias
+      if (cid_fid.find(cid) != cid_fid.end())
+        is_valid[pid] = false;
+      else
+        cid_fid[cid] = fid;
+    }
+  }
+
+  // Keep only the valid tracks. Those with one node were never added.
+  size_t num_valid = 0;
+  for (size_t pid = 0; pid < pid_to_cid_fid.size(); pid++) {
+    if (!is_valid[pid])
+      continue;
+    if (num_valid != pid)
+      pid_to_cid_fid[num_valid] = std::move(pid_to_cid_fid[pid]);
+    num_valid++;
+  }
+  pid_to_cid_fid.resize(num_valid);
+
+  if (pid_to_cid_fid.empty())
+    LOG(FATAL) << "No tracks left after filtering. Perhaps images "
+               << "are too dis-similar?\n";
+
   return;
 }
 
@@ -728,8 +844,7 @@ void addKeypoints(// Append from these
                   size_t num_out_cams,
                   // Outputs, append to these 
                   std::vector<int> & keypoint_count,
-                  std::vector<std::map<std::pair<float, float>, int>>
-                  & merged_keypoint_map) {
+                  std::vector<rig::KeypointMap> & merged_keypoint_map) {
 
   // Sanity checks
   if (num_out_cams != keypoint_count.size()) 
@@ -785,8 +900,7 @@ void addMatchPairs(// Append from these
                    std::vector<Eigen::Matrix2Xd>    const& cid_to_keypoint_map,
                    std::map<int, int>               const& cid2cid,
                    std::vector<Eigen::Vector2d>     const& keypoint_offsets,
-                   std::vector<std::map<std::pair<float, float>, int>>
-                   const& merged_keypoint_map, 
+                   std::vector<rig::KeypointMap> const& merged_keypoint_map, 
                    int cid_shift, size_t num_out_cams,
                    aspOpenMVG::matching::PairWiseMatches & match_map) { // append here
 
@@ -869,8 +983,7 @@ void transformAppendNvm(// Append from these
                         size_t num_out_cams,
                         // Outputs, append to these 
                         std::vector<int> & fid_count,
-                        std::vector<std::map<std::pair<float, float>, int>>
-                        & merged_keypoint_map,
+                        std::vector<rig::KeypointMap> & merged_keypoint_map,
                         std::vector<std::map<int, int>> & pid_to_cid_fid) {
 
   // Sanity checks
@@ -926,7 +1039,7 @@ void transformAppendNvm(// Append from these
 void findFid(std::pair<float, float> const & ip,
              int cid,
              // Outputs
-             std::vector<std::map<std::pair<float, float>, int>> & keypoint_map,
+             std::vector<rig::KeypointMap> & keypoint_map,
              std::vector<int> & fid_count,
              int & fid) {
   
@@ -948,9 +1061,11 @@ void findFid(std::pair<float, float> const & ip,
 void rmDuplicateTracks(std::vector<std::map<int, int>> & pid_to_cid_fid) {
 
   int num_tracks = pid_to_cid_fid.size();
-  // vector to set, and back
-  std::set<std::map<int, int>> track_set(pid_to_cid_fid.begin(), pid_to_cid_fid.end());
-  pid_to_cid_fid.assign(track_set.begin(), track_set.end());
+  // Sort the flat tracks rather than making a set of maps, which takes
+  // more memory. The resulting order is the same.
+  rig::TrackStore tracks(pid_to_cid_fid);
+  tracks.removeDuplicates();
+  tracks.toTracks(pid_to_cid_fid);
 
   int diff = num_tracks - int(pid_to_cid_fid.size());
   std::cout << "Removed " << diff << " duplicate tracks ("
@@ -1033,29 +1148,14 @@ void detectMatchFeatures(// Inputs
     LOG(FATAL) << "Failed to get the value of --num_threads in Astrobee software.\n";
   std::cout << "Using " << num_threads << " threads for feature detection/matching.\n";
 
-  std::cout << "Detecting features." << std::endl;
-
-  std::vector<cv::Mat> cid_to_descriptor_map;
-  std::vector<Eigen::Matrix2Xd> cid_to_keypoint_map;
-  cid_to_descriptor_map.resize(num_images);
-  cid_to_keypoint_map.resize(num_images);
-  {
-    // Make the thread pool go out of scope when not needed to not use up memory
-    rig::ThreadPool thread_pool;
-    for (size_t it = 0; it < num_images; it++) {
-      thread_pool.AddTask
-        (&rig::detectFeatures,    // multi-threaded  // NOLINT
-         // rig::detectFeatures(  // single-threaded // NOLINT
-         cams[it].image, verbose, &cid_to_descriptor_map[it], &cid_to_keypoint_map[it]);
-    }
-    thread_pool.Join();
-  }
-
   // Find which image pairs to match
   std::vector<std::pair<int, int>> image_pairs;
   if (!input_image_pairs.empty()) {
     // Use provided image pairs instead of num_overlaps
     image_pairs = input_image_pairs;
+    std::sort(image_pairs.begin(), image_pairs.end());
+    image_pairs.erase(std::unique(image_pairs.begin(), image_pairs.end()),
+                      image_pairs.end());
   } else {
     for (size_t it1 = 0; it1 < num_images; it1++) {
       int end = std::min(num_images, it1 + num_overlaps + 1);
@@ -1064,32 +1164,83 @@ void detectMatchFeatures(// Inputs
       }
     }
   }
-  
+
+  // The pairs are sorted, so with num_overlaps they form a window sliding
+  // over the images, in time order. Match them in chunks. Before matching a
+  // chunk, detect the features of the images in it that do not have them
+  // yet. After that, wipe the features of images not in later pairs. So
+  // features are found once per image, and kept only while in the window.
+  std::vector<int> last_use(num_images, -1);
+  for (size_t pair_it = 0; pair_it < image_pairs.size(); pair_it++) {
+    last_use[image_pairs[pair_it].first] = pair_it;
+    last_use[image_pairs[pair_it].second] = pair_it;
+  }
+
+  std::vector<cv::Mat> cid_to_descriptor_map(num_images);
+  std::vector<Eigen::Matrix2Xd> cid_to_keypoint_map(num_images);
+  std::vector<bool> detected(num_images, false);
   MATCH_MAP matches;
-  { // Deallocate local variables as soon as they are not needed
-    std::cout << "Matching features." << std::endl;
+  {
+    std::cout << "Detecting and matching features." << std::endl;
     rig::ThreadPool thread_pool;
     std::mutex match_mutex;
-    for (size_t pair_it = 0; pair_it < image_pairs.size(); pair_it++) {
-      auto pair = image_pairs[pair_it];
-      int left_image_it = pair.first, right_image_it = pair.second;
-      thread_pool.AddTask
-        (&rig::matchFeaturesWithCams,   // multi-threaded  // NOLINT
-         // rig::matchFeaturesWithCams( // single-threaded // NOLINT
-         &match_mutex, left_image_it, right_image_it,
-         cam_params[cams[left_image_it].camera_type],
-         cam_params[cams[right_image_it].camera_type],
-         filter_matches_using_cams,
-         world_to_cam[left_image_it], world_to_cam[right_image_it],
-         initial_max_reprojection_error,
-         cid_to_descriptor_map[left_image_it], cid_to_descriptor_map[right_image_it],
-         cid_to_keypoint_map[left_image_it], cid_to_keypoint_map[right_image_it], verbose,
-         &matches[pair]);
+    size_t chunk_size = 4 * std::max(thread_pool.NumThreads(), 1);
+    for (size_t beg = 0; beg < image_pairs.size(); beg += chunk_size) {
+      size_t end = std::min(beg + chunk_size, image_pairs.size());
+
+      {
+        rig::TaskGroup detect_group(thread_pool);
+        for (size_t pair_it = beg; pair_it < end; pair_it++) {
+          for (int cid: {image_pairs[pair_it].first, image_pairs[pair_it].second}) {
+            if (detected[cid])
+              continue;
+            detected[cid] = true;
+            detect_group.AddTask
+              (&rig::detectFeatures,    // multi-threaded  // NOLINT
+               // rig::detectFeatures(  // single-threaded // NOLINT
+               std::cref(cams[cid].image), verbose, &cid_to_descriptor_map[cid],
+               &cid_to_keypoint_map[cid]);
+          }
+        }
+        detect_group.Wait();
+      }
+
+      {
+        // The features are passed by reference, as they are not wiped
+        // until the tasks are done
+        rig::TaskGroup match_group(thread_pool);
+        for (size_t pair_it = beg; pair_it < end; pair_it++) {
+          auto pair = image_pairs[pair_it];
+          int left_image_it = pair.first, right_image_it = pair.second;
+          match_group.AddTask
+            (&rig::matchFeaturesWithCams,   // multi-threaded  // NOLINT
+             // rig::matchFeaturesWithCams( // single-threaded // NOLINT
+             &match_mutex, left_image_it, right_image_it,
+             std::cref(cam_params[cams[left_image_it].camera_type]),
+             std::cref(cam_params[cams[right_image_it].camera_type]),
+             filter_matches_using_cams,
+             std::cref(world_to_cam[left_image_it]), std::cref(world_to_cam[right_image_it]),
+             initial_max_reprojection_error,
+             std::cref(cid_to_descriptor_map[left_image_it]),
+             std::cref(cid_to_descriptor_map[right_image_it]),
+             std::cref(cid_to_keypoint_map[left_image_it]),
+             std::cref(cid_to_keypoint_map[right_image_it]), verbose,
+             &matches[pair]);
+        }
+        match_group.Wait();
+      }
+
+      // Wipe the features no longer needed
+      for (size_t pair_it = beg; pair_it < end; pair_it++) {
+        for (int cid: {image_pairs[pair_it].first, image_pairs[pair_it].second}) {
+          if (last_use[cid] < int(end)) {
+            cid_to_descriptor_map[cid] = cv::Mat();
+            cid_to_keypoint_map[cid] = Eigen::Matrix2Xd();
+          }
+        }
+      }
     }
-    thread_pool.Join();
   }
-  cid_to_keypoint_map = std::vector<Eigen::Matrix2Xd>(); // wipe, no longer needed
-  cid_to_descriptor_map = std::vector<cv::Mat>();  // Wipe, no longer needed
 
   if (save_matches) {
     if (out_dir.empty())
@@ -1117,7 +1268,7 @@ void detectMatchFeatures(// Inputs
   
   // Collect all keypoints in keypoint_map, and put the fid (indices of keypoints) in
   // match_map. It will be used to find the tracks.
-  std::vector<std::map<std::pair<float, float>, int>> keypoint_map(num_images);
+  std::vector<rig::KeypointMap> keypoint_map(num_images);
   std::vector<int> fid_count(num_images, 0); // track the fid of keypoints when adding them
   aspOpenMVG::matching::PairWiseMatches match_map;
   for (auto it = matches.begin(); it != matches.end(); it++) {
@@ -1231,6 +1382,33 @@ void detectMatchFeatures(// Inputs
   return;
 }
 
+// Find the inlier flag of each observation in the track store, to be used
+// without map lookups. These point into pid_cid_fid_inlier, which must not
+// be modified other than through them while they are in use.
+void findInlierFlags(rig::TrackStore const& tracks,
+                     std::vector<std::map<int, std::map<int, int>>> & pid_cid_fid_inlier,
+                     std::vector<int*> & inlier) {
+
+  if (pid_cid_fid_inlier.size() != tracks.numTracks())
+    LOG(FATAL) << "Expecting as many inlier flags as tracks.\n";
+
+  inlier.resize(tracks.numObs());
+
+  // Each track fills its own range, and the maps are not modified
+  #pragma omp parallel for schedule(dynamic, 256)
+  for (size_t pid = 0; pid < tracks.numTracks(); pid++) {
+    for (size_t obs = tracks.trackBeg(pid); obs < tracks.trackEnd(pid); obs++) {
+      auto cid_it = pid_cid_fid_inlier[pid].find(tracks.cid(obs));
+      if (cid_it == pid_cid_fid_inlier[pid].end())
+        LOG(FATAL) << "Current cid it out of range.\n";
+      auto fid_it = cid_it->second.find(tracks.fid(obs));
+      if (fid_it == cid_it->second.end())
+        LOG(FATAL) << "Current fid is out of range.\n";
+      inlier[obs] = &fid_it->second;
+    }
+  }
+}
+
 // TODO(oalexan1): Move to triangulation.cc.
 void multiViewTriangulation(// Inputs
                             std::vector<camera::CameraParameters>   const& cam_params,
@@ -1246,71 +1424,88 @@ void multiViewTriangulation(// Inputs
 
   if (cams.size() != world_to_cam.size()) 
     LOG(FATAL) << "Expecting as many images as cameras.\n";
+  if (cams.size() != keypoint_vec.size())
+    LOG(FATAL) << "Expecting as many images as sets of keypoints.\n";
   
   xyz_vec.clear();
   xyz_vec.resize(pid_to_cid_fid.size());
   for (size_t pid = 0; pid < pid_to_cid_fid.size(); pid++)
     xyz_vec[pid] = Eigen::Vector3d(0, 0, 0); // initialize to 0
-  
-  for (size_t pid = 0; pid < pid_to_cid_fid.size(); pid++) {
+
+  // Undistort the keypoints of all images of each sensor together, so that
+  // a lookup table is used for them if that is faster
+  std::vector<std::vector<Eigen::Vector2d>> undist_keypoint_vec(cams.size());
+  for (size_t cam_type = 0; cam_type < cam_params.size(); cam_type++) {
+    std::vector<Eigen::Vector2d> dist_pix, undist_pix;
+    for (size_t cid = 0; cid < cams.size(); cid++) {
+      if (cams[cid].camera_type != static_cast<int>(cam_type))
+        continue;
+      for (size_t fid = 0; fid < keypoint_vec[cid].size(); fid++)
+        dist_pix.push_back(Eigen::Vector2d(keypoint_vec[cid][fid].first,
+                                           keypoint_vec[cid][fid].second));
+    }
+    camera::UndistortPixels(cam_params[cam_type], FLAGS_undistortion_table_spacing,
+                            dist_pix, &undist_pix);
+    size_t count = 0;
+    for (size_t cid = 0; cid < cams.size(); cid++) {
+      if (cams[cid].camera_type != static_cast<int>(cam_type))
+        continue;
+      undist_keypoint_vec[cid].assign(undist_pix.begin() + count,
+                                      undist_pix.begin() + count + keypoint_vec[cid].size());
+      count += keypoint_vec[cid].size();
+    }
+  }
+
+  // Look up the inlier flags once, rather than for each access
+  rig::TrackStore tracks(pid_to_cid_fid);
+  std::vector<int*> inlier;
+  findInlierFlags(tracks, pid_cid_fid_inlier, inlier);
+
+  // Each track is triangulated independently, and it modifies only its own
+  // flags and point, so the result does not depend on the number of threads.
+  // The buffers are kept per thread to avoid reallocating them for each track.
+  #pragma omp parallel
+  {
     std::vector<double> focal_length_vec;
     std::vector<Eigen::Affine3d> world_to_cam_aff_vec;
     std::vector<Eigen::Vector2d> pix_vec;
 
-    for (auto cid_fid = pid_to_cid_fid[pid].begin(); cid_fid != pid_to_cid_fid[pid].end();
-         cid_fid++) {
-      int cid = cid_fid->first;
-      int fid = cid_fid->second;
+    #pragma omp for schedule(dynamic, 256)
+    for (size_t pid = 0; pid < pid_to_cid_fid.size(); pid++) {
+      focal_length_vec.clear();
+      world_to_cam_aff_vec.clear();
+      pix_vec.clear();
 
-      // Triangulate inliers only
-      if (!rig::getMapValue(pid_cid_fid_inlier, pid, cid, fid))
-        continue;
-
-      Eigen::Vector2d dist_ip(keypoint_vec[cid][fid].first, keypoint_vec[cid][fid].second);
-      Eigen::Vector2d undist_ip;
-      cam_params[cams[cid].camera_type].Convert<camera::DISTORTED, camera::UNDISTORTED_C>
-        (dist_ip, &undist_ip);
+      size_t beg = tracks.trackBeg(pid), end = tracks.trackEnd(pid);
+      for (size_t it = beg; it < end; it++) {
+        // Triangulate inliers only
+        if (!*inlier[it])
+          continue;
 
-      focal_length_vec.push_back(cam_params[cams[cid].camera_type].GetFocalLength());
-      world_to_cam_aff_vec.push_back(world_to_cam[cid]);
-      pix_vec.push_back(undist_ip);
-    }
+        int cid = tracks.cid(it);
+        focal_length_vec.push_back(cam_params[cams[cid].camera_type].GetFocalLength());
+        world_to_cam_aff_vec.push_back(world_to_cam[cid]);
+        pix_vec.push_back(undist_keypoint_vec[cid][tracks.fid(it)]);
+      }
 
-    if (pix_vec.size() < 2) {
       // If after outlier filtering less than two rays are left, can't triangulate.
-      // Must set all features for this pid to outliers.
-      for (auto cid_fid = pid_to_cid_fid[pid].begin();
-           cid_fid != pid_to_cid_fid[pid].end();
-           cid_fid++) {
-        int cid = cid_fid->first;
-        int fid = cid_fid->second;
-        rig::setMapValue(pid_cid_fid_inlier, pid, cid, fid, 0);
+      bool bad_xyz = (pix_vec.size() < 2);
+      if (!bad_xyz) {
+        // Triangulate n rays emanating from given undistorted and centered pixels
+        xyz_vec[pid] = rig::Triangulate(focal_length_vec, world_to_cam_aff_vec, pix_vec);
+        for (int c = 0; c < xyz_vec[pid].size(); c++) {
+          if (std::isinf(xyz_vec[pid][c]) || std::isnan(xyz_vec[pid][c]))
+            bad_xyz = true;
+        }
       }
 
-      // Nothing else to do
-      continue;
-    }
-
-    // Triangulate n rays emanating from given undistorted and centered pixels
-    xyz_vec[pid] = rig::Triangulate(focal_length_vec, world_to_cam_aff_vec,
-                                          pix_vec);
-
-    bool bad_xyz = false;
-    for (int c = 0; c < xyz_vec[pid].size(); c++) {
-      if (std::isinf(xyz_vec[pid][c]) || std::isnan(xyz_vec[pid][c])) 
-        bad_xyz = true;
-    }
-    if (bad_xyz) {
-      // if triangulation failed, must set all features for this pid to outliers.
-      for (auto cid_fid = pid_to_cid_fid[pid].begin(); cid_fid != pid_to_cid_fid[pid].end();
-           cid_fid++) {
-        int cid = cid_fid->first;
-        int fid = cid_fid->second;
-        rig::setMapValue(pid_cid_fid_inlier, pid, cid, fid, 0);
+      // If triangulation failed, must set all features for this pid to outliers.
+      if (bad_xyz) {
+        for (size_t it = beg; it < end; it++)
+          *inlier[it] = 0;
       }
-    }
-    
-  } // end iterating over triangulated points
+    } // end iterating over triangulated points
+  }
   
   return;
 }
@@ -1759,19 +1954,20 @@ void flagOutlierByExclusionDist(// Inputs
   // Initialize the output
   pid_cid_fid_inlier.resize(pid_to_cid_fid.size());
 
-  // Iterate though interest point matches
+  // Iterate though interest point matches. Each track fills only its own
+  // map, so the tracks can be processed in parallel.
   int num_excl = 0;
+  #pragma omp parallel for schedule(dynamic, 256) reduction(+:num_excl)
   for (size_t pid = 0; pid < pid_to_cid_fid.size(); pid++) {
+    auto & cid_fid_inlier = pid_cid_fid_inlier[pid]; // alias
     for (auto cid_fid = pid_to_cid_fid[pid].begin(); cid_fid != pid_to_cid_fid[pid].end();
          cid_fid++) {
       int cid = cid_fid->first;
       int fid = cid_fid->second;
       int cam_type = cams[cid].camera_type;
 
-      // Initially there are inliers only
-      pid_cid_fid_inlier[pid][cid][fid] = 1;
-
-      // Flag as outliers pixels at the image boundary.
+      // Flag as outliers pixels at the image boundary. Otherwise the
+      // features start as inliers.
       Eigen::Vector2d dist_pix(keypoint_vec[cid][fid].first,
                                keypoint_vec[cid][fid].second);
       Eigen::Vector2i dist_size = cam_params[cam_type].GetDistortedSize();
@@ -1780,8 +1976,10 @@ void flagOutlierByExclusionDist(// Inputs
       // size, no outliers are flagged
       if (std::abs(dist_pix[0] - dist_size[0] / 2.0) > dist_crop_size[0] / 2.0  ||
           std::abs(dist_pix[1] - dist_size[1] / 2.0) > dist_crop_size[1] / 2.0) {
-        rig::setMapValue(pid_cid_fid_inlier, pid, cid, fid, 0);
+        cid_fid_inlier[cid][fid] = 0;
         num_excl++;
+      } else {
+        cid_fid_inlier[cid][fid] = 1;
       }
     }
   }
@@ -1806,43 +2004,52 @@ void flagOutliersByTriAngleAndReprojErr(// Inputs
   // Outputs
   std::vector<std::map<int, std::map<int, int>>>& pid_cid_fid_inlier) {
 
+  // Look up the inlier flags once, rather than for each access
+  rig::TrackStore tracks(pid_to_cid_fid);
+  std::vector<int*> inlier;
+  findInlierFlags(tracks, pid_cid_fid_inlier, inlier);
+
+  // The camera centers, found once rather than for each pair of rays
+  std::vector<Eigen::Vector3d> cam_ctrs(world_to_cam.size());
+  for (size_t cid = 0; cid < world_to_cam.size(); cid++)
+    cam_ctrs[cid] = world_to_cam[cid].inverse() * Eigen::Vector3d(0, 0, 0);
+
   // Must deal with outliers by triangulation angle before
   // removing outliers by reprojection error, as the latter will
   // exclude some rays which form the given triangulated points.
+  // Each track modifies only its own flags, and the counts are summed
+  // in the reduction, so the result does not depend on the number of threads.
   int num_outliers_small_angle = 0;
+  #pragma omp parallel for schedule(dynamic, 256) reduction(+:num_outliers_small_angle)
   for (size_t pid = 0; pid < pid_to_cid_fid.size(); pid++) {
+    size_t beg = tracks.trackBeg(pid), end = tracks.trackEnd(pid);
+
     // Find the largest angle among any two intersecting rays
     double max_rays_angle = 0.0;
     bool point_checked = false;
-    for (auto cid_fid1 = pid_to_cid_fid[pid].begin();
-         cid_fid1 != pid_to_cid_fid[pid].end(); cid_fid1++) {
-      int cid1 = cid_fid1->first;
-      int fid1 = cid_fid1->second;
+    for (size_t it1 = beg; it1 < end; it1++) {
+      int cid1 = tracks.cid(it1);
 
       // Deal with inliers only
-      if (!rig::getMapValue(pid_cid_fid_inlier, pid, cid1, fid1)) 
+      if (!*inlier[it1])
         continue;
 
-      Eigen::Vector3d cam_ctr1 = (world_to_cam[cid1].inverse()) * Eigen::Vector3d(0, 0, 0);
-      Eigen::Vector3d ray1 = xyz_vec[pid] - cam_ctr1;
+      Eigen::Vector3d ray1 = xyz_vec[pid] - cam_ctrs[cid1];
       ray1.normalize();
 
-      for (auto cid_fid2 = pid_to_cid_fid[pid].begin();
-           cid_fid2 != pid_to_cid_fid[pid].end(); cid_fid2++) {
-        int cid2 = cid_fid2->first;
-        int fid2 = cid_fid2->second;
+      for (size_t it2 = beg; it2 < end; it2++) {
+        int cid2 = tracks.cid(it2);
 
         // Look at each cid and next cids
         if (cid2 <= cid1)
           continue;
 
         // Deal with inliers only
-        if (!rig::getMapValue(pid_cid_fid_inlier, pid, cid2, fid2))
+        if (!*inlier[it2])
            continue;
         point_checked = true;
 
-        Eigen::Vector3d cam_ctr2 = (world_to_cam[cid2].inverse()) * Eigen::Vector3d(0, 0, 0);
-        Eigen::Vector3d ray2 = xyz_vec[pid] - cam_ctr2;
+        Eigen::Vector3d ray2 = xyz_vec[pid] - cam_ctrs[cid2];
         ray2.normalize();
 
         double curr_angle = (180.0 / M_PI) * acos(ray1.dot(ray2));
@@ -1859,12 +2066,8 @@ void flagOutliersByTriAngleAndReprojErr(// Inputs
        
     // Flag as outliers all the features for this cid and increment the counter
     num_outliers_small_angle++;
-    for (auto cid_fid = pid_to_cid_fid[pid].begin();
-         cid_fid != pid_to_cid_fid[pid].end(); cid_fid++) {
-      int cid = cid_fid->first;
-      int fid = cid_fid->second;
-      rig::setMapValue(pid_cid_fid_inlier, pid, cid, fid, 0);
-    }
+    for (size_t it = beg; it < end; it++)
+      *inlier[it] = 0;
   }
 
   std::cout << std::setprecision(4) 
@@ -1875,20 +2078,19 @@ void flagOutliersByTriAngleAndReprojErr(// Inputs
   
   int num_outliers_reproj = 0;
   int num_total_features = 0;
+  #pragma omp parallel for schedule(dynamic, 256) \
+    reduction(+:num_outliers_reproj, num_total_features)
   for (size_t pid = 0; pid < pid_to_cid_fid.size(); pid++) {
-    for (auto cid_fid = pid_to_cid_fid[pid].begin();
-         cid_fid != pid_to_cid_fid[pid].end(); cid_fid++) {
-      int cid = cid_fid->first;
-      int fid = cid_fid->second;
-
+    for (size_t it = tracks.trackBeg(pid); it < tracks.trackEnd(pid); it++) {
       // Deal with inliers only
-      if (!rig::getMapValue(pid_cid_fid_inlier, pid, cid, fid)) 
+      if (!*inlier[it])
         continue;
 
       num_total_features++;
 
       // Find the pixel residuals
-      size_t residual_index = rig::getMapValue(pid_cid_fid_to_residual_index, pid, cid, fid);
+      size_t residual_index = rig::getMapValue(pid_cid_fid_to_residual_index, pid,
+                                               tracks.cid(it), tracks.fid(it));
       if (residuals.size() <= residual_index + 1) LOG(FATAL) << "Too few residuals.\n";
 
       double res_x = residuals[residual_index + 0];
@@ -1897,7 +2099,7 @@ void flagOutliersByTriAngleAndReprojErr(// Inputs
       bool is_good = (Eigen::Vector2d(res_x, res_y).norm() <= max_reprojection_error);
       if (!is_good) {
         num_outliers_reproj++;
-        rig::setMapValue(pid_cid_fid_inlier, pid, cid, fid, 0);
+        *inlier[it] = 0;
       }
     }
   }
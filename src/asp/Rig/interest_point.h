@@ -26,10 +26,12 @@
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 
+#include <functional>
 #include <string>
 #include <vector>
 #include <map>
 #include <mutex>
+#include <unordered_map>
 #include <utility>
 
 namespace camera {
@@ -51,6 +53,17 @@ class ImageMessage;
 class nvmData;
 class RigSet;
   
+// Hash a keypoint, to look it up among the keypoints of an image
+struct KeypointHash {
+  size_t operator()(std::pair<float, float> const& K) const {
+    size_t h1 = std::hash<float>()(K.first), h2 = std::hash<float>()(K.second);
+    return h1 ^ (h2 + 0x9e3779b9 + (h1 << 6) + (h1 >> 2));
+  }
+};
+
+// Map each keypoint of an image to its index (fid)
+typedef std::unordered_map<std::pair<float, float>, int, KeypointHash> KeypointMap;
+
 /// A class for storing information about an interest point
 /// in the format the NASA ASP can read it (very useful
 // for visualization)
@@ -303,7 +316,7 @@ void readListOrNvm(// Inputs
                    std::string const& extra_list,
                    bool use_initial_rig_transforms,
                    double bracket_len, bool nearest_neighbor_interp,
-                   bool read_nvm_no_shift,
+                   bool read_nvm_no_shift, bool no_nvm_matches,
                    rig::RigSet const& R,
                    // Outputs
                    nvmData & nvm,
@@ -323,8 +336,7 @@ void addMatchPairs(// Append from these
                    std::vector<Eigen::Matrix2Xd>    const& cid_to_keypoint_map,
                    std::map<int, int>               const& cid2cid,
                    std::vector<Eigen::Vector2d>     const& keypoint_offsets,
-                   std::vector<std::map<std::pair<float, float>, int>>
-                   const& merged_keypoint_map, 
+                   std::vector<rig::KeypointMap> const& merged_keypoint_map, 
                    int cid_shift, size_t num_out_cams,
                    aspOpenMVG::matching::PairWiseMatches & match_map); // append here
 
@@ -344,8 +356,7 @@ void transformAppendNvm(// Append from these
                         size_t num_out_cams,
                         // Outputs, append to these 
                         std::vector<int> & fid_count,
-                        std::vector<std::map<std::pair<float, float>, int>>
-                        & merged_keypoint_map,
+                        std::vector<rig::KeypointMap> & merged_keypoint_map,
                         std::vector<std::map<int, int>> & pid_to_cid_fid);
   
 // Add keypoints from a map, appending to existing keypoints. Take into
@@ -361,8 +372,7 @@ void addKeypoints(// Append from these
                   size_t num_out_cams,
                   // Outputs, append to these 
                   std::vector<int> & keypoint_count,
-                  std::vector<std::map<std::pair<float, float>, int>>
-                  & merged_keypoint_map);
+                  std::vector<rig::KeypointMap> & merged_keypoint_map);
 
 // Remove duplicate tracks. There can still be two tracks with one contained
 // in the other or otherwise having shared elements. 
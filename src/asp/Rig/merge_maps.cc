@@ -37,7 +37,7 @@
 #include <Rig/tracks.h>
 #include <Rig/nvm.h>
 #include <Rig/basic_algs.h>
-#include <Rig/ransac.h>
+#include <asp/Core/ParallelRansac.h>
 #include <Rig/transform_utils.h>
 #include <Rig/rig_config.h>
 #include <Rig/interest_point.h>
@@ -480,7 +480,7 @@ Eigen::Affine3d findMapToMapTransform(const std::vector<Eigen::Vector3d>& A_xyz_
   std::vector<size_t> inlier_indices;
   Eigen::Affine3d B2A_trans;
   try {
-    RandomSampleConsensus<TranslationRotationScaleFittingFunctor, TransformError>
+    asp::ParallelRansac<TranslationRotationScaleFittingFunctor, TransformError>
       ransac(TranslationRotationScaleFittingFunctor(),
              TransformError(), num_iterations,
              inlier_threshold, min_num_output_inliers,
@@ -764,7 +764,7 @@ void MergeMaps(rig::nvmData const& A,
   // This is very error-prone!
   std::vector<Eigen::Vector2d> keypoint_offsets(num_acid + num_bcid,
                                                 Eigen::Vector2d(0, 0));
-  std::vector<std::map<std::pair<float, float>, int>> merged_keypoint_map(num_out_cams);
+  std::vector<rig::KeypointMap> merged_keypoint_map(num_out_cams);
   std::vector<int> find_count(num_out_cams, 0); // how many keypoints so far
   std::vector<std::map<int, int>> merged_pid_to_cid_fid;
   // Add A
@@ -23,6 +23,7 @@
 #include <Rig/camera_image.h>
 #include <Rig/basic_algs.h>
 #include <Rig/system_utils.h>
+#include <asp/Core/Nvm.h>
 
 #include <boost/filesystem.hpp>
 #include <glog/logging.h>
@@ -43,6 +44,16 @@ void ReadNvm(std::string               const & input_filename,
              std::vector<Eigen::Vector3d>    & pid_to_xyz,
              std::vector<Eigen::Affine3d>    & cid_to_cam_t_global) {
 
+  if (asp::isBinaryNvm(input_filename)) {
+    std::vector<double> focal_lengths; // not used
+    std::map<std::string, Eigen::Vector2d> optical_centers; // not used
+    bool add_offsets = false;
+    asp::readBinaryNvm(input_filename, asp::NVM_ALL, add_offsets,
+                       cid_to_keypoint_map, cid_to_filename, pid_to_cid_fid,
+                       pid_to_xyz, cid_to_cam_t_global, focal_lengths, optical_centers);
+    return;
+  }
+
   std::cout << "Reading: " << input_filename << std::endl;
   std::ifstream f(input_filename, std::ios::in);
   std::string token;
@@ -120,6 +131,55 @@ void ReadNvm(std::string               const & input_filename,
   }
 }
 
+// Read an nvm file, text or binary, and the optical centers. See nvm.h.
+void readNvmData(std::string const& input_filename, bool read_offsets, bool read_tracks,
+                 nvmData & nvm) {
+
+  // Wipe the output
+  nvm = nvmData();
+
+  if (asp::isBinaryNvm(input_filename)) {
+    int sections = asp::NVM_CAMERAS;
+    if (read_tracks)
+      sections |= (asp::NVM_KEYPOINTS | asp::NVM_TRACKS);
+    std::vector<double> focal_lengths; // not used
+    bool add_offsets = false; // keep the keypoints as stored
+    asp::readBinaryNvm(input_filename, sections, add_offsets,
+                       nvm.cid_to_keypoint_map, nvm.cid_to_filename, nvm.pid_to_cid_fid,
+                       nvm.pid_to_xyz, nvm.cid_to_cam_t_global, focal_lengths,
+                       nvm.optical_centers);
+    if (read_offsets && nvm.optical_centers.empty())
+      LOG(FATAL) << "The file " << input_filename
+                 << " has no optical centers (offsets).\n";
+    return;
+  }
+
+  ReadNvm(input_filename, nvm.cid_to_keypoint_map, nvm.cid_to_filename,
+          nvm.pid_to_cid_fid, nvm.pid_to_xyz, nvm.cid_to_cam_t_global);
+  if (read_offsets)
+    readNvmOffsets(offsetsFilename(input_filename), nvm.optical_centers);
+}
+
+// Write an nvm file, text or binary, and the optical centers. See nvm.h.
+void writeNvmData(nvmData const& nvm, bool write_offsets, std::string const& output_filename) {
+
+  if (asp::isBinaryNvm(output_filename)) {
+    std::vector<double> focal_lengths; // will be set to 1, not used
+    std::map<std::string, Eigen::Vector2d> no_offsets;
+    bool subtract_offsets = false; // the keypoints are already shifted
+    asp::writeBinaryNvm(nvm.cid_to_keypoint_map, nvm.cid_to_filename, focal_lengths,
+                        nvm.pid_to_cid_fid, nvm.pid_to_xyz, nvm.cid_to_cam_t_global,
+                        write_offsets ? nvm.optical_centers : no_offsets,
+                        subtract_offsets, output_filename);
+    return;
+  }
+
+  WriteNvm(nvm.cid_to_keypoint_map, nvm.cid_to_filename, nvm.pid_to_cid_fid,
+           nvm.pid_to_xyz, nvm.cid_to_cam_t_global, output_filename);
+  if (write_offsets)
+    writeNvmOffsets(offsetsFilename(output_filename), nvm.optical_centers);
+}
+
 // A function to create the offsets filename from the nvm filename
 std::string offsetsFilename(std::string const& nvm_filename) {
   int file_len = nvm_filename.size(); // cast to int to make subtraction safe
@@ -268,6 +328,16 @@ void WriteNvm(std::vector<Eigen::Matrix2Xd> const& cid_to_keypoint_map,
               std::vector<Eigen::Affine3d> const& cid_to_cam_t_global,
               std::string const& output_filename) {
 
+  if (asp::isBinaryNvm(output_filename)) {
+    std::vector<double> focal_lengths; // will be set to 1, not used
+    std::map<std::string, Eigen::Vector2d> optical_centers; // not saved
+    bool subtract_offsets = false;
+    asp::writeBinaryNvm(cid_to_keypoint_map, cid_to_filename, focal_lengths,
+                        pid_to_cid_fid, pid_to_xyz, cid_to_cam_t_global,
+                        optical_centers, subtract_offsets, output_filename);
+    return;
+  }
+
   // Ensure that the output directory exists
   std::string out_dir = fs::path(output_filename).parent_path().string();
   rig::createDir(out_dir);
@@ -59,6 +59,21 @@ void ReadNvm(std::string               const & input_filename,
              std::vector<Eigen::Vector3d>    & pid_to_xyz,
              std::vector<Eigen::Affine3d>    & cid_to_cam_t_global);
 
+// Read an nvm file, text or binary (extension .nvmb). The keypoints are as
+// stored, so may be shifted relative to the optical centers. For a text file
+// the optical centers are read from the offsets file if read_offsets is
+// true. A binary file has them inside, if at all, and they are returned if
+// present, and must be present if read_offsets is true. If read_tracks is
+// false, only the cameras are read from a binary file, and there are no
+// tracks and no keypoints. A text file is always read fully.
+void readNvmData(std::string const& input_filename, bool read_offsets, bool read_tracks,
+                 nvmData & nvm);
+
+// Write an nvm file, text or binary (extension .nvmb), and the optical
+// centers if write_offsets is true. For a text file they go to the offsets
+// file. A binary file has them inside. The keypoints are written as they are.
+void writeNvmData(nvmData const& nvm, bool write_offsets, std::string const& output_filename);
+
 // Write the inliers in nvm format. The keypoints are shifted relative to the optical
 // center, as written by Theia.
 void writeInliersToNvm
@@ -18,6 +18,7 @@
 
 #include <Rig/sparse_mapping.h>
 #include <Rig/RigCameraModel.h>
+#include <Rig/tracks.h>
 
 #include <Eigen/Core>
 #include <gflags/gflags.h>
@@ -494,18 +495,12 @@ void MergePids(int repeat_index, int num_unique,
 }
 
 void PrintPidStats(std::vector<std::map<int, int> > const& pid_to_cid_fid) {
-  std::map<int, int> cid_to_pid;
-  for (size_t pid = 0; pid < pid_to_cid_fid.size(); pid++) {
-    std::map<int, int> const& cid_fid = pid_to_cid_fid[pid];
-    for (std::map<int, int>::const_iterator it = cid_fid.begin(); it != cid_fid.end();
-         it++) {
-      cid_to_pid[it->first]++;
-    }
-  }
+  rig::TrackStore tracks(pid_to_cid_fid);
   LOG(INFO) << "cid and number of pids having fids in that cid";
-  for (std::map<int, int>::iterator it = cid_to_pid.begin();
-       it != cid_to_pid.end(); it++) {
-    LOG(INFO) << "cid_fid " << it->first << ' ' << it->second;
+  for (size_t cid = 0; cid < tracks.numCams(); cid++) {
+    size_t num_pid = tracks.camEnd(cid) - tracks.camBeg(cid);
+    if (num_pid > 0)
+      LOG(INFO) << "cid_fid " << cid << ' ' << num_pid;
   }
 }
 
@@ -581,6 +576,11 @@ void FilterPID(double reproj_thresh,
   FilterStats s;
   s.total = (*pid_to_xyz).size();
 
+  // The tracks as flat arrays, so that removing features and points is done
+  // in one pass, rather than by erasing them one at a time
+  rig::TrackStore tracks(*pid_to_cid_fid);
+  std::vector<double> obs_err(tracks.numObs());
+
   std::vector<bool> is_bad((*pid_to_xyz).size(), false);
   Eigen::Vector2d half_size = camera_params.GetUndistortedHalfSize();
   for (size_t pid = 0; pid < (*pid_to_xyz).size(); pid++) {
@@ -594,10 +594,12 @@ void FilterPID(double reproj_thresh,
       is_bad[pid] = true;
     }
 
-    for (std::pair<int, int> cid_fid : (*pid_to_cid_fid)[pid]) {
-      Eigen::Vector2d pix = (cid_to_cam_t_global[cid_fid.first] *
+    for (size_t obs = tracks.trackBeg(pid); obs < tracks.trackEnd(pid); obs++) {
+      int cid = tracks.cid(obs);
+      Eigen::Vector2d pix = (cid_to_cam_t_global[cid] *
                              (*pid_to_xyz)[pid]).hnormalized() * camera_params.GetFocalLength();
-      errors.push_back((cid_to_keypoint_map[cid_fid.first].col(cid_fid.second) - pix).norm());
+      obs_err[obs] = (cid_to_keypoint_map[cid].col(tracks.fid(obs)) - pix).norm();
+      errors.push_back(obs_err[obs]);
       // Mark points which don't project at valid camera pixels
       // TODO(zmoratto) : This can probably be done with a Eigen Array reduction
       if (pix[0] < -half_size[0] || pix[0] >= half_size[0] || pix[1] < -half_size[1] || pix[1] >= half_size[1]) {
@@ -606,7 +608,7 @@ void FilterPID(double reproj_thresh,
       }
 
       // Mark points that are behind the camera
-      Eigen::Vector3d P = cid_to_cam_t_global[cid_fid.first] * (*pid_to_xyz)[pid];
+      Eigen::Vector3d P = cid_to_cam_t_global[cid] * (*pid_to_xyz)[pid];
       if (P[2] <= 0) {
         behind_cam = true;
         is_bad[pid] = true;
@@ -617,55 +619,32 @@ void FilterPID(double reproj_thresh,
     s.invalid_reproj += static_cast<int>(invalid_reproj);
   }
 
-  for (size_t pid = (*pid_to_xyz).size() - 1; pid < (*pid_to_xyz).size(); pid--) {
-    if (is_bad[pid]) {
-      std::vector<std::map<int, int> >::iterator cid_fid_it = (*pid_to_cid_fid).begin();
-      std::vector<Eigen::Vector3d>::iterator xyz_it = (*pid_to_xyz).begin();
-      std::advance(cid_fid_it, pid);
-      std::advance(xyz_it, pid);
-      (*pid_to_cid_fid).erase(cid_fid_it);
-      (*pid_to_xyz).erase(xyz_it);
-    }
-  }
-
-  // Wipe all features who are further than the reprojection of the
-  // corresponding 3D point than given threshold.
+  // Wipe the bad points, and all features who are further than the
+  // reprojection of the corresponding 3D point than given threshold.
   double thresh = std::max(GetErrThresh(errors, multiple_of_median), reproj_thresh);
   LOG(INFO) << "Filtering features with reprojection error higher than: "
             << thresh << " pixels";
-  for (size_t pid = (*pid_to_xyz).size() - 1; pid < (*pid_to_xyz).size(); pid--) {
-    std::map<int, int> & cid_fid = (*pid_to_cid_fid)[pid];
-    std::map<int, int>::iterator itr = cid_fid.begin();
-    while (itr != cid_fid.end()) {
+  std::vector<char> keep_obs(tracks.numObs(), 0);
+  for (size_t pid = 0; pid < (*pid_to_xyz).size(); pid++) {
+    if (is_bad[pid])
+      continue;
+    for (size_t obs = tracks.trackBeg(pid); obs < tracks.trackEnd(pid); obs++) {
       s.num_features++;
-      Eigen::Vector2d pix = (cid_to_cam_t_global[itr->first] *
-                             (*pid_to_xyz)[pid]).hnormalized() * camera_params.GetFocalLength();
-      double err
-        = (cid_to_keypoint_map[itr->first].col(itr->second) - pix).norm();
-
-      if (err >= thresh) {
-        std::map<int, int>::iterator toErase = itr;
-        ++itr;
-        cid_fid.erase(toErase);
+      if (obs_err[obs] >= thresh)
         s.big_reproj_err++;
-      } else {
-        ++itr;
-      }
-    }
-
-    // Wipe a 3D point altogether if it corresponds to less than 2 matches.
-    int total = (*pid_to_cid_fid)[pid].size();
-    if (total < 2) {
-      std::vector<std::map<int, int> >::iterator cid_fid_it
-        = (*pid_to_cid_fid).begin();
-      std::vector<Eigen::Vector3d>::iterator xyz_it = (*pid_to_xyz).begin();
-      std::advance(cid_fid_it, pid);
-      std::advance(xyz_it, pid);
-      (*pid_to_cid_fid).erase(cid_fid_it);
-      (*pid_to_xyz).erase(xyz_it);
+      else
+        keep_obs[obs] = 1;
     }
   }
 
+  // Wipe a 3D point altogether if it corresponds to less than 2 matches.
+  std::vector<int> old_pid;
+  tracks.filter(keep_obs, 2, &old_pid);
+  tracks.toTracks(*pid_to_cid_fid);
+  for (size_t pid = 0; pid < old_pid.size(); pid++)
+    (*pid_to_xyz)[pid] = (*pid_to_xyz)[old_pid[pid]];
+  (*pid_to_xyz).resize(old_pid.size());
+
   if (print_stats)
     s.PrintStats();
 }
@@ -52,6 +52,7 @@
 #include <fstream>
 #include <utility>
 #include <set>
+#include <omp.h>
 
 // TODO(oalexan1): Consider applying TILE_PADDING not to at the atlas
 // forming stage, when the patch is padded, but earlier, right when
@@ -205,6 +206,29 @@ void IsaacTextureAtlas::finalize() {
   this->finalized = true;
 }
 
+void IsaacTextureAtlas::stack(std::vector<IsaacTextureAtlas::Ptr> const& atlases) {
+  if (finalized)
+    throw util::Exception("No stacking possible, IsaacTextureAtlas already finalized");
+
+  int64_t factor = 2 * TILE_PADDING;
+  int64_t start = this->determined_height;
+  for (size_t atlas_it = 0; atlas_it < atlases.size(); atlas_it++) {
+    IsaacTextureAtlas const& atlas = *atlases[atlas_it];  // alias
+    if (atlas.width != this->width)
+      throw util::Exception("The atlases to stack do not have the same width.");
+
+    Eigen::Vector2d offset = Eigen::Vector2d(0, start);
+    faces.insert(faces.end(), atlas.faces.begin(), atlas.faces.end());
+    for (size_t tex_it = 0; tex_it < atlas.texcoords.size(); tex_it++)
+      texcoords.push_back(atlas.texcoords[tex_it] + offset);
+
+    // Use the rows of each atlas rounded as in resize_atlas()
+    start += factor * ceil(atlas.determined_height / static_cast<double>(factor));
+  }
+
+  this->determined_height = start;
+}
+
 void isaac_build_model(mve::TriangleMesh::ConstPtr mesh,
                        std::vector<IsaacTextureAtlas::Ptr> const& texture_atlases,
                        IsaacObjModel* obj_model) {
@@ -418,6 +442,86 @@ void merge_texture_atlases(std::vector<IsaacTextureAtlas::Ptr>* texture_atlases)
   prev_atlases.clear();  // wipe this
 }
 
+// With many patches, pack them in parallel in horizontal strips of the
+// same width, one per thread, and stack those in a single atlas. The
+// patches, sorted by decreasing size, are dealt to the strips in turn,
+// so all strips get a similar mix. Each strip is a smaller bin, so this
+// is faster even apart from the threads. Return false, with no atlas
+// created, if there are too few patches, or if a strip overflowed. Then
+// the patches must be packed serially.
+bool pack_texture_strips(double height_factor,
+                         std::list<IsaacTexturePatch::ConstPtr> const& sorted_patches,
+                         std::map<int, int>& face_positions,
+                         std::vector<IsaacTextureAtlas::Ptr>* texture_atlases) {
+  int64_t min_patches_per_strip = 20000;
+  int64_t num_patches = sorted_patches.size();
+  int64_t num_strips = std::min(static_cast<int64_t>(omp_get_max_threads()),
+                                num_patches / min_patches_per_strip);
+  if (num_strips < 2)
+    return false;
+
+  std::vector<std::list<IsaacTexturePatch::ConstPtr>> strip_patches(num_strips);
+  int64_t count = 0;
+  for (auto it = sorted_patches.begin(); it != sorted_patches.end(); it++) {
+    strip_patches[count % num_strips].push_back(*it);
+    count++;
+  }
+
+  // The strips are as wide as a single atlas for all patches, and only as
+  // tall as needed for their own patches
+  int64_t texture_width = 0, texture_height = 0;
+  calculate_texture_size(height_factor, sorted_patches, texture_width, texture_height);
+
+  std::vector<IsaacTextureAtlas::Ptr> strips(num_strips);
+  std::vector<int> success(num_strips, 1);
+#pragma omp parallel for
+  for (int64_t strip_it = 0; strip_it < num_strips; strip_it++) {
+    int64_t strip_area = 0, max_patch_height = 0;
+    for (IsaacTexturePatch::ConstPtr texture_patch : strip_patches[strip_it]) {
+      int64_t width  = texture_patch->get_width()  + 2 * TILE_PADDING;
+      int64_t height = texture_patch->get_height() + 2 * TILE_PADDING;
+      max_patch_height = std::max(max_patch_height, height);
+      strip_area += width * height;
+    }
+    int64_t strip_height = ceil(strip_area / static_cast<double>(texture_width));
+    strip_height = std::max(strip_height, max_patch_height);
+    int64_t factor = 2 * TILE_PADDING;
+    strip_height = factor * ceil(strip_height / static_cast<double>(factor));
+    strip_height *= height_factor;
+
+    strips[strip_it] = IsaacTextureAtlas::create(texture_width, strip_height);
+    for (IsaacTexturePatch::ConstPtr texture_patch : strip_patches[strip_it]) {
+      if (!strips[strip_it]->insert(texture_patch)) {
+        success[strip_it] = 0;
+        break;
+      }
+    }
+  }
+
+  int64_t final_height = 0;
+  for (int64_t strip_it = 0; strip_it < num_strips; strip_it++) {
+    if (!success[strip_it]) {
+      std::cout << "Could not pack the patches in parallel. Pack them serially.\n";
+      return false;
+    }
+    final_height += strips[strip_it]->get_height();
+  }
+  std::cout << "Adding patches: " << num_patches << "/" << num_patches
+            << " (in " << num_strips << " strips)" << std::endl;
+
+  texture_atlases->push_back(IsaacTextureAtlas::create(texture_width, final_height));
+  IsaacTextureAtlas::Ptr texture_atlas = texture_atlases->back();
+  texture_atlas->stack(strips);
+  texture_atlas->finalize();  // this will change the atlas dimensions
+
+  // The faces are no longer in the sorted order
+  IsaacTextureAtlas::Faces const& faces = texture_atlas->get_faces();  // alias
+  for (size_t face_it = 0; face_it < faces.size(); face_it++)
+    face_positions[faces[face_it]] = face_it;
+
+  return true;
+}
+
 void generate_texture_atlases(double height_factor,
                               std::vector<IsaacTexturePatch::ConstPtr>& texture_patches,
                               std::map<int, int>& face_positions,
@@ -449,6 +553,10 @@ void generate_texture_atlases(double height_factor,
   int64_t num_patches = local_texture_patches.size();
   count = 0;
 
+  if (pack_texture_strips(height_factor, local_texture_patches, face_positions,
+                          texture_atlases))
+    local_texture_patches.clear();
+
   while (!local_texture_patches.empty()) {
     int64_t texture_width = 0, texture_height = 0;
     calculate_texture_size(height_factor, local_texture_patches, texture_width, texture_height);
@@ -720,7 +828,7 @@ void formModel(mve::TriangleMesh::ConstPtr mesh, double pixel_size, int64_t num_
   std::vector<IsaacTexturePatch::ConstPtr> texture_patches(num_faces);
 
   double total_area = 0.0;
-#pragma omp parallel for
+#pragma omp parallel for reduction(+:total_area)
   for (int64_t face_id = 0; face_id < num_faces; face_id++) {
     math::Vec3f const& v1 = vertices[faces[3 * face_id + 0]];
     math::Vec3f const& v2 = vertices[faces[3 * face_id + 1]];
@@ -987,6 +1095,118 @@ void formObj(IsaacObjModel& texture_model, std::string const& out_prefix, std::s
   obj_str = out.str();
 }
 
+// The faces which may take their texture from this camera, and, for the
+// vertices of those faces, if the camera sees them and their distorted
+// pixels. A vertex is seen if the ray from it to the camera center does not
+// hit the mesh, it is in front of the camera, and it projects within the
+// acceptable undistorted region. A vertex is shared by several faces, so
+// casting a ray per vertex rather than per face corner avoids most of the
+// ray casting. The face cost is infinite for faces which are not candidates.
+void findVisibleVertices(mve::TriangleMesh::ConstPtr mesh,
+                         std::shared_ptr<BVHTree> const& bvh_tree,
+                         camera::CameraModel const& cam,
+                         std::vector<double> const& smallest_cost_per_face,
+                         // Outputs
+                         std::vector<double> & face_cost,
+                         std::vector<char> & vertex_seen,
+                         std::vector<Eigen::Vector2d> & vertex_pix) {
+
+  Eigen::Vector3d cam_ctr = cam.GetPosition();
+  std::vector<math::Vec3f> const& vertices = mesh->get_vertices();
+  std::vector<unsigned int> const& faces = mesh->get_faces();
+  std::vector<math::Vec3f> const& face_normals = mesh->get_face_normals();
+  int64_t num_faces = faces.size() / 3;
+
+  face_cost.assign(num_faces, std::numeric_limits<double>::infinity());
+#pragma omp parallel for
+  for (int64_t face_id = 0; face_id < num_faces; face_id++) {
+    math::Vec3f const& v1 = vertices[faces[3 * face_id + 0]];
+    math::Vec3f const& v2 = vertices[faces[3 * face_id + 1]];
+    math::Vec3f const& v3 = vertices[faces[3 * face_id + 2]];
+    math::Vec3f const& face_normal = face_normals[face_id];
+    math::Vec3f const face_center = (v1 + v2 + v3) / 3.0f;
+
+    // Do some geometric checks and compute the cost for this face and camera
+
+    Eigen::Vector3d cam_to_face_vec = (vec3f_to_eigen(face_center) - cam_ctr).normalized();
+    Eigen::Vector3d face_to_cam_vec = -cam_to_face_vec;
+    double face_normal_to_cam_dot_prod = face_to_cam_vec.dot(vec3f_to_eigen(face_normal));
+
+    if (face_normal_to_cam_dot_prod <= 0.0) continue;  // The face points away from the camera
+
+    // Angle between face normal and ray from face center to camera center
+    // is bigger than 75 degrees.
+    // TODO(oalexan1): Make this a parameter.
+    // TODO(oalexan1): Filter by distance from each of
+    // v1, v2, v3 to view_pos.
+    double face_normal_to_cam_angle = std::acos(face_normal_to_cam_dot_prod);  // radians
+    if (face_normal_to_cam_angle > 75.0 * M_PI / 180.0) continue;
+
+    // The further a camera is and the bigger then angle between the
+    // camera direction and the face normal, the less we want this
+    // camera's texture for this triangle.
+    double cost_val = face_normal_to_cam_angle + (vec3f_to_eigen(face_center) - cam_ctr).norm();
+    if (cost_val >= smallest_cost_per_face[face_id]) continue;
+
+    face_cost[face_id] = cost_val;
+  }
+
+  // The vertices of the candidate faces
+  std::vector<int64_t> needed;
+  std::vector<char> is_needed(vertices.size(), 0);
+  for (int64_t face_id = 0; face_id < num_faces; face_id++) {
+    if (face_cost[face_id] == std::numeric_limits<double>::infinity()) continue;
+    for (int64_t vertex_it = 0; vertex_it < 3; vertex_it++) {
+      unsigned int vid = faces[3 * face_id + vertex_it];
+      if (!is_needed[vid]) {
+        is_needed[vid] = 1;
+        needed.push_back(vid);
+      }
+    }
+  }
+
+  vertex_seen.assign(vertices.size(), 0);
+  vertex_pix.assign(vertices.size(), Eigen::Vector2d(0, 0));
+  Eigen::Affine3d const& world2cam = cam.GetTransform();
+#pragma omp parallel for
+  for (int64_t it = 0; it < int64_t(needed.size()); it++) {
+    int64_t vid = needed[it];
+
+    // A mesh vertex is seen if the ray from it does not intersect the
+    // mesh somewhere else before hitting the camera
+    BVHTree::Ray ray;
+    ray.origin = vertices[vid];
+    ray.dir = eigen_to_vec3f(cam_ctr) - ray.origin;
+    ray.tmax = ray.dir.norm();
+    ray.tmin = ray.tmax * 0.0001f;
+    ray.dir.normalize();
+
+    BVHTree::Hit hit;
+    if (bvh_tree->intersect(ray, &hit)) continue;
+
+    // Transform the vertex to camera coordinates
+    Eigen::Vector3d cam_pt = world2cam * vec3f_to_eigen(vertices[vid]);
+
+    // Skip points that project behind the camera
+    if (cam_pt.z() <= 0) continue;
+
+    // Get the undistorted pixel
+    Eigen::Vector2d undist_centered_pix =
+      cam.GetParameters().GetFocalVector().cwiseProduct(cam_pt.hnormalized());
+    if (std::abs(undist_centered_pix[0]) > cam.GetParameters().GetUndistortedHalfSize()[0] ||
+        std::abs(undist_centered_pix[1]) > cam.GetParameters().GetUndistortedHalfSize()[1]) {
+      // If we are out of acceptable undistorted region, there's some uncertainty whether
+      // the distortion computation in the next operation will work, so quit early.
+      continue;
+    }
+
+    // Get the distorted pixel value
+    cam.GetParameters().Convert<camera::UNDISTORTED_C, camera::DISTORTED>
+      (undist_centered_pix, &vertex_pix[vid]);
+    vertex_seen[vid] = 1;
+  }
+}
+
 // Project texture and find the UV coordinates
 void projectTexture(mve::TriangleMesh::ConstPtr mesh, std::shared_ptr<BVHTree> bvh_tree,
                     cv::Mat const& image,
@@ -1020,100 +1240,41 @@ void projectTexture(mve::TriangleMesh::ConstPtr mesh, std::shared_ptr<BVHTree> b
                << "These must be equal up to an integer factor.\n";
   }
 
-  Eigen::Vector3d cam_ctr = cam.GetPosition();
-
   std::vector<math::Vec3f> const& vertices = mesh->get_vertices();
   std::vector<math::Vec3f> const& mesh_normals = mesh->get_vertex_normals();
   if (vertices.size() != mesh_normals.size())
     LOG(FATAL) << "A mesh must have as many vertices as vertex normals.";
 
   std::vector<unsigned int> const& faces = mesh->get_faces();
-  std::vector<math::Vec3f> const& face_normals = mesh->get_face_normals();
 
   if (smallest_cost_per_face.size() != faces.size())
     LOG(FATAL) << "There must be one cost value per face.";
 
-#pragma omp parallel for
-  for (std::size_t face_id = 0; face_id < faces.size() / 3; face_id++) {
-    math::Vec3f const& v1 = vertices[faces[3 * face_id + 0]];
-    math::Vec3f const& v2 = vertices[faces[3 * face_id + 1]];
-    math::Vec3f const& v3 = vertices[faces[3 * face_id + 2]];
-    math::Vec3f const& face_normal = face_normals[face_id];
-    math::Vec3f const face_center = (v1 + v2 + v3) / 3.0f;
-
-    // Do some geometric checks and compute the cost for this face and camera
-
-    Eigen::Vector3d cam_to_face_vec = (vec3f_to_eigen(face_center) - cam_ctr).normalized();
-    Eigen::Vector3d face_to_cam_vec = -cam_to_face_vec;
-    double face_normal_to_cam_dot_prod = face_to_cam_vec.dot(vec3f_to_eigen(face_normal));
-
-    if (face_normal_to_cam_dot_prod <= 0.0) continue;  // The face points away from the camera
+  std::vector<double> face_cost;
+  std::vector<char> vertex_seen;
+  std::vector<Eigen::Vector2d> vertex_pix;
+  findVisibleVertices(mesh, bvh_tree, cam, smallest_cost_per_face,
+                      face_cost, vertex_seen, vertex_pix);
 
-    // Angle between face normal and ray from face center to camera center
-    // is bigger than 75 degrees.
-    // TODO(oalexan1): Make this a parameter.
-    // TODO(oalexan1): Filter by distance from each of
-    // v1, v2, v3 to view_pos.
-    double face_normal_to_cam_angle = std::acos(face_normal_to_cam_dot_prod);  // radians
-    if (face_normal_to_cam_angle > 75.0 * M_PI / 180.0) continue;
+  Eigen::Vector2i dist_size      = cam.GetParameters().GetDistortedSize();
+  Eigen::Vector2i dist_crop_size = cam.GetParameters().GetDistortedCropSize();
 
-    // The further a camera is and the bigger then angle between the
-    // camera direction and the face normal, the less we want this
-    // camera's texture for this triangle.
-    double cost_val = face_normal_to_cam_angle + (vec3f_to_eigen(face_center) - cam_ctr).norm();
-    if (cost_val >= smallest_cost_per_face[face_id]) {
-      continue;
-    }
+#pragma omp parallel for
+  for (std::size_t face_id = 0; face_id < faces.size() / 3; face_id++) {
+    double cost_val = face_cost[face_id];
+    if (cost_val == std::numeric_limits<double>::infinity()) continue;
 
-    // A mesh triangle is visible if rays from its vertices do not
-    // intersect the mesh somewhere else before hitting the camera,
-    // and hit the camera inside the image bounds.
+    // A mesh triangle is visible if its vertices are seen by the camera
+    // and project inside the image bounds
     bool visible = true;
-    math::Vec3f const* samples[] = {&v1, &v2, &v3};
-
     std::vector<Eigen::Vector2d> UV;
     for (std::size_t vertex_it = 0; vertex_it < 3; vertex_it++) {
-      BVHTree::Ray ray;
-      ray.origin = *samples[vertex_it];
-      ray.dir = eigen_to_vec3f(cam_ctr) - ray.origin;
-      ray.tmax = ray.dir.norm();
-      ray.tmin = ray.tmax * 0.0001f;
-      ray.dir.normalize();
-
-      BVHTree::Hit hit;
-      if (bvh_tree->intersect(ray, &hit)) {
-        visible = false;
-        break;
-      }
-
-      // Triangle vertex in world coordinates
-      Eigen::Vector3d world_pt = vec3f_to_eigen(*samples[vertex_it]);
-
-      // Transform the vertex to camera coordinates
-      Eigen::Affine3d const& world2cam = cam.GetTransform();
-      Eigen::Vector3d cam_pt = world2cam * world_pt;
-
-      // Skip points that project behind the camera
-      if (cam_pt.z() <= 0) {
+      unsigned int vid = faces[3 * face_id + vertex_it];
+      if (!vertex_seen[vid]) {
         visible = false;
         break;
       }
-
-      // Get the undistorted pixel
-      Eigen::Vector2d undist_centered_pix =
-        cam.GetParameters().GetFocalVector().cwiseProduct(cam_pt.hnormalized());
-      if (std::abs(undist_centered_pix[0]) > cam.GetParameters().GetUndistortedHalfSize()[0] ||
-          std::abs(undist_centered_pix[1]) > cam.GetParameters().GetUndistortedHalfSize()[1]) {
-        // If we are out of acceptable undistorted region, there's some uncertainty whether
-        // the distortion computation in the next operation will work, so quit early.
-        visible = false;
-        break;
-      }
-
-      // Get the distorted pixel value
-      Eigen::Vector2d dist_pix;
-      cam.GetParameters().Convert<camera::UNDISTORTED_C, camera::DISTORTED>
-        (undist_centered_pix, &dist_pix);
+      Eigen::Vector2d const& dist_pix = vertex_pix[vid];
 
       // Skip pixels that don't project in the window of dimensions
       // dist_crop_size centered at the image center. Note that
@@ -1121,8 +1282,6 @@ void projectTexture(mve::TriangleMesh::ConstPtr mesh, std::shared_ptr<BVHTree> b
       // normally either the full image or something smaller if the
       // user restricts the domain of validity of the distortion
       // model.
-      Eigen::Vector2i dist_size      = cam.GetParameters().GetDistortedSize();
-      Eigen::Vector2i dist_crop_size = cam.GetParameters().GetDistortedCropSize();
       if (std::abs(dist_pix[0] - dist_size[0] / 2.0) > dist_crop_size[0] / 2.0  ||
           std::abs(dist_pix[1] - dist_size[1] / 2.0) > dist_crop_size[1] / 2.0) {
         visible = false;
@@ -1207,99 +1366,37 @@ void projectTexture(mve::TriangleMesh::ConstPtr mesh, std::shared_ptr<BVHTree> b
   if (texture->channels() != NUM_CHANNELS)
     throw util::Exception("Wrong number of channels in the texture image.");
 
-  Eigen::Vector3d cam_ctr = cam.GetPosition();
-
   std::vector<math::Vec3f> const& vertices = mesh->get_vertices();
   std::vector<math::Vec3f> const& mesh_normals = mesh->get_vertex_normals();
   if (vertices.size() != mesh_normals.size())
     LOG(FATAL) << "A mesh must have as many vertices as vertex normals.";
 
   std::vector<unsigned int> const& faces = mesh->get_faces();
-  std::vector<math::Vec3f> const& face_normals = mesh->get_face_normals();
 
   if (smallest_cost_per_face.size() != faces.size())
     LOG(FATAL) << "There must be one cost value per face.";
 
+  std::vector<double> face_cost;
+  std::vector<char> vertex_seen;
+  std::vector<Eigen::Vector2d> vertex_pix;
+  findVisibleVertices(mesh, bvh_tree, cam, smallest_cost_per_face,
+                      face_cost, vertex_seen, vertex_pix);
+
 #pragma omp parallel for
   for (std::size_t face_id = 0; face_id < faces.size() / 3; face_id++) {
-    math::Vec3f const& v1 = vertices[faces[3 * face_id + 0]];
-    math::Vec3f const& v2 = vertices[faces[3 * face_id + 1]];
-    math::Vec3f const& v3 = vertices[faces[3 * face_id + 2]];
-    math::Vec3f const& face_normal = face_normals[face_id];
-    math::Vec3f const face_center = (v1 + v2 + v3) / 3.0f;
-
-    // Do some geometric checks and compute the cost for this face and camera
-
-    Eigen::Vector3d cam_to_face_vec = (vec3f_to_eigen(face_center) - cam_ctr).normalized();
-    Eigen::Vector3d face_to_cam_vec = -cam_to_face_vec;
-    double face_normal_to_cam_dot_prod = face_to_cam_vec.dot(vec3f_to_eigen(face_normal));
-
-    if (face_normal_to_cam_dot_prod <= 0.0) continue;  // The face points away from the camera
-
-    // Angle between face normal and ray from face center to camera center
-    // is bigger than 75 degrees.
-    // TODO(oalexan1): Make this a parameter.
-    // TODO(oalexan1): Filter by distance from each of
-    // v1, v2, v3 to view_pos.
-    double face_normal_to_cam_angle = std::acos(face_normal_to_cam_dot_prod);  // radians
-    if (face_normal_to_cam_angle > 75.0 * M_PI / 180.0) continue;
+    double cost_val = face_cost[face_id];
+    if (cost_val == std::numeric_limits<double>::infinity()) continue;
 
-    // The further a camera is and the bigger then angle between the
-    // camera direction and the face normal, the less we want this
-    // camera's texture for this triangle.
-    double cost_val = face_normal_to_cam_angle + (vec3f_to_eigen(face_center) - cam_ctr).norm();
-    if (cost_val >= smallest_cost_per_face[face_id]) {
-      continue;
-    }
-
-    // A mesh triangle is visible if rays from its vertices do not
-    // intersect the mesh somewhere else before hitting the camera,
-    // and hit the camera inside the image bounds.
+    // A mesh triangle is visible if its vertices are seen by the camera
+    // and project inside the image
     bool visible = true;
-    math::Vec3f const* samples[] = {&v1, &v2, &v3};
-
     for (std::size_t vertex_it = 0; vertex_it < 3; vertex_it++) {
-      BVHTree::Ray ray;
-      ray.origin = *samples[vertex_it];
-      ray.dir = eigen_to_vec3f(cam_ctr) - ray.origin;
-      ray.tmax = ray.dir.norm();
-      ray.tmin = ray.tmax * 0.0001f;
-      ray.dir.normalize();
-
-      BVHTree::Hit hit;
-      if (bvh_tree->intersect(ray, &hit)) {
+      unsigned int vid = faces[3 * face_id + vertex_it];
+      if (!vertex_seen[vid]) {
         visible = false;
         break;
       }
-
-      // Triangle vertex in world coordinates
-      Eigen::Vector3d world_pt = vec3f_to_eigen(*samples[vertex_it]);
-
-      // Transform the vertex to camera coordinates
-      Eigen::Affine3d const& world2cam = cam.GetTransform();
-      Eigen::Vector3d cam_pt = world2cam * world_pt;
-
-      // Skip points that project behind the camera
-      if (cam_pt.z() <= 0) {
-        visible = false;
-        break;
-      }
-
-      // Get the undistorted pixel
-      Eigen::Vector2d undist_centered_pix
-        = cam.GetParameters().GetFocalVector().cwiseProduct(cam_pt.hnormalized());
-      if (std::abs(undist_centered_pix[0]) > cam.GetParameters().GetUndistortedHalfSize()[0] ||
-          std::abs(undist_centered_pix[1]) > cam.GetParameters().GetUndistortedHalfSize()[1]) {
-        // If we are out of acceptable undistorted region, there's some uncertainty whether
-        // the distortion computation in the next operation will work, so quit early.
-        visible = false;
-        break;
-      }
-
-      // Get the distorted pixel value
-      Eigen::Vector2d dist_pix;
-      cam.GetParameters().Convert<camera::UNDISTORTED_C,
-        camera::DISTORTED>(undist_centered_pix, &dist_pix);
+      Eigen::Vector2d const& dist_pix = vertex_pix[vid];
 
       // Skip pixels that don't project in the image
       if (dist_pix.x() < 0 || dist_pix.x() > calib_image_cols - 1 || dist_pix.y() < 0 ||
@@ -1580,6 +1677,8 @@ void meshTriangulations(// Inputs
   pid_cid_fid_mesh_xyz.resize(pid_to_cid_fid.size());
   pid_mesh_xyz.resize(pid_to_cid_fid.size());
 
+  // Each track writes only its own outputs, so tracks can be done in parallel
+#pragma omp parallel for
   for (size_t pid = 0; pid < pid_to_cid_fid.size(); pid++) {
     Eigen::Vector3d avg_mesh_xyz(0, 0, 0);
     int num_intersections = 0;
@@ -242,6 +242,10 @@ class IsaacTextureAtlas {
 
   bool insert(IsaacTexturePatch::ConstPtr texture_patch);
 
+  // Append the patches inserted in the given atlases of the same width,
+  // placing each atlas below the previous one.
+  void stack(std::vector<IsaacTextureAtlas::Ptr> const& atlases);
+
   void scale_texcoords(void);
 
   void merge_texcoords(void);
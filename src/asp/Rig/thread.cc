@@ -21,81 +21,214 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
-#include <sys/time.h>
+#include <chrono>
 #include <thread>
 
 DEFINE_int32(num_threads, (std::thread::hardware_concurrency() == 0 ?
                            8 : std::thread::hardware_concurrency()),
              "Number of threads to use.");
 
-void* rig::HolderFunction(void* ptr) {
-  rig::ThreadPool::VarsTuple* vars = reinterpret_cast<rig::ThreadPool::VarsTuple*>(ptr);
+namespace {
+  // How many tasks per worker may wait in the queues
+  const size_t kTasksPerThread = 4;
 
-  // Run the function
-  std::get<0>(*vars)();
-
-  // Set out boolean so someone can know they can delete this
-  std::get<3>(*vars) = true;
+  // The pool the current thread is a worker of, if any, and its index there
+  thread_local rig::ThreadPool const* tls_pool = NULL;
+  thread_local int tls_index = -1;
+}
 
-  // Signal that we are finished
-  pthread_mutex_lock(std::get<1>(*vars));
-  pthread_cond_signal(std::get<2>(*vars));
-  pthread_mutex_unlock(std::get<1>(*vars));
+rig::ThreadPool::ThreadPool() {
+  Start(FLAGS_num_threads);
+}
 
-  return NULL;
+rig::ThreadPool::ThreadPool(int num_threads) {
+  Start(num_threads);
 }
 
-rig::ThreadPool::ThreadPool()
-  : max_concurrent_jobs_(FLAGS_num_threads) {
-  pthread_mutex_init(&cond_mutex_, NULL);
-  pthread_cond_init(&cond_, NULL);
-  if (max_concurrent_jobs_ <= 0) {
+void rig::ThreadPool::Start(int num_threads) {
+  num_queued_ = 0;
+  num_unfinished_ = 0;
+  next_queue_ = 0;
+  stop_ = false;
+  if (num_threads <= 0) {
+    // The tasks will be run by the thread adding them
     LOG(ERROR) << "Thread pool without threads created...";
+    num_threads = 0;
   }
+  max_queued_ = kTasksPerThread * std::max(num_threads, 1);
+
+  for (int it = 0; it < num_threads; it++)
+    queues_.emplace_back(new Queue);
+  for (int it = 0; it < num_threads; it++)
+    threads_.emplace_back(&rig::ThreadPool::WorkerLoop, this, it);
 }
 
 rig::ThreadPool::~ThreadPool() {
   Join();
-  pthread_cond_destroy(&cond_);
-  pthread_mutex_destroy(&cond_mutex_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cond_.notify_all();
+  for (size_t it = 0; it < threads_.size(); it++)
+    threads_[it].join();
 }
 
-void rig::ThreadPool::Join() {
-  while (threads_.size()) {
-    pthread_join(threads_.front(), NULL);
-    threads_.pop_front();
-    var_bindings_.pop_front();
-  }
+bool rig::ThreadPool::InWorker() const {
+  return tls_pool == this;
 }
 
-void rig::ThreadPool::WaitTillJobOpening() {
-  while (threads_.size() >= max_concurrent_jobs_) {
-    // Wait for a condition event to signal a free job or time out
-    // after one second. I do a time out because somehow I still have
-    // a deadlock. I think it occurs if a task just finishes faster
-    // than we can get back into a state to wait for condition.
-    pthread_mutex_lock(&cond_mutex_);
-    struct timeval tv;
-    struct timespec ts;
-    gettimeofday(&tv, NULL);
-    ts.tv_sec = tv.tv_sec + 1;
-    ts.tv_nsec = 0;
-    pthread_cond_timedwait(&cond_, &cond_mutex_, &ts);
-    pthread_mutex_unlock(&cond_mutex_);
-
-    // Iterate through and clean out all the finished jobs
-    std::list<pthread_t>::iterator thread_it = threads_.begin();
-    std::list<VarsTuple>::iterator vars_it = var_bindings_.begin();
-    while (thread_it != threads_.end()) {
-      if (std::get<3>(*vars_it)) {
-        // Thread says it has finished. Join.
-        pthread_join(*thread_it, NULL);
-        thread_it = threads_.erase(thread_it);
-        vars_it = var_bindings_.erase(vars_it);
-      } else {
-        thread_it++;
-        vars_it++;
+void rig::ThreadPool::Push(std::function<void()> task) {
+  if (threads_.empty()) {
+    task();
+    return;
+  }
+
+  bool in_worker = InWorker();
+  size_t queue_index = 0;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (in_worker) {
+      // A worker must not wait for the queues to drain, as it may be the
+      // one to drain them
+      if (num_queued_ >= long(max_queued_)) {
+        lock.unlock();
+        task();
+        return;
       }
+      queue_index = tls_index;
+    } else {
+      space_cond_.wait(lock, [this]{ return num_queued_ < long(max_queued_); });
+      queue_index = next_queue_;
+      next_queue_ = (next_queue_ + 1) % queues_.size();
     }
+    num_queued_++;
+    num_unfinished_++;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(queues_[queue_index]->mutex);
+    queues_[queue_index]->tasks.push_back(std::move(task));
+  }
+  work_cond_.notify_one();
+}
+
+bool rig::ThreadPool::PopOrSteal(int self, std::function<void()> & task) {
+  bool found = false;
+
+  // The newest task of this worker, as its data is likely still in the cache
+  if (self >= 0) {
+    Queue & queue = *queues_[self];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      found = true;
+    }
+  }
+
+  // Else the oldest task of another worker
+  for (size_t it = 1; it <= queues_.size() && !found; it++) {
+    Queue & queue = *queues_[(self + it) % queues_.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      found = true;
+    }
+  }
+
+  if (found) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      num_queued_--;
+    }
+    space_cond_.notify_one();
+  }
+
+  return found;
+}
+
+void rig::ThreadPool::Run(std::function<void()> & task) {
+  task();
+  task = std::function<void()>(); // release the arguments before reporting
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  num_unfinished_--;
+  if (num_unfinished_ == 0)
+    done_cond_.notify_all();
+}
+
+bool rig::ThreadPool::RunPendingTask() {
+  std::function<void()> task;
+  if (!PopOrSteal(InWorker() ? tls_index : -1, task))
+    return false;
+  Run(task);
+  return true;
+}
+
+void rig::ThreadPool::WorkerLoop(int self) {
+  tls_pool = this;
+  tls_index = self;
+
+  while (1) {
+    std::function<void()> task;
+    if (PopOrSteal(self, task)) {
+      Run(task);
+      continue;
+    }
+
+    // A task counted here may not be in a queue yet, in which case this
+    // will look again shortly
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_cond_.wait(lock, [this]{ return stop_ || num_queued_ > 0; });
+    if (stop_ && num_queued_ <= 0)
+      return;
+  }
+}
+
+void rig::ThreadPool::Join() {
+  if (InWorker())
+    LOG(FATAL) << "A task cannot wait for the pool running it. Use a TaskGroup.";
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cond_.wait(lock, [this]{ return num_unfinished_ == 0; });
+}
+
+rig::TaskGroup::TaskGroup(ThreadPool & pool): pool_(pool), num_unfinished_(0) {}
+
+rig::TaskGroup::~TaskGroup() {
+  Wait();
+}
+
+void rig::TaskGroup::Done() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  num_unfinished_--;
+  if (num_unfinished_ == 0)
+    done_cond_.notify_all();
+}
+
+void rig::TaskGroup::Wait() {
+  bool in_worker = pool_.InWorker();
+  while (1) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (num_unfinished_ == 0)
+        return;
+    }
+
+    // Help with the waiting tasks, which may include those of this group
+    if (pool_.RunPendingTask())
+      continue;
+
+    // The tasks of this group are being run. If this is a worker, new tasks
+    // may be added that only it can run if all other workers wait as well,
+    // so look again soon.
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (in_worker)
+      done_cond_.wait_for(lock, std::chrono::milliseconds(1),
+                          [this]{ return num_unfinished_ == 0; });
+    else
+      done_cond_.wait(lock, [this]{ return num_unfinished_ == 0; });
   }
 }
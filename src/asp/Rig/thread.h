@@ -20,10 +20,15 @@
 #define RIG_CALIBRATOR_THREAD_H
 
 #include <gflags/gflags.h>
-#include <pthread.h>
 
-#include <list>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #define GOOGLE_ALLOW_RVALUE_REFERENCES_PUSH
 #define GOOGLE_ALLOW_RVALUE_REFERENCES_POP
@@ -32,14 +37,23 @@ GOOGLE_ALLOW_RVALUE_REFERENCES_PUSH
 
 namespace rig {
 
-  void* HolderFunction(void* ptr);
-
+  // A fixed set of worker threads, started once, that run the tasks given
+  // to the pool. Each worker has its own queue. A worker runs the newest
+  // task in its own queue first, and when that is empty it takes the
+  // oldest task from the queue of another worker. The number of tasks
+  // waiting to run is bounded, so adding a task blocks when the queues
+  // are full, which limits the memory used by the copies of the task
+  // arguments. A task added from within a worker when the queues are full
+  // is run right away instead.
   class ThreadPool {
    public:
-    typedef std::tuple<std::function<void(void)>, pthread_mutex_t*, pthread_cond_t*, bool> VarsTuple;
-
+    // Use --num_threads workers
     ThreadPool();
+    explicit ThreadPool(int num_threads);
+
+    // Wait for all tasks, then stop the workers
     ~ThreadPool();
+
     // The following identifies this thread as non copyable and non
     // moveable. Our threads are holding pointers to this exact
     // object.
@@ -47,8 +61,8 @@ namespace rig {
     ThreadPool& operator=(const ThreadPool&) = delete;
 
     // This pushes back a function and it's arguments to be
-    // executed. This method will block if the number of threads is
-    // already maxed. You can also push back mixed types of functions.
+    // executed. This method will block if the queues are full. You can
+    // also push back mixed types of functions.
     //
     // Example:
     // void Monkey(std::vector const& input, int val, std::vector * output);
@@ -59,28 +73,94 @@ namespace rig {
     // will be copied. Other alternatives are to use a pointer.
     template <typename Function, typename... Args>
     void AddTask(Function&& f, Args&&... args) {
-      WaitTillJobOpening();
-
-      // Bind up the function the user has given us
-      var_bindings_.emplace_back(std::bind(f, args...),
-                                 &cond_mutex_,
-                                 &cond_, false);
+      Push(std::bind(std::forward<Function>(f), std::forward<Args>(args)...));
+    }
 
-      // Create the thread and start doing work
-      threads_.push_back(pthread_t());
-      pthread_create(&threads_.back(), NULL, HolderFunction, &var_bindings_.back());
+    // Same as AddTask(), but return a future with the result of the
+    // function, or the exception it threw.
+    template <typename Function, typename... Args>
+    auto Submit(Function&& f, Args&&... args)
+      -> std::future<decltype(std::bind(f, args...)())> {
+      typedef decltype(std::bind(f, args...)()) Result;
+      auto task = std::make_shared<std::packaged_task<Result()>>
+        (std::bind(std::forward<Function>(f), std::forward<Args>(args)...));
+      std::future<Result> result = task->get_future();
+      Push([task]() { (*task)(); });
+      return result;
     }
 
+    // Wait until all tasks added so far are done. If called from a
+    // worker, run tasks while waiting, so that nothing deadlocks.
     void Join();
 
+    int NumThreads() const { return threads_.size(); }
+
+    // If the current thread is one of the workers of this pool
+    bool InWorker() const;
+
+    // Run one waiting task on the current thread, if there is any.
+    // Return false if there was none.
+    bool RunPendingTask();
+
+   private:
+    struct Queue {
+      std::mutex mutex;
+      std::deque<std::function<void()>> tasks;
+    };
+
+    void Start(int num_threads);
+    void Push(std::function<void()> task);
+    bool PopOrSteal(int self, std::function<void()> & task);
+    void Run(std::function<void()> & task);
+    void WorkerLoop(int self);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable work_cond_, space_cond_, done_cond_;
+    long num_queued_;      // tasks in the queues, may briefly be off by the ones being moved
+    long num_unfinished_;  // tasks added and not done yet
+    size_t max_queued_;
+    size_t next_queue_;    // where to put the next task added from outside the workers
+    bool stop_;
+  };
+
+  // A set of tasks run in a pool, which can be waited on without waiting
+  // for the other tasks in the pool.
+  class TaskGroup {
+   public:
+    explicit TaskGroup(ThreadPool & pool);
+
+    // Wait for the tasks in the group
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    // Same as ThreadPool::AddTask(), for a task in this group
+    template <typename Function, typename... Args>
+    void AddTask(Function&& f, Args&&... args) {
+      auto bound = std::bind(std::forward<Function>(f), std::forward<Args>(args)...);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        num_unfinished_++;
+      }
+      pool_.AddTask([this, bound]() mutable {
+        bound();
+        Done();
+      });
+    }
+
+    // Wait until the tasks in this group are done
+    void Wait();
+
    private:
-    void WaitTillJobOpening();
+    void Done();
 
-    size_t max_concurrent_jobs_;
-    std::list<pthread_t> threads_;
-    std::list<VarsTuple> var_bindings_;
-    pthread_mutex_t cond_mutex_;
-    pthread_cond_t cond_;
+    ThreadPool & pool_;
+    std::mutex mutex_;
+    std::condition_variable done_cond_;
+    long num_unfinished_;
   };
 
 }  // namespace rig
@@ -31,6 +31,10 @@
 #include <OpenMVG/tracks.hpp>
 #pragma GCC diagnostic pop
 
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <numeric>
 #include <set>
 #include <vector>
 #include <map>
@@ -100,4 +104,147 @@ void splitTracksOneToOne(// Inputs
   return;
 }
 
+void TrackStore::fromTracks(TrackT const& pid_to_cid_fid) {
+
+  size_t num_tracks = pid_to_cid_fid.size();
+  m_start.resize(num_tracks + 1);
+  m_start[0] = 0;
+  for (size_t pid = 0; pid < num_tracks; pid++)
+    m_start[pid + 1] = m_start[pid] + pid_to_cid_fid[pid].size();
+
+  size_t num_obs = m_start[num_tracks];
+  m_cid.resize(num_obs);
+  m_fid.resize(num_obs);
+  for (size_t pid = 0; pid < num_tracks; pid++) {
+    size_t obs = m_start[pid];
+    for (auto map_it = pid_to_cid_fid[pid].begin(); map_it != pid_to_cid_fid[pid].end();
+         map_it++) {
+      m_cid[obs] = map_it->first;
+      m_fid[obs] = map_it->second;
+      obs++;
+    }
+  }
+
+  buildIndex();
+}
+
+void TrackStore::toTracks(TrackT & pid_to_cid_fid) const {
+
+  pid_to_cid_fid.clear();
+  pid_to_cid_fid.resize(numTracks());
+  for (size_t pid = 0; pid < numTracks(); pid++) {
+    auto & cid_fid = pid_to_cid_fid[pid]; // alias
+    // The cid are in increasing order, so each insertion is at the end
+    for (size_t obs = trackBeg(pid); obs < trackEnd(pid); obs++)
+      cid_fid.emplace_hint(cid_fid.end(), m_cid[obs], m_fid[obs]);
+  }
+}
+
+void TrackStore::buildIndex() {
+
+  size_t num_obs = m_cid.size();
+  m_pid.resize(num_obs);
+  for (size_t pid = 0; pid < numTracks(); pid++)
+    std::fill(m_pid.begin() + m_start[pid], m_pid.begin() + m_start[pid + 1], int(pid));
+
+  // Count the observations in each image, then place them with a counting sort.
+  // Since the observations are visited in order, each image has them in
+  // increasing order of pid.
+  int max_cid = -1;
+  for (size_t obs = 0; obs < num_obs; obs++)
+    max_cid = std::max(max_cid, m_cid[obs]);
+  m_cam_start.assign(max_cid + 2, 0);
+  for (size_t obs = 0; obs < num_obs; obs++)
+    m_cam_start[m_cid[obs] + 1]++;
+  for (size_t cid = 0; cid + 1 < m_cam_start.size(); cid++)
+    m_cam_start[cid + 1] += m_cam_start[cid];
+
+  m_cam_obs.resize(num_obs);
+  std::vector<size_t> pos(m_cam_start.begin(), m_cam_start.end() - 1);
+  for (size_t obs = 0; obs < num_obs; obs++)
+    m_cam_obs[pos[m_cid[obs]]++] = obs;
+}
+
+void TrackStore::filter(std::vector<char> const& keep_obs, size_t min_track_size,
+                        std::vector<int> * old_pid) {
+
+  if (keep_obs.size() != numObs())
+    LOG(FATAL) << "Expecting as many flags as observations.\n";
+
+  if (old_pid != NULL)
+    old_pid->clear();
+
+  // Compact the arrays in place. The write position never passes the read one.
+  size_t num_tracks = numTracks(), num_kept_tracks = 0, out = 0;
+  for (size_t pid = 0; pid < num_tracks; pid++) {
+    size_t beg = m_start[pid], end = m_start[pid + 1], track_out = out;
+    for (size_t obs = beg; obs < end; obs++) {
+      if (!keep_obs[obs])
+        continue;
+      m_cid[out] = m_cid[obs];
+      m_fid[out] = m_fid[obs];
+      out++;
+    }
+
+    if (out - track_out < std::max<size_t>(min_track_size, 1)) {
+      out = track_out; // drop this track
+      continue;
+    }
+
+    if (old_pid != NULL)
+      old_pid->push_back(pid);
+    num_kept_tracks++;
+    m_start[num_kept_tracks] = out;
+  }
+
+  m_start.resize(num_kept_tracks + 1);
+  m_cid.resize(out);
+  m_fid.resize(out);
+  buildIndex();
+}
+
+void TrackStore::removeDuplicates() {
+
+  size_t num_tracks = numTracks();
+
+  // Compare the tracks as sequences of (cid, fid) pairs, as std::map does
+  auto compare = [this](size_t a, size_t b) -> int {
+    size_t ia = m_start[a], ea = m_start[a + 1];
+    size_t ib = m_start[b], eb = m_start[b + 1];
+    for (; ia < ea && ib < eb; ia++, ib++) {
+      if (m_cid[ia] != m_cid[ib])
+        return m_cid[ia] < m_cid[ib] ? -1 : 1;
+      if (m_fid[ia] != m_fid[ib])
+        return m_fid[ia] < m_fid[ib] ? -1 : 1;
+    }
+    if (ia == ea && ib == eb)
+      return 0;
+    return (ia == ea) ? -1 : 1;
+  };
+
+  std::vector<size_t> order(num_tracks);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [&compare](size_t a, size_t b) { return compare(a, b) < 0; });
+
+  // Copy the distinct tracks in sorted order
+  std::vector<size_t> start(1, 0);
+  std::vector<int> cid, fid;
+  cid.reserve(m_cid.size());
+  fid.reserve(m_fid.size());
+  for (size_t it = 0; it < num_tracks; it++) {
+    size_t pid = order[it];
+    if (it > 0 && compare(order[it - 1], pid) == 0)
+      continue;
+    cid.insert(cid.end(), m_cid.begin() + m_start[pid], m_cid.begin() + m_start[pid + 1]);
+    fid.insert(fid.end(), m_fid.begin() + m_start[pid], m_fid.begin() + m_start[pid + 1]);
+    start.push_back(cid.size());
+  }
+
+  m_start.swap(start);
+  m_cid.swap(cid);
+  m_fid.swap(fid);
+  buildIndex();
+}
+
 } // end namespace rig
@@ -19,6 +19,7 @@
 #ifndef RIG_CALIBRATOR_TRACKS_H_
 #define RIG_CALIBRATOR_TRACKS_H_
 
+#include <cstddef>
 #include <set>
 #include <vector>
 #include <map>
@@ -44,7 +45,62 @@ void splitTracksOneToOne(// Inputs
                          KeypointVecT                              & B_keypoint_vec, 
                          std::vector<rig::cameraImage>       & A_cams, 
                          std::vector<rig::cameraImage>       & B_cams);
-  
+
+// Tracks stored as flat arrays rather than as a vector of maps. The
+// observations (cid, fid) of track pid are at indices trackBeg(pid) up to
+// trackEnd(pid), in increasing order of cid, as in a std::map<int, int>.
+// The observations in each image are indexed as well, at indices camBeg(cid)
+// up to camEnd(cid) in camObs(). This takes less memory than a vector of maps,
+// and is traversed without chasing pointers.
+class TrackStore {
+public:
+  TrackStore(): m_start(1, 0) {}
+  explicit TrackStore(TrackT const& pid_to_cid_fid) { fromTracks(pid_to_cid_fid); }
+
+  // Conversion from and to the tracks as maps
+  void fromTracks(TrackT const& pid_to_cid_fid);
+  void toTracks(TrackT & pid_to_cid_fid) const;
+
+  size_t numTracks() const { return m_start.size() - 1; }
+  size_t numObs() const { return m_cid.size(); }
+  size_t numCams() const { return m_cam_start.empty() ? 0 : m_cam_start.size() - 1; }
+
+  size_t trackBeg(size_t pid) const { return m_start[pid]; }
+  size_t trackEnd(size_t pid) const { return m_start[pid + 1]; }
+  size_t trackSize(size_t pid) const { return m_start[pid + 1] - m_start[pid]; }
+
+  // The image, feature, and track of an observation
+  int cid(size_t obs) const { return m_cid[obs]; }
+  int fid(size_t obs) const { return m_fid[obs]; }
+  int pid(size_t obs) const { return m_pid[obs]; }
+
+  // The observations in an image, in increasing order of pid. Must have
+  // cid < numCams(). Later images have no observations.
+  size_t camBeg(int cid) const { return m_cam_start[cid]; }
+  size_t camEnd(int cid) const { return m_cam_start[cid + 1]; }
+  size_t camObs(size_t it) const { return m_cam_obs[it]; }
+
+  // Keep only the observations for which keep_obs is nonzero, and then only
+  // the tracks with at least min_track_size observations (and at least one).
+  // If old_pid is not null, it is set to the index before filtering of each
+  // kept track.
+  void filter(std::vector<char> const& keep_obs, size_t min_track_size,
+              std::vector<int> * old_pid = NULL);
+
+  // Remove repeated tracks. The tracks are left in lexicographic order, as
+  // when put in a std::set<std::map<int, int>>.
+  void removeDuplicates();
+
+private:
+  // Create the pid of each observation and the per-image index
+  void buildIndex();
+
+  std::vector<size_t> m_start;      // numTracks() + 1 values
+  std::vector<int>    m_cid, m_fid, m_pid;
+  std::vector<size_t> m_cam_start;  // numCams() + 1 values
+  std::vector<size_t> m_cam_obs;
+};
+
 }  // namespace rig
 
 #endif  // RIG_CALIBRATOR_TRACKS_H_
@@ -24,6 +24,7 @@
 #include <asp/IsisIO/Equation.h>
 #include <asp/IsisIO/IsisCameraModel.h>
 #include <asp/Camera/CsmModel.h>
+#include <asp/Camera/CsmModelFit.h>
 #include <asp/Camera/LinescanDGModel.h>
 #include <asp/Camera/LinescanSpotModel.h>
 #include <asp/Camera/LinescanPeruSatModel.h>
@@ -44,14 +45,18 @@
 #include <vw/Core/Stopwatch.h>
 
 #include <xercesc/util/PlatformUtils.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
+#include <atomic>
 #include <map>
 #include <utility>
 #include <string>
 #include <ostream>
 #include <limits>
 
+namespace fs = boost::filesystem;
+
 namespace asp {
 
 CameraModelLoader::CameraModelLoader() {
@@ -129,11 +134,103 @@ CameraModelLoader::load_ASTER_camera_model(std::string const& path) const {
   return vw::CamPtr(load_ASTER_camera_model_from_xml(path, rpc_model));
 }
 
+// How many ISIS cameras were loaded as exact ISIS models and as CSM fits.
+// See isisCamerasAreAllCsm().
+static std::atomic<int> g_num_exact_isis_cams(0), g_num_csm_fit_isis_cams(0);
+
+bool isisCamerasAreAllCsm() {
+  return g_num_csm_fit_isis_cams > 0 && g_num_exact_isis_cams == 0;
+}
+
+// The fitted CSM model for a cube is cached next to it
+std::string isisCsmFitFile(std::string const& cube_file) {
+  return fs::path(cube_file).replace_extension(".fitted_csm.json").string();
+}
+
+#if defined(ASP_HAVE_PKG_ISISIO) && ASP_HAVE_PKG_ISISIO == 1
+// Replace an ISIS linescan camera with a CSM model fit to it, if the fit
+// agrees with the ISIS camera to within the given number of pixels. Try the
+// cached fit first. Return NULL if no good fit was found.
+vw::CamPtr isisToCsm(std::string const& cube_file,
+                     boost::shared_ptr<vw::camera::IsisCameraModel> isis_cam,
+                     double max_pixel_error) {
+
+  if (isis_cam->isis_type() != "LineScan") {
+    vw::vw_out(vw::WarningMessage) << "Only ISIS linescan cameras can be converted "
+                                   << "to CSM. Using the ISIS camera for: "
+                                   << cube_file << "\n";
+    return vw::CamPtr();
+  }
+
+  // Keep the actual planet radii in the CSM model. StereoSessionIsis::get_datum()
+  // will produce the same datum from them as for the ISIS camera.
+  bool use_sphere_for_non_earth = false;
+  vw::cartography::Datum datum = isis_cam->get_datum_isis(use_sphere_for_non_earth);
+  vw::Vector2i image_size(isis_cam->samples(), isis_cam->lines());
+  int num_pixel_samples = 10000;
+
+  // Try the cached fit. It must be newer than the cube.
+  std::string fit_file = isisCsmFitFile(cube_file);
+  boost::system::error_code ec;
+  if (fs::exists(fit_file) &&
+      fs::last_write_time(fit_file, ec) >= fs::last_write_time(cube_file, ec)) {
+    try {
+      boost::shared_ptr<asp::CsmModel> csm_cam(new asp::CsmModel(fit_file));
+      double err = asp::csmFitPixelError(isis_cam, datum, image_size,
+                                         num_pixel_samples, *csm_cam);
+      if (err <= max_pixel_error)
+        return csm_cam;
+    } catch (std::exception const& e) {
+      vw::vw_out() << "Could not use the cached CSM model: " << fit_file 
+                   << ". " << e.what() << "\n";
+    }
+  }
+
+  vw::vw_out() << "Fitting a CSM linescan model to: " << cube_file << "\n";
+  boost::shared_ptr<asp::CsmModel> csm_cam(new asp::CsmModel);
+  int max_num_rows = 64, max_num_cols = 32;
+  asp::fitCsmLinescanToCamera(isis_cam, isis_cam->serial_number(), datum, image_size,
+                              max_num_rows, max_num_cols, *csm_cam);
+  double err = asp::csmFitPixelError(isis_cam, datum, image_size, num_pixel_samples,
+                                     *csm_cam);
+  vw::vw_out() << "Maximum disagreement of the fit with the ISIS camera: " 
+               << err << " pixels.\n";
+  if (!(err <= max_pixel_error)) {
+    vw::vw_out(vw::WarningMessage) << "The CSM fit is not accurate enough. Using the "
+                                   << "ISIS camera for: " << cube_file << "\n";
+    return vw::CamPtr();
+  }
+
+  // The cube directory may not be writable, and then the fit is just not cached
+  try {
+    csm_cam->saveState(fit_file);
+    vw::vw_out() << "Wrote: " << fit_file << "\n";
+  } catch (std::exception const& e) {
+    vw::vw_out(vw::WarningMessage) << "Could not cache the CSM fit: " << e.what() << "\n";
+  }
+
+  return csm_cam;
+}
+#endif
+
 // Load an ISIS camera model
 boost::shared_ptr<vw::camera::CameraModel>
 CameraModelLoader::load_isis_camera_model(std::string const& path) const {
 #if defined(ASP_HAVE_PKG_ISISIO) && ASP_HAVE_PKG_ISISIO == 1
-  return vw::CamPtr(new vw::camera::IsisCameraModel(path));
+  boost::shared_ptr<vw::camera::IsisCameraModel> isis_cam
+    (new vw::camera::IsisCameraModel(path, asp::stereo_settings().isis_camera_pool_size));
+
+  double max_pixel_error = asp::stereo_settings().isis_to_csm_max_pixel_error;
+  if (max_pixel_error > 0) {
+    vw::CamPtr csm_cam = isisToCsm(path, isis_cam, max_pixel_error);
+    if (csm_cam.get() != NULL) {
+      g_num_csm_fit_isis_cams++;
+      return csm_cam;
+    }
+  }
+
+  g_num_exact_isis_cams++;
+  return isis_cam;
 #endif
   // If ISIS was not enabled in the build, just throw an exception.
   vw::vw_throw(vw::NoImplErr()
@@ -50,6 +50,13 @@ namespace asp {
     vw::CamPtr load_csm_camera_model        (std::string const& path) const;
   }; // End class CameraModelLoader
 
+  // If all ISIS cameras loaded so far were replaced with CSM fits, so they can
+  // be used with multiple threads. See --isis-to-csm-max-pixel-error.
+  bool isisCamerasAreAllCsm();
+
+  // The file having the CSM model fit to an ISIS cube
+  std::string isisCsmFitFile(std::string const& cube_file);
+
   
 } // end namespace asp
 
@@ -23,7 +23,10 @@
 #include <asp/Core/BundleAdjustUtils.h>
 #include <asp/Camera/RPCModel.h>
 #include <asp/Core/AspStringUtils.h>
+#include <asp/Core/AlignedImageView.h>
 #include <asp/Sessions/CameraUtils.h>
+#include <asp/Camera/GridApproxCamera.h>
+#include <asp/Core/DemUtils.h>
 
 #include <vw/Core/Exception.h>
 #include <vw/Core/Log.h>
@@ -34,6 +37,7 @@
 #include <vw/Image/PixelTypeInfo.h>
 #include <vw/FileIO/DiskImageResource.h>
 #include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/DiskImageResourceGDAL.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Cartography/Map2CamTrans.h>
 #include <vw/FileIO/MatrixIO.h>
@@ -459,6 +463,10 @@ void StereoSession::preprocessing_hook(bool adjust_left_image_size,
   PixelMask<float>nodata_pix(0); nodata_pix.invalidate();
   ValueEdgeExtension<PixelMask<float>> ext_nodata(nodata_pix); 
   
+  // If the images are aligned with a homography, they are warped and
+  // normalized in one pass.
+  bool fused_alignment = false;
+  
   // Initialize alignment matrices and get the input image sizes.
   Matrix<double> align_left_matrix  = math::identity_matrix<3>(),
     align_right_matrix = math::identity_matrix<3>();
@@ -490,13 +498,9 @@ void StereoSession::preprocessing_hook(bool adjust_left_image_size,
                               // In-out
                               align_left_matrix, align_right_matrix, left_size, right_size);
     
-    // Apply the alignment transform to both input images
-    Limg = transform(left_masked_image,
-                     HomographyTransform(align_left_matrix),
-                     left_size.x(), left_size.y());
-    Rimg = transform(right_masked_image,
-                     HomographyTransform(align_right_matrix),
-                     right_size.x(), right_size.y());
+    // The alignment transform is applied below, together with the
+    // normalization
+    fused_alignment = true;
       
   } else {
     // No alignment, just provide the original files.
@@ -509,11 +513,26 @@ void StereoSession::preprocessing_hook(bool adjust_left_image_size,
   bool do_not_exceed_min_max = (this->name() == "isis" ||
                                 this->name() == "isismapisis");
   // TODO(oalexan1): Should one add above "csm" and "csmmapcsm" / "csmmaprpc"?
-  asp::normalize_images(stereo_settings().force_use_entire_range,
-                        stereo_settings().individually_normalize,
-                        use_percentile_stretch, 
-                        do_not_exceed_min_max,
-                        left_stats, right_stats, Limg, Rimg);
+  if (fused_alignment) {
+    double left_min, left_max, right_min, right_max;
+    asp::normalization_bounds(stereo_settings().force_use_entire_range,
+                              stereo_settings().individually_normalize,
+                              use_percentile_stretch, 
+                              do_not_exceed_min_max,
+                              left_stats, right_stats,
+                              left_min, left_max, right_min, right_max);
+    // The right image is padded with no-data to the size of the left one
+    Limg = asp::AlignedImageView(left_masked_image, align_left_matrix,
+                                 left_size, left_size, left_min, left_max);
+    Rimg = asp::AlignedImageView(right_masked_image, align_right_matrix,
+                                 right_size, left_size, right_min, right_max);
+  } else {
+    asp::normalize_images(stereo_settings().force_use_entire_range,
+                          stereo_settings().individually_normalize,
+                          use_percentile_stretch, 
+                          do_not_exceed_min_max,
+                          left_stats, right_stats, Limg, Rimg);
+  }
 
   if (stereo_settings().alignment_method == "local_epipolar") {
     // Save these stats for local epipolar alignment, as they will be used
@@ -651,6 +670,10 @@ shared_preprocessing_hook(vw::GdalWriteOptions & options,
   options = this->m_options;
   options.gdal_options["PREDICTOR"] = "1";
 
+  // Save half-precision floats. GDAL reads these as regular floats.
+  if (stereo_settings().compact_intermediates)
+    options.gdal_options["NBITS"] = "16";
+
   // Read the georef if available in the input images
   has_left_georef  = read_georeference(left_georef,  left_input_file);
   has_right_georef = read_georeference(right_georef, right_input_file);
@@ -1116,6 +1139,50 @@ getTransformFromMapProject(const std::string &input_dem_path,
                                    call_from_mapproject));
 }
 
+/// If the image was map-projected with an approximate camera, approximate
+/// the camera the same way over the image extent. Then undoing the map
+/// projection for each pixel interpolates in a table rather than calling
+/// the exact point_to_pixel(), which is slow for linescan cameras. Else
+/// return the camera as is.
+vw::CamPtr mapTransCamera(std::string const& input_dem_path,
+                          std::string const& img_file_path,
+                          vw::CamPtr map_proj_model_ptr) {
+
+  std::string approx_str;
+  boost::shared_ptr<vw::DiskImageResource>
+    rsrc(new vw::DiskImageResourceGDAL(img_file_path));
+  vw::cartography::read_header_string(*rsrc.get(), "APPROX_MAX_PIXEL_ERROR", approx_str);
+  double approx_max_pixel_error = atof(approx_str.c_str());
+  if (!(approx_max_pixel_error > 0))
+    return map_proj_model_ptr;
+
+  cartography::GeoReference dem_georef, image_georef;
+  if (!read_georeference(dem_georef, input_dem_path) ||
+      !read_georeference(image_georef, img_file_path))
+    return map_proj_model_ptr; // this is checked later
+
+  ImageViewRef<PixelMask<float>> dem;
+  DiskImageView<float> dem_disk_image(input_dem_path);
+  boost::shared_ptr<DiskImageResource> dem_rsrc(DiskImageResourcePtr(input_dem_path));
+  if (dem_rsrc->has_nodata_read())
+    dem = create_mask(dem_disk_image, dem_rsrc->nodata_read());
+  else
+    dem = pixel_cast<PixelMask<float>>(dem_disk_image);
+
+  BBox2 point_box
+    = image_georef.pixel_to_point_bbox(BBox2i(0, 0, rsrc->cols(), rsrc->rows()));
+  double min_height = 0.0, max_height = 0.0;
+  if (!asp::demHeightRange(dem, dem_georef, image_georef, point_box,
+                           min_height, max_height))
+    return map_proj_model_ptr;
+
+  vw_out() << "Undoing the map projection of " << img_file_path
+           << " with an approximate camera.\n";
+  return vw::CamPtr(new asp::GridApproxCameraModel(map_proj_model_ptr, image_georef,
+                                                   point_box, min_height, max_height,
+                                                   approx_max_pixel_error));
+}
+
 typename StereoSession::tx_type
 StereoSession::tx_left_homography() const {
   Matrix<double> tx = math::identity_matrix<3>();
@@ -1151,7 +1218,10 @@ StereoSession::tx_left_map_trans() const {
   if (!m_left_map_proj_model)
     vw_throw(ArgumentErr() << "Map projection model not loaded for image "
               << left_map_proj_image);
-  return getTransformFromMapProject(m_input_dem, left_map_proj_image, m_left_map_proj_model);
+  if (!m_left_map_trans_model)
+    m_left_map_trans_model = mapTransCamera(m_input_dem, left_map_proj_image,
+                                            m_left_map_proj_model);
+  return getTransformFromMapProject(m_input_dem, left_map_proj_image, m_left_map_trans_model);
 }
 typename StereoSession::tx_type
 StereoSession::tx_right_map_trans() const {
@@ -1159,7 +1229,11 @@ StereoSession::tx_right_map_trans() const {
   if (!m_right_map_proj_model)
     vw_throw(ArgumentErr() << "Map projection model not loaded for image "
               << right_map_proj_image);
-  return getTransformFromMapProject(m_input_dem, right_map_proj_image, m_right_map_proj_model);
+  if (!m_right_map_trans_model)
+    m_right_map_trans_model = mapTransCamera(m_input_dem, right_map_proj_image,
+                                             m_right_map_proj_model);
+  return getTransformFromMapProject(m_input_dem, right_map_proj_image,
+                                    m_right_map_trans_model);
 }
 
 // Load an RPC model. Any adjustment in ba_prefix and pixel_offset
@@ -1409,28 +1483,39 @@ vw::Vector6f gather_stats(vw::ImageViewRef<vw::PixelMask<float>> image,
         << "input.tif output.tif\n";
     }
 
-    // Compute statistics at a reduced resolution
-    const float TARGET_NUM_PIXELS = 1000000;
-    float num_pixels = float(image.cols())*float(image.rows());
-    int   stat_scale = int(ceil(sqrt(num_pixels / TARGET_NUM_PIXELS)));
-
-    vw_out(InfoMessage) << "Using downsample scale: " << stat_scale << std::endl;
-
-    ChannelAccumulator<vw::math::CDFAccumulator<float> > accumulator;
-    vw::TerminalProgressCallback tp("asp","\t  stats:  ");
-    if (block_size[0] >= block_size[1]) // Rows are long, so go row by row
-     for_each_pixel_rowwise(subsample(edge_extend(image, ConstantEdgeExtension()),
-                               stat_scale), accumulator, tp);
-    else // Columns are long, so go column by column
-     for_each_pixel_columnwise(subsample(edge_extend(image, ConstantEdgeExtension()),
-                                  stat_scale), accumulator, tp);
-
-    result[0] = accumulator.quantile(0); // Min
-    result[1] = accumulator.quantile(1); // Max
-    result[2] = accumulator.approximate_mean();
-    result[3] = accumulator.approximate_stddev();
-    result[4] = accumulator.quantile(0.02); // Percentile values
-    result[5] = accumulator.quantile(0.98);
+    // Estimate the statistics from a sample of windows, if desired
+    bool done = false;
+    if (stereo_settings().image_stats_accuracy > 0.0) {
+      done = asp::sample_image_stats(image, block_size,
+                                     stereo_settings().image_stats_accuracy, result);
+      if (!done)
+        vw_out(WarningMessage) << "No valid pixels in the sample. Using the whole image.\n";
+    }
+    
+    if (!done) {
+      // Compute statistics at a reduced resolution
+      const float TARGET_NUM_PIXELS = 1000000;
+      float num_pixels = float(image.cols())*float(image.rows());
+      int   stat_scale = int(ceil(sqrt(num_pixels / TARGET_NUM_PIXELS)));
+
+      vw_out(InfoMessage) << "Using downsample scale: " << stat_scale << std::endl;
+
+      ChannelAccumulator<vw::math::CDFAccumulator<float> > accumulator;
+      vw::TerminalProgressCallback tp("asp","\t  stats:  ");
+      if (block_size[0] >= block_size[1]) // Rows are long, so go row by row
+       for_each_pixel_rowwise(subsample(edge_extend(image, ConstantEdgeExtension()),
+                                 stat_scale), accumulator, tp);
+      else // Columns are long, so go column by column
+       for_each_pixel_columnwise(subsample(edge_extend(image, ConstantEdgeExtension()),
+                                    stat_scale), accumulator, tp);
+
+      result[0] = accumulator.quantile(0); // Min
+      result[1] = accumulator.quantile(1); // Max
+      result[2] = accumulator.approximate_mean();
+      result[3] = accumulator.approximate_stddev();
+      result[4] = accumulator.quantile(0.02); // Percentile values
+      result[5] = accumulator.quantile(0.98);
+    }
 
     // Cache the results to disk
     if (use_cache) {
@@ -227,6 +227,11 @@ namespace asp {
     /// - Not used in non map-projected sessions.
     boost::shared_ptr<vw::camera::CameraModel> m_left_map_proj_model, m_right_map_proj_model;
 
+    /// The cameras used to undo the map projection. These are approximations
+    /// of the cameras above if the images were map-projected that way.
+    /// Found when first needed.
+    mutable vw::CamPtr m_left_map_trans_model, m_right_map_trans_model;
+
   protected:
 
     // Factor out here all functionality shared among the preprocessing hooks
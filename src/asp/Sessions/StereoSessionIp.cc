@@ -125,10 +125,11 @@ bool StereoSession::ip_matching(std::string const& input_file1,
     return true;
   }
 
-  // If having to rebuild then wipe the old data
-  if (boost::filesystem::exists(left_ip_file)) 
+  // If having to rebuild then wipe the old data. Cached interest points
+  // are kept, as their file name changes when the image or settings do.
+  if (boost::filesystem::exists(left_ip_file) && !asp::is_ip_cache_file(left_ip_file)) 
     boost::filesystem::remove(left_ip_file);
-  if (boost::filesystem::exists(right_ip_file)) 
+  if (boost::filesystem::exists(right_ip_file) && !asp::is_ip_cache_file(right_ip_file)) 
     boost::filesystem::remove(right_ip_file);
   if (boost::filesystem::exists(match_filename)) {
     vw_out() << "Removing old match file: " << match_filename << "\n";
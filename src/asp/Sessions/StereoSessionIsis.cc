@@ -482,8 +482,10 @@ void StereoSessionIsis::preprocessing_hook(bool adjust_left_image_size,
                                 has_right_georef, right_georef);
 }
 
+// An ISIS camera can be used from multiple threads only if it has a pool of
+// instances (see IsisCameraModel), or if it was replaced with a CSM fit.
 bool StereoSessionIsis::supports_multi_threading () const {
-  return false;
+  return asp::stereo_settings().isis_camera_pool_size > 1 || asp::isisCamerasAreAllCsm();
 }
   
 // Only used with mask_flatfield option?
@@ -551,6 +553,21 @@ void StereoSessionIsis::pre_filtering_hook(std::string const& input_file,
 /// point this needs to change.
 vw::cartography::Datum StereoSessionIsis::get_datum(const vw::camera::CameraModel* cam,
                                                     bool use_sphere_for_non_earth) const {
+
+  // A CSM model fit to the ISIS camera. Make the datum as for ISIS.
+  const asp::CsmModel * csm_cam
+    = dynamic_cast<const asp::CsmModel*>(vw::camera::unadjusted_model(cam));
+  if (csm_cam != NULL) {
+    vw::Vector3 radii = csm_cam->target_radii();
+    double radius1 = (radii[0] + radii[1]) / 2; // average the x and y axes (semi-major)
+    double radius2 = radius1;
+    if (!use_sphere_for_non_earth)
+      radius2 = radii[2]; // the z radius (semi-minor axis)
+    std::string target_name = asp::read_target_name(m_left_image_file);
+    return vw::cartography::Datum("D_" + target_name, target_name,
+                                  "Reference Meridian", radius1, radius2, 0);
+  }
+  
   const IsisCameraModel * isis_cam
     = dynamic_cast<const IsisCameraModel*>(vw::camera::unadjusted_model(cam));
   VW_ASSERT(isis_cam != NULL, ArgumentErr() << "StereoSessionISIS: Invalid camera.\n");
@@ -0,0 +1,173 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file SfsBatch.cc
+/// Compute the SfS normals and reflectance for a whole DEM row at once
+
+#include <asp/Sfs/SfsBatch.h>
+
+#include <vw/Cartography/GeoReference.h>
+
+#include <cmath>
+
+using namespace vw;
+
+namespace asp {
+
+// Find the xyz coordinates of all grid points in a DEM row. Each grid
+// point is a neighbor of four others when computing normals, so doing
+// this once per row saves most of the geodetic conversions.
+void demRowToXyz(ImageView<double> const& dem,
+                 cartography::GeoReference const& geo,
+                 int row, Vec3Array & xyz) {
+
+  xyz.resize(dem.cols());
+  for (int col = 0; col < dem.cols(); col++) {
+    Vector2 lonlat = geo.pixel_to_lonlat(Vector2(col, row));
+    Vector3 lonlat3(lonlat(0), lonlat(1), dem(col, row));
+    xyz.set(col, geo.datum().geodetic_to_cartesian(lonlat3));
+  }
+}
+
+// The four-point centered normals at a DEM row, given the xyz coordinates
+// of that row and of the rows above (top) and below (bottom) it. The
+// normals point up. They are computed for all but the first and last
+// column, where they are set to zero.
+void demRowNormals(Vec3Array const& top, Vec3Array const& center,
+                   Vec3Array const& bottom, Vec3Array & normals) {
+
+  int num = center.size();
+  normals.resize(num);
+  if (num == 0)
+    return;
+
+  double const* cx = center.x.data(), *cy = center.y.data(), *cz = center.z.data();
+  double const* tx = top.x.data(),    *ty = top.y.data(),    *tz = top.z.data();
+  double const* bx = bottom.x.data(), *by = bottom.y.data(), *bz = bottom.z.data();
+  double * nx = normals.x.data(), *ny = normals.y.data(), *nz = normals.z.data();
+
+  nx[0]     = ny[0]     = nz[0]     = 0.0;
+  nx[num-1] = ny[num-1] = nz[num-1] = 0.0;
+  for (int col = 1; col < num - 1; col++) {
+    // dx = right - left, dy = bottom - top
+    double dx0 = cx[col+1] - cx[col-1], dx1 = cy[col+1] - cy[col-1], dx2 = cz[col+1] - cz[col-1];
+    double dy0 = bx[col] - tx[col],     dy1 = by[col] - ty[col],     dy2 = bz[col] - tz[col];
+
+    // Same as -normalize(cross_prod(dx, dy))
+    double n0 = dx1*dy2 - dx2*dy1;
+    double n1 = dx2*dy0 - dx0*dy2;
+    double n2 = dx0*dy1 - dx1*dy0;
+    double len = std::sqrt(n0*n0 + n1*n1 + n2*n2);
+    nx[col] = -(n0/len);
+    ny[col] = -(n1/len);
+    nz[col] = -(n2/len);
+  }
+}
+
+// The reflectance for one reflectance type. The type is known at compile
+// time, so there is no branching on it per point. The Lambertian model is
+// written out so that its loop is vectorized. The other models call the
+// per-point functions, so they give the same results as those.
+template <int ReflectanceType>
+void reflectanceKernel(GlobalParams const& global_params,
+                       Vector3 const& sunPosition,
+                       Vec3Array const& cameraPositions,
+                       Vec3Array const& xyz,
+                       Vec3Array const& normals,
+                       const double * reflectance_model_coeffs,
+                       std::vector<double> & reflectance) {
+
+  int num = xyz.size();
+  reflectance.resize(num);
+
+  if constexpr (ReflectanceType == LAMBERT) {
+    double const* px = xyz.x.data(), *py = xyz.y.data(), *pz = xyz.z.data();
+    double const* nx = normals.x.data(), *ny = normals.y.data(), *nz = normals.z.data();
+    double * refl = reflectance.data();
+    double s0 = sunPosition[0], s1 = sunPosition[1], s2 = sunPosition[2];
+    for (int i = 0; i < num; i++) {
+      double d0 = s0 - px[i], d1 = s1 - py[i], d2 = s2 - pz[i];
+      double len = std::sqrt(d0*d0 + d1*d1 + d2*d2);
+      refl[i] = (d0/len)*nx[i] + (d1/len)*ny[i] + (d2/len)*nz[i];
+    }
+  } else if constexpr (ReflectanceType == NO_REFL) {
+    for (int i = 0; i < num; i++)
+      reflectance[i] = 1.0;
+  } else {
+    double phase_angle = 0.0; // not needed
+    for (int i = 0; i < num; i++) {
+      Vector3 cam = cameraPositions(i), pt = xyz(i), normal = normals(i);
+      double & refl = reflectance[i];
+      if constexpr (ReflectanceType == LUNAR_LAMBERT)
+        refl = computeLunarLambertianReflectanceFromNormal
+          (sunPosition, cam, pt, normal, global_params.phaseCoeffC1,
+           global_params.phaseCoeffC2, phase_angle, reflectance_model_coeffs);
+      else if constexpr (ReflectanceType == ARBITRARY_MODEL)
+        refl = computeArbitraryLambertianReflectanceFromNormal
+          (sunPosition, cam, pt, normal, global_params.phaseCoeffC1,
+           global_params.phaseCoeffC2, phase_angle, reflectance_model_coeffs);
+      else if constexpr (ReflectanceType == HAPKE)
+        refl = computeHapkeReflectanceFromNormal
+          (sunPosition, cam, pt, normal, global_params.phaseCoeffC1,
+           global_params.phaseCoeffC2, phase_angle, reflectance_model_coeffs);
+      else if constexpr (ReflectanceType == CHARON)
+        refl = computeCharonReflectanceFromNormal
+          (sunPosition, cam, pt, normal, global_params.phaseCoeffC1,
+           global_params.phaseCoeffC2, phase_angle, reflectance_model_coeffs);
+    }
+  }
+}
+
+// Compute the reflectance at many points. This agrees with calling
+// ComputeReflectance() for each point. The camera positions are not used
+// for the Lambertian model, as in ComputeReflectance().
+void computeReflectanceBatch(GlobalParams const& global_params,
+                             Vector3 const& sunPosition,
+                             Vec3Array const& cameraPositions,
+                             Vec3Array const& xyz,
+                             Vec3Array const& normals,
+                             const double * reflectance_model_coeffs,
+                             std::vector<double> & reflectance) {
+
+  switch (global_params.reflectanceType) {
+  case LAMBERT:
+    reflectanceKernel<LAMBERT>(global_params, sunPosition, cameraPositions, xyz,
+                               normals, reflectance_model_coeffs, reflectance);
+    break;
+  case LUNAR_LAMBERT:
+    reflectanceKernel<LUNAR_LAMBERT>(global_params, sunPosition, cameraPositions, xyz,
+                                     normals, reflectance_model_coeffs, reflectance);
+    break;
+  case ARBITRARY_MODEL:
+    reflectanceKernel<ARBITRARY_MODEL>(global_params, sunPosition, cameraPositions, xyz,
+                                       normals, reflectance_model_coeffs, reflectance);
+    break;
+  case HAPKE:
+    reflectanceKernel<HAPKE>(global_params, sunPosition, cameraPositions, xyz,
+                             normals, reflectance_model_coeffs, reflectance);
+    break;
+  case CHARON:
+    reflectanceKernel<CHARON>(global_params, sunPosition, cameraPositions, xyz,
+                              normals, reflectance_model_coeffs, reflectance);
+    break;
+  default:
+    reflectanceKernel<NO_REFL>(global_params, sunPosition, cameraPositions, xyz,
+                               normals, reflectance_model_coeffs, reflectance);
+  }
+}
+
+} // end namespace asp
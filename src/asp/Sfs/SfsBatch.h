@@ -0,0 +1,72 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file SfsBatch.h
+/// Compute the SfS normals and reflectance for a whole DEM row at once.
+/// The positions and normals are stored as one array per coordinate, so
+/// that the arithmetic loops can be vectorized by the compiler.
+
+#ifndef __SFS_BATCH_H__
+#define __SFS_BATCH_H__
+
+#include <asp/Sfs/SfsReflectanceModel.h>
+
+#include <vw/Image/ImageView.h>
+#include <vw/Math/Vector.h>
+
+#include <vector>
+
+namespace vw {
+  namespace cartography {
+    class GeoReference;
+  }
+}
+
+namespace asp {
+
+// 3D points or vectors, with one array per coordinate
+struct Vec3Array {
+  std::vector<double> x, y, z;
+
+  void resize(size_t num) { x.resize(num); y.resize(num); z.resize(num); }
+  size_t size() const { return x.size(); }
+
+  vw::Vector3 operator()(size_t i) const { return vw::Vector3(x[i], y[i], z[i]); }
+  void set(size_t i, vw::Vector3 const& v) { x[i] = v[0]; y[i] = v[1]; z[i] = v[2]; }
+};
+
+// See the .cc file for the documentation.
+void demRowToXyz(vw::ImageView<double> const& dem,
+                 vw::cartography::GeoReference const& geo,
+                 int row, Vec3Array & xyz);
+
+// See the .cc file for the documentation.
+void demRowNormals(Vec3Array const& top, Vec3Array const& center,
+                   Vec3Array const& bottom, Vec3Array & normals);
+
+// See the .cc file for the documentation.
+void computeReflectanceBatch(GlobalParams const& global_params,
+                             vw::Vector3 const& sunPosition,
+                             Vec3Array const& cameraPositions,
+                             Vec3Array const& xyz,
+                             Vec3Array const& normals,
+                             const double * reflectance_model_coeffs,
+                             std::vector<double> & reflectance);
+
+} // end namespace asp
+
+#endif // __SFS_BATCH_H__
@@ -0,0 +1,1204 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file SfsCamera.cc
+/// Approximate camera models for SfS
+
+#include <asp/Sfs/SfsCamera.h>
+#include <asp/Camera/RPCModel.h>
+#include <asp/Camera/RPCModelGen.h>
+#include <asp/IsisIO/IsisCameraModel.h>
+
+#include <vw/Core/Log.h>
+#include <vw/Core/ProgressCallback.h>
+#include <vw/Cartography/Datum.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+#include <vw/Image/Interpolation.h>
+#include <vw/Image/EdgeExtension.h>
+
+#include <boost/filesystem.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <unistd.h>
+
+using namespace vw;
+using namespace vw::camera;
+using namespace vw::cartography;
+namespace fs = boost::filesystem;
+
+namespace asp {
+
+int g_num_locks = 0;
+int g_warning_count = 0;
+int g_max_warning_count = 1000;
+
+namespace {
+
+// The directory for saved approximate camera tables. No caching if empty.
+std::string g_approx_cache_dir;
+
+const std::string APPROX_CACHE_MAGIC = "ASPSFSA1";
+
+// A 64-bit FNV-1a hash
+std::uint64_t fnvHash(const char* data, size_t len) {
+  std::uint64_t hash = 14695981039346656037ULL;
+  for (size_t it = 0; it < len; it++) {
+    hash ^= static_cast<unsigned char>(data[it]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+std::uint64_t fnvHash(std::string const& str) {
+  return fnvHash(str.data(), str.size());
+}
+
+std::string cacheFile(std::string const& key, std::string const& suffix) {
+  std::ostringstream os;
+  os << g_approx_cache_dir << "/approx-" << std::hex << std::setw(16)
+     << std::setfill('0') << fnvHash(key) << suffix;
+  return os.str();
+}
+
+// Describe a camera by where some pixels of its image box project. This
+// covers also any adjustments applied to it. Return false on failure.
+bool cameraFingerprint(CameraModel const& cam, BBox2i const& box, std::ostream & os) {
+  try {
+    Vector2 pixels[] = {Vector2(box.min()), Vector2(box.max()),
+                        Vector2(box.min().x(), box.max().y()),
+                        Vector2(box.max().x(), box.min().y()),
+                        (Vector2(box.min()) + Vector2(box.max()))/2.0};
+    os << cam.type() << '\n';
+    for (int it = 0; it < 5; it++)
+      os << cam.camera_center(pixels[it]) << ' ' << cam.pixel_to_vector(pixels[it]) << '\n';
+  } catch (...) {
+    return false;
+  }
+  return true;
+}
+
+void writeCacheString(std::ofstream & ofs, std::string const& str) {
+  std::uint64_t len = str.size();
+  ofs.write(reinterpret_cast<const char*>(&len), sizeof(len));
+  ofs.write(str.data(), len);
+}
+
+bool readCacheString(std::ifstream & ifs, std::string & str) {
+  std::uint64_t len = 0;
+  if (!ifs.read(reinterpret_cast<char*>(&len), sizeof(len)) || len > (1ULL << 30))
+    return false;
+  str.resize(len);
+  return bool(ifs.read(&str[0], len));
+}
+
+// Write to a temporary file unique to this process, then rename, so that a
+// partially written file is never read by another sfs run.
+void writeCacheFile(std::string const& file,
+                    std::function<void(std::ofstream&)> const& write_data) {
+  static std::atomic<int> count(0);
+  std::ostringstream os;
+  os << file << ".tmp" << getpid() << "_" << count++;
+  std::string tmp_file = os.str();
+  try {
+    fs::create_directories(fs::path(file).parent_path());
+    {
+      std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+      write_data(ofs);
+      if (!ofs)
+        vw_throw(IOErr() << "Failed writing: " << tmp_file);
+    }
+    fs::rename(tmp_file, file);
+  } catch (std::exception const& e) {
+    // The cache is only an optimization
+    vw_out(WarningMessage) << "Could not write the approximate camera cache file "
+                           << file << ". " << e.what() << "\n";
+    boost::system::error_code ec;
+    fs::remove(tmp_file, ec);
+  }
+}
+
+// One grid point of the approximate camera tables
+struct ApproxTableRecord {
+  double vec[3], pix[2];
+  std::uint8_t vec_valid, pix_valid, padding[6];
+};
+
+// The key for the tables of an approximate camera. It has everything the
+// tables depend on. Return an empty string if there is no caching.
+std::string approxTableKey(std::string const& type, CameraModel const& cam,
+                           BBox2i const& img_bbox, GeoReference const& geo,
+                           double mean_ht, BBox2 const& point_box,
+                           double gridx, double gridy, int numx, int numy) {
+  if (g_approx_cache_dir.empty())
+    return "";
+
+  std::ostringstream os;
+  os.precision(17);
+  os << type << '\n' << img_bbox << '\n' << geo.get_wkt() << '\n' << geo.transform() << '\n'
+     << mean_ht << ' ' << point_box << ' ' << gridx << ' ' << gridy << ' '
+     << numx << ' ' << numy << '\n';
+  if (!cameraFingerprint(cam, img_bbox, os))
+    return "";
+  return os.str();
+}
+
+// Read the tables, the mean direction, the number of valid entries, and the
+// crop box. The outputs are changed only on success.
+bool readApproxTables(std::string const& key, int numx, int numy,
+                      ImageView<PixelMask<Vector3>> & pixel_to_vec_mat,
+                      ImageView<PixelMask<Vector2>> & point_to_pix_mat,
+                      Vector3 & mean_dir, int & count, BBox2 & crop_box) {
+  if (key.empty())
+    return false;
+  std::string file = cacheFile(key, ".tbl");
+  if (!fs::exists(file))
+    return false;
+
+  try {
+    std::ifstream ifs(file.c_str(), std::ios::binary);
+    std::string magic, file_key;
+    std::int64_t cols = 0, rows = 0, num = 0;
+    double vals[7];
+    if (!readCacheString(ifs, magic) || magic != APPROX_CACHE_MAGIC ||
+        !readCacheString(ifs, file_key) || file_key != key ||
+        !ifs.read(reinterpret_cast<char*>(&cols), sizeof(cols)) ||
+        !ifs.read(reinterpret_cast<char*>(&rows), sizeof(rows)) ||
+        !ifs.read(reinterpret_cast<char*>(&num), sizeof(num)) ||
+        cols != numx || rows != numy ||
+        !ifs.read(reinterpret_cast<char*>(vals), sizeof(vals)))
+      return false;
+
+    std::vector<ApproxTableRecord> records(cols * rows);
+    if (!records.empty() &&
+        !ifs.read(reinterpret_cast<char*>(&records[0]),
+                  records.size() * sizeof(ApproxTableRecord)))
+      return false;
+
+    pixel_to_vec_mat.set_size(cols, rows);
+    point_to_pix_mat.set_size(cols, rows);
+    for (int x = 0; x < cols; x++) {
+      for (int y = 0; y < rows; y++) {
+        ApproxTableRecord const& R = records[x * rows + y];
+        pixel_to_vec_mat(x, y) = Vector3(R.vec[0], R.vec[1], R.vec[2]);
+        point_to_pix_mat(x, y) = Vector2(R.pix[0], R.pix[1]);
+        if (R.vec_valid) pixel_to_vec_mat(x, y).validate();
+        else             pixel_to_vec_mat(x, y).invalidate();
+        if (R.pix_valid) point_to_pix_mat(x, y).validate();
+        else             point_to_pix_mat(x, y).invalidate();
+      }
+    }
+    mean_dir = Vector3(vals[0], vals[1], vals[2]);
+    crop_box = BBox2(Vector2(vals[3], vals[4]), Vector2(vals[5], vals[6]));
+    count = num;
+  } catch (...) {
+    // A bad cache file is not an error. The tables will be computed.
+    return false;
+  }
+
+  vw_out() << "Read the approximate camera tables from: " << file << "\n";
+  return true;
+}
+
+void writeApproxTables(std::string const& key,
+                       ImageView<PixelMask<Vector3>> const& pixel_to_vec_mat,
+                       ImageView<PixelMask<Vector2>> const& point_to_pix_mat,
+                       Vector3 const& mean_dir, int count, BBox2 const& crop_box) {
+  if (key.empty())
+    return;
+
+  std::int64_t cols = pixel_to_vec_mat.cols(), rows = pixel_to_vec_mat.rows(), num = count;
+  std::vector<ApproxTableRecord> records(cols * rows);
+  for (int x = 0; x < cols; x++) {
+    for (int y = 0; y < rows; y++) {
+      ApproxTableRecord & R = records[x * rows + y];
+      std::memset(&R, 0, sizeof(R));
+      for (int c = 0; c < 3; c++)
+        R.vec[c] = pixel_to_vec_mat(x, y).child()[c];
+      for (int c = 0; c < 2; c++)
+        R.pix[c] = point_to_pix_mat(x, y).child()[c];
+      R.vec_valid = is_valid(pixel_to_vec_mat(x, y));
+      R.pix_valid = is_valid(point_to_pix_mat(x, y));
+    }
+  }
+  double vals[7] = {mean_dir[0], mean_dir[1], mean_dir[2],
+                    crop_box.min().x(), crop_box.min().y(),
+                    crop_box.max().x(), crop_box.max().y()};
+
+  writeCacheFile(cacheFile(key, ".tbl"), [&](std::ofstream & ofs) {
+      writeCacheString(ofs, APPROX_CACHE_MAGIC);
+      writeCacheString(ofs, key);
+      ofs.write(reinterpret_cast<const char*>(&cols), sizeof(cols));
+      ofs.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+      ofs.write(reinterpret_cast<const char*>(&num), sizeof(num));
+      ofs.write(reinterpret_cast<const char*>(vals), sizeof(vals));
+      if (!records.empty())
+        ofs.write(reinterpret_cast<const char*>(&records[0]),
+                  records.size() * sizeof(ApproxTableRecord));
+    });
+}
+
+} // end anonymous namespace
+
+void setApproxCameraCacheDir(std::string const& dir) {
+  g_approx_cache_dir = dir;
+}
+
+// The key for the check of an approximate camera against the exact one, over
+// the given DEM. The check depends on the tables, the DEM heights, and the
+// adjustments. Return an empty string if there is no caching.
+std::string approxCameraCheckKey(ApproxBaseCameraModel const& approx_cam,
+                                 AdjustedCameraModel const& exact_adjusted_camera,
+                                 ImageView<double> const& dem) {
+  if (approx_cam.cache_key().empty())
+    return "";
+
+  std::ostringstream os;
+  os.precision(17);
+  os << approx_cam.cache_key() << dem.cols() << ' ' << dem.rows() << '\n';
+  os << fnvHash(reinterpret_cast<const char*>(dem.data()),
+                dem.cols() * dem.rows() * sizeof(double)) << '\n';
+  if (!cameraFingerprint(exact_adjusted_camera, approx_cam.image_box(), os))
+    return "";
+  return os.str();
+}
+
+bool readApproxCameraCheck(std::string const& key, double & max_err, BBox2 & crop_box) {
+  if (key.empty())
+    return false;
+  std::string file = cacheFile(key, ".chk");
+  if (!fs::exists(file))
+    return false;
+
+  std::ifstream ifs(file.c_str(), std::ios::binary);
+  std::string magic, file_key;
+  double vals[5];
+  if (!readCacheString(ifs, magic) || magic != APPROX_CACHE_MAGIC ||
+      !readCacheString(ifs, file_key) || file_key != key ||
+      !ifs.read(reinterpret_cast<char*>(vals), sizeof(vals)))
+    return false;
+
+  max_err = vals[0];
+  crop_box = BBox2(Vector2(vals[1], vals[2]), Vector2(vals[3], vals[4]));
+  vw_out() << "Read the approximate camera check from: " << file << "\n";
+  return true;
+}
+
+void writeApproxCameraCheck(std::string const& key, double max_err, BBox2 const& crop_box) {
+  if (key.empty())
+    return;
+  double vals[5] = {max_err, crop_box.min().x(), crop_box.min().y(),
+                    crop_box.max().x(), crop_box.max().y()};
+  writeCacheFile(cacheFile(key, ".chk"), [&](std::ofstream & ofs) {
+      writeCacheString(ofs, APPROX_CACHE_MAGIC);
+      writeCacheString(ofs, key);
+      ofs.write(reinterpret_cast<const char*>(vals), sizeof(vals));
+    });
+}
+
+bool ApproxCameraModel::comp_rpc_approx_table(AdjustedCameraModel const& adj_camera,
+                                              boost::shared_ptr<CameraModel> exact_unadjusted_camera,
+                                              BBox2i img_bbox,
+                                              ImageView<double> const& dem,
+                                              GeoReference const& geo,
+                                              double rpc_penalty_weight){
+
+  try {
+    // Generate point pairs
+    std::vector<Vector3> all_llh;
+    std::vector<Vector2> all_pixels;
+
+    vw_out() << "Projecting pixels into the camera to generate the RPC model.\n";
+    vw::TerminalProgressCallback tpc("asp", "\t--> ");
+    double inc_amount = 1.0 / double(dem.cols());
+    tpc.report_progress(0);
+
+    // If the DEM is too big, we need to skip points. About
+    // 40,000 points should be good enough to determine 78 RPC
+    // coefficients.
+    double num = 200.0;
+    double delta_col = std::max(1.0, dem.cols()/double(num));
+    double delta_row = std::max(1.0, dem.rows()/double(num));
+    BBox3 llh_box;
+    BBox2 pixel_box;
+    for (double dcol = 0; dcol < dem.cols(); dcol += delta_col) {
+      for (double drow = 0; drow < dem.rows(); drow += delta_row) {
+        int col = dcol, row = drow; // cast to int
+        Vector2 pix(col, row);
+        Vector2 lonlat = geo.pixel_to_lonlat(pix);
+      
+        // Lon lat height
+        Vector3 llh;
+        llh[0] = lonlat[0]; llh[1] = lonlat[1]; llh[2] = dem(col, row);
+        Vector3 xyz = geo.datum().geodetic_to_cartesian(llh);
+
+        // Go back to llh. This is a bugfix for the 360 deg offset problem.
+        llh = geo.datum().cartesian_to_geodetic(xyz);
+      
+        Vector2 cam_pix = exact_unadjusted_camera->point_to_pixel(xyz);
+        //if (!m_img_bbox.contains(cam_pix)) 
+        //  continue; // skip out of range pixels? Not a good idea.
+     
+        if (m_img_bbox.contains(cam_pix)) 
+          m_crop_box.grow(cam_pix);
+
+        all_llh.push_back(llh);
+        all_pixels.push_back(cam_pix);
+
+        llh_box.grow(llh);
+        pixel_box.grow(cam_pix);
+      }
+
+      tpc.report_incremental_progress( inc_amount );
+    }
+    tpc.report_finished();
+  
+    BBox2 ll_box;
+    ll_box.min() = subvector(llh_box.min(), 0, 2);
+    ll_box.max() = subvector(llh_box.max(), 0, 2);
+
+    BBox2 cropped_pixel_box = pixel_box;
+    cropped_pixel_box.crop(m_img_bbox);
+    if (cropped_pixel_box.empty()) {
+      vw_out() << "No points fall into the camera.\n";
+      return false;
+    }
+
+    if (ll_box.empty()) {
+      vw_out() << "Empty lon-lat box.\n";
+      return false;
+    }
+
+    // This is a bugfix. The RPC approximation works best when the
+    // input llh points are in an llh box whose sides are vertical
+    // and horizontal, rather than in a box which is rotated.
+    vw_out() << "Re-projecting pixels into the camera to improve accuracy.\n";
+    vw::TerminalProgressCallback tpc2("asp", "\t--> ");
+    double inc_amount2 = 1.0 / double(num);
+    tpc2.report_progress(0);
+    llh_box = BBox3();
+    pixel_box = BBox2();
+    all_llh.clear();
+    all_pixels.clear();
+    ImageViewRef<double> interp_dem
+      = interpolate(dem, BicubicInterpolation(), ConstantEdgeExtension());
+    double delta_lon = (ll_box.max()[0] - ll_box.min()[0])/double(num);
+    double delta_lat = (ll_box.max()[1] - ll_box.min()[1])/double(num);
+    for (double lon = ll_box.min()[0]; lon <= ll_box.max()[0] + delta_lon; lon += delta_lon) {
+      for (double lat = ll_box.min()[1]; lat <= ll_box.max()[1] + delta_lat; lat += delta_lat) {
+
+        Vector2 pix = geo.lonlat_to_pixel(Vector2(lon, lat));
+        if (pix[0] < 0 || pix[0] > dem.cols()-1) continue;
+        if (pix[1] < 0 || pix[1] > dem.rows()-1) continue;
+        double ht = interp_dem(pix[0], pix[1]);
+
+        // Lon lat height
+        Vector3 llh;
+        llh[0] = lon; llh[1] = lat; llh[2] = ht;
+        Vector3 xyz = geo.datum().geodetic_to_cartesian(llh);
+
+        // Later we will project DEM points into the adjusted camera.
+        // That is the same as projecting adjusted points into the exact camera.
+        // Hence, develop the RPC approximation using adjusted points.
+        // TODO: Maybe we should also ensure that the unadjusted xyz is
+        // also part of the model building? But probably not, as usually
+        // adjustments change very little, and this will increase run-time by 2x.
+        xyz = adj_camera.adjusted_point(xyz);
+        
+        // Go back to llh. This is a bugfix for the 360 deg offset problem.
+        llh = geo.datum().cartesian_to_geodetic(xyz);
+
+        Vector2 cam_pix = exact_unadjusted_camera->point_to_pixel(xyz);
+        //if (!m_img_bbox.contains(cam_pix)) 
+        //  continue; // skip out of range pixels? Not a good idea.
+     
+        if (m_img_bbox.contains(cam_pix)) 
+          m_crop_box.grow(cam_pix);
+
+        all_llh.push_back(llh);
+        all_pixels.push_back(cam_pix);
+        
+        llh_box.grow(llh);
+        pixel_box.grow(cam_pix);
+      }
+      
+      tpc2.report_incremental_progress( inc_amount2 );
+    }
+    tpc2.report_finished();
+
+    cropped_pixel_box = pixel_box;
+    cropped_pixel_box.crop(m_img_bbox);
+    if (cropped_pixel_box.empty()) {
+      vw_out() << "No points fall into the camera.\n";
+      return false;
+    }
+
+    ll_box.min() = subvector(llh_box.min(), 0, 2);
+    ll_box.max() = subvector(llh_box.max(), 0, 2);
+    if (ll_box.empty()) {
+      vw_out() << "Empty lon-lat box.\n";
+      return false;
+    }
+    
+    Vector3 llh_scale  = (llh_box.max() - llh_box.min())/2.0; // half range
+    Vector3 llh_offset = (llh_box.max() + llh_box.min())/2.0; // center point
+  
+    Vector2 pixel_scale  = (pixel_box.max() - pixel_box.min())/2.0; // half range 
+    Vector2 pixel_offset = (pixel_box.max() + pixel_box.min())/2.0; // center point
+
+    // Ensure we never divide by zero. For example, if the input dem heights are all constant,
+    // then the height scale will be zero from above.
+    for (size_t i = 0; i < llh_scale.size(); i++) 
+      if (llh_scale[i] == 0) llh_scale[i] = 1;
+    for (size_t i = 0; i < pixel_scale.size(); i++) 
+      if (pixel_scale[i] == 0) pixel_scale[i] = 1;
+    
+    vw_out() << "Lon-lat-height box for the RPC approx: " << llh_box   << std::endl;
+    vw_out() << "Camera pixel box for the RPC approx:   " << pixel_box << std::endl;
+
+    Vector<double> normalized_llh;
+    Vector<double> normalized_pixels;
+    int num_total_pts = all_llh.size();
+    normalized_llh.set_size(asp::RPCModel::GEODETIC_COORD_SIZE*num_total_pts);
+    normalized_pixels.set_size(asp::RPCModel::IMAGE_COORD_SIZE*num_total_pts
+                               + asp::RpcSolveLMA::NUM_PENALTY_TERMS);
+    for (size_t i = 0; i < normalized_pixels.size(); i++) {
+      // Important: The extra penalty terms are all set to zero here.
+      normalized_pixels[i] = 0.0; 
+    }
+  
+    // Form the arrays of normalized pixels and normalized llh
+    for (int pt = 0; pt < num_total_pts; pt++) {
+
+      // Normalize the pixel to -1 <> 1 range
+      Vector3 llh_n   = elem_quot(all_llh[pt]    - llh_offset,   llh_scale);
+      Vector2 pixel_n = elem_quot(all_pixels[pt] - pixel_offset, pixel_scale);
+      subvector(normalized_llh, asp::RPCModel::GEODETIC_COORD_SIZE*pt,
+                asp::RPCModel::GEODETIC_COORD_SIZE) = llh_n;
+      subvector(normalized_pixels, asp::RPCModel::IMAGE_COORD_SIZE*pt,
+                asp::RPCModel::IMAGE_COORD_SIZE   ) = pixel_n;
+
+    }
+
+    // Find the RPC coefficients
+    asp::RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
+    std::string output_prefix = "";
+    vw_out() << "Generating the RPC approximation using " << num_total_pts << " point pairs.\n";
+    asp::gen_rpc(// Inputs
+                 rpc_penalty_weight, output_prefix,
+                 normalized_llh, normalized_pixels,  
+                 llh_scale, llh_offset, pixel_scale, pixel_offset,
+                 // Outputs
+                 line_num, line_den, samp_num, samp_den);
+  
+    m_rpc_model = boost::shared_ptr<asp::RPCModel>
+      (new asp::RPCModel(geo.datum(), line_num, line_den,
+                         samp_num, samp_den, pixel_offset, pixel_scale,
+                         llh_offset, llh_scale));
+  } catch (std::exception const& e) {
+    vw_out() << e.what() << std::endl;
+    return false;
+  }      
+  
+  return true;
+}
+
+void ApproxCameraModel::comp_entries_in_table() const{
+  for (int x = m_begX; x <= m_endX; x++) {
+    for (int y = m_begY; y <= m_endY; y++) {
+  
+      // This will be useful when we invoke this function repeatedly
+      if (m_point_to_pix_mat(x, y).child() != m_uncompValue) {
+        continue;
+      }
+  
+      Vector2 pt(m_point_box.min().x() + x*m_approx_table_gridx,
+                 m_point_box.min().y() + y*m_approx_table_gridy);
+      Vector2 lonlat = m_geo.point_to_lonlat(pt);
+      Vector3 xyz = m_geo.datum().geodetic_to_cartesian
+        (Vector3(lonlat[0], lonlat[1], m_mean_ht));
+      bool success = true;
+      Vector2 pix;
+      Vector3 vec;
+      try {
+        pix = m_exact_unadjusted_camera->point_to_pixel(xyz);
+        //if (true || m_img_bbox.contains(pix))  // Need to think more here
+        vec = m_exact_unadjusted_camera->pixel_to_vector(pix);
+        //else
+        // success = false;
+        
+      }catch(...){
+        success = false;
+      }
+      if (success) {
+        m_pixel_to_vec_mat(x, y) = vec;
+        m_point_to_pix_mat(x, y) = pix;
+        m_pixel_to_vec_mat(x, y).validate();
+        m_point_to_pix_mat(x, y).validate();
+        if (m_compute_mean) {
+          m_mean_dir += vec; // only when the point projects inside the camera?
+          if (m_img_bbox.contains(pix)) 
+            m_crop_box.grow(pix);
+          m_count++;
+        }
+      }else{
+        m_pixel_to_vec_mat(x, y).invalidate();
+        m_point_to_pix_mat(x, y).invalidate();
+      }
+    }
+  }
+  
+}
+
+ApproxCameraModel::ApproxCameraModel(AdjustedCameraModel const& exact_adjusted_camera,
+                                     boost::shared_ptr<CameraModel> exact_unadjusted_camera,
+                                     BBox2i img_bbox,
+                                     ImageView<double> const& dem,
+                                     GeoReference const& geo,
+                                     double nodata_val,
+                                     bool use_rpc_approximation, bool use_semi_approx,
+                                     double rpc_penalty_weight,
+                                     vw::Mutex &camera_mutex):
+  ApproxBaseCameraModel(exact_adjusted_camera, exact_unadjusted_camera, img_bbox),
+  m_geo(geo),
+  m_use_rpc_approximation(use_rpc_approximation),
+  m_use_semi_approx(use_semi_approx),
+  m_camera_mutex(camera_mutex) {
+
+  // Initialize members of the base class
+  m_model_is_valid = true;
+  
+  int big = 1e+8;
+  m_uncompValue = Vector2(-big, -big);
+  m_compute_mean = true; // We'll set this to false when we finish estimating the mean
+  m_stop_growing_range = false; // stop when it does not help
+  
+  if (dynamic_cast<IsisCameraModel*>(exact_unadjusted_camera.get()) == NULL)
+    vw_throw( ArgumentErr()
+              << "ApproxCameraModel: Expecting an unadjusted camera model.\n");
+
+  // Compute the mean DEM height.
+  // We expect all DEM entries to be valid.
+  m_mean_ht = 0;
+  double num = 0.0;
+  for (int col = 0; col < dem.cols(); col++) {
+    for (int row = 0; row < dem.rows(); row++) {
+      if (dem(col, row) == nodata_val)
+        vw_throw( ArgumentErr()
+                  << "ApproxCameraModel: Expecting a DEM without nodata values.\n");
+      m_mean_ht += dem(col, row);
+      num += 1.0;
+    }
+  }
+  if (num > 0) m_mean_ht /= num;
+
+  // The area we're supposed to work around
+  m_point_box = m_geo.pixel_to_point_bbox(bounding_box(dem));
+  double wx = m_point_box.width(), wy = m_point_box.height();
+  m_approx_table_gridx = wx/std::max(dem.cols(), 1);
+  m_approx_table_gridy = wy/std::max(dem.rows(), 1);
+
+  if (m_approx_table_gridx == 0 || m_approx_table_gridy == 0) {
+    vw_throw( ArgumentErr()
+              << "ApproxCameraModel: Expecting a positive grid size.\n");
+  }
+
+  // Expand the box, as later the DEM will change. 
+  double extra = 1.00; // may need to lower here!
+  m_point_box.min().x() -= extra*wx; m_point_box.max().x() += extra*wx;
+  m_point_box.min().y() -= extra*wy; m_point_box.max().y() += extra*wy;
+  wx = m_point_box.width();
+  wy = m_point_box.height();
+
+  vw_out() << "Approximation proj box: " << m_point_box << std::endl;
+
+  if (m_use_semi_approx)
+    return;
+  
+  // Bypass everything if doing RPC
+  if (m_use_rpc_approximation) {
+    m_model_is_valid = comp_rpc_approx_table(exact_adjusted_camera,
+                                             exact_unadjusted_camera, m_img_bbox,
+                                             dem,  geo, rpc_penalty_weight);
+    
+    // Ensure the box is valid
+    //if (m_crop_box.empty()) m_crop_box = BBox2(0, 0, 2, 2);
+
+#if 1
+    // Expand the box a bit, as later the DEM will change and values at some
+    // new pixels will be needed.
+    m_crop_box.crop(m_img_bbox);
+    if (!m_crop_box.empty()) {
+      double wd = m_crop_box.width();
+      double ht = m_crop_box.height();
+      m_crop_box.min().x() -= extra*wd; m_crop_box.max().x() += extra*wd;
+      m_crop_box.min().y() -= extra*ht; m_crop_box.max().y() += extra*ht;
+      m_crop_box = grow_bbox_to_int(m_crop_box);
+    }
+    m_crop_box.crop(m_img_bbox);
+#endif
+
+    return;
+  }
+  
+  // We will tabulate the point_to_pixel function at a multiple of
+  // the grid, and we'll use interpolation for anything in
+  // between.
+  //m_approx_table_gridx /= 2.0; m_approx_table_gridy /= 2.0; // fine
+  m_approx_table_gridx *= 2.0; m_approx_table_gridy *= 2.0; // coarse. good enough.
+
+  int numx = wx/m_approx_table_gridx;
+  int numy = wy/m_approx_table_gridy;
+
+  vw_out() << "Lookup table dimensions: " << numx << ' ' << numy << std::endl;
+
+  // Choose f so that the width from m_begX to m_endX is 2 x original wx
+  double f = 0; // (extra-0.5)/(2.0*extra+1.0);
+  m_begX = f*numx; m_endX = std::min((1.0-f)*numx, numx-1.0);
+  m_begY = f*numy; m_endY = std::min((1.0-f)*numy, numy-1.0);
+  
+  //vw_out() << "Size of actually pre-computed table: "
+  //           << m_endX - m_begX << ' ' << m_endY - m_begY << std::endl;
+  
+  // Mark all values as uncomputed and invalid
+  m_pixel_to_vec_mat.set_size(numx, numy);
+  m_point_to_pix_mat.set_size(numx, numy);
+  for (int x = 0; x < numx; x++) {
+    for (int y = 0; y < numy; y++) {
+      m_point_to_pix_mat(x, y) = m_uncompValue;
+      m_point_to_pix_mat(x, y).invalidate();
+    }
+  }
+  
+  // Fill in the table. Find along the way the mean direction from
+  // the camera to the ground. Invalid values will be masked.
+  // Use the saved tables if they were made the same way.
+  m_cache_key = approxTableKey("ApproxIsis", *m_exact_unadjusted_camera, m_img_bbox,
+                               m_geo, m_mean_ht, m_point_box,
+                               m_approx_table_gridx, m_approx_table_gridy, numx, numy);
+  if (!readApproxTables(m_cache_key, numx, numy, m_pixel_to_vec_mat, m_point_to_pix_mat,
+                        m_mean_dir, m_count, m_crop_box)) {
+    m_count = 0;
+    m_mean_dir = Vector3();
+    comp_entries_in_table();
+    m_mean_dir /= std::max(1, m_count);
+    m_mean_dir = m_mean_dir/norm_2(m_mean_dir);
+    writeApproxTables(m_cache_key, m_pixel_to_vec_mat, m_point_to_pix_mat,
+                      m_mean_dir, m_count, m_crop_box);
+  }
+  m_compute_mean = false; // done computing the mean
+  
+  // Ensure the box is valid
+  //if (m_crop_box.empty()) m_crop_box = BBox2(0, 0, 2, 2);
+
+#if 1
+  // Expansion should not be necessary, as we already expanded
+  // m_point_box and we used that expanded box to compute m_crop_box.
+  m_crop_box.crop(m_img_bbox);
+  if (!m_crop_box.empty()) {
+    // Expand the box a bit, as later the DEM will change and values at some
+    // new pixels will be needed.
+    double wd = m_crop_box.width();
+    double ht = m_crop_box.height();
+    double extra2 = 0.25; // still, just in case, a bit more expansion
+    m_crop_box.min().x() -= extra2*wd; m_crop_box.max().x() += extra2*wd;
+    m_crop_box.min().y() -= extra2*ht; m_crop_box.max().y() += extra2*ht;
+    m_crop_box = grow_bbox_to_int(m_crop_box);
+  }
+  m_crop_box.crop(m_img_bbox);
+#endif
+
+  return;
+}
+
+Vector2 ApproxCameraModel::point_to_pixel(Vector3 const& xyz) const{
+
+  if (m_use_semi_approx){
+    vw::Mutex::Lock lock(m_camera_mutex);
+    g_num_locks++;
+    return m_exact_unadjusted_camera->point_to_pixel(xyz);
+  }
+  
+  if (m_use_rpc_approximation) 
+    return m_rpc_model->point_to_pixel(xyz);
+  
+  // TODO: What happens if we use bicubic interpolation?
+  InterpolationView<EdgeExtensionView< ImageView< PixelMask<Vector3> >, ConstantEdgeExtension >, BilinearInterpolation> pixel_to_vec_interp
+    = interpolate(m_pixel_to_vec_mat, BilinearInterpolation(),
+                  ConstantEdgeExtension());
+
+  InterpolationView<EdgeExtensionView< ImageView< PixelMask<Vector2> >, ConstantEdgeExtension >, BilinearInterpolation> point_to_pix_interp
+    = interpolate(m_point_to_pix_mat, BilinearInterpolation(),
+                  ConstantEdgeExtension());
+
+  Vector3 dir = m_mean_dir;
+  Vector2 pix;
+  double major_radius = m_geo.datum().semi_major_axis() + m_mean_ht;
+  double minor_radius = m_geo.datum().semi_minor_axis() + m_mean_ht;
+  for (size_t i = 0; i < 10; i++) {
+
+    Vector3 S = xyz - 1.1*major_radius*dir; // push the point outside the sphere
+    if (norm_2(S) <= major_radius) {
+      // should not happen. Return the exact solution.
+      {
+        vw::Mutex::Lock lock(m_camera_mutex);
+        g_num_locks++;
+        if (g_warning_count < g_max_warning_count) {
+          g_warning_count++;
+          vw_out(WarningMessage) << "3D point is inside the planet.\n";
+        }
+        return m_exact_unadjusted_camera->point_to_pixel(xyz);
+      }
+    }
+
+    Vector3 datum_pt = datum_intersection(major_radius, minor_radius, S, dir);
+    Vector3 llh = m_geo.datum().cartesian_to_geodetic(datum_pt);
+    Vector2 pt = m_geo.lonlat_to_point(subvector(llh, 0, 2));
+
+    // Indices
+    double x = (pt.x() - m_point_box.min().x())/m_approx_table_gridx;
+    double y = (pt.y() - m_point_box.min().y())/m_approx_table_gridy;
+
+    bool out_of_range = ( x < 0 || x >= m_pixel_to_vec_mat.cols()-1 ||
+                          y < 0 || y >= m_pixel_to_vec_mat.rows()-1 );
+
+    bool out_of_comp_range = (x < m_begX || x >= m_endX-1 ||
+                              y < m_begY || y >= m_endY-1);
+
+    // If we are not out of range, but we need to expand the computed table, do that
+    if (!m_stop_growing_range && !out_of_range && out_of_comp_range) {
+      vw::Mutex::Lock lock(m_camera_mutex);
+      g_num_locks++;
+      if (g_warning_count < g_max_warning_count) {
+        g_warning_count++;
+        vw_out(WarningMessage) << "Pixel outside of computed range. "
+                               << "Growing the computed table." << std::endl;
+        vw_out(WarningMessage) << "Start table: " << m_begX << ' ' << m_begY << ' '
+                               << m_endX << ' ' << m_endY << std::endl;
+      }
+      
+      // If we have to expand, do it by a lot
+      int extrax = std::max(10, int(0.1*(m_endX - m_begX)));
+      int extray = std::max(10, int(0.1*(m_endY - m_begY)));
+
+      int old_begX = m_begX, old_begY = m_begY;
+      int old_endX = m_endX, old_endY = m_endY;
+
+      m_begX = std::min(m_begX, int(floor(x))) - extrax; m_begX = std::max(0, m_begX);
+      m_begY = std::min(m_begY, int(floor(y))) - extray; m_begY = std::max(0, m_begY);
+  
+      m_endX = std::max(m_endX, int(ceil(x))) + extrax;
+      m_endX = std::min(m_pixel_to_vec_mat.cols()-1, m_endX);
+
+      m_endY = std::max(m_endY, int(ceil(y))) + extray;
+      m_endY = std::min(m_pixel_to_vec_mat.rows()-1, m_endY);
+  
+      if (g_warning_count < g_max_warning_count) {
+        vw_out(WarningMessage) << "Updated table: " << m_begX << ' ' << m_begY << ' '
+                               << m_endX << ' ' << m_endY << std::endl;
+      }
+      comp_entries_in_table();
+
+      // Update this
+      out_of_comp_range = (x < m_begX || x >= m_endX-1 ||
+                           y < m_begY || y >= m_endY-1);
+
+      // Avoid an infinite loop if we can't grow the table
+      if (old_begX == m_begX && old_begY == m_begY &&
+          old_endX == m_endX && old_endY == m_endY ) {
+        m_stop_growing_range = true;
+      }
+    }
+
+    if (out_of_range || out_of_comp_range){
+      vw::Mutex::Lock lock(m_camera_mutex);
+      g_num_locks++;
+      if (g_warning_count < g_max_warning_count) {
+        g_warning_count++;
+        vw_out(WarningMessage) << "Pixel outside of range. Current values and range: "  << ' '
+                               << x << ' ' << y << ' '
+                               << m_pixel_to_vec_mat.cols() << ' ' << m_pixel_to_vec_mat.rows()
+                               << std::endl;
+      }
+      return m_exact_unadjusted_camera->point_to_pixel(xyz);
+    }
+    PixelMask<Vector3> masked_dir = pixel_to_vec_interp(x, y);
+    PixelMask<Vector2> masked_pix = point_to_pix_interp(x, y);
+
+    if (is_valid(masked_dir) && is_valid(masked_pix)) {
+      dir = masked_dir.child();
+      pix = masked_pix.child();
+    }else{
+      {
+        vw::Mutex::Lock lock(m_camera_mutex);
+        g_num_locks++;
+        if (g_warning_count < g_max_warning_count) {
+          g_warning_count++;
+          vw_out(WarningMessage) << "Invalid ground to camera direction: "
+                                 << masked_dir << ' ' << masked_pix << std::endl;
+        }
+        return m_exact_unadjusted_camera->point_to_pixel(xyz);
+      }
+    }
+  }
+
+  return pix;
+}
+
+Vector3 ApproxCameraModel::pixel_to_vector(Vector2 const& pix) const {
+
+  if (m_use_semi_approx) {
+    vw::Mutex::Lock lock(m_camera_mutex);
+    g_num_locks++;
+    return this->exact_unadjusted_camera()->pixel_to_vector(pix);
+  }
+
+  if (m_use_rpc_approximation){
+    return m_rpc_model->pixel_to_vector(pix);
+  }
+  
+  vw::Mutex::Lock lock(m_camera_mutex);
+  g_num_locks++;
+  if (g_warning_count < g_max_warning_count) {
+    g_warning_count++;
+    vw_out(WarningMessage) << "Invoked exact camera model pixel_to_vector for pixel: "
+                           << pix << std::endl;
+  }
+  return this->exact_unadjusted_camera()->pixel_to_vector(pix);
+}
+
+Vector3 ApproxCameraModel::camera_center(Vector2 const& pix) const{
+  // It is tricky to approximate the camera center
+  //if (m_use_rpc_approximation){
+  vw::Mutex::Lock lock(m_camera_mutex);
+  g_num_locks++;
+  //vw_out(WarningMessage) << "Invoked the camera center function for pixel: "
+  //                       << pix << std::endl;
+  return this->exact_unadjusted_camera()->camera_center(pix);
+  //return m_rpc_model->camera_center(pix);
+  //}
+
+#if 0
+  // TODO: Is this function invoked? Should just the underlying exact model
+  // camera center be used all the time?
+  InterpolationView<EdgeExtensionView< ImageView< PixelMask<Vector3> >, ConstantEdgeExtension >, BilinearInterpolation> camera_center_interp
+    = interpolate(m_camera_center_mat, BilinearInterpolation(),
+                  ConstantEdgeExtension());
+  double lx = pix[0] - m_crop_box.min().x();
+  double ly = pix[1] - m_crop_box.min().y();
+  if (0 <= lx && lx < m_camera_center_mat.cols() - 1 &&
+      0 <= ly && ly < m_camera_center_mat.rows() - 1 ) {
+    PixelMask<Vector3> ctr = camera_center_interp(lx, ly);
+    if (is_valid(ctr))
+      return ctr.child();
+  }
+#endif
+  
+  {
+    // Failed to interpolate
+    vw::Mutex::Lock lock(m_camera_mutex);
+    g_num_locks++;
+    if (g_warning_count < g_max_warning_count) {
+      g_warning_count++;
+      vw_out(WarningMessage) << "Invoked the camera center function for pixel: "
+                             << pix << std::endl;
+    }
+    return this->exact_unadjusted_camera()->camera_center(pix);
+  }
+
+}
+
+Quat ApproxCameraModel::camera_pose(Vector2 const& pix) const{
+  vw::Mutex::Lock lock(m_camera_mutex);
+  g_num_locks++;
+  if (g_warning_count < g_max_warning_count) {
+    g_warning_count++;
+    vw_out(WarningMessage) << "Invoked the camera pose function for pixel: "
+                           << pix << std::endl;
+  }
+  return this->exact_unadjusted_camera()->camera_pose(pix);
+}
+
+void ApproxAdjustedCameraModel::comp_entries_in_table() const{
+  for (int x = m_begX; x <= m_endX; x++) {
+    for (int y = m_begY; y <= m_endY; y++) {
+  
+      // This will be useful when we invoke this function repeatedly
+      if (m_point_to_pix_mat(x, y).child() != m_uncompValue) {
+        continue;
+      }
+  
+      Vector2 pt(m_point_box.min().x() + x*m_approx_table_gridx,
+                 m_point_box.min().y() + y*m_approx_table_gridy);
+      Vector2 lonlat = m_geo.point_to_lonlat(pt);
+      Vector3 xyz = m_geo.datum().geodetic_to_cartesian
+        (Vector3(lonlat[0], lonlat[1], m_mean_ht));
+      bool success = true;
+      Vector2 pix;
+      Vector3 vec;
+      try {
+        pix = m_exact_adjusted_camera.point_to_pixel(xyz);
+        //if (true || m_img_bbox.contains(pix))  // Need to think more here
+        vec = m_exact_adjusted_camera.pixel_to_vector(pix);
+        //else
+        // success = false;
+        
+      }catch(...){
+        success = false;
+      }
+      if (success) {
+        m_pixel_to_vec_mat(x, y) = vec;
+        m_point_to_pix_mat(x, y) = pix;
+        m_pixel_to_vec_mat(x, y).validate();
+        m_point_to_pix_mat(x, y).validate();
+        m_mean_dir += vec; // only when the point projects inside the camera?
+        if (m_img_bbox.contains(pix)) 
+          m_crop_box.grow(pix);
+        m_count++;
+      }else{
+        m_pixel_to_vec_mat(x, y).invalidate();
+        m_point_to_pix_mat(x, y).invalidate();
+      }
+    }
+  }
+  
+}
+
+ApproxAdjustedCameraModel::ApproxAdjustedCameraModel(AdjustedCameraModel const& exact_adjusted_camera,
+                                                     boost::shared_ptr<CameraModel> exact_unadjusted_camera,
+                                                     BBox2i img_bbox,
+                                                     ImageView<double> const& dem,
+                                                     GeoReference const& geo,
+                                                     double nodata_val,
+                                                     vw::Mutex &camera_mutex):
+  ApproxBaseCameraModel(exact_adjusted_camera, exact_unadjusted_camera, img_bbox),
+  m_geo(geo), m_camera_mutex(camera_mutex) {
+
+  // Initialize members of the base class
+  m_model_is_valid = true;
+
+  int big = 1e+8;
+  m_uncompValue = Vector2(-big, -big);
+  
+  if (dynamic_cast<AdjustedCameraModel*>(exact_unadjusted_camera.get()) != NULL)
+    vw_throw( ArgumentErr()
+              << "ApproxAdjustedCameraModel: Expecting an unadjusted camera model.\n");
+
+  // Compute the mean DEM height.
+  // We expect all DEM entries to be valid.
+  m_mean_ht = 0;
+  double num = 0.0;
+  for (int col = 0; col < dem.cols(); col++) {
+    for (int row = 0; row < dem.rows(); row++) {
+      if (dem(col, row) == nodata_val)
+        vw_throw( ArgumentErr()
+                  << "ApproxAdjustedCameraModel: Expecting a DEM without nodata values.\n");
+      m_mean_ht += dem(col, row);
+      num += 1.0;
+    }
+  }
+  if (num > 0) m_mean_ht /= num;
+
+  // The area we're supposed to work around
+  m_point_box = m_geo.pixel_to_point_bbox(bounding_box(dem));
+  double wx = m_point_box.width(), wy = m_point_box.height();
+  m_approx_table_gridx = wx/std::max(dem.cols(), 1);
+  m_approx_table_gridy = wy/std::max(dem.rows(), 1);
+
+  if (m_approx_table_gridx == 0 || m_approx_table_gridy == 0) {
+    vw_throw( ArgumentErr()
+              << "ApproxAdjustedCameraModel: Expecting a positive grid size.\n");
+  }
+
+  // Expand the box, as later the DEM will change. 
+  double extra = 0.5;
+  m_point_box.min().x() -= extra*wx; m_point_box.max().x() += extra*wx;
+  m_point_box.min().y() -= extra*wy; m_point_box.max().y() += extra*wy;
+  wx = m_point_box.width();
+  wy = m_point_box.height();
+
+  vw_out() << "Approximation proj box: " << m_point_box << std::endl;
+
+  // We will tabulate the point_to_pixel function at a multiple of
+  // the grid, and we'll use interpolation for anything in
+  // between.
+  //m_approx_table_gridx /= 2.0; m_approx_table_gridy /= 2.0; // fine
+  m_approx_table_gridx *= 2.0; m_approx_table_gridy *= 2.0; // Coarse. Good enough.
+
+  int numx = wx/m_approx_table_gridx;
+  int numy = wy/m_approx_table_gridy;
+
+  vw_out() << "Lookup table dimensions: " << numx << ' ' << numy << std::endl;
+
+  m_begX = 0; m_endX = numx-1;
+  m_begY = 0; m_endY = numy-1;
+  
+  //vw_out() << "Size of actually pre-computed table: "
+  //           << m_endX - m_begX << ' ' << m_endY - m_begY << std::endl;
+  
+  // Mark all values as uncomputed and invalid
+  m_pixel_to_vec_mat.set_size(numx, numy);
+  m_point_to_pix_mat.set_size(numx, numy);
+  for (int x = 0; x < numx; x++) {
+    for (int y = 0; y < numy; y++) {
+      m_point_to_pix_mat(x, y) = m_uncompValue;
+      m_point_to_pix_mat(x, y).invalidate();
+    }
+  }
+  
+  // Fill in the table. Find along the way the mean direction from
+  // the camera to the ground. Invalid values will be masked.
+  // Use the saved tables if they were made the same way.
+  m_cache_key = approxTableKey("ApproxAdjustedIsis", m_exact_adjusted_camera, m_img_bbox,
+                               m_geo, m_mean_ht, m_point_box,
+                               m_approx_table_gridx, m_approx_table_gridy, numx, numy);
+  if (!readApproxTables(m_cache_key, numx, numy, m_pixel_to_vec_mat, m_point_to_pix_mat,
+                        m_mean_dir, m_count, m_crop_box)) {
+    m_count = 0;
+    m_mean_dir = Vector3();
+    comp_entries_in_table();
+    m_mean_dir /= std::max(1, m_count);
+    m_mean_dir = m_mean_dir/norm_2(m_mean_dir);
+    writeApproxTables(m_cache_key, m_pixel_to_vec_mat, m_point_to_pix_mat,
+                      m_mean_dir, m_count, m_crop_box);
+  }
+  
+  m_crop_box.crop(m_img_bbox);
+
+  return;
+}
+
+Vector2 ApproxAdjustedCameraModel::point_to_pixel(Vector3 const& xyz) const{
+
+  // TODO: What happens if we use bicubic interpolation?
+  InterpolationView<EdgeExtensionView< ImageView< PixelMask<Vector3> >, ConstantEdgeExtension >, BilinearInterpolation> pixel_to_vec_interp
+    = interpolate(m_pixel_to_vec_mat, BilinearInterpolation(),
+                  ConstantEdgeExtension());
+
+  InterpolationView<EdgeExtensionView< ImageView< PixelMask<Vector2> >, ConstantEdgeExtension >, BilinearInterpolation> point_to_pix_interp
+    = interpolate(m_point_to_pix_mat, BilinearInterpolation(),
+                  ConstantEdgeExtension());
+
+  Vector3 dir = m_mean_dir;
+  Vector2 pix;
+  double major_radius = m_geo.datum().semi_major_axis() + m_mean_ht;
+  double minor_radius = m_geo.datum().semi_minor_axis() + m_mean_ht;
+  for (size_t i = 0; i < 10; i++) {
+
+    Vector3 S = xyz - 1.1*major_radius*dir; // push the point outside the sphere
+    if (norm_2(S) <= major_radius) {
+      // should not happen. Return the exact solution.
+      {
+        vw::Mutex::Lock lock(m_camera_mutex);
+        g_num_locks++;
+        if (g_warning_count < g_max_warning_count) {
+          g_warning_count++;
+          vw_out(WarningMessage) << "3D point is inside the planet.\n";
+        }
+        return m_exact_adjusted_camera.point_to_pixel(xyz);
+      }
+    }
+
+    Vector3 datum_pt = datum_intersection(major_radius, minor_radius, S, dir);
+    Vector3 llh = m_geo.datum().cartesian_to_geodetic(datum_pt);
+    Vector2 pt = m_geo.lonlat_to_point(subvector(llh, 0, 2));
+
+    // Indices
+    double x = (pt.x() - m_point_box.min().x())/m_approx_table_gridx;
+    double y = (pt.y() - m_point_box.min().y())/m_approx_table_gridy;
+
+    bool out_of_range = (x < m_begX || x >= m_endX-1 ||
+                         y < m_begY || y >= m_endY-1);
+
+    // If out of range, return the exact result. This should be very slow.
+    // The hope is that it will be very rare.
+    if (out_of_range){
+      vw::Mutex::Lock lock(m_camera_mutex);
+      g_num_locks++;
+      if (g_warning_count < g_max_warning_count) {
+        g_warning_count++;
+        vw_out(WarningMessage) << "Pixel outside of range. Current values and range: "  << ' '
+                               << x << ' ' << y << ' '
+                               << m_pixel_to_vec_mat.cols() << ' ' << m_pixel_to_vec_mat.rows()
+                               << std::endl;
+      }
+      return m_exact_adjusted_camera.point_to_pixel(xyz);
+    }
+    
+    PixelMask<Vector3> masked_dir = pixel_to_vec_interp(x, y);
+    PixelMask<Vector2> masked_pix = point_to_pix_interp(x, y);
+    if (is_valid(masked_dir) && is_valid(masked_pix)) {
+      dir = masked_dir.child();
+      pix = masked_pix.child();
+    }else{
+      {
+        vw::Mutex::Lock lock(m_camera_mutex);
+        g_num_locks++;
+        if (g_warning_count < g_max_warning_count) {
+          g_warning_count++;
+          vw_out(WarningMessage) << "Invalid ground to camera direction: "
+                                 << masked_dir << ' ' << masked_pix << std::endl;
+        }
+        return m_exact_adjusted_camera.point_to_pixel(xyz);
+      }
+    }
+  }
+
+  return pix;
+}
+
+Vector3 ApproxAdjustedCameraModel::pixel_to_vector(Vector2 const& pix) const {
+
+  vw::Mutex::Lock lock(m_camera_mutex);
+  g_num_locks++;
+  if (g_warning_count < g_max_warning_count) {
+    g_warning_count++;
+    vw_out(WarningMessage) << "Invoked exact camera model pixel_to_vector for pixel: "
+                           << pix << std::endl;
+  }
+  // TODO(oalexan1): Put here the exact adjusted camera!
+  return this->exact_unadjusted_camera()->pixel_to_vector(pix);
+}
+
+Vector3 ApproxAdjustedCameraModel::camera_center(Vector2 const& pix) const{
+  // It is tricky to approximate the camera center
+  // TODO(oalexan1): Must apply the adjustment here?
+  vw::Mutex::Lock lock(m_camera_mutex);
+  g_num_locks++;
+  // TODO(oalexan1): Put here the exact adjusted camera!
+  return this->exact_unadjusted_camera()->camera_center(pix);
+}
+
+Quat ApproxAdjustedCameraModel::camera_pose(Vector2 const& pix) const{
+  // TODO(oalexan1): Must apply the adjustment here?!!!
+  vw::Mutex::Lock lock(m_camera_mutex);
+  g_num_locks++;
+  if (g_warning_count < g_max_warning_count) {
+    g_warning_count++;
+    vw_out(WarningMessage) << "Invoked the camera pose function for pixel: "
+                           << pix << std::endl;
+  }
+  // TODO(oalexan1): Put here the exact adjusted camera!
+  return this->exact_unadjusted_camera()->camera_pose(pix);
+}
+
+} // end namespace asp
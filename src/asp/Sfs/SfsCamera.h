@@ -0,0 +1,228 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file SfsCamera.h
+/// Approximate camera models for SfS. These tabulate an exact camera
+/// around the current DEM, as evaluating ISIS cameras is slow.
+
+#ifndef __SFS_CAMERA_H__
+#define __SFS_CAMERA_H__
+
+#include <vw/Camera/CameraModel.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Core/Thread.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/BBox.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+
+namespace asp {
+
+class RPCModel;
+
+// Counters for how often the approximate cameras fall back to the exact
+// camera, which needs a lock. These are shared by all approximate cameras.
+extern int g_num_locks;
+extern int g_warning_count;
+extern int g_max_warning_count;
+
+// Save the tables of the approximate cameras created from now on in this
+// directory, and read them back when a later camera, in this or another
+// sfs run, is made the same way. No caching if the directory is empty.
+void setApproxCameraCacheDir(std::string const& dir);
+
+class ApproxBaseCameraModel;
+
+// See the .cc file for the documentation.
+std::string approxCameraCheckKey(ApproxBaseCameraModel const& approx_cam,
+                                 vw::camera::AdjustedCameraModel const& exact_adjusted_camera,
+                                 vw::ImageView<double> const& dem);
+
+// Save and read back the largest difference between an approximate
+// camera and the exact one, and the image box seen by the DEM, as found
+// by sfs. Do nothing if the key is empty.
+bool readApproxCameraCheck(std::string const& key, double & max_err, vw::BBox2 & crop_box);
+void writeApproxCameraCheck(std::string const& key, double max_err,
+                            vw::BBox2 const& crop_box);
+
+// A base approx camera model class that will factor out some functionality
+// from the two approx camera model classes we have below.
+class ApproxBaseCameraModel: public vw::camera::CameraModel {
+
+protected:
+  vw::BBox2i m_img_bbox;
+  mutable vw::BBox2 m_point_box, m_crop_box;
+  bool m_model_is_valid;
+  boost::shared_ptr<vw::camera::CameraModel> m_exact_unadjusted_camera;
+  vw::camera::AdjustedCameraModel m_exact_adjusted_camera;
+  std::string m_cache_key; // empty if the tables are not saved
+
+public:
+
+  ApproxBaseCameraModel(vw::camera::AdjustedCameraModel const& exact_adjusted_camera,
+                        boost::shared_ptr<vw::camera::CameraModel> exact_unadjusted_camera,
+                        vw::BBox2i img_bbox): m_exact_adjusted_camera(exact_adjusted_camera),
+                                              m_exact_unadjusted_camera(exact_unadjusted_camera),
+                                              m_img_bbox(img_bbox){}
+
+  // The range of pixels in the image we are actually expected to use.
+  // Note that the function returns an alias, so that we can modify the
+  // crop box from outside.
+  vw::BBox2 & crop_box(){
+    m_crop_box.crop(m_img_bbox);
+    return m_crop_box;
+  }
+
+  bool model_is_valid(){
+    return m_model_is_valid;
+  }
+
+  boost::shared_ptr<vw::camera::CameraModel> exact_unadjusted_camera() const{
+    return m_exact_unadjusted_camera;
+  }
+
+  vw::camera::AdjustedCameraModel exact_adjusted_camera() const{
+    return m_exact_adjusted_camera;
+  }
+
+  vw::BBox2i image_box() const{
+    return m_img_bbox;
+  }
+
+  // What the saved tables of this camera depend on
+  std::string const& cache_key() const{
+    return m_cache_key;
+  }
+
+};
+
+// This class provides an approximation for the point_to_pixel()
+// function of an ISIS camera around a current DEM. The algorithm
+// works by tabulation of point_to_pixel and pixel_to_vector values
+// at the mean dem height.
+class ApproxCameraModel: public ApproxBaseCameraModel {
+  mutable vw::Vector3 m_mean_dir; // mean vector from camera to ground
+  vw::cartography::GeoReference m_geo;
+  double m_mean_ht;
+  mutable vw::ImageView<vw::PixelMask<vw::Vector3>> m_pixel_to_vec_mat;
+  mutable vw::ImageView<vw::PixelMask<vw::Vector2>> m_point_to_pix_mat;
+  double m_approx_table_gridx, m_approx_table_gridy;
+  bool m_use_rpc_approximation, m_use_semi_approx;
+  vw::Mutex& m_camera_mutex;
+  vw::Vector2 m_uncompValue;
+  mutable int m_begX, m_endX, m_begY, m_endY;
+  mutable bool m_compute_mean, m_stop_growing_range;
+  mutable int m_count;
+  boost::shared_ptr<asp::RPCModel> m_rpc_model;
+
+  bool comp_rpc_approx_table(vw::camera::AdjustedCameraModel const& adj_camera,
+                             boost::shared_ptr<vw::camera::CameraModel> exact_unadjusted_camera,
+                             vw::BBox2i img_bbox,
+                             vw::ImageView<double> const& dem,
+                             vw::cartography::GeoReference const& geo,
+                             double rpc_penalty_weight);
+
+  void comp_entries_in_table() const;
+
+public:
+
+  ApproxCameraModel(vw::camera::AdjustedCameraModel const& exact_adjusted_camera,
+                    boost::shared_ptr<vw::camera::CameraModel> exact_unadjusted_camera,
+                    vw::BBox2i img_bbox,
+                    vw::ImageView<double> const& dem,
+                    vw::cartography::GeoReference const& geo,
+                    double nodata_val,
+                    bool use_rpc_approximation, bool use_semi_approx,
+                    double rpc_penalty_weight,
+                    vw::Mutex &camera_mutex);
+
+  // We have tabulated point_to_pixel at the mean dem height.
+  // Look-up point_to_pixel for the current point by first
+  // intersecting the ray from the current point to the camera
+  // with the datum at that height. We don't know that ray,
+  // so we iterate to find it.
+  virtual vw::Vector2 point_to_pixel(vw::Vector3 const& xyz) const;
+
+  virtual ~ApproxCameraModel(){}
+  virtual std::string type() const{ return "ApproxIsis"; }
+
+  virtual vw::Vector3 pixel_to_vector(vw::Vector2 const& pix) const;
+
+  virtual vw::Vector3 camera_center(vw::Vector2 const& pix) const;
+
+  virtual vw::Quat camera_pose(vw::Vector2 const& pix) const;
+
+};
+
+// TODO(oalexan1): Must use the adjusted model in the camera center
+// and camera pose functions!
+// This class provides an approximation for an adjusted ISIS camera
+// model around a current DEM. Unlike the ApproxCameraModel class,
+// here the adjusted camera is approximated, not the unadjusted one,
+// hence the adjustments and the cameras themselves cannot be
+// floated with this class. Keeping the cameras fixed allows the
+// domain of approximation to be narrower so using less memory. The
+// algorithm works by tabulation of point_to_pixel and
+// pixel_to_vector values at the mean dem height.
+class ApproxAdjustedCameraModel: public ApproxBaseCameraModel {
+  mutable vw::Vector3 m_mean_dir; // mean vector from camera to ground
+  vw::cartography::GeoReference m_geo;
+  double m_mean_ht;
+  mutable vw::ImageView<vw::PixelMask<vw::Vector3>> m_pixel_to_vec_mat;
+  mutable vw::ImageView<vw::PixelMask<vw::Vector2>> m_point_to_pix_mat;
+  double m_approx_table_gridx, m_approx_table_gridy;
+  vw::Mutex& m_camera_mutex;
+  vw::Vector2 m_uncompValue;
+  mutable int m_begX, m_endX, m_begY, m_endY;
+  mutable int m_count;
+
+  void comp_entries_in_table() const;
+
+public:
+
+  ApproxAdjustedCameraModel(vw::camera::AdjustedCameraModel const& exact_adjusted_camera,
+                            boost::shared_ptr<vw::camera::CameraModel> exact_unadjusted_camera,
+                            vw::BBox2i img_bbox,
+                            vw::ImageView<double> const& dem,
+                            vw::cartography::GeoReference const& geo,
+                            double nodata_val,
+                            vw::Mutex &camera_mutex);
+
+  // We have tabulated point_to_pixel at the mean dem height.
+  // Look-up point_to_pixel for the current point by first
+  // intersecting the ray from the current point to the camera
+  // with the datum at that height. We don't know that ray,
+  // so we iterate to find it.
+  virtual vw::Vector2 point_to_pixel(vw::Vector3 const& xyz) const;
+
+  virtual ~ApproxAdjustedCameraModel(){}
+  virtual std::string type() const{ return "ApproxAdjustedIsis"; }
+
+  virtual vw::Vector3 pixel_to_vector(vw::Vector2 const& pix) const;
+
+  virtual vw::Vector3 camera_center(vw::Vector2 const& pix) const;
+
+  virtual vw::Quat camera_pose(vw::Vector2 const& pix) const;
+
+};
+
+} // end namespace asp
+
+#endif // __SFS_CAMERA_H__
@@ -0,0 +1,116 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file SfsImageCache.cc
+/// A bounded in-memory cache of the image crops used by SfS
+
+#include <asp/Sfs/SfsImageCache.h>
+#include <asp/Sfs/SfsImageProc.h>
+
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
+
+#include <iomanip>
+#include <sstream>
+
+using namespace vw;
+
+namespace asp {
+
+SfsImageCache::SfsImageCache(double max_size_mb):
+  m_max_bytes(std::max(max_size_mb, 0.0) * 1024.0 * 1024.0),
+  m_bytes(0), m_num_hits(0), m_num_reads(0) {}
+
+ImageView<float> SfsImageCache::crop(std::string const& image_file, BBox2i const& box) {
+
+  // Any earlier crop of this image which contains the box will do. Move
+  // it to the front, as it was just used.
+  for (auto it = m_entries.begin(); it != m_entries.end(); it++) {
+    if (it->file != image_file || !it->params.empty() || !it->box.contains(box))
+      continue;
+
+    m_entries.splice(m_entries.begin(), m_entries, it);
+    m_num_hits++;
+    Entry const& entry = m_entries.front();
+    if (entry.box == box)
+      return entry.pixels;
+    BBox2i local(box.min() - entry.box.min(), box.max() - entry.box.min());
+    return vw::copy(vw::crop(entry.pixels, local));
+  }
+
+  m_num_reads++;
+  Entry entry;
+  entry.file   = image_file;
+  entry.box    = box;
+  entry.pixels = vw::crop(DiskImageView<float>(image_file), box);
+  entry.bytes  = sizeof(float) * size_t(box.width()) * size_t(box.height());
+  insert(entry);
+
+  return entry.pixels;
+}
+
+ImageView<double>
+SfsImageCache::blendingWeights(std::string const& image_file,
+                               BBox2i const& box,
+                               double min_valid, double max_valid,
+                               ImageViewRef<PixelMask<float>> const& masked_img,
+                               double blending_dist, double blending_power,
+                               int min_blend_size) {
+
+  // The weights depend on where the mask ends, so unlike for the
+  // pixels, only the same box and mask can be used.
+  std::ostringstream os;
+  os << std::setprecision(17) << min_valid << ' ' << max_valid << ' '
+     << blending_dist << ' ' << blending_power << ' ' << min_blend_size;
+  std::string params = os.str();
+
+  for (auto it = m_entries.begin(); it != m_entries.end(); it++) {
+    if (it->file != image_file || it->params != params || !(it->box == box))
+      continue;
+
+    m_entries.splice(m_entries.begin(), m_entries, it);
+    m_num_hits++;
+    return m_entries.front().weights;
+  }
+
+  Entry entry;
+  entry.file    = image_file;
+  entry.box     = box;
+  entry.params  = params;
+  entry.weights = asp::blendingWeights(masked_img, blending_dist, blending_power,
+                                       min_blend_size);
+  entry.bytes   = sizeof(double) * size_t(box.width()) * size_t(box.height());
+  insert(entry);
+
+  return entry.weights;
+}
+
+void SfsImageCache::insert(Entry const& entry) {
+
+  m_entries.push_front(entry);
+  m_bytes += entry.bytes;
+
+  // Drop the least recently used entries, but keep the one just added.
+  // Dropped data stays in memory as long as the caller still has it.
+  while (m_bytes > m_max_bytes && m_entries.size() > 1) {
+    m_bytes -= m_entries.back().bytes;
+    m_entries.pop_back();
+  }
+}
+
+} // end namespace asp
@@ -0,0 +1,81 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file SfsImageCache.h
+/// A bounded in-memory cache of the image crops used by SfS
+
+#ifndef __SFS_IMAGE_CACHE_H__
+#define __SFS_IMAGE_CACHE_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/BBox.h>
+
+#include <list>
+#include <string>
+
+namespace asp {
+
+// Keep the crops of the input images read from disk, and the blending
+// weights computed from them, so that a DEM clip which needs the same
+// part of an image, or a part of an earlier crop, does not read it from
+// disk again. The crops are made on first request, so only images which
+// see a clip are read. The least recently used entries are dropped when
+// the total size exceeds the given limit. The returned images share
+// memory with the cache and must not be modified.
+class SfsImageCache {
+public:
+
+  explicit SfsImageCache(double max_size_mb);
+
+  // The pixels of the given image in the given box
+  vw::ImageView<float> crop(std::string const& image_file, vw::BBox2i const& box);
+
+  // The blending weights of the image crop masked with the given range.
+  // See asp::blendingWeights().
+  vw::ImageView<double> blendingWeights(std::string const& image_file,
+                                        vw::BBox2i const& box,
+                                        double min_valid, double max_valid,
+                                        vw::ImageViewRef<vw::PixelMask<float>> const& masked_img,
+                                        double blending_dist, double blending_power,
+                                        int min_blend_size);
+
+  size_t num_hits() const { return m_num_hits; }
+  size_t num_reads() const { return m_num_reads; }
+
+private:
+
+  struct Entry {
+    std::string file;
+    vw::BBox2i box;
+    // Empty for pixel entries. For weights, the mask and blending parameters.
+    std::string params;
+    vw::ImageView<float> pixels;
+    vw::ImageView<double> weights;
+    size_t bytes;
+  };
+
+  void insert(Entry const& entry);
+
+  std::list<Entry> m_entries; // most recently used first
+  size_t m_max_bytes, m_bytes, m_num_hits, m_num_reads;
+};
+
+} // end namespace asp
+
+#endif // __SFS_IMAGE_CACHE_H__
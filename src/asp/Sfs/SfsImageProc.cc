@@ -18,7 +18,7 @@
 /// \file SfsImageProc.cc
 /// Image processing routines for SfS
 
-#include <asp/Core/SfsImageProc.h>
+#include <asp/Sfs/SfsImageProc.h>
 
 #include <vw/Core/Log.h>
 #include <vw/Camera/CameraModel.h>
@@ -448,27 +448,101 @@ bool isInShadow(int col, int row, Vector3 const& sunPos,
   return false;
 }
 
+// Find the points on a DEM which are shadowed by other points of the DEM.
+// This gives about the same result as isInShadow() at each point, but
+// rather than marching a ray for each point, sweep across the DEM one
+// line at a time, starting from the side facing the sun, and carry the
+// horizon which the terrain seen so far casts at the current line. The sun
+// is far, so the direction towards it in the DEM grid is found once, at
+// the DEM center. Each step moves by one grid point along the axis closer
+// to the sun direction, and by a fraction of a grid point along the other
+// one, with the horizon interpolated linearly in the previous line.
+// The shadow ray falls by the sun elevation and also by the curvature of
+// the planet, so the distance to the point casting the horizon is carried
+// as well. The cost is linear in the number of grid points.
 void areInShadow(Vector3 const& sunPos, ImageView<double> const& dem,
                  double gridx, double gridy,
                  cartography::GeoReference const& geo,
                  ImageView<float> & shadow){
 
-  // Find the max DEM height
-  double max_dem_height = -std::numeric_limits<double>::max();
-  for (int col = 0; col < dem.cols(); col++) {
-    for (int row = 0; row < dem.rows(); row++) {
-      if (dem(col, row) > max_dem_height) {
-        max_dem_height = dem(col, row);
-      }
+  int cols = dem.cols(), rows = dem.rows();
+  shadow.set_size(cols, rows);
+  for (int col = 0; col < cols; col++) {
+    for (int row = 0; row < rows; row++) {
+      shadow(col, row) = 0;
     }
   }
+  if (cols == 0 || rows == 0)
+    return;
+
+  // The direction to the sun at the DEM center, as in isInShadow()
+  Vector2 ctr_pix(cols/2, rows/2);
+  Vector2 ctr_ll = geo.pixel_to_lonlat(ctr_pix);
+  Vector3 xyz = geo.datum().geodetic_to_cartesian
+    (Vector3(ctr_ll[0], ctr_ll[1], dem(cols/2, rows/2)));
+  Vector3 dir = sunPos - xyz;
+  if (dir == Vector3())
+    return;
+  dir = dir/norm_2(dir);
+  Vector3 dir2 = dir - dot_prod(dir, xyz)*xyz/dot_prod(xyz, xyz);
+  double delta = 0.5*std::min(gridx, gridy)/std::max(norm_2(dir2), 1e-16);
 
-  shadow.set_size(dem.cols(), dem.rows());
-  for (int col = 0; col < dem.cols(); col++) {
-    for (int row = 0; row < dem.rows(); row++) {
-      shadow(col, row) = isInShadow(col, row, sunPos, dem,
-                                    max_dem_height, gridx, gridy, geo);
+  // Where a short move towards the sun lands in the DEM grid
+  Vector3 ray_llh = geo.datum().cartesian_to_geodetic(xyz + delta * dir);
+  ray_llh[0] += 360.0*round((ctr_ll[0] - ray_llh[0])/360.0);
+  Vector2 dpix = geo.lonlat_to_pixel(Vector2(ray_llh[0], ray_llh[1])) - ctr_pix;
+  double max_dpix = std::max(std::abs(dpix[0]), std::abs(dpix[1]));
+  if (max_dpix < 1e-8)
+    return; // the sun is overhead
+
+  // Per step, the rise of a ray going to the sun, and the square of the
+  // horizontal distance traveled, over twice the planet radius. The
+  // latter makes the ray rise more over the curved surface.
+  double rise = (ray_llh[2] - dem(cols/2, rows/2))/max_dpix;
+  double curv = pow(delta*norm_2(dir2)/max_dpix, 2.0)/(2.0*norm_2(xyz));
+
+  // Sweep lines are perpendicular to the axis along which the sun
+  // direction changes the most. Each step towards the sun changes the
+  // line by 'major' and the position in the line by 'minor'.
+  bool along_cols = (std::abs(dpix[0]) >= std::abs(dpix[1]));
+  int num_lines   = along_cols ? cols : rows;
+  int line_len    = along_cols ? rows : cols;
+  int major       = (along_cols ? dpix[0] : dpix[1]) > 0 ? 1 : -1;
+  double minor    = (along_cols ? dpix[1] : dpix[0])/max_dpix;
+
+  // The horizon height at each point of the previous and current line,
+  // and the distance, in steps, to the point casting it.
+  std::vector<double> prev_h(line_len), prev_d(line_len), curr_h(line_len), curr_d(line_len);
+  int first_line = (major > 0) ? num_lines - 1 : 0;
+  for (int line = first_line; line >= 0 && line < num_lines; line -= major) {
+    for (int pos = 0; pos < line_len; pos++) {
+      int col = along_cols ? line : pos;
+      int row = along_cols ? pos : line;
+      double h = dem(col, row);
+      curr_h[pos] = h;
+      curr_d[pos] = 0;
+
+      // The ray to the sun leaves the DEM, so this point is lit
+      double up = pos + minor;
+      if (line == first_line || up < 0 || up > line_len - 1)
+        continue;
+
+      int i0 = int(floor(up));
+      double w = up - i0;
+      int i1 = std::min(i0 + 1, line_len - 1);
+      double up_h = (1.0 - w) * prev_h[i0] + w * prev_h[i1];
+      double up_d = (1.0 - w) * prev_d[i0] + w * prev_d[i1];
+
+      // The horizon moved down by one step away from the sun
+      double horizon = up_h - rise - curv * (2.0 * up_d + 1.0);
+      if (horizon > h) {
+        shadow(col, row) = 1;
+        curr_h[pos] = horizon;
+        curr_d[pos] = up_d + 1.0;
+      }
     }
+    std::swap(prev_h, curr_h);
+    std::swap(prev_d, curr_d);
   }
 }
   
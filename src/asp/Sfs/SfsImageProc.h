@@ -59,6 +59,9 @@ bool isInShadow(int col, int row, vw::Vector3 const& sunPos,
                 double gridx, double gridy,
                 vw::cartography::GeoReference const& geo);
 
+// The same for all points of the DEM, sweeping it in the sun direction
+// and carrying the horizon. This is much faster than isInShadow() at each
+// point. See the .cc file for the details.
 void areInShadow(vw::Vector3 const& sunPos, vw::ImageView<double> const& dem,
                  double gridx, double gridy,
                  vw::cartography::GeoReference const& geo,
@@ -0,0 +1,463 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file SfsReflectanceModel.cc
+/// Reflectance models for SfS
+
+#include <asp/Sfs/SfsReflectanceModel.h>
+
+#include <vw/Core/Exception.h>
+#include <vw/Math/Vector.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+using namespace vw;
+
+namespace asp {
+
+// Make the reflectance nonlinear using a rational function
+double nonlin_reflectance(double reflectance, double exposure,
+                          double steepness_factor,
+                          double const* haze, int num_haze_coeffs){
+
+  // Make the exposure smaller. This will result in higher reflectance
+  // to compensate, as intensity = exposure * reflectance, hence
+  // steeper terrain. Things become more complicated if the haze
+  // and nonlinear reflectance is modeled.
+  exposure /= steepness_factor;
+  
+  double r = reflectance; // for short
+  if (num_haze_coeffs == 0) return (exposure*r);
+  if (num_haze_coeffs == 1) return (exposure*r + haze[0]);
+  if (num_haze_coeffs == 2) return (exposure*r + haze[0])/(haze[1]*r + 1);
+  if (num_haze_coeffs == 3) return (haze[2]*r*r + exposure*r + haze[0])/(haze[1]*r + 1);
+  if (num_haze_coeffs == 4) return (haze[2]*r*r + exposure*r + haze[0])/(haze[3]*r*r + haze[1]*r + 1);
+  if (num_haze_coeffs == 5) return (haze[4]*r*r*r + haze[2]*r*r + exposure*r + haze[0])/(haze[3]*r*r + haze[1]*r + 1);
+  if (num_haze_coeffs == 6) return (haze[4]*r*r*r + haze[2]*r*r + exposure*r + haze[0])/(haze[5]*r*r*r + haze[3]*r*r + haze[1]*r + 1);
+    
+  vw_throw(ArgumentErr() << "Invalid value for the number of haze coefficients.\n");
+  return 0;
+}
+
+// computes the Lambertian reflectance model (cosine of the light
+// direction and the normal to the Moon) Vector3 sunpos: the 3D
+// coordinates of the Sun relative to the center of the Moon Vector2
+// lon_lat is a 2D vector. First element is the longitude and the
+// second the latitude.
+//author Ara Nefian
+double
+computeLambertianReflectanceFromNormal(Vector3 sunPos, Vector3 xyz,
+                                       Vector3 normal) {
+  double reflectance;
+  Vector3 sunDirection = normalize(sunPos-xyz);
+
+  reflectance = sunDirection[0]*normal[0] + sunDirection[1]*normal[1] + sunDirection[2]*normal[2];
+
+  return reflectance;
+}
+
+
+double computeLunarLambertianReflectanceFromNormal(Vector3 const& sunPos,
+                                                   Vector3 const& viewPos,
+                                                   Vector3 const& xyz,
+                                                   Vector3 const& normal,
+                                                   double phaseCoeffC1,
+                                                   double phaseCoeffC2,
+                                                   double & alpha,
+                                                   const double * reflectance_model_coeffs) {
+  double reflectance;
+  double L;
+
+  double len = dot_prod(normal, normal);
+  if (abs(len - 1.0) > 1.0e-4){
+    std::cerr << "Error: Expecting unit normal in the reflectance computation, in "
+              << __FILE__ << " at line " << __LINE__ << std::endl;
+    exit(1);
+  }
+
+  //compute /mu_0 = cosine of the angle between the light direction and the surface normal.
+  //sun coordinates relative to the xyz point on the Moon surface
+  Vector3 sunDirection = normalize(sunPos-xyz);
+  double mu_0 = dot_prod(sunDirection, normal);
+
+  //double tol = 0.3;
+  //if (mu_0 < tol){
+  //  // Sun is too low, reflectance is too close to 0, the albedo will be inaccurate
+  //  return 0.0;
+  // }
+
+  //compute  /mu = cosine of the angle between the viewer direction and the surface normal.
+  //viewer coordinates relative to the xyz point on the Moon surface
+  Vector3 viewDirection = normalize(viewPos-xyz);
+  double mu = dot_prod(viewDirection,normal);
+
+  //compute the phase angle (alpha) between the viewing direction and the light source direction
+  double deg_alpha;
+  double cos_alpha;
+
+  cos_alpha = dot_prod(sunDirection, viewDirection);
+  if ((cos_alpha > 1)||(cos_alpha< -1)){
+    printf("cos_alpha error\n");
+  }
+
+  alpha     = acos(cos_alpha);  // phase angle in radians
+  deg_alpha = alpha*180.0/M_PI; // phase angle in degrees
+
+  //printf("deg_alpha = %f\n", deg_alpha);
+
+  //Bob Gaskell's model
+  //L = exp(-deg_alpha/60.0);
+
+  //Alfred McEwen's model
+  double O = reflectance_model_coeffs[0]; // 1
+  double A = reflectance_model_coeffs[1]; //-0.019;
+  double B = reflectance_model_coeffs[2]; // 0.000242;//0.242*1e-3;
+  double C = reflectance_model_coeffs[3]; // -0.00000146;//-1.46*1e-6;
+
+  L = O + A*deg_alpha + B*deg_alpha*deg_alpha + C*deg_alpha*deg_alpha*deg_alpha;
+ 
+  //printf(" deg_alpha = %f, L = %f\n", deg_alpha, L);
+
+  //if (mu_0 < 0.0){
+  //  return 0.0;
+  // }
+
+  //  if (mu < 0.0){ //emission angle is > 90
+  //  mu = 0.0;
+  //}
+
+  //if (mu_0 + mu == 0){
+  //  //printf("negative reflectance\n");
+  //  return 0.0;
+  //}
+  //else{
+  reflectance = 2*L*mu_0/(mu_0+mu) + (1-L)*mu_0;
+  //}
+  
+  //if (mu < 0 || mu_0 < 0 || mu_0 + mu <= 0 ||  reflectance <= 0 || reflectance != reflectance){
+  if (mu_0 + mu == 0 || reflectance != reflectance){
+    return 0.0;
+  }
+
+  // Attempt to compensate for points on the terrain being too bright
+  // if the sun is behind the spacecraft as seen from those points.
+
+  //reflectance *= std::max(0.4, exp(-alpha*alpha));
+  reflectance *= ( exp(-phaseCoeffC1*alpha) + phaseCoeffC2 );
+
+  return reflectance;
+}
+
+// Hapke's model.
+// See: An Experimental Study of Light Scattering by Large, Irregular Particles
+// Audrey F. McGuire, Bruce W. Hapke. 1995. The reflectance used is R(g), in equation
+// above Equation 21. The p(g) function is given by Equation (14), yet this one uses
+// an old convention. The updated p(g) is given in:
+// Spectrophotometric properties of materials observed by Pancam on the Mars Exploration Rovers: 1.
+// Spirit. JR Johnson, 2006.
+// We Use the two-term p(g), and the parameter c, not c'=1-c.
+// We also use the values of w(=omega), b, and c from that table.
+// Note that we use the updated Hapke model, having the term B(g). This one is given in
+// "Modeling spectral and bidirectional reflectance", Jacquemoud, 1992. It has the params
+// B0 and h.
+// The ultimate reference is probably Hapke, 1986, having all pieces in one place, but
+// that one is not available. 
+// We use mostly the parameter values for omega, b, c, B0 and h from:
+// Surface reflectance of Mars observed by CRISM/MRO: 2.
+// Estimation of surface photometric properties in Gusev Crater and Meridiani Planum by J. Fernando. 
+// See equations (1), (2) and (4) in that paper.
+// Example values for the params: w=omega=0.68, b=0.17, c=0.62, B0=0.52, h=0.52.
+// But we don't use equation (3) from that paper, we use instead what they call the formula H93,
+// which is the H(x) from McGuire and Hapke 1995 mentioned above.
+// See the complete formulas below.
+double computeHapkeReflectanceFromNormal(Vector3 const& sunPos,
+                                         Vector3 const& viewPos,
+                                         Vector3 const& xyz,
+                                         Vector3 const& normal,
+                                         double phaseCoeffC1,
+                                         double phaseCoeffC2,
+                                         double & alpha,
+                                         const double * reflectance_model_coeffs) {
+
+  double len = dot_prod(normal, normal);
+  if (abs(len - 1.0) > 1.0e-4){
+    std::cerr << "Error: Expecting unit normal in the reflectance computation, in "
+              << __FILE__ << " at line " << __LINE__ << std::endl;
+    exit(1);
+  }
+
+  //compute mu_0 = cosine of the angle between the light direction and the surface normal.
+  //sun coordinates relative to the xyz point on the Moon surface
+  Vector3 sunDirection = normalize(sunPos-xyz);
+  double mu_0 = dot_prod(sunDirection, normal);
+
+  //compute mu = cosine of the angle between the viewer direction and the surface normal.
+  //viewer coordinates relative to the xyz point on the Moon surface
+  Vector3 viewDirection = normalize(viewPos-xyz);
+  double mu = dot_prod(viewDirection,normal);
+
+  //compute the phase angle (g) between the viewing direction and the light source direction
+  // in radians
+  double cos_g = dot_prod(sunDirection, viewDirection);
+  double g = acos(cos_g);  // phase angle in radians
+
+  // Hapke params
+  double omega = std::abs(reflectance_model_coeffs[0]); // also known as w
+  double b     = std::abs(reflectance_model_coeffs[1]);
+  double c     = std::abs(reflectance_model_coeffs[2]);
+  // The older Hapke model lacks the B0 and h terms
+  double B0    = std::abs(reflectance_model_coeffs[3]);
+  double h     = std::abs(reflectance_model_coeffs[4]);   
+
+  double J = 1.0; // does not matter, we'll factor out the constant scale as camera exposures anyway
+  
+  // The P(g) term
+  double Pg 
+    = (1.0 - c) * (1.0 - b*b) / pow(1.0 + 2.0*b*cos_g + b*b, 1.5)
+    + c         * (1.0 - b*b) / pow(1.0 - 2.0*b*cos_g + b*b, 1.5);
+    
+  // The B(g) term
+  double Bg = B0 / ( 1.0 + (1.0/h)*tan(g/2.0) );
+
+  double H_mu0 = (1.0 + 2*mu_0) / (1.0 + 2*mu_0 * sqrt(1.0 - omega));
+  double H_mu  = (1.0 + 2*mu  ) / (1.0 + 2*mu   * sqrt(1.0 - omega));
+
+  // The reflectance
+  double R = (J*omega/4.0/M_PI) * ( mu_0/(mu_0+mu) ) * ( (1.0 + Bg)*Pg + H_mu0*H_mu - 1.0 );
+  
+  return R;
+}
+
+// Use the following model:
+// Reflectance = f(alpha) * A * mu_0 /(mu_0 + mu) + (1-A) * mu_0
+// The value of A is either 1 (the so-called lunar-model), or A=0.7.
+// f(alpha) = 0.63.
+double computeCharonReflectanceFromNormal(Vector3 const& sunPos,
+                                          Vector3 const& viewPos,
+                                          Vector3 const& xyz,
+                                          Vector3 const& normal,
+                                          double phaseCoeffC1,
+                                          double phaseCoeffC2,
+                                          double & alpha,
+                                          const double * reflectance_model_coeffs) {
+
+  double len = dot_prod(normal, normal);
+  if (abs(len - 1.0) > 1.0e-4){
+    std::cerr << "Error: Expecting unit normal in the reflectance computation, in "
+              << __FILE__ << " at line " << __LINE__ << std::endl;
+    exit(1);
+  }
+
+  //compute mu_0 = cosine of the angle between the light direction and the surface normal.
+  //sun coordinates relative to the xyz point on the Moon surface
+  Vector3 sunDirection = normalize(sunPos-xyz);
+  double mu_0 = dot_prod(sunDirection, normal);
+
+  //compute mu = cosine of the angle between the viewer direction and the surface normal.
+  //viewer coordinates relative to the xyz point on the Moon surface
+  Vector3 viewDirection = normalize(viewPos-xyz);
+  double mu = dot_prod(viewDirection,normal);
+
+  // Charon model params
+  double A       = std::abs(reflectance_model_coeffs[0]); // albedo 
+  double f_alpha = std::abs(reflectance_model_coeffs[1]); // phase function 
+
+  double reflectance = f_alpha*A*mu_0 / (mu_0 + mu) + (1.0 - A)*mu_0;
+  
+  if (mu_0 + mu == 0 || reflectance != reflectance){
+    return 0.0;
+  }
+
+  return reflectance;
+}
+
+double computeArbitraryLambertianReflectanceFromNormal(Vector3 const& sunPos,
+                                                       Vector3 const& viewPos,
+                                                       Vector3 const& xyz,
+                                                       Vector3 const& normal,
+                                                       double phaseCoeffC1,
+                                                       double phaseCoeffC2,
+                                                       double & alpha,
+                                                       const double * reflectance_model_coeffs) {
+  double reflectance;
+
+  double len = dot_prod(normal, normal);
+  if (abs(len - 1.0) > 1.0e-4){
+    std::cerr << "Error: Expecting unit normal in the reflectance computation, in "
+              << __FILE__ << " at line " << __LINE__ << std::endl;
+    exit(1);
+  }
+
+  //compute /mu_0 = cosine of the angle between the light direction and the surface normal.
+  //sun coordinates relative to the xyz point on the Moon surface
+  //Vector3 sunDirection = -normalize(sunPos-xyz);
+  Vector3 sunDirection = normalize(sunPos-xyz);
+  double mu_0 = dot_prod(sunDirection, normal);
+
+  //double tol = 0.3;
+  //if (mu_0 < tol){
+  //  // Sun is too low, reflectance is too close to 0, the albedo will be inaccurate
+  //  return 0.0;
+  // }
+
+  //compute  /mu = cosine of the angle between the viewer direction and the surface normal.
+  //viewer coordinates relative to the xyz point on the Moon surface
+  Vector3 viewDirection = normalize(viewPos-xyz);
+  double mu = dot_prod(viewDirection,normal);
+
+  //compute the phase angle (alpha) between the viewing direction and the light source direction
+  double deg_alpha;
+  double cos_alpha;
+
+  cos_alpha = dot_prod(sunDirection,viewDirection);
+  if ((cos_alpha > 1)||(cos_alpha< -1)){
+    printf("cos_alpha error\n");
+  }
+
+  alpha     = acos(cos_alpha);  // phase angle in radians
+  deg_alpha = alpha*180.0/M_PI; // phase angle in degrees
+
+  //printf("deg_alpha = %f\n", deg_alpha);
+
+  //Bob Gaskell's model
+  //L = exp(-deg_alpha/60.0);
+
+  //Alfred McEwen's model
+  double O1 = reflectance_model_coeffs[0]; // 1
+  double A1 = reflectance_model_coeffs[1]; // -0.019;
+  double B1 = reflectance_model_coeffs[2]; // 0.000242;//0.242*1e-3;
+  double C1 = reflectance_model_coeffs[3]; // -0.00000146;//-1.46*1e-6;
+  double D1 = reflectance_model_coeffs[4]; 
+  double E1 = reflectance_model_coeffs[5]; 
+  double F1 = reflectance_model_coeffs[6]; 
+  double G1 = reflectance_model_coeffs[7]; 
+
+  double O2 = reflectance_model_coeffs[8];  // 1
+  double A2 = reflectance_model_coeffs[9];  // -0.019;
+  double B2 = reflectance_model_coeffs[10]; // 0.000242;//0.242*1e-3;
+  double C2 = reflectance_model_coeffs[11]; // -0.00000146;//-1.46*1e-6;
+  double D2 = reflectance_model_coeffs[12]; 
+  double E2 = reflectance_model_coeffs[13]; 
+  double F2 = reflectance_model_coeffs[14]; 
+  double G2 = reflectance_model_coeffs[15]; 
+  
+  double L1 = O1 + A1*deg_alpha + B1*deg_alpha*deg_alpha + C1*deg_alpha*deg_alpha*deg_alpha;
+  double K1 = D1 + E1*deg_alpha + F1*deg_alpha*deg_alpha + G1*deg_alpha*deg_alpha*deg_alpha;
+  if (K1 == 0) K1 = 1;
+    
+  double L2 = O2 + A2*deg_alpha + B2*deg_alpha*deg_alpha + C2*deg_alpha*deg_alpha*deg_alpha;
+  double K2 = D2 + E2*deg_alpha + F2*deg_alpha*deg_alpha + G2*deg_alpha*deg_alpha*deg_alpha;
+  if (K2 == 0) K2 = 1;
+  
+  //printf(" deg_alpha = %f, L = %f\n", deg_alpha, L);
+
+  //if (mu_0 < 0.0){
+  //  return 0.0;
+  // }
+
+  //  if (mu < 0.0){ //emission angle is > 90
+  //  mu = 0.0;
+  //}
+
+  //if (mu_0 + mu == 0){
+  //  //printf("negative reflectance\n");
+  //  return 0.0;
+  //}
+  //else{
+  reflectance = 2*L1*mu_0/(mu_0+mu)/K1 + (1-L2)*mu_0/K2;
+  //}
+  
+  //if (mu < 0 || mu_0 < 0 || mu_0 + mu <= 0 ||  reflectance <= 0 || reflectance != reflectance){
+  if (mu_0 + mu == 0 || reflectance != reflectance){
+    return 0.0;
+  }
+
+  // Attempt to compensate for points on the terrain being too bright
+  // if the sun is behind the spacecraft as seen from those points.
+
+  //reflectance *= std::max(0.4, exp(-alpha*alpha));
+  reflectance *= ( exp(-phaseCoeffC1*alpha) + phaseCoeffC2 );
+
+  return reflectance;
+}
+
+double ComputeReflectance(Vector3 const& cameraPosition,
+                          Vector3 const& normal, Vector3 const& xyz,
+                          ModelParams const& input_img_params,
+                          GlobalParams const& global_params,
+                          double & phase_angle,
+                          const double * reflectance_model_coeffs) {
+  double input_img_reflectance;
+
+  switch ( global_params.reflectanceType )
+    {
+    case LUNAR_LAMBERT:
+      input_img_reflectance
+        = computeLunarLambertianReflectanceFromNormal(input_img_params.sunPosition,
+                                                      cameraPosition,
+                                                      xyz,  normal,
+                                                      global_params.phaseCoeffC1,
+                                                      global_params.phaseCoeffC2,
+                                                      phase_angle, // output
+                                                      reflectance_model_coeffs);
+      break;
+    case ARBITRARY_MODEL:
+      input_img_reflectance
+        = computeArbitraryLambertianReflectanceFromNormal(input_img_params.sunPosition,
+                                                          cameraPosition,
+                                                          xyz,  normal,
+                                                          global_params.phaseCoeffC1,
+                                                          global_params.phaseCoeffC2,
+                                                          phase_angle, // output
+                                                          reflectance_model_coeffs);
+      break;
+    case HAPKE:
+      input_img_reflectance
+        = computeHapkeReflectanceFromNormal(input_img_params.sunPosition,
+                                            cameraPosition,
+                                            xyz,  normal,
+                                            global_params.phaseCoeffC1,
+                                            global_params.phaseCoeffC2,
+                                            phase_angle, // output
+                                            reflectance_model_coeffs);
+      break;
+    case CHARON:
+      input_img_reflectance
+        = computeCharonReflectanceFromNormal(input_img_params.sunPosition,
+                                             cameraPosition,
+                                             xyz,  normal,
+                                             global_params.phaseCoeffC1,
+                                             global_params.phaseCoeffC2,
+                                             phase_angle, // output
+                                             reflectance_model_coeffs);
+      break;
+    case LAMBERT:
+      input_img_reflectance
+        = computeLambertianReflectanceFromNormal(input_img_params.sunPosition,
+                                                 xyz, normal);
+      break;
+
+    default:
+      input_img_reflectance = 1;
+    }
+
+  return input_img_reflectance;
+}
+
+} // end namespace asp
@@ -0,0 +1,103 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file SfsReflectanceModel.h
+/// Reflectance models for SfS
+
+#ifndef __SFS_REFLECTANCE_MODEL_H__
+#define __SFS_REFLECTANCE_MODEL_H__
+
+#include <vw/Math/Vector.h>
+
+namespace asp {
+
+enum {NO_REFL = 0, LAMBERT, LUNAR_LAMBERT, HAPKE, ARBITRARY_MODEL, CHARON};
+
+struct GlobalParams{
+  int reflectanceType;
+  // Two parameters used in the formula for the Lunar-Lambertian
+  // reflectance
+  double phaseCoeffC1, phaseCoeffC2;
+};
+
+struct ModelParams {
+  vw::Vector3 sunPosition; //relative to the center of the Moon
+  ModelParams(){}
+  ~ModelParams(){}
+};
+
+// See the .cc file for the documentation.
+double nonlin_reflectance(double reflectance, double exposure,
+                          double steepness_factor,
+                          double const* haze, int num_haze_coeffs);
+
+// See the .cc file for the documentation.
+double computeLambertianReflectanceFromNormal(vw::Vector3 sunPos, vw::Vector3 xyz,
+                                              vw::Vector3 normal);
+
+// See the .cc file for the documentation.
+double computeLunarLambertianReflectanceFromNormal(vw::Vector3 const& sunPos,
+                                                   vw::Vector3 const& viewPos,
+                                                   vw::Vector3 const& xyz,
+                                                   vw::Vector3 const& normal,
+                                                   double phaseCoeffC1,
+                                                   double phaseCoeffC2,
+                                                   double & alpha,
+                                                   const double * reflectance_model_coeffs);
+
+// See the .cc file for the documentation.
+double computeHapkeReflectanceFromNormal(vw::Vector3 const& sunPos,
+                                         vw::Vector3 const& viewPos,
+                                         vw::Vector3 const& xyz,
+                                         vw::Vector3 const& normal,
+                                         double phaseCoeffC1,
+                                         double phaseCoeffC2,
+                                         double & alpha,
+                                         const double * reflectance_model_coeffs);
+
+// See the .cc file for the documentation.
+double computeCharonReflectanceFromNormal(vw::Vector3 const& sunPos,
+                                          vw::Vector3 const& viewPos,
+                                          vw::Vector3 const& xyz,
+                                          vw::Vector3 const& normal,
+                                          double phaseCoeffC1,
+                                          double phaseCoeffC2,
+                                          double & alpha,
+                                          const double * reflectance_model_coeffs);
+
+// See the .cc file for the documentation.
+double computeArbitraryLambertianReflectanceFromNormal(vw::Vector3 const& sunPos,
+                                                       vw::Vector3 const& viewPos,
+                                                       vw::Vector3 const& xyz,
+                                                       vw::Vector3 const& normal,
+                                                       double phaseCoeffC1,
+                                                       double phaseCoeffC2,
+                                                       double & alpha,
+                                                       const double * reflectance_model_coeffs);
+
+// Compute the reflectance with the model in global_params.reflectanceType.
+// Also compute the phase angle, for the models which need it.
+double ComputeReflectance(vw::Vector3 const& cameraPosition,
+                          vw::Vector3 const& normal, vw::Vector3 const& xyz,
+                          ModelParams const& input_img_params,
+                          GlobalParams const& global_params,
+                          double & phase_angle,
+                          const double * reflectance_model_coeffs);
+
+} // end namespace asp
+
+#endif // __SFS_REFLECTANCE_MODEL_H__
@@ -0,0 +1,90 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Sfs/SfsBatch.h>
+#include <vw/Cartography/GeoReference.h>
+
+using namespace vw;
+using namespace asp;
+
+// The batched normals and reflectance must agree with the per-point
+// formulas used by sfs.
+TEST(SfsBatch, AgreesWithPerPoint) {
+
+  vw::cartography::GeoReference geo;
+  geo.set_well_known_geogcs("D_MOON");
+  Matrix3x3 affine;
+  affine(0, 0) = 0.001; affine(0, 2) = 10.0;
+  affine(1, 1) = -0.001; affine(1, 2) = -20.0;
+  affine(2, 2) = 1.0;
+  geo.set_transform(affine);
+
+  ImageView<double> dem(7, 5);
+  for (int col = 0; col < dem.cols(); col++)
+    for (int row = 0; row < dem.rows(); row++)
+      dem(col, row) = 100.0 * sin(0.7 * col) * cos(0.5 * row);
+
+  int row = 2;
+  Vec3Array top, center, bottom, normals;
+  demRowToXyz(dem, geo, row - 1, top);
+  demRowToXyz(dem, geo, row,     center);
+  demRowToXyz(dem, geo, row + 1, bottom);
+  demRowNormals(top, center, bottom, normals);
+
+  Vector3 sunPos(1.0e11, 2.0e10, -3.0e10);
+  Vec3Array xyz, nrm, cams;
+  for (int col = 1; col < dem.cols() - 1; col++) {
+    Vector3 normal = -normalize(cross_prod(center(col + 1) - center(col - 1),
+                                           bottom(col) - top(col)));
+    EXPECT_VECTOR_NEAR(normal, normals(col), 1e-12);
+    xyz.x.push_back(center.x[col]); xyz.y.push_back(center.y[col]); xyz.z.push_back(center.z[col]);
+    nrm.x.push_back(normal[0]); nrm.y.push_back(normal[1]); nrm.z.push_back(normal[2]);
+    Vector3 cam = 1.05 * center(col) + Vector3(1.0e4 * col, 0, 0);
+    cams.x.push_back(cam[0]); cams.y.push_back(cam[1]); cams.z.push_back(cam[2]);
+  }
+
+  std::vector<double> lunar_coeffs = {1, -0.019, 0.000242, -0.00000146, 1, 0, 0, 0,
+                                      1, -0.019, 0.000242, -0.00000146, 1, 0, 0, 0};
+  std::vector<double> hapke_coeffs = {0.68, 0.17, 0.62, 0.52, 0.52, 0, 0, 0,
+                                      0, 0, 0, 0, 0, 0, 0, 0};
+  std::vector<double> charon_coeffs = {0.7, 0.63, 0, 0, 0, 0, 0, 0,
+                                       0, 0, 0, 0, 0, 0, 0, 0};
+  int types[]                   = {LAMBERT, LUNAR_LAMBERT, HAPKE, CHARON};
+  std::vector<double> * coeffs[] = {&lunar_coeffs, &lunar_coeffs, &hapke_coeffs,
+                                    &charon_coeffs};
+  for (int t = 0; t < 4; t++) {
+    GlobalParams global_params;
+    global_params.reflectanceType = types[t];
+    global_params.phaseCoeffC1 = 0;
+    global_params.phaseCoeffC2 = 0;
+    ModelParams model_params;
+    model_params.sunPosition = sunPos;
+
+    std::vector<double> refl;
+    computeReflectanceBatch(global_params, sunPos, cams, xyz, nrm,
+                            &(*coeffs[t])[0], refl);
+    ASSERT_EQ(refl.size(), xyz.size());
+    for (size_t i = 0; i < xyz.size(); i++) {
+      double phase_angle = 0.0;
+      double expected = ComputeReflectance(cams(i), nrm(i), xyz(i), model_params,
+                                           global_params, phase_angle,
+                                           &(*coeffs[t])[0]);
+      EXPECT_NEAR(expected, refl[i], 1e-12) << "reflectance type " << types[t];
+    }
+  }
+}
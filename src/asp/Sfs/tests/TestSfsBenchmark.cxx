@@ -0,0 +1,236 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+// Benchmark of the per-grid-point work an sfs iteration does: convert the
+// DEM to xyz, find the normals, project into the camera, and compute the
+// reflectance, for each reflectance model and with one and several
+// threads. This covers both the per-point path used by the cost functions
+// and the per-row path used for the whole DEM. The shadow computation is
+// timed as well. The scene is a synthetic lunar DEM seen by a pinhole
+// camera, with a low sun. Each result is a line of tab-separated values:
+//   sfs_bench  <measurement>  <reflectance model>  <threads>  <value>  <unit>
+// which is printed, and appended to the file in ASP_SFS_BENCH_OUT if set,
+// to compare over releases. Set ASP_SFS_BENCH_SIZE to change the DEM size.
+// The checks are only for correctness, so that this can run with the other
+// tests.
+
+#include <test/Helpers.h>
+#include <asp/Sfs/SfsBatch.h>
+#include <asp/Sfs/SfsImageProc.h>
+#include <asp/Sfs/SfsReflectanceModel.h>
+#include <asp/Camera/CameraBatch.h>
+#include <vw/Camera/PinholeModel.h>
+#include <vw/Cartography/GeoReference.h>
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+int demSize() {
+  char const* val = getenv("ASP_SFS_BENCH_SIZE");
+  int num = (val == NULL) ? 300 : atoi(val);
+  return std::max(num, 10);
+}
+
+void report(std::string const& name, std::string const& model, int num_threads,
+            double value, std::string const& unit) {
+  std::ostringstream os;
+  os << "sfs_bench\t" << name << '\t' << model << '\t' << num_threads << '\t'
+     << value << '\t' << unit << '\n';
+  std::cout << os.str();
+  char const* file = getenv("ASP_SFS_BENCH_OUT");
+  if (file != NULL) {
+    std::ofstream ofs(file, std::ios::app);
+    ofs << os.str();
+  }
+}
+
+// Seconds to call the given function for the rows 1, ..., num_rows - 2,
+// split among the given number of threads.
+double timeRows(std::function<void(int)> const& doRow, int num_rows, int num_threads) {
+  auto beg = Clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.push_back(std::thread([&doRow, num_rows, num_threads, t]() {
+          for (int row = 1 + t; row < num_rows - 1; row += num_threads)
+            doRow(row);
+        }));
+  }
+  for (size_t t = 0; t < threads.size(); t++)
+    threads[t].join();
+  return std::chrono::duration<double>(Clock::now() - beg).count();
+}
+
+} // end anonymous namespace
+
+TEST(SfsBenchmark, SyntheticLunarScene) {
+
+  // A DEM with a few craters and hills, at 20 m per pixel
+  int size = demSize();
+  cartography::GeoReference geo;
+  geo.set_well_known_geogcs("D_MOON");
+  double deg_per_pix = 20.0 / geo.datum().semi_major_axis() * 180.0 / M_PI;
+  Matrix3x3 affine;
+  affine(0, 0) = deg_per_pix;  affine(0, 2) = 10.0;
+  affine(1, 1) = -deg_per_pix; affine(1, 2) = -20.0;
+  affine(2, 2) = 1.0;
+  geo.set_transform(affine);
+  ImageView<double> dem(size, size);
+  for (int col = 0; col < size; col++) {
+    for (int row = 0; row < size; row++) {
+      double x = double(col) / size, y = double(row) / size;
+      double r1 = hypot(x - 0.3, y - 0.4), r2 = hypot(x - 0.7, y - 0.6);
+      dem(col, row) = 30.0 * sin(9.0 * x) * cos(7.0 * y)
+        - 200.0 * exp(-r1 * r1 / 0.01) + 80.0 * exp(-r2 * r2 / 0.02);
+    }
+  }
+  double gridx = 20.0, gridy = 20.0;
+
+  // A pinhole camera 50 km above the DEM center, looking down, and a low sun
+  Vector2 ctr_ll = geo.pixel_to_lonlat(Vector2(size/2, size/2));
+  Vector3 ctr = geo.datum().geodetic_to_cartesian(Vector3(ctr_ll[0], ctr_ll[1], 0));
+  Vector3 up = normalize(ctr);
+  Vector3 east = normalize(cross_prod(Vector3(0, 0, 1), up));
+  Vector3 north = cross_prod(up, east);
+  Matrix3x3 R;
+  for (int it = 0; it < 3; it++) {
+    R(it, 0) = east[it];
+    R(it, 1) = -north[it];
+    R(it, 2) = -up[it];
+  }
+  vw::camera::PinholeModel cam(ctr + 5.0e4 * up, R, 5000, 5000, 1000, 1000);
+  double elev = 10.0 * M_PI / 180.0;
+  Vector3 sunPos = ctr + 1.5e11 * (cos(elev) * east + sin(elev) * up);
+
+  GlobalParams global_params;
+  global_params.phaseCoeffC1 = 0;
+  global_params.phaseCoeffC2 = 0;
+  ModelParams model_params;
+  model_params.sunPosition = sunPos;
+  std::vector<double> coeffs = {1, -0.019, 0.000242, -0.00000146, 1, 0, 0, 0,
+                                0.68, 0.17, 0.62, 0.52, 0.52, 0, 0, 0};
+  std::vector<double> hapke_coeffs = {0.68, 0.17, 0.62, 0.52, 0.52, 0, 0, 0,
+                                      0, 0, 0, 0, 0, 0, 0, 0};
+
+  int types[] = {LAMBERT, LUNAR_LAMBERT, HAPKE};
+  std::string names[] = {"lambert", "lunar_lambert", "hapke"};
+  double const* type_coeffs[] = {&coeffs[0], &coeffs[0], &hapke_coeffs[0]};
+  int max_threads = std::max(1u, std::min(8u, std::thread::hardware_concurrency()));
+  std::vector<int> thread_counts = {1};
+  if (max_threads > 1)
+    thread_counts.push_back(max_threads);
+  double num_points = double(size - 2) * double(size - 2);
+
+  ImageView<double> refl_row(size, size), refl_point(size, size);
+  for (int t = 0; t < 3; t++) {
+    global_params.reflectanceType = types[t];
+    bool need_ctr = (types[t] != LAMBERT);
+
+    // The per-row path, as for the whole DEM
+    auto doRow = [&](int row) {
+      Vec3Array top, center, bottom, normals, cams, xyz, nrm;
+      demRowToXyz(dem, geo, row - 1, top);
+      demRowToXyz(dem, geo, row,     center);
+      demRowToXyz(dem, geo, row + 1, bottom);
+      demRowNormals(top, center, bottom, normals);
+      int num = size - 2;
+      std::vector<Vector3> points(num), ctrs(num);
+      std::vector<Vector2> pixels(num);
+      for (int col = 1; col < size - 1; col++)
+        points[col - 1] = center(col);
+      pointsToPixels(&cam, &points[0], num, &pixels[0]);
+      if (need_ctr)
+        cameraCenters(&cam, &pixels[0], num, &ctrs[0]);
+      xyz.resize(num);
+      nrm.resize(num);
+      cams.resize(need_ctr ? num : 0);
+      for (int i = 0; i < num; i++) {
+        xyz.set(i, center(i + 1));
+        nrm.set(i, normals(i + 1));
+        if (need_ctr)
+          cams.set(i, ctrs[i]);
+      }
+      std::vector<double> refl;
+      computeReflectanceBatch(global_params, sunPos, cams, xyz, nrm, type_coeffs[t], refl);
+      for (int i = 0; i < num; i++)
+        refl_row(i + 1, row) = refl[i];
+    };
+
+    // The per-point path, as in the cost functions
+    auto doPoint = [&](int row) {
+      for (int col = 1; col < size - 1; col++) {
+        Vector3 p[5];
+        int dc[] = {0, -1, 1, 0, 0}, dr[] = {0, 0, 0, 1, -1};
+        for (int k = 0; k < 5; k++) {
+          Vector2 ll = geo.pixel_to_lonlat(Vector2(col + dc[k], row + dr[k]));
+          p[k] = geo.datum().geodetic_to_cartesian
+            (Vector3(ll[0], ll[1], dem(col + dc[k], row + dr[k])));
+        }
+        Vector3 normal = -normalize(cross_prod(p[2] - p[1], p[3] - p[4]));
+        Vector2 pix = cam.point_to_pixel(p[0]);
+        Vector3 cam_ctr;
+        if (need_ctr)
+          cam_ctr = cam.camera_center(pix);
+        double phase_angle = 0.0;
+        refl_point(col, row) = ComputeReflectance(cam_ctr, normal, p[0], model_params,
+                                                  global_params, phase_angle,
+                                                  type_coeffs[t]);
+      }
+    };
+
+    for (size_t n = 0; n < thread_counts.size(); n++) {
+      double secs = timeRows(doRow, size, thread_counts[n]);
+      report("row_points_per_sec", names[t], thread_counts[n],
+             num_points / std::max(secs, 1e-12), "points/s");
+      secs = timeRows(doPoint, size, thread_counts[n]);
+      report("point_points_per_sec", names[t], thread_counts[n],
+             num_points / std::max(secs, 1e-12), "points/s");
+    }
+
+    // The two paths must agree
+    double max_diff = 0.0;
+    for (int col = 1; col < size - 1; col++)
+      for (int row = 1; row < size - 1; row++)
+        max_diff = std::max(max_diff, std::abs(refl_row(col, row) - refl_point(col, row)));
+    EXPECT_LT(max_diff, 1e-8) << names[t];
+  }
+
+  // Shadows for the whole DEM
+  auto beg = Clock::now();
+  ImageView<float> shadow;
+  areInShadow(sunPos, dem, gridx, gridy, geo, shadow);
+  double secs = std::chrono::duration<double>(Clock::now() - beg).count();
+  report("shadow_points_per_sec", "none", 1, double(size) * size / std::max(secs, 1e-12),
+         "points/s");
+  EXPECT_EQ(shadow.cols(), size);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  report("max_resident_memory", "none", max_threads, usage.ru_maxrss, "kB");
+}
@@ -0,0 +1,84 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Sfs/SfsImageProc.h>
+#include <vw/Cartography/GeoReference.h>
+
+using namespace vw;
+using namespace asp;
+
+// The shadows found by sweeping the DEM must agree with marching a ray to
+// the sun from each grid point, other than at a few boundary points.
+TEST(SfsImageProc, ShadowSweep) {
+
+  vw::cartography::GeoReference geo;
+  geo.set_well_known_geogcs("D_MOON");
+  Matrix3x3 affine;
+  affine(0, 0) = 0.001; affine(0, 2) = 10.0;
+  affine(1, 1) = -0.001; affine(1, 2) = -20.0;
+  affine(2, 2) = 1.0;
+  geo.set_transform(affine);
+
+  // Two hills on a gentle slope
+  int cols = 80, rows = 60;
+  ImageView<double> dem(cols, rows);
+  for (int col = 0; col < cols; col++) {
+    for (int row = 0; row < rows; row++) {
+      double d1 = (col - 25.0) * (col - 25.0) + (row - 20.0) * (row - 20.0);
+      double d2 = (col - 55.0) * (col - 55.0) + (row - 40.0) * (row - 40.0);
+      dem(col, row) = 200.0 * exp(-d1 / 50.0) + 120.0 * exp(-d2 / 30.0) + 0.5 * col;
+    }
+  }
+
+  double gridx = 0.001 * M_PI / 180.0 * geo.datum().semi_major_axis();
+  double gridy = gridx;
+
+  double max_dem_height = -std::numeric_limits<double>::max();
+  for (int col = 0; col < cols; col++)
+    for (int row = 0; row < rows; row++)
+      max_dem_height = std::max(max_dem_height, dem(col, row));
+
+  // A low sun towards the north-east, and one towards the south
+  Vector2 ctr_ll = geo.pixel_to_lonlat(Vector2(cols/2, rows/2));
+  Vector3 ctr = geo.datum().geodetic_to_cartesian(Vector3(ctr_ll[0], ctr_ll[1], 0));
+  Vector3 up = normalize(ctr);
+  Vector3 east = normalize(cross_prod(Vector3(0, 0, 1), up));
+  Vector3 north = cross_prod(up, east);
+  double elevs[] = {3.0, 8.0}, azims[] = {40.0, 260.0};
+  for (int s = 0; s < 2; s++) {
+    double e = elevs[s] * M_PI / 180.0, a = azims[s] * M_PI / 180.0;
+    Vector3 sun_dir = cos(e) * (sin(a) * east + cos(a) * north) + sin(e) * up;
+    Vector3 sunPos = ctr + 1.5e11 * sun_dir;
+
+    ImageView<float> shadow;
+    areInShadow(sunPos, dem, gridx, gridy, geo, shadow);
+    ASSERT_EQ(shadow.cols(), cols);
+    ASSERT_EQ(shadow.rows(), rows);
+
+    int num_shadow = 0, num_diff = 0;
+    for (int col = 0; col < cols; col++) {
+      for (int row = 0; row < rows; row++) {
+        bool ray = isInShadow(col, row, sunPos, dem, max_dem_height, gridx, gridy, geo);
+        num_shadow += int(ray);
+        num_diff += int(ray != (shadow(col, row) != 0));
+      }
+    }
+    EXPECT_GT(num_shadow, cols * rows / 20);
+    EXPECT_LT(num_diff, cols * rows / 25);
+  }
+}
@@ -24,9 +24,12 @@
 #include "SpiceUsr.h"
 #include "SpiceZfc.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <fstream>
 #include <list>
+#include <mutex>
 #include <string>
 
 #include <vw/Core/Exception.h>
@@ -45,6 +48,10 @@ namespace spice {
 
   enum { LONG_MSG_LEN = 1840 };
 
+  // CSPICE keeps global state and is not thread-safe, so the queries
+  // below are done one at a time
+  static std::mutex g_spice_mutex;
+
   void CHECK_SPICE_ERROR() {
     char longms[LONG_MSG_LEN + 1];
 
@@ -127,6 +134,7 @@ namespace spice {
                   std::string const& planet,
                   std::string const& instrument) {
 
+    std::lock_guard<std::mutex> lock(g_spice_mutex);
     SpiceDouble time = time_;
 
     // Obtain the state vector of the spacecraft at the given
@@ -180,6 +188,7 @@ namespace spice {
                   std::string const& planet,
                   std::string const& instrument) {
 
+    std::lock_guard<std::mutex> lock(g_spice_mutex);
     unsigned int number_of_samples = (unsigned int)ceil((end_time - begin_time) / interval);
 
     position.resize(number_of_samples);
@@ -231,6 +240,78 @@ namespace spice {
     CHECK_SPICE_ERROR();
   }
 
+  BodyStateTable::BodyStateTable(double begin_time, double end_time, double interval,
+                                 std::string const& spacecraft,
+                                 std::string const& reference_frame,
+                                 std::string const& planet,
+                                 std::string const& instrument):
+    m_begin_time(begin_time), m_interval(interval) {
+
+    if (!(interval > 0) || !(end_time >= begin_time))
+      vw_throw(ArgumentErr() << "BodyStateTable: Invalid time range or interval.\n");
+
+    // Sample at least two times, with the last one at or past the end time.
+    // Each time is found from its index, to not accumulate errors.
+    int num_samples = std::max(2, int(ceil((end_time - begin_time) / interval)) + 1);
+    m_position.resize(num_samples);
+    m_velocity.resize(num_samples);
+    m_pose.resize(num_samples);
+    for (int it = 0; it < num_samples; it++)
+      spice::body_state(begin_time + it * interval, m_position[it], m_velocity[it],
+                        m_pose[it], spacecraft, reference_frame, planet, instrument);
+  }
+
+  void BodyStateTable::body_state(double time,
+                                  Vector3 &position,
+                                  Vector3 &velocity,
+                                  Quat &pose) const {
+
+    int num_samples = m_position.size();
+    double t = (time - m_begin_time) / m_interval;
+    if (!(t >= 0.0) || t > num_samples - 1.0)
+      vw_throw(SpiceErr() << "BodyStateTable: Time " << time << " is outside of the "
+               << "sampled range [" << begin_time() << ", " << end_time() << "].\n");
+
+    int i = std::min(int(floor(t)), num_samples - 2);
+    double s = t - i, s2 = s * s, s3 = s2 * s;
+
+    // Cubic Hermite basis and its derivative. The velocities are scaled by
+    // the interval, as the basis is for the normalized time s.
+    double h00 = 2*s3 - 3*s2 + 1, h10 = s3 - 2*s2 + s, h01 = -2*s3 + 3*s2, h11 = s3 - s2;
+    double d00 = 6*s2 - 6*s,      d10 = 3*s2 - 4*s + 1, d01 = -6*s2 + 6*s, d11 = 3*s2 - 2*s;
+    Vector3 const& p0 = m_position[i];
+    Vector3 const& p1 = m_position[i+1];
+    Vector3 v0 = m_velocity[i] * m_interval;
+    Vector3 v1 = m_velocity[i+1] * m_interval;
+    position = h00 * p0 + h10 * v0 + h01 * p1 + h11 * v1;
+    velocity = (d00 * p0 + d10 * v0 + d01 * p1 + d11 * v1) / m_interval;
+
+    // Spherical linear interpolation, along the shorter arc
+    Quat q0 = m_pose[i], q1 = m_pose[i+1];
+    double dot = 0.0;
+    for (int c = 0; c < 4; c++)
+      dot += q0[c] * q1[c];
+    double sign = 1.0;
+    if (dot < 0) {
+      sign = -1.0;
+      dot  = -dot;
+    }
+    double a = 1.0 - s, b = s;
+    if (dot < 0.9995) { // otherwise the quaternions are so close that lerp is enough
+      double theta = acos(dot);
+      a = sin(a * theta) / sin(theta);
+      b = sin(b * theta) / sin(theta);
+    }
+    b *= sign;
+    double q[4], norm = 0.0;
+    for (int c = 0; c < 4; c++) {
+      q[c] = a * q0[c] + b * q1[c];
+      norm += q[c] * q[c];
+    }
+    norm = sqrt(norm);
+    pose = Quat(q[0]/norm, q[1]/norm, q[2]/norm, q[3]/norm);
+  }
+
   // Load all relevent SPICE kernels.
   //
   // Someday, rather than hard coding these values, the user might be
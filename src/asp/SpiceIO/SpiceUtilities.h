@@ -69,6 +69,36 @@ namespace spice {
                   std::string const& planet,
                   std::string const& instrument);
 
+  /// The state of a body sampled from SPICE once, at the given interval
+  /// over a time range, so that later queries are answered by
+  /// interpolation without calling CSPICE. The position is interpolated
+  /// with cubic Hermite polynomials using the velocities, and the pose
+  /// with spherical linear interpolation. CSPICE is not thread-safe, so
+  /// calls to it in this file are serialized, while a table, once created,
+  /// can be queried from many threads at once.
+  class BodyStateTable {
+  public:
+    BodyStateTable(double begin_time, double end_time, double interval,
+                   std::string const& spacecraft,
+                   std::string const& reference_frame,
+                   std::string const& planet,
+                   std::string const& instrument);
+
+    /// The state at the given time, which must be within the sampled range
+    void body_state(double time,
+                    vw::Vector3 &position,
+                    vw::Vector3 &velocity,
+                    vw::Quaternion<double> &pose) const;
+
+    double begin_time() const { return m_begin_time; }
+    double end_time  () const { return m_begin_time + m_interval * (m_position.size() - 1); }
+
+  private:
+    double m_begin_time, m_interval;
+    std::vector<vw::Vector3> m_position, m_velocity;
+    std::vector<vw::Quaternion<double> > m_pose;
+  };
+
 }} // namespace asp::spice
 
 #endif // __SPICE_H__
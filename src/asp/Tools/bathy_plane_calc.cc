@@ -23,6 +23,7 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/ParallelRansac.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 
 #include <vw/Core/Stopwatch.h>
@@ -31,9 +32,10 @@
 #include <vw/Math/RANSAC.h>
 #include <vw/Camera/CameraModel.h>
 #include <vw/Cartography/CameraBBox.h>
-#include <vw/Core/ThreadPool.h>
 #include <vw/Math/RandomSet.h>
 
+#include <omp.h>
+
 #include <Eigen/Dense>
 
 #include <random>
@@ -100,137 +102,60 @@ void find_projection(// Inputs
   }
 }
 
-// This is not used for now, it could be used to make the logic
-// of processing mask boundary points multi-threaded.
-class MaskBoundaryTask : public vw::Task, private boost::noncopyable {
-  vw::BBox2i m_bbox; // Region of image we're working in
-
-  ImageViewRef<float>                   m_mask;
-  float                                 m_mask_nodata_val;
-  boost::shared_ptr<CameraModel>        m_camera_model;
-  vw::cartography::GeoReference         m_shape_georef;
-  vw::cartography::GeoReference         m_dem_georef;
-  ImageViewRef<PixelMask<float>>        m_masked_dem;
-  
-  // Note how all of these are aliases
-  Mutex                        & m_mutex;
-  std::vector<Eigen::Vector3d> & m_point_vec;
-  std::vector<vw::Vector3>     & m_llh_vec;
-  std::vector<vw::Vector2>     & m_used_vertices;
-  
-public:
-  MaskBoundaryTask(vw::BBox2i                            bbox,
-                   ImageViewRef<float>                   mask,
-                   float                                 mask_nodata_val,
-                   boost::shared_ptr<CameraModel>        camera_model,
-                   vw::cartography::GeoReference const & shape_georef,
-                   vw::cartography::GeoReference const & dem_georef,
-                   ImageViewRef<PixelMask<float>>        masked_dem,
-                   Mutex                               & mutex,
-                   std::vector<Eigen::Vector3d>        & point_vec,
-                   std::vector<vw::Vector3>            & llh_vec,
-                   std::vector<vw::Vector2>            & used_vertices):
-    m_bbox(bbox), m_mask(mask), m_mask_nodata_val(mask_nodata_val),
-    m_camera_model(camera_model), m_shape_georef(shape_georef),
-    m_dem_georef(dem_georef), m_masked_dem(masked_dem),
-    m_mutex(mutex), m_point_vec(point_vec),
-    m_llh_vec(llh_vec), m_used_vertices(used_vertices) {}
+// Find the pixels in the given box of the mask which are above
+// threshold and have a neighbor which is not above threshold.
+void find_mask_boundary_pixels(ImageViewRef<float> mask, float mask_nodata_val,
+                               vw::BBox2i const& bbox,
+                               std::vector<vw::Vector2> & boundary_pixels) {
+
+  boundary_pixels.clear();
   
-  void operator()() {
+  // Grow the box by 1 pixel as we need to look at the immediate neighbors
+  BBox2i extra_box = bbox;
+  extra_box.expand(1); 
+  extra_box.crop(bounding_box(mask));
 
-    // Grow the box by 1 pixel as we need to look at the immediate neighbors
-    BBox2i extra_box = m_bbox;
-    extra_box.expand(1); 
-    extra_box.crop(bounding_box(m_mask));
+  // Make a local copy of the tile
+  ImageView<float> mask_tile = crop(mask, extra_box);
 
-    // Make a local copy of the tile
-    ImageView<float> mask_tile = crop(m_mask, extra_box);
+  // The four neighbors
+  int col_vals[4] = {-1, 0, 0, 1};
+  int row_vals[4] = {0, -1, 1, 0};
 
-    for (int col = 0; col < mask_tile.cols(); col++) {
-      for (int row = 0; row < mask_tile.rows(); row++) {
+  for (int col = 0; col < mask_tile.cols(); col++) {
+    for (int row = 0; row < mask_tile.rows(); row++) {
 
-        // Look at pixels above threshold which have neighbors <= threshold
-        if (mask_tile(col, row) <= m_mask_nodata_val) 
-          continue;
-
-        // The four neighbors
-        int col_vals[4] = {-1, 0, 0, 1};
-        int row_vals[4] = {0, -1, 1, 0};
-          
-        bool border_pix = false;
-        for (int it = 0; it < 4; it++) {
-            
-          int icol = col + col_vals[it];
-          int irow = row + row_vals[it];
+      // Look at pixels above threshold which have neighbors <= threshold
+      if (mask_tile(col, row) <= mask_nodata_val) 
+        continue;
 
-          if (icol < 0 || irow < 0 || icol >= mask_tile.cols() || irow >= mask_tile.rows()) 
-            continue;
+      // Create the pixel in the full image coordinates. Only work on
+      // pixels in the current box (earlier had a bigger box to be able
+      // to examine neighbors).
+      Vector2 pix = Vector2(col, row) + extra_box.min();
+      if (!bbox.contains(pix))
+        continue;
+      
+      bool border_pix = false;
+      for (int it = 0; it < 4; it++) {
             
-          if (mask_tile(icol, irow) <= m_mask_nodata_val) {
-            border_pix = true;
-            break;
-          }
-        }
-          
-        if (!border_pix) 
-          continue;
-
-        // Create the pixel in the full image coordinates
-        Vector2 pix = Vector2(col, row) + extra_box.min();
+        int icol = col + col_vals[it];
+        int irow = row + row_vals[it];
 
-        // Only work on pixels in the current box (earlier had a
-        // bigger box to be able to examine neighbors).
-        if (!m_bbox.contains(pix))
+        if (icol < 0 || irow < 0 || icol >= mask_tile.cols() || irow >= mask_tile.rows()) 
           continue;
-        
-        // The ray going to the ground
-        // Here we assume that the camera model is thread-safe, which is
-        // true for all cameras except ISIS, and this code will be used
-        // on Earth only.
-        Vector3 cam_ctr = m_camera_model->camera_center(pix);
-        Vector3 cam_dir = m_camera_model->pixel_to_vector(pix);
-
-        // Intersect the ray going from the given camera pixel with a DEM.
-        bool treat_nodata_as_zero = false;
-        bool has_intersection = false;
-        double height_error_tol = 0.001; // in meters
-        double max_abs_tol = 1e-14;
-        double max_rel_tol = 1e-14;
-        int num_max_iter = 100;
-        Vector3 xyz_guess(0, 0, 0);
-        Vector3 xyz = vw::cartography::camera_pixel_to_dem_xyz
-          (cam_ctr, cam_dir, m_masked_dem,
-           m_dem_georef, treat_nodata_as_zero,
-           has_intersection, height_error_tol, max_abs_tol, max_rel_tol, 
-           num_max_iter, xyz_guess);
-          
-        if (!has_intersection) 
-          continue;
-
-        Vector3 llh = m_dem_georef.datum().cartesian_to_geodetic(xyz);
-
-        Eigen::Vector3d eigen_xyz;
-        for (size_t coord = 0; coord < 3; coord++) 
-          eigen_xyz[coord] = xyz[coord];
-
-        // TODO(oalexan1): This is fragile due to the 360 degree
-        // uncertainty in latitude
-        Vector2 proj_pt = m_shape_georef.lonlat_to_point(Vector2(llh[0], llh[1]));
-
-        {
-          // Need to make sure to lock the shared resource
-          Mutex::Lock lock(m_mutex);
-          m_point_vec.push_back(eigen_xyz);
-          m_used_vertices.push_back(proj_pt);
-          m_llh_vec.push_back(llh);
+            
+        if (mask_tile(icol, irow) <= mask_nodata_val) {
+          border_pix = true;
+          break;
         }
       }
-      
+          
+      if (border_pix) 
+        boundary_pixels.push_back(pix);
     }
-    
   }
-  
-};
+}
 
 // Find the mask boundary (points where the points in the mask have
 // neighbors not in the mask), shoot points from there onto the DEM,
@@ -251,115 +176,117 @@ void find_points_at_mask_boundary(ImageViewRef<float> mask,
   llh_vec.clear();
   used_vertices.clear();
 
-#if 0
-
-  // For some reason parallel processing is slower than serial processing.
-  // Likely it is because the DEM is shared. Need extra heuristics to cut
-  // that one as appropriate for each task.
+  omp_set_dynamic(0);
+  omp_set_num_threads(vw_settings().default_num_threads());
   
-  // Subdivide the box for parallel processing
+  // Let the mask boundary be the mask pixels whose value is above
+  // threshold and which border pixels whose values is not above
+  // threshold. Find these in parallel, one tile at a time, with each
+  // tile read only once. Concatenate the results in tile order, so
+  // that they do not depend on the number of threads.
+  vw_out() << "Finding the mask boundary.\n";
   int block_size = vw::vw_settings().default_tile_size();
-  FifoWorkQueue queue(vw_settings().default_num_threads());
   std::vector<BBox2i> bboxes = subdivide_bbox(mask, block_size, block_size);
-  
-  for (size_t it = 0; it < bboxes.size(); it++) {
-    std::cout << "Box is " << bboxes[it] << std::endl;
+  std::vector<std::vector<vw::Vector2>> tile_pixels(bboxes.size());
+  std::vector<std::string> errors(bboxes.size());
+  // OpenMP cannot propagate exceptions
+  #pragma omp parallel for schedule(dynamic)
+  for (int it = 0; it < int(bboxes.size()); it++) {
+    try {
+      find_mask_boundary_pixels(mask, mask_nodata_val, bboxes[it], tile_pixels[it]);
+    } catch (std::exception const& e) {
+      errors[it] = e.what();
+    }
   }
-
-  Mutex mutex;
-  for (size_t it = 0; it < bboxes.size(); it++) {
-    boost::shared_ptr<MaskBoundaryTask>
-      task(new MaskBoundaryTask(bboxes[it],  mask, mask_nodata_val, camera_model,
-                                shape_georef, dem_georef, masked_dem, mutex,
-                                point_vec, llh_vec, used_vertices));
-    queue.add_task(task);
+  for (size_t it = 0; it < errors.size(); it++) {
+    if (!errors[it].empty())
+      vw_throw(ArgumentErr() << errors[it]);
   }
-  
-  queue.join_all();
-  
-#else
-
-  // Let the mask boundary be the mask pixels whose value
-  // is above threshold and which border pixels whose values
-  // is not above threshold.
 
+  std::vector<vw::Vector2> boundary_pixels;
+  for (size_t it = 0; it < tile_pixels.size(); it++)
+    boundary_pixels.insert(boundary_pixels.end(), tile_pixels[it].begin(),
+                           tile_pixels[it].end());
+  tile_pixels.clear();
+  
+  // Shoot rays from the boundary pixels to the DEM in parallel. Each
+  // result goes to its own slot, and the pixels with no intersection are
+  // removed after that, so the order of the points is the same as for
+  // the pixels. Here we assume that the camera model is thread-safe,
+  // which is true for all cameras except ISIS, and this code will be
+  // used on Earth only.
   vw_out() << "Processing points at mask boundary.\n";
+  int num_pix = boundary_pixels.size();
+  std::vector<Eigen::Vector3d> all_points(num_pix);
+  std::vector<vw::Vector3> all_llh(num_pix);
+  std::vector<vw::Vector2> all_vertices(num_pix);
+  std::vector<int> has_point(num_pix, 0);
+  std::string error;
+  
   vw::TerminalProgressCallback tpc("asp", "\t--> ");
-  double inc_amount = 1.0 / mask.cols();
+  int num_done = 0, progress_step = std::max(num_pix / 100, 1);
   tpc.report_progress(0);
 
-  for (int col = 0; col < mask.cols(); col++) {
-    for (int row = 0; row < mask.rows(); row++) {
-
-      // Look at pixels above threshold which have neighbors <= threshold
-      if (mask(col, row) <= mask_nodata_val) 
-        continue;
-
-      // The four neighbors
-      int col_vals[4] = {-1, 0, 0, 1};
-      int row_vals[4] = {0, -1, 1, 0};
-          
-      bool border_pix = false;
-      for (int it = 0; it < 4; it++) {
-            
-        int icol = col + col_vals[it];
-        int irow = row + row_vals[it];
-
-        if (icol < 0 || irow < 0 || icol >= mask.cols() || irow >= mask.rows()) 
-          continue;
-            
-        if (mask(icol, irow) <= mask_nodata_val) {
-          border_pix = true;
-          break;
-        }
-      }
-          
-      if (!border_pix) 
-        continue;
+  #pragma omp parallel for schedule(dynamic, 64)
+  for (int pix_it = 0; pix_it < num_pix; pix_it++) {
 
-      // The ray going to the ground
-      Vector2 pix(col, row);
+    // The ray going to the ground
+    Vector2 pix = boundary_pixels[pix_it];
+    bool has_intersection = false;
+    Vector3 xyz;
+    try {
       Vector3 cam_ctr = camera_model->camera_center(pix);
       Vector3 cam_dir = camera_model->pixel_to_vector(pix);
 
       // Intersect the ray going from the given camera pixel with a DEM.
       bool treat_nodata_as_zero = false;
-      bool has_intersection = false;
       double height_error_tol = 0.001; // in meters
       double max_abs_tol = 1e-14;
       double max_rel_tol = 1e-14;
       int num_max_iter = 100;
       Vector3 xyz_guess(0, 0, 0);
-      Vector3 xyz = vw::cartography::camera_pixel_to_dem_xyz
+      xyz = vw::cartography::camera_pixel_to_dem_xyz
         (cam_ctr, cam_dir, masked_dem,
          dem_georef, treat_nodata_as_zero,
          has_intersection, height_error_tol, max_abs_tol, max_rel_tol, 
          num_max_iter, xyz_guess);
+    } catch (std::exception const& e) {
+      has_intersection = false;
+      #pragma omp critical
+      error = e.what();
+    }
           
-      if (!has_intersection) 
-        continue;
-
+    if (has_intersection) {
       Vector3 llh = dem_georef.datum().cartesian_to_geodetic(xyz);
-
-      Eigen::Vector3d eigen_xyz;
+      
       for (size_t coord = 0; coord < 3; coord++) 
-        eigen_xyz[coord] = xyz[coord];
-
+        all_points[pix_it][coord] = xyz[coord];
+      
       // TODO(oalexan1): This is fragile due to the 360 degree
       // uncertainty in latitude
-      Vector2 proj_pt = shape_georef.lonlat_to_point(Vector2(llh[0], llh[1]));
-          
-      point_vec.push_back(eigen_xyz);
-      used_vertices.push_back(proj_pt);
-      llh_vec.push_back(llh);
+      all_vertices[pix_it] = shape_georef.lonlat_to_point(Vector2(llh[0], llh[1]));
+      all_llh[pix_it] = llh;
+      has_point[pix_it] = 1;
     }
 
-    tpc.report_incremental_progress(inc_amount);
+    #pragma omp critical
+    {
+      num_done++;
+      if (num_done % progress_step == 0)
+        tpc.report_progress(double(num_done) / num_pix);
+    }
   }
-
   tpc.report_finished();
+  if (!error.empty())
+    vw_throw(ArgumentErr() << error);
   
-#endif
+  for (int pix_it = 0; pix_it < num_pix; pix_it++) {
+    if (!has_point[pix_it])
+      continue;
+    point_vec.push_back(all_points[pix_it]);
+    used_vertices.push_back(all_vertices[pix_it]);
+    llh_vec.push_back(all_llh[pix_it]);
+  }
   
   int num_pts = point_vec.size();
   if (num_pts > num_samples) {
@@ -1124,7 +1051,9 @@ int main( int argc, char *argv[] ) {
       // of scope prematurely, which will result in incorrect behavior.
       BestFitPlaneFunctor func(use_proj_water_surface);
       BestFitPlaneErrorMetric error_metric;
-      math::RandomSampleConsensus<BestFitPlaneFunctor, BestFitPlaneErrorMetric> 
+      // The hypotheses are evaluated in parallel. The result does not
+      // depend on the number of threads.
+      asp::ParallelRansac<BestFitPlaneFunctor, BestFitPlaneErrorMetric> 
         ransac(func, error_metric,
                opt.num_ransac_iterations, inlier_threshold,
                min_num_output_inliers, reduce_min_num_output_inliers_if_no_fit);
@@ -36,10 +36,13 @@
 #include <asp/Core/ImageUtils.h>
 #include <asp/Core/OutlierProcessing.h>
 #include <asp/Core/DataLoader.h>
+#include <asp/Core/Tracing.h>
 #include <asp/Camera/BundleAdjustEigen.h>
+#include <asp/Camera/BundleAdjustSolver.h>
 
 #include <vw/Camera/CameraUtilities.h>
 #include <vw/Core/CmdUtils.h>
+#include <vw/Core/Settings.h>
 #include <vw/FileIO/MatrixIO.h>
 #include <vw/InterestPoint/Matcher.h>
 #include <vw/Cartography/GeoReferenceBaseUtils.h>
@@ -48,6 +51,13 @@
 
 #include <xercesc/util/PlatformUtils.hpp>
 
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <iomanip>
+
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
@@ -74,6 +84,18 @@ private:
   asp::BAParams const& m_param_storage;
 };
 
+// Record each solver iteration in the trace, if tracing
+class TraceCallback: public ceres::IterationCallback {
+public:
+  virtual ceres::CallbackReturnType operator() (const ceres::IterationSummary& summary) {
+    std::int64_t dur = summary.iteration_time_in_seconds * 1.0e+6;
+    asp::trace_record("ceres_iteration", "solver", asp::trace_now_us() - dur, dur,
+                      "iteration " + std::to_string(summary.iteration) +
+                      ", cost " + std::to_string(summary.cost));
+    return ceres::SOLVER_CONTINUE;
+  }
+};
+
 void Options::copy_to_asp_settings() const {
   asp::stereo_settings().ip_matching_method         = ip_detect_method;
   asp::stereo_settings().epipolar_threshold         = epipolar_threshold;
@@ -83,6 +105,7 @@ void Options::copy_to_asp_settings() const {
   asp::stereo_settings().nodata_value               = nodata_value;
 
   asp::stereo_settings().aster_use_csm = aster_use_csm;
+  asp::stereo_settings().isis_to_csm_max_pixel_error = isis_to_csm_max_pixel_error;
   asp::stereo_settings().ip_per_tile = ip_per_tile;
   asp::stereo_settings().ip_per_image = ip_per_image;
   asp::stereo_settings().matches_per_tile = matches_per_tile;
@@ -102,6 +125,7 @@ void Options::copy_to_asp_settings() const {
   //asp::stereo_settings().lon_lat_limit              = lon_lat_limit;
 
   asp::stereo_settings().individually_normalize     = individually_normalize;
+  asp::stereo_settings().image_stats_accuracy       = image_stats_accuracy;
   asp::stereo_settings().force_reuse_match_files    = force_reuse_match_files;
   asp::stereo_settings().min_triangulation_angle    = min_triangulation_angle;
   asp::stereo_settings().ip_triangulation_max_error = ip_triangulation_max_error;
@@ -110,6 +134,8 @@ void Options::copy_to_asp_settings() const {
   asp::stereo_settings().ip_debug_images            = ip_debug_images;
   asp::stereo_settings().ip_normalize_tiles         = ip_normalize_tiles;
   asp::stereo_settings().flann_method               = flann_method;
+  asp::stereo_settings().ip_brute_force_matching    = ip_brute_force_matching;
+  asp::stereo_settings().ip_detect_in_bands         = ip_detect_in_bands;
   asp::stereo_settings().propagate_errors           = propagate_errors;
   // The setting below is not used, but populate it for completeness
   asp::stereo_settings().horizontal_stddev          = vw::Vector2(horizontal_stddev,
@@ -176,8 +202,15 @@ void add_reprojection_residual_block(Vector2 const& observation, Vector2 const&
       vw::vw_throw(vw::ArgumentErr() << "Unknown camera type.");
     }
 
-    ceres::CostFunction* cost_function =
-      BaReprojectionError::Create(observation, pixel_sigma, wrapper);
+    // Pinhole and CSM frame cameras have a faster cost function, with the
+    // point and pose Jacobians found via the chain rule. Otherwise
+    // use numerical differentiation.
+    ceres::CostFunction* cost_function = NULL;
+    if (opt.camera_type == BaCameraType_Pinhole || opt.camera_type == BaCameraType_CSM)
+      cost_function = BaFrameReprojectionError::Create(observation, pixel_sigma,
+                                                       camera_model);
+    if (cost_function == NULL)
+      cost_function = BaReprojectionError::Create(observation, pixel_sigma, wrapper);
     problem.AddResidualBlock(cost_function, loss_function, point, camera, 
                             center, focus, distortion);
 
@@ -315,7 +348,8 @@ int add_to_outliers(ControlNetwork & cnet,
                     size_t num_tri_residuals,
                     size_t num_cam_pos_residuals,
                     std::vector<vw::Vector3> const& reference_vec, 
-                    ceres::Problem &problem) {
+                    ceres::Problem &problem,
+                    std::vector<ceres::ResidualBlockId> const& residual_blocks) {
 
   vw_out() << "Removing pixel outliers in preparation for another solver attempt.\n";
 
@@ -328,7 +362,7 @@ int add_to_outliers(ControlNetwork & cnet,
   asp::compute_residuals(opt, crn, param_storage,  cam_residual_counts, pixel_sigmas, 
                     num_gcp_or_dem_residuals, num_uncertainty_residuals,
                     num_tri_residuals, num_cam_pos_residuals,
-                    reference_vec, problem,
+                    reference_vec, problem, residual_blocks,
                     // output
                     residuals);
 
@@ -713,28 +747,254 @@ void addCamPosCostFun(Options                                 const& opt,
 }
 
 // One pass of bundle adjustment
-int do_ba_ceres_one_pass(Options             & opt,
-                         asp::CRNJ      const& crn,
-                         bool                  first_pass,
-                         bool                  remove_outliers, 
-                         asp::BAParams       & param_storage, 
-                         asp::BAParams const & orig_parameters,
-                         bool                & convergence_reached,
-                         double              & final_cost) {
+// Set the linear solver according to the recommendations in the Ceres
+// solving FAQs.
+void setLinearSolver(int num_cameras, ceres::Solver::Options & options) {
+  options.linear_solver_type = ceres::SPARSE_SCHUR;
+  if (num_cameras < 100)
+    options.linear_solver_type = ceres::DENSE_SCHUR;
+  if (num_cameras > 3500) {
+    // This is supposed to help with speed in a certain size range
+    options.use_explicit_schur_complement = true; 
+    options.linear_solver_type  = ceres::ITERATIVE_SCHUR;
+    options.preconditioner_type = ceres::SCHUR_JACOBI;
+  }
+  if (num_cameras > 7000)
+    options.use_explicit_schur_complement = false; // Only matters with ITERATIVE_SCHUR
+}
+
+// Split the cameras into groups of up to partition_size cameras which see
+// common triangulated points. Each group is grown from the lowest-index
+// camera not yet in a group, by visiting the cameras it overlaps with in
+// breadth-first order. Also produce the inlier points seen by each camera.
+void partitionCameras(asp::CRNJ const& crn, asp::BAParams const& param_storage,
+                      int partition_size, 
+                      std::vector<std::vector<int>> & groups,
+                      std::vector<std::vector<int>> & cam_points) {
 
-  ControlNetwork & cnet = *opt.cnet;
   int num_cameras = param_storage.num_cameras();
   int num_points  = param_storage.num_points();
 
-  if ((int)crn.size() != num_cameras) 
-    vw_throw(ArgumentErr() << "Book-keeping error, the size of CameraRelationNetwork "
-             << "must equal the number of images.\n");
- 
+  std::vector<std::vector<int>> point_cams(num_points);
+  cam_points.clear();
+  cam_points.resize(num_cameras);
+  for (int icam = 0; icam < num_cameras; icam++) {
+    for (auto fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++) {
+      int ipt = (**fiter).m_point_id;
+      if (param_storage.get_point_outlier(ipt))
+        continue;
+      point_cams[ipt].push_back(icam);
+      cam_points[icam].push_back(ipt);
+    }
+  }
+
+  groups.clear();
+  std::vector<bool> queued(num_cameras, false);
+  std::vector<int> point_group(num_points, -1); // last group which visited a point
+  for (int seed = 0; seed < num_cameras; seed++) {
+    if (queued[seed])
+      continue;
+
+    int group_id = groups.size();
+    std::vector<int> group;
+    std::deque<int> queue;
+    queue.push_back(seed);
+    queued[seed] = true;
+    while (!queue.empty() && (int)group.size() < partition_size) {
+      int icam = queue.front();
+      queue.pop_front();
+      group.push_back(icam);
+      for (size_t it = 0; it < cam_points[icam].size(); it++) {
+        int ipt = cam_points[icam][it];
+        if (point_group[ipt] == group_id)
+          continue;
+        point_group[ipt] = group_id;
+        for (size_t jt = 0; jt < point_cams[ipt].size(); jt++) {
+          int jcam = point_cams[ipt][jt];
+          if (queued[jcam])
+            continue;
+          queued[jcam] = true;
+          queue.push_back(jcam);
+        }
+      }
+    }
+
+    // The cameras which did not fit will be in later groups
+    for (size_t it = 0; it < queue.size(); it++)
+      queued[queue[it]] = false;
+
+    groups.push_back(group);
+  }
+}
+
+// Solve the problem for one group of cameras at a time, with the other
+// cameras, and the points not seen by the group, held fixed. The points
+// seen by more than one group tie the groups together, and several sweeps
+// over the groups make them agree. Ceres leaves out the residuals having
+// only fixed parameters, so each solve is of the size of its group.
+void solvePartitioned(Options const& opt, asp::CRNJ const& crn,
+                      asp::BAParams & param_storage, ceres::Problem & problem,
+                      ceres::Solver::Options const& options,
+                      double & final_cost, bool & convergence_reached) {
+
+  std::vector<std::vector<int>> groups, cam_points;
+  partitionCameras(crn, param_storage, opt.partition_size, groups, cam_points);
+
+  // Blocks that are fixed for other reasons, such as with
+  // --fixed-camera-indices or for fixed GCP, will not be touched.
+  int num_cameras = param_storage.num_cameras();
+  int num_points  = param_storage.num_points();
+  std::vector<int> free_cams, free_points;
+  for (int icam = 0; icam < num_cameras; icam++) {
+    double * cam_ptr = param_storage.get_camera_ptr(icam);
+    if (problem.HasParameterBlock(cam_ptr) && !problem.IsParameterBlockConstant(cam_ptr))
+      free_cams.push_back(icam);
+  }
+  for (int ipt = 0; ipt < num_points; ipt++) {
+    double * point_ptr = param_storage.get_point_ptr(ipt);
+    if (problem.HasParameterBlock(point_ptr) && !problem.IsParameterBlockConstant(point_ptr))
+      free_points.push_back(ipt);
+  }
+
+  vw_out() << "Solving for " << groups.size() << " groups of up to "
+           << opt.partition_size << " cameras.\n";
+
+  // With several jobs, each solves for every num_partition_jobs-th group. The
+  // caller merges the cameras solved for by each job.
+  std::vector<bool> solved(num_cameras, false);
+  if (opt.num_partition_jobs > 0)
+    vw_out() << "Solving for the groups of job " << opt.partition_job << " of "
+             << opt.num_partition_jobs << ".\n";
+
   convergence_reached = true;
+  std::vector<bool> in_group(num_cameras), seen_by_group(num_points);
+  for (int sweep = 0; sweep < opt.partition_sweeps; sweep++) {
+    for (size_t g = 0; g < groups.size(); g++) {
+
+      // Alternate the direction of the sweeps, so no group is always last
+      int ig = (sweep % 2 == 0) ? g : groups.size() - 1 - g;
+      if (opt.num_partition_jobs > 0 && ig % opt.num_partition_jobs != opt.partition_job)
+        continue;
+      std::vector<int> const& group = groups[ig];
+
+      std::fill(in_group.begin(), in_group.end(), false);
+      std::fill(seen_by_group.begin(), seen_by_group.end(), false);
+      for (size_t it = 0; it < group.size(); it++) {
+        in_group[group[it]] = true;
+        for (size_t jt = 0; jt < cam_points[group[it]].size(); jt++)
+          seen_by_group[cam_points[group[it]][jt]] = true;
+      }
+
+      int num_group_cams = 0;
+      for (size_t it = 0; it < free_cams.size(); it++) {
+        double * cam_ptr = param_storage.get_camera_ptr(free_cams[it]);
+        if (in_group[free_cams[it]]) {
+          problem.SetParameterBlockVariable(cam_ptr);
+          solved[free_cams[it]] = true;
+          num_group_cams++;
+        } else {
+          problem.SetParameterBlockConstant(cam_ptr);
+        }
+      }
+      if (num_group_cams == 0)
+        continue; // All cameras in this group are fixed
+      for (size_t it = 0; it < free_points.size(); it++) {
+        double * point_ptr = param_storage.get_point_ptr(free_points[it]);
+        if (seen_by_group[free_points[it]])
+          problem.SetParameterBlockVariable(point_ptr);
+        else
+          problem.SetParameterBlockConstant(point_ptr);
+      }
+
+      vw_out() << "Sweep " << sweep + 1 << " of " << opt.partition_sweeps
+               << ", camera group " << g + 1 << " of " << groups.size()
+               << " (" << num_group_cams << " cameras).\n";
+      ceres::Solver::Options group_options = options;
+      setLinearSolver(num_group_cams, group_options);
+      ceres::Solver::Summary summary;
+      ceres::Solve(group_options, &problem, &summary);
+      vw_out() << summary.BriefReport() << "\n";
+      if (summary.termination_type == ceres::NO_CONVERGENCE)
+        convergence_reached = false;
+    }
+  }
+
+  // Undo the changes, as the problem is used further
+  for (size_t it = 0; it < free_cams.size(); it++)
+    problem.SetParameterBlockVariable(param_storage.get_camera_ptr(free_cams[it]));
+  for (size_t it = 0; it < free_points.size(); it++)
+    problem.SetParameterBlockVariable(param_storage.get_point_ptr(free_points[it]));
+
+  problem.Evaluate(ceres::Problem::EvaluateOptions(), &final_cost, NULL, NULL, NULL);
+  vw_out() << "Final cost of the full problem: " << final_cost << "\n";
+
+  if (opt.num_partition_jobs > 0) {
+    // For each camera, whether it was solved for, and its adjustment file
+    std::string list_file = opt.out_prefix + "-partition-cameras.txt";
+    vw_out() << "Writing: " << list_file << "\n";
+    std::ofstream ofs(list_file.c_str());
+    for (int icam = 0; icam < num_cameras; icam++)
+      ofs << icam << " " << int(solved[icam]) << " "
+          << asp::bundle_adjust_file_name(opt.out_prefix, opt.image_files[icam],
+                                          opt.camera_files[icam]) << "\n";
+    ofs.close();
+  }
+}
+
+// The Ceres problem and its book-keeping. When the problem can be reused, it
+// persists across the passes of outlier removal, and each later pass
+// only removes the residuals of the points newly flagged as outliers.
+struct BaProblem {
+  boost::shared_ptr<ceres::Problem> problem;
+  bool reusable;
+  std::vector<size_t> cam_residual_counts;
+  std::vector<std::map<int, vw::Vector2>> pixel_sigmas;
+  int num_gcp_or_dem_residuals, num_uncertainty_residuals, num_tri_residuals,
+    num_cam_pos_residuals;
+  std::vector<vw::Vector3> reference_vec;
+  std::vector<ImageViewRef<DispPixelT>> interp_disp; // must be kept in scope
+  std::vector<vw::CamPtr> orig_cams;
+  // The residual blocks in the order they were added. Removing blocks
+  // reorders them in the problem, and the residual logs need this order.
+  std::vector<ceres::ResidualBlockId> residual_blocks;
+  // Points with residuals in the problem, and those with a GCP or DEM constraint
+  std::vector<bool> active_points;
+  std::set<int> gcp_or_dem_points;
+  // The triangulation constraint functors, owned by the problem, so that
+  // they can be re-anchored at each pass.
+  std::map<int, XYZError*> tri_functors;
+  BaProblem(): reusable(false), num_gcp_or_dem_residuals(0), num_uncertainty_residuals(0),
+               num_tri_residuals(0), num_cam_pos_residuals(0) {}
+};
+
+// The problem can be kept across passes only if removing outliers does
+// not change the remaining residuals. The DEM and weight image constraints
+// are re-evaluated at the moved points, and the camera position and
+// uncertainty constraints depend on the number of inlier pixels per camera,
+// so these need a rebuild.
+bool canReuseBaProblem(Options const& opt) {
+  return opt.num_ba_passes > 1 && opt.heights_from_dem.empty() &&
+    opt.weight_image.empty() && opt.camera_position_weight <= 0 &&
+    opt.camera_position_uncertainty.empty();
+}
+
+// Build the Ceres problem from the inliers
+void buildBaProblem(Options             & opt,
+                    asp::CRNJ      const& crn,
+                    asp::BAParams       & param_storage, 
+                    asp::BAParams const & orig_parameters,
+                    BaProblem           & bp) {
+
+  ControlNetwork & cnet = *opt.cnet;
+  int num_cameras = param_storage.num_cameras();
+  int num_points  = param_storage.num_points();
+
+  bp = BaProblem();
+  bp.reusable = canReuseBaProblem(opt);
+  ceres::Problem::Options problem_options;
+  problem_options.enable_fast_removal = bp.reusable;
+  bp.problem.reset(new ceres::Problem(problem_options));
 
-  if (opt.proj_win != BBox2(0, 0, 0, 0) && (!opt.proj_str.empty()))
-    initial_filter_by_proj_win(opt, param_storage, cnet);
-  
   // How many times an xyz point shows up in the problem
   std::vector<int> count_map(num_points);
   for (int i = 0; i < num_points; i++) {
@@ -765,9 +1025,18 @@ int do_ba_ceres_one_pass(Options             & opt,
   }
   if (opt.heights_from_dem != "") {
     vw::vw_out() << "Constraining against DEM: " << opt.heights_from_dem << "\n";
-    asp::create_interp_dem(opt.heights_from_dem, dem_georef, interp_dem);
+    // Read in memory the DEM window around the points to be updated
+    std::vector<Vector3> inlier_xyz;
+    for (int ipt = 0; ipt < num_points; ipt++) {
+      if (outliers.find(ipt) == outliers.end())
+        inlier_xyz.push_back(cnet[ipt].position());
+    }
+    vw::ImageViewRef<vw::PixelMask<float>> masked_dem;
+    asp::create_masked_dem(opt.heights_from_dem, inlier_xyz, dem_georef, masked_dem);
+    asp::create_interp_dem(masked_dem, interp_dem);
+    asp::DemHeightPyramid dem_pyramid(masked_dem, dem_georef);
     asp::update_point_from_dem(cnet, crn, outliers, opt.camera_models,
-                               dem_georef, interp_dem, 
+                               dem_georef, interp_dem, dem_pyramid,
                                // Output
                                dem_xyz_vec);
   }
@@ -788,12 +1057,15 @@ int do_ba_ceres_one_pass(Options             & opt,
   // First is pixel reprojection error. Note: cam_residual_counts and num_pixels_per_cam
   // serve different purposes. 
   // TODO(oalexan1): Put this in a separate function.
-  ceres::Problem problem;
-  std::vector<size_t> cam_residual_counts(num_cameras, 0);
+  ceres::Problem & problem = *bp.problem;
+  std::vector<size_t> & cam_residual_counts = bp.cam_residual_counts;
+  cam_residual_counts.resize(num_cameras, 0);
   std::vector<size_t> num_pixels_per_cam(num_cameras, 0);
   std::vector<std::vector<vw::Vector2>> pixels_per_cam(num_cameras);
   std::vector<std::vector<vw::Vector3>> tri_points_per_cam(num_cameras);
-  std::vector<std::map<int, vw::Vector2>> pixel_sigmas(num_cameras);
+  std::vector<std::map<int, vw::Vector2>> & pixel_sigmas = bp.pixel_sigmas;
+  pixel_sigmas.resize(num_cameras);
+  bp.active_points.resize(num_points, false);
   for (int icam = 0; icam < num_cameras; icam++) { // Camera loop
     cam_residual_counts[icam] = 0;
     num_pixels_per_cam[icam] = 0;
@@ -884,6 +1156,7 @@ int do_ba_ceres_one_pass(Options             & opt,
       // Call function to add the appropriate Ceres residual block.
       add_reprojection_residual_block(observation, pixel_sigma, ipt, icam,
                                       param_storage, opt, problem);
+      bp.active_points[ipt] = true;
       cam_residual_counts[icam] += 1; // Track the number of residual blocks for each camera
       num_pixels_per_cam[icam] += 1;  // Track the number of pixels for each camera
       
@@ -893,7 +1166,7 @@ int do_ba_ceres_one_pass(Options             & opt,
   // Add ground control points or points based on a DEM constraint
   // Error goes up as GCP's move from their input positions.
   // TODO(oalexan1): Put this in a separate function.
-  int num_gcp = 0, num_gcp_or_dem_residuals = 0;
+  int & num_gcp_or_dem_residuals = bp.num_gcp_or_dem_residuals;
   for (int ipt = 0; ipt < num_points; ipt++) {
     if (cnet[ipt].type() != ControlPoint::GroundControlPoint &&
         cnet[ipt].type() != ControlPoint::PointFromDem)
@@ -901,8 +1174,6 @@ int do_ba_ceres_one_pass(Options             & opt,
 
     if (param_storage.get_point_outlier(ipt))
       continue; // skip outliers
-    if (cnet[ipt].type() == ControlPoint::GroundControlPoint)
-      num_gcp++;
     Vector3 observation = cnet[ipt].position();
     Vector3 xyz_sigma   = cnet[ipt].sigma();
 
@@ -931,6 +1202,8 @@ int do_ba_ceres_one_pass(Options             & opt,
     }
     double * point  = param_storage.get_point_ptr(ipt);
     problem.AddResidualBlock(cost_function, loss_function, point);
+    bp.active_points[ipt] = true;
+    bp.gcp_or_dem_points.insert(ipt);
 
     num_gcp_or_dem_residuals++;
     
@@ -980,11 +1253,11 @@ int do_ba_ceres_one_pass(Options             & opt,
   // Camera uncertainty. This is a rather hard constraint.
   // TODO(oalexan1): Likely orig_cams have the info as opt.camera_models. But need
   // to test this.
-  std::vector<vw::CamPtr> orig_cams;
+  std::vector<vw::CamPtr> & orig_cams = bp.orig_cams;
   asp::calcOptimizedCameras(opt, orig_parameters, orig_cams); // orig cameras
   std::vector<vw::Vector3> orig_cam_positions;
   asp::calcCameraCenters(orig_cams, orig_cam_positions);
-  int num_uncertainty_residuals = 0;
+  int & num_uncertainty_residuals = bp.num_uncertainty_residuals;
   if (opt.camera_position_uncertainty.size() > 0) {
     for (int icam = 0; icam < num_cameras; icam++) {
       // orig_ctr has the actual camera center, but orig_cam_ptr may have an adjustment
@@ -1004,20 +1277,19 @@ int do_ba_ceres_one_pass(Options             & opt,
 
   // Add a soft constraint to keep the cameras near the original position. Add one
   // constraint per reprojection error.
-  int num_cam_pos_residuals = 0;
+  int & num_cam_pos_residuals = bp.num_cam_pos_residuals;
   if (opt.camera_position_weight > 0)
     addCamPosCostFun(opt, orig_parameters, pixels_per_cam, tri_points_per_cam, pixel_sigmas,
                      orig_cams, param_storage, problem, num_cam_pos_residuals);
   
   // Add a cost function meant to tie up to known disparity
   // (option --reference-terrain).
-  std::vector<vw::Vector3> reference_vec;
-  std::vector<ImageViewRef<DispPixelT>> interp_disp; // must be kept in scope
   if (opt.reference_terrain != "") 
-    addReferenceTerrainCostFunction(opt, param_storage, problem, reference_vec, interp_disp);
+    addReferenceTerrainCostFunction(opt, param_storage, problem, bp.reference_vec,
+                                    bp.interp_disp);
 
   // TODO(oalexan1): Put this in a separate function
-  int num_tri_residuals = 0;
+  int & num_tri_residuals = bp.num_tri_residuals;
   if (opt.tri_weight > 0) {
     // Add triangulation weight to make each triangulated point not move too far
     std::vector<double> gsds;
@@ -1044,15 +1316,146 @@ int do_ba_ceres_one_pass(Options             & opt,
       double s = gsd/opt.tri_weight;
       Vector3 xyz_sigma(s, s, s);
 
-      ceres::CostFunction* cost_function = XYZError::Create(observation, xyz_sigma);
+      // Keep the functor, so it can be re-anchored if the problem is reused
+      XYZError * tri_functor = new XYZError(observation, xyz_sigma);
+      ceres::CostFunction* cost_function
+        = new ceres::AutoDiffCostFunction<XYZError, 3, 3>(tri_functor);
       ceres::LossFunction* loss_function 
         = get_loss_function(opt.cost_function, opt.tri_robust_threshold);
       problem.AddResidualBlock(cost_function, loss_function, point);
+      bp.tri_functors[ipt] = tri_functor;
 
       num_tri_residuals++;
     } // End loop through xyz
   } // end adding a triangulation constraint
 
+  // With no blocks removed yet, these are in the order they were added
+  problem.GetResidualBlocks(&bp.residual_blocks);
+} // End function buildBaProblem
+
+// Remove from the problem the residuals of the points that were flagged as
+// outliers after it was built, and anchor the triangulation constraint at
+// the latest triangulated points, as done when the problem is built.
+void updateBaProblem(Options        const& opt,
+                     asp::CRNJ      const& crn,
+                     asp::BAParams       & param_storage,
+                     BaProblem           & bp) {
+
+  ControlNetwork const& cnet = *opt.cnet;
+  ceres::Problem & problem = *bp.problem;
+  int num_points = param_storage.num_points();
+
+  std::set<ceres::ResidualBlockId> removed;
+  int num_removed_points = 0;
+  for (int ipt = 0; ipt < num_points; ipt++) {
+    if (!bp.active_points[ipt] || !param_storage.get_point_outlier(ipt))
+      continue;
+    bp.active_points[ipt] = false;
+    num_removed_points++;
+
+    // Undo the book-keeping done when the residuals of this point were added
+    size_t num_expected = 0;
+    for (size_t im = 0; im < cnet[ipt].size(); im++) {
+      int icam = cnet[ipt][im].image_id();
+      if (bp.pixel_sigmas[icam].find(ipt) == bp.pixel_sigmas[icam].end())
+        continue;
+      bp.cam_residual_counts[icam]--;
+      num_expected++;
+    }
+    for (size_t im = 0; im < cnet[ipt].size(); im++)
+      bp.pixel_sigmas[cnet[ipt][im].image_id()].erase(ipt);
+    if (bp.gcp_or_dem_points.erase(ipt) > 0) {
+      bp.num_gcp_or_dem_residuals--;
+      num_expected++;
+    }
+    auto tri_it = bp.tri_functors.find(ipt);
+    if (tri_it != bp.tri_functors.end()) {
+      bp.tri_functors.erase(tri_it);
+      bp.num_tri_residuals--;
+      num_expected++;
+    }
+
+    // The point block is kept, as other logic may look it up. Ceres ignores
+    // parameter blocks without residuals.
+    std::vector<ceres::ResidualBlockId> blocks;
+    problem.GetResidualBlocksForParameterBlock(param_storage.get_point_ptr(ipt), &blocks);
+    if (blocks.size() != num_expected)
+      vw_throw(LogicErr() << "Book-keeping error when removing the residuals of point "
+               << ipt << ". Expected " << num_expected << " residual blocks, but found "
+               << blocks.size() << ".\n");
+    for (size_t it = 0; it < blocks.size(); it++) {
+      problem.RemoveResidualBlock(blocks[it]);
+      removed.insert(blocks[it]);
+    }
+  }
+
+  if (!removed.empty()) {
+    std::vector<ceres::ResidualBlockId> kept;
+    kept.reserve(bp.residual_blocks.size() - removed.size());
+    for (size_t it = 0; it < bp.residual_blocks.size(); it++) {
+      if (removed.find(bp.residual_blocks[it]) == removed.end())
+        kept.push_back(bp.residual_blocks[it]);
+    }
+    bp.residual_blocks.swap(kept);
+  }
+
+  if (!bp.tri_functors.empty()) {
+    std::vector<double> gsds;
+    asp::estimateGsdPerTriPoint(opt.image_files, bp.orig_cams, crn, param_storage, gsds);
+    for (auto & tri: bp.tri_functors) {
+      double const* point = param_storage.get_point_ptr(tri.first);
+      tri.second->m_observation = Vector3(point[0], point[1], point[2]);
+      double gsd = gsds[tri.first];
+      if (gsd <= 0)
+        continue; // Keep the previous sigma
+      double s = gsd/opt.tri_weight;
+      tri.second->m_xyz_sigma = Vector3(s, s, s);
+    }
+  }
+
+  vw_out() << "Reusing the problem from the previous pass. Removed the residuals of "
+           << num_removed_points << " outlier points.\n";
+}
+
+int do_ba_ceres_one_pass(Options             & opt,
+                         asp::CRNJ      const& crn,
+                         bool                  first_pass,
+                         bool                  remove_outliers, 
+                         asp::BAParams       & param_storage, 
+                         asp::BAParams const & orig_parameters,
+                         BaProblem           & bp,
+                         bool                & convergence_reached,
+                         double              & final_cost,
+                         ceres::IterationCallback * extra_callback = NULL) {
+
+  ControlNetwork & cnet = *opt.cnet;
+  int num_cameras = param_storage.num_cameras();
+  int num_points  = param_storage.num_points();
+
+  if ((int)crn.size() != num_cameras) 
+    vw_throw(ArgumentErr() << "Book-keeping error, the size of CameraRelationNetwork "
+             << "must equal the number of images.\n");
+ 
+  convergence_reached = true;
+
+  if (opt.proj_win != BBox2(0, 0, 0, 0) && (!opt.proj_str.empty()))
+    initial_filter_by_proj_win(opt, param_storage, cnet);
+
+  if (bp.problem.get() != NULL && bp.reusable)
+    updateBaProblem(opt, crn, param_storage, bp);
+  else
+    buildBaProblem(opt, crn, param_storage, orig_parameters, bp);
+
+  ceres::Problem & problem = *bp.problem;
+  std::vector<size_t> const& cam_residual_counts = bp.cam_residual_counts;
+  std::vector<std::map<int, vw::Vector2>> const& pixel_sigmas = bp.pixel_sigmas;
+  int num_gcp_or_dem_residuals  = bp.num_gcp_or_dem_residuals;
+  int num_uncertainty_residuals = bp.num_uncertainty_residuals;
+  int num_tri_residuals         = bp.num_tri_residuals;
+  int num_cam_pos_residuals     = bp.num_cam_pos_residuals;
+  std::vector<vw::Vector3> const& reference_vec = bp.reference_vec;
+  std::vector<ceres::ResidualBlockId> const& residual_blocks = bp.residual_blocks;
+
   const size_t MIN_KML_POINTS = 50;
   size_t kmlPointSkip = 30;
   // Figure out a good KML point skip amount
@@ -1076,7 +1479,7 @@ int do_ba_ceres_one_pass(Options             & opt,
                         num_gcp_or_dem_residuals, 
                         num_uncertainty_residuals, num_tri_residuals,
                         num_cam_pos_residuals, 
-                        reference_vec, cnet, crn, problem);
+                        reference_vec, cnet, crn, problem, residual_blocks);
 
     std::string point_kml_path  = opt.out_prefix + "-initial_points.kml";
     std::string url = "http://maps.google.com/mapfiles/kml/shapes/placemark_circle.png";
@@ -1104,19 +1507,15 @@ int do_ba_ceres_one_pass(Options             & opt,
     options.callbacks.push_back(&callback);
     options.update_state_every_iteration = true;
   }
+  if (extra_callback != NULL)
+    options.callbacks.push_back(extra_callback);
+  TraceCallback trace_callback;
+  if (asp::trace_enabled())
+    options.callbacks.push_back(&trace_callback);
 
   // Set solver options according to the recommendations in the Ceres solving FAQs
-  options.linear_solver_type = ceres::SPARSE_SCHUR;
-  if (num_cameras < 100)
-    options.linear_solver_type = ceres::DENSE_SCHUR;
-  if (num_cameras > 3500) {
-    // This is supposed to help with speed in a certain size range
-    options.use_explicit_schur_complement = true; 
-    options.linear_solver_type  = ceres::ITERATIVE_SCHUR;
-    options.preconditioner_type = ceres::SCHUR_JACOBI;
-  }
-  if (num_cameras > 7000)
-    options.use_explicit_schur_complement = false; // Only matters with ITERATIVE_SCHUR
+  setLinearSolver(num_cameras, options);
+  asp::applySolverPreset(opt.solver_preset, options);
 
   //options.ordering_type = ceres::SCHUR;
   //options.eta = 1e-3; // FLAGS_eta;
@@ -1126,14 +1525,21 @@ int do_ba_ceres_one_pass(Options             & opt,
   //}
 
   vw_out() << "Starting the Ceres optimizer." << std::endl;
-  ceres::Solver::Summary summary;
-  ceres::Solve(options, &problem, &summary);
-  final_cost = summary.final_cost;
-  vw_out() << summary.FullReport() << "\n";
-  if (summary.termination_type == ceres::NO_CONVERGENCE) {
+  if (opt.partition_size > 0 &&
+      (num_cameras > opt.partition_size || opt.num_partition_jobs > 0)) {
+    solvePartitioned(opt, crn, param_storage, problem, options,
+                     final_cost, convergence_reached);
+  } else {
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+    final_cost = summary.final_cost;
+    vw_out() << summary.FullReport() << "\n";
+    if (summary.termination_type == ceres::NO_CONVERGENCE)
+      convergence_reached = false;
+  }
+  if (!convergence_reached) {
     // Print a clarifying message, so the user does not think that the algorithm failed.
     vw_out() << "Found a valid solution, but did not reach the actual minimum. This is expected and likely the produced solution is good enough.\n";
-    convergence_reached = false;
   }
 
   // Write the condition files after each pass, as we never know which pass will be the last
@@ -1145,7 +1551,7 @@ int do_ba_ceres_one_pass(Options             & opt,
                       num_gcp_or_dem_residuals, 
                       num_uncertainty_residuals, num_tri_residuals,
                       num_cam_pos_residuals,
-                      reference_vec, cnet, crn, problem);
+                      reference_vec, cnet, crn, problem, residual_blocks);
   
   std::string point_kml_path = opt.out_prefix + "-final_points.kml";
   std::string url
@@ -1159,77 +1565,174 @@ int do_ba_ceres_one_pass(Options             & opt,
                       param_storage,   // in-out
                       opt, cam_residual_counts, pixel_sigmas, num_gcp_or_dem_residuals,
                       num_uncertainty_residuals, num_tri_residuals,
-                      num_cam_pos_residuals, reference_vec, problem);
+                      num_cam_pos_residuals, reference_vec, problem, residual_blocks);
 
   return 0;
 } // End function do_ba_ceres_one_pass
 
+// Stop a random pass once its cost is clearly worse than the best cost found
+// so far by any pass.
+class RandomPassAbortCallback: public ceres::IterationCallback {
+public:
+  RandomPassAbortCallback(std::atomic<double> const& best_cost, double factor):
+    m_best_cost(best_cost), m_factor(factor) {}
+
+  virtual ceres::CallbackReturnType operator() (const ceres::IterationSummary& summary) {
+    if (summary.iteration > 0 && summary.cost > m_factor * m_best_cost.load()) {
+      vw_out() << "Stopping a random pass, as its cost is more than "
+               << m_factor << " times the best cost so far.\n";
+      return ceres::SOLVER_ABORT;
+    }
+    return ceres::SOLVER_CONTINUE;
+  }
+
+private:
+  std::atomic<double> const& m_best_cost;
+  double m_factor;
+};
+
 // Run several more passes with random initial parameter offsets. This flow is
 // only kicked in if opt.num_random_passes is positive, which is not the
+// default. Each pass starts from the current parameters with its own random
+// offsets, and several passes can run concurrently, with the threads split
+// among them. The parameters with the lowest cost are kept.
 void runRandomPasses(Options & opt, asp::BAParams & param_storage,
                      double & final_cost, asp::CRNJ const& crn,
                      bool remove_outliers,
                      asp::BAParams const& orig_parameters) {
 
-  // Record the parameters of the best result so far
-  double best_cost = final_cost;
-  boost::shared_ptr<asp::BAParams> best_params_ptr(new asp::BAParams(param_storage));
-
-  // Back up the output prefix
+  int num_passes = opt.num_random_passes;
+  int num_parallel = std::max(1, std::min(opt.num_parallel_random_passes, num_passes));
+  if (num_parallel > 1 && opt.single_threaded_cameras) {
+    vw_out(vw::WarningMessage) << "These cameras cannot be used from several threads. "
+                               << "Running the random passes one at a time.\n";
+    num_parallel = 1;
+  }
+  int total_threads = opt.num_threads;
+  if (total_threads <= 0)
+    total_threads = vw::vw_settings().default_num_threads();
+  int threads_per_pass = std::max(1, total_threads / num_parallel);
+  if (num_parallel > 1)
+    vw_out() << "Running " << num_parallel << " random passes at a time, with "
+             << threads_per_pass << " threads each.\n";
+
+  // Zero-pad the pass index, so no temporary prefix is a prefix of another one
+  int num_digits = std::to_string(std::max(num_passes - 1, 0)).size();
   std::string orig_out_prefix = opt.out_prefix;
-  
-  for (int pass = 0; pass < opt.num_random_passes; pass++) {
+  std::vector<std::string> pass_prefixes(num_passes);
+  for (int pass = 0; pass < num_passes; pass++) {
+    std::ostringstream os;
+    os << orig_out_prefix << "_rand" << std::setw(num_digits) << std::setfill('0') << pass;
+    pass_prefixes[pass] = os.str();
+  }
 
-    vw_out() << "\n--> Running bundle adjust pass " << pass 
-             << " with random initial parameter offsets.\n";
+  // The random offsets are drawn from one generator, in the order of the
+  // passes, so the results do not depend on the number of threads.
+  boost::random::mt19937 rand_gen = param_storage.m_rand_gen;
 
-    // Randomly distort the original inputs.
-    param_storage.randomize_cameras();
-    if (opt.solve_intrinsics)
-      param_storage.randomize_intrinsics(opt.intrinsics_limits);
+  // The best result so far. The cost is read by the abort callbacks.
+  std::atomic<double> best_cost(final_cost);
+  boost::shared_ptr<asp::BAParams> best_params_ptr(new asp::BAParams(param_storage));
+  int best_pass = -1;
 
-    // Write output files to a temporary prefix
-    opt.out_prefix = orig_out_prefix + "_rand";
+  std::mutex mutex;
+  int next_pass = 0;
+  std::vector<std::exception_ptr> errors(num_parallel);
+  auto runPasses = [&](int worker) {
+    try {
+      while (1) {
+        int pass = 0;
+        boost::shared_ptr<asp::BAParams> pass_params;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (next_pass >= num_passes)
+            return;
+          pass = next_pass++;
+          vw_out() << "\n--> Running bundle adjust pass " << pass 
+                   << " with random initial parameter offsets.\n";
+
+          // Randomly distort the inputs
+          pass_params.reset(new asp::BAParams(param_storage));
+          pass_params->m_rand_gen = rand_gen;
+          pass_params->randomize_cameras();
+          if (opt.solve_intrinsics)
+            pass_params->randomize_intrinsics(opt.intrinsics_limits);
+          rand_gen = pass_params->m_rand_gen;
+        }
 
-    // Do another pass of bundle adjustment.
-    bool first_pass = true; // this needs more thinking
-    bool convergence_reached = true;
-    double curr_cost = 0.0; // will be set
-    do_ba_ceres_one_pass(opt, crn, first_pass, remove_outliers,
-                         param_storage, orig_parameters,
-                         convergence_reached, curr_cost);
-    
-    // Record the parameters of the best result.
-    if (curr_cost < best_cost) {
-      vw_out() << "  --> Found a better solution using random passes.\n";
-      best_cost = curr_cost;
-      best_params_ptr.reset(new asp::BAParams(param_storage));
-
-      // Get a list of all the files that were generated in the random step.
-      std::vector<std::string> rand_files;
-      get_files_with_prefix(opt.out_prefix, rand_files);
-
-      // Replace the existing output files with them.
-      for (size_t i = 0; i < rand_files.size(); i++) {
-        std::string new_path = rand_files[i];
-        boost::replace_all(new_path, opt.out_prefix, orig_out_prefix);
-        boost::filesystem::copy_file(rand_files[i], new_path,
-                                     fs::copy_options::overwrite_existing);
+        // Each pass has its own copy of the options and control network, as
+        // these are modified, and writes its files to a temporary prefix.
+        Options pass_opt = opt;
+        pass_opt.cnet.reset(new ControlNetwork(*opt.cnet));
+        pass_opt.out_prefix = pass_prefixes[pass];
+        pass_opt.num_threads = threads_per_pass;
+        
+        RandomPassAbortCallback abort_callback(best_cost, opt.random_pass_abort_factor);
+        ceres::IterationCallback * extra_callback = NULL;
+        if (opt.random_pass_abort_factor > 0)
+          extra_callback = &abort_callback;
+
+        // Do another pass of bundle adjustment.
+        bool first_pass = true; // this needs more thinking
+        bool convergence_reached = true;
+        double curr_cost = 0.0; // will be set
+        BaProblem bp; // each random pass starts from scratch
+        do_ba_ceres_one_pass(pass_opt, crn, first_pass, remove_outliers,
+                             *pass_params, orig_parameters, bp,
+                             convergence_reached, curr_cost, extra_callback);
+
+        // Record the parameters of the best result. Ties go to the earlier pass.
+        std::lock_guard<std::mutex> lock(mutex);
+        if (curr_cost < best_cost.load() ||
+            (curr_cost == best_cost.load() && best_pass >= 0 && pass < best_pass)) {
+          vw_out() << "  --> Found a better solution using random passes.\n";
+          best_cost.store(curr_cost);
+          best_params_ptr = pass_params;
+          best_pass = pass;
+        }
       }
+    } catch (...) {
+      errors[worker] = std::current_exception();
+      std::lock_guard<std::mutex> lock(mutex);
+      next_pass = num_passes; // stop the other workers
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int worker = 1; worker < num_parallel; worker++)
+    workers.push_back(std::thread(runPasses, worker));
+  runPasses(0);
+  for (size_t it = 0; it < workers.size(); it++)
+    workers[it].join();
+  for (size_t it = 0; it < errors.size(); it++) {
+    if (errors[it])
+      std::rethrow_exception(errors[it]);
+  }
+
+  // Replace the existing output files with the ones from the best pass
+  if (best_pass >= 0) {
+    std::vector<std::string> rand_files;
+    get_files_with_prefix(pass_prefixes[best_pass], rand_files);
+    for (size_t i = 0; i < rand_files.size(); i++) {
+      std::string new_path = rand_files[i];
+      boost::replace_all(new_path, pass_prefixes[best_pass], orig_out_prefix);
+      boost::filesystem::copy_file(rand_files[i], new_path,
+                                   fs::copy_options::overwrite_existing);
     }
+  }
 
-    // Clear out the extra files that were generated
-    std::string cmd("rm -f " + opt.out_prefix + "*");
+  // Clear out the extra files that were generated
+  for (int pass = 0; pass < num_passes; pass++) {
+    std::string cmd("rm -f " + pass_prefixes[pass] + "*");
     vw_out() << "Deleting temporary files: " << cmd << std::endl;
     vw::exec_cmd(cmd.c_str());
   }
-  opt.out_prefix = orig_out_prefix; // So the cameras are written to the expected paths.
   
   // Copy back to the original parameters
   param_storage = *best_params_ptr;
   
   // Copy back the best cost
-  final_cost = best_cost;
+  final_cost = best_cost.load();
 }
 
 // Sanity check. This does not prevent the user from setting the wrong datum,
@@ -1281,14 +1784,15 @@ void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc
     } else {
       // Read matches into a control network
       bool triangulate_control_points = true;
-      bool success = vw::ba::build_control_network(triangulate_control_points,
+      bool success = asp::build_control_network_with_cache(triangulate_control_points,
                                                    cnet, opt.camera_models,
                                                    opt.image_files,
                                                    opt.match_files,
                                                    opt.min_matches,
                                                    opt.min_triangulation_angle*(M_PI/180.0),
                                                    opt.forced_triangulation_distance,
-                                                   opt.max_pairwise_matches);
+                                                   opt.max_pairwise_matches,
+                                                   opt.out_prefix);
       if (!success) {
         vw_out() << "Failed to build a control network.\n"
                  << " - Consider removing all .vwip and .match files and \n"
@@ -1455,6 +1959,7 @@ void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc
   
   bool remove_outliers = (opt.num_ba_passes > 1);
   double final_cost = 0.0;
+  BaProblem bp; // built at the first pass, and reused later if possible
   for (int pass = 0; pass < opt.num_ba_passes; pass++) {
 
     if (opt.apply_initial_transform_only)
@@ -1465,7 +1970,7 @@ void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc
     bool first_pass = (pass == 0);
     bool convergence_reached = true; // will change
     do_ba_ceres_one_pass(opt, crn, first_pass, remove_outliers,
-                         param_storage, orig_parameters,
+                         param_storage, orig_parameters, bp,
                          convergence_reached, final_cost);
     int num_points_remaining = num_points - param_storage.get_num_outliers();
     if (num_points_remaining < opt.min_matches && num_gcp == 0) {
@@ -1701,6 +2206,12 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("input-adjustments-prefix",  po::value(&opt.input_prefix),
      "Prefix to read initial adjustments from, written by a previous invocation of "
      "this program.")
+    ("incremental-prefix",  po::value(&opt.incremental_prefix)->default_value(""),
+     "The output prefix of a previous run of this program on a subset of the images. "
+     "The cameras having adjustments with this prefix start from those. Matches are "
+     "found only for pairs having at least one new image, while the matches among "
+     "the previous images are read with this prefix. Cached camera footprints are "
+     "reused as well.")
     ("initial-transform",  po::value(&opt.initial_transform_file)->default_value(""),
      "Before optimizing the cameras, apply to them the 4x4 rotation + translation transform "
      "from this file. The transform is in respect to the planet center, such as written by "
@@ -1790,6 +2301,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Set the maximum number of iterations.") // alias for num-iterations
     ("parameter-tolerance",  po::value(&opt.parameter_tolerance)->default_value(1e-8),
      "Stop when the relative error in the variables being optimized is less than this.")
+    ("solver-preset", po::value(&opt.solver_preset)->default_value("auto"),
+     "How to solve the linear system at each iteration. Options: auto, dense-schur, sparse-schur, iterative-schur, iterative-schur-explicit, iterative-schur-power-series, sparse-schur-mixed-precision, cuda-dense-schur, cuda-sparse-schur. Some of these need a newer Ceres or one built with CUDA. The default picks a solver based on the problem size.")
     ("overlap-limit",        po::value(&opt.overlap_limit)->default_value(0),
      "Limit the number of subsequent images to search for matches to the current image to this value. By default match all images.")
     ("overlap-list",         po::value(&opt.overlap_list_file)->default_value(""),
@@ -1885,6 +2398,18 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "How many passes of bundle adjustment to do, with given number of iterations in each pass. For more than one pass, outliers will be removed between passes using --remove-outliers-params, and re-optimization will take place. Residual files and a copy of the match files with the outliers removed (*-clean.match) will be written to disk.")
     ("num-random-passes",           po::value(&opt.num_random_passes)->default_value(0),
      "After performing the normal bundle adjustment passes, do this many more passes using the same matches but adding random offsets to the initial parameter values with the goal of avoiding local minima that the optimizer may be getting stuck in.")
+    ("num-parallel-random-passes", po::value(&opt.num_parallel_random_passes)->default_value(1),
+     "How many of the --num-random-passes to run at the same time. The threads are split among them. Each needs its own copy of the problem in memory.")
+    ("random-pass-abort-factor", po::value(&opt.random_pass_abort_factor)->default_value(0.0),
+     "If positive, stop a random pass once its cost exceeds this multiple of the lowest cost found so far. The default is to never stop early.")
+    ("partition-size", po::value(&opt.partition_size)->default_value(0),
+     "If positive and there are more cameras than this, in each pass solve for groups of up to this many cameras which see common points, one group at a time, with the other cameras fixed. This takes much less memory and time for thousands of cameras. Set to 0 to solve for all cameras at once.")
+    ("partition-sweeps", po::value(&opt.partition_sweeps)->default_value(2),
+     "With --partition-size, how many times to solve for all camera groups in each pass.")
+    ("num-partition-jobs", po::value(&opt.num_partition_jobs)->default_value(0),
+     "With --partition-size, split the camera groups among this many jobs, and solve only for the groups of the job given by --partition-job. Save the list of cameras solved for in <output prefix>-partition-cameras.txt. Used by parallel_bundle_adjust.")
+    ("partition-job", po::value(&opt.partition_job)->default_value(0),
+     "The job to solve for, with --num-partition-jobs. The first job is 0.")
     ("camera-position-uncertainty",  
      po::value(&opt.camera_position_uncertainty_str)->default_value(""),
      "A list having on each line the image name and the horizontal and vertical camera "
@@ -1934,10 +2459,12 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("individually-normalize", 
      po::bool_switch(&opt.individually_normalize)->default_value(false)->implicit_value(true),
      "Individually normalize the input images instead of using common values.")
+    ("image-stats-accuracy", po::value(&opt.image_stats_accuracy)->default_value(0.0),
+     "If positive, estimate the image statistics used for normalization from a sample of small windows spread over the image and read in parallel, rather than from the whole image. The sample is large enough for the percentiles to be within this fraction of the pixels of their true values, such as 0.002, most of the time.")
     ("ip-triangulation-max-error",  po::value(&opt.ip_triangulation_max_error)->default_value(-1),
      "When matching IP, filter out any pairs with a triangulation error higher than this.")
     ("ip-num-ransac-iterations", po::value(&opt.ip_num_ransac_iterations)->default_value(1000),
-     "How many RANSAC iterations to do in interest point matching.")
+     "The maximum number of RANSAC iterations to do in interest point matching. Fewer are done once a good fit is found with 99.9% confidence.")
     ("min-triangulation-angle", po::value(&opt.min_triangulation_angle)->default_value(0.1),
      "Filter as outlier any triangulation point for which all rays converging to "
       "it have an angle less than this (measured in degrees). This happens on "
@@ -1954,6 +2481,11 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "in the GCP file (or DEM uncertainty) are applied accordingly.")
     ("aster-use-csm", po::bool_switch(&opt.aster_use_csm)->default_value(false)->implicit_value(true),
      "Use the CSM model with ASTER cameras (-t aster).")
+    ("isis-to-csm-max-pixel-error", 
+     po::value(&opt.isis_to_csm_max_pixel_error)->default_value(0.0),
+     "If positive, replace each ISIS linescan camera with a CSM model fit to it, "
+     "if the two agree to within this many pixels. The fit is cached next to the "
+     "cube.")
     ("mapprojected-data",  po::value(&opt.mapprojected_data)->default_value(""),
      "Given map-projected versions of the input images "
      "and the DEM they were mapprojected onto, create interest point matches between "
@@ -2018,8 +2550,14 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("flann-method",  po::value(&opt.flann_method)->default_value("kmeans"),
        "Choose the FLANN method for matching interest points. The default 'kmeans' is "
        "slower but deterministic, while 'kdtree' is faster but not deterministic.")
+    ("ip-brute-force-matching", po::bool_switch(&opt.ip_brute_force_matching)->default_value(false)->implicit_value(true),
+     "Match interest points by comparing all descriptors, rather than with FLANN. This is exact and deterministic, and can be faster for many interest points. Without a datum, only matches which are each other's nearest neighbor are kept.")
+    ("ip-detect-in-bands", po::bool_switch(&opt.ip_detect_in_bands)->default_value(false)->implicit_value(true),
+     "Detect interest points one band of 1024 image rows at a time, with the 1024 x 1024 cells of each band shared among threads. This needs memory only for one band, and makes use of all threads for large images.")
     ("save-vwip", po::bool_switch(&opt.save_vwip)->default_value(false)->implicit_value(true),
      "Save .vwip files (intermediate files for creating .match files). For parallel_bundle_adjust these will be saved in subdirectories, as they depend on the image pair. Must start with an empty output directory for this to work.")
+    ("no-ip-cache", po::bool_switch(&opt.no_ip_cache)->default_value(false)->implicit_value(true),
+     "Do not save the interest points of each image in the <output prefix>-ip-cache directory, to be reused when matching it with other images.")
     ("vwip-prefix",  po::value(&opt.vwip_prefix),
      "Save .vwip files with this prefix. This is a private option used by parallel_bundle_adjust.")
     ("ip-debug-images", po::bool_switch(&opt.ip_debug_images)->default_value(false)->implicit_value(true),
@@ -2169,6 +2707,33 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
         << "--num-random-passes.\n");
   }
 
+  if (opt.num_parallel_random_passes < 1)
+    vw_throw(ArgumentErr() << "The value of --num-parallel-random-passes must be positive.\n");
+  if (opt.random_pass_abort_factor < 0)
+    vw_throw(ArgumentErr() << "The value of --random-pass-abort-factor must be non-negative.\n");
+
+  if (opt.partition_size < 0)
+    vw_throw(ArgumentErr() << "The value of --partition-size must be non-negative.\n");
+  if (opt.num_partition_jobs < 0)
+    vw_throw(ArgumentErr() << "The value of --num-partition-jobs must be non-negative.\n");
+  if (opt.num_partition_jobs > 0) {
+    if (opt.partition_size <= 0)
+      vw_throw(ArgumentErr() << "The option --num-partition-jobs needs --partition-size.\n");
+    if (opt.partition_job < 0 || opt.partition_job >= opt.num_partition_jobs)
+      vw_throw(ArgumentErr() << "The value of --partition-job must be non-negative "
+               << "and less than --num-partition-jobs.\n");
+    // The results of the jobs are merged by picking each camera's .adjust file
+    if (opt.camera_type != BaCameraType_Other)
+      vw_throw(ArgumentErr() << "The option --num-partition-jobs cannot be used "
+               << "with --inline-adjustments or when solving for intrinsics.\n");
+  }
+
+  // Fail early if the solver preset is not available
+  ceres::Solver::Options solver_options;
+  asp::applySolverPreset(opt.solver_preset, solver_options);
+  if (opt.partition_sweeps < 1)
+    vw_throw(ArgumentErr() << "The value of --partition-sweeps must be positive.\n");
+
   bool external_matches = (!opt.clean_match_files_prefix.empty() ||
                            !opt.match_files_prefix.empty());
   if (external_matches && (opt.isis_cnet != "" || opt.nvm != ""))
@@ -2256,7 +2821,7 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   if (opt.camera_type != BaCameraType_Other   &&
       opt.camera_type != BaCameraType_Pinhole &&
       opt.camera_type != BaCameraType_CSM     &&
-      opt.input_prefix != "")
+      (opt.input_prefix != "" || opt.incremental_prefix != ""))
     vw_throw( ArgumentErr() << "Can only use initial adjustments with camera type "
               << "'pinhole', 'csm', or 'other'. Here likely having optical bar cameras.\n");
 
@@ -2736,6 +3301,22 @@ void ba_match_ip(Options & opt, asp::SessionPtr session,
     }
   }
 
+  // When the interest points of an image do not depend on the other image
+  // of the pair, save them in a cache, so they are detected only once per
+  // image. That works across parallel_bundle_adjust processes too, as they
+  // share the output prefix.
+  if (!opt.save_vwip && !opt.no_ip_cache && bbox1.empty() && bbox2.empty()) {
+    std::string cache_dir = opt.out_prefix + "-ip-cache";
+    ip_file1 = asp::ip_cache_filename(cache_dir, image1_path,
+                                      Vector2i(masked_image1.cols(), masked_image1.rows()),
+                                      nodata1, image1_stats);
+    ip_file2 = asp::ip_cache_filename(cache_dir, image2_path,
+                                      Vector2i(masked_image2.cols(), masked_image2.rows()),
+                                      nodata2, image2_stats);
+    if (ip_file1 != "" || ip_file2 != "")
+      vw::create_out_dir(cache_dir + "/");
+  }
+
   // The match files (.match) are cached unless the images or camera
   // are newer than them.
   session->ip_matching(image1_path, image2_path,
@@ -3010,7 +3591,7 @@ void computeStats(Options const& opt, std::vector<std::string> const& map_files,
       asp::camera_bbox_with_cache(dem_file_for_overlap,
                                   opt.image_files[index], // use the original image
                                   opt.camera_models[index],  
-                                  opt.out_prefix);
+                                  opt.out_prefix, opt.incremental_prefix);
   }
   return;
 }
@@ -3082,6 +3663,21 @@ void findPairwiseMatches(Options & opt, // will change
     asp::listExistingMatchFiles(prefix, existing_files);
   }
   
+  // With --incremental-prefix, the pairs of images which were both in the
+  // previous run are not matched again. Their match files from that run are used.
+  std::vector<bool> prev_run(num_images, false);
+  std::set<std::string> prev_match_files;
+  if (opt.incremental_prefix != "" && !need_no_matches) {
+    int num_prev = 0;
+    for (int i = 0; i < num_images; i++) {
+      prev_run[i] = asp::in_previous_run(opt, i);
+      num_prev += int(prev_run[i]);
+    }
+    vw_out() << "Images from the previous run: " << num_prev << ". New images: "
+             << num_images - num_prev << ".\n";
+    asp::listExistingMatchFiles(opt.incremental_prefix, prev_match_files);
+  }
+
   vw::cartography::GeoReference dem_georef;
   ImageViewRef<PixelMask<double>> interp_dem;
   if (mapproj_dem != "")
@@ -3101,6 +3697,19 @@ void findPairwiseMatches(Options & opt, // will change
     std::string const& image2_path  = opt.image_files[j];  // alias
     std::string const& camera1_path = opt.camera_files[i]; // alias
     std::string const& camera2_path = opt.camera_files[j]; // alias
+
+    if (prev_run[i] && prev_run[j]) {
+      // Use the matches from the previous run, in either order, if any
+      std::string prev_match
+        = ip::match_filename(opt.incremental_prefix, image1_path, image2_path);
+      std::string prev_match_rev
+        = ip::match_filename(opt.incremental_prefix, image2_path, image1_path);
+      if (prev_match_files.find(prev_match) != prev_match_files.end())
+        opt.match_files[std::make_pair(i, j)] = prev_match;
+      else if (prev_match_files.find(prev_match_rev) != prev_match_files.end())
+        opt.match_files[std::make_pair(j, i)] = prev_match_rev;
+      continue;
+    }
     
     // See if perhaps to load match files from a different source
     std::string match_file 
@@ -3185,6 +3794,9 @@ int main(int argc, char* argv[]) {
 
     handle_arguments(argc, argv, opt);
 
+    // Cache the processed CSM ISDs, so that reruns load them faster
+    asp::CsmModel::setIsdCacheDir(opt.out_prefix + "-csm-cache");
+
     asp::load_cameras(opt.image_files, opt.camera_files, opt.out_prefix, opt,  
                       opt.approximate_pinhole_intrinsics,  
                       // Outputs
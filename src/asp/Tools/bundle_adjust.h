@@ -54,26 +54,30 @@ struct Options: public asp::BaBaseOptions {
   std::string cnet_file, vwip_prefix,
     cost_function, mapprojected_data, gcp_from_mapprojected;
   int ip_per_tile, ip_per_image, matches_per_tile;
-  double forced_triangulation_distance, overlap_exponent, ip_triangulation_max_error;
+  double forced_triangulation_distance, overlap_exponent, ip_triangulation_max_error,
+    image_stats_accuracy;
   int    instance_count, instance_index, num_random_passes, ip_num_ransac_iterations;
   bool   save_intermediate_cameras, approximate_pinhole_intrinsics,
     init_camera_using_gcp, disable_pinhole_gcp_init,
     transform_cameras_with_shared_gcp, transform_cameras_using_gcp,
     fix_gcp_xyz, solve_intrinsics, 
     ip_normalize_tiles, ip_debug_images, stop_after_stats, stop_after_matching,
-    skip_matching, apply_initial_transform_only, save_vwip, propagate_errors;
+    skip_matching, apply_initial_transform_only, save_vwip, no_ip_cache, propagate_errors,
+    ip_brute_force_matching, ip_detect_in_bands;
   std::string camera_position_file, initial_transform_file,
     csv_format_str, csv_proj4_str, disparity_list,
     dem_file_for_overlap;
   double semi_major, semi_minor, position_filter_dist;
-  int    num_ba_passes;
+  int    num_ba_passes, partition_size, partition_sweeps, partition_job, num_partition_jobs,
+    num_parallel_random_passes;
+  double random_pass_abort_factor;
   std::string remove_outliers_params_str;
   std::vector<double> intrinsics_limits;
   boost::shared_ptr<vw::ba::ControlNetwork> cnet;
   int    ip_detect_method, num_scales;
   double epipolar_threshold; // Max distance from epipolar line to search for IP matches.
   double ip_inlier_factor, ip_uniqueness_thresh, nodata_value, max_disp_error,
-    auto_overlap_buffer, pct_for_overlap, min_distortion;
+    auto_overlap_buffer, pct_for_overlap, min_distortion, isis_to_csm_max_pixel_error;
   bool skip_rough_homography, enable_rough_homography, disable_tri_filtering,
     enable_tri_filtering, no_datum, individually_normalize, use_llh_error,
     force_reuse_match_files, no_poses_from_nvm, save_cnet_as_csv, aster_use_csm;
@@ -93,12 +97,15 @@ struct Options: public asp::BaBaseOptions {
              save_intermediate_cameras(false),
              fix_gcp_xyz(false), solve_intrinsics(false), 
              semi_major(0), semi_minor(0), position_filter_dist(-1),
-             num_ba_passes(2), 
+             num_ba_passes(2), partition_size(0), partition_sweeps(2),
+             partition_job(0), num_partition_jobs(0),
+             num_parallel_random_passes(1), random_pass_abort_factor(0.0),
              ip_detect_method(0), num_scales(-1), 
              pct_for_overlap(-1), skip_rough_homography(false),
              individually_normalize(false), use_llh_error(false), 
              force_reuse_match_files(false), no_poses_from_nvm(false),
-             save_cnet_as_csv(false), aster_use_csm(false) {}
+             save_cnet_as_csv(false), aster_use_csm(false),
+             isis_to_csm_max_pixel_error(0.0) {}
 
   /// Bundle adjustment settings that must be passed to the asp settings
   void copy_to_asp_settings() const;
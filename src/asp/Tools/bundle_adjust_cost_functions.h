@@ -46,6 +46,7 @@
 
 #include <ceres/ceres.h>
 #include <ceres/loss_function.h>
+#include <ceres/rotation.h>
 
 #if defined(__GNUC__) || defined(__GNUG__)
 #if LOCAL_GCC_VERSION >= 40600
@@ -512,6 +513,252 @@ private:
 
 }; // End class BaReprojectionError
 
+/// A Ceres cost function for the reprojection error of a pinhole or CSM frame
+/// camera, with the intrinsics being solved for. Its residual is the same as
+/// for BaReprojectionError, which numerically differentiates the projection
+/// with respect to every parameter, and rebuilds the camera each time. Here
+/// the camera is built once per evaluation. As the pixel depends on the point
+/// and pose only via the point in the camera coordinate system, the Jacobians
+/// of the point and pose come from the chain rule, with only the 2x3
+/// derivative of the projection with respect to the point found numerically.
+/// The intrinsics are differentiated numerically, with central differences,
+/// without rebuilding the camera. Jacobians of constant blocks are skipped.
+class BaFrameReprojectionError: public ceres::CostFunction {
+public:
+  BaFrameReprojectionError(Vector2 const& observation, Vector2 const& pixel_sigma,
+                           boost::shared_ptr<vw::camera::PinholeModel> pinhole_model,
+                           boost::shared_ptr<asp::CsmModel> csm_model,
+                           int num_dist_params):
+    m_observation(observation), m_pixel_sigma(pixel_sigma),
+    m_pinhole_model(pinhole_model), m_csm_model(csm_model) {
+
+    set_num_residuals(2);
+    mutable_parameter_block_sizes()->push_back(3); // point
+    mutable_parameter_block_sizes()->push_back(6); // pose
+    mutable_parameter_block_sizes()->push_back(asp::NUM_CENTER_PARAMS);
+    mutable_parameter_block_sizes()->push_back(asp::NUM_FOCUS_PARAMS);
+    mutable_parameter_block_sizes()->push_back(num_dist_params);
+  }
+
+  virtual bool Evaluate(double const* const* parameters, double* residuals,
+                        double** jacobians) const {
+
+    double const* raw_point = parameters[0];
+    double const* raw_pose  = parameters[1];
+    Vector3 point(raw_point[0], raw_point[1], raw_point[2]);
+    CameraAdjustment correction(raw_pose);
+
+    // The intrinsics, as multipliers of the original values
+    std::vector<double> scales;
+    for (int block = 2; block < 5; block++) {
+      for (int it = 0; it < parameter_block_sizes()[block]; it++)
+        scales.push_back(parameters[block][it]);
+    }
+
+    // The projection, and the vector from the camera center, or from the
+    // center of rotation, to the point, before rotating it
+    vw::camera::PinholeModel pin_cam;
+    boost::shared_ptr<asp::CsmModel> csm_copy;
+    boost::shared_ptr<vw::camera::AdjustedCameraModel> adj_cam;
+    Vector3 offset;
+    if (m_pinhole_model.get() != NULL) {
+      pin_cam = *m_pinhole_model;
+      pin_cam.set_camera_center(correction.position());
+      pin_cam.set_camera_pose(correction.pose().rotation_matrix());
+      pin_cam.set_pixel_pitch(m_pinhole_model->pixel_pitch());
+      offset = point - correction.position();
+    } else {
+      m_csm_model->deep_copy(csm_copy);
+      adj_cam.reset(new vw::camera::AdjustedCameraModel(csm_copy, correction.position(),
+                                                        correction.pose()));
+      // See the .adjust file format in the documentation
+      offset = point - m_csm_model->camera_center(Vector2()) - correction.position();
+    }
+    set_intrinsics(scales, pin_cam, csm_copy);
+
+    Vector2 pixel;
+    bool success = project(point, pin_cam, adj_cam, pixel);
+    if (!success) {
+      // Do not allow one bad pixel value to ruin the whole problem
+      pixel = Vector2(g_big_pixel_value, g_big_pixel_value);
+    }
+    for (int row = 0; row < 2; row++)
+      residuals[row] = (pixel[row] - m_observation[row])/m_pixel_sigma[row];
+
+    if (jacobians == NULL)
+      return true;
+
+    // Wipe the Jacobians. They stay zero where the projection fails.
+    for (int block = 0; block < 5; block++) {
+      if (jacobians[block] != NULL) {
+        for (int it = 0; it < 2 * parameter_block_sizes()[block]; it++)
+          jacobians[block][it] = 0.0;
+      }
+    }
+    if (!success)
+      return true;
+
+    // The derivative of the pixel with respect to the point
+    if (jacobians[0] != NULL || jacobians[1] != NULL) {
+      Matrix<double, 2, 3> dpix_dpt;
+      double step = 1e-6 * std::max(norm_2(offset), 1.0);
+      for (int col = 0; col < 3; col++) {
+        Vector3 pt1 = point, pt2 = point;
+        pt1[col] += step;
+        pt2[col] -= step;
+        Vector2 pix1, pix2;
+        if (!project(pt1, pin_cam, adj_cam, pix1) || !project(pt2, pin_cam, adj_cam, pix2))
+          return true; // leave the Jacobians as zero
+        for (int row = 0; row < 2; row++)
+          dpix_dpt(row, col) = (pix1[row] - pix2[row]) / (2.0 * step);
+      }
+
+      if (jacobians[0] != NULL) {
+        for (int row = 0; row < 2; row++) {
+          for (int col = 0; col < 3; col++)
+            jacobians[0][3 * row + col] = dpix_dpt(row, col) / m_pixel_sigma[row];
+        }
+      }
+
+      if (jacobians[1] != NULL) {
+        // The point in the camera is R^T * offset, where R is the rotation
+        // given by the axis-angle a. The offset has the position subtracted,
+        // so the derivative with respect to position is minus the one with
+        // respect to the point. The derivative with respect to the point in
+        // the camera is dpix_dpt * R.
+        Matrix<double, 2, 3> dpix_dcam = dpix_dpt * correction.pose().rotation_matrix();
+        typedef ceres::Jet<double, 3> JetT;
+        JetT minus_a[3], jet_offset[3], cam_pt[3];
+        for (int it = 0; it < 3; it++) {
+          minus_a[it] = -JetT(raw_pose[3 + it], it); // R^T is the rotation by -a
+          jet_offset[it] = JetT(offset[it]);
+        }
+        ceres::AngleAxisRotatePoint(minus_a, jet_offset, cam_pt);
+        for (int row = 0; row < 2; row++) {
+          for (int col = 0; col < 3; col++) {
+            double d = 0.0;
+            for (int k = 0; k < 3; k++)
+              d += dpix_dcam(row, k) * cam_pt[k].v[col];
+            jacobians[1][6 * row + col]     = -dpix_dpt(row, col) / m_pixel_sigma[row];
+            jacobians[1][6 * row + 3 + col] = d / m_pixel_sigma[row];
+          }
+        }
+      }
+    }
+
+    // The intrinsics
+    int scale_index = 0;
+    for (int block = 2; block < 5; block++) {
+      int block_size = parameter_block_sizes()[block];
+      if (jacobians[block] == NULL) {
+        scale_index += block_size;
+        continue;
+      }
+      for (int col = 0; col < block_size; col++) {
+        double orig = scales[scale_index];
+        double step = 1e-6 * std::max(std::abs(orig), 1.0);
+        Vector2 pix1, pix2;
+        scales[scale_index] = orig + step;
+        set_intrinsics(scales, pin_cam, csm_copy);
+        bool good = project(point, pin_cam, adj_cam, pix1);
+        scales[scale_index] = orig - step;
+        set_intrinsics(scales, pin_cam, csm_copy);
+        good = good && project(point, pin_cam, adj_cam, pix2);
+        scales[scale_index] = orig;
+        if (good) {
+          for (int row = 0; row < 2; row++)
+            jacobians[block][block_size * row + col]
+              = (pix1[row] - pix2[row]) / (2.0 * step * m_pixel_sigma[row]);
+        }
+        scale_index++;
+      }
+      set_intrinsics(scales, pin_cam, csm_copy);
+    }
+
+    return true;
+  }
+
+  // Factory to hide the construction of the CostFunction object from the
+  // client code. Return NULL if this camera is not handled here.
+  static ceres::CostFunction* Create(Vector2 const& observation,
+                                     Vector2 const& pixel_sigma,
+                                     boost::shared_ptr<vw::camera::CameraModel> camera_model) {
+
+    boost::shared_ptr<vw::camera::PinholeModel> pinhole_model
+      = boost::dynamic_pointer_cast<vw::camera::PinholeModel>(camera_model);
+    if (pinhole_model.get() != NULL) {
+      int num_dist_params
+        = pinhole_model->lens_distortion()->distortion_parameters().size();
+      return new BaFrameReprojectionError(observation, pixel_sigma, pinhole_model,
+                                          boost::shared_ptr<asp::CsmModel>(),
+                                          num_dist_params);
+    }
+
+    boost::shared_ptr<asp::CsmModel> csm_model
+      = boost::dynamic_pointer_cast<asp::CsmModel>(camera_model);
+    if (csm_model.get() != NULL && csm_model->isFrameCam())
+      return new BaFrameReprojectionError(observation, pixel_sigma,
+                                          boost::shared_ptr<vw::camera::PinholeModel>(),
+                                          csm_model, csm_model->distortion().size());
+
+    return NULL;
+  }
+
+private:
+
+  // Set the intrinsics, given as multipliers of the original values. That is
+  // how they are optimized.
+  void set_intrinsics(std::vector<double> const& scales,
+                      vw::camera::PinholeModel & pin_cam,
+                      boost::shared_ptr<asp::CsmModel> & csm_copy) const {
+
+    if (m_pinhole_model.get() != NULL) {
+      double focus = scales[2] * m_pinhole_model->focal_length()[0];
+      pin_cam.set_focal_length(vw::Vector2(focus, focus));
+      pin_cam.set_point_offset(vw::Vector2(scales[0] * m_pinhole_model->point_offset()[0],
+                                           scales[1] * m_pinhole_model->point_offset()[1]));
+      boost::shared_ptr<LensDistortion> distortion
+        = m_pinhole_model->lens_distortion()->copy();
+      vw::Vector<double> lens = distortion->distortion_parameters();
+      for (size_t i = 0; i < lens.size(); i++)
+        lens[i] *= scales[3 + i];
+      distortion->set_distortion_parameters(lens);
+      pin_cam.set_lens_distortion(distortion.get());
+      return;
+    }
+
+    vw::Vector2 optical_center = m_csm_model->optical_center();
+    csm_copy->set_optical_center(vw::Vector2(scales[0] * optical_center[0],
+                                             scales[1] * optical_center[1]));
+    csm_copy->set_focal_length(scales[2] * m_csm_model->focal_length());
+    std::vector<double> distortion = m_csm_model->distortion();
+    for (size_t i = 0; i < distortion.size(); i++)
+      distortion[i] *= scales[3 + i];
+    csm_copy->set_distortion(distortion);
+  }
+
+  // Project a point. Return false on failure.
+  bool project(Vector3 const& point, vw::camera::PinholeModel const& pin_cam,
+               boost::shared_ptr<vw::camera::AdjustedCameraModel> const& adj_cam,
+               Vector2 & pixel) const {
+    try {
+      if (m_pinhole_model.get() != NULL)
+        pixel = pin_cam.point_to_pixel_no_check(point);
+      else
+        pixel = adj_cam->point_to_pixel(point);
+    } catch (...) {
+      return false;
+    }
+    return true;
+  }
+
+  Vector2 m_observation; ///< The pixel observation for this camera/point pair.
+  Vector2 m_pixel_sigma;
+  boost::shared_ptr<vw::camera::PinholeModel> m_pinhole_model;
+  boost::shared_ptr<asp::CsmModel> m_csm_model;
+
+}; // End class BaFrameReprojectionError
+
 /// A ceres cost function. Here we float two pinhole camera's
 /// intrinsic and extrinsic parameters. We take as input a reference
 /// xyz point and a disparity from left to right image. The
@@ -31,10 +31,12 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/FileUtils.h>
 #include <asp/Camera/RPCModelGen.h>
+#include <asp/Camera/CameraBatch.h>
 #include <asp/Core/PointUtils.h>
 
 #include <limits>
 #include <cstring>
+#include <algorithm>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
@@ -59,11 +61,11 @@ struct Options : public vw::GdalWriteOptions {
   float input_nodata_value, output_nodata_value;
   double semi_major, semi_minor;
   double gsd;
-  int num_samples;
+  int num_samples, num_adaptive_passes;
   Datum datum;
   Options(): penalty_weight(-1.0), no_crop(false),
              skip_computing_rpc(false), save_tif(false), has_output_nodata(false),
-             gsd(-1.0), num_samples(-1) {}
+             gsd(-1.0), num_samples(-1), num_adaptive_passes(0) {}
 };
 
 void handle_arguments(int argc, char *argv[], Options& opt) {
@@ -83,6 +85,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Minimum and maximum heights above the datum in which to compute the RPC model.")
     ("num-samples",     po::value(&opt.num_samples)->default_value(40),
      "How many samples to use in each direction in the longitude-latitude-height range.")
+    ("num-adaptive-passes", po::value(&opt.num_adaptive_passes)->default_value(0),
+     "After the initial sampling, do this many passes which fit an RPC model, evaluate it on a shifted sampling grid, and add the shifted samples where the error is above the median. This concentrates the samples where the RPC model fits worst.")
     ("penalty-weight",     po::value(&opt.penalty_weight)->default_value(0.03), // check here!
      "A higher penalty weight will result in smaller higher-order RPC coefficients.")
     ("save-tif-image", po::bool_switch(&opt.save_tif)->default_value(false),
@@ -192,6 +196,225 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   }
 }
 
+// Ground samples in the lon-lat-height box, on a grid shifted by the
+// given fraction of a grid cell. A shift of 0 gives the original grid.
+void sampleLonLatHeightBox(Options const& opt, double shift,
+                           std::vector<Vector3> & llh) {
+  llh.clear();
+  BBox2   const& ll = opt.lon_lat_range; // shortcut
+  Vector2 const& H  = opt.height_range;
+  double delta_lon = (ll.max()[0] - ll.min()[0])/double(opt.num_samples);
+  double delta_lat = (ll.max()[1] - ll.min()[1])/double(opt.num_samples);
+  double delta_ht  = (H[1] - H[0])/double(opt.num_samples);
+  for (double lon = ll.min()[0] + shift*delta_lon; lon <= ll.max()[0]; lon += delta_lon) {
+    for (double lat = ll.min()[1] + shift*delta_lat; lat <= ll.max()[1]; lat += delta_lat) {
+      for (double ht = H[0] + shift*delta_ht; ht <= H[1]; ht += delta_ht)
+        llh.push_back(Vector3(lon, lat, ht));
+    }
+  }
+}
+
+// Ground samples on the surface of the DEM, on a grid shifted by the
+// given fraction of a grid cell.
+void sampleDem(Options const& opt, ImageView<PixelMask<double>> const& dem,
+               GeoReference const& dem_geo, double shift,
+               std::vector<Vector3> & llh) {
+  llh.clear();
+
+  // If the DEM is too big, we need to skip points. About
+  // 40,000 points should be good enough to determine 78 RPC
+  // coefficients.
+  double delta_col = std::max(1.0, dem.cols()/double(opt.num_samples));
+  double delta_row = std::max(1.0, dem.rows()/double(opt.num_samples));
+  for (double dcol = shift*delta_col; dcol < dem.cols(); dcol += delta_col) {
+    for (double drow = shift*delta_row; drow < dem.rows(); drow += delta_row) {
+      int col = dcol, row = drow; // cast to int
+
+      if (!is_valid(dem(col, row))) continue;
+
+      Vector2 lonlat = dem_geo.pixel_to_lonlat(Vector2(col, row));
+      llh.push_back(Vector3(lonlat[0], lonlat[1], dem(col, row).child()));
+    }
+  }
+}
+
+// Project the ground samples into the camera, in parallel chunks if the
+// camera allows it. The heights are also brought to the datum's
+// longitude convention. Keep only the samples landing in the image box
+// and, if checking the image, on valid image pixels.
+void projectSamples(Options const& opt, CameraModel const* cam,
+                    bool multithreaded, BBox2 const& image_box,
+                    ImageViewRef<PixelMask<float>> const& input_img,
+                    bool check_image,
+                    std::vector<Vector3> & llh, std::vector<Vector2> & pixels) {
+
+  int num = llh.size();
+  std::vector<Vector3> xyz(num);
+  for (int i = 0; i < num; i++) {
+    xyz[i] = opt.datum.geodetic_to_cartesian(llh[i]);
+    // Go back to llh. This is a bugfix for the 360 deg offset problem.
+    llh[i] = opt.datum.cartesian_to_geodetic(xyz[i]);
+  }
+
+  // Each chunk goes through the batch camera API
+  pixels.resize(num);
+  int chunk = 1024;
+  int num_chunks = (num + chunk - 1) / chunk;
+  vw::TerminalProgressCallback tpc("asp", "\t--> ");
+  double inc_amount = 1.0 / std::max(num_chunks, 1);
+  tpc.report_progress(0);
+#pragma omp parallel for schedule(dynamic) if (multithreaded)
+  for (int c = 0; c < num_chunks; c++) {
+    int beg = c * chunk;
+    int len = std::min(chunk, num - beg);
+    asp::pointsToPixels(cam, &xyz[beg], len, &pixels[beg]);
+#pragma omp critical
+    tpc.report_incremental_progress(inc_amount);
+  }
+  tpc.report_finished();
+
+  // Failed projections are NaN and are not contained in the box. The
+  // image is a disk view, so check it in order.
+  int count = 0;
+  for (int i = 0; i < num; i++) {
+    Vector2 const& pix = pixels[i];
+    if (!image_box.contains(pix))
+      continue;
+    if (check_image && !is_valid(input_img(pix[0], pix[1])))
+      continue;
+    llh[count] = llh[i];
+    pixels[count] = pix;
+    count++;
+  }
+  llh.resize(count);
+  pixels.resize(count);
+}
+
+// Normalize the point pairs with the given offsets and scales and fit
+// the RPC coefficients.
+void fitRpc(double penalty_weight,
+            std::vector<Vector3> const& all_llh, std::vector<Vector2> const& all_pixels,
+            Vector3 const& llh_scale, Vector3 const& llh_offset,
+            Vector2 const& pixel_scale, Vector2 const& pixel_offset,
+            asp::RPCModel::CoeffVec & line_num, asp::RPCModel::CoeffVec & line_den,
+            asp::RPCModel::CoeffVec & samp_num, asp::RPCModel::CoeffVec & samp_den) {
+
+  Vector<double> normalized_llh;
+  Vector<double> normalized_pixels;
+  int num_total_pts = all_llh.size();
+  normalized_llh.set_size(asp::RPCModel::GEODETIC_COORD_SIZE*num_total_pts);
+  normalized_pixels.set_size(asp::RPCModel::IMAGE_COORD_SIZE*num_total_pts
+                             + asp::RpcSolveLMA::NUM_PENALTY_TERMS);
+  for (size_t i = 0; i < normalized_pixels.size(); i++) {
+    // Important: The extra penalty terms are all set to zero here.
+    normalized_pixels[i] = 0.0; 
+  }
+
+  // Form the arrays of normalized pixels and normalized llh
+  for (int pt = 0; pt < num_total_pts; pt++) {
+    // Normalize the pixel to -1 <> 1 range
+    Vector3 llh_n   = elem_quot(all_llh[pt]    - llh_offset,   llh_scale);
+    Vector2 pixel_n = elem_quot(all_pixels[pt] - pixel_offset, pixel_scale);
+    subvector(normalized_llh, asp::RPCModel::GEODETIC_COORD_SIZE*pt,
+              asp::RPCModel::GEODETIC_COORD_SIZE) = llh_n;
+    subvector(normalized_pixels, asp::RPCModel::IMAGE_COORD_SIZE*pt,
+              asp::RPCModel::IMAGE_COORD_SIZE   ) = pixel_n;
+  }
+
+  // Find the RPC coefficients
+  std::string output_prefix = "";
+  asp::gen_rpc(// Inputs
+               penalty_weight, output_prefix,
+               normalized_llh, normalized_pixels,
+               llh_scale, llh_offset, pixel_scale, pixel_offset,
+               // Outputs
+               line_num, line_den, samp_num, samp_den);
+}
+
+// The van der Corput sequence in base 2: 0.5, 0.25, 0.75, 0.125, ...
+// Successive passes shift the sampling grid to points not seen before.
+double gridShift(int pass) {
+  double shift = 0.0, f = 0.5;
+  for (int n = pass; n > 0; n /= 2, f /= 2.0)
+    shift += f * (n % 2);
+  return shift;
+}
+
+// Refine the samples where the RPC fit is worst. At each pass, fit the
+// current samples, evaluate the fit on a shifted sampling grid, and add
+// the shifted samples whose error is above the median.
+void addAdaptiveSamples(Options const& opt, CameraModel const* cam,
+                        bool multithreaded, BBox2 const& image_box,
+                        ImageViewRef<PixelMask<float>> const& input_img,
+                        ImageView<PixelMask<double>> const& dem,
+                        GeoReference const& dem_geo,
+                        std::vector<Vector3> & all_llh,
+                        std::vector<Vector2> & all_pixels) {
+
+  for (int pass = 1; pass <= opt.num_adaptive_passes; pass++) {
+
+    if (all_llh.empty())
+      return;
+
+    BBox3 llh_box;
+    BBox2 pixel_box;
+    for (size_t i = 0; i < all_llh.size(); i++) {
+      llh_box.grow(all_llh[i]);
+      pixel_box.grow(all_pixels[i]);
+    }
+    Vector3 llh_scale    = (llh_box.max() - llh_box.min())/2.0;
+    Vector3 llh_offset   = (llh_box.max() + llh_box.min())/2.0;
+    Vector2 pixel_scale  = (pixel_box.max() - pixel_box.min())/2.0;
+    Vector2 pixel_offset = (pixel_box.max() + pixel_box.min())/2.0;
+
+    asp::RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
+    fitRpc(opt.penalty_weight, all_llh, all_pixels,
+           llh_scale, llh_offset, pixel_scale, pixel_offset,
+           line_num, line_den, samp_num, samp_den);
+
+    // Candidate samples on the shifted grid
+    std::vector<Vector3> llh;
+    std::vector<Vector2> pixels;
+    double shift = gridShift(pass);
+    if (opt.dem_file.empty())
+      sampleLonLatHeightBox(opt, shift, llh);
+    else
+      sampleDem(opt, dem, dem_geo, shift, llh);
+    projectSamples(opt, cam, multithreaded, image_box, input_img,
+                   !opt.dem_file.empty(), llh, pixels);
+    if (llh.empty())
+      continue;
+
+    int num = llh.size();
+    std::vector<double> errors(num);
+#pragma omp parallel for
+    for (int i = 0; i < num; i++) {
+      Vector3 llh_n = elem_quot(llh[i] - llh_offset, llh_scale);
+      Vector2 pix_n = asp::RPCModel::normalized_geodetic_to_normalized_pixel
+        (llh_n, line_num, line_den, samp_num, samp_den);
+      errors[i] = norm_2(elem_prod(pix_n, pixel_scale) + pixel_offset - pixels[i]);
+    }
+
+    std::vector<double> sorted = errors;
+    std::nth_element(sorted.begin(), sorted.begin() + num/2, sorted.end());
+    double median = sorted[num/2];
+
+    int num_added = 0;
+    double max_error = 0.0;
+    for (int i = 0; i < num; i++) {
+      max_error = std::max(max_error, errors[i]);
+      if (errors[i] <= median)
+        continue;
+      all_llh.push_back(llh[i]);
+      all_pixels.push_back(pixels[i]);
+      num_added++;
+    }
+
+    vw_out() << "Adaptive pass " << pass << ": max pixel error of the current fit is "
+             << max_error << ". Added " << num_added << " samples.\n";
+  }
+}
+
 int main( int argc, char *argv[] ) {
 
   Options opt;
@@ -267,102 +490,40 @@ int main( int argc, char *argv[] ) {
     std::vector<Vector3> all_llh;
     std::vector<Vector2> all_pixels;
 
-    vw_out() << "Projecting pixels into the camera to generate the RPC model.\n";
-    vw::TerminalProgressCallback tpc("asp", "\t--> ");
-    double inc_amount = 1.0 / double(opt.num_samples);
-
-
     // Mask the input image
     ImageViewRef< PixelMask<float> > input_img
       = create_mask_less_or_equal(disk_view, opt.input_nodata_value);
 
+    ImageView<PixelMask<double>> dem;
+    GeoReference dem_geo;
     if (opt.dem_file.empty()) {
-
       vw_out() << "Using datum: " << opt.datum << std::endl;
-
-      BBox2   & ll = opt.lon_lat_range; // shortcut
-      Vector2 & H  = opt.height_range;
-      double delta_lon = (ll.max()[0] - ll.min()[0])/double(opt.num_samples);
-      double delta_lat = (ll.max()[1] - ll.min()[1])/double(opt.num_samples);
-      double delta_ht  = (H[1] - H[0])/double(opt.num_samples);
-      tpc.report_progress(0);
-      for (double lon = ll.min()[0]; lon <= ll.max()[0]; lon += delta_lon) {
-        for (double lat = ll.min()[1]; lat <= ll.max()[1]; lat += delta_lat) {
-          for (double ht = H[0]; ht <= H[1]; ht += delta_ht) {
-
-            Vector3 llh(lon, lat, ht);
-            Vector3 xyz = opt.datum.geodetic_to_cartesian(llh);
-
-            // Go back to llh. This is a bugfix for the 360 deg offset problem.
-            llh = opt.datum.cartesian_to_geodetic(xyz);
-
-            Vector2 cam_pix = cam->point_to_pixel(xyz);
-            if (image_box.contains(cam_pix)) {
-              all_llh.push_back(llh);
-              all_pixels.push_back(cam_pix);
-            }
-
-          }
-        }
-        tpc.report_incremental_progress(inc_amount);
-      }
-
+      sampleLonLatHeightBox(opt, 0.0, all_llh);
     }else{
       vw_out() << "Sampling the surface of the DEM: " << opt.dem_file  << std::endl;
 
       float dem_nodata_val = -std::numeric_limits<float>::max(); 
       vw::read_nodata_val(opt.dem_file, dem_nodata_val);
-      ImageView< PixelMask<double> > dem = create_mask
+      dem = create_mask
         (channel_cast<double>(DiskImageView<float>(opt.dem_file)), dem_nodata_val);
 
-      GeoReference dem_geo;
       if (!read_georeference(dem_geo, opt.dem_file))
         vw_throw( ArgumentErr() << "Missing georef.\n");
 
       // Get the datum from the DEM
       opt.datum = dem_geo.datum();
-      
-      // If the DEM is too big, we need to skip points. About
-      // 40,000 points should be good enough to determine 78 RPC
-      // coefficients.
-      double delta_col = std::max(1.0, dem.cols()/double(opt.num_samples));
-      double delta_row = std::max(1.0, dem.rows()/double(opt.num_samples));
-      tpc.report_progress(0);
-      for (double dcol = 0; dcol < dem.cols(); dcol += delta_col) {
-        for (double drow = 0; drow < dem.rows(); drow += delta_row) {
-          int col = dcol, row = drow; // cast to int
-
-          if (!is_valid(dem(col, row))) continue;
-
-          Vector2 pix(col, row);
-          Vector2 lonlat = dem_geo.pixel_to_lonlat(pix);
-
-          // Lon lat height
-          Vector3 llh;
-          llh[0] = lonlat[0]; llh[1] = lonlat[1]; llh[2] = dem(col, row).child();
-          Vector3 xyz = opt.datum.geodetic_to_cartesian(llh);
-
-          // Go back to llh. This is a bugfix for the 360 deg offset problem.
-          llh = opt.datum.cartesian_to_geodetic(xyz);
-
-          Vector2 cam_pix;
-          try {
-            // the point_to_pixel function can be capricious
-            cam_pix = cam->point_to_pixel(xyz);
-          }catch(...){
-            continue;
-          }
-
-          if (image_box.contains(cam_pix) && is_valid(input_img(cam_pix[0], cam_pix[1]))) {
-            all_llh.push_back(llh);
-            all_pixels.push_back(cam_pix);
-          }
-
-        }
-        tpc.report_incremental_progress(inc_amount);
-      }
+
+      sampleDem(opt, dem, dem_geo, 0.0, all_llh);
     }
-    tpc.report_finished();
+
+    vw_out() << "Projecting pixels into the camera to generate the RPC model.\n";
+    bool multithreaded = session->supports_multi_threading();
+    projectSamples(opt, cam.get(), multithreaded, image_box, input_img,
+                   !opt.dem_file.empty(), all_llh, all_pixels);
+
+    if (opt.num_adaptive_passes > 0)
+      addAdaptiveSamples(opt, cam.get(), multithreaded, image_box, input_img,
+                         dem, dem_geo, all_llh, all_pixels);
 
     // The pixel box
     BBox2 pixel_box;
@@ -431,38 +592,12 @@ int main( int argc, char *argv[] ) {
     vw_out() << "Lon-lat-height box for the RPC approx: " << llh_box   << std::endl;
     vw_out() << "Camera pixel box for the RPC approx (after crop): " << pixel_box << std::endl;
 
-    Vector<double> normalized_llh;
-    Vector<double> normalized_pixels;
-    int num_total_pts = all_llh.size();
-    normalized_llh.set_size(asp::RPCModel::GEODETIC_COORD_SIZE*num_total_pts);
-    normalized_pixels.set_size(asp::RPCModel::IMAGE_COORD_SIZE*num_total_pts
-                               + asp::RpcSolveLMA::NUM_PENALTY_TERMS);
-    for (size_t i = 0; i < normalized_pixels.size(); i++) {
-      // Important: The extra penalty terms are all set to zero here.
-      normalized_pixels[i] = 0.0; 
-    }
-
-    // Form the arrays of normalized pixels and normalized llh
-    for (int pt = 0; pt < num_total_pts; pt++) {
-      // Normalize the pixel to -1 <> 1 range
-      Vector3 llh_n   = elem_quot(all_llh[pt]    - llh_offset,   llh_scale);
-      Vector2 pixel_n = elem_quot(all_pixels[pt] - pixel_offset, pixel_scale);
-      subvector(normalized_llh, asp::RPCModel::GEODETIC_COORD_SIZE*pt,
-                asp::RPCModel::GEODETIC_COORD_SIZE) = llh_n;
-      subvector(normalized_pixels, asp::RPCModel::IMAGE_COORD_SIZE*pt,
-                asp::RPCModel::IMAGE_COORD_SIZE   ) = pixel_n;
-    }
-
-    // Find the RPC coefficients
+    vw_out() << "Generating the RPC approximation using " << all_llh.size()
+             << " point pairs.\n";
     asp::RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
-    std::string output_prefix = "";
-    vw_out() << "Generating the RPC approximation using " << num_total_pts << " point pairs.\n";
-    asp::gen_rpc(// Inputs
-                 opt.penalty_weight, output_prefix,
-                 normalized_llh, normalized_pixels,
-                 llh_scale, llh_offset, pixel_scale, pixel_offset,
-                 // Outputs
-                 line_num, line_den, samp_num, samp_den);
+    fitRpc(opt.penalty_weight, all_llh, all_pixels,
+           llh_scale, llh_offset, pixel_scale, pixel_offset,
+           line_num, line_den, samp_num, samp_den);
 
     // TODO: Integrate this with aster2asp existing functionality!
     // Have a generic function for saving WV RPC files. 
@@ -22,6 +22,7 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/FileUtils.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/DemUtils.h>
 #include <asp/Core/EigenUtils.h>
 #include <asp/Camera/CameraResectioning.h>
 #include <asp/Sessions/StereoSession.h>
@@ -1029,11 +1030,11 @@ void form_camera(Options & opt, vw::cartography::GeoReference & geo,
                  vw::CamPtr & input_camera_ptr,
                  boost::shared_ptr<CameraModel> & out_cam) {
 
-  ImageView<float> dem;
+  // The DEM tiles are read as needed. The DEM may be empty if not provided.
   float nodata_value = -std::numeric_limits<float>::max(); 
+  ImageViewRef<PixelMask<float>> masked_dem = create_mask(ImageView<float>(), nodata_value);
   bool has_dem = false;
   if (opt.reference_dem != "") {
-    dem = DiskImageView<float>(opt.reference_dem);
     bool ans = read_georeference(geo, opt.reference_dem);
     if (!ans) 
       vw_throw(ArgumentErr() << "Could not read the georeference from dem: "
@@ -1041,6 +1042,7 @@ void form_camera(Options & opt, vw::cartography::GeoReference & geo,
     has_dem = true;
     vw::read_nodata_val(opt.reference_dem, nodata_value);
     vw_out() << "Using nodata value: " << nodata_value << std::endl;
+    masked_dem = asp::CachedDem(opt.reference_dem);
     
     // For pinhole the datum may be unreliable, so warn only
     bool warn_only = (opt.stereo_session.find("pinhole") != std::string::npos);
@@ -1062,8 +1064,7 @@ void form_camera(Options & opt, vw::cartography::GeoReference & geo,
   }
 
   // Prepare the DEM for interpolation. It may be empty if not provided.
-  interp_dem = interpolate(create_mask(dem, nodata_value),
-                  BilinearInterpolation(), ZeroEdgeExtension());
+  interp_dem = interpolate(masked_dem, BilinearInterpolation(), ZeroEdgeExtension());
 
   // If we have camera center in ECI or ECEF coordinates in km, convert
   // it to meters, then find the height above datum.
@@ -1112,7 +1113,7 @@ void form_camera(Options & opt, vw::cartography::GeoReference & geo,
   if (opt.input_camera != "") {
     // Extract lon and lat from tracing rays from the camera to the ground.
     // This can modify opt.pixel_values. Also calc the camera center.
-    extract_lon_lat_cam_ctr_from_camera(opt, create_mask(dem, nodata_value), 
+    extract_lon_lat_cam_ctr_from_camera(opt, masked_dem, 
                                         geo, 
                                         // Outputs
                                         input_camera_ptr, cam_heights, input_cam_ctr);
@@ -17,7 +17,8 @@
 
 
 /// Compute the footprint of a camera on a DEM/datum, print it, and optionally
-///  write a KML file.
+///  write a KML file. With lists of images and cameras, compute the footprints
+///  of all of them in parallel, and write them to a single GeoJSON file.
 
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <vw/FileIO/DiskImageView.h>
@@ -33,6 +34,11 @@
 
 #include <limits>
 #include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <omp.h>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
@@ -48,8 +54,10 @@ using namespace vw::cartography;
 
 struct Options : public vw::GdalWriteOptions {
   string image_file, camera_file, stereo_session, bundle_adjust_prefix,
-         datum_str, dem_file, target_srs_string, output_kml;
+         datum_str, dem_file, target_srs_string, output_kml,
+         image_list, camera_list, output_geojson;
   bool quick;
+  std::vector<std::string> image_files, camera_files; // for the batch mode
   //BBox2i image_crop_box;
 };
 
@@ -71,7 +79,16 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     //("image-crop-box", po::value(&opt.image_crop_box)->default_value(BBox2i(0,0,0,0), "0 0 0 0"),
     // "The output image and RPC model should not exceed this box, specified in input image pixels as minx miny widx widy.")
     ("dem-file",   po::value(&opt.dem_file)->default_value(""),
-     "Instead of using a longitude-latitude-height box, sample the surface of this DEM.");
+     "Instead of using a longitude-latitude-height box, sample the surface of this DEM.")
+    ("image-list", po::value(&opt.image_list)->default_value(""),
+     "A file containing a list of images, to find the footprints of all of them in "
+     "parallel. Use space or newline as separator. Must be used with --camera-list "
+     "(unless the images have embedded cameras, such as for ISIS) and --output-geojson.")
+    ("camera-list", po::value(&opt.camera_list)->default_value(""),
+     "A file containing the list of cameras, in the same order as the images in "
+     "--image-list.")
+    ("output-geojson", po::value(&opt.output_geojson)->default_value(""),
+     "With --image-list, write the footprints of all images to this GeoJSON file.");
 
   general_options.add( vw::GdalWriteOptionsDescription(opt) );
 
@@ -84,7 +101,9 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   positional_desc.add("camera-image",1);
   positional_desc.add("camera-model",1);
 
-  string usage("[options] <camera-image> <camera-model>");
+  string usage("[options] <camera-image> <camera-model>\n"
+               "  camera_footprint [options] --image-list <file> --camera-list <file> "
+               "--output-geojson <file>");
   bool allow_unregistered = false;
   std::vector<std::string> unregistered;
   po::variables_map vm =
@@ -92,10 +111,38 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
 			    positional, positional_desc, usage,
 			    allow_unregistered, unregistered);
 
-  if ( opt.image_file.empty() )
-    vw_throw( ArgumentErr() << "Missing input image.\n" << usage << general_options );
+  if (!opt.image_list.empty()) {
+    if (!opt.image_file.empty())
+      vw_throw(ArgumentErr() << "The option --image-list was specified, but also "
+               << "an image on the command line.\n");
+    if (opt.output_geojson.empty())
+      vw_throw(ArgumentErr() << "The option --image-list must be used with "
+               << "--output-geojson.\n");
+    if (!opt.output_kml.empty())
+      vw_throw(ArgumentErr() << "The option --output-kml cannot be used with "
+               << "--image-list.\n");
+    asp::read_list(opt.image_list, opt.image_files);
+    if (!opt.camera_list.empty())
+      asp::read_list(opt.camera_list, opt.camera_files);
+    else
+      opt.camera_files = opt.image_files; // cameras embedded in the images
+    if (opt.image_files.empty())
+      vw_throw(ArgumentErr() << "No images were found in: " << opt.image_list << ".\n");
+    if (opt.image_files.size() != opt.camera_files.size())
+      vw_throw(ArgumentErr() << "The number of images and cameras must be the same.\n");
+  } else {
+    if (!opt.camera_list.empty() || !opt.output_geojson.empty())
+      vw_throw(ArgumentErr() << "The options --camera-list and --output-geojson "
+               << "must be used with --image-list.\n");
+    if ( opt.image_file.empty() )
+      vw_throw( ArgumentErr() << "Missing input image.\n" << usage << general_options );
+    if ( opt.camera_file.empty() )
+      vw_throw( ArgumentErr() << "Missing input camera.\n" );
+    opt.image_files.push_back(opt.image_file);
+    opt.camera_files.push_back(opt.camera_file);
+  }
 
-  if (boost::iends_with(opt.image_file, ".cub") && opt.stereo_session == "" )
+  if (boost::iends_with(opt.image_files[0], ".cub") && opt.stereo_session == "" )
     opt.stereo_session = "isis";
 
   // Need this to be able to load adjusted camera models. That will happen
@@ -121,6 +168,180 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   
 }
 
+// The surface to intersect the cameras with, shared by all of them. The DEM
+// is read through the image cache, so each of its blocks is read from disk
+// once, whichever camera needs it first.
+struct FootprintSurface {
+  bool have_dem;
+  ImageViewRef<PixelMask<double>> dem;
+  GeoReference dem_georef, target_georef;
+};
+
+void loadSurface(Options const& opt, FootprintSurface & surf) {
+
+  surf.have_dem = !opt.dem_file.empty();
+  if (!surf.have_dem) { // No DEM available, intersect with the datum.
+
+    // Initialize the georef/datum
+    bool have_user_datum = (opt.datum_str != "");
+    cartography::Datum datum(opt.datum_str);
+    surf.target_georef = GeoReference(datum);
+    bool have_input_georef = false;
+    asp::set_srs_string(opt.target_srs_string, have_user_datum, datum,
+                        have_input_georef, surf.target_georef);
+  } else { // DEM provided, intersect with it.
+
+    // Load the DEM
+    float dem_nodata_val = -std::numeric_limits<float>::max(); 
+    vw::read_nodata_val(opt.dem_file, dem_nodata_val);
+    surf.dem = create_mask
+      (channel_cast<double>(DiskImageView<float>(opt.dem_file)), dem_nodata_val);
+    
+    if (!read_georeference(surf.dem_georef, opt.dem_file))
+      vw_throw( ArgumentErr() << "Missing georef.\n");
+
+    surf.target_georef = surf.dem_georef; // return box in this projection
+  }
+  vw_out() << "Using georef: " << surf.target_georef << std::endl;
+}
+
+// Find the footprint of one camera. The coordinates are the points where the
+// rays through the image boundary meet the surface, as longitude, latitude,
+// and height.
+void calcFootprint(Options const& opt, FootprintSurface const& surf,
+                   std::string const& image_file, std::string const& camera_file,
+                   BBox2 & footprint_bbox, float & mean_gsd,
+                   std::vector<Vector3> & coords) {
+
+  std::string session_type = opt.stereo_session; // may change inside
+  asp::SessionPtr session(asp::StereoSessionFactory::create
+                          (session_type, opt,
+                           image_file,  image_file,
+                           camera_file, camera_file,
+                           "",
+                           "",
+                           false, // Do not allow promotion from normal to map projected session
+                           opt.image_files.size() > 1)); // quiet in batch mode
+
+  boost::shared_ptr<CameraModel> cam = session->camera_model(image_file, camera_file);
+
+  // Just get the image size
+  vw::Vector2i image_size = vw::file_image_size(image_file);
+
+  //    // The bounding box -> Add this feature in the future!
+  //    BBox2 image_box = bounding_box(input_img);
+  //    if (!opt.image_crop_box.empty()) 
+  //      image_box.crop(opt.image_crop_box);
+  
+  // Perform the computation
+  mean_gsd = 0;
+  coords.clear();
+  if (!surf.have_dem) {
+    std::vector<Vector2> coords2;
+    footprint_bbox = camera_bbox(surf.target_georef, cam, image_size[0], image_size[1],
+                                 mean_gsd, &coords2);
+    for (size_t i=0; i<coords2.size(); ++i) {
+      Vector3 proj_coord(coords2[i][0], coords2[i][1], 0.0);
+      coords.push_back(surf.target_georef.point_to_geodetic(proj_coord));
+    }
+  } else {
+    footprint_bbox = camera_bbox(surf.dem, surf.dem_georef, surf.target_georef, cam,
+                                 image_size[0], image_size[1], mean_gsd, opt.quick, &coords);
+    for (size_t i=0; i<coords.size(); ++i)
+      coords[i] = surf.target_georef.datum().cartesian_to_geodetic(coords[i]);
+  }
+}
+
+// Quote a string for JSON
+std::string jsonString(std::string const& str) {
+  std::ostringstream os;
+  os << '"';
+  for (size_t it = 0; it < str.size(); it++) {
+    char c = str[it];
+    if (c == '"' || c == '\\')
+      os << '\\' << c;
+    else if (c == '\n')
+      os << "\\n";
+    else
+      os << c;
+  }
+  os << '"';
+  return os.str();
+}
+
+// Find the footprints of all images in parallel, and write them to a
+// GeoJSON file, as polygons in longitude-latitude, in the order of the
+// images. Images whose footprints cannot be found are skipped, with a warning.
+void calcFootprints(Options const& opt, FootprintSurface const& surf) {
+
+  int num = opt.image_files.size();
+  std::vector<BBox2> bboxes(num);
+  std::vector<float> gsds(num, 0);
+  std::vector<std::vector<Vector3>> all_coords(num);
+  std::vector<std::string> errors(num);
+
+  // ISIS cameras cannot be loaded in parallel
+  bool multithreaded = (opt.stereo_session.find("isis") == std::string::npos);
+  omp_set_dynamic(0);
+  omp_set_num_threads(vw_settings().default_num_threads());
+  vw_out() << "Finding the footprints of " << num << " images.\n";
+  vw::TerminalProgressCallback tpc("asp", "\t--> ");
+  double inc_amount = 1.0 / num;
+  tpc.report_progress(0);
+#pragma omp parallel for schedule(dynamic) if (multithreaded)
+  for (int it = 0; it < num; it++) {
+    try {
+      calcFootprint(opt, surf, opt.image_files[it], opt.camera_files[it],
+                    bboxes[it], gsds[it], all_coords[it]);
+      if (all_coords[it].empty())
+        errors[it] = "The camera does not see the surface.";
+    } catch (std::exception const& e) {
+      errors[it] = e.what();
+    }
+#pragma omp critical
+    tpc.report_incremental_progress(inc_amount);
+  }
+  tpc.report_finished();
+
+  vw_out() << "Writing: " << opt.output_geojson << std::endl;
+  vw::create_out_dir(opt.output_geojson);
+  std::ofstream ofs(opt.output_geojson.c_str());
+  if (!ofs.good())
+    vw_throw(ArgumentErr() << "Cannot write: " << opt.output_geojson << ".\n");
+  ofs << std::setprecision(17);
+  ofs << "{\n\"type\": \"FeatureCollection\",\n\"features\": [";
+  int num_written = 0;
+  for (int it = 0; it < num; it++) {
+    if (!errors[it].empty()) {
+      vw_out(WarningMessage) << "Could not find the footprint of "
+                             << opt.image_files[it] << ": " << errors[it] << "\n";
+      continue;
+    }
+
+    // The polygon ring must be closed
+    std::vector<Vector3> const& coords = all_coords[it];
+    ofs << (num_written > 0 ? ",\n" : "\n");
+    ofs << "{\"type\": \"Feature\", \"properties\": {"
+        << "\"image\": " << jsonString(opt.image_files[it]) << ", "
+        << "\"camera\": " << jsonString(opt.camera_files[it]) << ", "
+        << "\"mean_gsd\": " << gsds[it] << ", "
+        << "\"bbox\": [" << bboxes[it].min().x() << ", " << bboxes[it].min().y() << ", "
+        << bboxes[it].max().x() << ", " << bboxes[it].max().y() << "]}, "
+        << "\"geometry\": {\"type\": \"Polygon\", \"coordinates\": [[";
+    for (size_t c = 0; c <= coords.size(); c++) {
+      Vector3 const& llh = coords[c % coords.size()];
+      ofs << (c > 0 ? ", " : "") << "[" << llh[0] << ", " << llh[1] << "]";
+    }
+    ofs << "]]}}";
+    num_written++;
+  }
+  ofs << "\n]\n}\n";
+  ofs.close();
+
+  vw_out() << "Found the footprints of " << num_written << " out of " << num
+           << " images.\n";
+}
+
 int main( int argc, char *argv[] ) {
 
   Options opt;
@@ -128,79 +349,19 @@ int main( int argc, char *argv[] ) {
 
     handle_arguments(argc, argv, opt);
 
-        asp::SessionPtr session(asp::StereoSessionFactory::create
-		       (opt.stereo_session, // may change inside
-                        opt,
-                        opt.image_file,  opt.image_file,
-                        opt.camera_file, opt.camera_file,
-                        "",
-                        "",
-                        false) ); // Do not allow promotion from normal to map projected session
-
-    if ( opt.camera_file.empty() )
-      vw_throw( ArgumentErr() << "Missing input camera.\n" );
-
-   
-    boost::shared_ptr<CameraModel> cam = session->camera_model(opt.image_file, opt.camera_file);
-
-    // The input nodata value
-    float input_nodata_value = -std::numeric_limits<float>::max(); 
-    vw::read_nodata_val(opt.image_file, input_nodata_value);
+    FootprintSurface surf;
+    loadSurface(opt, surf);
 
-    // Just get the image size
-    vw::Vector2i image_size = vw::file_image_size(opt.image_file);
+    if (!opt.image_list.empty()) {
+      calcFootprints(opt, surf);
+      return 0;
+    }
 
-    //    // The bounding box -> Add this feature in the future!
-    //    BBox2 image_box = bounding_box(input_img);
-    //    if (!opt.image_crop_box.empty()) 
-    //      image_box.crop(opt.image_crop_box);
-    
-    // Perform the computation
-    
-    GeoReference target_georef;
-    
     BBox2 footprint_bbox;
-    float mean_gsd=0;
+    float mean_gsd = 0;
     std::vector<Vector3> coords;
-    if (opt.dem_file.empty()) { // No DEM available, intersect with the datum.
-
-      // Initialize the georef/datum
-      bool have_user_datum = (opt.datum_str != "");
-      cartography::Datum datum(opt.datum_str);
-      target_georef = GeoReference(datum);
-      bool have_input_georef = false;
-      asp::set_srs_string(opt.target_srs_string, have_user_datum, datum,
-                          have_input_georef, target_georef);
-      vw_out() << "Using georef: " << target_georef << std::endl;
-
-      std::vector<Vector2> coords2;
-      footprint_bbox = camera_bbox(target_georef, cam, image_size[0], image_size[1],
-                                   mean_gsd, &coords2);
-      for (size_t i=0; i<coords2.size(); ++i) {
-        Vector3 proj_coord(coords2[i][0], coords2[i][1], 0.0);
-        coords.push_back(target_georef.point_to_geodetic(proj_coord));
-      }
-      
-    } else { // DEM provided, intersect with it.
-
-      // Load the DEM
-      float dem_nodata_val = -std::numeric_limits<float>::max(); 
-      vw::read_nodata_val(opt.dem_file, dem_nodata_val);
-      ImageViewRef< PixelMask<double> > dem = create_mask
-        (channel_cast<double>(DiskImageView<float>(opt.dem_file)), dem_nodata_val);
-      
-      GeoReference dem_georef;
-      if (!read_georeference(dem_georef, opt.dem_file))
-        vw_throw( ArgumentErr() << "Missing georef.\n");
-
-      target_georef = dem_georef; // return box in this projection
-      vw_out() << "Using georef: " << target_georef << std::endl;
-      
-      footprint_bbox = camera_bbox(dem, dem_georef, target_georef, cam,
-                                   image_size[0], image_size[1], mean_gsd, opt.quick, &coords);
-      for (size_t i=0; i<coords.size(); ++i)
-        coords[i] = target_georef.datum().cartesian_to_geodetic(coords[i]);
-    }
+    calcFootprint(opt, surf, opt.image_file, opt.camera_file,
+                  footprint_bbox, mean_gsd, coords);
     
     // Print out the results    
     vw_out() << "Computed footprint bounding box:\n" << footprint_bbox << std::endl;
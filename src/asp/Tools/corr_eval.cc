@@ -24,6 +24,7 @@
 #include <vw/Stereo/CorrEval.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/CorrEvalView.h>
 #include <asp/Core/StereoSettings.h>
 
 namespace po = boost::program_options;
@@ -32,7 +33,7 @@ namespace fs = boost::filesystem;
 struct Options : vw::GdalWriteOptions {
   std::string left_image, right_image, disparity, output_prefix, metric;
   vw::Vector2i kernel_size;
-  bool round_to_int;
+  bool round_to_int, per_pixel_patches;
   int prefilter_mode, sample_rate;
   float prefilter_kernel_width;
 };
@@ -82,7 +83,10 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "The output image size does not change. To shrink it, (say by 2x), run "
      "gdal_translate -r average -outsize 50% 50% in.tif out.tif.")
     ("round-to-int", po::bool_switch(&opt.round_to_int)->default_value(false),
-     "Round the disparity to integer and skip interpolation when finding the right image patches. This make the program faster by a factor of about 2, without changing significantly the output image.");
+     "Round the disparity to integer and skip interpolation when finding the right image patches. This make the program faster by a factor of about 2, without changing significantly the output image.")
+    ("per-pixel-patches", po::bool_switch(&opt.per_pixel_patches)->default_value(false),
+     "Extract the image patches for each pixel, as in earlier versions, rather than "
+     "using running sums. This is much slower, especially for large kernels.");
 
   general_options.add(vw::GdalWriteOptionsDescription(opt));
   
@@ -170,13 +174,21 @@ int main(int argc, char *argv[]) {
     bool has_left_georef = read_georeference(left_georef, opt.left_image);
     bool has_nodata      = true;
     std::string output_image = opt.output_prefix + "-" + opt.metric + ".tif";
+
+    ImageViewRef<PixelMask<float>> quality;
+    if (opt.per_pixel_patches)
+      quality = vw::stereo::corr_eval(masked_left, masked_right,
+                                      disp, opt.kernel_size, opt.metric,
+                                      opt.sample_rate, opt.round_to_int);
+    else
+      quality = asp::CorrEvalView(masked_left, masked_right,
+                                  disp, opt.kernel_size, opt.metric,
+                                  opt.sample_rate, opt.round_to_int);
+
     vw_out() << "Writing: " << output_image << "\n";
     vw::cartography::block_write_gdal_image
       (output_image,
-       apply_mask(vw::stereo::corr_eval(masked_left, masked_right,
-                                        disp, opt.kernel_size, opt.metric,
-                                        opt.sample_rate, opt.round_to_int),
-                  left_nodata),
+       apply_mask(quality, left_nodata),
        has_left_georef, left_georef,
        has_nodata, left_nodata, opt,
        TerminalProgressCallback("asp", "\t--> Correlation quality:"));
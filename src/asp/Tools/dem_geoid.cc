@@ -28,12 +28,11 @@ extern "C" {
                             double* flon, double* flat, double* val);
 }
 
-#include <vw/Image/Interpolation.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/GeoidGrid.h>
 
 #include <boost/filesystem.hpp>
-#include <boost/dll.hpp>
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
@@ -48,9 +47,7 @@ class DemGeoidView : public ImageViewBase<DemGeoidView<ImageT>> {
   ImageT                m_img;    // The DEM
   GeoReference   const& m_georef; // alias
   bool                  m_is_egm2008;
-  vector<double> const& m_egm2008_grid; // Special variable storing EGM2008 data
-  ImageViewRef<PixelMask<double>> const& m_geoid; // Interpolation view of the geoid
-  GeoReference const& m_geoid_georef; // alias
+  asp::GeoidGrid const& m_geoid;  // The geoid heights, with their georeference
   bool     m_reverse_adjustment; // If true, convert from orthometric height to geoid height
   double   m_correction;
   double   m_nodata_val;
@@ -63,13 +60,10 @@ public:
 
 
   DemGeoidView(ImageT const& img, GeoReference const& georef,
-               bool is_egm2008, vector<double> const& egm2008_grid,
-               ImageViewRef<PixelMask<double> > const& geoid,
-               GeoReference const& geoid_georef, bool reverse_adjustment,
-               double correction, double nodata_val):
+               bool is_egm2008, asp::GeoidGrid const& geoid,
+               bool reverse_adjustment, double correction, double nodata_val):
     m_img(img), m_georef(georef),
-    m_is_egm2008(is_egm2008), m_egm2008_grid(egm2008_grid),
-    m_geoid(geoid), m_geoid_georef(geoid_georef),
+    m_is_egm2008(is_egm2008), m_geoid(geoid),
     m_reverse_adjustment(reverse_adjustment),
     m_correction(correction),
     m_nodata_val(nodata_val){}
@@ -80,9 +74,10 @@ public:
 
   inline pixel_accessor origin() const { return pixel_accessor(*this); }
 
-  inline result_type operator()( size_t col, size_t row, size_t p=0 ) const {
+  // Adjust the given DEM height at the given pixel
+  inline double adjust(double height_above_ellipsoid, int col, int row) const {
 
-    if ( m_img(col, row, p) == m_nodata_val )
+    if (height_above_ellipsoid == m_nodata_val)
       return m_nodata_val; // Skip invalid pixels
 
     Vector2 lonlat = m_georef.pixel_to_lonlat(Vector2(col, row));
@@ -110,28 +105,22 @@ public:
     while( lonlat[0] <   0.0  ) lonlat[0] += 360.0;
     while( lonlat[0] >= 360.0 ) lonlat[0] -= 360.0;
 
-
-
-    result_type geoid_height = 0.0;
+    double geoid_height = 0.0;
     if (m_is_egm2008){
-      int nr = m_geoid.rows(), 
+      int nr = m_geoid.rows(),
           nc = m_geoid.cols();
       // Call fortran function from "geoid" mini external library
-      egm2008_call_interp_(&nr, &nc, (double*)&m_egm2008_grid[0],
+      egm2008_call_interp_(&nr, &nc, const_cast<double*>(m_geoid.data()),
                            &lonlat[0], &lonlat[1], &geoid_height);
     }else{
-      // Use our own interpolation into the geoid image
-      Vector2  pix = m_geoid_georef.lonlat_to_pixel(lonlat);
-      PixelMask<double> interp_val = m_geoid(pix[0], pix[1]);
-      if (!is_valid(interp_val))
+      // Use our own interpolation into the geoid grid
+      Vector2 pix = m_geoid.georef().lonlat_to_pixel(lonlat);
+      if (!m_geoid.interpolate(pix[0], pix[1], geoid_height))
         return m_nodata_val;
-      geoid_height = interp_val.child();
     }
 
     geoid_height += m_correction;
 
-    result_type height_above_ellipsoid = m_img(col, row, p);
-
     // Compute height above the geoid
     // - See the note in the main program about the formula below
     if (m_reverse_adjustment)
@@ -140,13 +129,20 @@ public:
       return height_above_ellipsoid - geoid_height;
   }
 
+  inline result_type operator()( size_t col, size_t row, size_t p=0 ) const {
+    return adjust(m_img(col, row, p), col, row);
+  }
+
   /// \cond INTERNAL
-  typedef DemGeoidView<typename ImageT::prerasterize_type> prerasterize_type;
+  // Read the DEM tile once, and adjust it in place
+  typedef CropView<ImageView<result_type>> prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return prerasterize_type( m_img.prerasterize(bbox), m_georef,
-                              m_is_egm2008, m_egm2008_grid,
-                              m_geoid, m_geoid_georef, m_reverse_adjustment,
-                              m_correction, m_nodata_val );
+    ImageView<result_type> tile = crop(m_img, bbox);
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++)
+        tile(col, row) = adjust(tile(col, row), bbox.min().x() + col, bbox.min().y() + row);
+    }
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
   }
   template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
     vw::rasterize( prerasterize(bbox), dest, bbox );
@@ -158,48 +154,20 @@ public:
 template <class ImageT>
 DemGeoidView<ImageT>
 dem_geoid( ImageViewBase<ImageT> const& img, GeoReference const& georef,
-           bool is_egm2008, vector<double> & egm2008_grid,
-           ImageViewRef<PixelMask<double> > const& geoid,
-           GeoReference const& geoid_georef, bool reverse_adjustment,
+           bool is_egm2008, asp::GeoidGrid const& geoid, bool reverse_adjustment,
            double correction, double nodata_val) {
-  return DemGeoidView<ImageT>( img.impl(), georef,
-                               is_egm2008, egm2008_grid,
-                               geoid, geoid_georef,
+  return DemGeoidView<ImageT>( img.impl(), georef, is_egm2008, geoid,
                                reverse_adjustment, correction, nodata_val );
 }
 
 /// Parameters for this tool
 struct Options : vw::GdalWriteOptions {
-  string dem_path, geoid, out_prefix;
+  string dem_path, geoid, out_prefix, geoid_cache_dir;
   double nodata_value;
   bool   use_double; // Otherwise use float
   bool   reverse_adjustment;
 };
 
-// Get the absolute path to the geoid. It is normally in the share/geoids
-// directory of the ASP distribution, but in dev mode the directory
-// having the geoids can be set via the ASP_GEOID_DIR env var.
-string get_geoid_full_path(std::string const& prog_name, std::string const& geoid_file){
-
-  // Convert to absolute path first, to avoid issues when prog_name
-  // is simply "dem_geoid" with no path, when subsequent operations on
-  // it will fail.
-  char * geoid_dir_ptr = getenv("ASP_GEOID_DIR");
-  fs::path geoid_dir;
-  if (geoid_dir_ptr != NULL && std::string(geoid_dir_ptr) != "")
-    geoid_dir = fs::path(std::string(geoid_dir_ptr));
-  else
-    geoid_dir = boost::dll::program_location().parent_path().parent_path() / fs::path("share")
-      / fs::path("geoids");
-  
-  fs::path geoid_path = geoid_dir / fs::path(geoid_file);
-  if (!fs::exists(geoid_path)) 
-    vw_throw( ArgumentErr() << "Could not find the geoid: " << geoid_path.string()
-              << ". Set export ASP_GEOID_DIR=/path/to/share/geoids\n");
-
-  return geoid_path.string();
-}
-
 void handle_arguments( int argc, char *argv[], Options& opt ){
 
   po::options_description general_options("");
@@ -213,7 +181,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ){
          "Output using double precision (64 bit) instead of float (32 bit).")
     ("reverse-adjustment",
                         po::bool_switch(&opt.reverse_adjustment)->default_value(false)->implicit_value(true),
-        "Go from DEM relative to the geoid to DEM relative to the ellipsoid.");
+        "Go from DEM relative to the geoid to DEM relative to the ellipsoid.")
+    ("geoid-cache-dir", po::value(&opt.geoid_cache_dir)->default_value(""),
+        "Save the decoded geoid grid in this directory, and read it from there in later runs. This is much faster for EGM2008.");
 
   general_options.add( vw::GdalWriteOptionsDescription(opt) );
 
@@ -291,7 +261,6 @@ int main( int argc, char *argv[] ) {
 
   Options opt;
   try {
-    std::string prog_name = argv[0];
     handle_arguments( argc, argv, opt );
 
     bool reverse_adjustment = opt.reverse_adjustment;
@@ -370,55 +339,15 @@ int main( int argc, char *argv[] ) {
       geoid_file = "mola_areoid.tif";
 
     // Find where we keep the information for this geoid
-    geoid_file = get_geoid_full_path(prog_name, geoid_file);
+    geoid_file = asp::geoid_full_path(geoid_file);
     vw_out() << "Adjusting the DEM using the geoid: " << geoid_file << endl;
 
-    // Read the geoid containing the adjustments. Read it in memory
-    // entirely to dramatically speed up the computations.
-    double geoid_nodata_val = numeric_limits<float>::quiet_NaN();
-    DiskImageResourceGDAL geoid_rsrc(geoid_file);
-    if ( geoid_rsrc.has_nodata_read() ) {
-      geoid_nodata_val = geoid_rsrc.nodata_read();
-    }
-    ImageView<float> geoid_img = DiskImageView<float>(geoid_rsrc);
-    GeoReference geoid_georef;
-    read_georeference(geoid_georef, geoid_rsrc);
-
-    if (is_wgs84 && !is_egm2008){
-      // Convert the egm96 int16 JPEG2000-encoded geoid to float.
-      double a =  0, 
-             b =  65534, // TODO: What is this?
-             c = -108, 
-             d =  86, 
-             s = (d-c)/(b-a);
-      for (int col = 0; col < geoid_img.cols(); col++){
-        for (int row = 0; row < geoid_img.rows(); row++){
-          geoid_img(col, row) = s*(geoid_img(col, row) - a) + c;
-        }
-      }
-    }
-
-    // The EGM2008 case is special. Then, we don't do bicubic interpolation into
-    // geoid_img, rather, we invoke some Fortran routine, which gives more accurate results.
-    // And we scale the int16 JPEG2000-encoded geoid to float.
-    vector<double> egm2008_grid;
-    if (is_egm2008){
-      double a  =  0,  
-             b  =  65534, // TODO: What is this?
-             c  = -107, 
-             d  =  86, 
-             s  = (d-c)/(b-a);
-      int    nr = geoid_img.rows(), 
-             nc = geoid_img.cols();
-      egm2008_grid.resize(nr*nc);
-      for (int col = 0; col < nc; col++){
-        for (int row = 0; row < nr; row++){
-          double val = geoid_img(col, row);
-          val = s*(val - a) + c;
-          egm2008_grid[row + col*nr] = val; // that is, egm2008_grid(row, col) = val;
-        }
-      }
-    }
+    // Read the geoid heights in memory entirely, to dramatically speed up
+    // the computations. The EGM2008 case is special. Then, we don't do
+    // bicubic interpolation into the grid, rather, we invoke some Fortran
+    // routine, which gives more accurate results.
+    asp::GeoidGrid geoid(geoid_file, opt.geoid_cache_dir);
+    GeoReference const& geoid_georef = geoid.georef();
 
     // Need to apply an extra correction if the datum radius of the geoid is different
     // than the datum radius of the DEM to correct. We do this only if the datum is
@@ -438,19 +367,8 @@ int main( int argc, char *argv[] ) {
                              << "axis lengths differ.\n";
     }
 
-    // Put an interpolation and mask wrapper around the input geoid file
-    ImageViewRef<PixelMask<double> > geoid
-      = interpolate(create_mask( pixel_cast<double>(geoid_img), 
-                                 geoid_nodata_val ),
-                    BicubicInterpolation(), ZeroEdgeExtension());
-
-    //vw_out() << "Input DEM georef: " << dem_georef << std::endl;
-    //vw_out() << "Geoid georef: " << geoid_georef << std::endl;
-
     // Set up conversion image view
-    ImageViewRef<double> adj_dem = dem_geoid(dem_img, dem_georef,
-                                             is_egm2008, egm2008_grid,
-                                             geoid, geoid_georef,
+    ImageViewRef<double> adj_dem = dem_geoid(dem_img, dem_georef, is_egm2008, geoid,
                                              reverse_adjustment, major_correction, dem_nodata_val);
 
     string adj_dem_file = opt.out_prefix + "-adj.tif";
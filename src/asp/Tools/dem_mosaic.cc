@@ -54,6 +54,11 @@
 #include <time.h>
 #include <limits>
 #include <algorithm>
+#include <map>
+#include <cstdint>
+#include <exception>
+#include <sstream>
+#include <thread>
 
 using namespace vw; // TODO(oalexan1): Remove this namespace
 using namespace vw::cartography;
@@ -348,30 +353,31 @@ GeoReference read_georef(std::string const& file){
 
 struct Options: vw::GdalWriteOptions {
   std::string dem_list_file, out_prefix, target_srs_string,
-    output_type, tile_list_str, this_dem_as_reference;
+    output_type, tile_list_str, this_dem_as_reference, bbox_cache, query_tiles_file,
+    weights_cache_dir, weights_cache_key;
   std::vector<std::string> dem_files;
   double tr, geo_tile_size;
   bool   has_out_nodata, force_projwin;
   double out_nodata_value;
   int    tile_size, tile_index, erode_len, priority_blending_len,
          extra_crop_len, hole_fill_len, block_size, save_dem_weight,
-         fill_num_passes;
+         fill_num_passes, dem_threads;
   double weights_exp, weights_blur_sigma, dem_blur_sigma;
   double nodata_threshold, fill_search_radius, fill_power, fill_percent;
   bool   first, last, min, max, block_max, mean, stddev, median, nmad,
     count, tap, save_index_map, use_centerline_weights,
-         first_dem_as_reference, propagate_nodata, no_border_blend;
+         first_dem_as_reference, propagate_nodata, no_border_blend, cog;
   std::set<int> tile_list;
   BBox2 projwin;
   Options(): tr(0), geo_tile_size(0), has_out_nodata(false), force_projwin(false), 
              tile_index(-1), erode_len(0), priority_blending_len(0), extra_crop_len(0),
              hole_fill_len(0), block_size(0), save_dem_weight(-1), 
-             fill_search_radius(0), fill_power(0), fill_percent(0), fill_num_passes(0),
+             fill_search_radius(0), fill_power(0), fill_percent(0), fill_num_passes(0), dem_threads(1),
              weights_exp(0), weights_blur_sigma(0.0), dem_blur_sigma(0.0),
              nodata_threshold(std::numeric_limits<double>::quiet_NaN()),
              first(false), last(false), min(false), max(false), block_max(false),
              mean(false), stddev(false), median(false), nmad(false),
-             count(false), save_index_map(false), tap(false),
+             count(false), save_index_map(false), tap(false), cog(false),
              use_centerline_weights(false), first_dem_as_reference(false), projwin(BBox2()) {}
 };
 
@@ -400,6 +406,197 @@ std::string tile_suffix(Options const& opt){
   return ans;
 }
 
+// The footprints of the input DEMs in the output pixels, binned into a
+// grid of square cells, to quickly find the DEMs which may overlap an
+// output block without checking each DEM.
+class DemFootprintIndex {
+  int m_cell_size;
+  std::vector<BBox2> m_boxes;
+  std::map<std::pair<int, int>, std::vector<int>> m_cells;
+  std::vector<int> m_large; // footprints spanning too many cells, checked each time
+
+  // The cells touched by a box, as a box of cell indices
+  BBox2i cellRange(BBox2 const& box) const {
+    Vector2i beg(floor(box.min().x() / m_cell_size), floor(box.min().y() / m_cell_size));
+    Vector2i end(floor(box.max().x() / m_cell_size), floor(box.max().y() / m_cell_size));
+    return BBox2i(beg, end + Vector2i(1, 1));
+  }
+  
+public:
+  // Each box must already include any margin needed. Queries are
+  // expected to be within the given region.
+  DemFootprintIndex(std::vector<BBox2> const& boxes, BBox2i const& query_region,
+                    int cell_size): m_cell_size(std::max(cell_size, 1)), m_boxes(boxes) {
+    for (int dem_iter = 0; dem_iter < (int)boxes.size(); dem_iter++) {
+      BBox2 box = boxes[dem_iter];
+      box.crop(BBox2(query_region));
+      if (box.empty())
+        continue;
+      BBox2i range = cellRange(box);
+      if (double(range.width()) * range.height() > 4096.0) {
+        m_large.push_back(dem_iter);
+        continue;
+      }
+      for (int cx = range.min().x(); cx < range.max().x(); cx++)
+        for (int cy = range.min().y(); cy < range.max().y(); cy++)
+          m_cells[std::make_pair(cx, cy)].push_back(dem_iter);
+    }
+  }
+
+  // The DEMs whose footprints intersect the given box, in increasing order
+  void query(BBox2i const& box, std::vector<int> & dem_ids) const {
+    dem_ids.clear();
+    for (size_t k = 0; k < m_large.size(); k++) {
+      if (m_boxes[m_large[k]].intersects(BBox2(box)))
+        dem_ids.push_back(m_large[k]);
+    }
+    BBox2i range = cellRange(BBox2(box));
+    for (int cx = range.min().x(); cx < range.max().x(); cx++) {
+      for (int cy = range.min().y(); cy < range.max().y(); cy++) {
+        auto it = m_cells.find(std::make_pair(cx, cy));
+        if (it == m_cells.end())
+          continue;
+        for (size_t k = 0; k < it->second.size(); k++) {
+          int dem_iter = it->second[k];
+          if (m_boxes[dem_iter].intersects(BBox2(box)))
+            dem_ids.push_back(dem_iter);
+        }
+      }
+    }
+    std::sort(dem_ids.begin(), dem_ids.end());
+    dem_ids.erase(std::unique(dem_ids.begin(), dem_ids.end()), dem_ids.end());
+  }
+};
+
+/// The values of an input DEM in an output tile, for median and nmad.
+/// Only the box of tile pixels where the DEM is valid is kept, in the
+/// precision of the inputs, so DEMs which overlap only part of the tile
+/// take less memory.
+struct ValidClip {
+  BBox2i           box;       // in the tile pixels
+  ImageView<RealT> vals;
+  int              dem_index; // in the list of all DEMs
+
+  // Return false if the tile has no valid values
+  bool init(ImageView<double> const& tile, double nodata_value, int dem_iter) {
+    int min_c = tile.cols(), min_r = tile.rows(), max_c = -1, max_r = -1;
+    for (int c = 0; c < tile.cols(); c++) {
+      for (int r = 0; r < tile.rows(); r++) {
+        if (tile(c, r) == nodata_value)
+          continue;
+        min_c = std::min(min_c, c); max_c = std::max(max_c, c);
+        min_r = std::min(min_r, r); max_r = std::max(max_r, r);
+      }
+    }
+    if (max_c < 0)
+      return false;
+
+    box = BBox2i(min_c, min_r, max_c - min_c + 1, max_r - min_r + 1);
+    vals = pixel_cast<RealT>(crop(tile, box));
+    dem_index = dem_iter;
+    return true;
+  }
+
+  // Get the value at a tile pixel. Return false if invalid.
+  bool get(int c, int r, double nodata_value, double & val) const {
+    if (c < box.min().x() || c >= box.max().x() || r < box.min().y() || r >= box.max().y())
+      return false;
+    val = vals(c - box.min().x(), r - box.min().y());
+    return (val != nodata_value);
+  }
+};
+
+/// An input DEM prepared for blending into an output block. This is the
+/// part of the DEM needed for the block, with holes filled and blurred as
+/// requested, with the blending weights in the alpha channel.
+struct PreparedDem {
+  bool overlaps; // false if the DEM does not overlap the block
+  BBox2 in_box;  // the loaded region, in the DEM pixel coordinates
+  boost::shared_ptr<GeoTransform> geotrans;
+  ImageView<PixelGrayA<double>> dem;
+  ImageView<double> first_dem; // the DEM in the block, for --first-dem-as-reference
+  PreparedDem(): overlaps(false) {}
+};
+
+/// Read a prepared DEM saved by write_prepared_dem(). Return false if the file
+/// is missing, or if it was made with a different key.
+bool read_prepared_dem(std::string const& cache_file, std::string const& key,
+                       PreparedDem & prep) {
+
+  std::ifstream ifs(cache_file.c_str(), std::ios::binary);
+  if (!ifs.good())
+    return false;
+
+  std::uint64_t key_len = 0;
+  ifs.read((char*)&key_len, sizeof(key_len));
+  if (!ifs.good() || key_len != key.size())
+    return false;
+  std::string file_key(key_len, ' ');
+  ifs.read(&file_key[0], key_len);
+  if (!ifs.good() || file_key != key)
+    return false;
+
+  double box[4];
+  std::int32_t cols = 0, rows = 0;
+  ifs.read((char*)box, sizeof(box));
+  ifs.read((char*)&cols, sizeof(cols));
+  ifs.read((char*)&rows, sizeof(rows));
+  if (!ifs.good() || cols <= 0 || rows <= 0)
+    return false;
+
+  ImageView<PixelGrayA<double>> dem(cols, rows);
+  std::vector<double> row_vals(2*cols);
+  for (int row = 0; row < rows; row++) {
+    ifs.read((char*)&row_vals[0], row_vals.size()*sizeof(double));
+    if (!ifs.good())
+      return false;
+    for (int col = 0; col < cols; col++)
+      dem(col, row) = PixelGrayA<double>(row_vals[2*col], row_vals[2*col + 1]);
+  }
+
+  prep.in_box = BBox2(Vector2(box[0], box[1]), Vector2(box[2], box[3]));
+  prep.dem = dem;
+  return true;
+}
+
+/// Save a prepared DEM, with its weights, so that a later run with the
+/// same DEMs and options can skip hole-filling and finding the weights.
+/// Write first to a temporary file, so that an interrupted run does not
+/// leave a partial cache file.
+void write_prepared_dem(std::string const& cache_file, std::string const& key,
+                        PreparedDem const& prep) {
+
+  std::string tmp_file = cache_file + ".tmp";
+  std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+  if (!ofs.good())
+    vw_throw(ArgumentErr() << "Cannot write: " << tmp_file << "\n");
+
+  std::uint64_t key_len = key.size();
+  ofs.write((char*)&key_len, sizeof(key_len));
+  ofs.write(key.data(), key_len);
+
+  double box[4] = {prep.in_box.min().x(), prep.in_box.min().y(),
+                   prep.in_box.max().x(), prep.in_box.max().y()};
+  std::int32_t cols = prep.dem.cols(), rows = prep.dem.rows();
+  ofs.write((char*)box, sizeof(box));
+  ofs.write((char*)&cols, sizeof(cols));
+  ofs.write((char*)&rows, sizeof(rows));
+
+  std::vector<double> row_vals(2*cols);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      row_vals[2*col]     = prep.dem(col, row).v();
+      row_vals[2*col + 1] = prep.dem(col, row).a();
+    }
+    ofs.write((char*)&row_vals[0], row_vals.size()*sizeof(double));
+  }
+  ofs.close();
+  if (!ofs.good())
+    vw_throw(ArgumentErr() << "Failed to write: " << tmp_file << "\n");
+
+  fs::rename(tmp_file, cache_file);
+}
+
 /// Class that does the actual image processing work
 class DemMosaicView: public ImageViewBase<DemMosaicView>{
   int m_cols, m_rows, m_bias;
@@ -409,6 +606,7 @@ class DemMosaicView: public ImageViewBase<DemMosaicView>{
   GeoReference                     m_out_georef;
   std::vector<double>       const& m_nodata_values;    // alias
   std::vector<vw::BBox2i>          const& m_dem_pixel_bboxes; // alias
+  DemFootprintIndex         const& m_dem_index;        // alias
   long long int                  & m_num_valid_pixels; // alias, to populate on output
   vw::Mutex                      & m_count_mutex;      // alias, a lock for m_num_valid_pixels
 
@@ -420,12 +618,14 @@ public:
                 GeoReference              const& out_georef,
                 std::vector<double>       const& nodata_values,
                 std::vector<BBox2i>       const& dem_pixel_bboxes,
+                DemFootprintIndex         const& dem_index,
                 long long int                  & num_valid_pixels,
                 vw::Mutex                      & count_mutex):
     m_cols(cols), m_rows(rows), m_bias(bias), m_opt(opt),
     m_imgMgr(imgMgr), m_georefs(georefs),
     m_out_georef(out_georef), m_nodata_values(nodata_values),
-    m_dem_pixel_bboxes(dem_pixel_bboxes), m_num_valid_pixels(num_valid_pixels),
+    m_dem_pixel_bboxes(dem_pixel_bboxes), m_dem_index(dem_index),
+    m_num_valid_pixels(num_valid_pixels),
     m_count_mutex(count_mutex) {
 
     // How many valid pixels we will have
@@ -477,6 +677,257 @@ public:
     return pixel_type();
   }
 
+  /// Prepare an input DEM for blending into the given output block. Read the
+  /// part of it which is needed, fill holes and blur as requested, and store
+  /// the blending weights in the alpha channel. With --weights-cache-dir,
+  /// read the result from the cache, if present, or else save it there.
+  void prepare_dem(int dem_iter, BBox2i const& bbox, PreparedDem & prep) const {
+
+    typedef PixelGrayA<double> DoubleGrayA;
+    const bool use_priority_blend = (m_opt.priority_blending_len > 0);
+
+    // Load the information for this DEM
+    GeoReference georef        = m_georefs         [dem_iter];
+    BBox2i       dem_pixel_box = m_dem_pixel_bboxes[dem_iter];
+
+    // The GeoTransform will hide the messy details of conversions
+    // from pixels to points and lon-lat.
+    prep.geotrans.reset(new GeoTransform(georef, m_out_georef, dem_pixel_box, bbox));
+
+    // Get the tile bbox in the frame of the current input DEM
+    BBox2 in_box = prep.geotrans->reverse_bbox(bbox);
+
+    // Grow to account for blending and erosion length, etc.  If
+    // priority blending length was positive, we've already expanded 'bbox'.
+    if (!use_priority_blend)
+      in_box.expand(m_bias + BilinearInterpolation::pixel_buffer + 1);
+      
+    in_box.crop(dem_pixel_box);
+    
+    if (in_box.width() == 1 || in_box.height() == 1){
+      // Grassfire likes to have width of at least 2
+      in_box.expand(1);
+      in_box.crop(dem_pixel_box);
+    }
+    prep.overlaps = (in_box.width() > 1 && in_box.height() > 1);
+    if (!prep.overlaps)
+      return; // No overlap with this tile
+    prep.in_box = in_box;
+
+    // If the nodata_threshold is specified, all values no more than this
+    // will be invalidated.
+    double nodata_value = m_nodata_values[dem_iter];
+    if (!boost::math::isnan(m_opt.nodata_threshold))
+      nodata_value = m_opt.nodata_threshold;
+
+    ImageViewRef<double> disk_dem = pixel_cast<double>(m_imgMgr.get_handle(dem_iter, bbox));
+
+    if (m_opt.first_dem_as_reference && dem_iter == 0) {
+      // We need to keep the first DEM, to use it as ref
+      // when merging in the blended DEM
+      prep.first_dem = crop(disk_dem, bbox);
+
+      //TODO: Should be a function!
+      // Convert to the output nodata value
+      for (int col = 0; col < prep.first_dem.cols(); col++) {
+        for (int row = 0; row < prep.first_dem.rows(); row++) {
+          if (prep.first_dem(col, row) == nodata_value) {
+            prep.first_dem(col, row) = m_opt.out_nodata_value;
+          }
+        }
+      }
+    }
+
+    if (dem_iter == 0 && m_opt.this_dem_as_reference != "") {
+      // We won't actually use this DEM, we just do all in reference to it.
+      m_imgMgr.release(dem_iter);
+      return;
+    }
+
+    // See if this DEM was prepared for this block in a previous run
+    std::string cache_file, cache_key;
+    if (m_opt.weights_cache_dir != "") {
+      std::ostringstream os;
+      os << m_opt.weights_cache_dir << "/dem" << dem_iter << "-" << bbox.min().x() << "_"
+         << bbox.min().y() << "_" << bbox.width() << "_" << bbox.height() << ".bin";
+      cache_file = os.str();
+      std::string dem_file = m_imgMgr.get_file_name(dem_iter);
+      boost::system::error_code ec;
+      std::ostringstream key;
+      key << m_opt.weights_cache_key << ' ' << fs::absolute(dem_file).string() << ' '
+          << fs::file_size(dem_file, ec) << ' ' << fs::last_write_time(dem_file, ec);
+      cache_key = key.str();
+      PreparedDem cached;
+      if (read_prepared_dem(cache_file, cache_key, cached) && cached.in_box == in_box) {
+        m_imgMgr.release(dem_iter);
+        prep.dem = cached.dem;
+        return;
+      }
+    }
+
+    // Crop the disk dem to a 2-channel in-memory image. First
+    // channel is the image pixels, second will be the weights.
+    ImageView<DoubleGrayA> dem = crop(disk_dem, in_box);
+
+    // Mark the handle to the image as not in use, though we still
+    // keep that image file open, for increased performance, unless
+    // their number becomes too large.
+    m_imgMgr.release(dem_iter);
+
+    if (!boost::math::isnan(m_opt.nodata_threshold)) {
+      for (int col = 0; col < dem.cols(); col++) {
+        for (int row = 0; row < dem.rows(); row++) {
+          if (dem(col, row)[0] <= nodata_value) {
+            dem(col, row)[0] = nodata_value;
+          }
+        }
+      }
+    }
+
+    // Fill holes. This happens here, in the expanded tile, to
+    // ensure we catch holes which are partially outside the tile
+    // being processed.
+    if (m_opt.hole_fill_len > 0)
+      dem = apply_mask(vw::fill_holes_grass
+                       (create_mask(select_channel(dem, 0), nodata_value),
+                        m_opt.hole_fill_len),
+                       nodata_value);
+
+    // Fill nodata based on radius. There is a sanity check that ensures we don't
+    // do both this and the hole filling above.
+    if (m_opt.fill_search_radius > 0.0) {
+      dem = apply_mask(fillNodataWithSearchRadius
+      (create_mask(select_channel(dem, 0), nodata_value),
+        m_opt.fill_search_radius, m_opt.fill_power, m_opt.fill_percent, 
+        m_opt.fill_num_passes),
+        nodata_value);
+    }
+
+    // Fill-in no-data values a bit and blur. If just the blurring is used,
+    // it will choke on no-data values, leaving large holes around each,
+    // hence the need to fill a little.
+    if (m_opt.dem_blur_sigma > 0.0) {
+      int kernel_size = vw::compute_kernel_size(m_opt.dem_blur_sigma);
+      dem = apply_mask(gaussian_filter(fill_nodata_with_avg
+                                       (create_mask(select_channel(dem, 0), nodata_value),
+                                        kernel_size),
+                                       m_opt.dem_blur_sigma), nodata_value);
+    }
+    
+    // Compute linear weights
+    ImageView<double> local_wts = grassfire(notnodata(select_channel(dem, 0), nodata_value),
+                                            m_opt.no_border_blend);
+    if (m_opt.use_centerline_weights) {
+      // Erode based on grassfire weights, and then overwrite the grassfire
+      // weights with centerline weights
+      ImageView<DoubleGrayA> dem2 = copy(dem);
+      for (int col = 0; col < dem2.cols(); col++) {
+        for (int row = 0; row < dem2.rows(); row++) {
+          if (local_wts(col, row) <= m_opt.erode_len) {
+            dem2(col, row) = DoubleGrayA(nodata_value);
+          }
+        }
+      }
+      // TODO: Generalize this modification and move it to VW!!!
+      centerline_weights2(create_mask_less_or_equal(select_channel(dem2, 0), nodata_value),
+                          local_wts, m_bias, -1.0);
+    } // End centerline weights case
+
+    // If we don't limit the weights from above, we will have tiling artifacts,
+    // as in different tiles the weights grow to different heights since
+    // they are cropped to different regions. For priority blending length,
+    // we'll do this process later, as the bbox is obtained differently in that case.
+    // With centerline weights, that is handled before 1D weights are multiplied
+    // to get the 2D weights.
+    if (!use_priority_blend && !m_opt.use_centerline_weights) {
+      for (int col = 0; col < local_wts.cols(); col++) {
+        for (int row = 0; row < local_wts.rows(); row++) {
+          local_wts(col, row) = std::min(local_wts(col, row), double(m_bias));
+        }
+      }
+    }
+
+    // Erode. We already did that if centerline weights are used.
+    if (!m_opt.use_centerline_weights) {
+      int max_cutoff = max_pixel_value(local_wts);
+      int min_cutoff = m_opt.erode_len;
+      if (max_cutoff <= min_cutoff)
+        max_cutoff = min_cutoff + 1; // precaution
+      local_wts = clamp(local_wts - min_cutoff, 0.0, max_cutoff - min_cutoff);
+    }
+    
+    // Blur the weights. If priority blending length is on, we'll do the blur later,
+    // after weights from different DEMs are combined.
+    if (m_opt.weights_blur_sigma > 0 && !use_priority_blend)
+      blur_weights(local_wts, m_opt.weights_blur_sigma);
+
+    // Raise to the power. Note that when priority blending length is positive, we
+    // delay this process.
+    if (m_opt.weights_exp != 1 && !use_priority_blend) {
+      for (int col = 0; col < dem.cols(); col++){
+        for (int row = 0; row < dem.rows(); row++){
+          if (local_wts(col, row) > 0)
+            local_wts(col, row) = pow(local_wts(col, row), m_opt.weights_exp);
+        }
+      }
+    }
+
+#if 0
+    // Save the weights with georeference. Very useful for debugging
+    // non-uniqueness issues across tiles.
+    std::ostringstream os;
+    os << "weights_" << dem_iter << "_" << bbox.min().x() << "_" << bbox.min().y() 
+       << ".tif";
+    vw_out() << "Writing: " << os.str() << std::endl;
+    bool has_georef = true, has_nodata = true;
+    block_write_gdal_image(os.str(), local_wts,
+			     has_georef, georef,
+			     has_nodata, -100,
+			     vw::GdalWriteOptions(),
+			     TerminalProgressCallback("asp", ""));
+#endif
+
+    // TODO(oalexan1): This must be a function
+    // Set the weights in the alpha channel
+    for (int col = 0; col < dem.cols(); col++){
+      for (int row = 0; row < dem.rows(); row++){
+        dem(col, row).a() = local_wts(col, row);
+      }
+    }
+
+    prep.dem = dem;
+    if (cache_file != "")
+      write_prepared_dem(cache_file, cache_key, prep);
+  }
+
+  /// Prepare the DEMs with indices dem_ids[start], ..., dem_ids[start + num - 1]
+  /// for blending into the given output block, each on its own thread.
+  void prepare_dems(std::vector<int> const& dem_ids, size_t start, size_t num,
+                    BBox2i const& bbox, std::vector<PreparedDem> & prepared) const {
+
+    prepared.clear();
+    prepared.resize(num);
+    std::vector<std::exception_ptr> errors(num);
+    auto prepare = [&](size_t it) {
+      try {
+        prepare_dem(dem_ids[start + it], bbox, prepared[it]);
+      } catch (...) {
+        errors[it] = std::current_exception();
+      }
+    };
+    std::vector<std::thread> workers;
+    for (size_t it = 1; it < num; it++)
+      workers.push_back(std::thread(prepare, it));
+    if (num > 0)
+      prepare(0);
+    for (size_t it = 0; it < workers.size(); it++)
+      workers[it].join();
+    for (size_t it = 0; it < errors.size(); it++) {
+      if (errors[it])
+        std::rethrow_exception(errors[it]);
+    }
+  }
+
   typedef CropView<ImageView<pixel_type> > prerasterize_type;
   inline prerasterize_type prerasterize(BBox2i bbox) const {
 
@@ -504,11 +955,8 @@ public:
     bool noblend = (no_blend(m_opt) > 0);
 
     // A vector of images the size of the output tile.
-    // - Used for median, nmad, and stddev calculation.
+    // - Used for priority blending and stddev calculation.
     std::vector<ImageView<double>> tile_vec, weight_vec;
-    std::vector<std::string> dem_vec;
-    if (m_opt.median || m_opt.nmad) // Store each input separately
-      tile_vec.reserve(m_imgMgr.size());
     if (m_opt.stddev) { // Need one working image
       tile_vec.push_back(ImageView<double>(bbox.width(), bbox.height()));
       // Each pixel starts at zero, nodata is handled later
@@ -528,6 +976,14 @@ public:
       fill(weight_modifier, std::numeric_limits<double>::max());
     }
 
+    // For median and nmad, the values of each input DEM, kept only over
+    // the part of the tile where that DEM is valid.
+    std::vector<ValidClip> valid_clips;
+
+    // For block max, the tile with the largest sum so far
+    ImageView<double> block_max_tile;
+    double block_max_sum = -std::numeric_limits<double>::max();
+    
     // For saving the weights
     std::vector<int> clip2dem_index;
     ImageView<double> saved_weight;
@@ -554,36 +1010,35 @@ public:
     }
 
     ImageView<double> first_dem;
-    ImageView<double> local_wts_orig;
 
-    // Loop through all input DEMs
-    for (int dem_iter = 0; dem_iter < (int)m_imgMgr.size(); dem_iter++) {
-
-      // Load the information for this DEM
-      GeoReference georef        = m_georefs         [dem_iter];
-      BBox2i       dem_pixel_box = m_dem_pixel_bboxes[dem_iter];
-
-      // The GeoTransform will hide the messy details of conversions
-      // from pixels to points and lon-lat.
-      GeoTransform geotrans(georef, m_out_georef, dem_pixel_box, bbox);
+    // Loop through the input DEMs which may overlap this tile. The rest
+    // would be skipped below anyway, but only after the costly creation
+    // of a GeoTransform for each.
+    std::vector<int> dem_ids;
+    m_dem_index.query(bbox, dem_ids);
+
+    // The DEMs are read and their weights are found in batches, with each
+    // DEM in a batch on its own thread. Then they are blended in order, so
+    // the result does not depend on the number of threads.
+    size_t batch_size = std::max(m_opt.dem_threads, 1);
+    std::vector<PreparedDem> batch;
+    for (size_t id_iter = 0; id_iter < dem_ids.size(); id_iter++) {
+      int dem_iter = dem_ids[id_iter];
+
+      if (id_iter % batch_size == 0)
+        prepare_dems(dem_ids, id_iter, std::min(batch_size, dem_ids.size() - id_iter),
+                     bbox, batch);
+      PreparedDem & prep = batch[id_iter % batch_size];
+      if (!prep.overlaps)
+        continue; // No overlap with this tile, skip to the next DEM.
 
-      // Get the tile bbox in the frame of the current input DEM
-      BBox2 in_box = geotrans.reverse_bbox(bbox);
+      if (m_opt.first_dem_as_reference && dem_iter == 0)
+        first_dem = prep.first_dem;
 
-      // Grow to account for blending and erosion length, etc.  If
-      // priority blending length was positive, we've already expanded 'bbox'.
-      if (!use_priority_blend)
-        in_box.expand(m_bias + BilinearInterpolation::pixel_buffer + 1);
-        
-      in_box.crop(dem_pixel_box);
-      
-      if (in_box.width() == 1 || in_box.height() == 1){
-        // Grassfire likes to have width of at least 2
-        in_box.expand(1);
-        in_box.crop(dem_pixel_box);
+      if (dem_iter == 0 && m_opt.this_dem_as_reference != "") {
+        // We won't actually use this DEM, we just do all in reference to it.
+        continue;
       }
-      if (in_box.width() <= 1 || in_box.height() <= 1)
-        continue; // No overlap with this tile, skip to the next DEM.
 
       if (m_opt.median || m_opt.nmad || use_priority_blend || m_opt.block_max) {
         // Must use a blank tile each time
@@ -591,167 +1046,11 @@ public:
         fill(weights, 0.0);
       }
 
-      // Crop the disk dem to a 2-channel in-memory image. First
-      // channel is the image pixels, second will be the weights.
-      ImageViewRef<double> disk_dem = pixel_cast<double>(m_imgMgr.get_handle(dem_iter, bbox));
-      ImageView<DoubleGrayA> dem    = crop(disk_dem, in_box);
-
-      if (m_opt.first_dem_as_reference && dem_iter == 0) {
-        // We need to keep the first DEM, to use it as ref
-        // when merging in the blended DEM
-        first_dem = crop(disk_dem, bbox);
-      }
-
+      BBox2                  const& in_box   = prep.in_box;
+      GeoTransform           const& geotrans = *prep.geotrans;
+      ImageView<DoubleGrayA>      & dem      = prep.dem;
       std::string dem_name = m_imgMgr.get_file_name(dem_iter);
 
-      // If the nodata_threshold is specified, all values no more than this
-      // will be invalidated.
-      double nodata_value = m_nodata_values[dem_iter];
-      if (!boost::math::isnan(m_opt.nodata_threshold)) {
-        nodata_value = m_opt.nodata_threshold;
-        for (int col = 0; col < dem.cols(); col++) {
-          for (int row = 0; row < dem.rows(); row++) {
-            if (dem(col, row)[0] <= nodata_value) {
-              dem(col, row)[0] = nodata_value;
-            }
-          }
-        }
-      }
-
-      if (m_opt.first_dem_as_reference && dem_iter == 0) {
-        //TODO: Should be a function!
-        // Convert to the output nodata value
-        for (int col = 0; col < first_dem.cols(); col++) {
-          for (int row = 0; row < first_dem.rows(); row++) {
-            if (first_dem(col, row) == nodata_value) {
-              first_dem(col, row) = m_opt.out_nodata_value;
-            }
-          }
-        }
-      }
-
-      // Fill holes. This happens here, in the expanded tile, to
-      // ensure we catch holes which are partially outside the tile
-      // being processed.
-      if (m_opt.hole_fill_len > 0)
-        dem = apply_mask(vw::fill_holes_grass
-                         (create_mask(select_channel(dem, 0), nodata_value),
-                          m_opt.hole_fill_len),
-                         nodata_value);
-
-      // Fill nodata based on radius. There is a sanity check that ensures we don't
-      // do both this and the hole filling above.
-      if (m_opt.fill_search_radius > 0.0) {
-        dem = apply_mask(fillNodataWithSearchRadius
-        (create_mask(select_channel(dem, 0), nodata_value),
-          m_opt.fill_search_radius, m_opt.fill_power, m_opt.fill_percent, 
-          m_opt.fill_num_passes),
-          nodata_value);
-      }
-
-      // Fill-in no-data values a bit and blur. If just the blurring is used,
-      // it will choke on no-data values, leaving large holes around each,
-      // hence the need to fill a little.
-      if (m_opt.dem_blur_sigma > 0.0) {
-        int kernel_size = vw::compute_kernel_size(m_opt.dem_blur_sigma);
-        dem = apply_mask(gaussian_filter(fill_nodata_with_avg
-                                         (create_mask(select_channel(dem, 0), nodata_value),
-                                          kernel_size),
-                                         m_opt.dem_blur_sigma), nodata_value);
-      }
-      
-      // Mark the handle to the image as not in use, though we still
-      // keep that image file open, for increased performance, unless
-      // their number becomes too large.
-      m_imgMgr.release(dem_iter);
-
-      if (dem_iter == 0 && m_opt.this_dem_as_reference != "") {
-        // We won't actually use this DEM, we just do all in reference to it.
-        continue;
-      }
-
-      // Compute linear weights
-      ImageView<double> local_wts = grassfire(notnodata(select_channel(dem, 0), nodata_value),
-                                              m_opt.no_border_blend);
-      local_wts_orig = local_wts;
-      if (m_opt.use_centerline_weights) {
-        // Erode based on grassfire weights, and then overwrite the grassfire
-        // weights with centerline weights
-        ImageView<DoubleGrayA> dem2 = copy(dem);
-        for (int col = 0; col < dem2.cols(); col++) {
-          for (int row = 0; row < dem2.rows(); row++) {
-            if (local_wts(col, row) <= m_opt.erode_len) {
-              dem2(col, row) = DoubleGrayA(nodata_value);
-            }
-          }
-        }
-        // TODO: Generalize this modification and move it to VW!!!
-        centerline_weights2(create_mask_less_or_equal(select_channel(dem2, 0), nodata_value),
-                            local_wts, m_bias, -1.0);
-      } // End centerline weights case
-
-      // If we don't limit the weights from above, we will have tiling artifacts,
-      // as in different tiles the weights grow to different heights since
-      // they are cropped to different regions. For priority blending length,
-      // we'll do this process later, as the bbox is obtained differently in that case.
-      // With centerline weights, that is handled before 1D weights are multiplied
-      // to get the 2D weights.
-      if (!use_priority_blend && !m_opt.use_centerline_weights) {
-        for (int col = 0; col < local_wts.cols(); col++) {
-          for (int row = 0; row < local_wts.rows(); row++) {
-            local_wts(col, row) = std::min(local_wts(col, row), double(m_bias));
-          }
-        }
-      }
-
-      // Erode. We already did that if centerline weights are used.
-      if (!m_opt.use_centerline_weights) {
-        int max_cutoff = max_pixel_value(local_wts);
-        int min_cutoff = m_opt.erode_len;
-        if (max_cutoff <= min_cutoff)
-          max_cutoff = min_cutoff + 1; // precaution
-        local_wts = clamp(local_wts - min_cutoff, 0.0, max_cutoff - min_cutoff);
-      }
-      
-      // Blur the weights. If priority blending length is on, we'll do the blur later,
-      // after weights from different DEMs are combined.
-      if (m_opt.weights_blur_sigma > 0 && !use_priority_blend)
-        blur_weights(local_wts, m_opt.weights_blur_sigma);
-
-      // Raise to the power. Note that when priority blending length is positive, we
-      // delay this process.
-      if (m_opt.weights_exp != 1 && !use_priority_blend) {
-        for (int col = 0; col < dem.cols(); col++){
-          for (int row = 0; row < dem.rows(); row++){
-            if (local_wts(col, row) > 0)
-              local_wts(col, row) = pow(local_wts(col, row), m_opt.weights_exp);
-          }
-        }
-      }
-
-#if 0
-      // Save the weights with georeference. Very useful for debugging
-      // non-uniqueness issues across tiles.
-      std::ostringstream os;
-      os << "weights_" << dem_iter << "_" << bbox.min().x() << "_" << bbox.min().y() 
-         << ".tif";
-      vw_out() << "Writing: " << os.str() << std::endl;
-      bool has_georef = true, has_nodata = true;
-      block_write_gdal_image(os.str(), local_wts,
-			     has_georef, georef,
-			     has_nodata, -100,
-			     vw::GdalWriteOptions(),
-			     TerminalProgressCallback("asp", ""));
-#endif
-
-      // TODO(oalexan1): This must be a function
-      // Set the weights in the alpha channel
-      for (int col = 0; col < dem.cols(); col++){
-        for (int row = 0; row < dem.rows(); row++){
-          dem(col, row).a() = local_wts(col, row);
-        }
-      }
-
       // Prepare the DEM for interpolation
       ImageViewRef<DoubleGrayA> interp_dem
         = interpolate(dem, BilinearInterpolation(), ConstantEdgeExtension());
@@ -904,12 +1203,31 @@ public:
         } // End col loop
       } // End row loop
 
-      // For the median option, keep a copy of the output tile for each input DEM!
-      // Also do it for max per block.
-      // - This will be memory intensive. 
-      if (m_opt.median || m_opt.nmad || m_opt.block_max) {
-        tile_vec.push_back(copy(tile));
-        dem_vec.push_back(dem_name);
+      // For the median option, keep the valid values of each input DEM
+      if (m_opt.median || m_opt.nmad) {
+        ValidClip clip;
+        if (clip.init(tile, m_opt.out_nodata_value, dem_iter))
+          valid_clips.push_back(clip);
+      }
+
+      // For max per block, keep only the tile with the largest sum so far
+      if (m_opt.block_max) {
+        double tile_sum = 0.0;
+        for (int c = 0; c < tile.cols(); c++) {
+          for (int r = 0; r < tile.rows(); r++) {
+            if (tile(c, r) != m_opt.out_nodata_value)
+              tile_sum += tile(c, r);
+          }
+        }
+        // The whole purpose of --block-max is to print the sum of
+        // pixels for each mapprojected image/DEM when doing SfS.
+        // The documentation has a longer explanation.
+        vw_out() << "\n" << bbox << " " << dem_name
+                 << " pixel sum: " << tile_sum << std::endl;
+        if (tile_sum > block_max_sum) {
+          block_max_sum  = tile_sum;
+          block_max_tile = copy(tile);
+        }
       }
       
       // For priority blending, need also to keep all tiles, but also the weights
@@ -920,6 +1238,9 @@ public:
       
       if (use_priority_blend || m_opt.save_index_map)
         clip2dem_index.push_back(dem_iter);
+
+      // This DEM is no longer needed
+      prep = PreparedDem();
       
     } // End iterating over DEMs
 
@@ -956,22 +1277,26 @@ public:
     if (m_opt.median || m_opt.nmad){
       // Init output pixels to nodata
       fill(tile, m_opt.out_nodata_value);
-      std::vector<double> vals, vals_all(tile_vec.size());
+      std::vector<double> vals, vals_all;
+      std::vector<int> vals_dem; // the DEM each value came from
       // Iterate through all pixels
       for (int c = 0; c < bbox.width(); c++){
         for (int r = 0; r < bbox.height(); r++){
           // Compute the median for this pixel
           vals.clear();
-          for (int i = 0; i < (int)tile_vec.size(); i++){
-            ImageView<double> & tile_ref = tile_vec[i];
-            double this_val = tile_ref(c, r);
-            vals_all[i] = this_val; // Record the original order.
-            if (this_val == m_opt.out_nodata_value)
+          vals_dem.clear();
+          for (size_t i = 0; i < valid_clips.size(); i++){
+            double this_val = 0.0;
+            if (!valid_clips[i].get(c, r, m_opt.out_nodata_value, this_val))
               continue;
             vals.push_back(this_val);
+            vals_dem.push_back(valid_clips[i].dem_index);
           }
           if (vals.empty())
             continue;
+          // Record the original order, as the median changes vals.
+          if (m_opt.save_index_map)
+            vals_all = vals;
           if (m_opt.median)
             tile(c, r) = math::destructive_median(vals);
           else
@@ -991,7 +1316,7 @@ public:
               // is m, but in the full list of DEMs, some of which are
               // likely skipped in this tile as they don't intersect
               // it.
-              index_map(c, r) = clip2dem_index[m];
+              index_map(c, r) = vals_dem[m];
               min_dist = dist;
             }
           }
@@ -1000,31 +1325,12 @@ public:
       } // End col loop
     } // End median/nmad case
 
-    // For max per block, find the sum of values in each DEM
+    // For max per block, use the DEM with the largest sum of values
     if (m_opt.block_max) {
-      fill(tile, m_opt.out_nodata_value);
-      int num_tiles = tile_vec.size();
-      if (tile_vec.size() != dem_vec.size()) 
-        vw_throw(ArgumentErr() << "Book-keeping error.\n");
-      std::vector<double> tile_sum(num_tiles, 0);
-      for (int i = 0; i < num_tiles; i++) {
-        for (int c = 0; c < tile_vec[i].cols(); c++) {
-          for (int r = 0; r < tile_vec[i].rows(); r++) {
-            if (tile_vec[i](c, r) != m_opt.out_nodata_value) {
-              tile_sum[i] += tile_vec[i](c, r);
-            }
-          }
-        }
-        // The whole purpose of --block-max is to print the sum of
-        // pixels for each mapprojected image/DEM when doing SfS.
-        // The documentation has a longer explanation.
-        vw_out() << "\n" << bbox << " " << dem_vec[i]
-                 << " pixel sum: " << tile_sum[i] << std::endl;
-      }
-      int max_index = std::distance(tile_sum.begin(),
-                                    std::max_element(tile_sum.begin(), tile_sum.end()));
-      if (max_index >= 0 && max_index < num_tiles) 
-        tile = copy(tile_vec[max_index]);
+      if (block_max_tile.cols() > 0)
+        tile = block_max_tile;
+      else
+        fill(tile, m_opt.out_nodata_value);
     }
 
     // For priority blending length.
@@ -1283,6 +1589,117 @@ void load_dem_bounding_boxes(Options       const& opt,
   
 } // End function load_dem_bounding_boxes
 
+/// Save the bounding boxes found by load_dem_bounding_boxes(), so that
+/// later runs on the same DEMs, such as the parallel_dem_mosaic
+/// workers, need not open each input DEM to find them again.
+void save_dem_bounding_boxes(std::string         const& cache_file,
+                             Options             const& opt,
+                             GeoReference        const& mosaic_georef,
+                             BBox2               const& mosaic_bbox,
+                             std::vector<BBox2>  const& dem_proj_bboxes,
+                             std::vector<BBox2i> const& dem_pixel_bboxes) {
+
+  vw_out() << "Writing: " << cache_file << "\n";
+  std::ofstream ofs(cache_file.c_str());
+  if (!ofs.good())
+    vw_throw(ArgumentErr() << "Cannot write: " << cache_file << "\n");
+
+  ofs.precision(17);
+  ofs << "srs " << mosaic_georef.proj4_str() << "\n";
+  ofs << "spacing " << mosaic_georef.transform()(0, 0) << "\n";
+  ofs << "num_dems " << opt.dem_files.size() << "\n";
+  ofs << "mosaic_bbox " << mosaic_bbox.min().x() << ' ' << mosaic_bbox.min().y() << ' '
+      << mosaic_bbox.max().x() << ' ' << mosaic_bbox.max().y() << "\n";
+
+  // The file name is last, as it may have spaces
+  for (size_t dem_iter = 0; dem_iter < opt.dem_files.size(); dem_iter++) {
+    BBox2i const& p = dem_pixel_bboxes[dem_iter];
+    BBox2  const& b = dem_proj_bboxes[dem_iter];
+    ofs << p.min().x() << ' ' << p.min().y() << ' ' << p.max().x() << ' ' << p.max().y() << ' '
+        << b.min().x() << ' ' << b.min().y() << ' ' << b.max().x() << ' ' << b.max().y() << ' '
+        << opt.dem_files[dem_iter] << "\n";
+  }
+  ofs.close();
+}
+
+/// Read the bounding boxes saved by save_dem_bounding_boxes(). Return
+/// false if the cache is for a different list of DEMs or output
+/// projection, and then it must be recomputed.
+bool read_dem_bounding_boxes(std::string   const& cache_file,
+                             Options       const& opt,
+                             GeoReference  const& mosaic_georef,
+                             BBox2              & mosaic_bbox,
+                             std::vector<BBox2> & dem_proj_bboxes,
+                             std::vector<BBox2i> & dem_pixel_bboxes) {
+
+  mosaic_bbox = BBox2();
+  dem_proj_bboxes.clear();
+  dem_pixel_bboxes.clear();
+
+  std::ifstream ifs(cache_file.c_str());
+  if (!ifs.good())
+    return false;
+
+  std::string line, key;
+  size_t num_dems = 0;
+  double spacing = 0.0;
+  if (!std::getline(ifs, line) || line != "srs " + mosaic_georef.proj4_str())
+    return false;
+  if (!(ifs >> key >> spacing) || key != "spacing" ||
+      spacing != mosaic_georef.transform()(0, 0))
+    return false;
+  if (!(ifs >> key >> num_dems) || key != "num_dems" || num_dems != opt.dem_files.size())
+    return false;
+  double a, b, c, d;
+  if (!(ifs >> key >> a >> b >> c >> d) || key != "mosaic_bbox")
+    return false;
+  mosaic_bbox = BBox2(Vector2(a, b), Vector2(c, d));
+
+  for (size_t dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+    int i0, j0, i1, j1;
+    std::string file;
+    if (!(ifs >> i0 >> j0 >> i1 >> j1 >> a >> b >> c >> d))
+      return false;
+    std::getline(ifs, file);
+    if (file.empty() || file.substr(1) != opt.dem_files[dem_iter])
+      return false;
+    dem_pixel_bboxes.push_back(BBox2i(Vector2i(i0, j0), Vector2i(i1, j1)));
+    dem_proj_bboxes.push_back(BBox2(Vector2(a, b), Vector2(c, d)));
+  }
+
+  return true;
+}
+
+/// The pixel box of the output tile with given index
+BBox2i output_tile_box(int tile_id, int num_tiles_x, int tile_size, int cols, int rows) {
+  int tile_index_y = tile_id / num_tiles_x;
+  int tile_index_x = tile_id - tile_index_y*num_tiles_x;
+  BBox2i tile_box(tile_index_x*tile_size, tile_index_y*tile_size, tile_size, tile_size);
+  tile_box.crop(BBox2i(0, 0, cols, rows));
+  return tile_box;
+}
+
+/// The name of the output file for the tile with given index
+std::string output_tile_name(Options const& opt, int tile_id, int num_tiles,
+                             bool write_to_precise_file) {
+  if (write_to_precise_file)
+    return opt.out_prefix; // the file name was set by user
+
+  // If there are 17 tiles, let them be tile-00, ..., tile-16.
+  int num_digits = 1;
+  int tens = 10;
+  while (num_tiles - 1 >= tens) {
+    num_digits++;
+    tens *= 10;
+  }
+
+  std::ostringstream os;
+  os << opt.out_prefix << "-tile-"
+     << std::setfill('0') << std::setw(num_digits) << tile_id
+     << tile_suffix(opt) << ".tif";
+  return os.str();
+}
+
 
 void handle_arguments(int argc, char *argv[], Options& opt) {
 
@@ -1376,7 +1793,15 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("force-projwin", po::bool_switch(&opt.force_projwin)->default_value(false),
      "Make the output mosaic fill precisely the specified projwin, by padding it if necessary and aligning the output grid to the region.")
     ("save-index-map",   po::bool_switch(&opt.save_index_map)->default_value(false),
-     "For each output pixel, save the index of the input DEM it came from (applicable only for --first, --last, --min, --max, --median, and --nmad). A text file with the index assigned to each input DEM is saved as well.");
+     "For each output pixel, save the index of the input DEM it came from (applicable only for --first, --last, --min, --max, --median, and --nmad). A text file with the index assigned to each input DEM is saved as well.")
+    ("bbox-cache", po::value(&opt.bbox_cache)->default_value(""),
+     "Read the bounding boxes of the input DEMs from this file, if it exists and was made for the same DEMs and output projection and grid size. Otherwise find them and save them to this file. This avoids opening each input DEM when many tiles are created in separate runs.")
+    ("query-tiles", po::value(&opt.query_tiles_file)->default_value(""),
+     "Write to this file, for each output tile, its index, the number of input DEMs overlapping it, and the name of the tile file, and then quit. Used by parallel_dem_mosaic.")
+    ("cog", po::bool_switch(&opt.cog)->default_value(false),
+     "Write the output mosaic (or each tile) as a Cloud-Optimized GeoTIFF, with internal overviews.")
+    ("weights-cache-dir", po::value(&opt.weights_cache_dir)->default_value(""),
+     "Save in this directory, for each input DEM and output block, the DEM after hole-filling and blurring, and its blending weights, and read them from there on a later run with the same DEMs and options. This can use a lot of disk space.");
 
   // Use in GdalWriteOptions '--tif-tile-size' rather than '--tile-size', to not conflict
   // with the '--tile-size' definition used by this tool.
@@ -1704,8 +2129,19 @@ int main(int argc, char *argv[]) {
     vw::BBox2 mosaic_bbox;
     std::vector<BBox2> dem_proj_bboxes;
     std::vector<BBox2i> dem_pixel_bboxes, loaded_dem_pixel_bboxes;
-    load_dem_bounding_boxes(opt, mosaic_georef, mosaic_bbox,
-                            dem_proj_bboxes, dem_pixel_bboxes);
+    std::vector<BBox2> loaded_dem_footprints;
+    if (opt.bbox_cache == "" ||
+        !read_dem_bounding_boxes(opt.bbox_cache, opt, mosaic_georef, mosaic_bbox,
+                                 dem_proj_bboxes, dem_pixel_bboxes)) {
+      load_dem_bounding_boxes(opt, mosaic_georef, mosaic_bbox,
+                              dem_proj_bboxes, dem_pixel_bboxes);
+      if (opt.bbox_cache != "")
+        save_dem_bounding_boxes(opt.bbox_cache, opt, mosaic_georef, mosaic_bbox,
+                                dem_proj_bboxes, dem_pixel_bboxes);
+    } else {
+      vw_out() << "Read the bounding boxes of the input DEMs from: "
+               << opt.bbox_cache << "\n";
+    }
 
 
     if (opt.tap) {
@@ -1804,18 +2240,33 @@ int main(int argc, char *argv[]) {
 
     // Compute the bounding box of each output tile
     std::vector<BBox2i> tile_pixel_bboxes;
-    for (int tile_id = start_tile; tile_id < end_tile; tile_id++){
-
-      int tile_index_y = tile_id / num_tiles_x;
-      int tile_index_x = tile_id - tile_index_y*num_tiles_x;
-      BBox2i tile_box(tile_index_x*opt.tile_size,
-		      tile_index_y*opt.tile_size,
-		      opt.tile_size, opt.tile_size);
-
-      // Bounding box of this tile in pixels in the output image
-      tile_box.crop(BBox2i(0, 0, cols, rows));
-
-      tile_pixel_bboxes.push_back(tile_box);
+    for (int tile_id = start_tile; tile_id < end_tile; tile_id++)
+      tile_pixel_bboxes.push_back(output_tile_box(tile_id, num_tiles_x, opt.tile_size,
+                                                  cols, rows));
+
+    // Find how many input DEMs overlap each tile, to help distribute
+    // the tiles among processes, and quit. Tiles with no DEMs need not
+    // be created.
+    if (opt.query_tiles_file != "") {
+      vw_out() << "Writing: " << opt.query_tiles_file << "\n";
+      std::ofstream ofs(opt.query_tiles_file.c_str());
+      if (!ofs.good())
+        vw_throw(ArgumentErr() << "Cannot write: " << opt.query_tiles_file << "\n");
+      for (int tile_id = start_tile; tile_id < end_tile; tile_id++) {
+        if (!opt.tile_list.empty() && opt.tile_list.find(tile_id) == opt.tile_list.end()) 
+          continue;
+        BBox2 tile_proj_box
+          = mosaic_georef.pixel_to_point_bbox(tile_pixel_bboxes[tile_id - start_tile]);
+        int num_dems = 0;
+        for (size_t dem_iter = 0; dem_iter < dem_proj_bboxes.size(); dem_iter++) {
+          if (tile_proj_box.intersects(dem_proj_bboxes[dem_iter]))
+            num_dems++;
+        }
+        ofs << tile_id << ' ' << num_dems << ' '
+            << output_tile_name(opt, tile_id, num_tiles, write_to_precise_file) << "\n";
+      }
+      ofs.close();
+      return 0;
     }
 
     // Store the no-data values, pointers to images, and georeferences (for speed).
@@ -1860,6 +2311,25 @@ int main(int argc, char *argv[]) {
 
       // Get the current DEM bounding box in pixel units of the output mosaicked DEM
       BBox2 curr_box = geotrans.forward_bbox(dem_pixel_box);
+
+      // The output pixels for which this DEM may be read. DemMosaicView
+      // grows the input box it reads by the bias and a few more pixels.
+      // If that cannot be found, such as beyond the pole, check this DEM
+      // for each block.
+      BBox2i grown_box = dem_pixel_box;
+      grown_box.expand(bias + BilinearInterpolation::pixel_buffer + 3);
+      BBox2 footprint;
+      try {
+        footprint = geotrans.forward_bbox(grown_box);
+        footprint.expand(2);
+        footprint.grow(curr_box);
+      } catch (...) {
+        footprint = BBox2(-std::numeric_limits<double>::max()/4.0,
+                          -std::numeric_limits<double>::max()/4.0,
+                          std::numeric_limits<double>::max()/2.0,
+                          std::numeric_limits<double>::max()/2.0);
+      }
+      
       curr_box.crop(output_dem_box);
 
       // This is a fix for GDAL crashing when there are too many open
@@ -1891,16 +2361,31 @@ int main(int argc, char *argv[]) {
       nodata_values.push_back(curr_nodata_value);
       georefs.push_back(georef);
       loaded_dem_pixel_bboxes.push_back(dem_pixel_box);
+      loaded_dem_footprints.push_back(footprint);
     } // End loop through DEM files
 
-    // If there are 17 tiles, let them be tile-00, ..., tile-16.
-    int num_digits = 1;
-    int tens = 10;
-    while (num_tiles - 1 >= tens) {
-      num_digits++;
-      tens *= 10;
+    // The output blocks can be grown by the bias, as in DemMosaicView
+    BBox2i query_region = output_dem_box;
+    query_region.expand(bias + BilinearInterpolation::pixel_buffer + 2);
+    DemFootprintIndex dem_index(loaded_dem_footprints, query_region, block_size);
+
+    // The prepared DEMs and weights depend on the output grid, the block
+    // size, and these options. The DEM file stats are added for each DEM.
+    if (opt.weights_cache_dir != "") {
+      vw::create_out_dir(opt.weights_cache_dir + "/");
+      std::ostringstream os;
+      os.precision(17);
+      os << mosaic_georef.proj4_str() << ' ' << mosaic_georef.transform() << ' '
+         << bias << ' ' << block_size << ' ' << opt.hole_fill_len << ' '
+         << opt.fill_search_radius << ' ' << opt.fill_power << ' ' << opt.fill_percent << ' '
+         << opt.fill_num_passes << ' ' << opt.dem_blur_sigma << ' '
+         << opt.nodata_threshold << ' ' << opt.erode_len << ' '
+         << opt.use_centerline_weights << ' ' << opt.no_border_blend << ' '
+         << opt.weights_blur_sigma << ' ' << opt.weights_exp << ' '
+         << opt.priority_blending_len;
+      opt.weights_cache_key = os.str();
     }
-    
+
     // Time to generate each of the output tiles
     for (int tile_id = start_tile; tile_id < end_tile; tile_id++){
 
@@ -1910,17 +2395,16 @@ int main(int argc, char *argv[]) {
       // Get the bounding box we previously computed
       vw::BBox2i tile_box = tile_pixel_bboxes[tile_id - start_tile];
 
-      std::string dem_tile;
-      if (!write_to_precise_file) {
-        std::ostringstream os;
-        os << opt.out_prefix << "-tile-"
-            << std::setfill('0') << std::setw(num_digits) << tile_id
-            << tile_suffix(opt) << ".tif";
-        dem_tile = os.str();
-      } else {
-        dem_tile = opt.out_prefix; // the file name was set by user
-      }
+      std::string dem_tile = output_tile_name(opt, tile_id, num_tiles,
+                                              write_to_precise_file);
       
+      // If there are fewer blocks in this tile than threads, as with a large
+      // bias, prepare several DEMs for each block in parallel.
+      int num_blocks = ((tile_box.width() + block_size - 1) / block_size) *
+                       ((tile_box.height() + block_size - 1) / block_size);
+      opt.dem_threads = std::max(1, int(vw_settings().default_num_threads())
+                                 / std::max(num_blocks, 1));
+
       // Set up tile image and metadata
       long long int num_valid_pixels; // Will be populated when saving to disk
       vw::Mutex count_mutex; // to lock when updating num_valid_pixels
@@ -1929,7 +2413,7 @@ int main(int argc, char *argv[]) {
         = crop(DemMosaicView(cols, rows, bias, opt,
                              imgMgr, georefs,
                              mosaic_georef, nodata_values,
-                             loaded_dem_pixel_bboxes,
+                             loaded_dem_pixel_bboxes, dem_index,
                              num_valid_pixels, count_mutex),
                tile_box);
       GeoReference crop_georef = crop(mosaic_georef, tile_box.min().x(),
@@ -1945,37 +2429,37 @@ int main(int argc, char *argv[]) {
       if (opt.output_type == "Float32") 
         asp::save_with_temp_big_blocks(block_size, dem_tile, out_dem,
                                        has_georef, crop_georef,
-                                       has_nodata, opt.out_nodata_value, opt, tpc);
+                                       has_nodata, opt.out_nodata_value, opt, tpc, opt.cog);
       else if (opt.output_type == "Byte") 
         asp::save_with_temp_big_blocks(block_size, dem_tile,
 				       per_pixel_filter(out_dem, RoundAndClamp<uint8, RealT>()),
                                        has_georef, crop_georef,
                                        has_nodata, vw::round_and_clamp<uint8>(opt.out_nodata_value),
-                                       opt, tpc);
+                                       opt, tpc, opt.cog);
       else if (opt.output_type == "UInt16") 
         asp::save_with_temp_big_blocks(block_size, dem_tile,
 				       per_pixel_filter(out_dem, RoundAndClamp<uint16, RealT>()),
                                        has_georef, crop_georef,
                                        has_nodata, vw::round_and_clamp<uint16>(opt.out_nodata_value),
-                                       opt, tpc);
+                                       opt, tpc, opt.cog);
       else if (opt.output_type == "Int16") 
         asp::save_with_temp_big_blocks(block_size, dem_tile,
 				       per_pixel_filter(out_dem, RoundAndClamp<int16, RealT>()),
                                        has_georef, crop_georef,
                                        has_nodata, vw::round_and_clamp<int16>(opt.out_nodata_value),
-                                       opt, tpc);
+                                       opt, tpc, opt.cog);
       else if (opt.output_type == "UInt32") 
         asp::save_with_temp_big_blocks(block_size, dem_tile,
 				       per_pixel_filter(out_dem, RoundAndClamp<uint32, RealT>()),
                                        has_georef, crop_georef,
                                        has_nodata, vw::round_and_clamp<uint32>(opt.out_nodata_value),
-                                       opt, tpc);
+                                       opt, tpc, opt.cog);
       else if (opt.output_type == "Int32") 
         asp::save_with_temp_big_blocks(block_size, dem_tile,
 				       per_pixel_filter(out_dem, RoundAndClamp<int32, RealT>()),
                                        has_georef, crop_georef,
                                        has_nodata, vw::round_and_clamp<int32>(opt.out_nodata_value),
-                                       opt, tpc);
+                                       opt, tpc, opt.cog);
       else
         vw_throw(NoImplErr() << "Unsupported output type: " << opt.output_type << ".\n");
 
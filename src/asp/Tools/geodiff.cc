@@ -212,6 +212,165 @@ void dem2dem_diff(Options& opt){
   }
 }
 
+// Running statistics of the differences, updated one value at a time
+struct DiffStats {
+  size_t count;
+  double min, max, sum, sum2;
+  DiffStats(): count(0), min(std::numeric_limits<double>::max()),
+               max(-std::numeric_limits<double>::max()), sum(0.0), sum2(0.0) {}
+  
+  void add(double diff) {
+    if (diff > max) max = diff;
+    if (diff < min) min = diff;
+    sum  += diff;
+    sum2 += diff*diff;
+    count++;
+  }
+
+  void finish(double & diff_min, double & diff_max,
+              double & diff_mean, double & diff_std) const {
+    diff_min = min;
+    diff_max = max;
+    diff_mean = 0.0;
+    diff_std  = 0.0;
+    if (count == 0)
+      return;
+    diff_mean = sum / count;
+    diff_std = sum2/count - diff_mean*diff_mean;
+    if (diff_std < 0)
+      diff_std = 0; // just in case, for numerical noise
+    diff_std = std::sqrt(diff_std);
+  }
+};
+
+// Read the (lon, lat, diff) values saved in binary form, in blocks 
+class DiffReader {
+  std::ifstream m_handle;
+  std::vector<double> m_buf;
+  size_t m_pos, m_len;
+public:
+  DiffReader(std::string const& file): m_handle(file.c_str(), std::ios::binary),
+                                       m_buf(3 * 65536), m_pos(0), m_len(0) {
+    if (!m_handle)
+      vw_throw(vw::IOErr() << "Unable to open file: " << file << "\n");
+  }
+  
+  // Return false if there is nothing left
+  bool next(double vals[3]) {
+    if (m_pos >= m_len) {
+      m_handle.read((char*)&m_buf[0], m_buf.size() * sizeof(double));
+      m_len = m_handle.gcount() / (3 * sizeof(double)) * 3;
+      m_pos = 0;
+      if (m_len == 0)
+        return false;
+    }
+    for (int i = 0; i < 3; i++)
+      vals[i] = m_buf[m_pos + i];
+    m_pos += 3;
+    return true;
+  }
+};
+
+// Find the difference with given rank (starting from 0) in the sorted
+// saved differences, which are in [min_val, max_val]. If there are too
+// many to keep in memory, a histogram is made of the values in the
+// current range, and the range is narrowed to the bin having the desired
+// rank. That is repeated until few enough values are left.
+double diff_of_rank(std::string const& diff_file, size_t num_vals, size_t rank,
+                    double min_val, double max_val) {
+
+  const size_t max_in_memory = 10000000, num_bins = 1000000;
+
+  // The bins chosen so far. A value is in the current range if it falls
+  // in each of these bins. Each next bin is within the previous one.
+  struct Bin {
+    double lo, width;
+    size_t index, num_bins;
+    size_t find_index(double val) const {
+      return std::min(size_t(std::max((val - lo) / width, 0.0)), num_bins - 1);
+    }
+    // -1 if the value is before the bin, 0 if in it, 1 if after
+    int compare(double val) const {
+      size_t i = find_index(val);
+      return (i < index) ? -1 : ((i > index) ? 1 : 0);
+    }
+  };
+  std::vector<Bin> bins;
+  
+  double vals[3];
+  while (1) {
+    
+    if (min_val == max_val)
+      return min_val;
+    
+    // Count the values before the current range and in it. Make the
+    // histogram of the values in it, while recording the bounds of each bin.
+    Bin curr;
+    curr.lo = min_val;
+    curr.width = (max_val - min_val) / num_bins;
+    curr.num_bins = num_bins;
+    std::vector<size_t> hist;
+    std::vector<double> bin_min, bin_max;
+    size_t num_before = 0, num_in = 0;
+    bool find_hist = (num_vals > max_in_memory && curr.width > 0);
+    if (find_hist) {
+      hist.resize(num_bins, 0);
+      bin_min.resize(num_bins, std::numeric_limits<double>::max());
+      bin_max.resize(num_bins, -std::numeric_limits<double>::max());
+    }
+    DiffReader reader(diff_file);
+    while (reader.next(vals)) {
+      int cmp = 0;
+      for (size_t b = 0; b < bins.size() && cmp == 0; b++)
+        cmp = bins[b].compare(vals[2]);
+      if (cmp < 0)
+        num_before++;
+      if (cmp != 0)
+        continue;
+      num_in++;
+      if (!find_hist)
+        continue;
+      size_t i = curr.find_index(vals[2]);
+      hist[i]++;
+      bin_min[i] = std::min(bin_min[i], vals[2]);
+      bin_max[i] = std::max(bin_max[i], vals[2]);
+    }
+
+    if (rank < num_before || rank >= num_before + num_in)
+      vw_throw(LogicErr() << "Book-keeping failure in finding the median.\n");
+    
+    if (num_in <= max_in_memory || !find_hist) {
+      // Few enough values are left. Find the desired one directly.
+      std::vector<double> in_vals;
+      in_vals.reserve(num_in);
+      DiffReader reader(diff_file);
+      while (reader.next(vals)) {
+        int cmp = 0;
+        for (size_t b = 0; b < bins.size() && cmp == 0; b++)
+          cmp = bins[b].compare(vals[2]);
+        if (cmp == 0)
+          in_vals.push_back(vals[2]);
+      }
+      size_t k = rank - num_before;
+      std::nth_element(in_vals.begin(), in_vals.begin() + k, in_vals.end());
+      return in_vals[k];
+    }
+
+    // Narrow down the range to the bin having the desired rank
+    size_t cum = num_before;
+    for (curr.index = 0; curr.index < num_bins; curr.index++) {
+      if (rank < cum + hist[curr.index])
+        break;
+      cum += hist[curr.index];
+    }
+    min_val = bin_min[curr.index];
+    max_val = bin_max[curr.index];
+    bins.push_back(curr);
+  }
+
+  return 0.0; // Will not be reached
+}
+
 // From a DEM, subtract a csv file. Reverse the sign is 'reverse' is true.
 void dem2csv_diff(Options & opt, std::string const& dem_file,
                   std::string const & csv_file, bool reverse){
@@ -257,36 +416,38 @@ void dem2csv_diff(Options & opt, std::string const& dem_file,
   GeoReference csv_georef = dem_georef;
   csv_conv.parse_georef(csv_georef);
 
-  std::list<asp::CsvConv::CsvRecord> csv_records;
-  typedef std::list<asp::CsvConv::CsvRecord>::const_iterator RecordIter;
-  csv_conv.read_csv_file(csv_file, csv_records);
-  
-  std::vector<Vector3> csv_llh;
-  for (RecordIter iter = csv_records.begin(); iter != csv_records.end(); iter++) {
-    Vector3 xyz = csv_conv.csv_to_cartesian(*iter, csv_georef);
-    if (xyz == Vector3() || xyz != xyz)
-      continue; // invalid point
-    Vector3 llh = dem_georef.datum().cartesian_to_geodetic(xyz); // use the dem's datum
-    csv_llh.push_back(llh);
-  }
-
   // We will interpolate into the DEM to find the difference
   ImageViewRef<PixelMask<double>> interp_dem
     = interpolate(create_mask(dem, dem_nodata),
 		  BilinearInterpolation(), ConstantEdgeExtension());
 
-  // Save the diffs
-  int    count     = 0;
-  double diff_min  = std::numeric_limits<double>::max();
-  double diff_max  = -diff_min;
-  double diff_mean = 0.0;
-  double diff_std  = 0.0;
-
-  std::vector<Vector3> csv_diff;
-  std::vector<double> csv_errs;
-  for (size_t it = 0; it < csv_llh.size(); it++) {
+  // Read the csv file one line at a time, find the differences, and
+  // save them to a binary file, so the memory use does not grow with
+  // the number of points. The statistics are written at the top of the
+  // output file, so it can be written only after all points are seen.
+  std::ifstream csv_handle(csv_file.c_str());
+  if (!csv_handle)
+    vw_throw(vw::IOErr() << "Unable to open file: " << csv_file << "\n");
+  std::string tmp_file = opt.output_prefix + "-diff-tmp.bin";
+  std::ofstream tmp_handle(tmp_file.c_str(), std::ios::binary);
+  if (!tmp_handle)
+    vw_throw(vw::IOErr() << "Unable to write: " << tmp_file << "\n");
+  
+  DiffStats stats;
+  bool first_line = true, success = false;
+  std::string line;
+  while (std::getline(csv_handle, line, '\n')) {
+
+    asp::CsvConv::CsvRecord record = csv_conv.parse_csv_line(first_line, success, line);
+    first_line = false;
+    if (!success)
+      continue;
+    
+    Vector3 xyz = csv_conv.csv_to_cartesian(record, csv_georef);
+    if (xyz == Vector3() || xyz != xyz)
+      continue; // invalid point
+    Vector3 llh = dem_georef.datum().cartesian_to_geodetic(xyz); // use the dem's datum
 
-    Vector3 llh = csv_llh[it];
     Vector2 ll  = subvector(llh, 0, 2);
     Vector2 pix = dem_georef.lonlat_to_pixel(ll);
     
@@ -303,28 +464,21 @@ void dem2csv_diff(Options & opt, std::string const& dem_file,
     if (opt.use_absolute)
       diff = std::abs(diff);
 
-    if (diff > diff_max) diff_max = diff;
-    if (diff < diff_min) diff_min = diff;
-
-    diff_mean += diff;
-    diff_std  += diff*diff;
-    count     += 1;
-    csv_diff.push_back(Vector3(ll[0], ll[1], diff));
-    csv_errs.push_back(diff);
+    stats.add(diff);
+    double vals[3] = {ll[0], ll[1], diff};
+    tmp_handle.write((char*)vals, sizeof(vals));
   }
+  csv_handle.close();
+  tmp_handle.close();
 
-  if (count > 0) {
-    diff_mean /= count;
-    diff_std = diff_std/count - diff_mean*diff_mean;
-    if (diff_std < 0)
-      diff_std = 0; // just in case, for numerical noise
-    diff_std = std::sqrt(diff_std);
-  }
+  double diff_min = 0.0, diff_max = 0.0, diff_mean = 0.0, diff_std = 0.0;
+  stats.finish(diff_min, diff_max, diff_mean, diff_std);
 
+  // The median is the value with this rank among the sorted differences
   double diff_median = 0.0;
-  std::sort(csv_errs.begin(), csv_errs.end());
-  if (csv_errs.size() > 0) 
-    diff_median = csv_errs[csv_errs.size()/2];
+  if (stats.count > 0) 
+    diff_median = diff_of_rank(tmp_file, stats.count, stats.count/2,
+                               diff_min, diff_max);
 
   vw_out() << "Max difference:       " << diff_max    << " meters" << std::endl;
   vw_out() << "Min difference:       " << diff_min    << " meters" << std::endl;
@@ -343,10 +497,13 @@ void dem2csv_diff(Options & opt, std::string const& dem_file,
   outfile << "# Mean difference:      " << diff_mean   << " meters" << std::endl;
   outfile << "# StdDev of difference: " << diff_std    << " meters" << std::endl;
   outfile << "# Median difference:    " << diff_median << " meters" << std::endl;
-  for (size_t it = 0; it < csv_diff.size(); it++) {
-    Vector3 diff = csv_diff[it];
-    outfile << diff[0] << "," << diff[1] << "," << diff[2] << std::endl;
-  }
+  DiffReader reader(tmp_file);
+  double vals[3];
+  while (reader.next(vals))
+    outfile << vals[0] << "," << vals[1] << "," << vals[2] << "\n";
+  outfile.close();
+  
+  fs::remove(tmp_file);
 }
 
 // Subtract from the first dem the second. One of them can be a CSV file.
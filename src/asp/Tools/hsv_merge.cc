@@ -28,30 +28,56 @@ namespace fs = boost::filesystem;
 
 using namespace vw;
 
-// Functors
-template <class Arg1T, class Arg2T>
-struct ReplaceChannelFunc: public ReturnFixedType<Arg1T> {
-private:
-  int m_channel;
+/// Replace the value channel of the RGB image, in HSV space, with the gray
+/// image, and convert back to RGB. The inputs are read one tile at a time,
+/// and the color conversions are done in the same pass over the tile.
+template <class ImageRgbT, class ImageGrayT>
+class HsvMergeView: public ImageViewBase<HsvMergeView<ImageRgbT, ImageGrayT>> {
+  ImageRgbT  m_rgb;
+  ImageGrayT m_gray;
+
 public:
-  ReplaceChannelFunc( int const& channel ) : m_channel(channel) {}
+  typedef typename ImageRgbT::pixel_type pixel_type;
+  typedef pixel_type result_type;
+  typedef ProceduralPixelAccessor<HsvMergeView> pixel_accessor;
+
+  HsvMergeView(ImageRgbT const& rgb, ImageGrayT const& gray):
+    m_rgb(rgb), m_gray(gray) {}
+
+  inline int32 cols  () const { return m_rgb.cols(); }
+  inline int32 rows  () const { return m_rgb.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
 
-  inline Arg1T operator()( Arg1T const& arg1,
-                           Arg2T const& arg2 ) const {
-    Arg1T t( arg1 );
-    t[m_channel] = arg2;
-    return t;
+  inline result_type operator()(int32 i, int32 j, int32 p = 0) const {
+    return merge(m_rgb(i, j), m_gray(i, j));
   }
-};
 
-template <class Image1T, class Image2T>
-inline BinaryPerPixelView<Image1T, Image2T, ReplaceChannelFunc<typename Image1T::pixel_type, typename Image2T::pixel_type> >
-replace_channel( ImageViewBase<Image1T> const& image1,
-                 int const& channel,
-                 ImageViewBase<Image2T> const& image2 ) {
-  typedef ReplaceChannelFunc<typename Image1T::pixel_type, typename Image2T::pixel_type> func_type;
-  return BinaryPerPixelView<Image1T, Image2T, func_type >( image1.impl(), image2.impl(), func_type(channel));
-}
+  static inline result_type merge(pixel_type const& rgb,
+                                  typename ImageGrayT::pixel_type const& gray) {
+    typedef typename PixelChannelType<pixel_type>::type ChannelT;
+    PixelHSV<ChannelT> hsv = pixel_cast<PixelHSV<ChannelT>>(rgb);
+    hsv[2] = gray;
+    return pixel_cast<pixel_type>(hsv);
+  }
+
+  typedef CropView<ImageView<result_type>> prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+    ImageView<pixel_type> tile = crop(m_rgb, bbox);
+    ImageView<typename ImageGrayT::pixel_type> gray_tile = crop(m_gray, bbox);
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++)
+        tile(col, row) = merge(tile(col, row), gray_tile(col, row));
+    }
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i const& bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
 
 // Standard Arguments
 struct Options : public vw::GdalWriteOptions {
@@ -68,7 +94,8 @@ void do_merge(Options const& opt) {
   cartography::read_georeference(georef, opt.input_rgb);
 
   ImageViewRef<PixelRGB<ChannelT> > result =
-    pixel_cast<PixelRGB<ChannelT> >(replace_channel(pixel_cast<PixelHSV<ChannelT> >(rgb_image),2,shaded_image));
+    HsvMergeView<DiskImageView<PixelRGB<ChannelT>>, DiskImageView<PixelGray<ChannelT>>>
+    (rgb_image, shaded_image);
 
   bool has_georef = true;
   bool has_nodata = false;
@@ -37,6 +37,7 @@
 #include <vw/Image/Filter.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/FileIO/DiskImageUtils.h>
+#include <vw/FileIO/FileUtils.h>
 
 #include <boost/program_options.hpp>
 #include <boost/spirit/include/qi.hpp>
@@ -377,6 +378,160 @@ struct calc_grammar : b_s::qi::grammar<ITER, calc_operation(), b_s::ascii::space
 
 }; // End struct calc_grammar
 
+/// A calc_operation tree flattened into a list of instructions in
+/// postfix order. Each instruction is applied to a whole row of pixels
+/// at once, using a stack of rows, rather than walking the tree for each
+/// pixel. The results are the same as for calc_operation::applyOperation().
+class calc_program {
+
+  struct instruction {
+    OperationType opType;
+    double        value;
+    int           varName;
+    int           numInputs;
+  };
+
+  std::vector<instruction> m_instructions;
+  int  m_stack_size;
+  bool m_has_rand;
+
+  // Append the instructions for this node. Its result will be in the
+  // stack at the given depth.
+  void compile(calc_operation const& node, int depth, int num_vars) {
+
+    m_stack_size = std::max(m_stack_size, depth + 1);
+    for (size_t i = 0; i < node.inputs.size(); i++)
+      compile(node.inputs[i], depth + i, num_vars);
+
+    int numInputs = node.inputs.size(), minInputs = 0;
+    switch(node.opType) {
+      case OP_number:   break;
+      case OP_variable:
+        if (node.varName < 0 || node.varName >= num_vars)
+          vw_throw(ArgumentErr()
+                   << "Unrecognized variable input. Note that the first variable is var_0.\n");
+        break;
+      case OP_negate: case OP_abs: case OP_sign: case OP_min: case OP_max:
+        minInputs = 1; break;
+      case OP_rand:
+        m_has_rand = true; minInputs = 1; break;
+      case OP_add: case OP_subtract: case OP_divide: case OP_multiply: case OP_power:
+        minInputs = 2; break;
+      case OP_lt: case OP_gt: case OP_lte: case OP_gte: case OP_eq:
+        minInputs = 4; break;
+      default:
+        vw_throw(LogicErr() << "Unexpected operation type.\n");
+    }
+    if (numInputs < minInputs)
+      vw_throw(LogicErr() << "Insufficient inputs for this operation.\n");
+
+    instruction inst;
+    inst.opType    = node.opType;
+    inst.value     = node.value;
+    inst.varName   = node.varName;
+    inst.numInputs = numInputs;
+    m_instructions.push_back(inst);
+  }
+
+public:
+
+  calc_program(calc_operation const& tree, int num_vars): m_stack_size(0), m_has_rand(false) {
+    compile(tree, 0, num_vars);
+  }
+
+  /// The random numbers must be drawn one pixel at a time, in the same
+  /// order as before, so then the tree must be applied to each pixel.
+  bool has_rand() const { return m_has_rand; }
+
+  /// Apply the program to n pixels. The values of variable i are in
+  /// vars[i]. The stack will be resized as needed. The result is in
+  /// stack[0].
+  void apply(std::vector<std::vector<double>> const& vars, int n,
+             std::vector<std::vector<double>> & stack) const {
+
+    if ((int)stack.size() < m_stack_size)
+      stack.resize(m_stack_size);
+    for (int s = 0; s < m_stack_size; s++) {
+      if ((int)stack[s].size() < n)
+        stack[s].resize(n);
+    }
+
+    int top = 0; // the number of rows in use in the stack
+    for (size_t it = 0; it < m_instructions.size(); it++) {
+      instruction const& inst = m_instructions[it];
+      int base = top - inst.numInputs; // the first input, and the output
+      double * out = &stack[base][0];
+      double const* a = (inst.numInputs > 1) ? &stack[base + 1][0] : NULL;
+      double const* t = (inst.numInputs > 3) ? &stack[base + 2][0] : NULL; // if true
+      double const* f = (inst.numInputs > 3) ? &stack[base + 3][0] : NULL; // if false
+
+      switch(inst.opType) {
+        case OP_number:
+          std::fill(out, out + n, inst.value);
+          break;
+        case OP_variable:
+          std::copy(vars[inst.varName].begin(), vars[inst.varName].begin() + n, out);
+          break;
+        case OP_negate:
+          for (int k = 0; k < n; k++) out[k] = -1 * out[k];
+          break;
+        case OP_abs:
+          for (int k = 0; k < n; k++) out[k] = std::abs(out[k]);
+          break;
+        case OP_sign:
+          for (int k = 0; k < n; k++) out[k] = boost::math::sign(out[k]);
+          break;
+        case OP_add:
+          for (int k = 0; k < n; k++) out[k] += a[k];
+          break;
+        case OP_subtract:
+          for (int k = 0; k < n; k++) out[k] -= a[k];
+          break;
+        case OP_divide:
+          for (int k = 0; k < n; k++) out[k] /= a[k];
+          break;
+        case OP_multiply:
+          for (int k = 0; k < n; k++) out[k] *= a[k];
+          break;
+        case OP_power:
+          for (int k = 0; k < n; k++) out[k] = pow(out[k], a[k]);
+          break;
+        case OP_min:
+          for (int i = 1; i < inst.numInputs; i++) {
+            double const* b = &stack[base + i][0];
+            for (int k = 0; k < n; k++) out[k] = (b[k] < out[k]) ? b[k] : out[k];
+          }
+          break;
+        case OP_max:
+          for (int i = 1; i < inst.numInputs; i++) {
+            double const* b = &stack[base + i][0];
+            for (int k = 0; k < n; k++) out[k] = (b[k] > out[k]) ? b[k] : out[k];
+          }
+          break;
+        case OP_lt:
+          for (int k = 0; k < n; k++) out[k] = (out[k] <  a[k]) ? t[k] : f[k];
+          break;
+        case OP_gt:
+          for (int k = 0; k < n; k++) out[k] = (out[k] >  a[k]) ? t[k] : f[k];
+          break;
+        case OP_lte:
+          for (int k = 0; k < n; k++) out[k] = (out[k] <= a[k]) ? t[k] : f[k];
+          break;
+        case OP_gte:
+          for (int k = 0; k < n; k++) out[k] = (out[k] >= a[k]) ? t[k] : f[k];
+          break;
+        case OP_eq:
+          for (int k = 0; k < n; k++) out[k] = (out[k] == a[k]) ? t[k] : f[k];
+          break;
+        default:
+          vw_throw(LogicErr() << "Unexpected operation type.\n");
+      }
+
+      top = base + 1;
+    }
+  }
+};
+
 /// Image view class which applies the calc_operation tree to each pixel location.
 template <class ImageT, typename OutputPixelT>
 class ImageCalcView : public ImageViewBase<ImageCalcView<ImageT, OutputPixelT> > {
@@ -392,6 +547,7 @@ private: // Variables
   std::vector<double> m_nodata_vec; // nodata is always double
   double              m_output_nodata;
   calc_operation m_operation_tree;
+  calc_program   m_program;
   int m_num_rows;
   int m_num_cols;
   int m_num_channels;
@@ -406,7 +562,7 @@ public: // Functions
                 calc_operation const& operation_tree):
     m_image_vec(imageVec),   m_has_nodata_vec(has_nodata_vec),
     m_nodata_vec(nodata_vec), m_output_nodata(outputNodata),
-    m_operation_tree(operation_tree) {
+    m_operation_tree(operation_tree), m_program(operation_tree, imageVec.size()) {
     const size_t numImages = imageVec.size();
     VW_ASSERT((numImages > 0), ArgumentErr()
               << "ImageCalcView: One or more images required.");
@@ -460,40 +616,88 @@ public: // Functions
     for (size_t i=0; i<num_images; ++i)
       input_tiles[i] = crop(m_image_vec[i], bbox);
 
-    // Loop through each output pixel and compute each output value
-    for (int c = 0; c < bbox.width(); c++) {
-      for (int r = 0; r < bbox.height(); r++) {
-        // Fetch all the input pixels for this location
+    if (m_program.has_rand()) {
+      // Loop through each output pixel and compute each output value
+      for (int c = 0; c < bbox.width(); c++) {
+        for (int r = 0; r < bbox.height(); r++) {
+          // Fetch all the input pixels for this location
+          bool isNodata = false;
+          for (size_t i=0; i<num_images; ++i) {
+            input_pixels[i] = (input_tiles[i])(c,r);
+
+            // If any of the input pixels are nodata, the output is nodata.
+            if (m_has_nodata_vec[i] && (m_nodata_vec[i] == input_pixels[i])) {
+              isNodata = true;
+              break;
+            }
+          } // End image loop
+
+          if (isNodata) { // Output is nodata, move on to the next pixel
+            tile(c, r) = m_output_nodata;
+            continue;
+          }
+
+          for (int chan=0; chan<m_num_channels; ++chan) {
+            for (size_t i=0; i<num_images; ++i) {
+              input_doubles[i] = input_pixels[i][chan];
+            } // End image loop
+
+            // Apply the operation tree to this pixel and store in the output pixel
+            // TODO(oalexan1): Should we round too, if output is int?
+            double newVal = m_operation_tree.applyOperation<double>(input_doubles);
+            tile(c, r, chan) = clamp_and_cast<output_channel_type>(newVal);
+
+          } // End channel loop
+
+        } // End row loop
+      } // End column loop
+      return prerasterize_type(tile,
+                               -bbox.min().x(), -bbox.min().y(),
+                               cols(), rows() );
+    }
+
+    // Apply the program to one row at a time. Pixels where any input is
+    // nodata are set to nodata and left out.
+    std::vector<int> valid_cols;
+    std::vector<std::vector<double>> vars(num_images), stack;
+    for (size_t i=0; i<num_images; ++i)
+      vars[i].resize(bbox.width());
+    for (int r = 0; r < bbox.height(); r++) {
+
+      valid_cols.clear();
+      for (int c = 0; c < bbox.width(); c++) {
         bool isNodata = false;
         for (size_t i=0; i<num_images; ++i) {
-          input_pixels[i] = (input_tiles[i])(c,r);
-
-          // If any of the input pixels are nodata, the output is nodata.
-          if (m_has_nodata_vec[i] && (m_nodata_vec[i] == input_pixels[i])) {
+          if (m_has_nodata_vec[i] && (m_nodata_vec[i] == (input_tiles[i])(c,r))) {
             isNodata = true;
             break;
           }
-        } // End image loop
-
-        if (isNodata) { // Output is nodata, move on to the next pixel
-          tile(c, r) = m_output_nodata;
-          continue;
         }
+        if (isNodata)
+          tile(c, r) = m_output_nodata;
+        else
+          valid_cols.push_back(c);
+      }
+      int n = valid_cols.size();
+      if (n == 0)
+        continue;
 
-        for (int chan=0; chan<m_num_channels; ++chan) {
-          for (size_t i=0; i<num_images; ++i) {
-            input_doubles[i] = input_pixels[i][chan];
-          } // End image loop
+      for (int chan=0; chan<m_num_channels; ++chan) {
+        for (size_t i=0; i<num_images; ++i) {
+          for (int k = 0; k < n; k++) {
+            input_pixel_type pix = (input_tiles[i])(valid_cols[k], r);
+            vars[i][k] = pix[chan];
+          }
+        }
 
-          // Apply the operation tree to this pixel and store in the output pixel
-          // TODO(oalexan1): Should we round too, if output is int?
-          double newVal = m_operation_tree.applyOperation<double>(input_doubles);
-          tile(c, r, chan) = clamp_and_cast<output_channel_type>(newVal);
+        m_program.apply(vars, n, stack);
 
-        } // End channel loop
+        // TODO(oalexan1): Should we round too, if output is int?
+        for (int k = 0; k < n; k++)
+          tile(valid_cols[k], r, chan) = clamp_and_cast<output_channel_type>(stack[0][k]);
+      } // End channel loop
 
-      } // End row loop
-    } // End column loop
+    } // End row loop
 
   // Return the tile we created with fake borders to make it look the
   // size of the entire output image
@@ -521,7 +725,7 @@ struct Options : vw::GdalWriteOptions {
   std::string output_data_string;
   int         output_data_type;
   bool        has_out_nodata;
-  bool        no_georef;
+  bool        no_georef, cog;
   double      out_nodata_value;
   std::string calc_string;
   std::string output_file, metadata;
@@ -564,6 +768,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("mo",  po::value(&opt.metadata)->default_value(""), "Write metadata to the output file. Provide as a string in quotes if more than one item, separated by a space, such as 'VAR1=VALUE1 VAR2=VALUE2'. Neither the variable names nor the values should contain spaces.")
     ("no-georef",         po::bool_switch(&opt.no_georef)->default_value(false),
      "Remove any georeference information (useful with subsequent GDAL-based processing).")
+    ("cog",               po::bool_switch(&opt.cog)->default_value(false),
+     "Write the output as a Cloud-Optimized GeoTIFF, with internal overviews.")
     ("longitude-offset",  po::value(&opt.lon_offset)->default_value(nan), "Add this value to the longitudes in the geoheader (can be used to offset the longitudes by 360 degrees).")
     ("help,h",            "Display this help message.");
 
@@ -652,6 +858,9 @@ void generate_output(const std::string                         & output_file,
      opt,
      TerminalProgressCallback("image_calc", "Writing:"),
      keywords);
+
+  if (opt.cog)
+    asp::convert_to_cog(output_file, opt);
 }
 
 /// This function loads the input images and calls the main processing function
@@ -790,6 +999,8 @@ int main( int argc, char *argv[] ) {
       output_file = firstFile.substr(0,pt_idx) + "_calc";
       output_file += firstFile.substr(pt_idx,firstFile.size()-pt_idx);
     }
+    if (opt.cog && vw::get_extension(output_file) != ".tif")
+      vw_throw(ArgumentErr() << "The option --cog requires a .tif output file.\n");
 
     // Determining the format of the input images
     boost::shared_ptr<vw::DiskImageResource> rsrc(vw::DiskImageResourcePtr(firstFile));
@@ -34,7 +34,10 @@
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 
+#include <atomic>
+#include <functional>
 #include <limits>
+#include <thread>
 
 using namespace vw;
 namespace po = boost::program_options;
@@ -85,20 +88,93 @@ void get_input_image(std::string const& path,
     nodata = std::numeric_limits<double>::quiet_NaN();
 }
 
-/// Get a list of matched IP, looking in certain image regions.
+/// The regions of an image which overlap the previous and the next image.
+/// Currently only horizontal orientation is supported.
+void get_overlap_regions(Vector2i const& image_size, Options const& opt,
+                         BBox2i & prev_roi, BBox2i & next_roi) {
+
+  prev_roi = BBox2i();
+  next_roi = BBox2i();
+  if (opt.orientation == "horizontal") {
+    prev_roi.min() = Vector2(0, 0); // Top left corner
+    prev_roi.max() = Vector2(std::min(opt.overlap_width, image_size[0]),
+                             image_size[1]); // Bottom right
+    next_roi.min() = Vector2(std::max(image_size[0] - opt.overlap_width, 0), 0);
+    next_roi.max() = image_size; // Bottom right corner
+  }
+
+  if (prev_roi.empty() || next_roi.empty())
+    vw_throw( ArgumentErr() << "Unrecognized image orientation!");
+}
+
+/// The interest points detected in the regions of an image which overlap
+/// the previous and the next image, in the coordinates of each region.
+struct ImageIp {
+  ip::InterestPointList prev_ip, next_ip;
+};
+
+/// Run the given function for each index in [0, num_tasks), using the given
+/// number of threads. The threads take the next index as they finish.
+void run_in_parallel(size_t num_tasks, int num_threads,
+                     std::function<void(size_t)> const& func) {
+
+  num_threads = std::max(1, std::min(num_threads, int(num_tasks)));
+  std::atomic<size_t> next_task(0);
+  std::vector<std::exception_ptr> errors(num_threads);
+  auto runTasks = [&](int worker) {
+    try {
+      while (1) {
+        size_t it = next_task.fetch_add(1);
+        if (it >= num_tasks)
+          break;
+        func(it);
+      }
+    } catch (...) {
+      errors[worker] = std::current_exception();
+      next_task.store(num_tasks); // stop the other workers
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int worker = 1; worker < num_threads; worker++)
+    workers.push_back(std::thread(runTasks, worker));
+  runTasks(0);
+  for (size_t it = 0; it < workers.size(); it++)
+    workers[it].join();
+  for (size_t it = 0; it < errors.size(); it++) {
+    if (errors[it])
+      std::rethrow_exception(errors[it]);
+  }
+}
+
+/// Detect interest points in a region of an image. They are in the
+/// coordinates of the region.
+void detect_ip_in_region(std::string const& image_file,
+                         BBox2i const& roi,
+                         Options const& opt,
+                         ip::InterestPointList & ip) {
+
+  ImageViewRef<float> image;
+  double              nodata;
+  get_input_image(image_file, opt, image, nodata);
+
+  vw_out() << "Detecting interest points in: " << image_file << " in region: "
+           << roi << std::endl;
+  asp::detect_ip(ip, crop(image, roi), opt.ip_per_tile, "", nodata);
+}
+
+/// Get a list of matched IP, using the IP detected in certain image regions.
 void match_ip_in_regions(std::string const& image_file1,
                          std::string const& image_file2,
                          BBox2i const& roi1,
                          BBox2i const& roi2,
+                         ip::InterestPointList const& ip1,
+                         ip::InterestPointList const& ip2,
                          std::vector<ip::InterestPoint> &matched_ip1,
                          std::vector<ip::InterestPoint> &matched_ip2,
                          Options const& opt) {
 
-  // Load the input images
-  ImageViewRef<float> image1,  image2;
-  double              nodata1, nodata2;
-  get_input_image(image_file1, opt, image1, nodata1);
-  get_input_image(image_file2, opt, image2, nodata2);
+  matched_ip1.clear();
+  matched_ip2.clear();
 
   vw_out() << "Matching interest points between: " << image_file1 << " and "
            << image_file2 << std::endl;
@@ -117,12 +193,22 @@ void match_ip_in_regions(std::string const& image_file1,
   }
 
   if (matched_ip1.empty()) {
-    // Now find and match interest points in the selected regions
+    // Load the input images
+    ImageViewRef<float> image1,  image2;
+    double              nodata1, nodata2;
+    get_input_image(image_file1, opt, image1, nodata1);
+    get_input_image(image_file2, opt, image2, nodata2);
+
+    // Filter copies of the IP, as the detected IP may be used again
+    ip::InterestPointList filtered_ip1 = ip1, filtered_ip2 = ip2;
+    asp::side_ip_filtering(filtered_ip1, filtered_ip2,
+                           BBox2i(0, 0, roi1.width(), roi1.height()),
+                           BBox2i(0, 0, roi2.width(), roi2.height()));
+
+    // Now match the interest points in the selected regions
     size_t number_of_jobs = 1;
-    asp::detect_match_ip(matched_ip1, matched_ip2,
-                        crop(image1, roi1),
-                        crop(image2, roi2), opt.ip_per_tile, number_of_jobs,
-                        "", "", nodata1, nodata2, match_file);
+    asp::match_ip_pair(filtered_ip1, filtered_ip2, crop(image1, roi1), crop(image2, roi2),
+                       number_of_jobs, matched_ip1, matched_ip2, match_file);
   }
 
   // TODO: This should be a function!
@@ -140,17 +226,19 @@ void match_ip_in_regions(std::string const& image_file1,
   }
 } // End function match_ip_in_regions
 
-/// Compute a matrix transform between images, searching for IP in
+/// Compute a matrix transform between images, using the IP detected in
 ///  the specified regions.
 Matrix<double> compute_ip_matching(std::string const& image_file1,
                                    std::string const& image_file2,
                                    BBox2i const& roi1,
                                    BBox2i const& roi2,
-                                   Options & opt) {
+                                   ip::InterestPointList const& ip1,
+                                   ip::InterestPointList const& ip2,
+                                   Options const& opt) {
 
-  // Find IP, looking in only the specified regions.
+  // Match the IP found in the specified regions.
   std::vector<ip::InterestPoint> matched_ip1, matched_ip2;
-  match_ip_in_regions(image_file1, image_file2, roi1, roi2,
+  match_ip_in_regions(image_file1, image_file2, roi1, roi2, ip1, ip2,
                       matched_ip1,  matched_ip2, opt);
 
   // Clean up lists.
@@ -213,66 +301,108 @@ Matrix<double> compute_ip_matching(std::string const& image_file1,
   return tf;
 }
 
-// TODO: Pass in image ref instead of paths?
-/// Compute the transform from image1 to image2
-///  (the top left corner of image1 is (0,0))
-Matrix<double> compute_relative_transform(std::string const& image1,
-                                          std::string const& image2,
-                                          Options& opt) {
-
-  Vector2i size1 = file_image_size(image1);
-  Vector2i size2 = file_image_size(image2);
+/// Compute the transform from each image to the previous one (the top
+///  left corner of the previous image is (0,0)). The IP are detected
+///  once in each overlap region, and the pairs are matched, in parallel.
+///  The transform for the first image is not set.
+void compute_relative_transforms(Options & opt,
+                                 std::vector<Matrix<double>> & relative_transforms) {
 
-  // Set up the ROIs for the two images based on the selected orientation.
-  // - Currently only horizontal orientation is supported.
-  BBox2i roi1, roi2;
-  if (opt.orientation == "horizontal") {
-    roi1.min() = Vector2(std::max(size1[0] - opt.overlap_width, 0), 0);
-    roi1.max() = size1; // Bottom right corner
-    roi2.min() = Vector2(0, 0); // Top left corner
-    roi2.max() = Vector2(std::min(opt.overlap_width, size2[0]), size2[1]); // Bottom right
+  const size_t num_images = opt.image_files.size();
+  relative_transforms.clear();
+  relative_transforms.resize(num_images);
+
+  // Set up the ROIs for the images based on the selected orientation.
+  std::vector<BBox2i> prev_rois(num_images), next_rois(num_images);
+  for (size_t i = 0; i < num_images; i++)
+    get_overlap_regions(file_image_size(opt.image_files[i]), opt,
+                        prev_rois[i], next_rois[i]);
+
+  // Detect the IP needed by each pair, unless its match file exists. Task
+  // 2*i is for the region of image i overlapping the previous image, and
+  // task 2*i + 1 is for the region overlapping the next image.
+  std::vector<size_t> detect_tasks;
+  for (size_t i = 1; i < num_images; i++) {
+    if (opt.out_prefix != "" &&
+        fs::exists(ip::match_filename(opt.out_prefix, opt.image_files[i-1],
+                                      opt.image_files[i])))
+      continue;
+    detect_tasks.push_back(2*(i-1) + 1);
+    detect_tasks.push_back(2*i);
   }
+  int num_threads = vw_settings().default_num_threads();
+  std::vector<ImageIp> image_ip(num_images);
+  run_in_parallel(detect_tasks.size(), num_threads, [&](size_t it) {
+    size_t i = detect_tasks[it] / 2;
+    if (detect_tasks[it] % 2 == 0)
+      detect_ip_in_region(opt.image_files[i], prev_rois[i], opt, image_ip[i].prev_ip);
+    else
+      detect_ip_in_region(opt.image_files[i], next_rois[i], opt, image_ip[i].next_ip);
+  });
 
-  if (roi1.empty() || roi2.empty())
-    vw_throw( ArgumentErr() << "Unrecognized image orientation!");
-
-  Matrix<double> tf;
-  
-  // Try several times, with ever-larger value of ip-per-tile. Normally this value 
-  // is computed internally, or passed in by the user via --ip-per-tile. In 
-  // either case, it will be recorded in asp::stereo_settings().ip_per_tile,
-  // which we will increase in subsequent attempts.
-  int num_attempts = 3;
-  for (int attempt = 1; attempt <= num_attempts; attempt++) {
+  // Match all pairs in parallel. A failed pair is redone below.
+  std::vector<int> failed(num_images, 0);
+  run_in_parallel(num_images - 1, num_threads, [&](size_t it) {
+    size_t i = it + 1;
     try {
-      tf = compute_ip_matching(image1, image2, roi1, roi2, opt);
-      break;
+      relative_transforms[i]
+        = compute_ip_matching(opt.image_files[i-1], opt.image_files[i],
+                              next_rois[i-1], prev_rois[i],
+                              image_ip[i-1].next_ip, image_ip[i].prev_ip, opt);
     } catch (std::exception const& e) {
       vw_out() << "Failed with error: " << e.what() << "\n";
-      if (attempt == num_attempts)
-        vw_throw(ArgumentErr()
-                 << "Failed to compute the relative transform. Inspect your images.\n");
+      failed[i] = 1;
     }
+  });
 
-    // Wipe any old match file to force it to be regenerated
-    std::string match_file;
-    if (opt.out_prefix != "")
-      match_file = ip::match_filename(opt.out_prefix, image1, image2);
-    if (!match_file.empty() && fs::exists(match_file)) {
-      vw::vw_out() << "Removing old match file: " << match_file << "\n";
-      fs::remove(match_file);
+  // Try the failed pairs again, with ever-larger value of ip-per-tile.
+  // Normally this value is computed internally, or passed in by the user
+  // via --ip-per-tile. In either case, it will be recorded in
+  // asp::stereo_settings().ip_per_tile, which we will increase in
+  // subsequent attempts.
+  int num_attempts = 3;
+  for (size_t i = 1; i < num_images; i++) {
+
+    if (!failed[i])
+      continue;
+
+    std::string const& image1 = opt.image_files[i-1];
+    std::string const& image2 = opt.image_files[i];
+    for (int attempt = 2; attempt <= num_attempts; attempt++) {
+
+      // Wipe any old match file to force it to be regenerated
+      std::string match_file;
+      if (opt.out_prefix != "")
+        match_file = ip::match_filename(opt.out_prefix, image1, image2);
+      if (!match_file.empty() && fs::exists(match_file)) {
+        vw::vw_out() << "Removing old match file: " << match_file << "\n";
+        fs::remove(match_file);
+      }
+
+      // Multiply the number of IP per tile by 4 and try again.
+      asp::stereo_settings().ip_per_tile *= 4;
+      opt.ip_per_tile = asp::stereo_settings().ip_per_tile;
+      vw_out() << "Increasing --ip-per-tile to: " << asp::stereo_settings().ip_per_tile 
+               << "\n";
+
+      try {
+        ip::InterestPointList ip1, ip2;
+        detect_ip_in_region(image1, next_rois[i-1], opt, ip1);
+        detect_ip_in_region(image2, prev_rois[i],   opt, ip2);
+        relative_transforms[i] = compute_ip_matching(image1, image2,
+                                                     next_rois[i-1], prev_rois[i],
+                                                     ip1, ip2, opt);
+        break;
+      } catch (std::exception const& e) {
+        vw_out() << "Failed with error: " << e.what() << "\n";
+        if (attempt == num_attempts)
+          vw_throw(ArgumentErr()
+                   << "Failed to compute the relative transform. Inspect your images.\n");
+      }
     }
-      
-    // Multiply the number of IP per tile by 4 and try again.
-    asp::stereo_settings().ip_per_tile *= 4;
-    opt.ip_per_tile = asp::stereo_settings().ip_per_tile;
-    vw_out() << "Increasing --ip-per-tile to: " << asp::stereo_settings().ip_per_tile 
-             << "\n";
   }
-  
-  return tf;
 
-} // End function compute_relative_transform
+} // End function compute_relative_transforms
 
 /// Compute the positions of each image relative to the first image.
 /// - The top left corner of the first image is coordinate 0,0 in the output image.
@@ -306,11 +436,14 @@ void compute_all_image_positions(Options & opt,
   // This approach only works for serial pairs, if we add another type of
   //  orientation it will need to be changed.
   Matrix<double> last_transform = identity_matrix(3);
+
+  // Find all the matches before chaining the transforms
+  std::vector<Matrix<double>> relative_transforms;
+  compute_relative_transforms(opt, relative_transforms);
   
   for (size_t i=1; i<num_images; ++i) {
 
-    Matrix<double> relative_transform = 
-        compute_relative_transform(opt.image_files[i-1], opt.image_files[i], opt);
+    Matrix<double> const& relative_transform = relative_transforms[i];
 
     image_size = file_image_size(opt.image_files[i]);
 
@@ -35,6 +35,7 @@
 #include <asp/Camera/JitterSolveRigUtils.h>
 #include <asp/Camera/LinescanUtils.h>
 #include <asp/Camera/BundleAdjustResiduals.h>
+#include <asp/Camera/BundleAdjustSolver.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/StereoSettings.h>
@@ -56,6 +57,8 @@
 
 #include <xercesc/util/PlatformUtils.hpp>
 
+#include <exception>
+
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
@@ -70,7 +73,7 @@ struct Options: public asp::BaBaseOptions {
   std::string anchor_weight_image;   
   std::string anchor_dem, rig_config;
   int num_anchor_points_extra_lines;
-  bool initial_camera_constraint;
+  bool initial_camera_constraint, banded_schur;
   double quat_norm_weight, anchor_weight, roll_weight, yaw_weight;
   std::map<int, int> orbital_groups;
   double forced_triangulation_distance;
@@ -137,6 +140,16 @@ void handle_arguments(int argc, char *argv[], Options& opt, rig::RigSet & rig) {
      "this file may be omitted, or specify the image names instead of camera names.")
     ("parameter-tolerance",  po::value(&opt.parameter_tolerance)->default_value(1e-12),
      "Stop when the relative error in the variables being optimized is less than this.")
+    ("solver-preset", po::value(&opt.solver_preset)->default_value("auto"),
+     "How to solve the linear system at each iteration. Options: auto, dense-schur, sparse-schur, iterative-schur, iterative-schur-explicit, iterative-schur-power-series, sparse-schur-mixed-precision, cuda-dense-schur, cuda-sparse-schur. Some of these need a newer Ceres or one built with CUDA. The default is iterative-schur.")
+    ("banded-schur",
+     po::bool_switch(&opt.banded_schur)->default_value(false)->implicit_value(true),
+     "Eliminate the triangulated points first, then factor the remaining system, for "
+     "the camera positions and orientations, with a sparse direct solver. This system "
+     "is banded, as each reprojection error involves only a few adjacent positions "
+     "and orientations. This can be much faster for long linescan images with small "
+     "values of --num-lines-per-position and --num-lines-per-orientation. Cannot be "
+     "used with --solver-preset.")
     ("num-iterations",       po::value(&opt.num_iterations)->default_value(500),
      "Set the maximum number of iterations.")
     ("tri-weight", po::value(&opt.tri_weight)->default_value(0.1),
@@ -342,6 +355,12 @@ void handle_arguments(int argc, char *argv[], Options& opt, rig::RigSet & rig) {
 
   if (opt.tri_robust_threshold <= 0.0) 
     vw_throw(ArgumentErr() << "The value of --tri-robust-threshold must be positive.\n");
+
+  // Fail early if the solver preset is not available
+  ceres::Solver::Options solver_options;
+  asp::applySolverPreset(opt.solver_preset, solver_options);
+  if (opt.banded_schur && opt.solver_preset != "auto")
+    vw_throw(ArgumentErr() << "Cannot use both --banded-schur and --solver-preset.\n");
   
   // This is a bug fix. The user by mistake passed in an empty height-from-dem string.
   if (!vm["heights-from-dem"].defaulted() && opt.heights_from_dem.empty())
@@ -423,6 +442,15 @@ void handle_arguments(int argc, char *argv[], Options& opt, rig::RigSet & rig) {
 // Calculate a set of anchor points uniformly distributed over the image
 // Will use opt.num_anchor_points_extra_lines. We append to weight_vec and
 // other quantities that were used for reprojection errors for match points.
+// An anchor point found in one bin of an image
+struct AnchorCandidate {
+  bool valid, out_of_range;
+  Vector2 pix;
+  Vector3 xyz;
+  double weight;
+  AnchorCandidate(): valid(false), out_of_range(false), weight(0.0) {}
+};
+
 void calcAnchorPoints(Options                         const & opt,
                       ImageViewRef<PixelMask<double>>         interp_anchor_dem,
                       vw::cartography::GeoReference   const & anchor_georef,
@@ -476,26 +504,35 @@ void calcAnchorPoints(Options                         const & opt,
     int lenx = ceil(double(numSamples) / bin_len); lenx = std::max(1, lenx);
     int leny = ceil(double(numLines + 2 * extra) / bin_len); leny = std::max(1, leny);
 
-    int numAnchorPoints = 0;
-    for (int binx = 0; binx <= lenx; binx++) {
+    // Intersecting rays with the DEM is slow, so it is done for all bins
+    // of this image in parallel. The results are collected in bin order,
+    // so they do not depend on the number of threads.
+    int num_bins = (lenx + 1) * (leny + 1);
+    std::vector<AnchorCandidate> candidates(num_bins);
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (int bin = 0; bin < num_bins; bin++) {
+      int binx = bin / (leny + 1), biny = bin % (leny + 1);
       double posx = binx * bin_len;
-      for (int biny = 0; biny <= leny; biny++) {
-        double posy = biny * bin_len - extra;
-        
-        if (posx > numSamples - 1 || posy < -extra || posy > numLines - 1 + extra) 
-          continue;
+      double posy = biny * bin_len - extra;
+      AnchorCandidate & cand = candidates[bin]; // alias
+
+      if (posx > numSamples - 1 || posy < -extra || posy > numLines - 1 + extra) 
+        continue;
         
-        Vector2 pix(posx, posy);
-        Vector3 xyz_guess(0, 0, 0);
+      Vector2 pix(posx, posy);
+      Vector3 xyz_guess(0, 0, 0);
         
-        bool treat_nodata_as_zero = false;
-        bool has_intersection = false;
-        double height_error_tol = 0.001; // 1 mm should be enough
-        double max_abs_tol      = 1e-14; // abs cost fun change b/w iterations
-        double max_rel_tol      = 1e-14;
-        int num_max_iter        = 50;   // Using many iterations can be very slow
+      bool treat_nodata_as_zero = false;
+      bool has_intersection = false;
+      double height_error_tol = 0.001; // 1 mm should be enough
+      double max_abs_tol      = 1e-14; // abs cost fun change b/w iterations
+      double max_rel_tol      = 1e-14;
+      int num_max_iter        = 50;   // Using many iterations can be very slow
           
-        Vector3 dem_xyz = vw::cartography::camera_pixel_to_dem_xyz
+      Vector3 dem_xyz;
+      Vector2 pix_out;
+      try {
+        dem_xyz = vw::cartography::camera_pixel_to_dem_xyz
           (opt.camera_models[icam]->camera_center(pix),
            opt.camera_models[icam]->pixel_to_vector(pix),
            interp_anchor_dem, anchor_georef, treat_nodata_as_zero, has_intersection,
@@ -504,70 +541,80 @@ void calcAnchorPoints(Options                         const & opt,
         if (!has_intersection || dem_xyz == Vector3())
           continue;
 
-        Vector2 pix_out;
-        try {
-          pix_out = opt.camera_models[icam]->point_to_pixel(dem_xyz);
-        } catch (...) {
-          continue;
-        }
+        pix_out = opt.camera_models[icam]->point_to_pixel(dem_xyz);
+      } catch (...) {
+        continue;
+      }
         
-        if (norm_2(pix - pix_out) > 10 * height_error_tol)
-          continue; // this is likely a bad point
-
-        // If we have a weight image, use it to multiply the weight
-        double anchor_weight_from_image = 1.0;
-        if (have_anchor_weight_image) {
-          vw::PixelMask<float> img_wt 
-            = vw::cartography::closestPixelVal(anchor_weight_image, 
-                                               anchor_weight_image_georef, 
-                                               dem_xyz);
+      if (norm_2(pix - pix_out) > 10 * height_error_tol)
+        continue; // this is likely a bad point
+
+      // If we have a weight image, use it to multiply the weight
+      double anchor_weight_from_image = 1.0;
+      if (have_anchor_weight_image) {
+        vw::PixelMask<float> img_wt 
+          = vw::cartography::closestPixelVal(anchor_weight_image, 
+                                             anchor_weight_image_georef, 
+                                             dem_xyz);
           
-          // Skip bad weights
-          if (!is_valid(img_wt) || std::isnan(img_wt.child()) || img_wt.child() <= 0.0) 
-            continue;
+        // Skip bad weights
+        if (!is_valid(img_wt) || std::isnan(img_wt.child()) || img_wt.child() <= 0.0) 
+          continue;
           
-          anchor_weight_from_image = img_wt.child();
-        }
+        anchor_weight_from_image = img_wt.child();
+      }
         
-        if (ls_model != NULL) {
-          // Anchor points must not be outside the range of tabulated positions and orientations
-          csm::ImageCoord imagePt;
-          asp::toCsmPixel(pix, imagePt);
-          double time    = ls_model->getImageTime(imagePt);
-          int numPos     = ls_model->m_positions.size() / NUM_XYZ_PARAMS;
-          double posT0   = ls_model->m_t0Ephem;
-          double posDt   = ls_model->m_dtEphem;
-          int pos_index  = static_cast<int>((time - posT0) / posDt);
-          int numQuat    = ls_model->m_quaternions.size() / NUM_QUAT_PARAMS;
-          double quatT0  = ls_model->m_t0Quat;
-          double quatDt  = ls_model->m_dtQuat;
-          int quat_index = static_cast<int>((time - quatT0) / quatDt);
-          if (pos_index < 0  || pos_index >= numPos || 
-              quat_index < 0 || quat_index >= numQuat) {
-            if (!warning_printed) {
-              vw::vw_out(vw::WarningMessage) << "Not placing anchor points outside "
-                << "the range of tabulated positions and orientations.\n";
-              warning_printed = true;
-            }
-            continue; 
-          }
+      if (ls_model != NULL) {
+        // Anchor points must not be outside the range of tabulated positions and orientations
+        csm::ImageCoord imagePt;
+        asp::toCsmPixel(pix, imagePt);
+        double time    = ls_model->getImageTime(imagePt);
+        int numPos     = ls_model->m_positions.size() / NUM_XYZ_PARAMS;
+        double posT0   = ls_model->m_t0Ephem;
+        double posDt   = ls_model->m_dtEphem;
+        int pos_index  = static_cast<int>((time - posT0) / posDt);
+        int numQuat    = ls_model->m_quaternions.size() / NUM_QUAT_PARAMS;
+        double quatT0  = ls_model->m_t0Quat;
+        double quatDt  = ls_model->m_dtQuat;
+        int quat_index = static_cast<int>((time - quatT0) / quatDt);
+        if (pos_index < 0  || pos_index >= numPos || 
+            quat_index < 0 || quat_index >= numQuat) {
+          cand.out_of_range = true;
+          continue; 
         }
+      }
+
+      cand.valid  = true;
+      cand.pix    = pix;
+      cand.xyz    = dem_xyz;
+      cand.weight = opt.anchor_weight * anchor_weight_from_image;
+    }
 
-        pixel_vec[icam].push_back(pix);
-        weight_vec[icam].push_back(opt.anchor_weight * anchor_weight_from_image);
-        isAnchor_vec[icam].push_back(1);
+    int numAnchorPoints = 0;
+    for (int bin = 0; bin < num_bins; bin++) {
+      AnchorCandidate const& cand = candidates[bin]; // alias
+      if (cand.out_of_range && !warning_printed) {
+        vw::vw_out(vw::WarningMessage) << "Not placing anchor points outside "
+          << "the range of tabulated positions and orientations.\n";
+        warning_printed = true;
+      }
+      if (!cand.valid)
+        continue;
+
+      pixel_vec[icam].push_back(cand.pix);
+      weight_vec[icam].push_back(cand.weight);
+      isAnchor_vec[icam].push_back(1);
         
-        // The current number of points in tri_points_vec is the index of the next point
-        pix2xyz_index[icam].push_back(tri_points_vec.size() / 3);
+      // The current number of points in tri_points_vec is the index of the next point
+      pix2xyz_index[icam].push_back(tri_points_vec.size() / 3);
 
-        // Append every coordinate of dem_xyz to tri_points_vec
-        for (int it = 0; it < 3; it++) {
-          orig_tri_points_vec.push_back(dem_xyz[it]);
-          tri_points_vec.push_back(dem_xyz[it]);
-        }
+      // Append every coordinate of dem_xyz to tri_points_vec
+      for (int it = 0; it < 3; it++) {
+        orig_tri_points_vec.push_back(cand.xyz[it]);
+        tri_points_vec.push_back(cand.xyz[it]);
+      }
           
-        numAnchorPoints++;
-      }   
+      numAnchorPoints++;
     }
 
     vw_out() << std::endl;
@@ -611,25 +658,39 @@ void initResampleCsmCams(Options                     const& opt,
       vw_throw(ArgumentErr() 
                << "Expecting the cameras to be of CSM linescan or frame type.\n");
 
-    // Normalize quaternions. Later, the quaternions being optimized will
-    // be kept close to being normalized.  This makes it easy to ensure
-    // that quaternion interpolation gives good results, especially that
-    // some quaternions may get optimized and some not.
-    if (ls_model != NULL) {
-      asp::normalizeQuaternions(ls_model);
-      // The provided tabulated positions, velocities and quaternions may be too few,
-      // so resample them with --num-lines-per-position and --num-lines-per-orientation,
-      // if those are set.
-      resampleModel(opt.num_lines_per_position, opt.num_lines_per_orientation, ls_model);
-    } else if (frame_model != NULL) {
-      normalizeQuaternions(frame_model);
-    } else {
-      vw::vw_throw(vw::ArgumentErr() 
-        << "Expecting the cameras to be of CSM linescan or frame type.\n");
-    }
-
     csm_models.push_back(csm_cam);
   }
+
+  // Normalize quaternions. Later, the quaternions being optimized will
+  // be kept close to being normalized.  This makes it easy to ensure
+  // that quaternion interpolation gives good results, especially that
+  // some quaternions may get optimized and some not. The provided tabulated
+  // positions, velocities and quaternions for linescan cameras may be too
+  // few, so resample them with --num-lines-per-position and
+  // --num-lines-per-orientation, if those are set. The cameras are
+  // independent, so this is done in parallel.
+  std::vector<std::exception_ptr> errors(csm_models.size());
+  #pragma omp parallel for schedule(dynamic, 1)
+  for (int icam = 0; icam < int(csm_models.size()); icam++) {
+    try {
+      UsgsAstroLsSensorModel * ls_model
+        = dynamic_cast<UsgsAstroLsSensorModel*>((csm_models[icam]->m_gm_model).get());
+      UsgsAstroFrameSensorModel * frame_model
+        = dynamic_cast<UsgsAstroFrameSensorModel*>((csm_models[icam]->m_gm_model).get());
+      if (ls_model != NULL) {
+        asp::normalizeQuaternions(ls_model);
+        resampleModel(opt.num_lines_per_position, opt.num_lines_per_orientation, ls_model);
+      } else if (frame_model != NULL) {
+        normalizeQuaternions(frame_model);
+      }
+    } catch (...) {
+      errors[icam] = std::current_exception();
+    }
+  }
+  for (size_t icam = 0; icam < errors.size(); icam++) {
+    if (errors[icam])
+      std::rethrow_exception(errors[icam]);
+  }
 }
 
 // Create structures for pixels, xyz, and weights, to be used in optimization.
@@ -791,6 +852,9 @@ void run_jitter_solve(int argc, char* argv[]) {
   rig::RigSet rig;
   handle_arguments(argc, argv, opt, rig);
 
+  // Cache the processed CSM ISDs, so that reruns load them faster
+  asp::CsmModel::setIsdCacheDir(opt.out_prefix + "-csm-cache");
+
   bool approximate_pinhole_intrinsics = false;
   asp::load_cameras(opt.image_files, opt.camera_files, opt.out_prefix, opt,  
                     approximate_pinhole_intrinsics,  
@@ -891,13 +955,15 @@ void run_jitter_solve(int argc, char* argv[]) {
                       cnet, isisCnetData); // outputs
   } else {
     bool triangulate_control_points = true;
-    bool success = vw::ba::build_control_network(triangulate_control_points,
-                                                cnet, // output
-                                                opt.camera_models, opt.image_files,
-                                                match_files, opt.min_matches,
-                                                opt.min_triangulation_angle*(M_PI/180.0),
-                                                opt.forced_triangulation_distance,
-                                                opt.max_pairwise_matches);
+    // Reuse the control network from an earlier run if the inputs are the same
+    bool success = asp::build_control_network_with_cache(triangulate_control_points,
+                                                         cnet, // output
+                                                         opt.camera_models, opt.image_files,
+                                                         match_files, opt.min_matches,
+                                                         opt.min_triangulation_angle*(M_PI/180.0),
+                                                         opt.forced_triangulation_distance,
+                                                         opt.max_pairwise_matches,
+                                                         opt.out_prefix);
     if (!success)
       vw::vw_throw(vw::ArgumentErr()
               << "Failed to build a control network. Check the bundle adjustment directory "
@@ -933,10 +999,19 @@ void run_jitter_solve(int argc, char* argv[]) {
   bool warn_only = false; // for jitter solving we always know well the datum
   if (have_dem) {
     vw::vw_out() << "Reading the DEM for the --heights-from-dem constraint.\n";
-    asp::create_interp_dem(opt.heights_from_dem, dem_georef, interp_dem);
+    // Read in memory the DEM window around the points to be updated
+    std::vector<Vector3> inlier_xyz;
+    for (int ipt = 0; ipt < (int)cnet.size(); ipt++) {
+      if (outliers.find(ipt) == outliers.end())
+        inlier_xyz.push_back(cnet[ipt].position());
+    }
+    vw::ImageViewRef<vw::PixelMask<float>> masked_dem;
+    asp::create_masked_dem(opt.heights_from_dem, inlier_xyz, dem_georef, masked_dem);
+    asp::create_interp_dem(masked_dem, interp_dem);
+    asp::DemHeightPyramid dem_pyramid(masked_dem, dem_georef);
     asp::checkDatumConsistency(opt.datum, dem_georef.datum(), warn_only);
     asp::update_point_from_dem(cnet, crn, outliers, opt.camera_models,
-                               dem_georef, interp_dem,  
+                               dem_georef, interp_dem, dem_pyramid,
                                // Output
                                dem_xyz_vec);
   }
@@ -1089,6 +1164,9 @@ void run_jitter_solve(int argc, char* argv[]) {
   options.linear_solver_type  = ceres::ITERATIVE_SCHUR;
   options.preconditioner_type = ceres::SCHUR_JACOBI;
   options.use_explicit_schur_complement = false; // Only matters with ITERATIVE_SCHUR
+  asp::applySolverPreset(opt.solver_preset, options);
+  if (opt.banded_schur && !tri_points_vec.empty())
+    asp::applyBandedSchur(problem, &tri_points_vec[0], tri_points_vec.size() / 3, options);
   
   // Solve the problem
   vw_out() << "Starting the Ceres optimizer." << std::endl;
@@ -1102,6 +1180,7 @@ void run_jitter_solve(int argc, char* argv[]) {
   // Update the cameras given the optimized parameters
   updateCameras(have_rig, rig, rig_cam_info, ref_to_curr_sensor_vec, 
                 csm_models, frame_params);  
+  asp::resetLsModelCache(); // the per-thread copies of the cameras are stale
 
   // By now the cameras have been updated in-place. Compute the optimized
   // camera centers.
@@ -28,12 +28,21 @@
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Camera/MapprojectImage.h>
+#include <asp/Camera/GridApproxCamera.h>
 #include <asp/Sessions/CameraUtils.h>
 #include <asp/Core/DemUtils.h>
+#include <asp/Camera/CsmModel.h>
+#include <asp/Camera/LinescanDGModel.h>
 
 #include <vw/Cartography/CameraBBox.h>
 #include <vw/Camera/PinholeModel.h>
 
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
 using namespace vw;
 using namespace vw::cartography;
 namespace po = boost::program_options;
@@ -82,11 +91,32 @@ void handle_arguments(int argc, char *argv[], asp::MapprojOptions& opt) {
      "Trace a ray from this input image pixel (values start from 0) to the ground. "
      "Print the intersection point with the DEM as lon, lat, height, then "
      "as DEM column, row, height. Quit afterwards.")
+    ("approx-max-pixel-error", po::value(&opt.approx_max_pixel_error)->default_value(0.0),
+     "If positive, project into the camera by interpolating in a table of exact "
+     "projections over the output region, refined where needed until the error is at "
+     "most this many pixels. This is much faster for linescan cameras. See the doc for "
+     "details.")
     ("aster-use-csm", 
      po::bool_switch(&opt.aster_use_csm)->default_value(false)->implicit_value(true),
      "Use the CSM model with ASTER cameras (-t aster).")
+    ("isis-camera-pool-size", po::value(&opt.isis_camera_pool_size)->default_value(1),
+     "Create up to this many ISIS camera instances, as needed, and use them in "
+     "parallel. If more than 1, ISIS cameras are used with multiple threads.")
+    ("isis-to-csm-max-pixel-error",
+     po::value(&opt.isis_to_csm_max_pixel_error)->default_value(0.0),
+     "If positive, replace an ISIS linescan camera with a CSM model fit to it, "
+     "if the two agree to within this many pixels. The fit is cached next to the "
+     "cube. CSM cameras are faster and can use multiple threads.")
     ("parse-options", po::bool_switch(&opt.parseOptions)->default_value(false),
      "Parse the options and print the results. Used by the mapproject script.")
+    ("camera-cache-dir", po::value(&opt.camera_cache_dir)->default_value(""),
+     "Save the loaded CSM and Digital Globe cameras in this directory, and read them "
+     "from there in later runs, rather than processing the camera files again. Used "
+     "by the mapproject script for the tiles.")
+    ("image-list", po::value(&opt.image_list)->default_value(""),
+     "Mapproject many images onto the same DEM in one run. Each line of this file "
+     "must have an image, a camera (unless contained in the image), and an output "
+     "image. Then only the DEM is passed on the command line.")
     ;
   general_options.add(vw::GdalWriteOptionsDescription(opt));
   
@@ -110,10 +140,19 @@ void handle_arguments(int argc, char *argv[], asp::MapprojOptions& opt) {
     asp::check_command_line(argc, argv, opt, general_options, general_options,
                             positional, positional_desc, usage,
                             allow_unregistered, unregistered);
-  
-  if ( !vm.count("dem") || !vm.count("camera-image") || !vm.count("camera-model") )
+
+  if (!opt.image_list.empty()) {
+    if (!vm.count("dem") || vm.count("camera-image"))
+      vw_throw(ArgumentErr() << "With --image-list, only the DEM must be specified.\n"
+               << usage << general_options);
+    if (opt.isQuery || opt.parseOptions || opt.target_pixelwin != BBox2() ||
+        !std::isnan(opt.query_pixel[0]) || !std::isnan(opt.query_pixel[1]))
+      vw_throw(ArgumentErr() << "The options --query-projection, --parse-options, "
+               << "--t_pixelwin, and --query-pixel cannot be used with --image-list.\n");
+  } else if (!vm.count("dem") || !vm.count("camera-image") || !vm.count("camera-model")) {
     vw_throw(ArgumentErr() << "Not all of the input DEM, image, and camera were specified.\n"
              << usage << general_options);
+  }
   
   // If exactly three files were passed in, the last one must be the output file and the image file
   // must contain the camera model.
@@ -127,6 +166,9 @@ void handle_arguments(int argc, char *argv[], asp::MapprojOptions& opt) {
     vw_throw(ArgumentErr() 
              << "The value of --t_srs is empty. Then it must not be set at all.\n");
 
+  if (opt.approx_max_pixel_error < 0)
+    vw_throw(ArgumentErr() << "The value of --approx-max-pixel-error must be non-negative.\n");
+
   if (asp::has_cam_extension(opt.output_file))
     vw_throw(ArgumentErr() << "The output file is a camera. Check your inputs.\n");
 
@@ -143,6 +185,12 @@ void handle_arguments(int argc, char *argv[], asp::MapprojOptions& opt) {
   // in the stereo session.
   asp::stereo_settings().bundle_adjust_prefix = opt.bundle_adjust_prefix;
   asp::stereo_settings().aster_use_csm = opt.aster_use_csm;
+  asp::stereo_settings().isis_camera_pool_size = opt.isis_camera_pool_size;
+  asp::stereo_settings().isis_to_csm_max_pixel_error = opt.isis_to_csm_max_pixel_error;
+  if (!opt.camera_cache_dir.empty()) {
+    asp::CsmModel::setIsdCacheDir(opt.camera_cache_dir);
+    asp::setDgXmlCacheDir(opt.camera_cache_dir);
+  }
   
   if (fs::path(opt.dem_file).extension() != "") {
     // A path to a real DEM file was provided, load it!
@@ -335,62 +383,362 @@ void calc_target_geom(// Inputs
   return;
 }
 
+/// Load the camera model for the image and camera in the options
+void load_camera(asp::MapprojOptions & opt) {
+
+  // TODO: Replace this using the new CameraModelLoader functions. But those
+  // may not have the session guessing logic.
+
+  // We create a stereo session where both of the cameras and images
+  // are the same, because we want to take advantage of the stereo
+  // pipeline's ability to generate camera models for various
+  // missions.  Hence, we create two identical camera models, but only one is used.
+  asp::SessionPtr session(asp::StereoSessionFactory::create
+                          (opt.stereo_session, // in-out
+                           opt,
+                           opt.image_file, opt.image_file, // The same file is passed in twice
+                           opt.camera_file, opt.camera_file,
+                           opt.output_file,
+                           "", // Do not use a DEM to not make the session mapprojected
+                           false)); // Do not allow promotion from normal to map projected session
+
+  if ( opt.output_file.empty() )
+    vw_throw( ArgumentErr() << "Missing output filename.\n" );
+
+  // Additional checks once the stereo session is determined.
+
+  if (opt.stereo_session == "dg" || opt.stereo_session == "perusat")
+    vw_out(WarningMessage) << "Images map-projected using the '" << opt.stereo_session
+                           << "' camera model cannot be used later for stereo. "
+                           << "If that is desired, please run mapproject with "
+                           << "'-t rpc' and a camera file having an RPC model.\n";
+
+  // If nothing else works
+  // TODO(oalexan1): Likely StereoSessionFactory already have this logic.
+  if (boost::iends_with(boost::to_lower_copy(opt.camera_file), ".xml") &&
+       opt.stereo_session == "" )
+    opt.stereo_session = "rpc";
+
+  // Initialize the camera model
+  opt.camera_model = session->camera_model(opt.image_file, opt.camera_file);
+
+  opt.multithreaded_model = session->supports_multi_threading();
+
+  {
+    // Safety check that the users are not trying to map project map
+    // projected images. This should not be an error as sometimes
+    // even raw images have some half-baked georeference attached to them.
+    GeoReference dummy_georef;
+    bool has_georef = vw::cartography::read_georeference( dummy_georef, opt.image_file );
+    if (has_georef)
+      vw_out(WarningMessage) << "Your input camera image is already map-"
+                             << "projected. The expected input is required "
+                             << "to be unprojected or raw camera imagery.\n";
+  }
+}
+
+/// Load the DEM. If a datum was given instead, make a constant-height DEM
+/// on the side of the planet seen by the camera.
+void load_dem(asp::MapprojOptions const& opt,
+              bool & datum_dem, GeoReference & dem_georef,
+              ImageViewRef<DemPixelT> & dem) {
+
+  datum_dem = false;
+  if (fs::path(opt.dem_file).extension() != "") {
+    // A path to a real DEM file was provided, load it!
+
+    bool has_georef = vw::cartography::read_georeference(dem_georef, opt.dem_file);
+    if (!has_georef)
+      vw_throw( ArgumentErr() << "There is no georeference information in: "
+                << opt.dem_file << ".\n" );
+
+    boost::shared_ptr<DiskImageResource> dem_rsrc(DiskImageResourcePtr(opt.dem_file));
+
+    // If we have a nodata value, create a mask.
+    DiskImageView<float> dem_disk_image(opt.dem_file);
+    if (dem_rsrc->has_nodata_read()){
+      dem = create_mask(dem_disk_image, dem_rsrc->nodata_read());
+    }else{
+      dem = pixel_cast<DemPixelT>(dem_disk_image);
+    }
+  } else {
+    // Projecting to a datum instead of a DEM
+    datum_dem = true;
+    std::string datum_name = opt.dem_file;
+
+    // Use the camera center to determine whether to center the fake DEM on 0 or 180.
+    Vector3 cam_ctr = opt.camera_model->camera_center(Vector2());
+    Vector3 llr_camera_loc = cartography::XYZtoLonLatRadEstimateFunctor::apply(cam_ctr);
+    float lonstart = 0;
+    if ((llr_camera_loc[0] < 0) && (llr_camera_loc[0] > -180))
+      lonstart = -180;
+    dem_georef = GeoReference(Datum(datum_name),
+                              // Need adjustments to work at boundaries!
+                              vw::Matrix3x3(1,  0, lonstart-0.5,
+                                            0, -1, 90+0.5,
+                                            0,  0,  1) );
+    dem = constant_view(PixelMask<float>(opt.datum_offset), 360.0, 180.0);
+    vw_out() << "\t--> Using flat datum \"" << datum_name << "\" as elevation model.\n";
+  }
+}
+
+/// Find the output georeference and size for the image in the options,
+/// and mapproject it onto the given DEM.
+void mapproject_image(asp::MapprojOptions & opt, bool datum_dem,
+                      GeoReference const& dem_georef,
+                      ImageViewRef<DemPixelT> const& dem) {
+
+  // Read projection. Work out output bounding box in points using original camera model.
+  GeoReference target_georef = dem_georef;
+
+  // User specified the proj4 string for the output georeference
+  if (opt.target_srs_string != "") {
+    bool  have_user_datum = false, have_input_georef = false;
+    Datum user_datum;
+    asp::set_srs_string(opt.target_srs_string, have_user_datum, user_datum,
+                        have_input_georef, target_georef);
+  }
+
+  // The user datum and DEM datum must agree
+  bool warn_only = false;
+  asp::checkDatumConsistency(dem_georef.datum(), target_georef.datum(), warn_only);
+
+  // Find the target resolution based --tr, --mpp, and --ppd if provided. Do
+  // the math to convert pixel-per-degree to meter-per-pixel and vice-versa.
+  int sum = (!std::isnan(opt.tr)) + (!std::isnan(opt.mpp)) + (!std::isnan(opt.ppd));
+  if (sum >= 2)
+    vw::vw_throw(vw::ArgumentErr()
+             << "Must specify at most one of the options: --tr, --mpp, --ppd.\n" );
+
+  double radius = target_georef.datum().semi_major_axis();
+  if (!std::isnan(opt.tr)) { // --tr was set
+    if (target_georef.is_projected()) {
+      if (std::isnan(opt.mpp)) opt.mpp = opt.tr; // User must have provided be meters per pixel
+    }else {
+      if (std::isnan(opt.ppd)) opt.ppd = 1.0/opt.tr; // User must have provided degrees per pixel
+    }
+  }
+
+  if (!std::isnan(opt.mpp)){ // Meters per pixel was set
+    if (std::isnan(opt.ppd)) opt.ppd = 2.0*M_PI*radius/(360.0*opt.mpp);
+  }
+  if (!std::isnan(opt.ppd)){ // Pixels per degree was set
+    if (std::isnan(opt.mpp)) opt.mpp = 2.0*M_PI*radius/(360.0*opt.ppd);
+  }
+
+  bool user_provided_resolution = (!std::isnan(opt.ppd));
+  bool     calc_target_res = !user_provided_resolution;
+  Vector2i image_size      = vw::file_image_size(opt.image_file);
+  BBox2    cam_box;
+  calc_target_geom(// Inputs
+                   calc_target_res, image_size, opt.camera_model,
+                   dem, dem_georef, datum_dem,
+                   // Outputs
+                   opt, cam_box, target_georef);
+
+  // Set a high precision, as the numbers can come out big for UTM
+  vw_out() << std::setprecision(17) << "Projected space bounding box: " << cam_box << std::endl;
+
+  // Compute output image size in pixels using bounding box in output projected space
+  BBox2i target_image_size = target_georef.point_to_pixel_bbox(cam_box);
+
+  // Very important note: this box may be in the middle of the
+  // image.  However, the virtual image we create with
+  // transform_nodata() below is assumed to start at (0, 0), and in
+  // target_georef we assume the same thing. Hence, its width and
+  // height are going to be the max values of target_image_size.
+  // There is no performance hit here, since that potentially huge
+  // image is never actually realized, we crop it as seen below
+  // before finding its pixels. This could be made less confusing.
+  int virtual_image_width  = target_image_size.max().x();
+  int virtual_image_height = target_image_size.max().y();
+
+  // Shrink output image BB if an output image BB was passed in
+  GeoReference croppedGeoRef  = target_georef;
+  BBox2i       croppedImageBB = target_image_size;
+  if (opt.target_pixelwin != BBox2()) {
+    // Replace with passed-in bounding box
+    croppedImageBB = opt.target_pixelwin;
+
+    // Update output georeference to match the reduced image size
+    croppedGeoRef = vw::cartography::crop(target_georef, croppedImageBB);
+  }
+
+  // Important: Don't modify the line below, we count on it in the Python
+  // mapproject program.
+  vw_out() << "Output image size:\n";
+  vw_out() << std::setprecision(17) << "(width: " << virtual_image_width
+           << " height: " << virtual_image_height << ")" << std::endl;
+
+  // Print an explanation for a potential problem.
+  if (virtual_image_width <= 0 || virtual_image_height <= 0)
+    vw_throw( ArgumentErr() << "Computed output image size is not positive. "
+              << "This can happen if the projection is in meters while the "
+              << "grid size is either in degrees or too large for the given input.\n" );
+
+  // Form the lon-lat bounding box of the output image. This helps with
+  // geotransform operations and should be done any time a georef is modified.
+  BBox2 image_bbox(0, 0, virtual_image_width, virtual_image_height);
+  croppedGeoRef.ll_box_from_pix_box(image_bbox);
+
+  if (opt.isQuery) { // Quit before we do any image work
+    vw_out() << "Query finished, exiting mapproject tool.\n";
+    return;
+  }
+
+  // For certain pinhole camera models the reverse check can make map
+  // projection very slow, so we disable it here.  The check is very important
+  // for computing the bounding box safely but we don't really need it when
+  // projecting the pixels back in to the camera.
+  boost::shared_ptr<vw::camera::PinholeModel> pinhole_ptr =
+              boost::dynamic_pointer_cast<vw::camera::PinholeModel>(opt.camera_model);
+  if (pinhole_ptr)
+    pinhole_ptr->set_do_point_to_pixel_check(false);
+
+  // Approximate the camera projection over the output region, if desired
+  if (opt.approx_max_pixel_error > 0) {
+    BBox2 point_box = target_georef.pixel_to_point_bbox(croppedImageBB);
+    double min_height = opt.datum_offset, max_height = opt.datum_offset;
+    bool have_heights = datum_dem ||
+      asp::demHeightRange(dem, dem_georef, target_georef, point_box,
+                          min_height, max_height);
+    if (have_heights)
+      opt.approx_camera_model.reset
+        (new asp::GridApproxCameraModel(opt.camera_model, target_georef, point_box,
+                                        min_height, max_height,
+                                        opt.approx_max_pixel_error));
+    else
+      vw_out(WarningMessage) << "No valid DEM heights found in the output region. "
+                             << "Will not approximate the camera.\n";
+  }
+
+  // Project the image depending on image format.
+  project_image(opt, dem_georef, target_georef, croppedGeoRef, image_size,
+                virtual_image_width, virtual_image_height, croppedImageBB);
+}
+
+/// Interleave the bits of the two values. Sorting by this key puts
+/// nearby cells next to each other, in Z order.
+std::uint64_t zorder_key(std::uint32_t x, std::uint32_t y) {
+  std::uint64_t key = 0;
+  for (int bit = 0; bit < 32; bit++) {
+    key |= std::uint64_t((x >> bit) & 1) << (2 * bit);
+    key |= std::uint64_t((y >> bit) & 1) << (2 * bit + 1);
+  }
+  return key;
+}
+
+/// Mapproject each image in the list onto the same DEM. The georeference
+/// of a real DEM is read and the DEM is opened only once. The images are
+/// processed in the order of the DEM regions under them, so that
+/// consecutive images read the same DEM tiles, which then are likely in
+/// memory already. Each image uses all threads, for its own tiles.
+void mapproject_image_list(asp::MapprojOptions const& opt) {
+
+  std::ifstream ifs(opt.image_list.c_str());
+  if (!ifs.good())
+    vw_throw(ArgumentErr() << "Cannot read: " << opt.image_list << ".\n");
+
+  // Each line has the image, perhaps the camera, and the output
+  std::vector<asp::MapprojOptions> jobs;
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream is(line);
+    std::vector<std::string> vals;
+    std::string val;
+    while (is >> val)
+      vals.push_back(val);
+    if (vals.empty() || vals[0][0] == '#')
+      continue;
+    if (vals.size() != 2 && vals.size() != 3)
+      vw_throw(ArgumentErr() << "Expecting an image, a camera, and an output image "
+               << "on each line of " << opt.image_list << ". Got: " << line << "\n");
+    asp::MapprojOptions job = opt;
+    job.image_file  = vals[0];
+    job.camera_file = (vals.size() == 3) ? vals[1] : "";
+    job.output_file = vals.back();
+    jobs.push_back(job);
+  }
+  if (jobs.empty())
+    vw_throw(ArgumentErr() << "No images found in: " << opt.image_list << ".\n");
+
+  for (size_t it = 0; it < jobs.size(); it++) {
+    if (asp::has_cam_extension(jobs[it].output_file))
+      vw_throw(ArgumentErr() << "The output file is a camera: " << jobs[it].output_file
+               << ". Check your inputs.\n");
+    load_camera(jobs[it]);
+  }
+
+  // With a datum, the DEM depends on the camera, and there are no tiles to read
+  bool datum_dem = false;
+  GeoReference dem_georef;
+  ImageViewRef<DemPixelT> dem;
+  if (fs::path(opt.dem_file).extension() != "") {
+    load_dem(jobs[0], datum_dem, dem_georef, dem);
+
+    // Sort by the DEM cell of 256 x 256 pixels under each camera center.
+    // Cameras which fail to be located go last.
+    std::vector<std::pair<std::uint64_t, size_t>> order(jobs.size());
+    for (size_t it = 0; it < jobs.size(); it++) {
+      std::uint64_t key = std::numeric_limits<std::uint64_t>::max();
+      try {
+        Vector3 cam_ctr = jobs[it].camera_model->camera_center(Vector2());
+        Vector3 llr = cartography::XYZtoLonLatRadEstimateFunctor::apply(cam_ctr);
+        Vector2 pix = dem_georef.lonlat_to_pixel(subvector(llr, 0, 2));
+        double cell = 256.0;
+        pix = elem_quot(pix, cell);
+        if (pix[0] == pix[0] && pix[1] == pix[1]) { // not NaN
+          double max_cell = std::numeric_limits<std::uint32_t>::max();
+          key = zorder_key(std::uint32_t(std::min(std::max(pix[0], 0.0), max_cell)),
+                           std::uint32_t(std::min(std::max(pix[1], 0.0), max_cell)));
+        }
+      } catch (...) {}
+      order[it] = std::make_pair(key, it);
+    }
+    std::sort(order.begin(), order.end());
+    std::vector<asp::MapprojOptions> sorted_jobs;
+    for (size_t it = 0; it < order.size(); it++)
+      sorted_jobs.push_back(jobs[order[it].second]);
+    jobs.swap(sorted_jobs);
+  }
+
+  int num_failed = 0;
+  for (size_t it = 0; it < jobs.size(); it++) {
+    asp::MapprojOptions & job = jobs[it];
+    vw_out() << "Mapprojecting image " << it + 1 << " of " << jobs.size() << ": "
+             << job.image_file << "\n";
+    try {
+      if (fs::path(opt.dem_file).extension() == "")
+        load_dem(job, datum_dem, dem_georef, dem);
+      mapproject_image(job, datum_dem, dem_georef, dem);
+      // Free the camera, which may be large, once done with it
+      job.camera_model.reset();
+      job.approx_camera_model.reset();
+    } catch (std::exception const& e) {
+      vw_out(WarningMessage) << "Failed to mapproject " << job.image_file << ": "
+                             << e.what() << "\n";
+      num_failed++;
+    }
+  }
+
+  if (num_failed > 0)
+    vw_throw(ArgumentErr() << "Failed to mapproject " << num_failed << " out of "
+             << jobs.size() << " images.\n");
+}
+
 int main(int argc, char* argv[]) {
 
   asp::MapprojOptions opt;
   try {
     handle_arguments(argc, argv, opt);
-  
-    // TODO: Replace this using the new CameraModelLoader functions. But those
-    // may not have the session guessing logic.
-
-    // We create a stereo session where both of the cameras and images
-    // are the same, because we want to take advantage of the stereo
-    // pipeline's ability to generate camera models for various
-    // missions.  Hence, we create two identical camera models, but only one is used.
-        asp::SessionPtr session(asp::StereoSessionFactory::create
-                       (opt.stereo_session, // in-out
-                        opt,
-                        opt.image_file, opt.image_file, // The same file is passed in twice
-                        opt.camera_file, opt.camera_file,
-                        opt.output_file,
-                        "", // Do not use a DEM to not make the session mapprojected
-                        false)); // Do not allow promotion from normal to map projected session
-    
-    if ( opt.output_file.empty() )
-      vw_throw( ArgumentErr() << "Missing output filename.\n" );
-
-    // Additional checks once the stereo session is determined.
-    
-    if (opt.stereo_session == "dg" || opt.stereo_session == "perusat")
-      vw_out(WarningMessage) << "Images map-projected using the '" << opt.stereo_session
-                             << "' camera model cannot be used later for stereo. "
-                             << "If that is desired, please run mapproject with "
-                             << "'-t rpc' and a camera file having an RPC model.\n";
-
-    // If nothing else works
-    // TODO(oalexan1): Likely StereoSessionFactory already have this logic.
-    if (boost::iends_with(boost::to_lower_copy(opt.camera_file), ".xml") &&
-         opt.stereo_session == "" )
-      opt.stereo_session = "rpc";
-
-    // Initialize the camera model
-    opt.camera_model = session->camera_model(opt.image_file, opt.camera_file);
-
-    opt.multithreaded_model = session->supports_multi_threading();
-      
-    {
-      // Safety check that the users are not trying to map project map
-      // projected images. This should not be an error as sometimes
-      // even raw images have some half-baked georeference attached to them.
-      GeoReference dummy_georef;
-      bool has_georef = vw::cartography::read_georeference( dummy_georef, opt.image_file );
-      if (has_georef)
-        vw_out(WarningMessage) << "Your input camera image is already map-"
-                               << "projected. The expected input is required "
-                               << "to be unprojected or raw camera imagery.\n";
+
+    if (!opt.image_list.empty()) {
+      mapproject_image_list(opt);
+      return 0;
     }
 
+    load_camera(opt);
+
     // If the query pixel option was set, run the query and exit
     if (!std::isnan(opt.query_pixel[0]) && !std::isnan(opt.query_pixel[1])) {
       asp::queryPixel(opt.dem_file, opt.camera_model, opt.query_pixel);
@@ -401,156 +749,10 @@ int main(int argc, char* argv[]) {
     bool datum_dem = false;
     GeoReference dem_georef;
     ImageViewRef<DemPixelT> dem;
-    if (fs::path(opt.dem_file).extension() != "") {
-      // A path to a real DEM file was provided, load it!
-
-      bool has_georef = vw::cartography::read_georeference(dem_georef, opt.dem_file);
-      if (!has_georef)
-        vw_throw( ArgumentErr() << "There is no georeference information in: "
-                  << opt.dem_file << ".\n" );
-
-      boost::shared_ptr<DiskImageResource> dem_rsrc(DiskImageResourcePtr(opt.dem_file));
-
-      // If we have a nodata value, create a mask.
-      DiskImageView<float> dem_disk_image(opt.dem_file);
-      if (dem_rsrc->has_nodata_read()){
-        dem = create_mask(dem_disk_image, dem_rsrc->nodata_read());
-      }else{
-        dem = pixel_cast<DemPixelT>(dem_disk_image);
-      }      
-    } else {
-      // Projecting to a datum instead of a DEM
-      datum_dem = true;
-      std::string datum_name = opt.dem_file;
-
-      // Use the camera center to determine whether to center the fake DEM on 0 or 180.
-      Vector3 cam_ctr = opt.camera_model->camera_center(Vector2());
-      Vector3 llr_camera_loc = cartography::XYZtoLonLatRadEstimateFunctor::apply(cam_ctr);
-      float lonstart = 0;
-      if ((llr_camera_loc[0] < 0) && (llr_camera_loc[0] > -180))
-        lonstart = -180;
-      dem_georef = GeoReference(Datum(datum_name),
-                                // Need adjustments to work at boundaries!
-                                vw::Matrix3x3(1,  0, lonstart-0.5,
-                                              0, -1, 90+0.5,
-                                              0,  0,  1) );
-      dem = constant_view(PixelMask<float>(opt.datum_offset), 360.0, 180.0);
-      vw_out() << "\t--> Using flat datum \"" << datum_name << "\" as elevation model.\n";
-      //std::cout << "dem_georef = " << dem_georef << std::endl;
-    }
-    // Finished setting up the datum
+    load_dem(opt, datum_dem, dem_georef, dem);
 
-    // Read projection. Work out output bounding box in points using original camera model.
-    GeoReference target_georef = dem_georef;
+    mapproject_image(opt, datum_dem, dem_georef, dem);
 
-    // User specified the proj4 string for the output georeference
-    if (opt.target_srs_string != "") {
-      bool  have_user_datum = false, have_input_georef = false;
-      Datum user_datum;
-      asp::set_srs_string(opt.target_srs_string, have_user_datum, user_datum,
-                          have_input_georef, target_georef);
-    }
-
-    // The user datum and DEM datum must agree
-    bool warn_only = false;
-    asp::checkDatumConsistency(dem_georef.datum(), target_georef.datum(), warn_only);
-     
-    // Find the target resolution based --tr, --mpp, and --ppd if provided. Do
-    // the math to convert pixel-per-degree to meter-per-pixel and vice-versa.
-    int sum = (!std::isnan(opt.tr)) + (!std::isnan(opt.mpp)) + (!std::isnan(opt.ppd));
-    if (sum >= 2)
-      vw::vw_throw(vw::ArgumentErr() 
-               << "Must specify at most one of the options: --tr, --mpp, --ppd.\n" );
-
-    double radius = target_georef.datum().semi_major_axis();
-    if (!std::isnan(opt.tr)) { // --tr was set
-      if (target_georef.is_projected()) {
-        if (std::isnan(opt.mpp)) opt.mpp = opt.tr; // User must have provided be meters per pixel
-      }else {
-        if (std::isnan(opt.ppd)) opt.ppd = 1.0/opt.tr; // User must have provided degrees per pixel
-      }
-    }
-    
-    if (!std::isnan(opt.mpp)){ // Meters per pixel was set
-      if (std::isnan(opt.ppd)) opt.ppd = 2.0*M_PI*radius/(360.0*opt.mpp);
-    }
-    if (!std::isnan(opt.ppd)){ // Pixels per degree was set
-      if (std::isnan(opt.mpp)) opt.mpp = 2.0*M_PI*radius/(360.0*opt.ppd);
-    }
-    
-    bool user_provided_resolution = (!std::isnan(opt.ppd));
-    bool     calc_target_res = !user_provided_resolution;
-    Vector2i image_size      = vw::file_image_size(opt.image_file);
-    BBox2    cam_box;
-    calc_target_geom(// Inputs
-                     calc_target_res, image_size, opt.camera_model,
-                     dem, dem_georef, datum_dem,
-                     // Outputs
-                     opt, cam_box, target_georef);
-
-    // Set a high precision, as the numbers can come out big for UTM
-    vw_out() << std::setprecision(17) << "Projected space bounding box: " << cam_box << std::endl;
-
-    // Compute output image size in pixels using bounding box in output projected space
-    BBox2i target_image_size = target_georef.point_to_pixel_bbox(cam_box);
-
-    // Very important note: this box may be in the middle of the
-    // image.  However, the virtual image we create with
-    // transform_nodata() below is assumed to start at (0, 0), and in
-    // target_georef we assume the same thing. Hence, its width and
-    // height are going to be the max values of target_image_size.
-    // There is no performance hit here, since that potentially huge
-    // image is never actually realized, we crop it as seen below
-    // before finding its pixels. This could be made less confusing.
-    int virtual_image_width  = target_image_size.max().x();
-    int virtual_image_height = target_image_size.max().y();
-
-    // Shrink output image BB if an output image BB was passed in
-    GeoReference croppedGeoRef  = target_georef;
-    BBox2i       croppedImageBB = target_image_size;
-    if (opt.target_pixelwin != BBox2()) {
-      // Replace with passed-in bounding box
-      croppedImageBB = opt.target_pixelwin;
-
-      // Update output georeference to match the reduced image size
-      croppedGeoRef = vw::cartography::crop(target_georef, croppedImageBB);
-    }
-
-    // Important: Don't modify the line below, we count on it in the Python
-    // mapproject program.
-    vw_out() << "Output image size:\n";
-    vw_out() << std::setprecision(17) << "(width: " << virtual_image_width
-             << " height: " << virtual_image_height << ")" << std::endl;
-
-    // Print an explanation for a potential problem.    
-    if (virtual_image_width <= 0 || virtual_image_height <= 0)
-      vw_throw( ArgumentErr() << "Computed output image size is not positive. "
-                << "This can happen if the projection is in meters while the "
-                << "grid size is either in degrees or too large for the given input.\n" );
-
-    // Form the lon-lat bounding box of the output image. This helps with
-    // geotransform operations and should be done any time a georef is modified.
-    BBox2 image_bbox(0, 0, virtual_image_width, virtual_image_height);
-    croppedGeoRef.ll_box_from_pix_box(image_bbox);
-
-    if (opt.isQuery) { // Quit before we do any image work
-      vw_out() << "Query finished, exiting mapproject tool.\n";
-      return 0;
-    }
-    
-    // For certain pinhole camera models the reverse check can make map
-    // projection very slow, so we disable it here.  The check is very important
-    // for computing the bounding box safely but we don't really need it when
-    // projecting the pixels back in to the camera.
-    boost::shared_ptr<vw::camera::PinholeModel> pinhole_ptr = 
-                boost::dynamic_pointer_cast<vw::camera::PinholeModel>(opt.camera_model);
-    if (pinhole_ptr)
-      pinhole_ptr->set_do_point_to_pixel_check(false);
-
-    // Project the image depending on image format.
-    project_image(opt, dem_georef, target_georef, croppedGeoRef, image_size, 
-                  virtual_image_width, virtual_image_height, croppedImageBB);
-    
   } ASP_STANDARD_CATCHES;
 
   return 0;
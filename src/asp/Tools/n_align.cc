@@ -46,6 +46,8 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/geometry.hpp>
+#include <boost/geometry/index/rtree.hpp>
 
 #include <Eigen/Core>
 #include <Eigen/Geometry>
@@ -53,6 +55,7 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <string>
 
 namespace fs = boost::filesystem;
 namespace po = boost::program_options;
@@ -71,12 +74,19 @@ typedef PM::DataPoints DP;
 
 typedef flann::Index<flann::L2<double>> KDTree_double;
 
+// An R-tree over the cloud bounding boxes, to find the overlapping clouds
+typedef boost::geometry::model::point<double, 3, boost::geometry::cs::cartesian> RtreePoint3;
+typedef boost::geometry::model::box<RtreePoint3> RtreeBox3;
+typedef std::pair<RtreeBox3, int> RtreeValue;
+typedef boost::geometry::index::rtree<RtreeValue, boost::geometry::index::rstar<16>>
+  CloudRtree;
+
 /// Options container
 struct Options : public vw::GdalWriteOptions {
   // Input
   string in_prefix, in_transforms, datum, csv_format_str, csv_proj4_str; 
   int    num_iter, max_num_points;
-  double semi_major_axis, semi_minor_axis, rel_error_tol;
+  double semi_major_axis, semi_minor_axis, rel_error_tol, overlap_margin;
   bool   save_transformed_clouds, align_to_first_cloud, verbose;
   std::vector<std::string> cloud_files;
   // Output
@@ -111,6 +121,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      "Specify the initial transforms as a list of files separated by spaces and in quotes, that is, as 'trans1.txt ... trans_n.txt'.")
     ("relative-error-tolerance", po::value(&opt.rel_error_tol)->default_value(1e-10),
      "Stop when the change in the error divided by the error itself is less than this.")
+    ("overlap-margin", po::value(&opt.overlap_margin)->default_value(-1.0),
+     "If non-negative, find correspondences only between clouds whose bounding boxes, grown by this many meters, intersect. By default all pairs of clouds are used.")
     ("align-to-first-cloud", po::bool_switch(&opt.align_to_first_cloud)->default_value(false)->implicit_value(true),
      "Align the other clouds to the first one, rather than to their common centroid.")
     ("verbose", po::bool_switch(&opt.verbose)->default_value(false)->implicit_value(true),
@@ -180,24 +192,6 @@ bool triplet_less(vw::Vector3 const& p, vw::Vector3 const& q) {
   return false;
 }
 
-// Define equality for pairs of integers
-bool operator==(std::pair<int, int> const& p, std::pair<int, int> const& q) {
-  return (p.first == q.first) && (p.second == q.second);
-}
-
-// An operator used to sort pairs of integers
-struct CustomCompare {
-  bool operator()(std::pair<int, int> const& p, std::pair<int, int> const& q) const {
-    if (p.first < q.first) return true;
-    if (p.first > q.first) return false;
-    
-    if (p.second < q.second) return true;
-    if (p.second > q.second) return false;
-    
-    return false;
-  }
-};
-
 bool vector_less(Eigen::VectorXd const& p, Eigen::VectorXd const& q) {
   for (int i = 0; i < p.size(); i++) {
     if (p[i] < q[i]) return true;
@@ -276,24 +270,72 @@ void BuildKDTree_double(std::vector<vw::Vector3> const& cloud, KDTree_double* tr
   *tree = temp_tree;
 }
 
-void SearchKDTree_double(KDTree_double* tree, const vw::Vector3& input, 
-                         std::vector<int>& indices,
-                         std::vector<double>& dists, int nn){
-  int rows_t = 1;
-  int dim = input.size();
+// Find the nearest neighbor in the tree of each point in the cloud, with
+// one batched search. The search is multi-threaded when not already
+// called from a parallel region.
+void SearchKDTree_double(KDTree_double* tree, std::vector<vw::Vector3> const& cloud,
+                         std::vector<int>& indices){
+  int rows_t = cloud.size();
+  int dim = vw::Vector3().size();
+  indices.assign(rows_t, -1);
+  if (rows_t == 0)
+    return;
   
-  std::vector<double> query;
-  query.resize(rows_t*dim);
-  for (int i = 0; i < dim; i++)
-    query[i] = input[i];
+  std::vector<double> query(rows_t*dim);
+  for (int i = 0; i < rows_t; i++)
+    for (int j = 0; j < dim; j++)
+      query[i * dim + j] = cloud[i][j];
   flann::Matrix<double> query_mat(&query[0], rows_t, dim);
   
-  indices.resize(rows_t*nn);
-  dists.resize(rows_t*nn);
-  flann::Matrix<int> indices_mat(&indices[0], rows_t, nn);
-  flann::Matrix<double> dists_mat(&dists[0], rows_t, nn);
-  
-  tree->knnSearch(query_mat, indices_mat, dists_mat, nn, flann::SearchParams(ONE_TWO_EIGHT));
+  std::vector<double> dists(rows_t);
+  flann::Matrix<int> indices_mat(&indices[0], rows_t, 1);
+  flann::Matrix<double> dists_mat(&dists[0], rows_t, 1);
+
+  flann::SearchParams params(ONE_TWO_EIGHT);
+  params.cores = 0; // use all threads
+  tree->knnSearch(query_mat, indices_mat, dists_mat, 1, params);
+}
+
+// Find the pairs of clouds to match. If the margin is non-negative, keep
+// only the clouds whose bounding boxes grown by the margin intersect.
+void find_cloud_pairs(std::vector<std::vector<vw::Vector3>> const& clouds,
+                      double margin,
+                      std::vector<std::pair<int, int>> & pairs) {
+
+  pairs.clear();
+  int numClouds = clouds.size();
+  if (margin < 0) {
+    for (int i = 0; i < numClouds; i++)
+      for (int j = i + 1; j < numClouds; j++)
+        pairs.push_back(std::make_pair(i, j));
+    return;
+  }
+
+  std::vector<RtreeValue> boxes;
+  for (int i = 0; i < numClouds; i++) {
+    if (clouds[i].empty())
+      continue;
+    BBox3 box;
+    for (size_t it = 0; it < clouds[i].size(); it++)
+      box.grow(clouds[i][it]);
+    box.expand(margin);
+    RtreeBox3 rbox(RtreePoint3(box.min()[0], box.min()[1], box.min()[2]),
+                   RtreePoint3(box.max()[0], box.max()[1], box.max()[2]));
+    boxes.push_back(std::make_pair(rbox, i));
+  }
+  CloudRtree rtree(boxes.begin(), boxes.end());
+
+  for (size_t it = 0; it < boxes.size(); it++) {
+    std::vector<RtreeValue> found;
+    rtree.query(boost::geometry::index::intersects(boxes[it].first),
+                std::back_inserter(found));
+    int i = boxes[it].second;
+    for (size_t f = 0; f < found.size(); f++) {
+      if (found[f].second > i)
+        pairs.push_back(std::make_pair(i, found[f].second));
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
 }
 
 std::string transform_file(std::string const& out_prefix, int index){
@@ -420,12 +462,21 @@ int main(int argc, char *argv[]){
     }
     
     // Build the trees
-    std::vector<boost::shared_ptr<KDTree_double>> Trees;
+    std::vector<boost::shared_ptr<KDTree_double>> Trees(numClouds);
+    for (int it = 0; it < numClouds; it++)
+      Trees[it].reset(new KDTree_double(flann::KDTreeSingleIndexParams(FIFTEEN)));
+    std::vector<std::string> errors(numClouds);
+    #pragma omp parallel for schedule(dynamic)
     for (int it = 0; it < numClouds; it++) {
-      boost::shared_ptr<KDTree_double>
-        tree(new KDTree_double(flann::KDTreeSingleIndexParams(FIFTEEN)));
-      BuildKDTree_double(clouds[it], tree.get());
-      Trees.push_back(tree);
+      try {
+        BuildKDTree_double(clouds[it], Trees[it].get());
+      } catch (std::exception const& e) {
+        errors[it] = e.what();
+      }
+    }
+    for (int it = 0; it < numClouds; it++) {
+      if (!errors[it].empty())
+        vw_throw(ArgumentErr() << "Cloud " << opt.cloud_files[it] << ": " << errors[it]);
     }
 
     std::string errCaption = std::string("Computing the error, defined as the mean of ") +
@@ -474,63 +525,41 @@ int main(int argc, char *argv[]){
         }
       }
     
-      for (size_t i = 0; i < numClouds; i++) {
-
-        //spanI = modelSpan(i)+1:modelSpan(i+1); 
-        std::vector<int> spanI;
-        int beg = modelSpan[i], end = modelSpan[i+1] - 1;
-        for (int it = beg; it <= end; it++) spanI.push_back(it);
-        
+      for (int i = 0; i < numClouds; i++) {
         //CentroidPtsBelMod(spanI,i) = 1:length(spanI);
-        for (size_t it = 0; it < spanI.size(); it++) {
-          CentroidPtsBelMod[spanI[it]][i] = it;
-        }
-
-        for (size_t j = i + 1; j < numClouds; j++) {
-        
-          //spanJ = modelSpan(j)+1:modelSpan(j+1); 
-          std::vector<int> spanJ;
-          int beg = modelSpan[j], end = modelSpan[j+1] - 1;
-          for (int it = beg; it <= end; it++) spanJ.push_back(it);
-        
-          std::vector<int> match, match2;
-          std::vector<double> dist;
-          typedef std::set<std::pair<int, int>, CustomCompare> PairType;
-
-          // For each point in cloud i, find a match in cloud j
-          PairType Corr1;
-          for (size_t index_i = 0; index_i < clouds[i].size(); index_i++){
-            SearchKDTree_double(Trees[j].get(), clouds[i][index_i], match, dist, 1);
-            if (match.empty()) continue; // should not happen
-            int index_j = match[0];
-            Corr1.insert(std::pair<int, int>(index_j, index_i));
-          }
-
-          // Now do it in reverse
-          PairType Corr2;
-          for (size_t index_j = 0; index_j < clouds[j].size(); index_j++){
-            SearchKDTree_double(Trees[i].get(), clouds[j][index_j], match, dist, 1);
-            if (match.empty()) continue; // should not happen
-            int index_i = match[0];
-            Corr2.insert(std::pair<int, int>(index_j, index_i));
-          }
-
-          std::vector<std::pair<int, int>> Corr;
-          for (PairType::iterator it = Corr1.begin(); it != Corr1.end(); it++) {
-            PairType::iterator it2 = Corr2.find(*it);
-            if (it2 == Corr2.end()) continue;
-
-            Corr.push_back(*it);
-          }
-
-          for (size_t it = 0; it < Corr.size(); it++) {
-            // CentroidPtsBelMod(spanI(Corr(:,2)),j) = Corr(:,1)';
-            CentroidPtsBelMod[spanI[Corr[it].second]][j] = Corr[it].first;
-
-            // CentroidPtsBelMod(spanJ(Corr(:,1)),i) = Corr(:,2)';
-            CentroidPtsBelMod[spanJ[Corr[it].first]][i] = Corr[it].second;
-          }
+        for (int it = modelSpan[i]; it < modelSpan[i+1]; it++)
+          CentroidPtsBelMod[it][i] = it - modelSpan[i];
+      }
 
+      // Find the mutual nearest neighbors for each pair of clouds. The
+      // pairs are processed in parallel. Each pair writes only the entries
+      // of its two clouds in each other's columns, so there are no races.
+      std::vector<std::pair<int, int>> pairs;
+      find_cloud_pairs(clouds, opt.overlap_margin, pairs);
+      if (opt.verbose)
+        vw_out() << "Matching " << pairs.size() << " pairs of clouds.\n";
+      #pragma omp parallel for schedule(dynamic) if (pairs.size() > 1)
+      for (size_t pairIter = 0; pairIter < pairs.size(); pairIter++) {
+
+        int i = pairs[pairIter].first, j = pairs[pairIter].second;
+
+        // For each point in cloud i, find a match in cloud j, then do it in reverse
+        std::vector<int> match_ij, match_ji;
+        SearchKDTree_double(Trees[j].get(), clouds[i], match_ij);
+        SearchKDTree_double(Trees[i].get(), clouds[j], match_ji);
+
+        // Keep the matches that agree
+        for (size_t index_i = 0; index_i < match_ij.size(); index_i++) {
+          int index_j = match_ij[index_i];
+          if (index_j < 0 || index_j >= int(match_ji.size()) ||
+              match_ji[index_j] != int(index_i))
+            continue;
+
+          // CentroidPtsBelMod(spanI(Corr(:,2)),j) = Corr(:,1)';
+          CentroidPtsBelMod[modelSpan[i] + index_i][j] = index_j;
+
+          // CentroidPtsBelMod(spanJ(Corr(:,1)),i) = Corr(:,2)';
+          CentroidPtsBelMod[modelSpan[j] + index_j][i] = index_i;
         }
       }
 
@@ -575,7 +604,8 @@ int main(int argc, char *argv[]){
       int numErrors = 0;
       
       // Find the transform from each cloud to the centroid, and apply it to each cloud
-      for (size_t cloudIter = 0; cloudIter < numClouds; cloudIter++) {
+      #pragma omp parallel for schedule(dynamic) reduction(+:errBefore,errAfter,numErrors)
+      for (int cloudIter = 0; cloudIter < numClouds; cloudIter++) {
 
         std::vector<Eigen::Vector3d> src, dst; 
         Eigen::Matrix3d rot;
@@ -23,10 +23,12 @@
 #include <limits>
 
 #include <vw/FileIO/DiskImageUtils.h>
-#include <vw/Image/Statistics.h>
 
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
+#include <asp/Core/ImageUtils.h>
+
+#include <omp.h>
 
 namespace po = boost::program_options;
 
@@ -34,10 +36,10 @@ using namespace vw;
 
 struct Options: vw::GdalWriteOptions {
   std::vector<std::string> image_files;
-  bool has_nodata_value;
+  bool has_nodata_value, use_overviews;
   std::int64_t num_samples, num_bins;
   double nodata_value;
-  Options(): has_nodata_value(false), num_samples(-1),
+  Options(): has_nodata_value(false), use_overviews(false), num_samples(-1),
              nodata_value(std::numeric_limits<double>::quiet_NaN()){}
 };
 
@@ -53,7 +55,11 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Number of bins to use for the histogram. A larger value is "
      "suggested if the image has outlying pixel values.")
     ("nodata-value", po::value(&opt.nodata_value),
-     "Use this nodata value instead of what is read from the file, if present.");
+     "Use this nodata value instead of what is read from the file, if present.")
+    ("use-overviews", po::bool_switch(&opt.use_overviews)->default_value(false),
+     "Find an approximate threshold from the coarsest GDAL internal overview of the "
+     "image having at least --num-samples pixels, if such an overview exists. If "
+     "--num-samples is not set, use the finest overview.");
   
   po::options_description positional("");
   positional.add_options()
@@ -89,6 +95,10 @@ int main( int argc, char *argv[] ) {
     // Find command line options
     handle_arguments(argc, argv, opt);
 
+    // The tiles of each image are processed in parallel
+    omp_set_dynamic(0);
+    omp_set_num_threads(vw_settings().default_num_threads());
+
     for (size_t it = 0; it < opt.image_files.size(); it++) {
       std::string image_file = opt.image_files[it];
 
@@ -115,35 +125,44 @@ int main( int argc, char *argv[] ) {
       if (num_vals <= 0) 
         vw_throw(ArgumentErr() << "Found empty image: " << image_file << "\n");
       
-      double samp_ratio = 1.0;
-      if (opt.num_samples > 0) 
-        samp_ratio = sqrt(double(num_vals) / double(opt.num_samples));
-      samp_ratio = std::max(samp_ratio, 1.0);
-
-      std::int64_t num_sample_rows = round(num_rows / samp_ratio);
-      num_sample_rows = std::max(std::int64_t(1), num_sample_rows);
-      num_sample_rows = std::min(num_rows, num_sample_rows);
-      
-      std::int64_t num_sample_cols = round(num_cols / samp_ratio);
-      num_sample_cols = std::max(std::int64_t(1), num_sample_cols);
-      num_sample_cols = std::min(num_cols, num_sample_cols);
-      
       std::cout << "Number of image rows and columns: "
                 << num_rows << ", " << num_cols << "\n";
-      std::cout << "Picking a uniform sample of dimensions "
-                << num_sample_rows << ", " << num_sample_cols << "\n";
       std::cout << "Number of bins in the histogram: " << opt.num_bins << std::endl;
-      std::cout << "It may take several minutes to find the answer.\n";
-
-      // The mask creation can handle a NaN for the opt.nodata_value.
-      double threshold = vw::otsu_threshold(create_mask(image, opt.nodata_value),
-                                               num_sample_rows, num_sample_cols,
-                                               opt.num_bins);
 
+      // Read the overview, if asked to and if it exists
+      ImageView<float> overview;
+      ImageViewRef<float> sample;
+      std::int64_t min_num_pixels = std::max(opt.num_samples, std::int64_t(1));
+      if (opt.use_overviews && asp::read_overview(image_file, min_num_pixels, overview)) {
+        std::cout << "Using the GDAL overview of dimensions "
+                  << overview.rows() << ", " << overview.cols() << "\n";
+        sample = overview;
+      } else {
+        if (opt.use_overviews)
+          std::cout << "No suitable GDAL overview found. Using the image.\n";
+        
+        // Pick a uniform sample, with every samp_ratio-th row and column
+        int samp_ratio = 1;
+        if (opt.num_samples > 0) 
+          samp_ratio = round(sqrt(double(num_vals) / double(opt.num_samples)));
+        samp_ratio = std::max(samp_ratio, 1);
+        sample = image;
+        if (samp_ratio > 1)
+          sample = subsample(image, samp_ratio);
+        
+        std::cout << "Picking a uniform sample of dimensions "
+                  << sample.rows() << ", " << sample.cols() << "\n";
+      }
 
-      // A different implementation, which gives the same result
-      // if above the full image is sampled and 256 bins are used.
-      //double threshold2 = vw::otsu_threshold(create_mask(image, opt.nodata_value));
+      // The mask creation can handle a NaN for the opt.nodata_value.
+      ImageViewRef<PixelMask<float>> masked_sample = create_mask(sample, opt.nodata_value);
+      double min_val = 0.0, max_val = 0.0;
+      if (!asp::valid_pixel_range(masked_sample, min_val, max_val))
+        vw_throw(ArgumentErr() << "No valid pixels found in: " << image_file << "\n");
+
+      std::vector<std::int64_t> hist;
+      asp::tile_histogram(masked_sample, opt.num_bins, min_val, max_val, hist);
+      double threshold = asp::otsu_threshold(hist, min_val, max_val);
       
       vw_out() << std::setprecision(16)
         << "Otsu threshold for image " << image_file << ": " << threshold << "\n";
@@ -140,46 +140,58 @@ public: // Functions
 
   /// Apply pansharp algorithm to a single pair of pixels.
   /// - Any required interpolation etc. will have already happened by now.
-  template <class P1, class P2>
-  result_type convert_pixel(P1 const& gray_pixel, P2 const& color_pixel) const {
-    // Convert RGB to YCbCr
-    P2 temp = rgbToYCbCr(color_pixel, m_min_val, m_max_val);
-    result_type ycbcr_pixel(temp[0], temp[1], temp[2]); // Extra step breaks any type dependency from the inputs
-
-    // Replace Y channel with gray value
-    ycbcr_pixel[0] = gray_pixel[0];
-
-    // Convert YCbCr back to RGB
-    return ycbcrToRgb(ycbcr_pixel, m_min_val, m_max_val);
+  /// - This is rgbToYCbCr(), replacing Y with the gray value, and then
+  ///   ycbcrToRgb(), fused together. The original Y is not needed.
+  inline result_type convert_pixel(double gray, double r, double g, double b) const {
+
+    double min_val  = m_min_val, max_val = m_max_val;
+    double mean_val = (min_val + max_val+1) / 2.0;
+
+    // Convert RGB to CbCr, and constrain
+    double cb = mean_val - 0.168736*r - 0.331264*g + 0.5     *b;
+    double cr = mean_val + 0.5     *r - 0.418688*g - 0.081312*b;
+    cb = std::min(std::max(cb, min_val), max_val);
+    cr = std::min(std::max(cr, min_val), max_val);
+
+    // Convert the gray value and CbCr back to RGB, and constrain
+    double temp[3];
+    temp[0] = gray                              + 1.402   * (cr - mean_val);
+    temp[1] = gray - 0.34414 * (cb - mean_val) - 0.71414 * (cr - mean_val);
+    temp[2] = gray + 1.772   * (cb - mean_val);
+    result_type rgb;
+    for (int i=0; i<3; ++i)
+      rgb[i] = std::min(std::max(temp[i], min_val), max_val);
+    return rgb;
   }
 
 
   typedef CropView<ImageView<result_type> > prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
 
+    // Rasterize the inputs for this tile once. This resamples the color
+    // image for the whole tile, rather than for one pixel at a time.
+    ImageView<typename ImageGrayT::pixel_type > gray_tile  = crop(m_gray_image,  bbox);
+    ImageView<typename ImageColorT::pixel_type> color_tile = crop(m_color_image, bbox);
+
     // Set up the output image tile
     ImageView<result_type> tile(bbox.width(), bbox.height());
 
     // Loop through each output pixels and compute each output value
-    for (int c = 0; c < bbox.width(); c++) {
-      int source_c = c + bbox.min()[0];
-      for (int r = 0; r < bbox.height(); r++) {
-        int source_r = r + bbox.min()[1];
+    for (int r = 0; r < bbox.height(); r++) {
+      for (int c = 0; c < bbox.width(); c++) {
 
         // Check for a masked pixel
-        if ( !is_valid(m_gray_image (source_c, source_r)) ||
-             !is_valid(m_color_image(source_c, source_r))  ) {
+        if ( !is_valid(gray_tile(c, r)) || !is_valid(color_tile(c, r)) ) {
           tile(c, r) = m_output_nodata;
           continue;
         }
 
         // Pass the two input pixels into the conversion function
-        //result_type output_pixel = convert_pixel(m_gray_image(source_c, r), m_color_image(source_c, r));
-        tile(c,r) = convert_pixel(m_gray_image (source_c, source_r),
-                                  m_color_image(source_c, source_r));
+        tile(c, r) = convert_pixel(gray_tile(c, r)[0], color_tile(c, r)[0],
+                                   color_tile(c, r)[1], color_tile(c, r)[2]);
 
-      } // End row loop
-    } // End column loop
+      } // End column loop
+    } // End row loop
 
     // Return the tile we created with fake borders to make it look the size of the entire output image
     return prerasterize_type(tile,
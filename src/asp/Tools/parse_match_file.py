@@ -19,7 +19,7 @@
 # Thanks to Amaury Dehecq for contributing this tool.
 # Bugfix by PicoJr.
 
-import argparse, os, struct
+import argparse, os, struct, sys
 import numpy as np
 
 def read_ip_record(mf):
@@ -132,19 +132,130 @@ def write_match_file(outfile, im1_ip, im2_ip):
     for k in range(size2):
         write_ip_record(out, im2_ip[k])
     return
-        
+
+# The match database format. See asp/Core/MatchDatabase.h.
+MATCH_DB_MAGIC = b'ASPMDB01'
+
+def pad8(length):
+    return (length + 7) // 8 * 8
+
+def append_to_match_database(db_file, match_files, keep_descriptors):
+    """
+    Append the given match files to the match database, creating it if
+    needed. Each record is named after the match file, without the directory.
+    A later record with the same name replaces an earlier one.
+    """
+
+    is_new = (not os.path.exists(db_file)) or os.path.getsize(db_file) == 0
+    print("Writing: " + db_file)
+    with open(db_file, 'ab') as out:
+        if is_new:
+            out.write(MATCH_DB_MAGIC)
+
+        for match_file in match_files:
+            im1_ip, im2_ip = read_match_file(match_file)
+            all_ip = im1_ip + im2_ip
+
+            # Descriptors are kept only if all have the same length
+            desc_len = 0
+            if keep_descriptors and len(all_ip) > 0:
+                lens = set([len(iprec) - 11 for iprec in all_ip])
+                if len(lens) == 1:
+                    desc_len = lens.pop()
+
+            key = os.path.basename(match_file).encode('utf-8')
+            out.write(struct.pack('<IIQQ', len(key), desc_len, len(im1_ip), len(im2_ip)))
+            out.write(key + b'\0' * (pad8(len(key)) - len(key)))
+
+            # x, y, orientation, scale, interest, ix, iy, octave, scale_lvl, polarity
+            num_bytes = 0
+            for iprec in all_ip:
+                out.write(struct.pack('<fffffiiIIi', iprec[0], iprec[1], iprec[4],
+                                      iprec[5], iprec[6], iprec[2], iprec[3],
+                                      iprec[8], iprec[9], int(iprec[7])))
+                num_bytes += 40
+            if desc_len > 0:
+                for iprec in all_ip:
+                    out.write(struct.pack('<%df' % desc_len, *iprec[11:]))
+                    num_bytes += 4 * desc_len
+            out.write(b'\0' * (pad8(num_bytes) - num_bytes))
+
+def read_match_database(db_file):
+    """
+    Read the match database. Return a dictionary from the match file
+    name to the IP records for image1 and image2.
+    """
+
+    print("Reading: " + db_file)
+    with open(db_file, 'rb') as f:
+        data = f.read()
+    if data[0:8] != MATCH_DB_MAGIC:
+        raise Exception("Invalid match database: " + db_file)
+
+    matches = {}
+    offset = 8
+    while offset + 24 <= len(data):
+        key_len, desc_len, size1, size2 = struct.unpack_from('<IIQQ', data, offset)
+        offset += 24
+        key = data[offset:offset + key_len].decode('utf-8')
+        offset += pad8(key_len)
+
+        num_ip = size1 + size2
+        points = data[offset:offset + 40 * num_ip]
+        floats = np.frombuffer(points, dtype=np.float32).reshape(num_ip, 10)
+        ints = np.frombuffer(points, dtype=np.int32).reshape(num_ip, 10)
+        uints = np.frombuffer(points, dtype=np.uint32).reshape(num_ip, 10)
+        offset += 40 * num_ip
+        desc = np.frombuffer(data[offset:offset + 4 * num_ip * desc_len],
+                             dtype=np.float32).reshape(num_ip, desc_len)
+        offset += pad8(40 * num_ip + 4 * num_ip * desc_len) - 40 * num_ip
+
+        all_ip = []
+        for k in range(num_ip):
+            iprec = [floats[k][0], floats[k][1], ints[k][5], ints[k][6], floats[k][2],
+                     floats[k][3], floats[k][4], ints[k][9] != 0, uints[k][7], uints[k][8],
+                     desc_len]
+            iprec.extend(desc[k])
+            all_ip.append(iprec)
+        matches[key] = (all_ip[0:size1], all_ip[size1:])
+
+    return matches
+
 
 if __name__ == '__main__':
 
     #Set up arguments
-    parser = argparse.ArgumentParser(description='Convert an ASP (binary) match file into a text file. Use option -rev to do the reverse operation.')
-    parser.add_argument('infile', type=str, help='Path to the input file.')
-    parser.add_argument('outfile', type=str, help='Path to the output file.')
+    parser = argparse.ArgumentParser(description='Convert an ASP (binary) match file into a text file. Use option -rev to do the reverse operation. Can also pack match files into a match database, and unpack it.')
+    parser.add_argument('files', type=str, nargs='+',
+                        help='The input and output files, or the match files to pack.')
     parser.add_argument('-rev', dest='rev', help='Convert a text file into an ASP match file.',
                         action='store_true')
+    parser.add_argument('-pack', dest='pack', type=str, default='',
+                        help='Append the given match files to this match database.')
+    parser.add_argument('-unpack', dest='unpack', type=str, default='',
+                        help='Write the match files in this match database to the ' + \
+                        'given directory.')
+    parser.add_argument('-descriptors', dest='descriptors', action='store_true',
+                        help='When packing, keep the interest point descriptors.')
     args = parser.parse_args()
 
-    
+    if args.pack != '':
+        append_to_match_database(args.pack, args.files, args.descriptors)
+        sys.exit(0)
+
+    if args.unpack != '':
+        if len(args.files) != 1:
+            parser.error('Expecting one output directory.')
+        matches = read_match_database(args.unpack)
+        for key in sorted(matches.keys()):
+            write_match_file(os.path.join(args.files[0], key),
+                             matches[key][0], matches[key][1])
+        sys.exit(0)
+
+    if len(args.files) != 2:
+        parser.error('Expecting an input and an output file.')
+    args.infile, args.outfile = args.files
+
     if args.rev==False:
 
         # Read match file
@@ -37,6 +37,8 @@
 
 #include <limits>
 #include <cstring>
+#include <sstream>
+#include <cmath>
 #include <thread>
 #include <omp.h>
 
@@ -64,10 +66,12 @@ struct Options : public vw::GdalWriteOptions {
   PointMatcher<RealT>::Matrix init_transform;
   int    num_iter,
          max_num_reference_points,
-         max_num_source_points;
+         max_num_source_points,
+         num_pyramid_levels;
   double diff_translation_err, diff_rotation_err,
          max_disp, outlier_ratio, semi_major_axis,
-         semi_minor_axis, initial_rotation_angle;
+         semi_minor_axis, initial_rotation_angle,
+         pyramid_voxel_size;
   bool   compute_translation_only, dont_use_dem_distances,
          save_trans_source, save_trans_ref,
          highest_accuracy, verbose, skip_shared_box_estimation;
@@ -143,6 +147,15 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("skip-shared-box-estimation", po::bool_switch(&opt.skip_shared_box_estimation)->default_value(false)->implicit_value(true),
      "Do not estimate the shared bounding box of the two clouds. This estimation "
      "can be costly for large clouds but helps with eliminating outliers.")
+    ("num-pyramid-levels", po::value(&opt.num_pyramid_levels)->default_value(1),
+     "Align coarse-to-fine with this many levels. At each level except the last, both "
+     "clouds are replaced by the means of their points in cubes, with the cube size "
+     "doubling at each coarser level, and aligned starting from the transform of the "
+     "previous level. The last level uses the clouds at full resolution. Applies to the "
+     "point-to-plane and point-to-point methods and their similarity versions.")
+    ("pyramid-voxel-size", po::value(&opt.pyramid_voxel_size)->default_value(0.0),
+     "The cube size, in meters, at the finest coarse level for --num-pyramid-levels. "
+     "A good value is a few times the point spacing.")
     ("config-file", po::value(&opt.config_file)->default_value(""),
      "This is an advanced option. Read the alignment parameters from a configuration file, in the format expected by libpointmatcher, over-riding the command-line options.");
 
@@ -257,6 +270,28 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 	      << "Least squares alignment can be used only when the "
 	      << "reference cloud is a DEM.\n" );
 
+  if ((opt.save_trans_ref && asp::get_cloud_type(opt.reference) == "INDEX") ||
+      (opt.save_trans_source && asp::get_cloud_type(opt.source) == "INDEX"))
+    vw_throw( ArgumentErr()
+	      << "Cannot save the transformed points of a point index. Use the "
+	      << "cloud the index was made from.\n" );
+
+  if (opt.num_pyramid_levels < 1)
+    vw_throw( ArgumentErr() << "The number of pyramid levels must be positive.\n" );
+
+  if (opt.num_pyramid_levels > 1) {
+    if (opt.pyramid_voxel_size <= 0.0)
+      vw_throw( ArgumentErr() << "Must set a positive --pyramid-voxel-size "
+                << "when using more than one pyramid level.\n" );
+    if (opt.alignment_method != "point-to-plane"            &&
+        opt.alignment_method != "point-to-point"            &&
+        opt.alignment_method != "similarity-point-to-point" &&
+        opt.alignment_method != "similarity-point-to-plane")
+      vw_throw( ArgumentErr() << "The option --num-pyramid-levels is only applicable to "
+                << "point-to-plane, point-to-point, similarity-point-to-point, and "
+                << "similarity-point-to-plane alignment.\n" );
+  }
+
   int num_iter  = opt.initial_transform_ransac_params[0];
   double factor = opt.initial_transform_ransac_params[1];
   if (num_iter < 1 || factor <= 0.0)
@@ -393,25 +428,50 @@ void save_errors(DP const& point_cloud,
     outfile << "# Projection: " << geo.get_wkt() << std::endl;
   }
 
-  int numPts = point_cloud.features.cols();
-  for (int col = 0; col < numPts; col++){
-    Vector3 P = get_cloud_gcc_coord(point_cloud, shift, col);
-
-    if (csv_conv.is_configured()){
-      Vector3 csv = csv_conv.cartesian_to_csv(P, geo, median_longitude);
-      outfile << csv[0] << ',' << csv[1] << ',' << csv[2]
-              << "," << errors(0, col) << endl;
-    }else{
-      Vector3 llh = geo.datum().cartesian_to_geodetic(P); // lon-lat-height
-      llh[0] += 360.0*round((median_longitude - llh[0])/360.0); // 360 deg adjustment
-
-      if (is_lola_rdr_format)
-        outfile << llh[0] << ',' << llh[1] << ',' << norm_2(P)/1000.0
-                << "," << errors(0, col) << endl;
-      else
-        outfile << llh[1] << ',' << llh[0] << ',' << llh[2]
-                << "," << errors(0, col) << endl;
+  // Format the lines in parallel, in blocks, and write them in order. Each
+  // thread has its own copy of the georeference, as the projection it uses
+  // is not thread-safe.
+  std::int64_t numPts = point_cloud.features.cols();
+  const std::int64_t block_size = 10000, blocks_per_pass = 256;
+  std::int64_t num_blocks = (numPts + block_size - 1) / block_size;
+  std::vector<std::string> lines(std::min(num_blocks, blocks_per_pass));
+  for (std::int64_t pass_beg = 0; pass_beg < num_blocks; pass_beg += blocks_per_pass) {
+    std::int64_t pass_end = std::min(num_blocks, pass_beg + blocks_per_pass);
+
+    #pragma omp parallel
+    {
+      GeoReference local_geo = geo;
+
+      #pragma omp for schedule(dynamic)
+      for (std::int64_t block = pass_beg; block < pass_end; block++) {
+        std::ostringstream os;
+        os.precision(16);
+        std::int64_t end = std::min(numPts, (block + 1) * block_size);
+        for (std::int64_t col = block * block_size; col < end; col++) {
+          Vector3 P = get_cloud_gcc_coord(point_cloud, shift, col);
+
+          if (csv_conv.is_configured()){
+            Vector3 csv = csv_conv.cartesian_to_csv(P, local_geo, median_longitude);
+            os << csv[0] << ',' << csv[1] << ',' << csv[2]
+               << "," << errors(0, col) << "\n";
+          }else{
+            Vector3 llh = local_geo.datum().cartesian_to_geodetic(P); // lon-lat-height
+            llh[0] += 360.0*round((median_longitude - llh[0])/360.0); // 360 deg adjustment
+
+            if (is_lola_rdr_format)
+              os << llh[0] << ',' << llh[1] << ',' << norm_2(P)/1000.0
+                 << "," << errors(0, col) << "\n";
+            else
+              os << llh[1] << ',' << llh[0] << ',' << llh[2]
+                 << "," << errors(0, col) << "\n";
+          }
+        }
+        lines[block - pass_beg] = os.str();
+      }
     }
+
+    for (std::int64_t block = pass_beg; block < pass_end; block++)
+      outfile << lines[block - pass_beg];
   }
   outfile.close();
 }
@@ -430,26 +490,41 @@ void calcErrorsWithDem(DP                                 const& point_cloud,
   const std::int64_t num_pts = point_cloud.features.cols();
   errors.resize(num_pts);
 
-  // Loop through every point in the point cloud
-  double dem_height_here;
-  for (std::int64_t i = 0; i < num_pts; i++){
-    // Extract and un-shift the point to get the real GCC coordinate
-    Vector3 gcc_coord = get_cloud_gcc_coord(point_cloud, point_cloud_shift, i);
-
-    // Convert from GDC to GCC
-    Vector3 llh = georef.datum().cartesian_to_geodetic(gcc_coord); // lon-lat-height
-
-    // Interpolate the point at this location
-    if (!interp_dem_height(dem, georef, llh, dem_height_here)) {
-      // If we did not intersect the DEM, record a flag error value here.
-      errors[i] = BIG_NUMBER;
-    }
-    else { // Success, the error is the absolute height difference
-      errors[i] = std::abs(llh[2] - dem_height_here);
+  // Process the points in blocks, in parallel. Each thread has its own copy
+  // of the georeference, as the projection it uses is not thread-safe.
+  const std::int64_t block_size = 10000;
+  std::int64_t num_blocks = (num_pts + block_size - 1) / block_size;
+  #pragma omp parallel
+  {
+    vw::cartography::GeoReference local_georef = georef;
+    std::vector<Vector3> llh; // lon-lat-height
+    std::vector<double> dem_heights;
+
+    #pragma omp for schedule(dynamic)
+    for (std::int64_t block = 0; block < num_blocks; block++) {
+      std::int64_t beg = block * block_size;
+      std::int64_t end = std::min(num_pts, beg + block_size);
+
+      // Extract and un-shift the points to get the real GCC coordinates,
+      // and convert them to GDC
+      llh.resize(end - beg);
+      for (std::int64_t i = beg; i < end; i++)
+        llh[i - beg] = local_georef.datum().cartesian_to_geodetic
+          (get_cloud_gcc_coord(point_cloud, point_cloud_shift, i));
+
+      // Interpolate the DEM at these locations. If a point did not intersect
+      // the DEM, record a flag error value. Otherwise the error is the
+      // absolute height difference.
+      interp_dem_heights(dem, local_georef, llh, dem_heights);
+      for (std::int64_t i = beg; i < end; i++) {
+        double dem_height = dem_heights[i - beg];
+        if (std::isnan(dem_height))
+          errors[i] = BIG_NUMBER;
+        else
+          errors[i] = std::abs(llh[i - beg][2] - dem_height);
+      }
     }
-
-  } // End loop through all points
-
+  }
 }
 
 /// Filters out all points from point_cloud with an error entry higher than cutoff
@@ -608,6 +683,45 @@ std::string alignment_method_fallback(std::string const& alignment_method){
   return alignment_method;
 }
 
+// Set the ICP parameters from the command line or the configuration file
+void set_icp_params(Options const& opt, PM::ICP & icp) {
+  if (opt.config_file == ""){
+    // Read the options from the command line
+    icp.setParams(opt.out_prefix, opt.num_iter, opt.outlier_ratio,
+                  (2.0*M_PI/360.0)*opt.diff_rotation_err, // convert to radians
+                  opt.diff_translation_err, alignment_method_fallback(opt.alignment_method),
+                  false/*opt.verbose*/);
+  }else{
+    vw_out() << "Will read the options from: " << opt.config_file << endl;
+    ifstream ifs(opt.config_file.c_str());
+    if (!ifs.good())
+      vw_throw( ArgumentErr() << "Cannot open configuration file: "
+                << opt.config_file << "\n" );
+    icp.loadFromYaml(ifs);
+  }
+}
+
+// Align coarse versions of the clouds, with the points in each cube of
+// given size replaced by their mean, starting from the given transform.
+PointMatcher<RealT>::Matrix
+pyramid_level_icp(Options const& opt, double voxel_size,
+                  DP const& ref_point_cloud, DP const& source_point_cloud,
+                  PointMatcher<RealT>::Matrix const& initT) {
+
+  DP ref_level, source_level;
+  voxel_downsample(ref_point_cloud, voxel_size, ref_level);
+  voxel_downsample(source_point_cloud, voxel_size, source_level);
+  vw_out() << "Aligning with cube size " << voxel_size << " meters, using "
+           << ref_level.features.cols() << " reference and "
+           << source_level.features.cols() << " source points.\n";
+
+  PM::ICP icp;
+  icp.initRefTree(ref_level, alignment_method_fallback(opt.alignment_method),
+                  opt.highest_accuracy, false /*opt.verbose*/);
+  set_icp_params(opt, icp);
+  return icp(source_level, ref_level, initT, opt.compute_translation_only);
+}
+
 // Hillshade the reference and source DEMs, and use them to find
 // interest point matches among the hillshaded images.  These will be
 // used later to find a rotation + translation + scale transform.
@@ -1051,7 +1165,18 @@ int main( int argc, char *argv[] ) {
       vw_out() << "Loading reference as DEM." << endl;
       // Load the dem, then wrap it inside an ImageViewRef object.
       // - This is done because the actual DEM type cannot be created without being initialized.
-      InterpolationReadyDem reference_dem(load_interpolation_ready_dem(opt.reference, dem_georef));
+      // Read in memory only the DEM window around the points which will be
+      // looked up in it. Sample them, as only their extent matters.
+      std::vector<Vector3> xyz_vec;
+      DP const* clouds[2] = {&ref_point_cloud, &source_point_cloud};
+      for (int c = 0; c < 2; c++) {
+        std::int64_t num_pts = clouds[c]->features.cols();
+        std::int64_t stride = std::max(std::int64_t(1), num_pts / 1000000);
+        for (std::int64_t i = 0; i < num_pts; i += stride)
+          xyz_vec.push_back(get_cloud_gcc_coord(*clouds[c], shift, i));
+      }
+      InterpolationReadyDem reference_dem(load_interpolation_ready_dem(opt.reference, xyz_vec,
+                                                                       dem_georef));
       reference_dem_ref.reset(reference_dem);
     }
 
@@ -1115,33 +1240,28 @@ int main( int argc, char *argv[] ) {
     Stopwatch sw4;
     sw4.start();
     PointMatcher<RealT>::Matrix Id = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
-    if (opt.config_file == ""){
-      // Read the options from the command line
-      icp.setParams(opt.out_prefix, opt.num_iter, opt.outlier_ratio,
-                    (2.0*M_PI/360.0)*opt.diff_rotation_err, // convert to radians
-                    opt.diff_translation_err, alignment_method_fallback(opt.alignment_method),
-                    false/*opt.verbose*/);
-    }else{
-      vw_out() << "Will read the options from: " << opt.config_file << endl;
-      ifstream ifs(opt.config_file.c_str());
-      if (!ifs.good())
-        vw_throw( ArgumentErr() << "Cannot open configuration file: "
-                  << opt.config_file << "\n" );
-      icp.loadFromYaml(ifs);
-    }
+    set_icp_params(opt, icp);
 
     // We bypass calling ICP if the user explicitely asks for 0 iterations.
     PointMatcher<RealT>::Matrix T = Id;
     if (opt.num_iter > 0){
       if (opt.alignment_method == "fgr") {
-        T = fgr_alignment(source_point_cloud, ref_point_cloud, opt.fgr_options);
+        T = fgr_alignment(source_point_cloud, ref_point_cloud, shift, opt.fgr_options);
       } else if (opt.alignment_method == "point-to-plane" ||
                  opt.alignment_method == "point-to-point" ||
                  opt.alignment_method == "similarity-point-to-point" ||
                  opt.alignment_method == "similarity-point-to-plane") {
         // Use libpointmatcher
         try {
-          T = icp(source_point_cloud, ref_point_cloud, Id, opt.compute_translation_only);
+          // Go from coarse to fine, if desired. The transform found at
+          // each level is the initial guess for the next one.
+          PointMatcher<RealT>::Matrix levelT = Id;
+          for (int level = opt.num_pyramid_levels - 1; level >= 1; level--) {
+            double voxel_size = opt.pyramid_voxel_size * pow(2.0, level - 1);
+            levelT = pyramid_level_icp(opt, voxel_size, ref_point_cloud,
+                                       source_point_cloud, levelT);
+          }
+          T = icp(source_point_cloud, ref_point_cloud, levelT, opt.compute_translation_only);
         } catch(std::exception const& e) {
           std::string error = e.what();
           if (error.find(libpointmatcher_error) != std::string::npos)
@@ -45,6 +45,8 @@
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
 
+#include <omp.h>
+
 #include <limits>
 
 using namespace vw;
@@ -145,8 +147,9 @@ void applyAffineTransform(ImageView<Vector<double, 4>> & pc, vw::Matrix<double>
   if (T.rows() != 4 && T.cols() != 4 && T(3, 3) != 1.0)
     vw_throw(ArgumentErr() << "Expecting a 4x4 affine transform.");
 
-  for (int col = 0; col < pc.cols(); col++) {
-    for (int row = 0; row < pc.rows(); row++) {
+  #pragma omp parallel for
+  for (int row = 0; row < pc.rows(); row++) {
+    for (int col = 0; col < pc.cols(); col++) {
       
       if (subvector(pc(col, row), 0, 3) == Vector3())
         continue; // outlier
@@ -212,8 +215,9 @@ void estimate_surface_res(ImageView<Vector<double, 4>> const& point_image,
   int offset_y[] = {0, -1, 1, 0};
   
   surface_res = ImageView<float>(point_image.cols(), point_image.rows());
-  for (int col = 0; col < surface_res.cols(); col++) {
-    for (int row = 0; row < surface_res.rows(); row++) {
+  #pragma omp parallel for
+  for (int row = 0; row < surface_res.rows(); row++) {
+    for (int col = 0; col < surface_res.cols(); col++) {
 
       surface_res(col, row) = 0.0;
 
@@ -253,6 +257,11 @@ int main(int argc, char *argv[]) {
   try {
     handle_arguments(argc, argv, opt);
 
+    // The filtering is multi-threaded with OpenMP, with the thread count
+    // from --threads
+    omp_set_dynamic(0);
+    omp_set_num_threads(vw_settings().default_num_threads());
+
     // For now only 4 channels are supported
     // TODO(oalexan1): Support also 3 channels
     int num_channels = get_num_channels(opt.input_cloud);
@@ -311,8 +320,9 @@ int main(int argc, char *argv[]) {
     ImageView<float> weight(point_image.cols(), point_image.rows());
     ImageView<float> out_texture(point_image.cols(), point_image.rows());
     ImageView<Vector<double, 4>> clean_points(point_image.cols(), point_image.rows());
-    for (int col = 0; col < point_image.cols(); col++) {
-      for (int row = 0; row < point_image.rows(); row++) {
+    #pragma omp parallel for
+    for (int row = 0; row < point_image.rows(); row++) {
+      for (int col = 0; col < point_image.cols(); col++) {
         weight(col, row) = 0.0;
         out_texture(col, row) = 0.0;
         clean_points(col, row) = Vector<double, 4>();
@@ -326,8 +336,10 @@ int main(int argc, char *argv[]) {
     // Camera direction, in camera's coordinate system
     Vector3 cam_dir(0.0, 0.0, 1.0);
 
-    for (int col = 0; col < point_image.cols(); col++) {
-      for (int row = 0; row < point_image.rows(); row++) {
+    // Each point is filtered on its own, so the rows are done in parallel
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (int row = 0; row < point_image.rows(); row++) {
+      for (int col = 0; col < point_image.cols(); col++) {
         
         Vector<double, 4> const& P = point_image(col, row); // alias
         if (subvector(P, 0, 3) == Vector3() ||
@@ -404,8 +416,9 @@ int main(int argc, char *argv[]) {
 
     if (opt.blending_dist > 0 && opt.blending_power > 0) {
       ImageView<int> mask(clean_points.cols(), clean_points.rows());
-      for (int col = 0; col < clean_points.cols(); col++) {
-        for (int row = 0; row < clean_points.rows(); row++) {
+      #pragma omp parallel for
+      for (int row = 0; row < clean_points.rows(); row++) {
+        for (int col = 0; col < clean_points.cols(); col++) {
           mask(col, row) = (subvector(clean_points(col, row), 0, 3) != Vector3());
         }
       }
@@ -413,8 +426,9 @@ int main(int argc, char *argv[]) {
       vw::bounded_dist(mask, opt.blending_dist, dist);
       
       // Adjust the weight by the normalized distance raised to given power
-      for (int col = 0; col < dist.cols(); col++) {
-        for (int row = 0; row < dist.rows(); row++) {
+      #pragma omp parallel for
+      for (int row = 0; row < dist.rows(); row++) {
+        for (int col = 0; col < dist.cols(); col++) {
           dist(col, row) = pow(dist(col, row) / opt.blending_dist, opt.blending_power);
           weight(col, row) *= dist(col, row);
         }
@@ -423,8 +437,9 @@ int main(int argc, char *argv[]) {
     }
 
     if (opt.reliable_surface_resolution > 0) {
-      for (int col = 0; col < weight.cols(); col++) {
-        for (int row = 0; row < weight.rows(); row++) {
+      #pragma omp parallel for
+      for (int row = 0; row < weight.rows(); row++) {
+        for (int col = 0; col < weight.cols(); col++) {
           if (weight(col, row) <= 0) 
             continue;
           
@@ -0,0 +1,142 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file pc_index.cc
+///
+/// Make a spatial index of a point cloud, to be used as the reference
+/// cloud in pc_align. Then only the part of the cloud near the source
+/// cloud is read, with no parsing of the original cloud.
+
+#include <asp/Core/Macros.h>
+#include <asp/Core/Common.h>
+#include <asp/Core/PointUtils.h>
+#include <asp/Core/PointIndex.h>
+#include <asp/PcAlign/pc_align_utils.h>
+
+#include <vw/Core/Stopwatch.h>
+#include <vw/Cartography/GeoReference.h>
+
+using namespace vw;
+using namespace vw::cartography;
+namespace po = boost::program_options;
+
+struct Options: public vw::GdalWriteOptions {
+  std::string input_cloud, output_file, datum, csv_format_str, csv_proj4_str;
+  double semi_major_axis, semi_minor_axis;
+  std::int64_t max_num_points;
+  Options(): semi_major_axis(0), semi_minor_axis(0), max_num_points(0) {}
+};
+
+void handle_arguments(int argc, char *argv[], Options& opt) {
+
+  po::options_description general_options("");
+  general_options.add_options()
+    ("output-file,o",   po::value(&opt.output_file)->default_value(""),
+     "The output index. Must have the .pcidx extension.")
+    ("max-num-points",  po::value(&opt.max_num_points)->default_value(100000000),
+     "Maximum number of (evenly picked) points to put in the index.")
+    ("csv-format",      po::value(&opt.csv_format_str)->default_value(""),
+     asp::csv_opt_caption().c_str())
+    ("csv-proj4",       po::value(&opt.csv_proj4_str)->default_value(""),
+     "The PROJ.4 string to use to interpret the entries in an input CSV file.")
+    ("datum",           po::value(&opt.datum)->default_value(""),
+     "Use this datum for a CSV file instead of auto-detecting it. Options: WGS_1984, D_MOON (1,737,400 meters), D_MARS (3,396,190 meters), MOLA (3,396,000 meters), NAD83, WGS72, and NAD27. Also accepted: Earth (=WGS_1984), Mars (=D_MARS), Moon (=D_MOON).")
+    ("semi-major-axis", po::value(&opt.semi_major_axis)->default_value(0),
+     "Explicitly set the datum semi-major axis in meters.")
+    ("semi-minor-axis", po::value(&opt.semi_minor_axis)->default_value(0),
+     "Explicitly set the datum semi-minor axis in meters.");
+
+  general_options.add(vw::GdalWriteOptionsDescription(opt));
+
+  po::options_description positional("");
+  positional.add_options()
+    ("input-cloud", po::value(&opt.input_cloud), "The input point cloud/DEM.");
+
+  po::positional_options_description positional_desc;
+  positional_desc.add("input-cloud", 1);
+
+  std::string usage("<input cloud> -o <output.pcidx> [options]");
+  bool allow_unregistered = false;
+  std::vector<std::string> unregistered;
+  po::variables_map vm =
+    asp::check_command_line(argc, argv, opt, general_options, general_options,
+                            positional, positional_desc, usage,
+                            allow_unregistered, unregistered);
+
+  if (opt.input_cloud.empty())
+    vw_throw(ArgumentErr() << "Missing input cloud.\n" << usage << general_options);
+
+  if (!asp::is_point_index(opt.output_file))
+    vw_throw(ArgumentErr() << "The output file must have the .pcidx extension.\n"
+             << usage << general_options);
+
+  if (asp::is_point_index(opt.input_cloud))
+    vw_throw(ArgumentErr() << "The input cloud is already a point index.\n");
+
+  if (opt.max_num_points <= 0)
+    vw_throw(ArgumentErr() << "The maximum number of points must be positive.\n");
+
+  if ((opt.semi_major_axis != 0 && opt.semi_minor_axis == 0) ||
+      (opt.semi_minor_axis != 0 && opt.semi_major_axis == 0))
+    vw_throw(ArgumentErr() << "One of the semi-major or semi-minor axes"
+             << " was specified, but not the other one.\n");
+
+  vw::create_out_dir(opt.output_file);
+}
+
+int main(int argc, char *argv[]) {
+
+  Options opt;
+  try {
+    handle_arguments(argc, argv, opt);
+
+    asp::CsvConv csv_conv;
+    csv_conv.parse_csv_format(opt.csv_format_str, opt.csv_proj4_str);
+
+    // The datum is needed to find the lon-lat of the points
+    GeoReference geo;
+    std::vector<std::string> clouds;
+    clouds.push_back(opt.input_cloud);
+    asp::read_georef(clouds, opt.datum, opt.csv_proj4_str,
+                     opt.semi_major_axis, opt.semi_minor_axis,
+                     opt.csv_format_str, csv_conv, geo);
+    if (geo.datum().name() == asp::UNSPECIFIED_DATUM)
+      vw_throw(ArgumentErr() << "Cannot detect the datum. Please specify it via "
+               << "--csv-proj4 or --datum or --semi-major-axis and --semi-minor-axis.\n");
+
+    // Load the points with no shift
+    Stopwatch sw;
+    sw.start();
+    bool calc_shift = false, verbose = true, is_lola_rdr_format = false;
+    vw::Vector3 shift;
+    double median_longitude = 0.0;
+    vw::BBox2 empty_box;
+    asp::DoubleMatrix points;
+    asp::load_cloud(opt.input_cloud, opt.max_num_points, empty_box,
+                    calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
+                    median_longitude, verbose, points);
+
+    vw_out() << "Writing: " << opt.output_file << "\n";
+    asp::writePointIndex(opt.output_file, geo.datum(), median_longitude, points);
+    sw.stop();
+    vw_out() << "Indexed " << points.cols() << " points in "
+             << sw.elapsed_seconds() << " seconds.\n";
+
+  } ASP_STANDARD_CATCHES;
+
+  return 0;
+}
@@ -90,23 +90,51 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 }
 
 
-/// Throws if the input point clouds do not have the same number of channels.
-/// - Returns the number of channels.
-int check_num_channels(std::vector<std::string> const& pc_files){
+/// What is needed from the header of each input cloud
+struct CloudInfo {
+  int num_channels;
+  bool has_shift, has_georef;
+  vw::Vector3 shift;
+  vw::cartography::GeoReference georef;
+  CloudInfo(): num_channels(0), has_shift(false), has_georef(false) {}
+};
+
+/// Read the headers of all input clouds, opening each file only once. With
+/// hundreds of clouds from a parallel_stereo run this matters.
+void read_cloud_info(std::vector<std::string> const& pc_files,
+                     std::vector<CloudInfo> & infos) {
   VW_ASSERT(pc_files.size() >= 1,
             ArgumentErr() << "Expecting at least one file.\n");
 
-  int target_num = get_num_channels(pc_files[0]);
-  for (int i = 1; i < (int)pc_files.size(); ++i){
-    int num_channels = get_num_channels(pc_files[i]);
-    if (num_channels != target_num)
+  infos.clear();
+  infos.resize(pc_files.size());
+  for (size_t i = 0; i < pc_files.size(); i++) {
+    vw::DiskImageResourceGDAL rsrc(pc_files[i]);
+    CloudInfo & info = infos[i];
+    info.num_channels = rsrc.format().planes * vw::num_channels(rsrc.format().pixel_format);
+    std::string shift_str;
+    if (vw::cartography::read_header_string(rsrc, asp::ASP_POINT_OFFSET_TAG_STR, shift_str)) {
+      info.shift = asp::str_to_vec<vw::Vector3>(shift_str);
+      info.has_shift = true;
+    }
+    info.has_georef = vw::cartography::read_georeference(info.georef, rsrc);
+  }
+}
+
+/// Throws if the input point clouds do not have the same number of channels.
+/// - Returns the number of channels.
+int check_num_channels(std::vector<CloudInfo> const& infos){
+
+  int target_num = infos[0].num_channels;
+  for (int i = 1; i < (int)infos.size(); ++i){
+    if (infos[i].num_channels != target_num)
       vw_throw( ArgumentErr() << "Input point clouds must all have the same number of channels!.\n" );
   }
   return target_num;
 }
 
 /// Determine the common shift value to use for the output files
-Vector3 determine_output_shift(std::vector<std::string> const& pc_files, Options const& opt){
+Vector3 determine_output_shift(std::vector<CloudInfo> const& infos, Options const& opt){
 
   // If writing to double format, no shift is needed.
   if (opt.write_double)
@@ -114,15 +142,12 @@ Vector3 determine_output_shift(std::vector<std::string> const& pc_files, Options
 
   // As an approximation, compute the mean shift vector of the input files.
   // - If none of the input files have a shift, the output file will be written as a double.
-  vw::Vector3 shift(0,0,0), shiftIn;
+  vw::Vector3 shift(0,0,0);
   double shift_count = 0;
-  for (size_t i=0; i<pc_files.size(); ++i) {
-    // Read in the shift from each cloud and accumulate them
-    std::string shift_str;
-    boost::shared_ptr<vw::DiskImageResource> rsrc( new vw::DiskImageResourceGDAL(pc_files[i]) );
-    if (vw::cartography::read_header_string(*rsrc.get(), asp::ASP_POINT_OFFSET_TAG_STR, shift_str)){
-      //std::cout << "shift string = " << shift_str << std::endl;
-      shift += asp::str_to_vec<vw::Vector3>(shift_str);
+  for (size_t i=0; i<infos.size(); ++i) {
+    // Accumulate the shift from each cloud
+    if (infos[i].has_shift) {
+      shift += infos[i].shift;
       shift_count += 1.0;
     }
   }
@@ -141,7 +166,7 @@ Vector3 determine_output_shift(std::vector<std::string> const& pc_files, Options
 // Case 1: Single-channel cloud.
 template <class PixelT>
 typename boost::enable_if<boost::is_same<PixelT, vw::PixelGray<float> >, void >::type
-do_work(Vector3 const& shift, Options const& opt) {
+do_work(Vector3 const& shift, std::vector<CloudInfo> const& infos, Options const& opt) {
   // The spacing is selected to be compatible with the point2dem convention.
   const int spacing = ASP_MAX_SUBBLOCK_SIZE;
   ImageViewRef<PixelT> merged_cloud = asp::form_point_cloud_composite<PixelT>(opt.pointcloud_files, spacing);
@@ -160,7 +185,7 @@ do_work(Vector3 const& shift, Options const& opt) {
 // Case 2: Multi-channel cloud.
 template <class PixelT>
 typename boost::disable_if<boost::is_same<PixelT, vw::PixelGray<float> >, void >::type
-do_work(Vector3 const& shift, Options const& opt) {
+do_work(Vector3 const& shift, std::vector<CloudInfo> const& infos, Options const& opt) {
   // The spacing is selected to be compatible with the point2dem convention.
   const int spacing = ASP_MAX_SUBBLOCK_SIZE;
   ImageViewRef<PixelT> merged_cloud = asp::form_point_cloud_composite<PixelT>(opt.pointcloud_files, spacing);
@@ -170,11 +195,9 @@ do_work(Vector3 const& shift, Options const& opt) {
   // and projection.
   bool has_georef = false;
   cartography::GeoReference georef;
-  for (size_t i = 0; i < opt.pointcloud_files.size(); i++){
-    cartography::GeoReference local_georef;
-
-    if (read_georeference(local_georef, opt.pointcloud_files[i])){
-      georef = local_georef;
+  for (size_t i = 0; i < infos.size(); i++){
+    if (infos[i].has_georef){
+      georef = infos[i].georef;
       has_georef = true;
     }
   }
@@ -202,21 +225,25 @@ int main( int argc, char *argv[] ) {
   try {
     handle_arguments( argc, argv, opt );
 
+    // Read the input headers
+    std::vector<CloudInfo> infos;
+    read_cloud_info(opt.pointcloud_files, infos);
+
     // Determine the number of channels
-    int num_channels = check_num_channels(opt.pointcloud_files);
+    int num_channels = check_num_channels(infos);
 
     // Determine the output shift (if any)
-    Vector3 shift = determine_output_shift(opt.pointcloud_files, opt);
+    Vector3 shift = determine_output_shift(infos, opt);
 
     // The code has to branch here depending on the number of channels
     switch (num_channels)
     {
       // The input point clouds have their shift incorporated and are stored as doubles.
       // If the output file is stored as float, it needs to have a single shift value applied.
-      case 1:  do_work< vw::PixelGray<float> >(shift, opt); break;
-      case 3:  do_work<Vector3>(shift, opt); break;
-      case 4:  do_work<Vector4>(shift, opt); break;
-      case 6:  do_work<Vector6>(shift, opt); break;
+      case 1:  do_work< vw::PixelGray<float> >(shift, infos, opt); break;
+      case 3:  do_work<Vector3>(shift, infos, opt); break;
+      case 4:  do_work<Vector4>(shift, infos, opt); break;
+      case 6:  do_work<Vector6>(shift, infos, opt); break;
       default: vw_throw( ArgumentErr() << "Unsupported number of channels!.\n" );
     }
 
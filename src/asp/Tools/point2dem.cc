@@ -38,6 +38,7 @@
 
 #include <boost/math/special_functions/fpclassify.hpp>
 #include <limits>
+#include <sstream>
 
 using namespace vw;
 using namespace asp;
@@ -146,6 +147,8 @@ void handle_arguments(int argc, char *argv[], DemOptions& opt) {
     ("output-prefix,o",   po::value(&opt.out_prefix),
      "Specify the output prefix.")
     ("output-filetype,t", po::value(&opt.output_file_type)->default_value("tif"), "Specify the output file.")
+    ("cog", po::bool_switch(&opt.cog)->default_value(false),
+     "Write the outputs as Cloud-Optimized GeoTIFFs, with internal overviews.")
     ("errorimage",        po::bool_switch(&opt.do_error)->default_value(false),
     "Write an additional image, whose values represent the triangulation ray "
     "intersection error in meters (the closest distance between the rays "
@@ -199,6 +202,10 @@ void handle_arguments(int argc, char *argv[], DemOptions& opt) {
      "Oversampling amount to perform antialiasing (obsolete).")
     ("no-dem", po::bool_switch(&opt.no_dem)->default_value(false),
      "Skip writing a DEM.")
+    ("profile-report", po::value(&opt.profile_report)->default_value(""),
+     "Save in this JSON file the wall time, CPU time, bytes read, and peak memory usage for each stage, and the times and number of points binned for each DEM tile.")
+    ("fused-rasterization", po::bool_switch(&opt.fused_rasterization)->default_value(false),
+     "Grid the DEM, and the intersection error, stddev, and orthoimage, if requested, in one pass over the point cloud, rather than reading it once for each output. Not for the error as a 3D vector, an orthoimage with hole-filling, or with --use-surface-sampling or --fsaa.")
     ("input-is-projected", po::bool_switch(&opt.input_is_projected)->default_value(false), 
      "Input data is already in projected coordinates, or is a point cloud in Cartesian "
      "coordinates that is small in extent. See the doc for more info.");
@@ -245,6 +252,9 @@ void handle_arguments(int argc, char *argv[], DemOptions& opt) {
              << usage << general_options);
   }
 
+  if (opt.cog && opt.output_file_type != "tif")
+    vw_throw(ArgumentErr() << "The option --cog requires the output file type to be tif.\n");
+
   if (opt.erode_len < 0){
     vw_throw(ArgumentErr() << "Erode length must be non-negative.\n"
                             << usage << general_options);
@@ -416,6 +426,8 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
   // Need to pass in by pointer because we can't get back the number from
   //  the original rasterizer object otherwise for some reason.
   std::int64_t num_invalid_pixels = 0;
+  boost::shared_ptr<asp::ProfileStage>
+    setup_stage(new asp::ProfileStage(opt.profiler, "RasterizerSetup"));
   asp::OrthoRasterizerView
     rasterizer(proj_points.impl(), select_channel(proj_points.impl(),2),
                opt.search_radius_factor, opt.sigma_factor, opt.use_surface_sampling,
@@ -429,8 +441,10 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
                TerminalProgressCallback("asp", "Point cloud extent estimation: "));
 
   sw1.stop();
+  setup_stage.reset();
   vw_out(DebugMessage,"asp") << "Extent estimation time: " 
     << sw1.elapsed_seconds() << " s.\n";
+  rasterizer.set_profiler(opt.profiler);
   
   // Perform other rasterizer configuration
   rasterizer.set_use_alpha(opt.has_alpha);
@@ -439,10 +453,21 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
 
   std::string base_out_prefix = opt.out_prefix;
 
-  // Call the function for each dem spacing
+  // Call the function for each dem spacing. The block boundaries index and
+  // the outlier statistics found above are shared by all of them.
   for (size_t i = 0; i < opt.dem_spacing.size(); i++) {
     double this_spacing = opt.dem_spacing[i];
 
+    // Writing the intersection error and orthoimage replaces the texture
+    // and possibly the point image of the rasterizer. Restore them, so each
+    // spacing grids the heights of the original cloud.
+    if (i > 0) {
+      vw_out() << "Reusing the point cloud extent and outlier statistics for "
+               << "the next DEM spacing.\n";
+      rasterizer.set_point_image(proj_points.impl());
+      rasterizer.set_texture(select_channel(proj_points.impl(), 2));
+    }
+
     // Required second init step for each spacing
     rasterizer.initialize_spacing(this_spacing);
 
@@ -483,10 +508,12 @@ void set_projection(DemOptions const& opt, cartography::GeoReference & output_ge
   return;
 } 
 
-int main(int argc, char *argv[]) {
+int point2dem_main(int argc, char *argv[]) {
   DemOptions opt;
   try {
     handle_arguments(argc, argv, opt);
+    if (!opt.profile_report.empty())
+      opt.profiler.reset(new asp::RunProfiler);
 
     // Set up the georeferencing information. We specify everything
     // here except for the affine transform, which is defined later once
@@ -539,7 +566,10 @@ int main(int argc, char *argv[]) {
     // - Should all be XYZ format when finished, unless option 
     //  --input-is-projected is set.
     std::vector<std::string> tmp_tifs;
-    chip_convert_to_tif(opt, output_georef.datum(), tmp_tifs);
+    {
+      asp::ProfileStage stage(opt.profiler, "CloudConversion");
+      chip_convert_to_tif(opt, output_georef.datum(), tmp_tifs);
+    }
 
     // Generate a merged xyz point cloud consisting of all inputs
     // - By now, each input exists in xyz tif format.
@@ -579,7 +609,11 @@ int main(int argc, char *argv[]) {
     // [-180, 180] or [0,360]. The former is used, unless the latter
     // results in a tighter range of longitudes, such as when crossing
     // the international date line.
-    vw::BBox2 lonlat_box = asp::estim_lonlat_box(point_image, output_georef.datum());
+    vw::BBox2 lonlat_box;
+    {
+      asp::ProfileStage stage(opt.profiler, "LonLatBoxEstimation");
+      lonlat_box = asp::estim_lonlat_box(point_image, output_georef.datum());
+    }
     output_georef.set_image_ll_box(lonlat_box);
     
     // TODO: Do we need the recenter code now that we have this?
@@ -619,12 +653,38 @@ int main(int argc, char *argv[]) {
       }
     }
 
-    // Estimate the proj box size, and the max intersection error (if having an error iamge)
+    // Estimate the proj box size, and the max intersection error (if having an
+    // error iamge). This is cached next to the input cloud, unless the cloud
+    // was converted to temporary files, and reused if nothing changed.
     double estim_max_error = 0.0;
     BBox3 estim_proj_box;
-    estim_max_error = asp::estim_max_tri_error_and_proj_box(proj_points, error_image,
-                                                         opt.remove_outliers_params,
-                                                         estim_proj_box);
+    std::string estim_cache_file, estim_key;
+    if (tmp_tifs.empty()) {
+      estim_cache_file = fs::path(opt.pointcloud_files[0]).replace_extension("").string()
+        + "-estim-box.txt";
+      std::ostringstream os;
+      os.precision(17);
+      os << output_georef.get_wkt() << " " << opt.input_is_projected << " "
+         << opt.rot_order << " " << opt.phi_rot << " " << opt.omega_rot << " "
+         << opt.kappa_rot << " " << opt.lon_offset << " " << opt.lat_offset << " "
+         << opt.height_offset << " " << opt.remove_outliers_params << " "
+         << (error_image.cols() > 0);
+      estim_key = asp::estim_cache_key(opt.pointcloud_files, os.str());
+    }
+    if (!estim_cache_file.empty() &&
+        asp::read_estim_max_tri_error_and_proj_box(estim_cache_file, estim_key,
+                                                   estim_max_error, estim_proj_box)) {
+      vw_out() << "Read the bounding box and triangulation error estimates from: "
+               << estim_cache_file << "\n";
+    } else {
+      asp::ProfileStage stage(opt.profiler, "ExtentAndErrorEstimation");
+      estim_max_error = asp::estim_max_tri_error_and_proj_box(proj_points, error_image,
+                                                              opt.remove_outliers_params,
+                                                              estim_proj_box);
+      if (!estim_cache_file.empty())
+        asp::write_estim_max_tri_error_and_proj_box(estim_cache_file, estim_key,
+                                                    estim_max_error, estim_proj_box);
+    }
     // Create the DEM
     do_software_rasterization_multi_spacing(proj_points, opt, output_georef, error_image,
                                             estim_max_error, estim_proj_box);
@@ -632,8 +692,17 @@ int main(int argc, char *argv[]) {
     for (int i = 0; i < (int)tmp_tifs.size(); i++)
       if (fs::exists(tmp_tifs[i])) 
         fs::remove(tmp_tifs[i]);
+
+    if (opt.profiler) {
+      vw_out() << "Writing: " << opt.profile_report << "\n";
+      opt.profiler->writeJson(opt.profile_report);
+    }
     
   } ASP_STANDARD_CATCHES;
 
   return 0;
 }
+
+int main(int argc, char *argv[]) {
+  return asp::run_batch(argc, argv, point2dem_main);
+}
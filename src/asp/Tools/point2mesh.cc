@@ -35,6 +35,12 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 
+#include <omp.h>
+
+#include <exception>
+#include <fstream>
+#include <sstream>
+
 using namespace vw;
 using namespace vw::cartography;
 namespace po = boost::program_options;
@@ -45,7 +51,7 @@ struct Options : vw::GdalWriteOptions {
   std::string pointcloud_filename, texture_file_name;
 
   // Settings
-  int point_cloud_step_size, texture_step_size, precision;
+  int point_cloud_step_size, texture_step_size, precision, tile_mesh_size, num_lod_levels;
   bool center;
 
   // Output
@@ -206,6 +212,223 @@ void save_mesh(std::string const& output_prefix,
   face_progress.report_finished();
 }
 
+// The mesh of one tile at one level of detail
+struct MeshTile {
+  int level, tile_col, tile_row;
+  BBox2i pix_box;   // the samples of the subsampled cloud in the tile
+  BBox3 bbox;       // the vertices, after subtracting the center
+  size_t num_faces;
+  std::string file; // relative to the tiles directory
+  MeshTile(): level(0), tile_col(0), tile_row(0), num_faces(0) {}
+};
+
+// Write to an .obj file the mesh of the points at the given columns and
+// rows of a tile of the subsampled cloud. The texture coordinates are
+// for the whole cloud, so all tiles share the texture. Return the number
+// of faces, and the box of the vertices.
+size_t write_tile_mesh(std::string const& mesh_file, std::string const& mtl_file,
+                       ImageView<Vector3> const& tile_cloud, Vector2i const& tile_corner,
+                       std::vector<int> const& cols, std::vector<int> const& rows,
+                       int cloud_cols, int cloud_rows, Vector3 const& C, int precision,
+                       BBox3 & bbox) {
+
+  int nc = cols.size(), nr = rows.size();
+
+  // Find which samples are vertices of valid triangles, with the same
+  // triangles as in save_mesh(). Number them in row-major order.
+  std::vector<int> vertex(size_t(nc) * nr, 0);
+  auto valid = [&](int i, int j) { return is_valid_pt(tile_cloud(cols[i], rows[j])); };
+  size_t num_faces = 0;
+  for (int j = 0; j + 1 < nr; j++) {
+    for (int i = 0; i + 1 < nc; i++) {
+      bool ul = valid(i, j), ur = valid(i + 1, j), ll = valid(i, j + 1), lr = valid(i + 1, j + 1);
+      if (ul && ll && ur) {
+        vertex[size_t(j) * nc + i] = vertex[size_t(j + 1) * nc + i]
+          = vertex[size_t(j) * nc + i + 1] = 1;
+        num_faces++;
+      }
+      if (ur && ll && lr) {
+        vertex[size_t(j) * nc + i + 1] = vertex[size_t(j + 1) * nc + i]
+          = vertex[size_t(j + 1) * nc + i + 1] = 1;
+        num_faces++;
+      }
+    }
+  }
+
+  std::ofstream ofs(mesh_file.c_str());
+  ofs.precision(precision);
+  ofs << "mtllib " << mtl_file << "\n";
+
+  bbox = BBox3();
+  int vertex_count = 0;
+  for (int j = 0; j < nr; j++) {
+    for (int i = 0; i < nc; i++) {
+      int & v = vertex[size_t(j) * nc + i];
+      if (v == 0)
+        continue;
+      v = ++vertex_count; // The obj spec calls for the starting vertex to have index 1.
+      Vector3 V = tile_cloud(cols[i], rows[j]) - C;
+      bbox.grow(V);
+      ofs << "v " << V[0] << " " << V[1] << " " << V[2] << '\n';
+      // Same texture coordinates as in add_vertex()
+      double u = double(tile_corner[0] + cols[i])/cloud_cols;
+      double w = double(cloud_rows - 1 - tile_corner[1] - rows[j])/cloud_rows;
+      ofs << "vt " << u << ' ' << w << '\n';
+    }
+  }
+
+  auto write_face = [&ofs](int a, int b, int c) {
+    ofs << "f " << a << "/" << a << " " << b << "/" << b << " " << c << "/" << c << '\n';
+  };
+  for (int j = 0; j + 1 < nr; j++) {
+    for (int i = 0; i + 1 < nc; i++) {
+      int ul = vertex[size_t(j) * nc + i],     ur = vertex[size_t(j) * nc + i + 1];
+      int ll = vertex[size_t(j + 1) * nc + i], lr = vertex[size_t(j + 1) * nc + i + 1];
+      bool vul = valid(i, j), vur = valid(i + 1, j), vll = valid(i, j + 1),
+        vlr = valid(i + 1, j + 1);
+      if (vul && vll && vur)
+        write_face(ul, ll, ur);
+      if (vur && vll && vlr)
+        write_face(ur, ll, lr);
+    }
+  }
+
+  if (!ofs)
+    vw_throw(IOErr() << "Failed to write: " << mesh_file << "\n");
+
+  return num_faces;
+}
+
+// Quote a string for JSON
+std::string jsonString(std::string const& str) {
+  std::ostringstream os;
+  os << '"';
+  for (size_t it = 0; it < str.size(); it++) {
+    char c = str[it];
+    if (c == '"' || c == '\\')
+      os << '\\' << c;
+    else if (c == '\n')
+      os << "\\n";
+    else
+      os << c;
+  }
+  os << '"';
+  return os.str();
+}
+
+// Split the subsampled cloud into tiles, and for each tile write meshes
+// at several levels of detail, each level using every other sample of
+// the previous one. Neighboring tiles share their boundary samples, so
+// their meshes join. The tiles are read and meshed in parallel. The
+// meshes go to <output prefix>-tiles, together with an index.json file
+// listing for each of them the level, tile, samples, and bounding box,
+// so that a viewer can load only the tiles and levels it needs.
+void save_mesh_tiles(Options const& opt, std::string const& output_prefix_no_dir,
+                     ImageViewRef<Vector3> point_cloud, Vector3 const& C) {
+
+  std::string tiles_dir = opt.output_prefix + "-tiles";
+  boost::filesystem::create_directories(tiles_dir);
+
+  // The tile .obj files use the material and texture of the whole mesh
+  std::string mtl_file = "../" + output_prefix_no_dir + ".mtl";
+
+  int cloud_cols = point_cloud.cols(), cloud_rows = point_cloud.rows();
+  int tile_size = opt.tile_mesh_size;
+  int num_tile_cols = std::max(1, (cloud_cols - 1 + tile_size - 1) / tile_size);
+  int num_tile_rows = std::max(1, (cloud_rows - 1 + tile_size - 1) / tile_size);
+  int num_tiles = num_tile_cols * num_tile_rows;
+  int num_levels = opt.num_lod_levels;
+
+  vw_out() << "Writing " << num_tiles << " mesh tiles at " << num_levels
+           << " level(s) of detail to: " << tiles_dir << "\n";
+
+  std::vector<MeshTile> tiles(size_t(num_tiles) * num_levels);
+  std::vector<std::exception_ptr> errors;
+  TerminalProgressCallback tpc("asp", "\tTiles:   ");
+  double inc_amount = 1.0 / double(num_tiles);
+  tpc.report_progress(0);
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int tile = 0; tile < num_tiles; tile++) {
+    try {
+      int tile_col = tile % num_tile_cols, tile_row = tile / num_tile_cols;
+      Vector2i corner(tile_col * tile_size, tile_row * tile_size);
+      BBox2i pix_box(corner, corner + Vector2i(tile_size + 1, tile_size + 1));
+      pix_box.crop(bounding_box(point_cloud));
+      ImageView<Vector3> tile_cloud = crop(point_cloud, pix_box);
+
+      for (int level = 0; level < num_levels; level++) {
+
+        // Every step-th sample, and the last one, so that tiles join
+        int step = 1 << level;
+        std::vector<int> cols, rows;
+        for (int c = 0; c < pix_box.width(); c += step)
+          cols.push_back(c);
+        if (cols.back() != pix_box.width() - 1)
+          cols.push_back(pix_box.width() - 1);
+        for (int r = 0; r < pix_box.height(); r += step)
+          rows.push_back(r);
+        if (rows.back() != pix_box.height() - 1)
+          rows.push_back(pix_box.height() - 1);
+
+        MeshTile & mt = tiles[size_t(tile) * num_levels + level];
+        mt.level = level;
+        mt.tile_col = tile_col;
+        mt.tile_row = tile_row;
+        mt.pix_box = pix_box;
+        std::ostringstream os;
+        os << "L" << level << "_" << tile_col << "_" << tile_row << ".obj";
+        mt.file = os.str();
+        mt.num_faces = write_tile_mesh(tiles_dir + "/" + mt.file, mtl_file, tile_cloud,
+                                       corner, cols, rows, cloud_cols, cloud_rows, C,
+                                       opt.precision, mt.bbox);
+      }
+    } catch (...) {
+      #pragma omp critical
+      errors.push_back(std::current_exception());
+    }
+
+    #pragma omp critical
+    tpc.report_incremental_progress(inc_amount);
+  }
+  tpc.report_finished();
+  if (!errors.empty())
+    std::rethrow_exception(errors[0]);
+
+  // The index of the tiles. Tiles with no faces are listed as well, so
+  // that the grid is complete.
+  std::string index_file = tiles_dir + "/index.json";
+  vw_out() << "Writing: " << index_file << "\n";
+  std::ofstream ofs(index_file.c_str());
+  ofs.precision(opt.precision);
+  ofs << "{\n"
+      << "  \"center\": [" << C[0] << ", " << C[1] << ", " << C[2] << "],\n"
+      << "  \"point_cloud_step_size\": " << opt.point_cloud_step_size << ",\n"
+      << "  \"tile_size\": " << tile_size << ",\n"
+      << "  \"num_levels\": " << num_levels << ",\n"
+      << "  \"num_tile_cols\": " << num_tile_cols << ",\n"
+      << "  \"num_tile_rows\": " << num_tile_rows << ",\n"
+      << "  \"material\": " << jsonString(mtl_file) << ",\n"
+      << "  \"tiles\": [\n";
+  for (size_t it = 0; it < tiles.size(); it++) {
+    MeshTile const& mt = tiles[it];
+    ofs << "    {\"level\": " << mt.level << ", \"tile_col\": " << mt.tile_col
+        << ", \"tile_row\": " << mt.tile_row
+        << ", \"file\": " << jsonString(mt.file)
+        << ", \"num_faces\": " << mt.num_faces
+        << ", \"pixel_box\": [" << mt.pix_box.min().x() << ", " << mt.pix_box.min().y()
+        << ", " << mt.pix_box.max().x() << ", " << mt.pix_box.max().y() << "]";
+    if (!mt.bbox.empty())
+      ofs << ", \"bbox\": [" << mt.bbox.min()[0] << ", " << mt.bbox.min()[1] << ", "
+          << mt.bbox.min()[2] << ", " << mt.bbox.max()[0] << ", " << mt.bbox.max()[1]
+          << ", " << mt.bbox.max()[2] << "]";
+    ofs << "}" << (it + 1 < tiles.size() ? "," : "") << "\n";
+  }
+  ofs << "  ]\n}\n";
+  if (!ofs)
+    vw_throw(IOErr() << "Failed to write: " << index_file << "\n");
+}
+
 void handle_arguments( int argc, char *argv[], Options& opt ) {
   po::options_description general_options("");
   general_options.add_options()
@@ -218,7 +441,14 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("center", po::bool_switch(&opt.center)->default_value(false),
      "Let the origin be the midpoint of the bounding box of the cloud. Use this option if you are experiencing numerical precision issues.")
     ("precision", po::value(&opt.precision)->default_value(17),
-     "How many digits of precision to save.");
+     "How many digits of precision to save.")
+    ("tile-mesh-size", po::value(&opt.tile_mesh_size)->default_value(0),
+     "Instead of one mesh, write a mesh for each tile of this many samples "
+     "of the subsampled cloud on a side, in <output prefix>-tiles, with an "
+     "index.json file listing them. The tiles are made in parallel.")
+    ("num-lod-levels", po::value(&opt.num_lod_levels)->default_value(1),
+     "With --tile-mesh-size, write each tile at this many levels of detail. Each "
+     "level uses every other sample of the previous one.");
   
   general_options.add( vw::GdalWriteOptionsDescription(opt) );
 
@@ -256,6 +486,14 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     vw_throw(ArgumentErr() << "Precision must be positive.\n"
              << usage << general_options);
 
+  if (opt.tile_mesh_size < 0)
+    vw_throw(ArgumentErr() << "The tile mesh size must be non-negative.\n"
+             << usage << general_options);
+
+  if (opt.num_lod_levels <= 0 || opt.num_lod_levels > 16)
+    vw_throw(ArgumentErr() << "The number of levels of detail must be between 1 and 16.\n"
+             << usage << general_options);
+
   // It is useful to have this to make the p
   if (opt.point_cloud_step_size % opt.texture_step_size != 0) 
     vw_throw(ArgumentErr() << "--point-cloud-step-size must be a multiple "
@@ -332,8 +570,13 @@ int main(int argc, char *argv[]){
     boost::filesystem::path p(opt.output_prefix);
     std::string output_prefix_no_dir = p.filename().string();
   
-    save_mesh(opt.output_prefix, output_prefix_no_dir,
-              point_cloud, C, opt.precision);
+    if (opt.tile_mesh_size > 0) {
+      omp_set_num_threads(vw_settings().default_num_threads());
+      save_mesh_tiles(opt, output_prefix_no_dir, point_cloud, C);
+    } else {
+      save_mesh(opt.output_prefix, output_prefix_no_dir,
+                point_cloud, C, opt.precision);
+    }
     
     save_texture(opt.output_prefix, texture_image);
     
@@ -637,8 +637,10 @@ struct BracketedDepthMeshError {
 };  // End class BracketedDepthMeshError
 
 // An error function minimizing a weight times the distance from a
-// variable xyz point to a fixed reference xyz point.
-struct XYZError {
+// variable xyz point to a fixed reference xyz point. The Jacobian is
+// the weight times the identity, so it is set directly.
+class XYZError: public ceres::SizedCostFunction<NUM_XYZ_PARAMS, NUM_XYZ_PARAMS> {
+ public:
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   XYZError(Eigen::Vector3d const& ref_xyz, std::vector<int> const& block_sizes, double weight)
       : m_ref_xyz(ref_xyz), m_block_sizes(block_sizes), m_weight(weight) {
@@ -647,14 +649,19 @@ struct XYZError {
       LOG(FATAL) << "XYZError: The block sizes were not set up properly.\n";
   }
 
-  // Call to work with ceres::DynamicNumericDiffCostFunction.
-  // Takes array of arrays as parameters.
-  // TODO(oalexan1): May want to use the analytical Ceres cost function
-  bool operator()(double const* const* parameters, double* residuals) const {
+  bool Evaluate(double const* const* parameters, double* residuals,
+                double** jacobians) const override {
     // Compute the residuals
     for (int it = 0; it < NUM_XYZ_PARAMS; it++)
       residuals[it] = m_weight * (parameters[0][it] - m_ref_xyz[it]);
 
+    if (jacobians != NULL && jacobians[0] != NULL) {
+      for (int row = 0; row < NUM_XYZ_PARAMS; row++) {
+        for (int col = 0; col < NUM_XYZ_PARAMS; col++)
+          jacobians[0][row * NUM_XYZ_PARAMS + col] = (row == col) ? m_weight : 0.0;
+      }
+    }
+
     return true;
   }
 
@@ -662,18 +669,7 @@ struct XYZError {
   static ceres::CostFunction* Create(Eigen::Vector3d const& ref_xyz,
                                      std::vector<int> const& block_sizes,
                                      double weight) {
-    ceres::DynamicNumericDiffCostFunction<XYZError>* cost_function =
-      new ceres::DynamicNumericDiffCostFunction<XYZError>
-      (new XYZError(ref_xyz, block_sizes, weight));
-
-    // The residual size is always the same
-    cost_function->SetNumResiduals(NUM_XYZ_PARAMS);
-
-    // The camera wrapper knows all of the block sizes to add.
-    for (size_t i = 0; i < block_sizes.size(); i++) {
-      cost_function->AddParameterBlock(block_sizes[i]);
-    }
-    return cost_function;
+    return new XYZError(ref_xyz, block_sizes, weight);
   }
 
  private:
@@ -876,17 +872,32 @@ void set_up_block_sizes(int num_depth_params,
   xyz_block_sizes.push_back(rig::NUM_XYZ_PARAMS);
 }
 
+// A residual block in the problem, with the names and scales of its
+// residuals. The pid is that of the triangulated point it constrains, if
+// any. The cid and fid are for the observation it is for, if any, and
+// are -1 otherwise.
+struct CalibResidual {
+  ceres::ResidualBlockId id;
+  int pid, cid, fid;
+  bool is_pixel;  // if a reprojection error
+  std::vector<std::string> names;
+  std::vector<double> scales;
+};
+
 // TODO(oalexan1): Move to residual_utils.cc
-// Evaluate the residuals before and after optimization
+// Evaluate the residuals before and after optimization, in the order of the
+// given residual blocks
 void evalResiduals(  // Inputs
   std::string const& tag, std::vector<std::string> const& residual_names,
   std::vector<double> const& residual_scales,
+  std::vector<ceres::ResidualBlockId> const& residual_blocks,
   // Outputs
   ceres::Problem& problem, std::vector<double>& residuals) {
   double total_cost = 0.0;
   ceres::Problem::EvaluateOptions eval_options;
   eval_options.num_threads = 1;
   eval_options.apply_loss_function = false;  // want raw residuals
+  eval_options.residual_blocks = residual_blocks;
   problem.Evaluate(eval_options, &total_cost, &residuals, NULL, NULL);
 
   // Sanity checks, after the residuals are created
@@ -1113,7 +1124,7 @@ int main(int argc, char** argv) {
                      FLAGS_image_sensor_list, FLAGS_extra_list,
                      FLAGS_use_initial_rig_transforms,
                      FLAGS_bracket_len, FLAGS_nearest_neighbor_interp, 
-                     FLAGS_read_nvm_no_shift, R,
+                     FLAGS_read_nvm_no_shift, FLAGS_no_nvm_matches, R,
                      // outputs
                      nvm, image_maps, depth_maps); // out
   
@@ -1338,6 +1349,19 @@ int main(int argc, char** argv) {
   std::vector<Eigen::Vector3d> pid_mesh_xyz;
   Eigen::Vector3d bad_xyz(1.0e+100, 1.0e+100, 1.0e+100);  // use this to flag invalid xyz
 
+  // For when we don't have distortion but must get a pointer to
+  // distortion for the interface
+  double distortion_placeholder = 0.0;
+
+  // The problem is formed in the first pass and kept for the next ones, so
+  // that its residuals and the settings of its parameters need not be made
+  // again. Then the residuals for the outliers flagged after a pass are
+  // removed from it, which fast removal makes cheap.
+  ceres::Problem::Options problem_options;
+  problem_options.enable_fast_removal = true;
+  std::shared_ptr<ceres::Problem> problem_ptr;
+  std::vector<rig::CalibResidual> calib_residuals;
+
   // TODO(oalexan1): All the logic for one pass should be its own function,
   // as the block below is too big.
   for (int pass = 0; pass < FLAGS_calibrator_num_passes; pass++) {
@@ -1392,296 +1416,314 @@ int main(int argc, char** argv) {
     std::vector<std::map<int, std::map<int, int>>> pid_cid_fid_to_residual_index;
     pid_cid_fid_to_residual_index.resize(pid_to_cid_fid.size());
 
-    // For when we don't have distortion but must get a pointer to
-    // distortion for the interface
-    double distortion_placeholder = 0.0;
-    
-    // Form the problem
-    ceres::Problem problem;
-    std::vector<std::string> residual_names;
-    std::vector<double> residual_scales;
-
-    // Prepare for the case of fixed rig translations and/or rotations    
-    std::set<double*> fixed_parameters; // to avoid double fixing
-    ceres::SubsetManifold* constant_transform_manifold = nullptr;
-    rig::setUpFixRigOptions(FLAGS_no_rig, FLAGS_fix_rig_translations, 
-                            FLAGS_fix_rig_rotations,
-                            constant_transform_manifold);
-    
+    // Form the problem in the first pass. With a mesh the mesh intersections
+    // change from pass to pass, and so the constraints using them, so then
+    // it is formed anew each pass.
+    bool form_problem = (problem_ptr.get() == NULL || FLAGS_mesh != "");
+    if (form_problem) {
+      problem_ptr.reset(new ceres::Problem(problem_options));
+      calib_residuals.clear();
+    }
+    ceres::Problem & problem = *problem_ptr;
+
+    // Keep track of a residual block just added to the problem
+    auto addResidual = [&calib_residuals](ceres::ResidualBlockId id, int pid, int cid,
+                                          int fid, bool is_pixel,
+                                          std::vector<std::string> const& names,
+                                          std::vector<double> const& scales) {
+      rig::CalibResidual res;
+      res.id = id;
+      res.pid = pid;
+      res.cid = cid;
+      res.fid = fid;
+      res.is_pixel = is_pixel;
+      res.names = names;
+      res.scales = scales;
+      calib_residuals.push_back(res);
+    };
+
+    // The constraints for a triangulated point are added only if some of the
+    // rays converging to it are inliers
+    std::vector<bool> is_tri_inlier(pid_to_cid_fid.size(), false);
     for (size_t pid = 0; pid < pid_to_cid_fid.size(); pid++) {
       for (auto cid_fid = pid_to_cid_fid[pid].begin();
            cid_fid != pid_to_cid_fid[pid].end(); cid_fid++) {
-        int cid = cid_fid->first;
-        int fid = cid_fid->second;
-
-        // Deal with inliers only
-        if (!rig::getMapValue(pid_cid_fid_inlier, pid, cid, fid))
-          continue;
+        if (rig::getMapValue(pid_cid_fid_inlier, pid, cid_fid->first, cid_fid->second)) {
+          is_tri_inlier[pid] = true;
+          break; // found it to be an inlier, no need to do further checking
+        }
+      }
+    }
 
-        // Find timestamps and pointers to bracketing cameras ref_to_cam transform.
-        // This strongly depends on whether we are using a rig or not.
-        int cam_type = cams[cid].camera_type;
-        double beg_ref_timestamp = -1.0, end_ref_timestamp = -1.0, cam_timestamp = -1.0;
-        double *beg_cam_ptr = NULL, *end_cam_ptr = NULL, *ref_to_cam_ptr = NULL;
-        rig::calcBracketing(// Inputs
-                      FLAGS_no_rig, cid, cam_type, cams, ref_timestamps, R,
-                      world_to_cam_vec, world_to_ref_vec, ref_to_cam_vec,
-                      ref_identity_vec, right_identity_vec,
-                      // Outputs
-                      beg_cam_ptr, end_cam_ptr, ref_to_cam_ptr,
-                      beg_ref_timestamp, end_ref_timestamp,
-                      cam_timestamp);
+    if (form_problem) {
+      // Prepare for the case of fixed rig translations and/or rotations
+      std::set<double*> fixed_parameters; // to avoid double fixing
+      ceres::SubsetManifold* constant_transform_manifold = nullptr;
+      rig::setUpFixRigOptions(FLAGS_no_rig, FLAGS_fix_rig_translations,
+                              FLAGS_fix_rig_rotations,
+                              constant_transform_manifold);
+
+      for (size_t pid = 0; pid < pid_to_cid_fid.size(); pid++) {
+        for (auto cid_fid = pid_to_cid_fid[pid].begin();
+             cid_fid != pid_to_cid_fid[pid].end(); cid_fid++) {
+          int cid = cid_fid->first;
+          int fid = cid_fid->second;
+
+          // Deal with inliers only
+          if (!rig::getMapValue(pid_cid_fid_inlier, pid, cid, fid))
+            continue;
+
+          // Find timestamps and pointers to bracketing cameras ref_to_cam transform.
+          // This strongly depends on whether we are using a rig or not.
+          int cam_type = cams[cid].camera_type;
+          double beg_ref_timestamp = -1.0, end_ref_timestamp = -1.0, cam_timestamp = -1.0;
+          double *beg_cam_ptr = NULL, *end_cam_ptr = NULL, *ref_to_cam_ptr = NULL;
+          rig::calcBracketing(// Inputs
+                        FLAGS_no_rig, cid, cam_type, cams, ref_timestamps, R,
+                        world_to_cam_vec, world_to_ref_vec, ref_to_cam_vec,
+                        ref_identity_vec, right_identity_vec,
+                        // Outputs
+                        beg_cam_ptr, end_cam_ptr, ref_to_cam_ptr,
+                        beg_ref_timestamp, end_ref_timestamp,
+                        cam_timestamp);
  
-        Eigen::Vector2d dist_ip(keypoint_vec[cid][fid].first,
-                                keypoint_vec[cid][fid].second);
-
-        // Remember the index of the pixel residuals about to create
-        pid_cid_fid_to_residual_index[pid][cid][fid] = residual_names.size();
-
-        // TODO(oalexan1): Add this block to CostFunctions.cc.
-        ceres::CostFunction* bracketed_cost_function =
-          rig::BracketedCamError::Create(dist_ip, beg_ref_timestamp,
-                                               end_ref_timestamp,
-                                               cam_timestamp, bracketed_cam_block_sizes,
-                                               R.cam_params[cam_type]);
-        ceres::LossFunction* bracketed_loss_function
-          = rig::GetLossFunction("cauchy", FLAGS_robust_threshold);
-
-        // Handle the case of no distortion
-        double * distortion_ptr = NULL;
-        if (distortions[cam_type].size() > 0) 
-          distortion_ptr = &distortions[cam_type][0];
-        else
-          distortion_ptr = &distortion_placeholder;
+          Eigen::Vector2d dist_ip(keypoint_vec[cid][fid].first,
+                                  keypoint_vec[cid][fid].second);
+
+          // TODO(oalexan1): Add this block to CostFunctions.cc.
+          ceres::CostFunction* bracketed_cost_function =
+            rig::BracketedCamError::Create(dist_ip, beg_ref_timestamp,
+                                                 end_ref_timestamp,
+                                                 cam_timestamp, bracketed_cam_block_sizes,
+                                                 R.cam_params[cam_type]);
+          ceres::LossFunction* bracketed_loss_function
+            = rig::GetLossFunction("cauchy", FLAGS_robust_threshold);
+
+          // Handle the case of no distortion
+          double * distortion_ptr = NULL;
+          if (distortions[cam_type].size() > 0) 
+            distortion_ptr = &distortions[cam_type][0];
+          else
+            distortion_ptr = &distortion_placeholder;
         
-        residual_names.push_back(R.cam_names[cam_type] + "_pix_x");
-        residual_names.push_back(R.cam_names[cam_type] + "_pix_y");
-        residual_scales.push_back(1.0);
-        residual_scales.push_back(1.0);
-        problem.AddResidualBlock
-          (bracketed_cost_function, bracketed_loss_function,
-           beg_cam_ptr, end_cam_ptr, ref_to_cam_ptr, &xyz_vec[pid][0],
-           &R.ref_to_cam_timestamp_offsets[cam_type],
-           &focal_lengths[cam_type], &optical_centers[cam_type][0], distortion_ptr);
-
-        // See which intrinsics to float
-        if (intrinsics_to_float[cam_type].find("focal_length") ==
-            intrinsics_to_float[cam_type].end())
-          problem.SetParameterBlockConstant(&focal_lengths[cam_type]);
-        if (intrinsics_to_float[cam_type].find("optical_center") ==
-            intrinsics_to_float[cam_type].end())
-          problem.SetParameterBlockConstant(&optical_centers[cam_type][0]);
-        if (intrinsics_to_float[cam_type].find("distortion")
-            == intrinsics_to_float[cam_type].end() || distortions[cam_type].size() == 0)
-          problem.SetParameterBlockConstant(distortion_ptr);
-
-        if (!FLAGS_no_rig) {
-          // See if to float the beg camera, which here will point to the ref cam
-          if (camera_poses_to_float.find(R.refSensor(cam_type))
-              == camera_poses_to_float.end())
-            problem.SetParameterBlockConstant(beg_cam_ptr);
-        } else {
-          // There is no rig. Then beg_cam_ptr refers to camera
-          // for cams[cid], and not to its ref bracketing cam.
-          // See if the user wants it floated.
-          if (camera_poses_to_float.find(R.cam_names[cam_type])
-              == camera_poses_to_float.end()) 
-            problem.SetParameterBlockConstant(beg_cam_ptr);
-        }
+          ceres::ResidualBlockId pix_id = problem.AddResidualBlock
+            (bracketed_cost_function, bracketed_loss_function,
+             beg_cam_ptr, end_cam_ptr, ref_to_cam_ptr, &xyz_vec[pid][0],
+             &R.ref_to_cam_timestamp_offsets[cam_type],
+             &focal_lengths[cam_type], &optical_centers[cam_type][0], distortion_ptr);
+          addResidual(pix_id, pid, cid, fid, true,
+                      {R.cam_names[cam_type] + "_pix_x", R.cam_names[cam_type] + "_pix_y"},
+                      {1.0, 1.0});
+
+          // See which intrinsics to float
+          if (intrinsics_to_float[cam_type].find("focal_length") ==
+              intrinsics_to_float[cam_type].end())
+            problem.SetParameterBlockConstant(&focal_lengths[cam_type]);
+          if (intrinsics_to_float[cam_type].find("optical_center") ==
+              intrinsics_to_float[cam_type].end())
+            problem.SetParameterBlockConstant(&optical_centers[cam_type][0]);
+          if (intrinsics_to_float[cam_type].find("distortion")
+              == intrinsics_to_float[cam_type].end() || distortions[cam_type].size() == 0)
+            problem.SetParameterBlockConstant(distortion_ptr);
+
+          if (!FLAGS_no_rig) {
+            // See if to float the beg camera, which here will point to the ref cam
+            if (camera_poses_to_float.find(R.refSensor(cam_type))
+                == camera_poses_to_float.end())
+              problem.SetParameterBlockConstant(beg_cam_ptr);
+          } else {
+            // There is no rig. Then beg_cam_ptr refers to camera
+            // for cams[cid], and not to its ref bracketing cam.
+            // See if the user wants it floated.
+            if (camera_poses_to_float.find(R.cam_names[cam_type])
+                == camera_poses_to_float.end()) 
+              problem.SetParameterBlockConstant(beg_cam_ptr);
+          }
 
-        // The end cam floats only if the ref cam can float and end cam brackets
-        // a non-ref cam and we have a rig. 
-        if (camera_poses_to_float.find(R.refSensor(cam_type))
-            == camera_poses_to_float.end() ||
-            R.isRefSensor(R.cam_names[cam_type]) || FLAGS_no_rig) 
-          problem.SetParameterBlockConstant(end_cam_ptr);
+          // The end cam floats only if the ref cam can float and end cam brackets
+          // a non-ref cam and we have a rig. 
+          if (camera_poses_to_float.find(R.refSensor(cam_type))
+              == camera_poses_to_float.end() ||
+              R.isRefSensor(R.cam_names[cam_type]) || FLAGS_no_rig) 
+            problem.SetParameterBlockConstant(end_cam_ptr);
         
-        // ref_to_cam is kept fixed at the identity if the cam is the ref type or
-        // no rig
-        if (camera_poses_to_float.find(R.cam_names[cam_type])
-            == camera_poses_to_float.end() ||
-            R.isRefSensor(R.cam_names[cam_type]) || FLAGS_no_rig) {
-          problem.SetParameterBlockConstant(ref_to_cam_ptr);
-          fixed_parameters.insert(ref_to_cam_ptr);
-        }
+          // ref_to_cam is kept fixed at the identity if the cam is the ref type or
+          // no rig
+          if (camera_poses_to_float.find(R.cam_names[cam_type])
+              == camera_poses_to_float.end() ||
+              R.isRefSensor(R.cam_names[cam_type]) || FLAGS_no_rig) {
+            problem.SetParameterBlockConstant(ref_to_cam_ptr);
+            fixed_parameters.insert(ref_to_cam_ptr);
+          }
 
-        // See if to fix the rig translation or rotation components
-        if ((FLAGS_fix_rig_translations || FLAGS_fix_rig_rotations) &&
-            fixed_parameters.find(ref_to_cam_ptr) == fixed_parameters.end())
-           problem.SetManifold(ref_to_cam_ptr, constant_transform_manifold);
+          // See if to fix the rig translation or rotation components
+          if ((FLAGS_fix_rig_translations || FLAGS_fix_rig_rotations) &&
+              fixed_parameters.find(ref_to_cam_ptr) == fixed_parameters.end())
+             problem.SetManifold(ref_to_cam_ptr, constant_transform_manifold);
         
-        // See if to fix some images. For that, an image must be in the list,
-        // and its camera must be either of ref type or there must be no rig.
-        if (!fixed_images.empty() &&
-            (fixed_images.find(cams[cid].image_name) != fixed_images.end()) &&
-            (R.isRefSensor(R.cam_names[cam_type]) || FLAGS_no_rig))
-          problem.SetParameterBlockConstant(beg_cam_ptr);
+          // See if to fix some images. For that, an image must be in the list,
+          // and its camera must be either of ref type or there must be no rig.
+          if (!fixed_images.empty() &&
+              (fixed_images.find(cams[cid].image_name) != fixed_images.end()) &&
+              (R.isRefSensor(R.cam_names[cam_type]) || FLAGS_no_rig))
+            problem.SetParameterBlockConstant(beg_cam_ptr);
         
-        if (!FLAGS_float_timestamp_offsets || R.isRefSensor(R.cam_names[cam_type]) ||
-            FLAGS_no_rig) {
-          // Either we don't float timestamp offsets at all, or the cam is the ref type,
-          // or with no extrinsics, when it can't float anyway.
-          problem.SetParameterBlockConstant(&R.ref_to_cam_timestamp_offsets[cam_type]);
-        } else {
-          problem.SetParameterLowerBound(&R.ref_to_cam_timestamp_offsets[cam_type], 0,
-                                         min_timestamp_offset[cam_type]);
-          problem.SetParameterUpperBound(&R.ref_to_cam_timestamp_offsets[cam_type], 0,
-                                         max_timestamp_offset[cam_type]);
-        }
-
-        Eigen::Vector3d depth_xyz(0, 0, 0);
-        bool have_depth_tri_constraint
-          = (FLAGS_depth_tri_weight > 0 &&
-             rig::depthValue(cams[cid].depth_cloud, dist_ip, depth_xyz));
-
-        if (have_depth_tri_constraint) {
-          // TODO(oalexan1): Add this block to CostFunctions.cc.
-          // Ensure that the depth points agree with triangulated points
-          ceres::CostFunction* bracketed_depth_cost_function
-            = rig::BracketedDepthError::Create(FLAGS_depth_tri_weight, depth_xyz,
-                                                     beg_ref_timestamp, end_ref_timestamp,
-                                                     cam_timestamp,
-                                                     bracketed_depth_block_sizes);
-
-          ceres::LossFunction* bracketed_depth_loss_function
-            = rig::GetLossFunction("cauchy", FLAGS_robust_threshold);
-
-          residual_names.push_back("depth_tri_x_m");
-          residual_names.push_back("depth_tri_y_m");
-          residual_names.push_back("depth_tri_z_m");
-          residual_scales.push_back(FLAGS_depth_tri_weight);
-          residual_scales.push_back(FLAGS_depth_tri_weight);
-          residual_scales.push_back(FLAGS_depth_tri_weight);
-          problem.AddResidualBlock
-            (bracketed_depth_cost_function, bracketed_depth_loss_function,
-             beg_cam_ptr, end_cam_ptr, ref_to_cam_ptr,
-             &depth_to_image_vec[num_depth_params * cam_type],
-             &depth_to_image_scales[cam_type],
-             &xyz_vec[pid][0],
-             &R.ref_to_cam_timestamp_offsets[cam_type]);
-
-          // Note that above we already considered fixing some params.
-          // We won't repeat that code here.
-          // If we model an affine depth to image, fix its scale here,
-          // it will change anyway as part of depth_to_image_vec.
-          if (!FLAGS_float_scale || FLAGS_affine_depth_to_image) {
-            problem.SetParameterBlockConstant(&depth_to_image_scales[cam_type]);
+          if (!FLAGS_float_timestamp_offsets || R.isRefSensor(R.cam_names[cam_type]) ||
+              FLAGS_no_rig) {
+            // Either we don't float timestamp offsets at all, or the cam is the ref type,
+            // or with no extrinsics, when it can't float anyway.
+            problem.SetParameterBlockConstant(&R.ref_to_cam_timestamp_offsets[cam_type]);
+          } else {
+            problem.SetParameterLowerBound(&R.ref_to_cam_timestamp_offsets[cam_type], 0,
+                                           min_timestamp_offset[cam_type]);
+            problem.SetParameterUpperBound(&R.ref_to_cam_timestamp_offsets[cam_type], 0,
+                                           max_timestamp_offset[cam_type]);
           }
 
-          if (depth_to_image_transforms_to_float.find(R.cam_names[cam_type])
-              == depth_to_image_transforms_to_float.end())
-            problem.SetParameterBlockConstant(&depth_to_image_vec[num_depth_params * cam_type]);
-        }
-
-        // Add the depth to mesh constraint
-        bool have_depth_mesh_constraint = false;
-        depth_xyz = Eigen::Vector3d(0, 0, 0);
-        Eigen::Vector3d mesh_xyz(0, 0, 0);
-        if (FLAGS_mesh != "") {
-          mesh_xyz = rig::getMapValue(pid_cid_fid_mesh_xyz, pid, cid, fid);
-          have_depth_mesh_constraint
-            = (FLAGS_depth_mesh_weight > 0 && mesh_xyz != bad_xyz &&
+          Eigen::Vector3d depth_xyz(0, 0, 0);
+          bool have_depth_tri_constraint
+            = (FLAGS_depth_tri_weight > 0 &&
                rig::depthValue(cams[cid].depth_cloud, dist_ip, depth_xyz));
-        }
 
-        if (have_depth_mesh_constraint) {
-          // TODO(oalexan1): Add this block to CostFunctions.cc.
-          // Try to make each mesh intersection agree with corresponding depth measurement,
-          // if it exists
-          ceres::CostFunction* bracketed_depth_mesh_cost_function
-            = rig::BracketedDepthMeshError::Create
-            (FLAGS_depth_mesh_weight, depth_xyz, mesh_xyz, beg_ref_timestamp,
-             end_ref_timestamp, cam_timestamp, bracketed_depth_mesh_block_sizes);
-
-          ceres::LossFunction* bracketed_depth_mesh_loss_function
-            = rig::GetLossFunction("cauchy", FLAGS_robust_threshold);
+          if (have_depth_tri_constraint) {
+            // TODO(oalexan1): Add this block to CostFunctions.cc.
+            // Ensure that the depth points agree with triangulated points
+            ceres::CostFunction* bracketed_depth_cost_function
+              = rig::BracketedDepthError::Create(FLAGS_depth_tri_weight, depth_xyz,
+                                                       beg_ref_timestamp, end_ref_timestamp,
+                                                       cam_timestamp,
+                                                       bracketed_depth_block_sizes);
+
+            ceres::LossFunction* bracketed_depth_loss_function
+              = rig::GetLossFunction("cauchy", FLAGS_robust_threshold);
+
+            ceres::ResidualBlockId depth_tri_id = problem.AddResidualBlock
+              (bracketed_depth_cost_function, bracketed_depth_loss_function,
+               beg_cam_ptr, end_cam_ptr, ref_to_cam_ptr,
+               &depth_to_image_vec[num_depth_params * cam_type],
+               &depth_to_image_scales[cam_type],
+               &xyz_vec[pid][0],
+               &R.ref_to_cam_timestamp_offsets[cam_type]);
+            addResidual(depth_tri_id, pid, cid, fid, false,
+                        {"depth_tri_x_m", "depth_tri_y_m", "depth_tri_z_m"},
+                        std::vector<double>(rig::NUM_XYZ_PARAMS, FLAGS_depth_tri_weight));
+
+            // Note that above we already considered fixing some params.
+            // We won't repeat that code here.
+            // If we model an affine depth to image, fix its scale here,
+            // it will change anyway as part of depth_to_image_vec.
+            if (!FLAGS_float_scale || FLAGS_affine_depth_to_image) {
+              problem.SetParameterBlockConstant(&depth_to_image_scales[cam_type]);
+            }
+
+            if (depth_to_image_transforms_to_float.find(R.cam_names[cam_type])
+                == depth_to_image_transforms_to_float.end())
+              problem.SetParameterBlockConstant(&depth_to_image_vec[num_depth_params * cam_type]);
+          }
 
-          residual_names.push_back("depth_mesh_x_m");
-          residual_names.push_back("depth_mesh_y_m");
-          residual_names.push_back("depth_mesh_z_m");
-          residual_scales.push_back(FLAGS_depth_mesh_weight);
-          residual_scales.push_back(FLAGS_depth_mesh_weight);
-          residual_scales.push_back(FLAGS_depth_mesh_weight);
-          problem.AddResidualBlock
-            (bracketed_depth_mesh_cost_function, bracketed_depth_mesh_loss_function,
-             beg_cam_ptr, end_cam_ptr, ref_to_cam_ptr,
-             &depth_to_image_vec[num_depth_params * cam_type],
-             &depth_to_image_scales[cam_type],
-             &R.ref_to_cam_timestamp_offsets[cam_type]);
-
-          // Note that above we already fixed some of these variables.
-          // Repeat the fixing of depth variables, however, as the previous block
-          // may not take place.
-          if (!FLAGS_float_scale || FLAGS_affine_depth_to_image)
-            problem.SetParameterBlockConstant(&depth_to_image_scales[cam_type]);
-
-          if (depth_to_image_transforms_to_float.find(R.cam_names[cam_type])
-              == depth_to_image_transforms_to_float.end())
-            problem.SetParameterBlockConstant(&depth_to_image_vec[num_depth_params * cam_type]);
-        }
-      }  // end iterating over all cid for given pid
+          // Add the depth to mesh constraint
+          bool have_depth_mesh_constraint = false;
+          depth_xyz = Eigen::Vector3d(0, 0, 0);
+          Eigen::Vector3d mesh_xyz(0, 0, 0);
+          if (FLAGS_mesh != "") {
+            mesh_xyz = rig::getMapValue(pid_cid_fid_mesh_xyz, pid, cid, fid);
+            have_depth_mesh_constraint
+              = (FLAGS_depth_mesh_weight > 0 && mesh_xyz != bad_xyz &&
+                 rig::depthValue(cams[cid].depth_cloud, dist_ip, depth_xyz));
+          }
 
-      // The constraints below will be for each triangulated point. Skip such a point
-      // if all rays converging to it come from outliers.
-      bool isTriInlier = false;
-      for (auto cid_fid = pid_to_cid_fid[pid].begin();
-           cid_fid != pid_to_cid_fid[pid].end(); cid_fid++) {
-        int cid = cid_fid->first;
-        int fid = cid_fid->second;
-        
-        if (rig::getMapValue(pid_cid_fid_inlier, pid, cid, fid)) {
-          isTriInlier = true;
-          break; // found it to be an inlier, no need to do further checking
+          if (have_depth_mesh_constraint) {
+            // TODO(oalexan1): Add this block to CostFunctions.cc.
+            // Try to make each mesh intersection agree with corresponding depth measurement,
+            // if it exists
+            ceres::CostFunction* bracketed_depth_mesh_cost_function
+              = rig::BracketedDepthMeshError::Create
+              (FLAGS_depth_mesh_weight, depth_xyz, mesh_xyz, beg_ref_timestamp,
+               end_ref_timestamp, cam_timestamp, bracketed_depth_mesh_block_sizes);
+
+            ceres::LossFunction* bracketed_depth_mesh_loss_function
+              = rig::GetLossFunction("cauchy", FLAGS_robust_threshold);
+
+            ceres::ResidualBlockId depth_mesh_id = problem.AddResidualBlock
+              (bracketed_depth_mesh_cost_function, bracketed_depth_mesh_loss_function,
+               beg_cam_ptr, end_cam_ptr, ref_to_cam_ptr,
+               &depth_to_image_vec[num_depth_params * cam_type],
+               &depth_to_image_scales[cam_type],
+               &R.ref_to_cam_timestamp_offsets[cam_type]);
+            addResidual(depth_mesh_id, pid, cid, fid, false,
+                        {"depth_mesh_x_m", "depth_mesh_y_m", "depth_mesh_z_m"},
+                        std::vector<double>(rig::NUM_XYZ_PARAMS, FLAGS_depth_mesh_weight));
+
+            // Note that above we already fixed some of these variables.
+            // Repeat the fixing of depth variables, however, as the previous block
+            // may not take place.
+            if (!FLAGS_float_scale || FLAGS_affine_depth_to_image)
+              problem.SetParameterBlockConstant(&depth_to_image_scales[cam_type]);
+
+            if (depth_to_image_transforms_to_float.find(R.cam_names[cam_type])
+                == depth_to_image_transforms_to_float.end())
+              problem.SetParameterBlockConstant(&depth_to_image_vec[num_depth_params * cam_type]);
+          }
+        }  // end iterating over all cid for given pid
+
+        // Add mesh-to-triangulated point constraint
+        bool have_mesh_tri_constraint = false;
+        Eigen::Vector3d avg_mesh_xyz(0, 0, 0);
+        if (FLAGS_mesh != "" && is_tri_inlier[pid]) {
+          avg_mesh_xyz = pid_mesh_xyz.at(pid);
+          if (FLAGS_mesh_tri_weight > 0 && avg_mesh_xyz != bad_xyz)
+            have_mesh_tri_constraint = true;
         }
-      }
-
-      // Add mesh-to-triangulated point constraint
-      bool have_mesh_tri_constraint = false;
-      Eigen::Vector3d avg_mesh_xyz(0, 0, 0);
-      if (FLAGS_mesh != "" && isTriInlier) {
-        avg_mesh_xyz = pid_mesh_xyz.at(pid);
-        if (FLAGS_mesh_tri_weight > 0 && avg_mesh_xyz != bad_xyz)
-          have_mesh_tri_constraint = true;
-      }
-      if (have_mesh_tri_constraint) {
-        // Try to make the triangulated point agree with the mesh intersection
+        if (have_mesh_tri_constraint) {
+          // Try to make the triangulated point agree with the mesh intersection
 
-        ceres::CostFunction* mesh_cost_function =
-          rig::XYZError::Create(avg_mesh_xyz, xyz_block_sizes, FLAGS_mesh_tri_weight);
+          ceres::CostFunction* mesh_cost_function =
+            rig::XYZError::Create(avg_mesh_xyz, xyz_block_sizes, FLAGS_mesh_tri_weight);
 
-        ceres::LossFunction* mesh_loss_function =
-          rig::GetLossFunction("cauchy", FLAGS_robust_threshold);
+          ceres::LossFunction* mesh_loss_function =
+            rig::GetLossFunction("cauchy", FLAGS_robust_threshold);
 
-        problem.AddResidualBlock(mesh_cost_function, mesh_loss_function,
-                                 &xyz_vec[pid][0]);
+          ceres::ResidualBlockId mesh_tri_id =
+            problem.AddResidualBlock(mesh_cost_function, mesh_loss_function,
+                                     &xyz_vec[pid][0]);
+          addResidual(mesh_tri_id, pid, -1, -1, false,
+                      {"mesh_tri_x_m", "mesh_tri_y_m", "mesh_tri_z_m"},
+                      std::vector<double>(rig::NUM_XYZ_PARAMS, FLAGS_mesh_tri_weight));
+        }
+      }  // end iterating over pid
 
-        residual_names.push_back("mesh_tri_x_m");
-        residual_names.push_back("mesh_tri_y_m");
-        residual_names.push_back("mesh_tri_z_m");
-        residual_scales.push_back(FLAGS_mesh_tri_weight);
-        residual_scales.push_back(FLAGS_mesh_tri_weight);
-        residual_scales.push_back(FLAGS_mesh_tri_weight);
+    } else {
+      // Keep the problem from the previous pass, with its parameters and
+      // their bounds and which of them are fixed. Remove the residuals for
+      // the observations which became outliers, and for the triangulated
+      // points and camera positions, whose reference values changed and
+      // which are added anew below.
+      std::vector<rig::CalibResidual> prev_residuals;
+      prev_residuals.swap(calib_residuals);
+      for (size_t res_it = 0; res_it < prev_residuals.size(); res_it++) {
+        rig::CalibResidual const& res = prev_residuals[res_it];
+        if (res.cid >= 0 && rig::getMapValue(pid_cid_fid_inlier, res.pid, res.cid, res.fid))
+          calib_residuals.push_back(res);
+        else
+          problem.RemoveResidualBlock(res.id);
       }
+    }
 
+    for (size_t pid = 0; pid < pid_to_cid_fid.size(); pid++) {
       // Add the constraint that the triangulated point does not go too far
-      if (FLAGS_tri_weight > 0.0 && isTriInlier) {
+      if (FLAGS_tri_weight > 0.0 && is_tri_inlier[pid]) {
         // Try to make the triangulated points (and hence cameras) not move too far
         ceres::CostFunction* tri_cost_function =
           rig::XYZError::Create(xyz_vec_orig[pid], xyz_block_sizes, FLAGS_tri_weight);
         ceres::LossFunction* tri_loss_function =
           rig::GetLossFunction("cauchy", FLAGS_tri_robust_threshold);
-        problem.AddResidualBlock(tri_cost_function, tri_loss_function,
-                                 &xyz_vec[pid][0]);
-
-        residual_names.push_back("tri_x_m");
-        residual_names.push_back("tri_y_m");
-        residual_names.push_back("tri_z_m");
-        residual_scales.push_back(FLAGS_tri_weight);
-        residual_scales.push_back(FLAGS_tri_weight);
-        residual_scales.push_back(FLAGS_tri_weight);
+        ceres::ResidualBlockId tri_id =
+          problem.AddResidualBlock(tri_cost_function, tri_loss_function,
+                                   &xyz_vec[pid][0]);
+        addResidual(tri_id, pid, -1, -1, false, {"tri_x_m", "tri_y_m", "tri_z_m"},
+                    std::vector<double>(rig::NUM_XYZ_PARAMS, FLAGS_tri_weight));
       }
-      
-    }  // end iterating over pid
+    }
 
     // Add the camera position constraints for the ref cams
     if (FLAGS_camera_position_weight > 0.0) {
@@ -1709,29 +1751,38 @@ int main(int argc, char** argv) {
         ceres::CostFunction* cam_pos_cost_function =
            rig::CamPositionErr::Create(beg_cam_ptr, FLAGS_camera_position_weight);
         ceres::LossFunction* cam_pos_loss_function = NULL; // no robust threshold
-        problem.AddResidualBlock(cam_pos_cost_function, cam_pos_loss_function,
-                                 beg_cam_ptr);
-        
-        residual_names.push_back(sensor_name + "_pos_x");
-        residual_names.push_back(sensor_name + "_pos_y");
-        residual_names.push_back(sensor_name + "_pos_z");
-        residual_names.push_back(sensor_name + "_q_x");
-        residual_names.push_back(sensor_name + "_q_y");
-        residual_names.push_back(sensor_name + "_q_z");
-        residual_names.push_back(sensor_name + "_q_w");
-        residual_scales.push_back(FLAGS_camera_position_weight);
-        residual_scales.push_back(FLAGS_camera_position_weight);
-        residual_scales.push_back(FLAGS_camera_position_weight);
-        residual_scales.push_back(1.0); // Rotations will not be constrained
-        residual_scales.push_back(1.0);
-        residual_scales.push_back(1.0);
-        residual_scales.push_back(1.0);
+        ceres::ResidualBlockId cam_pos_id =
+          problem.AddResidualBlock(cam_pos_cost_function, cam_pos_loss_function,
+                                   beg_cam_ptr);
+
+        // Rotations will not be constrained
+        double w = FLAGS_camera_position_weight;
+        addResidual(cam_pos_id, -1, -1, -1, false,
+                    {sensor_name + "_pos_x", sensor_name + "_pos_y", sensor_name + "_pos_z",
+                     sensor_name + "_q_x", sensor_name + "_q_y", sensor_name + "_q_z",
+                     sensor_name + "_q_w"},
+                    {w, w, w, 1.0, 1.0, 1.0, 1.0});
       }
     }
-      
+
+    // The residuals to evaluate, with their names and scales, and the index
+    // of the pixel residuals for each inlier observation
+    std::vector<ceres::ResidualBlockId> residual_blocks;
+    std::vector<std::string> residual_names;
+    std::vector<double> residual_scales;
+    for (size_t res_it = 0; res_it < calib_residuals.size(); res_it++) {
+      rig::CalibResidual const& res = calib_residuals[res_it];
+      if (res.is_pixel)
+        pid_cid_fid_to_residual_index[res.pid][res.cid][res.fid] = residual_names.size();
+      residual_blocks.push_back(res.id);
+      residual_names.insert(residual_names.end(), res.names.begin(), res.names.end());
+      residual_scales.insert(residual_scales.end(), res.scales.begin(), res.scales.end());
+    }
+
     // Evaluate the residuals before optimization
     std::vector<double> residuals;
-    rig::evalResiduals("before opt", residual_names, residual_scales, problem, residuals);
+    rig::evalResiduals("before opt", residual_names, residual_scales, residual_blocks,
+                       problem, residuals);
 
     if (pass == 0)
       rig::writeResiduals(FLAGS_out_dir, "initial", R.cam_names, cams, keypoint_vec,  
@@ -1793,8 +1844,8 @@ int main(int argc, char** argv) {
     }
 
     // Evaluate the residuals after optimization
-    rig::evalResiduals("after opt", residual_names, residual_scales, problem,
-                             residuals);
+    rig::evalResiduals("after opt", residual_names, residual_scales, residual_blocks,
+                       problem, residuals);
 
     // Must have up-to-date world_to_cam and residuals to flag the outliers
     rig::calc_world_to_cam_rig_or_not
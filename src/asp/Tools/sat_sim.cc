@@ -161,6 +161,10 @@ void handle_arguments(int argc, char *argv[], asp::SatSimOptions& opt,
      ("dem-height-error-tol", po::value(&opt.dem_height_error_tol)->default_value(0.001),
       "When intersecting a ray with a DEM, use this as the height error tolerance "
       "(measured in meters). It is expected that the default will be always good enough.")
+     ("num-parallel-frames", po::value(&opt.num_parallel_frames)->default_value(1),
+      "Create this many images at the same time, each with multiple threads. The "
+      "portions of the DEM and orthoimage seen by these are read in memory once. "
+      "This helps when creating many small images.")
     ;
   general_options.add(vw::GdalWriteOptionsDescription(opt));
 
@@ -204,6 +208,10 @@ void handle_arguments(int argc, char *argv[], asp::SatSimOptions& opt,
     vw::vw_throw(vw::ArgumentErr() << "The --camera-list and --no-images options "
       "cannot be used together.\n");
   
+  if (opt.num_parallel_frames <= 0)
+    vw::vw_throw(vw::ArgumentErr() << "The value of --num-parallel-frames must be "
+      << "positive.\n");
+
   if (opt.camera_list == "") {
     if (opt.first == vw::Vector3() || opt.last == vw::Vector3())
       vw::vw_throw(vw::ArgumentErr() << "The first and last camera positions must be "
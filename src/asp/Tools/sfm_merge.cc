@@ -35,10 +35,10 @@
 #include <algorithm>
 #include <thread>
 
-// Merge n maps by merging second into the first, then the third into
-// the merged map, etc. It works by finding matches among the maps
-// using -num_image_overlaps_at_endpoints and then bringing the second
-// map in the coordinate system of the first map. It is suggested that
+// Merge n maps by merging each map with the next one, then merging the
+// results the same way, until a single map is left. It works by finding
+// matches among the maps using -num_image_overlaps_at_endpoints and then
+// bringing the second map in the coordinate system of the first map. It is suggested that
 // bundle adjustment and registration to real-world coordinate systems
 // be (re-)done after maps are merged, using rig_calibrator.
 
@@ -85,6 +85,11 @@ DEFINE_double(close_dist, -1.0,
               "a tight subset of the triangulated points and printed on screen if "
               "not set. This is an advanced option. ");
 
+DEFINE_int32(num_parallel_merges, 4,
+             "When merging more than two maps, merge up to this many pairs of maps "
+             "at the same time. Each merge uses --num_threads threads. A larger "
+             "value uses more memory.");
+
 DEFINE_string(image_sensor_list, "",
               "Read image name, sensor name, and timestamp, from each line in this list. "
               "Alternatively, a directory structure can be used.");
@@ -109,6 +114,9 @@ void parameterValidation(int argc, char** argv) {
   if (!FLAGS_fast_merge && FLAGS_num_image_overlaps_at_endpoints <= 0)
     LOG(FATAL) << "Must have num_image_overlaps_at_endpoints > 0.";
 
+  if (FLAGS_num_parallel_merges <= 0)
+    LOG(FATAL) << "Must have num_parallel_merges > 0.";
+
   if (FLAGS_fix_first_map && argc != 3)
     LOG(FATAL) << "Keeping the first map fixed works only when there are two input maps.";
 }
@@ -144,61 +152,58 @@ int main(int argc, char** argv) {
   rig::readRigConfig(FLAGS_rig_config, use_initial_rig_transforms, R);
 
   // Store the offsets for all maps that we will merge
-  std::vector<std::map<std::string, Eigen::Vector2d>> offsets(argc - 1);
-
-  rig::nvmData in0;
-  rig::ReadNvm(argv[1],
-                     in0.cid_to_keypoint_map,  
-                     in0.cid_to_filename,  
-                     in0.pid_to_cid_fid,  
-                     in0.pid_to_xyz,  
-                     in0.cid_to_cam_t_global);
-  if (!FLAGS_no_shift) {
-    bool undo_shift = true; // remove the shift relative to the optical center
-    std::string offsets_file = rig::offsetsFilename(argv[1]);
-    rig::readNvmOffsets(offsets_file, in0.optical_centers);
-    offsets[0] = in0.optical_centers;
-    // TODO(oalexan1): Undoing shift of keypoints should happen on reading the nvm
-    rig::shiftKeypoints(undo_shift, R, in0);
-  }
-  
-  // Successively append the maps
-  rig::nvmData out_map;
-  for (int i = 2; i < argc; i++) {
-    
-    rig::nvmData in1;
-    rig::ReadNvm(argv[i],
-                       in1.cid_to_keypoint_map,  
-                       in1.cid_to_filename,  
-                       in1.pid_to_cid_fid,  
-                       in1.pid_to_xyz,  
-                       in1.cid_to_cam_t_global);
+  int num_maps = argc - 1;
+  std::vector<std::map<std::string, Eigen::Vector2d>> offsets(num_maps);
+
+  std::vector<rig::nvmData> maps(num_maps);
+  for (int i = 0; i < num_maps; i++) {
+    rig::nvmData & in = maps[i]; // alias
+    bool read_offsets = !FLAGS_no_shift, read_tracks = true;
+    rig::readNvmData(argv[i + 1], read_offsets, read_tracks, in);
     if (!FLAGS_no_shift) {
       bool undo_shift = true; // remove the shift relative to the optical center
-      std::string offsets_file = rig::offsetsFilename(argv[i]);
-      rig::readNvmOffsets(offsets_file, in1.optical_centers); 
-      offsets[i - 1] = in1.optical_centers;
+      offsets[i] = in.optical_centers;
       // TODO(oalexan1): Undoing shift of keypoints should happen on reading the nvm
-      rig::shiftKeypoints(undo_shift, R, in1);
+      rig::shiftKeypoints(undo_shift, R, in);
     }
-    
-    // TODO(oalexan1): Add flag to not have to transform second map, then use
-    // this code to merge the theia nvm and produced nvm.
-    rig::MergeMaps(in0, in1, R,
+  }
+
+  // Needed at the end. There are two maps in this case.
+  rig::nvmData in0;
+  if (FLAGS_fix_first_map)
+    in0 = maps[0];
+  
+  // Merge each map with the next one, with several merges in parallel, then
+  // merge the results the same way, until one map is left. A map is merged
+  // only with its neighbor in the list, as before, but the work for the
+  // tracks and images of all maps is done a number of times that grows as
+  // the logarithm of the number of maps, rather than once per map. Each
+  // merged map is in the coordinate system of the first of its inputs.
+  while (maps.size() > 1) {
+    int num_pairs = maps.size() / 2;
+    std::cout << "Merging " << maps.size() << " maps in pairs.\n";
+    std::vector<rig::nvmData> merged(num_pairs);
+    {
+      rig::ThreadPool pool(std::min(num_pairs, FLAGS_num_parallel_merges));
+      for (int it = 0; it < num_pairs; it++) {
+        pool.AddTask([&maps, &merged, &R, it]() {
+          rig::MergeMaps(maps[2 * it], maps[2 * it + 1], R,
                          FLAGS_num_image_overlaps_at_endpoints,
                          FLAGS_fast_merge,
                          FLAGS_no_transform,
                          FLAGS_close_dist,
                          FLAGS_image_sensor_list,
-                         out_map);
-    
-    if (i + 1 < argc) {
-      // There are more maps to marge. Let in0 be what we have so far,
-      // and will merge onto it at the next iteration
-      // TODO(oalexan1): Test this!
-      in0 = out_map;
-    }
+                         merged[it]);
+        });
+      }
+    } // wait for the merges to finish
+
+    // A map left without a pair is merged at the next level
+    if (maps.size() % 2 == 1)
+      merged.push_back(maps.back());
+    maps.swap(merged);
   }
+  rig::nvmData & out_map = maps[0]; // alias
 
   if (FLAGS_fix_first_map) {
     // TODO(oalexan1): Make this work with N maps
@@ -227,20 +232,10 @@ int main(int argc, char** argv) {
   }
   
   // TODO(oalexan1): Throw out outliers!
-  rig::WriteNvm(out_map.cid_to_keypoint_map,
-                      out_map.cid_to_filename,
-                      out_map.pid_to_cid_fid,
-                      out_map.pid_to_xyz,
-                      out_map.cid_to_cam_t_global,
-                      FLAGS_output_map);
-
-  // Save the optical offsets
-  if (!FLAGS_no_shift) {
-    // Write the optical center offsets to a file
-    std::string offsets_file = rig::offsetsFilename(FLAGS_output_map);
-    rig::writeNvmOffsets(offsets_file, out_map.optical_centers);
-  }
-  
+  // Also save the optical center offsets, unless there is no shift
+  bool write_offsets = !FLAGS_no_shift;
+  rig::writeNvmData(out_map, write_offsets, FLAGS_output_map);
+
   return 0;
 }
 
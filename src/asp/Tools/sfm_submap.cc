@@ -21,6 +21,7 @@
 #include <Rig/rig_config.h>
 #include <Rig/basic_algs.h>
 #include <Rig/tensor.h>
+#include <asp/Core/Nvm.h>
 
 #include <opencv2/features2d/features2d.hpp>
 
@@ -54,10 +55,10 @@ namespace fs = boost::filesystem;
 // sfm_submap -input_map <input map> -output_map <output map> -image_list <file>
 
 DEFINE_string(input_map, "",
-              "The input map, in .nvm format.");
+              "The input map, in .nvm format, or binary .nvmb format.");
 
 DEFINE_string(output_map, "",
-              "The output map, in .nvm format.");
+              "The output map, in .nvm format, or binary .nvmb format.");
 
 DEFINE_string(image_list, "",
               "A file having the names of the images to be included in "
@@ -89,34 +90,21 @@ int main(int argc, char** argv) {
       images_to_keep.push_back(image);
   }
 
-  rig::nvmData nvm;
-  rig::ReadNvm(FLAGS_input_map, 
-                     nvm.cid_to_keypoint_map,  
-                     nvm.cid_to_filename,  
-                     nvm.pid_to_cid_fid,  
-                     nvm.pid_to_xyz,  
-                     nvm.cid_to_cam_t_global);
- 
+  // A binary nvm file has the offsets inside, if at all. For a text file,
+  // read them only if the offsets file exists.
   std::string offsets_file = rig::offsetsFilename(FLAGS_input_map);
-  if (!fs::exists(offsets_file))
-    std::cout << "WARNING: No offsets file found. Will not write offsets for the submap.\n";
-  else 
-    rig::readNvmOffsets(offsets_file, nvm.optical_centers);
+  bool read_offsets = (!asp::isBinaryNvm(FLAGS_input_map) && fs::exists(offsets_file));
+  bool read_tracks = true;
+  rig::nvmData nvm;
+  rig::readNvmData(FLAGS_input_map, read_offsets, read_tracks, nvm);
+  if (nvm.optical_centers.empty())
+    std::cout << "WARNING: No offsets found. Will not write offsets for the submap.\n";
 
   // Extract the submap. Will also extract a subset of the optical centers.
   sparse_mapping::ExtractSubmap(images_to_keep, nvm);
 
-  rig::WriteNvm(nvm.cid_to_keypoint_map,
-                      nvm.cid_to_filename,
-                      nvm.pid_to_cid_fid,
-                      nvm.pid_to_xyz,
-                      nvm.cid_to_cam_t_global,
-                      FLAGS_output_map);
-
-  if (std::ifstream(offsets_file)) {
-    std::string output_offsets_file = rig::offsetsFilename(FLAGS_output_map);
-    rig::writeNvmOffsets(output_offsets_file, nvm.optical_centers);
-  }
+  bool write_offsets = !nvm.optical_centers.empty();
+  rig::writeNvmData(nvm, write_offsets, FLAGS_output_map);
 
   return 0;
 }
@@ -15,8 +15,9 @@
 //  limitations under the License.
 // __END_LICENSE__
 
-// TODO(oalexan1): Move image logic to SfsImageProc.cc. Add also
-// SfS camera approx logic, and SfS cost function logic.
+// TODO(oalexan1): Move image logic to asp/Sfs/SfsImageProc.cc. Move there
+// also the SfS cost function logic. That needs the global state
+// (g_opt, g_dem, etc.) to first be made per-run.
 // Remove all logic with multiple DEM clips, it turned out not to work.
 // Remove all floating of cameras from the code and the doc, one has to use bundle adjust.
 // Then also remove all the logic using unadjusted cameras except the place
@@ -96,15 +97,26 @@
 #include <asp/Camera/CsmModel.h>
 #include <asp/Core/BundleAdjustUtils.h>
 #include <asp/Core/StereoSettings.h>
-#include <asp/Core/SfsImageProc.h>
+#include <asp/Sfs/SfsImageProc.h>
+#include <asp/Sfs/SfsImageCache.h>
+#include <asp/Sfs/SfsReflectanceModel.h>
+#include <asp/Sfs/SfsCamera.h>
+#include <asp/Sfs/SfsBatch.h>
+#include <asp/Camera/CameraBatch.h>
 #include <asp/Camera/RPCModelGen.h>
 
 #include <ceres/ceres.h>
 #include <ceres/loss_function.h>
 
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include<sys/types.h>
 
 #if defined(__GNUC__) || defined(__GNUG__)
@@ -117,9 +129,6 @@
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
-int g_num_locks = 0;
-int g_warning_count = 0;
-int g_max_warning_count = 1000;
 const size_t g_num_model_coeffs = 16;
 const size_t g_max_num_haze_coeffs = 6; // see nonlin_reflectance()
 
@@ -132,987 +141,23 @@ using namespace vw;
 using namespace vw::camera;
 using namespace vw::cartography;
 
+using asp::ApproxBaseCameraModel;
+using asp::ApproxCameraModel;
+using asp::ApproxAdjustedCameraModel;
+using asp::GlobalParams;
+using asp::ModelParams;
+using asp::ComputeReflectance;
+using asp::nonlin_reflectance;
+using asp::NO_REFL;
+using asp::LAMBERT;
+using asp::LUNAR_LAMBERT;
+using asp::HAPKE;
+using asp::ARBITRARY_MODEL;
+using asp::CHARON;
+
 typedef ImageViewRef<PixelMask<float>> MaskedImgT;
 typedef ImageViewRef<double> DoubleImgT;
 
-namespace vw { namespace camera {
-
-  // A base approx camera model class that will factor out some functionality
-  // from the two approx camera model classes we have below.
-  class ApproxBaseCameraModel: public CameraModel {
-
-  protected:
-    BBox2i m_img_bbox;
-    mutable BBox2 m_point_box, m_crop_box;
-    bool m_model_is_valid;
-    boost::shared_ptr<CameraModel> m_exact_unadjusted_camera;
-    AdjustedCameraModel m_exact_adjusted_camera;
-
-  public:
-
-    ApproxBaseCameraModel(AdjustedCameraModel const& exact_adjusted_camera,
-                          boost::shared_ptr<CameraModel> exact_unadjusted_camera,
-                          BBox2i img_bbox): m_exact_adjusted_camera(exact_adjusted_camera),
-                                            m_exact_unadjusted_camera(exact_unadjusted_camera),
-                                            m_img_bbox(img_bbox){}
-    
-    // The range of pixels in the image we are actually expected to use.
-    // Note that the function returns an alias, so that we can modify the
-    // crop box from outside.
-    BBox2 & crop_box(){
-      m_crop_box.crop(m_img_bbox);
-      return m_crop_box;
-    }
-
-    bool model_is_valid(){
-      return m_model_is_valid;
-    }
-    
-    boost::shared_ptr<CameraModel> exact_unadjusted_camera() const{
-      return m_exact_unadjusted_camera;
-    }
-    
-    AdjustedCameraModel exact_adjusted_camera() const{
-      return m_exact_adjusted_camera;
-    }
-    
-  };
-    
-  // This class provides an approximation for the point_to_pixel()
-  // function of an ISIS camera around a current DEM. The algorithm
-  // works by tabulation of point_to_pixel and pixel_to_vector values
-  // at the mean dem height.
-  class ApproxCameraModel: public ApproxBaseCameraModel {
-    mutable Vector3 m_mean_dir; // mean vector from camera to ground
-    GeoReference m_geo;
-    double m_mean_ht;
-    mutable ImageView< PixelMask<Vector3> > m_pixel_to_vec_mat;
-    mutable ImageView< PixelMask<Vector2> > m_point_to_pix_mat;
-    double m_approx_table_gridx, m_approx_table_gridy;
-    bool m_use_rpc_approximation, m_use_semi_approx;
-    vw::Mutex& m_camera_mutex;
-    Vector2 m_uncompValue;
-    mutable int m_begX, m_endX, m_begY, m_endY;
-    mutable bool m_compute_mean, m_stop_growing_range;
-    mutable int m_count;
-    boost::shared_ptr<asp::RPCModel> m_rpc_model;
-    
-    bool comp_rpc_approx_table(AdjustedCameraModel const& adj_camera,
-                               boost::shared_ptr<CameraModel> exact_unadjusted_camera,
-                               BBox2i img_bbox,
-                               ImageView<double> const& dem,
-                               GeoReference const& geo,
-                               double rpc_penalty_weight){
-
-      try {
-        // Generate point pairs
-        std::vector<Vector3> all_llh;
-        std::vector<Vector2> all_pixels;
-
-        vw_out() << "Projecting pixels into the camera to generate the RPC model.\n";
-        vw::TerminalProgressCallback tpc("asp", "\t--> ");
-        double inc_amount = 1.0 / double(dem.cols());
-        tpc.report_progress(0);
-
-        // If the DEM is too big, we need to skip points. About
-        // 40,000 points should be good enough to determine 78 RPC
-        // coefficients.
-        double num = 200.0;
-        double delta_col = std::max(1.0, dem.cols()/double(num));
-        double delta_row = std::max(1.0, dem.rows()/double(num));
-        BBox3 llh_box;
-        BBox2 pixel_box;
-        for (double dcol = 0; dcol < dem.cols(); dcol += delta_col) {
-          for (double drow = 0; drow < dem.rows(); drow += delta_row) {
-            int col = dcol, row = drow; // cast to int
-            Vector2 pix(col, row);
-            Vector2 lonlat = geo.pixel_to_lonlat(pix);
-          
-            // Lon lat height
-            Vector3 llh;
-            llh[0] = lonlat[0]; llh[1] = lonlat[1]; llh[2] = dem(col, row);
-            Vector3 xyz = geo.datum().geodetic_to_cartesian(llh);
-
-            // Go back to llh. This is a bugfix for the 360 deg offset problem.
-            llh = geo.datum().cartesian_to_geodetic(xyz);
-          
-            Vector2 cam_pix = exact_unadjusted_camera->point_to_pixel(xyz);
-            //if (!m_img_bbox.contains(cam_pix)) 
-            //  continue; // skip out of range pixels? Not a good idea.
-         
-            if (m_img_bbox.contains(cam_pix)) 
-              m_crop_box.grow(cam_pix);
-
-            all_llh.push_back(llh);
-            all_pixels.push_back(cam_pix);
-
-            llh_box.grow(llh);
-            pixel_box.grow(cam_pix);
-          }
-
-          tpc.report_incremental_progress( inc_amount );
-        }
-        tpc.report_finished();
-      
-        BBox2 ll_box;
-        ll_box.min() = subvector(llh_box.min(), 0, 2);
-        ll_box.max() = subvector(llh_box.max(), 0, 2);
-
-        BBox2 cropped_pixel_box = pixel_box;
-        cropped_pixel_box.crop(m_img_bbox);
-        if (cropped_pixel_box.empty()) {
-          vw_out() << "No points fall into the camera.\n";
-          return false;
-        }
-
-        if (ll_box.empty()) {
-          vw_out() << "Empty lon-lat box.\n";
-          return false;
-        }
-
-        // This is a bugfix. The RPC approximation works best when the
-        // input llh points are in an llh box whose sides are vertical
-        // and horizontal, rather than in a box which is rotated.
-        vw_out() << "Re-projecting pixels into the camera to improve accuracy.\n";
-        vw::TerminalProgressCallback tpc2("asp", "\t--> ");
-        double inc_amount2 = 1.0 / double(num);
-        tpc2.report_progress(0);
-        llh_box = BBox3();
-        pixel_box = BBox2();
-        all_llh.clear();
-        all_pixels.clear();
-        ImageViewRef<double> interp_dem
-          = interpolate(dem, BicubicInterpolation(), ConstantEdgeExtension());
-        double delta_lon = (ll_box.max()[0] - ll_box.min()[0])/double(num);
-        double delta_lat = (ll_box.max()[1] - ll_box.min()[1])/double(num);
-        for (double lon = ll_box.min()[0]; lon <= ll_box.max()[0] + delta_lon; lon += delta_lon) {
-          for (double lat = ll_box.min()[1]; lat <= ll_box.max()[1] + delta_lat; lat += delta_lat) {
-
-            Vector2 pix = geo.lonlat_to_pixel(Vector2(lon, lat));
-            if (pix[0] < 0 || pix[0] > dem.cols()-1) continue;
-            if (pix[1] < 0 || pix[1] > dem.rows()-1) continue;
-            double ht = interp_dem(pix[0], pix[1]);
-
-            // Lon lat height
-            Vector3 llh;
-            llh[0] = lon; llh[1] = lat; llh[2] = ht;
-            Vector3 xyz = geo.datum().geodetic_to_cartesian(llh);
-
-            // Later we will project DEM points into the adjusted camera.
-            // That is the same as projecting adjusted points into the exact camera.
-            // Hence, develop the RPC approximation using adjusted points.
-            // TODO: Maybe we should also ensure that the unadjusted xyz is
-            // also part of the model building? But probably not, as usually
-            // adjustments change very little, and this will increase run-time by 2x.
-            xyz = adj_camera.adjusted_point(xyz);
-            
-            // Go back to llh. This is a bugfix for the 360 deg offset problem.
-            llh = geo.datum().cartesian_to_geodetic(xyz);
-
-            Vector2 cam_pix = exact_unadjusted_camera->point_to_pixel(xyz);
-            //if (!m_img_bbox.contains(cam_pix)) 
-            //  continue; // skip out of range pixels? Not a good idea.
-         
-            if (m_img_bbox.contains(cam_pix)) 
-              m_crop_box.grow(cam_pix);
-
-            all_llh.push_back(llh);
-            all_pixels.push_back(cam_pix);
-            
-            llh_box.grow(llh);
-            pixel_box.grow(cam_pix);
-          }
-          
-          tpc2.report_incremental_progress( inc_amount2 );
-        }
-        tpc2.report_finished();
-
-        cropped_pixel_box = pixel_box;
-        cropped_pixel_box.crop(m_img_bbox);
-        if (cropped_pixel_box.empty()) {
-          vw_out() << "No points fall into the camera.\n";
-          return false;
-        }
-
-        ll_box.min() = subvector(llh_box.min(), 0, 2);
-        ll_box.max() = subvector(llh_box.max(), 0, 2);
-        if (ll_box.empty()) {
-          vw_out() << "Empty lon-lat box.\n";
-          return false;
-        }
-        
-        Vector3 llh_scale  = (llh_box.max() - llh_box.min())/2.0; // half range
-        Vector3 llh_offset = (llh_box.max() + llh_box.min())/2.0; // center point
-      
-        Vector2 pixel_scale  = (pixel_box.max() - pixel_box.min())/2.0; // half range 
-        Vector2 pixel_offset = (pixel_box.max() + pixel_box.min())/2.0; // center point
-
-        // Ensure we never divide by zero. For example, if the input dem heights are all constant,
-        // then the height scale will be zero from above.
-        for (size_t i = 0; i < llh_scale.size(); i++) 
-          if (llh_scale[i] == 0) llh_scale[i] = 1;
-        for (size_t i = 0; i < pixel_scale.size(); i++) 
-          if (pixel_scale[i] == 0) pixel_scale[i] = 1;
-        
-        vw_out() << "Lon-lat-height box for the RPC approx: " << llh_box   << std::endl;
-        vw_out() << "Camera pixel box for the RPC approx:   " << pixel_box << std::endl;
-
-        Vector<double> normalized_llh;
-        Vector<double> normalized_pixels;
-        int num_total_pts = all_llh.size();
-        normalized_llh.set_size(asp::RPCModel::GEODETIC_COORD_SIZE*num_total_pts);
-        normalized_pixels.set_size(asp::RPCModel::IMAGE_COORD_SIZE*num_total_pts
-                                   + asp::RpcSolveLMA::NUM_PENALTY_TERMS);
-        for (size_t i = 0; i < normalized_pixels.size(); i++) {
-          // Important: The extra penalty terms are all set to zero here.
-          normalized_pixels[i] = 0.0; 
-        }
-      
-        // Form the arrays of normalized pixels and normalized llh
-        for (int pt = 0; pt < num_total_pts; pt++) {
-    
-          // Normalize the pixel to -1 <> 1 range
-          Vector3 llh_n   = elem_quot(all_llh[pt]    - llh_offset,   llh_scale);
-          Vector2 pixel_n = elem_quot(all_pixels[pt] - pixel_offset, pixel_scale);
-          subvector(normalized_llh, asp::RPCModel::GEODETIC_COORD_SIZE*pt,
-                    asp::RPCModel::GEODETIC_COORD_SIZE) = llh_n;
-          subvector(normalized_pixels, asp::RPCModel::IMAGE_COORD_SIZE*pt,
-                    asp::RPCModel::IMAGE_COORD_SIZE   ) = pixel_n;
-    
-        }
-
-        // Find the RPC coefficients
-        asp::RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
-        std::string output_prefix = "";
-        vw_out() << "Generating the RPC approximation using " << num_total_pts << " point pairs.\n";
-        asp::gen_rpc(// Inputs
-                     rpc_penalty_weight, output_prefix,
-                     normalized_llh, normalized_pixels,  
-                     llh_scale, llh_offset, pixel_scale, pixel_offset,
-                     // Outputs
-                     line_num, line_den, samp_num, samp_den);
-      
-        m_rpc_model = boost::shared_ptr<asp::RPCModel>
-          (new asp::RPCModel(geo.datum(), line_num, line_den,
-                             samp_num, samp_den, pixel_offset, pixel_scale,
-                             llh_offset, llh_scale));
-      } catch (std::exception const& e) {
-        vw_out() << e.what() << std::endl;
-        return false;
-      }      
-      
-      return true;
-    }
-    
-    void comp_entries_in_table() const{
-      for (int x = m_begX; x <= m_endX; x++) {
-        for (int y = m_begY; y <= m_endY; y++) {
-      
-          // This will be useful when we invoke this function repeatedly
-          if (m_point_to_pix_mat(x, y).child() != m_uncompValue) {
-            continue;
-          }
-      
-          Vector2 pt(m_point_box.min().x() + x*m_approx_table_gridx,
-                     m_point_box.min().y() + y*m_approx_table_gridy);
-          Vector2 lonlat = m_geo.point_to_lonlat(pt);
-          Vector3 xyz = m_geo.datum().geodetic_to_cartesian
-            (Vector3(lonlat[0], lonlat[1], m_mean_ht));
-          bool success = true;
-          Vector2 pix;
-          Vector3 vec;
-          try {
-            pix = m_exact_unadjusted_camera->point_to_pixel(xyz);
-            //if (true || m_img_bbox.contains(pix))  // Need to think more here
-            vec = m_exact_unadjusted_camera->pixel_to_vector(pix);
-            //else
-            // success = false;
-            
-          }catch(...){
-            success = false;
-          }
-          if (success) {
-            m_pixel_to_vec_mat(x, y) = vec;
-            m_point_to_pix_mat(x, y) = pix;
-            m_pixel_to_vec_mat(x, y).validate();
-            m_point_to_pix_mat(x, y).validate();
-            if (m_compute_mean) {
-              m_mean_dir += vec; // only when the point projects inside the camera?
-              if (m_img_bbox.contains(pix)) 
-                m_crop_box.grow(pix);
-              m_count++;
-            }
-          }else{
-            m_pixel_to_vec_mat(x, y).invalidate();
-            m_point_to_pix_mat(x, y).invalidate();
-          }
-        }
-      }
-      
-    }
-    
-  public:
-
-    ApproxCameraModel(AdjustedCameraModel const& exact_adjusted_camera,
-                      boost::shared_ptr<CameraModel> exact_unadjusted_camera,
-                      BBox2i img_bbox, 
-                      ImageView<double> const& dem,
-                      GeoReference const& geo,
-                      double nodata_val,
-                      bool use_rpc_approximation, bool use_semi_approx,
-                      double rpc_penalty_weight,
-                      vw::Mutex &camera_mutex):
-      ApproxBaseCameraModel(exact_adjusted_camera, exact_unadjusted_camera, img_bbox),
-      m_geo(geo),
-      m_use_rpc_approximation(use_rpc_approximation),
-      m_use_semi_approx(use_semi_approx),
-      m_camera_mutex(camera_mutex) {
-
-      // Initialize members of the base class
-      m_model_is_valid = true;
-      
-      int big = 1e+8;
-      m_uncompValue = Vector2(-big, -big);
-      m_compute_mean = true; // We'll set this to false when we finish estimating the mean
-      m_stop_growing_range = false; // stop when it does not help
-      
-      if (dynamic_cast<IsisCameraModel*>(exact_unadjusted_camera.get()) == NULL)
-        vw_throw( ArgumentErr()
-                  << "ApproxCameraModel: Expecting an unadjusted camera model.\n");
-
-      // Compute the mean DEM height.
-      // We expect all DEM entries to be valid.
-      m_mean_ht = 0;
-      double num = 0.0;
-      for (int col = 0; col < dem.cols(); col++) {
-        for (int row = 0; row < dem.rows(); row++) {
-          if (dem(col, row) == nodata_val)
-            vw_throw( ArgumentErr()
-                      << "ApproxCameraModel: Expecting a DEM without nodata values.\n");
-          m_mean_ht += dem(col, row);
-          num += 1.0;
-        }
-      }
-      if (num > 0) m_mean_ht /= num;
-
-      // The area we're supposed to work around
-      m_point_box = m_geo.pixel_to_point_bbox(bounding_box(dem));
-      double wx = m_point_box.width(), wy = m_point_box.height();
-      m_approx_table_gridx = wx/std::max(dem.cols(), 1);
-      m_approx_table_gridy = wy/std::max(dem.rows(), 1);
-
-      if (m_approx_table_gridx == 0 || m_approx_table_gridy == 0) {
-        vw_throw( ArgumentErr()
-                  << "ApproxCameraModel: Expecting a positive grid size.\n");
-      }
-
-      // Expand the box, as later the DEM will change. 
-      double extra = 1.00; // may need to lower here!
-      m_point_box.min().x() -= extra*wx; m_point_box.max().x() += extra*wx;
-      m_point_box.min().y() -= extra*wy; m_point_box.max().y() += extra*wy;
-      wx = m_point_box.width();
-      wy = m_point_box.height();
-
-      vw_out() << "Approximation proj box: " << m_point_box << std::endl;
-
-      if (m_use_semi_approx)
-        return;
-      
-      // Bypass everything if doing RPC
-      if (m_use_rpc_approximation) {
-        m_model_is_valid = comp_rpc_approx_table(exact_adjusted_camera,
-                                                 exact_unadjusted_camera, m_img_bbox,
-                                                 dem,  geo, rpc_penalty_weight);
-        
-        // Ensure the box is valid
-        //if (m_crop_box.empty()) m_crop_box = BBox2(0, 0, 2, 2);
-    
-#if 1
-        // Expand the box a bit, as later the DEM will change and values at some
-        // new pixels will be needed.
-        m_crop_box.crop(m_img_bbox);
-        if (!m_crop_box.empty()) {
-          double wd = m_crop_box.width();
-          double ht = m_crop_box.height();
-          m_crop_box.min().x() -= extra*wd; m_crop_box.max().x() += extra*wd;
-          m_crop_box.min().y() -= extra*ht; m_crop_box.max().y() += extra*ht;
-          m_crop_box = grow_bbox_to_int(m_crop_box);
-        }
-        m_crop_box.crop(m_img_bbox);
-#endif
-
-        return;
-      }
-      
-      // We will tabulate the point_to_pixel function at a multiple of
-      // the grid, and we'll use interpolation for anything in
-      // between.
-      //m_approx_table_gridx /= 2.0; m_approx_table_gridy /= 2.0; // fine
-      m_approx_table_gridx *= 2.0; m_approx_table_gridy *= 2.0; // coarse. good enough.
-
-      int numx = wx/m_approx_table_gridx;
-      int numy = wy/m_approx_table_gridy;
-
-      vw_out() << "Lookup table dimensions: " << numx << ' ' << numy << std::endl;
-
-      // Choose f so that the width from m_begX to m_endX is 2 x original wx
-      double f = 0; // (extra-0.5)/(2.0*extra+1.0);
-      m_begX = f*numx; m_endX = std::min((1.0-f)*numx, numx-1.0);
-      m_begY = f*numy; m_endY = std::min((1.0-f)*numy, numy-1.0);
-      
-      //vw_out() << "Size of actually pre-computed table: "
-      //           << m_endX - m_begX << ' ' << m_endY - m_begY << std::endl;
-      
-      // Mark all values as uncomputed and invalid
-      m_pixel_to_vec_mat.set_size(numx, numy);
-      m_point_to_pix_mat.set_size(numx, numy);
-      for (int x = 0; x < numx; x++) {
-        for (int y = 0; y < numy; y++) {
-          m_point_to_pix_mat(x, y) = m_uncompValue;
-          m_point_to_pix_mat(x, y).invalidate();
-        }
-      }
-      
-      // Fill in the table. Find along the way the mean direction from
-      // the camera to the ground. Invalid values will be masked.
-      m_count = 0;
-      m_mean_dir = Vector3();
-      comp_entries_in_table();
-      m_mean_dir /= std::max(1, m_count);
-      m_mean_dir = m_mean_dir/norm_2(m_mean_dir);
-      m_compute_mean = false; // done computing the mean
-      
-      // Ensure the box is valid
-      //if (m_crop_box.empty()) m_crop_box = BBox2(0, 0, 2, 2);
-
-#if 1
-      // Expansion should not be necessary, as we already expanded
-      // m_point_box and we used that expanded box to compute m_crop_box.
-      m_crop_box.crop(m_img_bbox);
-      if (!m_crop_box.empty()) {
-        // Expand the box a bit, as later the DEM will change and values at some
-        // new pixels will be needed.
-        double wd = m_crop_box.width();
-        double ht = m_crop_box.height();
-        double extra2 = 0.25; // still, just in case, a bit more expansion
-        m_crop_box.min().x() -= extra2*wd; m_crop_box.max().x() += extra2*wd;
-        m_crop_box.min().y() -= extra2*ht; m_crop_box.max().y() += extra2*ht;
-        m_crop_box = grow_bbox_to_int(m_crop_box);
-      }
-      m_crop_box.crop(m_img_bbox);
-#endif
-
-      return;
-    }
-
-    // We have tabulated point_to_pixel at the mean dem height.
-    // Look-up point_to_pixel for the current point by first
-    // intersecting the ray from the current point to the camera
-    // with the datum at that height. We don't know that ray,
-    // so we iterate to find it.
-    virtual Vector2 point_to_pixel(Vector3 const& xyz) const{
-
-      if (m_use_semi_approx){
-        vw::Mutex::Lock lock(m_camera_mutex);
-        g_num_locks++;
-        return m_exact_unadjusted_camera->point_to_pixel(xyz);
-      }
-      
-      if (m_use_rpc_approximation) 
-        return m_rpc_model->point_to_pixel(xyz);
-      
-      // TODO: What happens if we use bicubic interpolation?
-      InterpolationView<EdgeExtensionView< ImageView< PixelMask<Vector3> >, ConstantEdgeExtension >, BilinearInterpolation> pixel_to_vec_interp
-        = interpolate(m_pixel_to_vec_mat, BilinearInterpolation(),
-                      ConstantEdgeExtension());
-
-      InterpolationView<EdgeExtensionView< ImageView< PixelMask<Vector2> >, ConstantEdgeExtension >, BilinearInterpolation> point_to_pix_interp
-        = interpolate(m_point_to_pix_mat, BilinearInterpolation(),
-                      ConstantEdgeExtension());
-
-      Vector3 dir = m_mean_dir;
-      Vector2 pix;
-      double major_radius = m_geo.datum().semi_major_axis() + m_mean_ht;
-      double minor_radius = m_geo.datum().semi_minor_axis() + m_mean_ht;
-      for (size_t i = 0; i < 10; i++) {
-
-        Vector3 S = xyz - 1.1*major_radius*dir; // push the point outside the sphere
-        if (norm_2(S) <= major_radius) {
-          // should not happen. Return the exact solution.
-          {
-            vw::Mutex::Lock lock(m_camera_mutex);
-            g_num_locks++;
-            if (g_warning_count < g_max_warning_count) {
-              g_warning_count++;
-              vw_out(WarningMessage) << "3D point is inside the planet.\n";
-            }
-            return m_exact_unadjusted_camera->point_to_pixel(xyz);
-          }
-        }
-
-        Vector3 datum_pt = datum_intersection(major_radius, minor_radius, S, dir);
-        Vector3 llh = m_geo.datum().cartesian_to_geodetic(datum_pt);
-        Vector2 pt = m_geo.lonlat_to_point(subvector(llh, 0, 2));
-
-        // Indices
-        double x = (pt.x() - m_point_box.min().x())/m_approx_table_gridx;
-        double y = (pt.y() - m_point_box.min().y())/m_approx_table_gridy;
-
-        bool out_of_range = ( x < 0 || x >= m_pixel_to_vec_mat.cols()-1 ||
-                              y < 0 || y >= m_pixel_to_vec_mat.rows()-1 );
-
-        bool out_of_comp_range = (x < m_begX || x >= m_endX-1 ||
-                                  y < m_begY || y >= m_endY-1);
-
-        // If we are not out of range, but we need to expand the computed table, do that
-        if (!m_stop_growing_range && !out_of_range && out_of_comp_range) {
-          vw::Mutex::Lock lock(m_camera_mutex);
-          g_num_locks++;
-          if (g_warning_count < g_max_warning_count) {
-            g_warning_count++;
-            vw_out(WarningMessage) << "Pixel outside of computed range. "
-                                   << "Growing the computed table." << std::endl;
-            vw_out(WarningMessage) << "Start table: " << m_begX << ' ' << m_begY << ' '
-                                   << m_endX << ' ' << m_endY << std::endl;
-          }
-          
-          // If we have to expand, do it by a lot
-          int extrax = std::max(10, int(0.1*(m_endX - m_begX)));
-          int extray = std::max(10, int(0.1*(m_endY - m_begY)));
-
-          int old_begX = m_begX, old_begY = m_begY;
-          int old_endX = m_endX, old_endY = m_endY;
-
-          m_begX = std::min(m_begX, int(floor(x))) - extrax; m_begX = std::max(0, m_begX);
-          m_begY = std::min(m_begY, int(floor(y))) - extray; m_begY = std::max(0, m_begY);
-      
-          m_endX = std::max(m_endX, int(ceil(x))) + extrax;
-          m_endX = std::min(m_pixel_to_vec_mat.cols()-1, m_endX);
-
-          m_endY = std::max(m_endY, int(ceil(y))) + extray;
-          m_endY = std::min(m_pixel_to_vec_mat.rows()-1, m_endY);
-      
-          if (g_warning_count < g_max_warning_count) {
-            vw_out(WarningMessage) << "Updated table: " << m_begX << ' ' << m_begY << ' '
-                                   << m_endX << ' ' << m_endY << std::endl;
-          }
-          comp_entries_in_table();
-
-          // Update this
-          out_of_comp_range = (x < m_begX || x >= m_endX-1 ||
-                               y < m_begY || y >= m_endY-1);
-
-          // Avoid an infinite loop if we can't grow the table
-          if (old_begX == m_begX && old_begY == m_begY &&
-              old_endX == m_endX && old_endY == m_endY ) {
-            m_stop_growing_range = true;
-          }
-        }
-
-        if (out_of_range || out_of_comp_range){
-          vw::Mutex::Lock lock(m_camera_mutex);
-          g_num_locks++;
-          if (g_warning_count < g_max_warning_count) {
-            g_warning_count++;
-            vw_out(WarningMessage) << "Pixel outside of range. Current values and range: "  << ' '
-                                   << x << ' ' << y << ' '
-                                   << m_pixel_to_vec_mat.cols() << ' ' << m_pixel_to_vec_mat.rows()
-                                   << std::endl;
-          }
-          return m_exact_unadjusted_camera->point_to_pixel(xyz);
-        }
-        PixelMask<Vector3> masked_dir = pixel_to_vec_interp(x, y);
-        PixelMask<Vector2> masked_pix = point_to_pix_interp(x, y);
-
-        if (is_valid(masked_dir) && is_valid(masked_pix)) {
-          dir = masked_dir.child();
-          pix = masked_pix.child();
-        }else{
-          {
-            vw::Mutex::Lock lock(m_camera_mutex);
-            g_num_locks++;
-            if (g_warning_count < g_max_warning_count) {
-              g_warning_count++;
-              vw_out(WarningMessage) << "Invalid ground to camera direction: "
-                                     << masked_dir << ' ' << masked_pix << std::endl;
-            }
-            return m_exact_unadjusted_camera->point_to_pixel(xyz);
-          }
-        }
-      }
-
-      return pix;
-    }
-
-    virtual ~ApproxCameraModel(){}
-    virtual std::string type() const{ return "ApproxIsis"; }
-
-    virtual Vector3 pixel_to_vector(Vector2 const& pix) const {
-
-      if (m_use_semi_approx) {
-        vw::Mutex::Lock lock(m_camera_mutex);
-        g_num_locks++;
-        return this->exact_unadjusted_camera()->pixel_to_vector(pix);
-      }
-
-      if (m_use_rpc_approximation){
-        return m_rpc_model->pixel_to_vector(pix);
-      }
-      
-      vw::Mutex::Lock lock(m_camera_mutex);
-      g_num_locks++;
-      if (g_warning_count < g_max_warning_count) {
-        g_warning_count++;
-        vw_out(WarningMessage) << "Invoked exact camera model pixel_to_vector for pixel: "
-                               << pix << std::endl;
-      }
-      return this->exact_unadjusted_camera()->pixel_to_vector(pix);
-    }
-
-    virtual Vector3 camera_center(Vector2 const& pix) const{
-      // It is tricky to approximate the camera center
-      //if (m_use_rpc_approximation){
-      vw::Mutex::Lock lock(m_camera_mutex);
-      g_num_locks++;
-      //vw_out(WarningMessage) << "Invoked the camera center function for pixel: "
-      //                       << pix << std::endl;
-      return this->exact_unadjusted_camera()->camera_center(pix);
-      //return m_rpc_model->camera_center(pix);
-      //}
-
-#if 0
-      // TODO: Is this function invoked? Should just the underlying exact model
-      // camera center be used all the time?
-      InterpolationView<EdgeExtensionView< ImageView< PixelMask<Vector3> >, ConstantEdgeExtension >, BilinearInterpolation> camera_center_interp
-        = interpolate(m_camera_center_mat, BilinearInterpolation(),
-                      ConstantEdgeExtension());
-      double lx = pix[0] - m_crop_box.min().x();
-      double ly = pix[1] - m_crop_box.min().y();
-      if (0 <= lx && lx < m_camera_center_mat.cols() - 1 &&
-          0 <= ly && ly < m_camera_center_mat.rows() - 1 ) {
-        PixelMask<Vector3> ctr = camera_center_interp(lx, ly);
-        if (is_valid(ctr))
-          return ctr.child();
-      }
-#endif
-      
-      {
-        // Failed to interpolate
-        vw::Mutex::Lock lock(m_camera_mutex);
-        g_num_locks++;
-        if (g_warning_count < g_max_warning_count) {
-          g_warning_count++;
-          vw_out(WarningMessage) << "Invoked the camera center function for pixel: "
-                                 << pix << std::endl;
-        }
-        return this->exact_unadjusted_camera()->camera_center(pix);
-      }
-
-    }
-
-    virtual Quat camera_pose(Vector2 const& pix) const{
-      vw::Mutex::Lock lock(m_camera_mutex);
-      g_num_locks++;
-      if (g_warning_count < g_max_warning_count) {
-        g_warning_count++;
-        vw_out(WarningMessage) << "Invoked the camera pose function for pixel: "
-                               << pix << std::endl;
-      }
-      return this->exact_unadjusted_camera()->camera_pose(pix);
-    }
-
-  };
-
-  // TODO(oalexan1): Must use the adjusted model in the camera center
-  // and camera pose functions!
-  // This class provides an approximation for an adjusted ISIS camera
-  // model around a current DEM. Unlike the ApproxCameraModel class,
-  // here the adjusted camera is approximated, not the unadjusted one,
-  // hence the adjustments and the cameras themselves cannot be
-  // floated with this class. Keeping the cameras fixed allows the
-  // domain of approximation to be narrower so using less memory. The
-  // algorithm works by tabulation of point_to_pixel and
-  // pixel_to_vector values at the mean dem height.
-  class ApproxAdjustedCameraModel: public ApproxBaseCameraModel {
-    mutable Vector3 m_mean_dir; // mean vector from camera to ground
-    GeoReference m_geo;
-    double m_mean_ht;
-    mutable ImageView< PixelMask<Vector3> > m_pixel_to_vec_mat;
-    mutable ImageView< PixelMask<Vector2> > m_point_to_pix_mat;
-    double m_approx_table_gridx, m_approx_table_gridy;
-    vw::Mutex& m_camera_mutex;
-    Vector2 m_uncompValue;
-    mutable int m_begX, m_endX, m_begY, m_endY;
-    mutable int m_count;
-    
-    void comp_entries_in_table() const{
-      for (int x = m_begX; x <= m_endX; x++) {
-        for (int y = m_begY; y <= m_endY; y++) {
-      
-          // This will be useful when we invoke this function repeatedly
-          if (m_point_to_pix_mat(x, y).child() != m_uncompValue) {
-            continue;
-          }
-      
-          Vector2 pt(m_point_box.min().x() + x*m_approx_table_gridx,
-                     m_point_box.min().y() + y*m_approx_table_gridy);
-          Vector2 lonlat = m_geo.point_to_lonlat(pt);
-          Vector3 xyz = m_geo.datum().geodetic_to_cartesian
-            (Vector3(lonlat[0], lonlat[1], m_mean_ht));
-          bool success = true;
-          Vector2 pix;
-          Vector3 vec;
-          try {
-            pix = m_exact_adjusted_camera.point_to_pixel(xyz);
-            //if (true || m_img_bbox.contains(pix))  // Need to think more here
-            vec = m_exact_adjusted_camera.pixel_to_vector(pix);
-            //else
-            // success = false;
-            
-          }catch(...){
-            success = false;
-          }
-          if (success) {
-            m_pixel_to_vec_mat(x, y) = vec;
-            m_point_to_pix_mat(x, y) = pix;
-            m_pixel_to_vec_mat(x, y).validate();
-            m_point_to_pix_mat(x, y).validate();
-            m_mean_dir += vec; // only when the point projects inside the camera?
-            if (m_img_bbox.contains(pix)) 
-              m_crop_box.grow(pix);
-            m_count++;
-          }else{
-            m_pixel_to_vec_mat(x, y).invalidate();
-            m_point_to_pix_mat(x, y).invalidate();
-          }
-        }
-      }
-      
-    }
-    
-  public:
-
-    ApproxAdjustedCameraModel(AdjustedCameraModel const& exact_adjusted_camera,
-                              boost::shared_ptr<CameraModel> exact_unadjusted_camera,
-                              BBox2i img_bbox, 
-                              ImageView<double> const& dem,
-                              GeoReference const& geo,
-                              double nodata_val,
-                              vw::Mutex &camera_mutex):
-      ApproxBaseCameraModel(exact_adjusted_camera, exact_unadjusted_camera, img_bbox),
-      m_geo(geo), m_camera_mutex(camera_mutex) {
-
-      // Initialize members of the base class
-      m_model_is_valid = true;
-
-      int big = 1e+8;
-      m_uncompValue = Vector2(-big, -big);
-      
-      if (dynamic_cast<AdjustedCameraModel*>(exact_unadjusted_camera.get()) != NULL)
-        vw_throw( ArgumentErr()
-                  << "ApproxAdjustedCameraModel: Expecting an unadjusted camera model.\n");
-
-      // Compute the mean DEM height.
-      // We expect all DEM entries to be valid.
-      m_mean_ht = 0;
-      double num = 0.0;
-      for (int col = 0; col < dem.cols(); col++) {
-        for (int row = 0; row < dem.rows(); row++) {
-          if (dem(col, row) == nodata_val)
-            vw_throw( ArgumentErr()
-                      << "ApproxAdjustedCameraModel: Expecting a DEM without nodata values.\n");
-          m_mean_ht += dem(col, row);
-          num += 1.0;
-        }
-      }
-      if (num > 0) m_mean_ht /= num;
-
-      // The area we're supposed to work around
-      m_point_box = m_geo.pixel_to_point_bbox(bounding_box(dem));
-      double wx = m_point_box.width(), wy = m_point_box.height();
-      m_approx_table_gridx = wx/std::max(dem.cols(), 1);
-      m_approx_table_gridy = wy/std::max(dem.rows(), 1);
-
-      if (m_approx_table_gridx == 0 || m_approx_table_gridy == 0) {
-        vw_throw( ArgumentErr()
-                  << "ApproxAdjustedCameraModel: Expecting a positive grid size.\n");
-      }
-
-      // Expand the box, as later the DEM will change. 
-      double extra = 0.5;
-      m_point_box.min().x() -= extra*wx; m_point_box.max().x() += extra*wx;
-      m_point_box.min().y() -= extra*wy; m_point_box.max().y() += extra*wy;
-      wx = m_point_box.width();
-      wy = m_point_box.height();
-
-      vw_out() << "Approximation proj box: " << m_point_box << std::endl;
-
-      // We will tabulate the point_to_pixel function at a multiple of
-      // the grid, and we'll use interpolation for anything in
-      // between.
-      //m_approx_table_gridx /= 2.0; m_approx_table_gridy /= 2.0; // fine
-      m_approx_table_gridx *= 2.0; m_approx_table_gridy *= 2.0; // Coarse. Good enough.
-
-      int numx = wx/m_approx_table_gridx;
-      int numy = wy/m_approx_table_gridy;
-
-      vw_out() << "Lookup table dimensions: " << numx << ' ' << numy << std::endl;
-
-      m_begX = 0; m_endX = numx-1;
-      m_begY = 0; m_endY = numy-1;
-      
-      //vw_out() << "Size of actually pre-computed table: "
-      //           << m_endX - m_begX << ' ' << m_endY - m_begY << std::endl;
-      
-      // Mark all values as uncomputed and invalid
-      m_pixel_to_vec_mat.set_size(numx, numy);
-      m_point_to_pix_mat.set_size(numx, numy);
-      for (int x = 0; x < numx; x++) {
-        for (int y = 0; y < numy; y++) {
-          m_point_to_pix_mat(x, y) = m_uncompValue;
-          m_point_to_pix_mat(x, y).invalidate();
-        }
-      }
-      
-      // Fill in the table. Find along the way the mean direction from
-      // the camera to the ground. Invalid values will be masked.
-      m_count = 0;
-      m_mean_dir = Vector3();
-      comp_entries_in_table();
-      m_mean_dir /= std::max(1, m_count);
-      m_mean_dir = m_mean_dir/norm_2(m_mean_dir);
-      
-      m_crop_box.crop(m_img_bbox);
-
-      return;
-    }
-
-    // We have tabulated point_to_pixel at the mean dem height.
-    // Look-up point_to_pixel for the current point by first
-    // intersecting the ray from the current point to the camera
-    // with the datum at that height. We don't know that ray,
-    // so we iterate to find it.
-    virtual Vector2 point_to_pixel(Vector3 const& xyz) const{
-
-      // TODO: What happens if we use bicubic interpolation?
-      InterpolationView<EdgeExtensionView< ImageView< PixelMask<Vector3> >, ConstantEdgeExtension >, BilinearInterpolation> pixel_to_vec_interp
-        = interpolate(m_pixel_to_vec_mat, BilinearInterpolation(),
-                      ConstantEdgeExtension());
-
-      InterpolationView<EdgeExtensionView< ImageView< PixelMask<Vector2> >, ConstantEdgeExtension >, BilinearInterpolation> point_to_pix_interp
-        = interpolate(m_point_to_pix_mat, BilinearInterpolation(),
-                      ConstantEdgeExtension());
-
-      Vector3 dir = m_mean_dir;
-      Vector2 pix;
-      double major_radius = m_geo.datum().semi_major_axis() + m_mean_ht;
-      double minor_radius = m_geo.datum().semi_minor_axis() + m_mean_ht;
-      for (size_t i = 0; i < 10; i++) {
-
-        Vector3 S = xyz - 1.1*major_radius*dir; // push the point outside the sphere
-        if (norm_2(S) <= major_radius) {
-          // should not happen. Return the exact solution.
-          {
-            vw::Mutex::Lock lock(m_camera_mutex);
-            g_num_locks++;
-            if (g_warning_count < g_max_warning_count) {
-              g_warning_count++;
-              vw_out(WarningMessage) << "3D point is inside the planet.\n";
-            }
-            return m_exact_adjusted_camera.point_to_pixel(xyz);
-          }
-        }
-
-        Vector3 datum_pt = datum_intersection(major_radius, minor_radius, S, dir);
-        Vector3 llh = m_geo.datum().cartesian_to_geodetic(datum_pt);
-        Vector2 pt = m_geo.lonlat_to_point(subvector(llh, 0, 2));
-
-        // Indices
-        double x = (pt.x() - m_point_box.min().x())/m_approx_table_gridx;
-        double y = (pt.y() - m_point_box.min().y())/m_approx_table_gridy;
-
-        bool out_of_range = (x < m_begX || x >= m_endX-1 ||
-                             y < m_begY || y >= m_endY-1);
-
-        // If out of range, return the exact result. This should be very slow.
-        // The hope is that it will be very rare.
-        if (out_of_range){
-          vw::Mutex::Lock lock(m_camera_mutex);
-          g_num_locks++;
-          if (g_warning_count < g_max_warning_count) {
-            g_warning_count++;
-            vw_out(WarningMessage) << "Pixel outside of range. Current values and range: "  << ' '
-                                   << x << ' ' << y << ' '
-                                   << m_pixel_to_vec_mat.cols() << ' ' << m_pixel_to_vec_mat.rows()
-                                   << std::endl;
-          }
-          return m_exact_adjusted_camera.point_to_pixel(xyz);
-        }
-        
-        PixelMask<Vector3> masked_dir = pixel_to_vec_interp(x, y);
-        PixelMask<Vector2> masked_pix = point_to_pix_interp(x, y);
-        if (is_valid(masked_dir) && is_valid(masked_pix)) {
-          dir = masked_dir.child();
-          pix = masked_pix.child();
-        }else{
-          {
-            vw::Mutex::Lock lock(m_camera_mutex);
-            g_num_locks++;
-            if (g_warning_count < g_max_warning_count) {
-              g_warning_count++;
-              vw_out(WarningMessage) << "Invalid ground to camera direction: "
-                                     << masked_dir << ' ' << masked_pix << std::endl;
-            }
-            return m_exact_adjusted_camera.point_to_pixel(xyz);
-          }
-        }
-      }
-
-      return pix;
-    }
-
-    virtual ~ApproxAdjustedCameraModel(){}
-    virtual std::string type() const{ return "ApproxAdjustedIsis"; }
-
-    virtual Vector3 pixel_to_vector(Vector2 const& pix) const {
-
-      vw::Mutex::Lock lock(m_camera_mutex);
-      g_num_locks++;
-      if (g_warning_count < g_max_warning_count) {
-        g_warning_count++;
-        vw_out(WarningMessage) << "Invoked exact camera model pixel_to_vector for pixel: "
-                               << pix << std::endl;
-      }
-      // TODO(oalexan1): Put here the exact adjusted camera!
-      return this->exact_unadjusted_camera()->pixel_to_vector(pix);
-    }
-
-    virtual Vector3 camera_center(Vector2 const& pix) const{
-      // It is tricky to approximate the camera center
-      // TODO(oalexan1): Must apply the adjustment here?
-      vw::Mutex::Lock lock(m_camera_mutex);
-      g_num_locks++;
-      // TODO(oalexan1): Put here the exact adjusted camera!
-      return this->exact_unadjusted_camera()->camera_center(pix);
-    }
-
-    virtual Quat camera_pose(Vector2 const& pix) const{
-      // TODO(oalexan1): Must apply the adjustment here?!!!
-      vw::Mutex::Lock lock(m_camera_mutex);
-      g_num_locks++;
-      if (g_warning_count < g_max_warning_count) {
-        g_warning_count++;
-        vw_out(WarningMessage) << "Invoked the camera pose function for pixel: "
-                               << pix << std::endl;
-      }
-      // TODO(oalexan1): Put here the exact adjusted camera!
-      return this->exact_unadjusted_camera()->camera_pose(pix);
-    }
-
-  };
-  
-}}
-
 // Get the memory usage for the given process. This is for debugging, not used
 // in production code. It does not work on OSX.
 void callTop() {
@@ -1161,6 +206,7 @@ void compute_image_stats(ImageT const& I1, ImageT const& I2,
 
 struct Options : public vw::GdalWriteOptions {
   std::string input_dems_str, image_list, camera_list, out_prefix, stereo_session, bundle_adjust_prefix;
+  std::string approx_camera_cache_dir;
   std::vector<std::string> input_dems, input_images, input_cameras;
   std::string shadow_thresholds, custom_shadow_threshold_list, max_valid_image_vals, skip_images_str, image_exposure_prefix, model_coeffs_prefix, model_coeffs, image_haze_prefix, sun_positions_list;
   std::vector<float> shadow_threshold_vec, max_valid_image_vals_vec;
@@ -1169,7 +215,7 @@ struct Options : public vw::GdalWriteOptions {
   std::vector<double> model_coeffs_vec;
   std::vector<std::set<int>> skip_images;
   int max_iterations, max_coarse_iterations, reflectance_type, coarse_levels,
-    blending_dist, min_blend_size, num_haze_coeffs;
+    blending_dist, min_blend_size, num_haze_coeffs, query_coverage_spacing;
   bool float_albedo, float_exposure, float_cameras, float_all_cameras, model_shadows,
     save_computed_intensity_only, estimate_slope_errors, estimate_height_errors,
     compute_exposures_only,
@@ -1186,13 +232,14 @@ struct Options : public vw::GdalWriteOptions {
     nodata_val, initial_dem_constraint_weight, albedo_constraint_weight,
     albedo_robust_threshold,
     camera_position_step_size, rpc_penalty_weight, rpc_max_error,
-    unreliable_intensity_threshold, robust_threshold, shadow_threshold;
+    unreliable_intensity_threshold, robust_threshold, shadow_threshold,
+    image_cache_size_mb, coarse_function_tolerance;
   vw::BBox2 crop_win;
   vw::Vector2 height_error_params;
   
   Options():max_iterations(0), max_coarse_iterations(0), reflectance_type(0),
             coarse_levels(0), blending_dist(0), blending_power(2.0),
-            min_blend_size(0), num_haze_coeffs(0),
+            min_blend_size(0), num_haze_coeffs(0), query_coverage_spacing(0),
             float_albedo(false), float_exposure(false), float_cameras(false),
             float_all_cameras(false),
             model_shadows(false), 
@@ -1218,454 +265,11 @@ struct Options : public vw::GdalWriteOptions {
             albedo_constraint_weight(0.0), albedo_robust_threshold(0.0),
             camera_position_step_size(1.0), rpc_penalty_weight(0.0),
             rpc_max_error(0.0),
-            unreliable_intensity_threshold(0.0),
+            unreliable_intensity_threshold(0.0), image_cache_size_mb(0.0),
+            coarse_function_tolerance(0.0),
             crop_win(BBox2i(0, 0, 0, 0)){}
 };
 
-struct GlobalParams{
-  int reflectanceType;
-  // Two parameters used in the formula for the Lunar-Lambertian
-  // reflectance
-  double phaseCoeffC1, phaseCoeffC2;
-};
-
-struct ModelParams {
-  vw::Vector3 sunPosition; //relative to the center of the Moon
-  ModelParams(){}
-  ~ModelParams(){}
-};
-
-// Make the reflectance nonlinear using a rational function
-double nonlin_reflectance(double reflectance, double exposure,
-                          double steepness_factor,
-                          double const* haze, int num_haze_coeffs){
-
-  // Make the exposure smaller. This will result in higher reflectance
-  // to compensate, as intensity = exposure * reflectance, hence
-  // steeper terrain. Things become more complicated if the haze
-  // and nonlinear reflectance is modeled.
-  exposure /= steepness_factor;
-  
-  double r = reflectance; // for short
-  if (num_haze_coeffs == 0) return (exposure*r);
-  if (num_haze_coeffs == 1) return (exposure*r + haze[0]);
-  if (num_haze_coeffs == 2) return (exposure*r + haze[0])/(haze[1]*r + 1);
-  if (num_haze_coeffs == 3) return (haze[2]*r*r + exposure*r + haze[0])/(haze[1]*r + 1);
-  if (num_haze_coeffs == 4) return (haze[2]*r*r + exposure*r + haze[0])/(haze[3]*r*r + haze[1]*r + 1);
-  if (num_haze_coeffs == 5) return (haze[4]*r*r*r + haze[2]*r*r + exposure*r + haze[0])/(haze[3]*r*r + haze[1]*r + 1);
-  if (num_haze_coeffs == 6) return (haze[4]*r*r*r + haze[2]*r*r + exposure*r + haze[0])/(haze[5]*r*r*r + haze[3]*r*r + haze[1]*r + 1);
-    
-  vw_throw(ArgumentErr() << "Invalid value for the number of haze coefficients.\n");
-  return 0;
-}
-                          
-enum {NO_REFL = 0, LAMBERT, LUNAR_LAMBERT, HAPKE, ARBITRARY_MODEL, CHARON};
-
-// computes the Lambertian reflectance model (cosine of the light
-// direction and the normal to the Moon) Vector3 sunpos: the 3D
-// coordinates of the Sun relative to the center of the Moon Vector2
-// lon_lat is a 2D vector. First element is the longitude and the
-// second the latitude.
-//author Ara Nefian
-double
-computeLambertianReflectanceFromNormal(Vector3 sunPos, Vector3 xyz,
-                                       Vector3 normal) {
-  double reflectance;
-  Vector3 sunDirection = normalize(sunPos-xyz);
-
-  reflectance = sunDirection[0]*normal[0] + sunDirection[1]*normal[1] + sunDirection[2]*normal[2];
-
-  return reflectance;
-}
-
-
-double computeLunarLambertianReflectanceFromNormal(Vector3 const& sunPos,
-                                                   Vector3 const& viewPos,
-                                                   Vector3 const& xyz,
-                                                   Vector3 const& normal,
-                                                   double phaseCoeffC1,
-                                                   double phaseCoeffC2,
-                                                   double & alpha,
-                                                   const double * reflectance_model_coeffs) {
-  double reflectance;
-  double L;
-
-  double len = dot_prod(normal, normal);
-  if (abs(len - 1.0) > 1.0e-4){
-    std::cerr << "Error: Expecting unit normal in the reflectance computation, in "
-              << __FILE__ << " at line " << __LINE__ << std::endl;
-    exit(1);
-  }
-
-  //compute /mu_0 = cosine of the angle between the light direction and the surface normal.
-  //sun coordinates relative to the xyz point on the Moon surface
-  Vector3 sunDirection = normalize(sunPos-xyz);
-  double mu_0 = dot_prod(sunDirection, normal);
-
-  //double tol = 0.3;
-  //if (mu_0 < tol){
-  //  // Sun is too low, reflectance is too close to 0, the albedo will be inaccurate
-  //  return 0.0;
-  // }
-
-  //compute  /mu = cosine of the angle between the viewer direction and the surface normal.
-  //viewer coordinates relative to the xyz point on the Moon surface
-  Vector3 viewDirection = normalize(viewPos-xyz);
-  double mu = dot_prod(viewDirection,normal);
-
-  //compute the phase angle (alpha) between the viewing direction and the light source direction
-  double deg_alpha;
-  double cos_alpha;
-
-  cos_alpha = dot_prod(sunDirection, viewDirection);
-  if ((cos_alpha > 1)||(cos_alpha< -1)){
-    printf("cos_alpha error\n");
-  }
-
-  alpha     = acos(cos_alpha);  // phase angle in radians
-  deg_alpha = alpha*180.0/M_PI; // phase angle in degrees
-
-  //printf("deg_alpha = %f\n", deg_alpha);
-
-  //Bob Gaskell's model
-  //L = exp(-deg_alpha/60.0);
-
-  //Alfred McEwen's model
-  double O = reflectance_model_coeffs[0]; // 1
-  double A = reflectance_model_coeffs[1]; //-0.019;
-  double B = reflectance_model_coeffs[2]; // 0.000242;//0.242*1e-3;
-  double C = reflectance_model_coeffs[3]; // -0.00000146;//-1.46*1e-6;
-
-  L = O + A*deg_alpha + B*deg_alpha*deg_alpha + C*deg_alpha*deg_alpha*deg_alpha;
- 
-  //printf(" deg_alpha = %f, L = %f\n", deg_alpha, L);
-
-  //if (mu_0 < 0.0){
-  //  return 0.0;
-  // }
-
-  //  if (mu < 0.0){ //emission angle is > 90
-  //  mu = 0.0;
-  //}
-
-  //if (mu_0 + mu == 0){
-  //  //printf("negative reflectance\n");
-  //  return 0.0;
-  //}
-  //else{
-  reflectance = 2*L*mu_0/(mu_0+mu) + (1-L)*mu_0;
-  //}
-  
-  //if (mu < 0 || mu_0 < 0 || mu_0 + mu <= 0 ||  reflectance <= 0 || reflectance != reflectance){
-  if (mu_0 + mu == 0 || reflectance != reflectance){
-    return 0.0;
-  }
-
-  // Attempt to compensate for points on the terrain being too bright
-  // if the sun is behind the spacecraft as seen from those points.
-
-  //reflectance *= std::max(0.4, exp(-alpha*alpha));
-  reflectance *= ( exp(-phaseCoeffC1*alpha) + phaseCoeffC2 );
-
-  return reflectance;
-}
-
-// Hapke's model.
-// See: An Experimental Study of Light Scattering by Large, Irregular Particles
-// Audrey F. McGuire, Bruce W. Hapke. 1995. The reflectance used is R(g), in equation
-// above Equation 21. The p(g) function is given by Equation (14), yet this one uses
-// an old convention. The updated p(g) is given in:
-// Spectrophotometric properties of materials observed by Pancam on the Mars Exploration Rovers: 1.
-// Spirit. JR Johnson, 2006.
-// We Use the two-term p(g), and the parameter c, not c'=1-c.
-// We also use the values of w(=omega), b, and c from that table.
-// Note that we use the updated Hapke model, having the term B(g). This one is given in
-// "Modeling spectral and bidirectional reflectance", Jacquemoud, 1992. It has the params
-// B0 and h.
-// The ultimate reference is probably Hapke, 1986, having all pieces in one place, but
-// that one is not available. 
-// We use mostly the parameter values for omega, b, c, B0 and h from:
-// Surface reflectance of Mars observed by CRISM/MRO: 2.
-// Estimation of surface photometric properties in Gusev Crater and Meridiani Planum by J. Fernando. 
-// See equations (1), (2) and (4) in that paper.
-// Example values for the params: w=omega=0.68, b=0.17, c=0.62, B0=0.52, h=0.52.
-// But we don't use equation (3) from that paper, we use instead what they call the formula H93,
-// which is the H(x) from McGuire and Hapke 1995 mentioned above.
-// See the complete formulas below.
-double computeHapkeReflectanceFromNormal(Vector3 const& sunPos,
-                                         Vector3 const& viewPos,
-                                         Vector3 const& xyz,
-                                         Vector3 const& normal,
-                                         double phaseCoeffC1,
-                                         double phaseCoeffC2,
-                                         double & alpha,
-                                         const double * reflectance_model_coeffs) {
-
-  double len = dot_prod(normal, normal);
-  if (abs(len - 1.0) > 1.0e-4){
-    std::cerr << "Error: Expecting unit normal in the reflectance computation, in "
-              << __FILE__ << " at line " << __LINE__ << std::endl;
-    exit(1);
-  }
-
-  //compute mu_0 = cosine of the angle between the light direction and the surface normal.
-  //sun coordinates relative to the xyz point on the Moon surface
-  Vector3 sunDirection = normalize(sunPos-xyz);
-  double mu_0 = dot_prod(sunDirection, normal);
-
-  //compute mu = cosine of the angle between the viewer direction and the surface normal.
-  //viewer coordinates relative to the xyz point on the Moon surface
-  Vector3 viewDirection = normalize(viewPos-xyz);
-  double mu = dot_prod(viewDirection,normal);
-
-  //compute the phase angle (g) between the viewing direction and the light source direction
-  // in radians
-  double cos_g = dot_prod(sunDirection, viewDirection);
-  double g = acos(cos_g);  // phase angle in radians
-
-  // Hapke params
-  double omega = std::abs(reflectance_model_coeffs[0]); // also known as w
-  double b     = std::abs(reflectance_model_coeffs[1]);
-  double c     = std::abs(reflectance_model_coeffs[2]);
-  // The older Hapke model lacks the B0 and h terms
-  double B0    = std::abs(reflectance_model_coeffs[3]);
-  double h     = std::abs(reflectance_model_coeffs[4]);   
-
-  double J = 1.0; // does not matter, we'll factor out the constant scale as camera exposures anyway
-  
-  // The P(g) term
-  double Pg 
-    = (1.0 - c) * (1.0 - b*b) / pow(1.0 + 2.0*b*cos_g + b*b, 1.5)
-    + c         * (1.0 - b*b) / pow(1.0 - 2.0*b*cos_g + b*b, 1.5);
-    
-  // The B(g) term
-  double Bg = B0 / ( 1.0 + (1.0/h)*tan(g/2.0) );
-
-  double H_mu0 = (1.0 + 2*mu_0) / (1.0 + 2*mu_0 * sqrt(1.0 - omega));
-  double H_mu  = (1.0 + 2*mu  ) / (1.0 + 2*mu   * sqrt(1.0 - omega));
-
-  // The reflectance
-  double R = (J*omega/4.0/M_PI) * ( mu_0/(mu_0+mu) ) * ( (1.0 + Bg)*Pg + H_mu0*H_mu - 1.0 );
-  
-  return R;
-}
-
-// Use the following model:
-// Reflectance = f(alpha) * A * mu_0 /(mu_0 + mu) + (1-A) * mu_0
-// The value of A is either 1 (the so-called lunar-model), or A=0.7.
-// f(alpha) = 0.63.
-double computeCharonReflectanceFromNormal(Vector3 const& sunPos,
-                                          Vector3 const& viewPos,
-                                          Vector3 const& xyz,
-                                          Vector3 const& normal,
-                                          double phaseCoeffC1,
-                                          double phaseCoeffC2,
-                                          double & alpha,
-                                          const double * reflectance_model_coeffs) {
-
-  double len = dot_prod(normal, normal);
-  if (abs(len - 1.0) > 1.0e-4){
-    std::cerr << "Error: Expecting unit normal in the reflectance computation, in "
-              << __FILE__ << " at line " << __LINE__ << std::endl;
-    exit(1);
-  }
-
-  //compute mu_0 = cosine of the angle between the light direction and the surface normal.
-  //sun coordinates relative to the xyz point on the Moon surface
-  Vector3 sunDirection = normalize(sunPos-xyz);
-  double mu_0 = dot_prod(sunDirection, normal);
-
-  //compute mu = cosine of the angle between the viewer direction and the surface normal.
-  //viewer coordinates relative to the xyz point on the Moon surface
-  Vector3 viewDirection = normalize(viewPos-xyz);
-  double mu = dot_prod(viewDirection,normal);
-
-  // Charon model params
-  double A       = std::abs(reflectance_model_coeffs[0]); // albedo 
-  double f_alpha = std::abs(reflectance_model_coeffs[1]); // phase function 
-
-  double reflectance = f_alpha*A*mu_0 / (mu_0 + mu) + (1.0 - A)*mu_0;
-  
-  if (mu_0 + mu == 0 || reflectance != reflectance){
-    return 0.0;
-  }
-
-  return reflectance;
-}
-
-double computeArbitraryLambertianReflectanceFromNormal(Vector3 const& sunPos,
-                                                       Vector3 const& viewPos,
-                                                       Vector3 const& xyz,
-                                                       Vector3 const& normal,
-                                                       double phaseCoeffC1,
-                                                       double phaseCoeffC2,
-                                                       double & alpha,
-                                                       const double * reflectance_model_coeffs) {
-  double reflectance;
-
-  double len = dot_prod(normal, normal);
-  if (abs(len - 1.0) > 1.0e-4){
-    std::cerr << "Error: Expecting unit normal in the reflectance computation, in "
-              << __FILE__ << " at line " << __LINE__ << std::endl;
-    exit(1);
-  }
-
-  //compute /mu_0 = cosine of the angle between the light direction and the surface normal.
-  //sun coordinates relative to the xyz point on the Moon surface
-  //Vector3 sunDirection = -normalize(sunPos-xyz);
-  Vector3 sunDirection = normalize(sunPos-xyz);
-  double mu_0 = dot_prod(sunDirection, normal);
-
-  //double tol = 0.3;
-  //if (mu_0 < tol){
-  //  // Sun is too low, reflectance is too close to 0, the albedo will be inaccurate
-  //  return 0.0;
-  // }
-
-  //compute  /mu = cosine of the angle between the viewer direction and the surface normal.
-  //viewer coordinates relative to the xyz point on the Moon surface
-  Vector3 viewDirection = normalize(viewPos-xyz);
-  double mu = dot_prod(viewDirection,normal);
-
-  //compute the phase angle (alpha) between the viewing direction and the light source direction
-  double deg_alpha;
-  double cos_alpha;
-
-  cos_alpha = dot_prod(sunDirection,viewDirection);
-  if ((cos_alpha > 1)||(cos_alpha< -1)){
-    printf("cos_alpha error\n");
-  }
-
-  alpha     = acos(cos_alpha);  // phase angle in radians
-  deg_alpha = alpha*180.0/M_PI; // phase angle in degrees
-
-  //printf("deg_alpha = %f\n", deg_alpha);
-
-  //Bob Gaskell's model
-  //L = exp(-deg_alpha/60.0);
-
-  //Alfred McEwen's model
-  double O1 = reflectance_model_coeffs[0]; // 1
-  double A1 = reflectance_model_coeffs[1]; // -0.019;
-  double B1 = reflectance_model_coeffs[2]; // 0.000242;//0.242*1e-3;
-  double C1 = reflectance_model_coeffs[3]; // -0.00000146;//-1.46*1e-6;
-  double D1 = reflectance_model_coeffs[4]; 
-  double E1 = reflectance_model_coeffs[5]; 
-  double F1 = reflectance_model_coeffs[6]; 
-  double G1 = reflectance_model_coeffs[7]; 
-
-  double O2 = reflectance_model_coeffs[8];  // 1
-  double A2 = reflectance_model_coeffs[9];  // -0.019;
-  double B2 = reflectance_model_coeffs[10]; // 0.000242;//0.242*1e-3;
-  double C2 = reflectance_model_coeffs[11]; // -0.00000146;//-1.46*1e-6;
-  double D2 = reflectance_model_coeffs[12]; 
-  double E2 = reflectance_model_coeffs[13]; 
-  double F2 = reflectance_model_coeffs[14]; 
-  double G2 = reflectance_model_coeffs[15]; 
-  
-  double L1 = O1 + A1*deg_alpha + B1*deg_alpha*deg_alpha + C1*deg_alpha*deg_alpha*deg_alpha;
-  double K1 = D1 + E1*deg_alpha + F1*deg_alpha*deg_alpha + G1*deg_alpha*deg_alpha*deg_alpha;
-  if (K1 == 0) K1 = 1;
-    
-  double L2 = O2 + A2*deg_alpha + B2*deg_alpha*deg_alpha + C2*deg_alpha*deg_alpha*deg_alpha;
-  double K2 = D2 + E2*deg_alpha + F2*deg_alpha*deg_alpha + G2*deg_alpha*deg_alpha*deg_alpha;
-  if (K2 == 0) K2 = 1;
-  
-  //printf(" deg_alpha = %f, L = %f\n", deg_alpha, L);
-
-  //if (mu_0 < 0.0){
-  //  return 0.0;
-  // }
-
-  //  if (mu < 0.0){ //emission angle is > 90
-  //  mu = 0.0;
-  //}
-
-  //if (mu_0 + mu == 0){
-  //  //printf("negative reflectance\n");
-  //  return 0.0;
-  //}
-  //else{
-  reflectance = 2*L1*mu_0/(mu_0+mu)/K1 + (1-L2)*mu_0/K2;
-  //}
-  
-  //if (mu < 0 || mu_0 < 0 || mu_0 + mu <= 0 ||  reflectance <= 0 || reflectance != reflectance){
-  if (mu_0 + mu == 0 || reflectance != reflectance){
-    return 0.0;
-  }
-
-  // Attempt to compensate for points on the terrain being too bright
-  // if the sun is behind the spacecraft as seen from those points.
-
-  //reflectance *= std::max(0.4, exp(-alpha*alpha));
-  reflectance *= ( exp(-phaseCoeffC1*alpha) + phaseCoeffC2 );
-
-  return reflectance;
-}
-
-double ComputeReflectance(Vector3 const& cameraPosition,
-                          Vector3 const& normal, Vector3 const& xyz,
-                          ModelParams const& input_img_params,
-                          GlobalParams const& global_params,
-                          double & phase_angle,
-                          const double * reflectance_model_coeffs) {
-  double input_img_reflectance;
-
-  switch ( global_params.reflectanceType )
-    {
-    case LUNAR_LAMBERT:
-      input_img_reflectance
-        = computeLunarLambertianReflectanceFromNormal(input_img_params.sunPosition,
-                                                      cameraPosition,
-                                                      xyz,  normal,
-                                                      global_params.phaseCoeffC1,
-                                                      global_params.phaseCoeffC2,
-                                                      phase_angle, // output
-                                                      reflectance_model_coeffs);
-      break;
-    case ARBITRARY_MODEL:
-      input_img_reflectance
-        = computeArbitraryLambertianReflectanceFromNormal(input_img_params.sunPosition,
-                                                          cameraPosition,
-                                                          xyz,  normal,
-                                                          global_params.phaseCoeffC1,
-                                                          global_params.phaseCoeffC2,
-                                                          phase_angle, // output
-                                                          reflectance_model_coeffs);
-      break;
-    case HAPKE:
-      input_img_reflectance
-        = computeHapkeReflectanceFromNormal(input_img_params.sunPosition,
-                                            cameraPosition,
-                                            xyz,  normal,
-                                            global_params.phaseCoeffC1,
-                                            global_params.phaseCoeffC2,
-                                            phase_angle, // output
-                                            reflectance_model_coeffs);
-      break;
-    case CHARON:
-      input_img_reflectance
-        = computeCharonReflectanceFromNormal(input_img_params.sunPosition,
-                                             cameraPosition,
-                                             xyz,  normal,
-                                             global_params.phaseCoeffC1,
-                                             global_params.phaseCoeffC2,
-                                             phase_angle, // output
-                                             reflectance_model_coeffs);
-      break;
-    case LAMBERT:
-      input_img_reflectance
-        = computeLambertianReflectanceFromNormal(input_img_params.sunPosition,
-                                                 xyz, normal);
-      break;
-
-    default:
-      input_img_reflectance = 1;
-    }
-
-  return input_img_reflectance;
-}
-
 // Use this struct to keep track of height errors.
 struct HeightErrEstim {
 
@@ -1691,6 +295,66 @@ struct HeightErrEstim {
     }
   }
   
+  // Save the height error bounds after the first num_done images, so that
+  // an interrupted run can continue from there. The key describes the
+  // inputs. Write to a temporary file first, so an interrupted write
+  // does not make a bad file.
+  void saveState(std::string const& file, std::string const& key, int num_done) const {
+    std::string tmp_file = file + ".tmp";
+    {
+      std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+      int cols = height_error_vec.cols(), rows = height_error_vec.rows();
+      size_t key_len = key.size();
+      ofs.write(reinterpret_cast<const char*>(&key_len), sizeof(key_len));
+      ofs.write(key.data(), key_len);
+      ofs.write(reinterpret_cast<const char*>(&num_done), sizeof(num_done));
+      ofs.write(reinterpret_cast<const char*>(&cols), sizeof(cols));
+      ofs.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+      for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+          double vals[2] = {height_error_vec(col, row)[0], height_error_vec(col, row)[1]};
+          ofs.write(reinterpret_cast<const char*>(vals), sizeof(vals));
+        }
+      }
+      if (!ofs)
+        vw_throw(IOErr() << "Failed writing: " << tmp_file);
+    }
+    fs::rename(tmp_file, file);
+  }
+
+  // Read what saveState() wrote. Return the number of images done, or 0
+  // if the file is missing or is for other inputs.
+  int loadState(std::string const& file, std::string const& key) {
+    std::ifstream ifs(file.c_str(), std::ios::binary);
+    if (!ifs)
+      return 0;
+    size_t key_len = 0;
+    ifs.read(reinterpret_cast<char*>(&key_len), sizeof(key_len));
+    if (!ifs || key_len != key.size())
+      return 0;
+    std::string file_key(key_len, '\0');
+    ifs.read(&file_key[0], key_len);
+    int num_done = 0, cols = 0, rows = 0;
+    ifs.read(reinterpret_cast<char*>(&num_done), sizeof(num_done));
+    ifs.read(reinterpret_cast<char*>(&cols), sizeof(cols));
+    ifs.read(reinterpret_cast<char*>(&rows), sizeof(rows));
+    if (!ifs || file_key != key || cols != height_error_vec.cols() ||
+        rows != height_error_vec.rows())
+      return 0;
+    ImageView<Vector2> vals(cols, rows);
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        double pair[2];
+        ifs.read(reinterpret_cast<char*>(pair), sizeof(pair));
+        vals(col, row) = Vector2(pair[0], pair[1]);
+      }
+    }
+    if (!ifs)
+      return 0;
+    height_error_vec = vals;
+    return num_done;
+  }
+  
   int num_height_samples;
   ImageView<double> * albedo;
   Options * opt;
@@ -1700,6 +364,43 @@ struct HeightErrEstim {
   double nodata_height_val;
 };
 
+// The inputs the height error estimation depends on, for resuming it
+std::string heightErrorStateKey(Options const& opt, ImageView<double> const& dem,
+                                ImageView<double> const& albedo,
+                                HeightErrEstim const& heightErrEstim) {
+  std::ostringstream os;
+  os << std::setprecision(17) << "sfs height error state 1\n"
+     << heightErrEstim.num_height_samples << ' ' << heightErrEstim.max_height_error << '\n';
+  for (size_t it = 0; it < opt.input_images.size(); it++)
+    os << opt.input_images[it] << ' ' << opt.input_cameras[it] << ' '
+       << opt.image_exposures_vec[it] << '\n';
+  for (size_t it = 0; it < opt.image_haze_vec.size(); it++)
+    for (size_t hiter = 0; hiter < opt.image_haze_vec[it].size(); hiter++)
+      os << opt.image_haze_vec[it][hiter] << ' ';
+  for (size_t it = 0; it < opt.model_coeffs_vec.size(); it++)
+    os << opt.model_coeffs_vec[it] << ' ';
+  os << '\n';
+
+  // The DEM and albedo values, hashed
+  std::uint64_t hash = 14695981039346656037ULL;
+  ImageView<double> const* images[] = {&dem, &albedo};
+  for (int im = 0; im < 2; im++) {
+    os << images[im]->cols() << ' ' << images[im]->rows() << '\n';
+    for (int row = 0; row < images[im]->rows(); row++) {
+      for (int col = 0; col < images[im]->cols(); col++) {
+        double val = (*images[im])(col, row);
+        unsigned char const* bytes = reinterpret_cast<unsigned char const*>(&val);
+        for (size_t b = 0; b < sizeof(val); b++) {
+          hash ^= bytes[b];
+          hash *= 1099511628211ULL;
+        }
+      }
+    }
+  }
+  os << hash << '\n';
+  return os.str();
+}
+
 // Use this struct to keep track of slope errors.
 struct SlopeErrEstim {
 
@@ -1848,6 +549,11 @@ void estimateSlopeError(Vector3 const& cameraPosition,
 // Given the normal (height) to the SfS DEM, find how different
 // a height can be from this before the computed intensity
 // due to that height is bigger than max_intensity_err.
+// Rather than trying each height sample in turn, go up with a step
+// which doubles each time until the error budget is exceeded, then bisect
+// between the last two samples. This assumes that the intensity error
+// grows with the height perturbation between consecutive tries.
+// Heights beyond the bound found so far at a grid point are not tried.
 void estimateHeightError(ImageView<double> const& dem,
                          cartography::GeoReference const& geo,
                          Vector3 const& cameraPosition,
@@ -1864,6 +570,9 @@ void estimateHeightError(ImageView<double> const& dem,
   // Look at the neighbors
   int cols[] = {col - 1, col,     col,     col + 1};
   int rows[] = {row,     row - 1, row + 1, row};
+
+  int num_height_samples = heightErrEstim->num_height_samples;
+  double max_height_error = heightErrEstim->max_height_error;
   
   for (int it = 0; it < 4; it++) {
 
@@ -1875,21 +584,12 @@ void estimateHeightError(ImageView<double> const& dem,
 
     // Perturb the height down and up
     for (int sign = -1; sign <= 1; sign += 2) {
-      for (int height_it = 0; height_it < heightErrEstim->num_height_samples; height_it++) {
-        double dh = sign * heightErrEstim->max_height_error
-          * double(height_it)/double(heightErrEstim->num_height_samples);
-
-        if (sign == -1) {
-          if (dh < heightErrEstim->height_error_vec(colx, rowx)[0]) {
-            // We already determined dh can't go as low, so stop here
-            break;
-          }
-        } else if (sign == 1) {
-          if (dh > heightErrEstim->height_error_vec(colx, rowx)[1]) {
-            break;
-          }
-        }
 
+      // Whether perturbing the height at (colx, rowx) by the given sample
+      // makes the intensity at (col, row) differ by more than allowed.
+      auto exceeds = [&](int height_it) {
+        double dh = sign * max_height_error * double(height_it)/double(num_height_samples);
+        
         // Determine where to add the dh. Recall that we compute the intensity
         // at (col, row), while perturbing the dem height at (colx, rowx)
         double left_dh = 0, center_dh = 0, right_dh = 0, bottom_dh = 0, top_dh = 0;
@@ -1955,20 +655,123 @@ void estimateHeightError(ImageView<double> const& dem,
                              opt.steepness_factor,
                              &opt.image_haze_vec[image_iter][0], opt.num_haze_coeffs);
 
-        if (std::abs(comp_intensity - meas_intensity) > max_intensity_err) {
-          // We exceeded the error budget, record the dh at which it happens
-          if (sign == -1) {
-            heightErrEstim->height_error_vec(colx, rowx)[0] = dh;
-          } else if (sign == 1) {
-            heightErrEstim->height_error_vec(colx, rowx)[1] = dh;
-          }
-                
+        return std::abs(comp_intensity - meas_intensity) > max_intensity_err;
+      };
+
+      // The samples beyond the bound found so far need not be tried.
+      // Sample 0 is the unperturbed height, which is within the budget.
+      double bound = std::abs(heightErrEstim->height_error_vec(colx, rowx)[(sign + 1)/2]);
+      int max_it = std::min(num_height_samples - 1,
+                            int(floor(bound * num_height_samples / max_height_error)));
+      // Guard against this not being exact
+      while (max_it > 0 && max_it * max_height_error / num_height_samples > bound)
+        max_it--;
+      if (max_it <= 0)
+        continue;
+
+      // Find a sample within the budget (lo) and one beyond it (hi)
+      int lo = 0, hi = -1;
+      for (int height_it = 1; ; height_it *= 2) {
+        height_it = std::min(height_it, max_it);
+        if (exceeds(height_it)) {
+          hi = height_it;
           break;
         }
-
+        lo = height_it;
+        if (height_it == max_it)
+          break;
+      }
+      if (hi < 0)
+        continue; // Within the budget for all samples that could improve the bound
+
+      while (hi - lo > 1) {
+        int mid = (lo + hi)/2;
+        if (exceeds(mid))
+          hi = mid;
+        else
+          lo = mid;
       }
+
+      // We exceeded the error budget, record the dh at which it happens
+      double dh = sign * max_height_error * double(hi)/double(num_height_samples);
+      if (sign == -1)
+        heightErrEstim->height_error_vec(colx, rowx)[0] = dh;
+      else
+        heightErrEstim->height_error_vec(colx, rowx)[1] = dh;
+    }
+  }
+}
+
+// Given the reflectance at a DEM grid point and the camera pixel it projects
+// to, find the image intensity and ground weight there. Set the reflectance
+// to zero if the point is in shadow. Return false and invalidate the outputs
+// if the pixel is out of range or the intensity is invalid.
+bool lookUpIntensity(Vector2 pix, int col, int row,
+                     ImageView<double>         const& dem,
+                     cartography::GeoReference const& geo,
+                     bool model_shadows,
+                     double max_dem_height,
+                     double gridx, double gridy,
+                     Vector3      const & sunPosition,
+                     BBox2i       const & crop_box,
+                     MaskedImgT   const & image,
+                     DoubleImgT   const & blend_weight,
+                     PixelMask<double>  & reflectance,
+                     PixelMask<double>  & intensity,
+                     double             & ground_weight) {
+
+  // Since our image is cropped
+  pix -= crop_box.min();
+
+  // Check for out of range
+  if (pix[0] < 0 || pix[0] >= image.cols() - 1 || pix[1] < 0 || pix[1] >= image.rows() - 1) {
+    reflectance = 0.0; reflectance.invalidate();
+    intensity   = 0.0; intensity.invalidate();
+    ground_weight = 0.0;
+    return false;
+  }
+
+  InterpolationView<EdgeExtensionView<MaskedImgT, ConstantEdgeExtension>, BilinearInterpolation>
+    interp_image = interpolate(image, BilinearInterpolation(),
+                               ConstantEdgeExtension());
+  intensity = interp_image(pix[0], pix[1]); // this interpolates
+
+  if (g_blend_weight_is_ground_weight) {
+    if (blend_weight.cols() != dem.cols() || blend_weight.rows() != dem.rows()) 
+      vw::vw_throw(vw::ArgumentErr() << "Ground weight must have the same size as the DEM.\n");
+    ground_weight = blend_weight(col, row);
+  } else {
+    InterpolationView<EdgeExtensionView<DoubleImgT, ConstantEdgeExtension>, BilinearInterpolation>
+      interp_weight = interpolate(blend_weight, BilinearInterpolation(),
+                                  ConstantEdgeExtension());
+    if (blend_weight.cols() > 0 && blend_weight.rows() > 0) // The weight may not exist
+      ground_weight = interp_weight(pix[0], pix[1]); // this interpolates
+    else
+      ground_weight = 1.0;
+  }
+  
+  // Note that we allow negative reflectance. It will hopefully guide
+  // the SfS solution the right way.
+  if (!is_valid(intensity)) {
+    reflectance = 0.0; reflectance.invalidate();
+    intensity   = 0.0; intensity.invalidate();
+    ground_weight = 0.0;
+    return false;
+  }
+
+  if (model_shadows) {
+    bool inShadow = asp::isInShadow(col, row, sunPosition,
+                                    dem, max_dem_height, gridx, gridy,
+                                    geo);
+
+    if (inShadow) {
+      // The reflectance is valid, it is just zero
+      reflectance = 0;
+      reflectance.validate();
     }
   }
+
+  return true;
 }
 
 bool computeReflectanceAndIntensity(double left_h, double center_h, double right_h,
@@ -2079,57 +882,11 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
                                    reflectance_model_coeffs);
   reflectance.validate();
 
-
-  // Since our image is cropped
-  pix -= crop_box.min();
-
-  // Check for out of range
-  if (pix[0] < 0 || pix[0] >= image.cols() - 1 || pix[1] < 0 || pix[1] >= image.rows() - 1) {
-    reflectance = 0.0; reflectance.invalidate();
-    intensity   = 0.0; intensity.invalidate();
-    ground_weight = 0.0;
-    return false;
-  }
-
-  InterpolationView<EdgeExtensionView<MaskedImgT, ConstantEdgeExtension>, BilinearInterpolation>
-    interp_image = interpolate(image, BilinearInterpolation(),
-                               ConstantEdgeExtension());
-  intensity = interp_image(pix[0], pix[1]); // this interpolates
-
-  if (g_blend_weight_is_ground_weight) {
-    if (blend_weight.cols() != dem.cols() || blend_weight.rows() != dem.rows()) 
-      vw::vw_throw(vw::ArgumentErr() << "Ground weight must have the same size as the DEM.\n");
-    ground_weight = blend_weight(col, row);
-  } else {
-    InterpolationView<EdgeExtensionView<DoubleImgT, ConstantEdgeExtension>, BilinearInterpolation>
-      interp_weight = interpolate(blend_weight, BilinearInterpolation(),
-                                  ConstantEdgeExtension());
-    if (blend_weight.cols() > 0 && blend_weight.rows() > 0) // The weight may not exist
-      ground_weight = interp_weight(pix[0], pix[1]); // this interpolates
-    else
-      ground_weight = 1.0;
-  }
-  
-  // Note that we allow negative reflectance. It will hopefully guide
-  // the SfS solution the right way.
-  if (!is_valid(intensity)) {
-    reflectance = 0.0; reflectance.invalidate();
-    intensity   = 0.0; intensity.invalidate();
-    ground_weight = 0.0;
+  if (!lookUpIntensity(pix, col, row, dem, geo, model_shadows, max_dem_height,
+                       gridx, gridy, local_model_params.sunPosition,
+                       crop_box, image, blend_weight,
+                       reflectance, intensity, ground_weight))
     return false;
-  }
-
-  if (model_shadows) {
-    bool inShadow = asp::isInShadow(col, row, local_model_params.sunPosition,
-                                    dem, max_dem_height, gridx, gridy,
-                                    geo);
-
-    if (inShadow) {
-      // The reflectance is valid, it is just zero
-      reflectance = 0;
-      reflectance.validate();
-    }
-  }
 
   if (slopeErrEstim != NULL && is_valid(intensity) && is_valid(reflectance)) {
     
@@ -2181,6 +938,124 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
   return true;
 }
 
+// Compute the reflectance and intensity at the interior DEM grid points,
+// one row at a time. This agrees with computeReflectanceAndIntensity() for
+// each grid point, but each grid point is converted to xyz once rather than
+// five times, and the camera and reflectance calls are done for the whole
+// row. The shadows are found for the whole DEM with asp::areInShadow(),
+// which may differ from asp::isInShadow() at a few points on the shadow
+// boundary. The outputs must be allocated and invalidated by the caller.
+void computeReflectanceAndIntensityByRow(ImageView<double> const& dem,
+                                         cartography::GeoReference const& geo,
+                                         bool model_shadows,
+                                         double max_dem_height,
+                                         double gridx, double gridy,
+                                         ModelParams const& model_params,
+                                         GlobalParams const& global_params,
+                                         BBox2i const& crop_box,
+                                         MaskedImgT const  & image,
+                                         DoubleImgT const  & blend_weight,
+                                         CameraModel const * camera,
+                                         double     const  * scaled_sun_posn,
+                                         ImageView<PixelMask<double>> & reflectance,
+                                         ImageView<PixelMask<double>> & intensity,
+                                         ImageView<double>            & ground_weight,
+                                         const double   * reflectance_model_coeffs) {
+
+  if (dem.cols() < 3 || dem.rows() < 3 || crop_box.empty())
+    return;
+
+  Vector3 sunPosition;
+  for (int it = 0; it < 3; it++) 
+    sunPosition[it] = scaled_sun_posn[it] * model_params.sunPosition[it]; 
+
+  bool need_cam_ctr = (global_params.reflectanceType != LAMBERT);
+  int num_cols = dem.cols();
+
+  ImageView<float> shadow;
+  if (model_shadows)
+    asp::areInShadow(sunPosition, dem, gridx, gridy, geo, shadow);
+
+  // The xyz of the rows above, at, and below the current one
+  asp::Vec3Array top, center, bottom, normals;
+  asp::demRowToXyz(dem, geo, 0, center);
+  asp::demRowToXyz(dem, geo, 1, bottom);
+
+  std::vector<Vector3> points(num_cols - 2);
+  std::vector<Vector2> pixels(num_cols - 2);
+  std::vector<Vector3> ctrs;
+  std::vector<int> valid_cols;
+  asp::Vec3Array valid_xyz, valid_normals, valid_ctrs;
+  std::vector<double> valid_refl;
+  for (int row = 1; row < dem.rows() - 1; row++) {
+    std::swap(top, center);
+    std::swap(center, bottom);
+    asp::demRowToXyz(dem, geo, row + 1, bottom);
+    asp::demRowNormals(top, center, bottom, normals);
+
+    for (int col = 1; col < num_cols - 1; col++)
+      points[col - 1] = center(col);
+    asp::pointsToPixels(camera, &points[0], points.size(), &pixels[0]);
+
+    // Keep the grid points which project into the camera
+    valid_cols.clear();
+    for (int col = 1; col < num_cols - 1; col++) {
+      Vector2 const& pix = pixels[col - 1];
+      if (!std::isnan(pix[0]) && !std::isnan(pix[1]))
+        valid_cols.push_back(col);
+    }
+
+    // The camera center is needed only for the non-Lambertian models
+    if (need_cam_ctr && !valid_cols.empty()) {
+      std::vector<Vector2> valid_pix(valid_cols.size());
+      for (size_t i = 0; i < valid_cols.size(); i++)
+        valid_pix[i] = pixels[valid_cols[i] - 1];
+      ctrs.resize(valid_cols.size());
+      asp::cameraCenters(camera, &valid_pix[0], valid_pix.size(), &ctrs[0]);
+      size_t count = 0;
+      for (size_t i = 0; i < valid_cols.size(); i++) {
+        if (!std::isnan(ctrs[i][0])) {
+          valid_cols[count] = valid_cols[i];
+          ctrs[count] = ctrs[i];
+          count++;
+        }
+      }
+      valid_cols.resize(count);
+      ctrs.resize(count);
+    }
+
+    int num_valid = valid_cols.size();
+    valid_xyz.resize(num_valid);
+    valid_normals.resize(num_valid);
+    valid_ctrs.resize(need_cam_ctr ? num_valid : 0);
+    for (int i = 0; i < num_valid; i++) {
+      int col = valid_cols[i];
+      valid_xyz.set(i, center(col));
+      valid_normals.set(i, normals(col));
+      if (need_cam_ctr)
+        valid_ctrs.set(i, ctrs[i]);
+    }
+    asp::computeReflectanceBatch(global_params, sunPosition, valid_ctrs, valid_xyz,
+                                 valid_normals, reflectance_model_coeffs, valid_refl);
+
+    for (int i = 0; i < num_valid; i++) {
+      int col = valid_cols[i];
+      reflectance(col, row) = valid_refl[i];
+      reflectance(col, row).validate();
+      bool success = lookUpIntensity(pixels[col - 1], col, row, dem, geo,
+                                     false, // shadows are handled below
+                                     max_dem_height, gridx, gridy, sunPosition,
+                                     crop_box, image, blend_weight, reflectance(col, row),
+                                     intensity(col, row), ground_weight(col, row));
+      if (success && model_shadows && shadow(col, row) != 0) {
+        // The reflectance is valid, it is just zero
+        reflectance(col, row) = 0;
+        reflectance(col, row).validate();
+      }
+    }
+  }
+}
+
 void computeReflectanceAndIntensity(ImageView<double> const& dem,
                                     ImageView<Vector2> const& pq,
                                     cartography::GeoReference const& geo,
@@ -2230,9 +1105,22 @@ void computeReflectanceAndIntensity(ImageView<double> const& dem,
   }
 
   bool use_pq = (pq.cols() > 0 && pq.rows() > 0);
-  for (int col = 1; col < dem.cols() - 1; col += sample_col_rate) {
-    for (int row = 1; row < dem.rows() - 1; row += sample_row_rate) {
-      
+
+  // When all grid points are needed and the heights come from the DEM,
+  // do whole rows at once.
+  if (!use_pq && sample_col_rate == 1 && sample_row_rate == 1 &&
+      slopeErrEstim == NULL && heightErrEstim == NULL) {
+    computeReflectanceAndIntensityByRow(dem, geo, model_shadows, max_dem_height,
+                                        gridx, gridy, model_params, global_params,
+                                        crop_box, image, blend_weight, camera,
+                                        scaled_sun_posn, reflectance, intensity,
+                                        ground_weight, reflectance_model_coeffs);
+    return;
+  }
+
+  // Do one row of grid points
+  auto processRow = [&](int row) {
+    for (int col = 1; col < dem.cols() - 1; col += sample_col_rate) {
       double pval = 0, qval = 0;
       if (use_pq) {
         pval = pq(col, row)[0];
@@ -2253,7 +1141,60 @@ void computeReflectanceAndIntensity(ImageView<double> const& dem,
                                      slopeErrEstim,
                                      heightErrEstim);
     }
+  };
+
+  std::vector<int> rows;
+  for (int row = 1; row < dem.rows() - 1; row += sample_row_rate)
+    rows.push_back(row);
+
+  // Estimating the errors is slow, so then do the rows in parallel. A
+  // grid point updates the height error at its neighbors, so the rows
+  // are done in three rounds, such that rows done at the same time are
+  // at least three apart. The threads take the next row as they finish.
+  int num_threads = 1;
+  if (slopeErrEstim != NULL)
+    num_threads = slopeErrEstim->opt->num_threads;
+  if (heightErrEstim != NULL)
+    num_threads = heightErrEstim->opt->num_threads;
+  num_threads = std::max(num_threads, 1);
+  if (num_threads == 1) {
+    for (size_t it = 0; it < rows.size(); it++)
+      processRow(rows[it]);
+    return;
   }
+
+  TerminalProgressCallback tpc("asp", ": ");
+  std::mutex mutex;
+  for (int round = 0; round < 3; round++) {
+    std::atomic<size_t> next_row(round);
+    std::vector<std::exception_ptr> errors(num_threads);
+    auto runRows = [&](int worker) {
+      try {
+        while (1) {
+          size_t it = next_row.fetch_add(3);
+          if (it >= rows.size())
+            break;
+          processRow(rows[it]);
+          std::lock_guard<std::mutex> lock(mutex);
+          tpc.report_incremental_progress(1.0/rows.size());
+        }
+      } catch (...) {
+        errors[worker] = std::current_exception();
+        next_row.store(rows.size()); // stop the other workers
+      }
+    };
+    std::vector<std::thread> workers;
+    for (int worker = 1; worker < num_threads; worker++)
+      workers.push_back(std::thread(runRows, worker));
+    runRows(0);
+    for (size_t it = 0; it < workers.size(); it++)
+      workers[it].join();
+    for (size_t it = 0; it < errors.size(); it++) {
+      if (errors[it])
+        std::rethrow_exception(errors[it]);
+    }
+  }
+  tpc.report_finished();
   
   return;
 }
@@ -2345,6 +1286,45 @@ void sun_angles(Options const& opt,
   elevation = (180.0/M_PI) * atan2(-sun_dir_ned[2], L);
 }
 
+// For each sample of the DEM on a grid with given spacing, in row-major
+// order, find if the camera sees it in a pixel which is valid and not in
+// shadow. This is a cheap version of the logic for --crop-input-images, used
+// by parallel_sfs to estimate the work in each tile and which images to skip.
+std::string demCoverage(ImageView<double> const& dem, GeoReference const& georef,
+                        boost::shared_ptr<CameraModel> cam, std::string const& img_file,
+                        float shadow_thresh, float max_valid_val, int spacing) {
+
+  DiskImageView<float> img(img_file);
+  float img_nodata_val = -std::numeric_limits<float>::max();
+  vw::read_nodata_val(img_file, img_nodata_val);
+  float min_val = std::max(img_nodata_val, shadow_thresh);
+  BBox2i img_box = bounding_box(img);
+
+  std::string coverage;
+  for (int row = 0; row < dem.rows(); row += spacing) {
+    for (int col = 0; col < dem.cols(); col += spacing) {
+      char covered = '0';
+      try {
+        Vector2 ll = georef.pixel_to_lonlat(Vector2(col, row));
+        Vector3 xyz = georef.datum().geodetic_to_cartesian
+          (Vector3(ll[0], ll[1], dem(col, row)));
+        Vector2 pix = cam->point_to_pixel(xyz);
+        Vector2i ipix(round(pix[0]), round(pix[1]));
+        if (img_box.contains(ipix)) {
+          float val = img(ipix[0], ipix[1]);
+          if (val > min_val && val <= max_valid_val)
+            covered = '1';
+        }
+      } catch (...) {
+        // The point does not project into the camera
+      }
+      coverage += covered;
+    }
+  }
+
+  return coverage;
+}
+
 // A function to invoke at every iteration of ceres.
 // We need a lot of global variables to do something useful.
 Options                               const * g_opt = NULL;
@@ -3703,6 +2683,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Save a copy of the DEM while using a no-data value at a DEM grid point where all images show shadows. To be used if shadow thresholds are set.")
     ("use-approx-camera-models",   po::bool_switch(&opt.use_approx_camera_models)->default_value(false)->implicit_value(true),
      "Use approximate camera models for speed. Only with ISIS .cub cameras.")
+    ("approx-camera-cache-dir", po::value(&opt.approx_camera_cache_dir)->default_value(""),
+     "Save the tables of the approximate camera models in this directory, and reuse them in later runs with the same cameras, adjustments, and DEM. Can be shared by all runs of parallel_sfs.")
     ("use-rpc-approximation",   po::bool_switch(&opt.use_rpc_approximation)->default_value(false)->implicit_value(true),
      "Use RPC approximations for the camera models instead of approximate tabulated camera models (invoke with --use-approx-camera-models). This is broken and should not be used.")
     ("rpc-penalty-weight", po::value(&opt.rpc_penalty_weight)->default_value(0.1),
@@ -3715,8 +2697,12 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Solve the problem on a grid coarser than the original by a factor of 2 to this power, then refine the solution on finer grids. It is suggested to not use this option.")
     ("max-coarse-iterations", po::value(&opt.max_coarse_iterations)->default_value(10),
      "How many iterations to do at levels of resolution coarser than the final result.")
+    ("coarse-function-tolerance", po::value(&opt.coarse_function_tolerance)->default_value(1e-6),
+     "At levels of resolution coarser than the final result, stop when the relative decrease in the cost function is less than this. The solution is refined at the finer levels.")
     ("crop-input-images",   po::bool_switch(&opt.crop_input_images)->default_value(false)->implicit_value(true),
      "Crop the images to a region that was computed to be large enough, and keep them fully in memory, for speed.")
+    ("image-cache-size-mb", po::value(&opt.image_cache_size_mb)->default_value(2048.0),
+     "With --crop-input-images, keep image crops and blending weights up to this size (in MB) so that other DEM clips seeing the same image area do not read or compute them again.")
     ("blending-dist", po::value(&opt.blending_dist)->default_value(0),
      "Give less weight to image pixels close to no-data or boundary values. Enabled only when crop-input-images is true, for performance reasons. Blend over this many pixels.")
     ("blending-power", po::value(&opt.blending_power)->default_value(2.0),
@@ -3772,6 +2758,9 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "(experimental).")
     ("query",   po::bool_switch(&opt.query)->default_value(false)->implicit_value(true),
      "Print some info and exit. Invoked from parallel_sfs.")
+    ("query-coverage-spacing", po::value(&opt.query_coverage_spacing)->default_value(0),
+     "With --query, sample the DEM with this spacing in pixels, and print which "
+     "samples each image sees with valid and lit pixels. Invoked from parallel_sfs.")
     ("session-type,t",   po::value(&opt.stereo_session)->default_value(""),
      "Select the stereo session type to use for processing. Usually the program can select this automatically by the file extension, except for xml cameras. See the doc for options.")
     ("gradient-weight", po::value(&opt.gradient_weight)->default_value(0.0),
@@ -4651,14 +3640,6 @@ void run_sfs_level(// Fixed inputs
     }
   }
   
-  if (opt.num_threads > 1 &&
-      opt.stereo_session == "isis"  &&
-      !opt.use_approx_camera_models &&
-      !opt.use_approx_adjusted_camera_models) {
-    vw_out() << "Using exact ISIS camera models. Can run with only a single thread.\n";
-    opt.num_threads = 1;
-  }
-
   vw_out() << "Using: " << opt.num_threads << " thread(s).\n";
 
   ceres::Solver::Options options;
@@ -4669,6 +3650,13 @@ void run_sfs_level(// Fixed inputs
   options.num_threads = opt.num_threads;
   options.linear_solver_type = ceres::SPARSE_SCHUR;
 
+  // A coarse level only needs to be good enough to start the next one.
+  // All levels share the exposures, haze, cameras, sun positions, and
+  // reflectance model coefficients, so those start where the previous
+  // level ended.
+  if (g_level > 0)
+    options.function_tolerance = opt.coarse_function_tolerance;
+
   // Use a callback function at every iteration
   SfsCallback callback;
   options.callbacks.push_back(&callback);
@@ -5080,6 +4068,13 @@ int main(int argc, char* argv[]) {
     std::vector<ModelParams> model_params;
     read_sun_positions_from_list(opt, model_params);
     
+    // An exact ISIS camera can be used by only one thread at a time. Let
+    // each camera have as many instances as threads, so that the cost
+    // function can be evaluated in parallel. The approximate cameras call
+    // the exact camera under a lock, so they need only one instance.
+    if (!opt.use_approx_camera_models && !opt.use_approx_adjusted_camera_models)
+      asp::stereo_settings().isis_camera_pool_size = std::max(opt.num_threads, 1);
+    
     // Read in the camera models (and the sun positions, if not read from the list)
     int num_images = opt.input_images.size();
     std::vector<std::vector<boost::shared_ptr<CameraModel>>> cameras(num_dems);
@@ -5138,6 +4133,23 @@ int main(int argc, char* argv[]) {
       }
     }
 
+    // Print which samples of the DEM each image sees. This is used by
+    // parallel_sfs to balance the tiles and to skip images in each tile.
+    if (opt.query && opt.query_coverage_spacing > 0) {
+      int spacing = opt.query_coverage_spacing;
+      vw_out() << "coverage_spacing, " << spacing << std::endl;
+      for (int image_iter = 0; image_iter < num_images; image_iter++) {
+        if (opt.skip_images[0].find(image_iter) != opt.skip_images[0].end())
+          continue;
+        vw_out() << "image_coverage_" << image_iter << ", "
+                 << demCoverage(dems[0][0], geos[0][0], cameras[0][image_iter],
+                                opt.input_images[image_iter],
+                                opt.shadow_threshold_vec[image_iter],
+                                opt.max_valid_image_vals_vec[image_iter], spacing)
+                 << std::endl;
+      }
+    }
+
     // Stop here if all we wanted was some information
     if (opt.query) 
       return 0;
@@ -5210,6 +4222,8 @@ int main(int argc, char* argv[]) {
     // If to use approximate camera models or to crop input images
     if (opt.use_approx_camera_models || opt.use_approx_adjusted_camera_models) {
 
+      asp::setApproxCameraCacheDir(opt.approx_camera_cache_dir);
+
       // TODO(oalexan1): This code needs to be modularized.
       for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
       
@@ -5282,44 +4296,53 @@ int main(int argc, char* argv[]) {
           // TODO: No need to test how unadjusted models compare for RPC,
           // test only the adjusted models. 
           if (model_is_valid) {
-            // Recompute the crop box, can be done more reliably here
-            if (opt.use_rpc_approximation || opt.use_semi_approx)
-              cam_ptr->crop_box() = BBox2();
-            for (int col = 0; col < dems[0][dem_iter].cols(); col++) {
-              for (int row = 0; row < dems[0][dem_iter].rows(); row++) {
-                Vector2 ll = geos[0][dem_iter].pixel_to_lonlat(Vector2(col, row));
-                Vector3 xyz = geos[0][dem_iter].datum().geodetic_to_cartesian
-                  (Vector3(ll[0], ll[1], dems[0][dem_iter](col, row)));
-
-                if (opt.use_approx_camera_models) {
-                  // For approx adjusted camera models we don't do this,
-                  // as we don't approximate the unadjusted camera.
-                  // Test how unadjusted models compare
-                  Vector2 pix1 = exact_unadjusted_camera->point_to_pixel(xyz);
-                  //if (!img_bbox.contains(pix1)) continue;
+            // Reuse the check from an earlier run with the same inputs
+            std::string check_key
+              = asp::approxCameraCheckKey(*cam_ptr, exact_adjusted_camera, dems[0][dem_iter]);
+            BBox2 saved_crop_box;
+            if (asp::readApproxCameraCheck(check_key, max_curr_err, saved_crop_box)) {
+              cam_ptr->crop_box() = saved_crop_box;
+            } else {
+              // Recompute the crop box, can be done more reliably here
+              if (opt.use_rpc_approximation || opt.use_semi_approx)
+                cam_ptr->crop_box() = BBox2();
+              for (int col = 0; col < dems[0][dem_iter].cols(); col++) {
+                for (int row = 0; row < dems[0][dem_iter].rows(); row++) {
+                  Vector2 ll = geos[0][dem_iter].pixel_to_lonlat(Vector2(col, row));
+                  Vector3 xyz = geos[0][dem_iter].datum().geodetic_to_cartesian
+                    (Vector3(ll[0], ll[1], dems[0][dem_iter](col, row)));
+
+                  if (opt.use_approx_camera_models) {
+                    // For approx adjusted camera models we don't do this,
+                    // as we don't approximate the unadjusted camera.
+                    // Test how unadjusted models compare
+                    Vector2 pix1 = exact_unadjusted_camera->point_to_pixel(xyz);
+                    //if (!img_bbox.contains(pix1)) continue;
                   
-                  Vector2 pix2 = apcam->point_to_pixel(xyz);
-                  max_curr_err = std::max(max_curr_err, norm_2(pix1 - pix2));
+                    Vector2 pix2 = apcam->point_to_pixel(xyz);
+                    max_curr_err = std::max(max_curr_err, norm_2(pix1 - pix2));
                   
-                  // Use these pixels to expand the crop box, as we
-                  // now also know the adjustments.  This is a bug
-                  // fix.
-                  cam_ptr->crop_box().grow(pix1);
-                  cam_ptr->crop_box().grow(pix2);
-                }
+                    // Use these pixels to expand the crop box, as we
+                    // now also know the adjustments.  This is a bug
+                    // fix.
+                    cam_ptr->crop_box().grow(pix1);
+                    cam_ptr->crop_box().grow(pix2);
+                  }
                 
-                // Test how adjusted (exact and approximate) models compare
-                Vector2 pix3 = exact_adjusted_camera.point_to_pixel(xyz);
-                //if (!img_bbox.contains(pix3)) continue;
-                Vector2 pix4 = cameras[dem_iter][image_iter]->point_to_pixel(xyz);
-                max_curr_err = std::max(max_curr_err, norm_2(pix3 - pix4));
-
-                cam_ptr->crop_box().grow(pix3);
-                cam_ptr->crop_box().grow(pix4);
+                  // Test how adjusted (exact and approximate) models compare
+                  Vector2 pix3 = exact_adjusted_camera.point_to_pixel(xyz);
+                  //if (!img_bbox.contains(pix3)) continue;
+                  Vector2 pix4 = cameras[dem_iter][image_iter]->point_to_pixel(xyz);
+                  max_curr_err = std::max(max_curr_err, norm_2(pix3 - pix4));
+
+                  cam_ptr->crop_box().grow(pix3);
+                  cam_ptr->crop_box().grow(pix4);
+                }
               }
-            }
 
-            cam_ptr->crop_box().crop(img_bbox);
+              cam_ptr->crop_box().crop(img_bbox);
+              asp::writeApproxCameraCheck(check_key, max_curr_err, cam_ptr->crop_box());
+            }
             
             vw_out() << "Max approximate model error in pixels for: "
                      <<  opt.input_images[image_iter] << " and clip "
@@ -5454,6 +4477,10 @@ int main(int argc, char* argv[]) {
       }
     }
     
+    // Crops of the images and their blending weights, made only for the
+    // images which see a clip, and shared among the clips
+    asp::SfsImageCache image_cache(opt.image_cache_size_mb);
+    
     float img_nodata_val = -std::numeric_limits<float>::max();
     for (int image_iter = 0; image_iter < num_images; image_iter++){
       for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
@@ -5470,9 +4497,9 @@ int main(int argc, char* argv[]) {
         float shadow_thresh = opt.shadow_threshold_vec[image_iter];
         if (opt.crop_input_images) {
           // Make a copy in memory for faster access
-          if (!crop_boxes[0][dem_iter][image_iter].empty()) {
-            ImageView<float> cropped_img = 
-              crop(DiskImageView<float>(img_file), crop_boxes[0][dem_iter][image_iter]);
+          BBox2i const& crop_box = crop_boxes[0][dem_iter][image_iter];
+          if (!crop_box.empty()) {
+            ImageView<float> cropped_img = image_cache.crop(img_file, crop_box);
             masked_images_vec[0][dem_iter][image_iter]
               = create_pixel_range_mask2(cropped_img,
                                          std::max(img_nodata_val, shadow_thresh),
@@ -5482,9 +4509,12 @@ int main(int argc, char* argv[]) {
             // images. Otherwise the weights are too huge.
             if (opt.blending_dist > 0)
               blend_weights_vec[0][dem_iter][image_iter]
-                = asp::blendingWeights(masked_images_vec[0][dem_iter][image_iter],
-                                       opt.blending_dist, opt.blending_power,
-                                       opt.min_blend_size);
+                = image_cache.blendingWeights(img_file, crop_box,
+                                              std::max(img_nodata_val, shadow_thresh),
+                                              opt.max_valid_image_vals_vec[image_iter],
+                                              masked_images_vec[0][dem_iter][image_iter],
+                                              opt.blending_dist, opt.blending_power,
+                                              opt.min_blend_size);
           }
         }else{
           masked_images_vec[0][dem_iter][image_iter]
@@ -5494,6 +4524,9 @@ int main(int argc, char* argv[]) {
         }
       }
     }
+    if (opt.crop_input_images)
+      vw_out() << "Image crops read from disk: " << image_cache.num_reads()
+               << ", reused: " << image_cache.num_hits() << std::endl;
     g_img_nodata_val = &img_nodata_val;
 
     // Copy sun positions to an array
@@ -5692,7 +4725,22 @@ int main(int argc, char* argv[]) {
                               &albedos[0][0], &opt));
       }
       
-      for (int image_iter = 0; image_iter < num_images; image_iter++) {
+      // Continue the height error estimation of an earlier run with the
+      // same inputs which was stopped before it was done
+      std::string height_error_state_file = opt.out_prefix + "-height-error-state.bin";
+      std::string height_error_state_key;
+      int start_image = 0;
+      if (opt.estimate_height_errors) {
+        height_error_state_key = heightErrorStateKey(opt, dems[0][0], albedos[0][0],
+                                                     *heightErrEstim);
+        start_image = heightErrEstim->loadState(height_error_state_file,
+                                                height_error_state_key);
+        if (start_image > 0)
+          vw_out() << "Read: " << height_error_state_file << ". Continuing the height "
+                   << "error estimation after image " << start_image << ".\n";
+      }
+      
+      for (int image_iter = start_image; image_iter < num_images; image_iter++) {
         
         if (opt.estimate_slope_errors) 
           slopeErrEstim->image_iter = image_iter;
@@ -5715,6 +4763,12 @@ int main(int argc, char* argv[]) {
                                        &opt.model_coeffs_vec[0],
                                        slopeErrEstim.get(), heightErrEstim.get());
 
+        if (opt.estimate_height_errors) {
+          vw_out() << "Writing: " << height_error_state_file << std::endl;
+          heightErrEstim->saveState(height_error_state_file, height_error_state_key,
+                                    image_iter + 1);
+        }
+
         if (opt.skip_images[0].find(image_iter) == opt.skip_images[0].end() &&
             opt.allow_borderline_data) {
           // if not skipping, save the weight
@@ -5841,6 +4895,10 @@ int main(int argc, char* argv[]) {
                                has_georef, geos[0][0],
                                has_nodata, heightErrEstim->nodata_height_val,
                                opt, tpc);
+
+        // The state is not needed once the final result exists
+        boost::system::error_code ec;
+        fs::remove(height_error_state_file, ec);
       }
       
     } // End doing intensity computations and/or height and/or slope error estimations
@@ -5882,8 +4940,8 @@ int main(int argc, char* argv[]) {
           float shadow_thresh = 0.0; // Note how the shadow thresh is now 0, unlike before
           // Make a copy in memory for faster access
           if (!crop_boxes[0][dem_iter][image_iter].empty()) {
-            ImageView<float> cropped_img = 
-              crop(DiskImageView<float>(img_file), crop_boxes[0][dem_iter][image_iter]);
+            ImageView<float> cropped_img
+              = image_cache.crop(img_file, crop_boxes[0][dem_iter][image_iter]);
             masked_images_vec[0][dem_iter][image_iter]
               = create_pixel_range_mask2(cropped_img,
                                          std::max(img_nodata_val, shadow_thresh),
@@ -6176,7 +5234,7 @@ int main(int argc, char* argv[]) {
   } ASP_STANDARD_CATCHES;
   
   VW_OUT(DebugMessage, "asp") << "Number of times we used the global lock: "
-                              << g_num_locks << std::endl;
+                              << asp::g_num_locks << std::endl;
 
   sw_total.stop();
   vw_out() << "Total elapsed time: " << sw_total.elapsed_seconds() << " s." << std::endl;
@@ -19,9 +19,12 @@
 
 #include <asp/Tools/stereo.h>
 #include <asp/Core/Bathymetry.h>
+#include <asp/Core/MemoryBudget.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/Core/AspStringUtils.h>
 #include <asp/Camera/CameraErrorPropagation.h>
+#include <asp/Camera/CsmModel.h>
+#include <asp/Camera/LinescanDGModel.h>
 
 #include <vw/Cartography/PointImageManipulation.h>
 #include <vw/Stereo/StereoView.h>
@@ -30,6 +33,7 @@
 #include <vw/Stereo/CostFunctions.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <vw/FileIO/MatrixIO.h>
+#include <vw/Image/Algorithms2.h>
 
 // Can't do much about warnings in boost except to hide them
 #pragma GCC diagnostic push
@@ -283,6 +287,10 @@ void parse_multiview(int argc, char* argv[],
     vw_throw(ArgumentErr() << "Error propagation is not implemented when "
               << "bathymetry is modeled.\n");
   
+  if (stereo_settings().propagate_errors_grid_size < 0)
+    vw::vw_throw(vw::ArgumentErr() << "The value of --propagate-errors-grid-size "
+                  << "must be non-negative.\n");
+
   if (stereo_settings().propagate_errors && 
       stereo_settings().compute_error_vector) 
     vw::vw_throw(vw::ArgumentErr() << "Cannot use option --error-vector for computing "
@@ -408,6 +416,10 @@ void handle_arguments(int argc, char *argv[], ASPGlobalOptions& opt,
 
   asp::stereo_settings().validate();
 
+  // This replaces the cache sizes set from the command line
+  if (stereo_settings().memory_budget_mb > 0.0)
+    asp::set_memory_budget(asp::memory_budget_mb(stereo_settings().memory_budget_mb));
+
   if (stereo_settings().correlator_mode) {
     // Images are assumed aligned, unless alignment is explicitly requested.
     if (vm["alignment-method"].defaulted())
@@ -716,8 +728,22 @@ void handle_arguments(int argc, char *argv[], ASPGlobalOptions& opt,
               << "used only with alignment method local_epipolar.\n");
   }
 
+  // Cache the loaded cameras, so that later stereo steps and tiles need not
+  // process the camera files again. The tiles of parallel_stereo are passed
+  // the cache directory of the full run, as printed by stereo_parse.
+  if (stereo_settings().camera_cache_dir.empty())
+    stereo_settings().camera_cache_dir = opt.out_prefix + "-camera-cache";
+
+  // Validate --intermediate-compression before any work is done
+  asp::intermediate_write_options(opt, true);
+
   if (exit_early) 
     return;
+
+  if (stereo_settings().camera_cache_dir != "none") {
+    asp::CsmModel::setIsdCacheDir(stereo_settings().camera_cache_dir);
+    asp::setDgXmlCacheDir(stereo_settings().camera_cache_dir);
+  }
   
   // The StereoSession call automatically determines the type of
   // object to create from the input parameters.
@@ -1057,4 +1083,56 @@ vw::stereo::CorrelationAlgorithm stereo_alg_to_num(std::string alg) {
   return vw::stereo::VW_CORRELATION_OTHER;
 }
 
+std::string blend_weights_file(std::string const& disp_file) {
+  std::string base = disp_file;
+  std::string postfixes[] = {"nosym.tif", ".tif"};
+  for (size_t it = 0; it < 2; it++) {
+    std::string const& p = postfixes[it];
+    if (boost::ends_with(base, p)) {
+      base = base.substr(0, base.size() - p.size());
+      break;
+    }
+  }
+  return base + "-weights.tif";
+}
+
+void save_blend_weights(ASPGlobalOptions & opt,
+                        vw::ImageView<vw::PixelMask<vw::Vector2f>> const& disp,
+                        std::string const& disp_file) {
+
+  // Must be the same weights as stereo_blend would find from the disparity
+  vw::ImageView<double> weights;
+  centerline_weights(disp, weights);
+
+  std::string weights_file = blend_weights_file(disp_file);
+  vw::cartography::GeoReference georef;
+  bool   has_georef = false;
+  bool   has_nodata = false;
+  double nodata     = -32768.0;
+  vw_out() << "Writing: " << weights_file << "\n";
+  vw::cartography::block_write_gdal_image(weights_file, pixel_cast<float>(weights),
+                                          has_georef, georef,
+                                          has_nodata, nodata, opt,
+                                          vw::TerminalProgressCallback
+                                          ("asp", "\t--> Blend weights :"));
+}
+
+void save_blend_weights(ASPGlobalOptions & opt,
+                        vw::ImageView<vw::PixelMask<float>> const& disp,
+                        std::string const& disp_file) {
+
+  // Only which pixels are valid matters. This is how stereo_blend reads
+  // a single-channel image.
+  vw::ImageView<vw::PixelMask<vw::Vector2f>> disp2(disp.cols(), disp.rows());
+  for (int col = 0; col < disp.cols(); col++) {
+    for (int row = 0; row < disp.rows(); row++) {
+      float val = disp(col, row).child();
+      disp2(col, row) = vw::PixelMask<vw::Vector2f>(vw::Vector2f(val, val));
+      if (!is_valid(disp(col, row)))
+        disp2(col, row).invalidate();
+    }
+  }
+  save_blend_weights(opt, disp2, disp_file);
+}
+
 } // end namespace asp
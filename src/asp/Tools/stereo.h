@@ -96,6 +96,20 @@ namespace asp {
   // external algorithms will have to examine closer the algorithm
   // string. This function has a Python analog in parallel_stereo.
   vw::stereo::CorrelationAlgorithm stereo_alg_to_num(std::string alg);
+
+  /// The file with the blending weights of a tile disparity, such as
+  /// out-D-weights.tif for out-D.tif or out-Dnosym.tif.
+  std::string blend_weights_file(std::string const& disp_file);
+
+  /// Save the weights with which stereo_blend blends a tile disparity with
+  /// its neighbors. These depend on the whole tile, so with them saved the
+  /// neighbors of a tile need to be read only where they overlap it.
+  void save_blend_weights(ASPGlobalOptions & opt,
+                          vw::ImageView<vw::PixelMask<vw::Vector2f>> const& disp,
+                          std::string const& disp_file);
+  void save_blend_weights(ASPGlobalOptions & opt,
+                          vw::ImageView<vw::PixelMask<float>> const& disp,
+                          std::string const& disp_file);
   
 } // end namespace vw
 
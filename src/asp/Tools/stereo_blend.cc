@@ -84,8 +84,12 @@ BBox2i bbox_from_folder(std::string const& s, std::string const& in_file) {
   return BBox2i(x, y, width, height);
 }
 
-// Load an image and form its weights
-bool load_image_and_weights(std::string const& file_path,
+// Load an image and form its weights. If the region is not empty, load only
+// that region of the image (in its pixel coordinates). The weights depend on
+// the whole image, so then they are read from the file saved by stereo_corr.
+// If that file is not present or is older than the image, for example for a
+// run made before such files were saved, the whole image is loaded.
+bool load_image_and_weights(std::string const& file_path, BBox2i const& region,
                             ImageView<MaskedPixType> & image, WeightsType & weights,
                             int & num_channels, bool & has_nodata, float& nodata_value) {
 
@@ -98,8 +102,6 @@ bool load_image_and_weights(std::string const& file_path,
   if (file_path == "")
     return false;
 
-  vw_out() << "Reading: " << file_path << std::endl;
-
   // Verify that the disparity has float pixels, as expected. Blending
   // is done either after algorithms which are not the old ASP block
   // matching (ASP_BM), when the disparity pixels are always float, or
@@ -122,15 +124,32 @@ bool load_image_and_weights(std::string const& file_path,
                << "expecting to have a no-data value in order to keep track of invalid pixels.");
     }
   }
+
+  // See if the weights can be read rather than computed from the whole image
+  BBox2i full_box(0, 0, rsrc->cols(), rsrc->rows());
+  BBox2i read_box = full_box;
+  std::string weights_file = asp::blend_weights_file(file_path);
+  bool read_weights = false;
+  if (!region.empty() && full_box.contains(region) && fs::exists(weights_file) &&
+      file_image_size(weights_file) == Vector2i(full_box.width(), full_box.height()) &&
+      fs::last_write_time(weights_file) >= fs::last_write_time(file_path)) {
+    read_weights = true;
+    read_box = region;
+  }
+
+  vw_out() << "Reading: " << file_path;
+  if (read_box != full_box)
+    vw_out() << " (region " << read_box << ")";
+  vw_out() << std::endl;
   
   // Load the image from disk
   if (num_channels == 3) {
     // Load a disparity
-    image = DiskImageView<MaskedPixType>(file_path);
+    image = crop(DiskImageView<MaskedPixType>(file_path), read_box);
   } else if (num_channels == 1) {
     // Load a float image with a nodata value, and create a disparity. It is simpler
     // to do it this way than to write some template-based logic.
-    ImageView<float> curr_image = DiskImageView<float>(file_path);
+    ImageView<float> curr_image = crop(DiskImageView<float>(file_path), read_box);
     image.set_size(curr_image.cols(), curr_image.rows());
     for (int col = 0; col < curr_image.cols(); col++) {
       for (int row = 0; row < curr_image.rows(); row++) {
@@ -148,6 +167,11 @@ bool load_image_and_weights(std::string const& file_path,
     vw_throw(ArgumentErr() << "stereo_blend: Expecting an image with 1 or 3 bands, but "
              << "image " << file_path << " has " << num_channels << " channels.\n");
   }
+
+  if (read_weights) {
+    weights = pixel_cast<double>(crop(DiskImageView<float>(weights_file), read_box));
+    return true;
+  }
   
   // Compute the desired weights. Strictly speaking we need to compute the weights
   // only on the portion of the image that we will use for blending, but weights
@@ -161,6 +185,14 @@ bool load_image_and_weights(std::string const& file_path,
   vw_out() << "Writing: " << weights_file << std::endl;
   write_image(weights_file, weights);
 #endif
+
+  // Keep only the desired region
+  if (!region.empty()) {
+    ImageView<MaskedPixType> cropped_image = crop(image, region);
+    WeightsType cropped_weights = crop(weights, region);
+    image = cropped_image;
+    weights = cropped_weights;
+  }
   
   return true;
 }
@@ -361,6 +393,7 @@ ImageView<MaskedPixType> tile_blend(ASPGlobalOptions const& opt,
     ImageView<MaskedPixType> image;
     WeightsType weights;
     BBox2i padded_box;
+    Vector2i image_min; // the upper-left corner of the loaded image in the full image
     
     if (i == -1) {
       // Main tile
@@ -368,7 +401,7 @@ ImageView<MaskedPixType> tile_blend(ASPGlobalOptions const& opt,
       int curr_num_channels = 1;
       bool curr_has_nodata = false;
       float curr_nodata_value = -32768.0;
-      bool ans = load_image_and_weights(blend_opt.main_path, image, weights,
+      bool ans = load_image_and_weights(blend_opt.main_path, BBox2i(), image, weights,
                                         curr_num_channels, curr_has_nodata, curr_nodata_value);
       if (!ans) 
         vw_throw(ArgumentErr() << "stereo_blend: main tile is missing.");
@@ -379,6 +412,7 @@ ImageView<MaskedPixType> tile_blend(ASPGlobalOptions const& opt,
       nodata_value = curr_nodata_value;
 
       padded_box = blend_opt.padded_main;
+      image_min  = padded_box.min();
       
       // If there are no valid pixels in the main tile without its padding,
       // return an invalid blended tile.
@@ -387,10 +421,22 @@ ImageView<MaskedPixType> tile_blend(ASPGlobalOptions const& opt,
       
     } else {
       // A neighboring tile
+      if (blend_opt.neib_path[i] == "")
+        continue; // Nothing to blend
+
+      // Read only the part of the padded neighbor which overlaps the main tile
+      padded_box = blend_opt.padded_neib[i];
+      BBox2i overlap = padded_box;
+      overlap.crop(blend_opt.main_roi);
+      if (overlap.width() <= 0 || overlap.height() <= 0)
+        continue; // Nothing to blend
+      image_min = overlap.min();
+
       int curr_num_channels = 1;
       bool curr_has_nodata = false;
       float curr_nodata_value = -32768.0;
-      bool ans = load_image_and_weights(blend_opt.neib_path[i], image, weights,
+      bool ans = load_image_and_weights(blend_opt.neib_path[i], overlap - padded_box.min(),
+                                        image, weights,
                                         curr_num_channels, curr_has_nodata, curr_nodata_value);
       if (!ans)
         continue; // Nothing to blend
@@ -400,8 +446,6 @@ ImageView<MaskedPixType> tile_blend(ASPGlobalOptions const& opt,
       num_channels = curr_num_channels;
       has_nodata   = curr_has_nodata;
       nodata_value = curr_nodata_value;
-
-      padded_box = blend_opt.padded_neib[i];
     }
 
     // Do the blending, either with the main or neighboring tiles
@@ -411,8 +455,9 @@ ImageView<MaskedPixType> tile_blend(ASPGlobalOptions const& opt,
         // Convert the given pixel to the coordinate system of the full image
         Vector2 pix = Vector2(col, row) + blend_opt.main_roi.min();
 
-        // Convert the pixel to the coordinate system of the current padded tile
-        pix = pix - padded_box.min();
+        // Convert the pixel to the coordinate system of the loaded part of the
+        // current padded tile
+        pix = pix - image_min;
 
         // Padded tiles can overlap only partially with the central region of the main
         // tile. If not in the overlap region, skip the work.
@@ -481,7 +526,8 @@ void stereo_blending(ASPGlobalOptions const& opt, std::string const& in_file,
     // Write the blended disparity
     vw::cartography::block_write_gdal_image(full_out_file, blended_disp,
                                             has_left_georef, left_georef,
-                                            has_nodata, nodata, opt,
+                                            has_nodata, nodata,
+                                            asp::intermediate_write_options(opt, true),
                                             TerminalProgressCallback("asp", "\t--> Blending :"));
   } else if (num_channels == 1) {
     // Write a single-channel image with no-data
@@ -501,7 +547,7 @@ void stereo_blending(ASPGlobalOptions const& opt, std::string const& in_file,
   }
 }
 
-int main(int argc, char* argv[]) {
+int stereo_blend_main(int argc, char* argv[]) {
 
   try {
 
@@ -545,3 +591,7 @@ int main(int argc, char* argv[]) {
 
   return 0;
 }
+
+int main(int argc, char* argv[]) {
+  return asp::run_batch(argc, argv, stereo_blend_main);
+}
@@ -25,16 +25,22 @@
 #include <vw/InterestPoint/Matcher.h>
 #include <vw/Stereo/Correlation.h>
 
+#include <asp/Core/CorrMemoryScheduler.h>
 #include <asp/Core/DisparityProcessing.h>
 #include <asp/Core/DemDisparity.h>
 #include <asp/Core/InterestPointMatching.h>
 #include <asp/Core/IpMatchingAlgs.h>         // Lightweight header
 #include <asp/Core/LocalAlignment.h>
+#include <asp/Core/Tracing.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Tools/stereo.h>
 
 #include <boost/process/env.hpp>
 
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
 #include <xercesc/util/PlatformUtils.hpp>
 
 using namespace vw;
@@ -270,6 +276,27 @@ void produce_lowres_disparity(ASPGlobalOptions & opt) {
     // D_sub is already generated by now by sparse_disp
   }
 
+  // Find the point cloud center from D_sub, so that triangulation does not
+  // have to triangulate full-resolution tiles for that. A center from a
+  // prior run is wiped, as it may not be consistent with this D_sub.
+  // Failure here is not fatal, as triangulation can find the center.
+  std::string cloud_center_file = opt.out_prefix + "-PC-center.txt";
+  if (!stereo_settings().correlator_mode &&
+      !stereo_settings().save_double_precision_point_cloud) {
+    try {
+      if (fs::exists(cloud_center_file))
+        fs::remove(cloud_center_file);
+      boost::shared_ptr<camera::CameraModel> left_camera_model, right_camera_model;
+      opt.session->camera_models(left_camera_model, right_camera_model);
+      asp::save_cloud_center_from_D_sub(opt, opt.session->tx_left(), opt.session->tx_right(),
+                                        left_camera_model, right_camera_model, d_sub_file);
+    } catch (std::exception const& e) {
+      vw_out(WarningMessage) << "Could not find the point cloud center from D_sub. "
+                             << "It will be found during triangulation. The reason:\n"
+                             << e.what() << "\n";
+    }
+  }
+
   // Read this to print some text while still in low-res disparity
   // computation mode.  Next time we call this it will be per
   // individual tile so it will go to different log files.
@@ -621,12 +648,145 @@ BBox2 approximate_search_range(ASPGlobalOptions & opt, std::string const& match_
 } // End function approximate_search_range
 
 
+// Append to the stream the path, size, and modification time of a file
+void append_file_stats(std::ostream & os, std::string const& file) {
+  if (file.empty())
+    return;
+  boost::system::error_code ec;
+  os << fs::absolute(file).string() << ' ' << fs::file_size(file, ec) << ' '
+     << fs::last_write_time(file, ec) << ' ';
+}
+
+/// A key for the low-resolution disparity and the search range it was
+/// seeded with. It has the contents of the low-res images and masks that
+/// D_sub is computed from, which change when the inputs or the alignment
+/// change, and only the options that affect low-res correlation.
+std::string lowres_disparity_cache_key(ASPGlobalOptions const& opt) {
+
+  StereoSettings const& ss = stereo_settings();
+  std::ostringstream os;
+  os.precision(17);
+
+  os << "seed_mode " << ss.seed_mode << ' ';
+  const char * sub_files[] = {"-L_sub.tif", "-R_sub.tif", "-lMask_sub.tif", "-rMask_sub.tif"};
+  for (size_t it = 0; it < sizeof(sub_files)/sizeof(sub_files[0]); it++)
+    os << sub_files[it] << ' ' << asp::file_content_hash(opt.out_prefix + sub_files[it]) << ' ';
+  DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif");
+  os << "size " << Lmask.cols() << ' ' << Lmask.rows() << ' ';
+
+  // The cameras are used to filter D_sub and, with seed mode 2, to create it
+  append_file_stats(os, opt.in_file1);
+  append_file_stats(os, opt.in_file2);
+  append_file_stats(os, opt.cam_file1);
+  append_file_stats(os, opt.cam_file2);
+  os << "alignment " << ss.alignment_method << ' '
+     << ss.left_image_crop_win << ' ' << ss.right_image_crop_win << ' ';
+
+  // How the initial search range is found
+  if (ss.is_search_defined()) {
+    os << "search_range " << ss.search_range << ' ';
+  } else if (ss.seed_mode == 1) {
+    os << "ip " << ss.ip_per_tile << ' ' << ss.ip_per_image << ' ' << ss.matches_per_tile << ' '
+       << ss.ip_matching_method << ' ' << ss.epipolar_threshold << ' ' << ss.ip_inlier_factor << ' '
+       << ss.ip_uniqueness_thresh << ' ' << ss.ip_nodata_radius << ' '
+       << ss.ip_triangulation_max_error << ' ' << ss.ip_num_ransac_iterations << ' '
+       << ss.disable_tri_filtering << ' ' << ss.num_scales << ' ' << ss.ip_edge_buffer_percent << ' '
+       << ss.ip_normalize_tiles << ' ' << ss.min_num_ip << ' ' << ss.elevation_limit << ' '
+       << ss.lon_lat_limit << ' ' << ss.ip_filter_using_dem << ' '
+       << ss.match_files_prefix << ' ' << ss.clean_match_files_prefix << ' ';
+  }
+  os << "limit " << ss.corr_search_limit << ' ';
+
+  // Low-res correlation and filtering
+  if (ss.seed_mode == 1) {
+    os << "corr " << ss.seed_percent_pad << ' ' << ss.cost_mode << ' ' << ss.corr_kernel << ' '
+       << ss.corr_timeout << ' ' << ss.xcorr_threshold << ' ' << ss.min_xcorr_level << ' '
+       << ss.slogW << ' ' << ss.corr_max_levels << ' ' << ss.stereo_algorithm << ' '
+       << int(get_sgm_subpixel_mode()) << ' ' << ss.sgm_search_buffer << ' '
+       << ss.corr_memory_limit_mb << ' ' << ss.corr_blob_filter_area << ' '
+       << ss.rm_quantile_percentile << ' ' << ss.rm_quantile_multiple << ' '
+       << ss.rm_threshold << ' ' << ss.rm_min_matches << ' '
+       << ss.outlier_removal_params << ' ' << ss.max_disp_spread << ' '
+       << ss.correlator_mode << ' ';
+  } else if (ss.seed_mode == 2) {
+    os << "dem " << ss.disparity_estimation_dem << ' ' << ss.disparity_estimation_dem_error << ' ';
+    append_file_stats(os, ss.disparity_estimation_dem);
+  }
+
+  // Must fit on a line
+  std::string key = os.str();
+  std::replace(key.begin(), key.end(), '\n', ' ');
+  return key;
+}
+
+/// Read the key with which D_sub was created, and if D_sub_spread was
+/// created with it. Return false if not found.
+bool read_lowres_disparity_key(std::string const& key_file, std::string & key,
+                               bool & has_spread) {
+  std::ifstream ifs(key_file.c_str());
+  if (!ifs.good() || !std::getline(ifs, key))
+    return false;
+  return bool(ifs >> has_spread);
+}
+
+void write_lowres_disparity_key(std::string const& key_file, std::string const& key,
+                                bool has_spread) {
+  std::ofstream ofs(key_file.c_str());
+  if (!ofs.good())
+    vw_throw(IOErr() << "Cannot write: " << key_file << "\n");
+  ofs << key << "\n" << has_spread << "\n";
+}
+
+// Check if an image exists and can be opened, without printing errors
+bool is_readable_image(std::string const& file) {
+  if (!fs::exists(file))
+    return false;
+  bool ans = true;
+  try {
+    vw_log().console_log().rule_set().add_rule(-1, "fileio");
+    boost::shared_ptr<DiskImageResource> rsrc(vw::DiskImageResourcePtr(file));
+  } catch (...) {
+    ans = false;
+  }
+  vw_settings().reload_config();
+  return ans;
+}
+
 /// The first step of correlation computation.
 void lowres_correlation(ASPGlobalOptions & opt) {
 
   vw_out() << "\n[ " << current_posix_time_string()
            << " ] : Stage 1 --> LOW-RESOLUTION CORRELATION\n";
 
+  // Reuse the prior D_sub and search range if the images, alignment, and
+  // low-res correlation options did not change. This does not apply with
+  // seed mode 3, when sparse_disp creates D_sub, or when cropping the
+  // images each time, when D_sub must be computed anew.
+  bool crop_left  = (stereo_settings().left_image_crop_win  != BBox2i(0, 0, 0, 0));
+  bool crop_right = (stereo_settings().right_image_crop_win != BBox2i(0, 0, 0, 0));
+  bool use_cache  = ((stereo_settings().seed_mode == 1 || stereo_settings().seed_mode == 2) &&
+                     !crop_left && !crop_right);
+  std::string sub_disp_file = opt.out_prefix + "-D_sub.tif";
+  std::string spread_file   = opt.out_prefix + "-D_sub_spread.tif";
+  std::string key_file      = opt.out_prefix + "-D_sub-key.txt";
+  std::string cache_key;
+  if (use_cache) {
+    cache_key = lowres_disparity_cache_key(opt);
+    std::string prev_key;
+    bool prev_has_spread = false;
+    if (read_lowres_disparity_key(key_file, prev_key, prev_has_spread) &&
+        prev_key == cache_key && is_readable_image(sub_disp_file) &&
+        (!prev_has_spread || is_readable_image(spread_file))) {
+      // Skip finding the search range from interest points, as only D_sub needs it
+      vw_out() << "\t--> Using cached low-resolution disparity: " << sub_disp_file << "\n";
+      bool verbose = true;
+      read_search_range_from_D_sub(sub_disp_file, opt, verbose);
+      vw_out() << "\n[ " << current_posix_time_string()
+               << " ] : LOW-RESOLUTION CORRELATION FINISHED\n";
+      return;
+    }
+  }
+
   // Working out search range if need be
   if (stereo_settings().is_search_defined()) {
     vw_out() << "\t--> Using user-defined search range.\n";
@@ -676,19 +836,14 @@ void lowres_correlation(ASPGlobalOptions & opt) {
   // Performing disparity on sub images
   if (stereo_settings().seed_mode > 0) {
 
-    // Reuse prior existing D_sub if it exists, unless we
-    // are cropping the images each time, when D_sub must
-    // be computed anew each time.
-    bool crop_left  = (stereo_settings().left_image_crop_win  != BBox2i(0, 0, 0, 0));
-    bool crop_right = (stereo_settings().right_image_crop_win != BBox2i(0, 0, 0, 0));
-    
-    std::string sub_disp_file = opt.out_prefix + "-D_sub.tif";
-
+    // Reuse prior existing D_sub if it exists, unless we are cropping the
+    // images each time, when D_sub must be computed anew each time. If the
+    // cache key is used, we got here because it does not match.
     // Also need to rebuild if the inputs changed after the mask files were produced.
     bool inputs_changed = (!is_latest_timestamp(sub_disp_file, opt.in_file1,  opt.in_file2,
                                                 opt.cam_file1, opt.cam_file2));
 
-    bool rebuild = crop_left || crop_right || inputs_changed;
+    bool rebuild = crop_left || crop_right || inputs_changed || use_cache;
 
     try {
       vw_log().console_log().rule_set().add_rule(-1,"fileio");
@@ -709,6 +864,8 @@ void lowres_correlation(ASPGlobalOptions & opt) {
     if (rebuild) {
       // It will be rebuilt except for seed-mode 3 when sparse_disp takes care of it.
       produce_lowres_disparity(opt);
+      if (use_cache)
+        write_lowres_disparity_key(key_file, cache_key, fs::exists(spread_file));
     } else {
       vw_out() << "\t--> Using cached low-resolution disparity: " << sub_disp_file << "\n";
     }
@@ -718,6 +875,119 @@ void lowres_correlation(ASPGlobalOptions & opt) {
            << " ] : LOW-RESOLUTION CORRELATION FINISHED\n";
 } // End lowres_correlation
 
+/// Find the full-resolution search range for a tile from the low-resolution
+/// disparity, expanded by the spread if provided (has zero size otherwise).
+BBox2 seeded_search_range(BBox2i const& bbox,
+                          ImageViewRef<PixelMask<Vector2f>> const& sub_disp,
+                          ImageViewRef<PixelMask<Vector2i>> const& sub_disp_spread,
+                          Vector2 const& upscale_factor) {
+
+  // The low-res version of bbox
+  BBox2i seed_bbox(elem_quot(bbox.min(), upscale_factor),
+                   elem_quot(bbox.max(), upscale_factor));
+  seed_bbox.expand(1);
+  seed_bbox.crop(bounding_box(sub_disp));
+  // Get the disparity range in d_sub corresponding to this tile.
+  VW_OUT(DebugMessage, "stereo") << "\nGetting disparity range for : " << seed_bbox << "\n";
+  BBox2 search_range = stereo::get_disparity_range(crop(sub_disp, seed_bbox));
+
+  if (sub_disp_spread.cols() != 0 && sub_disp_spread.rows() != 0) {
+    // Expand the disparity range by sub_disp_spread.
+    BBox2 spread = stereo::get_disparity_range(crop(sub_disp_spread, seed_bbox));
+    search_range.min() -= spread.max();
+    search_range.max() += spread.max();
+  }
+
+  search_range = grow_bbox_to_int(search_range);
+  // Expand the search range by 1. This is necessary since
+  // sub_disp is integer-valued, and perhaps the search
+  // range was supposed to be a fraction of integer bigger.
+  search_range.expand(1);
+
+  // Scale the search range to full-resolution
+  search_range.min() = floor(elem_prod(search_range.min(), upscale_factor));
+  search_range.max() = ceil (elem_prod(search_range.max(), upscale_factor));
+
+  return search_range;
+}
+
+/// Estimate the cost of correlating each tile of given size, as the number of
+/// valid pixels times the area of the search range, and save these to a file.
+/// The tiles are in the same order as in parallel_stereo. That tool will use
+/// this to start the most expensive tiles first.
+void write_tile_costs(ASPGlobalOptions const& opt, Vector2i const& tile_size) {
+
+  std::string d_sub_file  = opt.out_prefix + "-D_sub.tif";
+  std::string spread_file = opt.out_prefix + "-D_sub_spread.tif";
+  std::string cost_file   = opt.out_prefix + "-corr-tile-costs.txt";
+
+  ImageViewRef<PixelMask<Vector2f>> sub_disp_ref;
+  if (!load_D_sub(d_sub_file, sub_disp_ref)) {
+    vw_out(WarningMessage) << "Could not read " << d_sub_file
+                           << ". Will not write: " << cost_file << "\n";
+    return;
+  }
+
+  // D_sub is small, so it is kept in memory
+  ImageView<PixelMask<Vector2f>> sub_disp = sub_disp_ref;
+  ImageView<PixelMask<Vector2i>> sub_disp_spread;
+  if (fs::exists(spread_file))
+    sub_disp_spread = DiskImageView<PixelMask<Vector2i>>(spread_file);
+  if (sub_disp_spread.cols() != 0 &&
+      (sub_disp_spread.cols() != sub_disp.cols() || sub_disp_spread.rows() != sub_disp.rows()))
+    sub_disp_spread.reset(); // inconsistent, so ignore it
+
+  DiskImageView<PixelGray<float>> left_image(opt.out_prefix + "-L.tif");
+  Vector2 upscale_factor(double(left_image.cols()) / sub_disp.cols(),
+                         double(left_image.rows()) / sub_disp.rows());
+
+  int tiles_nx = (left_image.cols() + tile_size[0] - 1) / tile_size[0];
+  int tiles_ny = (left_image.rows() + tile_size[1] - 1) / tile_size[1];
+
+  vw_out() << "Writing: " << cost_file << "\n";
+  std::ofstream ofs(cost_file.c_str());
+  if (!ofs.good())
+    vw_throw(IOErr() << "Cannot write: " << cost_file << "\n");
+  ofs << "# tile_index min_x min_y width height cost\n";
+  ofs.precision(17);
+
+  for (int j = 0; j < tiles_ny; j++) {
+    for (int i = 0; i < tiles_nx; i++) {
+      BBox2i tile(i * tile_size[0], j * tile_size[1], tile_size[0], tile_size[1]);
+      tile.crop(bounding_box(left_image));
+
+      // Fraction of valid low-res disparities over the tile
+      BBox2i seed_bbox(elem_quot(tile.min(), upscale_factor),
+                       elem_quot(tile.max(), upscale_factor));
+      seed_bbox.expand(1);
+      seed_bbox.crop(bounding_box(sub_disp));
+      double num_valid = 0;
+      for (int row = seed_bbox.min().y(); row < seed_bbox.max().y(); row++) {
+        for (int col = seed_bbox.min().x(); col < seed_bbox.max().x(); col++) {
+          if (is_valid(sub_disp(col, row)))
+            num_valid++;
+        }
+      }
+      
+      double cost = 0.0;
+      if (num_valid > 0) {
+        BBox2 search_range = seeded_search_range(tile, sub_disp, sub_disp_spread,
+                                                 upscale_factor);
+        if ((stereo_settings().corr_search_limit.min() != Vector2i()) || 
+            (stereo_settings().corr_search_limit.max() != Vector2i()))
+          search_range.crop(stereo_settings().corr_search_limit);
+        double valid_frac = num_valid / std::max(1.0, double(seed_bbox.area()));
+        cost = valid_frac * double(tile.area()) *
+          (std::max(search_range.width(), 0.0) + 1.0) *
+          (std::max(search_range.height(), 0.0) + 1.0);
+      }
+
+      ofs << j * tiles_nx + i << ' ' << tile.min().x() << ' ' << tile.min().y() << ' '
+          << tile.width() << ' ' << tile.height() << ' ' << cost << "\n";
+    }
+  }
+}
+
 /// This correlator takes a low resolution disparity image as an input
 /// so that it may narrow its search range for each tile that is processed.
 class SeededCorrelatorView: public ImageViewBase<SeededCorrelatorView> {
@@ -737,6 +1007,7 @@ class SeededCorrelatorView: public ImageViewBase<SeededCorrelatorView> {
   int      m_corr_timeout;
   double   m_seconds_per_op;
   Vector2  m_region_ul; // the upper-left corner of the region containing all pixels to process
+  CorrMemoryScheduler * m_scheduler; // if not null, limit memory across tiles
 public:
 
   // Set these input types here instead of making them template arguments
@@ -756,13 +1027,14 @@ public:
                        stereo::CostFunctionType cost_mode,
                        int corr_timeout, double seconds_per_op,
                        Vector2i const& region_ul,
-                       ImageView<PixelMask<float>> * lr_disp_diff):
+                       ImageView<PixelMask<float>> * lr_disp_diff,
+                       CorrMemoryScheduler * scheduler = NULL):
     m_left_image(left_image.impl()), m_right_image(right_image.impl()),
     m_left_mask (left_mask.impl ()), m_right_mask (right_mask.impl ()),
     m_sub_disp(sub_disp.impl()), m_sub_disp_spread(sub_disp_spread.impl()),
     m_kernel_size(kernel_size),  m_cost_mode(cost_mode),
     m_corr_timeout(corr_timeout), m_seconds_per_op(seconds_per_op),
-    m_region_ul(region_ul), m_lr_disp_diff(lr_disp_diff) {
+    m_region_ul(region_ul), m_lr_disp_diff(lr_disp_diff), m_scheduler(scheduler) {
     m_upscale_factor[0] = double(m_left_image.cols()) / m_sub_disp.cols();
     m_upscale_factor[1] = double(m_left_image.rows()) / m_sub_disp.rows();
     m_seed_bbox = bounding_box(m_sub_disp);
@@ -784,55 +1056,24 @@ public:
     return pixel_type();
   }
 
-  /// Does the work
-  typedef CropView<ImageView<pixel_type>> prerasterize_type;
-  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+  /// The search range for the given tile, based on D_sub and D_sub_spread
+  BBox2 tile_search_range(BBox2i const& bbox) const {
 
-    vw::stereo::CorrelationAlgorithm stereo_alg
-      = asp::stereo_alg_to_num(stereo_settings().stereo_algorithm);
-    
     // User strategies
     BBox2 local_search_range;
     if (stereo_settings().seed_mode > 0) {
 
-      // The low-res version of bbox
-      BBox2i seed_bbox(elem_quot(bbox.min(), m_upscale_factor),
-                       elem_quot(bbox.max(), m_upscale_factor));
-      seed_bbox.expand(1);
-      seed_bbox.crop(m_seed_bbox);
-      // Get the disparity range in d_sub corresponding to this tile.
-      VW_OUT(DebugMessage, "stereo") << "\nGetting disparity range for : " << seed_bbox << "\n";
-      DispSeedImageType disparity_in_box = crop(m_sub_disp, seed_bbox);
-
-      local_search_range = stereo::get_disparity_range(disparity_in_box);
-
+      // Sanity check: If m_sub_disp_spread was provided, it better have the same size as sub_disp.
       bool has_sub_disp_spread = (m_sub_disp_spread.cols() != 0 &&
                                   m_sub_disp_spread.rows() != 0);
-      // Sanity check: If m_sub_disp_spread was provided, it better have the same size as sub_disp.
       if (has_sub_disp_spread &&
           m_sub_disp_spread.cols() != m_sub_disp.cols() &&
           m_sub_disp_spread.rows() != m_sub_disp.rows()){
         vw_throw(ArgumentErr() << "stereo_corr: D_sub and D_sub_spread must have equal sizes.\n");
       }
 
-      if (has_sub_disp_spread) {
-        // Expand the disparity range by m_sub_disp_spread.
-        SpreadImageType spread_in_box = crop(m_sub_disp_spread, seed_bbox);
-
-        BBox2 spread = stereo::get_disparity_range(spread_in_box);
-        local_search_range.min() -= spread.max();
-        local_search_range.max() += spread.max();
-      } //endif has_sub_disp_spread
-
-      local_search_range = grow_bbox_to_int(local_search_range);
-      // Expand local_search_range by 1. This is necessary since
-      // m_sub_disp is integer-valued, and perhaps the search
-      // range was supposed to be a fraction of integer bigger.
-      local_search_range.expand(1);
-
-      // Scale the search range to full-resolution
-      local_search_range.min() = floor(elem_prod(local_search_range.min(),m_upscale_factor));
-      local_search_range.max() = ceil (elem_prod(local_search_range.max(),m_upscale_factor));
+      local_search_range = seeded_search_range(bbox, m_sub_disp, m_sub_disp_spread,
+                                               m_upscale_factor);
 
       // If the user specified a search range limit, apply it here.
       if ((stereo_settings().corr_search_limit.min() != Vector2i()) || 
@@ -852,6 +1093,32 @@ public:
       VW_OUT(DebugMessage,"stereo") << "Searching with " << stereo_settings().search_range << "\n";
     }
 
+    return local_search_range;
+  }
+
+  /// Does the work
+  typedef CropView<ImageView<pixel_type>> prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    asp::TraceSpan trace_span("corr_tile", "tile",
+                              [&bbox]() { return vw::stringify(bbox); });
+    vw::stereo::CorrelationAlgorithm stereo_alg
+      = asp::stereo_alg_to_num(stereo_settings().stereo_algorithm);
+
+    BBox2 local_search_range = tile_search_range(bbox);
+
+    // Wait until there is enough memory to correlate this tile, if
+    // a budget is set. This is released when the tile is done.
+    std::int64_t tile_mem = 0;
+    if (m_scheduler != NULL) {
+      tile_mem = estimCorrTileMemory(bbox.size(), local_search_range, m_kernel_size,
+                                     stereo_alg, stereo_settings().sgm_collar_size,
+                                     stereo_settings().corr_memory_limit_mb);
+      VW_OUT(DebugMessage, "stereo") << "Estimated memory for tile " << bbox << ": "
+                                     << tile_mem / (1024.0 * 1024.0) << " MB\n";
+    }
+    CorrMemoryReservation reservation(m_scheduler, tile_mem);
+
     SemiGlobalMatcher::SgmSubpixelMode sgm_subpixel_mode = get_sgm_subpixel_mode();
     Vector2i sgm_search_buffer = stereo_settings().sgm_search_buffer;
 
@@ -895,6 +1162,17 @@ public:
   }
 }; // End class SeededCorrelatorView
 
+/// An integer disparity is the difference of a right and a left image pixel,
+/// so it is no more than the image size, plus the kernel size as the
+/// correlation window may go off the image. If that is less than the largest
+/// 16-bit integer, the disparity can be saved with 16-bit integers.
+bool disparity_fits_int16(Vector2i const& left_size, Vector2i const& right_size,
+                          Vector2i const& kernel_size) {
+  int max_disp = std::max(vw::math::max(left_size), vw::math::max(right_size))
+    + vw::math::max(kernel_size);
+  return max_disp < std::numeric_limits<int16>::max();
+}
+
 
 /// Stereo correlation function using ASP's block-matching and MGM/SGM
 /// algorithms which can handle a 2D disparity.
@@ -908,6 +1186,11 @@ void stereo_correlation_2D(ASPGlobalOptions& opt) {
   if (!stereo_settings().skip_low_res_disparity_comp || stereo_settings().seed_mode == 0)
     lowres_correlation(opt);
 
+  // Per-tile cost estimates, for parallel_stereo
+  Vector2i tile_cost_size = stereo_settings().corr_tile_cost_size;
+  if (stereo_settings().seed_mode > 0 && tile_cost_size[0] > 0 && tile_cost_size[1] > 0)
+    write_tile_costs(opt, tile_cost_size);
+
   if (stereo_settings().compute_low_res_disparity_only) 
     return; // Just computed the low-res disparity, so quit.
 
@@ -992,13 +1275,20 @@ void stereo_correlation_2D(ASPGlobalOptions& opt) {
     lr_disp_diff_ptr = &lr_disp_diff;
   }
 
+  // If a memory budget is set, tiles with large search ranges will run with
+  // fewer tiles alongside them.
+  boost::shared_ptr<CorrMemoryScheduler> scheduler;
+  if (stereo_settings().corr_memory_budget_mb > 0)
+    scheduler.reset(new CorrMemoryScheduler(std::int64_t(stereo_settings().corr_memory_budget_mb)
+                                            * 1024 * 1024));
+
   // Set up the reference to the stereo disparity code
   // - Processing is limited to left_trans_crop_win for use with parallel_stereo.
   ImageViewRef<PixelMask<Vector2f>> fullres_disparity =
     crop(SeededCorrelatorView(left_disk_image, right_disk_image, Lmask, Rmask,
                               sub_disp, sub_disp_spread, kernel_size, 
                               cost_mode, corr_timeout, seconds_per_op,
-                              region_ul, lr_disp_diff_ptr), 
+                              region_ul, lr_disp_diff_ptr, scheduler.get()), 
          left_trans_crop_win);
 
   // With SGM, we must do the entire image chunk as one
@@ -1060,15 +1350,30 @@ void stereo_correlation_2D(ASPGlobalOptions& opt) {
                                     ASPGlobalOptions::rfne_tile_size());
     vw::cartography::block_write_gdal_image(d_file, result,
                                             has_left_georef, left_georef,
-                                            has_nodata, nodata, opt,
+                                            has_nodata, nodata,
+                                            asp::intermediate_write_options(opt, true),
                                             TerminalProgressCallback("asp", "\t--> Correlation :"));
+    if (stereo_settings().save_blend_weights)
+      save_blend_weights(opt, result, d_file);
 
+  } else if (stereo_settings().compact_intermediates &&
+             disparity_fits_int16(bounding_box(left_disk_image).size(),
+                                  bounding_box(right_disk_image).size(), kernel_size)) {
+    // Save with 16-bit integers. Readers convert the values on loading.
+    vw::cartography::block_write_gdal_image(d_file, 
+                                            pixel_cast<PixelMask<Vector<int16, 2>>>
+                                            (fullres_disparity),
+                                            has_left_georef, left_georef,
+                                            has_nodata, nodata,
+                                            asp::intermediate_write_options(opt, false),
+                                            TerminalProgressCallback("asp", "\t--> Correlation :"));
   } else {
     // Otherwise cast back to integer results to save on storage space.
     vw::cartography::block_write_gdal_image(d_file, 
                                             pixel_cast<PixelMask<Vector2i>>(fullres_disparity),
                                             has_left_georef, left_georef,
-                                            has_nodata, nodata, opt,
+                                            has_nodata, nodata,
+                                            asp::intermediate_write_options(opt, false),
                                             TerminalProgressCallback("asp", "\t--> Correlation :"));
   }
 
@@ -1085,6 +1390,8 @@ void stereo_correlation_2D(ASPGlobalOptions& opt) {
                                             has_lr_disp_nodata, lr_disp_nodata, opt,
                                             TerminalProgressCallback("asp",
                                                                      "\t--> L-R-disp-diff :"));
+    if (stereo_settings().save_blend_weights)
+      save_blend_weights(opt, lr_disp_diff, lr_disp_diff_file);
   }
 
   return;
@@ -1129,7 +1436,8 @@ void save_disparity(ASPGlobalOptions& opt,
   opt.gdal_options["TILED"] = "YES";
   vw::cartography::block_write_gdal_image(out_disp_file, unaligned_disp_2d,
                                           has_georef, georef,
-                                          has_nodata, nodata, opt,
+                                          has_nodata, nodata,
+                                          asp::intermediate_write_options(opt, true),
                                           TerminalProgressCallback
                                           ("asp", "\t--> Correlation :"));
 }
@@ -1636,6 +1944,8 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
   vw::ImageView<PixelMask<Vector2f>> cropped_disp;
   adjustForCropWin(unaligned_disp_2d, tile_crop_win, left_trans_crop_win, cropped_disp);
   save_disparity(opt, cropped_disp, out_disp_file);
+  if (stereo_settings().save_blend_weights)
+    save_blend_weights(opt, cropped_disp, out_disp_file);
   
   // If unaligned_lr_disp_diff is not empty, adjust it and save it
   if (unaligned_lr_disp_diff.cols() > 0) {
@@ -1643,11 +1953,13 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
     adjustForCropWin(unaligned_lr_disp_diff, tile_crop_win, left_trans_crop_win, cropped_diff);
     std::string lr_disp_diff_file = opt.out_prefix + "-L-R-disp-diff.tif";
     save_lr_disp_diff(opt, cropped_diff, lr_disp_diff_file);
+    if (stereo_settings().save_blend_weights)
+      save_blend_weights(opt, cropped_diff, lr_disp_diff_file);
   }
 
 } // End function stereo_correlation_1D
 
-int main(int argc, char* argv[]) {
+int stereo_corr_main(int argc, char* argv[]) {
 
   try {
     xercesc::XMLPlatformUtils::Initialize();
@@ -1735,3 +2047,7 @@ int main(int argc, char* argv[]) {
 
   return 0;
 }
+
+int main(int argc, char* argv[]) {
+  return asp::run_batch(argc, argv, stereo_corr_main);
+}
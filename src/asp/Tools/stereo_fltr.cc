@@ -19,6 +19,7 @@
 /// \file stereo_fltr.cc
 ///
 #include <asp/Tools/stereo.h>
+#include <asp/Tools/stereo_rfne.h>
 
 #include <vw/Stereo/DisparityMap.h>
 #include <vw/Stereo/Algorithms.h>
@@ -230,35 +231,90 @@ struct MultipleDisparityCleanUp {
   }
 };
 
+// The files with the valid region of the left and right masks, as found by
+// ThreadedEdgeMaskView.
+std::string edge_extents_file(std::string const& prefix, std::string const& mask) {
+  return prefix + "-" + mask + "-extents.bin";
+}
+
+// Find the valid region of a mask, or load it if it was saved before by
+// save_edge_extents(). The latter is much faster for large images.
+typedef ThreadedEdgeMaskView<DiskImageView<vw::uint8>> EdgeMaskType;
+EdgeMaskType edge_mask(std::string const& mask_file, int32 mask_buffer,
+                       std::string const& extents_file) {
+  DiskImageView<vw::uint8> mask(mask_file);
+  if (extents_file != "")
+    return EdgeMaskType(mask, mask_buffer, extents_file);
+  return asp::threaded_edge_mask(mask, 0, mask_buffer, 1024);
+}
+
+int32 edge_mask_buffer() {
+  int32 mask_buffer = stereo_settings().mask_buffer_size;
+  if (mask_buffer < 0) // If Unset, set to the subpixel kernel size.
+    mask_buffer = max( stereo_settings().subpixel_kernel );
+  return mask_buffer;
+}
+
+// Find the valid region of the masks once for the whole run, so that each
+// tile filtered by parallel_stereo does not have to redo it.
+void save_edge_extents(ASPGlobalOptions const& opt) {
+  int32 mask_buffer = edge_mask_buffer();
+  std::string masks[] = {"lMask", "rMask"};
+  for (int it = 0; it < 2; it++) {
+    std::string extents_file = edge_extents_file(opt.out_prefix, masks[it]);
+    vw_out() << "Writing: " << extents_file << std::endl;
+    edge_mask(opt.out_prefix + "-" + masks[it] + ".tif", mask_buffer, "")
+      .write_extents(mask_buffer, extents_file);
+  }
+}
+
+// Write the good pixel map and the filtered disparity. If out_box is smaller
+// than the input, as when parallel_stereo filters one tile, only that region
+// is written, at full resolution. The filters still see the pixels outside
+// of it. Inputs are read based on in_prefix.
 template <class ImageT>
 void write_good_pixel_and_filtered(ImageViewBase<ImageT> const& inputview,
-                                   ASPGlobalOptions const& opt) {
+                                   ASPGlobalOptions const& opt,
+                                   std::string const& in_prefix,
+                                   BBox2i const& out_box) {
+
+  typedef typename ImageT::pixel_type PixelT;
+  bool filter_tile = (out_box != bounding_box(inputview.impl()));
+
   // Write Good Pixel Map
   // Sub-sampling so that the user can actually view it.
   double sub_scale = double( min( inputview.impl().cols(),
                                 inputview.impl().rows() ) ) / 2048.0;
-  if (sub_scale < 1) // Don't use a sub_scale less than one.
+  if (sub_scale < 1 || filter_tile) // Don't use a sub_scale less than one.
     sub_scale = 1;
 
   // Write out the good pixel map
   std::string goodPixelFile = opt.out_prefix + "-GoodPixelMap.tif";
   vw_out() << "Writing: " << goodPixelFile << std::endl;
   ImageViewRef<  PixelRGB<uint8> > goodPixelImage
-    = subsample(apply_mask
-                (copy_mask
-                 (stereo::missing_pixel_image(inputview.impl()),
-                  create_mask(DiskImageView<vw::uint8>(opt.out_prefix+"-lMask.tif"), 0)
-                  )
-                 ), sub_scale);
+    = apply_mask
+    (copy_mask
+     (stereo::missing_pixel_image(inputview.impl()),
+      create_mask(DiskImageView<vw::uint8>(in_prefix+"-lMask.tif"), 0)
+      )
+     );
+  if (filter_tile)
+    goodPixelImage = crop(goodPixelImage, out_box);
+  else
+    goodPixelImage = subsample(goodPixelImage, sub_scale);
 
   // Determine if we can attach geo information to the output image
   cartography::GeoReference left_georef;
-  bool has_left_georef = read_georeference(left_georef,  opt.out_prefix + "-L.tif");
+  bool has_left_georef = read_georeference(left_georef,  in_prefix + "-L.tif");
   bool has_nodata = false;
   double nodata = -32768.0;
+  if (has_left_georef && filter_tile)
+    left_georef = crop(left_georef, out_box.min().x(), out_box.min().y());
 
   vw::cartography::GeoReference good_pixel_georef;
-  if (has_left_georef) {
+  if (filter_tile) {
+    good_pixel_georef = left_georef;
+  } else if (has_left_georef) {
     // Account for scale. Note that goodPixelImage is not guaranteed to respect
     // the sub_scale factor above, hence this calculation.
     double good_pixel_scale = 0.5*( double(goodPixelImage.cols())/inputview.impl().cols()
@@ -298,7 +354,7 @@ void write_good_pixel_and_filtered(ImageViewBase<ImageT> const& inputview,
                                    inpaint(inputview.impl(), smallHoleIndex,
                                            use_grassfire, default_inpaint_val),
                                    has_left_georef, left_georef,
-                                   has_nodata, nodata, opt,
+                                   has_nodata, nodata, asp::intermediate_write_options(opt, true),
                                    TerminalProgressCallback
                                    ("asp","\t--> Filtering: ") );
     }
@@ -313,60 +369,95 @@ void write_good_pixel_and_filtered(ImageViewBase<ImageT> const& inputview,
                                             use_grassfire,
                                             default_inpaint_val) ),
                                    has_left_georef, left_georef,
-                                   has_nodata, nodata, opt,
+                                   has_nodata, nodata, asp::intermediate_write_options(opt, true),
                                    TerminalProgressCallback
                                    ("asp","\t--> Filtering: ") );
     }
 
   } else { // No hole filling
-    if (!removeSmallBlobs) { // Skip small blob removal
-      vw_out() << "Writing: " << outF << endl;
-      vw::cartography::block_write_gdal_image( outF, inputview.impl(),
-                                   has_left_georef, left_georef,
-                                   has_nodata, nodata, opt,
-                                   TerminalProgressCallback
-                                   ("asp", "\t--> Filtering: ") );
-    }
-    else { // Add small blob removal step
+    ImageViewRef<PixelT> filtered = inputview.impl();
+    if (removeSmallBlobs) { // Add small blob removal step
       vw_out() << "\t--> Removing small blobs.\n";
-      // Write out the image to disk, removing the blobs in the process
-      vw_out() << "Writing: " << outF << endl;
-      vw::cartography::block_write_gdal_image(outF, per_tile_erode(inputview.impl()),
-                                  has_left_georef, left_georef,
-                                  has_nodata, nodata, opt,
-                                  TerminalProgressCallback
-                                  ("asp","\t--> Filtering: ") );
+      // Remove the blobs. This is done per tile, with padding, so it works
+      // also when writing only one tile of the image.
+      filtered = per_tile_erode(inputview.impl());
     }
+    if (filter_tile)
+      filtered = crop(filtered, out_box);
+
+    vw_out() << "Writing: " << outF << endl;
+    vw::cartography::block_write_gdal_image( outF, filtered,
+                                 has_left_georef, left_georef,
+                                 has_nodata, nodata, asp::intermediate_write_options(opt, true),
+                                 TerminalProgressCallback
+                                 ("asp", "\t--> Filtering: ") );
 
   } // End no hole filling case
 } //end write_good_pixel_and_filtered
 
 void stereo_filtering(ASPGlobalOptions& opt) {
 
+  // With fused refinement, the refined disparity is computed here in memory,
+  // rather than read from -RD.tif. The session hook needs a file on disk, so
+  // that case is skipped when the hook does something.
+  bool fused = stereo_settings().fused_refinement_filtering;
+  if (fused && stereo_settings().mask_flatfield) {
+    vw_out(WarningMessage) << "Cannot use --fused-refinement-filtering with "
+                           << "--mask-flatfield. Reading the refined disparity "
+                           << "from disk.\n";
+    fused = false;
+  }
+
+  // When parallel_stereo filters one tile, the inputs for the whole image are
+  // read from the parent run, and only the tile is written.
+  std::string in_prefix = opt.out_prefix;
+  bool filter_tile = (stereo_settings().filter_parent_prefix != "");
+  if (filter_tile) {
+    if (fused || stereo_settings().mask_flatfield || stereo_settings().enable_fill_holes ||
+        stereo_settings().gotcha_disparity_refinement)
+      vw_throw(ArgumentErr() << "Cannot filter one tile with --fused-refinement-filtering, "
+               << "--mask-flatfield, --enable-fill-holes, or "
+               << "--gotcha-disparity-refinement, as these work on the whole image.\n");
+    in_prefix = stereo_settings().filter_parent_prefix;
+  }
+
   string post_correlation_fname;
-  opt.session->pre_filtering_hook(opt.out_prefix+"-RD.tif",
-                                  post_correlation_fname);
+  if (!fused)
+    opt.session->pre_filtering_hook(in_prefix+"-RD.tif",
+                                    post_correlation_fname);
 
   try {
 
-    // Rasterize the results so far to a temporary file on disk.
-    // This file is deleted once we complete the second half of the
-    // disparity map filtering process.
-
     // Apply filtering for high frequencies
-    typedef DiskImageView<PixelMask<Vector2f> > input_type;
-    input_type disparity_disk_image(post_correlation_fname);
+    typedef ImageViewRef<PixelMask<Vector2f>> input_type;
+    input_type disparity_disk_image;
+    if (fused) {
+      // Each refined tile is cached, as filtering reads its input more
+      // than once. Tiles which got evicted from the cache are recomputed.
+      vw_out() << "\t--> Refining the disparity in memory.\n";
+      int ts = ASPGlobalOptions::rfne_tile_size();
+      disparity_disk_image = block_cache(refined_disparity_view(opt), Vector2i(ts, ts),
+                                         opt.num_threads);
+    } else {
+      disparity_disk_image = DiskImageView<PixelMask<Vector2f>>(post_correlation_fname);
+    }
 
-    // Applying additional clipping from the edge. We make new
-    // mask files to avoid a weird and tricky segfault due to ownership issues.
-    DiskImageView<vw::uint8> left_mask ( opt.out_prefix+"-lMask.tif" );
-    DiskImageView<vw::uint8> right_mask( opt.out_prefix+"-rMask.tif" );
-    int32 mask_buffer = stereo_settings().mask_buffer_size;
-    if (mask_buffer < 0) // If Unset, set to the subpixel kernel size.
-      mask_buffer = max( stereo_settings().subpixel_kernel );
+    // Applying additional clipping from the edge. The valid region of each
+    // mask is found once and shared by all the places it is used below.
+    int32 mask_buffer = edge_mask_buffer();
+    EdgeMaskType left_edge
+      = edge_mask(in_prefix + "-lMask.tif", mask_buffer,
+                  filter_tile ? edge_extents_file(in_prefix, "lMask") : "");
+    EdgeMaskType right_edge
+      = edge_mask(in_prefix + "-rMask.tif", mask_buffer,
+                  filter_tile ? edge_extents_file(in_prefix, "rMask") : "");
 
+    // The region to write
+    BBox2i out_box = bounding_box(disparity_disk_image);
+    if (filter_tile)
+      out_box.crop(stereo_settings().trans_crop_win);
 
-    DiskImageView<PixelGray<float> > left_disk_image (opt.out_prefix+"-L.tif");
+    DiskImageView<PixelGray<float> > left_disk_image (in_prefix+"-L.tif");
 
     vw_out() << "\t--> Cleaning up disparity map prior to filtering processes ("
              << stereo_settings().rm_cleanup_passes << " pass).\n";
@@ -384,15 +475,15 @@ void stereo_filtering(ASPGlobalOptions& opt) {
           stereo::disparity_mask
           (MultipleDisparityCleanUp<input_type>()
            (disparity_disk_image, stereo_settings().rm_cleanup_passes),
-           apply_mask(asp::threaded_edge_mask(left_mask, 0,mask_buffer,1024)),
-           apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024)));
+           apply_mask(left_edge),
+           apply_mask(right_edge));
       }
       else { // No cleanup passes
         filtered_disparity =
           stereo::disparity_mask
           (disparity_disk_image,
-           apply_mask(asp::threaded_edge_mask(left_mask, 0,mask_buffer,1024)),
-           apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024)));
+           apply_mask(left_edge),
+           apply_mask(right_edge));
       }
 
       // This is only turned on for apollo. Blob detection doesn't
@@ -409,7 +500,8 @@ void stereo_filtering(ASPGlobalOptions& opt) {
       vw_out() << "\t    * Eroding " << bindex.num_blobs() << " islands\n";
       write_good_pixel_and_filtered
         ( ErodeView<ImageViewRef<PixelMask<Vector2f> > >(filtered_disparity,
-                                                         bindex ), opt );
+                                                         bindex ), opt,
+          in_prefix, out_box );
     } else { // mask_flatfield == false
       // No Erosion step
       if ( stereo_settings().rm_cleanup_passes >= 1 ) {
@@ -418,9 +510,9 @@ void stereo_filtering(ASPGlobalOptions& opt) {
           (stereo::disparity_mask
             (MultipleDisparityCleanUp<input_type>()
               (disparity_disk_image, stereo_settings().rm_cleanup_passes),
-               apply_mask(asp::threaded_edge_mask(left_mask, 0,mask_buffer,1024)),
-               apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024))),
-             opt);
+               apply_mask(left_edge),
+               apply_mask(right_edge)),
+             opt, in_prefix, out_box);
       }
       else { // No cleanup passes
         write_good_pixel_and_filtered
@@ -431,9 +523,9 @@ void stereo_filtering(ASPGlobalOptions& opt) {
                                             stereo_settings().disp_smooth_size+2, // Compute texture a little larger than smooth radius
                                             stereo_settings().disp_smooth_texture, 
                                             stereo_settings().disp_smooth_size),
-              apply_mask(asp::threaded_edge_mask(left_mask, 0,mask_buffer,1024)),
-              apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024))),
-            opt);
+              apply_mask(left_edge),
+              apply_mask(right_edge)),
+            opt, in_prefix, out_box);
       } // End cleanup passes check
     } // End mask_flatfield check
 
@@ -488,17 +580,28 @@ void gotcha_disparity_refinement(ASPGlobalOptions& opt) {
   bool has_left_georef = read_georeference(left_georef, L_file);
   bool has_nodata = false;
   double nodata = -32768.0;
+  
+  // The blocks are refined in parallel. If there are fewer blocks than
+  // threads, use the remaining threads within each block.
+  int tile_size = ASPGlobalOptions::corr_tile_size();
+  int num_blocks = ((filtered_disparity.cols() + tile_size - 1) / tile_size) *
+                   ((filtered_disparity.rows() + tile_size - 1) / tile_size);
+  int total_threads = vw::vw_settings().default_num_threads();
+  int threads_per_block = std::max(1, total_threads / std::max(1, std::min(total_threads,
+                                                                           num_blocks)));
+  
   vw_out() << "Writing Gotcha-refined disparity: " << disp_file << endl;
   block_write_gdal_image(disp_file,
                          gotcha::gotcha_refine(filtered_disparity,  
                                                left_image, right_image,
-                                               padding, stereo_settings().casp_go_param_file),
+                                               padding, stereo_settings().casp_go_param_file,
+                                               threads_per_block),
                          has_left_georef, left_georef,
                          has_nodata, nodata, opt,
                          TerminalProgressCallback("asp","\t  Gotcha:  "));
 }
 
-int main(int argc, char* argv[]) {
+int stereo_fltr_main(int argc, char* argv[]) {
 
   try {
     xercesc::XMLPlatformUtils::Initialize();
@@ -523,6 +626,11 @@ int main(int argc, char* argv[]) {
                          verbose, output_prefix, opt_vec);
     ASPGlobalOptions opt = opt_vec[0];
 
+    if (stereo_settings().save_edge_extents_only) {
+      save_edge_extents(opt);
+      return 0;
+    }
+
     // Internal Processes
     //---------------------------------------------------------
     stereo_filtering(opt);
@@ -538,3 +646,7 @@ int main(int argc, char* argv[]) {
 
   return 0;
 }
+
+int main(int argc, char* argv[]) {
+  return asp::run_batch(argc, argv, stereo_fltr_main);
+}
@@ -243,7 +243,7 @@ void readImageNames(std::vector<std::string> const& all_files,
         // Found a gcp file
         stereo_settings().gcp_file = file;
         is_image = false;
-      } else if (get_extension(file) == ".nvm") {
+      } else if (get_extension(file) == ".nvm" || get_extension(file) == ".nvmb") {
         // Found an nvm file
         if (!stereo_settings().nvm.empty()) // sanity check
           vw_out() << "Multiple nvm files specified. Will load only: " << file << "\n";
@@ -299,24 +299,11 @@ int main(int argc, char** argv) {
     readImageNames(all_files, images, output_prefix);
 
     if (stereo_settings().create_image_pyramids_only) {
-      // Just create the image pyramids and exit. 
+      // Just create the image pyramids and exit. Hillshading is done on the
+      // fly from these, so it needs nothing more.
       for (size_t i = 0; i < images.size(); i++) {
         vw::gui::imageData img;
         img.read(images[i], opt);
-        if (stereo_settings().hillshade) {
-          // Create hillshaded images. 
-          std::string hillshaded_file;
-          bool have_gui = false; // so we don't use a pop up before the gui got started
-          bool success = vw::gui::write_hillshade(opt,
-                                                  have_gui,
-                                                  stereo_settings().hillshade_azimuth,
-                                                  stereo_settings().hillshade_elevation,
-                                                  images[i],
-                                                  // Output
-                                                  hillshaded_file);
-          if (success) // build the pyramids
-            img.read(hillshaded_file, opt, vw::gui::HILLSHADED_VIEW);
-        }
       }
       return 0;
     }
@@ -89,7 +89,7 @@ void find_tile_at_loc(std::string const& tile_at_loc, ASPGlobalOptions const& op
     vw_out() << "No tile found at location.\n"; 
 }
 
-int main(int argc, char* argv[]) {
+int stereo_parse_main(int argc, char* argv[]) {
 
   try {
     xercesc::XMLPlatformUtils::Initialize();
@@ -128,6 +128,10 @@ int main(int argc, char* argv[]) {
              << stereo_settings().left_image_crop_win.height()  << endl;
 
     vw_out() << "out_prefix," << output_prefix << endl;
+    vw_out() << "camera_cache_dir," << stereo_settings().camera_cache_dir << endl;
+    vw_out() << "intermediate_compression,"
+             << stereo_settings().intermediate_compression << endl;
+    vw_out() << "memory_budget_mb," << stereo_settings().memory_budget_mb << endl;
 
     Vector2i left_image_size  = file_image_size(opt.in_file1),
              right_image_size = file_image_size(opt.in_file2);
@@ -203,6 +207,15 @@ int main(int argc, char* argv[]) {
     vw_out() << "save_lr_disp_diff," << stereo_settings().save_lr_disp_diff << std::endl;
 
     vw_out() << "correlator_mode," << stereo_settings().correlator_mode << endl;
+
+    vw_out() << "fused_refinement_filtering,"
+             << stereo_settings().fused_refinement_filtering << endl;
+
+    // Filtering with these options needs the whole image at once
+    vw_out() << "enable_fill_holes," << stereo_settings().enable_fill_holes << endl;
+    vw_out() << "mask_flatfield," << stereo_settings().mask_flatfield << endl;
+    vw_out() << "gotcha_disparity_refinement,"
+             << stereo_settings().gotcha_disparity_refinement << endl;
     
     // This block of code should be in its own executable but I am
     // reluctant to create one just for it. This functionality will be
@@ -250,3 +263,7 @@ int main(int argc, char* argv[]) {
 
   return 0;
 }
+
+int main(int argc, char* argv[]) {
+  return asp::run_batch(argc, argv, stereo_parse_main);
+}
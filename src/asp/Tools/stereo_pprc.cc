@@ -26,6 +26,7 @@
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/InterestPoint/Matcher.h>
 #include <asp/Core/IpMatchingAlgs.h>        // Lightweight header
+#include <asp/Camera/CameraBatch.h>
 #include <asp/Sessions/CameraUtils.h>
 #include <vw/Math/Functors.h>
 #include <asp/Tools/stereo.h>
@@ -33,6 +34,7 @@
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <xercesc/util/PlatformUtils.hpp>
 #include <asp/Core/ThreadedEdgeMask.h>
+#include <asp/Core/LocalAlignment.h>
 
 using namespace vw;
 using namespace asp;
@@ -622,7 +624,9 @@ void estimate_convergence_angle(ASPGlobalOptions const& opt) {
   std::vector<double> sorted_angles;
   boost::shared_ptr<camera::CameraModel> left_cam, right_cam;
   opt.session->camera_models(left_cam, right_cam);
-  asp::convergence_angles(left_cam.get(), right_cam.get(), left_ip, right_ip, sorted_angles);
+  bool single_threaded_cameras = !opt.session->supports_multi_threading();
+  asp::convergence_angles(left_cam.get(), right_cam.get(), left_ip, right_ip,
+                          single_threaded_cameras, sorted_angles);
 
   if (sorted_angles.empty()) {
     vw_out() << "No convergence angles calculated.\n";
@@ -637,7 +641,7 @@ void estimate_convergence_angle(ASPGlobalOptions const& opt) {
            << "75% " << sorted_angles[0.75*len] << ".\n";
 }
 
-int main(int argc, char* argv[]) {
+int stereo_pprc_main(int argc, char* argv[]) {
 
   try {
     xercesc::XMLPlatformUtils::Initialize();
@@ -668,6 +672,11 @@ int main(int argc, char* argv[]) {
 
     stereo_preprocessing(adjust_left_image_size, opt);
 
+    // Detect the interest points for local alignment once, rather than
+    // in each tile during correlation
+    if (stereo_settings().alignment_method == "local_epipolar")
+      build_local_ip_index(opt);
+
     estimate_convergence_angle(opt);
     
     vw_out() << "\n[ " << current_posix_time_string() << " ] : PREPROCESSING FINISHED \n";
@@ -677,3 +686,7 @@ int main(int argc, char* argv[]) {
 
   return 0;
 }
+
+int main(int argc, char* argv[]) {
+  return asp::run_batch(argc, argv, stereo_pprc_main);
+}
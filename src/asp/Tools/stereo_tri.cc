@@ -28,20 +28,27 @@
 #include <asp/Sessions/StereoSessionASTER.h>
 
 #include <asp/Camera/RPCModel.h>
+#include <asp/Camera/BatchStereoModel.h>
 #include <asp/Core/DisparityProcessing.h>
 #include <asp/Core/Bathymetry.h>
+#include <asp/Core/MappedPointCloud.h>
+#include <asp/Core/PointUtils.h>
+#include <asp/Core/FileUtils.h>
 #include <asp/Tools/stereo.h>
 #include <asp/Tools/ccd_adjust.h>
 #include <asp/Core/IpMatchingAlgs.h>
 #include <asp/Camera/Covariance.h>
 
 #include <vw/Camera/CameraModel.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Stereo/StereoView.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <vw/Image/Filter.h>
 #include <vw/InterestPoint/Matcher.h>
 
 #include <xercesc/util/PlatformUtils.hpp>
+#include <boost/noncopyable.hpp>
 #include <ctime>
 
 using namespace vw;
@@ -53,19 +60,22 @@ enum OUTPUT_CLOUD_TYPE {FULL_CLOUD, BATHY_CLOUD, TOPO_CLOUD}; // all, below wate
 /// The main class for taking in a set of disparities and returning a
 /// point cloud using triangulation. Will compute the triangulation
 /// error, and perhaps propagate covariances (creating stddev).
+/// If threads_per_tile is more than 1, each tile is split into strips
+/// that are triangulated in parallel.
 class StereoTriangulation:
   public ImageViewBase<StereoTriangulation> {
   std::vector<DispImageType>    m_disparity_maps;
   std::vector<const vw::camera::CameraModel*> m_camera_ptrs;
   std::vector<vw::TransformPtr> m_transforms; // e.g., map-projection or homography to undo
   vw::cartography::Datum        m_datum;
-  vw::stereo::StereoModel       m_stereo_model;
+  asp::BatchStereoModel         m_stereo_model;
   asp::BathyStereoModel         m_bathy_model;
   bool                          m_is_map_projected;
   bool                          m_bathy_correct;
   OUTPUT_CLOUD_TYPE             m_cloud_type;
   ImageViewRef<PixelMask<float>> m_left_aligned_bathy_mask;
   ImageViewRef<PixelMask<float>> m_right_aligned_bathy_mask;
+  int                           m_threads_per_tile;
 
   typedef typename DispImageType::pixel_type DPixelT;
 
@@ -80,12 +90,13 @@ public:
                       std::vector<const vw::camera::CameraModel*> const& camera_ptrs,
                       std::vector<vw::TransformPtr> const& transforms,
                       vw::cartography::Datum        const& datum,
-                      vw::stereo::StereoModel       const& stereo_model,
+                      asp::BatchStereoModel         const& stereo_model,
                       asp::BathyStereoModel         const& bathy_model,
                       bool is_map_projected,
                       bool bathy_correct, OUTPUT_CLOUD_TYPE cloud_type,
                       ImageViewRef<PixelMask<float>> left_aligned_bathy_mask,
-                      ImageViewRef<PixelMask<float>> right_aligned_bathy_mask):
+                      ImageViewRef<PixelMask<float>> right_aligned_bathy_mask,
+                      int threads_per_tile = 1):
     m_disparity_maps(disparity_maps), m_camera_ptrs(camera_ptrs),
     m_transforms(transforms), m_datum(datum),
     m_stereo_model(stereo_model),
@@ -94,7 +105,8 @@ public:
     m_bathy_correct(bathy_correct),
     m_cloud_type(cloud_type),
     m_left_aligned_bathy_mask(left_aligned_bathy_mask),
-    m_right_aligned_bathy_mask(right_aligned_bathy_mask) {
+    m_right_aligned_bathy_mask(right_aligned_bathy_mask),
+    m_threads_per_tile(threads_per_tile) {
 
     // Sanity check
     for (int p = 1; p < (int)m_disparity_maps.size(); p++){
@@ -114,6 +126,13 @@ public:
   /// Compute the 3D coordinate corresponding to a pixel location.
   /// - p is not actually used here, it should always be zero!
   inline result_type operator()( size_t i, size_t j, size_t p=0 ) const {
+    return triangulate_pixel(i, j, true, p);
+  }
+
+  /// Same as operator(). If propagate is false, the errors are not
+  /// propagated to this point, as that is done later on a grid.
+  inline result_type triangulate_pixel(size_t i, size_t j, bool propagate,
+                                       size_t p=0) const {
 
     // For each input image, de-warp the pixel in to the native camera coordinates
     int num_disp = m_disparity_maps.size();
@@ -135,35 +154,13 @@ public:
     Vector3 errorVec;
     pixel_type result;
     if (!m_bathy_correct) {
+      Vector3 point;
       try {
-        subvector(result, 0, 3) = m_stereo_model(pixVec, errorVec);
-        double errLen = norm_2(errorVec);
-        if (!stereo_settings().propagate_errors) {
-          subvector(result, 3, 3) = errorVec;
-        } else {
-          // Store intersection error norm in band 3, horizontal
-          // stddev in band 4, and vertical stddev in band 5 (if band
-          // index starts from 0).
-          result[3] = errLen;
-          auto const& v = asp::stereo_settings().horizontal_stddev; // alias
-          subvector(result, 4, 2)
-            = asp::propagateCovariance(subvector(result, 0, 3),
-                                       m_datum, v[0], v[1],
-                                       m_camera_ptrs[0], m_camera_ptrs[1],
-                                       pixVec[0], pixVec[1]);
-        }
-        
-        // Filter by triangulation error, if desired
-        if (stereo_settings().max_valid_triangulation_error > 0.0 &&
-            errLen > stereo_settings().max_valid_triangulation_error) {
-          result = pixel_type();
-          errorVec = Vector3();
-        }
-      }catch(...) {
+        point = m_stereo_model(pixVec, errorVec);
+      } catch(...) {
         return pixel_type(); // The zero vector, it means that there is no valid data
       }
-      
-      return result; // Contains location and error vector
+      return finish_point(point, errorVec, pixVec, propagate);
     }
 
     // Continue with bathymetry correction. Note how we assume no
@@ -220,9 +217,33 @@ public:
     return result; // Contains location and error vector
   }
   
-  typedef StereoTriangulation prerasterize_type;
+  /// Triangulate the whole tile. The disparities of all cameras are
+  /// brought in memory first. Unless there is bathymetry or least squares
+  /// refinement, each row of the tile is triangulated with one batch call
+  /// per camera.
+  typedef CropView<ImageView<pixel_type>> prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return PreRasterHelper(bbox, m_transforms);
+    ImageView<pixel_type> tile(bbox.width(), bbox.height());
+    StereoTriangulation helper = PreRasterHelper(bbox, m_transforms);
+
+    const int min_strip_rows = 16;
+    int num_strips = std::min(m_threads_per_tile, bbox.height() / min_strip_rows);
+    if (num_strips <= 1) {
+      helper.triangulate_tile(bbox, bbox.min(), tile);
+    } else {
+      int strip_rows = (bbox.height() + num_strips - 1) / num_strips;
+      vw::FifoWorkQueue queue(num_strips);
+      for (int row = bbox.min().y(); row < bbox.max().y(); row += strip_rows) {
+        BBox2i strip(bbox.min().x(), row, bbox.width(),
+                     std::min(strip_rows, bbox.max().y() - row));
+        boost::shared_ptr<TriStripTask>
+          task(new TriStripTask(helper, strip, bbox.min(), tile));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
   }
   template <class DestT>
   inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
@@ -231,6 +252,341 @@ public:
 
 private:
 
+  /// Triangulate a strip of a tile, in its own thread
+  class TriStripTask: public vw::Task, private boost::noncopyable {
+    StereoTriangulation const& m_helper;
+    BBox2i                     m_strip;    // in image coordinates
+    Vector2i                   m_tile_min; // corner of the tile
+    ImageView<pixel_type>    & m_tile;
+  public:
+    TriStripTask(StereoTriangulation const& helper, BBox2i const& strip,
+                 Vector2i const& tile_min, ImageView<pixel_type> & tile):
+      m_helper(helper), m_strip(strip), m_tile_min(tile_min), m_tile(tile) {}
+    virtual void operator()() {
+      m_helper.triangulate_tile(m_strip, m_tile_min, m_tile);
+    }
+  };
+
+  /// Form the output for a triangulated point and its error vector, with
+  /// error propagation and filtering by triangulation error, if desired.
+  /// If propagate is false, the stddev bands are left as zero, to be
+  /// filled in later. If the left and right rays are known, as from batch
+  /// triangulation, they are passed in as ctrs and dirs, and then they
+  /// need not be found again.
+  pixel_type finish_point(Vector3 const& point, Vector3 errorVec,
+                          std::vector<Vector2> const& pixVec,
+                          bool propagate = true,
+                          Vector3 const* ctrs = NULL, Vector3 const* dirs = NULL) const {
+    pixel_type result;
+    try {
+      subvector(result, 0, 3) = point;
+      double errLen = norm_2(errorVec);
+      if (!stereo_settings().propagate_errors) {
+        subvector(result, 3, 3) = errorVec;
+      } else {
+        // Store intersection error norm in band 3, horizontal
+        // stddev in band 4, and vertical stddev in band 5 (if band
+        // index starts from 0).
+        result[3] = errLen;
+        auto const& v = asp::stereo_settings().horizontal_stddev; // alias
+        if (propagate && ctrs != NULL)
+          subvector(result, 4, 2)
+            = asp::propagateCovariance(subvector(result, 0, 3),
+                                       m_datum, v[0], v[1],
+                                       m_camera_ptrs[0], m_camera_ptrs[1],
+                                       pixVec[0], pixVec[1],
+                                       ctrs[0], dirs[0], ctrs[1], dirs[1]);
+        else if (propagate)
+          subvector(result, 4, 2)
+            = asp::propagateCovariance(subvector(result, 0, 3),
+                                       m_datum, v[0], v[1],
+                                       m_camera_ptrs[0], m_camera_ptrs[1],
+                                       pixVec[0], pixVec[1]);
+      }
+
+      // Filter by triangulation error, if desired
+      if (stereo_settings().max_valid_triangulation_error > 0.0 &&
+          errLen > stereo_settings().max_valid_triangulation_error) {
+        result = pixel_type();
+        errorVec = Vector3();
+      }
+    }catch(...) {
+      return pixel_type(); // The zero vector, it means that there is no valid data
+    }
+
+    return result; // Contains location and error vector
+  }
+
+  /// Triangulate the given box, which must be within the region whose
+  /// disparities are in memory. The results go to the tile whose upper-left
+  /// corner is at tile_min. If errors are propagated on a grid, that is
+  /// done once all points in the box are found.
+  void triangulate_tile(BBox2i const& bbox, Vector2i const& tile_min,
+                        ImageView<pixel_type> & tile) const {
+
+    int col0 = bbox.min().x() - tile_min.x(), row0 = bbox.min().y() - tile_min.y();
+    if (m_bathy_correct && m_stereo_model.supports_batch()) {
+      triangulate_bathy_tile(bbox, tile_min, tile);
+      return;
+    }
+
+    // Errors are not propagated with bathymetry, so then this is false
+    bool on_grid = (stereo_settings().propagate_errors &&
+                    stereo_settings().propagate_errors_grid_size > 0);
+    if (m_bathy_correct || !m_stereo_model.supports_batch()) {
+      for (int row = 0; row < bbox.height(); row++)
+        for (int col = 0; col < bbox.width(); col++)
+          tile(col0 + col, row0 + row) = triangulate_pixel(bbox.min().x() + col,
+                                                           bbox.min().y() + row,
+                                                           !on_grid);
+    } else {
+      triangulate_batch_tile(bbox, tile_min, tile, !on_grid);
+    }
+
+    if (on_grid)
+      propagate_on_grid(bbox, tile_min, tile);
+  }
+
+  /// Triangulate the given box a row at a time, with one batch call per
+  /// row. Only the per-row buffers below are allocated. If errors are
+  /// propagated per point, the rays found in the batch call are used for that.
+  void triangulate_batch_tile(BBox2i const& bbox, Vector2i const& tile_min,
+                              ImageView<pixel_type> & tile, bool propagate) const {
+
+    int col0 = bbox.min().x() - tile_min.x(), row0 = bbox.min().y() - tile_min.y();
+
+    // The de-warped pixels in each image for one row. The left pixels for
+    // the rays are NaN where no disparity is valid, so that no rays are
+    // found for them, but the actual left pixels are kept for the rest.
+    int num_disp = m_disparity_maps.size();
+    int width = bbox.width();
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    std::vector<std::vector<Vector2>> ray_pix(num_disp + 1, std::vector<Vector2>(width));
+    std::vector<Vector2 const*> ray_pix_ptrs(num_disp + 1);
+    for (int c = 0; c <= num_disp; c++)
+      ray_pix_ptrs[c] = &ray_pix[c][0];
+    std::vector<Vector2> left_pix(width), pixVec(num_disp + 1);
+    std::vector<Vector3> points(width), errors(width);
+    bool keep_rays = (propagate && stereo_settings().propagate_errors);
+    std::vector<std::vector<Vector3>> ctrs, dirs;
+    Vector3 pt_ctrs[2], pt_dirs[2]; // the left and right rays for one point
+
+    for (int row = 0; row < bbox.height(); row++) {
+      int j = bbox.min().y() + row;
+
+      for (int col = 0; col < width; col++) {
+        int i = bbox.min().x() + col;
+        left_pix[col] = m_transforms[0]->reverse(Vector2(i,j)); // De-warp "left" pixel
+        bool has_disp = false;
+        for (int c = 0; c < num_disp; c++) {
+          DPixelT disp = m_disparity_maps[c](i,j); // Disparity value at this pixel
+          if (is_valid(disp)) { // De-warp the "right" pixel
+            ray_pix[c+1][col] = m_transforms[c+1]->reverse(Vector2(i,j) +
+                                                           stereo::DispHelper(disp));
+            has_disp = true;
+          } else { // Insert flag values
+            ray_pix[c+1][col] = Vector2(nan, nan);
+          }
+        }
+        ray_pix[0][col] = has_disp ? left_pix[col] : Vector2(nan, nan);
+      }
+
+      if (keep_rays)
+        m_stereo_model.triangulate(ray_pix_ptrs, width, &points[0], &errors[0],
+                                   ctrs, dirs);
+      else
+        m_stereo_model.triangulate(ray_pix_ptrs, width, &points[0], &errors[0]);
+
+      for (int col = 0; col < width; col++) {
+        pixVec[0] = left_pix[col];
+        for (int c = 0; c < num_disp; c++)
+          pixVec[c+1] = ray_pix[c+1][col];
+        if (!keep_rays) {
+          tile(col0 + col, row0 + row) = finish_point(points[col], errors[col], pixVec,
+                                                      propagate);
+          continue;
+        }
+        // Errors are propagated only with two cameras
+        for (int c = 0; c < 2; c++) {
+          pt_ctrs[c] = ctrs[c][col];
+          pt_dirs[c] = dirs[c][col];
+        }
+        tile(col0 + col, row0 + row) = finish_point(points[col], errors[col], pixVec,
+                                                    propagate, pt_ctrs, pt_dirs);
+      }
+    }
+  }
+
+  /// Propagate the errors for the point triangulated at the given pixel.
+  /// The disparity for that pixel must be in memory.
+  Vector2 propagate_at(int i, int j, Vector3 const& point) const {
+    DPixelT disp = m_disparity_maps[0](i, j);
+    if (!is_valid(disp))
+      vw_throw(ArgumentErr() << "Missing disparity for error propagation.\n");
+    Vector2 lpix = m_transforms[0]->reverse(Vector2(i, j));
+    Vector2 rpix = m_transforms[1]->reverse(Vector2(i, j) + stereo::DispHelper(disp));
+    auto const& v = asp::stereo_settings().horizontal_stddev; // alias
+    return asp::propagateCovariance(point, m_datum, v[0], v[1],
+                                    m_camera_ptrs[0], m_camera_ptrs[1], lpix, rpix);
+  }
+
+  /// Find the grid nodes along an axis of given length, relative to its
+  /// start. The last node is at the end, so there is no extrapolation.
+  static void grid_nodes(int len, int spacing, std::vector<int> & nodes) {
+    nodes.clear();
+    for (int k = 0; k < len - 1; k += spacing)
+      nodes.push_back(k);
+    nodes.push_back(std::max(len - 1, 0));
+  }
+
+  /// Fill in the stddev bands of the points in the given box, which are
+  /// already in the tile. The errors are propagated only at the nodes of
+  /// a grid, and are interpolated bilinearly in between, as they vary
+  /// slowly across the image. Nodes with no valid point are skipped. A
+  /// point with no valid nodes around it has its errors propagated
+  /// directly. Points for which that fails are removed, as without the grid.
+  void propagate_on_grid(BBox2i const& bbox, Vector2i const& tile_min,
+                         ImageView<pixel_type> & tile) const {
+
+    int col0 = bbox.min().x() - tile_min.x(), row0 = bbox.min().y() - tile_min.y();
+    int spacing = stereo_settings().propagate_errors_grid_size;
+    std::vector<int> node_x, node_y;
+    grid_nodes(bbox.width(), spacing, node_x);
+    grid_nodes(bbox.height(), spacing, node_y);
+    int nx = node_x.size(), ny = node_y.size();
+
+    // The stddev at the nodes
+    std::vector<Vector2> node_stddev(nx * ny);
+    std::vector<char> node_valid(nx * ny, 0);
+    for (int iy = 0; iy < ny; iy++) {
+      for (int ix = 0; ix < nx; ix++) {
+        Vector3 point = subvector(tile(col0 + node_x[ix], row0 + node_y[iy]), 0, 3);
+        if (point == Vector3())
+          continue; // no valid point
+        try {
+          node_stddev[iy * nx + ix] = propagate_at(bbox.min().x() + node_x[ix],
+                                                   bbox.min().y() + node_y[iy], point);
+          node_valid[iy * nx + ix] = 1;
+        } catch (...) {}
+      }
+    }
+
+    for (int row = 0; row < bbox.height(); row++) {
+      int iy0 = std::min(row / spacing, ny - 1), iy1 = std::min(iy0 + 1, ny - 1);
+      double wy = (iy1 == iy0) ? 0.0 :
+        double(row - node_y[iy0]) / (node_y[iy1] - node_y[iy0]);
+
+      for (int col = 0; col < bbox.width(); col++) {
+        pixel_type & result = tile(col0 + col, row0 + row);
+        Vector3 point = subvector(result, 0, 3);
+        if (point == Vector3())
+          continue; // no valid point
+
+        int ix0 = std::min(col / spacing, nx - 1), ix1 = std::min(ix0 + 1, nx - 1);
+        double wx = (ix1 == ix0) ? 0.0 :
+          double(col - node_x[ix0]) / (node_x[ix1] - node_x[ix0]);
+
+        // Use the valid nodes of the cell, with their weights renormalized
+        int ids[4] = {iy0 * nx + ix0, iy0 * nx + ix1, iy1 * nx + ix0, iy1 * nx + ix1};
+        double wts[4] = {(1.0 - wx) * (1.0 - wy), wx * (1.0 - wy),
+                         (1.0 - wx) * wy,         wx * wy};
+        Vector2 sum;
+        double wsum = 0.0;
+        for (int k = 0; k < 4; k++) {
+          if (!node_valid[ids[k]] || wts[k] <= 0.0)
+            continue;
+          sum  += wts[k] * node_stddev[ids[k]];
+          wsum += wts[k];
+        }
+        if (wsum > 0.0) {
+          subvector(result, 4, 2) = sum / wsum;
+          continue;
+        }
+
+        try {
+          subvector(result, 4, 2) = propagate_at(bbox.min().x() + col,
+                                                 bbox.min().y() + row, point);
+        } catch (...) {
+          result = pixel_type(); // no valid data
+        }
+      }
+    }
+  }
+
+  /// Triangulate the given box with bathymetry correction, a row at a time.
+  /// This follows operator(). Pixels that cannot be in the requested cloud,
+  /// judging by the bathy masks, are skipped before finding any rays.
+  void triangulate_bathy_tile(BBox2i const& bbox, Vector2i const& tile_min,
+                              ImageView<pixel_type> & tile) const {
+
+    int col0 = bbox.min().x() - tile_min.x(), row0 = bbox.min().y() - tile_min.y();
+    int width = bbox.width();
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    std::vector<std::vector<Vector2>> ray_pix(2, std::vector<Vector2>(width));
+    std::vector<Vector2 const*> ray_pix_ptrs(2);
+    for (int c = 0; c < 2; c++)
+      ray_pix_ptrs[c] = &ray_pix[c][0];
+    std::vector<std::vector<Vector3>> ctrs, dirs;
+    std::vector<Vector3 const*> ctr_ptrs(2), dir_ptrs(2);
+    std::vector<bool> do_bathy(width), did_bathy;
+    std::vector<Vector3> points(width), errors(width);
+
+    for (int row = 0; row < bbox.height(); row++) {
+      int j = bbox.min().y() + row;
+
+      for (int col = 0; col < width; col++) {
+        int i = bbox.min().x() + col;
+        ray_pix[0][col] = Vector2(nan, nan);
+        ray_pix[1][col] = Vector2(nan, nan);
+        do_bathy[col] = false;
+
+        DPixelT disp = m_disparity_maps[0](i, j);
+        if (!is_valid(disp))
+          continue;
+
+        // Do bathy only when both the left and right matching pixels are
+        // in the aligned bathymetry masks (under water)
+        Vector2 lpix(i, j);
+        Vector2 rpix = lpix + stereo::DispHelper(disp);
+        Vector2 irpix(round(rpix.x()), round(rpix.y())); // integer version
+        bool under_water = (!is_valid(m_left_aligned_bathy_mask(i, j)) &&
+                0 <= irpix.x() && irpix.x() < m_right_aligned_bathy_mask.cols() &&
+                0 <= irpix.y() && irpix.y() < m_right_aligned_bathy_mask.rows() &&
+                !is_valid(m_right_aligned_bathy_mask(irpix.x(), irpix.y())));
+        if ((m_cloud_type == BATHY_CLOUD && !under_water) ||
+            (m_cloud_type == TOPO_CLOUD && under_water))
+          continue;
+
+        do_bathy[col] = under_water;
+        ray_pix[0][col] = m_transforms[0]->reverse(lpix); // De-warp the pixels
+        ray_pix[1][col] = m_transforms[1]->reverse(rpix);
+      }
+
+      m_stereo_model.find_rays(ray_pix_ptrs, width, ctrs, dirs);
+      for (int c = 0; c < 2; c++) {
+        ctr_ptrs[c] = &ctrs[c][0];
+        dir_ptrs[c] = &dirs[c][0];
+      }
+      m_bathy_model.triangulate(ctr_ptrs, dir_ptrs, width, do_bathy,
+                                &points[0], &errors[0], did_bathy);
+
+      for (int col = 0; col < width; col++) {
+        pixel_type result; // zero, so no valid data
+        Vector2 const& lpix = ray_pix[0][col];
+        bool skip = (lpix != lpix || // i.e., NaN
+                     (m_cloud_type == BATHY_CLOUD && !did_bathy[col]) ||
+                     (m_cloud_type == TOPO_CLOUD && did_bathy[col]) ||
+                     (stereo_settings().max_valid_triangulation_error > 0.0 &&
+                      norm_2(errors[col]) > stereo_settings().max_valid_triangulation_error));
+        if (!skip) {
+          subvector(result, 0, 3) = points[col];
+          subvector(result, 3, 3) = errors[col];
+        }
+        tile(col0 + col, row0 + row) = result;
+      }
+    }
+  }
+
   // Find the region associated with the right image that we need to bring in memory
   // based on the disparity 
   BBox2i calc_right_bbox(BBox2i const& left_bbox, ImageView<DPixelT> const& disparity) const {
@@ -243,7 +599,8 @@ private:
   
   /// RPC Map Transform needs to be explicitly copied and told to cache for performance.
   template <class T>
-  prerasterize_type PreRasterHelper(BBox2i const& bbox, std::vector<T> const& transforms) const {
+  StereoTriangulation PreRasterHelper(BBox2i const& bbox,
+                                      std::vector<T> const& transforms) const {
 
     ImageViewRef<PixelMask<float>> in_memory_left_aligned_bathy_mask;
     ImageViewRef<PixelMask<float>> in_memory_right_aligned_bathy_mask;
@@ -280,7 +637,7 @@ private:
         }
       }
 
-      return prerasterize_type(disparity_cropviews, m_camera_ptrs, transforms, m_datum,
+      return StereoTriangulation(disparity_cropviews, m_camera_ptrs, transforms, m_datum,
                                m_stereo_model, m_bathy_model,
                                m_is_map_projected, m_bathy_correct, m_cloud_type,
                                in_memory_left_aligned_bathy_mask,
@@ -344,7 +701,7 @@ private:
       transforms_copy[p+1]->reverse_bbox(right_bbox);
     }
 
-    return prerasterize_type(disparity_cropviews, m_camera_ptrs, transforms_copy, m_datum,
+    return StereoTriangulation(disparity_cropviews, m_camera_ptrs, transforms_copy, m_datum,
                              m_stereo_model, m_bathy_model, m_is_map_projected,
                              m_bathy_correct, m_cloud_type,
                              in_memory_left_aligned_bathy_mask,
@@ -358,18 +715,20 @@ stereo_triangulation(std::vector<DispImageType> const& disparities,
                      std::vector<const vw::camera::CameraModel*> const& camera_ptrs,
                      std::vector<vw::TransformPtr>  const& transforms,
                      vw::cartography::Datum         const& datum,
-                     vw::stereo::StereoModel        const& stereo_model,
+                     asp::BatchStereoModel          const& stereo_model,
                      asp::BathyStereoModel          const& bathy_model,
                      bool is_map_projected,
                      bool bathy_correct,
                      OUTPUT_CLOUD_TYPE cloud_type,
                      ImageViewRef<PixelMask<float>> left_aligned_bathy_mask,
-                     ImageViewRef<PixelMask<float>> right_aligned_bathy_mask) {
+                     ImageViewRef<PixelMask<float>> right_aligned_bathy_mask,
+                     int threads_per_tile = 1) {
   
   typedef StereoTriangulation result_type;
   return result_type(disparities, camera_ptrs, transforms, datum, stereo_model, bathy_model,
                      is_map_projected, bathy_correct, cloud_type,
-                     left_aligned_bathy_mask, right_aligned_bathy_mask);
+                     left_aligned_bathy_mask, right_aligned_bathy_mask,
+                     threads_per_tile);
 }
 
 
@@ -419,7 +778,8 @@ void save_point_cloud(Vector3 const& shift, ImageT const& point_cloud,
        stereo_settings().point_cloud_rounding_error,
        point_cloud,
        has_georef, georef, has_nodata, nodata,
-       opt, TerminalProgressCallback("asp", "\t--> Triangulating: "),
+       asp::intermediate_write_options(opt, true),
+       TerminalProgressCallback("asp", "\t--> Triangulating: "),
        keywords);
   }else{
     // ISIS does not support multi-threading
@@ -428,36 +788,12 @@ void save_point_cloud(Vector3 const& shift, ImageT const& point_cloud,
        stereo_settings().point_cloud_rounding_error,
        point_cloud,
        has_georef, georef, has_nodata, nodata,
-       opt, TerminalProgressCallback("asp", "\t--> Triangulating: "),
+       asp::intermediate_write_options(opt, true),
+       TerminalProgressCallback("asp", "\t--> Triangulating: "),
        keywords);
   }
 }
 
-// TODO(oalexan1): Move this to some low-level utils file  
-Vector3 find_approx_points_median(std::vector<Vector3> const& points){
-
-  // Find the median of the x coordinates of points, then of y, then of
-  // z. Perturb the median a bit to ensure it is never exactly on top
-  // of a real point, as in such a case after subtraction of that
-  // point from median we'd get the zero vector which by convention
-  // is invalid.
-
-  if (points.empty())
-    return Vector3();
-
-  Vector3 median;
-  std::vector<double> V(points.size());
-  for (int i = 0; i < (int)median.size(); i++){
-    for (int p = 0; p < (int)points.size(); p++) V[p] = points[p][i];
-    sort(V.begin(), V.end());
-    median[i] = V[points.size()/2];
-
-    median[i] += median[i]*1e-10*rand()/double(RAND_MAX);
-  }
-
-  return median;
-}
-
 // TODO(oalexan1): Move this to some low-level point cloud utils file
 // Compute the point cloud in a tile around the center of the
 // cloud. Find the median of all the points in that cloud.  That
@@ -520,26 +856,6 @@ Vector3 find_point_cloud_center(Vector2i const& tile_size,
   return find_approx_points_median(points);
 }
 
-// TODO(oalexan1): Move this to some low-level new util file
-bool read_point(std::string const& file, Vector3 & point){
-  point = Vector3();
-  
-  std::ifstream fh(file.c_str());
-  if (!fh.good()) return false;
-  
-  for (int c = 0; c < (int)point.size(); c++)
-    if (! (fh >> point[c]) ) return false;
-
-  return true;
-}
-void write_point(std::string const& file, Vector3 const& point){
-  std::ofstream fh(file.c_str());
-  fh.precision(18); // precision(16) is not enough
-  for (int c = 0; c < (int)point.size(); c++)
-    fh << point[c] << " ";
-  fh << std::endl;
-}
-
 // This is some logic unrelated to triangulation, but there seems to be no
 // good place to put it. Unalign the disparity, and/or create match points
 // from disparity, and/or solve for jitter.
@@ -703,8 +1019,8 @@ void stereo_triangulation(std::string const& output_prefix,
     // the regular stereo model and bathy stereo model can have
     // different interfaces and the former need not know about the
     // latter. Templates are avoided too.
-    vw::stereo::StereoModel stereo_model(camera_ptrs, stereo_settings().use_least_squares,
-                                         angle_tol);
+    asp::BatchStereoModel stereo_model(camera_ptrs, stereo_settings().use_least_squares,
+                                       angle_tol);
     asp::BathyStereoModel bathy_stereo_model(camera_ptrs, stereo_settings().use_least_squares,
                                              angle_tol);
     
@@ -745,13 +1061,31 @@ void stereo_triangulation(std::string const& output_prefix,
     // Used to find the datum for the given planet
     vw::cartography::GeoReference georef = opt_vec[0].session->get_georef();
     
+    // If there are fewer tiles than threads, such as for small parallel_stereo
+    // jobs on machines with many cores, let each tile use several threads.
+    int threads_per_tile = 1;
+    if (opt_vec[0].session->supports_multi_threading()) {
+      int num_threads = opt_vec[0].num_threads;
+      if (num_threads <= 0)
+        num_threads = vw::vw_settings().default_num_threads();
+      int ts = ASPGlobalOptions::tri_tile_size();
+      BBox2i crop_win = stereo_settings().trans_crop_win;
+      int num_tiles = std::max(1, ((crop_win.width()  + ts - 1) / ts) *
+                                  ((crop_win.height() + ts - 1) / ts));
+      threads_per_tile = std::max(1, num_threads / num_tiles);
+      if (threads_per_tile > 1)
+        vw_out() << "\t--> Using " << threads_per_tile
+                 << " threads per triangulation tile.\n";
+    }
+
     // Apply radius function and stereo model in one go
     vw_out() << "\t--> Generating a 3D point cloud." << std::endl;
     ImageViewRef<Vector6> point_cloud = per_pixel_filter
       (stereo_triangulation(disparity_maps, camera_ptrs, transforms, georef.datum(),
                             stereo_model, bathy_stereo_model,
                             is_map_projected, bathy_correct, cloud_type,
-                            left_aligned_bathy_mask, right_aligned_bathy_mask),
+                            left_aligned_bathy_mask, right_aligned_bathy_mask,
+                            threads_per_tile),
          universe_radius_func);
     
     // If we crop the left and right images, at each run we must
@@ -759,11 +1093,17 @@ void stereo_triangulation(std::string const& output_prefix,
     bool crop_left  = (stereo_settings().left_image_crop_win  != BBox2i(0, 0, 0, 0));
     bool crop_right = (stereo_settings().right_image_crop_win != BBox2i(0, 0, 0, 0));
 
-    // Compute the point cloud center, unless done by now
+    // Compute the point cloud center, unless done by now. Usually it is found
+    // from D_sub in stereo_corr. With cropping, a center from an earlier run
+    // is used only if not older than D_sub, which is then made anew.
     Vector3 cloud_center = Vector3();
     if (!stereo_settings().save_double_precision_point_cloud) {
       std::string cloud_center_file = output_prefix + "-PC-center.txt";
-      if (!read_point(cloud_center_file, cloud_center) || crop_left || crop_right){
+      std::string d_sub_file = output_prefix + "-D_sub.tif";
+      bool have_center = read_point(cloud_center_file, cloud_center);
+      if (have_center && (crop_left || crop_right))
+        have_center = asp::is_latest_timestamp(cloud_center_file, d_sub_file);
+      if (!have_center) {
         if (!stereo_settings().skip_point_cloud_center_comp) {
           cloud_center = find_point_cloud_center(opt_vec[0].raster_tile_size, point_cloud);
           vw_out() << "Writing point cloud center: " << cloud_center_file << std::endl;
@@ -800,6 +1140,12 @@ void stereo_triangulation(std::string const& output_prefix,
       save_point_cloud(cloud_center, crop_pc, point_cloud_file, georef, opt_vec[0]);
     } // End if/else
 
+    // Write a memory-mapped copy of the cloud, which later tools can read
+    // without decoding it
+    if (stereo_settings().save_mapped_point_cloud)
+      asp::write_mapped_point_cloud(point_cloud_file, ASPGlobalOptions::tri_tile_size(),
+                                    TerminalProgressCallback("asp", "\t--> Mapped cloud: "));
+
     // Must print this at the end, as it contains statistics on the number of rejected points.
     vw_out() << "\t--> " << universe_radius_func;
 
@@ -812,7 +1158,7 @@ void stereo_triangulation(std::string const& output_prefix,
 
 } // End namespace asp
 
-int main(int argc, char* argv[]) {
+int stereo_tri_main(int argc, char* argv[]) {
 
   if (asp::stereo_settings().correlator_mode) {
     vw_out() << "The triangulation step is skipped with --correlator-mode.\n";
@@ -868,3 +1214,7 @@ int main(int argc, char* argv[]) {
 
   return 0;
 }
+
+int main(int argc, char* argv[]) {
+  return asp::run_batch(argc, argv, stereo_tri_main);
+}
@@ -69,6 +69,11 @@ DEFINE_string(undistorted_crop_win, "",
               "dimensions and optical center will be printed on screen. "
               "Specify as: 'crop_x crop_y'.");
 
+DEFINE_double(distortion_table_spacing, 0.0,
+              "If positive, find the undistortion map exactly only at the nodes of a "
+              "grid with this spacing, in pixels, and interpolate bilinearly in between. "
+              "This is faster, particularly for large images.");
+
 DEFINE_bool(save_bgr, false,
             "Save the undistorted images as BGR instead of grayscale. (Some tools expect BGR.)");
 
@@ -142,7 +147,7 @@ int main(int argc, char ** argv) {
 
   // Create the undistortion map
   cv::Mat floating_remap, fixed_map, interp_map;
-  cam_ptr->GenerateRemapMaps(&floating_remap, FLAGS_scale);
+  cam_ptr->GenerateRemapMaps(&floating_remap, FLAGS_scale, FLAGS_distortion_table_spacing);
 
   // Make adjustments to floating_remap.
   // TODO(oalexan1): This must be a function.
@@ -41,6 +41,9 @@
 #include <xercesc/util/PlatformUtils.hpp>
 #include <boost/dll.hpp>
 
+#include <algorithm>
+#include <cmath>
+
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 using namespace vw;
@@ -538,6 +541,69 @@ void get_offsets(int tdi, bool is_wv01, bool is_forward,
   }
 }
 
+// The value and validity of a pixel, with or without a mask
+inline double pixel_value(float pix) { return pix; }
+inline double pixel_value(PixelMask<float> const& pix) { return pix.child(); }
+inline bool pixel_valid(float) { return true; }
+inline bool pixel_valid(PixelMask<float> const& pix) { return is_valid(pix); }
+inline void make_pixel(double val, bool, float & pix) { pix = val; }
+inline void make_pixel(double val, bool valid, PixelMask<float> & pix) {
+  pix = PixelMask<float>(val);
+  if (!valid)
+    pix.invalidate();
+}
+
+// Fill a tile, with the given box in the image, by shifting each of its
+// columns by its own subpixel amounts. The tile pixel at (col, row) in
+// the image gets the bilinearly interpolated value of the input at
+// (col + sx[c], row + sy[c]), where c is the column index in the tile.
+// The input is the image cropped to in_box, and beyond its edges the
+// nearest pixel is used. This is the same as interpolating the cropped
+// image with BilinearInterpolation and ConstantEdgeExtension, but the
+// input columns and weights are found once per column, and each row of
+// the tile is done in a tight loop. As with masked pixel arithmetic, a
+// result is valid only if all four input pixels are valid.
+template <class PixelT>
+void shift_columns(ImageView<PixelT> const& in, BBox2i const& in_box,
+                   BBox2i const& bbox,
+                   std::vector<double> const& sx, std::vector<double> const& sy,
+                   ImageView<PixelT> & tile) {
+
+  int width = bbox.width(), height = bbox.height();
+  int max_col = in.cols() - 1, max_row = in.rows() - 1;
+
+  // Input columns and weights for each tile column
+  std::vector<int> x0(width), x1(width);
+  std::vector<double> nx(width);
+  for (int c = 0; c < width; c++) {
+    double x = bbox.min().x() + c - in_box.min().x() + sx[c];
+    double fx = std::floor(x);
+    nx[c] = x - fx;
+    x0[c] = std::min(std::max(int(fx),     0), max_col);
+    x1[c] = std::min(std::max(int(fx) + 1, 0), max_col);
+  }
+
+  tile.set_size(width, height);
+  for (int r = 0; r < height; r++) {
+    int row = bbox.min().y() + r - in_box.min().y();
+    for (int c = 0; c < width; c++) {
+      double y = row + sy[c];
+      double fy = std::floor(y), ny = y - fy;
+      int y0 = std::min(std::max(int(fy),     0), max_row);
+      int y1 = std::min(std::max(int(fy) + 1, 0), max_row);
+      PixelT const& v00 = in(x0[c], y0);
+      PixelT const& v01 = in(x0[c], y1);
+      PixelT const& v10 = in(x1[c], y0);
+      PixelT const& v11 = in(x1[c], y1);
+      double val = (pixel_value(v00) * (1.0 - ny) + pixel_value(v01) * ny) * (1.0 - nx[c])
+        + (pixel_value(v10) * (1.0 - ny) + pixel_value(v11) * ny) * nx[c];
+      bool valid = pixel_valid(v00) && pixel_valid(v01) &&
+        pixel_valid(v10) && pixel_valid(v11);
+      make_pixel(val, valid, tile(c, r));
+    }
+  }
+}
+
 // Apply WorldView corrections to each vertical block as high as the image
 // corresponding to one CCD sensor.
 template <class ImageT>
@@ -600,12 +666,8 @@ public:
     biased_box.crop(bounding_box(m_img));
     
     ImageView<result_type> cropped_img = crop(m_img, biased_box);
-    InterpolationView<EdgeExtensionView< ImageView<result_type>,
-      ConstantEdgeExtension >, BilinearInterpolation> interp_img
-      = interpolate(cropped_img, BilinearInterpolation(),
-                    ConstantEdgeExtension());
 
-    ImageView<result_type> tile(bbox.width(), bbox.height());
+    std::vector<double> sx(bbox.width(), 0.0), sy(bbox.width(), 0.0);
     for (int col = bbox.min().x(); col < bbox.max().x(); col++){
 
       // Accumulate the corrections up to the current column
@@ -624,13 +686,12 @@ public:
           }
         }
       }
-      
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++){
-        tile(col - bbox.min().x(), row - bbox.min().y() )
-          = interp_img(col - biased_box.min().x() + valx,
-                       row - biased_box.min().y() + valy);
-      }
+      sx[col - bbox.min().x()] = valx;
+      sy[col - bbox.min().x()] = valy;
     }
+
+    ImageView<result_type> tile;
+    shift_columns(cropped_img, biased_box, bbox, sx, sy, tile);
     
     return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
                              cols(), rows() );
@@ -708,23 +769,17 @@ public:
     biased_box.crop(bounding_box(m_img));
     
     ImageView<result_type> cropped_img = crop(m_img, biased_box);
-    InterpolationView<EdgeExtensionView< ImageView<result_type>,
-      ConstantEdgeExtension >, BilinearInterpolation> interp_img
-      = interpolate(cropped_img, BilinearInterpolation(),
-                    ConstantEdgeExtension());
-
-    
-    ImageView<result_type> tile(bbox.width(), bbox.height());
 
+    // Note that the same correction is used for an entire column
+    std::vector<double> sx(bbox.width()), sy(bbox.width());
     for (int col = bbox.min().x(); col < bbox.max().x(); col++) {
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++) {
-        // Note that the same correction is used for an entire column
-        tile(col - bbox.min().x(), row - bbox.min().y() )
-          = interp_img(col - biased_box.min().x() - m_dx[col],
-                       row - biased_box.min().y() - m_dy[col]);
-      }
+      sx[col - bbox.min().x()] = -m_dx[col];
+      sy[col - bbox.min().x()] = -m_dy[col];
     }
 
+    ImageView<result_type> tile;
+    shift_columns(cropped_img, biased_box, bbox, sx, sy, tile);
+
     return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
                              cols(), rows() );
   }